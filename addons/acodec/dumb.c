@@ -26,6 +26,11 @@
 
 ALLEGRO_DEBUG_CHANNEL("acodec")
 
+/* Modules are rendered 100 ms at a time, as each render call has a
+ * considerable fixed cost.
+ */
+#define RENDER_AHEAD_FRAMES   4410
+
 /* In addition to DUMB 0.9.3 at http://dumb.sourceforge.net/,
  * we support kode54's fork of DUMB at https://github.com/kode54/dumb.
  * The newest version before kode54's fork was DUMB 0.9.3, and the first
@@ -52,6 +57,7 @@ typedef struct MOD_FILE
    ALLEGRO_FILE *fh;
    double length;
    long loop_start, loop_end;
+   _AL_ACODEC_BLOCK block;
 } MOD_FILE;
 
 
@@ -166,7 +172,7 @@ static int loop_callback(void *data)
    return 0;
 }
 
-static size_t modaudio_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
+static size_t modaudio_stream_render(ALLEGRO_AUDIO_STREAM *stream, void *data,
    size_t buf_size)
 {
    MOD_FILE *const df = stream->extra;
@@ -174,7 +180,6 @@ static size_t modaudio_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
    /* the mod files are stereo and 16-bit */
    const int sample_size = 4;
    size_t written = 0;
-   size_t i;
    bool internal_loop = false;
 
    DUMB_IT_SIGRENDERER *it_sig = lib.duh_get_it_sigrenderer(df->sig);
@@ -207,13 +212,18 @@ static size_t modaudio_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
       }
    }
 
-   /* Fill the remainder with silence */
-   for (i = written; i < buf_size; ++i)
-      ((char *)data)[i] = 0;
-
    return written;
 }
 
+static size_t modaudio_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
+   size_t buf_size)
+{
+   MOD_FILE *const df = stream->extra;
+
+   return _al_acodec_read_block(stream, &df->block, data, buf_size,
+      modaudio_stream_render);
+}
+
 static void modaudio_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 {
    MOD_FILE *const df = stream->extra;
@@ -221,6 +231,7 @@ static void modaudio_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 
    lib.duh_end_sigrenderer(df->sig);
    lib.unload_duh(df->duh);
+   _al_acodec_free_block(&df->block);
    if (df->fh)
       al_fclose(df->fh);
 }
@@ -230,6 +241,7 @@ static bool modaudio_stream_rewind(ALLEGRO_AUDIO_STREAM *stream)
    MOD_FILE *const df = stream->extra;
    lib.duh_end_sigrenderer(df->sig);
    df->sig = lib.duh_start_sigrenderer(df->duh, 0, 2, df->loop_start);
+   _al_acodec_reset_block(&df->block);
    return true;
 }
 
@@ -243,6 +255,7 @@ static bool modaudio_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 
    lib.duh_end_sigrenderer(df->sig);
    df->sig = lib.duh_start_sigrenderer(df->duh, 0, 2, time * 65536);
+   _al_acodec_reset_block(&df->block);
 
    return true;
 }
@@ -250,7 +263,8 @@ static bool modaudio_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 static double modaudio_stream_get_position(ALLEGRO_AUDIO_STREAM *stream)
 {
    MOD_FILE *const df = stream->extra;
-   return lib.duh_sigrenderer_get_position(df->sig) / 65536.0;
+   return lib.duh_sigrenderer_get_position(df->sig) / 65536.0
+      - _al_acodec_block_frames_left(&df->block) / 44100.0;
 }
 
 static double modaudio_stream_get_length(ALLEGRO_AUDIO_STREAM *stream)
@@ -330,6 +344,12 @@ static ALLEGRO_AUDIO_STREAM *modaudio_stream_init(ALLEGRO_FILE* f,
 
    if (stream) {
       MOD_FILE *mf = al_malloc(sizeof(MOD_FILE));
+      if (!mf || !_al_acodec_init_block(&mf->block, RENDER_AHEAD_FRAMES, 4)) {
+         ALLEGRO_ERROR("Failed to allocate the render buffer.\n");
+         al_free(mf);
+         al_destroy_audio_stream(stream);
+         goto Error;
+      }
       mf->duh = duh;
       mf->sig = sig;
       mf->fh = NULL;
@@ -552,6 +552,46 @@ ALLEGRO_SAMPLE *_al_load_flac(const char *filename)
    return spl;
 }
 
+/* Decodes a range of the file for _al_acodec_decode_parallel, a frame at a
+ * time through the usual write callback.
+ */
+static bool flac_decode_range(ALLEGRO_FILE *f, uint64_t start,
+   uint64_t frames, void *dst)
+{
+   FLACFILE *ff;
+   int frame_size;
+   uint64_t done = 0;
+   bool ok;
+
+   ff = flac_open(f);
+   if (!ff) {
+      return false;
+   }
+
+   frame_size = ff->channels * ff->sample_size;
+   ok = lib.FLAC__stream_decoder_seek_absolute(ff->decoder, start);
+
+   while (ok && done < frames) {
+      uint64_t count = ff->buffer_pos / frame_size;
+
+      if (count == 0) {
+         ok = lib.FLAC__stream_decoder_process_single(ff->decoder)
+            && ff->buffer_pos > 0;
+         continue;
+      }
+
+      count = _ALLEGRO_MIN(count, frames - done);
+      memcpy((char *)dst + done * frame_size, ff->buffer, count * frame_size);
+      done += count;
+      ff->buffer_pos = 0;
+   }
+
+   al_free(ff->buffer);
+   flac_close(ff);
+
+   return ok;
+}
+
 ALLEGRO_SAMPLE *_al_load_flac_f(ALLEGRO_FILE *f)
 {
    ALLEGRO_SAMPLE *sample;
@@ -565,7 +605,11 @@ ALLEGRO_SAMPLE *_al_load_flac_f(ALLEGRO_FILE *f)
    ff->buffer_size = ff->total_samples * ff->channels * ff->sample_size;
    ff->buffer = al_malloc(ff->buffer_size);
 
-   lib.FLAC__stream_decoder_process_until_end_of_stream(ff->decoder);
+   if (!ff->buffer || ff->total_samples == 0
+         || !_al_acodec_decode_parallel(f, ff->total_samples,
+            ff->channels * ff->sample_size, ff->buffer, flac_decode_range)) {
+      lib.FLAC__stream_decoder_process_until_end_of_stream(ff->decoder);
+   }
 
    sample = al_create_sample(ff->buffer, ff->total_samples, ff->sample_rate,
       _al_word_size_to_depth_conf(ff->sample_size),
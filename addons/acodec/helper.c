@@ -1,3 +1,5 @@
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern.h"
@@ -5,8 +7,61 @@
 #include "allegro5/internal/aintern_system.h"
 #include "helper.h"
 
+ALLEGRO_DEBUG_CHANNEL("acodec")
+
+/* Size of an Ogg page header without its segment table. */
+#define OGG_PAGE_HEADER_SIZE  27
+
+/* Samples decoding to less PCM than this are loaded on one thread. */
+#define PARALLEL_DECODE_MIN_BYTES  (4 << 20)
+
+/* Least PCM worth giving each decoding thread. */
+#define PARALLEL_DECODE_CHUNK_BYTES  (1 << 20)
+
+#define PARALLEL_DECODE_MAX_THREADS  8
+
+typedef struct READ_ONLY_MEMFILE
+{
+   const char *mem;
+   int64_t size;
+   int64_t pos;
+   bool eof;
+} READ_ONLY_MEMFILE;
+
+typedef struct DECODE_JOB
+{
+   const char *mem;
+   int64_t size;
+   uint64_t start;
+   uint64_t frames;
+   void *dst;
+   _al_acodec_range_decoder_t decode;
+   bool ok;
+} DECODE_JOB;
+
+
+static bool want_seek_index(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "build_seek_index");
+   return value && !_al_stricmp(value, "true");
+}
+
+
 void _al_acodec_start_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 {
+   /* Index the stream if asked to, before the feeder starts reading it. */
+   if (stream->index_feeder && want_seek_index())
+      al_build_audio_stream_seek_index(stream);
+
+   /* Without a sound device, the stream is fed as its voice is rendered. */
+   if (_al_kcm_null_feeder_add(stream))
+      return;
+
+   /* Use the shared feeder threads if there are any. */
+   if (_al_kcm_feeder_pool_add(stream))
+      return;
+
    stream->feed_thread = al_create_thread(_al_kcm_feed_stream, stream);
    stream->feed_thread_started_cond = al_create_cond();
    stream->feed_thread_started_mutex = al_create_mutex();
@@ -29,6 +84,16 @@ void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 {
    ALLEGRO_EVENT quit_event;
 
+   if (stream->feed_pooled) {
+      _al_kcm_feeder_pool_remove(stream);
+      return;
+   }
+
+   if (stream->feed_offline) {
+      _al_kcm_null_feeder_remove(stream);
+      return;
+   }
+
    quit_event.type = _KCM_STREAM_FEEDER_QUIT_EVENT_TYPE;
    al_emit_user_event(al_get_audio_stream_event_source(stream), &quit_event, NULL);
    al_join_thread(stream->feed_thread, NULL);
@@ -38,3 +103,435 @@ void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 
    stream->feed_thread = NULL;
 }
+
+
+/* _al_acodec_init_block:
+ *  Allocates a render-ahead block of 'frames' frames.
+ */
+bool _al_acodec_init_block(_AL_ACODEC_BLOCK *block, size_t frames,
+   int frame_size)
+{
+   block->size = frames * frame_size;
+   block->data = al_malloc(block->size);
+   block->frame_size = frame_size;
+   _al_acodec_reset_block(block);
+   return block->data != NULL;
+}
+
+
+void _al_acodec_free_block(_AL_ACODEC_BLOCK *block)
+{
+   al_free(block->data);
+   block->data = NULL;
+}
+
+
+/* _al_acodec_reset_block:
+ *  Drops whatever was rendered ahead, to be called when the decoder's
+ *  position changes.
+ */
+void _al_acodec_reset_block(_AL_ACODEC_BLOCK *block)
+{
+   block->used = 0;
+   block->pos = 0;
+   block->ended = false;
+}
+
+
+/* _al_acodec_block_frames_left:
+ *  Returns how far the decoder is ahead of the stream, in frames.
+ */
+size_t _al_acodec_block_frames_left(const _AL_ACODEC_BLOCK *block)
+{
+   return (block->used - block->pos) / block->frame_size;
+}
+
+
+/* _al_acodec_read_block:
+ *  Fills 'data' from the block, calling 'render' to refill the block as
+ *  needed. 'render' works like a stream feeder: writing less than it was
+ *  asked for means the end of the stream or loop was reached, which is
+ *  passed on once the block has been played out. The rest of 'data' is
+ *  then filled with silence.
+ */
+size_t _al_acodec_read_block(ALLEGRO_AUDIO_STREAM *stream,
+   _AL_ACODEC_BLOCK *block, void *data, size_t buf_size,
+   _al_acodec_render_t render)
+{
+   size_t written = 0;
+
+   while (written < buf_size) {
+      size_t n;
+
+      if (block->pos == block->used) {
+         if (block->ended)
+            break;
+         block->used = render(stream, block->data, block->size);
+         block->pos = 0;
+         block->ended = (block->used < block->size);
+         if (block->used == 0)
+            break;
+      }
+
+      n = _ALLEGRO_MIN(buf_size - written, block->used - block->pos);
+      memcpy((char *)data + written, block->data + block->pos, n);
+      written += n;
+      block->pos += n;
+   }
+
+   memset((char *)data + written, 0, buf_size - written);
+
+   return written;
+}
+
+
+static uint64_t get_le64(const uint8_t *p)
+{
+   uint64_t v = 0;
+   int i;
+
+   for (i = 7; i >= 0; i--)
+      v = (v << 8) | p[i];
+   return v;
+}
+
+
+/* _al_acodec_index_ogg_pages:
+ *  Builds a seek index for the Ogg file 'f' by reading just the page
+ *  headers. An entry is made at the start of a page whenever at least
+ *  'spacing' frames have passed since the last one; its frame is the granule
+ *  position of the page before, less 'granule_bias'. Fails for files with
+ *  more than one logical bitstream. The file position is left unchanged.
+ */
+bool _al_acodec_index_ogg_pages(ALLEGRO_FILE *f, uint64_t granule_bias,
+   uint64_t spacing, _AL_KCM_SEEK_POINT **points, size_t *count)
+{
+   const int64_t saved_pos = al_ftell(f);
+   _AL_KCM_SEEK_POINT *index = NULL;
+   size_t size = 0;
+   size_t capacity = 0;
+   uint64_t granule = 0;
+   uint32_t serial = 0;
+   bool ok = false;
+
+   if (saved_pos < 0 || !al_fseek(f, 0, ALLEGRO_SEEK_SET))
+      return false;
+
+   for (;;) {
+      uint8_t header[OGG_PAGE_HEADER_SIZE];
+      uint8_t lacing[255];
+      const int64_t page_pos = al_ftell(f);
+      size_t got = al_fread(f, header, OGG_PAGE_HEADER_SIZE);
+      uint64_t page_granule;
+      uint32_t page_serial;
+      int body_size = 0;
+      int i;
+
+      if (got == 0 && al_feof(f)) {
+         ok = (size > 0);
+         break;
+      }
+      if (got < OGG_PAGE_HEADER_SIZE || memcmp(header, "OggS", 4) != 0
+            || header[4] != 0) {
+         ALLEGRO_WARN("Bad Ogg page at %ld, not indexing.\n", (long)page_pos);
+         break;
+      }
+
+      page_granule = get_le64(header + 6);
+      page_serial = header[14] | (header[15] << 8) | (header[16] << 16)
+         | ((uint32_t)header[17] << 24);
+      if (page_pos == 0)
+         serial = page_serial;
+      else if (page_serial != serial) {
+         ALLEGRO_DEBUG("Multiple Ogg bitstreams, not indexing.\n");
+         break;
+      }
+
+      /* Pages continuing a packet from the page before are no good to
+       * start decoding at.
+       */
+      if (!(header[5] & 1) && (size == 0
+            || granule >= index[size-1].frame + granule_bias + spacing)) {
+         if (size == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 256;
+            _AL_KCM_SEEK_POINT *new_index = al_realloc(index,
+               new_capacity * sizeof(*index));
+            if (!new_index)
+               break;
+            index = new_index;
+            capacity = new_capacity;
+         }
+         index[size].frame = (granule > granule_bias) ?
+            granule - granule_bias : 0;
+         index[size].offset = page_pos;
+         size++;
+      }
+
+      /* A granule position of -1 means no packet ends on this page. */
+      if (page_granule != (uint64_t)-1)
+         granule = page_granule;
+
+      if (al_fread(f, lacing, header[26]) < header[26])
+         break;
+      for (i = 0; i < header[26]; i++)
+         body_size += lacing[i];
+      if (!al_fseek(f, body_size, ALLEGRO_SEEK_CUR))
+         break;
+   }
+
+   al_fseek(f, saved_pos, ALLEGRO_SEEK_SET);
+
+   if (!ok) {
+      al_free(index);
+      return false;
+   }
+
+   *points = index;
+   *count = size;
+   return true;
+}
+
+
+static bool romem_fclose(ALLEGRO_FILE *f)
+{
+   al_free(al_get_file_userdata(f));
+   return true;
+}
+
+
+static size_t romem_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   READ_ONLY_MEMFILE *mf = al_get_file_userdata(f);
+   size_t n = size;
+
+   if (mf->size - mf->pos < (int64_t)size) {
+      n = mf->size - mf->pos;
+      mf->eof = true;
+   }
+   memcpy(ptr, mf->mem + mf->pos, n);
+   mf->pos += n;
+   return n;
+}
+
+
+static size_t romem_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   (void)f;
+   (void)ptr;
+   (void)size;
+   return 0;
+}
+
+
+static bool romem_fflush(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return true;
+}
+
+
+static int64_t romem_ftell(ALLEGRO_FILE *f)
+{
+   READ_ONLY_MEMFILE *mf = al_get_file_userdata(f);
+   return mf->pos;
+}
+
+
+static bool romem_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   READ_ONLY_MEMFILE *mf = al_get_file_userdata(f);
+   int64_t pos = offset;
+
+   if (whence == ALLEGRO_SEEK_CUR)
+      pos += mf->pos;
+   else if (whence == ALLEGRO_SEEK_END)
+      pos += mf->size;
+
+   mf->pos = _ALLEGRO_CLAMP(0, pos, mf->size);
+   mf->eof = false;
+   return true;
+}
+
+
+static bool romem_feof(ALLEGRO_FILE *f)
+{
+   READ_ONLY_MEMFILE *mf = al_get_file_userdata(f);
+   return mf->eof;
+}
+
+
+static int romem_ferror(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return 0;
+}
+
+
+static const char *romem_ferrmsg(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return "";
+}
+
+
+static void romem_fclearerr(ALLEGRO_FILE *f)
+{
+   READ_ONLY_MEMFILE *mf = al_get_file_userdata(f);
+   mf->eof = false;
+}
+
+
+static off_t romem_fsize(ALLEGRO_FILE *f)
+{
+   READ_ONLY_MEMFILE *mf = al_get_file_userdata(f);
+   return mf->size;
+}
+
+
+/* The memfile addon isn't linked to acodec, and all a decoding thread needs
+ * is its own read position in the shared copy of the file.
+ */
+static const ALLEGRO_FILE_INTERFACE romem_vtable = {
+   NULL,    /* open */
+   romem_fclose,
+   romem_fread,
+   romem_fwrite,
+   romem_fflush,
+   romem_ftell,
+   romem_fseek,
+   romem_feof,
+   romem_ferror,
+   romem_ferrmsg,
+   romem_fclearerr,
+   NULL,    /* ungetc */
+   romem_fsize
+};
+
+
+static void *decode_job(ALLEGRO_THREAD *thread, void *arg)
+{
+   DECODE_JOB *job = arg;
+   READ_ONLY_MEMFILE *mf;
+   ALLEGRO_FILE *f;
+   (void)thread;
+
+   job->ok = false;
+
+   mf = al_calloc(1, sizeof(*mf));
+   if (!mf)
+      return NULL;
+   mf->mem = job->mem;
+   mf->size = job->size;
+
+   f = al_create_file_handle(&romem_vtable, mf);
+   if (!f) {
+      al_free(mf);
+      return NULL;
+   }
+
+   job->ok = job->decode(f, job->start, job->frames, job->dst);
+   al_fclose(f);
+   return NULL;
+}
+
+
+static int decode_thread_count(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "sample_decode_threads");
+   int count;
+
+   if (value && value[0] != '\0')
+      count = atoi(value);
+   else
+      count = al_get_cpu_count();
+
+   return _ALLEGRO_MIN(count, PARALLEL_DECODE_MAX_THREADS);
+}
+
+
+/* _al_acodec_decode_parallel:
+ *  Decodes the 'total_frames' frames of the file 'f' into 'dst' by splitting
+ *  them into ranges, each decoded on its own thread from a copy of the file
+ *  held in memory. Returns false without having decoded anything useful if
+ *  the sample is too short to be worth it, only one thread is to be used, or
+ *  anything fails; the caller should then decode the file itself. The file
+ *  position is left unchanged.
+ */
+bool _al_acodec_decode_parallel(ALLEGRO_FILE *f, uint64_t total_frames,
+   int frame_size, void *dst, _al_acodec_range_decoder_t decode)
+{
+   const uint64_t total_bytes = total_frames * frame_size;
+   DECODE_JOB jobs[PARALLEL_DECODE_MAX_THREADS];
+   ALLEGRO_THREAD *threads[PARALLEL_DECODE_MAX_THREADS];
+   int64_t saved_pos;
+   int64_t size;
+   char *mem;
+   int count;
+   int i;
+   bool ok;
+
+   if (total_bytes < PARALLEL_DECODE_MIN_BYTES)
+      return false;
+
+   count = _ALLEGRO_MIN((uint64_t)decode_thread_count(),
+      total_bytes / PARALLEL_DECODE_CHUNK_BYTES);
+   if (count < 2)
+      return false;
+
+   saved_pos = al_ftell(f);
+   size = al_fsize(f);
+   if (saved_pos < 0 || size <= 0 || (uint64_t)size > SIZE_MAX)
+      return false;
+
+   mem = al_malloc(size);
+   if (!mem)
+      return false;
+
+   ok = al_fseek(f, 0, ALLEGRO_SEEK_SET)
+      && al_fread(f, mem, size) == (size_t)size;
+   al_fseek(f, saved_pos, ALLEGRO_SEEK_SET);
+   if (!ok) {
+      al_free(mem);
+      return false;
+   }
+
+   ALLEGRO_DEBUG("Decoding %lu frames on %d threads.\n",
+      (unsigned long)total_frames, count);
+
+   for (i = 0; i < count; i++) {
+      jobs[i].mem = mem;
+      jobs[i].size = size;
+      jobs[i].start = total_frames * i / count;
+      jobs[i].frames = total_frames * (i + 1) / count - jobs[i].start;
+      jobs[i].dst = (char *)dst + jobs[i].start * frame_size;
+      jobs[i].decode = decode;
+      jobs[i].ok = false;
+   }
+
+   /* The first range is decoded on this thread while the others run. */
+   for (i = 1; i < count; i++) {
+      threads[i] = al_create_thread(decode_job, &jobs[i]);
+      if (threads[i]) {
+         al_set_thread_name(threads[i], "al-decode");
+         al_start_thread(threads[i]);
+      }
+   }
+   decode_job(NULL, &jobs[0]);
+
+   ok = jobs[0].ok;
+   for (i = 1; i < count; i++) {
+      if (threads[i]) {
+         al_join_thread(threads[i], NULL);
+         al_destroy_thread(threads[i]);
+      }
+      ok = ok && threads[i] && jobs[i].ok;
+   }
+
+   al_free(mem);
+
+   if (!ok)
+      ALLEGRO_WARN("Parallel decoding failed, decoding on one thread.\n");
+
+   return ok;
+}
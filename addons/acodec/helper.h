@@ -3,5 +3,39 @@
 
 void _al_acodec_start_feed_thread(ALLEGRO_AUDIO_STREAM *stream);
 void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream);
+/* Audio rendered ahead of a stream in blocks bigger than its fragments, for
+ * decoders with a high cost per call.
+ */
+typedef struct _AL_ACODEC_BLOCK
+{
+   char *data;
+   size_t size;
+   size_t used;
+   size_t pos;
+   int frame_size;
+   bool ended;
+} _AL_ACODEC_BLOCK;
+
+typedef size_t (*_al_acodec_render_t)(ALLEGRO_AUDIO_STREAM *, void *, size_t);
+
+bool _al_acodec_init_block(_AL_ACODEC_BLOCK *block, size_t frames,
+   int frame_size);
+void _al_acodec_free_block(_AL_ACODEC_BLOCK *block);
+void _al_acodec_reset_block(_AL_ACODEC_BLOCK *block);
+size_t _al_acodec_block_frames_left(const _AL_ACODEC_BLOCK *block);
+size_t _al_acodec_read_block(ALLEGRO_AUDIO_STREAM *stream,
+   _AL_ACODEC_BLOCK *block, void *data, size_t buf_size,
+   _al_acodec_render_t render);
+bool _al_acodec_index_ogg_pages(ALLEGRO_FILE *f, uint64_t granule_bias,
+   uint64_t spacing, _AL_KCM_SEEK_POINT **points, size_t *count);
+
+/* Decodes 'frames' frames starting at frame 'start' of the file 'f' into
+ * 'dst', returning false unless all of them were decoded.
+ */
+typedef bool (*_al_acodec_range_decoder_t)(ALLEGRO_FILE *f, uint64_t start,
+   uint64_t frames, void *dst);
+
+bool _al_acodec_decode_parallel(ALLEGRO_FILE *f, uint64_t total_frames,
+   int frame_size, void *dst, _al_acodec_range_decoder_t decode);
 
 #endif
@@ -28,6 +28,11 @@ ALLEGRO_DEBUG_CHANNEL("acodec")
    #include <vorbis/vorbisfile.h>
 #endif
 
+/* Frames decoded before the seek target when seeking with the seek index,
+ * enough to cover the overlap with the previous block.
+ */
+#define SEEK_PREROLL   4096
+
 typedef struct AL_OV_DATA AL_OV_DATA;
 
 struct AL_OV_DATA {
@@ -35,6 +40,7 @@ struct AL_OV_DATA {
    vorbis_info *vi;
    ALLEGRO_FILE *file;
    int bitstream;
+   int word_size;
    double loop_start;
    double loop_end;
 };
@@ -56,12 +62,19 @@ static struct
    double (*ov_time_total)(OggVorbis_File *, int);
    int (*ov_time_seek)(OggVorbis_File *, double);
    double (*ov_time_tell)(OggVorbis_File *);
+   int (*ov_raw_seek)(OggVorbis_File *, ogg_int64_t);
+   int (*ov_pcm_seek)(OggVorbis_File *, ogg_int64_t);
+   ogg_int64_t (*ov_pcm_tell)(OggVorbis_File *);
    long (*ov_read)(OggVorbis_File *, char *, int, int, int, int, int *);
+   long (*ov_read_float)(OggVorbis_File *, float ***, int, int *);
 #else
    int (*ov_open_callbacks)(void *, OggVorbis_File *, const char *, long, ov_callbacks);
    ogg_int64_t (*ov_time_total)(OggVorbis_File *, int);
    int (*ov_time_seek)(OggVorbis_File *, ogg_int64_t);
    ogg_int64_t (*ov_time_tell)(OggVorbis_File *);
+   int (*ov_raw_seek)(OggVorbis_File *, ogg_int64_t);
+   int (*ov_pcm_seek)(OggVorbis_File *, ogg_int64_t);
+   ogg_int64_t (*ov_pcm_tell)(OggVorbis_File *);
    long (*ov_read)(OggVorbis_File *, char *, int, int *);
 #endif
 } lib;
@@ -122,7 +135,13 @@ static bool init_dynlib(void)
    INITSYM(ov_time_total);
    INITSYM(ov_time_seek);
    INITSYM(ov_time_tell);
+   INITSYM(ov_raw_seek);
+   INITSYM(ov_pcm_seek);
+   INITSYM(ov_pcm_tell);
    INITSYM(ov_read);
+#ifndef TREMOR
+   INITSYM(ov_read_float);
+#endif
 
    return true;
 
@@ -188,6 +207,57 @@ static ov_callbacks callbacks = {
 };
 
 
+/* Decodes a range of the file for _al_acodec_decode_parallel, in the
+ * format _al_load_ogg_vorbis_f uses.
+ */
+static bool ogg_decode_range(ALLEGRO_FILE *file, uint64_t start,
+   uint64_t frames, void *dst)
+{
+#ifdef ALLEGRO_LITTLE_ENDIAN
+   const int endian = 0; /* 0 for Little-Endian, 1 for Big-Endian */
+#else
+   const int endian = 1; /* 0 for Little-Endian, 1 for Big-Endian */
+#endif
+   const int word_size = 2;
+   const int packet_size = 4096;
+   OggVorbis_File vf;
+   AL_OV_DATA ov;
+   char *buffer = dst;
+   int bitstream = -1;
+   uint64_t pos = 0;
+   uint64_t size;
+
+   ov.file = file;
+   if (lib.ov_open_callbacks(&ov, &vf, NULL, 0, callbacks) < 0) {
+      return false;
+   }
+
+   size = frames * lib.ov_info(&vf, -1)->channels * word_size;
+
+   if (lib.ov_pcm_seek(&vf, start) == 0) {
+      while (pos < size) {
+         const int read_size = _ALLEGRO_MIN((uint64_t)packet_size, size - pos);
+         long read;
+
+#ifndef TREMOR
+         read = lib.ov_read(&vf, buffer + pos, read_size, endian, word_size,
+            1, &bitstream);
+#else
+         (void)endian;
+         read = lib.ov_read(&vf, buffer + pos, read_size, &bitstream);
+#endif
+         if (read <= 0)
+            break;
+         pos += read;
+      }
+   }
+
+   lib.ov_clear(&vf);
+
+   return pos == size;
+}
+
+
 ALLEGRO_SAMPLE *_al_load_ogg_vorbis(const char *filename)
 {
    ALLEGRO_FILE *f;
@@ -266,6 +336,10 @@ ALLEGRO_SAMPLE *_al_load_ogg_vorbis_f(ALLEGRO_FILE *file)
    }
 
    pos = 0;
+   if (total_samples > 0 && _al_acodec_decode_parallel(file, total_samples,
+         channels * word_size, buffer, ogg_decode_range)) {
+      pos = total_size;
+   }
    while (pos < total_size) {
       const int read_size = _ALLEGRO_MIN(packet_size, total_size - pos);
       ASSERT(pos + read_size <= total_size);
@@ -299,11 +373,88 @@ ALLEGRO_SAMPLE *_al_load_ogg_vorbis_f(ALLEGRO_FILE *file)
 }
 
 
+/* Decodes up to 'size' bytes of whole frames into 'dst' in the stream's
+ * sample format. Returns the number of bytes written, 0 at the end of the
+ * stream or a negative number on errors.
+ */
+static long stream_read(AL_OV_DATA *extra, char *dst, int size)
+{
+#ifndef TREMOR
+#ifdef ALLEGRO_LITTLE_ENDIAN
+   const int endian = 0;      /* 0 for Little-Endian, 1 for Big-Endian */
+#else
+   const int endian = 1;      /* 0 for Little-Endian, 1 for Big-Endian */
+#endif
+
+   if (extra->word_size == 4) {
+      /* Interleave the decoder's own float output, rather than having
+       * ov_read convert it to int16 for the mixer to convert back.
+       */
+      const int channels = extra->vi->channels;
+      float *out = (float *)dst;
+      float **pcm;
+      long frames;
+      long i;
+      int c;
+
+      frames = lib.ov_read_float(extra->vf, &pcm, size / (4 * channels),
+         &extra->bitstream);
+      if (frames <= 0)
+         return frames;
+      for (i = 0; i < frames; i++) {
+         for (c = 0; c < channels; c++)
+            *out++ = pcm[c][i];
+      }
+      return frames * 4 * channels;
+   }
+
+   return lib.ov_read(extra->vf, dst, size, endian, 2, 1, &extra->bitstream);
+#else
+   return lib.ov_read(extra->vf, dst, size, &extra->bitstream);
+#endif
+}
+
+
+/* Jumps to the seek index entry before 'frame' and decodes up to it, which
+ * is much cheaper than ov_time_seek's bisection on slow files.
+ */
+static bool seek_with_index(ALLEGRO_AUDIO_STREAM *stream, ogg_int64_t frame)
+{
+   AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
+   const int frame_size = extra->word_size * extra->vi->channels;
+   const _AL_KCM_SEEK_POINT *point;
+   char buf[4096];
+   ogg_int64_t pos;
+
+   point = _al_kcm_find_seek_point(stream,
+      frame > SEEK_PREROLL ? frame - SEEK_PREROLL : 0);
+   if (!point)
+      return false;
+   if (lib.ov_raw_seek(extra->vf, point->offset) != 0)
+      return false;
+
+   pos = lib.ov_pcm_tell(extra->vf);
+   if (pos < 0 || pos > frame)
+      return false;
+   while (pos < frame) {
+      int want = (int)_ALLEGRO_MIN(frame - pos, (ogg_int64_t)(sizeof(buf) / frame_size));
+      long read = stream_read(extra, buf, want * frame_size);
+      if (read <= 0)
+         return false;
+      pos += read / frame_size;
+   }
+
+   return true;
+}
+
+
 static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
    if (time >= extra->loop_end)
       return false;
+   if (stream->seek_index && seek_with_index(stream, time * extra->vi->rate))
+      return true;
 #ifndef TREMOR
    return (lib.ov_time_seek(extra->vf, time) != -1);
 #else
@@ -342,6 +493,16 @@ static double ogg_stream_get_length(ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
+static bool ogg_stream_index(ALLEGRO_AUDIO_STREAM *stream,
+   _AL_KCM_SEEK_POINT **points, size_t *count)
+{
+   AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
+
+   return _al_acodec_index_ogg_pages(extra->file, 0, extra->vi->rate,
+      points, count);
+}
+
+
 static bool ogg_stream_set_loop(ALLEGRO_AUDIO_STREAM *stream, double start, double end)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
@@ -373,14 +534,7 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
                                 size_t buf_size)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
-	
-#ifdef ALLEGRO_LITTLE_ENDIAN
-   const int endian = 0;      /* 0 for Little-Endian, 1 for Big-Endian */
-#else
-   const int endian = 1;      /* 0 for Little-Endian, 1 for Big-Endian */
-#endif
-   const int word_size = 2;   /* 1 = 8bit, 2 = 16-bit. nothing else */
-   const int signedness = 1;  /* 0 for unsigned, 1 for signed */
+   const int word_size = extra->word_size;
 
    unsigned long pos = 0;
    int read_length = buf_size;
@@ -391,7 +545,7 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
 #endif
    double rate = extra->vi->rate;
    double btime = ((double)buf_size / ((double)word_size * (double)extra->vi->channels)) / rate;
-   unsigned long read;
+   long read;
    
    if (stream->spl.loop != _ALLEGRO_PLAYMODE_STREAM_ONCE && ctime + btime > extra->loop_end) {
       const int frame_size = word_size * extra->vi->channels;
@@ -403,21 +557,13 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
       }
    }
    while (pos < (unsigned long)read_length) {
-#ifndef TREMOR
-      read = lib.ov_read(extra->vf, (char *)data + pos,
-         read_length - pos, endian, word_size, signedness, &extra->bitstream);
-#else
-      (void)endian;
-      (void)signedness;
-      read = lib.ov_read(extra->vf, (char *)data + pos,
-         read_length - pos, &extra->bitstream);
-#endif
-      pos += read;
+      read = stream_read(extra, (char *)data + pos, read_length - pos);
 	   
-      if (read == 0) {
+      if (read <= 0) {
          /* Return the number of useful bytes written. */
          return pos;
       }
+      pos += read;
    }
 
    return pos;
@@ -450,7 +596,14 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream(const char *filename,
 ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
    size_t buffer_count, unsigned int samples)
 {
-   const int word_size = 2; /* 1 = 8bit, 2 = 16-bit. nothing else */
+   /* Vorbis decodes to float, which the stream takes as it is. Tremor only
+    * decodes to 16-bit.
+    */
+#ifndef TREMOR
+   const int word_size = 4;
+#else
+   const int word_size = 2;
+#endif
    OggVorbis_File* vf;
    vorbis_info* vi;
    int channels;
@@ -489,6 +642,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
    extra->vi = vi;
 
    extra->bitstream = -1;
+   extra->word_size = word_size;
 
    ALLEGRO_DEBUG("channels %d\n", channels);
    ALLEGRO_DEBUG("word_size %d\n", word_size);
@@ -517,6 +671,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
    stream->get_feeder_position = ogg_stream_get_position;
    stream->get_feeder_length = ogg_stream_get_length;
    stream->set_feeder_loop = ogg_stream_set_loop;
+   stream->index_feeder = ogg_stream_index;
    stream->unload_feeder = ogg_stream_close;
    _al_acodec_start_feed_thread(stream);
 	
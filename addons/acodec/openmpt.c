@@ -24,6 +24,11 @@
 
 ALLEGRO_DEBUG_CHANNEL("acodec")
 
+/* Modules are rendered 100 ms at a time, as each render call has a
+ * considerable fixed cost.
+ */
+#define RENDER_AHEAD_FRAMES   4410
+
 
 typedef struct MOD_FILE
 {
@@ -31,6 +36,7 @@ typedef struct MOD_FILE
    ALLEGRO_FILE *fh;
    double length;
    double loop_start, loop_end;
+   _AL_ACODEC_BLOCK block;
 } MOD_FILE;
 
 
@@ -89,7 +95,7 @@ static int error_func(int error, void *user)
 }
 
 // /* Stream Functions */
-static size_t openmpt_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
+static size_t openmpt_stream_render(ALLEGRO_AUDIO_STREAM *stream, void *data,
    size_t buf_size)
 {
    MOD_FILE *const modf = stream->extra;
@@ -97,7 +103,6 @@ static size_t openmpt_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
    /* the mod files are stereo and 16-bit */
    const int frame_size = 4;
    size_t written = 0;
-   size_t i;
 
    if (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONCE) {
      openmpt_module_ctl_set_text(modf->mod, "play.at_end", "stop");
@@ -109,13 +114,13 @@ static size_t openmpt_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
 
    int count = 0;
    while (written < buf_size) {
-      long frames_to_read = (buf_size - written * frame_size) / frame_size;
+      long frames_to_read = (buf_size - written) / frame_size;
       double position = openmpt_module_get_position_seconds(modf->mod);
       bool manual_loop = false;
       /* If manual looping is not enabled, then we need to implement
        * short-stopping manually. */
       if (stream->spl.loop != _ALLEGRO_PLAYMODE_STREAM_ONCE && modf->loop_end != -1 &&
-          position + frames_to_read / 44100 >= modf->loop_end) {
+          position + frames_to_read / 44100.0 >= modf->loop_end) {
          frames_to_read = (long)((modf->loop_end - position) * 44100);
          if (frames_to_read < 0)
             frames_to_read = 0;
@@ -129,19 +134,26 @@ static size_t openmpt_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
       count += 1;
    }
 
-   /* Fill the remainder with silence */
-   for (i = written; i < buf_size; ++i)
-      ((char *)data)[i] = 0;
-
    return written;
 }
 
+
+static size_t openmpt_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
+   size_t buf_size)
+{
+   MOD_FILE *const modf = stream->extra;
+
+   return _al_acodec_read_block(stream, &modf->block, data, buf_size,
+      openmpt_stream_render);
+}
+
 static void openmpt_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 {
    MOD_FILE *const modf = stream->extra;
    _al_acodec_stop_feed_thread(stream);
 
    openmpt_module_destroy(modf->mod);
+   _al_acodec_free_block(&modf->block);
 
    if (modf->fh)
       al_fclose(modf->fh);
@@ -151,6 +163,7 @@ static bool openmpt_stream_rewind(ALLEGRO_AUDIO_STREAM *stream)
 {
    MOD_FILE *const modf = stream->extra;
    openmpt_module_set_position_seconds(modf->mod, modf->loop_start);
+   _al_acodec_reset_block(&modf->block);
    return true;
 }
 
@@ -164,6 +177,7 @@ static bool openmpt_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
    }
 
    openmpt_module_set_position_seconds(modf->mod, time);
+   _al_acodec_reset_block(&modf->block);
 
    return false;
 }
@@ -172,7 +186,8 @@ static bool openmpt_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 static double openmpt_stream_get_position(ALLEGRO_AUDIO_STREAM *stream)
 {
    MOD_FILE *const modf = stream->extra;
-   return openmpt_module_get_position_seconds(modf->mod);
+   return openmpt_module_get_position_seconds(modf->mod)
+      - _al_acodec_block_frames_left(&modf->block) / 44100.0;
 }
 
 
@@ -233,6 +248,12 @@ static ALLEGRO_AUDIO_STREAM *openmpt_stream_init(ALLEGRO_FILE* f,
 
    if (stream) {
       MOD_FILE *mf = al_malloc(sizeof(MOD_FILE));
+      if (!mf || !_al_acodec_init_block(&mf->block, RENDER_AHEAD_FRAMES, 4)) {
+         ALLEGRO_ERROR("Failed to allocate the render buffer.\n");
+         al_free(mf);
+         al_destroy_audio_stream(stream);
+         goto Error;
+      }
       mf->mod = mod;
       mf->fh = NULL;
       mf->length = openmpt_module_get_duration_seconds(mod);
@@ -22,6 +22,11 @@ ALLEGRO_DEBUG_CHANNEL("acodec")
 
 #include <opus/opusfile.h>
 
+/* Frames decoded before the seek target when seeking with the seek index,
+ * as the decoder needs 80 ms to converge after a jump.
+ */
+#define SEEK_PREROLL   3840
+
 typedef struct AL_OP_DATA AL_OP_DATA;
 
 struct AL_OP_DATA {
@@ -47,7 +52,10 @@ static struct
    ogg_int64_t (*op_pcm_total)(const OggOpusFile *_of, int _li);
    int (*op_pcm_seek)(OggOpusFile *_of, ogg_int64_t _pcm_offset);
    ogg_int64_t (*op_pcm_tell)(const OggOpusFile *_of);
+   int (*op_raw_seek)(OggOpusFile *_of, opus_int64 _byte_offset);
+   const OpusHead *(*op_head)(const OggOpusFile *_of, int _li);
    int (*op_read)(OggOpusFile *_of, opus_int16 *_pcm, int _buf_size, int *_li);
+   int (*op_read_float)(OggOpusFile *_of, float *_pcm, int _buf_size, int *_li);
 } lib;
 
 
@@ -105,7 +113,10 @@ static bool init_dynlib(void)
    INITSYM(op_pcm_total);
    INITSYM(op_pcm_seek);
    INITSYM(op_pcm_tell);
+   INITSYM(op_raw_seek);
+   INITSYM(op_head);
    INITSYM(op_read);
+   INITSYM(op_read_float);
 
    return true;
 
@@ -192,6 +203,47 @@ ALLEGRO_SAMPLE *_al_load_ogg_opus(const char *filename)
 }
 
 
+/* Decodes a range of the file for _al_acodec_decode_parallel, in the
+ * format _al_load_ogg_opus_f uses. op_pcm_seek pre-rolls the decoder, but
+ * Opus output only converges after a seek, so the first few milliseconds of
+ * each range can differ slightly from a sequential decode.
+ */
+static bool opus_decode_range(ALLEGRO_FILE *file, uint64_t start,
+   uint64_t frames, void *dst)
+{
+   const int packet_size = 5760;
+   OggOpusFile *of;
+   AL_OP_DATA op;
+   opus_int16 *buffer = dst;
+   int channels;
+   uint64_t pos = 0;
+
+   op.file = file;
+   of = lib.op_open_callbacks(&op, &callbacks, NULL, 0, NULL);
+   if (!of) {
+      return false;
+   }
+
+   channels = lib.op_channel_count(of, -1);
+
+   if (lib.op_pcm_seek(of, start) == 0) {
+      while (pos < frames) {
+         const int read_size = _ALLEGRO_MIN((uint64_t)packet_size, frames - pos);
+         long read = lib.op_read(of, buffer + pos * channels,
+            read_size * channels, NULL);
+
+         if (read <= 0)
+            break;
+         pos += read;
+      }
+   }
+
+   lib.op_free(of);
+
+   return pos == frames;
+}
+
+
 ALLEGRO_SAMPLE *_al_load_ogg_opus_f(ALLEGRO_FILE *file)
 {
    /* Note: decoding library can return 16-bit or floating-point output,
@@ -241,6 +293,10 @@ ALLEGRO_SAMPLE *_al_load_ogg_opus_f(ALLEGRO_FILE *file)
    }
 
    pos = 0;
+   if (total_samples > 0 && _al_acodec_decode_parallel(file, total_samples,
+         channels * word_size, buffer, opus_decode_range)) {
+      pos = total_samples;
+   }
    while (pos < total_samples) {
       const int read_size = _ALLEGRO_MIN(packet_size, total_samples - pos);
       ASSERT(pos + read_size <= total_samples);
@@ -267,12 +323,48 @@ ALLEGRO_SAMPLE *_al_load_ogg_opus_f(ALLEGRO_FILE *file)
 }
 
 
+/* Jumps to the seek index entry before 'frame' and decodes up to it, which
+ * is much cheaper than op_pcm_seek's bisection on slow files.
+ */
+static bool seek_with_index(ALLEGRO_AUDIO_STREAM *stream, ogg_int64_t frame)
+{
+   AL_OP_DATA *extra = (AL_OP_DATA *) stream->extra;
+   const _AL_KCM_SEEK_POINT *point;
+   float buf[2048];
+   ogg_int64_t pos;
+
+   point = _al_kcm_find_seek_point(stream,
+      frame > SEEK_PREROLL ? frame - SEEK_PREROLL : 0);
+   if (!point)
+      return false;
+   if (lib.op_raw_seek(extra->of, point->offset) != 0)
+      return false;
+
+   pos = lib.op_pcm_tell(extra->of);
+   if (pos < 0 || pos > frame)
+      return false;
+   while (pos < frame) {
+      int want = (int)_ALLEGRO_MIN(frame - pos,
+         (ogg_int64_t)(2048 / extra->channels));
+      int read = lib.op_read_float(extra->of, buf, want * extra->channels,
+         NULL);
+      if (read <= 0)
+         return false;
+      pos += read;
+   }
+
+   return true;
+}
+
+
 static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 {
    AL_OP_DATA *extra = (AL_OP_DATA *) stream->extra;
 
    if (time >= extra->loop_end)
       return false;
+   if (stream->seek_index && seek_with_index(stream, time * 48000))
+      return true;
 
    return !lib.op_pcm_seek(extra->of, time * 48000);;
 }
@@ -302,6 +394,17 @@ static double ogg_stream_get_length(ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
+static bool ogg_stream_index(ALLEGRO_AUDIO_STREAM *stream,
+   _AL_KCM_SEEK_POINT **points, size_t *count)
+{
+   AL_OP_DATA *extra = (AL_OP_DATA *) stream->extra;
+   const OpusHead *head = lib.op_head(extra->of, -1);
+
+   return _al_acodec_index_ogg_pages(extra->file, head->pre_skip, 48000,
+      points, count);
+}
+
+
 static bool ogg_stream_set_loop(ALLEGRO_AUDIO_STREAM *stream, double start, double end)
 {
    AL_OP_DATA *extra = (AL_OP_DATA *) stream->extra;
@@ -333,39 +436,35 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
 {
    AL_OP_DATA *extra = (AL_OP_DATA *) stream->extra;
 
-   const int word_size = 2;   /* 2 = 16-bit. opus_int16 size, for use in op_read */
-
-   unsigned long pos = 0;
-   int read_length = buf_size;
-   int buf_in_word;
+   /* Streams take the decoder's float output directly. */
+   const int word_size = 4;
+   const int channels = extra->channels;
    long rate = 48000;
-   int channels = extra->channels;
+   long frames = buf_size / (word_size * channels);
+   long pos = 0;
 
    double ctime = lib.op_pcm_tell(extra->of)/(double)rate;
 
-   double btime = ((double)buf_size / (word_size * channels)) / rate;
-   long read;
+   double btime = (double)frames / rate;
 
    if (stream->spl.loop != _ALLEGRO_PLAYMODE_STREAM_ONCE && ctime + btime > extra->loop_end) {
-      read_length = (extra->loop_end - ctime) * rate * word_size * channels;
-      if (read_length < 0)
+      frames = (extra->loop_end - ctime) * rate;
+      if (frames < 0)
          return 0;
-      read_length += read_length % word_size;
    }
 
-   buf_in_word= read_length/word_size;
+   while (pos < frames) {
+      int read = lib.op_read_float(extra->of, (float *)data + pos * channels,
+         (frames - pos) * channels, NULL);
 
-   while (pos < (unsigned long) read_length) {
-      read = lib.op_read(extra->of, (opus_int16 *)data + pos, buf_in_word - pos, NULL);
-      pos += read * channels;
-
-      if (read == 0) {
+      if (read <= 0) {
          /* Return the number of useful bytes written. */
-         return pos*word_size;
+         break;
       }
+      pos += read;
    }
 
-   return pos;
+   return pos * word_size * channels;
 }
 
 
@@ -395,7 +494,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_opus_audio_stream(const char *filename,
 ALLEGRO_AUDIO_STREAM *_al_load_ogg_opus_audio_stream_f(ALLEGRO_FILE *file,
    size_t buffer_count, unsigned int samples)
 {
-   const int word_size = 2; /* 1 = 8bit, 2 = 16-bit. nothing else */
+   const int word_size = 4; /* float, from op_read_float */
    OggOpusFile* of;
    int channels;
    long rate;
@@ -460,6 +559,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_opus_audio_stream_f(ALLEGRO_FILE *file,
    stream->get_feeder_position = ogg_stream_get_position;
    stream->get_feeder_length = ogg_stream_get_length;
    stream->set_feeder_loop = ogg_stream_set_loop;
+   stream->index_feeder = ogg_stream_index;
    stream->unload_feeder = ogg_stream_close;
    _al_acodec_start_feed_thread(stream);
 
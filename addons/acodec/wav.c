@@ -3,10 +3,14 @@
  * author: Matthew Leverton 
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include <stdio.h>
 
 #include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_audio.h"
+#include "allegro5/internal/aintern_file.h"
 #include "acodec.h"
 #include "helper.h"
 
@@ -295,6 +299,63 @@ static void wav_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
+static bool want_mapping(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "map_wav_samples");
+   return value && !_al_stricmp(value, "true");
+}
+
+
+static void unmap_file(void *mapping)
+{
+   al_fclose(mapping);
+}
+
+
+/* load_mapped_wav:
+ *  Creates a sample whose buffer is the data chunk of the mapped file, for
+ *  files whose samples can be played as they are stored. Pages are then only
+ *  read in as the sample is played. The sample takes over the file if this
+ *  succeeds, otherwise returns NULL.
+ */
+static ALLEGRO_SAMPLE *load_mapped_wav(ALLEGRO_FILE *f)
+{
+   WAVFILE *wavfile = wav_open(f);
+   ALLEGRO_SAMPLE *spl = NULL;
+   void *base;
+   int64_t size;
+
+   if (!wavfile)
+      return NULL;
+
+#ifdef ALLEGRO_BIG_ENDIAN
+   /* 16-bit data would need swapping. */
+   if (wavfile->bits != 8) {
+      wav_close(wavfile);
+      return NULL;
+   }
+#endif
+
+   /* The mapping is copy-on-write, so the sample data may be modified. */
+   if (al_get_file_mapping(f, &base, &size) && wavfile->samples > 0 &&
+         (int64_t)(wavfile->dpos +
+            (size_t)wavfile->sample_size * wavfile->samples) <= size) {
+      spl = al_create_sample((char *)base + wavfile->dpos,
+         wavfile->samples, wavfile->freq,
+         _al_word_size_to_depth_conf(wavfile->bits / 8),
+         _al_count_to_channel_conf(wavfile->channels), false);
+      if (spl) {
+         spl->unmap_buf = unmap_file;
+         spl->mapping = f;
+      }
+   }
+
+   wav_close(wavfile);
+   return spl;
+}
+
+
 /* _al_load_wav:
  *  Reads a RIFF WAV format sample ALLEGRO_FILE, returning an ALLEGRO_SAMPLE
  *  structure, or NULL on error.
@@ -305,12 +366,24 @@ ALLEGRO_SAMPLE *_al_load_wav(const char *filename)
    ALLEGRO_SAMPLE *spl;
    ASSERT(filename);
 
-   f = al_fopen(filename, "rb");
+   f = _al_fopen_for_reading(filename, "rb");
    if (!f) {
       ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
       return NULL;
    }
 
+   if (al_get_file_mapping(f, NULL, NULL) && want_mapping()) {
+      spl = load_mapped_wav(f);
+      if (spl)
+         return spl;
+      ALLEGRO_DEBUG("Could not use the mapping of %s, reading it instead.\n",
+         filename);
+      if (!al_fseek(f, 0, ALLEGRO_SEEK_SET)) {
+         al_fclose(f);
+         return NULL;
+      }
+   }
+
    spl = _al_load_wav_f(f);
 
    al_fclose(f);
@@ -0,0 +1,613 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      AAudio sound driver for Android 8.0 and later.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aaudio/AAudio.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio-aaudio")
+
+
+/* AAudio pulls the data from a callback on its own high priority thread, so
+ * unlike the OpenSL driver there is no polling thread and no extra buffer
+ * between the mixer and the device. The stream's buffer is kept at a few
+ * bursts and only grows when the device runs dry.
+ *
+ * libaaudio.so is loaded at run time, so the same binary still runs on older
+ * Android versions, where open() fails and the OpenSL driver is used instead.
+ */
+
+/* Default buffer size, in bursts. Two is the smallest that does not glitch
+ * on most devices.
+ */
+#define DEFAULT_BURSTS 2
+
+typedef aaudio_result_t (*CREATE_BUILDER)(AAudioStreamBuilder **);
+typedef const char *(*RESULT_TO_TEXT)(aaudio_result_t);
+typedef void (*BUILDER_SET_INT)(AAudioStreamBuilder *, int32_t);
+typedef void (*BUILDER_SET_DATA_CALLBACK)(AAudioStreamBuilder *,
+   AAudioStream_dataCallback, void *);
+typedef void (*BUILDER_SET_ERROR_CALLBACK)(AAudioStreamBuilder *,
+   AAudioStream_errorCallback, void *);
+typedef aaudio_result_t (*BUILDER_OPEN_STREAM)(AAudioStreamBuilder *,
+   AAudioStream **);
+typedef aaudio_result_t (*BUILDER_DELETE)(AAudioStreamBuilder *);
+typedef aaudio_result_t (*STREAM_ACTION)(AAudioStream *);
+typedef int32_t (*STREAM_GET_INT)(AAudioStream *);
+typedef aaudio_result_t (*STREAM_SET_INT)(AAudioStream *, int32_t);
+
+static void *aaudio_library;
+
+typedef struct AAUDIO_API {
+   CREATE_BUILDER createStreamBuilder;
+   RESULT_TO_TEXT convertResultToText;
+   BUILDER_SET_INT setDirection;
+   BUILDER_SET_INT setSampleRate;
+   BUILDER_SET_INT setChannelCount;
+   BUILDER_SET_INT setFormat;
+   BUILDER_SET_INT setSharingMode;
+   BUILDER_SET_INT setPerformanceMode;
+   BUILDER_SET_DATA_CALLBACK setDataCallback;
+   BUILDER_SET_ERROR_CALLBACK setErrorCallback;
+   BUILDER_OPEN_STREAM openStream;
+   BUILDER_DELETE deleteBuilder;
+   STREAM_ACTION requestStart;
+   STREAM_ACTION requestStop;
+   STREAM_ACTION close;
+   STREAM_GET_INT getSampleRate;
+   STREAM_GET_INT getChannelCount;
+   STREAM_GET_INT getFormat;
+   STREAM_GET_INT getSharingMode;
+   STREAM_GET_INT getPerformanceMode;
+   STREAM_GET_INT getFramesPerBurst;
+   STREAM_GET_INT getBufferSizeInFrames;
+   STREAM_GET_INT getBufferCapacityInFrames;
+   STREAM_GET_INT getXRunCount;
+   STREAM_SET_INT setBufferSizeInFrames;
+} AAUDIO_API;
+
+static AAUDIO_API aa;
+
+static const struct {
+   const char *name;
+   size_t offset;
+} aaudio_symbols[] = {
+#define SYM(field, name) { name, offsetof(AAUDIO_API, field) }
+   SYM(createStreamBuilder, "AAudio_createStreamBuilder"),
+   SYM(convertResultToText, "AAudio_convertResultToText"),
+   SYM(setDirection, "AAudioStreamBuilder_setDirection"),
+   SYM(setSampleRate, "AAudioStreamBuilder_setSampleRate"),
+   SYM(setChannelCount, "AAudioStreamBuilder_setChannelCount"),
+   SYM(setFormat, "AAudioStreamBuilder_setFormat"),
+   SYM(setSharingMode, "AAudioStreamBuilder_setSharingMode"),
+   SYM(setPerformanceMode, "AAudioStreamBuilder_setPerformanceMode"),
+   SYM(setDataCallback, "AAudioStreamBuilder_setDataCallback"),
+   SYM(setErrorCallback, "AAudioStreamBuilder_setErrorCallback"),
+   SYM(openStream, "AAudioStreamBuilder_openStream"),
+   SYM(deleteBuilder, "AAudioStreamBuilder_delete"),
+   SYM(requestStart, "AAudioStream_requestStart"),
+   SYM(requestStop, "AAudioStream_requestStop"),
+   SYM(close, "AAudioStream_close"),
+   SYM(getSampleRate, "AAudioStream_getSampleRate"),
+   SYM(getChannelCount, "AAudioStream_getChannelCount"),
+   SYM(getFormat, "AAudioStream_getFormat"),
+   SYM(getSharingMode, "AAudioStream_getSharingMode"),
+   SYM(getPerformanceMode, "AAudioStream_getPerformanceMode"),
+   SYM(getFramesPerBurst, "AAudioStream_getFramesPerBurst"),
+   SYM(getBufferSizeInFrames, "AAudioStream_getBufferSizeInFrames"),
+   SYM(getBufferCapacityInFrames, "AAudioStream_getBufferCapacityInFrames"),
+   SYM(getXRunCount, "AAudioStream_getXRunCount"),
+   SYM(setBufferSizeInFrames, "AAudioStream_setBufferSizeInFrames")
+#undef SYM
+};
+
+
+enum AAUDIO_VOICE_STATUS {
+   AV_IDLE,
+   AV_PLAYING,
+   AV_FAILED
+};
+
+typedef struct AAUDIO_VOICE {
+   AAudioStream *stream;
+   enum AAUDIO_VOICE_STATUS status;
+   bool started;
+   size_t frame_size;
+   int32_t burst;
+   int32_t xruns;
+
+   /* Non-streaming voices play straight from the sample. */
+   char *buffer;
+   char *buffer_end;
+} AAUDIO_VOICE;
+
+
+static const char *result_text(aaudio_result_t result)
+{
+   return aa.convertResultToText(result);
+}
+
+
+/* The open method starts up the driver and should lock the device, using the
+   previously set paramters, or defaults. It shouldn't need to start sending
+   audio data to the device yet, however. */
+static int aaudio_open(void)
+{
+   unsigned int i;
+
+   aaudio_library = dlopen("libaaudio.so", RTLD_NOW);
+   if (!aaudio_library) {
+      ALLEGRO_INFO("AAudio not available: %s\n", dlerror());
+      return 1;
+   }
+
+   for (i = 0; i < sizeof(aaudio_symbols) / sizeof(aaudio_symbols[0]); i++) {
+      void *sym = dlsym(aaudio_library, aaudio_symbols[i].name);
+      if (!sym) {
+         ALLEGRO_WARN("%s not found in libaaudio.so\n",
+            aaudio_symbols[i].name);
+         dlclose(aaudio_library);
+         aaudio_library = NULL;
+         return 1;
+      }
+      memcpy((char *)&aa + aaudio_symbols[i].offset, &sym, sizeof(sym));
+   }
+
+   return 0;
+}
+
+
+/* The close method should close the device, freeing any resources, and allow
+   other processes to use the device */
+static void aaudio_close(void)
+{
+   if (aaudio_library) {
+      dlclose(aaudio_library);
+      aaudio_library = NULL;
+   }
+   memset(&aa, 0, sizeof(aa));
+}
+
+
+/* Reads the next frames of a non-streaming voice's sample. Returns the
+ * number of frames written, the rest must be filled with silence. The voice
+ * mutex must be held.
+ */
+static int32_t read_direct_buffer(ALLEGRO_VOICE *voice, AAUDIO_VOICE *av,
+   char *out, int32_t frames)
+{
+   ALLEGRO_SAMPLE_INSTANCE *spl = voice->attached_stream;
+   int32_t done = 0;
+
+   while (done < frames && av->status == AV_PLAYING && spl &&
+         spl->spl_data.len > 0) {
+      int32_t avail = (int32_t)((av->buffer_end - av->buffer) / av->frame_size);
+      int32_t n = frames - done;
+      if (n > avail)
+         n = avail;
+
+      memcpy(out + done * av->frame_size, av->buffer, n * av->frame_size);
+      av->buffer += n * av->frame_size;
+      spl->pos += n;
+      done += n;
+
+      if (av->buffer >= av->buffer_end) {
+         av->buffer = (char *)spl->spl_data.buffer.ptr;
+         spl->pos = 0;
+         if (spl->loop == ALLEGRO_PLAYMODE_ONCE) {
+            av->status = AV_IDLE;
+            al_broadcast_cond(voice->cond);
+         }
+      }
+   }
+
+   return done;
+}
+
+
+/* Gives the device more room after it ran dry, the way the AAudio
+ * documentation suggests: one burst at a time, up to the capacity.
+ */
+static void handle_xruns(ALLEGRO_VOICE *voice, AAUDIO_VOICE *av,
+   AAudioStream *stream)
+{
+   int32_t xruns = aa.getXRunCount(stream);
+   int32_t size;
+
+   if (xruns <= av->xruns)
+      return;
+   av->xruns = xruns;
+
+   size = aa.getBufferSizeInFrames(stream);
+   if (size + av->burst <= aa.getBufferCapacityInFrames(stream)) {
+      aa.setBufferSizeInFrames(stream, size + av->burst);
+      ALLEGRO_DEBUG("Underrun, buffer size now %d frames\n",
+         (int)aa.getBufferSizeInFrames(stream));
+   }
+
+   _al_kcm_voice_underrun(voice);
+}
+
+
+static aaudio_data_callback_result_t aaudio_data_callback(
+   AAudioStream *stream, void *user_data, void *audio_data, int32_t frames)
+{
+   ALLEGRO_VOICE *voice = user_data;
+   AAUDIO_VOICE *av = voice->extra;
+   char *out = audio_data;
+   int32_t done = 0;
+   bool playing;
+
+   handle_xruns(voice, av, stream);
+
+   al_lock_mutex(voice->mutex);
+   playing = (av->status == AV_PLAYING);
+   if (playing && !voice->is_streaming)
+      done = read_direct_buffer(voice, av, out, frames);
+   al_unlock_mutex(voice->mutex);
+
+   /* The mixer writes straight into AAudio's buffer, one chunk at a time. */
+   if (playing && voice->is_streaming) {
+      while (done < frames) {
+         unsigned int n = frames - done;
+         const void *data = _al_voice_update(voice, voice->mutex, &n);
+         if (!data || n == 0)
+            break;
+         memcpy(out + done * av->frame_size, data, n * av->frame_size);
+         done += n;
+      }
+   }
+
+   if (done < frames) {
+      al_fill_silence(out + done * av->frame_size, frames - done,
+         voice->depth, voice->chan_conf);
+   }
+
+   return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+
+static void aaudio_error_callback(AAudioStream *stream, void *user_data,
+   aaudio_result_t error)
+{
+   ALLEGRO_VOICE *voice = user_data;
+   AAUDIO_VOICE *av = voice->extra;
+   (void)stream;
+
+   /* Most likely the device was unplugged. The stream must not be closed
+    * from here; the voice stays silent until it is destroyed.
+    */
+   ALLEGRO_ERROR("Stream error: %s\n", result_text(error));
+
+   al_lock_mutex(voice->mutex);
+   av->status = AV_FAILED;
+   al_broadcast_cond(voice->cond);
+   al_unlock_mutex(voice->mutex);
+}
+
+
+static bool get_config_exclusive(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(),
+      "aaudio", "exclusive");
+   return !value || _al_stricmp(value, "false") != 0;
+}
+
+
+static int32_t get_config_bursts(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(),
+      "aaudio", "buffer_size");
+   int32_t bursts = value ? atoi(value) : 0;
+   return bursts > 0 ? bursts : DEFAULT_BURSTS;
+}
+
+
+static bool open_stream(ALLEGRO_VOICE *voice, AAUDIO_VOICE *av)
+{
+   AAudioStreamBuilder *builder;
+   aaudio_format_t format;
+   int32_t channels = al_get_channel_count(voice->chan_conf);
+   int32_t capacity;
+   int32_t size;
+   aaudio_result_t result;
+
+   switch (voice->depth) {
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         format = AAUDIO_FORMAT_PCM_I16;
+         break;
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+         format = AAUDIO_FORMAT_PCM_FLOAT;
+         break;
+      default:
+         ALLEGRO_ERROR("Unsupported audio depth %d\n", voice->depth);
+         return false;
+   }
+
+   result = aa.createStreamBuilder(&builder);
+   if (result != AAUDIO_OK) {
+      ALLEGRO_ERROR("AAudio_createStreamBuilder failed: %s\n",
+         result_text(result));
+      return false;
+   }
+
+   aa.setDirection(builder, AAUDIO_DIRECTION_OUTPUT);
+   aa.setSampleRate(builder, voice->frequency);
+   aa.setChannelCount(builder, channels);
+   aa.setFormat(builder, format);
+   aa.setPerformanceMode(builder, AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+   /* AAudio falls back to a shared stream by itself if the device cannot be
+    * had exclusively.
+    */
+   aa.setSharingMode(builder, get_config_exclusive() ?
+      AAUDIO_SHARING_MODE_EXCLUSIVE : AAUDIO_SHARING_MODE_SHARED);
+   aa.setDataCallback(builder, aaudio_data_callback, voice);
+   aa.setErrorCallback(builder, aaudio_error_callback, voice);
+
+   result = aa.openStream(builder, &av->stream);
+   aa.deleteBuilder(builder);
+   if (result != AAUDIO_OK) {
+      ALLEGRO_ERROR("AAudioStreamBuilder_openStream failed: %s\n",
+         result_text(result));
+      av->stream = NULL;
+      return false;
+   }
+
+   /* We asked for these, but a stream is allowed to differ. */
+   if (aa.getSampleRate(av->stream) != (int32_t)voice->frequency ||
+         aa.getChannelCount(av->stream) != channels ||
+         aa.getFormat(av->stream) != format) {
+      ALLEGRO_ERROR("Stream format does not match the voice\n");
+      aa.close(av->stream);
+      av->stream = NULL;
+      return false;
+   }
+
+   av->frame_size = channels * al_get_audio_depth_size(voice->depth);
+   av->burst = aa.getFramesPerBurst(av->stream);
+   av->xruns = aa.getXRunCount(av->stream);
+
+   capacity = aa.getBufferCapacityInFrames(av->stream);
+   size = get_config_bursts() * av->burst;
+   if (av->burst > 0 && size <= capacity)
+      aa.setBufferSizeInFrames(av->stream, size);
+
+   ALLEGRO_INFO("Opened %s stream%s, %d frames per burst, "
+      "buffer %d of %d frames\n",
+      aa.getSharingMode(av->stream) == AAUDIO_SHARING_MODE_EXCLUSIVE ?
+         "exclusive" : "shared",
+      aa.getPerformanceMode(av->stream) ==
+         AAUDIO_PERFORMANCE_MODE_LOW_LATENCY ? " (low latency)" : "",
+      (int)av->burst, (int)aa.getBufferSizeInFrames(av->stream),
+      (int)capacity);
+
+   return true;
+}
+
+
+/* The allocate_voice method should grab a voice from the system, and allocate
+   any data common to streaming and non-streaming sources. */
+static int aaudio_allocate_voice(ALLEGRO_VOICE *voice)
+{
+   AAUDIO_VOICE *av;
+
+   av = al_calloc(1, sizeof(*av));
+   if (!av) {
+      ALLEGRO_ERROR("Could not allocate voice data memory\n");
+      return 1;
+   }
+   av->status = AV_IDLE;
+
+   voice->extra = av;
+
+   if (!open_stream(voice, av)) {
+      al_free(av);
+      voice->extra = NULL;
+      return 1;
+   }
+
+   return 0;
+}
+
+
+/* The deallocate_voice method should free the resources for the given voice,
+   but still retain a hold on the device. The voice should be stopped and
+   unloaded by the time this is called */
+static void aaudio_deallocate_voice(ALLEGRO_VOICE *voice)
+{
+   AAUDIO_VOICE *av = voice->extra;
+
+   /* Closing waits for the callback to return, so the voice must not be
+    * locked here.
+    */
+   aa.close(av->stream);
+   al_free(av);
+   voice->extra = NULL;
+}
+
+
+/* The load_voice method loads a sample into the driver's memory. The voice's
+   'streaming' field will be set to false for these voices, and it's
+   'buffer_size' field will be the total length in bytes of the sample data.
+   The voice's attached sample's looping mode should be honored, and loading
+   must fail if it cannot be. */
+static int aaudio_load_voice(ALLEGRO_VOICE *voice, const void *data)
+{
+   AAUDIO_VOICE *av = voice->extra;
+   (void)data;
+
+   if (voice->attached_stream->loop == ALLEGRO_PLAYMODE_BIDIR) {
+      ALLEGRO_INFO("Backwards playing not supported by the driver.\n");
+      return 1;
+   }
+
+   voice->attached_stream->pos = 0;
+
+   av->buffer = (char *)voice->attached_stream->spl_data.buffer.ptr;
+   av->buffer_end = av->buffer +
+      voice->attached_stream->spl_data.len * av->frame_size;
+
+   return 0;
+}
+
+
+/* The unload_voice method unloads a sample previously loaded with load_voice.
+   This method should not be called on a streaming voice. */
+static void aaudio_unload_voice(ALLEGRO_VOICE *voice)
+{
+   (void)voice;
+}
+
+
+/* The start_voice should, surprise, start the voice. For streaming voices, it
+   should start polling the device and call _al_voice_update for audio data.
+   For non-streaming voices, it should resume playing from the last set
+   position */
+static int aaudio_start_voice(ALLEGRO_VOICE *voice)
+{
+   AAUDIO_VOICE *av = voice->extra;
+   aaudio_result_t result;
+
+   /* We already hold voice->mutex. Starting does not wait for the
+    * callback, which needs it.
+    */
+   if (av->status == AV_FAILED)
+      return 1;
+
+   av->status = AV_PLAYING;
+   al_broadcast_cond(voice->cond);
+
+   if (!av->started) {
+      result = aa.requestStart(av->stream);
+      if (result != AAUDIO_OK) {
+         ALLEGRO_ERROR("AAudioStream_requestStart failed: %s\n",
+            result_text(result));
+         av->status = AV_IDLE;
+         return 1;
+      }
+      av->started = true;
+   }
+
+   return 0;
+}
+
+
+/* The stop_voice method should stop playback. For non-streaming voices, it
+   should leave the data loaded, and reset the voice position to 0. */
+static int aaudio_stop_voice(ALLEGRO_VOICE *voice)
+{
+   AAUDIO_VOICE *av = voice->extra;
+
+   /* We already hold voice->mutex, so the callback is not in the middle of
+    * reading the sample. It plays silence from now on, until the stream
+    * has stopped.
+    */
+   if (av->status != AV_FAILED)
+      av->status = AV_IDLE;
+   al_broadcast_cond(voice->cond);
+
+   if (av->started) {
+      aa.requestStop(av->stream);
+      av->started = false;
+   }
+
+   if (!voice->is_streaming) {
+      voice->attached_stream->pos = 0;
+      av->buffer = (char *)voice->attached_stream->spl_data.buffer.ptr;
+   }
+
+   return 0;
+}
+
+
+/* The voice_is_playing method should only be called on non-streaming sources,
+   and should return true if the voice is playing */
+static bool aaudio_voice_is_playing(const ALLEGRO_VOICE *voice)
+{
+   AAUDIO_VOICE *av = voice->extra;
+   return av->status == AV_PLAYING;
+}
+
+
+/* The get_voice_position method should return the current sample position of
+   the voice (sample_pos = byte_pos / (depth/8) / channels). This should never
+   be called on a streaming voice. */
+static unsigned int aaudio_get_voice_position(const ALLEGRO_VOICE *voice)
+{
+   return voice->attached_stream->pos;
+}
+
+
+/* The set_voice_position method should set the voice's playback position,
+   given the value in samples. This should never be called on a streaming
+   voice. */
+static int aaudio_set_voice_position(ALLEGRO_VOICE *voice, unsigned int val)
+{
+   AAUDIO_VOICE *av = voice->extra;
+
+   /* We already hold voice->mutex. */
+   voice->attached_stream->pos = val;
+   av->buffer = (char *)voice->attached_stream->spl_data.buffer.ptr +
+      val * av->frame_size;
+
+   return 0;
+}
+
+
+static double aaudio_get_voice_latency(const ALLEGRO_VOICE *voice)
+{
+   AAUDIO_VOICE *av = voice->extra;
+   return (double)aa.getBufferSizeInFrames(av->stream) / voice->frequency;
+}
+
+
+ALLEGRO_AUDIO_DRIVER _al_kcm_aaudio_driver = {
+   "AAudio",
+
+   aaudio_open,
+   aaudio_close,
+
+   aaudio_allocate_voice,
+   aaudio_deallocate_voice,
+
+   aaudio_load_voice,
+   aaudio_unload_voice,
+
+   aaudio_start_voice,
+   aaudio_stop_voice,
+
+   aaudio_voice_is_playing,
+
+   aaudio_get_voice_position,
+   aaudio_set_voice_position,
+
+   NULL,
+   NULL,
+
+   NULL,
+
+   aaudio_get_voice_latency
+};
+
+/* vim: set sts=3 sw=3 et: */
@@ -49,6 +49,7 @@ enum ALLEGRO_AUDIO_EVENT_TYPE
    ALLEGRO_EVENT_AUDIO_STREAM_FINISHED   = 514,
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
    ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT = 515,
+   ALLEGRO_EVENT_AUDIO_UNDERRUN          = 516,
 #endif
 };
 
@@ -63,6 +64,17 @@ struct ALLEGRO_AUDIO_RECORDER_EVENT
    void *buffer;
    unsigned int samples;
 };
+
+/* Type: ALLEGRO_AUDIO_TIMING
+ */
+typedef struct ALLEGRO_AUDIO_TIMING ALLEGRO_AUDIO_TIMING;
+struct ALLEGRO_AUDIO_TIMING
+{
+   double last_time;
+   double max_time;
+   double period;
+   unsigned int underruns;
+};
 #endif
 
 
@@ -133,7 +145,10 @@ enum ALLEGRO_MIXER_QUALITY
 {
    ALLEGRO_MIXER_QUALITY_POINT   = 0x110,
    ALLEGRO_MIXER_QUALITY_LINEAR  = 0x111,
-   ALLEGRO_MIXER_QUALITY_CUBIC   = 0x112
+   ALLEGRO_MIXER_QUALITY_CUBIC   = 0x112,
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
+   ALLEGRO_MIXER_QUALITY_SINC    = 0x113
+#endif
 };
 
 
@@ -201,6 +216,11 @@ ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_SAMPLE *, al_create_sample, (void *buf,
       unsigned int samples, unsigned int freq, ALLEGRO_AUDIO_DEPTH depth,
       ALLEGRO_CHANNEL_CONF chan_conf, bool free_buf));
 ALLEGRO_KCM_AUDIO_FUNC(void, al_destroy_sample, (ALLEGRO_SAMPLE *spl));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
+ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_SAMPLE *, al_create_compressed_sample, (const ALLEGRO_SAMPLE *spl));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_is_sample_compressed, (const ALLEGRO_SAMPLE *spl));
+ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_SAMPLE *, al_resample_sample, (const ALLEGRO_SAMPLE *spl, unsigned int frequency));
+#endif
 
 
 /* Sample instance functions */
@@ -249,6 +269,8 @@ ALLEGRO_KCM_AUDIO_FUNC(bool, al_play_sample_instance, (ALLEGRO_SAMPLE_INSTANCE *
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_stop_sample_instance, (ALLEGRO_SAMPLE_INSTANCE *spl));
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_sample_instance_channel_matrix, (ALLEGRO_SAMPLE_INSTANCE *spl, const float *matrix));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_sample_instance_gain_ramp, (ALLEGRO_SAMPLE_INSTANCE *spl, float val, unsigned int frames));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_sample_instance_pan_ramp, (ALLEGRO_SAMPLE_INSTANCE *spl, float val, unsigned int frames));
 #endif
 
 
@@ -298,6 +320,14 @@ ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_audio_stream_event_source,
 
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_audio_stream_channel_matrix, (ALLEGRO_AUDIO_STREAM *stream, const float *matrix));
+ALLEGRO_KCM_AUDIO_FUNC(unsigned int, al_get_audio_stream_underruns, (const ALLEGRO_AUDIO_STREAM *stream));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_audio_stream_adaptive_fragments, (ALLEGRO_AUDIO_STREAM *stream, unsigned int min_fragments));
+ALLEGRO_KCM_AUDIO_FUNC(unsigned int, al_get_audio_stream_active_fragments, (const ALLEGRO_AUDIO_STREAM *stream));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_build_audio_stream_seek_index, (ALLEGRO_AUDIO_STREAM *stream));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_save_audio_stream_seek_index, (ALLEGRO_AUDIO_STREAM *stream, const char *filename));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_save_audio_stream_seek_index_f, (ALLEGRO_AUDIO_STREAM *stream, ALLEGRO_FILE *fp));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_load_audio_stream_seek_index, (ALLEGRO_AUDIO_STREAM *stream, const char *filename));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_load_audio_stream_seek_index_f, (ALLEGRO_AUDIO_STREAM *stream, ALLEGRO_FILE *fp));
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_AUDIO_STREAM *, al_play_audio_stream, (const char *filename));
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_AUDIO_STREAM *, al_play_audio_stream_f, (ALLEGRO_FILE *fp, const char *ident));
 #endif
@@ -330,6 +360,11 @@ ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_mixer_quality, (ALLEGRO_MIXER *mixer, ALLEGR
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_mixer_gain, (ALLEGRO_MIXER *mixer, float gain));
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_mixer_playing, (ALLEGRO_MIXER *mixer, bool val));
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_detach_mixer, (ALLEGRO_MIXER *mixer));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_get_mixer_parallel, (const ALLEGRO_MIXER *mixer));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_mixer_parallel, (ALLEGRO_MIXER *mixer, bool parallel));
+ALLEGRO_KCM_AUDIO_FUNC(void, al_get_mixer_timing, (const ALLEGRO_MIXER *mixer, ALLEGRO_AUDIO_TIMING *timing));
+#endif
 
 /* Voice functions */
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_VOICE*, al_create_voice, (unsigned int freq,
@@ -352,6 +387,12 @@ ALLEGRO_KCM_AUDIO_FUNC(bool, al_get_voice_playing, (const ALLEGRO_VOICE *voice))
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_voice_has_attachments, (const ALLEGRO_VOICE* voice));
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_voice_position, (ALLEGRO_VOICE *voice, unsigned int val));
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_voice_playing, (ALLEGRO_VOICE *voice, bool val));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
+ALLEGRO_KCM_AUDIO_FUNC(double, al_get_voice_latency, (const ALLEGRO_VOICE *voice));
+ALLEGRO_KCM_AUDIO_FUNC(void, al_get_voice_timing, (const ALLEGRO_VOICE *voice, ALLEGRO_AUDIO_TIMING *timing));
+ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_voice_event_source, (ALLEGRO_VOICE *voice));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_render_voice, (ALLEGRO_VOICE *voice, void *buffer, unsigned int frames));
+#endif
 
 /* Misc. audio functions */
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_install_audio, (void));
@@ -384,6 +425,10 @@ ALLEGRO_KCM_AUDIO_FUNC(void, al_set_default_voice, (ALLEGRO_VOICE *voice));
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_SAMPLE_INSTANCE*, al_lock_sample_id, (ALLEGRO_SAMPLE_ID *spl_id));
 ALLEGRO_KCM_AUDIO_FUNC(void, al_unlock_sample_id, (ALLEGRO_SAMPLE_ID *spl_id));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_play_sample_with_priority, (ALLEGRO_SAMPLE *data,
+      float gain, float pan, float speed, ALLEGRO_PLAYMODE loop,
+      int priority, int group, ALLEGRO_SAMPLE_ID *ret_id));
+ALLEGRO_KCM_AUDIO_FUNC(void, al_stop_sample_group, (int group));
 #endif
 
 /* File type handlers */
@@ -423,6 +468,16 @@ ALLEGRO_KCM_AUDIO_FUNC(char const *, al_identify_sample, (char const *filename))
 
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_KCM_AUDIO_SRC)
 
+/* Flags for al_load_audio_stream_flags */
+enum {
+   ALLEGRO_AUDIO_STREAM_IN_MEMORY = 0x0001
+};
+
+ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_AUDIO_STREAM *, al_load_audio_stream_flags, (const char *filename,
+   size_t buffer_count, unsigned int samples, int flags));
+ALLEGRO_KCM_AUDIO_FUNC(void, al_set_audio_stream_cache_size, (size_t size));
+ALLEGRO_KCM_AUDIO_FUNC(size_t, al_get_audio_stream_cache_size, (void));
+
 /* Recording functions */
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_AUDIO_RECORDER *, al_create_audio_recorder, (size_t fragment_count,
    unsigned int samples, unsigned int freq, ALLEGRO_AUDIO_DEPTH depth, ALLEGRO_CHANNEL_CONF chan_conf));
@@ -433,6 +488,12 @@ ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_audio_recorder_event_sourc
    (ALLEGRO_AUDIO_RECORDER *r));
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_AUDIO_RECORDER_EVENT *, al_get_audio_recorder_event, (ALLEGRO_EVENT *event));
 ALLEGRO_KCM_AUDIO_FUNC(void, al_destroy_audio_recorder, (ALLEGRO_AUDIO_RECORDER *r));
+ALLEGRO_KCM_AUDIO_FUNC(void, al_set_audio_recorder_ring_mode, (ALLEGRO_AUDIO_RECORDER *r, bool ring_mode));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_get_audio_recorder_ring_mode, (const ALLEGRO_AUDIO_RECORDER *r));
+ALLEGRO_KCM_AUDIO_FUNC(const void *, al_get_audio_recorder_data, (ALLEGRO_AUDIO_RECORDER *r,
+   unsigned int *samples, double *timestamp));
+ALLEGRO_KCM_AUDIO_FUNC(void, al_commit_audio_recorder_data, (ALLEGRO_AUDIO_RECORDER *r, unsigned int samples));
+ALLEGRO_KCM_AUDIO_FUNC(unsigned int, al_get_audio_recorder_dropped_samples, (const ALLEGRO_AUDIO_RECORDER *r));
 
 #endif
    
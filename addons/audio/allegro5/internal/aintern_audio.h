@@ -6,10 +6,19 @@
 #define AINTERN_AUDIO_H
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_list.h"
 #include "allegro5/internal/aintern_vector.h"
 #include "../allegro_audio.h"
 
+/* A run of frames the driver delivered to the recorder's ring at once. */
+typedef struct _AL_KCM_RECORDER_BLOCK {
+  unsigned int             start;
+  unsigned int             frames;
+  double                   time;
+                           /* al_get_time() when the first frame came in */
+} _AL_KCM_RECORDER_BLOCK;
+
 struct ALLEGRO_AUDIO_RECORDER {
   ALLEGRO_EVENT_SOURCE source;
   
@@ -44,6 +53,31 @@ struct ALLEGRO_AUDIO_RECORDER {
                               
   void                     *extra;
                            /* custom data for the driver to use as needed */
+
+  volatile bool            ring_mode;
+                           /* deliver into the ring instead of emitting
+                              fragment events */
+
+  uint8_t                  *ring;
+  unsigned int             ring_frames;
+  _AL_KCM_RECORDER_BLOCK   *blocks;
+  unsigned int             block_count;
+                           /* single producer, single consumer rings of
+                              frames and of the blocks they came in; one
+                              entry of each is always left empty */
+
+  unsigned int             ring_write;
+  unsigned int             dropped;
+                           /* only written by the driver's thread */
+
+  _AL_ATOMIC               ring_read;
+  _AL_ATOMIC               block_read;
+  _AL_ATOMIC               block_write;
+                           /* published with release stores */
+
+  unsigned int             block_offset;
+                           /* frames of the oldest block already committed,
+                              only used by the reader */
 };
 
 typedef enum ALLEGRO_AUDIO_DRIVER_ENUM
@@ -57,7 +91,10 @@ typedef enum ALLEGRO_AUDIO_DRIVER_ENUM
    ALLEGRO_AUDIO_DRIVER_AQUEUE     = 0x20005,
    ALLEGRO_AUDIO_DRIVER_PULSEAUDIO = 0x20006,
    ALLEGRO_AUDIO_DRIVER_OPENSL     = 0x20007,
-   ALLEGRO_AUDIO_DRIVER_SDL        = 0x20008
+   ALLEGRO_AUDIO_DRIVER_SDL        = 0x20008,
+   ALLEGRO_AUDIO_DRIVER_WASAPI     = 0x20009,
+   ALLEGRO_AUDIO_DRIVER_NULL       = 0x2000A,
+   ALLEGRO_AUDIO_DRIVER_AAUDIO     = 0x2000B
 } ALLEGRO_AUDIO_DRIVER_ENUM;
 
 typedef struct ALLEGRO_AUDIO_DRIVER ALLEGRO_AUDIO_DRIVER;
@@ -86,12 +123,31 @@ struct ALLEGRO_AUDIO_DRIVER {
    void           (*deallocate_recorder)(struct ALLEGRO_AUDIO_RECORDER *);
 
    _AL_LIST*      (*get_output_devices)(void);
+
+   double         (*get_voice_latency)(const ALLEGRO_VOICE*);
 };
 
 extern ALLEGRO_AUDIO_DRIVER *_al_kcm_driver;
 
+/* How long mixing a buffer took, against how long the buffer plays for. */
+typedef struct _AL_KCM_TIMING {
+   double               last_time;
+   double               max_time;
+   double               period;
+   unsigned int         underruns;
+                        /* Buffers that took longer than they play for. */
+} _AL_KCM_TIMING;
+
 const void *_al_voice_update(ALLEGRO_VOICE *voice, ALLEGRO_MUTEX *mutex,
    unsigned int *samples);
+void _al_kcm_voice_underrun(ALLEGRO_VOICE *voice);
+void _al_kcm_raise_audio_thread(ALLEGRO_THREAD *self, const char *name,
+   bool realtime);
+bool _al_kcm_update_timing(_AL_KCM_TIMING *timing, double start,
+   unsigned int samples, unsigned int frequency);
+void _al_kcm_emit_underrun_event(ALLEGRO_EVENT_SOURCE *es);
+void _al_kcm_emit_recorder_fragment(struct ALLEGRO_AUDIO_RECORDER *r,
+   void *buffer, unsigned int samples);
 bool _al_kcm_set_voice_playing(ALLEGRO_VOICE *voice, ALLEGRO_MUTEX *mutex,
    bool val);
 
@@ -128,6 +184,15 @@ struct ALLEGRO_VOICE {
 
    void                 *extra;
                         /* Extra data for use by the driver. */
+
+   _AL_KCM_TIMING       timing;
+                        /* Updated by _al_voice_update, protected by the
+                         * mutex. Underruns the driver notices are added by
+                         * _al_kcm_voice_underrun.
+                         */
+
+   ALLEGRO_EVENT_SOURCE es;
+                        /* For ALLEGRO_EVENT_AUDIO_UNDERRUN. */
 };
 
 
@@ -152,6 +217,17 @@ struct ALLEGRO_SAMPLE {
                         /* Whether `buffer' needs to be freed when the sample
                          * is destroyed, or when `buffer' changes.
                          */
+   bool                 compressed;
+                        /* Whether `buffer' holds IMA-ADPCM blocks made by
+                         * al_create_compressed_sample. `depth' is then the
+                         * depth the blocks decode to.
+                         */
+   void                 (*unmap_buf)(void *mapping);
+   void                 *mapping;
+                        /* If set, `buffer' points into a file mapping made
+                         * by a sample loader, and is released by calling
+                         * `unmap_buf' with `mapping' instead of being freed.
+                         */
    _AL_LIST_ITEM        *dtor_item;
 };
 
@@ -177,6 +253,22 @@ struct ALLEGRO_SAMPLE {
 typedef void (*stream_reader_t)(void *source, void **vbuf,
    unsigned int *samples, ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc);
 
+/* Compressed samples are made of blocks of this many frames, each of which
+ * can be decoded on its own. A block takes _AL_KCM_ADPCM_BLOCK_BYTES per
+ * channel: the predictor and step index the block starts with, then one
+ * nibble for each further frame.
+ */
+#define _AL_KCM_ADPCM_BLOCK_FRAMES  505
+#define _AL_KCM_ADPCM_BLOCK_BYTES   256
+#define _AL_KCM_DECODE_CACHE_SLOTS  4
+
+/* The most recently decoded blocks of a compressed sample, per instance. */
+typedef struct _AL_KCM_DECODE_CACHE {
+   int                  block[_AL_KCM_DECODE_CACHE_SLOTS];
+   int                  channels;
+   int16_t              *frames;
+} _AL_KCM_DECODE_CACHE;
+
 typedef struct {
    union {
       ALLEGRO_MIXER     *mixer;
@@ -186,6 +278,26 @@ typedef struct {
    bool                 is_voice;
 } sample_parent_t;
 
+/* A linear change of an instance's gain or pan over a number of mixer
+ * frames. target and length are what was asked for; the mixer thread takes
+ * them up when it runs the command for the ramp and then owns delta and left.
+ */
+typedef struct _AL_KCM_RAMP {
+   float                target;
+   unsigned int         length;
+   float                delta;
+                        /* Change per mixer frame. */
+   unsigned int         left;
+                        /* Frames until the target is reached, 0 if not
+                         * ramping.
+                         */
+} _AL_KCM_RAMP;
+
+/* Ramps are applied in blocks of this many frames, the matrix being worked
+ * out again before each block.
+ */
+#define _AL_KCM_RAMP_BLOCK 16
+
 /* The sample struct also serves the base of ALLEGRO_AUDIO_STREAM, ALLEGRO_MIXER. */
 struct ALLEGRO_SAMPLE_INSTANCE {
    /* ALLEGRO_SAMPLE_INSTANCE does not generate any events yet but ALLEGRO_AUDIO_STREAM
@@ -201,6 +313,8 @@ struct ALLEGRO_SAMPLE_INSTANCE {
    float                speed;
    float                gain;
    float                pan;
+   _AL_KCM_RAMP         gain_ramp;
+   _AL_KCM_RAMP         pan_ramp;
 
    /* When resampling an audio stream there will be fractional sample
     * positions due to the difference in frequencies.
@@ -223,6 +337,17 @@ struct ALLEGRO_SAMPLE_INSTANCE {
                          * The gain is premultiplied in.
                          */
 
+   float                *rechannel;
+                        /* The channel conversion alone, without gain or pan.
+                         * Allocated along with the matrix, and only valid
+                         * while that is not NULL.
+                         */
+
+   bool                 zero_matrix;
+                        /* All of the matrix is zero, e.g. because the gain
+                         * is, so the mixer only has to advance the position.
+                         */
+
    bool                 is_mixer;
    stream_reader_t      spl_read;
                         /* Reads sample data into the provided buffer, using
@@ -238,10 +363,24 @@ struct ALLEGRO_SAMPLE_INSTANCE {
    sample_parent_t      parent;
                         /* The object that this sample is attached to, if any.
                          */
+   int                  parent_index;
+                        /* The index in the streams of the parent mixer, if
+                         * attached to one.
+                         */
+   _AL_KCM_DECODE_CACHE *decode_cache;
+                        /* Only for compressed samples. */
    _AL_LIST_ITEM        *dtor_item;
+   bool                 pooled;
+                        /* Allocated from the sample instance pool. */
 };
 
 void _al_kcm_destroy_sample(ALLEGRO_SAMPLE_INSTANCE *sample, bool unregister);
+void _al_kcm_init_instance_pool(void);
+void _al_kcm_shutdown_instance_pool(void);
+bool _al_kcm_prepare_decode_cache(ALLEGRO_SAMPLE_INSTANCE *spl);
+void _al_kcm_free_decode_cache(ALLEGRO_SAMPLE_INSTANCE *spl);
+void _al_kcm_decode_adpcm_block(const ALLEGRO_SAMPLE *spl, int block,
+   int16_t *frames);
 void _al_kcm_stream_set_mutex(ALLEGRO_SAMPLE_INSTANCE *stream, ALLEGRO_MUTEX *mutex);
 void _al_kcm_detach_from_parent(ALLEGRO_SAMPLE_INSTANCE *spl);
 
@@ -254,6 +393,17 @@ typedef double (*get_feeder_position_t)(ALLEGRO_AUDIO_STREAM *);
 typedef double (*get_feeder_length_t)(ALLEGRO_AUDIO_STREAM *);
 typedef bool (*set_feeder_loop_t)(ALLEGRO_AUDIO_STREAM *, double, double);
 
+/* An entry of a stream's seek index: decoding from byte 'offset' of the
+ * source file starts at or before sample frame 'frame'.
+ */
+typedef struct _AL_KCM_SEEK_POINT {
+   uint64_t frame;
+   uint64_t offset;
+} _AL_KCM_SEEK_POINT;
+
+typedef bool (*index_feeder_t)(ALLEGRO_AUDIO_STREAM *, _AL_KCM_SEEK_POINT **,
+   size_t *);
+
 struct ALLEGRO_AUDIO_STREAM {
    ALLEGRO_SAMPLE_INSTANCE spl;
                         /* ALLEGRO_AUDIO_STREAM is derived from
@@ -297,17 +447,59 @@ struct ALLEGRO_AUDIO_STREAM {
                           * the stream was started.
                           */
 
+   unsigned int          underruns;
+                         /* Times the mixer ran out of fragments while the
+                          * stream was not draining.
+                          */
+
+   unsigned int          active_fragments;
+   unsigned int          min_active_fragments;
+   unsigned int          adaptive_streak;
+   unsigned int          adaptive_shrink_after;
+                         /* At most 'active_fragments' fragments are filled
+                          * or handed out at a time, which is 'buf_count'
+                          * unless the stream is adaptive. Adaptive streams
+                          * (min_active_fragments > 0) use more after an
+                          * underrun, and one less after
+                          * 'adaptive_shrink_after' fragments in a row which
+                          * left another one queued.
+                          */
+
+   bool                  *silent_fragments;
+   bool                  lag_silent;
+                         /* Whether each fragment, by its place in the
+                          * main_buffer, held only silence when it was
+                          * passed to al_set_audio_stream_fragment, and
+                          * whether the sample values copied in front of the
+                          * current fragment are silent. Lets the mixer skip
+                          * silent stretches of the stream.
+                          */
+
    ALLEGRO_THREAD        *feed_thread;
    ALLEGRO_MUTEX         *feed_thread_started_mutex;
    ALLEGRO_COND          *feed_thread_started_cond;
    bool                  feed_thread_started;
    volatile bool         quit_feed_thread;
+   bool                  finished_event_sent;
+   bool                  feed_pooled;
+   bool                  feed_pending;
+   bool                  feed_busy;
+                         /* Set while the stream is fed by the shared feeder
+                          * pool instead of its own thread. 'feed_pending'
+                          * and 'feed_busy' are protected by the pool's
+                          * mutex.
+                          */
+   bool                  feed_offline;
+                         /* Set while the stream is fed by al_render_voice,
+                          * with the null driver.
+                          */
    unload_feeder_t       unload_feeder;
    rewind_feeder_t       rewind_feeder;
    seek_feeder_t         seek_feeder;
    get_feeder_position_t get_feeder_position;
    get_feeder_length_t   get_feeder_length;
    set_feeder_loop_t     set_feeder_loop;
+   index_feeder_t        index_feeder;
    stream_callback_t     feeder;
                          /* If ALLEGRO_AUDIO_STREAM has been created by
                           * al_load_audio_stream(), the stream will be fed
@@ -315,6 +507,14 @@ struct ALLEGRO_AUDIO_STREAM {
                           * streams don't need to be fed by the user.
                           */
 
+   _AL_KCM_SEEK_POINT    *seek_index;
+   size_t                seek_index_size;
+                         /* Optional table of resync points sorted by frame,
+                          * built by 'index_feeder' or loaded from a file.
+                          * Lets 'seek_feeder' jump straight to the right
+                          * place in the file instead of searching for it.
+                          */
+
    _AL_LIST_ITEM        *dtor_item;
 
    void                  *extra;
@@ -322,6 +522,9 @@ struct ALLEGRO_AUDIO_STREAM {
 };
 
 bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream);
+ALLEGRO_KCM_AUDIO_FUNC(bool, _al_kcm_feed_fragment, (ALLEGRO_AUDIO_STREAM *stream));
+ALLEGRO_KCM_AUDIO_FUNC(const _AL_KCM_SEEK_POINT *, _al_kcm_find_seek_point,
+   (ALLEGRO_AUDIO_STREAM *stream, uint64_t frame));
 
 
 typedef void (*postprocess_callback_t)(void *buf, unsigned int samples,
@@ -333,6 +536,21 @@ typedef void (*postprocess_callback_t)(void *buf, unsigned int samples,
  * will be set to a different function that will call the read method of all
  * attached streams (which may be a sample, or another mixer).
  */
+/* Commands for the mixer thread, see _al_kcm_mixer_post_command. */
+enum {
+   _AL_KCM_UPDATE_MATRIX,
+   _AL_KCM_UPDATE_STEP,
+   _AL_KCM_UPDATE_GAIN_RAMP,
+   _AL_KCM_UPDATE_PAN_RAMP
+};
+
+#define _AL_KCM_COMMAND_RING_SIZE 256
+
+typedef struct _AL_KCM_COMMAND {
+   ALLEGRO_SAMPLE_INSTANCE *spl;
+   int                     type;
+} _AL_KCM_COMMAND;
+
 struct ALLEGRO_MIXER {
    ALLEGRO_SAMPLE_INSTANCE          ss;
                            /* ALLEGRO_MIXER is derived from ALLEGRO_SAMPLE_INSTANCE. */
@@ -347,12 +565,42 @@ struct ALLEGRO_MIXER {
                             * streams being mixed together.
                             */
    _AL_LIST_ITEM           *dtor_item;
+
+   _AL_KCM_COMMAND         commands[_AL_KCM_COMMAND_RING_SIZE];
+   volatile _AL_ATOMIC     command_head;
+                           /* Next slot to write, only advanced by posters. */
+   volatile _AL_ATOMIC     command_tail;
+                           /* Next slot to run, only advanced while holding
+                            * the mixer mutex.
+                            */
+   ALLEGRO_MUTEX           *command_mutex;
+                           /* Serialises posters. Never taken by the mixer
+                            * thread.
+                            */
+
+   bool                    parallel;
+                           /* Render child mixers on worker threads. */
+   bool                    prerendered;
+                           /* The buffer was rendered by the parent already. */
+   bool                    audible;
+                           /* Something was mixed into the buffer the last
+                            * time it was rendered. Otherwise it is silent.
+                            */
+   ALLEGRO_MIXER           **parallel_children;
+   int                     parallel_size;
+   _AL_KCM_TIMING          timing;
+                           /* Updated by render_mixer. */
 };
 
 extern void _al_kcm_mixer_rejig_sample_matrix(ALLEGRO_MIXER *mixer,
    ALLEGRO_SAMPLE_INSTANCE *spl);
 extern void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
    ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc);
+extern void _al_kcm_mixer_rejig_sample_step(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl);
+extern void _al_kcm_mixer_post_command(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl, int type);
+extern void _al_kcm_mixer_run_commands(ALLEGRO_MIXER *mixer);
 
 
 typedef enum {
@@ -374,6 +622,22 @@ ALLEGRO_KCM_AUDIO_FUNC(void*, _al_kcm_feed_stream, (ALLEGRO_THREAD *self, void *
 
 /* Helper to emit an event that the stream has got a buffer ready to be refilled. */
 void _al_kcm_emit_stream_events(ALLEGRO_AUDIO_STREAM *stream);
+bool _al_kcm_stream_is_silent(const ALLEGRO_AUDIO_STREAM *stream, int frames);
+
+/* Shared feeder threads for streams created by al_load_audio_stream. */
+void _al_kcm_init_feeder_pool(void);
+void _al_kcm_shutdown_feeder_pool(void);
+ALLEGRO_KCM_AUDIO_FUNC(bool, _al_kcm_feeder_pool_add, (ALLEGRO_AUDIO_STREAM *stream));
+ALLEGRO_KCM_AUDIO_FUNC(void, _al_kcm_feeder_pool_remove, (ALLEGRO_AUDIO_STREAM *stream));
+
+/* Compressed files kept in memory for ALLEGRO_AUDIO_STREAM_IN_MEMORY. */
+void _al_kcm_init_stream_cache(void);
+void _al_kcm_shutdown_stream_cache(void);
+ALLEGRO_FILE *_al_kcm_open_cached_file(const char *filename);
+
+/* Feeding of such streams by al_render_voice, with the null driver. */
+ALLEGRO_KCM_AUDIO_FUNC(bool, _al_kcm_null_feeder_add, (ALLEGRO_AUDIO_STREAM *stream));
+ALLEGRO_KCM_AUDIO_FUNC(void, _al_kcm_null_feeder_remove, (ALLEGRO_AUDIO_STREAM *stream));
 
 void _al_kcm_init_destructors(void);
 void _al_kcm_shutdown_destructors(void);
@@ -384,6 +648,47 @@ void _al_kcm_foreach_destructor(
       void (*callback)(void *object, void (*func)(void *), void *udata),
       void *userdata);
 
+extern void (*_al_kcm_scale_f32)(float *p, size_t n, float gain);
+extern void (*_al_kcm_accumulate_f32)(float *dst, const float *src, size_t n);
+extern void (*_al_kcm_mix_frames_f32)(float *buf, const float *x0,
+   const float *x1, float t, size_t frames, size_t maxc, size_t dest_maxc,
+   const float *matrix);
+extern void (*_al_kcm_sinc_f32)(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc);
+void _al_kcm_init_mixer_simd(void);
+uint64_t _al_kcm_flush_denormals(void);
+void _al_kcm_restore_denormals(uint64_t state);
+
+/* Windowed sinc resampling. The filter length can be set between 8 and
+ * _AL_KCM_SINC_MAX_LENGTH taps. Mixers play samples at most
+ * _AL_KCM_SINC_MIXER_MAX_RATIO times faster than their own frequency with
+ * a low-pass filter matching the speed; beyond that they alias.
+ */
+#define _AL_KCM_SINC_MAX_LENGTH        64
+#define _AL_KCM_SINC_MIXER_MAX_RATIO   4
+#define _AL_KCM_SINC_MIXER_MAX_TAPS \
+   (_AL_KCM_SINC_MAX_LENGTH * _AL_KCM_SINC_MIXER_MAX_RATIO + 2)
+
+/* The filter for one output frame: taps source frames from `first' frames
+ * relative to the current one, weighted by c0, or by c0 and c1 interpolated
+ * by t if c1 is not NULL.
+ */
+typedef struct _AL_KCM_SINC_FILTER {
+   int first;
+   int taps;
+   const float *c0;
+   const float *c1;
+   float t;
+} _AL_KCM_SINC_FILTER;
+
+bool _al_kcm_init_sinc(void);
+void _al_kcm_shutdown_sinc(void);
+int _al_kcm_sinc_max_taps(float ratio);
+void _al_kcm_sinc_filter(_AL_KCM_SINC_FILTER *filter, float *coef,
+   float frac, float ratio);
+void _al_kcm_sample_frame_to_float(float *dst, const ALLEGRO_SAMPLE *spl,
+   int frame, int maxc);
+
 ALLEGRO_KCM_AUDIO_FUNC(void, _al_kcm_shutdown_default_mixer, (void));
 
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_CHANNEL_CONF, _al_count_to_channel_conf, (int num_channels));
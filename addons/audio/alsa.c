@@ -55,7 +55,20 @@ static _AL_LIST* output_device_list;
 // This value works well on my RPI3 and Linux machine.
 #define DEFAULT_BUFFER_SIZE 2048
 
-static unsigned int get_period_size(void)
+/* In low latency mode the buffer defaults to this many periods of this
+ * size, i.e. about 4 ms at 48 kHz.
+ */
+#define LOW_LATENCY_PERIOD_SIZE  64
+#define LOW_LATENCY_PERIODS      3
+
+static bool get_low_latency(void)
+{
+   const char *val = al_get_config_value(al_get_system_config(),
+      "alsa", "low_latency");
+   return val && (strcmp(val, "yes") == 0 || strcmp(val, "true") == 0);
+}
+
+static unsigned int get_period_size(bool low_latency)
 {
    const char *val = al_get_config_value(al_get_system_config(),
       "alsa", "buffer_size");
@@ -66,10 +79,11 @@ static unsigned int get_period_size(void)
       return n;
    }
 
-   return DEFAULT_PERIOD_SIZE;
+   return low_latency ? LOW_LATENCY_PERIOD_SIZE : DEFAULT_PERIOD_SIZE;
 }
 
-static snd_pcm_uframes_t get_buffer_size(void)
+static snd_pcm_uframes_t get_buffer_size(bool low_latency,
+   snd_pcm_uframes_t period_size)
 {
    const char *val = al_get_config_value(al_get_system_config(),
       "alsa", "buffer_size2");
@@ -80,13 +94,16 @@ static snd_pcm_uframes_t get_buffer_size(void)
       return n;
    }
 
-   return DEFAULT_BUFFER_SIZE;
+   return low_latency ? period_size * LOW_LATENCY_PERIODS
+      : DEFAULT_BUFFER_SIZE;
 }
 
 typedef struct ALSA_VOICE {
    unsigned int frame_size; /* in bytes */
    unsigned int len; /* in frames */
    snd_pcm_uframes_t frag_len; /* in frames */
+   snd_pcm_uframes_t buffer_len; /* in frames */
+   bool low_latency;
    bool reversed; /* true if playing reversed ATM. */
 
    volatile bool stop;
@@ -154,9 +171,12 @@ static void alsa_close(void)
 
 
 /* Underrun and suspend recovery */
-static int xrun_recovery(snd_pcm_t *handle, int err)
+static int xrun_recovery(ALLEGRO_VOICE *voice, int err)
 {
+   snd_pcm_t *handle = ((ALSA_VOICE *)voice->extra)->pcm_handle;
+
    if (err == -EPIPE) { /* under-run */
+      _al_kcm_voice_underrun(voice);
       err = snd_pcm_prepare(handle);
       if (err < 0) {
          ALLEGRO_ERROR("Can't recover from underrun, prepare failed: %s\n", snd_strerror(err));
@@ -242,13 +262,16 @@ static int alsa_update_nonstream_voice(ALLEGRO_VOICE *voice, void **buf, int *by
 }
 
 
-/* Returns true if the voice is ready for more data. */
-static int alsa_voice_is_ready(ALSA_VOICE *alsa_voice)
+/* Returns true if the voice is ready for more data. Waits up to timeout_ms
+ * milliseconds for it to become ready.
+ */
+static int alsa_voice_is_ready(ALLEGRO_VOICE *voice, int timeout_ms)
 {
+   ALSA_VOICE *alsa_voice = voice->extra;
    unsigned short revents;
    int err;
 
-   poll(alsa_voice->ufds, alsa_voice->ufds_count, 0);
+   poll(alsa_voice->ufds, alsa_voice->ufds_count, timeout_ms);
    snd_pcm_poll_descriptors_revents(alsa_voice->pcm_handle, alsa_voice->ufds,
                                     alsa_voice->ufds_count, &revents);
 
@@ -261,7 +284,7 @@ static int alsa_voice_is_ready(ALSA_VOICE *alsa_voice)
          else
             err = -ESTRPIPE;
 
-         if (xrun_recovery(alsa_voice->pcm_handle, err) < 0) {
+         if (xrun_recovery(voice, err) < 0) {
             ALLEGRO_ERROR("Write error: %s\n", snd_strerror(err));
             return -POLLERR;
          }
@@ -295,6 +318,9 @@ static void *alsa_update_mmap(ALLEGRO_THREAD *self, void *arg)
 
    ALLEGRO_INFO("ALSA update_mmap thread started\n");
 
+   _al_kcm_raise_audio_thread(self, "al-audio-alsa",
+      alsa_voice->low_latency);
+
    while (!al_get_thread_should_stop(self)) {
       if (alsa_voice->stop && !alsa_voice->stopped) {
          snd_pcm_drop(alsa_voice->pcm_handle);
@@ -334,11 +360,15 @@ static void *alsa_update_mmap(ALLEGRO_THREAD *self, void *arg)
          ALLEGRO_DEBUG("snd_pcm_start returned: %d\n", rc);
       }
 
-      ret = alsa_voice_is_ready(alsa_voice);
+      /* In low latency mode a whole 5 ms sleep can be longer than the
+       * buffer, so wait on the device itself instead.
+       */
+      ret = alsa_voice_is_ready(voice, alsa_voice->low_latency ? 5 : 0);
       if (ret < 0)
          break;
       if (ret == 0) {
-         al_rest(0.005); /* TODO: Why not use an event or condition variable? */
+         if (!alsa_voice->low_latency)
+            al_rest(0.005); /* TODO: Why not use an event or condition variable? */
          continue;
       }
 
@@ -346,7 +376,7 @@ static void *alsa_update_mmap(ALLEGRO_THREAD *self, void *arg)
       frames = alsa_voice->frag_len;
       ret = snd_pcm_mmap_begin(alsa_voice->pcm_handle, &areas, &offset, &frames);
       if (ret < 0) {
-         if ((ret = xrun_recovery(alsa_voice->pcm_handle, ret)) < 0) {
+         if ((ret = xrun_recovery(voice, ret)) < 0) {
             ALLEGRO_ERROR("MMAP begin avail error: %s\n", snd_strerror(ret));
          }
          break;
@@ -399,7 +429,7 @@ silence:
 commit:
       commitres = snd_pcm_mmap_commit(alsa_voice->pcm_handle, offset, frames);
       if (commitres < 0 || (snd_pcm_uframes_t)commitres != frames) {
-         if ((ret = xrun_recovery(alsa_voice->pcm_handle, commitres >= 0 ? -EPIPE : commitres)) < 0) {
+         if ((ret = xrun_recovery(voice, commitres >= 0 ? -EPIPE : commitres)) < 0) {
             ALLEGRO_ERROR("MMAP commit error: %s\n", snd_strerror(ret));
             break;
          }
@@ -423,6 +453,9 @@ static void *alsa_update_rw(ALLEGRO_THREAD *self, void *arg)
 
    ALLEGRO_INFO("ALSA update_rw thread started\n");
 
+   _al_kcm_raise_audio_thread(self, "al-audio-alsa",
+      alsa_voice->low_latency);
+
    while (!al_get_thread_should_stop(self)) {
       if (alsa_voice->stop && !alsa_voice->stopped) {
          snd_pcm_drop(alsa_voice->pcm_handle);
@@ -466,6 +499,7 @@ static void *alsa_update_rw(ALLEGRO_THREAD *self, void *arg)
       err = snd_pcm_avail_update(alsa_voice->pcm_handle);
       if (err < 0) {
          if (err == -EPIPE) {
+            _al_kcm_voice_underrun(voice);
             snd_pcm_prepare(alsa_voice->pcm_handle);
          }
          else {
@@ -506,6 +540,7 @@ silence:
       err = snd_pcm_writei(alsa_voice->pcm_handle, buf, frames);
       if (err < 0) {
          if (err == -EPIPE) {
+            _al_kcm_voice_underrun(voice);
             snd_pcm_prepare(alsa_voice->pcm_handle);
          }
       }
@@ -593,6 +628,15 @@ static bool alsa_voice_is_playing(const ALLEGRO_VOICE *voice)
 }
 
 
+/* The get_voice_latency method returns how much audio, in seconds, the
+   hardware buffer holds. */
+static double alsa_get_voice_latency(const ALLEGRO_VOICE *voice)
+{
+   ALSA_VOICE *ex_data = voice->extra;
+   return (double)ex_data->buffer_len / voice->frequency;
+}
+
+
 /* The allocate_voice method should grab a voice from the system, and allocate
    any data common to streaming and non-streaming sources. */
 static int alsa_allocate_voice(ALLEGRO_VOICE *voice)
@@ -614,7 +658,8 @@ static int alsa_allocate_voice(ALLEGRO_VOICE *voice)
    ex_data->stopped = true;
    ex_data->reversed = false;
 
-   ex_data->frag_len = get_period_size();
+   ex_data->low_latency = get_low_latency();
+   ex_data->frag_len = get_period_size(ex_data->low_latency);
 
    if (voice->depth == ALLEGRO_AUDIO_DEPTH_INT8)
       format = SND_PCM_FORMAT_S8;
@@ -656,10 +701,17 @@ static int alsa_allocate_voice(ALLEGRO_VOICE *voice)
    ALSA_CHECK(snd_pcm_hw_params_set_channels(ex_data->pcm_handle, hwparams, chan_count));
    ALSA_CHECK(snd_pcm_hw_params_set_rate_near(ex_data->pcm_handle, hwparams, &req_freq, NULL));
    ALSA_CHECK(snd_pcm_hw_params_set_period_size_near(ex_data->pcm_handle, hwparams, &ex_data->frag_len, NULL));
-   snd_pcm_uframes_t buffer_size = get_buffer_size();
+   snd_pcm_uframes_t buffer_size = get_buffer_size(ex_data->low_latency, ex_data->frag_len);
    ALSA_CHECK(snd_pcm_hw_params_set_buffer_size_near(ex_data->pcm_handle, hwparams, &buffer_size));
    ALSA_CHECK(snd_pcm_hw_params(ex_data->pcm_handle, hwparams));
 
+   /* The _near calls may have given us something else than we asked for. */
+   ALSA_CHECK(snd_pcm_hw_params_get_period_size(hwparams, &ex_data->frag_len, NULL));
+   ALSA_CHECK(snd_pcm_hw_params_get_buffer_size(hwparams, &ex_data->buffer_len));
+   ALLEGRO_INFO("Period size %lu, buffer size %lu frames (%.1f ms latency).\n",
+      (unsigned long)ex_data->frag_len, (unsigned long)ex_data->buffer_len,
+      1000.0 * ex_data->buffer_len / req_freq);
+
    if (voice->frequency != req_freq) {
       ALLEGRO_ERROR("Unsupported rate! Requested %u, got %iu.\n", voice->frequency, req_freq);
       goto Error;
@@ -754,10 +806,11 @@ static void *alsa_update_recorder(ALLEGRO_THREAD *t, void *thread_data)
 {
    ALLEGRO_AUDIO_RECORDER *r = thread_data;
    ALSA_RECORDER_DATA *alsa = r->extra;
-   ALLEGRO_EVENT user_event;
    uint8_t *null_buffer;
    unsigned int fragment_i = 0;
    
+   _al_kcm_raise_audio_thread(t, "al-audio-rec", get_low_latency());
+
    null_buffer = al_malloc(1024 * r->sample_size);
    if (!null_buffer) {
       ALLEGRO_ERROR("Unable to create buffer for draining ALSA.\n");
@@ -777,15 +830,10 @@ static void *alsa_update_recorder(ALLEGRO_THREAD *t, void *thread_data)
          snd_pcm_readi(alsa->capture_handle, null_buffer, 1024);
       }
       else {
-         ALLEGRO_AUDIO_RECORDER_EVENT *e;
          snd_pcm_sframes_t count;
          al_unlock_mutex(r->mutex);
          if ((count = snd_pcm_readi(alsa->capture_handle, r->fragments[fragment_i], r->samples)) > 0) {
-            user_event.user.type = ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT;
-            e = al_get_audio_recorder_event(&user_event);
-            e->buffer = r->fragments[fragment_i];
-            e->samples = count;
-            al_emit_user_event(&r->source, &user_event, NULL);
+            _al_kcm_emit_recorder_fragment(r, r->fragments[fragment_i], count);
          
             if (++fragment_i == r->fragment_count) {
                fragment_i = 0;
@@ -1021,7 +1069,9 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_alsa_driver =
    alsa_allocate_recorder,
    alsa_deallocate_recorder,
 
-   alsa_get_output_devices
+   alsa_get_output_devices,
+
+   alsa_get_voice_latency
 };
 
 /* vim: set sts=3 sw=3 et: */
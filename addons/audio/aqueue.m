@@ -562,13 +562,8 @@ static void _aqueue_recording_callback(void *user_data, AudioQueueRef aq,
          ALLEGRO_ASSERT(recorder->samples >= data->samples_written);
          
          if (data->samples_written == recorder->samples) {
-            ALLEGRO_EVENT user_event;
-            ALLEGRO_AUDIO_RECORDER_EVENT *e;
-            user_event.user.type = ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT;
-            e = al_get_audio_recorder_event(&user_event);
-            e->buffer = recorder->fragments[data->fragment_i];
-            e->samples = recorder->samples;
-            al_emit_user_event(&recorder->source, &user_event, NULL);
+            _al_kcm_emit_recorder_fragment(recorder,
+               recorder->fragments[data->fragment_i], recorder->samples);
             
             if (++data->fragment_i == recorder->fragment_count) {
                data->fragment_i = 0;
@@ -687,5 +682,7 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_aqueue_driver = {
    _aqueue_deallocate_recorder,
 
    _aqueue_get_output_devices,
+
+   NULL,
 };
 
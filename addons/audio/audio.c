@@ -31,6 +31,9 @@ ALLEGRO_AUDIO_DRIVER *_al_kcm_driver = NULL;
 #if defined(ALLEGRO_CFG_KCM_OPENSL)
    extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_opensl_driver;
 #endif
+#if defined(ALLEGRO_CFG_KCM_AAUDIO)
+   extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_aaudio_driver;
+#endif
 #if defined(ALLEGRO_CFG_KCM_ALSA)
    extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_alsa_driver;
 #endif
@@ -40,6 +43,9 @@ ALLEGRO_AUDIO_DRIVER *_al_kcm_driver = NULL;
 #if defined(ALLEGRO_CFG_KCM_DSOUND)
    extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_dsound_driver;
 #endif
+#if defined(ALLEGRO_CFG_KCM_WASAPI)
+   extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_wasapi_driver;
+#endif
 #if defined(ALLEGRO_CFG_KCM_AQUEUE)
    extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_aqueue_driver;
 #endif
@@ -49,6 +55,7 @@ ALLEGRO_AUDIO_DRIVER *_al_kcm_driver = NULL;
 #if defined(ALLEGRO_SDL)
    extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_sdl_driver;
 #endif
+extern struct ALLEGRO_AUDIO_DRIVER _al_kcm_null_driver;
 
 /* Channel configuration helpers */
 
@@ -184,6 +191,9 @@ static ALLEGRO_AUDIO_DRIVER_ENUM get_config_audio_driver(void)
    if (0 == _al_stricmp(value, "OPENSL"))
       return ALLEGRO_AUDIO_DRIVER_OPENSL;
 
+   if (0 == _al_stricmp(value, "AAUDIO"))
+      return ALLEGRO_AUDIO_DRIVER_AAUDIO;
+
    if (0 == _al_stricmp(value, "OSS"))
       return ALLEGRO_AUDIO_DRIVER_OSS;
 
@@ -193,6 +203,12 @@ static ALLEGRO_AUDIO_DRIVER_ENUM get_config_audio_driver(void)
    if (0 == _al_stricmp(value, "DSOUND") || 0 == _al_stricmp(value, "DIRECTSOUND"))
       return ALLEGRO_AUDIO_DRIVER_DSOUND;
 
+   if (0 == _al_stricmp(value, "WASAPI"))
+      return ALLEGRO_AUDIO_DRIVER_WASAPI;
+
+   if (0 == _al_stricmp(value, "NULL"))
+      return ALLEGRO_AUDIO_DRIVER_NULL;
+
    return ALLEGRO_AUDIO_DRIVER_AUTODETECT;
 }
 
@@ -282,6 +298,14 @@ static bool do_install_audio(ALLEGRO_AUDIO_DRIVER_ENUM mode)
          if (retVal)
             return retVal;
 #endif
+/* WASAPI has much lower latency than DirectSound, which is emulated on top
+ * of it since Windows Vista.
+ */
+#if defined(ALLEGRO_CFG_KCM_WASAPI)
+         retVal = do_install_audio(ALLEGRO_AUDIO_DRIVER_WASAPI);
+         if (retVal)
+            return retVal;
+#endif
 #if defined(ALLEGRO_CFG_KCM_DSOUND)
          retVal = do_install_audio(ALLEGRO_AUDIO_DRIVER_DSOUND);
          if (retVal)
@@ -297,6 +321,12 @@ static bool do_install_audio(ALLEGRO_AUDIO_DRIVER_ENUM mode)
          if (retVal)
             return retVal;
 #endif
+/* AAudio is only there since Android 8.0, OpenSL covers older versions. */
+#if defined(ALLEGRO_CFG_KCM_AAUDIO)
+         retVal = do_install_audio(ALLEGRO_AUDIO_DRIVER_AAUDIO);
+         if (retVal)
+            return retVal;
+#endif
 #if defined(ALLEGRO_CFG_KCM_OPENSL)
          retVal = do_install_audio(ALLEGRO_AUDIO_DRIVER_OPENSL);
          if (retVal)
@@ -346,6 +376,19 @@ static bool do_install_audio(ALLEGRO_AUDIO_DRIVER_ENUM mode)
             return false;
          #endif
 
+      case ALLEGRO_AUDIO_DRIVER_AAUDIO:
+         #if defined(ALLEGRO_CFG_KCM_AAUDIO)
+            if (_al_kcm_aaudio_driver.open() == 0) {
+               ALLEGRO_INFO("Using AAudio driver\n");
+               _al_kcm_driver = &_al_kcm_aaudio_driver;
+               return true;
+            }
+            return false;
+         #else
+            _al_set_error(ALLEGRO_INVALID_PARAM, "AAudio not available on this platform");
+            return false;
+         #endif
+
       case ALLEGRO_AUDIO_DRIVER_ALSA:
          #if defined(ALLEGRO_CFG_KCM_ALSA)
             if (_al_kcm_alsa_driver.open() == 0) {
@@ -398,6 +441,19 @@ static bool do_install_audio(ALLEGRO_AUDIO_DRIVER_ENUM mode)
             return false;
          #endif
 
+      case ALLEGRO_AUDIO_DRIVER_WASAPI:
+         #if defined(ALLEGRO_CFG_KCM_WASAPI)
+            if (_al_kcm_wasapi_driver.open() == 0) {
+               ALLEGRO_INFO("Using WASAPI driver\n");
+               _al_kcm_driver = &_al_kcm_wasapi_driver;
+               return true;
+            }
+            return false;
+         #else
+            _al_set_error(ALLEGRO_INVALID_PARAM, "WASAPI not available on this platform");
+            return false;
+         #endif
+
       case ALLEGRO_AUDIO_DRIVER_SDL:
          #if defined(ALLEGRO_SDL)
             if (_al_kcm_sdl_driver.open() == 0) {
@@ -411,6 +467,15 @@ static bool do_install_audio(ALLEGRO_AUDIO_DRIVER_ENUM mode)
             return false;
          #endif
 
+      /* Never autodetected, as it produces no sound by itself. */
+      case ALLEGRO_AUDIO_DRIVER_NULL:
+         if (_al_kcm_null_driver.open() == 0) {
+            ALLEGRO_INFO("Using null driver\n");
+            _al_kcm_driver = &_al_kcm_null_driver;
+            return true;
+         }
+         return false;
+
       default:
          _al_set_error(ALLEGRO_INVALID_PARAM, "Invalid audio driver");
          return false;
@@ -430,6 +495,10 @@ bool al_install_audio(void)
     * because the user may still create samples.
     */
    _al_kcm_init_destructors();
+   _al_kcm_init_instance_pool();
+   _al_kcm_init_mixer_simd();
+   _al_kcm_init_feeder_pool();
+   _al_kcm_init_stream_cache();
    _al_add_exit_func(al_uninstall_audio, "al_uninstall_audio");
 
    ret = do_install_audio(ALLEGRO_AUDIO_DRIVER_AUTODETECT);
@@ -440,6 +509,8 @@ bool al_install_audio(void)
  */
 void al_uninstall_audio(void)
 {
+   _al_kcm_shutdown_feeder_pool();
+
    if (_al_kcm_driver) {
       _al_kcm_shutdown_default_mixer();
       _al_kcm_shutdown_destructors();
@@ -449,6 +520,10 @@ void al_uninstall_audio(void)
    else {
       _al_kcm_shutdown_destructors();
    }
+   _al_kcm_shutdown_instance_pool();
+   _al_kcm_shutdown_stream_cache();
+
+   _al_kcm_shutdown_sinc();
 }
 
 /* Function: al_is_audio_installed
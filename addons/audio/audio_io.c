@@ -2,11 +2,14 @@
  * Allegro audio codec table.
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_audio.h"
 #include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_extmap.h"
 #include "allegro5/internal/aintern_vector.h"
 
 ALLEGRO_DEBUG_CHANNEL("audio")
@@ -35,6 +38,7 @@ struct ACODEC_TABLE
 /* globals */
 static bool acodec_inited = false;
 static _AL_VECTOR acodec_table = _AL_VECTOR_INITIALIZER(ACODEC_TABLE);
+static _AL_EXTMAP acodec_map = _AL_EXTMAP_INITIALIZER;
 static ALLEGRO_AUDIO_STREAM *global_stream;
 
 
@@ -42,6 +46,7 @@ static void acodec_shutdown(void)
 {
    if (acodec_inited) {
       _al_vector_free(&acodec_table);
+      _al_extmap_free(&acodec_map);
       acodec_inited = false;
    }
    al_destroy_audio_stream(global_stream);
@@ -50,36 +55,47 @@ static void acodec_shutdown(void)
 
 static ACODEC_TABLE *find_acodec_table_entry(const char *ext)
 {
-   ACODEC_TABLE *ent;
-   unsigned i;
+   int i = _al_extmap_find(&acodec_map, ext);
 
-   for (i = 0; i < _al_vector_size(&acodec_table); i++) {
-      ent = _al_vector_ref(&acodec_table, i);
-      if (0 == _al_stricmp(ent->ext, ext)) {
-         return ent;
-      }
-   }
-
-   return NULL;
+   if (i < 0)
+      return NULL;
+   return _al_vector_ref(&acodec_table, i);
 }
 
 
 static ACODEC_TABLE *find_acodec_table_entry_for_file(ALLEGRO_FILE *f)
 {
    ACODEC_TABLE *ent;
+   ACODEC_TABLE *found = NULL;
+   ALLEGRO_FILE *buffered = NULL;
+   int64_t pos;
+   void *base;
+   int64_t size;
    unsigned i;
 
+   /* The identifiers all read the start of the file. */
+   pos = al_ftell(f);
+   if (pos >= 0 && !al_get_file_mapping(f, &base, &size))
+      buffered = al_fopen_buffered(f, 4096);
+
    for (i = 0; i < _al_vector_size(&acodec_table); i++) {
       ent = _al_vector_ref(&acodec_table, i);
       if (ent->identifier) {
-         int64_t pos = al_ftell(f);
-         bool identified = ent->identifier(f);
-         al_fseek(f, pos, ALLEGRO_SEEK_SET);
-         if (identified)
-            return ent;
+         ALLEGRO_FILE *fp = buffered ? buffered : f;
+         bool identified = ent->identifier(fp);
+         al_fseek(fp, pos, ALLEGRO_SEEK_SET);
+         if (identified) {
+            found = ent;
+            break;
+         }
       }
    }
-   return NULL;
+
+   if (buffered) {
+      al_fclose(buffered);
+      al_fseek(f, pos, ALLEGRO_SEEK_SET);
+   }
+   return found;
 }
 
 
@@ -94,6 +110,8 @@ static ACODEC_TABLE *add_acodec_table_entry(const char *ext)
       _al_add_exit_func(acodec_shutdown, "acodec_shutdown");
    }
 
+   if (!_al_extmap_insert(&acodec_map, ext, _al_vector_size(&acodec_table)))
+      return NULL;
    ent = _al_vector_alloc_back(&acodec_table);
    strcpy(ent->ext, ext);
    ent->loader = NULL;
@@ -129,6 +147,8 @@ bool al_register_sample_loader(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->loader = loader;
@@ -156,6 +176,8 @@ bool al_register_sample_loader_f(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->fs_loader = loader;
@@ -183,6 +205,8 @@ bool al_register_sample_saver(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->saver = saver;
@@ -210,6 +234,8 @@ bool al_register_sample_saver_f(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->fs_saver = saver;
@@ -238,6 +264,8 @@ bool al_register_audio_stream_loader(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->stream_loader = stream_loader;
@@ -266,6 +294,8 @@ bool al_register_audio_stream_loader_f(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->fs_stream_loader = stream_loader;
@@ -293,6 +323,8 @@ bool al_register_sample_identifier(const char *ext,
    }
    else if (!ent) {
       ent = add_acodec_table_entry(ext);
+      if (!ent)
+         return false;
    }
 
    ent->identifier = identifier;
@@ -383,6 +415,43 @@ ALLEGRO_AUDIO_STREAM *al_load_audio_stream(const char *filename,
 }
 
 
+/* Function: al_load_audio_stream_flags
+ */
+ALLEGRO_AUDIO_STREAM *al_load_audio_stream_flags(const char *filename,
+   size_t buffer_count, unsigned int samples, int flags)
+{
+   ALLEGRO_AUDIO_STREAM *stream;
+   ALLEGRO_FILE *fp;
+   const char *ext;
+
+   ASSERT(filename);
+
+   if (!(flags & ALLEGRO_AUDIO_STREAM_IN_MEMORY))
+      return al_load_audio_stream(filename, buffer_count, samples);
+
+   fp = _al_kcm_open_cached_file(filename);
+   if (!fp) {
+      ALLEGRO_INFO("Streaming %s from the file system.\n", filename);
+      return al_load_audio_stream(filename, buffer_count, samples);
+   }
+
+   ext = al_identify_sample_f(fp);
+   if (!ext) {
+      ext = strrchr(filename, '.');
+      if (ext == NULL) {
+         ALLEGRO_ERROR("Unable to determine extension for %s.\n", filename);
+         al_fclose(fp);
+         return NULL;
+      }
+   }
+
+   stream = al_load_audio_stream_f(fp, ext, buffer_count, samples);
+   if (!stream)
+      al_fclose(fp);
+   return stream;
+}
+
+
 /* Function: al_load_audio_stream_f
  */
 ALLEGRO_AUDIO_STREAM *al_load_audio_stream_f(ALLEGRO_FILE* fp, const char *ident,
@@ -466,6 +535,11 @@ bool al_save_sample(const char *filename, ALLEGRO_SAMPLE *spl)
       return false;
    }
 
+   if (spl->compressed) {
+      ALLEGRO_ERROR("Compressed samples cannot be saved.\n");
+      return false;
+   }
+
    ent = find_acodec_table_entry(ext);
    if (ent && ent->saver) {
       return (ent->saver)(filename, spl);
@@ -487,7 +561,12 @@ bool al_save_sample_f(ALLEGRO_FILE *fp, const char *ident, ALLEGRO_SAMPLE *spl)
 
    ASSERT(fp);
    ASSERT(ident);
-   
+
+   if (spl->compressed) {
+      ALLEGRO_ERROR("Compressed samples cannot be saved.\n");
+      return false;
+   }
+
    ent = find_acodec_table_entry(ident);
    if (ent && ent->fs_saver) {
       return (ent->fs_saver)(fp, spl);
@@ -169,7 +169,8 @@ static void* _dsound_update(ALLEGRO_THREAD *self, void *arg)
    unsigned char *data;
    unsigned char *silence;
    HRESULT hr;
-   (void)self;
+
+   _al_kcm_raise_audio_thread(self, "al-audio-dsound");
 
    /* Make a buffer full of silence. */
    silence = (unsigned char *)al_malloc(buffer_size);
@@ -644,7 +645,6 @@ static void *_dsound_update_recorder(ALLEGRO_THREAD *t, void *data)
    ALLEGRO_AUDIO_RECORDER *r = (ALLEGRO_AUDIO_RECORDER *) data;
    DSOUND_RECORD_DATA *extra = (DSOUND_RECORD_DATA *) r->extra;
    DWORD last_read_pos = 0;
-   ALLEGRO_EVENT user_event;
    bool is_dsound_recording = false;
 
    size_t fragment_i = 0;
@@ -652,6 +652,8 @@ static void *_dsound_update_recorder(ALLEGRO_THREAD *t, void *data)
 
    ALLEGRO_INFO("Starting recorder thread\n");
 
+   _al_kcm_raise_audio_thread(t, "al-audio-rec");
+
    while (!al_get_thread_should_stop(t)) {
       al_lock_mutex(r->mutex);
       while (!r->is_recording) {
@@ -700,18 +702,14 @@ static void *_dsound_update_recorder(ALLEGRO_THREAD *t, void *data)
                buffer_size = 0;
             }
             else {
-               ALLEGRO_AUDIO_RECORDER_EVENT *e;
                size_t bytes_to_write = r->fragment_size - bytes_written;
                memcpy((uint8_t*) r->fragments[fragment_i] + bytes_written, buffer, bytes_to_write);
 
                buffer_size -= bytes_to_write;
                buffer += bytes_to_write;
 
-               user_event.user.type = ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT;
-               e = al_get_audio_recorder_event(&user_event);
-               e->buffer = r->fragments[fragment_i];
-               e->samples = r->samples;
-               al_emit_user_event(&r->source, &user_event, NULL);
+               _al_kcm_emit_recorder_fragment(r, r->fragments[fragment_i],
+                  r->samples);
 
                /* advance to the next fragment */
                if (++fragment_i == r->fragment_count) {
@@ -879,6 +877,8 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_dsound_driver = {
    _dsound_close_recorder,
 
    _dsound_get_output_devices,
+
+   NULL,
 };
 
 } /* End extern "C" */
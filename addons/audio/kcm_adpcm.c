@@ -0,0 +1,328 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Samples kept IMA-ADPCM compressed in memory.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+static const int16_t step_table[89] = {
+   7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+   19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+   50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+   130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+   337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+   876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+   2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+   5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+   15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t index_table[16] = {
+   -1, -1, -1, -1, 2, 4, 6, 8,
+   -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+
+/* Applies one nibble to the predictor and step index. The encoder calls this
+ * too, so that it tracks exactly what the decoder will produce.
+ */
+static INLINE void decode_nibble(int nibble, int *predictor, int *index)
+{
+   int step = step_table[*index];
+   int diff = step >> 3;
+
+   if (nibble & 4)
+      diff += step;
+   if (nibble & 2)
+      diff += step >> 1;
+   if (nibble & 1)
+      diff += step >> 2;
+
+   if (nibble & 8)
+      *predictor -= diff;
+   else
+      *predictor += diff;
+
+   if (*predictor > 32767)
+      *predictor = 32767;
+   else if (*predictor < -32768)
+      *predictor = -32768;
+
+   *index += index_table[nibble];
+   if (*index < 0)
+      *index = 0;
+   else if (*index > 88)
+      *index = 88;
+}
+
+
+static int encode_nibble(int value, int predictor, int index)
+{
+   int step = step_table[index];
+   int diff = value - predictor;
+   int nibble = 0;
+
+   if (diff < 0) {
+      nibble = 8;
+      diff = -diff;
+   }
+   if (diff >= step) {
+      nibble |= 4;
+      diff -= step;
+   }
+   step >>= 1;
+   if (diff >= step) {
+      nibble |= 2;
+      diff -= step;
+   }
+   step >>= 1;
+   if (diff >= step)
+      nibble |= 1;
+
+   return nibble;
+}
+
+
+/* _al_kcm_decode_adpcm_block:
+ *  Decodes one block of a compressed sample into interleaved 16-bit frames.
+ */
+void _al_kcm_decode_adpcm_block(const ALLEGRO_SAMPLE *spl, int block,
+   int16_t *frames)
+{
+   const int channels = al_get_channel_count(spl->chan_conf);
+   const uint8_t *data = spl->buffer.u8 +
+      (size_t)block * channels * _AL_KCM_ADPCM_BLOCK_BYTES;
+   int c, i;
+
+   for (c = 0; c < channels; c++) {
+      const uint8_t *p = data + c * _AL_KCM_ADPCM_BLOCK_BYTES;
+      int predictor = (int16_t)(p[0] | (p[1] << 8));
+      int index = p[2];
+      int16_t *out = frames + c;
+
+      *out = predictor;
+      out += channels;
+      p += 4;
+
+      for (i = 1; i < _AL_KCM_ADPCM_BLOCK_FRAMES; i += 2) {
+         decode_nibble(*p & 15, &predictor, &index);
+         *out = predictor;
+         out += channels;
+         decode_nibble(*p >> 4, &predictor, &index);
+         *out = predictor;
+         out += channels;
+         p++;
+      }
+   }
+}
+
+
+/* Returns sample value i of a PCM sample as a 16-bit value, converting the
+ * same way the 16-bit mixer does.
+ */
+static int sample_value16(const ALLEGRO_SAMPLE *spl, int i)
+{
+   switch (spl->depth) {
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32: {
+         float f = spl->buffer.f32[i];
+         if (f > 1.0f)
+            f = 1.0f;
+         else if (f < -1.0f)
+            f = -1.0f;
+         return (int16_t)(f * 0x7FFF);
+      }
+      case ALLEGRO_AUDIO_DEPTH_INT24:
+         return (int16_t)(spl->buffer.s24[i] >> 9);
+      case ALLEGRO_AUDIO_DEPTH_UINT24:
+         return (int16_t)((spl->buffer.u24[i] - 0x800000) >> 9);
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         return spl->buffer.s16[i];
+      case ALLEGRO_AUDIO_DEPTH_UINT16:
+         return (int16_t)(spl->buffer.u16[i] - 0x8000);
+      case ALLEGRO_AUDIO_DEPTH_INT8:
+         return (int16_t)spl->buffer.s8[i] << 7;
+      case ALLEGRO_AUDIO_DEPTH_UINT8:
+         return (int16_t)(spl->buffer.u8[i] - 0x80) << 7;
+   }
+   ASSERT(false);
+   return 0;
+}
+
+
+/* Frames past the end of the sample repeat the last one. */
+static int frame_value16(const ALLEGRO_SAMPLE *spl, int frame, int c,
+   int channels)
+{
+   if (frame >= spl->len)
+      frame = spl->len - 1;
+   if (frame < 0)
+      return 0;
+   return sample_value16(spl, frame * channels + c);
+}
+
+
+/* Function: al_create_compressed_sample
+ */
+ALLEGRO_SAMPLE *al_create_compressed_sample(const ALLEGRO_SAMPLE *spl)
+{
+   ALLEGRO_SAMPLE *cspl;
+   int channels;
+   int num_blocks;
+   int index[ALLEGRO_MAX_CHANNELS] = {0};
+   uint8_t *data;
+   uint8_t *p;
+   int b, c, i;
+
+   ASSERT(spl);
+
+   if (spl->compressed) {
+      _al_set_error(ALLEGRO_INVALID_PARAM, "Sample is already compressed");
+      return NULL;
+   }
+
+   channels = al_get_channel_count(spl->chan_conf);
+   num_blocks = (spl->len + _AL_KCM_ADPCM_BLOCK_FRAMES - 1) /
+      _AL_KCM_ADPCM_BLOCK_FRAMES;
+   if (num_blocks == 0)
+      num_blocks = 1;
+
+   data = al_malloc((size_t)num_blocks * channels * _AL_KCM_ADPCM_BLOCK_BYTES);
+   if (!data) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating compressed sample data");
+      return NULL;
+   }
+
+   p = data;
+   for (b = 0; b < num_blocks; b++) {
+      const int first = b * _AL_KCM_ADPCM_BLOCK_FRAMES;
+
+      for (c = 0; c < channels; c++) {
+         int predictor = frame_value16(spl, first, c, channels);
+
+         /* The step index carries on from the previous block, so the
+          * encoder does not have to adapt again at every block.
+          */
+         p[0] = predictor & 0xFF;
+         p[1] = (predictor >> 8) & 0xFF;
+         p[2] = index[c];
+         p[3] = 0;
+         p += 4;
+
+         for (i = 1; i < _AL_KCM_ADPCM_BLOCK_FRAMES; i += 2) {
+            int lo = encode_nibble(frame_value16(spl, first + i, c, channels),
+               predictor, index[c]);
+            int hi;
+            decode_nibble(lo, &predictor, &index[c]);
+            hi = encode_nibble(frame_value16(spl, first + i + 1, c, channels),
+               predictor, index[c]);
+            decode_nibble(hi, &predictor, &index[c]);
+            *p++ = lo | (hi << 4);
+         }
+      }
+   }
+
+   cspl = al_create_sample(data, spl->len, spl->frequency,
+      ALLEGRO_AUDIO_DEPTH_INT16, spl->chan_conf, true);
+   if (!cspl) {
+      al_free(data);
+      return NULL;
+   }
+   cspl->compressed = true;
+
+   ALLEGRO_DEBUG("Compressed %d frames into %d blocks.\n", spl->len,
+      num_blocks);
+
+   return cspl;
+}
+
+
+/* Function: al_is_sample_compressed
+ */
+bool al_is_sample_compressed(const ALLEGRO_SAMPLE *spl)
+{
+   ASSERT(spl);
+
+   return spl->compressed;
+}
+
+
+/* _al_kcm_prepare_decode_cache:
+ *  Gives the instance an empty decode cache if its sample is compressed, or
+ *  frees it if not.
+ */
+bool _al_kcm_prepare_decode_cache(ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   _AL_KCM_DECODE_CACHE *cache = spl->decode_cache;
+   int channels;
+   int i;
+
+   if (!spl->spl_data.compressed || !spl->spl_data.buffer.ptr) {
+      _al_kcm_free_decode_cache(spl);
+      return true;
+   }
+
+   channels = al_get_channel_count(spl->spl_data.chan_conf);
+
+   if (cache && cache->channels != channels) {
+      _al_kcm_free_decode_cache(spl);
+      cache = NULL;
+   }
+
+   if (!cache) {
+      cache = al_calloc(1, sizeof *cache);
+      if (!cache)
+         goto Error;
+      cache->channels = channels;
+      cache->frames = al_malloc(sizeof(int16_t) * channels *
+         _AL_KCM_ADPCM_BLOCK_FRAMES * _AL_KCM_DECODE_CACHE_SLOTS);
+      if (!cache->frames) {
+         al_free(cache);
+         goto Error;
+      }
+      spl->decode_cache = cache;
+   }
+
+   for (i = 0; i < _AL_KCM_DECODE_CACHE_SLOTS; i++)
+      cache->block[i] = -1;
+
+   return true;
+
+Error:
+   _al_set_error(ALLEGRO_GENERIC_ERROR,
+      "Out of memory allocating sample decode cache");
+   return false;
+}
+
+
+/* _al_kcm_free_decode_cache:
+ *  Frees the instance's decode cache, if it has one.
+ */
+void _al_kcm_free_decode_cache(ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   if (spl->decode_cache) {
+      al_free(spl->decode_cache->frames);
+      al_free(spl->decode_cache);
+      spl->decode_cache = NULL;
+   }
+}
+
+
+/* vim: set sts=3 sw=3 et: */
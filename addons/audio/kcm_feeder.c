@@ -0,0 +1,327 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Shared feeder threads for streams loaded from files.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+/* By default every stream created by al_load_audio_stream gets a thread of
+ * its own. If the stream_feeder_threads config key is set, that many
+ * threads are shared by all such streams instead. The streams' fragment
+ * events all go into one queue; a worker marks the streams they came from
+ * as pending and then refills the pending stream with the least audio
+ * queued, one fragment at a time.
+ */
+typedef struct FEEDER_POOL {
+   ALLEGRO_MUTEX *mutex;
+   ALLEGRO_COND *cond;           /* Signalled when a stream stops being fed. */
+   ALLEGRO_EVENT_QUEUE *queue;
+   ALLEGRO_EVENT_SOURCE quit_es;
+   _AL_VECTOR streams;           /* ALLEGRO_AUDIO_STREAM * */
+   ALLEGRO_THREAD **threads;
+   int num_threads;
+   bool quit;
+} FEEDER_POOL;
+
+static FEEDER_POOL *pool = NULL;
+
+
+static int find_stream(ALLEGRO_AUDIO_STREAM *stream)
+{
+   unsigned i;
+
+   for (i = 0; i < _al_vector_size(&pool->streams); i++) {
+      ALLEGRO_AUDIO_STREAM **slot = _al_vector_ref(&pool->streams, i);
+      if (*slot == stream)
+         return i;
+   }
+   return -1;
+}
+
+
+/* Seconds of audio the stream has queued before it runs dry. */
+static double queued_time(const ALLEGRO_AUDIO_STREAM *stream)
+{
+   unsigned int filled = stream->active_fragments -
+      al_get_available_audio_stream_fragments(stream);
+   float speed = stream->spl.speed > 0.0f ? stream->spl.speed : 1.0f;
+
+   return (double)filled * stream->spl.spl_data.len /
+      (stream->spl.spl_data.frequency * speed);
+}
+
+
+/* Must be called with the pool mutex held. */
+static void collect_events(void)
+{
+   ALLEGRO_EVENT event;
+
+   while (al_get_next_event(pool->queue, &event)) {
+      ALLEGRO_AUDIO_STREAM *stream;
+
+      if (event.type != ALLEGRO_EVENT_AUDIO_STREAM_FRAGMENT)
+         continue;
+      /* Events of removed streams were discarded when their event source
+       * was unregistered, so the source is still alive.
+       */
+      stream = (ALLEGRO_AUDIO_STREAM *)event.any.source;
+      stream->feed_pending = true;
+   }
+}
+
+
+/* Must be called with the pool mutex held. */
+static ALLEGRO_AUDIO_STREAM *most_urgent_stream(void)
+{
+   ALLEGRO_AUDIO_STREAM *best = NULL;
+   double best_time = 0.0;
+   unsigned i;
+
+   for (i = 0; i < _al_vector_size(&pool->streams); i++) {
+      ALLEGRO_AUDIO_STREAM **slot = _al_vector_ref(&pool->streams, i);
+      ALLEGRO_AUDIO_STREAM *stream = *slot;
+      double t;
+
+      if (!stream->feed_pending || stream->feed_busy)
+         continue;
+      t = queued_time(stream);
+      if (!best || t < best_time) {
+         best = stream;
+         best_time = t;
+      }
+   }
+   return best;
+}
+
+
+static void *feeder_thread(ALLEGRO_THREAD *self, void *arg)
+{
+   (void)arg;
+
+   /* Running dry here means running dry at the voice a little later. */
+   al_set_thread_name(self, "al-stream-feed");
+   al_set_thread_priority(self, ALLEGRO_THREAD_PRIORITY_HIGH);
+
+   al_lock_mutex(pool->mutex);
+
+   while (!pool->quit) {
+      ALLEGRO_AUDIO_STREAM *stream;
+
+      collect_events();
+
+      stream = most_urgent_stream();
+      if (!stream) {
+         al_unlock_mutex(pool->mutex);
+         al_wait_for_event(pool->queue, NULL);
+         al_lock_mutex(pool->mutex);
+         continue;
+      }
+
+      stream->feed_pending = false;
+      stream->feed_busy = true;
+      al_unlock_mutex(pool->mutex);
+
+      /* Only one fragment, so that the other streams get their turn once
+       * this one is no longer the most urgent.
+       */
+      if (_al_kcm_feed_fragment(stream) &&
+            al_get_available_audio_stream_fragments(stream) > 0) {
+         al_lock_mutex(pool->mutex);
+         stream->feed_pending = true;
+      }
+      else {
+         al_lock_mutex(pool->mutex);
+      }
+
+      stream->feed_busy = false;
+      al_broadcast_cond(pool->cond);
+   }
+
+   al_unlock_mutex(pool->mutex);
+
+   return NULL;
+}
+
+
+/* _al_kcm_init_feeder_pool:
+ *  Starts the shared feeder threads if the configuration asks for them.
+ */
+void _al_kcm_init_feeder_pool(void)
+{
+   const char *value;
+   int num_threads;
+   int i;
+
+   if (pool)
+      return;
+
+   value = al_get_config_value(al_get_system_config(), "audio",
+      "stream_feeder_threads");
+   if (!value)
+      return;
+   num_threads = atoi(value);
+   if (num_threads <= 0)
+      return;
+
+   pool = al_calloc(1, sizeof *pool);
+   if (!pool)
+      return;
+
+   pool->mutex = al_create_mutex();
+   pool->cond = al_create_cond();
+   pool->queue = al_create_event_queue();
+   pool->threads = al_calloc(num_threads, sizeof *pool->threads);
+   if (!pool->mutex || !pool->cond || !pool->queue || !pool->threads) {
+      ALLEGRO_ERROR("Could not create the stream feeder pool.\n");
+      al_destroy_mutex(pool->mutex);
+      al_destroy_cond(pool->cond);
+      if (pool->queue)
+         al_destroy_event_queue(pool->queue);
+      al_free(pool->threads);
+      al_free(pool);
+      pool = NULL;
+      return;
+   }
+
+   al_init_user_event_source(&pool->quit_es);
+   al_register_event_source(pool->queue, &pool->quit_es);
+   _al_vector_init(&pool->streams, sizeof(ALLEGRO_AUDIO_STREAM *));
+
+   for (i = 0; i < num_threads; i++) {
+      ALLEGRO_THREAD *thread = al_create_thread(feeder_thread, NULL);
+      if (!thread)
+         break;
+      pool->threads[pool->num_threads++] = thread;
+      al_start_thread(thread);
+   }
+
+   ALLEGRO_INFO("Started %d shared stream feeder threads.\n",
+      pool->num_threads);
+}
+
+
+/* _al_kcm_shutdown_feeder_pool:
+ *  Stops the shared feeder threads. Streams still using them are not fed
+ *  any more.
+ */
+void _al_kcm_shutdown_feeder_pool(void)
+{
+   ALLEGRO_EVENT quit_event;
+   int t;
+
+   if (!pool)
+      return;
+
+   al_lock_mutex(pool->mutex);
+   pool->quit = true;
+   al_unlock_mutex(pool->mutex);
+
+   /* Left in the queue, so it wakes up every waiting thread. */
+   quit_event.type = _KCM_STREAM_FEEDER_QUIT_EVENT_TYPE;
+   al_emit_user_event(&pool->quit_es, &quit_event, NULL);
+
+   for (t = 0; t < pool->num_threads; t++) {
+      al_join_thread(pool->threads[t], NULL);
+      al_destroy_thread(pool->threads[t]);
+   }
+
+   /* Streams still marked as pooled are only unregistered when they are
+    * destroyed, which still calls their unload_feeder.
+    */
+   _al_vector_free(&pool->streams);
+
+   al_destroy_event_queue(pool->queue);
+   al_destroy_user_event_source(&pool->quit_es);
+   al_destroy_cond(pool->cond);
+   al_destroy_mutex(pool->mutex);
+   al_free(pool->threads);
+   al_free(pool);
+   pool = NULL;
+}
+
+
+/* _al_kcm_feeder_pool_add:
+ *  Hands the stream to the shared feeder threads. Returns false if there
+ *  are none, in which case the caller should start a thread for it.
+ */
+bool _al_kcm_feeder_pool_add(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_AUDIO_STREAM **slot;
+
+   if (!pool)
+      return false;
+
+   /* Fill the first fragment right away, like a stream's own thread does
+    * before it starts waiting for events.
+    */
+   stream->quit_feed_thread = false;
+   stream->finished_event_sent = false;
+   _al_kcm_feed_fragment(stream);
+
+   al_lock_mutex(pool->mutex);
+   slot = _al_vector_alloc_back(&pool->streams);
+   if (!slot) {
+      al_unlock_mutex(pool->mutex);
+      return false;
+   }
+   *slot = stream;
+   stream->feed_pooled = true;
+   stream->feed_pending = false;
+   stream->feed_busy = false;
+   al_register_event_source(pool->queue, &stream->spl.es);
+   al_unlock_mutex(pool->mutex);
+
+   return true;
+}
+
+
+/* _al_kcm_feeder_pool_remove:
+ *  Takes the stream away from the shared feeder threads, waiting for a
+ *  refill in progress to finish.
+ */
+void _al_kcm_feeder_pool_remove(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_EVENT fin_event;
+   int i;
+
+   if (!pool || !stream->feed_pooled)
+      return;
+
+   al_lock_mutex(pool->mutex);
+   while (stream->feed_busy)
+      al_wait_cond(pool->cond, pool->mutex);
+   i = find_stream(stream);
+   if (i >= 0)
+      _al_vector_delete_at(&pool->streams, i);
+   al_unregister_event_source(pool->queue, &stream->spl.es);
+   stream->feed_pooled = false;
+   stream->feed_pending = false;
+   al_unlock_mutex(pool->mutex);
+
+   fin_event.user.type = ALLEGRO_EVENT_AUDIO_STREAM_FINISHED;
+   fin_event.user.timestamp = al_get_time();
+   al_emit_user_event(&stream->spl.es, &fin_event, NULL);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
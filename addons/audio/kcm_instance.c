@@ -8,8 +8,11 @@
 /* Title: Sample Instance functions
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern_audio.h"
@@ -61,6 +64,53 @@ void _al_kcm_stream_set_mutex(ALLEGRO_SAMPLE_INSTANCE *stream, ALLEGRO_MUTEX *mu
 }
 
 
+/* Sample instances are created and destroyed often by some programs, so
+ * they come from a pool while the audio addon is installed. Mixers, which
+ * start with a sample instance, are allocated separately.
+ */
+static ALLEGRO_MEMORY_POOL *instance_pool = NULL;
+
+
+void _al_kcm_init_instance_pool(void)
+{
+   if (!instance_pool)
+      instance_pool = al_create_memory_pool(sizeof(ALLEGRO_SAMPLE_INSTANCE));
+}
+
+
+/* Must be called after all pooled instances were destroyed. */
+void _al_kcm_shutdown_instance_pool(void)
+{
+   al_destroy_memory_pool(instance_pool);
+   instance_pool = NULL;
+}
+
+
+static ALLEGRO_SAMPLE_INSTANCE *alloc_instance(void)
+{
+   ALLEGRO_SAMPLE_INSTANCE *spl = NULL;
+
+   if (instance_pool) {
+      spl = al_alloc_from_memory_pool(instance_pool);
+      if (spl) {
+         memset(spl, 0, sizeof(*spl));
+         spl->pooled = true;
+         return spl;
+      }
+   }
+   return al_calloc(1, sizeof(*spl));
+}
+
+
+static void free_instance(ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   if (spl->pooled)
+      al_free_to_memory_pool(instance_pool, spl);
+   else
+      al_free(spl);
+}
+
+
 /* stream_free:
  *  This function is ALLEGRO_MIXER aware and frees the memory associated with
  *  the sample or mixer, and detaches any attached streams or mixers.
@@ -77,6 +127,14 @@ static void stream_free(ALLEGRO_SAMPLE_INSTANCE *spl)
 
          _al_kcm_stream_set_mutex(&mixer->ss, NULL);
 
+         if (mixer->command_mutex) {
+            al_destroy_mutex(mixer->command_mutex);
+            mixer->command_mutex = NULL;
+         }
+         al_free(mixer->parallel_children);
+         mixer->parallel_children = NULL;
+         mixer->parallel_size = 0;
+
          for (i = _al_vector_size(&mixer->streams) - 1; i >= 0; i--) {
             ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
             ALLEGRO_SAMPLE_INSTANCE *spl = *slot;
@@ -99,7 +157,8 @@ static void stream_free(ALLEGRO_SAMPLE_INSTANCE *spl)
 
       ASSERT(! spl->spl_data.free_buf);
 
-      al_free(spl);
+      _al_kcm_free_decode_cache(spl);
+      free_instance(spl);
    }
 }
 
@@ -122,25 +181,29 @@ void _al_kcm_detach_from_parent(ALLEGRO_SAMPLE_INSTANCE *spl)
    }
    
    mixer = spl->parent.u.mixer;
+   i = spl->parent_index;
+   ASSERT(i >= 0 && i < (int)_al_vector_size(&mixer->streams));
+   ASSERT(*(ALLEGRO_SAMPLE_INSTANCE **)_al_vector_ref(&mixer->streams, i) == spl);
 
-   /* Search through the streams and check for this one */
-   for (i = _al_vector_size(&mixer->streams) - 1; i >= 0; i--) {
-      ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
-
-      if (*slot == spl) {
-         maybe_lock_mutex(mixer->ss.mutex);
+   maybe_lock_mutex(mixer->ss.mutex);
 
-         _al_vector_delete_at(&mixer->streams, i);
-         spl->parent.u.mixer = NULL;
-         _al_kcm_stream_set_mutex(spl, NULL);
+   /* Nothing may refer to the sample once it is gone. */
+   _al_kcm_mixer_run_commands(mixer);
 
-         spl->spl_read = NULL;
+   /* The order of the streams does not matter, so move the last one into
+    * the gap rather than all that follow.
+    */
+   _al_vector_delete_at_unordered(&mixer->streams, i);
+   if (i < (int)_al_vector_size(&mixer->streams)) {
+      ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
+      (*slot)->parent_index = i;
+   }
+   spl->parent.u.mixer = NULL;
+   _al_kcm_stream_set_mutex(spl, NULL);
 
-         maybe_unlock_mutex(mixer->ss.mutex);
+   spl->spl_read = NULL;
 
-         break;
-      }
-   }
+   maybe_unlock_mutex(mixer->ss.mutex);
 
    al_free(spl->matrix);
    spl->matrix = NULL;
@@ -153,7 +216,7 @@ ALLEGRO_SAMPLE_INSTANCE *al_create_sample_instance(ALLEGRO_SAMPLE *sample_data)
 {
    ALLEGRO_SAMPLE_INSTANCE *spl;
 
-   spl = al_calloc(1, sizeof(*spl));
+   spl = alloc_instance();
    if (!spl) {
       _al_set_error(ALLEGRO_GENERIC_ERROR,
          "Out of memory allocating sample object");
@@ -182,6 +245,11 @@ ALLEGRO_SAMPLE_INSTANCE *al_create_sample_instance(ALLEGRO_SAMPLE *sample_data)
    spl->mutex = NULL;
    spl->parent.u.ptr = NULL;
 
+   if (!_al_kcm_prepare_decode_cache(spl)) {
+      free_instance(spl);
+      return NULL;
+   }
+
    spl->dtor_item = _al_kcm_register_destructor("sample_instance", spl,
       (void (*)(void *))al_destroy_sample_instance);
 
@@ -426,21 +494,8 @@ bool al_set_sample_instance_speed(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
 
    spl->speed = val;
    if (spl->parent.u.mixer) {
-      ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
-
-      maybe_lock_mutex(spl->mutex);
-
-      spl->step = (spl->spl_data.frequency) * spl->speed;
-      spl->step_denom = mixer->ss.spl_data.frequency;
-      /* Don't wanna be trapped with a step value of 0 */
-      if (spl->step == 0) {
-         if (spl->speed > 0.0f)
-            spl->step = 1;
-         else
-            spl->step = -1;
-      }
-
-      maybe_unlock_mutex(spl->mutex);
+      _al_kcm_mixer_post_command(spl->parent.u.mixer, spl,
+         _AL_KCM_UPDATE_STEP);
    }
 
    return true;
@@ -459,18 +514,20 @@ bool al_set_sample_instance_gain(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
       return false;
    }
 
-   if (spl->gain != val) {
+   if (spl->gain != val || spl->gain_ramp.left > 0) {
       spl->gain = val;
 
       /* If attached to a mixer already, need to recompute the sample
-       * matrix to take into account the gain.
+       * matrix to take into account the gain, and stop any ramp.
        */
       if (spl->parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
-
-         maybe_lock_mutex(spl->mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
-         maybe_unlock_mutex(spl->mutex);
+         spl->gain_ramp.target = val;
+         spl->gain_ramp.length = 0;
+         _al_kcm_mixer_post_command(spl->parent.u.mixer, spl,
+            _AL_KCM_UPDATE_GAIN_RAMP);
+      }
+      else {
+         spl->gain_ramp.left = 0;
       }
    }
 
@@ -478,6 +535,30 @@ bool al_set_sample_instance_gain(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
 }
 
 
+/* Function: al_set_sample_instance_gain_ramp
+ */
+bool al_set_sample_instance_gain_ramp(ALLEGRO_SAMPLE_INSTANCE *spl, float val,
+   unsigned int frames)
+{
+   ASSERT(spl);
+
+   if (!spl->parent.u.mixer || frames == 0)
+      return al_set_sample_instance_gain(spl, val);
+   if (spl->parent.is_voice) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Could not set gain of sample attached to voice");
+      return false;
+   }
+
+   spl->gain_ramp.target = val;
+   spl->gain_ramp.length = frames;
+   _al_kcm_mixer_post_command(spl->parent.u.mixer, spl,
+      _AL_KCM_UPDATE_GAIN_RAMP);
+
+   return true;
+}
+
+
 /* Function: al_set_sample_instance_pan
  */
 bool al_set_sample_instance_pan(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
@@ -494,18 +575,20 @@ bool al_set_sample_instance_pan(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
       return false;
    }
 
-   if (spl->pan != val) {
+   if (spl->pan != val || spl->pan_ramp.left > 0) {
       spl->pan = val;
 
       /* If attached to a mixer already, need to recompute the sample
-       * matrix to take into account the panning.
+       * matrix to take into account the panning, and stop any ramp.
        */
       if (spl->parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
-
-         maybe_lock_mutex(spl->mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
-         maybe_unlock_mutex(spl->mutex);
+         spl->pan_ramp.target = val;
+         spl->pan_ramp.length = 0;
+         _al_kcm_mixer_post_command(spl->parent.u.mixer, spl,
+            _AL_KCM_UPDATE_PAN_RAMP);
+      }
+      else {
+         spl->pan_ramp.left = 0;
       }
    }
 
@@ -513,6 +596,34 @@ bool al_set_sample_instance_pan(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
 }
 
 
+/* Function: al_set_sample_instance_pan_ramp
+ */
+bool al_set_sample_instance_pan_ramp(ALLEGRO_SAMPLE_INSTANCE *spl, float val,
+   unsigned int frames)
+{
+   ASSERT(spl);
+
+   if (!spl->parent.u.mixer || frames == 0)
+      return al_set_sample_instance_pan(spl, val);
+   if (spl->parent.is_voice) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Could not set panning of sample attached to voice");
+      return false;
+   }
+   if (val != ALLEGRO_AUDIO_PAN_NONE && (val < -1.0 || val > 1.0)) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR, "Invalid pan value");
+      return false;
+   }
+
+   spl->pan_ramp.target = val;
+   spl->pan_ramp.length = frames;
+   _al_kcm_mixer_post_command(spl->parent.u.mixer, spl,
+      _AL_KCM_UPDATE_PAN_RAMP);
+
+   return true;
+}
+
+
 /* Function: al_set_sample_instance_playmode
  */
 bool al_set_sample_instance_playmode(ALLEGRO_SAMPLE_INSTANCE *spl,
@@ -614,7 +725,8 @@ bool al_set_sample(ALLEGRO_SAMPLE_INSTANCE *spl, ALLEGRO_SAMPLE *data)
    if (spl->parent.u.ptr != NULL) {
       if (spl->spl_data.frequency != data->frequency ||
             spl->spl_data.depth != data->depth ||
-            spl->spl_data.chan_conf != data->chan_conf) {
+            spl->spl_data.chan_conf != data->chan_conf ||
+            spl->spl_data.compressed != data->compressed) {
          old_parent = spl->parent;
          need_reattach = true;
          _al_kcm_detach_from_parent(spl);
@@ -628,6 +740,13 @@ bool al_set_sample(ALLEGRO_SAMPLE_INSTANCE *spl, ALLEGRO_SAMPLE *data)
    spl->loop_end = data->len;
    /* Should we reset the loop mode? */
 
+   if (!_al_kcm_prepare_decode_cache(spl)) {
+      if (spl->parent.u.ptr)
+         _al_kcm_detach_from_parent(spl);
+      spl->spl_data.buffer.ptr = NULL;
+      return false;
+   }
+
    if (need_reattach) {
       if (old_parent.is_voice) {
          if (!al_attach_sample_instance_to_voice(spl, old_parent.u.voice)) {
@@ -674,11 +793,17 @@ bool al_set_sample_instance_channel_matrix(ALLEGRO_SAMPLE_INSTANCE *spl, const f
       ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
       size_t dst_chans = al_get_channel_count(mixer->ss.spl_data.chan_conf);
       size_t src_chans = al_get_channel_count(spl->spl_data.chan_conf);
+      size_t i;
       ASSERT(spl->matrix);
 
       maybe_lock_mutex(spl->mutex);
 
       memcpy(spl->matrix, matrix, dst_chans * src_chans * sizeof(float));
+      spl->zero_matrix = true;
+      for (i = 0; i < dst_chans * src_chans; i++) {
+         if (matrix[i] != 0.0f)
+            spl->zero_matrix = false;
+      }
 
       maybe_unlock_mutex(spl->mutex);
    }
@@ -8,6 +8,9 @@
 /* Title: Mixer functions
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 
@@ -15,6 +18,8 @@
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_audio.h"
 #include "allegro5/internal/aintern_audio_cfg.h"
+#include "allegro5/internal/aintern_debug.h"
+#include "allegro5/internal/aintern_jobs.h"
 
 ALLEGRO_DEBUG_CHANNEL("audio")
 
@@ -44,23 +49,20 @@ static void maybe_unlock_mutex(ALLEGRO_MUTEX *mutex)
 
 
 /* _al_rechannel_matrix:
- *  This function provides a (temporary!) matrix that can be used to convert
- *  one channel configuration into another.
- *
- *  Returns a pointer to a statically allocated array.
+ *  This function fills in a matrix that can be used to convert one channel
+ *  configuration into another, before gain and panning. The matrix is the
+ *  caller's as this also runs in the mixer threads of different voices.
  */
-static float *_al_rechannel_matrix(ALLEGRO_CHANNEL_CONF orig,
-   ALLEGRO_CHANNEL_CONF target, float gain, float pan)
+static void _al_rechannel_matrix(
+   float mat[ALLEGRO_MAX_CHANNELS][ALLEGRO_MAX_CHANNELS],
+   ALLEGRO_CHANNEL_CONF orig, ALLEGRO_CHANNEL_CONF target)
 {
-   /* Max 7.1 (8 channels) for input and output */
-   static float mat[ALLEGRO_MAX_CHANNELS][ALLEGRO_MAX_CHANNELS];
-
    size_t dst_chans = al_get_channel_count(target);
    size_t src_chans = al_get_channel_count(orig);
-   size_t i, j;
+   size_t i;
 
    /* Start with a simple identity matrix */
-   memset(mat, 0, sizeof(mat));
+   memset(mat, 0, sizeof(float) * ALLEGRO_MAX_CHANNELS * ALLEGRO_MAX_CHANNELS);
    for (i = 0; i < src_chans && i < dst_chans; i++) {
       mat[i][i] = 1.0;
    }
@@ -91,34 +93,11 @@ static float *_al_rechannel_matrix(ALLEGRO_CHANNEL_CONF orig,
       mat[dst_chans-1][src_chans-1] = 1.0;
    }
 
-   /* Apply panning, which is supposed to maintain a constant power level.
-    * I took that to mean we want:
-    *    sqrt(rgain^2 + lgain^2) = 1.0
-    */
-   if (pan != ALLEGRO_AUDIO_PAN_NONE) {
-      float rgain = sqrt(( pan + 1.0f) / 2.0f);
-      float lgain = sqrt((-pan + 1.0f) / 2.0f);
-
-      /* I dunno what to do about >2 channels, so don't even try for now. */
-      for (j = 0; j < src_chans; j++) {
-         mat[0][j] *= lgain;
-         mat[1][j] *= rgain;
-      }
-   }
-
-   /* Apply gain */
-   if (gain != 1.0f) {
-      for (i = 0; i < dst_chans; i++) {
-         for (j = 0; j < src_chans; j++) {
-            mat[i][j] *= gain;
-         }
-      }
-   }
-
 #ifdef DEBUGMODE
    {
       char debug[1024];
-      ALLEGRO_DEBUG("sample matrix:\n");
+      size_t j;
+      ALLEGRO_DEBUG("rechannel matrix:\n");
       for (i = 0; i < dst_chans; i++) {
          strcpy(debug, "");
          for (j = 0; j < src_chans; j++) {
@@ -128,40 +107,234 @@ static float *_al_rechannel_matrix(ALLEGRO_CHANNEL_CONF orig,
       }
    }
 #endif
-
-   return &mat[0][0];
 }
 
 
 /* _al_kcm_mixer_rejig_sample_matrix:
  *  Recompute the mixing matrix for a sample attached to a mixer.
+ *  The rechannel matrix is only worked out when the sample is attached,
+ *  after that a gain or pan change just scales it again.
  *  The caller must be holding the mixer mutex.
  */
 void _al_kcm_mixer_rejig_sample_matrix(ALLEGRO_MIXER *mixer,
    ALLEGRO_SAMPLE_INSTANCE *spl)
 {
-   float *mat;
+   const float gain = spl->gain;
+   const float pan = spl->pan;
+   float lgain = 1.0f;
+   float rgain = 1.0f;
    size_t dst_chans;
    size_t src_chans;
    size_t i, j;
 
-   mat = _al_rechannel_matrix(spl->spl_data.chan_conf,
-      mixer->ss.spl_data.chan_conf, spl->gain, spl->pan);
-
    dst_chans = al_get_channel_count(mixer->ss.spl_data.chan_conf);
    src_chans = al_get_channel_count(spl->spl_data.chan_conf);
 
-   if (!spl->matrix)
-      spl->matrix = al_calloc(1, src_chans * dst_chans * sizeof(float));
+   if (!spl->matrix) {
+      /* Max 7.1 (8 channels) for input and output */
+      float mat[ALLEGRO_MAX_CHANNELS][ALLEGRO_MAX_CHANNELS];
+
+      /* The rechannel matrix lives in the same block, after the matrix. */
+      spl->matrix = al_calloc(2, src_chans * dst_chans * sizeof(float));
+      spl->rechannel = spl->matrix + src_chans * dst_chans;
+
+      _al_rechannel_matrix(mat, spl->spl_data.chan_conf,
+         mixer->ss.spl_data.chan_conf);
+      for (i = 0; i < dst_chans; i++) {
+         for (j = 0; j < src_chans; j++) {
+            spl->rechannel[i*src_chans + j] = mat[i][j];
+         }
+      }
+   }
+
+   /* Panning is supposed to maintain a constant power level.
+    * I took that to mean we want:
+    *    sqrt(rgain^2 + lgain^2) = 1.0
+    * I dunno what to do about >2 channels, so don't even try for now.
+    */
+   if (pan != ALLEGRO_AUDIO_PAN_NONE) {
+      rgain = sqrt(( pan + 1.0f) / 2.0f);
+      lgain = sqrt((-pan + 1.0f) / 2.0f);
+   }
 
+   spl->zero_matrix = true;
    for (i = 0; i < dst_chans; i++) {
       for (j = 0; j < src_chans; j++) {
-         spl->matrix[i*src_chans + j] = mat[i*ALLEGRO_MAX_CHANNELS + j];
+         float v = spl->rechannel[i*src_chans + j];
+         /* Same order of operations as ever, so the matrix comes out the
+          * same.
+          */
+         if (pan != ALLEGRO_AUDIO_PAN_NONE && i < 2)
+            v *= (i == 0) ? lgain : rgain;
+         if (gain != 1.0f)
+            v *= gain;
+         spl->matrix[i*src_chans + j] = v;
+         if (v != 0.0f)
+            spl->zero_matrix = false;
       }
    }
 }
 
 
+/* _al_kcm_mixer_rejig_sample_step:
+ *  Recompute the step for a sample attached to a mixer from the speed.
+ *  The caller must be holding the mixer mutex.
+ */
+void _al_kcm_mixer_rejig_sample_step(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   spl->step = (spl->spl_data.frequency) * spl->speed;
+   spl->step_denom = mixer->ss.spl_data.frequency;
+   /* Don't want to be trapped with a step value of 0. */
+   if (spl->step == 0) {
+      if (spl->speed > 0.0f)
+         spl->step = 1;
+      else
+         spl->step = -1;
+   }
+}
+
+
+/* start_ramp:
+ *  Sets off a ramp from the current value towards the target asked for,
+ *  or jumps straight to the target if the length is 0.
+ */
+static void start_ramp(float *value, _AL_KCM_RAMP *ramp)
+{
+   ramp->left = ramp->length;
+   if (ramp->left == 0)
+      *value = ramp->target;
+   else
+      ramp->delta = (ramp->target - *value) / ramp->left;
+}
+
+
+/* advance_ramp:
+ *  Moves a ramp on by some frames. Returns false if it was not running.
+ */
+static bool advance_ramp(float *value, _AL_KCM_RAMP *ramp, unsigned int frames)
+{
+   if (ramp->left == 0)
+      return false;
+
+   if (frames >= ramp->left) {
+      *value = ramp->target;
+      ramp->left = 0;
+   }
+   else {
+      *value += ramp->delta * frames;
+      ramp->left -= frames;
+   }
+   return true;
+}
+
+
+static bool is_ramping(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   return spl->gain_ramp.left > 0 || spl->pan_ramp.left > 0;
+}
+
+
+static void advance_ramps(ALLEGRO_MIXER *mixer, ALLEGRO_SAMPLE_INSTANCE *spl,
+   unsigned int frames)
+{
+   bool changed = advance_ramp(&spl->gain, &spl->gain_ramp, frames);
+
+   if (advance_ramp(&spl->pan, &spl->pan_ramp, frames))
+      changed = true;
+   if (changed)
+      _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
+}
+
+
+static void run_command(ALLEGRO_MIXER *mixer, const _AL_KCM_COMMAND *cmd)
+{
+   ALLEGRO_SAMPLE_INSTANCE *spl = cmd->spl;
+
+   switch (cmd->type) {
+      case _AL_KCM_UPDATE_MATRIX:
+         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
+         break;
+      case _AL_KCM_UPDATE_STEP:
+         _al_kcm_mixer_rejig_sample_step(mixer, spl);
+         break;
+      case _AL_KCM_UPDATE_GAIN_RAMP:
+         start_ramp(&spl->gain, &spl->gain_ramp);
+         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
+         break;
+      case _AL_KCM_UPDATE_PAN_RAMP:
+         /* There is nothing in between no panning and some. */
+         if (spl->pan == ALLEGRO_AUDIO_PAN_NONE ||
+               spl->pan_ramp.target == ALLEGRO_AUDIO_PAN_NONE)
+            spl->pan_ramp.length = 0;
+         start_ramp(&spl->pan, &spl->pan_ramp);
+         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
+         break;
+   }
+}
+
+
+/* _al_kcm_mixer_run_commands:
+ *  Carry out the commands posted to the mixer so far. The caller must be
+ *  holding the mixer mutex, which makes it the only reader of the ring.
+ */
+void _al_kcm_mixer_run_commands(ALLEGRO_MIXER *mixer)
+{
+   int tail = mixer->command_tail;
+   int head = _al_atomic_load_acquire(&mixer->command_head);
+
+   while (tail != head) {
+      run_command(mixer, &mixer->commands[tail]);
+      tail = (tail + 1) % _AL_KCM_COMMAND_RING_SIZE;
+   }
+   _al_atomic_store_release(&mixer->command_tail, tail);
+}
+
+
+/* _al_kcm_mixer_post_command:
+ *  Have the mixer recompute something for an attached sample after the
+ *  sample's gain, pan or speed was changed.
+ *
+ *  If a voice is playing the mixer, the command goes into a ring which the
+ *  mixer thread empties before it mixes the next buffer, so the caller does
+ *  not wait for the mixer mutex. The mixer thread reads the sample's
+ *  settings when it gets to the command, so repeated changes collapse into
+ *  the latest. Only if the ring is full does the caller take the mutex and
+ *  empty it itself.
+ */
+void _al_kcm_mixer_post_command(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl, int type)
+{
+   _AL_KCM_COMMAND cmd;
+   int head, next;
+
+   cmd.spl = spl;
+   cmd.type = type;
+
+   if (!mixer->ss.mutex || !mixer->command_mutex) {
+      run_command(mixer, &cmd);
+      return;
+   }
+
+   al_lock_mutex(mixer->command_mutex);
+
+   head = mixer->command_head;
+   next = (head + 1) % _AL_KCM_COMMAND_RING_SIZE;
+   if (next == _al_atomic_load_acquire(&mixer->command_tail)) {
+      al_lock_mutex(mixer->ss.mutex);
+      _al_kcm_mixer_run_commands(mixer);
+      run_command(mixer, &cmd);
+      al_unlock_mutex(mixer->ss.mutex);
+   }
+   else {
+      mixer->commands[head] = cmd;
+      _al_atomic_store_release(&mixer->command_head, next);
+   }
+
+   al_unlock_mutex(mixer->command_mutex);
+}
+
+
 /* fix_looped_position:
  *  When a stream loops, this will fix up the position and anything else to
  *  allow it to safely continue playing as expected. Returns false if it
@@ -276,6 +449,302 @@ static INLINE int32_t clamp(int32_t val, int32_t min, int32_t max)
 }
 
 
+/* The frame after the last one that can be read going forwards without
+ * fix_looped_position having to step in.
+ */
+static int forward_end(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   switch (spl->loop) {
+      case ALLEGRO_PLAYMODE_LOOP:
+      case ALLEGRO_PLAYMODE_LOOP_ONCE:
+      case ALLEGRO_PLAYMODE_BIDIR:
+         return spl->loop_end;
+      default:
+         return spl->spl_data.len;
+   }
+}
+
+
+static bool is_stream(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   return spl->loop == _ALLEGRO_PLAYMODE_STREAM_ONCE ||
+      spl->loop == _ALLEGRO_PLAYMODE_STREAM_LOOP_ONCE ||
+      spl->loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR;
+}
+
+
+/* Mix runs of frames for samples played one frame per output frame, up to
+ * the next point where the position would have to be looped. They return how
+ * many frames were mixed, 0 to have the caller mix the next frame itself.
+ */
+static size_t point_run32(void *vbuf, ALLEGRO_SAMPLE_INSTANCE *spl,
+   size_t frames, size_t maxc, size_t dest_maxc)
+{
+   int left = forward_end(spl) - spl->pos;
+
+   if (spl->spl_data.depth != ALLEGRO_AUDIO_DEPTH_FLOAT32 || left <= 0)
+      return 0;
+   if (frames > (size_t)left)
+      frames = left;
+
+   _al_kcm_mix_frames_f32(vbuf, spl->spl_data.buffer.f32 + spl->pos * maxc,
+      NULL, 0.0f, frames, maxc, dest_maxc, spl->matrix);
+   return frames;
+}
+
+
+static size_t linear_run32(void *vbuf, ALLEGRO_SAMPLE_INSTANCE *spl,
+   size_t frames, size_t maxc, size_t dest_maxc)
+{
+   const float *x0;
+   float t;
+   int left;
+
+   if (spl->spl_data.depth != ALLEGRO_AUDIO_DEPTH_FLOAT32)
+      return 0;
+
+   /* Same as linear_spl32: streams interpolate towards the current frame,
+    * the others towards the next, which must not need wrapping.
+    */
+   if (is_stream(spl)) {
+      left = spl->spl_data.len - spl->pos;
+      x0 = spl->spl_data.buffer.f32 + (spl->pos - 1) * maxc;
+   }
+   else {
+      left = forward_end(spl) - 1 - spl->pos;
+      x0 = spl->spl_data.buffer.f32 + spl->pos * maxc;
+   }
+   if (left <= 0)
+      return 0;
+   if (frames > (size_t)left)
+      frames = left;
+
+   t = (float) spl->pos_bresenham_error / spl->step_denom;
+   _al_kcm_mix_frames_f32(vbuf, x0, x0 + maxc, t, frames, maxc, dest_maxc,
+      spl->matrix);
+   return frames;
+}
+
+
+static size_t no_run(void *vbuf, ALLEGRO_SAMPLE_INSTANCE *spl,
+   size_t frames, size_t maxc, size_t dest_maxc)
+{
+   (void)vbuf;
+   (void)spl;
+   (void)frames;
+   (void)maxc;
+   (void)dest_maxc;
+   return 0;
+}
+
+
+/* Playing at the mixer's frequency without a fractional offset is the same
+ * as point sampling.
+ */
+static size_t sinc_run32(void *vbuf, ALLEGRO_SAMPLE_INSTANCE *spl,
+   size_t frames, size_t maxc, size_t dest_maxc)
+{
+   if (spl->pos_bresenham_error != 0)
+      return 0;
+   return point_run32(vbuf, spl, frames, maxc, dest_maxc);
+}
+
+
+/* Where the sinc filter reads source frame p from, or -1 for silence. The
+ * frames from lo up to hi can be read as they are. Loops wrap around, or
+ * bounce for bidirectional ones; history before the loop start comes from
+ * the end of the loop only once the loop has been entered.
+ */
+static int sinc_frame_pos(const ALLEGRO_SAMPLE_INSTANCE *spl, int p, int lo,
+   int hi)
+{
+   int len;
+
+   if (p >= lo && p < hi)
+      return p;
+
+   if (spl->loop != ALLEGRO_PLAYMODE_LOOP &&
+         spl->loop != ALLEGRO_PLAYMODE_BIDIR)
+      return -1;
+
+   len = spl->loop_end - spl->loop_start;
+   if (len <= 0 || (p < lo && lo != spl->loop_start))
+      return -1;
+
+   p -= spl->loop_start;
+   if (spl->loop == ALLEGRO_PLAYMODE_LOOP) {
+      p %= len;
+      if (p < 0)
+         p += len;
+   }
+   else {
+      p %= 2 * len;
+      if (p < 0)
+         p += 2 * len;
+      if (p >= len)
+         p = 2 * len - 1 - p;
+   }
+   return spl->loop_start + p;
+}
+
+
+/* Returns the taps source frames from first on as float values, converted
+ * into buf unless they can be read from the sample directly.
+ */
+static const float *sinc_frames(float *buf, const ALLEGRO_SAMPLE_INSTANCE *spl,
+   int first, int taps, unsigned int maxc)
+{
+   int lo = 0;
+   int hi = forward_end(spl);
+   int k;
+
+   if ((spl->loop == ALLEGRO_PLAYMODE_LOOP ||
+         spl->loop == ALLEGRO_PLAYMODE_BIDIR) && spl->pos >= spl->loop_start)
+      lo = spl->loop_start;
+
+   if (spl->spl_data.depth == ALLEGRO_AUDIO_DEPTH_FLOAT32 &&
+         first >= lo && first + taps <= hi)
+      return spl->spl_data.buffer.f32 + first * maxc;
+
+   for (k = 0; k < taps; k++) {
+      const int p = sinc_frame_pos(spl, first + k, lo, hi);
+      if (p >= 0)
+         _al_kcm_sample_frame_to_float(buf + k * maxc, &spl->spl_data, p, maxc);
+      else
+         memset(buf + k * maxc, 0, sizeof(float) * maxc);
+   }
+   return buf;
+}
+
+
+static INLINE const void *sinc_spl32(SAMP_BUF *samp_buf,
+   const ALLEGRO_SAMPLE_INSTANCE *spl, unsigned int maxc)
+{
+   float coef[_AL_KCM_SINC_MIXER_MAX_TAPS];
+   float buf[_AL_KCM_SINC_MIXER_MAX_TAPS * ALLEGRO_MAX_CHANNELS];
+   const float frac = (float) spl->pos_bresenham_error / spl->step_denom;
+   float ratio = (float) (spl->step < 0 ? -spl->step : spl->step) /
+      spl->step_denom;
+   _AL_KCM_SINC_FILTER filter;
+   const float *x;
+
+   if (ratio > _AL_KCM_SINC_MIXER_MAX_RATIO)
+      ratio = _AL_KCM_SINC_MIXER_MAX_RATIO;
+
+   _al_kcm_sinc_filter(&filter, coef, frac, ratio);
+   x = sinc_frames(buf, spl, spl->pos + filter.first, filter.taps, maxc);
+   _al_kcm_sinc_f32(samp_buf->f32, x, filter.c0, filter.c1, filter.t,
+      filter.taps, maxc);
+   return samp_buf->f32;
+}
+
+
+/* Compressed samples are decoded a block at a time into the instance's
+ * decode cache, from where the frames are read like the frames of an
+ * uncompressed 16-bit sample.
+ */
+static INLINE const int16_t *compressed_frame(
+   const ALLEGRO_SAMPLE_INSTANCE *spl, int pos, unsigned int maxc)
+{
+   _AL_KCM_DECODE_CACHE *cache = spl->decode_cache;
+   const int block = pos / _AL_KCM_ADPCM_BLOCK_FRAMES;
+   const int slot = block % _AL_KCM_DECODE_CACHE_SLOTS;
+   int16_t *frames = cache->frames +
+      slot * _AL_KCM_ADPCM_BLOCK_FRAMES * maxc;
+
+   if (cache->block[slot] != block) {
+      _al_kcm_decode_adpcm_block(&spl->spl_data, block, frames);
+      cache->block[slot] = block;
+   }
+   return frames + (pos - block * _AL_KCM_ADPCM_BLOCK_FRAMES) * maxc;
+}
+
+
+/* The frame linear interpolation goes towards, as in linear_spl32. Streams
+ * are never compressed.
+ */
+static INLINE int compressed_next_pos(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   int p1 = spl->pos + 1;
+
+   switch (spl->loop) {
+      case ALLEGRO_PLAYMODE_LOOP_ONCE:
+      case ALLEGRO_PLAYMODE_LOOP:
+         if (p1 >= spl->loop_end)
+            p1 = spl->loop_start;
+         break;
+      case ALLEGRO_PLAYMODE_BIDIR:
+         if (p1 >= spl->loop_end) {
+            p1 = spl->loop_end - 1;
+            if (p1 < spl->loop_start)
+               p1 = spl->loop_start;
+         }
+         break;
+      default:
+         if (p1 >= spl->spl_data.len)
+            p1 = spl->pos;
+         break;
+   }
+   return p1;
+}
+
+
+static INLINE const void *compressed_point_spl32(SAMP_BUF *samp_buf,
+   const ALLEGRO_SAMPLE_INSTANCE *spl, unsigned int maxc)
+{
+   const int16_t *x = compressed_frame(spl, spl->pos, maxc);
+   unsigned int i;
+
+   for (i = 0; i < maxc; i++)
+      samp_buf->f32[i] = (float) x[i] / ((float) 0x7FFF + 0.5f);
+   return samp_buf->f32;
+}
+
+
+static INLINE const void *compressed_linear_spl32(SAMP_BUF *samp_buf,
+   const ALLEGRO_SAMPLE_INSTANCE *spl, unsigned int maxc)
+{
+   const float t = (float) spl->pos_bresenham_error / spl->step_denom;
+   const int16_t *x0 = compressed_frame(spl, spl->pos, maxc);
+   const int16_t *x1 = compressed_frame(spl, compressed_next_pos(spl), maxc);
+   unsigned int i;
+
+   for (i = 0; i < maxc; i++) {
+      const float s = (x0[i] * (1.0f - t)) + (x1[i] * t);
+      samp_buf->f32[i] = s / ((float) 0x7FFF + 0.5f);
+   }
+   return samp_buf->f32;
+}
+
+
+static INLINE const void *compressed_point_spl16(SAMP_BUF *samp_buf,
+   const ALLEGRO_SAMPLE_INSTANCE *spl, unsigned int maxc)
+{
+   const int16_t *x = compressed_frame(spl, spl->pos, maxc);
+   unsigned int i;
+
+   for (i = 0; i < maxc; i++)
+      samp_buf->s16[i] = x[i];
+   return samp_buf->s16;
+}
+
+
+static INLINE const void *compressed_linear_spl16(SAMP_BUF *samp_buf,
+   const ALLEGRO_SAMPLE_INSTANCE *spl, unsigned int maxc)
+{
+   const int32_t t = 256 * spl->pos_bresenham_error / spl->step_denom;
+   const int16_t *x0 = compressed_frame(spl, spl->pos, maxc);
+   const int16_t *x1 = compressed_frame(spl, compressed_next_pos(spl), maxc);
+   unsigned int i;
+
+   for (i = 0; i < maxc; i++) {
+      const int32_t s = ((x0[i] * (256 - t)) >> 8) + ((x1[i] * t) >> 8);
+      samp_buf->s16[i] = (int16_t) s;
+   }
+   return samp_buf->s16;
+}
+
+
 /* Mix as many sample values as possible from the source sample into a mixer
  * buffer.  Implements stream_reader_t.
  *
@@ -291,7 +760,7 @@ static INLINE int32_t clamp(int32_t val, int32_t min, int32_t max)
       delta_error = spl->step - delta * spl->step_denom;                      \
    } while (0)
 
-#define MAKE_MIXER(NAME, NEXT_SAMPLE_VALUE, TYPE)                             \
+#define MAKE_MIXER(NAME, NEXT_SAMPLE_VALUE, MIX_RUN, TYPE)                    \
 static void NAME(void *source, void **vbuf, unsigned int *samples,            \
    ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)                        \
 {                                                                             \
@@ -318,6 +787,19 @@ static void NAME(void *source, void **vbuf, unsigned int *samples,            \
          BRESENHAM;                                                           \
       }                                                                       \
                                                                               \
+      /* Without resampling the position simply advances, so whole runs       \
+       * can be mixed at once.                                                \
+       */                                                                     \
+      if (delta == 1 && delta_error == 0) {                                   \
+         size_t n = MIX_RUN(buf, spl, samples_l, maxc, dest_maxc);            \
+         if (n > 0) {                                                         \
+            buf += n * dest_maxc;                                             \
+            spl->pos += n;                                                    \
+            samples_l -= n;                                                   \
+            continue;                                                         \
+         }                                                                    \
+      }                                                                       \
+                                                                              \
       /* It might be worth preparing multiple sample values at once. */       \
       s = (TYPE *) NEXT_SAMPLE_VALUE(&samp_buf, spl, maxc);                   \
                                                                               \
@@ -357,31 +839,240 @@ static void NAME(void *source, void **vbuf, unsigned int *samples,            \
    (void)buffer_depth;                                                        \
 }
 
-MAKE_MIXER(read_to_mixer_point_float_32, point_spl32, float)
-MAKE_MIXER(read_to_mixer_linear_float_32, linear_spl32, float)
-MAKE_MIXER(read_to_mixer_cubic_float_32, cubic_spl32, float)
-MAKE_MIXER(read_to_mixer_point_int16_t_16, point_spl16, int16_t)
-MAKE_MIXER(read_to_mixer_linear_int16_t_16, linear_spl16, int16_t)
+MAKE_MIXER(read_to_mixer_point_float_32, point_spl32, point_run32, float)
+MAKE_MIXER(read_to_mixer_linear_float_32, linear_spl32, linear_run32, float)
+MAKE_MIXER(read_to_mixer_cubic_float_32, cubic_spl32, no_run, float)
+MAKE_MIXER(read_to_mixer_sinc_float_32, sinc_spl32, sinc_run32, float)
+MAKE_MIXER(read_to_mixer_point_int16_t_16, point_spl16, no_run, int16_t)
+MAKE_MIXER(read_to_mixer_linear_int16_t_16, linear_spl16, no_run, int16_t)
+MAKE_MIXER(read_compressed_to_mixer_point_float_32, compressed_point_spl32,
+   no_run, float)
+MAKE_MIXER(read_compressed_to_mixer_linear_float_32, compressed_linear_spl32,
+   no_run, float)
+MAKE_MIXER(read_compressed_to_mixer_point_int16_t_16, compressed_point_spl16,
+   no_run, int16_t)
+MAKE_MIXER(read_compressed_to_mixer_linear_int16_t_16,
+   compressed_linear_spl16, no_run, int16_t)
 
 #undef MAKE_MIXER
 
 
-/* _al_kcm_mixer_read:
- *  Mixes the streams attached to the mixer and writes additively to the
- *  specified buffer (or if *buf is NULL, indicating a voice, convert it and
- *  set it to the buffer pointer).
+/* How many frames an instance can be moved on from x, its position times
+ * step_denom plus the Bresenham error, before fix_looped_position has to
+ * step in again. At least 1 and at most left.
  */
-void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
-   ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+static int64_t skip_frames(const ALLEGRO_SAMPLE_INSTANCE *spl, int64_t x,
+   int64_t left)
+{
+   const int64_t denom = spl->step_denom;
+   int64_t n;
+
+   if ((spl->loop == ALLEGRO_PLAYMODE_LOOP ||
+         spl->loop == ALLEGRO_PLAYMODE_BIDIR) &&
+         spl->loop_end == spl->loop_start)
+      return left;
+
+   if (spl->step > 0) {
+      n = ((int64_t)forward_end(spl) * denom - x + spl->step - 1) / spl->step;
+   }
+   else {
+      int64_t start;
+      switch (spl->loop) {
+         case ALLEGRO_PLAYMODE_LOOP:
+         case ALLEGRO_PLAYMODE_BIDIR:
+            start = spl->loop_start;
+            break;
+         case ALLEGRO_PLAYMODE_ONCE:
+         case ALLEGRO_PLAYMODE_LOOP_ONCE:
+            start = 0;
+            break;
+         default:
+            return left;
+      }
+      n = (x - start * denom) / -spl->step + 1;
+   }
+
+   if (n < 1)
+      return 1;
+   return n < left ? n : left;
+}
+
+
+/* skip_sample_instance:
+ *  Moves an instance on by as many frames as mixing it would, looping and
+ *  refilling streams the same way, without reading or mixing anything.
+ */
+static void skip_sample_instance(ALLEGRO_SAMPLE_INSTANCE *spl,
+   unsigned int samples)
+{
+   int64_t left = samples;
+
+   if (!spl->is_playing)
+      return;
+
+   while (left > 0) {
+      const int64_t denom = spl->step_denom;
+      int64_t x, n, err;
+
+      if (!fix_looped_position(spl))
+         return;
+
+      x = (int64_t)spl->pos * denom + spl->pos_bresenham_error;
+      n = skip_frames(spl, x, left);
+      x += n * spl->step;
+      err = x % denom;
+      if (err < 0)
+         err += denom;
+      spl->pos = (x - err) / denom;
+      spl->pos_bresenham_error = err;
+      left -= n;
+   }
+   fix_looped_position(spl);
+}
+
+
+/* Whether nothing of an instance would be heard in the next samples frames
+ * of the mixer, so it only has to be skipped. Child mixers always render
+ * themselves.
+ */
+static bool is_inaudible(const ALLEGRO_SAMPLE_INSTANCE *spl, bool muted,
+   unsigned int samples)
+{
+   int64_t frames;
+
+   if (spl->is_mixer)
+      return false;
+   if (muted)
+      return true;
+   /* A ramp may be about to bring the gain up from 0. */
+   if (spl->zero_matrix)
+      return !is_ramping(spl);
+   if (!is_stream(spl) || spl->step <= 0)
+      return false;
+
+   /* The stream frames the interpolation reaches, counting from the current
+    * one.
+    */
+   frames = ((int64_t)spl->pos_bresenham_error +
+      (int64_t)(samples - 1) * spl->step) / spl->step_denom + 1;
+   if (frames > INT_MAX)
+      return false;
+   return _al_kcm_stream_is_silent((const ALLEGRO_AUDIO_STREAM *)spl,
+      (int)frames);
+}
+
+
+static bool render_mixer(ALLEGRO_MIXER *m, unsigned int *samples);
+
+
+typedef struct PRERENDER_JOB {
+   ALLEGRO_MIXER *mixer;
+   unsigned int *samples;
+} PRERENDER_JOB;
+
+
+static void prerender_range(int begin, int end, void *arg)
+{
+   PRERENDER_JOB *job = arg;
+   int i;
+
+   for (i = begin; i < end; i++) {
+      ALLEGRO_MIXER *child = job->mixer->parallel_children[i];
+      child->prerendered = render_mixer(child, job->samples);
+   }
+}
+
+
+/* prerender_children:
+ *  Renders the playing child mixers of a mixer with the parallel option on
+ *  the worker threads. _al_kcm_mixer_read then only adds their buffers to
+ *  the parent, in the same order as without the option, so the result is
+ *  the same.
+ */
+static void prerender_children(ALLEGRO_MIXER *mixer, unsigned int *samples)
+{
+   PRERENDER_JOB job;
+   ALLEGRO_JOB_POOL *pool;
+   int size = _al_vector_size(&mixer->streams);
+   int i, n = 0;
+
+   if (mixer->parallel_size < size) {
+      ALLEGRO_MIXER **children = al_realloc(mixer->parallel_children,
+         size * sizeof(*children));
+      if (!children)
+         return;
+      mixer->parallel_children = children;
+      mixer->parallel_size = size;
+   }
+
+   for (i = 0; i < size; i++) {
+      ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
+
+      if ((*slot)->is_mixer && (*slot)->is_playing)
+         mixer->parallel_children[n++] = (ALLEGRO_MIXER *)*slot;
+   }
+
+   if (n < 2 || !(pool = _al_get_job_pool()))
+      return;
+
+   job.mixer = mixer;
+   job.samples = samples;
+   al_parallel_for(pool, 0, n, 1, prerender_range, &job);
+}
+
+
+/* read_ramping:
+ *  Mixes an instance whose gain or pan is ramping, a block at a time with
+ *  the matrix moved on between blocks, and the rest in one go once the
+ *  ramps are over.
+ */
+static void read_ramping(ALLEGRO_MIXER *m, ALLEGRO_SAMPLE_INSTANCE *spl,
+   unsigned int samples, int maxc)
+{
+   const size_t frame_size = maxc *
+      al_get_audio_depth_size(m->ss.spl_data.depth);
+   char *buf = m->ss.spl_data.buffer.ptr;
+   unsigned int done = 0;
+
+   while (done < samples && spl->is_playing) {
+      unsigned int n = samples - done;
+      void *p = buf + done * frame_size;
+
+      if (is_ramping(spl)) {
+         n = _ALLEGRO_MIN(n, _AL_KCM_RAMP_BLOCK);
+         advance_ramps(m, spl, n);
+      }
+      spl->spl_read(spl, &p, &n, m->ss.spl_data.depth, maxc);
+      done += n;
+   }
+}
+
+
+/* render_mixer:
+ *  Mixes the streams attached to the mixer into the mixer's own buffer and
+ *  applies the gain. Returns false if there is nothing in the buffer.
+ *  Instances which would not be heard are only moved on, and if nothing was
+ *  mixed at all the buffer is left silent and audible is cleared.
+ */
+static bool render_mixer(ALLEGRO_MIXER *m, unsigned int *samples)
 {
    const ALLEGRO_MIXER *mixer;
-   ALLEGRO_MIXER *m = (ALLEGRO_MIXER *)source;
    int maxc = al_get_channel_count(m->ss.spl_data.chan_conf);
    int samples_l = *samples;
+   bool muted;
+   uint64_t fp_state = 0;
+   double start;
    int i;
 
+   m->audible = false;
+
    if (!m->ss.is_playing)
-      return;
+      return false;
+
+   start = al_get_time();
+
+   /* Catch up with changes posted by other threads. */
+   _al_kcm_mixer_run_commands(m);
 
    /* Make sure the mixer buffer is big enough. */
    if (m->ss.spl_data.len*maxc < samples_l*maxc) {
@@ -391,7 +1082,7 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
          _al_set_error(ALLEGRO_GENERIC_ERROR,
             "Out of memory allocating mixer buffer");
          m->ss.spl_data.len = 0;
-         return;
+         return false;
       }
       m->ss.spl_data.len = samples_l;
    }
@@ -401,34 +1092,57 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
    /* Clear the buffer to silence. */
    memset(mixer->ss.spl_data.buffer.ptr, 0, samples_l * maxc * al_get_audio_depth_size(mixer->ss.spl_data.depth));
 
+   /* Child mixers rendered here are only added to the buffer below. */
+   if (m->parallel)
+      prerender_children(m, samples);
+
+   if (m->ss.spl_data.depth == ALLEGRO_AUDIO_DEPTH_FLOAT32)
+      fp_state = _al_kcm_flush_denormals();
+
+   /* With a gain of 0 nothing of the instances would be heard, unless the
+    * post-processing callback does something about it.
+    */
+   muted = mixer->ss.gain == 0.0f && !mixer->postprocess_callback;
+
    /* Mix the streams into the mixer buffer. */
    for (i = _al_vector_size(&mixer->streams) - 1; i >= 0; i--) {
       ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
       ALLEGRO_SAMPLE_INSTANCE *spl = *slot;
       ASSERT(spl->spl_read);
-      spl->spl_read(spl, (void **) &mixer->ss.spl_data.buffer.ptr, samples,
-         m->ss.spl_data.depth, maxc);
+      if (is_inaudible(spl, muted, *samples)) {
+         if (spl->is_playing)
+            advance_ramps(m, spl, *samples);
+         skip_sample_instance(spl, *samples);
+         continue;
+      }
+      if (!spl->is_mixer && spl->is_playing)
+         m->audible = true;
+      if (is_ramping(spl) && spl->is_playing)
+         read_ramping(m, spl, *samples, maxc);
+      else
+         spl->spl_read(spl, (void **) &mixer->ss.spl_data.buffer.ptr, samples,
+            m->ss.spl_data.depth, maxc);
+      if (spl->is_mixer && spl->is_playing && ((ALLEGRO_MIXER *)spl)->audible)
+         m->audible = true;
    }
 
    /* Call the post-processing callback. */
    if (mixer->postprocess_callback) {
       mixer->postprocess_callback(mixer->ss.spl_data.buffer.ptr,
          *samples, mixer->pp_callback_userdata);
+      m->audible = true;
    }
 
    samples_l *= maxc;
 
    /* Apply the gain if necessary. */
-   if (mixer->ss.gain != 1.0f) {
+   if (m->audible && mixer->ss.gain != 1.0f) {
       float mixer_gain = mixer->ss.gain;
       unsigned long i = samples_l;
 
       switch (m->ss.spl_data.depth) {
          case ALLEGRO_AUDIO_DEPTH_FLOAT32: {
-            float *p = mixer->ss.spl_data.buffer.f32;
-            while (i-- > 0) {
-               *p++ *= mixer_gain;
-            }
+            _al_kcm_scale_f32(mixer->ss.spl_data.buffer.f32, i, mixer_gain);
             break;
          }
 
@@ -451,20 +1165,51 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
       }
    }
 
+   if (m->ss.spl_data.depth == ALLEGRO_AUDIO_DEPTH_FLOAT32)
+      _al_kcm_restore_denormals(fp_state);
+
+   _al_kcm_update_timing(&m->timing, start, *samples,
+      m->ss.spl_data.frequency);
+
+   return true;
+}
+
+
+/* mixer_read:
+ *  Mixes the streams attached to the mixer and writes additively to the
+ *  specified buffer (or if *buf is NULL, indicating a voice, convert it and
+ *  set it to the buffer pointer).
+ */
+static void mixer_read(void *source, void **buf, unsigned int *samples,
+   ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+{
+   const ALLEGRO_MIXER *mixer;
+   ALLEGRO_MIXER *m = (ALLEGRO_MIXER *)source;
+   int maxc = al_get_channel_count(m->ss.spl_data.chan_conf);
+   int samples_l = *samples * maxc;
+
+   if (!m->ss.is_playing)
+      return;
+
+   if (m->prerendered)
+      m->prerendered = false;
+   else if (!render_mixer(m, samples))
+      return;
+
+   mixer = m;
+
    /* Feeding to a non-voice.
     * Currently we only support mixers of the same audio depth doing this.
+    * A silent buffer has nothing to add.
     */
    if (*buf) {
+      if (!m->audible)
+         return;
       switch (m->ss.spl_data.depth) {
          case ALLEGRO_AUDIO_DEPTH_FLOAT32: {
             /* We don't need to clamp in the mixer yet. */
-            float *lbuf = *buf;
-            float *src = mixer->ss.spl_data.buffer.f32;
-            while (samples_l-- > 0) {
-               *lbuf += *src;
-               lbuf++;
-               src++;
-            }
+            _al_kcm_accumulate_f32(*buf, mixer->ss.spl_data.buffer.f32,
+               samples_l);
             break;
 
          case ALLEGRO_AUDIO_DEPTH_INT16: {
@@ -625,6 +1370,18 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
 }
 
 
+/* _al_kcm_mixer_read:
+ *  The read method of mixers, see mixer_read.
+ */
+void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
+   ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+{
+   _AL_BEGIN_CPU_ZONE("_al_kcm_mixer_read");
+   mixer_read(source, buf, samples, buffer_depth, dest_maxc);
+   _AL_END_CPU_ZONE();
+}
+
+
 /* Function: al_create_mixer
  */
 ALLEGRO_MIXER *al_create_mixer(unsigned int freq,
@@ -650,6 +1407,10 @@ ALLEGRO_MIXER *al_create_mixer(unsigned int freq,
          ALLEGRO_INFO("Cubic interpolation\n");
          default_mixer_quality = ALLEGRO_MIXER_QUALITY_CUBIC;
       }
+      else if (!_al_stricmp(p, "sinc")) {
+         ALLEGRO_INFO("Sinc interpolation\n");
+         default_mixer_quality = ALLEGRO_MIXER_QUALITY_SINC;
+      }
    }
 
    if (!freq) {
@@ -688,6 +1449,8 @@ ALLEGRO_MIXER *al_create_mixer(unsigned int freq,
 
    _al_vector_init(&mixer->streams, sizeof(ALLEGRO_SAMPLE_INSTANCE *));
 
+   mixer->command_mutex = al_create_mutex();
+
    mixer->dtor_item = _al_kcm_register_destructor("mixer", mixer, (void (*)(void *)) al_destroy_mixer);
 
    return mixer;
@@ -737,22 +1500,31 @@ bool al_attach_sample_instance_to_mixer(ALLEGRO_SAMPLE_INSTANCE *spl,
       return false;
    }
    (*slot) = spl;
+   spl->parent_index = _al_vector_size(&mixer->streams) - 1;
 
-   spl->step = (spl->spl_data.frequency) * spl->speed;
-   spl->step_denom = mixer->ss.spl_data.frequency;
-   /* Don't want to be trapped with a step value of 0. */
-   if (spl->step == 0) {
-      if (spl->speed > 0.0f)
-         spl->step = 1;
-      else
-         spl->step = -1;
-   }
+   _al_kcm_mixer_rejig_sample_step(mixer, spl);
 
    /* Set the proper sample stream reader. */
    ASSERT(spl->spl_read == NULL);
    if (spl->is_mixer) {
       spl->spl_read = _al_kcm_mixer_read;
    }
+   else if (spl->spl_data.compressed) {
+      bool point = (mixer->quality == ALLEGRO_MIXER_QUALITY_POINT);
+
+      /* Cubic and sinc quality fall back to linear interpolation here. */
+      if (mixer->ss.spl_data.depth == ALLEGRO_AUDIO_DEPTH_FLOAT32) {
+         spl->spl_read = point ? read_compressed_to_mixer_point_float_32
+            : read_compressed_to_mixer_linear_float_32;
+      }
+      else {
+         ASSERT(mixer->ss.spl_data.depth == ALLEGRO_AUDIO_DEPTH_INT16);
+         spl->spl_read = point ? read_compressed_to_mixer_point_int16_t_16
+            : read_compressed_to_mixer_linear_int16_t_16;
+      }
+
+      _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
+   }
    else {
       switch (mixer->ss.spl_data.depth) {
          case ALLEGRO_AUDIO_DEPTH_FLOAT32:
@@ -763,6 +1535,16 @@ bool al_attach_sample_instance_to_mixer(ALLEGRO_SAMPLE_INSTANCE *spl,
                case ALLEGRO_MIXER_QUALITY_LINEAR:
                   spl->spl_read = read_to_mixer_linear_float_32;
                   break;
+               case ALLEGRO_MIXER_QUALITY_SINC:
+                  /* Streams only keep a few frames from before the current
+                   * fragment, not enough for the filter.
+                   */
+                  if (!is_stream(spl) && _al_kcm_init_sinc()) {
+                     spl->spl_read = read_to_mixer_sinc_float_32;
+                     break;
+                  }
+                  ALLEGRO_DEBUG("Falling back to cubic interpolation\n");
+                  /* fallthrough */
                case ALLEGRO_MIXER_QUALITY_CUBIC:
                   spl->spl_read = read_to_mixer_cubic_float_32;
                   break;
@@ -775,6 +1557,7 @@ bool al_attach_sample_instance_to_mixer(ALLEGRO_SAMPLE_INSTANCE *spl,
                   spl->spl_read = read_to_mixer_point_int16_t_16;
                   break;
                case ALLEGRO_MIXER_QUALITY_CUBIC:
+               case ALLEGRO_MIXER_QUALITY_SINC:
                   ALLEGRO_WARN("Falling back to linear interpolation\n");
                   /* fallthrough */
                case ALLEGRO_MIXER_QUALITY_LINEAR:
@@ -905,6 +1688,16 @@ ALLEGRO_MIXER_QUALITY al_get_mixer_quality(const ALLEGRO_MIXER *mixer)
 }
 
 
+/* Function: al_get_mixer_parallel
+ */
+bool al_get_mixer_parallel(const ALLEGRO_MIXER *mixer)
+{
+   ASSERT(mixer);
+
+   return mixer->parallel;
+}
+
+
 /* Function: al_get_mixer_gain
  */
 float al_get_mixer_gain(const ALLEGRO_MIXER *mixer)
@@ -915,6 +1708,23 @@ float al_get_mixer_gain(const ALLEGRO_MIXER *mixer)
 }
 
 
+/* Function: al_get_mixer_timing
+ */
+void al_get_mixer_timing(const ALLEGRO_MIXER *mixer,
+   ALLEGRO_AUDIO_TIMING *timing)
+{
+   ASSERT(mixer);
+   ASSERT(timing);
+
+   maybe_lock_mutex(mixer->ss.mutex);
+   timing->last_time = mixer->timing.last_time;
+   timing->max_time = mixer->timing.max_time;
+   timing->period = mixer->timing.period;
+   timing->underruns = mixer->timing.underruns;
+   maybe_unlock_mutex(mixer->ss.mutex);
+}
+
+
 /* Function: al_get_mixer_playing
  */
 bool al_get_mixer_playing(const ALLEGRO_MIXER *mixer)
@@ -992,6 +1802,20 @@ bool al_set_mixer_quality(ALLEGRO_MIXER *mixer, ALLEGRO_MIXER_QUALITY new_qualit
 }
 
 
+/* Function: al_set_mixer_parallel
+ */
+bool al_set_mixer_parallel(ALLEGRO_MIXER *mixer, bool parallel)
+{
+   ASSERT(mixer);
+
+   maybe_lock_mutex(mixer->ss.mutex);
+   mixer->parallel = parallel;
+   maybe_unlock_mutex(mixer->ss.mutex);
+
+   return true;
+}
+
+
 /* Function: al_set_mixer_gain
  */
 bool al_set_mixer_gain(ALLEGRO_MIXER *mixer, float new_gain)
@@ -0,0 +1,737 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Vectorised float32 mixing loops.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+#include "allegro5/internal/aintern_cpu.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+/*
+ * The mixer loops that run once per sample frame of every playing sample
+ * instance, or once per value of a mixer buffer.
+ *
+ * _al_kcm_mix_frames_f32 is what the float32 point and linear mixers do for
+ * each frame when a sample plays at the mixer's own frequency: interpolate
+ * (or just read) the source frame, apply the channel matrix and add it to the
+ * mixer buffer. The vector versions cover mono and stereo on both sides and
+ * leave other channel layouts to the scalar loop. They do the same float
+ * operations in the same order as the scalar code, one product added at a
+ * time starting from the last source channel, so the mix comes out the same
+ * whichever version is used.
+ *
+ * _al_kcm_sinc_f32 is the inner loop of the sinc resampler, one dot product
+ * of the filter coefficients with the source frames per channel. The vector
+ * versions add up the products in a different order, so the last bits of
+ * the result can differ between them.
+ *
+ * The vector versions are picked by _al_kcm_init_mixer_simd from
+ * al_get_cpu_features, so that 32-bit x86 builds can use SSE2 without
+ * requiring it.
+ */
+
+static void scale_generic(float *p, size_t n, float gain)
+{
+   while (n-- > 0)
+      *p++ *= gain;
+}
+
+
+static void accumulate_generic(float *dst, const float *src, size_t n)
+{
+   while (n-- > 0)
+      *dst++ += *src++;
+}
+
+
+static void mix_frames_generic(float *buf, const float *x0, const float *x1,
+   float t, size_t frames, size_t maxc, size_t dest_maxc, const float *matrix)
+{
+   const float u = 1.0f - t;
+   float s[ALLEGRO_MAX_CHANNELS];
+   size_t i, c, k;
+
+   for (i = 0; i < frames; i++) {
+      for (k = 0; k < maxc; k++)
+         s[k] = x1 ? (x0[k] * u) + (x1[k] * t) : x0[k];
+
+      for (c = 0; c < dest_maxc; c++) {
+         const float *m = matrix + c * maxc;
+         float acc = buf[c];
+         for (k = maxc; k-- > 0;)
+            acc += s[k] * m[k];
+         buf[c] = acc;
+      }
+
+      buf += dest_maxc;
+      x0 += maxc;
+      if (x1)
+         x1 += maxc;
+   }
+}
+
+
+/* Adds the products of taps frames to out. */
+static void sinc_add_generic(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc)
+{
+   size_t j, k;
+
+   for (j = 0; j < taps; j++) {
+      const float c = c1 ? c0[j] + (c1[j] - c0[j]) * t : c0[j];
+      for (k = 0; k < maxc; k++)
+         out[k] += x[k] * c;
+      x += maxc;
+   }
+}
+
+
+static void sinc_generic(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc)
+{
+   size_t k;
+
+   for (k = 0; k < maxc; k++)
+      out[k] = 0.0f;
+   sinc_add_generic(out, x, c0, c1, t, taps, maxc);
+}
+
+
+#ifdef _AL_SIMD_X86
+
+_AL_TARGET_SSE2
+static void scale_sse2(float *p, size_t n, float gain)
+{
+   const __m128 g = _mm_set1_ps(gain);
+   size_t i;
+
+   for (i = 0; i + 4 <= n; i += 4)
+      _mm_storeu_ps(p + i, _mm_mul_ps(_mm_loadu_ps(p + i), g));
+   scale_generic(p + i, n - i, gain);
+}
+
+
+_AL_TARGET_SSE2
+static void accumulate_sse2(float *dst, const float *src, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i + 4 <= n; i += 4) {
+      _mm_storeu_ps(dst + i,
+         _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+   }
+   accumulate_generic(dst + i, src + i, n - i);
+}
+
+
+/* Four source values, interpolated if x1 is given. */
+_AL_TARGET_SSE2
+static INLINE __m128 load_sse2(const float *x0, const float *x1,
+   __m128 u, __m128 t)
+{
+   __m128 a = _mm_loadu_ps(x0);
+   if (!x1)
+      return a;
+   return _mm_add_ps(_mm_mul_ps(a, u), _mm_mul_ps(_mm_loadu_ps(x1), t));
+}
+
+
+/* Returns how many frames were mixed. */
+_AL_TARGET_SSE2
+static size_t mix_frames_sse2_part(float *buf, const float *x0,
+   const float *x1, float t, size_t frames, size_t maxc, size_t dest_maxc,
+   const float *m)
+{
+   const __m128 vt = _mm_set1_ps(t);
+   const __m128 vu = _mm_set1_ps(1.0f - t);
+   size_t i = 0;
+
+   if (maxc == 1 && dest_maxc == 1) {
+      const __m128 m0 = _mm_set1_ps(m[0]);
+      for (; i + 4 <= frames; i += 4) {
+         __m128 s = load_sse2(x0 + i, x1 ? x1 + i : NULL, vu, vt);
+         __m128 b = _mm_loadu_ps(buf + i);
+         _mm_storeu_ps(buf + i, _mm_add_ps(b, _mm_mul_ps(s, m0)));
+      }
+   }
+   else if (maxc == 1 && dest_maxc == 2) {
+      const __m128 mm = _mm_setr_ps(m[0], m[1], m[0], m[1]);
+      for (; i + 4 <= frames; i += 4) {
+         __m128 s = load_sse2(x0 + i, x1 ? x1 + i : NULL, vu, vt);
+         __m128 b0 = _mm_loadu_ps(buf + 2*i);
+         __m128 b1 = _mm_loadu_ps(buf + 2*i + 4);
+         b0 = _mm_add_ps(b0, _mm_mul_ps(_mm_unpacklo_ps(s, s), mm));
+         b1 = _mm_add_ps(b1, _mm_mul_ps(_mm_unpackhi_ps(s, s), mm));
+         _mm_storeu_ps(buf + 2*i, b0);
+         _mm_storeu_ps(buf + 2*i + 4, b1);
+      }
+   }
+   else if (maxc == 2 && dest_maxc == 1) {
+      const __m128 m0 = _mm_set1_ps(m[0]);
+      const __m128 m1 = _mm_set1_ps(m[1]);
+      for (; i + 4 <= frames; i += 4) {
+         __m128 a = load_sse2(x0 + 2*i, x1 ? x1 + 2*i : NULL, vu, vt);
+         __m128 c = load_sse2(x0 + 2*i + 4, x1 ? x1 + 2*i + 4 : NULL,
+            vu, vt);
+         __m128 l = _mm_shuffle_ps(a, c, _MM_SHUFFLE(2, 0, 2, 0));
+         __m128 r = _mm_shuffle_ps(a, c, _MM_SHUFFLE(3, 1, 3, 1));
+         __m128 b = _mm_loadu_ps(buf + i);
+         b = _mm_add_ps(b, _mm_mul_ps(r, m1));
+         b = _mm_add_ps(b, _mm_mul_ps(l, m0));
+         _mm_storeu_ps(buf + i, b);
+      }
+   }
+   else if (maxc == 2 && dest_maxc == 2) {
+      /* Each output takes the right source channel first, then the left. */
+      const __m128 mr = _mm_setr_ps(m[1], m[3], m[1], m[3]);
+      const __m128 ml = _mm_setr_ps(m[0], m[2], m[0], m[2]);
+      for (; i + 2 <= frames; i += 2) {
+         __m128 s = load_sse2(x0 + 2*i, x1 ? x1 + 2*i : NULL, vu, vt);
+         __m128 r = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 1, 1));
+         __m128 l = _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 2, 0, 0));
+         __m128 b = _mm_loadu_ps(buf + 2*i);
+         b = _mm_add_ps(b, _mm_mul_ps(r, mr));
+         b = _mm_add_ps(b, _mm_mul_ps(l, ml));
+         _mm_storeu_ps(buf + 2*i, b);
+      }
+   }
+
+   return i;
+}
+
+
+static void mix_frames_sse2(float *buf, const float *x0, const float *x1,
+   float t, size_t frames, size_t maxc, size_t dest_maxc, const float *matrix)
+{
+   size_t i = mix_frames_sse2_part(buf, x0, x1, t, frames, maxc, dest_maxc,
+      matrix);
+   mix_frames_generic(buf + i * dest_maxc, x0 + i * maxc,
+      x1 ? x1 + i * maxc : NULL, t, frames - i, maxc, dest_maxc, matrix);
+}
+
+
+/* Four coefficients, interpolated if c1 is given. */
+_AL_TARGET_SSE2
+static INLINE __m128 coefs_sse2(const float *c0, const float *c1, __m128 t)
+{
+   __m128 a = _mm_loadu_ps(c0);
+   if (!c1)
+      return a;
+   return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(c1), a), t));
+}
+
+
+_AL_TARGET_SSE2
+static INLINE float hsum_sse2(__m128 v)
+{
+   v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+   v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+   return _mm_cvtss_f32(v);
+}
+
+
+_AL_TARGET_SSE2
+static void sinc_sse2(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc)
+{
+   const __m128 vt = _mm_set1_ps(t);
+   __m128 acc = _mm_setzero_ps();
+   size_t j = 0;
+
+   if (maxc == 1) {
+      for (; j + 4 <= taps; j += 4) {
+         __m128 c = coefs_sse2(c0 + j, c1 ? c1 + j : NULL, vt);
+         acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + j), c));
+      }
+      out[0] = hsum_sse2(acc);
+   }
+   else if (maxc == 2) {
+      for (; j + 4 <= taps; j += 4) {
+         __m128 c = coefs_sse2(c0 + j, c1 ? c1 + j : NULL, vt);
+         acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + 2*j),
+            _mm_unpacklo_ps(c, c)));
+         acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + 2*j + 4),
+            _mm_unpackhi_ps(c, c)));
+      }
+      acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+      out[0] = _mm_cvtss_f32(acc);
+      out[1] = _mm_cvtss_f32(_mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+   }
+   else {
+      sinc_generic(out, x, c0, c1, t, taps, maxc);
+      return;
+   }
+
+   sinc_add_generic(out, x + j * maxc, c0 + j, c1 ? c1 + j : NULL, t,
+      taps - j, maxc);
+}
+
+
+_AL_TARGET_AVX2
+static void scale_avx2(float *p, size_t n, float gain)
+{
+   const __m256 g = _mm256_set1_ps(gain);
+   size_t i;
+
+   for (i = 0; i + 8 <= n; i += 8)
+      _mm256_storeu_ps(p + i, _mm256_mul_ps(_mm256_loadu_ps(p + i), g));
+   scale_sse2(p + i, n - i, gain);
+}
+
+
+_AL_TARGET_AVX2
+static void accumulate_avx2(float *dst, const float *src, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i + 8 <= n; i += 8) {
+      _mm256_storeu_ps(dst + i,
+         _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+   }
+   accumulate_sse2(dst + i, src + i, n - i);
+}
+
+
+_AL_TARGET_AVX2
+static INLINE __m256 load_avx2(const float *x0, const float *x1,
+   __m256 u, __m256 t)
+{
+   __m256 a = _mm256_loadu_ps(x0);
+   if (!x1)
+      return a;
+   return _mm256_add_ps(_mm256_mul_ps(a, u),
+      _mm256_mul_ps(_mm256_loadu_ps(x1), t));
+}
+
+
+/* Like mix_frames_sse2_part, eight values at a time. The shuffles only work
+ * within 128-bit lanes, hence the extra permutes.
+ */
+_AL_TARGET_AVX2
+static size_t mix_frames_avx2_part(float *buf, const float *x0,
+   const float *x1, float t, size_t frames, size_t maxc, size_t dest_maxc,
+   const float *m)
+{
+   const __m256 vt = _mm256_set1_ps(t);
+   const __m256 vu = _mm256_set1_ps(1.0f - t);
+   size_t i = 0;
+
+   if (maxc == 1 && dest_maxc == 1) {
+      const __m256 m0 = _mm256_set1_ps(m[0]);
+      for (; i + 8 <= frames; i += 8) {
+         __m256 s = load_avx2(x0 + i, x1 ? x1 + i : NULL, vu, vt);
+         __m256 b = _mm256_loadu_ps(buf + i);
+         _mm256_storeu_ps(buf + i, _mm256_add_ps(b, _mm256_mul_ps(s, m0)));
+      }
+   }
+   else if (maxc == 1 && dest_maxc == 2) {
+      const __m256 mm = _mm256_setr_ps(m[0], m[1], m[0], m[1],
+         m[0], m[1], m[0], m[1]);
+      for (; i + 8 <= frames; i += 8) {
+         __m256 s = load_avx2(x0 + i, x1 ? x1 + i : NULL, vu, vt);
+         __m256 lo = _mm256_unpacklo_ps(s, s);
+         __m256 hi = _mm256_unpackhi_ps(s, s);
+         __m256 d0 = _mm256_permute2f128_ps(lo, hi, 0x20);
+         __m256 d1 = _mm256_permute2f128_ps(lo, hi, 0x31);
+         __m256 b0 = _mm256_loadu_ps(buf + 2*i);
+         __m256 b1 = _mm256_loadu_ps(buf + 2*i + 8);
+         b0 = _mm256_add_ps(b0, _mm256_mul_ps(d0, mm));
+         b1 = _mm256_add_ps(b1, _mm256_mul_ps(d1, mm));
+         _mm256_storeu_ps(buf + 2*i, b0);
+         _mm256_storeu_ps(buf + 2*i + 8, b1);
+      }
+   }
+   else if (maxc == 2 && dest_maxc == 1) {
+      const __m256 m0 = _mm256_set1_ps(m[0]);
+      const __m256 m1 = _mm256_set1_ps(m[1]);
+      for (; i + 8 <= frames; i += 8) {
+         __m256 a = load_avx2(x0 + 2*i, x1 ? x1 + 2*i : NULL, vu, vt);
+         __m256 c = load_avx2(x0 + 2*i + 8, x1 ? x1 + 2*i + 8 : NULL, vu, vt);
+         __m256 l = _mm256_shuffle_ps(a, c, _MM_SHUFFLE(2, 0, 2, 0));
+         __m256 r = _mm256_shuffle_ps(a, c, _MM_SHUFFLE(3, 1, 3, 1));
+         __m256 b = _mm256_loadu_ps(buf + i);
+         l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+         r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r),
+            _MM_SHUFFLE(3, 1, 2, 0)));
+         b = _mm256_add_ps(b, _mm256_mul_ps(r, m1));
+         b = _mm256_add_ps(b, _mm256_mul_ps(l, m0));
+         _mm256_storeu_ps(buf + i, b);
+      }
+   }
+   else if (maxc == 2 && dest_maxc == 2) {
+      const __m256 mr = _mm256_setr_ps(m[1], m[3], m[1], m[3],
+         m[1], m[3], m[1], m[3]);
+      const __m256 ml = _mm256_setr_ps(m[0], m[2], m[0], m[2],
+         m[0], m[2], m[0], m[2]);
+      for (; i + 4 <= frames; i += 4) {
+         __m256 s = load_avx2(x0 + 2*i, x1 ? x1 + 2*i : NULL, vu, vt);
+         __m256 b = _mm256_loadu_ps(buf + 2*i);
+         b = _mm256_add_ps(b, _mm256_mul_ps(_mm256_movehdup_ps(s), mr));
+         b = _mm256_add_ps(b, _mm256_mul_ps(_mm256_moveldup_ps(s), ml));
+         _mm256_storeu_ps(buf + 2*i, b);
+      }
+   }
+
+   return i;
+}
+
+
+static void mix_frames_avx2(float *buf, const float *x0, const float *x1,
+   float t, size_t frames, size_t maxc, size_t dest_maxc, const float *matrix)
+{
+   size_t i = mix_frames_avx2_part(buf, x0, x1, t, frames, maxc, dest_maxc,
+      matrix);
+   mix_frames_sse2(buf + i * dest_maxc, x0 + i * maxc,
+      x1 ? x1 + i * maxc : NULL, t, frames - i, maxc, dest_maxc, matrix);
+}
+
+
+_AL_TARGET_AVX2
+static INLINE __m256 coefs_avx2(const float *c0, const float *c1, __m256 t)
+{
+   __m256 a = _mm256_loadu_ps(c0);
+   if (!c1)
+      return a;
+   return _mm256_add_ps(a,
+      _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(c1), a), t));
+}
+
+
+/* Like sinc_sse2, eight taps at a time. */
+_AL_TARGET_AVX2
+static void sinc_avx2(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc)
+{
+   const __m256 vt = _mm256_set1_ps(t);
+   __m256 acc = _mm256_setzero_ps();
+   __m128 sum;
+   size_t j = 0;
+
+   if (maxc == 1) {
+      for (; j + 8 <= taps; j += 8) {
+         __m256 c = coefs_avx2(c0 + j, c1 ? c1 + j : NULL, vt);
+         acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + j), c));
+      }
+      sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+         _mm256_extractf128_ps(acc, 1));
+      out[0] = hsum_sse2(sum);
+   }
+   else if (maxc == 2) {
+      for (; j + 8 <= taps; j += 8) {
+         __m256 c = coefs_avx2(c0 + j, c1 ? c1 + j : NULL, vt);
+         __m256 a = _mm256_loadu_ps(x + 2*j);
+         __m256 b = _mm256_loadu_ps(x + 2*j + 8);
+         /* Frames 0 1 4 5 and 2 3 6 7, to go with the unpacked taps. */
+         __m256 lo = _mm256_permute2f128_ps(a, b, 0x20);
+         __m256 hi = _mm256_permute2f128_ps(a, b, 0x31);
+         acc = _mm256_add_ps(acc, _mm256_mul_ps(lo, _mm256_unpacklo_ps(c, c)));
+         acc = _mm256_add_ps(acc, _mm256_mul_ps(hi, _mm256_unpackhi_ps(c, c)));
+      }
+      sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+         _mm256_extractf128_ps(acc, 1));
+      sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+      out[0] = _mm_cvtss_f32(sum);
+      out[1] = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+   }
+   else {
+      sinc_generic(out, x, c0, c1, t, taps, maxc);
+      return;
+   }
+
+   sinc_add_generic(out, x + j * maxc, c0 + j, c1 ? c1 + j : NULL, t,
+      taps - j, maxc);
+}
+
+#endif /* _AL_SIMD_X86 */
+
+
+#ifdef _AL_SIMD_NEON
+
+static void scale_neon(float *p, size_t n, float gain)
+{
+   const float32x4_t g = vdupq_n_f32(gain);
+   size_t i;
+
+   for (i = 0; i + 4 <= n; i += 4)
+      vst1q_f32(p + i, vmulq_f32(vld1q_f32(p + i), g));
+   scale_generic(p + i, n - i, gain);
+}
+
+
+static void accumulate_neon(float *dst, const float *src, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i + 4 <= n; i += 4)
+      vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+   accumulate_generic(dst + i, src + i, n - i);
+}
+
+
+#ifdef __aarch64__
+
+static INLINE float32x4_t load_neon(const float *x0, const float *x1,
+   float32x4_t u, float32x4_t t)
+{
+   float32x4_t a = vld1q_f32(x0);
+   if (!x1)
+      return a;
+   /* Not vmlaq_f32, that may become a fused multiply-add. */
+   return vaddq_f32(vmulq_f32(a, u), vmulq_f32(vld1q_f32(x1), t));
+}
+
+
+static void mix_frames_neon(float *buf, const float *x0, const float *x1,
+   float t, size_t frames, size_t maxc, size_t dest_maxc, const float *m)
+{
+   const float32x4_t vt = vdupq_n_f32(t);
+   const float32x4_t vu = vdupq_n_f32(1.0f - t);
+   size_t i = 0;
+
+   if (maxc == 1 && dest_maxc == 1) {
+      const float32x4_t m0 = vdupq_n_f32(m[0]);
+      for (; i + 4 <= frames; i += 4) {
+         float32x4_t s = load_neon(x0 + i, x1 ? x1 + i : NULL, vu, vt);
+         float32x4_t b = vld1q_f32(buf + i);
+         vst1q_f32(buf + i, vaddq_f32(b, vmulq_f32(s, m0)));
+      }
+   }
+   else if (maxc == 1 && dest_maxc == 2) {
+      const float mv[4] = {m[0], m[1], m[0], m[1]};
+      const float32x4_t mm = vld1q_f32(mv);
+      for (; i + 4 <= frames; i += 4) {
+         float32x4_t s = load_neon(x0 + i, x1 ? x1 + i : NULL, vu, vt);
+         float32x4_t b0 = vld1q_f32(buf + 2*i);
+         float32x4_t b1 = vld1q_f32(buf + 2*i + 4);
+         b0 = vaddq_f32(b0, vmulq_f32(vzip1q_f32(s, s), mm));
+         b1 = vaddq_f32(b1, vmulq_f32(vzip2q_f32(s, s), mm));
+         vst1q_f32(buf + 2*i, b0);
+         vst1q_f32(buf + 2*i + 4, b1);
+      }
+   }
+   else if (maxc == 2 && dest_maxc == 1) {
+      const float32x4_t m0 = vdupq_n_f32(m[0]);
+      const float32x4_t m1 = vdupq_n_f32(m[1]);
+      for (; i + 4 <= frames; i += 4) {
+         float32x4_t a = load_neon(x0 + 2*i, x1 ? x1 + 2*i : NULL, vu, vt);
+         float32x4_t c = load_neon(x0 + 2*i + 4, x1 ? x1 + 2*i + 4 : NULL,
+            vu, vt);
+         float32x4_t b = vld1q_f32(buf + i);
+         b = vaddq_f32(b, vmulq_f32(vuzp2q_f32(a, c), m1));
+         b = vaddq_f32(b, vmulq_f32(vuzp1q_f32(a, c), m0));
+         vst1q_f32(buf + i, b);
+      }
+   }
+   else if (maxc == 2 && dest_maxc == 2) {
+      const float mrv[4] = {m[1], m[3], m[1], m[3]};
+      const float mlv[4] = {m[0], m[2], m[0], m[2]};
+      const float32x4_t mr = vld1q_f32(mrv);
+      const float32x4_t ml = vld1q_f32(mlv);
+      for (; i + 2 <= frames; i += 2) {
+         float32x4_t s = load_neon(x0 + 2*i, x1 ? x1 + 2*i : NULL, vu, vt);
+         float32x4_t b = vld1q_f32(buf + 2*i);
+         b = vaddq_f32(b, vmulq_f32(vtrn2q_f32(s, s), mr));
+         b = vaddq_f32(b, vmulq_f32(vtrn1q_f32(s, s), ml));
+         vst1q_f32(buf + 2*i, b);
+      }
+   }
+
+   mix_frames_generic(buf + i * dest_maxc, x0 + i * maxc,
+      x1 ? x1 + i * maxc : NULL, t, frames - i, maxc, dest_maxc, m);
+}
+
+#endif /* __aarch64__ */
+
+
+static INLINE float32x4_t coefs_neon(const float *c0, const float *c1,
+   float32x4_t t)
+{
+   float32x4_t a = vld1q_f32(c0);
+   if (!c1)
+      return a;
+   return vaddq_f32(a, vmulq_f32(vsubq_f32(vld1q_f32(c1), a), t));
+}
+
+
+static INLINE float hsum_neon(float32x4_t v)
+{
+   float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+   return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+
+static void sinc_neon(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc)
+{
+   const float32x4_t vt = vdupq_n_f32(t);
+   size_t j = 0;
+
+   if (maxc == 1) {
+      float32x4_t acc = vdupq_n_f32(0.0f);
+      for (; j + 4 <= taps; j += 4) {
+         float32x4_t c = coefs_neon(c0 + j, c1 ? c1 + j : NULL, vt);
+         acc = vaddq_f32(acc, vmulq_f32(vld1q_f32(x + j), c));
+      }
+      out[0] = hsum_neon(acc);
+   }
+   else if (maxc == 2) {
+      float32x4_t l = vdupq_n_f32(0.0f);
+      float32x4_t r = vdupq_n_f32(0.0f);
+      for (; j + 4 <= taps; j += 4) {
+         float32x4_t c = coefs_neon(c0 + j, c1 ? c1 + j : NULL, vt);
+         float32x4x2_t s = vld2q_f32(x + 2*j);
+         l = vaddq_f32(l, vmulq_f32(s.val[0], c));
+         r = vaddq_f32(r, vmulq_f32(s.val[1], c));
+      }
+      out[0] = hsum_neon(l);
+      out[1] = hsum_neon(r);
+   }
+   else {
+      sinc_generic(out, x, c0, c1, t, taps, maxc);
+      return;
+   }
+
+   sinc_add_generic(out, x + j * maxc, c0 + j, c1 ? c1 + j : NULL, t,
+      taps - j, maxc);
+}
+
+#endif /* _AL_SIMD_NEON */
+
+
+/* Multiplies n values by gain. */
+void (*_al_kcm_scale_f32)(float *p, size_t n, float gain) = scale_generic;
+
+/* Adds n values of src to dst. */
+void (*_al_kcm_accumulate_f32)(float *dst, const float *src, size_t n) =
+   accumulate_generic;
+
+/* Mixes frames of maxc channels starting at x0 into buf, which has dest_maxc
+ * channels per frame, through the dest_maxc by maxc matrix. If x1 is not
+ * NULL, each source frame is interpolated between x0 and x1 by t.
+ */
+void (*_al_kcm_mix_frames_f32)(float *buf, const float *x0, const float *x1,
+   float t, size_t frames, size_t maxc, size_t dest_maxc,
+   const float *matrix) = mix_frames_generic;
+
+/* Sets out, maxc values, to the sum over taps frames of maxc channels from x
+ * of each frame times its coefficient. The coefficients are c0, or c0 and c1
+ * interpolated by t if c1 is not NULL.
+ */
+void (*_al_kcm_sinc_f32)(float *out, const float *x, const float *c0,
+   const float *c1, float t, size_t taps, size_t maxc) = sinc_generic;
+
+
+#if defined(_AL_SIMD_X86)
+
+static bool have_mxcsr;
+
+/* Flush-to-zero and denormals-are-zero. */
+#define MXCSR_FTZ_DAZ   0x8040
+
+_AL_TARGET_SSE2 static uint64_t flush_denormals_sse2(void)
+{
+   unsigned int state = _mm_getcsr();
+   _mm_setcsr(state | MXCSR_FTZ_DAZ);
+   return state;
+}
+
+_AL_TARGET_SSE2 static void restore_denormals_sse2(uint64_t state)
+{
+   _mm_setcsr((unsigned int)state);
+}
+
+#endif
+
+
+/* _al_kcm_flush_denormals:
+ *  Makes float operations on this thread treat denormal numbers as zero, so
+ *  that signals decaying towards silence do not take the slow path in the
+ *  FPU. Returns the previous state for _al_kcm_restore_denormals. Does
+ *  nothing where the mode cannot be set.
+ */
+uint64_t _al_kcm_flush_denormals(void)
+{
+#if defined(_AL_SIMD_X86)
+   if (have_mxcsr)
+      return flush_denormals_sse2();
+   return 0;
+#elif defined(__aarch64__) && defined(__GNUC__)
+   uint64_t state;
+   __asm__ __volatile__("mrs %0, fpcr" : "=r"(state));
+   __asm__ __volatile__("msr fpcr, %0" : : "r"(state | (1 << 24)));
+   return state;
+#else
+   return 0;
+#endif
+}
+
+
+/* _al_kcm_restore_denormals:
+ *  Undoes _al_kcm_flush_denormals.
+ */
+void _al_kcm_restore_denormals(uint64_t state)
+{
+#if defined(_AL_SIMD_X86)
+   if (have_mxcsr)
+      restore_denormals_sse2(state);
+#elif defined(__aarch64__) && defined(__GNUC__)
+   __asm__ __volatile__("msr fpcr, %0" : : "r"(state));
+#else
+   (void)state;
+#endif
+}
+
+
+void _al_kcm_init_mixer_simd(void)
+{
+   int features = al_get_cpu_features();
+   (void)features;
+
+#if defined(_AL_SIMD_X86)
+   have_mxcsr = (features & ALLEGRO_CPU_SSE2) != 0;
+   if (features & ALLEGRO_CPU_SSE2) {
+      _al_kcm_scale_f32 = scale_sse2;
+      _al_kcm_accumulate_f32 = accumulate_sse2;
+      _al_kcm_mix_frames_f32 = mix_frames_sse2;
+      _al_kcm_sinc_f32 = sinc_sse2;
+      if (features & ALLEGRO_CPU_AVX2) {
+         _al_kcm_scale_f32 = scale_avx2;
+         _al_kcm_accumulate_f32 = accumulate_avx2;
+         _al_kcm_mix_frames_f32 = mix_frames_avx2;
+         _al_kcm_sinc_f32 = sinc_avx2;
+      }
+   }
+   ALLEGRO_DEBUG("Vector mixing (SSE2: %d, AVX2: %d).\n",
+      (features & ALLEGRO_CPU_SSE2) != 0, (features & ALLEGRO_CPU_AVX2) != 0);
+#elif defined(_AL_SIMD_NEON)
+   if (features & ALLEGRO_CPU_NEON) {
+      _al_kcm_scale_f32 = scale_neon;
+      _al_kcm_accumulate_f32 = accumulate_neon;
+      _al_kcm_sinc_f32 = sinc_neon;
+#ifdef __aarch64__
+      _al_kcm_mix_frames_f32 = mix_frames_neon;
+#endif
+   }
+   ALLEGRO_DEBUG("Vector mixing (NEON: %d).\n",
+      (features & ALLEGRO_CPU_NEON) != 0);
+#endif
+}
+
+/* vim: set sts=3 sw=3 et: */
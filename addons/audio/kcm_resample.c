@@ -0,0 +1,442 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Windowed sinc resampling.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <limits.h>
+#include <math.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+/* The filter is a sinc function under a Kaiser window, `length' taps long.
+ *
+ * For each of SINC_PHASES fractional positions between two source frames
+ * the polyphase table holds one row of `length' coefficients, normalised so
+ * that they add up to one. The coefficients for positions in between are
+ * interpolated from the two nearest rows. That is all a mixer needs as long
+ * as the sample does not play faster than the mixer's frequency.
+ *
+ * When it does, the filter's cutoff has to come down by the same ratio, so
+ * the window is stretched over more source frames. Those coefficients are
+ * looked up in the fine table instead, which holds one side of the
+ * (symmetric) kernel at SINC_PHASES points per source frame.
+ */
+#define SINC_PHASES           256
+#define SINC_DEFAULT_LENGTH   16
+#define SINC_MIN_LENGTH       8
+#define KAISER_BETA           8.0
+
+typedef struct SINC_TABLE {
+   int length;
+   float *poly;         /* (SINC_PHASES + 1) rows of `length' values */
+   float *fine;         /* length / 2 * SINC_PHASES + 1 values */
+} SINC_TABLE;
+
+static SINC_TABLE sinc;
+
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x)
+{
+   double sum = 1.0;
+   double term = 1.0;
+   int k;
+
+   for (k = 1; k < 64; k++) {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+      if (term < sum * 1e-12)
+         break;
+   }
+   return sum;
+}
+
+
+/* The kernel at x source frames from the centre, for half the length. */
+static double kernel(double x, int half)
+{
+   double r;
+   double s;
+
+   if (fabs(x) >= half)
+      return 0.0;
+
+   r = x / half;
+   s = (x == 0.0) ? 1.0 : sin(ALLEGRO_PI * x) / (ALLEGRO_PI * x);
+   return s * bessel_i0(KAISER_BETA * sqrt(1.0 - r * r)) /
+      bessel_i0(KAISER_BETA);
+}
+
+
+static int get_sinc_length(void)
+{
+   const char *value;
+   int length = SINC_DEFAULT_LENGTH;
+
+   value = al_get_config_value(al_get_system_config(), "audio",
+      "sinc_length");
+   if (value && value[0] != '\0') {
+      length = atoi(value);
+      if (length < SINC_MIN_LENGTH)
+         length = SINC_MIN_LENGTH;
+      else if (length > _AL_KCM_SINC_MAX_LENGTH)
+         length = _AL_KCM_SINC_MAX_LENGTH;
+   }
+
+   /* Whole vectors of taps for the mixing loops. */
+   return (length + 3) & ~3;
+}
+
+
+/* _al_kcm_init_sinc:
+ *  Builds the filter tables, if they have not been built yet.
+ */
+bool _al_kcm_init_sinc(void)
+{
+   int length;
+   int half;
+   int p, j;
+   float *poly;
+   float *fine;
+
+   if (sinc.length)
+      return true;
+
+   length = get_sinc_length();
+   half = length / 2;
+
+   poly = al_malloc(sizeof(float) * (SINC_PHASES + 1) * length);
+   fine = al_malloc(sizeof(float) * (half * SINC_PHASES + 1));
+   if (!poly || !fine) {
+      al_free(poly);
+      al_free(fine);
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating sinc filter tables");
+      return false;
+   }
+
+   for (p = 0; p <= SINC_PHASES; p++) {
+      float *row = poly + p * length;
+      double frac = (double)p / SINC_PHASES;
+      double sum = 0.0;
+
+      /* Tap j is the source frame j - half + 1 frames from the current. */
+      for (j = 0; j < length; j++) {
+         double v = kernel(j - half + 1 - frac, half);
+         row[j] = v;
+         sum += v;
+      }
+      for (j = 0; j < length; j++)
+         row[j] /= sum;
+   }
+
+   for (j = 0; j <= half * SINC_PHASES; j++)
+      fine[j] = kernel((double)j / SINC_PHASES, half);
+
+   sinc.poly = poly;
+   sinc.fine = fine;
+   sinc.length = length;
+
+   ALLEGRO_DEBUG("Sinc filter with %d taps.\n", length);
+
+   return true;
+}
+
+
+/* _al_kcm_shutdown_sinc:
+ *  Frees the filter tables.
+ */
+void _al_kcm_shutdown_sinc(void)
+{
+   al_free(sinc.poly);
+   al_free(sinc.fine);
+   sinc.poly = NULL;
+   sinc.fine = NULL;
+   sinc.length = 0;
+}
+
+
+/* _al_kcm_sinc_max_taps:
+ *  Returns how many coefficients _al_kcm_sinc_filter may need at most when
+ *  playing ratio source frames per output frame.
+ */
+int _al_kcm_sinc_max_taps(float ratio)
+{
+   if (ratio <= 1.0f)
+      return sinc.length;
+   return (int)ceil(sinc.length * ratio) + 2;
+}
+
+
+/* _al_kcm_sinc_filter:
+ *  Sets up the filter for an output frame frac of the way from the current
+ *  source frame to the next, playing ratio source frames per output frame.
+ *  coef must have room for _al_kcm_sinc_max_taps(ratio) values.
+ */
+void _al_kcm_sinc_filter(_AL_KCM_SINC_FILTER *filter, float *coef,
+   float frac, float ratio)
+{
+   const int half = sinc.length / 2;
+   float reach;
+   float scale;
+   float sum = 0.0f;
+   int last;
+   int k;
+
+   ASSERT(sinc.length);
+
+   if (ratio <= 1.0f) {
+      float pf = frac * SINC_PHASES;
+      int p = (int)pf;
+
+      if (p >= SINC_PHASES)
+         p = SINC_PHASES - 1;
+      filter->first = 1 - half;
+      filter->taps = sinc.length;
+      filter->c0 = sinc.poly + p * sinc.length;
+      filter->c1 = filter->c0 + sinc.length;
+      filter->t = pf - p;
+      return;
+   }
+
+   /* The window stretched by ratio, with the taps that fall inside it. */
+   reach = half * ratio;
+   scale = SINC_PHASES / ratio;
+   filter->first = (int)floorf(frac - reach) + 1;
+   last = (int)ceilf(frac + reach) - 1;
+   filter->taps = last - filter->first + 1;
+
+   for (k = 0; k < filter->taps; k++) {
+      float x = fabsf(filter->first + k - frac) * scale;
+      int i = (int)x;
+      float v = 0.0f;
+
+      if (i < half * SINC_PHASES)
+         v = sinc.fine[i] + (sinc.fine[i + 1] - sinc.fine[i]) * (x - i);
+      coef[k] = v;
+      sum += v;
+   }
+   for (k = 0; k < filter->taps; k++)
+      coef[k] /= sum;
+
+   filter->c0 = coef;
+   filter->c1 = NULL;
+   filter->t = 0.0f;
+}
+
+
+/* _al_kcm_sample_frame_to_float:
+ *  Reads one frame of an uncompressed sample as float values, converting the
+ *  same way the float32 mixer does.
+ */
+void _al_kcm_sample_frame_to_float(float *dst, const ALLEGRO_SAMPLE *spl,
+   int frame, int maxc)
+{
+   const int i0 = frame * maxc;
+   int i;
+
+   switch (spl->depth) {
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+         for (i = 0; i < maxc; i++)
+            dst[i] = spl->buffer.f32[i0 + i];
+         break;
+      case ALLEGRO_AUDIO_DEPTH_INT24:
+         for (i = 0; i < maxc; i++)
+            dst[i] = (float) spl->buffer.s24[i0 + i] /
+               ((float) 0x7FFFFF + 0.5f);
+         break;
+      case ALLEGRO_AUDIO_DEPTH_UINT24:
+         for (i = 0; i < maxc; i++)
+            dst[i] = (float) spl->buffer.u24[i0 + i] /
+               ((float) 0x7FFFFF + 0.5f) - 1.0f;
+         break;
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         for (i = 0; i < maxc; i++)
+            dst[i] = (float) spl->buffer.s16[i0 + i] /
+               ((float) 0x7FFF + 0.5f);
+         break;
+      case ALLEGRO_AUDIO_DEPTH_UINT16:
+         for (i = 0; i < maxc; i++)
+            dst[i] = (float) spl->buffer.u16[i0 + i] /
+               ((float) 0x7FFF + 0.5f) - 1.0f;
+         break;
+      case ALLEGRO_AUDIO_DEPTH_INT8:
+         for (i = 0; i < maxc; i++)
+            dst[i] = (float) spl->buffer.s8[i0 + i] / ((float) 0x7F + 0.5f);
+         break;
+      case ALLEGRO_AUDIO_DEPTH_UINT8:
+         for (i = 0; i < maxc; i++)
+            dst[i] = (float) spl->buffer.u8[i0 + i] /
+               ((float) 0x7F + 0.5f) - 1.0f;
+         break;
+   }
+}
+
+
+/* Rounds v, clipped to -1 .. 1, to the integer scale. Unsigned depths use an
+ * offset of one.
+ */
+static INLINE int32_t to_int(float v, float scale, float offset)
+{
+   if (v > 1.0f)
+      v = 1.0f;
+   else if (v < -1.0f)
+      v = -1.0f;
+   return (int32_t)floorf((v + offset) * scale + 0.5f);
+}
+
+
+/* The inverse of _al_kcm_sample_frame_to_float. */
+static void float_to_sample_frame(ALLEGRO_SAMPLE *spl, int frame,
+   const float *src, int maxc)
+{
+   const int i0 = frame * maxc;
+   const float s24 = (float) 0x7FFFFF + 0.5f;
+   const float s16 = (float) 0x7FFF + 0.5f;
+   const float s8 = (float) 0x7F + 0.5f;
+   int i;
+
+   for (i = 0; i < maxc; i++) {
+      switch (spl->depth) {
+         case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+            spl->buffer.f32[i0 + i] = src[i];
+            break;
+         case ALLEGRO_AUDIO_DEPTH_INT24:
+            spl->buffer.s24[i0 + i] = _ALLEGRO_CLAMP(-0x800000,
+               to_int(src[i], s24, 0.0f), 0x7FFFFF);
+            break;
+         case ALLEGRO_AUDIO_DEPTH_UINT24:
+            spl->buffer.u24[i0 + i] = _ALLEGRO_CLAMP(0,
+               to_int(src[i], s24, 1.0f), 0xFFFFFF);
+            break;
+         case ALLEGRO_AUDIO_DEPTH_INT16:
+            spl->buffer.s16[i0 + i] = _ALLEGRO_CLAMP(-0x8000,
+               to_int(src[i], s16, 0.0f), 0x7FFF);
+            break;
+         case ALLEGRO_AUDIO_DEPTH_UINT16:
+            spl->buffer.u16[i0 + i] = _ALLEGRO_CLAMP(0,
+               to_int(src[i], s16, 1.0f), 0xFFFF);
+            break;
+         case ALLEGRO_AUDIO_DEPTH_INT8:
+            spl->buffer.s8[i0 + i] = _ALLEGRO_CLAMP(-0x80,
+               to_int(src[i], s8, 0.0f), 0x7F);
+            break;
+         case ALLEGRO_AUDIO_DEPTH_UINT8:
+            spl->buffer.u8[i0 + i] = _ALLEGRO_CLAMP(0,
+               to_int(src[i], s8, 1.0f), 0xFF);
+            break;
+      }
+   }
+}
+
+
+/* Function: al_resample_sample
+ */
+ALLEGRO_SAMPLE *al_resample_sample(const ALLEGRO_SAMPLE *spl,
+   unsigned int frequency)
+{
+   ALLEGRO_SAMPLE *rspl;
+   int maxc;
+   float ratio;
+   uint64_t len;
+   float *coef = NULL;
+   float *frames = NULL;
+   void *data = NULL;
+   int max_taps;
+   int i, k;
+
+   ASSERT(spl);
+
+   if (spl->compressed) {
+      _al_set_error(ALLEGRO_INVALID_PARAM, "Cannot resample a compressed sample");
+      return NULL;
+   }
+   if (!frequency) {
+      _al_set_error(ALLEGRO_INVALID_PARAM, "Invalid sample frequency");
+      return NULL;
+   }
+   if (!_al_kcm_init_sinc())
+      return NULL;
+
+   maxc = al_get_channel_count(spl->chan_conf);
+   ratio = (float)spl->frequency / frequency;
+   len = ((uint64_t)spl->len * frequency + spl->frequency - 1) /
+      spl->frequency;
+   if (len == 0 || len > INT_MAX) {
+      _al_set_error(ALLEGRO_INVALID_PARAM, "Invalid resampled length");
+      return NULL;
+   }
+
+   max_taps = _al_kcm_sinc_max_taps(ratio);
+   coef = al_malloc(sizeof(float) * max_taps);
+   frames = al_malloc(sizeof(float) * max_taps * maxc);
+   data = al_malloc(len * maxc * al_get_audio_depth_size(spl->depth));
+   if (!coef || !frames || !data) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating resampled sample");
+      goto Error;
+   }
+
+   rspl = al_create_sample(data, len, frequency, spl->depth, spl->chan_conf,
+      true);
+   if (!rspl)
+      goto Error;
+
+   for (i = 0; i < (int)len; i++) {
+      /* Exact source position, so that long samples do not drift. */
+      const uint64_t num = (uint64_t)i * spl->frequency;
+      const int pos = num / frequency;
+      const float frac = (float)(num % frequency) / frequency;
+      _AL_KCM_SINC_FILTER filter;
+      float out[ALLEGRO_MAX_CHANNELS];
+
+      _al_kcm_sinc_filter(&filter, coef, frac, ratio);
+
+      /* Beyond both ends of the sample there is silence. */
+      for (k = 0; k < filter.taps; k++) {
+         const int frame = pos + filter.first + k;
+         if (frame >= 0 && frame < spl->len)
+            _al_kcm_sample_frame_to_float(frames + k * maxc, spl, frame, maxc);
+         else
+            memset(frames + k * maxc, 0, sizeof(float) * maxc);
+      }
+
+      _al_kcm_sinc_f32(out, frames, filter.c0, filter.c1, filter.t,
+         filter.taps, maxc);
+      float_to_sample_frame(rspl, i, out, maxc);
+   }
+
+   al_free(coef);
+   al_free(frames);
+
+   ALLEGRO_DEBUG("Resampled %d frames at %u Hz to %d frames at %u Hz.\n",
+      spl->len, spl->frequency, (int)len, frequency);
+
+   return rspl;
+
+Error:
+   al_free(coef);
+   al_free(frames);
+   al_free(data);
+   return NULL;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
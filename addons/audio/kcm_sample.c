@@ -36,15 +36,25 @@ typedef struct AUTO_SAMPLE {
    ALLEGRO_SAMPLE_INSTANCE *instance;
    int id;
    bool locked;
+   int priority;
+   int group;
+   bool listed;   /* on free_slots */
 } AUTO_SAMPLE;
 
 static _AL_VECTOR auto_samples = _AL_VECTOR_INITIALIZER(AUTO_SAMPLE);
 
+/* Indices of auto_samples which were free when put there. Slots also become
+ * free on their own when they finish playing, those are picked up by
+ * reclaim_slots once this runs dry.
+ */
+static _AL_VECTOR free_slots = _AL_VECTOR_INITIALIZER(int);
+
 
 static bool create_default_mixer(void);
 static bool do_play_sample(ALLEGRO_SAMPLE_INSTANCE *spl, ALLEGRO_SAMPLE *data,
       float gain, float pan, float speed, ALLEGRO_PLAYMODE loop);
 static void free_sample_vector(void);
+static void reset_free_slots(void);
 
 
 static int string_to_depth(const char *s)
@@ -192,7 +202,10 @@ void al_destroy_sample(ALLEGRO_SAMPLE *spl)
          al_get_sample_data(spl));
       _al_kcm_unregister_destructor(spl->dtor_item);
 
-      if (spl->free_buf && spl->buffer.ptr) {
+      if (spl->unmap_buf) {
+         spl->unmap_buf(spl->mapping);
+      }
+      else if (spl->free_buf && spl->buffer.ptr) {
          al_free(spl->buffer.ptr);
       }
       spl->buffer.ptr = NULL;
@@ -227,6 +240,9 @@ bool al_reserve_samples(int reserve_samples)
          slot->id = 0;
          slot->instance = al_create_sample_instance(NULL);
          slot->locked = false;
+         slot->priority = 0;
+         slot->group = 0;
+         slot->listed = false;
          if (!slot->instance) {
             ALLEGRO_ERROR("al_create_sample failed\n");
             goto Error;
@@ -244,6 +260,7 @@ bool al_reserve_samples(int reserve_samples)
          al_destroy_sample_instance(slot->instance);
          _al_vector_delete_at(&auto_samples, current_samples_count);
       }
+      reset_free_slots();
    }
 
    return true;
@@ -273,6 +290,7 @@ bool al_set_default_mixer(ALLEGRO_MIXER *mixer)
       int i;
 
       default_mixer = mixer;
+      reset_free_slots();
 
       /* Destroy all current sample instances, recreate them, and
        * attach them to the new mixer */
@@ -337,14 +355,128 @@ void al_set_default_voice(ALLEGRO_VOICE *voice)
 }
 
 
+static bool slot_is_free(const AUTO_SAMPLE *slot)
+{
+   return !slot->locked && !al_get_sample_instance_playing(slot->instance);
+}
+
+
+/* Puts a slot on the free list if it is free and not there yet. */
+static void release_slot(int index)
+{
+   AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, index);
+
+   if (!slot->listed && slot_is_free(slot)) {
+      *(int *)_al_vector_alloc_back(&free_slots) = index;
+      slot->listed = true;
+   }
+}
+
+
+static void reset_free_slots(void)
+{
+   unsigned int i;
+
+   _al_vector_free(&free_slots);
+   for (i = 0; i < _al_vector_size(&auto_samples); i++) {
+      AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, i);
+      slot->listed = false;
+   }
+}
+
+
+static int pop_free_slot(void)
+{
+   while (_al_vector_is_nonempty(&free_slots)) {
+      unsigned int last = _al_vector_size(&free_slots) - 1;
+      int index = *(int *)_al_vector_ref(&free_slots, last);
+      AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, index);
+
+      _al_vector_delete_at(&free_slots, last);
+      slot->listed = false;
+      /* It may have been locked since. */
+      if (slot_is_free(slot))
+         return index;
+   }
+   return -1;
+}
+
+
+/* Lists all slots that have finished playing. Returns the slot to steal if
+ * there are none: the one with the lowest priority below the given one, and
+ * of those the quietest. Locked slots are never stolen.
+ */
+static int reclaim_slots(int priority)
+{
+   AUTO_SAMPLE *victim = NULL;
+   int victim_index = -1;
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&auto_samples); i++) {
+      AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, i);
+
+      if (slot_is_free(slot)) {
+         release_slot(i);
+         continue;
+      }
+      if (slot->locked || slot->priority >= priority)
+         continue;
+      if (!victim || slot->priority < victim->priority ||
+            (slot->priority == victim->priority &&
+             al_get_sample_instance_gain(slot->instance) <
+             al_get_sample_instance_gain(victim->instance))) {
+         victim = slot;
+         victim_index = i;
+      }
+   }
+
+   return victim_index;
+}
+
+
+static int find_slot(int priority)
+{
+   int index = pop_free_slot();
+   int victim;
+
+   if (index >= 0)
+      return index;
+
+   victim = reclaim_slots(priority);
+   index = pop_free_slot();
+   if (index >= 0)
+      return index;
+
+   if (victim >= 0) {
+      AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, victim);
+      ALLEGRO_DEBUG("Stealing sample slot %d (priority %d)\n", victim,
+         slot->priority);
+      al_stop_sample_instance(slot->instance);
+   }
+   return victim;
+}
+
+
 /* Function: al_play_sample
  */
 bool al_play_sample(ALLEGRO_SAMPLE *spl, float gain, float pan, float speed,
    ALLEGRO_PLAYMODE loop, ALLEGRO_SAMPLE_ID *ret_id)
+{
+   return al_play_sample_with_priority(spl, gain, pan, speed, loop, 0, 0,
+      ret_id);
+}
+
+
+/* Function: al_play_sample_with_priority
+ */
+bool al_play_sample_with_priority(ALLEGRO_SAMPLE *spl, float gain, float pan,
+   float speed, ALLEGRO_PLAYMODE loop, int priority, int group,
+   ALLEGRO_SAMPLE_ID *ret_id)
 {
    static int next_id = 0;
-   unsigned int i;
-   
+   AUTO_SAMPLE *slot;
+   int i;
+
    ASSERT(spl);
 
    if (ret_id != NULL) {
@@ -352,23 +484,26 @@ bool al_play_sample(ALLEGRO_SAMPLE *spl, float gain, float pan, float speed,
       ret_id->_index = 0;
    }
 
-   for (i = 0; i < _al_vector_size(&auto_samples); i++) {
-      AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, i);
+   i = find_slot(priority);
+   if (i < 0)
+      return false;
 
-      if (!al_get_sample_instance_playing(slot->instance) && !slot->locked) {
-         if (!do_play_sample(slot->instance, spl, gain, pan, speed, loop))
-            break;
+   slot = _al_vector_ref(&auto_samples, i);
+   slot->id = ++next_id;
+   slot->priority = priority;
+   slot->group = group;
 
-         if (ret_id != NULL) {
-            ret_id->_index = (int) i;
-            ret_id->_id = slot->id = ++next_id;
-         }
+   if (!do_play_sample(slot->instance, spl, gain, pan, speed, loop)) {
+      release_slot(i);
+      return false;
+   }
 
-         return true;
-      }
+   if (ret_id != NULL) {
+      ret_id->_index = i;
+      ret_id->_id = slot->id;
    }
 
-   return false;
+   return true;
 }
 
 
@@ -408,6 +543,7 @@ void al_stop_sample(ALLEGRO_SAMPLE_ID *spl_id)
    slot = _al_vector_ref(&auto_samples, spl_id->_index);
    if (slot->id == spl_id->_id) {
       al_stop_sample_instance(slot->instance);
+      release_slot(spl_id->_index);
    }
 }
 
@@ -442,6 +578,7 @@ void al_unlock_sample_id(ALLEGRO_SAMPLE_ID *spl_id)
    slot = _al_vector_ref(&auto_samples, spl_id->_index);
    if (slot->id == spl_id->_id) {
       slot->locked = false;
+      release_slot(spl_id->_index);
    }
 }
 
@@ -455,6 +592,23 @@ void al_stop_samples(void)
    for (i = 0; i < _al_vector_size(&auto_samples); i++) {
       AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, i);
       al_stop_sample_instance(slot->instance);
+      release_slot(i);
+   }
+}
+
+
+/* Function: al_stop_sample_group
+ */
+void al_stop_sample_group(int group)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&auto_samples); i++) {
+      AUTO_SAMPLE *slot = _al_vector_ref(&auto_samples, i);
+      if (slot->group == group && slot->id != 0) {
+         al_stop_sample_instance(slot->instance);
+         release_slot(i);
+      }
    }
 }
 
@@ -519,6 +673,7 @@ static void free_sample_vector(void)
       al_destroy_sample_instance(slot->instance);
    }
    _al_vector_free(&auto_samples);
+   _al_vector_free(&free_slots);
 }
 
 
@@ -8,11 +8,15 @@
 /* Title: Stream functions
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include <stdio.h>
+#include <string.h>
 
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern_audio.h"
 #include "allegro5/internal/aintern_audio_cfg.h"
+#include "allegro5/internal/aintern_debug.h"
 
 ALLEGRO_DEBUG_CHANNEL("audio")
 
@@ -23,6 +27,18 @@ ALLEGRO_DEBUG_CHANNEL("audio")
  */
 #define MAX_LAG   (3)
 
+/* Seek index files start with this, followed by a version number. */
+#define SEEK_INDEX_MAGIC     "ALSI"
+#define SEEK_INDEX_VERSION   1
+
+/* Adaptive streams first give up a fragment after this many fragments in a
+ * row played with another one queued. Each underrun doubles it, up to the
+ * maximum, so streams which run dry now and then settle instead of going
+ * back and forth.
+ */
+#define ADAPTIVE_SHRINK_AFTER       256
+#define ADAPTIVE_SHRINK_AFTER_MAX   16384
+
 
 /*
  * To avoid deadlocks, unlock the mutex returned by this function, rather than
@@ -98,6 +114,7 @@ ALLEGRO_AUDIO_STREAM *al_create_audio_stream(size_t fragment_count,
    stream->spl.spl_data.len  = stream->spl.pos;
 
    stream->buf_count = fragment_count;
+   stream->active_fragments = fragment_count;
 
    stream->used_bufs = al_calloc(1, fragment_count * sizeof(void *) * 2);
    if (!stream->used_bufs) {
@@ -124,6 +141,16 @@ ALLEGRO_AUDIO_STREAM *al_create_audio_stream(size_t fragment_count,
       return NULL;
    }
 
+   stream->silent_fragments = al_calloc(fragment_count, sizeof(bool));
+   if (!stream->silent_fragments) {
+      al_free(stream->main_buffer);
+      al_free(stream->used_bufs);
+      al_free(stream);
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating stream buffer");
+      return NULL;
+   }
+
    for (i = 0; i < fragment_count; i++) {
       char *buffer = (char *)stream->main_buffer
          + i * (MAX_LAG * bytes_per_sample + bytes_per_frag_buf);
@@ -145,7 +172,7 @@ ALLEGRO_AUDIO_STREAM *al_create_audio_stream(size_t fragment_count,
 void al_destroy_audio_stream(ALLEGRO_AUDIO_STREAM *stream)
 {
    if (stream) {
-      if (stream->feed_thread) {
+      if (stream->feed_thread || stream->feed_pooled || stream->feed_offline) {
          stream->unload_feeder(stream);
       }
       /* See commented out call to _al_kcm_register_destructor. */
@@ -153,6 +180,8 @@ void al_destroy_audio_stream(ALLEGRO_AUDIO_STREAM *stream)
       _al_kcm_detach_from_parent(&stream->spl);
 
       al_destroy_user_event_source(&stream->spl.es);
+      al_free(stream->seek_index);
+      al_free(stream->silent_fragments);
       al_free(stream->main_buffer);
       al_free(stream->used_bufs);
       al_free(stream);
@@ -209,17 +238,31 @@ unsigned int al_get_audio_stream_fragments(const ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
-/* Function: al_get_available_audio_stream_fragments
+/* Returns how many free fragments may be handed out, keeping at most
+ * 'active_fragments' of them filled or being filled.
  */
-unsigned int al_get_available_audio_stream_fragments(
+static unsigned int count_available_fragments(
    const ALLEGRO_AUDIO_STREAM *stream)
 {
    unsigned int i;
-   ASSERT(stream);
 
    for (i = 0; i < stream->buf_count && stream->used_bufs[i]; i++)
       ;
-   return i;
+   /* The others are in use. */
+   if (stream->buf_count - i >= stream->active_fragments)
+      return 0;
+   return stream->active_fragments - (stream->buf_count - i);
+}
+
+
+/* Function: al_get_available_audio_stream_fragments
+ */
+unsigned int al_get_available_audio_stream_fragments(
+   const ALLEGRO_AUDIO_STREAM *stream)
+{
+   ASSERT(stream);
+
+   return count_available_fragments(stream);
 }
 
 
@@ -326,6 +369,49 @@ uint64_t al_get_audio_stream_played_samples(const ALLEGRO_AUDIO_STREAM *stream)
    return result;
 }
 
+/* Function: al_get_audio_stream_underruns
+ */
+unsigned int al_get_audio_stream_underruns(const ALLEGRO_AUDIO_STREAM *stream)
+{
+   ASSERT(stream);
+
+   return stream->underruns;
+}
+
+
+/* Function: al_set_audio_stream_adaptive_fragments
+ */
+bool al_set_audio_stream_adaptive_fragments(ALLEGRO_AUDIO_STREAM *stream,
+   unsigned int min_fragments)
+{
+   ALLEGRO_MUTEX *stream_mutex;
+   ASSERT(stream);
+
+   if (min_fragments >= stream->buf_count)
+      min_fragments = 0;
+
+   stream_mutex = maybe_lock_mutex(stream->spl.mutex);
+   stream->min_active_fragments = min_fragments;
+   stream->active_fragments = min_fragments ? min_fragments : stream->buf_count;
+   stream->adaptive_streak = 0;
+   stream->adaptive_shrink_after = ADAPTIVE_SHRINK_AFTER;
+   maybe_unlock_mutex(stream_mutex);
+
+   return true;
+}
+
+
+/* Function: al_get_audio_stream_active_fragments
+ */
+unsigned int al_get_audio_stream_active_fragments(
+   const ALLEGRO_AUDIO_STREAM *stream)
+{
+   ASSERT(stream);
+
+   return stream->active_fragments;
+}
+
+
 /* Function: al_get_audio_stream_fragment
 */
 void *al_get_audio_stream_fragment(const ALLEGRO_AUDIO_STREAM *stream)
@@ -337,7 +423,7 @@ void *al_get_audio_stream_fragment(const ALLEGRO_AUDIO_STREAM *stream)
 
    stream_mutex = maybe_lock_mutex(stream->spl.mutex);
 
-   if (!stream->used_bufs[0]) {
+   if (count_available_fragments(stream) == 0) {
       /* No free fragments are available. */
       fragment = NULL;
    }
@@ -375,17 +461,8 @@ bool al_set_audio_stream_speed(ALLEGRO_AUDIO_STREAM *stream, float val)
 
    stream->spl.speed = val;
    if (stream->spl.parent.u.mixer) {
-      ALLEGRO_MIXER *mixer = stream->spl.parent.u.mixer;
-      ALLEGRO_MUTEX *stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-
-      stream->spl.step = (stream->spl.spl_data.frequency) * stream->spl.speed;
-      stream->spl.step_denom = mixer->ss.spl_data.frequency;
-      /* Don't wanna be trapped with a step value of 0 */
-      if (stream->spl.step == 0) {
-         stream->spl.step = 1;
-      }
-
-      maybe_unlock_mutex(stream_mutex);
+      _al_kcm_mixer_post_command(stream->spl.parent.u.mixer, &stream->spl,
+         _AL_KCM_UPDATE_STEP);
    }
 
    return true;
@@ -411,10 +488,8 @@ bool al_set_audio_stream_gain(ALLEGRO_AUDIO_STREAM *stream, float val)
        * matrix to take into account the gain.
        */
       if (stream->spl.parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = stream->spl.parent.u.mixer;
-         ALLEGRO_MUTEX *stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, &stream->spl);
-         maybe_unlock_mutex(stream_mutex);
+         _al_kcm_mixer_post_command(stream->spl.parent.u.mixer, &stream->spl,
+            _AL_KCM_UPDATE_MATRIX);
       }
    }
 
@@ -445,10 +520,8 @@ bool al_set_audio_stream_pan(ALLEGRO_AUDIO_STREAM *stream, float val)
        * matrix to take into account the panning.
        */
       if (stream->spl.parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = stream->spl.parent.u.mixer;
-         ALLEGRO_MUTEX *stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, &stream->spl);
-         maybe_unlock_mutex(stream_mutex);
+         _al_kcm_mixer_post_command(stream->spl.parent.u.mixer, &stream->spl,
+            _AL_KCM_UPDATE_MATRIX);
       }
    }
 
@@ -533,6 +606,7 @@ static void reset_stopped_stream(ALLEGRO_AUDIO_STREAM *stream)
    stream->spl.pos = stream->spl.spl_data.len;
    stream->spl.pos_bresenham_error = 0;
    stream->consumed_fragments = 0;
+   stream->lag_silent = false;
 }
 
 
@@ -584,21 +658,95 @@ bool al_detach_audio_stream(ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
+/* Returns the place of a fragment buffer in the main_buffer. */
+static size_t fragment_index(const ALLEGRO_AUDIO_STREAM *stream,
+   const void *fragment)
+{
+   const int bytes_per_sample =
+      al_get_channel_count(stream->spl.spl_data.chan_conf) *
+      al_get_audio_depth_size(stream->spl.spl_data.depth);
+   const size_t fragment_buffer_size =
+      bytes_per_sample * (stream->spl.spl_data.len + MAX_LAG);
+
+   return ((const char *)fragment - (const char *)stream->main_buffer) /
+      fragment_buffer_size;
+}
+
+
+/* Whether a fragment holds only silence. Just all-zero data is recognised,
+ * which is silence for the signed and floating point depths.
+ */
+static bool is_silent_fragment(const ALLEGRO_AUDIO_STREAM *stream,
+   const void *fragment)
+{
+   const size_t bytes = (size_t)stream->spl.spl_data.len *
+      al_get_channel_count(stream->spl.spl_data.chan_conf) *
+      al_get_audio_depth_size(stream->spl.spl_data.depth);
+   const char *p = fragment;
+
+   if (stream->spl.spl_data.depth & ALLEGRO_AUDIO_DEPTH_UNSIGNED)
+      return false;
+
+   /* Every byte equals the one after it, and the first one is zero. */
+   return p[0] == 0 && memcmp(p, p + 1, bytes - 1) == 0;
+}
+
+
+/* _al_kcm_stream_is_silent:
+ *  Returns true if the next frames of the stream, counting from its current
+ *  position, and the frames interpolated from before it are known to be
+ *  silent.
+ */
+bool _al_kcm_stream_is_silent(const ALLEGRO_AUDIO_STREAM *stream, int frames)
+{
+   const ALLEGRO_SAMPLE_INSTANCE *spl = &stream->spl;
+   size_t i;
+
+   if (!spl->spl_data.buffer.ptr || spl->pos < 0 ||
+         spl->pos >= (int)spl->spl_data.len)
+      return false;
+   if (!stream->silent_fragments[fragment_index(stream,
+         spl->spl_data.buffer.ptr)])
+      return false;
+   if (spl->pos < MAX_LAG && !stream->lag_silent)
+      return false;
+
+   /* pending_bufs[0] is the current fragment. Running out of fragments is
+    * fine, the stream stops there.
+    */
+   frames -= spl->spl_data.len - spl->pos;
+   for (i = 1; frames > 0 && i < stream->buf_count && stream->pending_bufs[i];
+         i++) {
+      if (!stream->silent_fragments[fragment_index(stream,
+            stream->pending_bufs[i])])
+         return false;
+      frames -= spl->spl_data.len;
+   }
+
+   return true;
+}
+
+
 /* Function: al_set_audio_stream_fragment
  */
 bool al_set_audio_stream_fragment(ALLEGRO_AUDIO_STREAM *stream, void *val)
 {
    size_t i;
    bool ret;
+   bool silent;
    ALLEGRO_MUTEX *stream_mutex;
    ASSERT(stream);
 
+   silent = val && is_silent_fragment(stream, val);
+
    stream_mutex = maybe_lock_mutex(stream->spl.mutex);
 
    for (i = 0; i < stream->buf_count && stream->pending_bufs[i] ; i++)
       ;
    if (i < stream->buf_count) {
       stream->pending_bufs[i] = val;
+      if (val)
+         stream->silent_fragments[fragment_index(stream, val)] = silent;
       ret = true;
    }
    else {
@@ -613,6 +761,40 @@ bool al_set_audio_stream_fragment(ALLEGRO_AUDIO_STREAM *stream, void *val)
 }
 
 
+/* Gives an adaptive stream which ran dry half as many fragments again, and
+ * waits twice as long before trying fewer.
+ */
+static void grow_active_fragments(ALLEGRO_AUDIO_STREAM *stream)
+{
+   stream->active_fragments += (stream->active_fragments + 1) / 2;
+   if (stream->active_fragments > stream->buf_count)
+      stream->active_fragments = stream->buf_count;
+   stream->adaptive_streak = 0;
+   if (stream->adaptive_shrink_after < ADAPTIVE_SHRINK_AFTER_MAX)
+      stream->adaptive_shrink_after *= 2;
+}
+
+
+/* Takes a fragment away from an adaptive stream which kept one to spare
+ * for long enough.
+ */
+static void maybe_shrink_active_fragments(ALLEGRO_AUDIO_STREAM *stream)
+{
+   if (stream->active_fragments <= stream->min_active_fragments)
+      return;
+
+   /* pending_bufs[0] is the fragment which starts playing now. */
+   if (stream->buf_count < 2 || !stream->pending_bufs[1]) {
+      stream->adaptive_streak = 0;
+      return;
+   }
+   if (++stream->adaptive_streak >= stream->adaptive_shrink_after) {
+      stream->active_fragments--;
+      stream->adaptive_streak = 0;
+   }
+}
+
+
 /* _al_kcm_refill_stream:
  *  Called by the mixer when the current buffer has been used up.  It should
  *  point to the next pending buffer and adjust the sample position to reflect
@@ -650,6 +832,15 @@ bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream)
    stream->spl.spl_data.buffer.ptr = new_buf;
    if (!new_buf) {
       ALLEGRO_WARN("Out of buffers\n");
+      /* Count running dry once, not for every mixer buffer until the
+       * next fragment arrives.
+       */
+      if (old_buf && !stream->is_draining) {
+         stream->underruns++;
+         _al_kcm_emit_underrun_event(&stream->spl.es);
+         if (stream->min_active_fragments)
+            grow_active_fragments(stream);
+      }
       return false;
    }
 
@@ -667,6 +858,13 @@ bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream)
          bytes_per_sample * MAX_LAG);
 
       stream->consumed_fragments++;
+      stream->lag_silent =
+         stream->silent_fragments[fragment_index(stream, old_buf)];
+      if (stream->min_active_fragments)
+         maybe_shrink_active_fragments(stream);
+   }
+   else {
+      stream->lag_silent = false;
    }
 
    stream->spl.pos = new_pos;
@@ -675,6 +873,87 @@ bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
+/* _al_kcm_feed_fragment:
+ *  Fills one free fragment of a stream created by al_load_audio_stream from
+ *  its feeder. Returns false if there was no fragment to fill.
+ */
+bool _al_kcm_feed_fragment(ALLEGRO_AUDIO_STREAM *stream)
+{
+   char *fragment;
+   unsigned long bytes;
+   unsigned long bytes_written;
+   ALLEGRO_MUTEX *stream_mutex;
+
+   if (stream->is_draining)
+      return false;
+
+   fragment = al_get_audio_stream_fragment(stream);
+   if (!fragment) {
+      /* This is not an error. */
+      return false;
+   }
+
+   bytes = (stream->spl.spl_data.len) *
+         al_get_channel_count(stream->spl.spl_data.chan_conf) *
+         al_get_audio_depth_size(stream->spl.spl_data.depth);
+
+   stream_mutex = maybe_lock_mutex(stream->spl.mutex);
+   bytes_written = stream->feeder(stream, fragment, bytes);
+   maybe_unlock_mutex(stream_mutex);
+
+   if (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR) {
+      /* Keep rewinding until the fragment is filled. */
+      while (bytes_written < bytes &&
+               stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR) {
+         size_t bw;
+         al_rewind_audio_stream(stream);
+         stream_mutex = maybe_lock_mutex(stream->spl.mutex);
+         bw = stream->feeder(stream, fragment + bytes_written,
+            bytes - bytes_written);
+         bytes_written += bw;
+         maybe_unlock_mutex(stream_mutex);
+      }
+   }
+   else if (bytes_written < bytes) {
+      /* Fill the rest of the fragment with silence. */
+      int silence_samples = (bytes - bytes_written) /
+         (al_get_channel_count(stream->spl.spl_data.chan_conf) *
+          al_get_audio_depth_size(stream->spl.spl_data.depth));
+      al_fill_silence(fragment + bytes_written, silence_samples,
+                      stream->spl.spl_data.depth, stream->spl.spl_data.chan_conf);
+   }
+
+   if (!al_set_audio_stream_fragment(stream, fragment)) {
+      ALLEGRO_ERROR("Error setting stream buffer.\n");
+      return false;
+   }
+
+   /* The streaming source doesn't feed any more, so drain the stream.
+    * Don't quit in case the user decides to seek and then restart the
+    * stream. */
+   if (bytes_written != bytes &&
+       (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONCE ||
+        stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_LOOP_ONCE)) {
+      /* Why not al_drain_audio_stream? We don't want to block on draining
+       * because the user might adjust the stream loop points and restart
+       * the stream. */
+      stream->is_draining = true;
+
+      if (!stream->finished_event_sent) {
+         ALLEGRO_EVENT fin_event;
+         fin_event.user.type = ALLEGRO_EVENT_AUDIO_STREAM_FINISHED;
+         fin_event.user.timestamp = al_get_time();
+         al_emit_user_event(&stream->spl.es, &fin_event, NULL);
+         stream->finished_event_sent = true;
+      }
+   } else {
+      stream->finished_event_sent = false;
+   }
+
+   return true;
+}
+
+
 /* _al_kcm_feed_stream:
  * A routine running in another thread that feeds the stream buffers as
  * necessary, usually getting data from some file reader backend.
@@ -683,92 +962,29 @@ void *_al_kcm_feed_stream(ALLEGRO_THREAD *self, void *vstream)
 {
    ALLEGRO_AUDIO_STREAM *stream = vstream;
    ALLEGRO_EVENT_QUEUE *queue;
-   bool finished_event_sent = false;
    bool prefill = true;
-   (void)self;
 
    ALLEGRO_DEBUG("Stream feeder thread started.\n");
 
+   al_set_thread_name(self, "al-stream-feed");
+   al_set_thread_priority(self, ALLEGRO_THREAD_PRIORITY_HIGH);
+
    queue = al_create_event_queue();
    al_register_event_source(queue, &stream->spl.es);
 
    stream->quit_feed_thread = false;
+   stream->finished_event_sent = false;
 
    while (!stream->quit_feed_thread) {
-      char *fragment;
       ALLEGRO_EVENT event;
 
       if (!prefill)
          al_wait_for_event(queue, &event);
 
-      if ((prefill || event.type == ALLEGRO_EVENT_AUDIO_STREAM_FRAGMENT)
-          && !stream->is_draining) {
-         unsigned long bytes;
-         unsigned long bytes_written;
-         ALLEGRO_MUTEX *stream_mutex;
-
-         fragment = al_get_audio_stream_fragment(stream);
-         if (!fragment) {
-            /* This is not an error. */
-            continue;
-         }
-
-         bytes = (stream->spl.spl_data.len) *
-               al_get_channel_count(stream->spl.spl_data.chan_conf) *
-               al_get_audio_depth_size(stream->spl.spl_data.depth);
-
-         stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-         bytes_written = stream->feeder(stream, fragment, bytes);
-         maybe_unlock_mutex(stream_mutex);
-
-         if (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR) {
-            /* Keep rewinding until the fragment is filled. */
-            while (bytes_written < bytes &&
-                     stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR) {
-               size_t bw;
-               al_rewind_audio_stream(stream);
-               stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-               bw = stream->feeder(stream, fragment + bytes_written,
-                  bytes - bytes_written);
-               bytes_written += bw;
-               maybe_unlock_mutex(stream_mutex);
-            }
-         }
-         else if (bytes_written < bytes) {
-            /* Fill the rest of the fragment with silence. */
-            int silence_samples = (bytes - bytes_written) /
-               (al_get_channel_count(stream->spl.spl_data.chan_conf) *
-                al_get_audio_depth_size(stream->spl.spl_data.depth));
-            al_fill_silence(fragment + bytes_written, silence_samples,
-                            stream->spl.spl_data.depth, stream->spl.spl_data.chan_conf);
-         }
-
-         if (!al_set_audio_stream_fragment(stream, fragment)) {
-            ALLEGRO_ERROR("Error setting stream buffer.\n");
-            continue;
-         }
-
-         /* The streaming source doesn't feed any more, so drain the stream.
-          * Don't quit in case the user decides to seek and then restart the
-          * stream. */
-         if (bytes_written != bytes &&
-             (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONCE ||
-              stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_LOOP_ONCE)) {
-            /* Why not al_drain_audio_stream? We don't want to block on draining
-             * because the user might adjust the stream loop points and restart
-             * the stream. */
-            stream->is_draining = true;
-
-            if (!finished_event_sent) {
-               ALLEGRO_EVENT fin_event;
-               fin_event.user.type = ALLEGRO_EVENT_AUDIO_STREAM_FINISHED;
-               fin_event.user.timestamp = al_get_time();
-               al_emit_user_event(&stream->spl.es, &fin_event, NULL);
-               finished_event_sent = true;
-            }
-         } else {
-            finished_event_sent = false;
-         }
+      if (prefill || event.type == ALLEGRO_EVENT_AUDIO_STREAM_FRAGMENT) {
+         _AL_BEGIN_CPU_ZONE("audio stream refill");
+         _al_kcm_feed_fragment(stream);
+         _AL_END_CPU_ZONE();
       }
       else if (event.type == _KCM_STREAM_FEEDER_QUIT_EVENT_TYPE) {
          ALLEGRO_EVENT fin_event;
@@ -911,6 +1127,246 @@ bool al_set_audio_stream_loop_secs(ALLEGRO_AUDIO_STREAM *stream,
 }
 
 
+/* Replaces the seek index of the stream, taking ownership of 'points'. */
+static void set_seek_index(ALLEGRO_AUDIO_STREAM *stream,
+   _AL_KCM_SEEK_POINT *points, size_t count)
+{
+   al_free(stream->seek_index);
+   stream->seek_index = points;
+   stream->seek_index_size = count;
+}
+
+
+/* Length of the stream in frames, as recorded in seek index files so that
+ * an index is not applied to a different file. Call with the stream locked.
+ */
+static uint64_t stream_length_frames(ALLEGRO_AUDIO_STREAM *stream)
+{
+   double length;
+
+   if (!stream->get_feeder_length)
+      return 0;
+   length = stream->get_feeder_length(stream);
+   if (length <= 0.0)
+      return 0;
+   return (uint64_t)(length * stream->spl.spl_data.frequency + 0.5);
+}
+
+
+/* _al_kcm_find_seek_point:
+ *  Returns the last entry of the seek index at or before 'frame', or NULL.
+ *  Called by seek feeders, with the stream locked.
+ */
+const _AL_KCM_SEEK_POINT *_al_kcm_find_seek_point(ALLEGRO_AUDIO_STREAM *stream,
+   uint64_t frame)
+{
+   size_t lo = 0;
+   size_t hi = stream->seek_index_size;
+
+   if (hi == 0 || stream->seek_index[0].frame > frame)
+      return NULL;
+
+   /* The answer lies in [lo, hi). */
+   while (hi - lo > 1) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (stream->seek_index[mid].frame <= frame)
+         lo = mid;
+      else
+         hi = mid;
+   }
+
+   return &stream->seek_index[lo];
+}
+
+
+/* Function: al_build_audio_stream_seek_index
+ */
+bool al_build_audio_stream_seek_index(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_MUTEX *stream_mutex;
+   _AL_KCM_SEEK_POINT *points = NULL;
+   size_t count = 0;
+   bool ret = false;
+   ASSERT(stream);
+
+   if (!stream->index_feeder) {
+      _al_set_error(ALLEGRO_INVALID_PARAM,
+         "The stream can't build a seek index");
+      return false;
+   }
+
+   stream_mutex = maybe_lock_mutex(stream->spl.mutex);
+   if (stream->index_feeder(stream, &points, &count)) {
+      set_seek_index(stream, points, count);
+      ret = true;
+   }
+   maybe_unlock_mutex(stream_mutex);
+
+   if (ret)
+      ALLEGRO_DEBUG("Built a seek index with %u entries.\n", (unsigned)count);
+   return ret;
+}
+
+
+/* Function: al_save_audio_stream_seek_index_f
+ */
+bool al_save_audio_stream_seek_index_f(ALLEGRO_AUDIO_STREAM *stream,
+   ALLEGRO_FILE *fp)
+{
+   ALLEGRO_MUTEX *stream_mutex;
+   uint64_t length;
+   size_t i;
+   bool ret = false;
+   ASSERT(stream);
+   ASSERT(fp);
+
+   stream_mutex = maybe_lock_mutex(stream->spl.mutex);
+
+   if (!stream->seek_index) {
+      _al_set_error(ALLEGRO_INVALID_OBJECT, "The stream has no seek index");
+      goto done;
+   }
+
+   length = stream_length_frames(stream);
+   al_fwrite(fp, SEEK_INDEX_MAGIC, 4);
+   al_fwrite32le(fp, SEEK_INDEX_VERSION);
+   al_fwrite32le(fp, stream->spl.spl_data.frequency);
+   al_fwrite32le(fp, al_get_channel_count(stream->spl.spl_data.chan_conf));
+   al_fwrite32le(fp, (int32_t)(length & 0xffffffff));
+   al_fwrite32le(fp, (int32_t)(length >> 32));
+   al_fwrite32le(fp, (int32_t)stream->seek_index_size);
+   for (i = 0; i < stream->seek_index_size; i++) {
+      const _AL_KCM_SEEK_POINT *p = &stream->seek_index[i];
+      al_fwrite32le(fp, (int32_t)(p->frame & 0xffffffff));
+      al_fwrite32le(fp, (int32_t)(p->frame >> 32));
+      al_fwrite32le(fp, (int32_t)(p->offset & 0xffffffff));
+      al_fwrite32le(fp, (int32_t)(p->offset >> 32));
+   }
+   ret = !al_ferror(fp);
+
+done:
+   maybe_unlock_mutex(stream_mutex);
+   return ret;
+}
+
+
+/* Function: al_save_audio_stream_seek_index
+ */
+bool al_save_audio_stream_seek_index(ALLEGRO_AUDIO_STREAM *stream,
+   const char *filename)
+{
+   ALLEGRO_FILE *fp;
+   bool ret;
+   ASSERT(filename);
+
+   fp = al_fopen(filename, "wb");
+   if (!fp) {
+      ALLEGRO_ERROR("Unable to open %s for writing.\n", filename);
+      return false;
+   }
+
+   ret = al_save_audio_stream_seek_index_f(stream, fp);
+   if (!al_fclose(fp))
+      ret = false;
+   return ret;
+}
+
+
+static uint64_t read_uint64le(ALLEGRO_FILE *fp)
+{
+   uint64_t lo = (uint32_t)al_fread32le(fp);
+   uint64_t hi = (uint32_t)al_fread32le(fp);
+   return lo | (hi << 32);
+}
+
+
+/* Function: al_load_audio_stream_seek_index_f
+ */
+bool al_load_audio_stream_seek_index_f(ALLEGRO_AUDIO_STREAM *stream,
+   ALLEGRO_FILE *fp)
+{
+   ALLEGRO_MUTEX *stream_mutex;
+   _AL_KCM_SEEK_POINT *points;
+   char magic[4];
+   unsigned int freq;
+   unsigned int channels;
+   uint64_t length;
+   uint32_t count;
+   uint32_t i;
+   ASSERT(stream);
+   ASSERT(fp);
+
+   if (al_fread(fp, magic, 4) != 4 || memcmp(magic, SEEK_INDEX_MAGIC, 4) != 0
+         || al_fread32le(fp) != SEEK_INDEX_VERSION) {
+      ALLEGRO_ERROR("Not a seek index file.\n");
+      return false;
+   }
+
+   freq = (uint32_t)al_fread32le(fp);
+   channels = (uint32_t)al_fread32le(fp);
+   length = read_uint64le(fp);
+   count = (uint32_t)al_fread32le(fp);
+   if (al_feof(fp) || al_ferror(fp) || count == 0) {
+      ALLEGRO_ERROR("Truncated seek index file.\n");
+      return false;
+   }
+
+   points = al_calloc(count, sizeof(*points));
+   if (!points) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating the seek index");
+      return false;
+   }
+   for (i = 0; i < count; i++) {
+      points[i].frame = read_uint64le(fp);
+      points[i].offset = read_uint64le(fp);
+      if (i > 0 && (points[i].frame < points[i-1].frame
+            || points[i].offset < points[i-1].offset))
+         break;
+   }
+   if (i < count || al_feof(fp) || al_ferror(fp)) {
+      ALLEGRO_ERROR("Invalid seek index file.\n");
+      al_free(points);
+      return false;
+   }
+
+   stream_mutex = maybe_lock_mutex(stream->spl.mutex);
+   if (freq != stream->spl.spl_data.frequency
+         || channels != al_get_channel_count(stream->spl.spl_data.chan_conf)
+         || length != stream_length_frames(stream)) {
+      maybe_unlock_mutex(stream_mutex);
+      ALLEGRO_ERROR("The seek index was made for a different stream.\n");
+      al_free(points);
+      return false;
+   }
+   set_seek_index(stream, points, count);
+   maybe_unlock_mutex(stream_mutex);
+
+   return true;
+}
+
+
+/* Function: al_load_audio_stream_seek_index
+ */
+bool al_load_audio_stream_seek_index(ALLEGRO_AUDIO_STREAM *stream,
+   const char *filename)
+{
+   ALLEGRO_FILE *fp;
+   bool ret;
+   ASSERT(filename);
+
+   fp = al_fopen(filename, "rb");
+   if (!fp) {
+      ALLEGRO_WARN("Unable to open %s for reading.\n", filename);
+      return false;
+   }
+
+   ret = al_load_audio_stream_seek_index_f(stream, fp);
+   al_fclose(fp);
+   return ret;
+}
+
+
 /* Function: al_get_audio_stream_event_source
  */
 ALLEGRO_EVENT_SOURCE *al_get_audio_stream_event_source(
@@ -0,0 +1,423 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Cache of whole compressed files for streams loaded with
+ *      ALLEGRO_AUDIO_STREAM_IN_MEMORY.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+/* Files are kept by name and file interface. Entries which no stream reads
+ * any more stay around for the next time the file is played, until the
+ * budget is needed for other files. Entries in use are never evicted, so a
+ * file is only cached if it fits in the budget next to them.
+ */
+
+#define DEFAULT_CACHE_SIZE (32 * 1024 * 1024)
+
+typedef struct CACHE_ENTRY {
+   char *filename;
+   const ALLEGRO_FILE_INTERFACE *iface;
+   char *data;
+   int64_t size;
+   int refcount;
+} CACHE_ENTRY;
+
+typedef struct CACHE_FILE {
+   CACHE_ENTRY *entry;
+   int64_t pos;
+   bool eof;
+} CACHE_FILE;
+
+static size_t cache_budget = DEFAULT_CACHE_SIZE;
+static size_t cache_used;
+static ALLEGRO_MUTEX *cache_mutex;
+/* Least recently used first. */
+static _AL_VECTOR cache_entries = _AL_VECTOR_INITIALIZER(CACHE_ENTRY *);
+
+
+static void free_entry(CACHE_ENTRY *entry)
+{
+   al_free(entry->filename);
+   al_free(entry->data);
+   al_free(entry);
+}
+
+
+/* Drops unused entries, oldest first, until 'needed' more bytes fit in the
+ * budget. Returns false if they still don't. The cache mutex must be held.
+ */
+static bool make_room(size_t needed)
+{
+   unsigned int i = 0;
+
+   while (cache_used + needed > cache_budget &&
+         i < _al_vector_size(&cache_entries)) {
+      CACHE_ENTRY **slot = _al_vector_ref(&cache_entries, i);
+      CACHE_ENTRY *entry = *slot;
+
+      if (entry->refcount > 0) {
+         i++;
+         continue;
+      }
+      ALLEGRO_DEBUG("Evicting %s from the stream cache\n", entry->filename);
+      cache_used -= entry->size;
+      _al_vector_delete_at(&cache_entries, i);
+      free_entry(entry);
+   }
+
+   return cache_used + needed <= cache_budget;
+}
+
+
+/* Marks the entry at index i as the most recently used and takes a
+ * reference to it. The cache mutex must be held.
+ */
+static CACHE_ENTRY *use_entry(unsigned int i)
+{
+   CACHE_ENTRY **slot = _al_vector_ref(&cache_entries, i);
+   CACHE_ENTRY *entry = *slot;
+
+   _al_vector_delete_at(&cache_entries, i);
+   slot = _al_vector_alloc_back(&cache_entries);
+   *slot = entry;
+   entry->refcount++;
+   return entry;
+}
+
+
+static int find_entry(const char *filename,
+   const ALLEGRO_FILE_INTERFACE *iface)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&cache_entries); i++) {
+      CACHE_ENTRY **slot = _al_vector_ref(&cache_entries, i);
+      if ((*slot)->iface == iface && strcmp((*slot)->filename, filename) == 0)
+         return i;
+   }
+   return -1;
+}
+
+
+/* Reads the whole file, if it fits in the budget. */
+static CACHE_ENTRY *read_entry(const char *filename,
+   const ALLEGRO_FILE_INTERFACE *iface)
+{
+   CACHE_ENTRY *entry;
+   ALLEGRO_FILE *f;
+   int64_t size;
+
+   f = al_fopen(filename, "rb");
+   if (!f)
+      return NULL;
+
+   size = al_fsize(f);
+   if (size <= 0 || (uint64_t)size > cache_budget) {
+      ALLEGRO_DEBUG("Not caching %s (%ld bytes)\n", filename, (long)size);
+      al_fclose(f);
+      return NULL;
+   }
+
+   entry = al_calloc(1, sizeof(*entry));
+   if (!entry) {
+      al_fclose(f);
+      return NULL;
+   }
+   entry->filename = al_malloc(strlen(filename) + 1);
+   if (entry->filename)
+      strcpy(entry->filename, filename);
+   entry->iface = iface;
+   entry->size = size;
+   entry->data = al_malloc(size);
+   if (!entry->filename || !entry->data ||
+         al_fread(f, entry->data, size) != (size_t)size) {
+      al_fclose(f);
+      free_entry(entry);
+      return NULL;
+   }
+
+   al_fclose(f);
+   return entry;
+}
+
+
+static bool cache_fclose(ALLEGRO_FILE *fp)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+
+   al_lock_mutex(cache_mutex);
+   cf->entry->refcount--;
+   /* The budget may have shrunk while the file was in use. */
+   make_room(0);
+   al_unlock_mutex(cache_mutex);
+
+   al_free(cf);
+   return true;
+}
+
+
+static size_t cache_fread(ALLEGRO_FILE *fp, void *ptr, size_t size)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+   int64_t left = cf->entry->size - cf->pos;
+   size_t n = size;
+
+   if (left < (int64_t)size) {
+      n = left;
+      cf->eof = true;
+   }
+
+   memcpy(ptr, cf->entry->data + cf->pos, n);
+   cf->pos += n;
+   return n;
+}
+
+
+static size_t cache_fwrite(ALLEGRO_FILE *fp, const void *ptr, size_t size)
+{
+   (void)fp;
+   (void)ptr;
+   (void)size;
+   al_set_errno(EPERM);
+   return 0;
+}
+
+
+static bool cache_fflush(ALLEGRO_FILE *fp)
+{
+   (void)fp;
+   return true;
+}
+
+
+static int64_t cache_ftell(ALLEGRO_FILE *fp)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+   return cf->pos;
+}
+
+
+static bool cache_fseek(ALLEGRO_FILE *fp, int64_t offset, int whence)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+   int64_t pos = cf->pos;
+
+   switch (whence) {
+      case ALLEGRO_SEEK_SET:
+         pos = offset;
+         break;
+
+      case ALLEGRO_SEEK_CUR:
+         pos = cf->pos + offset;
+         break;
+
+      case ALLEGRO_SEEK_END:
+         pos = cf->entry->size + offset;
+         break;
+   }
+
+   if (pos >= cf->entry->size)
+      pos = cf->entry->size;
+   else if (pos < 0)
+      pos = 0;
+
+   cf->pos = pos;
+   cf->eof = false;
+   return true;
+}
+
+
+static bool cache_feof(ALLEGRO_FILE *fp)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+   return cf->eof;
+}
+
+
+static int cache_ferror(ALLEGRO_FILE *fp)
+{
+   (void)fp;
+   return 0;
+}
+
+
+static const char *cache_ferrmsg(ALLEGRO_FILE *fp)
+{
+   (void)fp;
+   return "";
+}
+
+
+static void cache_fclearerr(ALLEGRO_FILE *fp)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+   cf->eof = false;
+}
+
+
+static off_t cache_fsize(ALLEGRO_FILE *fp)
+{
+   CACHE_FILE *cf = al_get_file_userdata(fp);
+   return cf->entry->size;
+}
+
+
+static const ALLEGRO_FILE_INTERFACE cache_vtable = {
+   NULL,    /* open */
+   cache_fclose,
+   cache_fread,
+   cache_fwrite,
+   cache_fflush,
+   cache_ftell,
+   cache_fseek,
+   cache_feof,
+   cache_ferror,
+   cache_ferrmsg,
+   cache_fclearerr,
+   NULL,    /* ungetc */
+   cache_fsize
+};
+
+
+/* _al_kcm_open_cached_file:
+ *  Opens the file from the stream cache, reading it into the cache first if
+ *  it is not there yet. Returns NULL if the file can't be read, or doesn't
+ *  fit in the cache, in which case the caller should read it from the file
+ *  system as usual.
+ */
+ALLEGRO_FILE *_al_kcm_open_cached_file(const char *filename)
+{
+   const ALLEGRO_FILE_INTERFACE *iface = al_get_new_file_interface();
+   CACHE_ENTRY *entry = NULL;
+   CACHE_ENTRY *loaded;
+   CACHE_FILE *cf;
+   ALLEGRO_FILE *fp;
+   int i;
+
+   if (!cache_mutex)
+      return NULL;
+
+   al_lock_mutex(cache_mutex);
+   i = find_entry(filename, iface);
+   if (i >= 0)
+      entry = use_entry(i);
+   al_unlock_mutex(cache_mutex);
+
+   if (!entry) {
+      /* Read without holding the mutex, so that streams closing their
+       * files are not held up.
+       */
+      loaded = read_entry(filename, iface);
+      if (!loaded)
+         return NULL;
+
+      al_lock_mutex(cache_mutex);
+      i = find_entry(filename, iface);
+      if (i >= 0) {
+         /* Another thread was quicker. */
+         entry = use_entry(i);
+         free_entry(loaded);
+      }
+      else if (make_room(loaded->size)) {
+         CACHE_ENTRY **slot = _al_vector_alloc_back(&cache_entries);
+         *slot = loaded;
+         entry = loaded;
+         entry->refcount = 1;
+         cache_used += entry->size;
+         ALLEGRO_DEBUG("Cached %s (%ld bytes)\n", filename,
+            (long)entry->size);
+      }
+      else {
+         ALLEGRO_DEBUG("No room in the stream cache for %s\n", filename);
+         free_entry(loaded);
+      }
+      al_unlock_mutex(cache_mutex);
+
+      if (!entry)
+         return NULL;
+   }
+
+   cf = al_calloc(1, sizeof(*cf));
+   if (cf) {
+      cf->entry = entry;
+      fp = al_create_file_handle(&cache_vtable, cf);
+      if (fp)
+         return fp;
+      al_free(cf);
+   }
+
+   al_lock_mutex(cache_mutex);
+   entry->refcount--;
+   al_unlock_mutex(cache_mutex);
+   return NULL;
+}
+
+
+void _al_kcm_init_stream_cache(void)
+{
+   if (!cache_mutex)
+      cache_mutex = al_create_mutex();
+}
+
+
+/* All streams must have been destroyed by now. */
+void _al_kcm_shutdown_stream_cache(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&cache_entries); i++) {
+      CACHE_ENTRY **slot = _al_vector_ref(&cache_entries, i);
+      ASSERT((*slot)->refcount == 0);
+      free_entry(*slot);
+   }
+   _al_vector_free(&cache_entries);
+   cache_used = 0;
+
+   al_destroy_mutex(cache_mutex);
+   cache_mutex = NULL;
+}
+
+
+/* Function: al_set_audio_stream_cache_size
+ */
+void al_set_audio_stream_cache_size(size_t size)
+{
+   if (cache_mutex)
+      al_lock_mutex(cache_mutex);
+   cache_budget = size;
+   make_room(0);
+   if (cache_mutex)
+      al_unlock_mutex(cache_mutex);
+}
+
+
+/* Function: al_get_audio_stream_cache_size
+ */
+size_t al_get_audio_stream_cache_size(void)
+{
+   return cache_budget;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -8,6 +8,8 @@
 /* Title: Voice functions
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include <stdio.h>
 
 #include "allegro5/allegro_audio.h"
@@ -40,6 +42,7 @@ const void *_al_voice_update(ALLEGRO_VOICE *voice, ALLEGRO_MUTEX *mutex,
    unsigned int *samples)
 {
    void *buf = NULL;
+   bool late = false;
 
    /* The mutex parameter is intended to make it obvious at the call site
     * that the voice mutex will be acquired here.
@@ -50,16 +53,91 @@ const void *_al_voice_update(ALLEGRO_VOICE *voice, ALLEGRO_MUTEX *mutex,
 
    al_lock_mutex(voice->mutex);
    if (voice->attached_stream) {
+      double start = al_get_time();
+      unsigned int requested = *samples;
       ASSERT(voice->attached_stream->spl_read);
       voice->attached_stream->spl_read(voice->attached_stream, &buf, samples,
          voice->depth, 0);
+      late = _al_kcm_update_timing(&voice->timing, start, requested,
+         voice->frequency);
    }
    al_unlock_mutex(voice->mutex);
 
+   if (late)
+      _al_kcm_emit_underrun_event(&voice->es);
+
    return buf;
 }
 
 
+/* _al_kcm_voice_underrun:
+ *  For drivers to report that the device ran out of data for the voice.
+ */
+void _al_kcm_voice_underrun(ALLEGRO_VOICE *voice)
+{
+   al_lock_mutex(voice->mutex);
+   voice->timing.underruns++;
+   al_unlock_mutex(voice->mutex);
+
+   _al_kcm_emit_underrun_event(&voice->es);
+}
+
+
+/* _al_kcm_raise_audio_thread:
+ *  Names a driver's update thread and, if realtime is true, asks for
+ *  real-time priority for it, so that the small buffers of a low latency
+ *  device do not run dry while the CPU is busy. Drivers only ask for that
+ *  when the user opted in, since a real-time thread can starve the rest of
+ *  the system. Must be called by the thread itself, as some platforms only
+ *  allow that. The priority usually needs extra permissions on Linux, so
+ *  failing to get it is not an error.
+ */
+void _al_kcm_raise_audio_thread(ALLEGRO_THREAD *self, const char *name,
+   bool realtime)
+{
+   al_set_thread_name(self, name);
+   if (!realtime)
+      return;
+   if (al_set_thread_priority(self, ALLEGRO_THREAD_PRIORITY_REALTIME))
+      ALLEGRO_INFO("%s thread runs at real-time priority.\n", name);
+   else
+      ALLEGRO_INFO("%s thread runs at normal priority.\n", name);
+}
+
+
+/* _al_kcm_update_timing:
+ *  Records that mixing samples frames at the given frequency took from start
+ *  until now. Returns true if that took longer than the frames play for, in
+ *  which case the device has probably run dry in the meantime.
+ */
+bool _al_kcm_update_timing(_AL_KCM_TIMING *timing, double start,
+   unsigned int samples, unsigned int frequency)
+{
+   timing->last_time = al_get_time() - start;
+   if (timing->last_time > timing->max_time)
+      timing->max_time = timing->last_time;
+   timing->period = (double)samples / frequency;
+
+   if (timing->last_time > timing->period) {
+      timing->underruns++;
+      return true;
+   }
+   return false;
+}
+
+
+/* _al_kcm_emit_underrun_event:
+ *  Emits ALLEGRO_EVENT_AUDIO_UNDERRUN from a voice or stream.
+ */
+void _al_kcm_emit_underrun_event(ALLEGRO_EVENT_SOURCE *es)
+{
+   ALLEGRO_EVENT event;
+   event.user.type = ALLEGRO_EVENT_AUDIO_UNDERRUN;
+   event.user.timestamp = al_get_time();
+   al_emit_user_event(es, &event, NULL);
+}
+
+
 /* Function: al_create_voice
  */
 ALLEGRO_VOICE *al_create_voice(unsigned int freq,
@@ -83,11 +161,13 @@ ALLEGRO_VOICE *al_create_voice(unsigned int freq,
 
    voice->mutex = al_create_mutex();
    voice->cond = al_create_cond();
+   al_init_user_event_source(&voice->es);
    /* XXX why is this needed? there should only be one active driver */
    voice->driver = _al_kcm_driver;
 
    ASSERT(_al_kcm_driver);
    if (_al_kcm_driver->allocate_voice(voice) != 0) {
+      al_destroy_user_event_source(&voice->es);
       al_destroy_mutex(voice->mutex);
       al_destroy_cond(voice->cond);
       al_free(voice);
@@ -113,6 +193,7 @@ void al_destroy_voice(ALLEGRO_VOICE *voice)
 
       /* We do NOT lock the voice mutex when calling this method. */
       voice->driver->deallocate_voice(voice);
+      al_destroy_user_event_source(&voice->es);
       al_destroy_mutex(voice->mutex);
       al_destroy_cond(voice->cond);
 
@@ -146,6 +227,13 @@ bool al_attach_sample_instance_to_voice(ALLEGRO_SAMPLE_INSTANCE *spl,
       return false;
    }
 
+   if (spl->spl_data.compressed) {
+      ALLEGRO_WARN("Attempted to attach a compressed sample to a voice\n");
+      _al_set_error(ALLEGRO_INVALID_OBJECT,
+         "Compressed samples can only be attached to mixers");
+      return false;
+   }
+
    if (voice->chan_conf != spl->spl_data.chan_conf ||
       voice->frequency != spl->spl_data.frequency ||
       voice->depth != spl->spl_data.depth)
@@ -464,6 +552,43 @@ bool al_get_voice_playing(const ALLEGRO_VOICE *voice)
    return voice->attached_stream ? true : false;
 }
 
+/* Function: al_get_voice_latency
+ */
+double al_get_voice_latency(const ALLEGRO_VOICE *voice)
+{
+   ASSERT(voice);
+
+   if (voice->driver->get_voice_latency)
+      return voice->driver->get_voice_latency(voice);
+
+   return 0.0;
+}
+
+/* Function: al_get_voice_timing
+ */
+void al_get_voice_timing(const ALLEGRO_VOICE *voice,
+   ALLEGRO_AUDIO_TIMING *timing)
+{
+   ASSERT(voice);
+   ASSERT(timing);
+
+   al_lock_mutex(voice->mutex);
+   timing->last_time = voice->timing.last_time;
+   timing->max_time = voice->timing.max_time;
+   timing->period = voice->timing.period;
+   timing->underruns = voice->timing.underruns;
+   al_unlock_mutex(voice->mutex);
+}
+
+/* Function: al_get_voice_event_source
+ */
+ALLEGRO_EVENT_SOURCE *al_get_voice_event_source(ALLEGRO_VOICE *voice)
+{
+   ASSERT(voice);
+
+   return &voice->es;
+}
+
 /* Function: al_voice_has_attachments
  */
 bool al_voice_has_attachments(const ALLEGRO_VOICE* voice)
@@ -0,0 +1,402 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Null sound driver, which plays nothing by itself and only mixes
+ *      voices when al_render_voice asks for frames.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+/* Nothing runs in the background with this driver. Streams loaded with
+ * al_load_audio_stream get no feeder thread; instead al_render_voice tops
+ * up all of them before mixing each chunk, and keeps the chunks short
+ * enough that none of them can run out within one. So the output only
+ * depends on the inputs, never on timing.
+ */
+
+typedef struct NULL_VOICE
+{
+   bool playing;
+} NULL_VOICE;
+
+/* Streams fed by al_render_voice. The mutex is held while they are fed, so
+ * that a stream cannot be destroyed in the middle of that.
+ */
+static ALLEGRO_MUTEX *feed_mutex;
+static _AL_VECTOR feed_streams = _AL_VECTOR_INITIALIZER(ALLEGRO_AUDIO_STREAM *);
+
+
+static bool is_stream(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   return spl->loop == _ALLEGRO_PLAYMODE_STREAM_ONCE ||
+      spl->loop == _ALLEGRO_PLAYMODE_STREAM_LOOP_ONCE ||
+      spl->loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR;
+}
+
+
+static int null_open(void)
+{
+   feed_mutex = al_create_mutex();
+   if (!feed_mutex)
+      return 1;
+   _al_vector_init(&feed_streams, sizeof(ALLEGRO_AUDIO_STREAM *));
+   return 0;
+}
+
+
+static void null_close(void)
+{
+   _al_vector_free(&feed_streams);
+   al_destroy_mutex(feed_mutex);
+   feed_mutex = NULL;
+}
+
+
+static int null_allocate_voice(ALLEGRO_VOICE *voice)
+{
+   NULL_VOICE *ex_data = al_calloc(1, sizeof(NULL_VOICE));
+   if (!ex_data)
+      return 1;
+   voice->extra = ex_data;
+   return 0;
+}
+
+
+static void null_deallocate_voice(ALLEGRO_VOICE *voice)
+{
+   al_free(voice->extra);
+   voice->extra = NULL;
+}
+
+
+static int null_load_voice(ALLEGRO_VOICE *voice, const void *data)
+{
+   /* Like most drivers, only forward playback of samples attached directly
+    * to a voice is supported.
+    */
+   if (voice->attached_stream->loop == ALLEGRO_PLAYMODE_BIDIR) {
+      ALLEGRO_INFO("Backwards playing not supported by the driver.\n");
+      return 1;
+   }
+
+   voice->attached_stream->pos = 0;
+   return 0;
+   (void)data;
+}
+
+
+static void null_unload_voice(ALLEGRO_VOICE *voice)
+{
+   (void)voice;
+}
+
+
+static int null_start_voice(ALLEGRO_VOICE *voice)
+{
+   NULL_VOICE *ex_data = voice->extra;
+   ex_data->playing = true;
+   return 0;
+}
+
+
+static int null_stop_voice(ALLEGRO_VOICE *voice)
+{
+   NULL_VOICE *ex_data = voice->extra;
+   ex_data->playing = false;
+   if (!voice->is_streaming)
+      voice->attached_stream->pos = 0;
+   return 0;
+}
+
+
+static bool null_voice_is_playing(const ALLEGRO_VOICE *voice)
+{
+   NULL_VOICE *ex_data = voice->extra;
+   return ex_data->playing;
+}
+
+
+static unsigned int null_get_voice_position(const ALLEGRO_VOICE *voice)
+{
+   return voice->attached_stream->pos;
+}
+
+
+static int null_set_voice_position(ALLEGRO_VOICE *voice, unsigned int val)
+{
+   voice->attached_stream->pos = val;
+   return 0;
+}
+
+
+ALLEGRO_AUDIO_DRIVER _al_kcm_null_driver =
+{
+   "Null",
+
+   null_open,
+   null_close,
+
+   null_allocate_voice,
+   null_deallocate_voice,
+
+   null_load_voice,
+   null_unload_voice,
+
+   null_start_voice,
+   null_stop_voice,
+
+   null_voice_is_playing,
+
+   null_get_voice_position,
+   null_set_voice_position,
+
+   NULL,
+   NULL,
+
+   NULL,
+
+   NULL
+};
+
+
+/* _al_kcm_null_feeder_add:
+ *  Takes over feeding a stream loaded from a file if the null driver is in
+ *  use. Returns false otherwise, in which case the caller should feed it
+ *  with a thread as usual.
+ */
+bool _al_kcm_null_feeder_add(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_AUDIO_STREAM **slot;
+
+   if (_al_kcm_driver != &_al_kcm_null_driver)
+      return false;
+
+   stream->quit_feed_thread = false;
+   stream->finished_event_sent = false;
+
+   al_lock_mutex(feed_mutex);
+   slot = _al_vector_alloc_back(&feed_streams);
+   if (!slot) {
+      al_unlock_mutex(feed_mutex);
+      return false;
+   }
+   *slot = stream;
+   stream->feed_offline = true;
+   al_unlock_mutex(feed_mutex);
+
+   /* Fill all fragments right away, so the stream can start playing. */
+   while (_al_kcm_feed_fragment(stream))
+      ;
+
+   return true;
+}
+
+
+/* _al_kcm_null_feeder_remove:
+ *  Stops feeding the stream from al_render_voice.
+ */
+void _al_kcm_null_feeder_remove(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_EVENT fin_event;
+
+   if (!stream->feed_offline)
+      return;
+
+   al_lock_mutex(feed_mutex);
+   _al_vector_find_and_delete(&feed_streams, &stream);
+   stream->feed_offline = false;
+   al_unlock_mutex(feed_mutex);
+
+   fin_event.user.type = ALLEGRO_EVENT_AUDIO_STREAM_FINISHED;
+   fin_event.user.timestamp = al_get_time();
+   al_emit_user_event(&stream->spl.es, &fin_event, NULL);
+}
+
+
+/* Refills every free fragment of the streams fed by al_render_voice. Must
+ * be called without any voice mutex held, as the stream functions lock it.
+ */
+static void feed_all_streams(void)
+{
+   unsigned int i;
+
+   al_lock_mutex(feed_mutex);
+   for (i = 0; i < _al_vector_size(&feed_streams); i++) {
+      ALLEGRO_AUDIO_STREAM **slot = _al_vector_ref(&feed_streams, i);
+      while (_al_kcm_feed_fragment(*slot))
+         ;
+   }
+   al_unlock_mutex(feed_mutex);
+}
+
+
+/* Returns how many frames may be mixed from spl, which is played back at
+ * 'rate' source frames per voice frame, before a stream fed by
+ * al_render_voice underneath it could run out of buffered fragments.
+ */
+static unsigned int safe_frames(ALLEGRO_SAMPLE_INSTANCE *spl, double rate,
+   unsigned int frames)
+{
+   if (spl->is_mixer) {
+      ALLEGRO_MIXER *mixer = (ALLEGRO_MIXER *)spl;
+      unsigned int i;
+
+      for (i = 0; i < _al_vector_size(&mixer->streams); i++) {
+         ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
+         ALLEGRO_SAMPLE_INSTANCE *child = *slot;
+         double child_rate = rate;
+
+         if (child->step_denom)
+            child_rate *= fabs((double)child->step / child->step_denom);
+         frames = safe_frames(child, child_rate, frames);
+      }
+   }
+   else if (is_stream(spl)) {
+      ALLEGRO_AUDIO_STREAM *stream = (ALLEGRO_AUDIO_STREAM *)spl;
+      double buffered;
+      size_t i;
+
+      if (!stream->feed_offline ||
+            !spl->is_playing || stream->is_draining || rate <= 0)
+         return frames;
+
+      buffered = -(double)spl->pos;
+      for (i = 0; i < stream->buf_count && stream->pending_bufs[i]; i++)
+         buffered += spl->spl_data.len;
+
+      /* Leave a frame for rounding and one for the mixer reading ahead. */
+      buffered = floor((buffered - 2) / rate);
+      if (buffered < 1)
+         buffered = 1;
+      if (buffered < frames)
+         frames = buffered;
+   }
+
+   return frames;
+}
+
+
+/* Mixes up to 'frames' frames of the voice into buf, returning how many it
+ * did. The voice mutex must be held.
+ */
+static unsigned int render_frames(ALLEGRO_VOICE *voice, char *buf,
+   unsigned int frames)
+{
+   NULL_VOICE *ex_data = voice->extra;
+   ALLEGRO_SAMPLE_INSTANCE *spl = voice->attached_stream;
+   const size_t frame_size = al_get_channel_count(voice->chan_conf) *
+      al_get_audio_depth_size(voice->depth);
+   unsigned int done = 0;
+
+   if (!spl || !ex_data->playing) {
+      al_fill_silence(buf, frames, voice->depth, voice->chan_conf);
+      return frames;
+   }
+
+   if (voice->is_streaming) {
+      frames = safe_frames(spl, 1.0, frames);
+
+      while (done < frames) {
+         void *data = NULL;
+         unsigned int n = frames - done;
+
+         spl->spl_read(spl, &data, &n, voice->depth, 0);
+         if (!data || n == 0) {
+            al_fill_silence(buf + done * frame_size, frames - done,
+               voice->depth, voice->chan_conf);
+            break;
+         }
+         memcpy(buf + done * frame_size, data, n * frame_size);
+         done += n;
+      }
+      return frames;
+   }
+
+   /* A sample attached directly to the voice. */
+   while (done < frames && ex_data->playing) {
+      int pos = spl->pos;
+      unsigned int n = frames - done;
+
+      if (pos < 0 || pos >= spl->spl_data.len) {
+         if (spl->loop == ALLEGRO_PLAYMODE_LOOP && spl->spl_data.len > 0) {
+            spl->pos = 0;
+            continue;
+         }
+         spl->pos = 0;
+         ex_data->playing = false;
+         break;
+      }
+
+      if (n > (unsigned int)(spl->spl_data.len - pos))
+         n = spl->spl_data.len - pos;
+      memcpy(buf + done * frame_size,
+         (char *)spl->spl_data.buffer.ptr + pos * frame_size, n * frame_size);
+      spl->pos = pos + n;
+      done += n;
+   }
+
+   if (done < frames) {
+      al_fill_silence(buf + done * frame_size, frames - done,
+         voice->depth, voice->chan_conf);
+   }
+   return frames;
+}
+
+
+/* Function: al_render_voice
+ */
+bool al_render_voice(ALLEGRO_VOICE *voice, void *buffer, unsigned int frames)
+{
+   size_t frame_size;
+   char *buf = buffer;
+
+   ASSERT(voice);
+   ASSERT(buffer || frames == 0);
+
+   if (voice->driver != &_al_kcm_null_driver) {
+      _al_set_error(ALLEGRO_INVALID_OBJECT,
+         "Only voices of the null audio driver can be rendered");
+      return false;
+   }
+
+   frame_size = al_get_channel_count(voice->chan_conf) *
+      al_get_audio_depth_size(voice->depth);
+
+   while (frames > 0) {
+      unsigned int n;
+
+      feed_all_streams();
+
+      al_lock_mutex(voice->mutex);
+      n = render_frames(voice, buf, frames);
+      al_unlock_mutex(voice->mutex);
+
+      buf += n * frame_size;
+      frames -= n;
+   }
+
+   return true;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -168,6 +168,8 @@ static void *_openal_update(ALLEGRO_THREAD *self, void *arg)
    const void *data;
    void *silence;
 
+   _al_kcm_raise_audio_thread(self, "al-audio-openal", false);
+
    /* Streams should not be set to looping */
    alSourcei(ex_data->source, AL_LOOPING, AL_FALSE);
 
@@ -663,6 +665,8 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_openal_driver = {
    NULL,
    NULL,
 
+   NULL,
+
    NULL
 };
 
@@ -445,6 +445,8 @@ static void * opensl_update(ALLEGRO_THREAD * self, void * data){
     ALLEGRO_VOICE *voice = data;
     OpenSLData * opensl = voice->extra;
 
+    _al_kcm_raise_audio_thread(self, "al-audio-opensl", false);
+
     int bufferIndex = 0;
     while (!al_get_thread_should_stop(self)) {
         if (opensl->status == PLAYING) {
@@ -722,5 +724,7 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_opensl_driver = {
    NULL,
    NULL,
 
+   NULL,
+
    NULL
 };
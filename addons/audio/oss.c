@@ -423,7 +423,8 @@ static void* oss_update(ALLEGRO_THREAD *self, void *arg)
 {
    ALLEGRO_VOICE *voice = arg;
    OSS_VOICE *oss_voice = voice->extra;
-   (void)self;
+
+   _al_kcm_raise_audio_thread(self, "al-audio-oss", false);
 
    while (!al_get_thread_should_stop(self)) {
       /*
@@ -623,6 +624,8 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_oss_driver =
    NULL,
    NULL,
 
+   NULL,
+
    NULL
 };
 
@@ -22,6 +22,8 @@
 #include <pulse/error.h>
 #include <pulse/introspect.h>
 #include <pulse/mainloop.h>
+#include <pulse/stream.h>
+#include <pulse/thread-mainloop.h>
 #include <stdlib.h>
 
 ALLEGRO_DEBUG_CHANNEL("PulseAudio")
@@ -33,19 +35,24 @@ enum PULSEAUDIO_VOICE_STATUS {
    PV_JOIN
 };
 
+/* Playback runs on a PulseAudio threaded mainloop. Its write callback only
+ * wakes up the voice's update thread, which mixes without holding the
+ * mainloop lock. This is necessary because mixing takes voice->mutex, and
+ * the driver methods below are called with voice->mutex held and then take
+ * the mainloop lock.
+ */
 typedef struct PULSEAUDIO_VOICE
 {
-   pa_simple *s;
+   pa_threaded_mainloop *mainloop;
+   pa_context *context;
+   pa_stream *stream;
    unsigned int buffer_size_in_frames;
    unsigned int frame_size_in_bytes;
 
    ALLEGRO_THREAD *poll_thread;
-   /* status_cond and status are protected by voice->mutex.
-    * Using another mutex introduces a deadlock if waiting for a change in
-    * status (while holding voice->mutex, acquired by a higher layer)
-    * and the background thread tries to acquire voice->mutex as well.
+   /* Protected by the mainloop lock. Changes are signalled with
+    * pa_threaded_mainloop_signal.
     */
-   ALLEGRO_COND *status_cond;
    enum PULSEAUDIO_VOICE_STATUS status;
 
    // direct buffer (non-streaming):
@@ -59,6 +66,9 @@ static _AL_LIST* output_device_list;
 #define DEFAULT_BUFFER_SIZE   1024
 #define MIN_BUFFER_SIZE       128
 
+#define DEFAULT_LATENCY_MSEC  20
+#define MIN_LATENCY_MSEC      1
+
 static unsigned int get_buffer_size(const ALLEGRO_CONFIG *config)
 {
    if (config) {
@@ -75,6 +85,22 @@ static unsigned int get_buffer_size(const ALLEGRO_CONFIG *config)
    return DEFAULT_BUFFER_SIZE;
 }
 
+static unsigned int get_latency_msec(const ALLEGRO_CONFIG *config)
+{
+   if (config) {
+      const char *val = al_get_config_value(config,
+         "pulseaudio", "latency");
+      if (val && val[0] != '\0') {
+         int n = atoi(val);
+         if (n < MIN_LATENCY_MSEC)
+            n = MIN_LATENCY_MSEC;
+         return n;
+      }
+   }
+
+   return DEFAULT_LATENCY_MSEC;
+}
+
 static void _output_device_list_dtor(void* value, void* userdata)
 {
    (void)userdata;
@@ -184,83 +210,265 @@ static void pulseaudio_close(void)
    _al_list_destroy(output_device_list);
 }
 
+static void context_state_cb(pa_context *c, void *userdata)
+{
+   PULSEAUDIO_VOICE *pv = userdata;
+   (void)c;
+
+   pa_threaded_mainloop_signal(pv->mainloop, 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata)
+{
+   PULSEAUDIO_VOICE *pv = userdata;
+   (void)s;
+
+   pa_threaded_mainloop_signal(pv->mainloop, 0);
+}
+
+static void stream_write_cb(pa_stream *s, size_t nbytes, void *userdata)
+{
+   PULSEAUDIO_VOICE *pv = userdata;
+   (void)s;
+   (void)nbytes;
+
+   pa_threaded_mainloop_signal(pv->mainloop, 0);
+}
+
+static void stream_underflow_cb(pa_stream *s, void *userdata)
+{
+   (void)s;
+   (void)userdata;
+
+   ALLEGRO_DEBUG("Stream underflow\n");
+}
+
+static void stream_success_cb(pa_stream *s, int success, void *userdata)
+{
+   PULSEAUDIO_VOICE *pv = userdata;
+   (void)s;
+   (void)success;
+
+   pa_threaded_mainloop_signal(pv->mainloop, 0);
+}
+
+/* For operations nobody waits for. */
+static void unref_op(pa_operation *op)
+{
+   if (op)
+      pa_operation_unref(op);
+}
+
+/* Lets what was written play out, then goes idle unless the voice was
+ * stopped in the meantime. Must be called with the mainloop lock held.
+ */
+static void drain_stream(PULSEAUDIO_VOICE *pv)
+{
+   pa_operation *op = pa_stream_drain(pv->stream, stream_success_cb, pv);
+
+   if (op) {
+      while (pa_operation_get_state(op) == PA_OPERATION_RUNNING &&
+            pv->status == PV_STOPPING) {
+         pa_threaded_mainloop_wait(pv->mainloop);
+      }
+      if (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
+         pa_operation_cancel(op);
+      pa_operation_unref(op);
+   }
+
+   if (pv->status == PV_STOPPING) {
+      unref_op(pa_stream_cork(pv->stream, 1, NULL, NULL));
+      pv->status = PV_IDLE;
+      pa_threaded_mainloop_signal(pv->mainloop, 0);
+   }
+}
+
+/* Takes the next chunk of a non-streaming voice's sample. Sets *finished if
+ * the sample ended and should not loop.
+ */
+static const void *read_direct_buffer(ALLEGRO_VOICE *voice,
+   PULSEAUDIO_VOICE *pv, unsigned int *frames, bool *finished)
+{
+   const char *data;
+   unsigned int len;
+
+   al_lock_mutex(pv->buffer_mutex);
+   data = pv->buffer;
+   len = *frames * pv->frame_size_in_bytes;
+   pv->buffer += len;
+   if (pv->buffer > pv->buffer_end) {
+      len = pv->buffer_end - data;
+      pv->buffer = voice->attached_stream->spl_data.buffer.ptr;
+      voice->attached_stream->pos = 0;
+      if (voice->attached_stream->loop == ALLEGRO_PLAYMODE_ONCE)
+         *finished = true;
+   }
+   else {
+      voice->attached_stream->pos += *frames;
+   }
+   al_unlock_mutex(pv->buffer_mutex);
+
+   *frames = len / pv->frame_size_in_bytes;
+   return data;
+}
+
 static void *pulseaudio_update(ALLEGRO_THREAD *self, void *data)
 {
    ALLEGRO_VOICE *voice = data;
    PULSEAUDIO_VOICE *pv = voice->extra;
-   (void)self;
+
+   _al_kcm_raise_audio_thread(self, "al-audio-pulse", false);
 
    void* silence = al_malloc(pv->buffer_size_in_frames * pv->frame_size_in_bytes);
    al_fill_silence(silence, pv->buffer_size_in_frames, voice->depth, voice->chan_conf);
 
+   pa_threaded_mainloop_lock(pv->mainloop);
+
    for (;;) {
-      enum PULSEAUDIO_VOICE_STATUS status;
+      size_t writable = 0;
+      unsigned int frames;
+      const void *buf;
+      bool finished = false;
 
-      al_lock_mutex(voice->mutex);
-      while ((status = pv->status) == PV_IDLE) {
-         al_wait_cond(pv->status_cond, voice->mutex);
+      if (pv->status == PV_JOIN) {
+         break;
       }
-      al_unlock_mutex(voice->mutex);
 
-      if (status == PV_JOIN) {
-         break;
+      if (pv->status == PV_STOPPING) {
+         drain_stream(pv);
+         continue;
       }
 
-      if (status == PV_PLAYING) {
-         unsigned int frames = pv->buffer_size_in_frames;
-         if (voice->is_streaming) { 
-            // streaming audio           
-            const void *data = _al_voice_update(voice, voice->mutex, &frames);
-            if (!data) {
-              data = silence;
-              frames = pv->buffer_size_in_frames;
-            }
-            pa_simple_write(pv->s, data,
-               frames * pv->frame_size_in_bytes, NULL);
-         }
-         else {
-            // direct buffer audio
-            al_lock_mutex(pv->buffer_mutex);
-            const char *data = pv->buffer;
-            unsigned int len = frames * pv->frame_size_in_bytes;
-            pv->buffer += frames * pv->frame_size_in_bytes;
-            if (pv->buffer > pv->buffer_end) {
-               len = pv->buffer_end - data;
-               pv->buffer = voice->attached_stream->spl_data.buffer.ptr;
-               voice->attached_stream->pos = 0;
-               if (voice->attached_stream->loop == ALLEGRO_PLAYMODE_ONCE) {
-                  al_lock_mutex(voice->mutex);
-                  pv->status = PV_STOPPING;
-                  al_broadcast_cond(pv->status_cond);
-                  al_unlock_mutex(voice->mutex);
-               }
-            }
-            else {
-               voice->attached_stream->pos += frames;
-            }
-            al_unlock_mutex(pv->buffer_mutex);
+      if (pv->status == PV_PLAYING) {
+         writable = pa_stream_writable_size(pv->stream);
+         if (writable == (size_t)-1)
+            writable = 0;
+      }
+      if (writable < pv->frame_size_in_bytes) {
+         pa_threaded_mainloop_wait(pv->mainloop);
+         continue;
+      }
+
+      frames = writable / pv->frame_size_in_bytes;
+      if (frames > pv->buffer_size_in_frames)
+         frames = pv->buffer_size_in_frames;
 
-            pa_simple_write(pv->s, data, len, NULL);
+      pa_threaded_mainloop_unlock(pv->mainloop);
+      if (voice->is_streaming) {
+         // streaming audio
+         buf = _al_voice_update(voice, voice->mutex, &frames);
+         if (!buf) {
+            buf = silence;
          }
       }
-      else if (status == PV_STOPPING) {
-         pa_simple_drain(pv->s, NULL);
-         al_lock_mutex(voice->mutex);
-         pv->status = PV_IDLE;
-         al_broadcast_cond(pv->status_cond);
-         al_unlock_mutex(voice->mutex);
+      else {
+         // direct buffer audio
+         buf = read_direct_buffer(voice, pv, &frames, &finished);
+      }
+      pa_threaded_mainloop_lock(pv->mainloop);
+
+      /* The voice may have been stopped while we were mixing. */
+      if (pv->status != PV_PLAYING)
+         continue;
+
+      if (frames > 0) {
+         pa_stream_write(pv->stream, buf, frames * pv->frame_size_in_bytes,
+            NULL, 0, PA_SEEK_RELATIVE);
+      }
+      if (finished) {
+         pv->status = PV_STOPPING;
       }
    }
+
+   pa_threaded_mainloop_unlock(pv->mainloop);
    al_free(silence);
 
    return NULL;
 }
 
+static void free_voice_connection(PULSEAUDIO_VOICE *pv)
+{
+   /* Once the mainloop thread is stopped, no locking is needed. */
+   if (pv->mainloop)
+      pa_threaded_mainloop_stop(pv->mainloop);
+   if (pv->stream) {
+      pa_stream_disconnect(pv->stream);
+      pa_stream_unref(pv->stream);
+   }
+   if (pv->context) {
+      pa_context_disconnect(pv->context);
+      pa_context_unref(pv->context);
+   }
+   if (pv->mainloop)
+      pa_threaded_mainloop_free(pv->mainloop);
+}
+
+/* Must be called with the mainloop lock held. */
+static bool connect_voice(PULSEAUDIO_VOICE *pv, const pa_sample_spec *ss,
+   const pa_buffer_attr *ba)
+{
+   pa_context_state_t cs;
+   pa_stream_state_t ss_state;
+
+   pa_context_set_state_callback(pv->context, context_state_cb, pv);
+   if (pa_context_connect(pv->context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+      ALLEGRO_ERROR("pa_context_connect failed: %s\n",
+         pa_strerror(pa_context_errno(pv->context)));
+      return false;
+   }
+
+   while ((cs = pa_context_get_state(pv->context)) != PA_CONTEXT_READY) {
+      if (!PA_CONTEXT_IS_GOOD(cs)) {
+         ALLEGRO_ERROR("PA_CONTEXT_FAILED\n");
+         return false;
+      }
+      pa_threaded_mainloop_wait(pv->mainloop);
+   }
+
+   pv->stream = pa_stream_new(pv->context, "Allegro Voice", ss, NULL);
+   if (!pv->stream) {
+      ALLEGRO_ERROR("pa_stream_new failed: %s\n",
+         pa_strerror(pa_context_errno(pv->context)));
+      return false;
+   }
+   pa_stream_set_state_callback(pv->stream, stream_state_cb, pv);
+   pa_stream_set_write_callback(pv->stream, stream_write_cb, pv);
+   pa_stream_set_underflow_callback(pv->stream, stream_underflow_cb, pv);
+
+   /* ADJUST_LATENCY makes the server size the sink's own buffer after
+    * tlength, instead of only our part of the buffer.
+    */
+   if (pa_stream_connect_playback(pv->stream, NULL, ba,
+         PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+         PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_START_CORKED,
+         NULL, NULL) < 0) {
+      ALLEGRO_ERROR("pa_stream_connect_playback failed: %s\n",
+         pa_strerror(pa_context_errno(pv->context)));
+      return false;
+   }
+
+   while ((ss_state = pa_stream_get_state(pv->stream)) != PA_STREAM_READY) {
+      if (!PA_STREAM_IS_GOOD(ss_state)) {
+         ALLEGRO_ERROR("PA_STREAM_FAILED\n");
+         return false;
+      }
+      pa_threaded_mainloop_wait(pv->mainloop);
+   }
+
+   return true;
+}
+
 static int pulseaudio_allocate_voice(ALLEGRO_VOICE *voice)
 {
-   PULSEAUDIO_VOICE *pv = al_malloc(sizeof(PULSEAUDIO_VOICE));
+   PULSEAUDIO_VOICE *pv = al_calloc(1, sizeof(PULSEAUDIO_VOICE));
+   const ALLEGRO_CONFIG *config = al_get_system_config();
    pa_sample_spec ss;
    pa_buffer_attr ba;
+   pa_usec_t latency;
+   bool ok;
+
+   if (!pv)
+      return 1;
 
    ss.channels = al_get_channel_count(voice->chan_conf);
    ss.rate = voice->frequency;
@@ -281,39 +489,44 @@ static int pulseaudio_allocate_voice(ALLEGRO_VOICE *voice)
       return 1;
    }
 
-   // These settings match what pulseaudio does by default, but with a slightly lower latency.
-   // The latency can also be controlled via PULSE_LATENCY_MSEC environment variable.
+   // The server asks for more data whenever a quarter of the target latency
+   // has been played. The latency can also be controlled via the
+   // PULSE_LATENCY_MSEC environment variable.
+   latency = (pa_usec_t)get_latency_msec(config) * 1000;
    ba.maxlength = -1;
-   ba.tlength   = pa_usec_to_bytes(50 * 1000, &ss);  // 50 ms of latency by default.
+   ba.tlength   = pa_usec_to_bytes(latency, &ss);
    ba.prebuf    = -1;
-   ba.minreq    = -1;
+   ba.minreq    = pa_usec_to_bytes(latency / 4, &ss);
    ba.fragsize  = -1;
 
-   pv->s = pa_simple_new(
-      NULL,                // Use the default server.
-      al_get_app_name(),     
-      PA_STREAM_PLAYBACK,
-      NULL,                // Use the default device.
-      "Allegro Voice",    
-      &ss,                
-      NULL,                // Use default channel map
-      &ba,                
-      NULL                 // Ignore error code.
-   );
-
-   if (!pv->s) {
+   pv->mainloop = pa_threaded_mainloop_new();
+   if (!pv->mainloop) {
+      al_free(pv);
+      return 1;
+   }
+   pv->context = pa_context_new(pa_threaded_mainloop_get_api(pv->mainloop),
+      al_get_app_name());
+   if (!pv->context || pa_threaded_mainloop_start(pv->mainloop) < 0) {
+      free_voice_connection(pv);
+      al_free(pv);
+      return 1;
+   }
+
+   pa_threaded_mainloop_lock(pv->mainloop);
+   ok = connect_voice(pv, &ss, &ba);
+   pa_threaded_mainloop_unlock(pv->mainloop);
+   if (!ok) {
+      free_voice_connection(pv);
       al_free(pv);
       return 1;
    }
 
    voice->extra = pv;
 
-   pv->buffer_size_in_frames = get_buffer_size(al_get_system_config());
+   pv->buffer_size_in_frames = get_buffer_size(config);
    pv->frame_size_in_bytes = ss.channels * al_get_audio_depth_size(voice->depth);
 
    pv->status = PV_IDLE;
-   //pv->status_mutex = al_create_mutex();
-   pv->status_cond = al_create_cond();
    pv->buffer_mutex = al_create_mutex();
 
    pv->poll_thread = al_create_thread(pulseaudio_update, (void*)voice);
@@ -326,10 +539,10 @@ static void pulseaudio_deallocate_voice(ALLEGRO_VOICE *voice)
 {
    PULSEAUDIO_VOICE *pv = voice->extra;
 
-   al_lock_mutex(voice->mutex);
+   pa_threaded_mainloop_lock(pv->mainloop);
    pv->status = PV_JOIN;
-   al_broadcast_cond(pv->status_cond);
-   al_unlock_mutex(voice->mutex);
+   pa_threaded_mainloop_signal(pv->mainloop, 0);
+   pa_threaded_mainloop_unlock(pv->mainloop);
 
    /* We do NOT hold the voice mutex here, so this does NOT result in a
     * deadlock when the thread calls _al_voice_update.
@@ -337,10 +550,9 @@ static void pulseaudio_deallocate_voice(ALLEGRO_VOICE *voice)
    al_join_thread(pv->poll_thread, NULL);
    al_destroy_thread(pv->poll_thread);
 
-   al_destroy_cond(pv->status_cond);
    al_destroy_mutex(pv->buffer_mutex);
 
-   pa_simple_free(pv->s);
+   free_voice_connection(pv);
    al_free(pv);
 }
 
@@ -375,14 +587,17 @@ static int pulseaudio_start_voice(ALLEGRO_VOICE *voice)
 
    /* We hold the voice->mutex already. */
 
+   pa_threaded_mainloop_lock(pv->mainloop);
    if (pv->status == PV_IDLE) {
       pv->status = PV_PLAYING;
-      al_broadcast_cond(pv->status_cond);
+      unref_op(pa_stream_cork(pv->stream, 0, NULL, NULL));
+      pa_threaded_mainloop_signal(pv->mainloop, 0);
       ret = 0;
    }
    else {
       ret = 1;
    }
+   pa_threaded_mainloop_unlock(pv->mainloop);
 
    return ret;
 }
@@ -393,14 +608,14 @@ static int pulseaudio_stop_voice(ALLEGRO_VOICE *voice)
 
    /* We hold the voice->mutex already. */
 
-   if (pv->status == PV_PLAYING) {
-      pv->status = PV_STOPPING;
-      al_broadcast_cond(pv->status_cond);
-   }
-
-   while (pv->status != PV_IDLE) {
-      al_wait_cond(pv->status_cond, voice->mutex);
+   pa_threaded_mainloop_lock(pv->mainloop);
+   if (pv->status == PV_PLAYING || pv->status == PV_STOPPING) {
+      pv->status = PV_IDLE;
+      unref_op(pa_stream_cork(pv->stream, 1, NULL, NULL));
+      unref_op(pa_stream_flush(pv->stream, NULL, NULL));
+      pa_threaded_mainloop_signal(pv->mainloop, 0);
    }
+   pa_threaded_mainloop_unlock(pv->mainloop);
 
    return 0;
 }
@@ -420,7 +635,10 @@ static int pulseaudio_set_voice_position(ALLEGRO_VOICE *voice, unsigned int pos)
 {
    PULSEAUDIO_VOICE *pv = voice->extra;
 
-   pa_simple_drain(pv->s, NULL);
+   /* Drop what was queued from the old position. */
+   pa_threaded_mainloop_lock(pv->mainloop);
+   unref_op(pa_stream_flush(pv->stream, NULL, NULL));
+   pa_threaded_mainloop_unlock(pv->mainloop);
 
    al_lock_mutex(pv->buffer_mutex);
    voice->attached_stream->pos = pos;
@@ -431,6 +649,22 @@ static int pulseaudio_set_voice_position(ALLEGRO_VOICE *voice, unsigned int pos)
    return 0;
 }
 
+static double pulseaudio_get_voice_latency(const ALLEGRO_VOICE *voice)
+{
+   PULSEAUDIO_VOICE *pv = voice->extra;
+   pa_usec_t usec = 0;
+   int negative = 0;
+
+   pa_threaded_mainloop_lock(pv->mainloop);
+   if (pa_stream_get_latency(pv->stream, &usec, &negative) < 0)
+      usec = 0;
+   pa_threaded_mainloop_unlock(pv->mainloop);
+
+   if (negative)
+      return 0.0;
+   return usec / 1000000.0;
+}
+
 /* Recording */
 
 typedef struct PULSEAUDIO_RECORDER {
@@ -443,10 +677,11 @@ static void *pulse_audio_update_recorder(ALLEGRO_THREAD *t, void *data)
 {
    ALLEGRO_AUDIO_RECORDER *r = (ALLEGRO_AUDIO_RECORDER *) data;
    PULSEAUDIO_RECORDER *pa = (PULSEAUDIO_RECORDER *) r->extra;
-   ALLEGRO_EVENT user_event;
    uint8_t *null_buffer;
    unsigned int fragment_i = 0;
-   
+
+   _al_kcm_raise_audio_thread(t, "al-audio-rec", false);
+
    null_buffer = al_malloc(1024);
    if (!null_buffer) {
       ALLEGRO_ERROR("Unable to create buffer for draining PulseAudio.\n");
@@ -464,14 +699,10 @@ static void *pulse_audio_update_recorder(ALLEGRO_THREAD *t, void *data)
          pa_simple_read(pa->s, null_buffer, 1024, NULL);
       }
       else {
-         ALLEGRO_AUDIO_RECORDER_EVENT *e;
          al_unlock_mutex(r->mutex);
          if (pa_simple_read(pa->s, r->fragments[fragment_i], r->fragment_size, NULL) >= 0) {
-            user_event.user.type = ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT;
-            e = al_get_audio_recorder_event(&user_event);
-            e->buffer = r->fragments[fragment_i];
-            e->samples = r->samples;           
-            al_emit_user_event(&r->source, &user_event, NULL);
+            _al_kcm_emit_recorder_fragment(r, r->fragments[fragment_i],
+               r->samples);
          
             if (++fragment_i == r->fragment_count) {
                fragment_i = 0;
@@ -575,7 +806,9 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_pulseaudio_driver =
    pulseaudio_allocate_recorder,
    pulseaudio_deallocate_recorder,
 
-   pulseaudio_get_output_devices
+   pulseaudio_get_output_devices,
+
+   pulseaudio_get_voice_latency
 };
 
 /* vim: set sts=3 sw=3 et: */
@@ -2,6 +2,8 @@
  * Allegro audio recording
  */
 
+#include <string.h>
+
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern_audio.h"
 #include "allegro5/internal/aintern_audio_cfg.h"
@@ -65,6 +67,25 @@ ALLEGRO_AUDIO_RECORDER *al_create_audio_recorder(size_t fragment_count,
       }
    }
 
+   /* The ring holds as much as the fragments, and there is room for two
+    * blocks per fragment in case the driver delivers partial ones.
+    */
+   r->ring_frames = r->fragment_count * r->samples + 1;
+   r->block_count = r->fragment_count * 2 + 1;
+   r->ring = al_malloc((size_t)r->ring_frames * r->sample_size);
+   r->blocks = al_malloc(r->block_count * sizeof(*r->blocks));
+   if (!r->ring || !r->blocks) {
+      al_free(r->ring);
+      al_free(r->blocks);
+      for (i = 0; i < fragment_count; ++i) {
+         al_free(r->fragments[i]);
+      }
+      al_free(r->fragments);
+
+      ALLEGRO_ERROR("Unable to allocate memory for ALLEGRO_AUDIO_RECORDER ring\n");
+      return false;
+   }
+
    if (_al_kcm_driver->allocate_recorder(r)) {
       ALLEGRO_ERROR("Failed to allocate recorder from driver\n");
       return false;
@@ -138,6 +159,153 @@ ALLEGRO_EVENT_SOURCE *al_get_audio_recorder_event_source(ALLEGRO_AUDIO_RECORDER
    return &r->source;
 }
 
+/* Function: al_set_audio_recorder_ring_mode
+ */
+void al_set_audio_recorder_ring_mode(ALLEGRO_AUDIO_RECORDER *r, bool ring_mode)
+{
+   ASSERT(r);
+
+   r->ring_mode = ring_mode;
+}
+
+/* Function: al_get_audio_recorder_ring_mode
+ */
+bool al_get_audio_recorder_ring_mode(const ALLEGRO_AUDIO_RECORDER *r)
+{
+   ASSERT(r);
+
+   return r->ring_mode;
+}
+
+/* Function: al_get_audio_recorder_data
+ */
+const void *al_get_audio_recorder_data(ALLEGRO_AUDIO_RECORDER *r,
+   unsigned int *samples, double *timestamp)
+{
+   int br = _al_atomic_load_acquire(&r->block_read);
+   int bw = _al_atomic_load_acquire(&r->block_write);
+   const _AL_KCM_RECORDER_BLOCK *b;
+   unsigned int start, n;
+
+   ASSERT(r);
+   ASSERT(samples);
+
+   if (br == bw) {
+      *samples = 0;
+      return NULL;
+   }
+
+   b = &r->blocks[br];
+   start = (b->start + r->block_offset) % r->ring_frames;
+   n = b->frames - r->block_offset;
+   /* Only hand out what is contiguous, the rest comes next time. */
+   if (start + n > r->ring_frames)
+      n = r->ring_frames - start;
+
+   *samples = n;
+   if (timestamp)
+      *timestamp = b->time + (double)r->block_offset / r->frequency;
+   return r->ring + (size_t)start * r->sample_size;
+}
+
+/* Function: al_commit_audio_recorder_data
+ */
+void al_commit_audio_recorder_data(ALLEGRO_AUDIO_RECORDER *r,
+   unsigned int samples)
+{
+   int br = _al_atomic_load_acquire(&r->block_read);
+   const _AL_KCM_RECORDER_BLOCK *b;
+
+   if (br == _al_atomic_load_acquire(&r->block_write))
+      return;
+
+   b = &r->blocks[br];
+   ASSERT(samples <= b->frames - r->block_offset);
+
+   r->block_offset += samples;
+   if (r->block_offset >= b->frames) {
+      r->block_offset = 0;
+      _al_atomic_store_release(&r->ring_read,
+         (b->start + b->frames) % r->ring_frames);
+      _al_atomic_store_release(&r->block_read, (br + 1) % r->block_count);
+   }
+}
+
+/* Function: al_get_audio_recorder_dropped_samples
+ */
+unsigned int al_get_audio_recorder_dropped_samples(
+   const ALLEGRO_AUDIO_RECORDER *r)
+{
+   ASSERT(r);
+
+   return r->dropped;
+}
+
+/* Appends a block to the ring, or drops it if the reader has fallen behind
+ * so far that there is no room.
+ */
+static void ring_write(ALLEGRO_AUDIO_RECORDER *r, const void *buffer,
+   unsigned int samples, double time)
+{
+   unsigned int rd = _al_atomic_load_acquire(&r->ring_read);
+   unsigned int wr = r->ring_write;
+   int bw = _al_atomic_load_acquire(&r->block_write);
+   int next_bw = (bw + 1) % r->block_count;
+   unsigned int space = (rd + r->ring_frames - wr - 1) % r->ring_frames;
+   unsigned int first;
+   _AL_KCM_RECORDER_BLOCK *b;
+
+   if (samples > space ||
+         next_bw == _al_atomic_load_acquire(&r->block_read)) {
+      r->dropped += samples;
+      return;
+   }
+
+   first = r->ring_frames - wr;
+   if (first > samples)
+      first = samples;
+   memcpy(r->ring + (size_t)wr * r->sample_size, buffer,
+      (size_t)first * r->sample_size);
+   memcpy(r->ring, (const uint8_t *)buffer + (size_t)first * r->sample_size,
+      (size_t)(samples - first) * r->sample_size);
+
+   b = &r->blocks[bw];
+   b->start = wr;
+   b->frames = samples;
+   b->time = time;
+
+   r->ring_write = (wr + samples) % r->ring_frames;
+   _al_atomic_store_release(&r->block_write, next_bw);
+}
+
+/* _al_kcm_emit_recorder_fragment:
+ *  Called by the drivers for every fragment they have recorded. Emits an
+ *  ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT event, or in ring mode appends the
+ *  fragment to the ring.
+ */
+void _al_kcm_emit_recorder_fragment(ALLEGRO_AUDIO_RECORDER *r,
+   void *buffer, unsigned int samples)
+{
+   /* The fragment has only just been completed, so it started to come in
+    * one fragment's time ago.
+    */
+   double time = al_get_time() - (double)samples / r->frequency;
+
+   if (r->ring_mode) {
+      ring_write(r, buffer, samples, time);
+   }
+   else {
+      ALLEGRO_EVENT user_event;
+      ALLEGRO_AUDIO_RECORDER_EVENT *e;
+      user_event.user.type = ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT;
+      user_event.user.timestamp = time;
+      e = al_get_audio_recorder_event(&user_event);
+      e->buffer = buffer;
+      e->samples = samples;
+      al_emit_user_event(&r->source, &user_event, NULL);
+   }
+}
+
 /* Function: al_destroy_audio_recorder
  */
 void al_destroy_audio_recorder(ALLEGRO_AUDIO_RECORDER *r)
@@ -171,5 +339,7 @@ void al_destroy_audio_recorder(ALLEGRO_AUDIO_RECORDER *r)
       al_free(r->fragments[i]);
    }
    al_free(r->fragments);
+   al_free(r->ring);
+   al_free(r->blocks);
    al_free(r);
 }
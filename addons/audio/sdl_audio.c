@@ -160,13 +160,8 @@ static void recorder_callback(void *userdata, Uint8 *stream, int len)
       int count = SDL_min(len, r->samples * r->sample_size);
       memcpy(r->fragments[sdl->fragment], stream, count);
 
-      ALLEGRO_EVENT user_event;
-      ALLEGRO_AUDIO_RECORDER_EVENT *e;
-      user_event.user.type = ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT;
-      e = al_get_audio_recorder_event(&user_event);
-      e->buffer = r->fragments[sdl->fragment];
-      e->samples = count / r->sample_size;
-      al_emit_user_event(&r->source, &user_event, NULL);
+      _al_kcm_emit_recorder_fragment(r, r->fragments[sdl->fragment],
+         count / r->sample_size);
 
       sdl->fragment++;
       if (sdl->fragment == r->fragment_count) {
@@ -269,4 +264,6 @@ ALLEGRO_AUDIO_DRIVER _al_kcm_sdl_driver =
    sdl_deallocate_recorder,
 
    sdl_get_output_devices,
+
+   NULL,
 };
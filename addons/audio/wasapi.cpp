@@ -0,0 +1,1172 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      WASAPI sound driver.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#ifndef WINVER
+#define WINVER 0x0601
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <windows.h>
+#include <mmreg.h>
+#include <mmdeviceapi.h>
+#include <audioclient.h>
+#include <propidl.h>
+
+#include "allegro5/allegro.h"
+
+extern "C" {
+
+ALLEGRO_DEBUG_CHANNEL("audio-wasapi")
+
+#include "allegro5/internal/aintern_audio.h"
+#include "allegro5/internal/aintern_wunicode.h"
+
+/* Defined here so that we need neither uuid.lib nor initguid.h tricks. */
+static const CLSID _al_CLSID_MMDeviceEnumerator = { 0xbcde0395, 0xe52f, 0x467c, { 0x8e, 0x3d, 0xc4, 0x57, 0x92, 0x91, 0x69, 0x2e } };
+static const IID _al_IID_IMMDeviceEnumerator =    { 0xa95664d2, 0x9614, 0x4f35, { 0xa7, 0x46, 0xde, 0x8d, 0xb6, 0x36, 0x17, 0xe6 } };
+static const IID _al_IID_IAudioClient =           { 0x1cb9ad4c, 0xdbfa, 0x4c32, { 0xb1, 0x78, 0xc2, 0xf5, 0x68, 0xa7, 0x03, 0xb2 } };
+static const IID _al_IID_IAudioClient3 =          { 0x7ed4ee07, 0x8e67, 0x4cd4, { 0x8c, 0x1a, 0x2b, 0x7a, 0x59, 0x87, 0xad, 0x42 } };
+static const IID _al_IID_IAudioRenderClient =     { 0xf294acfc, 0x3146, 0x4483, { 0xa7, 0xbf, 0xad, 0xdc, 0xa7, 0xc2, 0x60, 0xe2 } };
+static const IID _al_IID_IAudioCaptureClient =    { 0xc8adbd64, 0xe71e, 0x48a0, { 0xa4, 0xde, 0x18, 0x5c, 0x39, 0x5c, 0xd3, 0x17 } };
+static const GUID _al_KSDATAFORMAT_SUBTYPE_PCM =  { 0x00000001, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID _al_KSDATAFORMAT_SUBTYPE_IEEE_FLOAT = { 0x00000003, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const PROPERTYKEY _al_PKEY_Device_FriendlyName = { { 0xa45c254e, 0xdf1c, 0x4efd, { 0x80, 0x20, 0x67, 0xd1, 0x46, 0xa8, 0x50, 0xe0 } }, 14 };
+
+/* Missing from older MinGW headers. */
+#ifndef AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM
+#define AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM      0x80000000
+#endif
+#ifndef AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY
+#define AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY 0x08000000
+#endif
+
+#define REFTIMES_PER_SEC   10000000
+
+static _AL_LIST* output_device_list;
+
+enum WASAPI_VOICE_STATUS {
+   WV_IDLE,
+   WV_PLAYING,
+   WV_DRAINING,
+   WV_JOIN
+};
+
+/* All WASAPI calls for a voice are made on the voice's own thread, which
+ * sleeps on the event WASAPI sets whenever it wants another period. The
+ * driver methods set the same event to wake it up after changing status.
+ */
+struct WASAPI_VOICE {
+   IAudioClient *client;
+   IAudioRenderClient *render;
+   HANDLE event;
+   UINT32 buffer_frames;
+   unsigned int frame_size;
+   bool exclusive;
+   double latency;
+
+   ALLEGRO_THREAD *thread;
+   /* The fields below are protected by voice->mutex. Changes to them are
+    * signalled through voice->cond.
+    */
+   enum WASAPI_VOICE_STATUS status;
+   int init_result;              /* -1 while the thread is starting. */
+   bool started;                 /* Whether the client is running. */
+
+   /* Direct buffer (non-streaming). */
+   char *buffer;
+   char *buffer_end;
+};
+
+
+static bool get_exclusive(void)
+{
+   const char *val = al_get_config_value(al_get_system_config(),
+      "wasapi", "exclusive");
+   return val && (strcmp(val, "yes") == 0 || strcmp(val, "true") == 0);
+}
+
+/* In frames. 0 asks for the smallest buffer the device allows. */
+static unsigned int get_buffer_size(void)
+{
+   const char *val = al_get_config_value(al_get_system_config(),
+      "wasapi", "buffer_size");
+   if (val && val[0] != '\0') {
+      int n = atoi(val);
+      if (n < 0)
+         n = 0;
+      return n;
+   }
+
+   return 0;
+}
+
+
+static DWORD get_channel_mask(ALLEGRO_CHANNEL_CONF chan_conf)
+{
+   switch (chan_conf) {
+      case ALLEGRO_CHANNEL_CONF_1:
+         return SPEAKER_FRONT_CENTER;
+      case ALLEGRO_CHANNEL_CONF_2:
+         return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+      case ALLEGRO_CHANNEL_CONF_4:
+         return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT |
+            SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+      case ALLEGRO_CHANNEL_CONF_5_1:
+         return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT |
+            SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+            SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+      case ALLEGRO_CHANNEL_CONF_7_1:
+         return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT |
+            SPEAKER_FRONT_CENTER | SPEAKER_LOW_FREQUENCY |
+            SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT |
+            SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+      default:
+         return 0;
+   }
+}
+
+
+static bool make_format(ALLEGRO_AUDIO_DEPTH depth,
+   ALLEGRO_CHANNEL_CONF chan_conf, unsigned int frequency,
+   WAVEFORMATEXTENSIBLE *wfx)
+{
+   int bits;
+   bool is_float = false;
+
+   switch (depth) {
+      case ALLEGRO_AUDIO_DEPTH_UINT8:
+         bits = 8;
+         break;
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         bits = 16;
+         break;
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+         bits = 32;
+         is_float = true;
+         break;
+      default:
+         /* 24-bit samples are right-aligned in 32 bits in Allegro, but
+          * WASAPI wants them left-aligned.
+          */
+         ALLEGRO_ERROR("Unsupported audio depth\n");
+         return false;
+   }
+
+   memset(wfx, 0, sizeof(*wfx));
+   wfx->dwChannelMask = get_channel_mask(chan_conf);
+   if (!wfx->dwChannelMask) {
+      ALLEGRO_ERROR("Unsupported channel configuration\n");
+      return false;
+   }
+
+   wfx->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+   wfx->Format.nChannels = (WORD)al_get_channel_count(chan_conf);
+   wfx->Format.nSamplesPerSec = frequency;
+   wfx->Format.wBitsPerSample = (WORD)bits;
+   wfx->Format.nBlockAlign = wfx->Format.nChannels * bits / 8;
+   wfx->Format.nAvgBytesPerSec = wfx->Format.nBlockAlign * frequency;
+   wfx->Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+   wfx->Samples.wValidBitsPerSample = (WORD)bits;
+   wfx->SubFormat = is_float ? _al_KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+      : _al_KSDATAFORMAT_SUBTYPE_PCM;
+
+   return true;
+}
+
+
+static GUID get_subformat(const WAVEFORMATEX *fmt)
+{
+   if (fmt->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+      return ((const WAVEFORMATEXTENSIBLE *)fmt)->SubFormat;
+   if (fmt->wFormatTag == WAVE_FORMAT_IEEE_FLOAT)
+      return _al_KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+   return _al_KSDATAFORMAT_SUBTYPE_PCM;
+}
+
+
+static bool same_format(const WAVEFORMATEX *a, const WAVEFORMATEXTENSIBLE *b)
+{
+   if (a->nChannels != b->Format.nChannels ||
+         a->nSamplesPerSec != b->Format.nSamplesPerSec ||
+         a->wBitsPerSample != b->Format.wBitsPerSample)
+      return false;
+   if (!IsEqualGUID(get_subformat(a), b->SubFormat))
+      return false;
+   if (a->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+         ((const WAVEFORMATEXTENSIBLE *)a)->dwChannelMask != b->dwChannelMask)
+      return false;
+   return true;
+}
+
+
+static IMMDevice *get_default_device(EDataFlow flow)
+{
+   IMMDeviceEnumerator *enumerator = NULL;
+   IMMDevice *dev = NULL;
+   HRESULT hr;
+
+   hr = CoCreateInstance(_al_CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
+      _al_IID_IMMDeviceEnumerator, (void **)&enumerator);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("CoCreateInstance failed: 0x%08lx\n", (unsigned long)hr);
+      return NULL;
+   }
+   hr = enumerator->GetDefaultAudioEndpoint(flow, eConsole, &dev);
+   enumerator->Release();
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("GetDefaultAudioEndpoint failed: 0x%08lx\n",
+         (unsigned long)hr);
+      return NULL;
+   }
+   return dev;
+}
+
+
+static IAudioClient *activate_client(IMMDevice *dev)
+{
+   IAudioClient *client = NULL;
+   HRESULT hr;
+
+   hr = dev->Activate(_al_IID_IAudioClient, CLSCTX_ALL, NULL,
+      (void **)&client);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("Activate failed: 0x%08lx\n", (unsigned long)hr);
+      return NULL;
+   }
+   return client;
+}
+
+
+/* Exclusive mode bypasses the Windows mixer entirely and runs at the
+ * device's smallest period, but only if the device takes our format as is.
+ */
+static IAudioClient *init_exclusive(IMMDevice *dev,
+   const WAVEFORMATEXTENSIBLE *wfx)
+{
+   IAudioClient *client;
+   REFERENCE_TIME period;
+   HRESULT hr;
+
+   client = activate_client(dev);
+   if (!client)
+      return NULL;
+
+   hr = client->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE,
+      (const WAVEFORMATEX *)wfx, NULL);
+   if (hr != S_OK) {
+      ALLEGRO_WARN("Format not supported in exclusive mode\n");
+      client->Release();
+      return NULL;
+   }
+
+   hr = client->GetDevicePeriod(NULL, &period);
+   if (FAILED(hr)) {
+      client->Release();
+      return NULL;
+   }
+
+   hr = client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+      AUDCLNT_STREAMFLAGS_EVENTCALLBACK, period, period,
+      (const WAVEFORMATEX *)wfx, NULL);
+   if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED) {
+      /* The client must be recreated with a period that fits the buffer
+       * size the device prefers.
+       */
+      UINT32 frames;
+      client->GetBufferSize(&frames);
+      client->Release();
+      period = (REFERENCE_TIME)((double)REFTIMES_PER_SEC * frames /
+         wfx->Format.nSamplesPerSec + 0.5);
+      client = activate_client(dev);
+      if (!client)
+         return NULL;
+      hr = client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+         AUDCLNT_STREAMFLAGS_EVENTCALLBACK, period, period,
+         (const WAVEFORMATEX *)wfx, NULL);
+   }
+   if (FAILED(hr)) {
+      ALLEGRO_WARN("Exclusive mode Initialize failed: 0x%08lx\n",
+         (unsigned long)hr);
+      client->Release();
+      return NULL;
+   }
+
+   return client;
+}
+
+
+static IAudioClient *init_shared(IMMDevice *dev,
+   const WAVEFORMATEXTENSIBLE *wfx)
+{
+   IAudioClient *client;
+   IAudioClient3 *client3;
+   REFERENCE_TIME duration;
+   HRESULT hr;
+
+   client = activate_client(dev);
+   if (!client)
+      return NULL;
+
+   /* IAudioClient3 (Windows 10) can run a shared stream at the engine's
+    * smallest period, but only in the engine's own format.
+    */
+   if (SUCCEEDED(client->QueryInterface(_al_IID_IAudioClient3,
+         (void **)&client3))) {
+      WAVEFORMATEX *mix = NULL;
+      UINT32 def_period, fund_period, min_period, max_period;
+      bool ok = false;
+
+      if (SUCCEEDED(client3->GetMixFormat(&mix)) && same_format(mix, wfx) &&
+            SUCCEEDED(client3->GetSharedModeEnginePeriod(mix, &def_period,
+               &fund_period, &min_period, &max_period))) {
+         hr = client3->InitializeSharedAudioStream(
+            AUDCLNT_STREAMFLAGS_EVENTCALLBACK, min_period, mix, NULL);
+         if (SUCCEEDED(hr)) {
+            ALLEGRO_INFO("Shared mode with %u frame periods\n", min_period);
+            ok = true;
+         }
+      }
+      CoTaskMemFree(mix);
+      client3->Release();
+      if (ok)
+         return client;
+   }
+
+   duration = (REFERENCE_TIME)((double)REFTIMES_PER_SEC * get_buffer_size() /
+      wfx->Format.nSamplesPerSec);
+   hr = client->Initialize(AUDCLNT_SHAREMODE_SHARED,
+      AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+      AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY, duration, 0,
+      (const WAVEFORMATEX *)wfx, NULL);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("Shared mode Initialize failed: 0x%08lx\n",
+         (unsigned long)hr);
+      client->Release();
+      return NULL;
+   }
+
+   return client;
+}
+
+
+static void release_client(WASAPI_VOICE *wv)
+{
+   if (wv->render) {
+      wv->render->Release();
+      wv->render = NULL;
+   }
+   if (wv->client) {
+      wv->client->Release();
+      wv->client = NULL;
+   }
+}
+
+
+static bool init_client(ALLEGRO_VOICE *voice, WASAPI_VOICE *wv)
+{
+   IMMDevice *dev;
+   WAVEFORMATEXTENSIBLE wfx;
+   REFERENCE_TIME stream_latency = 0;
+   HRESULT hr;
+
+   if (!make_format(voice->depth, voice->chan_conf, voice->frequency, &wfx))
+      return false;
+   wv->frame_size = wfx.Format.nBlockAlign;
+
+   dev = get_default_device(eRender);
+   if (!dev)
+      return false;
+
+   if (get_exclusive()) {
+      wv->client = init_exclusive(dev, &wfx);
+      wv->exclusive = (wv->client != NULL);
+   }
+   if (!wv->client)
+      wv->client = init_shared(dev, &wfx);
+   dev->Release();
+   if (!wv->client)
+      return false;
+
+   hr = wv->client->SetEventHandle(wv->event);
+   if (FAILED(hr))
+      goto Error;
+   hr = wv->client->GetBufferSize(&wv->buffer_frames);
+   if (FAILED(hr))
+      goto Error;
+   hr = wv->client->GetService(_al_IID_IAudioRenderClient,
+      (void **)&wv->render);
+   if (FAILED(hr))
+      goto Error;
+
+   wv->client->GetStreamLatency(&stream_latency);
+   wv->latency = (double)stream_latency / REFTIMES_PER_SEC +
+      (double)wv->buffer_frames / voice->frequency;
+
+   ALLEGRO_INFO("%s mode, buffer of %u frames (%.1f ms latency)\n",
+      wv->exclusive ? "Exclusive" : "Shared", wv->buffer_frames,
+      wv->latency * 1000.0);
+
+   return true;
+
+Error:
+   ALLEGRO_ERROR("Setting up the audio client failed: 0x%08lx\n",
+      (unsigned long)hr);
+   release_client(wv);
+   return false;
+}
+
+
+/* Reads the next frames of a non-streaming voice's sample. Returns the
+ * number of frames written, the rest must be filled with silence.
+ */
+static UINT32 read_direct_buffer(ALLEGRO_VOICE *voice, WASAPI_VOICE *wv,
+   BYTE *out, UINT32 frames)
+{
+   ALLEGRO_SAMPLE_INSTANCE *spl;
+   UINT32 done = 0;
+
+   al_lock_mutex(voice->mutex);
+   spl = voice->attached_stream;
+   while (done < frames && wv->status == WV_PLAYING && spl &&
+         spl->spl_data.len > 0) {
+      UINT32 avail = (UINT32)((wv->buffer_end - wv->buffer) / wv->frame_size);
+      UINT32 n = frames - done;
+      if (n > avail)
+         n = avail;
+
+      memcpy(out + done * wv->frame_size, wv->buffer, n * wv->frame_size);
+      wv->buffer += n * wv->frame_size;
+      spl->pos += n;
+      done += n;
+
+      if (wv->buffer >= wv->buffer_end) {
+         wv->buffer = (char *)spl->spl_data.buffer.ptr;
+         spl->pos = 0;
+         if (spl->loop == ALLEGRO_PLAYMODE_ONCE) {
+            wv->status = WV_DRAINING;
+            al_broadcast_cond(voice->cond);
+         }
+      }
+   }
+   al_unlock_mutex(voice->mutex);
+
+   return done;
+}
+
+
+/* Gives WASAPI as many frames as fit into its buffer. */
+static bool fill_buffer(ALLEGRO_VOICE *voice, WASAPI_VOICE *wv)
+{
+   UINT32 padding = 0;
+   UINT32 frames;
+   UINT32 done = 0;
+   BYTE *out;
+   HRESULT hr;
+
+   /* In exclusive mode every event asks for a whole buffer. */
+   if (!wv->exclusive) {
+      hr = wv->client->GetCurrentPadding(&padding);
+      if (FAILED(hr)) {
+         ALLEGRO_ERROR("GetCurrentPadding failed: 0x%08lx\n",
+            (unsigned long)hr);
+         return false;
+      }
+   }
+   frames = wv->buffer_frames - padding;
+   if (frames == 0)
+      return true;
+
+   hr = wv->render->GetBuffer(frames, &out);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("GetBuffer failed: 0x%08lx\n", (unsigned long)hr);
+      return false;
+   }
+
+   if (voice->is_streaming) {
+      while (done < frames) {
+         unsigned int n = frames - done;
+         const void *data = _al_voice_update(voice, voice->mutex, &n);
+         if (!data || n == 0)
+            break;
+         memcpy(out + done * wv->frame_size, data, n * wv->frame_size);
+         done += n;
+      }
+   }
+   else {
+      done = read_direct_buffer(voice, wv, out, frames);
+   }
+
+   if (done < frames) {
+      al_fill_silence(out + done * wv->frame_size, frames - done,
+         voice->depth, voice->chan_conf);
+   }
+
+   hr = wv->render->ReleaseBuffer(frames, 0);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("ReleaseBuffer failed: 0x%08lx\n", (unsigned long)hr);
+      return false;
+   }
+
+   return true;
+}
+
+
+static void set_started(ALLEGRO_VOICE *voice, WASAPI_VOICE *wv, bool started)
+{
+   al_lock_mutex(voice->mutex);
+   wv->started = started;
+   al_broadcast_cond(voice->cond);
+   al_unlock_mutex(voice->mutex);
+}
+
+
+static void stop_client(ALLEGRO_VOICE *voice, WASAPI_VOICE *wv)
+{
+   if (wv->started) {
+      wv->client->Stop();
+      wv->client->Reset();
+      set_started(voice, wv, false);
+   }
+}
+
+
+static void *wasapi_update(ALLEGRO_THREAD *self, void *arg)
+{
+   ALLEGRO_VOICE *voice = (ALLEGRO_VOICE *)arg;
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+   bool com = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+   bool failed;
+
+   failed = !init_client(voice, wv);
+
+   al_lock_mutex(voice->mutex);
+   wv->init_result = failed ? 1 : 0;
+   al_broadcast_cond(voice->cond);
+   al_unlock_mutex(voice->mutex);
+
+   if (!failed) {
+      /* With buffers this small, we must not wait for other threads. */
+      _al_kcm_raise_audio_thread(self, "al-audio-wasapi");
+      ALLEGRO_INFO("WASAPI update thread started\n");
+   }
+
+   while (!failed) {
+      enum WASAPI_VOICE_STATUS status;
+      UINT32 padding = 0;
+
+      WaitForSingleObject(wv->event, 200);
+
+      al_lock_mutex(voice->mutex);
+      status = wv->status;
+      al_unlock_mutex(voice->mutex);
+
+      if (status == WV_JOIN)
+         break;
+
+      if (status == WV_IDLE) {
+         stop_client(voice, wv);
+         continue;
+      }
+
+      if (status == WV_DRAINING) {
+         /* Let what was already queued play out. */
+         if (!wv->exclusive &&
+               SUCCEEDED(wv->client->GetCurrentPadding(&padding)) &&
+               padding > 0)
+            continue;
+         stop_client(voice, wv);
+         al_lock_mutex(voice->mutex);
+         if (wv->status == WV_DRAINING)
+            wv->status = WV_IDLE;
+         al_unlock_mutex(voice->mutex);
+         continue;
+      }
+
+      if (!fill_buffer(voice, wv)) {
+         /* Most likely the device was unplugged. The voice stays silent
+          * until it is destroyed.
+          */
+         stop_client(voice, wv);
+         failed = true;
+         break;
+      }
+
+      /* Starting after the first fill avoids an initial glitch. */
+      if (!wv->started) {
+         HRESULT hr = wv->client->Start();
+         if (FAILED(hr)) {
+            ALLEGRO_ERROR("Start failed: 0x%08lx\n", (unsigned long)hr);
+            failed = true;
+            break;
+         }
+         set_started(voice, wv, true);
+      }
+   }
+
+   /* Wait to be told to quit, so that the other methods need not care
+    * whether the thread is still running.
+    */
+   if (failed) {
+      al_lock_mutex(voice->mutex);
+      while (wv->status != WV_JOIN)
+         al_wait_cond(voice->cond, voice->mutex);
+      al_unlock_mutex(voice->mutex);
+   }
+
+   stop_client(voice, wv);
+   release_client(wv);
+
+   if (com)
+      CoUninitialize();
+
+   ALLEGRO_INFO("WASAPI update thread stopped\n");
+
+   return NULL;
+}
+
+
+/* Recording */
+
+struct WASAPI_RECORDER {
+   WAVEFORMATEXTENSIBLE wfx;
+   HANDLE event;
+   IAudioClient *client;
+   IAudioCaptureClient *capture;
+   bool started;
+
+   unsigned int fragment_i;
+   size_t bytes_written;
+};
+
+
+static bool init_capture_client(WASAPI_RECORDER *wr)
+{
+   IMMDevice *dev;
+   HRESULT hr;
+
+   dev = get_default_device(eCapture);
+   if (!dev)
+      return false;
+   wr->client = activate_client(dev);
+   dev->Release();
+   if (!wr->client)
+      return false;
+
+   hr = wr->client->Initialize(AUDCLNT_SHAREMODE_SHARED,
+      AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+      AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY, 0, 0,
+      (const WAVEFORMATEX *)&wr->wfx, NULL);
+   if (SUCCEEDED(hr))
+      hr = wr->client->SetEventHandle(wr->event);
+   if (SUCCEEDED(hr))
+      hr = wr->client->GetService(_al_IID_IAudioCaptureClient,
+         (void **)&wr->capture);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("Setting up the capture client failed: 0x%08lx\n",
+         (unsigned long)hr);
+      wr->client->Release();
+      wr->client = NULL;
+      return false;
+   }
+
+   return true;
+}
+
+
+/* Copies captured data into the fragments, emitting an event for each one
+ * that fills up. A NULL data pointer records silence.
+ */
+static void record_data(ALLEGRO_AUDIO_RECORDER *r, WASAPI_RECORDER *wr,
+   const BYTE *data, size_t size)
+{
+   while (size > 0) {
+      uint8_t *dst = (uint8_t *)r->fragments[wr->fragment_i] +
+         wr->bytes_written;
+      size_t n = r->fragment_size - wr->bytes_written;
+      if (n > size)
+         n = size;
+
+      if (data) {
+         memcpy(dst, data, n);
+         data += n;
+      }
+      else {
+         al_fill_silence(dst, n / r->sample_size, r->depth, r->chan_conf);
+      }
+      size -= n;
+      wr->bytes_written += n;
+
+      if (wr->bytes_written == r->fragment_size) {
+         _al_kcm_emit_recorder_fragment(r, r->fragments[wr->fragment_i],
+            r->samples);
+
+         if (++wr->fragment_i == r->fragment_count)
+            wr->fragment_i = 0;
+         wr->bytes_written = 0;
+      }
+   }
+}
+
+
+static void *wasapi_update_recorder(ALLEGRO_THREAD *t, void *data)
+{
+   ALLEGRO_AUDIO_RECORDER *r = (ALLEGRO_AUDIO_RECORDER *)data;
+   WASAPI_RECORDER *wr = (WASAPI_RECORDER *)r->extra;
+   bool com = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+   bool ok;
+
+   ok = init_capture_client(wr);
+   _al_kcm_raise_audio_thread(t, "al-audio-rec");
+
+   while (!al_get_thread_should_stop(t)) {
+      UINT32 packet = 0;
+
+      al_lock_mutex(r->mutex);
+      while (!r->is_recording && !al_get_thread_should_stop(t)) {
+         if (wr->started) {
+            wr->client->Stop();
+            wr->client->Reset();
+            wr->started = false;
+         }
+         al_wait_cond(r->cond, r->mutex);
+      }
+      al_unlock_mutex(r->mutex);
+
+      if (!ok || al_get_thread_should_stop(t)) {
+         al_rest(0.1);
+         continue;
+      }
+
+      if (!wr->started) {
+         if (FAILED(wr->client->Start())) {
+            ALLEGRO_ERROR("Could not start capturing\n");
+            ok = false;
+            continue;
+         }
+         wr->started = true;
+      }
+
+      WaitForSingleObject(wr->event, 200);
+
+      while (SUCCEEDED(wr->capture->GetNextPacketSize(&packet)) &&
+            packet > 0) {
+         BYTE *buf;
+         UINT32 frames;
+         DWORD flags;
+
+         if (FAILED(wr->capture->GetBuffer(&buf, &frames, &flags, NULL, NULL)))
+            break;
+         record_data(r, wr,
+            (flags & AUDCLNT_BUFFERFLAGS_SILENT) ? NULL : buf,
+            (size_t)frames * r->sample_size);
+         wr->capture->ReleaseBuffer(frames);
+      }
+   }
+
+   if (wr->started)
+      wr->client->Stop();
+   if (wr->capture)
+      wr->capture->Release();
+   if (wr->client)
+      wr->client->Release();
+   wr->capture = NULL;
+   wr->client = NULL;
+
+   if (com)
+      CoUninitialize();
+
+   return NULL;
+}
+
+
+static int wasapi_allocate_recorder(ALLEGRO_AUDIO_RECORDER *r)
+{
+   WASAPI_RECORDER *wr;
+
+   wr = (WASAPI_RECORDER *)al_calloc(1, sizeof(*wr));
+   if (!wr) {
+      ALLEGRO_ERROR("Unable to allocate memory for WASAPI_RECORDER.\n");
+      return 1;
+   }
+
+   if (!make_format(r->depth, r->chan_conf, r->frequency, &wr->wfx)) {
+      al_free(wr);
+      return 1;
+   }
+
+   wr->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+   if (!wr->event) {
+      al_free(wr);
+      return 1;
+   }
+
+   /* The capture client is set up by the thread, which is the only one
+    * using it.
+    */
+   r->extra = wr;
+   r->thread = al_create_thread(wasapi_update_recorder, r);
+
+   return 0;
+}
+
+
+static void wasapi_deallocate_recorder(ALLEGRO_AUDIO_RECORDER *r)
+{
+   WASAPI_RECORDER *wr = (WASAPI_RECORDER *)r->extra;
+
+   CloseHandle(wr->event);
+   al_free(wr);
+   r->extra = NULL;
+}
+
+
+static void _output_device_list_dtor(void* value, void* userdata)
+{
+   (void)userdata;
+
+   ALLEGRO_AUDIO_DEVICE* device = (ALLEGRO_AUDIO_DEVICE*)value;
+   al_free(device->name);
+   al_free(device->identifier);
+   al_free(device);
+}
+
+
+static void enumerate_output_devices(IMMDeviceEnumerator *enumerator)
+{
+   IMMDeviceCollection *collection;
+   UINT count = 0;
+   UINT i;
+
+   if (FAILED(enumerator->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE,
+         &collection)))
+      return;
+   collection->GetCount(&count);
+
+   for (i = 0; i < count; i++) {
+      IMMDevice *dev;
+      IPropertyStore *props;
+      LPWSTR id;
+      PROPVARIANT name;
+
+      if (FAILED(collection->Item(i, &dev)))
+         continue;
+      if (FAILED(dev->GetId(&id))) {
+         dev->Release();
+         continue;
+      }
+
+      PropVariantInit(&name);
+      if (SUCCEEDED(dev->OpenPropertyStore(STGM_READ, &props))) {
+         props->GetValue(_al_PKEY_Device_FriendlyName, &name);
+         props->Release();
+      }
+
+      ALLEGRO_AUDIO_DEVICE* device = (ALLEGRO_AUDIO_DEVICE*)al_malloc(sizeof(ALLEGRO_AUDIO_DEVICE));
+      device->name = _al_win_utf16_to_utf8(name.vt == VT_LPWSTR ? name.pwszVal : id);
+      device->identifier = _al_win_utf16_to_utf8(id);
+      _al_list_push_back_ex(output_device_list, device, _output_device_list_dtor);
+
+      PropVariantClear(&name);
+      CoTaskMemFree(id);
+      dev->Release();
+   }
+
+   collection->Release();
+}
+
+
+/* The open method starts up the driver and should lock the device, using the
+   previously set parameters, or defaults. It shouldn't need to start sending
+   audio data to the device yet, however. */
+static int wasapi_open(void)
+{
+   IMMDeviceEnumerator *enumerator;
+   IMMDevice *dev;
+   HRESULT hr;
+   /* Fails with RPC_E_CHANGED_MODE if the program initialized COM itself,
+    * which is fine.
+    */
+   bool com = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+
+   hr = CoCreateInstance(_al_CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
+      _al_IID_IMMDeviceEnumerator, (void **)&enumerator);
+   if (FAILED(hr)) {
+      ALLEGRO_WARN("WASAPI is not available: 0x%08lx\n", (unsigned long)hr);
+      if (com)
+         CoUninitialize();
+      return 1;
+   }
+
+   hr = enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &dev);
+   if (FAILED(hr)) {
+      ALLEGRO_WARN("No default audio endpoint: 0x%08lx\n", (unsigned long)hr);
+      enumerator->Release();
+      if (com)
+         CoUninitialize();
+      return 1;
+   }
+   dev->Release();
+
+   output_device_list = _al_list_create();
+   enumerate_output_devices(enumerator);
+
+   enumerator->Release();
+   if (com)
+      CoUninitialize();
+
+   ALLEGRO_INFO("WASAPI opened\n");
+   return 0;
+}
+
+
+/* The close method should close the device, freeing any resources, and allow
+   other processes to use the device */
+static void wasapi_close(void)
+{
+   _al_list_destroy(output_device_list);
+   output_device_list = NULL;
+}
+
+
+/* The allocate_voice method should grab a voice from the system, and allocate
+   any data common to streaming and non-streaming sources. */
+static int wasapi_allocate_voice(ALLEGRO_VOICE *voice)
+{
+   WASAPI_VOICE *wv;
+   int result;
+
+   wv = (WASAPI_VOICE *)al_calloc(1, sizeof(*wv));
+   if (!wv) {
+      ALLEGRO_ERROR("Could not allocate voice data memory\n");
+      return 1;
+   }
+
+   wv->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+   if (!wv->event) {
+      al_free(wv);
+      return 1;
+   }
+   wv->status = WV_IDLE;
+   wv->init_result = -1;
+
+   voice->extra = wv;
+
+   wv->thread = al_create_thread(wasapi_update, (void *)voice);
+   if (!wv->thread) {
+      CloseHandle(wv->event);
+      al_free(wv);
+      voice->extra = NULL;
+      return 1;
+   }
+   al_start_thread(wv->thread);
+
+   al_lock_mutex(voice->mutex);
+   while (wv->init_result < 0)
+      al_wait_cond(voice->cond, voice->mutex);
+   result = wv->init_result;
+   if (result != 0) {
+      wv->status = WV_JOIN;
+      al_broadcast_cond(voice->cond);
+   }
+   al_unlock_mutex(voice->mutex);
+
+   if (result != 0) {
+      al_join_thread(wv->thread, NULL);
+      al_destroy_thread(wv->thread);
+      CloseHandle(wv->event);
+      al_free(wv);
+      voice->extra = NULL;
+      return 1;
+   }
+
+   return 0;
+}
+
+
+/* The deallocate_voice method should free the resources for the given voice,
+   but still retain a hold on the device. The voice should be stopped and
+   unloaded by the time this is called */
+static void wasapi_deallocate_voice(ALLEGRO_VOICE *voice)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+
+   al_lock_mutex(voice->mutex);
+   wv->status = WV_JOIN;
+   al_broadcast_cond(voice->cond);
+   al_unlock_mutex(voice->mutex);
+   SetEvent(wv->event);
+
+   al_join_thread(wv->thread, NULL);
+   al_destroy_thread(wv->thread);
+
+   CloseHandle(wv->event);
+   al_free(wv);
+   voice->extra = NULL;
+}
+
+
+/* The load_voice method loads a sample into the driver's memory. The voice's
+   'streaming' field will be set to false for these voices, and it's
+   'buffer_size' field will be the total length in bytes of the sample data.
+   The voice's attached sample's looping mode should be honored, and loading
+   must fail if it cannot be. */
+static int wasapi_load_voice(ALLEGRO_VOICE *voice, const void *data)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+   (void)data;
+
+   if (voice->attached_stream->loop == ALLEGRO_PLAYMODE_BIDIR) {
+      ALLEGRO_INFO("Backwards playing not supported by the driver.\n");
+      return 1;
+   }
+
+   voice->attached_stream->pos = 0;
+
+   wv->buffer = (char *)voice->attached_stream->spl_data.buffer.ptr;
+   wv->buffer_end = wv->buffer +
+      voice->attached_stream->spl_data.len * wv->frame_size;
+
+   return 0;
+}
+
+
+/* The unload_voice method unloads a sample previously loaded with load_voice.
+   This method should not be called on a streaming voice. */
+static void wasapi_unload_voice(ALLEGRO_VOICE *voice)
+{
+   (void)voice;
+}
+
+
+/* The start_voice should, surprise, start the voice. For streaming voices, it
+   should start polling the device and call _al_voice_update for audio data.
+   For non-streaming voices, it should resume playing from the last set
+   position */
+static int wasapi_start_voice(ALLEGRO_VOICE *voice)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+
+   /* We already hold voice->mutex. */
+   wv->status = WV_PLAYING;
+   al_broadcast_cond(voice->cond);
+   SetEvent(wv->event);
+
+   return 0;
+}
+
+
+/* The stop_voice method should stop playback. For non-streaming voices, it
+   should leave the data loaded, and reset the voice position to 0. */
+static int wasapi_stop_voice(ALLEGRO_VOICE *voice)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+
+   /* We already hold voice->mutex. */
+   wv->status = WV_IDLE;
+   al_broadcast_cond(voice->cond);
+   SetEvent(wv->event);
+
+   while (wv->started) {
+      al_wait_cond(voice->cond, voice->mutex);
+   }
+
+   return 0;
+}
+
+
+/* The voice_is_playing method should only be called on non-streaming sources,
+   and should return true if the voice is playing */
+static bool wasapi_voice_is_playing(const ALLEGRO_VOICE *voice)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+   return wv->status == WV_PLAYING;
+}
+
+
+/* The get_voice_position method should return the current sample position of
+   the voice (sample_pos = byte_pos / (depth/8) / channels). This should never
+   be called on a streaming voice. */
+static unsigned int wasapi_get_voice_position(const ALLEGRO_VOICE *voice)
+{
+   return voice->attached_stream->pos;
+}
+
+
+/* The set_voice_position method should set the voice's playback position,
+   given the value in samples. This should never be called on a streaming
+   voice. */
+static int wasapi_set_voice_position(ALLEGRO_VOICE *voice, unsigned int val)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+
+   /* We already hold voice->mutex. */
+   voice->attached_stream->pos = val;
+   wv->buffer = (char *)voice->attached_stream->spl_data.buffer.ptr +
+      val * wv->frame_size;
+
+   return 0;
+}
+
+
+static _AL_LIST* wasapi_get_output_devices(void)
+{
+   return output_device_list;
+}
+
+
+static double wasapi_get_voice_latency(const ALLEGRO_VOICE *voice)
+{
+   WASAPI_VOICE *wv = (WASAPI_VOICE *)voice->extra;
+   return wv->latency;
+}
+
+
+ALLEGRO_AUDIO_DRIVER _al_kcm_wasapi_driver = {
+   "WASAPI",
+
+   wasapi_open,
+   wasapi_close,
+
+   wasapi_allocate_voice,
+   wasapi_deallocate_voice,
+
+   wasapi_load_voice,
+   wasapi_unload_voice,
+
+   wasapi_start_voice,
+   wasapi_stop_voice,
+
+   wasapi_voice_is_playing,
+
+   wasapi_get_voice_position,
+   wasapi_set_voice_position,
+
+   wasapi_allocate_recorder,
+   wasapi_deallocate_recorder,
+
+   wasapi_get_output_devices,
+
+   wasapi_get_voice_latency
+};
+
+} /* End extern "C" */
+
+/* vim: set sts=3 sw=3 et: */
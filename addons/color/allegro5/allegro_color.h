@@ -93,6 +93,27 @@ ALLEGRO_COLOR_FUNC(void, al_color_rgb_to_linear, (float red, float green, float
    float *x, float *y, float *z));
 ALLEGRO_COLOR_FUNC(ALLEGRO_COLOR, al_color_linear, (float r, float g, float b));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_COLOR_SRC)
+ALLEGRO_COLOR_FUNC(void, al_color_rgb_to_linear_n, (const float *rgb,
+   float *linear, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_rgb8_to_linear_n, (const unsigned char *rgb,
+   float *linear, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_linear_to_rgb_n, (const float *linear,
+   float *rgb, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_rgb_to_oklab_n, (const float *rgb,
+   float *oklab, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_rgb8_to_oklab_n, (const unsigned char *rgb,
+   float *oklab, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_oklab_to_rgb_n, (const float *oklab,
+   float *rgb, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_rgb_to_lab_n, (const float *rgb,
+   float *lab, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_rgb8_to_lab_n, (const unsigned char *rgb,
+   float *lab, int n));
+ALLEGRO_COLOR_FUNC(void, al_color_lab_to_rgb_n, (const float *lab,
+   float *rgb, int n));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
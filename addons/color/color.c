@@ -11,6 +11,16 @@
 #include "allegro5/internal/aintern.h"
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+   (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #define USE_SSE
+   #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+   #define USE_NEON
+   #include <arm_neon.h>
+#endif
 
 typedef struct {
    char const *name;
@@ -679,7 +689,7 @@ static double cielab_f(double x) {
 
 
 static double cielab_f_inv(double x) {
-   if (x > delta) return pow(x, 3);
+   if (x > delta) return x * x * x;
    return (x - 4.0 / 29) * 3 * delta2;
 }
 
@@ -899,5 +909,446 @@ ALLEGRO_COLOR al_color_oklab(float l, float a, float b)
 }
 
 
+/* Array versions of the conversions.
+ *
+ * The colors are stored as consecutive triples of floats, so the gamma
+ * curve and the cube root can be applied to the whole array as if it
+ * was a flat list of numbers. With SSE2 or NEON that is done four numbers
+ * at a time using polynomial approximations of log2 and exp2, which are
+ * accurate to about 1e-6 relative to the single color functions.
+ */
+
+#if defined(USE_SSE) || defined(USE_NEON)
+
+#ifdef USE_SSE
+
+typedef __m128 VEC;
+typedef __m128 MASK;
+typedef __m128i IVEC;
+
+static INLINE VEC v_set(float x) { return _mm_set1_ps(x); }
+static INLINE VEC v_load(const float *p) { return _mm_loadu_ps(p); }
+static INLINE void v_store(float *p, VEC v) { _mm_storeu_ps(p, v); }
+static INLINE VEC v_add(VEC a, VEC b) { return _mm_add_ps(a, b); }
+static INLINE VEC v_sub(VEC a, VEC b) { return _mm_sub_ps(a, b); }
+static INLINE VEC v_mul(VEC a, VEC b) { return _mm_mul_ps(a, b); }
+static INLINE VEC v_div(VEC a, VEC b) { return _mm_div_ps(a, b); }
+static INLINE VEC v_abs(VEC a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static INLINE VEC v_copysign(VEC a, VEC s)
+{
+   VEC sign = _mm_and_ps(s, _mm_set1_ps(-0.0f));
+   return _mm_or_ps(v_abs(a), sign);
+}
+static INLINE MASK v_lt(VEC a, VEC b) { return _mm_cmplt_ps(a, b); }
+static INLINE VEC v_select(MASK m, VEC a, VEC b)
+{
+   return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+static INLINE IVEC v_bits(VEC a) { return _mm_castps_si128(a); }
+static INLINE VEC v_from_bits(IVEC a) { return _mm_castsi128_ps(a); }
+static INLINE IVEC i_set(int x) { return _mm_set1_epi32(x); }
+static INLINE IVEC i_add(IVEC a, IVEC b) { return _mm_add_epi32(a, b); }
+static INLINE IVEC i_sub(IVEC a, IVEC b) { return _mm_sub_epi32(a, b); }
+static INLINE IVEC i_and(IVEC a, IVEC b) { return _mm_and_si128(a, b); }
+static INLINE IVEC i_or(IVEC a, IVEC b) { return _mm_or_si128(a, b); }
+static INLINE IVEC i_shr23(IVEC a) { return _mm_srli_epi32(a, 23); }
+static INLINE IVEC i_shl23(IVEC a) { return _mm_slli_epi32(a, 23); }
+/* All ones in a mask lane is -1 as an integer. */
+static INLINE IVEC i_from_mask(MASK m) { return _mm_castps_si128(m); }
+static INLINE VEC i_to_float(IVEC a) { return _mm_cvtepi32_ps(a); }
+static INLINE IVEC v_trunc(VEC a) { return _mm_cvttps_epi32(a); }
+
+#else
+
+typedef float32x4_t VEC;
+typedef uint32x4_t MASK;
+typedef int32x4_t IVEC;
+
+static INLINE VEC v_set(float x) { return vdupq_n_f32(x); }
+static INLINE VEC v_load(const float *p) { return vld1q_f32(p); }
+static INLINE void v_store(float *p, VEC v) { vst1q_f32(p, v); }
+static INLINE VEC v_add(VEC a, VEC b) { return vaddq_f32(a, b); }
+static INLINE VEC v_sub(VEC a, VEC b) { return vsubq_f32(a, b); }
+static INLINE VEC v_mul(VEC a, VEC b) { return vmulq_f32(a, b); }
+static INLINE VEC v_div(VEC a, VEC b)
+{
+#ifdef __aarch64__
+   return vdivq_f32(a, b);
+#else
+   /* Two Newton-Raphson steps on the reciprocal estimate. */
+   VEC r = vrecpeq_f32(b);
+   r = vmulq_f32(r, vrecpsq_f32(b, r));
+   r = vmulq_f32(r, vrecpsq_f32(b, r));
+   return vmulq_f32(a, r);
+#endif
+}
+static INLINE VEC v_abs(VEC a) { return vabsq_f32(a); }
+static INLINE VEC v_copysign(VEC a, VEC s)
+{
+   return vbslq_f32(vdupq_n_u32(0x80000000), s, vabsq_f32(a));
+}
+static INLINE MASK v_lt(VEC a, VEC b) { return vcltq_f32(a, b); }
+static INLINE VEC v_select(MASK m, VEC a, VEC b) { return vbslq_f32(m, a, b); }
+static INLINE IVEC v_bits(VEC a) { return vreinterpretq_s32_f32(a); }
+static INLINE VEC v_from_bits(IVEC a) { return vreinterpretq_f32_s32(a); }
+static INLINE IVEC i_set(int x) { return vdupq_n_s32(x); }
+static INLINE IVEC i_add(IVEC a, IVEC b) { return vaddq_s32(a, b); }
+static INLINE IVEC i_sub(IVEC a, IVEC b) { return vsubq_s32(a, b); }
+static INLINE IVEC i_and(IVEC a, IVEC b) { return vandq_s32(a, b); }
+static INLINE IVEC i_or(IVEC a, IVEC b) { return vorrq_s32(a, b); }
+static INLINE IVEC i_shr23(IVEC a) { return vshrq_n_s32(a, 23); }
+static INLINE IVEC i_shl23(IVEC a) { return vshlq_n_s32(a, 23); }
+static INLINE IVEC i_from_mask(MASK m) { return vreinterpretq_s32_u32(m); }
+static INLINE VEC i_to_float(IVEC a) { return vcvtq_f32_s32(a); }
+static INLINE IVEC v_trunc(VEC a) { return vcvtq_s32_f32(a); }
+
+#endif
+
+/* log2(x) for positive, normal x. The mantissa is brought into
+ * [sqrt(1/2), sqrt(2)) and log2 of it is computed from the series of
+ * atanh((m - 1) / (m + 1)).
+ */
+static INLINE VEC v_log2(VEC x)
+{
+   IVEC bits = v_bits(x);
+   IVEC e = i_sub(i_shr23(bits), i_set(127));
+   VEC m = v_from_bits(i_or(i_and(bits, i_set(0x007fffff)), i_set(0x3f800000)));
+   MASK big = v_lt(v_set(1.41421356f), m);
+   VEC t, t2, p;
+
+   m = v_select(big, v_mul(m, v_set(0.5f)), m);
+   e = i_sub(e, i_from_mask(big));
+
+   t = v_div(v_sub(m, v_set(1)), v_add(m, v_set(1)));
+   t2 = v_mul(t, t);
+   p = v_set(2 / (9 * 0.693147181f));
+   p = v_add(v_mul(p, t2), v_set(2 / (7 * 0.693147181f)));
+   p = v_add(v_mul(p, t2), v_set(2 / (5 * 0.693147181f)));
+   p = v_add(v_mul(p, t2), v_set(2 / (3 * 0.693147181f)));
+   p = v_add(v_mul(p, t2), v_set(2 / 0.693147181f));
+   return v_add(i_to_float(e), v_mul(p, t));
+}
+
+/* 2^x, with x clamped to the range of normal floats. The fraction is
+ * brought into [-1/2, 1/2) and 2^f computed from its Taylor series.
+ */
+static INLINE VEC v_exp2(VEC x)
+{
+   IVEC n;
+   VEC f, p;
+   MASK neg;
+
+   x = v_select(v_lt(x, v_set(-126)), v_set(-126), x);
+   x = v_select(v_lt(v_set(127), x), v_set(127), x);
+
+   /* Round to nearest by truncating x + 0.5 towards minus infinity. */
+   f = v_add(x, v_set(0.5f));
+   n = v_trunc(f);
+   neg = v_lt(f, i_to_float(n));
+   n = i_add(n, i_from_mask(neg));
+   f = v_sub(x, i_to_float(n));
+
+   p = v_set(1.52527338e-5f);
+   p = v_add(v_mul(p, f), v_set(1.54035304e-4f));
+   p = v_add(v_mul(p, f), v_set(1.33335581e-3f));
+   p = v_add(v_mul(p, f), v_set(9.61812911e-3f));
+   p = v_add(v_mul(p, f), v_set(5.55041087e-2f));
+   p = v_add(v_mul(p, f), v_set(2.40226507e-1f));
+   p = v_add(v_mul(p, f), v_set(6.93147181e-1f));
+   p = v_add(v_mul(p, f), v_set(1));
+   return v_mul(p, v_from_bits(i_shl23(i_add(n, i_set(127)))));
+}
+
+static INLINE VEC v_srgb_to_linear(VEC x)
+{
+   VEC lo = v_mul(x, v_set(1 / 12.92f));
+   VEC base = v_mul(v_add(x, v_set(0.055f)), v_set(1 / 1.055f));
+   VEC hi = v_exp2(v_mul(v_log2(base), v_set(2.4f)));
+   return v_select(v_lt(x, v_set(0.04045f)), lo, hi);
+}
+
+static INLINE VEC v_linear_to_srgb(VEC x)
+{
+   VEC lo = v_mul(x, v_set(12.92f));
+   VEC hi = v_exp2(v_mul(v_log2(x), v_set(1 / 2.4f)));
+   hi = v_sub(v_mul(hi, v_set(1.055f)), v_set(0.055f));
+   return v_select(v_lt(x, v_set(0.0031308f)), lo, hi);
+}
+
+/* The estimate from log2 and exp2 is refined with a Newton step. Tiny
+ * numbers, including zero, give zero.
+ */
+static INLINE VEC v_cbrt(VEC x)
+{
+   VEC a = v_abs(x);
+   MASK tiny = v_lt(a, v_set(1e-30f));
+   VEC y = v_exp2(v_mul(v_log2(a), v_set(1 / 3.0f)));
+   y = v_mul(v_add(v_add(y, y), v_div(a, v_mul(y, y))), v_set(1 / 3.0f));
+   return v_select(tiny, v_set(0), v_copysign(y, x));
+}
+
+static INLINE VEC v_cielab_f(VEC x)
+{
+   VEC lo = v_add(v_set(4.0f / 29), v_mul(x, v_set(1 / (3 * delta2))));
+   return v_select(v_lt(v_set(delta3), x), v_cbrt(x), lo);
+}
+
+#define DEFINE_ARRAY_FUNC(name, vfunc)                                   \
+   static void name(const float *in, float *out, int count)             \
+   {                                                                     \
+      float tmp[4] = {0, 0, 0, 0};                                       \
+      int i;                                                             \
+      for (i = 0; i + 4 <= count; i += 4)                                \
+         v_store(out + i, vfunc(v_load(in + i)));                        \
+      if (i < count) {                                                   \
+         /* Do the remainder the same way so the result does not depend  \
+          * on the position in the array.                                \
+          */                                                             \
+         memcpy(tmp, in + i, (count - i) * sizeof(float));               \
+         v_store(tmp, vfunc(v_load(tmp)));                               \
+         memcpy(out + i, tmp, (count - i) * sizeof(float));              \
+      }                                                                  \
+   }
+
+#else
+
+static float s_srgb_to_linear(float x) { return srgba_gamma_to_linear(x); }
+static float s_linear_to_srgb(float x) { return srgba_linear_to_gamma(x); }
+static float s_cbrt(float x) { return cbrtf(x); }
+static float s_cielab_f(float x) { return cielab_f(x); }
+
+#define DEFINE_ARRAY_FUNC(name, sfunc)                                   \
+   static void name(const float *in, float *out, int count)             \
+   {                                                                     \
+      int i;                                                             \
+      for (i = 0; i < count; i++)                                        \
+         out[i] = sfunc(in[i]);                                          \
+   }
+
+#define v_srgb_to_linear s_srgb_to_linear
+#define v_linear_to_srgb s_linear_to_srgb
+#define v_cbrt s_cbrt
+#define v_cielab_f s_cielab_f
+
+#endif
+
+DEFINE_ARRAY_FUNC(srgb_to_linear_array, v_srgb_to_linear)
+DEFINE_ARRAY_FUNC(linear_to_srgb_array, v_linear_to_srgb)
+DEFINE_ARRAY_FUNC(cbrt_array, v_cbrt)
+DEFINE_ARRAY_FUNC(cielab_f_array, v_cielab_f)
+
+
+/* sRGB to linear for all 8-bit values, computed with srgba_gamma_to_linear.
+ */
+static const float srgb8_to_linear_table[256] = {
+   0.0f, 0.000303526991f, 0.000607053982f, 0.000910580973f, 0.00121410796f,
+   0.00151763496f, 0.00182116195f, 0.00212468882f, 0.00242821593f,
+   0.0027317428f, 0.00303526991f, 0.00334653584f, 0.00367650739f,
+   0.00402471703f, 0.00439144205f, 0.00477695325f, 0.00518151652f,
+   0.00560539169f, 0.00604883302f, 0.00651209056f, 0.00699541019f,
+   0.00749903219f, 0.00802319311f, 0.00856812578f, 0.00913405884f,
+   0.00972121768f, 0.010329823f, 0.0109600937f, 0.0116122449f, 0.012286488f,
+   0.0129830325f, 0.0137020834f, 0.0144438436f, 0.0152085144f, 0.0159962941f,
+   0.0168073755f, 0.0176419541f, 0.01850022f, 0.0193823613f, 0.0202885624f,
+   0.0212190095f, 0.0221738853f, 0.0231533665f, 0.0241576321f, 0.0251868591f,
+   0.0262412224f, 0.0273208916f, 0.02842604f, 0.0295568351f, 0.0307134446f,
+   0.0318960324f, 0.0331047662f, 0.0343398079f, 0.0356013142f, 0.0368894488f,
+   0.0382043719f, 0.0395462364f, 0.0409151986f, 0.0423114114f, 0.043735031f,
+   0.045186203f, 0.0466650873f, 0.0481718257f, 0.0497065671f, 0.0512694567f,
+   0.0528606474f, 0.054480277f, 0.0561284907f, 0.0578054301f, 0.0595112368f,
+   0.0612460524f, 0.0630100146f, 0.064803265f, 0.0666259378f, 0.0684781671f,
+   0.0703600943f, 0.0722718537f, 0.0742135718f, 0.0761853829f, 0.078187421f,
+   0.0802198201f, 0.0822827071f, 0.0843762085f, 0.0865004584f, 0.0886555836f,
+   0.0908417106f, 0.0930589661f, 0.0953074694f, 0.097587347f, 0.0998987257f,
+   0.102241732f, 0.104616486f, 0.107023105f, 0.10946171f, 0.111932427f,
+   0.114435375f, 0.116970666f, 0.119538426f, 0.122138776f, 0.124771819f,
+   0.127437681f, 0.130136475f, 0.13286832f, 0.135633335f, 0.138431609f,
+   0.141263291f, 0.144128472f, 0.147027269f, 0.149959788f, 0.152926147f,
+   0.155926466f, 0.158960834f, 0.162029371f, 0.165132195f, 0.168269396f,
+   0.171441108f, 0.174647406f, 0.177888423f, 0.18116425f, 0.18447499f,
+   0.187820777f, 0.191201687f, 0.194617838f, 0.198069319f, 0.20155625f,
+   0.205078736f, 0.208636865f, 0.212230757f, 0.215860501f, 0.219526201f,
+   0.223227963f, 0.226965874f, 0.230740055f, 0.23455058f, 0.238397568f,
+   0.242281124f, 0.246201321f, 0.25015828f, 0.254152089f, 0.258182853f,
+   0.262250662f, 0.266355604f, 0.270497799f, 0.274677306f, 0.278894275f,
+   0.283148736f, 0.287440836f, 0.291770637f, 0.296138257f, 0.300543785f,
+   0.304987311f, 0.309468925f, 0.313988715f, 0.318546772f, 0.323143214f,
+   0.327778101f, 0.332451522f, 0.337163627f, 0.341914415f, 0.346704066f,
+   0.351532608f, 0.356400132f, 0.361306787f, 0.366252601f, 0.371237695f,
+   0.376262128f, 0.38132602f, 0.386429429f, 0.391572475f, 0.396755219f,
+   0.401977777f, 0.407240212f, 0.412542611f, 0.417885065f, 0.423267663f,
+   0.428690493f, 0.434153646f, 0.439657182f, 0.445201188f, 0.450785786f,
+   0.456411034f, 0.462076992f, 0.467783809f, 0.473531485f, 0.479320168f,
+   0.48514995f, 0.491020858f, 0.496932983f, 0.502886474f, 0.50888133f,
+   0.514917672f, 0.520995557f, 0.527115107f, 0.533276379f, 0.539479494f,
+   0.545724452f, 0.55201143f, 0.558340371f, 0.564711511f, 0.571124852f,
+   0.577580452f, 0.584078431f, 0.590618849f, 0.597201765f, 0.603827357f,
+   0.610495567f, 0.617206573f, 0.623960376f, 0.630757153f, 0.637596846f,
+   0.644479692f, 0.651405632f, 0.658374846f, 0.665387273f, 0.672443151f,
+   0.679542482f, 0.686685324f, 0.693871737f, 0.701101899f, 0.708375752f,
+   0.715693474f, 0.723055124f, 0.730460763f, 0.73791039f, 0.745404184f,
+   0.752942204f, 0.760524511f, 0.768151164f, 0.775822222f, 0.783537805f,
+   0.791297913f, 0.799102724f, 0.806952238f, 0.814846575f, 0.822785735f,
+   0.830769897f, 0.838799f, 0.846873224f, 0.854992628f, 0.863157213f,
+   0.871367097f, 0.8796224f, 0.887923121f, 0.896269381f, 0.904661179f,
+   0.913098633f, 0.921581864f, 0.930110872f, 0.938685715f, 0.947306514f,
+   0.955973327f, 0.964686275f, 0.973445296f, 0.982250571f, 0.991102099f, 1.0f
+};
+
+
+static void srgb8_to_linear_array(const unsigned char *in, float *out,
+   int count)
+{
+   int i;
+   for (i = 0; i < count; i++)
+      out[i] = srgb8_to_linear_table[in[i]];
+}
+
+
+/* Converts n linear RGB triples in place. */
+static void linear_to_oklab_array(float *p, int n)
+{
+   int i;
+   for (i = 0; i < n; i++, p += 3) {
+      float r = p[0], g = p[1], b = p[2];
+      p[0] = 0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b;
+      p[1] = 0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b;
+      p[2] = 0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b;
+   }
+   p -= 3 * n;
+   cbrt_array(p, p, 3 * n);
+   for (i = 0; i < n; i++, p += 3) {
+      float l_ = p[0], m_ = p[1], s_ = p[2];
+      p[0] = 0.2104542553f*l_ + 0.7936177850f*m_ - 0.0040720468f*s_;
+      p[1] = 1.9779984951f*l_ - 2.4285922050f*m_ + 0.4505937099f*s_;
+      p[2] = 0.0259040371f*l_ + 0.7827717662f*m_ - 0.8086757660f*s_;
+   }
+}
+
+
+/* Converts n linear RGB triples in place. */
+static void linear_to_lab_array(float *p, int n)
+{
+   int i;
+   for (i = 0; i < n; i++, p += 3) {
+      float r = p[0], g = p[1], b = p[2];
+      p[0] = (r * 0.4124f + g * 0.3576f + b * 0.1805f) / (float)Xn;
+      p[1] = (r * 0.2126f + g * 0.7152f + b * 0.0722f) / (float)Yn;
+      p[2] = (r * 0.0193f + g * 0.1192f + b * 0.9505f) / (float)Zn;
+   }
+   p -= 3 * n;
+   cielab_f_array(p, p, 3 * n);
+   for (i = 0; i < n; i++, p += 3) {
+      float fx = p[0], fy = p[1], fz = p[2];
+      p[0] = 1.16f * fy - 0.16f;
+      p[1] = 5.00f * (fx - fy);
+      p[2] = 2.00f * (fy - fz);
+   }
+}
+
+
+/* Function: al_color_rgb_to_linear_n
+ */
+void al_color_rgb_to_linear_n(const float *rgb, float *linear, int n)
+{
+   srgb_to_linear_array(rgb, linear, 3 * n);
+}
+
+
+/* Function: al_color_rgb8_to_linear_n
+ */
+void al_color_rgb8_to_linear_n(const unsigned char *rgb, float *linear,
+   int n)
+{
+   srgb8_to_linear_array(rgb, linear, 3 * n);
+}
+
+
+/* Function: al_color_linear_to_rgb_n
+ */
+void al_color_linear_to_rgb_n(const float *linear, float *rgb, int n)
+{
+   linear_to_srgb_array(linear, rgb, 3 * n);
+}
+
+
+/* Function: al_color_rgb_to_oklab_n
+ */
+void al_color_rgb_to_oklab_n(const float *rgb, float *oklab, int n)
+{
+   srgb_to_linear_array(rgb, oklab, 3 * n);
+   linear_to_oklab_array(oklab, n);
+}
+
+
+/* Function: al_color_rgb8_to_oklab_n
+ */
+void al_color_rgb8_to_oklab_n(const unsigned char *rgb, float *oklab, int n)
+{
+   srgb8_to_linear_array(rgb, oklab, 3 * n);
+   linear_to_oklab_array(oklab, n);
+}
+
+
+/* Function: al_color_oklab_to_rgb_n
+ */
+void al_color_oklab_to_rgb_n(const float *oklab, float *rgb, int n)
+{
+   int i;
+   for (i = 0; i < n; i++) {
+      const float *p = oklab + 3 * i;
+      float *q = rgb + 3 * i;
+      float l_ = p[0] + 0.3963377774f * p[1] + 0.2158037573f * p[2];
+      float m_ = p[0] - 0.1055613458f * p[1] - 0.0638541728f * p[2];
+      float s_ = p[0] - 0.0894841775f * p[1] - 1.2914855480f * p[2];
+      float l = l_*l_*l_;
+      float m = m_*m_*m_;
+      float s = s_*s_*s_;
+      q[0] = +4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s;
+      q[1] = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s;
+      q[2] = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s;
+   }
+   linear_to_srgb_array(rgb, rgb, 3 * n);
+}
+
+
+/* Function: al_color_rgb_to_lab_n
+ */
+void al_color_rgb_to_lab_n(const float *rgb, float *lab, int n)
+{
+   srgb_to_linear_array(rgb, lab, 3 * n);
+   linear_to_lab_array(lab, n);
+}
+
+
+/* Function: al_color_rgb8_to_lab_n
+ */
+void al_color_rgb8_to_lab_n(const unsigned char *rgb, float *lab, int n)
+{
+   srgb8_to_linear_array(rgb, lab, 3 * n);
+   linear_to_lab_array(lab, n);
+}
+
+
+/* Function: al_color_lab_to_rgb_n
+ */
+void al_color_lab_to_rgb_n(const float *lab, float *rgb, int n)
+{
+   int i;
+   for (i = 0; i < n; i++) {
+      const float *p = lab + 3 * i;
+      float *q = rgb + 3 * i;
+      double y = (p[0] + 0.16) / 1.16;
+      double x = Xn * cielab_f_inv(y + p[1] / 5.00);
+      double z = Zn * cielab_f_inv(y - p[2] / 2.00);
+      y = Yn * cielab_f_inv(y);
+      q[0] = 3.2406 * x + (-1.5372 * y) + (-0.4986 * z);
+      q[1] = -0.9689 * x + 1.8758 * y + 0.0415 * z;
+      q[2] = 0.0557 * x + (-0.2040 * y) + 1.0570 * z;
+   }
+   linear_to_srgb_array(rgb, rgb, 3 * n);
+}
+
+
 
 /* vim: set sts=3 sw=3 et: */
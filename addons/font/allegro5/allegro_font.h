@@ -118,6 +118,50 @@ ALLEGRO_FONT_FUNC(int, al_get_glyph_advance, (const ALLEGRO_FONT *f,
    int codepoint1, int codepoint2));
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_FONT_SRC)
 ALLEGRO_FONT_FUNC(bool, al_get_glyph, (const ALLEGRO_FONT *f, int prev_codepoint, int codepoint, ALLEGRO_GLYPH *glyph));
+
+/* Type: ALLEGRO_TEXT_RUN
+*/
+typedef struct ALLEGRO_TEXT_RUN ALLEGRO_TEXT_RUN;
+
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_RUN *, al_create_text_run, (const ALLEGRO_FONT *font, const char *text));
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_RUN *, al_create_ustr_text_run, (const ALLEGRO_FONT *font, const ALLEGRO_USTR *text));
+ALLEGRO_FONT_FUNC(void, al_destroy_text_run, (ALLEGRO_TEXT_RUN *run));
+ALLEGRO_FONT_FUNC(void, al_draw_text_run, (ALLEGRO_TEXT_RUN *run, ALLEGRO_COLOR color, float x, float y, int flags));
+ALLEGRO_FONT_FUNC(int, al_get_text_run_width, (const ALLEGRO_TEXT_RUN *run));
+
+/* Type: ALLEGRO_TEXT_ITEM
+*/
+typedef struct ALLEGRO_TEXT_ITEM ALLEGRO_TEXT_ITEM;
+
+struct ALLEGRO_TEXT_ITEM
+{
+   const ALLEGRO_FONT *font;
+   ALLEGRO_COLOR color;
+   float x;
+   float y;
+   int flags;
+   const char *text;
+};
+
+ALLEGRO_FONT_FUNC(void, al_draw_text_batch, (const ALLEGRO_TEXT_ITEM *items, int n));
+
+/* Type: ALLEGRO_TEXT_LAYOUT
+*/
+typedef struct ALLEGRO_TEXT_LAYOUT ALLEGRO_TEXT_LAYOUT;
+
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_LAYOUT *, al_create_text_layout, (const ALLEGRO_FONT *font, float max_width));
+ALLEGRO_FONT_FUNC(void, al_destroy_text_layout, (ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(void, al_set_text_layout_text, (ALLEGRO_TEXT_LAYOUT *layout, const char *text));
+ALLEGRO_FONT_FUNC(void, al_set_text_layout_ustr, (ALLEGRO_TEXT_LAYOUT *layout, const ALLEGRO_USTR *text));
+ALLEGRO_FONT_FUNC(void, al_append_text_layout_text, (ALLEGRO_TEXT_LAYOUT *layout, const char *text));
+ALLEGRO_FONT_FUNC(void, al_replace_text_layout_range, (ALLEGRO_TEXT_LAYOUT *layout, int start_pos, int end_pos, const ALLEGRO_USTR *text));
+ALLEGRO_FONT_FUNC(const ALLEGRO_USTR *, al_get_text_layout_ustr, (const ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(void, al_set_text_layout_width, (ALLEGRO_TEXT_LAYOUT *layout, float max_width));
+ALLEGRO_FONT_FUNC(float, al_get_text_layout_width, (const ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(int, al_get_text_layout_line_count, (const ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(const ALLEGRO_USTR *, al_ref_text_layout_line, (const ALLEGRO_TEXT_LAYOUT *layout, ALLEGRO_USTR_INFO *info, int line_num));
+ALLEGRO_FONT_FUNC(int, al_get_text_layout_line_width, (const ALLEGRO_TEXT_LAYOUT *layout, int line_num));
+ALLEGRO_FONT_FUNC(void, al_draw_text_layout, (const ALLEGRO_TEXT_LAYOUT *layout, ALLEGRO_COLOR color, float x, float y, float line_height, int flags));
 #endif
 
 ALLEGRO_FONT_FUNC(void, al_draw_multiline_text, (const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, float max_width, float line_height, int flags, const char *text));
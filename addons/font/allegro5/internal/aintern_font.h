@@ -2,6 +2,7 @@
 #define __al_included_allegro_aintern_font_h
 
 #include "allegro5/internal/aintern_list.h"
+#include "allegro5/internal/aintern_vector.h"
 
 typedef struct ALLEGRO_FONT_VTABLE ALLEGRO_FONT_VTABLE;
 
@@ -14,6 +15,24 @@ struct ALLEGRO_FONT
    _AL_LIST_ITEM *dtor_item;
 };
 
+struct ALLEGRO_TEXT_RUN
+{
+   const ALLEGRO_FONT *font;
+   ALLEGRO_USTR *text;
+   int width;
+   void *data;  /* owned by the font driver */
+};
+
+/* A glyph quad, as collected by al_draw_text_batch. */
+typedef struct ALLEGRO_TEXT_QUAD
+{
+   ALLEGRO_BITMAP *bitmap;
+   float sx, sy, sw, sh;
+   float dx, dy;
+   ALLEGRO_COLOR color;
+   int order;
+} ALLEGRO_TEXT_QUAD;
+
 /* text- and font-related stuff */
 struct ALLEGRO_FONT_VTABLE
 {
@@ -36,6 +55,17 @@ struct ALLEGRO_FONT_VTABLE
       int codepoint1, int codepoint2));
 
    ALLEGRO_FONT_METHOD(bool, get_glyph, (const ALLEGRO_FONT *f, int prev_codepoint, int codepoint, ALLEGRO_GLYPH *glyph));
+
+   /* Optional, text runs are drawn with render if these are NULL. */
+   ALLEGRO_FONT_METHOD(int, render_run, (const ALLEGRO_FONT *f, ALLEGRO_TEXT_RUN *run, ALLEGRO_COLOR color, float x, float y));
+   ALLEGRO_FONT_METHOD(void, destroy_run, (ALLEGRO_TEXT_RUN *run));
+
+   /* Optional. Appends the glyph quads of the text to the vector of
+    * ALLEGRO_TEXT_QUAD and returns 1, or returns 0 if the text must be drawn
+    * with render. Returns -1 if glyph bitmaps were dropped, so quads
+    * appended before may refer to bitmaps which are gone.
+    */
+   ALLEGRO_FONT_METHOD(int, get_text_quads, (const ALLEGRO_FONT *f, const ALLEGRO_USTR *text, ALLEGRO_COLOR color, float x, float y, _AL_VECTOR *quads));
 };
 
 #endif
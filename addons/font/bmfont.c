@@ -407,6 +407,7 @@ static void destroy_range(BMFONT_RANGE *range) {
       al_free(c->kerning);
       al_free(c);
    }
+   al_free(range->characters);
    al_free(range);
 }
 
@@ -426,6 +427,7 @@ static void destroy(ALLEGRO_FONT *f) {
    al_free(data->pages);
    
    al_free(data->kerning);
+   al_free(data);
    al_free(f);
 }
 
@@ -473,19 +475,271 @@ static ALLEGRO_FONT_VTABLE _al_font_vtable_xml = {
    get_font_ranges,
    get_glyph_dimensions,
    get_glyph_advance,
-   get_glyph
+   get_glyph,
+   NULL,
+   NULL,
+   NULL
 };
 
-ALLEGRO_FONT *_al_load_bmfont_xml(const char *filename, int size,
+/* Reads the whole file into memory. */
+static char *read_file(ALLEGRO_FILE *f, size_t *size)
+{
+   int64_t fsize = al_fsize(f);
+   size_t capacity = fsize > 0 ? (size_t)fsize : 4096;
+   char *buffer = al_malloc(capacity);
+   size_t pos = 0;
+
+   while (buffer) {
+      pos += al_fread(f, buffer + pos, capacity - pos);
+      if (pos < capacity)
+         break;
+      capacity *= 2;
+      buffer = al_realloc(buffer, capacity);
+   }
+   if (!buffer || al_ferror(f)) {
+      al_free(buffer);
+      return NULL;
+   }
+   *size = pos;
+   return buffer;
+}
+
+static int get_u8(unsigned char const *p) {
+   return p[0];
+}
+
+static int get_u16(unsigned char const *p) {
+   return p[0] | (p[1] << 8);
+}
+
+static int get_s16(unsigned char const *p) {
+   return (int16_t)get_u16(p);
+}
+
+static uint32_t get_u32(unsigned char const *p) {
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+typedef struct {
+   int id;
+   int index;
+   BMFONT_CHAR *c;
+} BMFONT_ID;
+
+static int compare_ids(void const *a, void const *b) {
+   BMFONT_ID const *ia = a;
+   BMFONT_ID const *ib = b;
+   if (ia->id != ib->id) return ia->id < ib->id ? -1 : 1;
+   /* Keep the first of several characters with the same id. */
+   return ia->index - ib->index;
+}
+
+/* Builds the ranges from all characters at once, which avoids searching
+ * the ranges for every single character as add_codepoint does.
+ */
+static void build_ranges(BMFONT_DATA *data, BMFONT_ID *ids, int count) {
+   BMFONT_RANGE **link = &data->range_first;
+   int i = 0;
+   int n = 0;
+
+   qsort(ids, count, sizeof *ids, compare_ids);
+   for (i = 0; i < count; i++) {
+      if (n > 0 && ids[i].id == ids[n - 1].id) {
+         al_free(ids[i].c);
+         continue;
+      }
+      ids[n++] = ids[i];
+   }
+
+   i = 0;
+   while (i < n) {
+      int j = i + 1;
+      int k;
+      while (j < n && ids[j].id == ids[j - 1].id + 1)
+         j++;
+      BMFONT_RANGE *range = al_calloc(1, sizeof *range);
+      range->first = ids[i].id;
+      range->count = j - i;
+      reallocate(range);
+      for (k = 0; k < range->count; k++)
+         range->characters[k] = ids[i + k].c;
+      *link = range;
+      link = &range->next;
+      i = j;
+   }
+}
+
+/* The binary format consists of the magic "BMF" and a version byte of 3,
+ * followed by blocks with a one byte type and a 32-bit size each.
+ */
+static bool load_binary(BMFONT_PARSER *parser, unsigned char const *buffer,
+      size_t size)
+{
+   ALLEGRO_FONT *font = parser->font;
+   BMFONT_DATA *data = font->data;
+   size_t pos = 4;
+   int pages = 0;
+   bool have_chars = false;
+
+   if (buffer[3] != 3) {
+      ALLEGRO_ERROR("Unsupported binary BMFont version %d.\n", buffer[3]);
+      return false;
+   }
+
+   while (pos < size) {
+      if (size - pos < 5) {
+         ALLEGRO_ERROR("Truncated binary BMFont block header.\n");
+         return false;
+      }
+      int type = get_u8(buffer + pos);
+      uint32_t block_size = get_u32(buffer + pos + 1);
+      unsigned char const *block = buffer + pos + 5;
+      pos += 5;
+      if (block_size > size - pos) {
+         ALLEGRO_ERROR("Truncated binary BMFont block %d.\n", type);
+         return false;
+      }
+      pos += block_size;
+
+      if (type == 2) {
+         if (block_size < 15) {
+            ALLEGRO_ERROR("Invalid binary BMFont common block.\n");
+            return false;
+         }
+         data->line_height = get_u16(block);
+         data->base = get_u16(block + 2);
+         pages = get_u16(block + 8);
+      }
+      else if (type == 3) {
+         /* A sequence of zero-terminated file names. */
+         char const *name = (char const *)block;
+         char const *end = name + block_size;
+         while (name < end) {
+            char const *zero = memchr(name, 0, end - name);
+            if (!zero) {
+               ALLEGRO_ERROR("Invalid binary BMFont pages block.\n");
+               return false;
+            }
+            add_page(parser, name);
+            name = zero + 1;
+         }
+      }
+      else if (type == 4) {
+         int count = block_size / 20;
+         int i;
+         BMFONT_ID *ids;
+         if (have_chars) {
+            ALLEGRO_ERROR("Duplicate binary BMFont chars block.\n");
+            return false;
+         }
+         have_chars = true;
+         ids = al_malloc((count ? count : 1) * sizeof *ids);
+         for (i = 0; i < count; i++) {
+            unsigned char const *p = block + i * 20;
+            BMFONT_CHAR *c = al_calloc(1, sizeof *c);
+            c->x = get_u16(p + 4);
+            c->y = get_u16(p + 6);
+            c->width = get_u16(p + 8);
+            c->height = get_u16(p + 10);
+            c->xoffset = get_s16(p + 12);
+            c->yoffset = get_s16(p + 14);
+            c->xadvance = get_s16(p + 16);
+            c->page = get_u8(p + 18);
+            c->chnl = get_u8(p + 19);
+            ids[i].id = get_u32(p);
+            ids[i].index = i;
+            ids[i].c = c;
+         }
+         build_ranges(data, ids, count);
+         al_free(ids);
+      }
+      else if (type == 5) {
+         int count = block_size / 10;
+         int i;
+         data->kerning = al_realloc(data->kerning,
+            (data->kerning_pairs + count) * sizeof *data->kerning);
+         for (i = 0; i < count; i++) {
+            unsigned char const *p = block + i * 10;
+            BMFONT_KERNING *k = data->kerning + data->kerning_pairs + i;
+            k->first = get_u32(p);
+            k->second = get_u32(p + 4);
+            k->amount = get_s16(p + 8);
+         }
+         data->kerning_pairs += count;
+      }
+   }
+
+   if (pages != data->pages_count) {
+      ALLEGRO_ERROR("Binary BMFont has %d pages but names %d.\n", pages,
+         data->pages_count);
+      return false;
+   }
+   return true;
+}
+
+/* Gives each character its own kerning pairs. The pairs are counted first
+ * so every character's array is only allocated once.
+ */
+static void assign_kerning(BMFONT_DATA *data) {
+   BMFONT_RANGE *range;
+   int i;
+
+   for (i = 0; i < data->kerning_pairs; i++) {
+      BMFONT_CHAR *c = find_codepoint(data, data->kerning[i].first);
+      if (c) c->kerning_pairs++;
+   }
+   for (range = data->range_first; range; range = range->next) {
+      for (i = 0; i < range->count; i++) {
+         BMFONT_CHAR *c = range->characters[i];
+         if (c->kerning_pairs) {
+            c->kerning = al_malloc(c->kerning_pairs * sizeof *c->kerning);
+            c->kerning_pairs = 0;
+         }
+      }
+   }
+   for (i = 0; i < data->kerning_pairs; i++) {
+      BMFONT_KERNING *k = data->kerning + i;
+      BMFONT_CHAR *c = find_codepoint(data, k->first);
+      if (c) c->kerning[c->kerning_pairs++] = *k;
+   }
+}
+
+/* Checks that all characters are on a page which was loaded. */
+static bool check_pages(BMFONT_DATA *data) {
+   BMFONT_RANGE *range;
+   int i;
+
+   for (range = data->range_first; range; range = range->next) {
+      for (i = 0; i < range->count; i++) {
+         int page = range->characters[i]->page;
+         if (page < 0 || page >= data->pages_count || !data->pages[page]) {
+            ALLEGRO_ERROR("BMFont character %d is on missing page %d.\n",
+               range->first + i, page);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+ALLEGRO_FONT *_al_load_bmfont(const char *filename, int size,
       int font_flags)
 {
    (void)size;
-   ALLEGRO_FILE *f = al_fopen(filename, "r");
+   ALLEGRO_FILE *f = al_fopen(filename, "rb");
    if (!f) {
       ALLEGRO_DEBUG("Could not open %s.\n", filename);
       return NULL;
    }
 
+   size_t buffer_size;
+   char *buffer = read_file(f, &buffer_size);
+   al_fclose(f);
+   if (!buffer) {
+      ALLEGRO_ERROR("Could not read %s.\n", filename);
+      return NULL;
+   }
+
    BMFONT_DATA *data = al_calloc(1, sizeof *data);
    BMFONT_PARSER _parser;
    BMFONT_PARSER *parser = &_parser;
@@ -499,21 +753,27 @@ ALLEGRO_FONT *_al_load_bmfont_xml(const char *filename, int size,
    font->data = data;
    parser->font = font;
 
-   _al_xml_parse(f, xml_callback, parser);
+   bool ok = true;
+   if (buffer_size >= 4 && memcmp(buffer, "BMF", 3) == 0) {
+      ok = load_binary(parser, (unsigned char *)buffer, buffer_size);
+   }
+   else {
+      _al_xml_parse(buffer, buffer_size, xml_callback, parser);
+   }
+   al_free(buffer);
 
-   int i;
-   for (i = 0; i < data->kerning_pairs; i++) {
-      BMFONT_KERNING *k = data->kerning + i;
-      BMFONT_CHAR *c = find_codepoint(data, k->first);
-      c->kerning_pairs++;
-      c->kerning = al_realloc(c->kerning, c->kerning_pairs *
-         sizeof *c->kerning);
-      c->kerning[c->kerning_pairs - 1] = *k;
+   if (ok) {
+      assign_kerning(data);
+      ok = check_pages(data);
    }
 
    al_ustr_free(parser->tag);
    al_ustr_free(parser->attribute);
    al_destroy_path(parser->path);
-   
+
+   if (!ok) {
+      destroy(font);
+      return NULL;
+   }
    return font;
 }
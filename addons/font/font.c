@@ -21,6 +21,7 @@
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_font.h"
 #include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_extmap.h"
 #include "allegro5/internal/aintern_vector.h"
 
 #include "font.h"
@@ -39,6 +40,7 @@ typedef struct
 /* globals */
 static bool font_inited = false;
 static _AL_VECTOR font_handlers = _AL_VECTOR_INITIALIZER(FONT_HANDLER);
+static _AL_EXTMAP font_handler_map = _AL_EXTMAP_INITIALIZER;
 
 
 /* al_font_404_character:
@@ -110,6 +112,10 @@ static void color_get_text_dimensions(ALLEGRO_FONT const *f,
 
 
 
+#define COLOR_PAGE_BITS 8
+#define COLOR_PAGE_SIZE (1 << COLOR_PAGE_BITS)
+
+
 static ALLEGRO_FONT_COLOR_DATA *_al_font_find_page(
    ALLEGRO_FONT_COLOR_DATA *cf, int ch)
 {
@@ -122,6 +128,47 @@ static ALLEGRO_FONT_COLOR_DATA *_al_font_find_page(
 }
 
 
+/* _al_font_color_build_lookup:
+ *  Builds the table of glyphs by code point in the first range, so the
+ *  ranges need not be searched for every character. Where ranges overlap
+ *  the first one wins, like in _al_font_find_page.
+ */
+void _al_font_color_build_lookup(ALLEGRO_FONT_COLOR_DATA *cf)
+{
+    ALLEGRO_FONT_COLOR_DATA *range;
+    int end = 0;
+    int ch;
+
+    for (range = cf; range; range = range->next) {
+        if (range->end > end)
+            end = range->end;
+    }
+    if (!cf || end <= 0)
+        return;
+
+    cf->num_pages = ((end - 1) >> COLOR_PAGE_BITS) + 1;
+    cf->pages = al_calloc(cf->num_pages, sizeof *cf->pages);
+    if (!cf->pages) {
+        cf->num_pages = 0;
+        return;
+    }
+
+    for (range = cf; range; range = range->next) {
+        for (ch = _ALLEGRO_MAX(range->begin, 0); ch < range->end; ch++) {
+            ALLEGRO_BITMAP ***page = &cf->pages[ch >> COLOR_PAGE_BITS];
+            if (!*page) {
+                *page = al_calloc(COLOR_PAGE_SIZE, sizeof **page);
+                if (!*page)
+                    continue;
+            }
+            if (!(*page)[ch & (COLOR_PAGE_SIZE - 1)])
+                (*page)[ch & (COLOR_PAGE_SIZE - 1)] =
+                    range->bitmaps[ch - range->begin];
+        }
+    }
+}
+
+
 /* _color_find_glyph:
  *  Helper for color vtable entries, below.
  */
@@ -129,8 +176,14 @@ static ALLEGRO_BITMAP* _al_font_color_find_glyph(const ALLEGRO_FONT* f, int ch)
 {
     ALLEGRO_FONT_COLOR_DATA* cf = (ALLEGRO_FONT_COLOR_DATA*)(f->data);
 
-    cf = _al_font_find_page(cf, ch);
-    if (cf) {
+    if (cf && cf->pages) {
+        int page = ch >> COLOR_PAGE_BITS;
+        if (ch >= 0 && page < cf->num_pages && cf->pages[page] &&
+              cf->pages[page][ch & (COLOR_PAGE_SIZE - 1)]) {
+            return cf->pages[page][ch & (COLOR_PAGE_SIZE - 1)];
+        }
+    }
+    else if ((cf = _al_font_find_page(cf, ch)) != NULL) {
         return cf->bitmaps[ch - cf->begin];
     }
 
@@ -242,14 +295,19 @@ static void color_destroy(ALLEGRO_FONT* f)
 {
     ALLEGRO_FONT_COLOR_DATA* cf;
     ALLEGRO_BITMAP *glyphs = NULL;
+    int page;
 
     if (!f)
         return;
 
     cf = (ALLEGRO_FONT_COLOR_DATA*)(f->data);
 
-    if (cf)
+    if (cf) {
         glyphs = cf->glyphs;
+        for (page = 0; page < cf->num_pages; page++)
+            al_free(cf->pages[page]);
+        al_free(cf->pages);
+    }
 
     while (cf) {
         ALLEGRO_FONT_COLOR_DATA* next = cf->next;
@@ -342,7 +400,10 @@ ALLEGRO_FONT_VTABLE _al_font_vtable_color = {
     color_get_font_ranges,
     color_get_glyph_dimensions,
     color_get_glyph_advance,
-    color_get_glyph
+    color_get_glyph,
+    NULL,
+    NULL,
+    NULL
 };
 
 
@@ -357,6 +418,7 @@ static void font_shutdown(void)
        _al_vector_delete_at(&font_handlers, _al_vector_size(&font_handlers)-1);
     }
     _al_vector_free(&font_handlers);
+    _al_extmap_free(&font_handler_map);
 
     font_inited = false;
 }
@@ -377,8 +439,8 @@ bool al_init_font_addon(void)
    al_register_font_loader(".png", _al_load_bitmap_font);
    al_register_font_loader(".tga", _al_load_bitmap_font);
 
-   al_register_font_loader(".xml", _al_load_bmfont_xml);
-   al_register_font_loader(".fnt", _al_load_bmfont_xml);
+   al_register_font_loader(".xml", _al_load_bmfont);
+   al_register_font_loader(".fnt", _al_load_bmfont);
 
    _al_add_exit_func(font_shutdown, "font_shutdown");
 
@@ -407,16 +469,24 @@ void al_shutdown_font_addon(void)
 
 static FONT_HANDLER *find_extension(char const *extension)
 {
-   int i;
-   /* Go backwards so a handler registered later for the same extension
-    * has precedence.
-    */
-   for (i = _al_vector_size(&font_handlers) - 1; i >= 0 ; i--) {
+   int i = _al_extmap_find(&font_handler_map, extension);
+   if (i < 0)
+      return NULL;
+   return _al_vector_ref(&font_handlers, i);
+}
+
+
+
+/* Deleting a handler moves the ones after it, so map them all again. */
+static void remap_font_handlers(void)
+{
+   unsigned i;
+
+   _al_extmap_free(&font_handler_map);
+   for (i = 0; i < _al_vector_size(&font_handlers); i++) {
       FONT_HANDLER *handler = _al_vector_ref(&font_handlers, i);
-      if (0 == _al_stricmp(al_cstr(handler->extension), extension))
-         return handler;
+      _al_extmap_insert(&font_handler_map, al_cstr(handler->extension), i);
    }
-   return NULL;
 }
 
 
@@ -430,13 +500,18 @@ bool al_register_font_loader(char const *extension,
    if (!handler) {
       if (!load_font)
          return false; /* Nothing to remove. */
+      if (!_al_extmap_insert(&font_handler_map, extension,
+            _al_vector_size(&font_handlers)))
+         return false;
       handler = _al_vector_alloc_back(&font_handlers);
       handler->extension = al_ustr_new(extension);
    }
    else {
       if (!load_font) {
          al_ustr_free(handler->extension);
-         return _al_vector_find_and_delete(&font_handlers, handler);
+         _al_vector_find_and_delete(&font_handlers, handler);
+         remap_font_handlers();
+         return true;
       }
    }
    handler->load_font = load_font;
@@ -11,11 +11,19 @@ typedef struct ALLEGRO_FONT_COLOR_DATA
    ALLEGRO_BITMAP *glyphs;           /* our glyphs */
    ALLEGRO_BITMAP **bitmaps;         /* sub bitmaps pointing to our glyphs */
    struct ALLEGRO_FONT_COLOR_DATA *next;  /* linked list structure */
+
+   /* Only set in the first range: the glyphs of all ranges indexed by
+    * code point, in pages of 256 which are NULL if they have no glyphs.
+    */
+   ALLEGRO_BITMAP ***pages;
+   int num_pages;
 } ALLEGRO_FONT_COLOR_DATA;
 
+void _al_font_color_build_lookup(ALLEGRO_FONT_COLOR_DATA *cf);
+
 ALLEGRO_FONT *_al_load_bitmap_font(const char *filename,
    int size, int flags);
-ALLEGRO_FONT *_al_load_bmfont_xml(const char *filename,
+ALLEGRO_FONT *_al_load_bmfont(const char *filename,
    int size, int flags);
 
 
@@ -283,6 +283,7 @@ ALLEGRO_FONT *al_grab_font_from_bitmap(ALLEGRO_BITMAP *bmp,
    cf = f->data;
    if (cf && cf->bitmaps[0])
       f->height = al_get_bitmap_height(cf->bitmaps[0]);
+   _al_font_color_build_lookup(cf);
 
    if (lock)
       al_unlock_bitmap(bmp);
@@ -19,15 +19,18 @@
  *      See readme.txt for copyright information.
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
 
 #include <math.h>
 #include <ctype.h>
+#include <limits.h>
 #include "allegro5/allegro.h"
 
 #include "allegro5/allegro_font.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_font.h"
 #include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_vector.h"
 
 /* If you call this, you're probably making a mistake. */
 /*
@@ -410,6 +413,257 @@ bool al_get_glyph(const ALLEGRO_FONT *f, int prev_codepoint, int codepoint, ALLE
 };
 
 
+/* Function: al_create_ustr_text_run
+ */
+ALLEGRO_TEXT_RUN *al_create_ustr_text_run(const ALLEGRO_FONT *font,
+   const ALLEGRO_USTR *text)
+{
+   ALLEGRO_TEXT_RUN *run;
+   ASSERT(font);
+   ASSERT(text);
+
+   run = al_calloc(1, sizeof *run);
+   if (!run)
+      return NULL;
+   run->font = font;
+   run->text = al_ustr_dup(text);
+   run->width = font->vtable->text_length(font, text);
+   return run;
+}
+
+
+/* Function: al_create_text_run
+ */
+ALLEGRO_TEXT_RUN *al_create_text_run(const ALLEGRO_FONT *font,
+   const char *text)
+{
+   ALLEGRO_USTR_INFO info;
+   ASSERT(text);
+   return al_create_ustr_text_run(font, al_ref_cstr(&info, text));
+}
+
+
+/* Function: al_destroy_text_run
+ */
+void al_destroy_text_run(ALLEGRO_TEXT_RUN *run)
+{
+   if (!run)
+      return;
+
+   if (run->data && run->font->vtable->destroy_run)
+      run->font->vtable->destroy_run(run);
+   al_ustr_free(run->text);
+   al_free(run);
+}
+
+
+/* Function: al_draw_text_run
+ */
+void al_draw_text_run(ALLEGRO_TEXT_RUN *run, ALLEGRO_COLOR color,
+   float x, float y, int flags)
+{
+   const ALLEGRO_FONT *font;
+   ASSERT(run);
+
+   font = run->font;
+   if (flags & ALLEGRO_ALIGN_CENTRE) {
+      /* Same as al_draw_ustr. */
+      x -= run->width / 2;
+   }
+   else if (flags & ALLEGRO_ALIGN_RIGHT) {
+      x -= run->width;
+   }
+
+   if (flags & ALLEGRO_ALIGN_INTEGER)
+      align_to_integer_pixel(&x, &y);
+
+   if (font->vtable->render_run)
+      font->vtable->render_run(font, run, color, x, y);
+   else
+      font->vtable->render(font, color, run->text, x, y);
+}
+
+
+/* Function: al_get_text_run_width
+ */
+int al_get_text_run_width(const ALLEGRO_TEXT_RUN *run)
+{
+   ASSERT(run);
+   return run->width;
+}
+
+
+static int compare_text_quads(const void *a, const void *b)
+{
+   const ALLEGRO_TEXT_QUAD *q1 = a;
+   const ALLEGRO_TEXT_QUAD *q2 = b;
+
+   if (q1->bitmap != q2->bitmap)
+      return (uintptr_t)q1->bitmap < (uintptr_t)q2->bitmap ? -1 : 1;
+   return q1->order - q2->order;
+}
+
+
+/* Draws the quads with one call for each bitmap they use. */
+static void draw_text_quads(_AL_VECTOR *quads)
+{
+   _AL_VECTOR instances;  /* of ALLEGRO_SPRITE_INSTANCE */
+   int num_quads = _al_vector_size(quads);
+   int i, start;
+
+   if (num_quads == 0)
+      return;
+
+   /* Glyphs on sub-bitmaps of the same bitmap share the texture. */
+   for (i = 0; i < num_quads; i++) {
+      ALLEGRO_TEXT_QUAD *q = _al_vector_ref(quads, i);
+      ALLEGRO_BITMAP *parent = al_get_parent_bitmap(q->bitmap);
+      if (parent) {
+         q->sx += al_get_bitmap_x(q->bitmap);
+         q->sy += al_get_bitmap_y(q->bitmap);
+         q->bitmap = parent;
+      }
+      q->order = i;
+   }
+   qsort(_al_vector_ref_front(quads), num_quads, sizeof(ALLEGRO_TEXT_QUAD),
+      compare_text_quads);
+
+   _al_vector_init(&instances, sizeof(ALLEGRO_SPRITE_INSTANCE));
+   for (start = 0; start < num_quads; start = i) {
+      ALLEGRO_TEXT_QUAD *first = _al_vector_ref(quads, start);
+
+      _al_vector_free(&instances);
+      for (i = start; i < num_quads; i++) {
+         ALLEGRO_TEXT_QUAD *q = _al_vector_ref(quads, i);
+         ALLEGRO_SPRITE_INSTANCE *in;
+         if (q->bitmap != first->bitmap)
+            break;
+         in = _al_vector_alloc_back(&instances);
+         memset(in, 0, sizeof *in);
+         in->sx = q->sx;
+         in->sy = q->sy;
+         in->sw = q->sw;
+         in->sh = q->sh;
+         in->dx = q->dx;
+         in->dy = q->dy;
+         in->xscale = 1;
+         in->yscale = 1;
+         in->tint = q->color;
+      }
+      al_draw_bitmap_instances(first->bitmap,
+         _al_vector_ref_front(&instances), i - start, 0);
+   }
+   _al_vector_free(&instances);
+}
+
+
+/* Function: al_draw_text_batch
+ */
+void al_draw_text_batch(const ALLEGRO_TEXT_ITEM *items, int n)
+{
+   _AL_VECTOR quads;  /* of ALLEGRO_TEXT_QUAD */
+   _AL_VECTOR others;  /* of item indices, for fonts without quads */
+   float *pos;
+   bool hold = al_is_bitmap_drawing_held();
+   int attempt, i;
+   ASSERT(items || n == 0);
+
+   if (n <= 0)
+      return;
+
+   /* Measure first, as that may cache glyphs too. */
+   pos = al_malloc(2 * n * sizeof *pos);
+   for (i = 0; i < n; i++) {
+      const ALLEGRO_FONT *font = items[i].font;
+      ALLEGRO_USTR_INFO info;
+      const ALLEGRO_USTR *ustr = al_ref_cstr(&info, items[i].text);
+      float x = items[i].x;
+      float y = items[i].y;
+
+      if (items[i].flags & ALLEGRO_ALIGN_CENTRE)
+         x -= font->vtable->text_length(font, ustr) / 2;
+      else if (items[i].flags & ALLEGRO_ALIGN_RIGHT)
+         x -= font->vtable->text_length(font, ustr);
+      if (items[i].flags & ALLEGRO_ALIGN_INTEGER)
+         align_to_integer_pixel(&x, &y);
+      pos[2 * i] = x;
+      pos[2 * i + 1] = y;
+   }
+
+   al_hold_bitmap_drawing(true);
+   _al_vector_init(&quads, sizeof(ALLEGRO_TEXT_QUAD));
+   _al_vector_init(&others, sizeof(int));
+
+   /* Fonts may drop glyph bitmaps to cache new glyphs, which invalidates
+    * the quads collected before. That is rare, so just start over, and
+    * draw the items one by one if it happens again.
+    */
+   for (attempt = 0; attempt < 2; attempt++) {
+      bool changed = false;
+
+      _al_vector_free(&quads);
+      _al_vector_free(&others);
+      for (i = 0; i < n && !changed; i++) {
+         const ALLEGRO_FONT *font = items[i].font;
+         ALLEGRO_USTR_INFO info;
+         int result = 0;
+
+         if (font->vtable->get_text_quads) {
+            result = font->vtable->get_text_quads(font,
+               al_ref_cstr(&info, items[i].text), items[i].color,
+               pos[2 * i], pos[2 * i + 1], &quads);
+         }
+         if (result < 0)
+            changed = true;
+         else if (result == 0)
+            *(int *)_al_vector_alloc_back(&others) = i;
+      }
+
+      if (!changed)
+         break;
+   }
+
+   if (attempt == 2) {
+      _al_vector_free(&quads);
+      _al_vector_free(&others);
+      for (i = 0; i < n; i++) {
+         ALLEGRO_USTR_INFO info;
+         items[i].font->vtable->render(items[i].font, items[i].color,
+            al_ref_cstr(&info, items[i].text), pos[2 * i], pos[2 * i + 1]);
+      }
+   }
+   else {
+      draw_text_quads(&quads);
+      for (i = 0; i < (int)_al_vector_size(&others); i++) {
+         int *index = _al_vector_ref(&others, i);
+         const ALLEGRO_TEXT_ITEM *item = &items[*index];
+         ALLEGRO_USTR_INFO info;
+         item->font->vtable->render(item->font, item->color,
+            al_ref_cstr(&info, item->text), pos[2 * *index],
+            pos[2 * *index + 1]);
+      }
+   }
+
+   _al_vector_free(&quads);
+   _al_vector_free(&others);
+   al_free(pos);
+   al_hold_bitmap_drawing(hold);
+}
+
+
+/* The widths get_next_soft_line compared against max_width. The same line
+ * is returned for any max_width with fit <= max_width < fail, as all the
+ * comparisons come out the same.
+ */
+typedef struct SOFT_LINE_METRICS
+{
+   int width;  /* of the returned line */
+   int fit;    /* widest measurement which fit, or INT_MIN */
+   int fail;   /* measurement which did not fit, or INT_MAX */
+} SOFT_LINE_METRICS;
+
+
+
 /* This helper function helps splitting an ustr in several delimited parts.
  * It returns an ustr that refers to the next part of the string that
  * is delimited by the delimiters in delimiter.
@@ -450,16 +704,20 @@ static const ALLEGRO_USTR *ustr_split_next(const ALLEGRO_USTR *ustr,
  * The soft line will not include the trailing space where the
  * line was split, but pos will be set to point to after that trailing
  * space so iteration can continue easily.
+ * If m is not NULL, it is set to the measurements made, see
+ * SOFT_LINE_METRICS.
  */
 static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
    ALLEGRO_USTR_INFO *info, int *pos,
-   const ALLEGRO_FONT *font, float max_width)
+   const ALLEGRO_FONT *font, float max_width, SOFT_LINE_METRICS *m)
 {
    const ALLEGRO_USTR *result = NULL;
    const char *whitespace = " \t";
    int old_end = 0;
    int end = 0;
    int size = al_ustr_size(ustr);
+   int width = 0;
+   int fit = INT_MIN;
    bool first_word = true;
 
    if (*pos >= size) {
@@ -478,11 +736,17 @@ static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
       result = al_ref_ustr(info, ustr, *pos, end);
 
       /* Check if the line is too long. If it is, return a soft line. */
-      if (al_get_ustr_width(font, result) > max_width) {
+      width = al_get_ustr_width(font, result);
+      if (width > max_width) {
          /* Corner case: a single word may not even fit the line.
           * In that case, return the word/line anyway as the "soft line",
           * the user can set a clip rectangle to cut it. */
 
+         if (m) {
+            m->width = first_word ? width : m->width;
+            m->fit = fit;
+            m->fail = width;
+         }
          if (first_word) {
             /* Set pos to character AFTER end to allow easy iteration. */
             al_ustr_next(ustr, &end);
@@ -498,6 +762,10 @@ static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
             return result;
          }
       }
+      if (m)
+         m->width = width;
+      if (width > fit)
+         fit = width;
       first_word = false;
       old_end    = end;
       /* Skip the character at end which normally is whitespace. */
@@ -506,6 +774,13 @@ static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
 
    /* If we get here the whole ustr will fit.*/
    result = al_ref_ustr(info, ustr, *pos, size);
+   if (m) {
+      /* The line may end in whitespace which was not measured yet. */
+      if (old_end != size)
+         m->width = al_get_ustr_width(font, result);
+      m->fit = fit;
+      m->fail = INT_MAX;
+   }
    *pos = size;
    return result;
 }
@@ -533,7 +808,7 @@ void al_do_multiline_ustr(const ALLEGRO_FONT *font, float max_width,
       soft_line_pos = 0;
       soft_line =
       get_next_soft_line(hard_line, &soft_line_info, &soft_line_pos, font,
-         max_width);
+         max_width, NULL);
       /* No soft line here because it's an empty hard line. */
       if (!soft_line) {
          /* Call the callback with empty string to indicate an empty line. */
@@ -548,7 +823,7 @@ void al_do_multiline_ustr(const ALLEGRO_FONT *font, float max_width,
          line_num++;
 
          soft_line = get_next_soft_line(hard_line, &soft_line_info,
-            &soft_line_pos, font, max_width);
+            &soft_line_pos, font, max_width, NULL);
       }
       hard_line = ustr_split_next(ustr, &hard_line_info, &hard_line_pos,
          linebreak);
@@ -690,6 +965,400 @@ void al_draw_multiline_textf(const ALLEGRO_FONT *font,
 }
 
 
+/* A soft line of a text layout. */
+typedef struct TEXT_LAYOUT_LINE
+{
+   int start, end;  /* byte offsets in the text */
+   int width;
+   int fit, fail;   /* see SOFT_LINE_METRICS */
+   bool hard;       /* first line of a hard line */
+} TEXT_LAYOUT_LINE;
+
+struct ALLEGRO_TEXT_LAYOUT
+{
+   const ALLEGRO_FONT *font;
+   ALLEGRO_USTR *text;
+   float max_width;
+   _AL_VECTOR lines;  /* of TEXT_LAYOUT_LINE */
+};
+
+
+
+/* Appends the soft lines of the hard lines starting from byte offset pos up
+ * to last, exactly as al_do_multiline_ustr would split them.
+ */
+static void break_hard_lines(ALLEGRO_TEXT_LAYOUT *layout, _AL_VECTOR *lines,
+   int pos, int last)
+{
+   const ALLEGRO_USTR *hard_line, *soft_line;
+   ALLEGRO_USTR_INFO hard_line_info, soft_line_info;
+
+   while (pos <= last) {
+      int hard_line_start = pos;
+      int soft_line_pos = 0;
+      bool hard = true;
+
+      hard_line = ustr_split_next(layout->text, &hard_line_info, &pos, "\n");
+      if (!hard_line)
+         break;
+
+      do {
+         int soft_line_start = soft_line_pos;
+         SOFT_LINE_METRICS m;
+         TEXT_LAYOUT_LINE *line;
+
+         soft_line = get_next_soft_line(hard_line, &soft_line_info,
+            &soft_line_pos, layout->font, layout->max_width, &m);
+         /* An empty hard line is a single empty line. */
+         if (!soft_line && !hard)
+            break;
+
+         line = _al_vector_alloc_back(lines);
+         line->start = hard_line_start + soft_line_start;
+         line->hard = hard;
+         if (soft_line) {
+            line->end = line->start + al_ustr_size(soft_line);
+            line->width = m.width;
+            line->fit = m.fit;
+            line->fail = m.fail;
+         }
+         else {
+            line->end = line->start;
+            line->width = 0;
+            line->fit = INT_MIN;
+            line->fail = INT_MAX;
+         }
+         hard = false;
+      } while (soft_line);
+   }
+}
+
+
+
+/* Returns the index of the first line starting at or after pos. */
+static int find_layout_line(const ALLEGRO_TEXT_LAYOUT *layout, int pos)
+{
+   int lo = 0;
+   int hi = _al_vector_size(&layout->lines);
+
+   while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      TEXT_LAYOUT_LINE *line = _al_vector_ref(&layout->lines, mid);
+      if (line->start < pos)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+
+
+/* Function: al_create_text_layout
+ */
+ALLEGRO_TEXT_LAYOUT *al_create_text_layout(const ALLEGRO_FONT *font,
+   float max_width)
+{
+   ALLEGRO_TEXT_LAYOUT *layout;
+   ASSERT(font);
+
+   layout = al_calloc(1, sizeof *layout);
+   if (!layout)
+      return NULL;
+   layout->font = font;
+   layout->text = al_ustr_new("");
+   layout->max_width = max_width;
+   _al_vector_init(&layout->lines, sizeof(TEXT_LAYOUT_LINE));
+   return layout;
+}
+
+
+
+/* Function: al_destroy_text_layout
+ */
+void al_destroy_text_layout(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   if (!layout)
+      return;
+
+   _al_vector_free(&layout->lines);
+   al_ustr_free(layout->text);
+   al_free(layout);
+}
+
+
+
+/* Function: al_replace_text_layout_range
+ */
+void al_replace_text_layout_range(ALLEGRO_TEXT_LAYOUT *layout,
+   int start_pos, int end_pos, const ALLEGRO_USTR *text)
+{
+   _AL_VECTOR lines;
+   int size, first, last, i, n;
+   int hard_start, hard_end, delta;
+   ASSERT(layout);
+   ASSERT(text);
+
+   size = al_ustr_size(layout->text);
+   if (start_pos < 0)
+      start_pos = 0;
+   if (end_pos > size)
+      end_pos = size;
+   if (end_pos < start_pos)
+      end_pos = start_pos;
+
+   /* Only the hard lines touched by the range need to be split again. */
+   hard_start = al_ustr_rfind_chr(layout->text, start_pos, '\n') + 1;
+   hard_end = al_ustr_find_chr(layout->text, end_pos, '\n');
+   if (hard_end < 0)
+      hard_end = size;
+   first = find_layout_line(layout, hard_start);
+   last = find_layout_line(layout, hard_end + 1);
+
+   delta = al_ustr_size(text) - (end_pos - start_pos);
+   al_ustr_replace_range(layout->text, start_pos, end_pos, text);
+
+   _al_vector_init(&lines, sizeof(TEXT_LAYOUT_LINE));
+   if (first > 0) {
+      _al_vector_append_array(&lines, first,
+         _al_vector_ref_front(&layout->lines));
+   }
+   break_hard_lines(layout, &lines, hard_start, hard_end + delta);
+   n = _al_vector_size(&layout->lines);
+   if (last < n) {
+      int offset = _al_vector_size(&lines);
+      _al_vector_append_array(&lines, n - last,
+         _al_vector_ref(&layout->lines, last));
+      for (i = offset; i < offset + n - last; i++) {
+         TEXT_LAYOUT_LINE *line = _al_vector_ref(&lines, i);
+         line->start += delta;
+         line->end += delta;
+      }
+   }
+
+   _al_vector_free(&layout->lines);
+   layout->lines = lines;
+}
+
+
+
+/* Function: al_set_text_layout_ustr
+ */
+void al_set_text_layout_ustr(ALLEGRO_TEXT_LAYOUT *layout,
+   const ALLEGRO_USTR *text)
+{
+   ASSERT(layout);
+   al_replace_text_layout_range(layout, 0, al_ustr_size(layout->text), text);
+}
+
+
+
+/* Function: al_set_text_layout_text
+ */
+void al_set_text_layout_text(ALLEGRO_TEXT_LAYOUT *layout, const char *text)
+{
+   ALLEGRO_USTR_INFO info;
+   ASSERT(text);
+   al_set_text_layout_ustr(layout, al_ref_cstr(&info, text));
+}
+
+
+
+/* Function: al_append_text_layout_text
+ */
+void al_append_text_layout_text(ALLEGRO_TEXT_LAYOUT *layout,
+   const char *text)
+{
+   ALLEGRO_USTR_INFO info;
+   int size;
+   ASSERT(layout);
+   ASSERT(text);
+
+   size = al_ustr_size(layout->text);
+   al_replace_text_layout_range(layout, size, size, al_ref_cstr(&info, text));
+}
+
+
+
+/* Function: al_get_text_layout_ustr
+ */
+const ALLEGRO_USTR *al_get_text_layout_ustr(const ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+   return layout->text;
+}
+
+
+
+/* Function: al_set_text_layout_width
+ */
+void al_set_text_layout_width(ALLEGRO_TEXT_LAYOUT *layout, float max_width)
+{
+   _AL_VECTOR lines;
+   int n, i, j;
+   ASSERT(layout);
+
+   if (max_width == layout->max_width)
+      return;
+   layout->max_width = max_width;
+
+   /* Hard lines are only split again if one of their comparisons against
+    * the width would now come out differently.
+    */
+   _al_vector_init(&lines, sizeof(TEXT_LAYOUT_LINE));
+   n = _al_vector_size(&layout->lines);
+   for (i = 0; i < n; i = j) {
+      TEXT_LAYOUT_LINE *first = _al_vector_ref(&layout->lines, i);
+      bool valid = true;
+
+      for (j = i; j < n; j++) {
+         TEXT_LAYOUT_LINE *line = _al_vector_ref(&layout->lines, j);
+         if (j > i && line->hard)
+            break;
+         if (line->fit > max_width || line->fail <= max_width)
+            valid = false;
+      }
+
+      if (valid)
+         _al_vector_append_array(&lines, j - i, first);
+      else
+         break_hard_lines(layout, &lines, first->start, first->start);
+   }
+
+   _al_vector_free(&layout->lines);
+   layout->lines = lines;
+}
+
+
+
+/* Function: al_get_text_layout_width
+ */
+float al_get_text_layout_width(const ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+   return layout->max_width;
+}
+
+
+
+/* Function: al_get_text_layout_line_count
+ */
+int al_get_text_layout_line_count(const ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+   return _al_vector_size(&layout->lines);
+}
+
+
+
+/* Function: al_ref_text_layout_line
+ */
+const ALLEGRO_USTR *al_ref_text_layout_line(const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_USTR_INFO *info, int line_num)
+{
+   TEXT_LAYOUT_LINE *line;
+   ASSERT(layout);
+   ASSERT(info);
+   ASSERT(line_num >= 0 &&
+      line_num < (int)_al_vector_size(&layout->lines));
+
+   line = _al_vector_ref(&layout->lines, line_num);
+   return al_ref_ustr(info, layout->text, line->start, line->end);
+}
+
+
+
+/* Function: al_get_text_layout_line_width
+ */
+int al_get_text_layout_line_width(const ALLEGRO_TEXT_LAYOUT *layout,
+   int line_num)
+{
+   TEXT_LAYOUT_LINE *line;
+   ASSERT(layout);
+   ASSERT(line_num >= 0 &&
+      line_num < (int)_al_vector_size(&layout->lines));
+
+   line = _al_vector_ref(&layout->lines, line_num);
+   return line->width;
+}
+
+
+
+/* Narrows [*first, *last) to the lines which may show inside the clipping
+ * rectangle. That is only worked out for transformations which keep
+ * horizontal lines horizontal. A line is kept on either side, as glyphs can
+ * reach beyond their line.
+ */
+static void clip_layout_lines(float y, float line_height, int *first,
+   int *last)
+{
+   const ALLEGRO_TRANSFORM *t = al_get_current_transform();
+   int cx, cy, cw, ch;
+   float y1, y2;
+
+   if (!t || t->m[1][0] != 0 || t->m[0][1] != 0 || t->m[1][1] == 0 ||
+         t->m[0][3] != 0 || t->m[1][3] != 0 || t->m[3][3] != 1)
+      return;
+
+   al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+   y1 = (cy - t->m[3][1]) / t->m[1][1];
+   y2 = (cy + ch - t->m[3][1]) / t->m[1][1];
+   if (y1 > y2) {
+      float tmp = y1;
+      y1 = y2;
+      y2 = tmp;
+   }
+
+   y1 = floorf((y1 - y) / line_height) - 1;
+   y2 = ceilf((y2 - y) / line_height) + 1;
+   if (y1 > *first)
+      *first = y1 < *last ? (int)y1 : *last;
+   if (y2 < *last)
+      *last = y2 > *first ? (int)y2 : *first;
+}
+
+
+
+/* Function: al_draw_text_layout
+ */
+void al_draw_text_layout(const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y, float line_height, int flags)
+{
+   int first = 0;
+   int last;
+   int i;
+   bool hold;
+   ASSERT(layout);
+
+   if (line_height < 1)
+      line_height = al_get_font_line_height(layout->font);
+
+   last = _al_vector_size(&layout->lines);
+   clip_layout_lines(y, line_height, &first, &last);
+
+   hold = al_is_bitmap_drawing_held();
+   al_hold_bitmap_drawing(true);
+   for (i = first; i < last; i++) {
+      TEXT_LAYOUT_LINE *line = _al_vector_ref(&layout->lines, i);
+      ALLEGRO_USTR_INFO info;
+      const ALLEGRO_USTR *ustr = al_ref_ustr(&info, layout->text,
+         line->start, line->end);
+      float lx = x;
+
+      /* Same as al_draw_ustr, without measuring the line again. */
+      if (flags & ALLEGRO_ALIGN_CENTRE)
+         lx -= line->width / 2;
+      else if (flags & ALLEGRO_ALIGN_RIGHT)
+         lx -= line->width;
+
+      al_draw_ustr(layout->font, color, lx, y + line_height * i,
+         flags & ALLEGRO_ALIGN_INTEGER, ustr);
+   }
+   al_hold_bitmap_drawing(hold);
+}
+
+
+
 /* Function: al_set_fallback_font
  */
 void al_set_fallback_font(ALLEGRO_FONT *font, ALLEGRO_FONT *fallback)
@@ -3,27 +3,34 @@
 
 #include "xml.h"
 
+/* The parser works in place: characters which are part of a value are
+ * copied back towards the start of the buffer, and each finished value
+ * is terminated there before being passed to the callback. The write
+ * position never overtakes the read position.
+ */
 typedef struct {
    XmlState state;
    bool closing;
-   ALLEGRO_USTR *value;
+   char *value;
+   char *end;
    int (*callback)(XmlState state, char const *value, void *u);
    void *u;
 } XmlParser;
 
 static void scalar(XmlParser *x) {
-   x->callback(x->state, al_cstr(x->value), x->u);
-   al_ustr_assign_cstr(x->value, "");
+   *x->end = '\0';
+   x->callback(x->state, x->value, x->u);
+   x->value = x->end;
 }
 
 static void opt_scalar(XmlParser *x) {
-   if (al_ustr_size(x->value)) {
+   if (x->end > x->value) {
       scalar(x);
    }
 }
 
 static void discard_scalar(XmlParser *x) {
-   al_ustr_assign_cstr(x->value, "");
+   x->end = x->value;
 }
 
 static void close_tag(XmlParser *x) {
@@ -32,8 +39,7 @@ static void close_tag(XmlParser *x) {
 }
 
 static void add_char(XmlParser *x, char c) {
-   char s[] = {c, 0};
-   al_ustr_append_cstr(x->value, s);
+   *x->end++ = c;
 }
 
 static void create_tag(XmlParser *x) {
@@ -44,23 +50,22 @@ static void open_tag(XmlParser *x) {
    x->state = Outside;
 }
 
-void _al_xml_parse(ALLEGRO_FILE *f,
+void _al_xml_parse(char *buffer, size_t size,
         int (*callback)(XmlState state, char const *value, void *u),
         void *u)
 {
    XmlParser x_;
    XmlParser *x = &x_;
-   x->value = al_ustr_new("");
+   size_t i;
+   x->value = buffer;
+   x->end = buffer;
    x->state = Outside;
    x->closing = false;
    x->callback = callback;
    x->u = u;
 
-   while (true) {
-      int c = al_fgetc(f);
-      if (c < 0) {
-         break;
-      }
+   for (i = 0; i < size; i++) {
+      unsigned char c = buffer[i];
       if (x->state == Outside) {
          if (c == '<') {
             opt_scalar(x);
@@ -132,7 +137,4 @@ void _al_xml_parse(ALLEGRO_FILE *f,
       }
       add_char(x, c);
    }
-   
-   al_fclose(f);
-   al_ustr_free(x->value);
 }
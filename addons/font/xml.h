@@ -6,6 +6,7 @@ typedef enum {
    AttributeValue
 } XmlState;
 
-void _al_xml_parse(ALLEGRO_FILE *f,
+/* Parses size bytes of buffer in place. The buffer is modified. */
+void _al_xml_parse(char *buffer, size_t size,
         int (*callback)(XmlState state, char const *value, void *u),
         void *u);
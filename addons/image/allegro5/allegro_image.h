@@ -1,7 +1,7 @@
 #ifndef __al_included_allegro5_allegro_image_h
 #define __al_included_allegro5_allegro_image_h
 
-#include "allegro5/base.h"
+#include "allegro5/allegro.h"
 
 #if (defined ALLEGRO_MINGW32) || (defined ALLEGRO_MSVC) || (defined ALLEGRO_BCC32)
    #ifndef ALLEGRO_STATICLINK
@@ -36,6 +36,21 @@ ALLEGRO_IIO_FUNC(bool, al_is_image_addon_initialized, (void));
 ALLEGRO_IIO_FUNC(void, al_shutdown_image_addon, (void));
 ALLEGRO_IIO_FUNC(uint32_t, al_get_allegro_image_version, (void));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_IIO_SRC)
+/* Type: ALLEGRO_ANIMATED_BITMAP
+ */
+typedef struct ALLEGRO_ANIMATED_BITMAP ALLEGRO_ANIMATED_BITMAP;
+
+ALLEGRO_IIO_FUNC(ALLEGRO_ANIMATED_BITMAP *, al_open_animated_bitmap, (const char *filename, int flags));
+ALLEGRO_IIO_FUNC(ALLEGRO_ANIMATED_BITMAP *, al_open_animated_bitmap_f, (ALLEGRO_FILE *fp, const char *ident, int flags));
+ALLEGRO_IIO_FUNC(void, al_close_animated_bitmap, (ALLEGRO_ANIMATED_BITMAP *anim));
+ALLEGRO_IIO_FUNC(bool, al_read_animated_bitmap_frame, (ALLEGRO_ANIMATED_BITMAP *anim, double *duration));
+ALLEGRO_IIO_FUNC(bool, al_rewind_animated_bitmap, (ALLEGRO_ANIMATED_BITMAP *anim));
+ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, al_get_animated_bitmap_bitmap, (ALLEGRO_ANIMATED_BITMAP *anim));
+ALLEGRO_IIO_FUNC(int, al_get_animated_bitmap_frame_count, (ALLEGRO_ANIMATED_BITMAP *anim));
+ALLEGRO_IIO_FUNC(int, al_get_animated_bitmap_loop_count, (ALLEGRO_ANIMATED_BITMAP *anim));
+#endif
+
 
 #ifdef __cplusplus
 }
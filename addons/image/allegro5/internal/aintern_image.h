@@ -9,6 +9,31 @@ extern "C"
 {
 #endif 
 
+/* Defined in bitmap_io.h, if ALLEGRO_UNSTABLE is. */
+struct ALLEGRO_BITMAP_INFO;
+
+#ifdef ALLEGRO_IIO_SRC
+/* Format specific part of an ALLEGRO_ANIMATED_BITMAP. */
+typedef struct ALLEGRO_ANIMATED_BITMAP_INTERFACE
+{
+   bool (*read_frame)(ALLEGRO_ANIMATED_BITMAP *anim, double *duration);
+   bool (*rewind)(ALLEGRO_ANIMATED_BITMAP *anim);
+   void (*destroy)(ALLEGRO_ANIMATED_BITMAP *anim);
+} ALLEGRO_ANIMATED_BITMAP_INTERFACE;
+
+struct ALLEGRO_ANIMATED_BITMAP
+{
+   const ALLEGRO_ANIMATED_BITMAP_INTERFACE *vt;
+   ALLEGRO_FILE *fp;
+   int flags;
+   /* Every frame is decoded into this bitmap, which the opener creates. */
+   ALLEGRO_BITMAP *bitmap;
+   int frame_count;
+   int loop_count;
+   void *extra;
+};
+#endif
+
 #ifdef ALLEGRO_CFG_WANT_NATIVE_IMAGE_LOADER
 
 #ifdef ALLEGRO_IPHONE
@@ -27,12 +52,14 @@ ALLEGRO_IIO_FUNC(bool, _al_save_pcx, (const char *filename, ALLEGRO_BITMAP *bmp)
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_pcx_f, (ALLEGRO_FILE *f, int flags));
 ALLEGRO_IIO_FUNC(bool, _al_save_pcx_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
 ALLEGRO_IIO_FUNC(bool, _al_identify_pcx, (ALLEGRO_FILE *f));
+ALLEGRO_IIO_FUNC(bool, _al_probe_pcx, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
 
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_bmp, (const char *filename, int flags));
 ALLEGRO_IIO_FUNC(bool, _al_save_bmp, (const char *filename, ALLEGRO_BITMAP *bmp));
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_bmp_f, (ALLEGRO_FILE *f, int flags));
 ALLEGRO_IIO_FUNC(bool, _al_save_bmp_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
 ALLEGRO_IIO_FUNC(bool, _al_identify_bmp, (ALLEGRO_FILE *f));
+ALLEGRO_IIO_FUNC(bool, _al_probe_bmp, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
 
 
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_tga, (const char *filename, int flags));
@@ -40,14 +67,26 @@ ALLEGRO_IIO_FUNC(bool, _al_save_tga, (const char *filename, ALLEGRO_BITMAP *bmp)
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_tga_f, (ALLEGRO_FILE *f, int flags));
 ALLEGRO_IIO_FUNC(bool, _al_save_tga_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
 ALLEGRO_IIO_FUNC(bool, _al_identify_tga, (ALLEGRO_FILE *f));
+ALLEGRO_IIO_FUNC(bool, _al_probe_tga, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
+
+ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_qoi, (const char *filename, int flags));
+ALLEGRO_IIO_FUNC(bool, _al_save_qoi, (const char *filename, ALLEGRO_BITMAP *bmp));
+ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_qoi_f, (ALLEGRO_FILE *f, int flags));
+ALLEGRO_IIO_FUNC(bool, _al_save_qoi_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
+ALLEGRO_IIO_FUNC(bool, _al_identify_qoi, (ALLEGRO_FILE *f));
+ALLEGRO_IIO_FUNC(bool, _al_probe_qoi, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
 
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_dds, (const char *filename, int flags));
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_dds_f, (ALLEGRO_FILE *f, int flags));
 ALLEGRO_IIO_FUNC(bool, _al_identify_dds, (ALLEGRO_FILE *f));
+ALLEGRO_IIO_FUNC(bool, _al_probe_dds, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
 
 ALLEGRO_IIO_FUNC(bool, _al_identify_png, (ALLEGRO_FILE *f));
 ALLEGRO_IIO_FUNC(bool, _al_identify_jpg, (ALLEGRO_FILE *f));
 ALLEGRO_IIO_FUNC(bool, _al_identify_webp, (ALLEGRO_FILE *f));
+ALLEGRO_IIO_FUNC(bool, _al_probe_png, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
+ALLEGRO_IIO_FUNC(bool, _al_probe_jpg, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
+ALLEGRO_IIO_FUNC(bool, _al_probe_webp, (ALLEGRO_FILE *f, struct ALLEGRO_BITMAP_INFO *info));
 
 #ifdef ALLEGRO_CFG_IIO_HAVE_FREEIMAGE
 ALLEGRO_IIO_FUNC(bool, _al_init_fi, (void));
@@ -81,6 +120,7 @@ ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_png, (const char *filename, int flag
 ALLEGRO_IIO_FUNC(bool, _al_save_png, (const char *filename, ALLEGRO_BITMAP *bmp));
 ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_png_f, (ALLEGRO_FILE *f, int flags));
 ALLEGRO_IIO_FUNC(bool, _al_save_png_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
+ALLEGRO_IIO_FUNC(bool, _al_open_animated_png, (ALLEGRO_ANIMATED_BITMAP *anim));
 #endif
 
 #ifdef ALLEGRO_CFG_IIO_HAVE_JPG
@@ -97,6 +137,10 @@ ALLEGRO_IIO_FUNC(ALLEGRO_BITMAP *, _al_load_webp_f, (ALLEGRO_FILE *f, int flags)
 ALLEGRO_IIO_FUNC(bool, _al_save_webp_f, (ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp));
 #endif
 
+#ifdef ALLEGRO_CFG_IIO_HAVE_WEBPDEMUX
+ALLEGRO_IIO_FUNC(bool, _al_open_animated_webp, (ALLEGRO_ANIMATED_BITMAP *anim));
+#endif
+
 #ifdef __cplusplus
 }
 #endif 
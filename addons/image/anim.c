@@ -0,0 +1,170 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Animated bitmaps, decoded one frame at a time.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_image.h"
+
+#include "iio.h"
+
+ALLEGRO_DEBUG_CHANNEL("image")
+
+
+/* Function: al_open_animated_bitmap
+ */
+ALLEGRO_ANIMATED_BITMAP *al_open_animated_bitmap(const char *filename,
+   int flags)
+{
+   ALLEGRO_FILE *fp;
+   const char *ext;
+
+   ALLEGRO_ASSERT(filename);
+
+   ext = al_identify_bitmap(filename);
+   if (!ext) {
+      ext = strrchr(filename, '.');
+      if (!ext) {
+         ALLEGRO_ERROR("Could not identify %s\n", filename);
+         return NULL;
+      }
+   }
+
+   fp = al_fopen(filename, "rb");
+   if (!fp) {
+      ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
+      return NULL;
+   }
+
+   return al_open_animated_bitmap_f(fp, ext, flags);
+}
+
+
+/* Function: al_open_animated_bitmap_f
+ */
+ALLEGRO_ANIMATED_BITMAP *al_open_animated_bitmap_f(ALLEGRO_FILE *fp,
+   const char *ident, int flags)
+{
+   ALLEGRO_ANIMATED_BITMAP *anim;
+   bool ret = false;
+
+   ALLEGRO_ASSERT(fp);
+
+   if (!ident)
+      ident = al_identify_bitmap_f(fp);
+   if (!ident) {
+      ALLEGRO_ERROR("Could not identify the animated bitmap.\n");
+      al_fclose(fp);
+      return NULL;
+   }
+
+   anim = al_calloc(1, sizeof *anim);
+   if (!anim) {
+      al_fclose(fp);
+      return NULL;
+   }
+   anim->fp = fp;
+   anim->flags = flags;
+
+#ifdef ALLEGRO_CFG_IIO_HAVE_PNG
+   if (_al_stricmp(ident, ".png") == 0)
+      ret = _al_open_animated_png(anim);
+#endif
+#ifdef ALLEGRO_CFG_IIO_HAVE_WEBPDEMUX
+   if (_al_stricmp(ident, ".webp") == 0)
+      ret = _al_open_animated_webp(anim);
+#endif
+
+   if (!ret) {
+      ALLEGRO_ERROR("Could not open %s as an animated bitmap.\n", ident);
+      al_fclose(fp);
+      al_free(anim);
+      return NULL;
+   }
+
+   ALLEGRO_ASSERT(anim->vt);
+   ALLEGRO_ASSERT(anim->bitmap);
+   return anim;
+}
+
+
+/* Function: al_close_animated_bitmap
+ */
+void al_close_animated_bitmap(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   if (!anim)
+      return;
+
+   anim->vt->destroy(anim);
+   al_destroy_bitmap(anim->bitmap);
+   al_fclose(anim->fp);
+   al_free(anim);
+}
+
+
+/* Function: al_read_animated_bitmap_frame
+ */
+bool al_read_animated_bitmap_frame(ALLEGRO_ANIMATED_BITMAP *anim,
+   double *duration)
+{
+   double dummy;
+   ALLEGRO_ASSERT(anim);
+
+   return anim->vt->read_frame(anim, duration ? duration : &dummy);
+}
+
+
+/* Function: al_rewind_animated_bitmap
+ */
+bool al_rewind_animated_bitmap(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ALLEGRO_ASSERT(anim);
+
+   return anim->vt->rewind(anim);
+}
+
+
+/* Function: al_get_animated_bitmap_bitmap
+ */
+ALLEGRO_BITMAP *al_get_animated_bitmap_bitmap(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ALLEGRO_ASSERT(anim);
+
+   return anim->bitmap;
+}
+
+
+/* Function: al_get_animated_bitmap_frame_count
+ */
+int al_get_animated_bitmap_frame_count(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ALLEGRO_ASSERT(anim);
+
+   return anim->frame_count;
+}
+
+
+/* Function: al_get_animated_bitmap_loop_count
+ */
+int al_get_animated_bitmap_loop_count(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ALLEGRO_ASSERT(anim);
+
+   return anim->loop_count;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -17,12 +17,15 @@
  *      See readme.txt for copyright information.
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
 
 #include <string.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_convert.h"
+#include "allegro5/internal/aintern_file.h"
 #include "allegro5/internal/aintern_image.h"
 
 #include "iio.h"
@@ -308,6 +311,75 @@ static uint32_t read_32le(void *buf)
 
 
 
+/* convert_line:
+ *  Converts a row of pixels as stored in the file to
+ *  ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE. src_format names the layout the file
+ *  bytes have on a little endian machine, where this is a plain pixel format
+ *  conversion and goes through the (vectorised) converters of the core.
+ */
+static void convert_line(char *buf, int src_format, char *data, int length)
+{
+#ifdef ALLEGRO_LITTLE_ENDIAN
+   _al_convert_bitmap_data(buf, src_format, 0,
+      data, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, 0, 0, 0, 0, 0, length, 1);
+#else
+   unsigned char *ucbuf = (unsigned char *)buf;
+   uint32_t *data32 = (uint32_t *)data;
+   int i;
+
+   for (i = 0; i < length; i++) {
+      uint32_t pixel;
+
+      switch (src_format) {
+         case ALLEGRO_PIXEL_FORMAT_RGB_888:
+            pixel = ucbuf[i*3] | (ucbuf[i*3+1] << 8) | (ucbuf[i*3+2] << 16);
+            data32[i] = ALLEGRO_CONVERT_RGB_888_TO_ABGR_8888_LE(pixel);
+            break;
+         case ALLEGRO_PIXEL_FORMAT_XRGB_8888:
+            pixel = read_32le(buf + i*4);
+            data32[i] = ALLEGRO_CONVERT_XRGB_8888_TO_ABGR_8888_LE(pixel);
+            break;
+         case ALLEGRO_PIXEL_FORMAT_RGBX_8888:
+            pixel = read_32le(buf + i*4);
+            data32[i] = ALLEGRO_CONVERT_RGBX_8888_TO_ABGR_8888_LE(pixel);
+            break;
+         case ALLEGRO_PIXEL_FORMAT_ARGB_8888:
+            pixel = read_32le(buf + i*4);
+            data32[i] = ALLEGRO_CONVERT_ARGB_8888_TO_ABGR_8888_LE(pixel);
+            break;
+         case ALLEGRO_PIXEL_FORMAT_RGBA_8888:
+            pixel = read_32le(buf + i*4);
+            data32[i] = ALLEGRO_CONVERT_RGBA_8888_TO_ABGR_8888_LE(pixel);
+            break;
+         default:
+            ASSERT(false);
+      }
+   }
+#endif
+}
+
+
+
+/* premultiply_line:
+ *  Premultiplies a row of ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE pixels.
+ */
+static void premultiply_line(unsigned char *data, int length)
+{
+   int i;
+
+   for (i = 0; i < length; i++, data += 4) {
+      int a = data[3];
+
+      if (a != 255) {
+         data[0] = data[0] * a / 255;
+         data[1] = data[1] * a / 255;
+         data[2] = data[2] * a / 255;
+      }
+   }
+}
+
+
+
 /* read_1bit_line:
  *  Support function for reading the 1 bit bitmap file format.
  */
@@ -479,9 +551,6 @@ static void read_16_rgb_565_line(ALLEGRO_FILE *f, char *buf, char *data,
 static void read_24_rgb_888_line(ALLEGRO_FILE *f, char *buf, char *data,
    int length, bool premul)
 {
-   int bi, i;
-   unsigned char *ucbuf = (unsigned char *)buf;
-   uint32_t *data32 = (uint32_t *)data;
    size_t bytes_wanted = length * 3 + (length & 3);
 
    size_t bytes_read = al_fread(f, buf, bytes_wanted);
@@ -489,28 +558,7 @@ static void read_24_rgb_888_line(ALLEGRO_FILE *f, char *buf, char *data,
 
    (void)premul;
 
-   for (i = 0, bi = 0; i < (length & ~3); i += 4, bi += 3) {
-      uint32_t a = read_32le(buf + bi*4);     // BGRB [LE:BRGB]
-      uint32_t b = read_32le(buf + bi*4 + 4); // GRBG [LE:GBRG]
-      uint32_t c = read_32le(buf + bi*4 + 8); // RBGR [LE:RGBR]
-
-      uint32_t w = a;
-      uint32_t x = (a >> 24) | (b << 8);
-      uint32_t y = (b >> 16) | (c << 16);
-      uint32_t z = (c >> 8);
-
-      data32[i]   = ALLEGRO_CONVERT_RGB_888_TO_ABGR_8888_LE(w);
-      data32[i+1] = ALLEGRO_CONVERT_RGB_888_TO_ABGR_8888_LE(x);
-      data32[i+2] = ALLEGRO_CONVERT_RGB_888_TO_ABGR_8888_LE(y);
-      data32[i+3] = ALLEGRO_CONVERT_RGB_888_TO_ABGR_8888_LE(z);
-   }
-
-   bi *= 4;
-
-   for (; i < length; i++, bi += 3) {
-      uint32_t pixel = ucbuf[bi] | (ucbuf[bi+1] << 8) | (ucbuf[bi+2] << 16);
-      data32[i] = ALLEGRO_CONVERT_RGB_888_TO_ABGR_8888_LE(pixel);
-   }
+   convert_line(buf, ALLEGRO_PIXEL_FORMAT_RGB_888, data, length);
 }
 
 
@@ -521,8 +569,6 @@ static void read_24_rgb_888_line(ALLEGRO_FILE *f, char *buf, char *data,
 static void read_32_xrgb_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
    int length, bool premul)
 {
-   int i;
-   uint32_t *data32 = (uint32_t *)data;
    size_t bytes_wanted = length * 4;
 
    size_t bytes_read = al_fread(f, buf, bytes_wanted);
@@ -530,10 +576,7 @@ static void read_32_xrgb_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
 
    (void)premul;
 
-   for (i = 0; i < length; i++) {
-      uint32_t pixel = read_32le(buf + i*4);
-      data32[i] = ALLEGRO_CONVERT_XRGB_8888_TO_ABGR_8888_LE(pixel);
-   }
+   convert_line(buf, ALLEGRO_PIXEL_FORMAT_XRGB_8888, data, length);
 }
 
 
@@ -544,8 +587,6 @@ static void read_32_xrgb_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
 static void read_32_rgbx_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
    int length, bool premul)
 {
-   int i;
-   uint32_t *data32 = (uint32_t *)data;
    size_t bytes_wanted = length * 4;
 
    size_t bytes_read = al_fread(f, buf, bytes_wanted);
@@ -553,10 +594,7 @@ static void read_32_rgbx_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
 
    (void)premul;
 
-   for (i = 0; i < length; i++) {
-      uint32_t pixel = read_32le(buf + i*4);
-      data32[i] = ALLEGRO_CONVERT_RGBX_8888_TO_ABGR_8888_LE(pixel);
-   }
+   convert_line(buf, ALLEGRO_PIXEL_FORMAT_RGBX_8888, data, length);
 }
 
 
@@ -567,24 +605,15 @@ static void read_32_rgbx_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
 static void read_32_argb_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
    int length, bool premul)
 {
-   int i;
-   uint32_t *data32 = (uint32_t *)data;
    size_t bytes_wanted = length * 4;
 
    size_t bytes_read = al_fread(f, buf, bytes_wanted);
    memset(buf + bytes_read, 0, bytes_wanted - bytes_read);
 
-   for (i = 0; i < length; i++) {
-      uint32_t pixel = read_32le(buf + i*4);
-      uint32_t a = (pixel & 0xFF000000U) >> 24;
-      data32[i] = ALLEGRO_CONVERT_ARGB_8888_TO_ABGR_8888_LE(pixel);
-
-      if (premul && a != 255) {
-         data[i*4+1] = data[i*4+1] * a / 255;
-         data[i*4+2] = data[i*4+2] * a / 255;
-         data[i*4+3] = data[i*4+3] * a / 255;
-      }
-   }
+   convert_line(buf, ALLEGRO_PIXEL_FORMAT_ARGB_8888, data, length);
+
+   if (premul)
+      premultiply_line((unsigned char *)data, length);
 }
 
 
@@ -595,24 +624,15 @@ static void read_32_argb_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
 static void read_32_rgba_8888_line(ALLEGRO_FILE *f, char *buf, char *data,
    int length, bool premul)
 {
-   int i;
-   uint32_t *data32 = (uint32_t *)data;
    size_t bytes_wanted = length * 4;
 
    size_t bytes_read = al_fread(f, buf, bytes_wanted);
    memset(buf + bytes_read, 0, bytes_wanted - bytes_read);
 
-   for (i = 0; i < length; i++) {
-      uint32_t pixel = read_32le(buf + i*4);
-      uint32_t a = (pixel & 0x000000FFU);
-      data32[i] = ALLEGRO_CONVERT_RGBA_8888_TO_ABGR_8888_LE(pixel);
-
-      if (premul && a != 255) {
-         data[i*4]   = data[i*4] * a / 255;
-         data[i*4+1] = data[i*4+1] * a / 255;
-         data[i*4+2] = data[i*4+2] * a / 255;
-      }
-   }
+   convert_line(buf, ALLEGRO_PIXEL_FORMAT_RGBA_8888, data, length);
+
+   if (premul)
+      premultiply_line((unsigned char *)data, length);
 }
 
 
@@ -719,9 +739,21 @@ static bool read_RGB_paletted_image(ALLEGRO_FILE *f, int flags,
    int i, j, line, height, width, dir;
    size_t linesize;
    char *linebuf;
+   uint32_t pal32[256];
 
    (void)flags;
 
+   /* Expand the palette to whole pixels once, so each pixel of the image is
+    * a single table lookup and store.
+    */
+   for (i = 0; i < 256; i++) {
+      unsigned char *c = (unsigned char *)&pal32[i];
+      c[0] = pal[i].r;
+      c[1] = pal[i].g;
+      c[2] = pal[i].b;
+      c[3] = pal[i].a;
+   }
+
    height = infoheader->biHeight;
    width = infoheader->biWidth;
 
@@ -746,15 +778,11 @@ static bool read_RGB_paletted_image(ALLEGRO_FILE *f, int flags,
 
    for (i = 0; i < height; i++, line += dir) {
       char *data = (char *)lr->data + lr->pitch * line;
+      uint32_t *data32 = (uint32_t *)data;
       fn(f, linebuf, data, width, false);
 
-      for (j = 0; j < width; ++j) {
-         unsigned char idx = linebuf[j];
-         data[j*4]   = pal[idx].r;
-         data[j*4+1] = pal[idx].g;
-         data[j*4+2] = pal[idx].b;
-         data[j*4+3] = pal[idx].a;
-      }
+      for (j = 0; j < width; ++j)
+         data32[j] = pal32[(unsigned char)linebuf[j]];
    }
 
    al_free(linebuf);
@@ -984,11 +1012,7 @@ static bool read_RGB_image_32bit_alpha_hack(ALLEGRO_FILE *f, int flags,
       for (i = 0; i < height; i++, line += dir) {
          unsigned char *data = (unsigned char *)lr->data + lr->pitch * line;
 
-         for (j = 0; j < width; j++) {
-            data[j*4]   = data[j*4] * data[j*4+3] / 255;
-            data[j*4+1] = data[j*4+1] * data[j*4+3] / 255;
-            data[j*4+2] = data[j*4+2] * data[j*4+3] / 255;
-         }
+         premultiply_line(data, width);
       }
    }
 
@@ -1677,7 +1701,7 @@ ALLEGRO_BITMAP *_al_load_bmp(const char *filename, int flags)
    ALLEGRO_BITMAP *bmp;
    ASSERT(filename);
 
-   f = al_fopen(filename, "rb");
+   f = _al_fopen_for_reading(filename, "rb");
    if (!f) {
       ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
       return NULL;
@@ -1737,4 +1761,50 @@ bool _al_identify_bmp(ALLEGRO_FILE *f)
    return false;
 }
 
+bool _al_probe_bmp(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   BMPFILEHEADER fileheader;
+   BMPINFOHEADER infoheader;
+   unsigned long biSize;
+
+   if (read_bmfileheader(f, &fileheader) != 0)
+      return false;
+
+   biSize = (uint32_t)al_fread32le(f);
+   switch (biSize) {
+      case WININFOHEADERSIZE:
+      case WININFOHEADERSIZEV2:
+      case WININFOHEADERSIZEV3:
+      case WININFOHEADERSIZEV4:
+      case WININFOHEADERSIZEV5:
+         if (read_win_bminfoheader(f, &infoheader) != 0)
+            return false;
+         break;
+      case OS2INFOHEADERSIZE:
+         if (read_os2_bminfoheader(f, &infoheader) != 0)
+            return false;
+         break;
+      default:
+         return false;
+   }
+
+   info->width = infoheader.biWidth;
+   info->height = labs(infoheader.biHeight);
+   info->bit_depth = infoheader.biBitCount;
+
+   /* An alpha channel is either given by a mask (BITMAPV3INFOHEADER and
+    * later) or by a non-zero fourth byte of 32-bit pixels, which only shows
+    * in the pixel data. Assume there is one in both cases.
+    */
+   info->channels = infoheader.biBitCount == 32 ? 4 : 3;
+   if (infoheader.biCompression == BIT_BITFIELDS &&
+         biSize >= WININFOHEADERSIZEV3) {
+      al_fseek(f, 12, ALLEGRO_SEEK_CUR);
+      if (al_fread32le(f) != 0)
+         info->channels = 4;
+   }
+
+   return (int)info->width > 0 && info->height > 0;
+}
+
 /* vim: set sts=3 sw=3 et: */
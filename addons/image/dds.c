@@ -13,8 +13,13 @@
  *      See readme.txt for copyright information.
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_file.h"
 #include "allegro5/internal/aintern_image.h"
 
 #include "iio.h"
@@ -57,6 +62,110 @@ typedef struct {
 #define FOURCC(c0, c1, c2, c3) ((int)(c0) | ((int)(c1) << 8) | ((int)(c2) << 16) | ((int)(c3) << 24))
 
 #define DDPF_FOURCC 0x4
+#define DDSD_MIPMAPCOUNT 0x20000
+
+#define DDS_HEADER_DXT10_SIZE 20
+
+/* Returns the pixel format for a FourCC code or, if it is 'DX10', for the
+ * DXGI format of the extended header. -1 if the format is not supported.
+ */
+static int get_format(int fourcc, int dxgi_format)
+{
+   switch (fourcc) {
+      case FOURCC('D', 'X', 'T', '1'):
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1;
+      case FOURCC('D', 'X', 'T', '3'):
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3;
+      case FOURCC('D', 'X', 'T', '5'):
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5;
+      case FOURCC('A', 'T', 'I', '1'):
+      case FOURCC('B', 'C', '4', 'U'):
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1;
+      case FOURCC('A', 'T', 'I', '2'):
+      case FOURCC('B', 'C', '5', 'U'):
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2;
+      case FOURCC('D', 'X', '1', '0'):
+         break;
+      default:
+         return -1;
+   }
+
+   switch (dxgi_format) {
+      case 70: /* DXGI_FORMAT_BC1_TYPELESS */
+      case 71: /* DXGI_FORMAT_BC1_UNORM */
+      case 72: /* DXGI_FORMAT_BC1_UNORM_SRGB */
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1;
+      case 73: /* DXGI_FORMAT_BC2_TYPELESS */
+      case 74: /* DXGI_FORMAT_BC2_UNORM */
+      case 75: /* DXGI_FORMAT_BC2_UNORM_SRGB */
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3;
+      case 76: /* DXGI_FORMAT_BC3_TYPELESS */
+      case 77: /* DXGI_FORMAT_BC3_UNORM */
+      case 78: /* DXGI_FORMAT_BC3_UNORM_SRGB */
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5;
+      case 79: /* DXGI_FORMAT_BC4_TYPELESS */
+      case 80: /* DXGI_FORMAT_BC4_UNORM */
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1;
+      case 82: /* DXGI_FORMAT_BC5_TYPELESS */
+      case 83: /* DXGI_FORMAT_BC5_UNORM */
+         return ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2;
+      case 97: /* DXGI_FORMAT_BC7_TYPELESS */
+      case 98: /* DXGI_FORMAT_BC7_UNORM */
+      case 99: /* DXGI_FORMAT_BC7_UNORM_SRGB */
+         /* Textures are stored bottom-up, and BC7 blocks can't be flipped
+          * vertically without re-encoding them.
+          */
+         ALLEGRO_ERROR("BC7 DDS files are not supported.\n");
+         return -1;
+      default:
+         return -1;
+   }
+}
+
+/* Size in bytes of the mipmap levels from 0 to num_levels - 1. */
+static size_t mip_chain_size(int w, int h, int num_levels, int format)
+{
+   int block_width = al_get_pixel_block_width(format);
+   int block_height = al_get_pixel_block_height(format);
+   int block_size = al_get_pixel_block_size(format);
+   size_t size = 0;
+   int i;
+
+   for (i = 0; i < num_levels; i++) {
+      size += (size_t)((w + block_width - 1) / block_width) *
+         ((h + block_height - 1) / block_height) * block_size;
+      w = _ALLEGRO_MAX(w / 2, 1);
+      h = _ALLEGRO_MAX(h / 2, 1);
+   }
+   return size;
+}
+
+/* Reads the whole mipmap chain with a single read and hands it to the
+ * bitmap's driver, skipping locking and the copy it implies.
+ */
+static bool upload_mip_chain(ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp,
+   int num_levels)
+{
+   int w = al_get_bitmap_width(bmp);
+   int h = al_get_bitmap_height(bmp);
+   int64_t pos = al_ftell(f);
+   size_t size = mip_chain_size(w, h, num_levels, al_get_bitmap_format(bmp));
+   void *data;
+   bool ret = false;
+
+   data = al_malloc(size);
+   if (!data)
+      return false;
+
+   if (al_fread(f, data, size) == size)
+      ret = _al_upload_compressed_bitmap_levels(bmp, num_levels, data);
+   al_free(data);
+
+   /* Let the caller read the first level again the slow way. */
+   if (!ret)
+      al_fseek(f, pos, ALLEGRO_SEEK_SET);
+   return ret;
+}
 
 ALLEGRO_BITMAP *_al_load_dds_f(ALLEGRO_FILE *f, int flags)
 {
@@ -64,7 +173,9 @@ ALLEGRO_BITMAP *_al_load_dds_f(ALLEGRO_FILE *f, int flags)
    DDS_HEADER header;
    DWORD magic;
    size_t num_read;
-   int w, h, fourcc, format, block_width, block_height, block_size;
+   int w, h, fourcc, dxgi_format = 0, format;
+   int block_width, block_height, block_size;
+   int num_levels = 1;
    ALLEGRO_STATE state;
    ALLEGRO_LOCKED_REGION *lr = NULL;
    int ii;
@@ -93,19 +204,19 @@ ALLEGRO_BITMAP *_al_load_dds_f(ALLEGRO_FILE *f, int flags)
    h = header.dwHeight;
    fourcc = header.ddspf.dwFourCC;
 
-   switch (fourcc) {
-      case FOURCC('D', 'X', 'T', '1'):
-         format = ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1;
-         break;
-      case FOURCC('D', 'X', 'T', '3'):
-         format = ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3;
-         break;
-      case FOURCC('D', 'X', 'T', '5'):
-         format = ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5;
-         break;
-      default:
-         ALLEGRO_ERROR("Invalid pixel format.\n");
+   if (fourcc == FOURCC('D', 'X', '1', '0')) {
+      dxgi_format = al_fread32le(f);
+      al_fseek(f, DDS_HEADER_DXT10_SIZE - 4, ALLEGRO_SEEK_CUR);
+      if (al_feof(f)) {
+         ALLEGRO_ERROR("DDS file too short.\n");
          return NULL;
+      }
+   }
+
+   format = get_format(fourcc, dxgi_format);
+   if (format < 0) {
+      ALLEGRO_ERROR("Invalid pixel format.\n");
+      return NULL;
    }
 
    block_width = al_get_pixel_block_width(format);
@@ -113,7 +224,8 @@ ALLEGRO_BITMAP *_al_load_dds_f(ALLEGRO_FILE *f, int flags)
    block_size = al_get_pixel_block_size(format);
 
    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
-   al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
+   al_set_new_bitmap_flags((al_get_new_bitmap_flags() &
+      ~(ALLEGRO_MEMORY_BITMAP | ALLEGRO_CONVERT_BITMAP)) | ALLEGRO_VIDEO_BITMAP);
    al_set_new_bitmap_format(format);
    bmp = al_create_bitmap(w, h);
    if (!bmp) {
@@ -126,6 +238,20 @@ ALLEGRO_BITMAP *_al_load_dds_f(ALLEGRO_FILE *f, int flags)
       goto FAIL;
    }
 
+   /* Mipmaps stored in the file are only worth reading if the bitmap is
+    * going to use them, otherwise the driver generates its own.
+    */
+   if ((al_get_bitmap_flags(bmp) & ALLEGRO_MIPMAP) &&
+         (header.dwFlags & DDSD_MIPMAPCOUNT) && header.dwMipMapCount > 1) {
+      int max_levels = 1;
+      while ((w >> max_levels) > 0 || (h >> max_levels) > 0)
+         max_levels++;
+      num_levels = _ALLEGRO_MIN(header.dwMipMapCount, max_levels);
+   }
+
+   if (upload_mip_chain(f, bmp, num_levels))
+      goto RESET;
+
    lr = al_lock_bitmap_blocked(bmp, ALLEGRO_LOCK_WRITEONLY);
 
    if (!lr) {
@@ -133,12 +259,14 @@ ALLEGRO_BITMAP *_al_load_dds_f(ALLEGRO_FILE *f, int flags)
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1:
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3:
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5:
+         case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:
+         case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2:
             ALLEGRO_ERROR("Could not lock the bitmap (probably the support for locking this format has not been enabled).\n");
             break;
          default:
             ALLEGRO_ERROR("Could not lock the bitmap.\n");
       }
-      return NULL;
+      goto FAIL;
    }
 
    bitmap_data = lr->data;
@@ -171,7 +299,7 @@ ALLEGRO_BITMAP *_al_load_dds(const char *filename, int flags)
    ALLEGRO_BITMAP *bmp;
    ASSERT(filename);
 
-   f = al_fopen(filename, "rb");
+   f = _al_fopen_for_reading(filename, "rb");
    if (!f) {
       ALLEGRO_ERROR("Unable open %s for reading.\n", filename);
       return NULL;
@@ -196,3 +324,48 @@ bool _al_identify_dds(ALLEGRO_FILE *f)
       return false;
    return true;
 }
+
+bool _al_probe_dds(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   int pf_flags, fourcc, dxgi_format = 0;
+
+   if (!_al_identify_dds(f))
+      return false;
+
+   al_fread32le(f); /* dwFlags */
+   info->height = al_fread32le(f);
+   info->width = al_fread32le(f);
+   al_fseek(f, 4 * 14, ALLEGRO_SEEK_CUR); /* up to ddspf */
+   al_fread32le(f); /* ddspf.dwSize */
+   pf_flags = al_fread32le(f);
+   fourcc = al_fread32le(f);
+   if (al_feof(f) || !(pf_flags & DDPF_FOURCC))
+      return false;
+
+   if (fourcc == FOURCC('D', 'X', '1', '0')) {
+      al_fseek(f, 4 * 10, ALLEGRO_SEEK_CUR); /* rest of the header */
+      dxgi_format = al_fread32le(f);
+      if (al_feof(f))
+         return false;
+   }
+
+   info->format = get_format(fourcc, dxgi_format);
+   if (info->format < 0)
+      return false;
+
+   switch (info->format) {
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:
+         info->channels = 1;
+         break;
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2:
+         info->channels = 2;
+         break;
+      default:
+         info->channels = 4;
+   }
+   info->bit_depth = al_get_pixel_block_size(info->format) * 8 /
+      (al_get_pixel_block_width(info->format) *
+       al_get_pixel_block_height(info->format));
+
+   return info->width > 0 && info->height > 0;
+}
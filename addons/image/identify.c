@@ -1,3 +1,5 @@
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
 #include "allegro5/internal/aintern_image.h"
@@ -37,3 +39,163 @@ bool _al_identify_webp(ALLEGRO_FILE *f)
       return false;
    return true;
 }
+
+bool _al_probe_png(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   uint8_t ihdr[13];
+   uint8_t name[4];
+   int bit_depth, colour_type;
+   bool trns = false;
+
+   if (!_al_identify_png(f))
+      return false;
+   if (al_fread32be(f) != 13 || al_fread(f, name, 4) != 4 ||
+         memcmp(name, "IHDR", 4) != 0 || al_fread(f, ihdr, 13) != 13)
+      return false;
+
+   info->width = (ihdr[0] << 24) | (ihdr[1] << 16) | (ihdr[2] << 8) | ihdr[3];
+   info->height = (ihdr[4] << 24) | (ihdr[5] << 16) | (ihdr[6] << 8) | ihdr[7];
+   bit_depth = ihdr[8];
+   colour_type = ihdr[9];
+
+   /* The chunks before the image data tell about transparency and, for
+    * APNG, the number of frames. They are small, so walk over them.
+    */
+   al_fseek(f, 4, ALLEGRO_SEEK_CUR); /* CRC */
+   while (true) {
+      int32_t length = al_fread32be(f);
+      if (al_fread(f, name, 4) != 4 || length < 0)
+         break;
+      if (memcmp(name, "IDAT", 4) == 0 || memcmp(name, "IEND", 4) == 0)
+         break;
+      if (memcmp(name, "tRNS", 4) == 0)
+         trns = true;
+      if (memcmp(name, "acTL", 4) == 0 && length >= 4) {
+         info->frames = al_fread32be(f);
+         length -= 4;
+      }
+      if (!al_fseek(f, length + 4, ALLEGRO_SEEK_CUR))
+         break;
+   }
+
+   switch (colour_type) {
+      case 0: info->channels = 1; break;
+      case 2: info->channels = 3; break;
+      case 3: info->channels = 3; break;
+      case 4: info->channels = 2; break;
+      case 6: info->channels = 4; break;
+      default: return false;
+   }
+   info->bit_depth = colour_type == 3 ? bit_depth :
+      bit_depth * info->channels;
+   if (trns)
+      info->channels++;
+
+   return info->width > 0 && info->height > 0;
+}
+
+bool _al_probe_jpg(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   if ((uint16_t)al_fread16be(f) != 0xffd8)
+      return false;
+
+   /* Skip over the segments before the start of frame marker. */
+   while (!al_feof(f)) {
+      int marker;
+      int length;
+
+      if (al_fgetc(f) != 0xff)
+         return false;
+      do {
+         marker = al_fgetc(f);
+      } while (marker == 0xff);
+      if (marker == EOF)
+         return false;
+
+      /* Markers without a segment. */
+      if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+         continue;
+      if (marker == 0xd9 || marker == 0xda)
+         return false;
+
+      length = (uint16_t)al_fread16be(f);
+      if (length < 2)
+         return false;
+
+      /* SOF0 to SOF15, except DHT, JPG and DAC which share the range. */
+      if (marker >= 0xc0 && marker <= 0xcf &&
+            marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+         int precision = al_fgetc(f);
+         info->height = (uint16_t)al_fread16be(f);
+         info->width = (uint16_t)al_fread16be(f);
+         info->channels = al_fgetc(f);
+         info->bit_depth = precision * info->channels;
+         return !al_feof(f) && info->width > 0 && info->height > 0 &&
+            info->channels > 0;
+      }
+
+      if (!al_fseek(f, length - 2, ALLEGRO_SEEK_CUR))
+         return false;
+   }
+
+   return false;
+}
+
+bool _al_probe_webp(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   uint8_t fourcc[4];
+   uint8_t x[10];
+   uint32_t size;
+
+   if (!_al_identify_webp(f))
+      return false;
+   if (al_fread(f, fourcc, 4) != 4)
+      return false;
+   size = al_fread32le(f);
+
+   if (memcmp(fourcc, "VP8 ", 4) == 0) {
+      /* Frame tag, start code, then 14-bit dimensions. */
+      if (al_fread(f, x, 10) != 10 || x[3] != 0x9d || x[4] != 0x01 ||
+            x[5] != 0x2a)
+         return false;
+      info->width = (x[6] | (x[7] << 8)) & 0x3fff;
+      info->height = (x[8] | (x[9] << 8)) & 0x3fff;
+      info->channels = 3;
+   }
+   else if (memcmp(fourcc, "VP8L", 4) == 0) {
+      uint32_t bits;
+      if (al_fgetc(f) != 0x2f)
+         return false;
+      bits = al_fread32le(f);
+      info->width = (bits & 0x3fff) + 1;
+      info->height = ((bits >> 14) & 0x3fff) + 1;
+      info->channels = (bits & (1 << 28)) ? 4 : 3;
+   }
+   else if (memcmp(fourcc, "VP8X", 4) == 0) {
+      if (al_fread(f, x, 10) != 10)
+         return false;
+      info->width = (x[4] | (x[5] << 8) | (x[6] << 16)) + 1;
+      info->height = (x[7] | (x[8] << 8) | (x[9] << 16)) + 1;
+      info->channels = (x[0] & 0x10) ? 4 : 3;
+
+      /* Animations have one ANMF chunk per frame. */
+      if (x[0] & 0x02) {
+         info->frames = 0;
+         if (!al_fseek(f, size + (size & 1) - 10, ALLEGRO_SEEK_CUR))
+            return false;
+         while (al_fread(f, fourcc, 4) == 4) {
+            size = al_fread32le(f);
+            if (memcmp(fourcc, "ANMF", 4) == 0)
+               info->frames++;
+            if (!al_fseek(f, size + (size & 1), ALLEGRO_SEEK_CUR))
+               break;
+         }
+      }
+   }
+   else {
+      return false;
+   }
+
+   info->bit_depth = 8 * info->channels;
+   return true;
+}
@@ -1,3 +1,5 @@
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
 #include "allegro5/internal/aintern_exitfunc.h"
@@ -25,28 +27,42 @@ bool al_init_image_addon(void)
    success |= al_register_bitmap_loader_f(".pcx", _al_load_pcx_f);
    success |= al_register_bitmap_saver_f(".pcx", _al_save_pcx_f);
    success |= al_register_bitmap_identifier(".pcx", _al_identify_pcx);
+   success |= al_register_bitmap_prober(".pcx", _al_probe_pcx);
 
    success |= al_register_bitmap_loader(".bmp", _al_load_bmp);
    success |= al_register_bitmap_saver(".bmp", _al_save_bmp);
    success |= al_register_bitmap_loader_f(".bmp", _al_load_bmp_f);
    success |= al_register_bitmap_saver_f(".bmp", _al_save_bmp_f);
    success |= al_register_bitmap_identifier(".bmp", _al_identify_bmp);
+   success |= al_register_bitmap_prober(".bmp", _al_probe_bmp);
 
    success |= al_register_bitmap_loader(".tga", _al_load_tga);
    success |= al_register_bitmap_saver(".tga", _al_save_tga);
    success |= al_register_bitmap_loader_f(".tga", _al_load_tga_f);
    success |= al_register_bitmap_saver_f(".tga", _al_save_tga_f);
    success |= al_register_bitmap_identifier(".tga", _al_identify_tga);
+   success |= al_register_bitmap_prober(".tga", _al_probe_tga);
+
+   success |= al_register_bitmap_loader(".qoi", _al_load_qoi);
+   success |= al_register_bitmap_saver(".qoi", _al_save_qoi);
+   success |= al_register_bitmap_loader_f(".qoi", _al_load_qoi_f);
+   success |= al_register_bitmap_saver_f(".qoi", _al_save_qoi_f);
+   success |= al_register_bitmap_identifier(".qoi", _al_identify_qoi);
+   success |= al_register_bitmap_prober(".qoi", _al_probe_qoi);
 
    success |= al_register_bitmap_loader(".dds", _al_load_dds);
    success |= al_register_bitmap_loader_f(".dds", _al_load_dds_f);
    success |= al_register_bitmap_identifier(".dds", _al_identify_dds);
+   success |= al_register_bitmap_prober(".dds", _al_probe_dds);
 
    /* Even if we don't have libpng or libjpeg we most likely have a
     * native reader for those instead so always identify them.
     */
    success |= al_register_bitmap_identifier(".png", _al_identify_png);
    success |= al_register_bitmap_identifier(".jpg", _al_identify_jpg);
+   success |= al_register_bitmap_prober(".png", _al_probe_png);
+   success |= al_register_bitmap_prober(".jpg", _al_probe_jpg);
+   success |= al_register_bitmap_prober(".jpeg", _al_probe_jpg);
 
 /* ALLEGRO_CFG_IIO_HAVE_* is sufficient to know that the library
    should be used. i.e., ALLEGRO_CFG_IIO_HAVE_GDIPLUS and
@@ -100,6 +116,7 @@ bool al_init_image_addon(void)
    success |= al_register_bitmap_loader_f(".webp", _al_load_webp_f);
    success |= al_register_bitmap_saver_f(".webp", _al_save_webp_f);
    success |= al_register_bitmap_identifier(".webp", _al_identify_webp);
+   success |= al_register_bitmap_prober(".webp", _al_probe_webp);
 #endif
 
 #ifdef ALLEGRO_CFG_IIO_HAVE_FREEIMAGE
@@ -134,6 +151,7 @@ bool al_init_image_addon(void)
          //success |= al_register_bitmap_saver(extensions[i], _al_save_android_bitmap);
       }
       success |= al_register_bitmap_identifier(".webp", _al_identify_webp);
+      success |= al_register_bitmap_prober(".webp", _al_probe_webp);
    }
 #endif
 
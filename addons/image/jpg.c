@@ -1,3 +1,5 @@
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 /* libjpeg wrapper for Allegro 5 iio addon.
  * by Elias Pschernig
  */
@@ -11,8 +13,12 @@
 
 #define BUFFER_SIZE 4096
 
+/* Number of scanlines requested from libjpeg at a time. */
+#define ROWS_PER_READ 16
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_image.h"
 
 #include "iio.h"
@@ -158,6 +164,33 @@ struct load_jpg_entry_helper_data {
    unsigned char *row;
 };
 
+/* set_scale:
+ *  Picks the smallest of the 1/1, 1/2, 1/4 and 1/8 DCT scalings which all
+ *  versions of libjpeg support that still covers the size requested with
+ *  al_set_new_bitmap_load_size. Decoding at 1/8 hardly does more than an
+ *  inverse DCT of each block's DC coefficient.
+ */
+static void set_scale(j_decompress_ptr cinfo)
+{
+   int min_w, min_h;
+   int denom;
+
+   al_get_new_bitmap_load_size(&min_w, &min_h);
+   if (min_w == 0 && min_h == 0)
+      return;
+
+   for (denom = 8; denom > 1; denom /= 2) {
+      /* libjpeg rounds the scaled dimensions up. */
+      int w = ((int)cinfo->image_width + denom - 1) / denom;
+      int h = ((int)cinfo->image_height + denom - 1) / denom;
+      if (w >= min_w && h >= min_h)
+         break;
+   }
+
+   cinfo->scale_num = 1;
+   cinfo->scale_denom = denom;
+}
+
 static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
    struct load_jpg_entry_helper_data *data, int flags)
 {
@@ -190,6 +223,7 @@ static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
    jpeg_create_decompress(&cinfo);
    jpeg_packfile_src(&cinfo, fp, data->buffer);
    jpeg_read_header(&cinfo, true);
+   set_scale(&cinfo);
    jpeg_start_decompress(&cinfo);
 
    w = cinfo.output_width;
@@ -229,30 +263,38 @@ static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
 
    if (s == 3) {
       /* Colour. */
-      int y;
+      unsigned char *out[ROWS_PER_READ];
+      int i, n, y;
 
       for (y = cinfo.output_scanline; y < h; y = cinfo.output_scanline) {
-         unsigned char *out[1];
-         out[0] = ((unsigned char *)lock->data) + y * lock->pitch;
-         jpeg_read_scanlines(&cinfo, (void *)out, 1);
+         n = _ALLEGRO_MIN(h - y, ROWS_PER_READ);
+         for (i = 0; i < n; i++)
+            out[i] = ((unsigned char *)lock->data) + (y + i) * lock->pitch;
+         jpeg_read_scanlines(&cinfo, (void *)out, n);
       }
    }
    else if (s == 1) {
       /* Greyscale. */
+      unsigned char *rows[ROWS_PER_READ];
       unsigned char *in;
       unsigned char *out;
-      int x, y;
+      int i, n, x, y;
 
-      data->row = al_malloc(w);
+      data->row = al_malloc(w * ROWS_PER_READ);
+      for (i = 0; i < ROWS_PER_READ; i++)
+         rows[i] = data->row + i * w;
       for (y = cinfo.output_scanline; y < h; y = cinfo.output_scanline) {
-         jpeg_read_scanlines(&cinfo, (void *)&data->row, 1);
-         in = data->row;
-         out = ((unsigned char *)lock->data) + y * lock->pitch;
-         for (x = 0; x < w; x++) {
-            *out++ = *in;
-            *out++ = *in;
-            *out++ = *in;
-            in++;
+         n = jpeg_read_scanlines(&cinfo, (void *)rows,
+            _ALLEGRO_MIN(h - y, ROWS_PER_READ));
+         for (i = 0; i < n; i++) {
+            in = rows[i];
+            out = ((unsigned char *)lock->data) + (y + i) * lock->pitch;
+            for (x = 0; x < w; x++) {
+               *out++ = *in;
+               *out++ = *in;
+               *out++ = *in;
+               in++;
+            }
          }
       }
    }
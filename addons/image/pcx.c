@@ -1,6 +1,9 @@
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
 #include "allegro5/internal/aintern_image.h"
+#include "allegro5/internal/aintern_file.h"
 
 #include "iio.h"
 
@@ -274,7 +277,7 @@ ALLEGRO_BITMAP *_al_load_pcx(const char *filename, int flags)
    ALLEGRO_BITMAP *bmp;
    ASSERT(filename);
 
-   f = al_fopen(filename, "rb");
+   f = _al_fopen_for_reading(filename, "rb");
    if (!f) {
       ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
       return NULL;
@@ -323,5 +326,23 @@ bool _al_identify_pcx(ALLEGRO_FILE *f)
    return true;
 }
 
+bool _al_probe_pcx(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   uint8_t x[68];
+
+   if (al_fread(f, x, 68) != 68)
+      return false;
+   if (x[0] != 0x0a || x[3] != 8 || (x[65] != 1 && x[65] != 3))
+      return false;
+
+   /* The window from xmin, ymin to xmax, ymax, inclusive. */
+   info->width = (x[8] | (x[9] << 8)) - (x[4] | (x[5] << 8)) + 1;
+   info->height = (x[10] | (x[11] << 8)) - (x[6] | (x[7] << 8)) + 1;
+   info->channels = 3;
+   info->bit_depth = 8 * x[65];
+
+   return info->width > 0 && info->height > 0;
+}
+
 
 /* vim: set sts=3 sw=3 et: */
@@ -3,12 +3,20 @@
  */
 
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include <limits.h>
 #include <png.h>
 #include <zlib.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
 #include "allegro5/internal/aintern_image.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_vector.h"
 
 #include "iio.h"
 
@@ -86,65 +94,86 @@ static int check_if_png(ALLEGRO_FILE *fp)
 
 
 
-/* really_load_png:
- *  Worker routine, used by load_png and load_memory_png.
+/* premultiply_rows:
+ *  Premultiplies the colour channels of decoded rows by their alpha.
  */
-static ALLEGRO_BITMAP *really_load_png(png_structp png_ptr, png_infop info_ptr,
-   int flags)
+static void premultiply_rows(png_bytepp rows, png_uint_32 count,
+   png_uint_32 width, const int offsets[4])
 {
-   ALLEGRO_BITMAP *bmp;
-   png_uint_32 width, height, rowbytes, real_rowbytes;
-   int bit_depth, color_type, interlace_type;
-   double image_gamma, screen_gamma;
-   int intent;
-   int bpp;
-   int number_passes, pass;
-   int num_trans = 0;
-   PalEntry pal[256];
-   png_bytep trans;
-   ALLEGRO_LOCKED_REGION *lock;
-   unsigned char *buf;
-   unsigned char *dest;
-   bool premul = !(flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA);
-   bool index_only;
+   png_uint_32 y, x;
+
+   for (y = 0; y < count; y++) {
+      unsigned char *p = rows[y];
+      for (x = 0; x < width; x++) {
+         int a = p[offsets[3]];
+         if (a != 255) {
+            p[offsets[0]] = p[offsets[0]] * a / 255;
+            p[offsets[1]] = p[offsets[1]] * a / 255;
+            p[offsets[2]] = p[offsets[2]] * a / 255;
+         }
+         p += 4;
+      }
+   }
+}
 
-   ALLEGRO_ASSERT(png_ptr && info_ptr);
 
-   /* The call to png_read_info() gives us all of the information from the
-    * PNG file before the first IDAT (image data chunk).
-    */
-   png_read_info(png_ptr, info_ptr);
+
+/* Number of rows handed to libpng at a time for non-interlaced images. */
+#define PNG_ROWS_PER_READ 16
+
+/* set_transforms:
+ *  Sets up libpng to produce either palette indices or 32-bit pixels with
+ *  the channels at the given byte offsets, and updates info_ptr to match.
+ *  Returns whether the image has an alpha channel.
+ */
+static bool set_transforms(png_structp png_ptr, png_infop info_ptr,
+   bool index_only, const int offsets[4])
+{
+   png_uint_32 width, height;
+   int bit_depth, color_type;
+   double image_gamma, screen_gamma;
+   int intent;
+   bool has_alpha;
 
    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth,
-                &color_type, &interlace_type, NULL, NULL);
+                &color_type, NULL, NULL, NULL);
 
    /* Extract multiple pixels with bit depths of 1, 2, and 4 from a single
     * byte into separate bytes (useful for paletted and grayscale images).
     */
    png_set_packing(png_ptr);
 
-   /* Expand grayscale images to the full 8 bits from 1, 2, or 4 bits/pixel */
-   if ((color_type == PNG_COLOR_TYPE_GRAY) && (bit_depth < 8))
+   has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) ||
+      png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS);
+
+   if (!index_only) {
+      /* Expand palettes, grayscale images of less than 8 bits per pixel and
+       * tRNS chunks to full RGB(A) pixels.
+       */
       png_set_expand(png_ptr);
 
-   /* Adds a full alpha channel if there is transparency information
-    * in a tRNS chunk.
-    */
-   if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
-      if (!(color_type & PNG_COLOR_MASK_PALETTE))
-         png_set_tRNS_to_alpha(png_ptr);
-      png_get_tRNS(png_ptr, info_ptr, &trans, &num_trans, NULL);
+      /* Convert 16-bits per colour component to 8-bits per colour
+       * component.
+       */
+      if (bit_depth == 16)
+         png_set_strip_16(png_ptr);
+
+      /* Convert grayscale to RGB triplets */
+      if ((color_type == PNG_COLOR_TYPE_GRAY) ||
+          (color_type == PNG_COLOR_TYPE_GRAY_ALPHA))
+         png_set_gray_to_rgb(png_ptr);
+
+      /* Arrange the channels in the order of the lock format. */
+      if (offsets[0] > offsets[2])
+         png_set_bgr(png_ptr);
+      if (offsets[3] == 0)
+         png_set_swap_alpha(png_ptr);
+      if (!has_alpha) {
+         png_set_filler(png_ptr, 0xff,
+            offsets[3] == 0 ? PNG_FILLER_BEFORE : PNG_FILLER_AFTER);
+      }
    }
 
-   /* Convert 16-bits per colour component to 8-bits per colour component. */
-   if (bit_depth == 16)
-      png_set_strip_16(png_ptr);
-
-   /* Convert grayscale to RGB triplets */
-   if ((color_type == PNG_COLOR_TYPE_GRAY) ||
-       (color_type == PNG_COLOR_TYPE_GRAY_ALPHA))
-      png_set_gray_to_rgb(png_ptr);
-
    /* Optionally, tell libpng to handle the gamma correction for us. */
    screen_gamma = get_gamma();
    if (screen_gamma != 0.0) {
@@ -159,47 +188,76 @@ static ALLEGRO_BITMAP *really_load_png(png_structp png_ptr, png_infop info_ptr,
    }
 
    /* Turn on interlace handling. */
-   number_passes = png_set_interlace_handling(png_ptr);
+   png_set_interlace_handling(png_ptr);
 
    /* Call to gamma correct and add the background to the palette
     * and update info structure.
     */
    png_read_update_info(png_ptr, info_ptr);
 
-   /* Palettes. */
-   if (color_type & PNG_COLOR_MASK_PALETTE) {
-      int num_palette, i;
-      png_colorp palette;
-
-      if (png_get_PLTE(png_ptr, info_ptr, &palette, &num_palette)) {
-         /* We don't actually dither, we just copy the palette. */
-         for (i = 0; ((i < num_palette) && (i < 256)); i++) {
-            pal[i].r = palette[i].red;
-            pal[i].g = palette[i].green;
-            pal[i].b = palette[i].blue;
-         }
+   ALLEGRO_ASSERT(png_get_rowbytes(png_ptr, info_ptr) ==
+      width * (index_only ? 1 : 4));
+
+   return has_alpha;
+}
+
 
-         for (; i < 256; i++)
-            pal[i].r = pal[i].g = pal[i].b = 0;
+
+/* read_rows:
+ *  Reads the whole image into rows, premultiplying it if asked to.
+ */
+static void read_rows(png_structp png_ptr, png_infop info_ptr,
+   png_bytepp rows, bool premul, const int offsets[4])
+{
+   png_uint_32 width = png_get_image_width(png_ptr, info_ptr);
+   png_uint_32 height = png_get_image_height(png_ptr, info_ptr);
+   png_uint_32 y;
+
+   if (png_get_interlace_type(png_ptr, info_ptr) == PNG_INTERLACE_ADAM7) {
+      /* Every pass writes over the rows of the previous one. */
+      png_read_image(png_ptr, rows);
+      if (premul)
+         premultiply_rows(rows, height, width, offsets);
+   }
+   else {
+      /* Premultiply each batch while it is still in the cache. */
+      for (y = 0; y < height; y += PNG_ROWS_PER_READ) {
+         png_uint_32 n = _ALLEGRO_MIN(height - y, PNG_ROWS_PER_READ);
+         png_read_rows(png_ptr, rows + y, NULL, n);
+         if (premul)
+            premultiply_rows(rows + y, n, width, offsets);
       }
    }
+}
 
-   rowbytes = png_get_rowbytes(png_ptr, info_ptr);
 
-   /* Allocate the memory to hold the image using the fields of info_ptr. */
-   bpp = rowbytes * 8 / width;
 
-   /* Allegro cannot handle less than 8 bpp. */
-   if (bpp < 8)
-      bpp = 8;
+/* really_load_png:
+ *  Worker routine, used by load_png and load_memory_png.
+ */
+static ALLEGRO_BITMAP *really_load_png(png_structp png_ptr, png_infop info_ptr,
+   int flags)
+{
+   ALLEGRO_BITMAP *bmp;
+   png_uint_32 width, height, y;
+   int bit_depth, color_type;
+   int lock_format;
+   int offsets[4];
+   ALLEGRO_LOCKED_REGION *lock;
+   png_bytepp rows;
+   bool premul = !(flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA);
+   bool index_only;
+   bool has_alpha;
+
+   ALLEGRO_ASSERT(png_ptr && info_ptr);
 
+   /* The call to png_read_info() gives us all of the information from the
+    * PNG file before the first IDAT (image data chunk).
+    */
+   png_read_info(png_ptr, info_ptr);
 
-   if ((bpp == 24) || (bpp == 32)) {
-#ifdef ALLEGRO_BIG_ENDIAN
-      png_set_bgr(png_ptr);
-      png_set_swap_alpha(png_ptr);
-#endif
-   }
+   png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth,
+                &color_type, NULL, NULL, NULL);
 
    bmp = al_create_bitmap(width, height);
    if (!bmp) {
@@ -207,128 +265,42 @@ static ALLEGRO_BITMAP *really_load_png(png_structp png_ptr, png_infop info_ptr,
       return NULL;
    }
 
-   // TODO: can this be different from rowbytes?
-   real_rowbytes = ((bpp + 7) / 8) * width;
-   if (interlace_type == PNG_INTERLACE_ADAM7)
-      buf = al_malloc(real_rowbytes * height);
-   else
-      buf = al_malloc(real_rowbytes);
+   index_only = (color_type & PNG_COLOR_MASK_PALETTE) &&
+      (flags & ALLEGRO_KEEP_INDEX);
 
-   if (bpp == 8 && (color_type & PNG_COLOR_MASK_PALETTE) &&
-      (flags & ALLEGRO_KEEP_INDEX))
-   {
-      lock = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8,
-         ALLEGRO_LOCK_WRITEONLY);
-      index_only = true;
+   /* Decode straight into the bitmap's own format where libpng can produce
+    * it, so unlocking the bitmap does not have to convert the pixels again.
+    */
+   if (index_only) {
+      lock_format = ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8;
    }
    else {
-      lock = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
-         ALLEGRO_LOCK_WRITEONLY);
-      index_only = false;
-   }
-
-   /* Read the image, one line at a time (easier to debug!) */
-   for (pass = 0; pass < number_passes; pass++) {
-      png_uint_32 y;
-      unsigned int i;
-      unsigned char *ptr;
-      dest = lock->data;
-
-      for (y = 0; y < height; y++) {
-         unsigned char *dest_row_start = dest;
-         /* For interlaced pictures, the row needs to be initialized with
-          * the contents of the previous pass.
-          */
-         if (interlace_type == PNG_INTERLACE_ADAM7)
-            ptr = buf + y * real_rowbytes;
-         else
-            ptr = buf;
-         png_read_row(png_ptr, NULL, ptr);
-   
-         switch (bpp) {
-            case 8:
-               if (index_only) {
-                  for (i = 0; i < width; i++) {
-                     *(dest++) = *(ptr++);
-                  }
-               }
-               else if (color_type & PNG_COLOR_MASK_PALETTE) {
-                  for (i = 0; i < width; i++) {
-                     int pix = ptr[0];
-                     ptr++;
-                     dest[0] = pal[pix].r;
-                     dest[1] = pal[pix].g;
-                     dest[2] = pal[pix].b;
-                     if (pix < num_trans) {
-                        int a = trans[pix];
-                        dest[3] = a;
-                        if (premul) {
-                           dest[0] = dest[0] * a / 255;
-                           dest[1] = dest[1] * a / 255;
-                           dest[2] = dest[2] * a / 255;
-                        }
-                     } else {
-                        dest[3] = 255;
-                     }
-                     dest += 4;
-                  }
-               }
-               else {
-                  for (i = 0; i < width; i++) {
-                     int pix = ptr[0];
-                     ptr++;
-                     *(dest++) = pix;
-                     *(dest++) = pix;
-                     *(dest++) = pix;
-                     *(dest++) = 255;
-                  }
-               }
-               break;
-
-            case 24:
-               for (i = 0; i < width; i++) {
-                  uint32_t pix = _AL_READ3BYTES(ptr);
-                  ptr += 3;
-                  *(dest++) = pix & 0xff;
-                  *(dest++) = (pix >> 8) & 0xff;
-                  *(dest++) = (pix >> 16) & 0xff;
-                  *(dest++) = 255;
-               }
-               break;
-
-            case 32:
-               for (i = 0; i < width; i++) {
-                  uint32_t pix = *(uint32_t*)ptr;
-                  int r = pix & 0xff;
-                  int g = (pix >> 8) & 0xff;
-                  int b = (pix >> 16) & 0xff;
-                  int a = (pix >> 24) & 0xff;
-                  ptr += 4;
-
-                  if (premul) {
-                     r = r * a / 255;
-                     g = g * a / 255;
-                     b = b * a / 255;
-                  }
-
-                  *(dest++) = r;
-                  *(dest++) = g;
-                  *(dest++) = b;
-                  *(dest++) = a;
-               }
-               break;
-
-            default:
-               ALLEGRO_ASSERT(bpp == 8 || bpp == 24 || bpp == 32);
-               break;
-         }
-         dest = dest_row_start + lock->pitch;
+      lock_format = al_get_bitmap_format(bmp);
+      if (!_al_get_pixel_format_byte_offsets(lock_format, offsets)) {
+         lock_format = ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE;
+         _al_get_pixel_format_byte_offsets(lock_format, offsets);
       }
    }
 
+   has_alpha = set_transforms(png_ptr, info_ptr, index_only, offsets);
+
+   lock = al_lock_bitmap(bmp, lock_format, ALLEGRO_LOCK_WRITEONLY);
+   if (!lock) {
+      ALLEGRO_ERROR("al_lock_bitmap failed while loading PNG.\n");
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+
+   rows = al_malloc(height * sizeof(*rows));
+   for (y = 0; y < height; y++)
+      rows[y] = (png_bytep)lock->data + (int)y * lock->pitch;
+
+   read_rows(png_ptr, info_ptr, rows,
+      premul && has_alpha && !index_only, offsets);
+
    al_unlock_bitmap(bmp);
 
-   al_free(buf);
+   al_free(rows);
 
    /* Read rest of file, and get additional chunks in info_ptr. */
    png_read_end(png_ptr, info_ptr);
@@ -410,7 +382,7 @@ ALLEGRO_BITMAP *_al_load_png(const char *filename, int flags)
 
    ALLEGRO_ASSERT(filename);
 
-   fp = al_fopen(filename, "rb");
+   fp = _al_fopen_for_reading(filename, "rb");
    if (!fp) {
       ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
       return NULL;
@@ -426,6 +398,619 @@ ALLEGRO_BITMAP *_al_load_png(const char *filename, int flags)
 
 
 
+/*****************************************************************************
+ * Animated PNG
+ *
+ * libpng does not know about APNG, so every frame is fed to it as a PNG
+ * stream of its own: the signature, an IHDR with the frame's size, the
+ * chunks that preceded the first IDAT in the file (PLTE, tRNS, gAMA, ...)
+ * and one IDAT holding the frame's compressed data. Only the position of
+ * each frame is kept between calls; its data is read when it is decoded.
+ ****************************************************************************/
+
+
+
+#define APNG_DISPOSE_OP_NONE        0
+#define APNG_DISPOSE_OP_BACKGROUND  1
+#define APNG_DISPOSE_OP_PREVIOUS    2
+
+#define APNG_BLEND_OP_SOURCE        0
+#define APNG_BLEND_OP_OVER          1
+
+/* Signature and IHDR chunk of a frame's stream. */
+#define APNG_HEAD_SIZE  (8 + 12 + 13)
+
+typedef struct APNG_FRAME {
+   int64_t pos;         /* First chunk after the frame's fcTL. */
+   bool idat;           /* The frame's data is in IDAT, not fdAT, chunks. */
+   png_uint_32 x, y, w, h;
+   double delay;
+   int dispose_op;
+   int blend_op;
+} APNG_FRAME;
+
+typedef struct APNG {
+   unsigned char ihdr[13];
+   png_uint_32 width, height;
+   unsigned char *chunks;     /* Chunks copied into every frame's stream. */
+   size_t chunks_size;
+   _AL_VECTOR frames;
+   int next_frame;
+   int prev_frame;
+   /* Compressed data of the frame being decoded. */
+   unsigned char *zdata;
+   size_t zdata_size, zdata_cap;
+   /* Unpremultiplied RGBA: the composited image, the decoded frame and
+    * the area under a frame that is disposed of to the previous contents.
+    */
+   unsigned char *canvas;
+   unsigned char *pixels;
+   unsigned char *saved;
+   size_t pixels_cap, saved_cap;
+   png_bytepp rows;
+} APNG;
+
+typedef struct APNG_STREAM {
+   const unsigned char *data[5];
+   size_t size[5];
+   int cur;
+   size_t pos;
+} APNG_STREAM;
+
+
+
+/* read_stream:
+ *  Read function handing out the pieces of a frame's stream in turn.
+ */
+static void read_stream(png_structp png_ptr, png_bytep data, size_t length)
+{
+   APNG_STREAM *s = (APNG_STREAM *)png_get_io_ptr(png_ptr);
+
+   while (length > 0) {
+      size_t n;
+      if (s->cur == 5)
+         png_error(png_ptr, "read past the end of an APNG frame");
+      n = _ALLEGRO_MIN(length, s->size[s->cur] - s->pos);
+      memcpy(data, s->data[s->cur] + s->pos, n);
+      data += n;
+      length -= n;
+      s->pos += n;
+      if (s->pos == s->size[s->cur]) {
+         s->cur++;
+         s->pos = 0;
+      }
+   }
+}
+
+
+
+static bool grow_buffer(unsigned char **buf, size_t *cap, size_t size)
+{
+   unsigned char *p;
+
+   if (size <= *cap)
+      return true;
+   p = al_realloc(*buf, size);
+   if (!p)
+      return false;
+   *buf = p;
+   *cap = size;
+   return true;
+}
+
+
+
+/* read_frame_data:
+ *  Gathers the compressed data of a frame from its IDAT or fdAT chunks.
+ */
+static bool read_frame_data(ALLEGRO_FILE *fp, APNG *apng,
+   const APNG_FRAME *f)
+{
+   const char *type = f->idat ? "IDAT" : "fdAT";
+   /* fdAT chunks start with a sequence number. */
+   const png_uint_32 skip = f->idat ? 0 : 4;
+
+   apng->zdata_size = 0;
+
+   if (!al_fseek(fp, f->pos, ALLEGRO_SEEK_SET))
+      return false;
+
+   for (;;) {
+      unsigned char hdr[8];
+      png_uint_32 len;
+
+      if (al_fread(fp, hdr, 8) != 8)
+         return false;
+      len = png_get_uint_32(hdr);
+      if (len > PNG_UINT_31_MAX)
+         return false;
+
+      if (memcmp(hdr + 4, type, 4) == 0) {
+         size_t n;
+         if (len < skip || !al_fseek(fp, skip, ALLEGRO_SEEK_CUR))
+            return false;
+         n = len - skip;
+         if (apng->zdata_size + n > PNG_UINT_31_MAX ||
+               !grow_buffer(&apng->zdata, &apng->zdata_cap,
+                  apng->zdata_size + n))
+            return false;
+         if (al_fread(fp, apng->zdata + apng->zdata_size, n) != n)
+            return false;
+         apng->zdata_size += n;
+         if (!al_fseek(fp, 4, ALLEGRO_SEEK_CUR))
+            return false;
+      }
+      else if (apng->zdata_size > 0 || memcmp(hdr + 4, "fcTL", 4) == 0 ||
+            memcmp(hdr + 4, "IEND", 4) == 0) {
+         break;
+      }
+      else if (!al_fseek(fp, (int64_t)len + 4, ALLEGRO_SEEK_CUR)) {
+         return false;
+      }
+   }
+
+   return apng->zdata_size > 0;
+}
+
+
+
+static void put_chunk_header(unsigned char *p, png_uint_32 len,
+   const char *type)
+{
+   png_save_uint_32(p, len);
+   memcpy(p + 4, type, 4);
+}
+
+
+
+/* decode_frame:
+ *  Decodes the compressed data of a frame into apng->pixels.
+ */
+static bool decode_frame(APNG *apng, const APNG_FRAME *f)
+{
+   static const unsigned char iend[12] = {
+      0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82
+   };
+   unsigned char head[APNG_HEAD_SIZE];
+   unsigned char idat[8];
+   unsigned char tail[4 + sizeof(iend)];
+   APNG_STREAM stream;
+   jmp_buf jmpbuf;
+   png_structp png_ptr;
+   png_infop info_ptr;
+   int offsets[4];
+   png_uint_32 y;
+
+   png_save_uint_32(head, 0x89504e47);
+   png_save_uint_32(head + 4, 0x0d0a1a0a);
+   put_chunk_header(head + 8, 13, "IHDR");
+   memcpy(head + 16, apng->ihdr, 13);
+   png_save_uint_32(head + 16, f->w);
+   png_save_uint_32(head + 20, f->h);
+   png_save_uint_32(head + 29, crc32(0, head + 12, 17));
+
+   put_chunk_header(idat, apng->zdata_size, "IDAT");
+   png_save_uint_32(tail, crc32(crc32(0, idat + 4, 4), apng->zdata,
+      apng->zdata_size));
+   memcpy(tail + 4, iend, sizeof(iend));
+
+   stream.data[0] = head;
+   stream.size[0] = sizeof(head);
+   stream.data[1] = apng->chunks;
+   stream.size[1] = apng->chunks_size;
+   stream.data[2] = idat;
+   stream.size[2] = sizeof(idat);
+   stream.data[3] = apng->zdata;
+   stream.size[3] = apng->zdata_size;
+   stream.data[4] = tail;
+   stream.size[4] = sizeof(tail);
+   stream.cur = 0;
+   stream.pos = 0;
+
+   if (!grow_buffer(&apng->pixels, &apng->pixels_cap,
+         (size_t)f->w * f->h * 4))
+      return false;
+
+   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+                                    (void *)NULL, NULL, NULL);
+   if (!png_ptr)
+      return false;
+   info_ptr = png_create_info_struct(png_ptr);
+   if (!info_ptr) {
+      png_destroy_read_struct(&png_ptr, (png_infopp) NULL, (png_infopp) NULL);
+      return false;
+   }
+
+   if (setjmp(jmpbuf)) {
+      png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
+      ALLEGRO_ERROR("Error decoding APNG frame\n");
+      return false;
+   }
+   png_set_error_fn(png_ptr, jmpbuf, user_error_fn, NULL);
+   png_set_read_fn(png_ptr, &stream, (png_rw_ptr) read_stream);
+
+   png_read_info(png_ptr, info_ptr);
+
+   _al_get_pixel_format_byte_offsets(ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      offsets);
+   set_transforms(png_ptr, info_ptr, false, offsets);
+
+   for (y = 0; y < f->h; y++)
+      apng->rows[y] = apng->pixels + (size_t)y * f->w * 4;
+   read_rows(png_ptr, info_ptr, apng->rows, false, offsets);
+
+   png_read_end(png_ptr, NULL);
+   png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
+
+   return true;
+}
+
+
+
+/* copy_rect:
+ *  Copies a frame sized area between the canvas and a packed buffer.
+ */
+static void copy_rect(APNG *apng, const APNG_FRAME *f, unsigned char *buf,
+   bool to_canvas)
+{
+   png_uint_32 y;
+
+   for (y = 0; y < f->h; y++) {
+      unsigned char *p = apng->canvas +
+         (((size_t)f->y + y) * apng->width + f->x) * 4;
+      unsigned char *q = buf + (size_t)y * f->w * 4;
+      if (to_canvas)
+         memcpy(p, q, f->w * 4);
+      else
+         memcpy(q, p, f->w * 4);
+   }
+}
+
+
+
+/* blend_frame:
+ *  Composites the decoded frame onto the canvas.
+ */
+static void blend_frame(APNG *apng, const APNG_FRAME *f)
+{
+   png_uint_32 x, y;
+
+   if (f->blend_op == APNG_BLEND_OP_SOURCE) {
+      copy_rect(apng, f, apng->pixels, true);
+      return;
+   }
+
+   for (y = 0; y < f->h; y++) {
+      unsigned char *dst = apng->canvas +
+         (((size_t)f->y + y) * apng->width + f->x) * 4;
+      const unsigned char *src = apng->pixels + (size_t)y * f->w * 4;
+      for (x = 0; x < f->w; x++, dst += 4, src += 4) {
+         int sa = src[3];
+         if (sa == 255) {
+            memcpy(dst, src, 4);
+         }
+         else if (sa != 0) {
+            /* Both colours are unpremultiplied, and a is scaled by 255. */
+            int da = dst[3] * (255 - sa);
+            int a = sa * 255 + da;
+            int c;
+            for (c = 0; c < 3; c++)
+               dst[c] = (src[c] * sa * 255 + dst[c] * da + a / 2) / a;
+            dst[3] = (a + 127) / 255;
+         }
+      }
+   }
+}
+
+
+
+/* upload_rect:
+ *  Copies an area of the canvas into the animation's bitmap.
+ */
+static bool upload_rect(ALLEGRO_ANIMATED_BITMAP *anim, int x, int y,
+   int w, int h)
+{
+   APNG *apng = anim->extra;
+   bool premul = !(anim->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA);
+   ALLEGRO_LOCKED_REGION *lock;
+   int offsets[4];
+   int i;
+
+   lock = al_lock_bitmap_region(anim->bitmap, x, y, w, h,
+      ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+   if (!lock) {
+      ALLEGRO_ERROR("al_lock_bitmap failed while decoding APNG.\n");
+      return false;
+   }
+
+   _al_get_pixel_format_byte_offsets(ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      offsets);
+
+   for (i = 0; i < h; i++) {
+      png_bytep row = (png_bytep)lock->data + i * lock->pitch;
+      memcpy(row, apng->canvas + (((size_t)y + i) * apng->width + x) * 4,
+         w * 4);
+      if (premul)
+         premultiply_rows(&row, 1, w, offsets);
+   }
+
+   al_unlock_bitmap(anim->bitmap);
+   return true;
+}
+
+
+
+static bool apng_read_frame(ALLEGRO_ANIMATED_BITMAP *anim, double *duration)
+{
+   APNG *apng = anim->extra;
+   const APNG_FRAME *f;
+   int x1, y1, x2, y2;
+
+   if (apng->next_frame >= (int)_al_vector_size(&apng->frames))
+      return false;
+   f = _al_vector_ref(&apng->frames, apng->next_frame);
+
+   if (!read_frame_data(anim->fp, apng, f) || !decode_frame(apng, f)) {
+      ALLEGRO_ERROR("Could not read APNG frame %d\n", apng->next_frame);
+      return false;
+   }
+
+   x1 = f->x;
+   y1 = f->y;
+   x2 = f->x + f->w;
+   y2 = f->y + f->h;
+
+   if (apng->prev_frame >= 0) {
+      const APNG_FRAME *p = _al_vector_ref(&apng->frames, apng->prev_frame);
+      if (p->dispose_op != APNG_DISPOSE_OP_NONE) {
+         png_uint_32 y;
+         if (p->dispose_op == APNG_DISPOSE_OP_PREVIOUS) {
+            copy_rect(apng, p, apng->saved, true);
+         }
+         else {
+            for (y = 0; y < p->h; y++) {
+               memset(apng->canvas +
+                  (((size_t)p->y + y) * apng->width + p->x) * 4, 0, p->w * 4);
+            }
+         }
+         x1 = _ALLEGRO_MIN(x1, (int)p->x);
+         y1 = _ALLEGRO_MIN(y1, (int)p->y);
+         x2 = _ALLEGRO_MAX(x2, (int)(p->x + p->w));
+         y2 = _ALLEGRO_MAX(y2, (int)(p->y + p->h));
+      }
+   }
+   else {
+      /* The bitmap has not been drawn to since it was created. */
+      x1 = 0;
+      y1 = 0;
+      x2 = apng->width;
+      y2 = apng->height;
+   }
+
+   if (f->dispose_op == APNG_DISPOSE_OP_PREVIOUS) {
+      if (!grow_buffer(&apng->saved, &apng->saved_cap,
+            (size_t)f->w * f->h * 4))
+         return false;
+      copy_rect(apng, f, apng->saved, false);
+   }
+
+   blend_frame(apng, f);
+
+   if (!upload_rect(anim, x1, y1, x2 - x1, y2 - y1))
+      return false;
+
+   apng->prev_frame = apng->next_frame;
+   apng->next_frame++;
+   *duration = f->delay;
+   return true;
+}
+
+
+
+static bool apng_rewind(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   APNG *apng = anim->extra;
+
+   memset(apng->canvas, 0, (size_t)apng->width * apng->height * 4);
+   apng->next_frame = 0;
+   apng->prev_frame = -1;
+   return true;
+}
+
+
+
+static void apng_destroy(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   APNG *apng = anim->extra;
+
+   if (!apng)
+      return;
+
+   _al_vector_free(&apng->frames);
+   al_free(apng->chunks);
+   al_free(apng->zdata);
+   al_free(apng->canvas);
+   al_free(apng->pixels);
+   al_free(apng->saved);
+   al_free(apng->rows);
+   al_free(apng);
+   anim->extra = NULL;
+}
+
+
+
+static const ALLEGRO_ANIMATED_BITMAP_INTERFACE apng_vt = {
+   apng_read_frame,
+   apng_rewind,
+   apng_destroy
+};
+
+
+
+/* parse_fctl:
+ *  Reads a frame control chunk, which must fit on the canvas.
+ */
+static bool parse_fctl(APNG *apng, const unsigned char *data, APNG_FRAME *f)
+{
+   int delay_num, delay_den;
+
+   f->w = png_get_uint_32(data + 4);
+   f->h = png_get_uint_32(data + 8);
+   f->x = png_get_uint_32(data + 12);
+   f->y = png_get_uint_32(data + 16);
+   delay_num = png_get_uint_16(data + 20);
+   delay_den = png_get_uint_16(data + 22);
+   f->dispose_op = data[24];
+   f->blend_op = data[25];
+
+   /* A denominator of 0 stands for 1/100 s. */
+   f->delay = (double)delay_num / (delay_den ? delay_den : 100);
+
+   return f->w > 0 && f->h > 0 &&
+      (uint64_t)f->x + f->w <= apng->width &&
+      (uint64_t)f->y + f->h <= apng->height &&
+      f->dispose_op <= APNG_DISPOSE_OP_PREVIOUS &&
+      f->blend_op <= APNG_BLEND_OP_OVER;
+}
+
+
+
+/* index_apng:
+ *  Walks the chunks of the file, remembering where each frame starts.
+ *  A PNG without an acTL chunk has a single frame.
+ */
+static bool index_apng(ALLEGRO_ANIMATED_BITMAP *anim, APNG *apng)
+{
+   ALLEGRO_FILE *fp = anim->fp;
+   bool have_ihdr = false;
+   bool have_actl = false;
+   bool seen_idat = false;
+   size_t chunks_cap = 0;
+
+   anim->loop_count = 1;
+
+   for (;;) {
+      unsigned char hdr[8];
+      unsigned char data[26];
+      png_uint_32 len;
+      int64_t pos;
+
+      if (al_fread(fp, hdr, 8) != 8)
+         return false;
+      len = png_get_uint_32(hdr);
+      if (len > PNG_UINT_31_MAX)
+         return false;
+      pos = al_ftell(fp);
+
+      if (!have_ihdr) {
+         if (memcmp(hdr + 4, "IHDR", 4) != 0 || len != 13 ||
+               al_fread(fp, apng->ihdr, 13) != 13)
+            return false;
+         apng->width = png_get_uint_32(apng->ihdr);
+         apng->height = png_get_uint_32(apng->ihdr + 4);
+         have_ihdr = true;
+      }
+      else if (memcmp(hdr + 4, "acTL", 4) == 0 && !seen_idat) {
+         if (len != 8 || al_fread(fp, data, 8) != 8)
+            return false;
+         anim->loop_count = png_get_uint_32(data + 4);
+         have_actl = true;
+      }
+      else if (memcmp(hdr + 4, "fcTL", 4) == 0 && have_actl) {
+         APNG_FRAME *f;
+         if (len != 26 || al_fread(fp, data, 26) != 26)
+            return false;
+         f = _al_vector_alloc_back(&apng->frames);
+         if (!parse_fctl(apng, data, f)) {
+            ALLEGRO_ERROR("Invalid APNG frame control chunk\n");
+            return false;
+         }
+         f->pos = pos + len + 4;
+         f->idat = !seen_idat;
+         /* There is nothing to go back to before the first frame. */
+         if (_al_vector_size(&apng->frames) == 1 &&
+               f->dispose_op == APNG_DISPOSE_OP_PREVIOUS)
+            f->dispose_op = APNG_DISPOSE_OP_BACKGROUND;
+      }
+      else if (memcmp(hdr + 4, "IDAT", 4) == 0) {
+         if (!seen_idat && !have_actl) {
+            APNG_FRAME *f = _al_vector_alloc_back(&apng->frames);
+            f->pos = pos - 8;
+            f->idat = true;
+            f->x = f->y = 0;
+            f->w = apng->width;
+            f->h = apng->height;
+            f->delay = 0.0;
+            f->dispose_op = APNG_DISPOSE_OP_NONE;
+            f->blend_op = APNG_BLEND_OP_SOURCE;
+         }
+         seen_idat = true;
+      }
+      else if (memcmp(hdr + 4, "IEND", 4) == 0) {
+         break;
+      }
+      else if (!seen_idat && memcmp(hdr + 4, "fdAT", 4) != 0) {
+         /* Keep PLTE, tRNS, gAMA and the like for every frame. */
+         size_t n = 8 + (size_t)len + 4;
+         if (!grow_buffer(&apng->chunks, &chunks_cap, apng->chunks_size + n))
+            return false;
+         memcpy(apng->chunks + apng->chunks_size, hdr, 8);
+         if (al_fread(fp, apng->chunks + apng->chunks_size + 8, len + 4) !=
+               len + 4)
+            return false;
+         apng->chunks_size += n;
+      }
+
+      if (!al_fseek(fp, pos + len + 4, ALLEGRO_SEEK_SET))
+         return false;
+   }
+
+   return seen_idat && _al_vector_size(&apng->frames) > 0;
+}
+
+
+
+bool _al_open_animated_png(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   APNG *apng;
+   unsigned char sig[8];
+
+   if (al_fread(anim->fp, sig, 8) != 8 || png_sig_cmp(sig, 0, 8) != 0) {
+      ALLEGRO_ERROR("Not a png.\n");
+      return false;
+   }
+
+   apng = al_calloc(1, sizeof *apng);
+   if (!apng)
+      return false;
+   _al_vector_init(&apng->frames, sizeof(APNG_FRAME));
+   anim->extra = apng;
+
+   if (!index_apng(anim, apng)) {
+      ALLEGRO_ERROR("Could not read the frames of the PNG file.\n");
+      apng_destroy(anim);
+      return false;
+   }
+
+   apng->canvas = al_calloc((size_t)apng->width * apng->height, 4);
+   apng->rows = al_malloc(apng->height * sizeof(*apng->rows));
+   if (apng->canvas && apng->rows)
+      anim->bitmap = al_create_bitmap(apng->width, apng->height);
+   if (!anim->bitmap) {
+      ALLEGRO_ERROR("al_create_bitmap failed while opening APNG.\n");
+      apng_destroy(anim);
+      return false;
+   }
+
+   anim->vt = &apng_vt;
+   anim->frame_count = _al_vector_size(&apng->frames);
+   apng->prev_frame = -1;
+   return true;
+}
+
+
+
+
 /*****************************************************************************
  * Saving routines
  ****************************************************************************/
@@ -471,6 +1056,60 @@ static int translate_compression_level(const char* value) {
    return strtol(value, NULL, 10);
 }
 
+/* translate_filter:
+ *  Translate string with config value into a mask of PNG row filters.
+ *  Returns -1 to leave the choice to libpng.
+ */
+static int translate_filter(const char* value) {
+   if (!value || strcmp(value, "default") == 0) {
+      return -1;
+   }
+   if (strcmp(value, "none") == 0) {
+      return PNG_FILTER_NONE;
+   }
+   if (strcmp(value, "sub") == 0) {
+      return PNG_FILTER_SUB;
+   }
+   if (strcmp(value, "up") == 0) {
+      return PNG_FILTER_UP;
+   }
+   if (strcmp(value, "average") == 0) {
+      return PNG_FILTER_AVG;
+   }
+   if (strcmp(value, "paeth") == 0) {
+      return PNG_FILTER_PAETH;
+   }
+   if (strcmp(value, "all") == 0) {
+      return PNG_ALL_FILTERS;
+   }
+   ALLEGRO_WARN("Unknown png_filter %s, using default.\n", value);
+   return -1;
+}
+
+/* translate_strategy:
+ *  Translate string with config value into zlib's compression strategy.
+ */
+static int translate_strategy(const char* value) {
+   if (!value || strcmp(value, "default") == 0) {
+      return Z_DEFAULT_STRATEGY;
+   }
+   if (strcmp(value, "filtered") == 0) {
+      return Z_FILTERED;
+   }
+   if (strcmp(value, "huffman") == 0) {
+      return Z_HUFFMAN_ONLY;
+   }
+   if (strcmp(value, "rle") == 0) {
+      return Z_RLE;
+   }
+   if (strcmp(value, "fixed") == 0) {
+      return Z_FIXED;
+   }
+   ALLEGRO_WARN("Unknown png_compression_strategy %s, using default.\n",
+      value);
+   return Z_DEFAULT_STRATEGY;
+}
+
 /* save_rgba:
  *  Core save routine for 32 bpp images.
  */
@@ -497,6 +1136,355 @@ static int save_rgba(png_structp png_ptr, ALLEGRO_BITMAP *bmp)
 
 
 
+/*****************************************************************************
+ * Parallel saving
+ *
+ * Large images can be compressed in horizontal bands on the worker threads,
+ * the way pigz does it: every band is filtered and deflated into a raw
+ * stream of its own that ends on a byte boundary (Z_SYNC_FLUSH), so the
+ * streams can simply be concatenated inside one zlib header and an Adler-32
+ * checksum combined from those of the bands. The cost is that no band can
+ * refer back to data in the band before it.
+ ****************************************************************************/
+
+
+
+/* Images with fewer pixels are always saved on the calling thread. */
+#define PARALLEL_MIN_PIXELS (512 * 512)
+
+/* Bands shorter than this compress noticeably worse. */
+#define MIN_BAND_ROWS 64
+
+/* Size of a 32 bpp pixel, which filters use as their distance. */
+#define SAVE_BPP 4
+
+typedef struct DEFLATE_BAND {
+   unsigned char *out;
+   size_t size;
+   uLong adler;
+   bool ok;
+} DEFLATE_BAND;
+
+typedef struct DEFLATE_JOB {
+   const unsigned char *data;
+   int pitch;
+   int width, height;
+   int band_h;
+   int num_bands;
+   int filters;
+   int level;
+   int strategy;
+   DEFLATE_BAND *bands;
+} DEFLATE_JOB;
+
+
+static int paeth_predictor(int a, int b, int c)
+{
+   int p = a + b - c;
+   int pa = abs(p - a);
+   int pb = abs(p - b);
+   int pc = abs(p - c);
+
+   if (pa <= pb && pa <= pc)
+      return a;
+   if (pb <= pc)
+      return b;
+   return c;
+}
+
+
+/* filter_row:
+ *  Applies the PNG filter type to row, with prev being the row above or
+ *  NULL. Stores the filter type byte and the n filtered bytes in out and
+ *  returns the sum of their absolute signed values, the same heuristic that
+ *  libpng uses to choose between filters.
+ */
+static unsigned filter_row(int type, const unsigned char *row,
+   const unsigned char *prev, unsigned char *out, int n)
+{
+   unsigned sum = 0;
+   int i;
+
+   out[0] = type;
+   out++;
+
+   for (i = 0; i < n; i++) {
+      int a = i >= SAVE_BPP ? row[i - SAVE_BPP] : 0;
+      int b = prev ? prev[i] : 0;
+      int c = (prev && i >= SAVE_BPP) ? prev[i - SAVE_BPP] : 0;
+      unsigned char v;
+
+      switch (type) {
+         case PNG_FILTER_VALUE_SUB:
+            v = row[i] - a;
+            break;
+         case PNG_FILTER_VALUE_UP:
+            v = row[i] - b;
+            break;
+         case PNG_FILTER_VALUE_AVG:
+            v = row[i] - ((a + b) >> 1);
+            break;
+         case PNG_FILTER_VALUE_PAETH:
+            v = row[i] - paeth_predictor(a, b, c);
+            break;
+         default:
+            v = row[i];
+            break;
+      }
+
+      out[i] = v;
+      sum += v < 128 ? v : 256 - v;
+   }
+
+   return sum;
+}
+
+
+/* filter_band_row:
+ *  Filters a row with the cheapest filter allowed by the filters mask.
+ *  scratch must have room for one filtered row.
+ */
+static void filter_band_row(int filters, const unsigned char *row,
+   const unsigned char *prev, unsigned char *out, unsigned char *scratch,
+   int n)
+{
+   static const int masks[] = {
+      PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG,
+      PNG_FILTER_PAETH
+   };
+   unsigned best = UINT_MAX;
+   int type;
+
+   for (type = 0; type < 5; type++) {
+      unsigned sum;
+
+      if (!(filters & masks[type]))
+         continue;
+
+      if (best == UINT_MAX) {
+         best = filter_row(type, row, prev, out, n);
+         continue;
+      }
+
+      sum = filter_row(type, row, prev, scratch, n);
+      if (sum < best) {
+         best = sum;
+         memcpy(out, scratch, n + 1);
+      }
+   }
+}
+
+
+static void deflate_band(DEFLATE_JOB *job, int band_index)
+{
+   DEFLATE_BAND *band = &job->bands[band_index];
+   const int y0 = band_index * job->band_h;
+   const int rows = _ALLEGRO_MIN(job->band_h, job->height - y0);
+   const int n = job->width * SAVE_BPP;
+   const bool last = (band_index == job->num_bands - 1);
+   unsigned char *filtered;
+   size_t filtered_size = (size_t)(n + 1) * rows;
+   size_t capacity;
+   z_stream z;
+   int y, ret;
+
+   band->ok = false;
+
+   filtered = al_malloc(filtered_size + n + 1);
+   if (!filtered)
+      return;
+
+   for (y = 0; y < rows; y++) {
+      const unsigned char *row = job->data + (y0 + y) * job->pitch;
+      const unsigned char *prev = (y0 + y > 0) ? row - job->pitch : NULL;
+      filter_band_row(job->filters, row, prev,
+         filtered + (size_t)y * (n + 1), filtered + filtered_size, n);
+   }
+
+   band->adler = adler32(adler32(0, Z_NULL, 0), filtered, filtered_size);
+
+   memset(&z, 0, sizeof(z));
+   if (deflateInit2(&z, job->level, Z_DEFLATED, -MAX_WBITS, 8,
+         job->strategy) != Z_OK) {
+      al_free(filtered);
+      return;
+   }
+
+   /* Leave room for the empty stored block of the flush. */
+   capacity = deflateBound(&z, filtered_size) + 16;
+   band->out = al_malloc(capacity);
+   if (!band->out) {
+      deflateEnd(&z);
+      al_free(filtered);
+      return;
+   }
+
+   z.next_in = filtered;
+   z.avail_in = filtered_size;
+   z.next_out = band->out;
+   z.avail_out = capacity;
+   ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+   band->size = capacity - z.avail_out;
+   band->ok = (ret == (last ? Z_STREAM_END : Z_OK)) && z.avail_in == 0 &&
+      z.avail_out > 0;
+
+   deflateEnd(&z);
+   al_free(filtered);
+}
+
+
+static void deflate_bands(int begin, int end, void *arg)
+{
+   int i;
+
+   for (i = begin; i < end; i++)
+      deflate_band(arg, i);
+}
+
+
+/* zlib_header:
+ *  The two byte zlib header deflate would write for the level.
+ */
+static int zlib_header(int level)
+{
+   int flags;
+   int header;
+
+   if (level == Z_DEFAULT_COMPRESSION)
+      level = 6;
+   if (level < 2)
+      flags = 0;
+   else if (level < 6)
+      flags = 1;
+   else if (level == 6)
+      flags = 2;
+   else
+      flags = 3;
+
+   header = (0x78 << 8) | (flags << 6);
+   return header + 31 - header % 31;
+}
+
+
+/* write_bands:
+ *  Writes the compressed bands as IDAT chunks, the first one starting with
+ *  the zlib header and the last one ending with the checksum, and then the
+ *  IEND chunk.
+ */
+static bool write_bands(png_structp png_ptr, const DEFLATE_JOB *job,
+   uLong adler)
+{
+   jmp_buf jmpbuf;
+   unsigned char bytes[4];
+   int i;
+
+   /* Catch write errors here so that the caller can free the bands. */
+   if (setjmp(jmpbuf))
+      return false;
+   png_set_error_fn(png_ptr, jmpbuf, user_error_fn, NULL);
+
+   for (i = 0; i < job->num_bands; i++) {
+      const bool first = (i == 0);
+      const bool last = (i == job->num_bands - 1);
+      const DEFLATE_BAND *band = &job->bands[i];
+
+      png_write_chunk_start(png_ptr, (png_const_bytep)"IDAT",
+         band->size + (first ? 2 : 0) + (last ? 4 : 0));
+      if (first) {
+         int header = zlib_header(job->level);
+         bytes[0] = header >> 8;
+         bytes[1] = header & 0xff;
+         png_write_chunk_data(png_ptr, bytes, 2);
+      }
+      png_write_chunk_data(png_ptr, band->out, band->size);
+      if (last) {
+         bytes[0] = adler >> 24;
+         bytes[1] = (adler >> 16) & 0xff;
+         bytes[2] = (adler >> 8) & 0xff;
+         bytes[3] = adler & 0xff;
+         png_write_chunk_data(png_ptr, bytes, 4);
+      }
+      png_write_chunk_end(png_ptr);
+   }
+
+   png_write_chunk(png_ptr, (png_const_bytep)"IEND", NULL, 0);
+
+   return true;
+}
+
+
+/* save_rgba_parallel:
+ *  Like save_rgba followed by png_write_end, but compresses the image data
+ *  in bands on the worker threads. Returns -1 without writing anything if
+ *  the image is too small to be worth it or there is only one thread.
+ */
+static int save_rgba_parallel(png_structp png_ptr, ALLEGRO_BITMAP *bmp,
+   int filters, int level, int strategy)
+{
+   DEFLATE_JOB job;
+   ALLEGRO_JOB_POOL *pool;
+   ALLEGRO_LOCKED_REGION *lock;
+   uLong adler;
+   int num_threads;
+   int ret = 0;
+   int i;
+
+   job.width = al_get_bitmap_width(bmp);
+   job.height = al_get_bitmap_height(bmp);
+
+   if ((int64_t)job.width * job.height < PARALLEL_MIN_PIXELS ||
+         !(pool = _al_get_job_pool()) ||
+         (num_threads = al_get_job_pool_workers(pool)) < 2)
+      return -1;
+
+   job.num_bands = _ALLEGRO_MIN(num_threads * 2, job.height / MIN_BAND_ROWS);
+   if (job.num_bands < 2)
+      return -1;
+   job.band_h = (job.height + job.num_bands - 1) / job.num_bands;
+   job.num_bands = (job.height + job.band_h - 1) / job.band_h;
+
+   job.filters = filters;
+   job.level = level;
+   job.strategy = strategy;
+   job.bands = al_calloc(job.num_bands, sizeof(*job.bands));
+   if (!job.bands)
+      return 0;
+
+   lock = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      ALLEGRO_LOCK_READONLY);
+   if (!lock)
+      goto done;
+   job.data = lock->data;
+   job.pitch = lock->pitch;
+
+   al_parallel_for(pool, 0, job.num_bands, 1, deflate_bands, &job);
+
+   al_unlock_bitmap(bmp);
+
+   adler = adler32(0, Z_NULL, 0);
+   for (i = 0; i < job.num_bands; i++) {
+      int rows = _ALLEGRO_MIN(job.band_h, job.height - i * job.band_h);
+      if (!job.bands[i].ok) {
+         ALLEGRO_ERROR("Failed to compress rows %d to %d.\n",
+            i * job.band_h, i * job.band_h + rows - 1);
+         goto done;
+      }
+      adler = adler32_combine(adler, job.bands[i].adler,
+         (z_off_t)(job.width * SAVE_BPP + 1) * rows);
+   }
+
+   ret = write_bands(png_ptr, &job, adler);
+
+ done:
+   for (i = 0; i < job.num_bands; i++)
+      al_free(job.bands[i].out);
+   al_free(job.bands);
+
+   return ret;
+}
+
+
+
 /* Writes a non-interlaced, no-frills PNG, taking the usual save_xyz
  *  parameters.  Returns non-zero on error.
  */
@@ -505,7 +1493,13 @@ bool _al_save_png_f(ALLEGRO_FILE *fp, ALLEGRO_BITMAP *bmp)
    jmp_buf jmpbuf;
    png_structp png_ptr = NULL;
    png_infop info_ptr = NULL;
+   ALLEGRO_CONFIG *config = al_get_system_config();
    int colour_type;
+   int filters;
+   int z_strategy;
+   const char *value;
+   bool parallel;
+   int ret;
 
    /* Create and initialize the png_struct with the
     * desired error handler functions.
@@ -546,10 +1540,21 @@ bool _al_save_png_f(ALLEGRO_FILE *fp, ALLEGRO_BITMAP *bmp)
 
    /* Set compression level. */
    int z_level = translate_compression_level(
-      al_get_config_value(al_get_system_config(), "image", "png_compression_level")
+      al_get_config_value(config, "image", "png_compression_level")
    );
    png_set_compression_level(png_ptr, z_level);
 
+   /* Set row filters and compression strategy. */
+   filters = translate_filter(
+      al_get_config_value(config, "image", "png_filter"));
+   if (filters != -1)
+      png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
+   z_strategy = translate_strategy(
+      al_get_config_value(config, "image", "png_compression_strategy"));
+   png_set_compression_strategy(png_ptr, z_strategy);
+   value = al_get_config_value(config, "image", "png_parallel_deflate");
+   parallel = value && strcmp(value, "true") == 0;
+
    png_set_IHDR(png_ptr, info_ptr,
                 al_get_bitmap_width(bmp), al_get_bitmap_height(bmp),
                 8, colour_type,
@@ -566,12 +1571,25 @@ bool _al_save_png_f(ALLEGRO_FILE *fp, ALLEGRO_BITMAP *bmp)
     * PNG_TEXT_COMPRESSION_zTXt_WR, so it doesn't get written out again
     * at the end.
     */
-   if (!save_rgba(png_ptr, bmp)) {
-      ALLEGRO_ERROR("save_rgba failed.\n");
-      goto Error;
+   ret = -1;
+   if (parallel) {
+      /* libpng filters all rows adaptively by default. */
+      ret = save_rgba_parallel(png_ptr, bmp,
+         filters == -1 ? PNG_ALL_FILTERS : filters, z_level, z_strategy);
+      if (ret == 0) {
+         ALLEGRO_ERROR("save_rgba_parallel failed.\n");
+         goto Error;
+      }
    }
 
-   png_write_end(png_ptr, info_ptr);
+   if (ret == -1) {
+      if (!save_rgba(png_ptr, bmp)) {
+         ALLEGRO_ERROR("save_rgba failed.\n");
+         goto Error;
+      }
+
+      png_write_end(png_ptr, info_ptr);
+   }
 
    png_destroy_write_struct(&png_ptr, &info_ptr);
 
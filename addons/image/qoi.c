@@ -0,0 +1,432 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      QOI (Quite OK Image) reader and writer.
+ *
+ *      See https://qoiformat.org/qoi-specification.pdf
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern_file.h"
+#include "allegro5/internal/aintern_image.h"
+#include "allegro5/internal/aintern_pixels.h"
+
+#include "iio.h"
+
+ALLEGRO_DEBUG_CHANNEL("image")
+
+
+#define QOI_OP_INDEX  0x00
+#define QOI_OP_DIFF   0x40
+#define QOI_OP_LUMA   0x80
+#define QOI_OP_RUN    0xc0
+#define QOI_OP_RGB    0xfe
+#define QOI_OP_RGBA   0xff
+#define QOI_MASK      0xc0
+
+#define QOI_HASH(r, g, b, a)  (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) % 64)
+
+/* The format puts no limit on the size, this keeps w * h * 4 in an int. */
+#define QOI_MAX_PIXELS  400000000
+
+static const unsigned char qoi_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+
+typedef struct QOI_READER {
+   ALLEGRO_FILE *f;
+   unsigned char buf[4096];
+   int pos, len;
+   bool eof;
+} QOI_READER;
+
+
+static int qoi_getc(QOI_READER *rd)
+{
+   if (rd->pos == rd->len) {
+      rd->len = al_fread(rd->f, rd->buf, sizeof(rd->buf));
+      rd->pos = 0;
+      if (rd->len == 0) {
+         rd->eof = true;
+         return 0;
+      }
+   }
+   return rd->buf[rd->pos++];
+}
+
+
+/* The bitmap is locked in whichever of the two 32-bit formats it already has,
+ * so that unlocking it needs no conversion in the common case. Pixels are
+ * then read and written as native 32-bit words.
+ */
+static int qoi_lock_format(ALLEGRO_BITMAP *bmp)
+{
+   if (al_get_bitmap_format(bmp) == ALLEGRO_PIXEL_FORMAT_ARGB_8888)
+      return ALLEGRO_PIXEL_FORMAT_ARGB_8888;
+   return ALLEGRO_PIXEL_FORMAT_ABGR_8888;
+}
+
+
+static bool qoi_read_header(ALLEGRO_FILE *f, int *w, int *h, int *channels)
+{
+   unsigned char magic[4];
+
+   if (al_fread(f, magic, 4) != 4 || memcmp(magic, "qoif", 4) != 0)
+      return false;
+   *w = al_fread32be(f);
+   *h = al_fread32be(f);
+   *channels = al_fgetc(f);
+   al_fgetc(f); /* colour space, informative only */
+
+   if (al_feof(f) || al_ferror(f))
+      return false;
+   return *channels == 3 || *channels == 4;
+}
+
+
+ALLEGRO_BITMAP *_al_load_qoi_f(ALLEGRO_FILE *f, int flags)
+{
+   QOI_READER *rd;
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_LOCKED_REGION *lr;
+   unsigned char index[64][4];
+   unsigned char r = 0, g = 0, b = 0, a = 255;
+   bool premul = !(flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA);
+   bool argb;
+   int w, h, channels;
+   int run = 0;
+   int x, y;
+   ASSERT(f);
+
+   if (!qoi_read_header(f, &w, &h, &channels)) {
+      ALLEGRO_ERROR("Invalid QOI header.\n");
+      return NULL;
+   }
+   if (w <= 0 || h <= 0 || (int64_t)w * h > QOI_MAX_PIXELS) {
+      ALLEGRO_ERROR("Invalid QOI size %dx%d.\n", w, h);
+      return NULL;
+   }
+
+   bmp = al_create_bitmap(w, h);
+   if (!bmp) {
+      ALLEGRO_ERROR("Failed to create bitmap.\n");
+      return NULL;
+   }
+
+   argb = qoi_lock_format(bmp) == ALLEGRO_PIXEL_FORMAT_ARGB_8888;
+   lr = al_lock_bitmap(bmp, qoi_lock_format(bmp), ALLEGRO_LOCK_WRITEONLY);
+   rd = al_malloc(sizeof(*rd));
+   if (!lr || !rd) {
+      ALLEGRO_ERROR("Failed to lock bitmap.\n");
+      al_free(rd);
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+   rd->f = f;
+   rd->pos = rd->len = 0;
+   rd->eof = false;
+   memset(index, 0, sizeof(index));
+
+   for (y = 0; y < h && !rd->eof; y++) {
+      uint32_t *dest = (uint32_t *)((char *)lr->data + y * lr->pitch);
+
+      for (x = 0; x < w; x++) {
+         int pr, pg, pb;
+
+         if (run > 0) {
+            run--;
+         }
+         else {
+            int c = qoi_getc(rd);
+
+            if (c == QOI_OP_RGB) {
+               r = qoi_getc(rd);
+               g = qoi_getc(rd);
+               b = qoi_getc(rd);
+            }
+            else if (c == QOI_OP_RGBA) {
+               r = qoi_getc(rd);
+               g = qoi_getc(rd);
+               b = qoi_getc(rd);
+               a = qoi_getc(rd);
+            }
+            else if ((c & QOI_MASK) == QOI_OP_INDEX) {
+               r = index[c][0];
+               g = index[c][1];
+               b = index[c][2];
+               a = index[c][3];
+            }
+            else if ((c & QOI_MASK) == QOI_OP_DIFF) {
+               r += ((c >> 4) & 3) - 2;
+               g += ((c >> 2) & 3) - 2;
+               b += (c & 3) - 2;
+            }
+            else if ((c & QOI_MASK) == QOI_OP_LUMA) {
+               int c2 = qoi_getc(rd);
+               int dg = (c & 0x3f) - 32;
+               r += dg - 8 + ((c2 >> 4) & 0x0f);
+               g += dg;
+               b += dg - 8 + (c2 & 0x0f);
+            }
+            else {
+               run = c & 0x3f;
+            }
+
+            index[QOI_HASH(r, g, b, a)][0] = r;
+            index[QOI_HASH(r, g, b, a)][1] = g;
+            index[QOI_HASH(r, g, b, a)][2] = b;
+            index[QOI_HASH(r, g, b, a)][3] = a;
+         }
+
+         pr = r;
+         pg = g;
+         pb = b;
+         if (premul && a != 255) {
+            pr = pr * a / 255;
+            pg = pg * a / 255;
+            pb = pb * a / 255;
+         }
+         if (argb)
+            dest[x] = ((uint32_t)a << 24) | (pr << 16) | (pg << 8) | pb;
+         else
+            dest[x] = ((uint32_t)a << 24) | (pb << 16) | (pg << 8) | pr;
+      }
+   }
+
+   al_unlock_bitmap(bmp);
+
+   if (rd->eof) {
+      ALLEGRO_ERROR("Unexpected end of QOI data.\n");
+      al_free(rd);
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+
+   al_free(rd);
+   return bmp;
+}
+
+
+typedef struct QOI_WRITER {
+   ALLEGRO_FILE *f;
+   unsigned char *buf;
+   int len;
+} QOI_WRITER;
+
+
+static void qoi_flush(QOI_WRITER *wr)
+{
+   al_fwrite(wr->f, wr->buf, wr->len);
+   wr->len = 0;
+}
+
+
+bool _al_save_qoi_f(ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp)
+{
+   QOI_WRITER wr;
+   ALLEGRO_LOCKED_REGION *lr;
+   unsigned char index[64][4];
+   int pr = 0, pg = 0, pb = 0, pa = 255;
+   bool argb;
+   int w, h;
+   int run = 0;
+   int x, y;
+   ASSERT(f);
+   ASSERT(bmp);
+
+   w = al_get_bitmap_width(bmp);
+   h = al_get_bitmap_height(bmp);
+
+   al_set_errno(0);
+
+   al_fwrite(f, "qoif", 4);
+   al_fwrite32be(f, w);
+   al_fwrite32be(f, h);
+   al_fputc(f, _al_pixel_format_has_alpha(al_get_bitmap_format(bmp)) ? 4 : 3);
+   al_fputc(f, 0);      /* sRGB with linear alpha */
+
+   argb = qoi_lock_format(bmp) == ALLEGRO_PIXEL_FORMAT_ARGB_8888;
+   lr = al_lock_bitmap(bmp, qoi_lock_format(bmp), ALLEGRO_LOCK_READONLY);
+   /* A row is written at a time. Each pixel takes at most 5 bytes, and
+    * a run can only end in one byte more.
+    */
+   wr.f = f;
+   wr.buf = al_malloc(w * 5 + 1);
+   wr.len = 0;
+   if (!lr || !wr.buf) {
+      ALLEGRO_ERROR("Failed to lock bitmap.\n");
+      if (lr)
+         al_unlock_bitmap(bmp);
+      al_free(wr.buf);
+      return false;
+   }
+   memset(index, 0, sizeof(index));
+
+   for (y = 0; y < h; y++) {
+      const uint32_t *src =
+         (const uint32_t *)((const char *)lr->data + y * lr->pitch);
+
+      for (x = 0; x < w; x++) {
+         const uint32_t c = src[x];
+         const int a = c >> 24;
+         const int g = (c >> 8) & 0xff;
+         const int r = argb ? (c >> 16) & 0xff : c & 0xff;
+         const int b = argb ? c & 0xff : (c >> 16) & 0xff;
+         unsigned char *e;
+
+         if (r == pr && g == pg && b == pb && a == pa) {
+            run++;
+            if (run == 62) {
+               wr.buf[wr.len++] = QOI_OP_RUN | (run - 1);
+               run = 0;
+            }
+            continue;
+         }
+         if (run > 0) {
+            wr.buf[wr.len++] = QOI_OP_RUN | (run - 1);
+            run = 0;
+         }
+
+         e = index[QOI_HASH(r, g, b, a)];
+         if (e[0] == r && e[1] == g && e[2] == b && e[3] == a) {
+            wr.buf[wr.len++] = QOI_OP_INDEX | QOI_HASH(r, g, b, a);
+         }
+         else {
+            e[0] = r;
+            e[1] = g;
+            e[2] = b;
+            e[3] = a;
+
+            if (a == pa) {
+               const int dr = (signed char)(r - pr);
+               const int dg = (signed char)(g - pg);
+               const int db = (signed char)(b - pb);
+               const int dr_dg = dr - dg;
+               const int db_dg = db - dg;
+
+               if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+                     db >= -2 && db <= 1) {
+                  wr.buf[wr.len++] = QOI_OP_DIFF |
+                     (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+               }
+               else if (dg >= -32 && dg <= 31 &&
+                     dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                  wr.buf[wr.len++] = QOI_OP_LUMA | (dg + 32);
+                  wr.buf[wr.len++] = (dr_dg + 8) << 4 | (db_dg + 8);
+               }
+               else {
+                  wr.buf[wr.len++] = QOI_OP_RGB;
+                  wr.buf[wr.len++] = r;
+                  wr.buf[wr.len++] = g;
+                  wr.buf[wr.len++] = b;
+               }
+            }
+            else {
+               wr.buf[wr.len++] = QOI_OP_RGBA;
+               wr.buf[wr.len++] = r;
+               wr.buf[wr.len++] = g;
+               wr.buf[wr.len++] = b;
+               wr.buf[wr.len++] = a;
+            }
+         }
+
+         pr = r;
+         pg = g;
+         pb = b;
+         pa = a;
+      }
+
+      qoi_flush(&wr);
+   }
+
+   if (run > 0) {
+      wr.buf[wr.len++] = QOI_OP_RUN | (run - 1);
+      qoi_flush(&wr);
+   }
+   al_fwrite(f, qoi_padding, sizeof(qoi_padding));
+
+   al_unlock_bitmap(bmp);
+   al_free(wr.buf);
+
+   return al_get_errno() || al_ferror(f) ? false : true;
+}
+
+
+ALLEGRO_BITMAP *_al_load_qoi(const char *filename, int flags)
+{
+   ALLEGRO_FILE *f;
+   ALLEGRO_BITMAP *bmp;
+   ASSERT(filename);
+
+   f = _al_fopen_for_reading(filename, "rb");
+   if (!f) {
+      ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
+      return NULL;
+   }
+
+   bmp = _al_load_qoi_f(f, flags);
+
+   al_fclose(f);
+
+   return bmp;
+}
+
+
+bool _al_save_qoi(const char *filename, ALLEGRO_BITMAP *bmp)
+{
+   ALLEGRO_FILE *f;
+   bool retsave;
+   bool retclose;
+   ASSERT(filename);
+
+   f = al_fopen(filename, "wb");
+   if (!f) {
+      ALLEGRO_ERROR("Unable to open %s for writing.\n", filename);
+      return false;
+   }
+
+   retsave = _al_save_qoi_f(f, bmp);
+
+   retclose = al_fclose(f);
+
+   return retsave && retclose;
+}
+
+
+bool _al_identify_qoi(ALLEGRO_FILE *f)
+{
+   uint8_t x[4];
+   if (al_fread(f, x, 4) != 4)
+      return false;
+   return memcmp(x, "qoif", 4) == 0;
+}
+
+
+bool _al_probe_qoi(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   int w, h, channels;
+
+   if (!qoi_read_header(f, &w, &h, &channels))
+      return false;
+
+   info->width = w;
+   info->height = h;
+   info->channels = channels;
+   info->bit_depth = 8;
+
+   return w > 0 && h > 0;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
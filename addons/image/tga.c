@@ -21,9 +21,11 @@
  *      See readme.txt for copyright information.
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern_file.h"
 #include "allegro5/internal/aintern_image.h"
 #include "allegro5/internal/aintern_pixels.h"
 
@@ -648,7 +650,7 @@ ALLEGRO_BITMAP *_al_load_tga(const char *filename, int flags)
    ALLEGRO_BITMAP *bmp;
    ASSERT(filename);
 
-   f = al_fopen(filename, "rb");
+   f = _al_fopen_for_reading(filename, "rb");
    if (!f) {
       ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
       return NULL;
@@ -699,5 +701,35 @@ bool _al_identify_tga(ALLEGRO_FILE *f)
    return true;
 }
 
+bool _al_probe_tga(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info)
+{
+   uint8_t x[18];
+   int palette_entry_size;
+
+   if (al_fread(f, x, 18) != 18)
+      return false;
+
+   info->width = x[12] | (x[13] << 8);
+   info->height = x[14] | (x[15] << 8);
+   info->bit_depth = x[16];
+   palette_entry_size = x[7];
+
+   switch (x[2] & 7) {
+      case 1:
+         info->channels = palette_entry_size == 32 ? 4 : 3;
+         break;
+      case 2:
+         info->channels = info->bit_depth == 32 ? 4 : 3;
+         break;
+      case 3:
+         info->channels = 1;
+         break;
+      default:
+         return false;
+   }
+
+   return info->width > 0 && info->height > 0;
+}
+
 
 /* vim: set sts=3 sw=3 et: */
@@ -5,6 +5,9 @@
 
 #include <webp/decode.h>
 #include <webp/encode.h>
+#ifdef ALLEGRO_CFG_IIO_HAVE_WEBPDEMUX
+#include <webp/demux.h>
+#endif
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_image.h"
@@ -185,4 +188,145 @@ bool _al_save_webp(const char *filename, ALLEGRO_BITMAP *bmp)
    return retsave && retclose;
 }
 
+
+
+#ifdef ALLEGRO_CFG_IIO_HAVE_WEBPDEMUX
+
+/*****************************************************************************
+ * Animation routines
+ ****************************************************************************/
+
+
+typedef struct ANIM_WEBP {
+   uint8_t *data;
+   WebPAnimDecoder *dec;
+   int timestamp;
+} ANIM_WEBP;
+
+
+static bool anim_webp_read_frame(ALLEGRO_ANIMATED_BITMAP *anim,
+   double *duration)
+{
+   ANIM_WEBP *webp = anim->extra;
+   ALLEGRO_LOCKED_REGION *lock;
+   uint8_t *canvas;
+   int timestamp;
+   int w = al_get_bitmap_width(anim->bitmap);
+   int h = al_get_bitmap_height(anim->bitmap);
+   int y;
+
+   if (!WebPAnimDecoderHasMoreFrames(webp->dec))
+      return false;
+
+   if (!WebPAnimDecoderGetNext(webp->dec, &canvas, &timestamp)) {
+      ALLEGRO_ERROR("Could not decode WebP frame\n");
+      return false;
+   }
+
+   /* The decoder keeps the canvas, so it has to be copied. */
+   lock = al_lock_bitmap(anim->bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      ALLEGRO_LOCK_WRITEONLY);
+   if (!lock) {
+      ALLEGRO_ERROR("Failed to lock bitmap.\n");
+      return false;
+   }
+   for (y = 0; y < h; y++) {
+      memcpy((uint8_t *)lock->data + y * lock->pitch, canvas + y * w * 4,
+         w * 4);
+   }
+   al_unlock_bitmap(anim->bitmap);
+
+   /* Timestamps are when each frame ends, in milliseconds. */
+   *duration = (timestamp - webp->timestamp) / 1000.0;
+   webp->timestamp = timestamp;
+   return true;
+}
+
+
+static bool anim_webp_rewind(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ANIM_WEBP *webp = anim->extra;
+
+   WebPAnimDecoderReset(webp->dec);
+   webp->timestamp = 0;
+   return true;
+}
+
+
+static void anim_webp_destroy(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ANIM_WEBP *webp = anim->extra;
+
+   if (webp->dec)
+      WebPAnimDecoderDelete(webp->dec);
+   al_free(webp->data);
+   al_free(webp);
+   anim->extra = NULL;
+}
+
+
+static const ALLEGRO_ANIMATED_BITMAP_INTERFACE anim_webp_vt = {
+   anim_webp_read_frame,
+   anim_webp_rewind,
+   anim_webp_destroy
+};
+
+
+bool _al_open_animated_webp(ALLEGRO_ANIMATED_BITMAP *anim)
+{
+   ANIM_WEBP *webp;
+   WebPAnimDecoderOptions options;
+   WebPAnimInfo info;
+   WebPData webp_data;
+   size_t data_size;
+
+   webp = al_calloc(1, sizeof *webp);
+   if (!webp)
+      return false;
+   anim->extra = webp;
+
+   /* WebPAnimDecoder works on the compressed file in memory, which is
+    * still much smaller than the decoded frames.
+    */
+   data_size = al_fsize(anim->fp);
+   webp->data = al_malloc(data_size);
+   if (!webp->data || al_fread(anim->fp, webp->data, data_size) != data_size) {
+      ALLEGRO_ERROR("Could not read WebP file\n");
+      anim_webp_destroy(anim);
+      return false;
+   }
+
+   if (!WebPAnimDecoderOptionsInit(&options)) {
+      anim_webp_destroy(anim);
+      return false;
+   }
+   options.color_mode = (anim->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) ?
+      MODE_RGBA : MODE_rgbA;
+   options.use_threads = 0;
+
+   webp_data.bytes = webp->data;
+   webp_data.size = data_size;
+   webp->dec = WebPAnimDecoderNew(&webp_data, &options);
+   if (!webp->dec || !WebPAnimDecoderGetInfo(webp->dec, &info)) {
+      ALLEGRO_ERROR("Could not read WebP stream info\n");
+      anim_webp_destroy(anim);
+      return false;
+   }
+
+   anim->bitmap = al_create_bitmap(info.canvas_width, info.canvas_height);
+   if (!anim->bitmap) {
+      ALLEGRO_ERROR("al_create_bitmap failed while opening WebP.\n");
+      anim_webp_destroy(anim);
+      return false;
+   }
+
+   anim->vt = &anim_webp_vt;
+   anim->frame_count = info.frame_count;
+   anim->loop_count = info.loop_count;
+   return true;
+}
+
+#endif /* ALLEGRO_CFG_IIO_HAVE_WEBPDEMUX */
+
+
 /* vim: set sts=3 sw=3 et: */
@@ -1,5 +1,7 @@
 #include <allegro5/allegro.h>
 #include "allegro5/allegro_memfile.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
 
 typedef struct ALLEGRO_FILE_MEMFILE ALLEGRO_FILE_MEMFILE;
 
@@ -11,11 +13,45 @@ struct ALLEGRO_FILE_MEMFILE {
    int64_t size;
    int64_t pos;
    char *mem;
+
+   /* Dynamic memfiles own mem and grow it as needed. */
+   bool dynamic;
+   int64_t capacity;
 };
 
 static bool memfile_fclose(ALLEGRO_FILE *fp)
 {
-   al_free(al_get_file_userdata(fp));
+   ALLEGRO_FILE_MEMFILE *mf = al_get_file_userdata(fp);
+
+   if (mf->dynamic)
+      al_free(mf->mem);
+   al_free(mf);
+   return true;
+}
+
+/* Grows the buffer of a dynamic memfile to hold at least 'needed' bytes,
+ * doubling the capacity so that a series of small writes is amortised.
+ */
+static bool memfile_grow(ALLEGRO_FILE_MEMFILE *mf, int64_t needed)
+{
+   int64_t capacity = mf->capacity > 0 ? mf->capacity : 256;
+   char *mem;
+
+   while (capacity < needed)
+      capacity *= 2;
+   if ((uint64_t)(size_t)capacity != (uint64_t)capacity) {
+      al_set_errno(ENOMEM);
+      return false;
+   }
+
+   mem = al_realloc(mf->mem, capacity);
+   if (!mem) {
+      al_set_errno(ENOMEM);
+      return false;
+   }
+
+   mf->mem = mem;
+   mf->capacity = capacity;
    return true;
 }
 
@@ -53,6 +89,13 @@ static size_t memfile_fwrite(ALLEGRO_FILE *fp, const void *ptr, size_t size)
       al_set_errno(EPERM);
       return 0;
    }   
+
+   if (mf->dynamic && mf->pos + (int64_t)size > mf->size) {
+      if (mf->pos + (int64_t)size > mf->capacity)
+         memfile_grow(mf, mf->pos + size);
+      /* Extend the file as far as the buffer allows. */
+      mf->size = _ALLEGRO_MIN(mf->pos + (int64_t)size, mf->capacity);
+   }
    
    if (mf->size - mf->pos < (int64_t)size) {
       /* partial write */
@@ -196,6 +239,67 @@ ALLEGRO_FILE *al_open_memfile(void *mem, int64_t size, const char *mode)
    return memfile;
 }
 
+/* Function: al_open_memfile_dynamic
+ */
+ALLEGRO_FILE *al_open_memfile_dynamic(int64_t initial_capacity)
+{
+   ALLEGRO_FILE *memfile;
+   ALLEGRO_FILE_MEMFILE *userdata;
+
+   ASSERT(initial_capacity >= 0);
+
+   userdata = al_calloc(1, sizeof(ALLEGRO_FILE_MEMFILE));
+   if (!userdata) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   userdata->readable = true;
+   userdata->writable = true;
+   userdata->dynamic = true;
+
+   if (initial_capacity > 0 && !memfile_grow(userdata, initial_capacity)) {
+      al_free(userdata);
+      return NULL;
+   }
+
+   memfile = al_create_file_handle(&memfile_vtable, userdata);
+   if (!memfile) {
+      al_free(userdata->mem);
+      al_free(userdata);
+   }
+
+   return memfile;
+}
+
+/* Function: al_take_memfile_buffer
+ */
+void *al_take_memfile_buffer(ALLEGRO_FILE *fp, int64_t *size)
+{
+   ALLEGRO_FILE_MEMFILE *mf;
+   void *mem;
+
+   ASSERT(fp);
+
+   if (fp->vtable != &memfile_vtable)
+      return NULL;
+   mf = al_get_file_userdata(fp);
+   if (!mf->dynamic)
+      return NULL;
+
+   mem = mf->mem;
+   if (size)
+      *size = mf->size;
+
+   mf->mem = NULL;
+   mf->capacity = 0;
+   mf->size = 0;
+   mf->pos = 0;
+   mf->eof = false;
+
+   return mem;
+}
+
 /* Function: al_get_allegro_memfile_version
  */
 uint32_t al_get_allegro_memfile_version(void)
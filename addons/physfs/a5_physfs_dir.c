@@ -7,9 +7,12 @@
 #include <physfs.h>
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_physfs.h"
+#include "allegro5/internal/aintern_exitfunc.h"
 
 #include "allegro_physfs_intern.h"
 
+ALLEGRO_DEBUG_CHANNEL("physfs")
+
 #if defined(ENOTSUP)
    #define NOTSUP ENOTSUP
 #elif defined(ENOSYS)
@@ -27,6 +30,10 @@ struct ALLEGRO_FS_ENTRY_PHYSFS
    ALLEGRO_PATH *path;
    const char *path_cstr;
 
+   /* Stat results, refreshed by fs_phys_update_entry. */
+   bool exists;
+   PHYSFS_Stat stat;
+
    /* For directory listing. */
    char **file_list;
    char **file_list_pos;
@@ -36,6 +43,37 @@ struct ALLEGRO_FS_ENTRY_PHYSFS
 /* forward declaration */
 static const ALLEGRO_FS_INTERFACE fs_phys_vtable;
 
+/* Every PHYSFS_stat walks the whole search path, which is slow with many
+ * large archives mounted, so stat results (including failures) are kept
+ * in a hash table keyed by path.
+ *
+ * PhysFS doesn't tell us when the search path changes, so its directory
+ * names are hashed on each lookup and the cache is emptied when that hash
+ * changes. Mounted directories may also change behind PhysFS's back, so
+ * the cache is only used while nothing but archives is mounted. Writes
+ * can't change what is visible then, as they go to the write directory.
+ */
+#define STAT_CACHE_MAX_COUNT  (1 << 20)
+
+typedef struct STAT_CACHE_ENTRY
+{
+   char *path;          /* NULL for an empty slot */
+   uint32_t hash;
+   bool exists;
+   PHYSFS_Stat stat;
+} STAT_CACHE_ENTRY;
+
+static struct
+{
+   ALLEGRO_MUTEX *mutex;
+   STAT_CACHE_ENTRY *entries;
+   int capacity;        /* zero or a power of two */
+   int count;
+   bool checked;        /* the next two are up to date */
+   uint64_t search_path_hash;
+   bool usable;         /* only archives are mounted */
+} stat_cache;
+
 /* current working directory */
 /* We cannot use ALLEGRO_USTR because we have nowhere to free it. */
 static char fs_phys_cwd[1024] = "/";
@@ -66,6 +104,192 @@ ALLEGRO_USTR *_al_physfs_process_path(const char *path)
    return us;
 }
 
+static uint32_t hash_path(const char *path)
+{
+   uint32_t hash = 2166136261u;
+
+   for (; *path; path++) {
+      hash ^= (unsigned char)*path;
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+static void clear_stat_cache_locked(void)
+{
+   int i;
+
+   for (i = 0; i < stat_cache.capacity; i++)
+      al_free(stat_cache.entries[i].path);
+   al_free(stat_cache.entries);
+   stat_cache.entries = NULL;
+   stat_cache.capacity = 0;
+   stat_cache.count = 0;
+}
+
+static void clear_stat_cache(void)
+{
+   if (!stat_cache.mutex)
+      return;
+   al_lock_mutex(stat_cache.mutex);
+   clear_stat_cache_locked();
+   stat_cache.checked = false;
+   al_unlock_mutex(stat_cache.mutex);
+}
+
+static void hash_search_path_entry(void *data, const char *dir)
+{
+   uint64_t *hash = data;
+
+   for (; *dir; dir++) {
+      *hash ^= (unsigned char)*dir;
+      *hash *= UINT64_C(0x100000001b3);
+   }
+   *hash ^= '\n';
+   *hash *= UINT64_C(0x100000001b3);
+}
+
+/* Whether everything on the search path is an archive on disk, rather than
+ * a directory.
+ */
+static bool only_archives_mounted(void)
+{
+   const ALLEGRO_FS_INTERFACE *old = al_get_fs_interface();
+   char **list = PHYSFS_getSearchPath();
+   char **dir;
+   bool ret = (list != NULL);
+
+   al_set_standard_fs_interface();
+   for (dir = list; ret && *dir; dir++) {
+      ALLEGRO_FS_ENTRY *e = al_create_fs_entry(*dir);
+      ret = e && (al_get_fs_entry_mode(e) & ALLEGRO_FILEMODE_ISFILE);
+      al_destroy_fs_entry(e);
+   }
+   al_set_fs_interface(old);
+
+   PHYSFS_freeList(list);
+   return ret;
+}
+
+/* Must be called with the cache locked. */
+static void check_search_path(void)
+{
+   uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+   PHYSFS_getSearchPathCallback(hash_search_path_entry, &hash);
+   if (stat_cache.checked && hash == stat_cache.search_path_hash)
+      return;
+
+   clear_stat_cache_locked();
+   stat_cache.checked = true;
+   stat_cache.search_path_hash = hash;
+   stat_cache.usable = only_archives_mounted();
+   ALLEGRO_DEBUG("Search path changed, stat cache %s.\n",
+      stat_cache.usable ? "enabled" : "disabled");
+}
+
+/* Must be called with the cache locked. */
+static bool grow_stat_cache(void)
+{
+   STAT_CACHE_ENTRY *old = stat_cache.entries;
+   int old_capacity = stat_cache.capacity;
+   int capacity = old_capacity ? old_capacity * 2 : 256;
+   int mask = capacity - 1;
+   int i;
+
+   stat_cache.entries = al_calloc(capacity, sizeof *stat_cache.entries);
+   if (!stat_cache.entries) {
+      stat_cache.entries = old;
+      return false;
+   }
+   stat_cache.capacity = capacity;
+
+   for (i = 0; i < old_capacity; i++) {
+      int j;
+      if (!old[i].path)
+         continue;
+      j = old[i].hash & mask;
+      while (stat_cache.entries[j].path)
+         j = (j + 1) & mask;
+      stat_cache.entries[j] = old[i];
+   }
+   al_free(old);
+   return true;
+}
+
+/* cached_stat:
+ *  PHYSFS_stat with the results cached. path must be absolute, as
+ *  returned by _al_physfs_process_path.
+ */
+static bool cached_stat(const char *path, PHYSFS_Stat *stat)
+{
+   STAT_CACHE_ENTRY *entry;
+   uint32_t hash;
+   int mask;
+   int i;
+   bool exists;
+
+   /* The cache is gone after al_uninstall_system. */
+   if (!stat_cache.mutex)
+      return PHYSFS_stat(path, stat) != 0;
+
+   al_lock_mutex(stat_cache.mutex);
+
+   check_search_path();
+   if (!stat_cache.usable) {
+      al_unlock_mutex(stat_cache.mutex);
+      return PHYSFS_stat(path, stat) != 0;
+   }
+
+   hash = hash_path(path);
+   mask = stat_cache.capacity - 1;
+   for (i = hash & mask; stat_cache.capacity > 0 &&
+         stat_cache.entries[i].path; i = (i + 1) & mask) {
+      entry = &stat_cache.entries[i];
+      if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+         *stat = entry->stat;
+         exists = entry->exists;
+         al_unlock_mutex(stat_cache.mutex);
+         return exists;
+      }
+   }
+
+   exists = PHYSFS_stat(path, stat) != 0;
+
+   if (stat_cache.count >= STAT_CACHE_MAX_COUNT)
+      clear_stat_cache_locked();
+   /* Keep the hash table at most half full. */
+   if (2 * (stat_cache.count + 1) > stat_cache.capacity &&
+         !grow_stat_cache()) {
+      al_unlock_mutex(stat_cache.mutex);
+      return exists;
+   }
+
+   mask = stat_cache.capacity - 1;
+   for (i = hash & mask; stat_cache.entries[i].path; i = (i + 1) & mask)
+      ;
+   entry = &stat_cache.entries[i];
+   entry->path = al_malloc(strlen(path) + 1);
+   if (entry->path) {
+      strcpy(entry->path, path);
+      entry->hash = hash;
+      entry->exists = exists;
+      entry->stat = *stat;
+      stat_cache.count++;
+   }
+
+   al_unlock_mutex(stat_cache.mutex);
+   return exists;
+}
+
+static void shutdown_stat_cache(void)
+{
+   clear_stat_cache_locked();
+   stat_cache.checked = false;
+   al_destroy_mutex(stat_cache.mutex);
+   stat_cache.mutex = NULL;
+}
+
 static ALLEGRO_FS_ENTRY *fs_phys_create_entry(const char *path)
 {
    ALLEGRO_FS_ENTRY_PHYSFS *e;
@@ -84,6 +308,7 @@ static ALLEGRO_FS_ENTRY *fs_phys_create_entry(const char *path)
       return NULL;
    }
    e->path_cstr = al_path_cstr(e->path, '/');
+   e->exists = cached_stat(e->path_cstr, &e->stat);
    return &e->fs_entry;
 }
 
@@ -118,8 +343,10 @@ static bool fs_phys_change_directory(const char *path)
 
    ret = false;
 
-   if (!PHYSFS_stat(al_cstr(us), &stat))
+   if (!cached_stat(al_cstr(us), &stat)) {
+      al_ustr_free(us);
       return false;
+   }
 
    if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY ) {
       ensure_trailing_slash(us);
@@ -140,9 +367,10 @@ static bool fs_phys_filename_exists(const char *path)
 {
    ALLEGRO_USTR *us;
    bool ret;
+   PHYSFS_Stat stat;
 
    us = _al_physfs_process_path(path);
-   ret = PHYSFS_exists(al_cstr(us)) ? true : false;
+   ret = cached_stat(al_cstr(us), &stat);
    al_ustr_free(us);
    return ret;
 }
@@ -177,31 +405,27 @@ static const char *fs_phys_entry_name(ALLEGRO_FS_ENTRY *fse)
 
 static bool fs_phys_update_entry(ALLEGRO_FS_ENTRY *fse)
 {
-   (void)fse;
+   ALLEGRO_FS_ENTRY_PHYSFS *e = (ALLEGRO_FS_ENTRY_PHYSFS *)fse;
+   e->exists = cached_stat(e->path_cstr, &e->stat);
    return true;
 }
 
 static off_t fs_phys_entry_size(ALLEGRO_FS_ENTRY *fse)
 {
    ALLEGRO_FS_ENTRY_PHYSFS *e = (ALLEGRO_FS_ENTRY_PHYSFS *)fse;
-   PHYSFS_file *f = PHYSFS_openRead(e->path_cstr);
-   if (f) {
-      off_t s = PHYSFS_fileLength(f);
-      PHYSFS_close(f);
-      return s;
-   }
-   return 0;
+   if (!e->exists || e->stat.filesize < 0)
+      return 0;
+   return e->stat.filesize;
 }
 
 static uint32_t fs_phys_entry_mode(ALLEGRO_FS_ENTRY *fse)
 {
    ALLEGRO_FS_ENTRY_PHYSFS *e = (ALLEGRO_FS_ENTRY_PHYSFS *)fse;
    uint32_t mode = ALLEGRO_FILEMODE_READ;
-   PHYSFS_Stat stat;
-   if (!PHYSFS_stat(e->path_cstr, &stat))
+   if (!e->exists)
       return mode;
 
-   if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY )
+   if (e->stat.filetype == PHYSFS_FILETYPE_DIRECTORY )
       mode |= ALLEGRO_FILEMODE_ISDIR | ALLEGRO_FILEMODE_EXECUTE;
    else
       mode |= ALLEGRO_FILEMODE_ISFILE;
@@ -211,16 +435,15 @@ static uint32_t fs_phys_entry_mode(ALLEGRO_FS_ENTRY *fse)
 static time_t fs_phys_entry_mtime(ALLEGRO_FS_ENTRY *fse)
 {
    ALLEGRO_FS_ENTRY_PHYSFS *e = (ALLEGRO_FS_ENTRY_PHYSFS *)fse;
-   PHYSFS_Stat stat;
-   if (!PHYSFS_stat(e->path_cstr, &stat))
+   if (!e->exists)
       return -1;
-   return stat.modtime;
+   return e->stat.modtime;
 }
 
 static bool fs_phys_entry_exists(ALLEGRO_FS_ENTRY *fse)
 {
    ALLEGRO_FS_ENTRY_PHYSFS *e = (ALLEGRO_FS_ENTRY_PHYSFS *)fse;
-   return PHYSFS_exists(e->path_cstr) != 0;
+   return e->exists;
 }
 
 static bool fs_phys_remove_entry(ALLEGRO_FS_ENTRY *fse)
@@ -315,6 +538,11 @@ static const ALLEGRO_FS_INTERFACE fs_phys_vtable =
 
 void _al_set_physfs_fs_interface(void)
 {
+   if (!stat_cache.mutex) {
+      stat_cache.mutex = al_create_mutex();
+      _al_add_exit_func(shutdown_stat_cache, "shutdown_stat_cache");
+   }
+   clear_stat_cache();
    al_set_fs_interface(&fs_phys_vtable);
 }
 
@@ -111,7 +111,10 @@ typedef enum ALLEGRO_PRIM_BUFFER_FLAGS
    ALLEGRO_PRIM_BUFFER_STREAM       = 0x01,
    ALLEGRO_PRIM_BUFFER_STATIC       = 0x02,
    ALLEGRO_PRIM_BUFFER_DYNAMIC      = 0x04,
-   ALLEGRO_PRIM_BUFFER_READWRITE    = 0x08
+   ALLEGRO_PRIM_BUFFER_READWRITE    = 0x08,
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+   ALLEGRO_PRIM_BUFFER_PRIMITIVE_RESTART = 0x10
+#endif
 } ALLEGRO_PRIM_BUFFER_FLAGS;
 
 /* Enum: ALLEGRO_VERTEX_CACHE_SIZE
@@ -159,6 +162,21 @@ typedef struct ALLEGRO_VERTEX_BUFFER ALLEGRO_VERTEX_BUFFER;
  */
 typedef struct ALLEGRO_INDEX_BUFFER ALLEGRO_INDEX_BUFFER;
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+/* Type: ALLEGRO_DRAW_RANGE
+ */
+typedef struct ALLEGRO_DRAW_RANGE ALLEGRO_DRAW_RANGE;
+
+struct ALLEGRO_DRAW_RANGE {
+   int start;
+   int end;
+};
+
+/* Type: ALLEGRO_TILE_LAYER
+ */
+typedef struct ALLEGRO_TILE_LAYER ALLEGRO_TILE_LAYER;
+#endif
+
 ALLEGRO_PRIM_FUNC(uint32_t, al_get_allegro_primitives_version, (void));
 
 /*
@@ -172,6 +190,14 @@ ALLEGRO_PRIM_FUNC(int, al_draw_indexed_prim, (const void* vtxs, const ALLEGRO_VE
 ALLEGRO_PRIM_FUNC(int, al_draw_vertex_buffer, (ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BITMAP* texture, int start, int end, int type));
 ALLEGRO_PRIM_FUNC(int, al_draw_indexed_buffer, (ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BITMAP* texture, ALLEGRO_INDEX_BUFFER* index_buffer, int start, int end, int type));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+ALLEGRO_PRIM_FUNC(void, al_hold_primitive_drawing, (bool hold));
+ALLEGRO_PRIM_FUNC(bool, al_is_primitive_drawing_held, (void));
+ALLEGRO_PRIM_FUNC(void, al_set_primitive_antialiasing, (bool onoff));
+ALLEGRO_PRIM_FUNC(bool, al_get_primitive_antialiasing, (void));
+ALLEGRO_PRIM_FUNC(int, al_draw_indexed_buffer_multi, (ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BITMAP* texture, ALLEGRO_INDEX_BUFFER* index_buffer, const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int type));
+#endif
+
 ALLEGRO_PRIM_FUNC(ALLEGRO_VERTEX_DECL*, al_create_vertex_decl, (const ALLEGRO_VERTEX_ELEMENT* elements, int stride));
 ALLEGRO_PRIM_FUNC(void, al_destroy_vertex_decl, (ALLEGRO_VERTEX_DECL* decl));
 
@@ -192,6 +218,21 @@ ALLEGRO_PRIM_FUNC(void, al_destroy_index_buffer, (ALLEGRO_INDEX_BUFFER* buffer))
 ALLEGRO_PRIM_FUNC(void*, al_lock_index_buffer, (ALLEGRO_INDEX_BUFFER* buffer, int offset, int length, int flags));
 ALLEGRO_PRIM_FUNC(void, al_unlock_index_buffer, (ALLEGRO_INDEX_BUFFER* buffer));
 ALLEGRO_PRIM_FUNC(int, al_get_index_buffer_size, (ALLEGRO_INDEX_BUFFER* buffer));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+ALLEGRO_PRIM_FUNC(int, al_get_index_buffer_index_size, (ALLEGRO_INDEX_BUFFER* buffer));
+ALLEGRO_PRIM_FUNC(bool, al_set_shader_storage_buffer, (const char* name, ALLEGRO_VERTEX_BUFFER* buffer, int binding));
+#endif
+
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+/*
+ * Tile layers
+ */
+ALLEGRO_PRIM_FUNC(ALLEGRO_TILE_LAYER*, al_create_tile_layer, (ALLEGRO_BITMAP* atlas, int tile_w, int tile_h, int width, int height, const int* tiles, int flags));
+ALLEGRO_PRIM_FUNC(void, al_destroy_tile_layer, (ALLEGRO_TILE_LAYER* layer));
+ALLEGRO_PRIM_FUNC(bool, al_set_tile_layer_tile, (ALLEGRO_TILE_LAYER* layer, int x, int y, int tile));
+ALLEGRO_PRIM_FUNC(int, al_get_tile_layer_tile, (const ALLEGRO_TILE_LAYER* layer, int x, int y));
+ALLEGRO_PRIM_FUNC(int, al_draw_tile_layer, (ALLEGRO_TILE_LAYER* layer, float dx, float dy));
+#endif
 
 /*
 * Utilities for high level primitives.
@@ -229,6 +270,10 @@ ALLEGRO_PRIM_FUNC(void, al_draw_pieslice, (float cx, float cy, float r, float st
 
 ALLEGRO_PRIM_FUNC(void, al_calculate_spline, (float* dest, int stride, const float points[8], float thickness, int num_segments));
 ALLEGRO_PRIM_FUNC(void, al_draw_spline, (const float points[8], ALLEGRO_COLOR color, float thickness));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+ALLEGRO_PRIM_FUNC(void, al_calculate_splines, (float* dest, int stride, const float* points, int num_splines, float thickness, int num_segments));
+ALLEGRO_PRIM_FUNC(void, al_draw_splines, (const float* points, int num_splines, ALLEGRO_COLOR color, float thickness));
+#endif
 
 ALLEGRO_PRIM_FUNC(void, al_calculate_ribbon, (float* dest, int dest_stride, const float *points, int points_stride, float thickness, int num_segments));
 ALLEGRO_PRIM_FUNC(void, al_draw_ribbon, (const float *points, int points_stride, ALLEGRO_COLOR color, float thickness, int num_segments));
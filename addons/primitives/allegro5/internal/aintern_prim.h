@@ -8,7 +8,8 @@ extern "C" {
 enum ALLEGRO_PRIM_VERTEX_CACHE_TYPE
 {
    ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE,
-   ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP
+   ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP,
+   ALLEGRO_PRIM_VERTEX_CACHE_LINE_LIST
 };
 
 struct ALLEGRO_VERTEX_DECL {
@@ -18,8 +19,14 @@ struct ALLEGRO_VERTEX_DECL {
    void* d3d_dummy_shader;
 };
 
+/* Largest number of vertices _al_prim_cache_init_bulk allocates for. */
+#define _AL_PRIM_MAX_BULK_VERTICES  (1 << 18)
+
 typedef struct ALLEGRO_PRIM_VERTEX_CACHE {
    ALLEGRO_VERTEX  buffer[ALLEGRO_VERTEX_CACHE_SIZE];
+   /* Either buffer or a larger block from _al_prim_cache_init_bulk. */
+   ALLEGRO_VERTEX* vertices;
+   size_t          capacity;
    ALLEGRO_VERTEX* current;
    size_t          size;
    ALLEGRO_COLOR   color;
@@ -27,6 +34,9 @@ typedef struct ALLEGRO_PRIM_VERTEX_CACHE {
    void*           user_data;
 } ALLEGRO_PRIM_VERTEX_CACHE;
 
+/* How many copies of the data an OpenGL stream buffer cycles through. */
+#define _AL_PRIM_STREAM_REGIONS 3
+
 typedef struct ALLEGRO_BUFFER_COMMON {
    uintptr_t handle;
    bool write_only;
@@ -40,6 +50,16 @@ typedef struct ALLEGRO_BUFFER_COMMON {
    int local_buffer_length;
    int lock_offset;
    int lock_length;
+
+   /* Stream buffers hold num_regions copies of the data, of region_length
+    * bytes each. Only the current region is drawn from, and each region
+    * has a fence for the last draw that used it.
+    */
+   int num_regions;
+   int region;
+   int region_length;
+   void* fences[_AL_PRIM_STREAM_REGIONS];
+   bool is_mapped;
 } ALLEGRO_BUFFER_COMMON;
 
 struct ALLEGRO_VERTEX_BUFFER {
@@ -50,14 +70,25 @@ struct ALLEGRO_VERTEX_BUFFER {
 struct ALLEGRO_INDEX_BUFFER {
    int index_size;
    ALLEGRO_BUFFER_COMMON common;
+
+   /* For ALLEGRO_PRIM_BUFFER_PRIMITIVE_RESTART, the sorted positions of the
+    * restart indices, at which draws are split. They are found when the data
+    * is written, through lock_ptr.
+    */
+   bool restart;
+   int* restarts;
+   int num_restarts;
+   void* lock_ptr;
 };
 
 /* Internal cache for primitives. */
 void _al_prim_cache_init(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color);
 void _al_prim_cache_init_ex(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color, void* user_data);
+void _al_prim_cache_init_bulk(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color, size_t num_vertices);
 void _al_prim_cache_term(ALLEGRO_PRIM_VERTEX_CACHE* cache);
 void _al_prim_cache_flush(ALLEGRO_PRIM_VERTEX_CACHE* cache);
 void _al_prim_cache_push_point(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v);
+void _al_prim_cache_push_line(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v0, const float* v1);
 void _al_prim_cache_push_triangle(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v0, const float* v1, const float* v2);
 
 
@@ -69,6 +100,35 @@ bool      _al_prim_is_point_in_triangle(const float* point, const float* v0, con
 bool      _al_prim_intersect_segment(const float* v0, const float* v1, const float* p0, const float* p1, float* point, float* t0, float* t1);
 bool      _al_prim_are_points_equal(const float* point_a, const float* point_b);
 
+/* Shapes drawn by _al_prim_draw_shape. */
+enum {
+   _AL_PRIM_SHAPE_BOX,
+   _AL_PRIM_SHAPE_ELLIPSE,
+   _AL_PRIM_SHAPE_PIE
+};
+
+typedef struct _AL_PRIM_SHAPE {
+   int kind;
+   /* Centre and the direction of the shape's x axis. */
+   float cx, cy;
+   float ux, uy;
+   /* Half extents, radii, or the radius of a pie in hx. */
+   float hx, hy;
+   /* Corner radius of a box, or half the angle of a pie. */
+   float radius;
+   /* Outline thickness, filled if 0. */
+   float thickness;
+} _AL_PRIM_SHAPE;
+
+bool _al_prim_draw_shape(const _AL_PRIM_SHAPE *shape, ALLEGRO_COLOR color, float scale);
+bool _al_prim_init_shapes(void);
+void _al_prim_shutdown_shapes(void);
+void _al_prim_flush_held_shapes(void);
+void _al_prim_flush_held_vertices(void);
+
+bool _al_prim_init_arc_cache(void);
+void _al_prim_shutdown_arc_cache(void);
+
 int _al_bitmap_region_is_locked(ALLEGRO_BITMAP* bmp, int x1, int y1, int x2, int y2);
 int _al_draw_buffer_common_soft(ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BITMAP* texture, ALLEGRO_INDEX_BUFFER* index_buffer, int start, int end, int type);
 
@@ -8,6 +8,7 @@ bool _al_create_vertex_buffer_opengl(ALLEGRO_VERTEX_BUFFER* buf, const void* ini
 void _al_destroy_vertex_buffer_opengl(ALLEGRO_VERTEX_BUFFER* buf);
 void* _al_lock_vertex_buffer_opengl(ALLEGRO_VERTEX_BUFFER* buf);
 void _al_unlock_vertex_buffer_opengl(ALLEGRO_VERTEX_BUFFER* buf);
+bool _al_set_shader_storage_buffer_opengl(const char *name, ALLEGRO_VERTEX_BUFFER* buf, int binding);
 
 bool _al_create_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf, const void* initial_data, size_t num_indices, int flags);
 void _al_destroy_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf);
@@ -16,5 +17,6 @@ void _al_unlock_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf);
 
 int _al_draw_vertex_buffer_opengl(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX_BUFFER* vertex_buffer, int start, int end, int type);
 int _al_draw_indexed_buffer_opengl(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_INDEX_BUFFER* index_buffer, int start, int end, int type);
+int _al_draw_indexed_buffer_multi_opengl(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_INDEX_BUFFER* index_buffer, const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int type);
 
 #endif
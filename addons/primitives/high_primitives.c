@@ -42,7 +42,9 @@
 #ifdef ALLEGRO_CFG_OPENGL
 #include "allegro5/allegro_opengl.h"
 #endif
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_prim.h"
 #include "allegro5/debug.h"
 #include <math.h>
 
@@ -76,6 +78,43 @@ static float get_scale(void)
 #undef DET2D
 }
 
+/*
+ * Draws the shape as a single antialiased quad, if enabled with
+ * al_set_primitive_antialiasing and supported by the target.
+ */
+static bool draw_shape(int kind, float cx, float cy, float ux, float uy,
+   float hx, float hy, float radius, float thickness, ALLEGRO_COLOR color)
+{
+   _AL_PRIM_SHAPE shape;
+
+   if (!al_get_primitive_antialiasing())
+      return false;
+
+   shape.kind = kind;
+   shape.cx = cx;
+   shape.cy = cy;
+   shape.ux = ux;
+   shape.uy = uy;
+   shape.hx = hx;
+   shape.hy = hy;
+   shape.radius = radius;
+   shape.thickness = thickness;
+   return _al_prim_draw_shape(&shape, color, get_scale());
+}
+
+static bool draw_rounded_rectangle_shape(float x1, float y1, float x2,
+   float y2, float rx, float ry, ALLEGRO_COLOR color, float thickness)
+{
+   float hx = fabsf(x2 - x1) / 2;
+   float hy = fabsf(y2 - y1) / 2;
+
+   /* Elliptical corners have no simple distance function. */
+   if (rx != ry)
+      return false;
+   return draw_shape(_AL_PRIM_SHAPE_BOX, (x1 + x2) / 2, (y1 + y2) / 2, 1, 0,
+      hx, hy, _ALLEGRO_MIN(rx, _ALLEGRO_MIN(hx, hy)), thickness, color);
+}
+
 /* Function: al_draw_line
  */
 void al_draw_line(float x1, float y1, float x2, float y2,
@@ -91,6 +130,11 @@ void al_draw_line(float x1, float y1, float x2, float y2,
       if (len == 0)
          return;
 
+      if (draw_shape(_AL_PRIM_SHAPE_BOX, (x1 + x2) / 2, (y1 + y2) / 2,
+            (x2 - x1) / len, (y2 - y1) / len, len / 2, thickness / 2, 0, 0,
+            color))
+         return;
+
       tx = 0.5f * thickness * (y2 - y1) / len;
       ty = 0.5f * thickness * -(x2 - x1) / len;
             
@@ -422,30 +466,139 @@ void al_draw_filled_rectangle(float x1, float y1, float x2, float y2,
    al_draw_prim(vtx, 0, 0, 0, 4, ALLEGRO_PRIM_TRIANGLE_FAN);
 }
 
+/* Unit arc tessellations, as produced by the rotation recurrence below, are
+ * cached so that repeatedly drawing the same arc (at any centre, radius or
+ * thickness) skips both the trigonometry and the recurrence. The cache is
+ * only used once the addon is initialised, as it needs the mutex.
+ */
+#define ARC_CACHE_ENTRIES     8
+#define ARC_CACHE_MAX_POINTS  ALLEGRO_VERTEX_CACHE_SIZE
+
+typedef struct ARC_CACHE_ENTRY {
+   float start_theta;
+   float delta_theta;
+   int num_points;
+   unsigned int last_use;
+   float points[2 * ARC_CACHE_MAX_POINTS];
+} ARC_CACHE_ENTRY;
+
+static ALLEGRO_MUTEX *arc_cache_mutex = NULL;
+static ARC_CACHE_ENTRY *arc_cache = NULL;
+static unsigned int arc_cache_clock = 0;
+
+bool _al_prim_init_arc_cache(void)
+{
+   if (arc_cache)
+      return true;
+   arc_cache = al_calloc(ARC_CACHE_ENTRIES, sizeof(ARC_CACHE_ENTRY));
+   arc_cache_mutex = al_create_mutex();
+   if (!arc_cache || !arc_cache_mutex) {
+      _al_prim_shutdown_arc_cache();
+      return false;
+   }
+   return true;
+}
+
+void _al_prim_shutdown_arc_cache(void)
+{
+   al_free(arc_cache);
+   arc_cache = NULL;
+   al_destroy_mutex(arc_cache_mutex);
+   arc_cache_mutex = NULL;
+   arc_cache_clock = 0;
+}
+
+static void calculate_unit_arc(float* dest, float start_theta,
+   float delta_theta, int num_points)
+{
+   float theta = delta_theta / ((float)num_points - 1);
+   float c = cosf(theta);
+   float s = sinf(theta);
+   float x = cosf(start_theta);
+   float y = sinf(start_theta);
+   float t;
+   int ii;
+
+   for (ii = 0; ii < num_points; ii++) {
+      dest[2 * ii] = x;
+      dest[2 * ii + 1] = y;
+
+      t = x;
+      x = c * x - s * y;
+      y = s * t + c * y;
+   }
+}
+
+/* Returns the unit arc with the mutex held, or NULL if it can't be cached. */
+static const float* lock_unit_arc(float start_theta, float delta_theta,
+   int num_points)
+{
+   ARC_CACHE_ENTRY* entry;
+   ARC_CACHE_ENTRY* oldest;
+   int ii;
+
+   if (!arc_cache || num_points > ARC_CACHE_MAX_POINTS)
+      return NULL;
+
+   al_lock_mutex(arc_cache_mutex);
+
+   arc_cache_clock++;
+   oldest = &arc_cache[0];
+   for (ii = 0; ii < ARC_CACHE_ENTRIES; ii++) {
+      entry = &arc_cache[ii];
+      if (entry->num_points == num_points &&
+            entry->start_theta == start_theta &&
+            entry->delta_theta == delta_theta) {
+         entry->last_use = arc_cache_clock;
+         return entry->points;
+      }
+      if (entry->last_use < oldest->last_use)
+         oldest = entry;
+   }
+
+   calculate_unit_arc(oldest->points, start_theta, delta_theta, num_points);
+   oldest->start_theta = start_theta;
+   oldest->delta_theta = delta_theta;
+   oldest->num_points = num_points;
+   oldest->last_use = arc_cache_clock;
+   return oldest->points;
+}
+
 /* Function: al_calculate_arc
  */
 void al_calculate_arc(float* dest, int stride, float cx, float cy,
    float rx, float ry, float start_theta, float delta_theta, float thickness,
    int num_points)
-{   
-   float theta;
-   float c;
-   float s;
-   float x, y, t;
+{
+   float local_points[2 * ARC_CACHE_MAX_POINTS];
+   const float* unit;
+   float* points = NULL;
+   float x, y;
    int ii;
- 
+
    ASSERT(dest);
    ASSERT(num_points > 1);
    ASSERT(rx >= 0);
    ASSERT(ry >= 0);
 
+   if (thickness > 0.0f && rx != ry && (rx == 0 || ry == 0))
+      return;
+
+   unit = lock_unit_arc(start_theta, delta_theta, num_points);
+   if (!unit) {
+      if (num_points > ARC_CACHE_MAX_POINTS) {
+         points = al_malloc(2 * num_points * sizeof(float));
+         if (!points)
+            return;
+      }
+      else {
+         points = local_points;
+      }
+      calculate_unit_arc(points, start_theta, delta_theta, num_points);
+      unit = points;
+   }
+
    if (thickness > 0.0f) {
-      theta = delta_theta / ((float)(num_points) - 1);
-      c = cosf(theta);
-      s = sinf(theta);
-      x = cosf(start_theta);
-      y = sinf(start_theta);
- 
       if (rx == ry) {
          /*
          The circle case is particularly simple
@@ -453,54 +606,44 @@ void al_calculate_arc(float* dest, int stride, float cx, float cy,
          float r1 = rx - thickness / 2.0f;
          float r2 = rx + thickness / 2.0f;
          for (ii = 0; ii < num_points; ii ++) {
+            x = unit[2 * ii];
+            y = unit[2 * ii + 1];
             *dest =       r2 * x + cx;
             *(dest + 1) = r2 * y + cy;
             dest = (float*)(((char*)dest) + stride);
             *dest =        r1 * x + cx;
             *(dest + 1) =  r1 * y + cy;
             dest = (float*)(((char*)dest) + stride);
-            
-            t = x;
-            x = c * x - s * y;
-            y = s * t + c * y;
          }
       } else {
-         if (rx != 0 && ry != 0) {
-            for (ii = 0; ii < num_points; ii++) {
-               float denom = hypotf(ry * x, rx * y);
-               float nx = thickness / 2 * ry * x / denom;
-               float ny = thickness / 2 * rx * y / denom;
-
-               *dest =       rx * x + cx + nx;
-               *(dest + 1) = ry * y + cy + ny;
-               dest = (float*)(((char*)dest) + stride);
-               *dest =       rx * x + cx - nx;
-               *(dest + 1) = ry * y + cy - ny;
-               dest = (float*)(((char*)dest) + stride);
-
-               t = x;
-               x = c * x - s * y;
-               y = s * t + c * y;
-            }
+         for (ii = 0; ii < num_points; ii++) {
+            float denom, nx, ny;
+            x = unit[2 * ii];
+            y = unit[2 * ii + 1];
+            denom = hypotf(ry * x, rx * y);
+            nx = thickness / 2 * ry * x / denom;
+            ny = thickness / 2 * rx * y / denom;
+
+            *dest =       rx * x + cx + nx;
+            *(dest + 1) = ry * y + cy + ny;
+            dest = (float*)(((char*)dest) + stride);
+            *dest =       rx * x + cx - nx;
+            *(dest + 1) = ry * y + cy - ny;
+            dest = (float*)(((char*)dest) + stride);
          }
       }
    } else {
-      theta = delta_theta / ((float)num_points - 1);
-      c = cosf(theta);
-      s = sinf(theta);
-      x = cosf(start_theta);
-      y = sinf(start_theta);
-      
       for (ii = 0; ii < num_points; ii++) {
-         *dest =       rx * x + cx;
-         *(dest + 1) = ry * y + cy;
+         *dest =       rx * unit[2 * ii] + cx;
+         *(dest + 1) = ry * unit[2 * ii + 1] + cy;
          dest = (float*)(((char*)dest) + stride);
-
-         t = x;
-         x = c * x - s * y;
-         y = s * t + c * y;
       }
    }
+
+   if (!points)
+      al_unlock_mutex(arc_cache_mutex);
+   else if (points != local_points)
+      al_free(points);
 }
 
 /* Function: al_draw_pieslice
@@ -669,6 +812,24 @@ void al_draw_filled_pieslice(float cx, float cy, float r, float start_theta,
    int num_segments, ii;
    
    ASSERT(r >= 0);
+
+   if (r > 0 && delta_theta != 0) {
+      float half_theta = fabsf(delta_theta) / 2;
+      float mid_theta = start_theta + delta_theta / 2;
+      bool drawn;
+
+      if (half_theta >= ALLEGRO_PI) {
+         drawn = draw_shape(_AL_PRIM_SHAPE_ELLIPSE, cx, cy, 1, 0, r, r, 0, 0,
+            color);
+      }
+      else {
+         /* The pie opens around the shape's y axis. */
+         drawn = draw_shape(_AL_PRIM_SHAPE_PIE, cx, cy, sinf(mid_theta),
+            -cosf(mid_theta), r, r, half_theta, 0, color);
+      }
+      if (drawn)
+         return;
+   }
    
    num_segments = fabs(delta_theta / (2 * ALLEGRO_PI) * ALLEGRO_PRIM_QUALITY * sqrtf(scale * r));
 
@@ -709,6 +870,10 @@ void al_draw_ellipse(float cx, float cy, float rx, float ry,
       if (num_segments < 2)
          return;
 
+      if (rx > 0 && ry > 0 && draw_shape(_AL_PRIM_SHAPE_ELLIPSE, cx, cy, 1, 0,
+            rx, ry, 0, thickness, color))
+         return;
+
       if (2 * num_segments >= ALLEGRO_VERTEX_CACHE_SIZE) {
          num_segments = (ALLEGRO_VERTEX_CACHE_SIZE - 1) / 2;
       }
@@ -761,6 +926,10 @@ void al_draw_filled_ellipse(float cx, float cy, float rx, float ry,
     */
    if (num_segments < 2)
       return;
+
+   if (rx > 0 && ry > 0 && draw_shape(_AL_PRIM_SHAPE_ELLIPSE, cx, cy, 1, 0,
+         rx, ry, 0, 0, color))
+      return;
    
    if (num_segments >= ALLEGRO_VERTEX_CACHE_SIZE) {
       num_segments = ALLEGRO_VERTEX_CACHE_SIZE - 1;
@@ -865,6 +1034,9 @@ void al_draw_rounded_rectangle(float x1, float y1, float x2, float y2,
       int num_segments = ALLEGRO_PRIM_QUALITY * sqrtf(scale * (rx + ry) / 2.0f) / 4;
       int ii;
 
+      if (draw_rounded_rectangle_shape(x1, y1, x2, y2, rx, ry, color, thickness))
+         return;
+
       /* In case rx and ry are both 0. */
       if (num_segments < 2) {
          al_draw_rectangle(x1, y1, x2, y2, color, thickness);
@@ -960,6 +1132,9 @@ void al_draw_filled_rounded_rectangle(float x1, float y1, float x2, float y2,
 
    ASSERT(rx >= 0);
    ASSERT(ry >= 0);
+
+   if (draw_rounded_rectangle_shape(x1, y1, x2, y2, rx, ry, color, 0))
+      return;
    
    /* In case rx and ry are both 0. */
    if (num_segments < 2) {
@@ -1078,18 +1253,33 @@ void al_calculate_spline(float* dest, int stride, const float points[8],
    }
 }
 
-/* Function: al_draw_spline
+/* Function: al_calculate_splines
  */
-void al_draw_spline(const float points[8], ALLEGRO_COLOR color, float thickness)
+void al_calculate_splines(float* dest, int stride, const float* points,
+   int num_splines, float thickness, int num_segments)
 {
+   int points_per_spline = thickness > 0 ? 2 * num_segments : num_segments;
    int ii;
-   float scale = get_scale();
+
+   ASSERT(points);
+   ASSERT(num_splines >= 0);
+
+   for (ii = 0; ii < num_splines; ii++) {
+      al_calculate_spline(dest, stride, points + 8 * ii, thickness, num_segments);
+      dest = (float*)(((char*)dest) + stride * points_per_spline);
+   }
+}
+
+/* How many segments al_draw_spline uses for a spline, at most as many as
+ * fit into the vertex cache.
+ */
+static int get_spline_segments(const float points[8], float scale, float thickness)
+{
    int num_segments = (int)(sqrtf(hypotf(points[2] - points[0], points[3] - points[1]) +
                                   hypotf(points[4] - points[2], points[5] - points[3]) +
                                   hypotf(points[6] - points[4], points[7] - points[5])) *
                             1.2 * ALLEGRO_PRIM_QUALITY * scale / 10);
-   LOCAL_VERTEX_CACHE;
-   
+
    if(num_segments < 2)
       num_segments = 2;
 
@@ -1097,7 +1287,24 @@ void al_draw_spline(const float points[8], ALLEGRO_COLOR color, float thickness)
       if (2 * num_segments >= ALLEGRO_VERTEX_CACHE_SIZE) {
          num_segments = (ALLEGRO_VERTEX_CACHE_SIZE - 1) / 2;
       }
-         
+   } else {
+      if (num_segments >= ALLEGRO_VERTEX_CACHE_SIZE) {
+         num_segments = ALLEGRO_VERTEX_CACHE_SIZE - 1;
+      }
+   }
+
+   return num_segments;
+}
+
+/* Function: al_draw_spline
+ */
+void al_draw_spline(const float points[8], ALLEGRO_COLOR color, float thickness)
+{
+   int ii;
+   int num_segments = get_spline_segments(points, get_scale(), thickness);
+   LOCAL_VERTEX_CACHE;
+
+   if (thickness > 0) {
       al_calculate_spline(&(vertex_cache[0].x), sizeof(ALLEGRO_VERTEX), points, thickness, num_segments);
       
       for (ii = 0; ii < 2 * num_segments; ii++) {
@@ -1107,10 +1314,6 @@ void al_draw_spline(const float points[8], ALLEGRO_COLOR color, float thickness)
       
       al_draw_prim(vertex_cache, 0, 0, 0, 2 * num_segments, ALLEGRO_PRIM_TRIANGLE_STRIP);
    } else {
-      if (num_segments >= ALLEGRO_VERTEX_CACHE_SIZE) {
-         num_segments = ALLEGRO_VERTEX_CACHE_SIZE - 1;
-      }
-         
       al_calculate_spline(&(vertex_cache[0].x), sizeof(ALLEGRO_VERTEX), points, thickness, num_segments);
       
       for (ii = 0; ii < num_segments; ii++) {
@@ -1122,6 +1325,53 @@ void al_draw_spline(const float points[8], ALLEGRO_COLOR color, float thickness)
    }
 }
 
+/* Function: al_draw_splines
+ */
+void al_draw_splines(const float* points, int num_splines, ALLEGRO_COLOR color, float thickness)
+{
+   ALLEGRO_PRIM_VERTEX_CACHE cache;
+   float spline_points[2 * ALLEGRO_VERTEX_CACHE_SIZE];
+   float scale = get_scale();
+   size_t num_vertices = 0;
+   int ii, jj;
+
+   ASSERT(points);
+   ASSERT(num_splines >= 0);
+
+   /* Size the cache so that all of the splines are drawn at once. */
+   for (ii = 0; ii < num_splines; ii++) {
+      int num_segments = get_spline_segments(points + 8 * ii, scale, thickness);
+      num_vertices += thickness > 0 ? 6 * (num_segments - 1) : 2 * (num_segments - 1);
+   }
+
+   _al_prim_cache_init_bulk(&cache, thickness > 0 ? ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE :
+      ALLEGRO_PRIM_VERTEX_CACHE_LINE_LIST, color, num_vertices);
+
+   for (ii = 0; ii < num_splines; ii++) {
+      const float* p = points + 8 * ii;
+      int num_segments = get_spline_segments(p, scale, thickness);
+
+      al_calculate_spline(spline_points, 2 * sizeof(float), p, thickness, num_segments);
+
+      if (thickness > 0) {
+         /* The triangles of the strip al_draw_spline draws. */
+         for (jj = 0; jj < 2 * num_segments - 2; jj += 2) {
+            const float* v = spline_points + 2 * jj;
+            _al_prim_cache_push_triangle(&cache, v, v + 2, v + 4);
+            _al_prim_cache_push_triangle(&cache, v + 2, v + 4, v + 6);
+         }
+      }
+      else {
+         for (jj = 0; jj < num_segments - 1; jj++) {
+            const float* v = spline_points + 2 * jj;
+            _al_prim_cache_push_line(&cache, v, v + 2);
+         }
+      }
+   }
+
+   _al_prim_cache_term(&cache);
+}
+
 /* Function: al_calculate_ribbon
  */
 void al_calculate_ribbon(float* dest, int dest_stride, const float *points,
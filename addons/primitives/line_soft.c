@@ -40,12 +40,20 @@ typedef void (*shader_step)(uintptr_t, int);
 
 typedef struct {
    ALLEGRO_COLOR color;
+   _AL_BLENDER blender;
 } state_solid_any_2d;
 
+/* Like al_put_blended_pixel, but with the blender looked up once per line. */
+static void put_blended_pixel(const _AL_BLENDER *blender, int x, int y,
+   ALLEGRO_COLOR color)
+{
+   _al_blend_span_memory(blender, &color, al_get_target_bitmap(), x, y, 1);
+}
+
 static void shader_solid_any_draw_shade(uintptr_t state, int x, int y)
 {
    state_solid_any_2d* s = (state_solid_any_2d*)state;
-   al_put_blended_pixel(x, y, s->color);
+   put_blended_pixel(&s->blender, x, y, s->color);
 }
 
 static void shader_solid_any_draw_opaque(uintptr_t state, int x, int y)
@@ -168,6 +176,7 @@ typedef struct {
    float minor_dv;
    float major_du;
    float major_dv;
+   _AL_BLENDER blender;
 } state_texture_solid_any_2d;
 
 static void get_texcoords(state_texture_solid_any_2d *s, int *u, int *v)
@@ -187,7 +196,7 @@ static void shader_texture_solid_any_draw_shade(uintptr_t state, int x, int y)
 
    ALLEGRO_COLOR color = al_get_pixel(s->texture, u, v);
    SHADE_COLORS(color, s->color)
-   al_put_blended_pixel(x, y, color);
+   put_blended_pixel(&s->blender, x, y, color);
 }
 
 static void shader_texture_solid_any_draw_shade_white(uintptr_t state, int x, int y)
@@ -195,7 +204,7 @@ static void shader_texture_solid_any_draw_shade_white(uintptr_t state, int x, in
    state_texture_solid_any_2d* s = (state_texture_solid_any_2d*)state;
    GET_UV
 
-   al_put_blended_pixel(x, y, al_get_pixel(s->texture, u, v));
+   put_blended_pixel(&s->blender, x, y, al_get_pixel(s->texture, u, v));
 }
 
 static void shader_texture_solid_any_draw_opaque(uintptr_t state, int x, int y)
@@ -518,6 +527,7 @@ void _al_line_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2
       if (grad) {
          state_texture_grad_any_2d state;
          state.solid.texture = texture;
+         _al_get_blender(&state.solid.blender);
 
          if (shade) {
             al_draw_soft_line(v1, v2, (uintptr_t)&state, shader_texture_grad_any_first, shader_texture_grad_any_step, shader_texture_solid_any_draw_shade);
@@ -532,6 +542,7 @@ void _al_line_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2
             white = 1;
          }
          state.texture = texture;
+         _al_get_blender(&state.blender);
 
          if (shade) {
             if(white) {
@@ -550,6 +561,7 @@ void _al_line_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2
    } else {
       if (grad) {
          state_grad_any_2d state;
+         _al_get_blender(&state.solid.blender);
          if (shade) {
             al_draw_soft_line(v1, v2, (uintptr_t)&state, shader_grad_any_first, shader_grad_any_step, shader_solid_any_draw_shade);
          } else {
@@ -557,6 +569,7 @@ void _al_line_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2
          }
       } else {
          state_solid_any_2d state;
+         _al_get_blender(&state.blender);
          if (shade) {
             al_draw_soft_line(v1, v2, (uintptr_t)&state, shader_solid_any_first, shader_solid_any_step, shader_solid_any_draw_shade);
          } else {
@@ -24,62 +24,90 @@
 #include <math.h>
 
 
+/* Direction, normal direction and the length of a line segment. */
+typedef struct POLYLINE_SEGMENT {
+   float dir[2];
+   float normal[2];
+   float length;
+} POLYLINE_SEGMENT;
+
+/* Polylines up to this many vertices keep their segments on the stack. */
+#define LOCAL_SEGMENT_COUNT  64
+
 /*
- * Computes direction, normal direction and the length of the segment.
+ * Computes all segments of the polyline, segment i going from vertex i to
+ * vertex i + 1. The last one closes the line. This is done in one pass up
+ * front, as each segment is needed for both of its joins and the loop is
+ * simple enough for the compiler to vectorize.
  */
-static float compute_direction_and_normal(const float* begin, const float* end, float* dir, float* normal)
+static void compute_segments(POLYLINE_SEGMENT* segments, const float* vertices, int vertex_stride, int vertex_count)
 {
-   float length;
+   int i;
 
-   /* Determine direction, normal direction and length of the line segment. */
-   dir[0] = end[0] - begin[0];
-   dir[1] = end[1] - begin[1];
+   for (i = 0; i < vertex_count; ++i) {
+
+      const float* begin = (const float*)(((uint8_t*)vertices) + vertex_stride * i);
+      const float* end   = (const float*)(((uint8_t*)vertices) + vertex_stride * (i + 1 < vertex_count ? i + 1 : 0));
+      POLYLINE_SEGMENT* segment = segments + i;
+      float dx = end[0] - begin[0];
+      float dy = end[1] - begin[1];
+      /* The same as hypotf, which computes this in double too. */
+      float length = (float)sqrt((double)dx * dx + (double)dy * dy);
+      float inv_length = length > 0.0f ? 1.0f / length : 1.0f;
+
+      segment->dir[0]    = dx * inv_length;
+      segment->dir[1]    = dy * inv_length;
+      segment->normal[0] = -segment->dir[1];
+      segment->normal[1] =  segment->dir[0];
+      segment->length    = length;
+   }
+}
 
-   length = _al_prim_normalize(dir);
+/*
+ * Returns the segment running the other way.
+ */
+static POLYLINE_SEGMENT reverse_segment(const POLYLINE_SEGMENT* segment)
+{
+   POLYLINE_SEGMENT reversed;
 
-   normal[0] = -dir[1];
-   normal[1] =  dir[0];
+   reversed.dir[0]    = -segment->dir[0];
+   reversed.dir[1]    = -segment->dir[1];
+   reversed.normal[0] = -segment->normal[0];
+   reversed.normal[1] = -segment->normal[1];
+   reversed.length    = segment->length;
 
-   return length;
+   return reversed;
 }
 
 /*
  * Compute end cross points.
  */
-static void compute_end_cross_points(const float* v0, const float* v1, float radius, float* p0, float* p1)
+static void compute_end_cross_points(const float* v1, const POLYLINE_SEGMENT* segment, float radius, float* p0, float* p1)
 {
-   float dir[2];
-   float normal[2];
-   /* XXX delete this parameter? */
-   (void)radius;
-
-   compute_direction_and_normal(v0, v1, dir, normal);
-
-   p0[0] = v1[0] + normal[0] * radius;
-   p0[1] = v1[1] + normal[1] * radius;
-   p1[0] = v1[0] - normal[0] * radius;
-   p1[1] = v1[1] - normal[1] * radius;
+   p0[0] = v1[0] + segment->normal[0] * radius;
+   p0[1] = v1[1] + segment->normal[1] * radius;
+   p1[0] = v1[0] - segment->normal[0] * radius;
+   p1[1] = v1[1] - segment->normal[1] * radius;
 }
 
 /*
  * Compute cross points.
  */
-static void compute_cross_points(const float* v0, const float* v1, const float* v2, float radius,
+static void compute_cross_points(const float* v1, const POLYLINE_SEGMENT* segment_0, const POLYLINE_SEGMENT* segment_1, float radius,
    float* l0, float* l1, float* r0, float* r1, float* out_middle, float* out_angle, float* out_miter_distance)
 {
-   float normal_0[2], normal_1[2];
-   float dir_0[2], dir_1[2];
+   const float* normal_0 = segment_0->normal;
+   const float* normal_1 = segment_1->normal;
+   const float* dir_0 = segment_0->dir;
+   const float* dir_1 = segment_1->dir;
+   float len_0 = segment_0->length;
+   float len_1 = segment_1->length;
    float middle[2];
    float diff[2];
    float miter_distance;
    float angle;
-   float len_0, len_1;
    bool sharp = false;
 
-   /* Compute directions. */
-   len_0 = compute_direction_and_normal(v0, v1, dir_0, normal_0);
-   len_1 = compute_direction_and_normal(v1, v2, dir_1, normal_1);
-
    /* Compute angle of deflection between segments. */
    diff[0] =   dir_0[0] * dir_1[0] + dir_0[1] * dir_1[1];
    diff[1] = -(dir_0[0] * dir_1[1] - dir_0[1] * dir_1[0]);
@@ -275,15 +303,15 @@ static void emit_round_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* pi
 /*
  * Emits end cap.
  *
- * Direction of the end cap is defined by vector [v1 - v0]. p0 and p1 are starting
+ * Direction of the end cap is defined by the segment ending at v1. p0 and p1 are starting
  * and ending point of the cap. Both should be located on the circle with center
  * in v1 and specified radius. p0 have to be located on the negative and p0 on the
  * positive half plane defined by direction vector.
  */
-static void emit_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, int cap_style, const float* v0, const float* v1, float radius)
+static void emit_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, int cap_style, const float* v1, const POLYLINE_SEGMENT* segment, float radius)
 {
-   float dir[2];
-   float normal[2];
+   const float* dir = segment->dir;
+   const float* normal = segment->normal;
 
    /* Do do not want you to call this function for closed cap.
     * It is special and there is nothing we can do with it there.
@@ -294,9 +322,6 @@ static void emit_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, int cap_style, const
    if (cap_style == ALLEGRO_LINE_CAP_NONE)
       return;
 
-   /* Compute normal and direction for our segment. */
-   compute_direction_and_normal(v0, v1, dir, normal);
-
    /* Emit vertices for cap. */
    if (cap_style == ALLEGRO_LINE_CAP_SQUARE)
       emit_square_end_cap(cache, v1, dir, normal, radius);
@@ -396,9 +421,11 @@ static void emit_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, int join_style, const fl
    }
 }
 
-static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertices, int vertex_stride, int vertex_count, int join_style, int cap_style, float thickness, float miter_limit)
+static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertices, int vertex_stride, int vertex_count,
+   const POLYLINE_SEGMENT* segments, int join_style, int cap_style, float thickness, float miter_limit)
 {
 # define VERTEX(index)  ((const float*)(((uint8_t*)vertices) + vertex_stride * ((vertex_count + (index)) % vertex_count)))
+# define SEGMENT(index) (segments + (vertex_count + (index)) % vertex_count)
 
    float l0[2], l1[2];
    float r0[2], r1[2];
@@ -430,11 +457,13 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
       * it is guaranteed that there are at least two vertices
       * in the buffer.
       */
-      emit_end_cap(cache, cap_style,  VERTEX(1),  VERTEX(0), radius);
-      emit_end_cap(cache, cap_style, VERTEX(-2), VERTEX(-1), radius);
+      POLYLINE_SEGMENT first = reverse_segment(SEGMENT(0));
+
+      emit_end_cap(cache, cap_style,  VERTEX(0), &first, radius);
+      emit_end_cap(cache, cap_style, VERTEX(-1), SEGMENT(-2), radius);
 
       /* Compute points on the left side of the very first segment. */
-      compute_end_cross_points(VERTEX(1), VERTEX(0), radius, p1, p0);
+      compute_end_cross_points(VERTEX(0), &first, radius, p1, p0);
 
       /* For non-closed line we have N - 1 steps, but since we iterate
       * from one, N is right value.
@@ -444,7 +473,7 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
    else
    {
       /* Compute points on the left side of the very first segment. */
-      compute_cross_points(VERTEX(-1), VERTEX(0), VERTEX(1), radius, l0, l1, p0, p1, NULL, NULL, NULL);
+      compute_cross_points(VERTEX(0), SEGMENT(-1), SEGMENT(0), radius, l0, l1, p0, p1, NULL, NULL, NULL);
 
       /* Closed line use N steps, because last vertex have to be
       * connected with first one.
@@ -458,7 +487,6 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
       /* Pick vertex and their neighbors. */
       const float* v0 = VERTEX(i - 1);
       const float* v1 = VERTEX(i);
-      const float* v2 = VERTEX(i + 1);
 
       /* Choose correct cross points. */
       if ((cap_style == ALLEGRO_LINE_CAP_CLOSED) || (i < steps - 1)) {
@@ -468,7 +496,7 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
          float angle;
 
          /* Compute cross points. */
-         compute_cross_points(v0, v1, v2, radius, l0, l1, r0, r1, middle, &angle, &miter_distance);
+         compute_cross_points(v1, SEGMENT(i - 1), SEGMENT(i), radius, l0, l1, r0, r1, middle, &angle, &miter_distance);
 
          /* Emit join. */
          if (angle >= 0.0f)
@@ -477,7 +505,7 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
             emit_join(cache, join_style, v1, r1, l1, radius, middle, angle, miter_distance, miter_limit);
       }
       else
-         compute_end_cross_points(v0, v1, radius, l0, l1);
+         compute_end_cross_points(v1, SEGMENT(i - 1), radius, l0, l1);
 
       /* Emit triangles. */
       _al_prim_cache_push_triangle(cache, v0, v1, l1);
@@ -490,16 +518,47 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
       memcpy(p1, r1, sizeof(float) * 2);
    }
 
+# undef SEGMENT
 # undef VERTEX
 }
 
+/*
+ * Estimates how many vertices emit_polyline produces, so that the whole
+ * line can usually be drawn at once.
+ */
+static size_t estimate_polyline_vertices(int vertex_count, int join_style, int cap_style)
+{
+   /* Two quads per segment and the worst case miter, while round joins
+    * rarely need more than a few triangles.
+    */
+   size_t per_vertex = 12 + (join_style == ALLEGRO_LINE_JOIN_ROUND ? 24 : 9);
+   size_t caps = cap_style == ALLEGRO_LINE_CAP_CLOSED ? 0 : 2 * 3 * 32;
+
+   return (size_t)(vertex_count + 1) * per_vertex + caps;
+}
+
 static void do_draw_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertices, int vertex_stride, int vertex_count, int join_style, int cap_style, ALLEGRO_COLOR color, float thickness, float miter_limit)
 {
    if (thickness > 0.0f)
    {
-      _al_prim_cache_init(cache, ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE, color);
-      emit_polyline(cache, vertices, vertex_stride, vertex_count, join_style, cap_style, thickness, miter_limit);
+      POLYLINE_SEGMENT local_segments[LOCAL_SEGMENT_COUNT];
+      POLYLINE_SEGMENT* segments = local_segments;
+
+      if (vertex_count > LOCAL_SEGMENT_COUNT) {
+         segments = al_malloc(vertex_count * sizeof(POLYLINE_SEGMENT));
+         if (!segments)
+            return;
+      }
+
+      compute_segments(segments, vertices, vertex_stride, vertex_count);
+
+      _al_prim_cache_init_bulk(cache, ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE, color,
+         estimate_polyline_vertices(vertex_count, join_style, cap_style));
+      emit_polyline(cache, vertices, vertex_stride, vertex_count, segments, join_style, cap_style, thickness, miter_limit);
       _al_prim_cache_term(cache);
+
+      if (segments != local_segments)
+         al_free(segments);
    }
    else
    {
@@ -507,21 +566,13 @@ static void do_draw_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vert
 
       int i;
 
-      _al_prim_cache_init(cache, ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP, color);
-
-      for (i = 0; i < vertex_count; ++i) {
-         if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 2))
-            _al_prim_cache_flush(cache);
+      _al_prim_cache_init_bulk(cache, ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP, color, vertex_count + 1);
 
+      for (i = 0; i < vertex_count; ++i)
          _al_prim_cache_push_point(cache, VERTEX(i));
-      }
-
-      if (cap_style == ALLEGRO_LINE_CAP_CLOSED && vertex_count > 2) {
-         if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 2))
-            _al_prim_cache_flush(cache);
 
+      if (cap_style == ALLEGRO_LINE_CAP_CLOSED && vertex_count > 2)
          _al_prim_cache_push_point(cache, VERTEX(0));
-      }
 
       _al_prim_cache_term(cache);
 
@@ -27,6 +27,8 @@
 #include "allegro5/platform/alplatf.h"
 #include "allegro5/internal/aintern_prim.h"
 
+ALLEGRO_DEBUG_CHANNEL("opengl_primitives")
+
 #ifdef ALLEGRO_CFG_OPENGL
 
 #include "allegro5/allegro_opengl.h"
@@ -252,7 +254,7 @@ static void setup_state(const char* vtxs, const ALLEGRO_VERTEX_DECL* decl, ALLEG
    }
 
    if (texture) {
-      GLuint gl_texture = al_get_opengl_texture(texture);
+      GLuint gl_texture = _al_ogl_get_texture(texture);
       int true_w, true_h;
       int tex_x, tex_y;
       float mat[4][4] = {
@@ -288,7 +290,7 @@ static void setup_state(const char* vtxs, const ALLEGRO_VERTEX_DECL* decl, ALLEG
       }
 
       if (!(display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE)) {
-         glBindTexture(GL_TEXTURE_2D, gl_texture);
+         _al_ogl_bind_texture(display, 0, gl_texture);
       }
 
       ALLEGRO_BITMAP_WRAP wrap_u, wrap_v;
@@ -309,10 +311,18 @@ static void setup_state(const char* vtxs, const ALLEGRO_VERTEX_DECL* decl, ALLEG
          if (display->ogl_extras->varlocs.use_tex_loc >= 0) {
             glUniform1i(display->ogl_extras->varlocs.use_tex_loc, 1);
          }
-         if (display->ogl_extras->varlocs.tex_loc >= 0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, al_get_opengl_texture(texture));
-            glUniform1i(display->ogl_extras->varlocs.tex_loc, 0); // 0th sampler
+         /* The default shader for ALLEGRO_HELD_BITMAP_TEXTURES picks the
+          * unit per vertex, and its first sampler always reads unit 0.
+          */
+         handle = display->ogl_extras->varlocs.tex_unit_loc;
+         if (handle >= 0)
+            glVertexAttrib1f(handle, 0);
+
+         if (display->ogl_extras->varlocs.tex_loc >= 0 ||
+               display->ogl_extras->varlocs.held_tex_loc >= 0) {
+            _al_ogl_bind_texture(display, 0, gl_texture);
+            if (display->ogl_extras->varlocs.tex_loc >= 0)
+               glUniform1i(display->ogl_extras->varlocs.tex_loc, 0); // 0th sampler
 
             if (wrap_u == ALLEGRO_BITMAP_WRAP_DEFAULT)
                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -337,7 +347,7 @@ static void setup_state(const char* vtxs, const ALLEGRO_VERTEX_DECL* decl, ALLEG
       /* Don't unbind the texture here if shaders are used, since the user may
        * have set the 0'th texture unit manually via the shader API. */
       if (!(display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE)) {
-         glBindTexture(GL_TEXTURE_2D, 0);
+         _al_ogl_bind_texture(display, 0, 0);
       }
    }
 }
@@ -368,7 +378,8 @@ static void revert_state(ALLEGRO_BITMAP* texture)
          if (display->ogl_extras->varlocs.use_tex_loc >= 0)
             glUniform1i(display->ogl_extras->varlocs.use_tex_loc, 0);
 
-         if (display->ogl_extras->varlocs.tex_loc >= 0) {
+         if (display->ogl_extras->varlocs.tex_loc >= 0 ||
+               display->ogl_extras->varlocs.held_tex_loc >= 0) {
             if (wrap_u == ALLEGRO_BITMAP_WRAP_DEFAULT)
                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             if (wrap_v == ALLEGRO_BITMAP_WRAP_DEFAULT)
@@ -410,6 +421,26 @@ static void revert_state(ALLEGRO_BITMAP* texture)
    }
 }
 
+/* Byte offset of the region that is currently drawn from. */
+static int region_offset(const ALLEGRO_BUFFER_COMMON* common)
+{
+   return common->region * common->region_length;
+}
+
+/* Remembers that the GPU reads the current region of a stream buffer. */
+static void fence_region(ALLEGRO_BUFFER_COMMON* common)
+{
+#if !defined ALLEGRO_CFG_OPENGLES
+   if (common->num_regions > 1) {
+      if (common->fences[common->region])
+         glDeleteSync((GLsync)common->fences[common->region]);
+      common->fences[common->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   }
+#else
+   (void)common;
+#endif
+}
+
 static int draw_prim_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture,
    ALLEGRO_VERTEX_BUFFER* vertex_buffer,
    const void* vtx, const ALLEGRO_VERTEX_DECL* decl,
@@ -438,6 +469,7 @@ static int draw_prim_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture,
 
    if (vertex_buffer) {
       glBindBuffer(GL_ARRAY_BUFFER, (GLuint)vertex_buffer->common.handle);
+      vtx = (const void*)(uintptr_t)region_offset(&vertex_buffer->common);
    }
 
    _al_opengl_set_blender(disp);
@@ -485,6 +517,7 @@ static int draw_prim_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture,
 
    if (vertex_buffer) {
       glBindBuffer(GL_ARRAY_BUFFER, 0);
+      fence_region(&vertex_buffer->common);
    }
 
    return num_primitives;
@@ -512,7 +545,7 @@ static int draw_prim_indexed_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture
 
    if (use_buffers) {
       idx_size = index_buffer->index_size == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
-      start_offset = start * index_buffer->index_size;
+      start_offset = region_offset(&index_buffer->common) + start * index_buffer->index_size;
    }
 
    if (target->parent) {
@@ -548,6 +581,7 @@ static int draw_prim_indexed_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture
    if (use_buffers) {
       glBindBuffer(GL_ARRAY_BUFFER, (GLuint)vertex_buffer->common.handle);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)index_buffer->common.handle);
+      vtx = (const void*)(uintptr_t)region_offset(&vertex_buffer->common);
    }
 
    setup_state(vtx, decl, texture);
@@ -593,6 +627,8 @@ static int draw_prim_indexed_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture
    if (use_buffers) {
       glBindBuffer(GL_ARRAY_BUFFER, 0);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      fence_region(&vertex_buffer->common);
+      fence_region(&index_buffer->common);
    }
 
 #if defined ALLEGRO_IPHONE
@@ -602,6 +638,106 @@ static int draw_prim_indexed_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture
    return num_primitives;
 }
 
+/* Draws several ranges of an index buffer, with one glMultiDrawElements
+ * where available.
+ */
+static int draw_indexed_buffer_multi_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture,
+   ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_INDEX_BUFFER* index_buffer,
+   const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int type)
+{
+   int num_primitives = 0;
+   ALLEGRO_DISPLAY *disp = _al_get_bitmap_display(target);
+   ALLEGRO_BITMAP *opengl_target = target;
+   ALLEGRO_BITMAP_EXTRA_OPENGL *extra;
+   GLenum idx_size = index_buffer->index_size == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+   GLsizei local_counts[64];
+   const GLvoid* local_offsets[64];
+   GLsizei* counts = local_counts;
+   const GLvoid** offsets = local_offsets;
+   GLenum mode;
+   int base = region_offset(&index_buffer->common);
+   int i;
+
+   if (target->parent) {
+      opengl_target = target->parent;
+   }
+   extra = opengl_target->extra;
+
+   if ((!extra->is_backbuffer && disp->ogl_extras->opengl_target !=
+      opengl_target) || al_is_bitmap_locked(target)) {
+      for (i = 0; i < num_ranges; i++)
+         num_primitives += _al_draw_buffer_common_soft(vertex_buffer, texture, index_buffer, ranges[i].start, ranges[i].end, type);
+      return num_primitives;
+   }
+
+   switch (type) {
+      case ALLEGRO_PRIM_LINE_LIST:      mode = GL_LINES;          break;
+      case ALLEGRO_PRIM_LINE_STRIP:     mode = GL_LINE_STRIP;     break;
+      case ALLEGRO_PRIM_TRIANGLE_LIST:  mode = GL_TRIANGLES;      break;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP: mode = GL_TRIANGLE_STRIP; break;
+      case ALLEGRO_PRIM_TRIANGLE_FAN:   mode = GL_TRIANGLE_FAN;   break;
+      default:
+         /* Unimplemented, as it's too hard to do for Direct3D */
+         return 0;
+   }
+
+   if (num_ranges > 64) {
+      counts = al_malloc(num_ranges * sizeof(GLsizei));
+      offsets = al_malloc(num_ranges * sizeof(const GLvoid*));
+      if (!counts || !offsets) {
+         al_free(counts);
+         al_free(offsets);
+         return 0;
+      }
+   }
+
+   for (i = 0; i < num_ranges; i++) {
+      int num_vtx = ranges[i].end - ranges[i].start;
+
+      counts[i] = num_vtx;
+      offsets[i] = (const GLvoid*)(uintptr_t)(base + ranges[i].start * index_buffer->index_size);
+
+      switch (type) {
+         case ALLEGRO_PRIM_LINE_LIST:     num_primitives += num_vtx / 2; break;
+         case ALLEGRO_PRIM_LINE_STRIP:    num_primitives += num_vtx - 1; break;
+         case ALLEGRO_PRIM_TRIANGLE_LIST: num_primitives += num_vtx / 3; break;
+         default:                         num_primitives += num_vtx - 2; break;
+      }
+   }
+
+   _al_opengl_set_blender(disp);
+
+   glBindBuffer(GL_ARRAY_BUFFER, (GLuint)vertex_buffer->common.handle);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)index_buffer->common.handle);
+
+   setup_state((const char*)(uintptr_t)region_offset(&vertex_buffer->common), vertex_buffer->decl, texture);
+
+#if !defined ALLEGRO_CFG_OPENGLES
+   if (disp->ogl_extras->ogl_info.version >= _ALLEGRO_OPENGL_VERSION_1_4) {
+      glMultiDrawElements(mode, counts, idx_size, offsets, num_ranges);
+   }
+   else
+#endif
+   {
+      for (i = 0; i < num_ranges; i++)
+         glDrawElements(mode, counts[i], idx_size, offsets[i]);
+   }
+
+   revert_state(texture);
+
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+   fence_region(&vertex_buffer->common);
+   fence_region(&index_buffer->common);
+
+   if (counts != local_counts) {
+      al_free(counts);
+      al_free(offsets);
+   }
+
+   return num_primitives;
+}
+
 #endif /* ALLEGRO_CFG_OPENGL */
 
 int _al_draw_prim_opengl(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_VERTEX_DECL* decl, int start, int end, int type)
@@ -671,13 +807,44 @@ int _al_draw_indexed_buffer_opengl(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* textu
 #endif
 }
 
+int _al_draw_indexed_buffer_multi_opengl(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_INDEX_BUFFER* index_buffer, const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int type)
+{
 #ifdef ALLEGRO_CFG_OPENGL
+   return draw_indexed_buffer_multi_raw(target, texture, vertex_buffer, index_buffer, ranges, num_ranges, type);
+#else
+   (void)target;
+   (void)texture;
+   (void)vertex_buffer;
+   (void)index_buffer;
+   (void)ranges;
+   (void)num_ranges;
+   (void)type;
+
+   return 0;
+#endif
+}
+
+#ifdef ALLEGRO_CFG_OPENGL
+/* Stream buffers need unsynchronized mapping and fences. */
+static bool can_stream(void)
+{
+#if !defined ALLEGRO_CFG_OPENGLES
+   ALLEGRO_OGL_EXTRAS* ogl = al_get_current_display()->ogl_extras;
+
+   return ogl->extension_list->ALLEGRO_GL_ARB_sync &&
+      ogl->extension_list->ALLEGRO_GL_ARB_map_buffer_range;
+#else
+   return false;
+#endif
+}
+
 static bool create_buffer_common(ALLEGRO_BUFFER_COMMON* common, GLenum type, const void* initial_data, GLsizeiptr size, int flags)
 {
    GLuint vbo;
    GLenum usage;
+   int num_regions = 1;
 
-   switch (flags)
+   switch (flags & (ALLEGRO_PRIM_BUFFER_STREAM | ALLEGRO_PRIM_BUFFER_STATIC | ALLEGRO_PRIM_BUFFER_DYNAMIC))
    {
 #if !defined ALLEGRO_CFG_OPENGLES
       case ALLEGRO_PRIM_BUFFER_STREAM:
@@ -694,16 +861,31 @@ static bool create_buffer_common(ALLEGRO_BUFFER_COMMON* common, GLenum type, con
          usage = GL_STATIC_DRAW;
    }
 
+   if ((flags & ALLEGRO_PRIM_BUFFER_STREAM) && can_stream())
+      num_regions = _AL_PRIM_STREAM_REGIONS;
+
    glGenBuffers(1, &vbo);
    glBindBuffer(type, vbo);
-   glBufferData(type, size, initial_data, usage);
+   if (num_regions > 1) {
+      glBufferData(type, size * num_regions, NULL, usage);
+      if (initial_data)
+         glBufferSubData(type, 0, size, initial_data);
+   }
+   else {
+      glBufferData(type, size, initial_data, usage);
+   }
    glBindBuffer(type, 0);
 
-   if (glGetError())
+   if (glGetError()) {
+      glDeleteBuffers(1, &vbo);
       return false;
+   }
 
    common->handle = vbo;
    common->local_buffer_length = 0;
+   common->num_regions = num_regions;
+   common->region = 0;
+   common->region_length = size;
    return true;
 }
 #endif
@@ -738,11 +920,26 @@ bool _al_create_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf, const void* initi
 #endif
 }
 
+#ifdef ALLEGRO_CFG_OPENGL
+static void destroy_buffer_common(ALLEGRO_BUFFER_COMMON* common)
+{
+#if !defined ALLEGRO_CFG_OPENGLES
+   int i;
+
+   for (i = 0; i < common->num_regions; i++) {
+      if (common->fences[i])
+         glDeleteSync((GLsync)common->fences[i]);
+   }
+#endif
+   glDeleteBuffers(1, (GLuint*)&common->handle);
+   al_free(common->locked_memory);
+}
+#endif
+
 void _al_destroy_vertex_buffer_opengl(ALLEGRO_VERTEX_BUFFER* buf)
 {
 #ifdef ALLEGRO_CFG_OPENGL
-   glDeleteBuffers(1, (GLuint*)&buf->common.handle);
-   al_free(buf->common.locked_memory);
+   destroy_buffer_common(&buf->common);
 #else
    (void)buf;
 #endif
@@ -751,16 +948,62 @@ void _al_destroy_vertex_buffer_opengl(ALLEGRO_VERTEX_BUFFER* buf)
 void _al_destroy_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf)
 {
 #ifdef ALLEGRO_CFG_OPENGL
-   glDeleteBuffers(1, (GLuint*)&buf->common.handle);
-   al_free(buf->common.locked_memory);
+   destroy_buffer_common(&buf->common);
 #else
    (void)buf;
 #endif
 }
 
 #ifdef ALLEGRO_CFG_OPENGL
+#if !defined ALLEGRO_CFG_OPENGLES
+/* Waits until the GPU is done with the region. This is normally immediate,
+ * as the region was last drawn from a few locks ago.
+ */
+static void wait_for_region(ALLEGRO_BUFFER_COMMON* common, int region)
+{
+   GLsync fence = (GLsync)common->fences[region];
+
+   if (!fence)
+      return;
+
+   while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+      ;
+   glDeleteSync(fence);
+   common->fences[region] = NULL;
+}
+
+/* Write-only locks of stream buffers map the buffer directly without
+ * synchronizing with the GPU. A lock of the whole buffer replaces its
+ * contents, so it moves on to the next region while the GPU may still be
+ * drawing from the current one.
+ */
+static void* lock_stream_region(ALLEGRO_BUFFER_COMMON* common, GLenum type)
+{
+   GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+   void* ptr;
+
+   if (common->lock_offset == 0 && common->lock_length == common->region_length) {
+      common->region = (common->region + 1) % common->num_regions;
+      access |= GL_MAP_INVALIDATE_RANGE_BIT;
+   }
+   wait_for_region(common, common->region);
+
+   glBindBuffer(type, (GLuint)common->handle);
+   ptr = glMapBufferRange(type, region_offset(common) + common->lock_offset, common->lock_length, access);
+   glBindBuffer(type, 0);
+
+   common->is_mapped = ptr != NULL;
+   return ptr;
+}
+#endif
+
 static void* lock_buffer_common(ALLEGRO_BUFFER_COMMON* common, GLenum type)
 {
+#if !defined ALLEGRO_CFG_OPENGLES
+   if (common->num_regions > 1 && common->lock_flags == ALLEGRO_LOCK_WRITEONLY)
+      return lock_stream_region(common, type);
+#endif
+
    if (common->local_buffer_length < common->lock_length) {
       common->locked_memory = al_realloc(common->locked_memory, common->lock_length);
       common->local_buffer_length = common->lock_length;
@@ -769,7 +1012,7 @@ static void* lock_buffer_common(ALLEGRO_BUFFER_COMMON* common, GLenum type)
    if (common->lock_flags != ALLEGRO_LOCK_WRITEONLY) {
 #if !defined ALLEGRO_CFG_OPENGLES
       glBindBuffer(type, (GLuint)common->handle);
-      glGetBufferSubData(type, common->lock_offset, common->lock_length, common->locked_memory);
+      glGetBufferSubData(type, region_offset(common) + common->lock_offset, common->lock_length, common->locked_memory);
       glBindBuffer(type, 0);
       if (glGetError())
          return 0;
@@ -807,9 +1050,19 @@ void* _al_lock_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf)
 #ifdef ALLEGRO_CFG_OPENGL
 static void unlock_buffer_common(ALLEGRO_BUFFER_COMMON* common, GLenum type)
 {
+#if !defined ALLEGRO_CFG_OPENGLES
+   if (common->is_mapped) {
+      glBindBuffer(type, (GLuint)common->handle);
+      glUnmapBuffer(type);
+      glBindBuffer(type, 0);
+      common->is_mapped = false;
+      return;
+   }
+#endif
+
    if (common->lock_flags != ALLEGRO_LOCK_READONLY) {
       glBindBuffer(type, (GLuint)common->handle);
-      glBufferSubData(type, common->lock_offset, common->lock_length, common->locked_memory);
+      glBufferSubData(type, region_offset(common) + common->lock_offset, common->lock_length, common->locked_memory);
       glBindBuffer(type, 0);
    }
 }
@@ -832,3 +1085,44 @@ void _al_unlock_index_buffer_opengl(ALLEGRO_INDEX_BUFFER* buf)
    (void)buf;
 #endif
 }
+
+bool _al_set_shader_storage_buffer_opengl(const char *name,
+   ALLEGRO_VERTEX_BUFFER* buf, int binding)
+{
+#if defined ALLEGRO_CFG_OPENGL && !defined ALLEGRO_CFG_OPENGLES
+   ALLEGRO_SHADER* shader = al_get_current_shader();
+   GLuint program;
+   GLuint index;
+
+   if (!al_get_opengl_extension_list()->ALLEGRO_GL_ARB_shader_storage_buffer_object) {
+      ALLEGRO_WARN("Shader storage buffers are not supported\n");
+      return false;
+   }
+   if (!shader || !(program = _al_ogl_get_program_object(shader)))
+      return false;
+
+   /* Only the current region of a stream buffer is drawn from, and it moves
+    * whenever the buffer is locked.
+    */
+   if (buf && buf->common.num_regions > 1) {
+      ALLEGRO_WARN("Cannot use stream vertex buffer as storage buffer\n");
+      return false;
+   }
+
+   index = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, name);
+   if (index == GL_INVALID_INDEX) {
+      ALLEGRO_WARN("No buffer block '%s' in shader program\n", name);
+      return false;
+   }
+
+   glShaderStorageBlockBinding(program, index, binding);
+   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding,
+      buf ? (GLuint)buf->common.handle : 0);
+   return glGetError() == 0;
+#else
+   (void)name;
+   (void)buf;
+   (void)binding;
+   return false;
+#endif
+}
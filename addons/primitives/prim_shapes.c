@@ -0,0 +1,464 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Antialiased shapes drawn as single quads, with the coverage of
+ *      each pixel computed from the shape's signed distance function.
+ *
+ *
+ *      See readme.txt for copyright information.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_primitives.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_dtor.h"
+#include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_prim.h"
+#include "allegro5/internal/aintern_transform.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+ALLEGRO_DEBUG_CHANNEL("primitives")
+
+static bool antialiasing = false;
+
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+
+typedef struct SHAPE_VERTEX {
+   float x, y;
+   ALLEGRO_COLOR color;
+   /* Position in the shape's own frame and its half extents. */
+   float local[4];
+   /* Shape kind, corner radius or pie half-angle, half the thickness. */
+   float params[4];
+} SHAPE_VERTEX;
+
+typedef struct SHAPE_DISPLAY {
+   ALLEGRO_DISPLAY *display;
+   /* NULL if the shader could not be built for this display. */
+   ALLEGRO_SHADER *shader;
+} SHAPE_DISPLAY;
+
+/* Shapes drawn while the primitive drawing is held. They are kept apart
+ * from the other held primitives as they need their own shader, and only
+ * one of the two lists is ever non-empty.
+ */
+typedef struct HELD_SHAPES {
+   ALLEGRO_BITMAP *target;
+   SHAPE_VERTEX *vtxs;
+   int num_vtx;
+   int size;
+} HELD_SHAPES;
+
+#define MAX_HELD_SHAPE_VERTICES  65536
+
+static ALLEGRO_MUTEX *shape_mutex = NULL;
+static ALLEGRO_VERTEX_DECL *shape_decl = NULL;
+static SHAPE_DISPLAY *shape_displays = NULL;
+static int num_shape_displays = 0;
+static HELD_SHAPES held_shapes;
+
+static const char *shape_vertex_source =
+   "attribute vec4 " ALLEGRO_SHADER_VAR_POS ";\n"
+   "attribute vec4 " ALLEGRO_SHADER_VAR_COLOR ";\n"
+   "attribute vec4 " ALLEGRO_SHADER_VAR_USER_ATTR "0;\n"
+   "attribute vec4 " ALLEGRO_SHADER_VAR_USER_ATTR "1;\n"
+   "uniform mat4 " ALLEGRO_SHADER_VAR_PROJVIEW_MATRIX ";\n"
+   "varying vec4 varying_color;\n"
+   "varying vec4 varying_local;\n"
+   "varying vec4 varying_params;\n"
+   "void main()\n"
+   "{\n"
+   "  varying_color = " ALLEGRO_SHADER_VAR_COLOR ";\n"
+   "  varying_local = " ALLEGRO_SHADER_VAR_USER_ATTR "0;\n"
+   "  varying_params = " ALLEGRO_SHADER_VAR_USER_ATTR "1;\n"
+   "  gl_Position = " ALLEGRO_SHADER_VAR_PROJVIEW_MATRIX " * " ALLEGRO_SHADER_VAR_POS ";\n"
+   "}\n";
+
+/* The distance functions follow Inigo Quilez's well known formulations;
+ * the ellipse one is the usual first order approximation, which is exact
+ * on the outline itself.
+ */
+static const char *shape_pixel_source =
+   "#ifdef GL_ES\n"
+   "#extension GL_OES_standard_derivatives : enable\n"
+   "precision mediump float;\n"
+   "#endif\n"
+   "varying vec4 varying_color;\n"
+   "varying vec4 varying_local;\n"
+   "varying vec4 varying_params;\n"
+   "\n"
+   "float sd_box(vec2 p, vec2 b, float r)\n"
+   "{\n"
+   "  vec2 q = abs(p) - b + r;\n"
+   "  return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - r;\n"
+   "}\n"
+   "\n"
+   "float sd_ellipse(vec2 p, vec2 ab)\n"
+   "{\n"
+   "  float k0 = length(p / ab);\n"
+   "  float k1 = length(p / (ab * ab));\n"
+   "  if (k1 == 0.0)\n"
+   "    return -min(ab.x, ab.y);\n"
+   "  return k0 * (k0 - 1.0) / k1;\n"
+   "}\n"
+   "\n"
+   "float sd_pie(vec2 p, float r, float a)\n"
+   "{\n"
+   "  vec2 c = vec2(sin(a), cos(a));\n"
+   "  float l, m;\n"
+   "  p.x = abs(p.x);\n"
+   "  l = length(p) - r;\n"
+   "  m = length(p - c * clamp(dot(p, c), 0.0, r));\n"
+   "  return max(l, m * sign(c.y * p.x - c.x * p.y));\n"
+   "}\n"
+   "\n"
+   "void main()\n"
+   "{\n"
+   "  vec2 p = varying_local.xy;\n"
+   "  float d;\n"
+   "  if (varying_params.x < 0.5)\n"
+   "    d = sd_box(p, varying_local.zw, varying_params.y);\n"
+   "  else if (varying_params.x < 1.5)\n"
+   "    d = sd_ellipse(p, varying_local.zw);\n"
+   "  else\n"
+   "    d = sd_pie(p, varying_local.z, varying_params.y);\n"
+   "  if (varying_params.z > 0.0)\n"
+   "    d = abs(d) - varying_params.z;\n"
+   "  d /= max(fwidth(d), 0.0001);\n"
+   "  gl_FragColor = varying_color * clamp(0.5 - d, 0.0, 1.0);\n"
+   "}\n";
+
+static void display_invalidated(ALLEGRO_DISPLAY* display)
+{
+   int ii;
+
+   /*
+    * If there is no mutex, the addon has been shutdown earlier
+    */
+   if (!shape_mutex)
+      return;
+
+   al_lock_mutex(shape_mutex);
+
+   for (ii = 0; ii < num_shape_displays; ii++) {
+      if (shape_displays[ii].display == display) {
+         al_destroy_shader(shape_displays[ii].shader);
+         shape_displays[ii] = shape_displays[num_shape_displays - 1];
+         num_shape_displays--;
+         break;
+      }
+   }
+
+   al_unlock_mutex(shape_mutex);
+}
+
+static ALLEGRO_SHADER *create_shape_shader(void)
+{
+   ALLEGRO_SHADER *shader;
+
+   _al_push_destructor_owner();
+   shader = al_create_shader(ALLEGRO_SHADER_GLSL);
+   _al_pop_destructor_owner();
+
+   if (!shader)
+      return NULL;
+
+   if (!al_attach_shader_source(shader, ALLEGRO_VERTEX_SHADER, shape_vertex_source) ||
+       !al_attach_shader_source(shader, ALLEGRO_PIXEL_SHADER, shape_pixel_source) ||
+       !al_build_shader(shader)) {
+      ALLEGRO_ERROR("Building the shape shader failed: %s\n",
+         al_get_shader_log(shader));
+      al_destroy_shader(shader);
+      return NULL;
+   }
+   return shader;
+}
+
+/* Returns the shape shader of the target's display, creating it on first
+ * use. The target must be a display bitmap.
+ */
+static ALLEGRO_SHADER *get_shape_shader(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_VERTEX_ELEMENT elems[] = {
+      {ALLEGRO_PRIM_POSITION, ALLEGRO_PRIM_FLOAT_2, offsetof(SHAPE_VERTEX, x)},
+      {ALLEGRO_PRIM_COLOR_ATTR, 0, offsetof(SHAPE_VERTEX, color)},
+      {ALLEGRO_PRIM_USER_ATTR + 0, ALLEGRO_PRIM_FLOAT_4, offsetof(SHAPE_VERTEX, local)},
+      {ALLEGRO_PRIM_USER_ATTR + 1, ALLEGRO_PRIM_FLOAT_4, offsetof(SHAPE_VERTEX, params)},
+      {0, 0, 0}
+   };
+   ALLEGRO_SHADER *shader = NULL;
+   SHAPE_DISPLAY *new_displays;
+   int ii;
+
+   al_lock_mutex(shape_mutex);
+
+   if (!shape_decl) {
+      shape_decl = al_create_vertex_decl(elems, sizeof(SHAPE_VERTEX));
+      if (!shape_decl) {
+         al_unlock_mutex(shape_mutex);
+         return NULL;
+      }
+   }
+
+   for (ii = 0; ii < num_shape_displays; ii++) {
+      if (shape_displays[ii].display == display) {
+         shader = shape_displays[ii].shader;
+         al_unlock_mutex(shape_mutex);
+         return shader;
+      }
+   }
+
+   new_displays = al_realloc(shape_displays,
+      (num_shape_displays + 1) * sizeof(SHAPE_DISPLAY));
+   if (new_displays) {
+      shader = create_shape_shader();
+      shape_displays = new_displays;
+      shape_displays[num_shape_displays].display = display;
+      shape_displays[num_shape_displays].shader = shader;
+      num_shape_displays++;
+      _al_add_display_invalidated_callback(display, &display_invalidated);
+   }
+
+   al_unlock_mutex(shape_mutex);
+   return shader;
+}
+
+static bool can_draw_shapes(ALLEGRO_BITMAP *target)
+{
+   ALLEGRO_DISPLAY *display;
+   ALLEGRO_SHADER *current;
+   int flags;
+
+   if (!antialiasing || !shape_mutex || !target || al_get_target_command_list())
+      return false;
+   if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(target)))
+      return false;
+
+   display = _al_get_bitmap_display(target);
+   flags = al_get_display_flags(display);
+   if (!(flags & ALLEGRO_OPENGL) || !(flags & ALLEGRO_PROGRAMMABLE_PIPELINE))
+      return false;
+
+   /* A custom shader set by the user takes precedence. */
+   current = al_get_current_shader();
+   if (current && current != display->default_shader)
+      return false;
+
+   return get_shape_shader(display) != NULL;
+}
+
+static void draw_shape_vertices(ALLEGRO_BITMAP *target,
+   const SHAPE_VERTEX *vtxs, int num_vtx)
+{
+   ALLEGRO_SHADER *old = al_get_current_shader();
+
+   al_use_shader(get_shape_shader(_al_get_bitmap_display(target)));
+   al_draw_prim(vtxs, shape_decl, NULL, 0, num_vtx, ALLEGRO_PRIM_TRIANGLE_LIST);
+   al_use_shader(old);
+}
+
+void _al_prim_flush_held_shapes(void)
+{
+   HELD_SHAPES *h = &held_shapes;
+   ALLEGRO_BITMAP *old_target;
+   ALLEGRO_TRANSFORM old, ident;
+   int num_vtx;
+
+   if (h->num_vtx == 0)
+      return;
+
+   old_target = al_get_target_bitmap();
+   if (old_target != h->target)
+      al_set_target_bitmap(h->target);
+
+   /* Clear the count first, so al_draw_prim doesn't flush these again. */
+   num_vtx = h->num_vtx;
+   h->num_vtx = 0;
+
+   al_copy_transform(&old, al_get_current_transform());
+   al_identity_transform(&ident);
+   al_use_transform(&ident);
+   draw_shape_vertices(h->target, h->vtxs, num_vtx);
+   al_use_transform(&old);
+
+   if (old_target != h->target)
+      al_set_target_bitmap(old_target);
+}
+
+static bool hold_shape_vertices(ALLEGRO_BITMAP *target,
+   const SHAPE_VERTEX *vtxs, int num_vtx)
+{
+   HELD_SHAPES *h = &held_shapes;
+   const ALLEGRO_TRANSFORM *trans = al_get_current_transform();
+
+   _al_prim_flush_held_vertices();
+
+   if (target != h->target || h->num_vtx + num_vtx > MAX_HELD_SHAPE_VERTICES)
+      _al_prim_flush_held_shapes();
+
+   if (h->num_vtx + num_vtx > h->size) {
+      int size = _ALLEGRO_MAX(h->size * 2, 1024);
+      SHAPE_VERTEX *new_vtxs = al_realloc(h->vtxs, size * sizeof(SHAPE_VERTEX));
+      if (!new_vtxs) {
+         _al_prim_flush_held_shapes();
+         return false;
+      }
+      h->vtxs = new_vtxs;
+      h->size = size;
+   }
+
+   h->target = target;
+   memcpy(&h->vtxs[h->num_vtx], vtxs, num_vtx * sizeof(SHAPE_VERTEX));
+   _al_transform_coordinates_kind_n(trans, _al_get_current_transform_kind(),
+      &h->vtxs[h->num_vtx].x, sizeof(SHAPE_VERTEX), num_vtx, false);
+   h->num_vtx += num_vtx;
+   return true;
+}
+
+bool _al_prim_draw_shape(const _AL_PRIM_SHAPE *shape, ALLEGRO_COLOR color,
+   float scale)
+{
+   static const int corners[6][2] = {
+      {-1, -1}, {1, -1}, {1, 1}, {-1, -1}, {1, 1}, {-1, 1}
+   };
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   SHAPE_VERTEX vtxs[6];
+   float ht = shape->thickness > 0 ? shape->thickness / 2 : 0;
+   float margin, ex, ey;
+   int ii;
+
+   if (!can_draw_shapes(target))
+      return false;
+
+   /* Leave room for the antialiased edge, which is about a pixel wide. */
+   margin = scale > 0 ? 1.5f / scale : 1.5f;
+   if (shape->kind == _AL_PRIM_SHAPE_PIE) {
+      ex = ey = shape->hx + margin;
+   }
+   else {
+      ex = shape->hx + ht + margin;
+      ey = shape->hy + ht + margin;
+   }
+
+   for (ii = 0; ii < 6; ii++) {
+      SHAPE_VERTEX *v = &vtxs[ii];
+      float lx = corners[ii][0] * ex;
+      float ly = corners[ii][1] * ey;
+
+      /* The local y axis is the x axis turned by 90 degrees. */
+      v->x = shape->cx + lx * shape->ux - ly * shape->uy;
+      v->y = shape->cy + lx * shape->uy + ly * shape->ux;
+      v->color = color;
+      v->local[0] = lx;
+      v->local[1] = ly;
+      v->local[2] = shape->hx;
+      v->local[3] = shape->hy;
+      v->params[0] = shape->kind;
+      v->params[1] = shape->radius;
+      v->params[2] = ht;
+      v->params[3] = 0;
+   }
+
+   /* Shapes need their own shader, so they end a held bitmap batch. The
+    * display uses the identity transform while bitmap drawing is held.
+    */
+   if (al_is_bitmap_drawing_held()) {
+      _al_flush_vertex_cache(_al_get_bitmap_display(target),
+         ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+      _al_transform_coordinates_kind_n(al_get_current_transform(),
+         _al_get_current_transform_kind(), &vtxs[0].x, sizeof(SHAPE_VERTEX), 6,
+         false);
+   }
+   else if (al_is_primitive_drawing_held() &&
+         hold_shape_vertices(target, vtxs, 6)) {
+      return true;
+   }
+   draw_shape_vertices(target, vtxs, 6);
+   return true;
+}
+
+bool _al_prim_init_shapes(void)
+{
+   if (!shape_mutex)
+      shape_mutex = al_create_mutex();
+   return shape_mutex != NULL;
+}
+
+void _al_prim_shutdown_shapes(void)
+{
+   int ii;
+
+   for (ii = 0; ii < num_shape_displays; ii++) {
+      _al_remove_display_invalidated_callback(shape_displays[ii].display,
+         &display_invalidated);
+      al_destroy_shader(shape_displays[ii].shader);
+   }
+   al_free(shape_displays);
+   shape_displays = NULL;
+   num_shape_displays = 0;
+
+   al_free(held_shapes.vtxs);
+   memset(&held_shapes, 0, sizeof(held_shapes));
+
+   al_destroy_vertex_decl(shape_decl);
+   shape_decl = NULL;
+   al_destroy_mutex(shape_mutex);
+   shape_mutex = NULL;
+   antialiasing = false;
+}
+
+#else
+
+void _al_prim_flush_held_shapes(void)
+{
+}
+
+bool _al_prim_draw_shape(const _AL_PRIM_SHAPE *shape, ALLEGRO_COLOR color,
+   float scale)
+{
+   (void)shape;
+   (void)color;
+   (void)scale;
+   return false;
+}
+
+bool _al_prim_init_shapes(void)
+{
+   return true;
+}
+
+void _al_prim_shutdown_shapes(void)
+{
+   antialiasing = false;
+}
+
+#endif
+
+/* Function: al_set_primitive_antialiasing
+ */
+void al_set_primitive_antialiasing(bool onoff)
+{
+   antialiasing = onoff;
+}
+
+/* Function: al_get_primitive_antialiasing
+ */
+bool al_get_primitive_antialiasing(void)
+{
+   return antialiasing;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -25,6 +25,7 @@
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_prim_soft.h"
 #include "allegro5/internal/aintern_prim.h"
+#include "allegro5/internal/aintern_transform.h"
 #include "allegro5/internal/aintern_tri_soft.h"
 
 /*
@@ -32,6 +33,11 @@ The vertex cache allows for bulk transformation of vertices, for faster run spee
 */
 #define LOCAL_VERTEX_CACHE  ALLEGRO_VERTEX vertex_cache[ALLEGRO_VERTEX_CACHE_SIZE]
 
+/*
+Cached triangles are handed over as one batch, so that they can be drawn in parallel
+*/
+#define LOCAL_INDEX_CACHE   int index_cache[3 * ALLEGRO_VERTEX_CACHE_SIZE]
+
 static void convert_vtx(ALLEGRO_BITMAP* texture, const char* src, ALLEGRO_VERTEX* dest, const ALLEGRO_VERTEX_DECL* decl)
 {
    ALLEGRO_VERTEX_ELEMENT* e;
@@ -101,6 +107,105 @@ static void convert_vtx(ALLEGRO_BITMAP* texture, const char* src, ALLEGRO_VERTEX
    }
 }
 
+/*
+Triangles of larger primitives are handed to the rasterizer in batches of this many
+*/
+#define TRIANGLE_BATCH_SIZE  16384
+
+/*
+Draws a triangle list, strip or fan too large for the vertex cache in batches, so
+that they can be drawn in parallel. Vertices in the ALLEGRO_VERTEX layout which
+need no transformation are used straight from the user's array, others are
+converted once up front. The triangles have their vertices in the same order as
+when drawing them one at a time. Returns false if out of memory.
+*/
+static bool draw_triangle_batches(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_VERTEX_DECL* decl, int start, int end, int type)
+{
+   const ALLEGRO_TRANSFORM* global_trans = al_get_current_transform();
+   int stride = decl ? decl->stride : (int)sizeof(ALLEGRO_VERTEX);
+   int num_vtx = end - start;
+   ALLEGRO_VERTEX* converted = NULL;
+   ALLEGRO_VERTEX* vtx;
+   int* indices;
+   float dx, dy;
+   int ii;
+   int n = 0;
+
+   if (!decl && _al_transform_is_translation(global_trans, &dx, &dy) && dx == 0 && dy == 0) {
+      /* The rasterizer only reads the vertices. */
+      vtx = (ALLEGRO_VERTEX*)vtxs + start;
+   }
+   else {
+      const char* vtxptr = (const char*)vtxs + start * stride;
+
+      converted = al_malloc(num_vtx * sizeof(ALLEGRO_VERTEX));
+      if (!converted)
+         return false;
+      for (ii = 0; ii < num_vtx; ii++) {
+         convert_vtx(texture, vtxptr, &converted[ii], decl);
+         vtxptr += stride;
+      }
+      al_transform_coordinates_n(global_trans, &converted[0].x,
+         sizeof(ALLEGRO_VERTEX), num_vtx);
+      vtx = converted;
+   }
+
+   indices = al_malloc(3 * TRIANGLE_BATCH_SIZE * sizeof(int));
+   if (!indices) {
+      al_free(converted);
+      return false;
+   }
+
+#define PUSH_TRIANGLE(a, b, c)                                       \
+   indices[n++] = (a);                                               \
+   indices[n++] = (b);                                               \
+   indices[n++] = (c);                                               \
+   if (n == 3 * TRIANGLE_BATCH_SIZE) {                               \
+      _al_draw_soft_triangles(texture, vtx, indices, n / 3);         \
+      n = 0;                                                         \
+   }
+
+   switch (type) {
+      case ALLEGRO_PRIM_TRIANGLE_LIST: {
+         for (ii = 0; ii < num_vtx - 2; ii += 3) {
+            PUSH_TRIANGLE(ii, ii + 1, ii + 2);
+         }
+         break;
+      };
+      case ALLEGRO_PRIM_TRIANGLE_STRIP: {
+         /* The serial path keeps the last three vertices in a ring. */
+         for (ii = 2; ii < num_vtx; ii++) {
+            PUSH_TRIANGLE(ii - ii % 3, ii - (ii - 1) % 3, ii - (ii - 2) % 3);
+         }
+         break;
+      };
+      case ALLEGRO_PRIM_TRIANGLE_FAN: {
+         /* The serial path keeps even and odd vertices in two slots, and
+          * starts with a degenerate triangle.
+          */
+         PUSH_TRIANGLE(0, 1, 1);
+         for (ii = 2; ii < num_vtx; ii++) {
+            if (ii % 2) {
+               PUSH_TRIANGLE(0, ii - 1, ii);
+            }
+            else {
+               PUSH_TRIANGLE(0, ii, ii - 1);
+            }
+         }
+         break;
+      };
+   }
+
+#undef PUSH_TRIANGLE
+
+   if (n > 0)
+      _al_draw_soft_triangles(texture, vtx, indices, n / 3);
+
+   al_free(indices);
+   al_free(converted);
+   return true;
+}
+
 int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_VERTEX_DECL* decl, int start, int end, int type)
 {
    LOCAL_VERTEX_CACHE;
@@ -123,10 +228,11 @@ int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_
       const char* vtxptr = (const char*)vtxs + start * stride;
       for (ii = 0; ii < num_vtx; ii++) {
          convert_vtx(texture, vtxptr, &vertex_cache[ii], decl);
-         al_transform_coordinates(global_trans, &vertex_cache[ii].x, &vertex_cache[ii].y);
          n++;
          vtxptr += stride;
       }
+      al_transform_coordinates_n(global_trans, &vertex_cache[0].x,
+         sizeof(ALLEGRO_VERTEX), num_vtx);
    }
    
 #define SET_VERTEX(v, idx)                                             \
@@ -198,11 +304,16 @@ int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_
       };
       case ALLEGRO_PRIM_TRIANGLE_LIST: {
          if (use_cache) {
+            LOCAL_INDEX_CACHE;
             int ii;
+            int n = 0;
             for (ii = 0; ii < num_vtx - 2; ii += 3) {
-               _al_triangle_2d(texture, &vertex_cache[ii], &vertex_cache[ii + 1], &vertex_cache[ii + 2]);
+               index_cache[n++] = ii;
+               index_cache[n++] = ii + 1;
+               index_cache[n++] = ii + 2;
             }
-         } else {
+            _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
+         } else if (!draw_triangle_batches(texture, vtxs, decl, start, end, type)) {
             int ii;
             for (ii = start; ii < end - 2; ii += 3) {
                ALLEGRO_VERTEX v1, v2, v3;
@@ -218,11 +329,16 @@ int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_
       };
       case ALLEGRO_PRIM_TRIANGLE_STRIP: {
          if (use_cache) {
+            LOCAL_INDEX_CACHE;
             int ii;
+            int n = 0;
             for (ii = 2; ii < num_vtx; ii++) {
-               _al_triangle_2d(texture, &vertex_cache[ii - 2], &vertex_cache[ii - 1], &vertex_cache[ii]);
+               index_cache[n++] = ii - 2;
+               index_cache[n++] = ii - 1;
+               index_cache[n++] = ii;
             }
-         } else {
+            _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
+         } else if (!draw_triangle_batches(texture, vtxs, decl, start, end, type)) {
             int ii;
             int idx = 2;
             ALLEGRO_VERTEX vtx[3];
@@ -240,11 +356,16 @@ int _al_draw_prim_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const ALLEGRO_
       };
       case ALLEGRO_PRIM_TRIANGLE_FAN: {
          if (use_cache) {
+            LOCAL_INDEX_CACHE;
             int ii;
+            int n = 0;
             for (ii = 1; ii < num_vtx; ii++) {
-               _al_triangle_2d(texture, &vertex_cache[0], &vertex_cache[ii], &vertex_cache[ii - 1]);
+               index_cache[n++] = 0;
+               index_cache[n++] = ii;
+               index_cache[n++] = ii - 1;
             }
-         } else {
+            _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
+         } else if (!draw_triangle_batches(texture, vtxs, decl, start, end, type)) {
             int ii;
             int idx = 1;
             ALLEGRO_VERTEX v0;
@@ -415,13 +536,19 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
       };
       case ALLEGRO_PRIM_TRIANGLE_LIST: {
          if (use_cache) {
+            LOCAL_INDEX_CACHE;
             int ii;
+            int n = 0;
             for (ii = 0; ii < num_vtx - 2; ii += 3) {
-               int idx1 = indices[ii] - min_idx;
-               int idx2 = indices[ii + 1] - min_idx;
-               int idx3 = indices[ii + 2] - min_idx;
-               _al_triangle_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2], &vertex_cache[idx3]);
+               if (n == 3 * ALLEGRO_VERTEX_CACHE_SIZE) {
+                  _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
+                  n = 0;
+               }
+               index_cache[n++] = indices[ii] - min_idx;
+               index_cache[n++] = indices[ii + 1] - min_idx;
+               index_cache[n++] = indices[ii + 2] - min_idx;
             }
+            _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
          } else {
             int ii;
             for (ii = 0; ii < num_vtx - 2; ii += 3) {
@@ -442,13 +569,19 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
       };
       case ALLEGRO_PRIM_TRIANGLE_STRIP: {
          if (use_cache) {
+            LOCAL_INDEX_CACHE;
             int ii;
+            int n = 0;
             for (ii = 2; ii < num_vtx; ii++) {
-               int idx1 = indices[ii - 2] - min_idx;
-               int idx2 = indices[ii - 1] - min_idx;
-               int idx3 = indices[ii] - min_idx;
-               _al_triangle_2d(texture, &vertex_cache[idx1], &vertex_cache[idx2], &vertex_cache[idx3]);
+               if (n == 3 * ALLEGRO_VERTEX_CACHE_SIZE) {
+                  _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
+                  n = 0;
+               }
+               index_cache[n++] = indices[ii - 2] - min_idx;
+               index_cache[n++] = indices[ii - 1] - min_idx;
+               index_cache[n++] = indices[ii] - min_idx;
             }
+            _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
          } else {
             int ii;
             int idx = 2;
@@ -467,13 +600,20 @@ int _al_draw_prim_indexed_soft(ALLEGRO_BITMAP* texture, const void* vtxs, const
       };
       case ALLEGRO_PRIM_TRIANGLE_FAN: {
          if (use_cache) {
+            LOCAL_INDEX_CACHE;
             int ii;
+            int n = 0;
             int idx0 = indices[0] - min_idx;
             for (ii = 1; ii < num_vtx; ii++) {
-               int idx1 = indices[ii] - min_idx;
-               int idx2 = indices[ii - 1] - min_idx;
-               _al_triangle_2d(texture, &vertex_cache[idx0], &vertex_cache[idx1], &vertex_cache[idx2]);
+               if (n == 3 * ALLEGRO_VERTEX_CACHE_SIZE) {
+                  _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
+                  n = 0;
+               }
+               index_cache[n++] = idx0;
+               index_cache[n++] = indices[ii] - min_idx;
+               index_cache[n++] = indices[ii - 1] - min_idx;
             }
+            _al_draw_soft_triangles(texture, vertex_cache, index_cache, n / 3);
          } else {
             int ii;
             int idx = 1;
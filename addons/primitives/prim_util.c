@@ -170,6 +170,8 @@ void _al_prim_cache_init(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGR
 
 void _al_prim_cache_init_ex(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color, void* user_data)
 {
+   cache->vertices  = cache->buffer;
+   cache->capacity  = ALLEGRO_VERTEX_CACHE_SIZE;
    cache->size      = 0;
    cache->current   = cache->buffer;
    cache->color     = color;
@@ -177,9 +179,42 @@ void _al_prim_cache_init_ex(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALL
    cache->user_data = user_data;
 }
 
+/*
+ *  Like _al_prim_cache_init, but room for about 'num_vertices' vertices is
+ *  allocated up front, so that long primitives are drawn in one go rather
+ *  than in ALLEGRO_VERTEX_CACHE_SIZE chunks. The cache must be released
+ *  with _al_prim_cache_term.
+ */
+void _al_prim_cache_init_bulk(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color, size_t num_vertices)
+{
+   _al_prim_cache_init_ex(cache, prim_type, color, NULL);
+
+   if (num_vertices > _AL_PRIM_MAX_BULK_VERTICES)
+      num_vertices = _AL_PRIM_MAX_BULK_VERTICES;
+
+   if (num_vertices > ALLEGRO_VERTEX_CACHE_SIZE) {
+
+      ALLEGRO_VERTEX* vertices = al_malloc(num_vertices * sizeof(ALLEGRO_VERTEX));
+
+      /* Fall back to the small buffer if there is no memory. */
+      if (vertices) {
+         cache->vertices = vertices;
+         cache->capacity = num_vertices;
+         cache->current  = vertices;
+      }
+   }
+}
+
 void _al_prim_cache_term(ALLEGRO_PRIM_VERTEX_CACHE* cache)
 {
    _al_prim_cache_flush(cache);
+
+   if (cache->vertices != cache->buffer) {
+      al_free(cache->vertices);
+      cache->vertices = cache->buffer;
+      cache->capacity = ALLEGRO_VERTEX_CACHE_SIZE;
+      cache->current  = cache->buffer;
+   }
 }
 
 void _al_prim_cache_flush(ALLEGRO_PRIM_VERTEX_CACHE* cache)
@@ -188,26 +223,28 @@ void _al_prim_cache_flush(ALLEGRO_PRIM_VERTEX_CACHE* cache)
       return;
 
    if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE)
-      al_draw_prim(cache->buffer, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_TRIANGLE_LIST);
+      al_draw_prim(cache->vertices, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_TRIANGLE_LIST);
    else if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP)
-      al_draw_prim(cache->buffer, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_LINE_STRIP);
+      al_draw_prim(cache->vertices, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_LINE_STRIP);
+   else if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_LINE_LIST)
+      al_draw_prim(cache->vertices, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_LINE_LIST);
 
    if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP)
    {
-      cache->buffer[0] = *(cache->current - 1);
-      cache->current   = cache->buffer + 1;
-      cache->size      = 1;
+      cache->vertices[0] = *(cache->current - 1);
+      cache->current     = cache->vertices + 1;
+      cache->size        = 1;
    }
    else
    {
-      cache->current = cache->buffer;
+      cache->current = cache->vertices;
       cache->size    = 0;
    }
 }
 
 void _al_prim_cache_push_triangle(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v0, const float* v1, const float* v2)
 {
-   if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 3))
+   if (cache->size >= (cache->capacity - 3))
       _al_prim_cache_flush(cache);
 
    cache->current->x     = v0[0];
@@ -236,9 +273,31 @@ void _al_prim_cache_push_triangle(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float*
    //al_draw_triangle(v0[0], v0[1], v1[0], v1[1], v2[0], v2[1], cache->color, 1.0f);
 }
 
+void _al_prim_cache_push_line(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v0, const float* v1)
+{
+   if (cache->size >= (cache->capacity - 2))
+      _al_prim_cache_flush(cache);
+
+   cache->current->x     = v0[0];
+   cache->current->y     = v0[1];
+   cache->current->z     = 0.0f;
+   cache->current->color = cache->color;
+
+   ++cache->current;
+
+   cache->current->x     = v1[0];
+   cache->current->y     = v1[1];
+   cache->current->z     = 0.0f;
+   cache->current->color = cache->color;
+
+   ++cache->current;
+
+   cache->size += 2;
+}
+
 void _al_prim_cache_push_point(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v)
 {
-   if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 1))
+   if (cache->size >= (cache->capacity - 1))
       _al_prim_cache_flush(cache);
 
    cache->current->x     = v[0];
@@ -23,13 +23,17 @@
 #include "allegro5/platform/alplatf.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_command_list.h"
+#include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_pixels.h"
 #include "allegro5/internal/aintern_prim.h"
 #include "allegro5/internal/aintern_prim_directx.h"
 #include "allegro5/internal/aintern_prim_opengl.h"
 #include "allegro5/internal/aintern_prim_soft.h"
+#include "allegro5/internal/aintern_transform.h"
 #include <math.h>
+#include <string.h>
 
 #ifdef ALLEGRO_CFG_OPENGL
 #include "allegro5/allegro_opengl.h"
@@ -43,12 +47,16 @@ ALLEGRO_DEBUG_CHANNEL("primitives")
 
 static bool addon_initialized = false;
 
+static void free_held_prims(void);
+
 /* Function: al_init_primitives_addon
  */
 bool al_init_primitives_addon(void)
 {
    bool ret = true;
    ret &= _al_init_d3d_driver();
+   ret &= _al_prim_init_arc_cache();
+   ret &= _al_prim_init_shapes();
    
    addon_initialized = ret;
    
@@ -68,25 +76,112 @@ bool al_is_primitives_addon_initialized(void)
  */
 void al_shutdown_primitives_addon(void)
 {
+   free_held_prims();
+   _al_prim_shutdown_shapes();
+   _al_prim_shutdown_arc_cache();
    _al_shutdown_d3d_driver();
    addon_initialized = false;
 }
 
-/* Function: al_draw_prim
+/* Primitives drawn while recording a command list. Plain ALLEGRO_VERTEX
+ * positions are transformed while recording, other vertex declarations keep
+ * the transform to be drawn with instead.
  */
-int al_draw_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
-   ALLEGRO_BITMAP* texture, int start, int end, int type)
-{  
-   ALLEGRO_BITMAP *target;
-   int ret = 0;
- 
-   ASSERT(addon_initialized);
-   ASSERT(vtxs);
-   ASSERT(end >= start);
-   ASSERT(start >= 0);
-   ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
+typedef struct RECORDED_PRIM {
+   void *vtxs;
+   const ALLEGRO_VERTEX_DECL *decl;
+   ALLEGRO_BITMAP *texture;
+   int num_vtx;
+   int type;
+   ALLEGRO_TRANSFORM transform;
+} RECORDED_PRIM;
+
+static void replay_prim(void *data)
+{
+   RECORDED_PRIM *prim = data;
+   ALLEGRO_TRANSFORM backup;
+
+   al_copy_transform(&backup, al_get_current_transform());
+   al_use_transform(&prim->transform);
+   al_draw_prim(prim->vtxs, prim->decl, prim->texture, 0, prim->num_vtx,
+      prim->type);
+   al_use_transform(&backup);
+}
 
-   target = al_get_target_bitmap();
+static void destroy_prim(void *data)
+{
+   RECORDED_PRIM *prim = data;
+   al_free(prim->vtxs);
+   al_free(prim);
+}
+
+static int count_prims(int num_vtx, int type)
+{
+   switch (type) {
+      case ALLEGRO_PRIM_LINE_LIST:
+         return num_vtx / 2;
+      case ALLEGRO_PRIM_LINE_STRIP:
+         return _ALLEGRO_MAX(num_vtx - 1, 0);
+      case ALLEGRO_PRIM_TRIANGLE_LIST:
+         return num_vtx / 3;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         return _ALLEGRO_MAX(num_vtx - 2, 0);
+      default:
+         return num_vtx;
+   }
+}
+
+static int record_prim(ALLEGRO_COMMAND_LIST *list, const void *vtxs,
+   const ALLEGRO_VERTEX_DECL *decl, ALLEGRO_BITMAP *texture,
+   const int *indices, int start, int num_vtx, int type)
+{
+   int stride = decl ? decl->stride : (int)sizeof(ALLEGRO_VERTEX);
+   RECORDED_PRIM *prim;
+   int i;
+
+   if (num_vtx <= 0)
+      return 0;
+
+   prim = al_malloc(sizeof *prim);
+   if (!prim)
+      return 0;
+   prim->vtxs = al_malloc(num_vtx * stride);
+   if (!prim->vtxs) {
+      al_free(prim);
+      return 0;
+   }
+
+   /* Indexed primitives are stored expanded. */
+   for (i = 0; i < num_vtx; i++) {
+      int j = indices ? indices[i] : start + i;
+      memcpy((char *)prim->vtxs + i * stride,
+         (const char *)vtxs + j * stride, stride);
+   }
+
+   if (decl) {
+      al_copy_transform(&prim->transform, al_get_current_transform());
+   }
+   else {
+      ALLEGRO_VERTEX *v = prim->vtxs;
+      al_transform_coordinates_3d_n(al_get_current_transform(),
+         &v[0].x, sizeof(ALLEGRO_VERTEX), num_vtx);
+      al_identity_transform(&prim->transform);
+   }
+   prim->decl = decl;
+   prim->texture = texture;
+   prim->num_vtx = num_vtx;
+   prim->type = type;
+
+   _al_command_list_add_callback(list, replay_prim, destroy_prim, prim);
+   return count_prims(num_vtx, type);
+}
+
+static int draw_prim(ALLEGRO_BITMAP *target, const void* vtxs,
+   const ALLEGRO_VERTEX_DECL* decl, ALLEGRO_BITMAP* texture,
+   int start, int end, int type)
+{
+   int ret = 0;
 
    /* In theory, if we ever get a camera concept for this addon, the transformation into
     * view space should occur here
@@ -108,6 +203,319 @@ int al_draw_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    return ret;
 }
 
+/* Primitives drawn while the drawing is held. They are collected into a
+ * single list of triangles, lines or points as long as the target and the
+ * texture stay the same. As with held bitmap drawing, the positions are
+ * transformed as they come in and drawn later with the identity transform.
+ */
+typedef struct HELD_PRIMS {
+   bool held;
+   ALLEGRO_BITMAP *target;
+   ALLEGRO_BITMAP *texture;
+   int type;
+   ALLEGRO_VERTEX *vtxs;
+   int num_vtx;
+   int size;
+} HELD_PRIMS;
+
+/* Held primitives are drawn once they reach this many vertices. */
+#define MAX_HELD_VERTICES  65536
+
+static HELD_PRIMS held_prims;
+
+/* Scratch space for primitives drawn while bitmap drawing is held. */
+static ALLEGRO_VERTEX *bitmap_held_vtxs;
+static int bitmap_held_size;
+
+ALLEGRO_STATIC_ASSERT(primitives,
+   sizeof(ALLEGRO_VERTEX) == sizeof(_AL_PRIM_VERTEX));
+
+void _al_prim_flush_held_vertices(void)
+{
+   HELD_PRIMS *h = &held_prims;
+   ALLEGRO_BITMAP *old_target;
+   ALLEGRO_TRANSFORM old, ident;
+
+   if (h->num_vtx == 0)
+      return;
+
+   old_target = al_get_target_bitmap();
+   if (old_target != h->target)
+      al_set_target_bitmap(h->target);
+
+   al_copy_transform(&old, al_get_current_transform());
+   al_identity_transform(&ident);
+   al_use_transform(&ident);
+   draw_prim(h->target, h->vtxs, NULL, h->texture, 0, h->num_vtx, h->type);
+   al_use_transform(&old);
+
+   if (old_target != h->target)
+      al_set_target_bitmap(old_target);
+
+   h->num_vtx = 0;
+}
+
+static void flush_held_prims(void)
+{
+   _al_prim_flush_held_shapes();
+   _al_prim_flush_held_vertices();
+}
+
+static void free_held_prims(void)
+{
+   al_free(held_prims.vtxs);
+   memset(&held_prims, 0, sizeof(held_prims));
+   al_free(bitmap_held_vtxs);
+   bitmap_held_vtxs = NULL;
+   bitmap_held_size = 0;
+}
+
+/* Returns the number of vertices of the primitive converted to a list, and
+ * the type of the list, or -1 if it can't be converted.
+ */
+static int list_size(int num_vtx, int type, int *list_type)
+{
+   switch (type) {
+      case ALLEGRO_PRIM_TRIANGLE_LIST:
+         *list_type = ALLEGRO_PRIM_TRIANGLE_LIST;
+         return num_vtx / 3 * 3;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         *list_type = ALLEGRO_PRIM_TRIANGLE_LIST;
+         return 3 * _ALLEGRO_MAX(num_vtx - 2, 0);
+      case ALLEGRO_PRIM_LINE_LIST:
+         *list_type = ALLEGRO_PRIM_LINE_LIST;
+         return num_vtx / 2 * 2;
+      case ALLEGRO_PRIM_LINE_STRIP:
+         *list_type = ALLEGRO_PRIM_LINE_LIST;
+         return 2 * _ALLEGRO_MAX(num_vtx - 1, 0);
+      case ALLEGRO_PRIM_LINE_LOOP:
+         *list_type = ALLEGRO_PRIM_LINE_LIST;
+         return num_vtx >= 2 ? 2 * num_vtx : 0;
+      case ALLEGRO_PRIM_POINT_LIST:
+         *list_type = ALLEGRO_PRIM_POINT_LIST;
+         return num_vtx;
+      default:
+         *list_type = -1;
+         return 0;
+   }
+}
+
+/* Writes the n vertices of the primitive converted to a list, with their
+ * positions transformed by the current transform.
+ */
+static void make_list(ALLEGRO_VERTEX *out, const ALLEGRO_VERTEX *in,
+   const int *indices, int start, int num_vtx, int type, int n)
+{
+   ALLEGRO_VERTEX *first = out;
+   int i;
+
+#define VTX(i) in[indices ? indices[i] : start + (i)]
+   switch (type) {
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+         for (i = 0; i + 2 < num_vtx; i++) {
+            /* Every other triangle is flipped to keep the winding. */
+            *out++ = VTX(i + (i & 1));
+            *out++ = VTX(i + 1 - (i & 1));
+            *out++ = VTX(i + 2);
+         }
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         for (i = 1; i + 1 < num_vtx; i++) {
+            *out++ = VTX(0);
+            *out++ = VTX(i);
+            *out++ = VTX(i + 1);
+         }
+         break;
+      case ALLEGRO_PRIM_LINE_STRIP:
+      case ALLEGRO_PRIM_LINE_LOOP:
+         for (i = 0; i + 1 < num_vtx; i++) {
+            *out++ = VTX(i);
+            *out++ = VTX(i + 1);
+         }
+         if (type == ALLEGRO_PRIM_LINE_LOOP && num_vtx >= 2) {
+            *out++ = VTX(num_vtx - 1);
+            *out++ = VTX(0);
+         }
+         break;
+      default:
+         for (i = 0; i < n; i++)
+            *out++ = VTX(i);
+         break;
+   }
+#undef VTX
+
+   _al_transform_coordinates_kind_n(al_get_current_transform(),
+      _al_get_current_transform_kind(), &first->x, sizeof(ALLEGRO_VERTEX), n,
+      true);
+}
+
+/* Adds a primitive to the held ones, converted to a list. Returns false if
+ * it has to be drawn right away instead, after the held ones.
+ */
+static bool hold_prim(const void *vtxs, const ALLEGRO_VERTEX_DECL *decl,
+   ALLEGRO_BITMAP *texture, const int *indices, int start, int num_vtx,
+   int type)
+{
+   HELD_PRIMS *h = &held_prims;
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   int list_type, n;
+
+   _al_prim_flush_held_shapes();
+
+   n = list_size(num_vtx, type, &list_type);
+
+   /* Drawing in software gains nothing from holding. */
+   if (decl || list_type < 0 || n > MAX_HELD_VERTICES ||
+       al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
+       (texture && al_get_bitmap_flags(texture) & ALLEGRO_MEMORY_BITMAP) ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(target))) {
+      flush_held_prims();
+      return false;
+   }
+
+   if (target != h->target || texture != h->texture || list_type != h->type ||
+       h->num_vtx + n > MAX_HELD_VERTICES) {
+      flush_held_prims();
+   }
+
+   if (h->num_vtx + n > h->size) {
+      int size = _ALLEGRO_MAX(_ALLEGRO_MAX(h->size * 2, h->num_vtx + n), 1024);
+      ALLEGRO_VERTEX *new_vtxs = al_realloc(h->vtxs, size * sizeof(ALLEGRO_VERTEX));
+      if (!new_vtxs) {
+         flush_held_prims();
+         return false;
+      }
+      h->vtxs = new_vtxs;
+      h->size = size;
+   }
+
+   h->target = target;
+   h->texture = texture;
+   h->type = list_type;
+
+   make_list(h->vtxs + h->num_vtx, vtxs, indices, start, num_vtx, type, n);
+   h->num_vtx += n;
+   return true;
+}
+
+/* Draws a primitive while bitmap drawing is held. Triangles are added to
+ * the held bitmaps, so that both are drawn in order in the same batch if
+ * the display can. Otherwise the held bitmaps are drawn first, and the
+ * primitive is drawn with its positions transformed here, as the display
+ * uses the identity transform while bitmap drawing is held. Returns false
+ * if it has to be drawn right away instead.
+ */
+static bool draw_with_held_bitmaps(const void *vtxs,
+   const ALLEGRO_VERTEX_DECL *decl, ALLEGRO_BITMAP *texture,
+   const int *indices, int start, int num_vtx, int type)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   ALLEGRO_TRANSFORM old, ident;
+   int list_type, n;
+
+   /* Software drawing is not affected by the batch. */
+   if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(target)))
+      return false;
+
+   flush_held_prims();
+
+   /* Larger batches than held primitives allow would not fit into the
+    * display's vertex ring either, so they are drawn on their own.
+    */
+   n = list_size(num_vtx, type, &list_type);
+   if (decl || list_type < 0 || n > MAX_HELD_VERTICES ||
+       (texture && al_get_bitmap_flags(texture) & ALLEGRO_MEMORY_BITMAP)) {
+      _al_flush_vertex_cache(_al_get_bitmap_display(target),
+         ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+      return false;
+   }
+   if (n == 0)
+      return true;
+
+   if (n > bitmap_held_size) {
+      int size = _ALLEGRO_MAX(n, 1024);
+      ALLEGRO_VERTEX *new_vtxs = al_realloc(bitmap_held_vtxs,
+         size * sizeof(ALLEGRO_VERTEX));
+      if (!new_vtxs) {
+         _al_flush_vertex_cache(_al_get_bitmap_display(target),
+            ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+         return false;
+      }
+      bitmap_held_vtxs = new_vtxs;
+      bitmap_held_size = size;
+   }
+
+   make_list(bitmap_held_vtxs, vtxs, indices, start, num_vtx, type, n);
+   if (list_type == ALLEGRO_PRIM_TRIANGLE_LIST) {
+      if (_al_draw_held_triangles(texture,
+            (const _AL_PRIM_VERTEX *)bitmap_held_vtxs, n))
+         return true;
+   }
+   else {
+      _al_flush_vertex_cache(_al_get_bitmap_display(target),
+         ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+   }
+
+   al_copy_transform(&old, al_get_current_transform());
+   al_identity_transform(&ident);
+   al_use_transform(&ident);
+   draw_prim(target, bitmap_held_vtxs, NULL, texture, 0, n, list_type);
+   al_use_transform(&old);
+   return true;
+}
+
+/* Function: al_hold_primitive_drawing
+ */
+void al_hold_primitive_drawing(bool hold)
+{
+   ASSERT(addon_initialized);
+
+   if (!hold)
+      flush_held_prims();
+   held_prims.held = hold;
+}
+
+/* Function: al_is_primitive_drawing_held
+ */
+bool al_is_primitive_drawing_held(void)
+{
+   return held_prims.held;
+}
+
+/* Function: al_draw_prim
+ */
+int al_draw_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
+   ALLEGRO_BITMAP* texture, int start, int end, int type)
+{  
+   ALLEGRO_BITMAP *target;
+ 
+   ASSERT(addon_initialized);
+   ASSERT(vtxs);
+   ASSERT(end >= start);
+   ASSERT(start >= 0);
+   ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
+
+   if (al_get_target_command_list()) {
+      return record_prim(al_get_target_command_list(), vtxs, decl, texture,
+         NULL, start, end - start, type);
+   }
+
+   if (al_is_bitmap_drawing_held()) {
+      if (draw_with_held_bitmaps(vtxs, decl, texture, NULL, start,
+            end - start, type))
+         return count_prims(end - start, type);
+   }
+   else if (held_prims.held) {
+      if (hold_prim(vtxs, decl, texture, NULL, start, end - start, type))
+         return count_prims(end - start, type);
+   }
+
+   target = al_get_target_bitmap();
+   return draw_prim(target, vtxs, decl, texture, start, end, type);
+}
+
 /* Function: al_draw_indexed_prim
  */
 int al_draw_indexed_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
@@ -122,6 +530,21 @@ int al_draw_indexed_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    ASSERT(num_vtx > 0);
    ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
 
+   if (al_get_target_command_list()) {
+      return record_prim(al_get_target_command_list(), vtxs, decl, texture,
+         indices, 0, num_vtx, type);
+   }
+
+   if (al_is_bitmap_drawing_held()) {
+      if (draw_with_held_bitmaps(vtxs, decl, texture, indices, 0, num_vtx,
+            type))
+         return count_prims(num_vtx, type);
+   }
+   else if (held_prims.held) {
+      if (hold_prim(vtxs, decl, texture, indices, 0, num_vtx, type))
+         return count_prims(num_vtx, type);
+   }
+
    target = al_get_target_bitmap();
    
    /* In theory, if we ever get a camera concept for this addon, the transformation into
@@ -269,19 +692,92 @@ fail:
    return 0;
 }
 
+/* Replaces the restart positions in [offset, offset + length) with those of
+ * the index data just written there.
+ */
+static void update_restarts(ALLEGRO_INDEX_BUFFER* buffer, const void* data, int offset, int length)
+{
+   int* restarts;
+   int num_restarts = 0;
+   int ii;
+
+   restarts = al_malloc((buffer->num_restarts + length) * sizeof(int));
+   if (!restarts)
+      return;
+
+   for (ii = 0; ii < buffer->num_restarts && buffer->restarts[ii] < offset; ii++)
+      restarts[num_restarts++] = buffer->restarts[ii];
+
+   for (ii = 0; ii < length; ii++) {
+      bool is_restart = buffer->index_size == 4 ?
+         ((const uint32_t*)data)[ii] == 0xFFFFFFFF :
+         ((const uint16_t*)data)[ii] == 0xFFFF;
+      if (is_restart)
+         restarts[num_restarts++] = offset + ii;
+   }
+
+   for (ii = 0; ii < buffer->num_restarts; ii++) {
+      if (buffer->restarts[ii] >= offset + length)
+         restarts[num_restarts++] = buffer->restarts[ii];
+   }
+
+   al_free(buffer->restarts);
+   buffer->restarts = restarts;
+   buffer->num_restarts = num_restarts;
+}
+
+/* Picks 16 bit indices for int data when they all fit, the restart index
+ * aside. Returns the converted data, or NULL if 32 bit indices are needed.
+ */
+static uint16_t* compact_indices(const int* indices, int num_indices, bool restart)
+{
+   unsigned int max_index = restart ? 0xFFFE : 0xFFFF;
+   uint16_t* compact;
+   int ii;
+
+   for (ii = 0; ii < num_indices; ii++) {
+      if ((unsigned int)indices[ii] > max_index && !(restart && indices[ii] == -1))
+         return NULL;
+   }
+
+   compact = al_malloc(num_indices * sizeof(uint16_t));
+   if (compact) {
+      for (ii = 0; ii < num_indices; ii++)
+         compact[ii] = (uint16_t)indices[ii];
+   }
+   return compact;
+}
+
 /* Function: al_create_index_buffer
  */
 ALLEGRO_INDEX_BUFFER* al_create_index_buffer(int index_size,
     const void* initial_data, int num_indices, int flags)
 {
    ALLEGRO_INDEX_BUFFER* ret;
+   uint16_t* compact = NULL;
    int display_flags = al_get_display_flags(al_get_current_display());
    ASSERT(addon_initialized);
-   ASSERT(index_size == 2 || index_size == 4);
+   ASSERT(index_size == 0 || index_size == 2 || index_size == 4);
+
+   if (index_size == 0) {
+      index_size = 4;
+      if (initial_data) {
+         compact = compact_indices(initial_data, num_indices, flags & ALLEGRO_PRIM_BUFFER_PRIMITIVE_RESTART);
+         if (compact) {
+            index_size = 2;
+            initial_data = compact;
+         }
+      }
+   }
+
    ret = al_calloc(1, sizeof(ALLEGRO_INDEX_BUFFER));
    ret->common.size = num_indices;
    ret->common.write_only = !(flags & ALLEGRO_PRIM_BUFFER_READWRITE);
    ret->index_size = index_size;
+   ret->restart = (flags & ALLEGRO_PRIM_BUFFER_PRIMITIVE_RESTART) != 0;
+
+   if (ret->restart && initial_data)
+      update_restarts(ret, initial_data, 0, num_indices);
 
 #if defined ALLEGRO_IPHONE || defined ALLEGRO_ANDROID
    if (flags & ALLEGRO_PRIM_BUFFER_READWRITE)
@@ -294,17 +790,23 @@ ALLEGRO_INDEX_BUFFER* al_create_index_buffer(int index_size,
 #endif
 
    if (display_flags & ALLEGRO_OPENGL) {
-      if (_al_create_index_buffer_opengl(ret, initial_data, num_indices, flags))
+      if (_al_create_index_buffer_opengl(ret, initial_data, num_indices, flags)) {
+         al_free(compact);
          return ret;
+      }
    }
    else if (display_flags & ALLEGRO_DIRECT3D) {
-      if (_al_create_index_buffer_directx(ret, initial_data, num_indices, flags))
+      if (_al_create_index_buffer_directx(ret, initial_data, num_indices, flags)) {
+         al_free(compact);
          return ret;
+      }
    }
 
    /* Silence the warning */
    goto fail;
 fail:
+   al_free(compact);
+   al_free(ret->restarts);
    al_free(ret);
    return NULL;
 }
@@ -350,6 +852,7 @@ void al_destroy_index_buffer(ALLEGRO_INDEX_BUFFER* buffer)
       _al_destroy_index_buffer_directx(buffer);
    }
 
+   al_free(buffer->restarts);
    al_free(buffer);
 }
 
@@ -411,14 +914,16 @@ void* al_lock_index_buffer(ALLEGRO_INDEX_BUFFER* buffer, int offset,
       return NULL;
 
    if (disp_flags & ALLEGRO_OPENGL) {
-      return _al_lock_index_buffer_opengl(buffer);
+      buffer->lock_ptr = _al_lock_index_buffer_opengl(buffer);
    }
    else if (disp_flags & ALLEGRO_DIRECT3D) {
-      return _al_lock_index_buffer_directx(buffer);
+      buffer->lock_ptr = _al_lock_index_buffer_directx(buffer);
    }
    else {
-      return NULL;
+      buffer->lock_ptr = NULL;
    }
+
+   return buffer->lock_ptr;
 }
 
 /* Function: al_unlock_vertex_buffer
@@ -442,6 +947,23 @@ void al_unlock_vertex_buffer(ALLEGRO_VERTEX_BUFFER* buffer)
    }
 }
 
+/* Function: al_set_shader_storage_buffer
+ */
+bool al_set_shader_storage_buffer(const char* name, ALLEGRO_VERTEX_BUFFER* buffer, int binding)
+{
+   int flags = al_get_display_flags(al_get_current_display());
+   ASSERT(name);
+   ASSERT(addon_initialized);
+
+   if (buffer && buffer->common.is_locked)
+      return false;
+
+   if (flags & ALLEGRO_OPENGL) {
+      return _al_set_shader_storage_buffer_opengl(name, buffer, binding);
+   }
+   return false;
+}
+
 /* Function: al_unlock_index_buffer
  */
 void al_unlock_index_buffer(ALLEGRO_INDEX_BUFFER* buffer)
@@ -455,6 +977,11 @@ void al_unlock_index_buffer(ALLEGRO_INDEX_BUFFER* buffer)
 
    buffer->common.is_locked = false;
 
+   if (buffer->restart && buffer->common.lock_flags != ALLEGRO_LOCK_READONLY) {
+      update_restarts(buffer, buffer->lock_ptr, buffer->common.lock_offset / buffer->index_size,
+         buffer->common.lock_length / buffer->index_size);
+   }
+
    if (flags & ALLEGRO_OPENGL) {
       _al_unlock_index_buffer_opengl(buffer);
    }
@@ -523,6 +1050,8 @@ int al_draw_vertex_buffer(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
    ASSERT(vertex_buffer);
    ASSERT(!vertex_buffer->common.is_locked);
 
+   flush_held_prims();
+
    target = al_get_target_bitmap();
 
    if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
@@ -561,6 +1090,15 @@ int al_draw_indexed_buffer(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
    ASSERT(index_buffer);
    ASSERT(!index_buffer->common.is_locked);
 
+   if (index_buffer->num_restarts > 0) {
+      ALLEGRO_DRAW_RANGE range;
+      range.start = start;
+      range.end = end;
+      return al_draw_indexed_buffer_multi(vertex_buffer, texture, index_buffer, &range, 1, type);
+   }
+
+   flush_held_prims();
+
    target = al_get_target_bitmap();
 
    if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
@@ -580,6 +1118,124 @@ int al_draw_indexed_buffer(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
    return ret;
 }
 
+/* Splits the ranges at the restart indices of the buffer. Returns the new
+ * ranges, to be freed by the caller, or NULL if there is no memory.
+ */
+static ALLEGRO_DRAW_RANGE* split_at_restarts(ALLEGRO_INDEX_BUFFER* index_buffer,
+   const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int* num_split)
+{
+   ALLEGRO_DRAW_RANGE* split;
+   int n = 0;
+   int ii, jj = 0;
+
+   split = al_malloc((num_ranges + index_buffer->num_restarts) * sizeof(ALLEGRO_DRAW_RANGE));
+   if (!split)
+      return NULL;
+
+   for (ii = 0; ii < num_ranges; ii++) {
+      int start = ranges[ii].start;
+      int end = ranges[ii].end;
+
+      /* Ranges may be in any order. */
+      if (jj > 0 && index_buffer->restarts[jj - 1] >= start)
+         jj = 0;
+      while (jj < index_buffer->num_restarts && index_buffer->restarts[jj] < start)
+         jj++;
+
+      for (; jj < index_buffer->num_restarts && index_buffer->restarts[jj] < end; jj++) {
+         if (index_buffer->restarts[jj] > start) {
+            split[n].start = start;
+            split[n].end = index_buffer->restarts[jj];
+            n++;
+         }
+         start = index_buffer->restarts[jj] + 1;
+      }
+      if (end > start) {
+         split[n].start = start;
+         split[n].end = end;
+         n++;
+      }
+   }
+
+   *num_split = n;
+   return split;
+}
+
+static int draw_indexed_ranges(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
+   ALLEGRO_BITMAP* texture, ALLEGRO_INDEX_BUFFER* index_buffer,
+   const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int type)
+{
+   ALLEGRO_BITMAP *target;
+   int ret = 0;
+   int i;
+
+   flush_held_prims();
+
+   target = al_get_target_bitmap();
+
+   if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP ||
+       (texture && al_get_bitmap_flags(texture) & ALLEGRO_MEMORY_BITMAP) ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(target))) {
+      for (i = 0; i < num_ranges; i++)
+         ret += _al_draw_buffer_common_soft(vertex_buffer, texture, index_buffer, ranges[i].start, ranges[i].end, type);
+   } else {
+      int flags = al_get_display_flags(al_get_current_display());
+      if (flags & ALLEGRO_OPENGL) {
+         ret = _al_draw_indexed_buffer_multi_opengl(target, texture, vertex_buffer, index_buffer, ranges, num_ranges, type);
+      }
+      else if (flags & ALLEGRO_DIRECT3D) {
+         /* Direct3D 9 has no multi-draw, but the state stays the same. */
+         for (i = 0; i < num_ranges; i++)
+            ret += _al_draw_indexed_buffer_directx(target, texture, vertex_buffer, index_buffer, ranges[i].start, ranges[i].end, type);
+      }
+   }
+
+   return ret;
+}
+
+/* Function: al_draw_indexed_buffer_multi
+ */
+int al_draw_indexed_buffer_multi(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
+   ALLEGRO_BITMAP* texture, ALLEGRO_INDEX_BUFFER* index_buffer,
+   const ALLEGRO_DRAW_RANGE* ranges, int num_ranges, int type)
+{
+   ALLEGRO_DRAW_RANGE* split;
+   int ret;
+
+   ASSERT(addon_initialized);
+   ASSERT(ranges || num_ranges == 0);
+   ASSERT(num_ranges >= 0);
+   ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
+   ASSERT(vertex_buffer);
+   ASSERT(!vertex_buffer->common.is_locked);
+   ASSERT(index_buffer);
+   ASSERT(!index_buffer->common.is_locked);
+
+#ifdef DEBUGMODE
+   {
+      int i;
+      for (i = 0; i < num_ranges; i++) {
+         ASSERT(ranges[i].end >= ranges[i].start);
+         ASSERT(ranges[i].start >= 0);
+         ASSERT(ranges[i].end <= al_get_index_buffer_size(index_buffer));
+      }
+   }
+#endif
+
+   if (num_ranges == 0)
+      return 0;
+
+   if (index_buffer->num_restarts == 0)
+      return draw_indexed_ranges(vertex_buffer, texture, index_buffer, ranges, num_ranges, type);
+
+   split = split_at_restarts(index_buffer, ranges, num_ranges, &num_ranges);
+   if (!split)
+      return 0;
+   ret = draw_indexed_ranges(vertex_buffer, texture, index_buffer, split, num_ranges, type);
+   al_free(split);
+   return ret;
+}
+
 /* Function: al_get_vertex_buffer_size
  */
 int al_get_vertex_buffer_size(ALLEGRO_VERTEX_BUFFER* buffer)
@@ -595,3 +1251,11 @@ int al_get_index_buffer_size(ALLEGRO_INDEX_BUFFER* buffer)
    ASSERT(buffer);
    return buffer->common.size;
 }
+
+/* Function: al_get_index_buffer_index_size
+ */
+int al_get_index_buffer_index_size(ALLEGRO_INDEX_BUFFER* buffer)
+{
+   ASSERT(buffer);
+   return buffer->index_size;
+}
@@ -0,0 +1,343 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Tile layers kept in vertex buffers.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_primitives.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_transform.h"
+#include <math.h>
+
+ALLEGRO_DEBUG_CHANNEL("primitives")
+
+/* Tiles are grouped into square chunks of this many tiles per side. Each
+ * tile has a quad of four vertices and six indices. The quads are stored
+ * chunk by chunk, row by row of chunks, and row by row within a chunk, so
+ * that the visible chunks of a row of chunks are one range of indices.
+ * Empty tiles have all four vertices in one place.
+ */
+#define CHUNK_SIZE 32
+
+struct ALLEGRO_TILE_LAYER {
+   ALLEGRO_BITMAP *atlas;
+   int tile_w, tile_h;
+   int width, height;
+   int atlas_columns;
+   int num_atlas_tiles;
+   int *tiles;
+   ALLEGRO_VERTEX_BUFFER *vertex_buffer;
+   ALLEGRO_INDEX_BUFFER *index_buffer;
+   int chunks_w, chunks_h;
+   ALLEGRO_DRAW_RANGE *ranges;
+};
+
+
+/* Returns the position of the tile's quad in the vertex buffer, in quads. */
+static int quad_index(const ALLEGRO_TILE_LAYER *layer, int x, int y)
+{
+   int cx = x / CHUNK_SIZE;
+   int cy = y / CHUNK_SIZE;
+   int chunk_w = _ALLEGRO_MIN(CHUNK_SIZE, layer->width - cx * CHUNK_SIZE);
+   int chunk_h = _ALLEGRO_MIN(CHUNK_SIZE, layer->height - cy * CHUNK_SIZE);
+
+   return cy * CHUNK_SIZE * layer->width + cx * CHUNK_SIZE * chunk_h +
+      (y % CHUNK_SIZE) * chunk_w + x % CHUNK_SIZE;
+}
+
+
+static void make_quad(const ALLEGRO_TILE_LAYER *layer, int x, int y,
+   int tile, ALLEGRO_VERTEX *v)
+{
+   ALLEGRO_COLOR white = al_map_rgb_f(1, 1, 1);
+   float x0 = x * layer->tile_w;
+   float y0 = y * layer->tile_h;
+   float x1 = x0, y1 = y0;
+   float u0 = 0, v0 = 0, u1 = 0, v1 = 0;
+   int i;
+
+   if (tile >= 0) {
+      x1 = x0 + layer->tile_w;
+      y1 = y0 + layer->tile_h;
+      u0 = (tile % layer->atlas_columns) * layer->tile_w;
+      v0 = (tile / layer->atlas_columns) * layer->tile_h;
+      u1 = u0 + layer->tile_w;
+      v1 = v0 + layer->tile_h;
+   }
+
+   for (i = 0; i < 4; i++) {
+      v[i].z = 0;
+      v[i].color = white;
+   }
+   v[0].x = x0; v[0].y = y0; v[0].u = u0; v[0].v = v0;
+   v[1].x = x1; v[1].y = y0; v[1].u = u1; v[1].v = v0;
+   v[2].x = x1; v[2].y = y1; v[2].u = u1; v[2].v = v1;
+   v[3].x = x0; v[3].y = y1; v[3].u = u0; v[3].v = v1;
+}
+
+
+static bool build_buffers(ALLEGRO_TILE_LAYER *layer, int flags)
+{
+   int num_quads = layer->width * layer->height;
+   ALLEGRO_VERTEX *vtxs;
+   int *indices;
+   int x, y, i;
+
+   vtxs = al_malloc(num_quads * 4 * sizeof(ALLEGRO_VERTEX));
+   indices = al_malloc(num_quads * 6 * sizeof(int));
+   if (!vtxs || !indices) {
+      al_free(vtxs);
+      al_free(indices);
+      return false;
+   }
+
+   for (y = 0; y < layer->height; y++) {
+      for (x = 0; x < layer->width; x++) {
+         make_quad(layer, x, y, layer->tiles[y * layer->width + x],
+            &vtxs[quad_index(layer, x, y) * 4]);
+      }
+   }
+   for (i = 0; i < num_quads; i++) {
+      indices[i * 6 + 0] = i * 4 + 0;
+      indices[i * 6 + 1] = i * 4 + 1;
+      indices[i * 6 + 2] = i * 4 + 2;
+      indices[i * 6 + 3] = i * 4 + 0;
+      indices[i * 6 + 4] = i * 4 + 2;
+      indices[i * 6 + 5] = i * 4 + 3;
+   }
+
+   layer->vertex_buffer = al_create_vertex_buffer(NULL, vtxs, num_quads * 4,
+      flags ? flags : ALLEGRO_PRIM_BUFFER_STATIC);
+   layer->index_buffer = al_create_index_buffer(0, indices, num_quads * 6,
+      ALLEGRO_PRIM_BUFFER_STATIC);
+
+   al_free(vtxs);
+   al_free(indices);
+   return layer->vertex_buffer && layer->index_buffer;
+}
+
+
+/* Function: al_create_tile_layer
+ */
+ALLEGRO_TILE_LAYER *al_create_tile_layer(ALLEGRO_BITMAP *atlas,
+   int tile_w, int tile_h, int width, int height, const int *tiles,
+   int flags)
+{
+   ALLEGRO_TILE_LAYER *layer;
+   int num_tiles;
+   int i;
+   ASSERT(atlas);
+   ASSERT(tile_w > 0 && tile_h > 0);
+   ASSERT(width > 0 && height > 0);
+
+   layer = al_calloc(1, sizeof(*layer));
+   if (!layer)
+      return NULL;
+
+   layer->atlas = atlas;
+   layer->tile_w = tile_w;
+   layer->tile_h = tile_h;
+   layer->width = width;
+   layer->height = height;
+   layer->atlas_columns = _ALLEGRO_MAX(al_get_bitmap_width(atlas) / tile_w, 1);
+   layer->num_atlas_tiles = layer->atlas_columns *
+      (al_get_bitmap_height(atlas) / tile_h);
+   layer->chunks_w = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+   layer->chunks_h = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+   num_tiles = width * height;
+   layer->tiles = al_malloc(num_tiles * sizeof(int));
+   layer->ranges = al_malloc(layer->chunks_h * sizeof(ALLEGRO_DRAW_RANGE));
+   if (!layer->tiles || !layer->ranges)
+      goto fail;
+
+   for (i = 0; i < num_tiles; i++) {
+      int tile = tiles ? tiles[i] : -1;
+      layer->tiles[i] = tile < layer->num_atlas_tiles ? _ALLEGRO_MAX(tile, -1)
+         : -1;
+   }
+
+   if (!build_buffers(layer, flags)) {
+      ALLEGRO_ERROR("Could not create the buffers of a %dx%d tile layer.\n",
+         width, height);
+      goto fail;
+   }
+
+   return layer;
+
+fail:
+   al_destroy_tile_layer(layer);
+   return NULL;
+}
+
+
+/* Function: al_destroy_tile_layer
+ */
+void al_destroy_tile_layer(ALLEGRO_TILE_LAYER *layer)
+{
+   if (!layer)
+      return;
+
+   if (layer->vertex_buffer)
+      al_destroy_vertex_buffer(layer->vertex_buffer);
+   if (layer->index_buffer)
+      al_destroy_index_buffer(layer->index_buffer);
+   al_free(layer->tiles);
+   al_free(layer->ranges);
+   al_free(layer);
+}
+
+
+/* Function: al_set_tile_layer_tile
+ */
+bool al_set_tile_layer_tile(ALLEGRO_TILE_LAYER *layer, int x, int y,
+   int tile)
+{
+   ALLEGRO_VERTEX *v;
+   ASSERT(layer);
+
+   if (x < 0 || y < 0 || x >= layer->width || y >= layer->height ||
+         tile >= layer->num_atlas_tiles)
+      return false;
+   if (tile < 0)
+      tile = -1;
+   if (layer->tiles[y * layer->width + x] == tile)
+      return true;
+
+   v = al_lock_vertex_buffer(layer->vertex_buffer,
+      quad_index(layer, x, y) * 4, 4, ALLEGRO_LOCK_WRITEONLY);
+   if (!v)
+      return false;
+   make_quad(layer, x, y, tile, v);
+   al_unlock_vertex_buffer(layer->vertex_buffer);
+
+   layer->tiles[y * layer->width + x] = tile;
+   return true;
+}
+
+
+/* Function: al_get_tile_layer_tile
+ */
+int al_get_tile_layer_tile(const ALLEGRO_TILE_LAYER *layer, int x, int y)
+{
+   ASSERT(layer);
+
+   if (x < 0 || y < 0 || x >= layer->width || y >= layer->height)
+      return -1;
+   return layer->tiles[y * layer->width + x];
+}
+
+
+/* Finds the tiles which may show up in the clipping rectangle of the
+ * target, when drawn with the transform. Returns false if that can't be
+ * told, and every tile has to be drawn.
+ */
+static bool visible_tiles(const ALLEGRO_TILE_LAYER *layer,
+   const ALLEGRO_TRANSFORM *trans, int *tx1, int *ty1, int *tx2, int *ty2)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   const float (*m)[4] = trans->m;
+   float min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+   int cx, cy, cw, ch;
+   float det;
+   int i;
+
+   if (!target || al_get_target_command_list())
+      return false;
+   if (_al_classify_transform(trans) == _AL_TRANSFORM_PROJECTIVE)
+      return false;
+
+   /* Positions in the plane of the layer map to normalized device
+    * coordinates as ndc = A * (x, y) + b.
+    */
+   det = m[0][0] * m[1][1] - m[1][0] * m[0][1];
+   if (fabsf(det) < 1e-12f)
+      return false;
+
+   al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+   for (i = 0; i < 4; i++) {
+      float px = (i & 1) ? cx + cw : cx;
+      float py = (i & 2) ? cy + ch : cy;
+      float nx = 2.0f * px / target->w - 1.0f - m[3][0];
+      float ny = 1.0f - 2.0f * py / target->h - m[3][1];
+      float x = (m[1][1] * nx - m[1][0] * ny) / det;
+      float y = (m[0][0] * ny - m[0][1] * nx) / det;
+
+      if (i == 0 || x < min_x) min_x = x;
+      if (i == 0 || x > max_x) max_x = x;
+      if (i == 0 || y < min_y) min_y = y;
+      if (i == 0 || y > max_y) max_y = y;
+   }
+
+   /* A tile touching the rectangle may still cover a pixel center. */
+   *tx1 = (int)floorf(min_x / layer->tile_w) - 1;
+   *ty1 = (int)floorf(min_y / layer->tile_h) - 1;
+   *tx2 = (int)floorf(max_x / layer->tile_w) + 1;
+   *ty2 = (int)floorf(max_y / layer->tile_h) + 1;
+   return true;
+}
+
+
+/* Function: al_draw_tile_layer
+ */
+int al_draw_tile_layer(ALLEGRO_TILE_LAYER *layer, float dx, float dy)
+{
+   ALLEGRO_TRANSFORM backup, t, view;
+   int cx1 = 0, cy1 = 0, cx2 = layer->chunks_w - 1, cy2 = layer->chunks_h - 1;
+   int tx1, ty1, tx2, ty2;
+   int num_ranges = 0;
+   int ret;
+   int cy;
+   ASSERT(layer);
+
+   al_copy_transform(&backup, al_get_current_transform());
+   al_identity_transform(&t);
+   al_translate_transform(&t, dx, dy);
+   al_compose_transform(&t, &backup);
+
+   al_copy_transform(&view, &t);
+   al_compose_transform(&view, al_get_current_projection_transform());
+   if (visible_tiles(layer, &view, &tx1, &ty1, &tx2, &ty2)) {
+      if (tx2 < 0 || ty2 < 0 || tx1 >= layer->width || ty1 >= layer->height)
+         return 0;
+      cx1 = _ALLEGRO_MAX(tx1, 0) / CHUNK_SIZE;
+      cy1 = _ALLEGRO_MAX(ty1, 0) / CHUNK_SIZE;
+      cx2 = _ALLEGRO_MIN(tx2, layer->width - 1) / CHUNK_SIZE;
+      cy2 = _ALLEGRO_MIN(ty2, layer->height - 1) / CHUNK_SIZE;
+   }
+
+   for (cy = cy1; cy <= cy2; cy++) {
+      int chunk_h = _ALLEGRO_MIN(CHUNK_SIZE, layer->height - cy * CHUNK_SIZE);
+      int row = cy * CHUNK_SIZE * layer->width;
+      int first = row + cx1 * CHUNK_SIZE * chunk_h;
+      int last = row + _ALLEGRO_MIN((cx2 + 1) * CHUNK_SIZE, layer->width) *
+         chunk_h;
+      ALLEGRO_DRAW_RANGE *r = &layer->ranges[num_ranges++];
+
+      r->start = first * 6;
+      r->end = last * 6;
+   }
+
+   al_use_transform(&t);
+   ret = al_draw_indexed_buffer_multi(layer->vertex_buffer, layer->atlas,
+      layer->index_buffer, layer->ranges, num_ranges,
+      ALLEGRO_PRIM_TRIANGLE_LIST);
+   al_use_transform(&backup);
+   return ret;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
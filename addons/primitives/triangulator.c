@@ -19,10 +19,13 @@
 
 # include "allegro5/allegro.h"
 # include "allegro5/allegro_primitives.h"
+# include "allegro5/internal/aintern.h"
 # include "allegro5/internal/aintern_prim.h"
 # include "allegro5/internal/aintern_list.h"
 # include <float.h>
+# include <limits.h>
 # include <math.h>
+# include <stdlib.h>
 
 
 # define POLY_DEBUG 0
@@ -808,6 +811,440 @@ static void poly_do_triangulate(POLY* polygon)
 }
 
 
+/*
+ *  Triangulator for large polygons.
+ *
+ *  The algorithm is the same as above: holes are bridged into the outline
+ *  and ears are clipped afterwards. The vertices live in a single array
+ *  and are linked by indices, and instead of keeping a list of reflex
+ *  vertices for the ear tests, all vertices are kept in a uniform grid so
+ *  that only those around the tested triangle are visited.
+ */
+# define POLY_FAST_MIN_VERTICES   256
+
+typedef struct POLY_NODE {
+   const float*   point;
+   int            index;
+   int            prev;
+   int            next;
+   int            cell;
+   int            cell_prev;
+   int            cell_next;
+} POLY_NODE;
+
+typedef struct POLY_FAST {
+   POLY_NODE*  nodes;
+   int         node_count;
+   int*        cells;
+   int         grid_width;
+   int         grid_height;
+   float       grid_x;
+   float       grid_y;
+   float       grid_scale;
+} POLY_FAST;
+
+
+static float poly_fast_cross(POLY_FAST* poly, int a, int b, int c)
+{
+   const float* v0 = poly->nodes[a].point;
+   const float* v1 = poly->nodes[b].point;
+   const float* v2 = poly->nodes[c].point;
+
+   return (v0[0] - v1[0]) * (v2[1] - v1[1]) - (v0[1] - v1[1]) * (v2[0] - v1[0]);
+}
+
+
+static bool poly_fast_is_reflex(POLY_FAST* poly, int i)
+{
+   return poly_fast_cross(poly, poly->nodes[i].prev, i, poly->nodes[i].next) < 0;
+}
+
+
+static int poly_fast_cell_coord(float v, float origin, float scale, int size)
+{
+   int c = (int)((v - origin) * scale);
+
+   return c < 0 ? 0 : (c >= size ? size - 1 : c);
+}
+
+
+static void poly_fast_grid_insert(POLY_FAST* poly, int i)
+{
+   POLY_NODE* node = poly->nodes + i;
+   int cx = poly_fast_cell_coord(node->point[0], poly->grid_x, poly->grid_scale, poly->grid_width);
+   int cy = poly_fast_cell_coord(node->point[1], poly->grid_y, poly->grid_scale, poly->grid_height);
+
+   node->cell      = cy * poly->grid_width + cx;
+   node->cell_prev = -1;
+   node->cell_next = poly->cells[node->cell];
+   if (node->cell_next >= 0)
+      poly->nodes[node->cell_next].cell_prev = i;
+   poly->cells[node->cell] = i;
+}
+
+
+static void poly_fast_grid_remove(POLY_FAST* poly, int i)
+{
+   POLY_NODE* node = poly->nodes + i;
+
+   if (node->cell_prev >= 0)
+      poly->nodes[node->cell_prev].cell_next = node->cell_next;
+   else
+      poly->cells[node->cell] = node->cell_next;
+
+   if (node->cell_next >= 0)
+      poly->nodes[node->cell_next].cell_prev = node->cell_prev;
+}
+
+
+static int poly_fast_insert_after(POLY_FAST* poly, int after, const float* point, int index)
+{
+   int i = poly->node_count++;
+   POLY_NODE* node = poly->nodes + i;
+
+   node->point = point;
+   node->index = index;
+   if (after < 0) {
+      node->prev = i;
+      node->next = i;
+   }
+   else {
+      node->prev = after;
+      node->next = poly->nodes[after].next;
+      poly->nodes[node->next].prev = i;
+      poly->nodes[after].next = i;
+   }
+
+   return i;
+}
+
+
+/*
+ *  Find where to bridge the hole whose rightmost vertex is 'point' into
+ *  the outline starting at 'start'. See poly_find_outter_split_vertex.
+ */
+static int poly_fast_find_split_vertex(POLY_FAST* poly, int start, const float* point)
+{
+   float v1[2] = { point[0] + 1.0f, point[1] };
+   float intersection[2];
+   float best_point[2] = { 0, 0 };
+   float best_t = FLT_MAX;
+   float best_distance;
+   float t0, t1;
+   int best_e0 = -1;
+   int best_e1 = -1;
+   int best_vertex;
+   int vertex;
+   const float* p;
+   int i;
+
+   i = start;
+   do {
+      int next = poly->nodes[i].next;
+      const float* p0 = poly->nodes[i].point;
+      const float* p1 = poly->nodes[next].point;
+
+      if (!((p0[1] < p1[1]) || (p0[0] <= point[0] && p1[0] <= point[0])) &&
+          _al_prim_intersect_segment(point, v1, p0, p1, intersection, &t0, &t1) &&
+          (t1 >= 0.0f) && (t1 <= 1.0f) && (t0 >= 0.0f) && (t0 < best_t)) {
+
+         best_t        = t0;
+         best_point[0] = intersection[0];
+         best_point[1] = intersection[1];
+         best_e0       = i;
+         best_e1       = next;
+      }
+
+      i = next;
+   } while (i != start);
+
+   if (best_e0 < 0)
+      return -1;
+
+   if (_al_prim_are_points_equal(point, poly->nodes[best_e0].point))
+      return best_e0;
+
+   if (_al_prim_are_points_equal(point, poly->nodes[best_e1].point))
+      return best_e1;
+
+   if (poly->nodes[best_e0].point[0] > poly->nodes[best_e1].point[0])
+      vertex = best_e0;
+   else
+      vertex = best_e1;
+   p = poly->nodes[vertex].point;
+
+   /* Seek in reflex vertices. */
+   best_vertex   = -1;
+   best_distance = FLT_MAX;
+
+   i = start;
+   do {
+      const float* reflex_point = poly->nodes[i].point;
+
+      if (poly_fast_is_reflex(poly, i) &&
+          _al_prim_is_point_in_triangle(reflex_point, point, p, best_point)) {
+
+         float diff_x = reflex_point[0] - point[0];
+         float diff_y = reflex_point[1] - point[1];
+         float dist = diff_x * diff_x + diff_y * diff_y;
+
+         if (dist < best_distance) {
+
+            best_distance = dist;
+            best_vertex   = i;
+         }
+      }
+
+      i = poly->nodes[i].next;
+   } while (i != start);
+
+   return best_vertex >= 0 ? best_vertex : vertex;
+}
+
+
+static int poly_fast_compare_splits(const void* a, const void* b)
+{
+   const POLY_SPLIT* split_a = (const POLY_SPLIT*)a;
+   const POLY_SPLIT* split_b = (const POLY_SPLIT*)b;
+
+   /* Rightmost holes go first, keeping their order otherwise. */
+   if (split_a->point[0] > split_b->point[0])
+      return -1;
+   if (split_a->point[0] < split_b->point[0])
+      return 1;
+   return split_a->begin - split_b->begin;
+}
+
+
+# define POLY_VERTEX(index)      ((float*)(((uint8_t*)polygon->vertex_buffer) + (index) * polygon->vertex_stride))
+# define POLY_SPLIT(index)       (*((int*)(((uint8_t*)polygon->split_indices) + (index) * polygon->split_stride)))
+
+
+/*
+ *  Link the outline and bridge all holes into it. Returns the first vertex.
+ */
+static int poly_fast_initialize(POLY* polygon, POLY_FAST* poly)
+{
+   POLY_SPLIT* splits = NULL;
+   int split_count = (int)polygon->split_count - 1;
+   int start = -1;
+   int i, j;
+
+   for (i = 0; i < POLY_SPLIT(0); ++i)
+      start = poly_fast_insert_after(poly, start, POLY_VERTEX(i), i);
+   start = poly->nodes[start].next;
+
+   if (split_count <= 0)
+      return start;
+
+   splits = (POLY_SPLIT*)al_malloc(split_count * sizeof(POLY_SPLIT));
+   if (NULL == splits)
+      return -1;
+
+   for (i = 0; i < split_count; ++i) {
+
+      POLY_SPLIT* split = splits + i;
+      float max = -FLT_MAX;
+
+      split->begin     = POLY_SPLIT(i);
+      split->size      = POLY_SPLIT(i + 1) - split->begin;
+      split->point     = NULL;
+      split->max_index = -1;
+
+      for (j = split->begin; j < split->begin + (int)split->size; ++j) {
+
+         float* point = POLY_VERTEX(j);
+
+         if (point[0] >= max) {
+
+            max              = point[0];
+            split->point     = point;
+            split->max_index = j - split->begin;
+         }
+      }
+   }
+
+   qsort(splits, split_count, sizeof(POLY_SPLIT), poly_fast_compare_splits);
+
+   for (i = 0; i < split_count; ++i) {
+
+      POLY_SPLIT* split = splits + i;
+      int first_vertex = poly_fast_find_split_vertex(poly, start, split->point);
+      int last_vertex;
+      size_t k;
+
+      if (first_vertex < 0)
+         break;
+
+      /* Insert hole vertices, then the bridge back to the outline. */
+      last_vertex = first_vertex;
+      for (k = 0; k <= split->size; ++k) {
+
+         int index = split->begin + (int)((k + split->max_index) % split->size);
+         last_vertex = poly_fast_insert_after(poly, last_vertex, POLY_VERTEX(index), index);
+      }
+      poly_fast_insert_after(poly, last_vertex, poly->nodes[first_vertex].point, poly->nodes[first_vertex].index);
+   }
+
+   al_free(splits);
+
+   return start;
+}
+
+# undef POLY_VERTEX
+# undef POLY_SPLIT
+
+
+static void poly_fast_build_grid(POLY_FAST* poly, int start)
+{
+   float min_x = FLT_MAX, min_y = FLT_MAX;
+   float max_x = -FLT_MAX, max_y = -FLT_MAX;
+   float size;
+   int cells;
+   int i;
+
+   i = start;
+   do {
+      const float* p = poly->nodes[i].point;
+
+      if (p[0] < min_x) min_x = p[0];
+      if (p[0] > max_x) max_x = p[0];
+      if (p[1] < min_y) min_y = p[1];
+      if (p[1] > max_y) max_y = p[1];
+
+      i = poly->nodes[i].next;
+   } while (i != start);
+
+   /* Aim for a few vertices per cell. */
+   size  = _ALLEGRO_MAX(max_x - min_x, max_y - min_y);
+   cells = (int)sqrtf(poly->node_count / 4.0f) + 1;
+   poly->grid_x      = min_x;
+   poly->grid_y      = min_y;
+   poly->grid_scale  = size > 0.0f ? cells / size : 0.0f;
+   poly->grid_width  = poly_fast_cell_coord(max_x, min_x, poly->grid_scale, INT_MAX) + 1;
+   poly->grid_height = poly_fast_cell_coord(max_y, min_y, poly->grid_scale, INT_MAX) + 1;
+
+   for (i = 0; i < poly->grid_width * poly->grid_height; ++i)
+      poly->cells[i] = -1;
+
+   i = start;
+   do {
+      poly_fast_grid_insert(poly, i);
+      i = poly->nodes[i].next;
+   } while (i != start);
+}
+
+
+static bool poly_fast_is_ear(POLY_FAST* poly, int a, int b, int c)
+{
+   const float* v0 = poly->nodes[a].point;
+   const float* v1 = poly->nodes[b].point;
+   const float* v2 = poly->nodes[c].point;
+   int x0, x1, y0, y1, x, y;
+
+   if (poly_fast_cross(poly, a, b, c) < 0)
+      return false;
+
+   x0 = poly_fast_cell_coord(_ALLEGRO_MIN(v0[0], _ALLEGRO_MIN(v1[0], v2[0])), poly->grid_x, poly->grid_scale, poly->grid_width);
+   x1 = poly_fast_cell_coord(_ALLEGRO_MAX(v0[0], _ALLEGRO_MAX(v1[0], v2[0])), poly->grid_x, poly->grid_scale, poly->grid_width);
+   y0 = poly_fast_cell_coord(_ALLEGRO_MIN(v0[1], _ALLEGRO_MIN(v1[1], v2[1])), poly->grid_y, poly->grid_scale, poly->grid_height);
+   y1 = poly_fast_cell_coord(_ALLEGRO_MAX(v0[1], _ALLEGRO_MAX(v1[1], v2[1])), poly->grid_y, poly->grid_scale, poly->grid_height);
+
+   for (y = y0; y <= y1; ++y) {
+      for (x = x0; x <= x1; ++x) {
+
+         int i;
+
+         for (i = poly->cells[y * poly->grid_width + x]; i >= 0; i = poly->nodes[i].cell_next) {
+
+            const float* v = poly->nodes[i].point;
+
+            /* Ignore vertices which belong to the triangle. */
+            if ((v == v0) || (v == v1) || (v == v2))
+               continue;
+
+            if (poly_fast_is_reflex(poly, i) && _al_prim_is_point_in_triangle(v, v0, v1, v2))
+               return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+
+static void poly_fast_triangulate(POLY* polygon, POLY_FAST* poly, int start)
+{
+   int remaining = poly->node_count;
+   int ear = start;
+   int stop = start;
+
+   while (remaining >= 3) {
+
+      POLY_NODE* node = poly->nodes + ear;
+      int prev = node->prev;
+      int next = node->next;
+
+      if (poly_fast_is_ear(poly, prev, ear, next)) {
+
+         polygon->emit(poly->nodes[prev].index, node->index, poly->nodes[next].index, polygon->userdata);
+
+         poly_fast_grid_remove(poly, ear);
+         poly->nodes[prev].next = next;
+         poly->nodes[next].prev = prev;
+         --remaining;
+
+         /* The neighbours may have become ears, so start over from there. */
+         ear  = prev;
+         stop = prev;
+         continue;
+      }
+
+      ear = next;
+
+      /* No ear was found in the whole polygon. */
+      if (ear == stop)
+         break;
+   }
+}
+
+
+/*
+ *  Triangulate a polygon using the array based triangulator. Returns false
+ *  if memory could not be allocated.
+ */
+static bool poly_triangulate_fast(POLY* polygon)
+{
+   POLY_FAST poly;
+   size_t vertex_count = polygon->vertex_count + (polygon->split_count - 1) * 2;
+   size_t max_cells = ((size_t)sqrtf(vertex_count / 4.0f) + 2) * ((size_t)sqrtf(vertex_count / 4.0f) + 2);
+   uint8_t* arena;
+   int start;
+
+   /* Nodes and grid cells share one allocation. */
+   arena = al_malloc(vertex_count * sizeof(POLY_NODE) + max_cells * sizeof(int));
+   if (NULL == arena)
+      return false;
+
+   memset(&poly, 0, sizeof(poly));
+   poly.nodes = (POLY_NODE*)arena;
+   poly.cells = (int*)(arena + vertex_count * sizeof(POLY_NODE));
+
+   start = poly_fast_initialize(polygon, &poly);
+   if (start < 0) {
+      al_free(arena);
+      return false;
+   }
+
+   poly_fast_build_grid(&poly, start);
+   poly_fast_triangulate(polygon, &poly, start);
+
+   al_free(arena);
+
+   return true;
+}
+
+
 /* Function: al_triangulate_polygon
  *  General triangulation function.
  */
@@ -848,7 +1285,11 @@ bool al_triangulate_polygon(
    polygon.emit          = emit_triangle;
    polygon.userdata      = userdata;
 
-   if (poly_initialize(&polygon)) {
+   if (vertex_count >= POLY_FAST_MIN_VERTICES) {
+
+      ret = poly_triangulate_fast(&polygon);
+   }
+   else if (poly_initialize(&polygon)) {
 
       poly_do_triangulate(&polygon);
 
@@ -43,6 +43,39 @@ ALLEGRO_TTF_FUNC(bool, al_is_ttf_addon_initialized, (void));
 ALLEGRO_TTF_FUNC(void, al_shutdown_ttf_addon, (void));
 ALLEGRO_TTF_FUNC(uint32_t, al_get_allegro_ttf_version, (void));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_TTF_SRC)
+#define ALLEGRO_TTF_SDF         8
+
+/* Enum: ALLEGRO_TTF_EVENT_TYPE
+ */
+enum ALLEGRO_TTF_EVENT_TYPE
+{
+   ALLEGRO_EVENT_TTF_PREWARM_FINISHED = 560
+};
+
+/* Type: ALLEGRO_TTF_CACHE_STATS
+ */
+typedef struct ALLEGRO_TTF_CACHE_STATS ALLEGRO_TTF_CACHE_STATS;
+
+struct ALLEGRO_TTF_CACHE_STATS
+{
+   int pages;
+   int glyphs;
+   int64_t memory;
+   int64_t hits;
+   int64_t misses;
+   int64_t evictions;
+};
+
+ALLEGRO_TTF_FUNC(bool, al_prewarm_ttf_glyphs, (ALLEGRO_FONT *font, int ranges_count, const int *ranges));
+ALLEGRO_TTF_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_ttf_font_event_source, (ALLEGRO_FONT *font));
+ALLEGRO_TTF_FUNC(bool, al_set_ttf_cache_budget, (ALLEGRO_FONT *font, int64_t bytes));
+ALLEGRO_TTF_FUNC(bool, al_compact_ttf_cache, (ALLEGRO_FONT *font));
+ALLEGRO_TTF_FUNC(bool, al_get_ttf_cache_stats, (ALLEGRO_FONT *font, ALLEGRO_TTF_CACHE_STATS *stats));
+ALLEGRO_TTF_FUNC(bool, al_save_ttf_glyph_cache, (ALLEGRO_FONT *font, const char *filename));
+ALLEGRO_TTF_FUNC(bool, al_load_ttf_glyph_cache, (ALLEGRO_FONT *font, const char *filename));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
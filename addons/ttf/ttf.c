@@ -5,6 +5,9 @@
 #include "allegro5/allegro_opengl.h"
 #endif
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_debug.h"
+#include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_vector.h"
 
 #include "allegro5/allegro_ttf.h"
@@ -16,7 +19,10 @@
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_MODULE_H
+#include FT_OUTLINE_H
 
+#include <math.h>
 #include <stdlib.h>
 
 ALLEGRO_DEBUG_CHANNEL("font")
@@ -37,6 +43,38 @@ ALLEGRO_DEBUG_CHANNEL("font")
 
 #define RANGE_SIZE   128
 
+/* Glyph metrics are kept in pages of this many glyph indices. */
+#define METRICS_PAGE_SIZE   256
+
+/* Pairs of glyph indices below this use the kerning table. */
+#define KERNING_TABLE_SIZE   128
+#define KERNING_UNKNOWN      INT16_MIN
+
+/* Glyph cache files start with this, followed by the cache key. */
+#define GLYPH_CACHE_MAGIC    "A5TTFGC1"
+#define GLYPH_CACHE_KEY_SIZE 8
+
+
+/* FreeType has rendered signed distance fields since 2.11. With older
+ * versions we compute them from the coverage bitmap.
+ */
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+   #define HAVE_FT_SDF
+#endif
+
+/* Since 2.9.1 FreeType presets the bitmap size of outlines which are loaded
+ * without being rendered.
+ */
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && (FREETYPE_MINOR > 9 || \
+      (FREETYPE_MINOR == 9 && FREETYPE_PATCH >= 1)))
+   #define HAVE_FT_PRESET_BITMAP
+#endif
+
+/* How far in pixels, at the base size, distance fields reach out from the
+ * outline. This is also the padding around each SDF glyph.
+ */
+#define SDF_SPREAD   4
+
 
 typedef struct REGION
 {
@@ -54,9 +92,24 @@ typedef struct ALLEGRO_TTF_GLYPH_DATA
    short offset_x;
    short offset_y;
    short advance;
+   uint64_t last_use;  /* value of use_clock when last looked up */
 } ALLEGRO_TTF_GLYPH_DATA;
 
 
+/* The size and position a glyph has when rendered, which is all measuring
+ * text needs. These are loaded without rendering the glyph.
+ */
+typedef struct GLYPH_METRICS
+{
+   short offset_x;
+   short offset_y;
+   short w;
+   short h;
+   short advance;
+   bool loaded;
+} GLYPH_METRICS;
+
+
 typedef struct ALLEGRO_TTF_GLYPH_RANGE
 {
    int32_t range_start;
@@ -64,6 +117,89 @@ typedef struct ALLEGRO_TTF_GLYPH_RANGE
 } ALLEGRO_TTF_GLYPH_RANGE;
 
 
+/* A glyph rasterized by the prewarm thread, waiting to be copied into a page
+ * bitmap by the thread which uses the font.
+ */
+typedef struct PREWARM_GLYPH
+{
+   int ft_index;
+   short offset_x;
+   short offset_y;
+   short advance;
+   FT_Bitmap bitmap;  /* buffer is owned by us */
+} PREWARM_GLYPH;
+
+
+typedef struct PREWARM_JOB
+{
+   ALLEGRO_FONT *font;
+   ALLEGRO_EVENT_SOURCE *es;
+   ALLEGRO_THREAD *thread;
+   ALLEGRO_MUTEX *mutex;
+   int *ranges;
+   int ranges_count;
+   FT_Int32 ft_load_flags;
+   bool sdf;
+
+   /* The worker has its own library and face, sharing only the font file
+    * (see ftread) with the face used for drawing.
+    */
+   FT_Library library;
+   FT_Face face;
+   FT_StreamRec stream;
+
+   /* Protected by mutex. */
+   _AL_VECTOR glyphs;  /* of PREWARM_GLYPH */
+   bool finished;
+
+   unsigned char *sdf_scratch;
+} PREWARM_JOB;
+
+
+/* A string laid out once, as batches of glyph quads on the same page
+ * bitmap. It is valid until glyphs are removed from the pages.
+ */
+typedef struct TTF_RUN_BATCH
+{
+   ALLEGRO_BITMAP *page;
+   ALLEGRO_TTF_GLYPH_DATA *glyph;  /* any glyph on the page */
+   _AL_VECTOR instances;  /* of ALLEGRO_SPRITE_INSTANCE */
+   _AL_VECTOR offsets;  /* of float[2], glyph positions within the run */
+} TTF_RUN_BATCH;
+
+
+typedef struct TTF_RUN
+{
+   int generation;  /* cache_generation of the font when laid out */
+   bool complete;  /* false if some glyph can't be kept in the run */
+   int advance;
+   _AL_VECTOR batches;  /* of TTF_RUN_BATCH */
+
+   /* The instances are filled in for this color and position. */
+   bool filled;
+   ALLEGRO_COLOR color;
+   float x;
+   float y;
+} TTF_RUN;
+
+
+typedef struct KERNING_PAIR
+{
+   uint64_t key;  /* both glyph indices plus one, 0 if the slot is empty */
+   int kerning;
+} KERNING_PAIR;
+
+
+/* An entry in the cache of recently drawn strings. */
+typedef struct RUN_CACHE_ENTRY
+{
+   ALLEGRO_USTR *text;
+   uint32_t hash;
+   uint64_t last_use;
+   TTF_RUN *run;  /* NULL until the string is drawn a second time */
+} RUN_CACHE_ENTRY;
+
+
 typedef struct ALLEGRO_TTF_FONT_DATA
 {
    FT_Face face;
@@ -80,6 +216,16 @@ typedef struct ALLEGRO_TTF_FONT_DATA
    ALLEGRO_FILE *file;
    unsigned long base_offset;
    unsigned long offset;
+   ALLEGRO_MUTEX *file_mutex;  /* created by the first prewarm */
+
+   int size_w;
+   int size_h;
+
+   /* With ALLEGRO_TTF_SDF the face is set to the base size, and the glyphs
+    * are scaled by this much when drawn.
+    */
+   float sdf_scale;
+   unsigned char *sdf_scratch;
 
    int bitmap_format;
    int bitmap_flags;
@@ -88,6 +234,45 @@ typedef struct ALLEGRO_TTF_FONT_DATA
    int max_page_size;
 
    bool skip_cache_misses;
+
+   /* Pages are evicted in least recently used order to stay within the
+    * budget, 0 means unlimited.
+    */
+   int64_t cache_budget;
+   uint64_t use_clock;
+   uint64_t compact_clock;  /* use_clock at the last compaction */
+   int64_t hits;
+   int64_t misses;
+   int64_t evictions;
+   int repack_size;  /* typical glyph size while compacting, else 0 */
+   int cache_generation;  /* changed whenever glyphs leave the pages */
+
+   /* Kerning of the pairs looked up so far. Pairs of the first glyphs,
+    * which are the ASCII ones in most fonts, are kept in a table and the
+    * others in a hash table.
+    */
+   int16_t *kerning_table;  /* [KERNING_TABLE_SIZE * KERNING_TABLE_SIZE] */
+   KERNING_PAIR *kerning_pairs;
+   int kerning_pairs_size;  /* a power of two */
+   int kerning_pairs_count;
+
+   RUN_CACHE_ENTRY *run_cache;
+   int run_cache_size;
+   uint64_t run_clock;
+
+   /* Metrics of the glyphs measured so far, kept apart from the page
+    * bitmaps so measuring text does not fill them.
+    */
+   GLYPH_METRICS **metrics_pages;  /* allocated as needed */
+
+   ALLEGRO_EVENT_SOURCE es;
+   PREWARM_JOB *prewarm;
+
+   /* The glyph cache file, see al_save_ttf_glyph_cache. */
+   bool have_file_hash;
+   uint64_t file_hash;
+   ALLEGRO_PATH *glyph_cache_path;  /* from glyph_cache_dir, or NULL */
+   bool glyph_cache_dirty;  /* glyphs were cached since the file was read */
 } ALLEGRO_TTF_FONT_DATA;
 
 
@@ -97,6 +282,171 @@ static FT_Library ft;
 static ALLEGRO_FONT_VTABLE vt;
 
 
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+
+typedef struct SDF_DISPLAY
+{
+   ALLEGRO_DISPLAY *display;
+   /* NULL if the shader could not be built for this display. */
+   ALLEGRO_SHADER *shader;
+} SDF_DISPLAY;
+
+static ALLEGRO_MUTEX *sdf_mutex;
+static SDF_DISPLAY *sdf_displays;
+static int num_sdf_displays;
+
+/* The distance is in the alpha channel, 0.5 on the outline. The color
+ * channels are either equal to it, or 1 for fonts loaded with
+ * ALLEGRO_NO_PREMULTIPLIED_ALPHA, see copy_glyph_color.
+ */
+static const char *sdf_pixel_source =
+   "#ifdef GL_ES\n"
+   "#extension GL_OES_standard_derivatives : enable\n"
+   "precision mediump float;\n"
+   "#endif\n"
+   "uniform sampler2D " ALLEGRO_SHADER_VAR_TEX ";\n"
+   "varying vec4 varying_color;\n"
+   "varying vec2 varying_texcoord;\n"
+   "void main()\n"
+   "{\n"
+   "  vec4 t = texture2D(" ALLEGRO_SHADER_VAR_TEX ", varying_texcoord);\n"
+   "  float w = max(fwidth(t.a), 0.0001);\n"
+   "  float a = smoothstep(0.5 - w, 0.5 + w, t.a);\n"
+   "  if (t.r > t.a)\n"
+   "    gl_FragColor = vec4(varying_color.rgb, varying_color.a * a);\n"
+   "  else\n"
+   "    gl_FragColor = varying_color * a;\n"
+   "}\n";
+
+static void sdf_display_invalidated(ALLEGRO_DISPLAY *display)
+{
+   int i;
+
+   if (!sdf_mutex)
+      return;
+
+   al_lock_mutex(sdf_mutex);
+
+   for (i = 0; i < num_sdf_displays; i++) {
+      if (sdf_displays[i].display == display) {
+         al_destroy_shader(sdf_displays[i].shader);
+         sdf_displays[i] = sdf_displays[num_sdf_displays - 1];
+         num_sdf_displays--;
+         break;
+      }
+   }
+
+   al_unlock_mutex(sdf_mutex);
+}
+
+static ALLEGRO_SHADER *create_sdf_shader(void)
+{
+   ALLEGRO_SHADER *shader;
+
+   _al_push_destructor_owner();
+   shader = al_create_shader(ALLEGRO_SHADER_GLSL);
+   _al_pop_destructor_owner();
+
+   if (!shader)
+      return NULL;
+
+   if (!al_attach_shader_source(shader, ALLEGRO_VERTEX_SHADER,
+         al_get_default_shader_source(ALLEGRO_SHADER_GLSL,
+            ALLEGRO_VERTEX_SHADER)) ||
+       !al_attach_shader_source(shader, ALLEGRO_PIXEL_SHADER,
+         sdf_pixel_source) ||
+       !al_build_shader(shader)) {
+      ALLEGRO_ERROR("Building the SDF shader failed: %s\n",
+         al_get_shader_log(shader));
+      al_destroy_shader(shader);
+      return NULL;
+   }
+   return shader;
+}
+
+/* Returns the SDF shader for the target, creating it on first use for its
+ * display, or NULL if it can't be used there.
+ */
+static ALLEGRO_SHADER *get_sdf_shader(ALLEGRO_BITMAP *target)
+{
+   ALLEGRO_DISPLAY *display;
+   ALLEGRO_SHADER *current;
+   ALLEGRO_SHADER *shader = NULL;
+   SDF_DISPLAY *new_displays;
+   int flags;
+   int i;
+
+   if (!sdf_mutex || !target ||
+         (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP))
+      return NULL;
+
+   display = _al_get_bitmap_display(target);
+   flags = al_get_display_flags(display);
+   if (!(flags & ALLEGRO_OPENGL) || !(flags & ALLEGRO_PROGRAMMABLE_PIPELINE))
+      return NULL;
+
+   /* A custom shader set by the user takes precedence. */
+   current = al_get_current_shader();
+   if (current && current != display->default_shader)
+      return NULL;
+
+   al_lock_mutex(sdf_mutex);
+
+   for (i = 0; i < num_sdf_displays; i++) {
+      if (sdf_displays[i].display == display) {
+         shader = sdf_displays[i].shader;
+         al_unlock_mutex(sdf_mutex);
+         return shader;
+      }
+   }
+
+   new_displays = al_realloc(sdf_displays,
+      (num_sdf_displays + 1) * sizeof(SDF_DISPLAY));
+   if (new_displays) {
+      shader = create_sdf_shader();
+      sdf_displays = new_displays;
+      sdf_displays[num_sdf_displays].display = display;
+      sdf_displays[num_sdf_displays].shader = shader;
+      num_sdf_displays++;
+      _al_add_display_invalidated_callback(display, &sdf_display_invalidated);
+   }
+
+   al_unlock_mutex(sdf_mutex);
+   return shader;
+}
+
+static void shutdown_sdf_shaders(void)
+{
+   int i;
+
+   for (i = 0; i < num_sdf_displays; i++) {
+      _al_remove_display_invalidated_callback(sdf_displays[i].display,
+         &sdf_display_invalidated);
+      al_destroy_shader(sdf_displays[i].shader);
+   }
+   al_free(sdf_displays);
+   sdf_displays = NULL;
+   num_sdf_displays = 0;
+
+   al_destroy_mutex(sdf_mutex);
+   sdf_mutex = NULL;
+}
+
+#else
+
+static ALLEGRO_SHADER *get_sdf_shader(ALLEGRO_BITMAP *target)
+{
+   (void)target;
+   return NULL;
+}
+
+static void shutdown_sdf_shaders(void)
+{
+}
+
+#endif
+
+
 static INLINE int align4(int x)
 {
 #ifdef ALIGN_TO_4_PIXEL
@@ -107,6 +457,26 @@ static INLINE int align4(int x)
 }
 
 
+/* Converts from pixels at the base size of an SDF font to pixels at the
+ * size it was loaded with.
+ */
+static int scale_sdf(ALLEGRO_TTF_FONT_DATA const *data, int x)
+{
+   if (!(data->flags & ALLEGRO_TTF_SDF))
+      return x;
+   return (int)floorf(x * data->sdf_scale + 0.5f);
+}
+
+
+/* Like scale_sdf, for 26.6 fixed point face metrics. */
+static int scale_metric(ALLEGRO_TTF_FONT_DATA const *data, FT_Pos x)
+{
+   if (!(data->flags & ALLEGRO_TTF_SDF))
+      return x >> 6;
+   return (int)floorf(x * data->sdf_scale / 64 + 0.5f);
+}
+
+
 /* Returns false if the glyph is invalid.
  */
 static bool get_glyph(ALLEGRO_TTF_FONT_DATA *data,
@@ -169,15 +539,161 @@ static void unlock_current_page(ALLEGRO_TTF_FONT_DATA *data)
 }
 
 
+static int64_t get_page_memory(ALLEGRO_BITMAP *page)
+{
+   return (int64_t)al_get_bitmap_width(page) * al_get_bitmap_height(page) *
+      al_get_pixel_size(al_get_bitmap_format(page));
+}
+
+
+static int64_t get_cache_memory(ALLEGRO_TTF_FONT_DATA *data)
+{
+   int64_t memory = 0;
+   int i;
+
+   for (i = 0; i < (int)_al_vector_size(&data->page_bitmaps); i++) {
+      ALLEGRO_BITMAP **page = _al_vector_ref(&data->page_bitmaps, i);
+      memory += get_page_memory(*page);
+   }
+   return memory;
+}
+
+
+/* Marks all glyphs on the page as not cached. Passing NULL forgets the
+ * glyphs on all pages.
+ */
+static void forget_page_glyphs(ALLEGRO_TTF_FONT_DATA *data,
+   ALLEGRO_BITMAP *page)
+{
+   int i, j;
+
+   data->cache_generation++;
+
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         if (glyph->page_bitmap && (!page || glyph->page_bitmap == page)) {
+            glyph->page_bitmap = NULL;
+            glyph->region.x = 0;
+            glyph->region.y = 0;
+         }
+      }
+   }
+}
+
+
+/* Returns the index of the page whose glyphs were used least recently. */
+static int find_lru_page(ALLEGRO_TTF_FONT_DATA *data)
+{
+   int num_pages = _al_vector_size(&data->page_bitmaps);
+   uint64_t *last_use = al_calloc(num_pages, sizeof *last_use);
+   int i, j, k, lru = 0;
+
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         if (!glyph->page_bitmap)
+            continue;
+         for (k = 0; k < num_pages; k++) {
+            ALLEGRO_BITMAP **page = _al_vector_ref(&data->page_bitmaps, k);
+            if (*page == glyph->page_bitmap) {
+               if (glyph->last_use > last_use[k])
+                  last_use[k] = glyph->last_use;
+               break;
+            }
+         }
+      }
+   }
+
+   for (k = 1; k < num_pages; k++) {
+      if (last_use[k] < last_use[lru])
+         lru = k;
+   }
+   al_free(last_use);
+   return lru;
+}
+
+
+/* Evicts pages until another `needed` bytes fit into the budget. If
+ * `recycle_size` is positive, the first evicted page at least that large is
+ * returned instead of being destroyed, so it can be reused as the next page.
+ *
+ * NOTE: this function flushes held drawing, as the pending draws may refer
+ * to the evicted pages.
+ */
+static ALLEGRO_BITMAP *evict_pages(ALLEGRO_TTF_FONT_DATA *data,
+   int64_t needed, int recycle_size)
+{
+   /* Evicted glyphs are never cached again when skipping cache misses. */
+   if (data->cache_budget <= 0 || data->skip_cache_misses)
+      return NULL;
+
+   while (!_al_vector_is_empty(&data->page_bitmaps) &&
+         get_cache_memory(data) + needed > data->cache_budget) {
+      int lru = find_lru_page(data);
+      ALLEGRO_BITMAP **ref = _al_vector_ref(&data->page_bitmaps, lru);
+      ALLEGRO_BITMAP *page = *ref;
+
+      if (al_is_bitmap_drawing_held()) {
+         al_hold_bitmap_drawing(false);
+         al_hold_bitmap_drawing(true);
+      }
+
+      ALLEGRO_DEBUG("Evicting page: %p\n", page);
+      forget_page_glyphs(data, page);
+      _al_vector_delete_at(&data->page_bitmaps, lru);
+      data->evictions++;
+
+      if (lru == (int)_al_vector_size(&data->page_bitmaps) &&
+            !_al_vector_is_empty(&data->page_bitmaps)) {
+         /* The current page is gone, treat the new last page as full. */
+         ALLEGRO_BITMAP **back = _al_vector_ref_back(&data->page_bitmaps);
+         data->page_pos_x = 0;
+         data->page_pos_y = al_get_bitmap_height(*back);
+         data->page_line_height = 0;
+      }
+
+      if (recycle_size > 0 && al_get_bitmap_width(page) >= recycle_size &&
+            al_get_bitmap_height(page) >= recycle_size) {
+         return page;
+      }
+      al_destroy_bitmap(page);
+   }
+
+   return NULL;
+}
+
+
+static ALLEGRO_BITMAP *create_page(ALLEGRO_TTF_FONT_DATA *data, int w, int h)
+{
+   ALLEGRO_BITMAP *page;
+   ALLEGRO_STATE state;
+
+   /* The bitmap will be destroyed when the parent font is destroyed so
+    * it is not safe to register a destructor for it.
+    */
+   _al_push_destructor_owner();
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   al_set_new_bitmap_format(data->bitmap_format);
+   al_set_new_bitmap_flags(data->bitmap_flags);
+   page = al_create_bitmap(w, h);
+   al_restore_state(&state);
+   _al_pop_destructor_owner();
+   return page;
+}
+
+
 static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size)
 {
     ALLEGRO_BITMAP **back;
     ALLEGRO_BITMAP *page;
-    ALLEGRO_STATE state;
     int page_size = 1;
+    int typical_size = data->repack_size > 0 ? data->repack_size : glyph_size;
     /* 16 seems to work well. A particular problem are fixed width fonts which
      * take an inordinate amount of space. */
-    while (page_size < 16 * glyph_size) {
+    while (page_size < 16 * typical_size || page_size < glyph_size) {
       page_size *= 2;
     }
     if (page_size < data->min_page_size) {
@@ -194,16 +710,15 @@ static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size
 
     unlock_current_page(data);
 
-    /* The bitmap will be destroyed when the parent font is destroyed so
-     * it is not safe to register a destructor for it.
+    /* The bitmap is assumed to have 4 bytes per pixel until it exists.
+     * Every glyph region is cleared when it is allocated, so a recycled page
+     * needs no clearing.
      */
-    _al_push_destructor_owner();
-    al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
-    al_set_new_bitmap_format(data->bitmap_format);
-    al_set_new_bitmap_flags(data->bitmap_flags);
-    page = al_create_bitmap(page_size, page_size);
-    al_restore_state(&state);
-    _al_pop_destructor_owner();
+    page = evict_pages(data, (int64_t)page_size * page_size * 4, page_size);
+
+    if (!page) {
+       page = create_page(data, page_size, page_size);
+    }
 
     if (page) {
        back = _al_vector_alloc_back(&data->page_bitmaps);
@@ -339,14 +854,14 @@ static unsigned char *alloc_glyph_region(ALLEGRO_TTF_FONT_DATA *data,
 }
 
 
-static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   unsigned char *glyph_data)
+static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data,
+   const FT_Bitmap *bitmap, unsigned char *glyph_data)
 {
    int pitch = font_data->page_lr->pitch;
    int x, y;
 
-   for (y = 0; y < (int)face->glyph->bitmap.rows; y++) {
-      unsigned char const *ptr = face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * y;
+   for (y = 0; y < (int)bitmap->rows; y++) {
+      unsigned char const *ptr = bitmap->buffer + bitmap->pitch * y;
       unsigned char *dptr = glyph_data + pitch * y;
       int bit = 0;
 
@@ -354,7 +869,7 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          /* FIXME We could just set the alpha byte since the
           * region was cleared above when allocated
           */
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char set = ((*ptr >> (7-bit)) & 1) ? 255 : 0;
             *dptr++ = 255;
             *dptr++ = 255;
@@ -367,7 +882,7 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          }
       }
       else {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char set = ((*ptr >> (7-bit)) & 1) ? 255 : 0;
             *dptr++ = set;
             *dptr++ = set;
@@ -383,21 +898,21 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
-static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   unsigned char *glyph_data)
+static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data,
+   const FT_Bitmap *bitmap, unsigned char *glyph_data)
 {
    int pitch = font_data->page_lr->pitch;
    int x, y;
 
-   for (y = 0; y < (int)face->glyph->bitmap.rows; y++) {
-      unsigned char const *ptr = face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * y;
+   for (y = 0; y < (int)bitmap->rows; y++) {
+      unsigned char const *ptr = bitmap->buffer + bitmap->pitch * y;
       unsigned char *dptr = glyph_data + pitch * y;
 
       if (font_data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
          /* FIXME We could just set the alpha byte since the
           * region was cleared above when allocated
           */
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char c = *ptr;
             *dptr++ = 255;
             *dptr++ = 255;
@@ -407,7 +922,7 @@ static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          }
       }
       else {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char c = *ptr;
             *dptr++ = c;
             *dptr++ = c;
@@ -420,26 +935,9 @@ static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
-/* NOTE: this function may disable the bitmap hold drawing state
- * and leave the current page bitmap locked.
- * 
- * NOTE: We have previously tried to be more clever about caching multiple
- * glyphs during incidental cache misses, but found that approach to be slower.
- */
-static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph, bool lock_whole_page)
+static FT_Int32 get_load_flags(ALLEGRO_TTF_FONT_DATA *font_data)
 {
     FT_Int32 ft_load_flags;
-    FT_Error e;
-    int w, h;
-    unsigned char *glyph_data;
-
-    if (glyph->page_bitmap || glyph->region.x < 0)
-        return;
-   
-    /* We shouldn't ever get here, as cache misses
-     * should have been set to ft_index = 0. */
-    ASSERT(!(font_data->skip_cache_misses && !lock_whole_page));
 
     // FIXME: make this a config setting? FT_LOAD_FORCE_AUTOHINT
 
@@ -447,22 +945,138 @@ static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
     // NO_BITMAP flags. Supposedly using that flag makes small sizes
     // look bad so ideally we would not used it.
     ft_load_flags = FT_LOAD_RENDER | FT_LOAD_NO_BITMAP;
+    if (font_data->flags & ALLEGRO_TTF_SDF) {
+       /* Hinting for the base size would be wrong at any other size. The
+        * distance field is rendered by load_glyph_bitmap.
+        */
+       return FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING;
+    }
     if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
        ft_load_flags |= FT_LOAD_TARGET_MONO;
     if (font_data->flags & ALLEGRO_TTF_NO_AUTOHINT)
        ft_load_flags |= FT_LOAD_NO_AUTOHINT;
 
-    e = FT_Load_Glyph(face, ft_index, ft_load_flags);
-    if (e) {
-       ALLEGRO_WARN("Failed loading glyph %d from.\n", ft_index);
-    }
+    return ft_load_flags;
+}
+
+
+#ifndef HAVE_FT_SDF
+/* Computes the distance field of a coverage bitmap into *scratch, by brute
+ * force over the spread. Only used for older FreeType versions.
+ */
+static void compute_sdf(const FT_Bitmap *src, unsigned char **scratch,
+   FT_Bitmap *dst)
+{
+   const int s = SDF_SPREAD;
+   int w = src->width + 2 * s;
+   int h = src->rows + 2 * s;
+   int x, y, dx, dy;
+
+   #define INSIDE(px, py) ((px) >= 0 && (py) >= 0 && \
+      (px) < (int)src->width && (py) < (int)src->rows && \
+      src->buffer[(py) * src->pitch + (px)] >= 128)
+
+   *scratch = al_realloc(*scratch, w * h);
+
+   for (y = 0; y < h; y++) {
+      for (x = 0; x < w; x++) {
+         bool inside = INSIDE(x - s, y - s);
+         int best = (s + 1) * (s + 1);
+         float d;
+
+         for (dy = -s; dy <= s; dy++) {
+            for (dx = -s; dx <= s; dx++) {
+               int d2 = dx * dx + dy * dy;
+               if (d2 < best && INSIDE(x - s + dx, y - s + dy) != inside)
+                  best = d2;
+            }
+         }
+
+         /* The outline is about halfway to the nearest opposite pixel. */
+         d = sqrtf(best) - 0.5f;
+         if (!inside)
+            d = -d;
+         (*scratch)[y * w + x] =
+            _ALLEGRO_CLAMP(0, (int)(128 + d * 128 / s), 255);
+      }
+   }
 
-    glyph->offset_x = face->glyph->bitmap_left;
-    glyph->offset_y = (face->size->metrics.ascender >> 6) - face->glyph->bitmap_top;
-    glyph->advance = face->glyph->advance.x >> 6;
+   #undef INSIDE
 
-    w = face->glyph->bitmap.width;
-    h = face->glyph->bitmap.rows;
+   *dst = *src;
+   dst->width = w;
+   dst->rows = h;
+   dst->pitch = w;
+   dst->buffer = *scratch;
+}
+#endif
+
+
+/* Loads a glyph into the glyph slot of the face and returns its bitmap and
+ * position. For SDF fonts this is the distance field, padded by SDF_SPREAD
+ * on each side. If FreeType can't render those it is computed into *scratch.
+ */
+static FT_Error load_glyph_bitmap(FT_Face face, int ft_index,
+   FT_Int32 ft_load_flags, bool sdf, unsigned char **scratch,
+   FT_Bitmap *bitmap, int *left, int *top)
+{
+   FT_GlyphSlot slot = face->glyph;
+   FT_Error e;
+
+   if (!sdf) {
+      e = FT_Load_Glyph(face, ft_index, ft_load_flags);
+      *bitmap = slot->bitmap;
+      *left = slot->bitmap_left;
+      *top = slot->bitmap_top;
+      return e;
+   }
+
+#ifdef HAVE_FT_SDF
+   (void)scratch;
+   e = FT_Load_Glyph(face, ft_index, ft_load_flags);
+   /* Empty outlines, like the space, have nothing to render. */
+   if (!e && slot->format == FT_GLYPH_FORMAT_OUTLINE &&
+         slot->outline.n_points > 0) {
+      e = FT_Render_Glyph(slot, FT_RENDER_MODE_SDF);
+   }
+   *bitmap = slot->bitmap;
+   *left = slot->bitmap_left;
+   *top = slot->bitmap_top;
+#else
+   e = FT_Load_Glyph(face, ft_index, ft_load_flags | FT_LOAD_RENDER);
+   *bitmap = slot->bitmap;
+   *left = slot->bitmap_left - SDF_SPREAD;
+   *top = slot->bitmap_top + SDF_SPREAD;
+   if (!e && bitmap->width > 0 && bitmap->rows > 0)
+      compute_sdf(&slot->bitmap, scratch, bitmap);
+#endif
+
+   if (e || slot->format != FT_GLYPH_FORMAT_BITMAP) {
+      bitmap->width = 0;
+      bitmap->rows = 0;
+   }
+   /* The advance is unhinted, round it rather than truncate it later. */
+   slot->advance.x = (slot->advance.x + 32) & ~63;
+   return e;
+}
+
+
+/* Copies a rendered glyph bitmap into a page and fills in the glyph data.
+ */
+static void store_glyph(ALLEGRO_TTF_FONT_DATA *font_data, int ft_index,
+   ALLEGRO_TTF_GLYPH_DATA *glyph, int offset_x, int offset_y, int advance,
+   const FT_Bitmap *bitmap, bool lock_whole_page)
+{
+    int w, h;
+    unsigned char *glyph_data;
+
+    glyph->offset_x = offset_x;
+    glyph->offset_y = offset_y;
+    glyph->advance = advance;
+    font_data->glyph_cache_dirty = true;
+
+    w = bitmap->width;
+    h = bitmap->rows;
 
     if (w == 0 || h == 0) {
        /* Mark this glyph so we won't try to cache it next time. */
@@ -486,25 +1100,200 @@ static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
        return;
     }
 
-    if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
-       copy_glyph_mono(font_data, face, glyph_data);
+    if ((font_data->flags & ALLEGRO_TTF_MONOCHROME) &&
+          !(font_data->flags & ALLEGRO_TTF_SDF))
+       copy_glyph_mono(font_data, bitmap, glyph_data);
     else
-       copy_glyph_color(font_data, face, glyph_data);
+       copy_glyph_color(font_data, bitmap, glyph_data);
 
     if (!lock_whole_page) {
        unlock_current_page(font_data);
     }
 }
 
-/* WARNING: It is only valid to call this function when the current page is empty
- * (or already locked), otherwise it will gibberify the current glyphs on that page.
- * 
- * This leaves the current page unlocked.
- */
-static void cache_glyphs(ALLEGRO_TTF_FONT_DATA *data, const char *text, size_t text_size)
+
+static void free_prewarm_glyphs(_AL_VECTOR *glyphs)
 {
-   ALLEGRO_USTR_INFO info;
-   const ALLEGRO_USTR* ustr = al_ref_buffer(&info, text, text_size);
+   int i;
+
+   for (i = 0; i < (int)_al_vector_size(glyphs); i++) {
+      PREWARM_GLYPH *pg = _al_vector_ref(glyphs, i);
+      al_free(pg->bitmap.buffer);
+   }
+   _al_vector_free(glyphs);
+}
+
+
+static void destroy_prewarm(ALLEGRO_TTF_FONT_DATA *data)
+{
+   PREWARM_JOB *job = data->prewarm;
+
+   al_set_thread_should_stop(job->thread);
+   al_join_thread(job->thread, NULL);
+   al_destroy_thread(job->thread);
+
+   free_prewarm_glyphs(&job->glyphs);
+   al_destroy_mutex(job->mutex);
+   FT_Done_Face(job->face);
+   FT_Done_FreeType(job->library);
+   al_free(job->sdf_scratch);
+   al_free(job->ranges);
+   al_free(job);
+   data->prewarm = NULL;
+}
+
+
+/* Moves the glyphs rasterized by the prewarm thread so far into the pages.
+ * Glyphs which were cached in the meantime are skipped.
+ */
+static void flush_prewarm(ALLEGRO_TTF_FONT_DATA *data)
+{
+   PREWARM_JOB *job = data->prewarm;
+   _AL_VECTOR glyphs;
+   bool finished;
+   int i;
+
+   al_lock_mutex(job->mutex);
+   glyphs = job->glyphs;
+   _al_vector_init(&job->glyphs, sizeof(PREWARM_GLYPH));
+   finished = job->finished;
+   al_unlock_mutex(job->mutex);
+
+   for (i = 0; i < (int)_al_vector_size(&glyphs); i++) {
+      PREWARM_GLYPH *pg = _al_vector_ref(&glyphs, i);
+      ALLEGRO_TTF_GLYPH_DATA *glyph;
+
+      get_glyph(data, pg->ft_index, &glyph);
+      if (glyph->page_bitmap || glyph->region.x < 0)
+         continue;
+      glyph->last_use = data->use_clock;
+      store_glyph(data, pg->ft_index, glyph, pg->offset_x, pg->offset_y,
+         pg->advance, &pg->bitmap, false);
+   }
+   free_prewarm_glyphs(&glyphs);
+
+   if (finished) {
+      destroy_prewarm(data);
+   }
+}
+
+
+/* NOTE: this function may disable the bitmap hold drawing state
+ * and leave the current page bitmap locked.
+ * 
+ * NOTE: We have previously tried to be more clever about caching multiple
+ * glyphs during incidental cache misses, but found that approach to be slower.
+ */
+static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
+   int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph, bool lock_whole_page)
+{
+    FT_Bitmap bitmap;
+    int left, top;
+    FT_Error e;
+
+    if (font_data->prewarm && !lock_whole_page)
+        flush_prewarm(font_data);
+
+    glyph->last_use = ++font_data->use_clock;
+
+    if (glyph->page_bitmap || glyph->region.x < 0) {
+        font_data->hits++;
+        return;
+    }
+    font_data->misses++;
+   
+    /* We shouldn't ever get here, as cache misses
+     * should have been set to ft_index = 0. */
+    ASSERT(!(font_data->skip_cache_misses && !lock_whole_page));
+
+    _AL_BEGIN_CPU_ZONE("ttf cache_glyph");
+    e = load_glyph_bitmap(face, ft_index, get_load_flags(font_data),
+       font_data->flags & ALLEGRO_TTF_SDF, &font_data->sdf_scratch,
+       &bitmap, &left, &top);
+    if (e) {
+       ALLEGRO_WARN("Failed loading glyph %d from.\n", ft_index);
+    }
+
+    store_glyph(font_data, ft_index, glyph, left,
+       (face->size->metrics.ascender >> 6) - top,
+       face->glyph->advance.x >> 6,
+       &bitmap, lock_whole_page);
+    _AL_END_CPU_ZONE();
+}
+
+/* Returns the metrics of a glyph as cache_glyph would store them, without
+ * rendering it or touching the page bitmaps.
+ */
+static GLYPH_METRICS *get_glyph_metrics(ALLEGRO_TTF_FONT_DATA *data,
+   FT_Face face, int ft_index)
+{
+   int page = ft_index / METRICS_PAGE_SIZE;
+   GLYPH_METRICS *m;
+   FT_GlyphSlot slot = face->glyph;
+   bool sdf = data->flags & ALLEGRO_TTF_SDF;
+   int left = 0, top = 0, w = 0, h = 0;
+
+   if (!data->metrics_pages) {
+      data->metrics_pages = al_calloc(face->num_glyphs / METRICS_PAGE_SIZE + 1,
+         sizeof *data->metrics_pages);
+   }
+   if (!data->metrics_pages[page]) {
+      data->metrics_pages[page] = al_calloc(METRICS_PAGE_SIZE,
+         sizeof *data->metrics_pages[page]);
+   }
+   m = &data->metrics_pages[page][ft_index % METRICS_PAGE_SIZE];
+   if (m->loaded)
+      return m;
+   m->loaded = true;
+
+   if (FT_Load_Glyph(face, ft_index, get_load_flags(data) & ~FT_LOAD_RENDER)) {
+      ALLEGRO_WARN("Failed loading glyph %d.\n", ft_index);
+      return m;
+   }
+
+   /* SDF glyphs with empty outlines, like the space, are not rendered. */
+   if (slot->format == FT_GLYPH_FORMAT_OUTLINE &&
+         (!sdf || slot->outline.n_points > 0)) {
+#ifdef HAVE_FT_PRESET_BITMAP
+      left = slot->bitmap_left;
+      top = slot->bitmap_top;
+      w = slot->bitmap.width;
+      h = slot->bitmap.rows;
+#else
+      FT_BBox cbox;
+      FT_Outline_Get_CBox(&slot->outline, &cbox);
+      left = cbox.xMin >> 6;
+      top = (cbox.yMax + 63) >> 6;
+      w = ((cbox.xMax + 63) >> 6) - left;
+      h = top - (cbox.yMin >> 6);
+#endif
+      if (sdf) {
+         left -= SDF_SPREAD;
+         top += SDF_SPREAD;
+         w += 2 * SDF_SPREAD;
+         h += 2 * SDF_SPREAD;
+      }
+   }
+
+   m->offset_x = left;
+   m->offset_y = (face->size->metrics.ascender >> 6) - top;
+   m->w = w;
+   m->h = h;
+   /* SDF advances are unhinted, see load_glyph_bitmap. */
+   m->advance = sdf ? (slot->advance.x + 32) >> 6 : slot->advance.x >> 6;
+   return m;
+}
+
+
+/* WARNING: It is only valid to call this function when the current page is empty
+ * (or already locked), otherwise it will gibberify the current glyphs on that page.
+ * 
+ * This leaves the current page unlocked.
+ */
+static void cache_glyphs(ALLEGRO_TTF_FONT_DATA *data, const char *text, size_t text_size)
+{
+   ALLEGRO_USTR_INFO info;
+   const ALLEGRO_USTR* ustr = al_ref_buffer(&info, text, text_size);
    FT_Face face = data->face;
    int pos = 0;
    int32_t ch;  
@@ -518,18 +1307,99 @@ static void cache_glyphs(ALLEGRO_TTF_FONT_DATA *data, const char *text, size_t t
 }
 
 
-static int get_kerning(ALLEGRO_TTF_FONT_DATA const *data, FT_Face face,
+static int load_kerning(FT_Face face, int prev_ft_index, int ft_index)
+{
+   FT_Vector delta;
+   FT_Get_Kerning(face, prev_ft_index, ft_index, FT_KERNING_DEFAULT, &delta);
+   return delta.x >> 6;
+}
+
+
+static int hash_kerning_key(uint64_t key, int mask)
+{
+   return (int)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+}
+
+
+static void grow_kerning_pairs(ALLEGRO_TTF_FONT_DATA *data)
+{
+   KERNING_PAIR *old_pairs = data->kerning_pairs;
+   int old_size = data->kerning_pairs_size;
+   int i;
+
+   data->kerning_pairs_size = old_size ? old_size * 2 : 64;
+   data->kerning_pairs = al_calloc(data->kerning_pairs_size,
+      sizeof *data->kerning_pairs);
+
+   for (i = 0; i < old_size; i++) {
+      int mask = data->kerning_pairs_size - 1;
+      int j;
+      if (!old_pairs[i].key)
+         continue;
+      j = hash_kerning_key(old_pairs[i].key, mask);
+      while (data->kerning_pairs[j].key)
+         j = (j + 1) & mask;
+      data->kerning_pairs[j] = old_pairs[i];
+   }
+   al_free(old_pairs);
+}
+
+
+static int get_kerning_pair(ALLEGRO_TTF_FONT_DATA *data, FT_Face face,
+   int prev_ft_index, int ft_index)
+{
+   uint64_t key = ((uint64_t)(prev_ft_index + 1) << 32) |
+      (uint32_t)(ft_index + 1);
+   int mask, i;
+
+   /* Keep the hash table at most half full. */
+   if (data->kerning_pairs_count * 2 >= data->kerning_pairs_size)
+      grow_kerning_pairs(data);
+
+   mask = data->kerning_pairs_size - 1;
+   i = hash_kerning_key(key, mask);
+   while (data->kerning_pairs[i].key) {
+      if (data->kerning_pairs[i].key == key)
+         return data->kerning_pairs[i].kerning;
+      i = (i + 1) & mask;
+   }
+
+   data->kerning_pairs[i].key = key;
+   data->kerning_pairs[i].kerning = load_kerning(face, prev_ft_index,
+      ft_index);
+   data->kerning_pairs_count++;
+   return data->kerning_pairs[i].kerning;
+}
+
+
+static int get_kerning(ALLEGRO_TTF_FONT_DATA *data, FT_Face face,
    int prev_ft_index, int ft_index)
 {
+   int16_t *kerning;
+   int i;
+
    /* Do kerning? */
-   if (!(data->flags & ALLEGRO_TTF_NO_KERNING) && prev_ft_index != -1) {
-      FT_Vector delta;
-      FT_Get_Kerning(face, prev_ft_index, ft_index,
-         FT_KERNING_DEFAULT, &delta);
-      return delta.x >> 6;
+   if ((data->flags & ALLEGRO_TTF_NO_KERNING) || prev_ft_index == -1 ||
+         !FT_HAS_KERNING(face)) {
+      return 0;
+   }
+
+   /* FreeType looks the pair up in the font each time, so remember it. */
+   if (prev_ft_index >= KERNING_TABLE_SIZE || ft_index >= KERNING_TABLE_SIZE)
+      return get_kerning_pair(data, face, prev_ft_index, ft_index);
+
+   if (!data->kerning_table) {
+      data->kerning_table = al_malloc(KERNING_TABLE_SIZE *
+         KERNING_TABLE_SIZE * sizeof *data->kerning_table);
+      for (i = 0; i < KERNING_TABLE_SIZE * KERNING_TABLE_SIZE; i++)
+         data->kerning_table[i] = KERNING_UNKNOWN;
    }
 
-   return 0;
+   kerning = &data->kerning_table[prev_ft_index * KERNING_TABLE_SIZE +
+      ft_index];
+   if (*kerning == KERNING_UNKNOWN)
+      *kerning = load_kerning(face, prev_ft_index, ft_index);
+   return *kerning;
 }
 
 
@@ -610,6 +1480,78 @@ static int render_glyph(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
 }
 
 
+/* Glyphs collected by render_text, drawn together whenever the page they
+ * are on changes.
+ */
+typedef struct GLYPH_BATCH
+{
+   ALLEGRO_BITMAP *page;
+   ALLEGRO_COLOR color;
+   ALLEGRO_BITMAP_REGION regions[64];
+   int count;
+} GLYPH_BATCH;
+
+
+static void flush_glyph_batch(GLYPH_BATCH *batch)
+{
+   if (batch->count > 0) {
+      _al_draw_bitmap_regions(batch->page, batch->color, batch->regions,
+         batch->count);
+   }
+   batch->count = 0;
+}
+
+
+/* Whether getting the glyph leaves the pages alone. Caching it, or the glyphs
+ * of a prewarm, may evict the page of a glyph waiting in a batch.
+ */
+static bool glyph_is_cached(ALLEGRO_TTF_FONT_DATA *data, int ft_index)
+{
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+
+   if (data->prewarm || !get_glyph(data, ft_index, &glyph))
+      return false;
+   return glyph->page_bitmap || glyph->region.x < 0;
+}
+
+
+/* Like render_glyph, but adds the glyph to the batch instead of drawing it
+ * right away.
+ */
+static int batch_glyph(ALLEGRO_FONT const *f, GLYPH_BATCH *batch,
+   int prev_ft_index, int ft_index, int32_t prev_ch, int32_t ch, float xpos,
+   float ypos)
+{
+   ALLEGRO_GLYPH glyph;
+   ALLEGRO_BITMAP_REGION *r;
+
+   if (!glyph_is_cached(f->data, ft_index))
+      flush_glyph_batch(batch);
+
+   if (ttf_get_glyph_worker(f, prev_ft_index, ft_index, prev_ch, ch, &glyph) == false)
+      return 0;
+
+   if (glyph.bitmap != NULL) {
+      if (glyph.bitmap != batch->page ||
+            batch->count == (int)(sizeof batch->regions /
+               sizeof batch->regions[0])) {
+         flush_glyph_batch(batch);
+         batch->page = glyph.bitmap;
+      }
+      /* The same region as render_glyph draws. */
+      r = &batch->regions[batch->count++];
+      r->sx = glyph.x - 1;
+      r->sy = glyph.y - 1;
+      r->sw = glyph.w + 2;
+      r->sh = glyph.h + 2;
+      r->dx = xpos + glyph.offset_x + glyph.kerning - 1;
+      r->dy = ypos + glyph.offset_y - 1;
+   }
+
+   return glyph.advance;
+}
+
+
 static int ttf_font_height(ALLEGRO_FONT const *f)
 {
    ASSERT(f);
@@ -627,7 +1569,7 @@ static int ttf_font_ascent(ALLEGRO_FONT const *f)
     data = f->data;
     face = data->face;
 
-    return face->size->metrics.ascender >> 6;
+    return scale_metric(data, face->size->metrics.ascender);
 }
 
 
@@ -641,7 +1583,55 @@ static int ttf_font_descent(ALLEGRO_FONT const *f)
     data = f->data;
     face = data->face;
 
-    return (-face->size->metrics.descender) >> 6;
+    return scale_metric(data, -face->size->metrics.descender);
+}
+
+
+/* SDF glyphs are drawn at their base size through a transformation which
+ * scales them to the font size, and with the SDF shader where possible.
+ */
+typedef struct SDF_DRAWING
+{
+   ALLEGRO_TRANSFORM old_transform;
+   ALLEGRO_SHADER *old_shader;
+   bool use_shader;
+   bool hold;
+} SDF_DRAWING;
+
+
+static void begin_sdf_drawing(ALLEGRO_TTF_FONT_DATA *data, float x, float y,
+   SDF_DRAWING *sdf)
+{
+   ALLEGRO_SHADER *shader = get_sdf_shader(al_get_target_bitmap());
+   ALLEGRO_TRANSFORM t;
+
+   sdf->hold = al_is_bitmap_drawing_held();
+   sdf->use_shader = shader != NULL;
+   if (shader) {
+      /* What was held so far must not be drawn with the SDF shader. */
+      al_hold_bitmap_drawing(false);
+      sdf->old_shader = al_get_current_shader();
+      al_use_shader(shader);
+   }
+   al_hold_bitmap_drawing(true);
+
+   al_copy_transform(&sdf->old_transform, al_get_current_transform());
+   al_identity_transform(&t);
+   al_scale_transform(&t, data->sdf_scale, data->sdf_scale);
+   al_translate_transform(&t, x, y);
+   al_compose_transform(&t, &sdf->old_transform);
+   al_use_transform(&t);
+}
+
+
+static void end_sdf_drawing(SDF_DRAWING *sdf)
+{
+   al_use_transform(&sdf->old_transform);
+   if (sdf->use_shader) {
+      al_hold_bitmap_drawing(false);
+      al_use_shader(sdf->old_shader);
+   }
+   al_hold_bitmap_drawing(sdf->hold);
 }
 
 
@@ -652,8 +1642,15 @@ static int ttf_render_char(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
    FT_Face face = data->face;
    int advance = 0;
    int32_t ch32 = (int32_t) ch;
+   SDF_DRAWING sdf;
 
    int ft_index = FT_Get_Char_Index(face, ch32);
+   if (data->flags & ALLEGRO_TTF_SDF) {
+      begin_sdf_drawing(data, xpos, ypos, &sdf);
+      advance = render_glyph(f, color, -1, ft_index, -1, ch, 0, 0);
+      end_sdf_drawing(&sdf);
+      return scale_sdf(data, advance);
+   }
    advance = render_glyph(f, color, -1, ft_index, -1, ch, xpos, ypos);
 
    return advance;
@@ -672,46 +1669,362 @@ static int ttf_char_length(ALLEGRO_FONT const *f, int ch)
          return al_get_glyph_width(f->fallback, ch);
       }
       else {
-         get_glyph(data, 0, &glyph);
          ft_index = 0;
       }
    }
-   cache_glyph(data, face, ft_index, glyph, false);
-   result = glyph->region.w - 4;    /* Remove 2-pixel border from width */
+   result = get_glyph_metrics(data, face, ft_index)->w;
+   if (data->flags & ALLEGRO_TTF_SDF) {
+      /* And the padding of the distance field. */
+      result = scale_sdf(data, _ALLEGRO_MAX(result - 2 * SDF_SPREAD, 0));
+   }
 
    return result;
 }
 
 
-static int ttf_render(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
-   const ALLEGRO_USTR *text, float x, float y)
+static void free_run_batches(TTF_RUN *run)
+{
+   int i;
+
+   for (i = 0; i < (int)_al_vector_size(&run->batches); i++) {
+      TTF_RUN_BATCH *batch = _al_vector_ref(&run->batches, i);
+      _al_vector_free(&batch->instances);
+      _al_vector_free(&batch->offsets);
+   }
+   _al_vector_free(&run->batches);
+}
+
+
+static void destroy_run(TTF_RUN *run)
+{
+   if (!run)
+      return;
+
+   free_run_batches(run);
+   al_free(run);
+}
+
+
+/* Glyphs are drawn in order, as overlapping ones would blend differently,
+ * so a new batch starts whenever the page changes.
+ */
+static TTF_RUN_BATCH *get_run_batch(TTF_RUN *run, ALLEGRO_BITMAP *page)
+{
+   TTF_RUN_BATCH *batch;
+
+   if (!_al_vector_is_empty(&run->batches)) {
+      batch = _al_vector_ref_back(&run->batches);
+      if (batch->page == page)
+         return batch;
+   }
+
+   batch = _al_vector_alloc_back(&run->batches);
+   batch->page = page;
+   _al_vector_init(&batch->instances, sizeof(ALLEGRO_SPRITE_INSTANCE));
+   _al_vector_init(&batch->offsets, 2 * sizeof(float));
+   return batch;
+}
+
+
+/* Lays out the string once, with the same quads render_glyph would draw.
+ * Strings using the fallback font, or glyphs which could not be cached,
+ * give an incomplete run which is not drawn.
+ *
+ * NOTE: like cache_glyph this may disable the bitmap hold drawing state.
+ */
+static TTF_RUN *layout_run(ALLEGRO_FONT const *f, const ALLEGRO_USTR *text)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    FT_Face face = data->face;
+   TTF_RUN *run = al_calloc(1, sizeof *run);
    int pos = 0;
-   int advance = 0;
    int prev_ft_index = -1;
    int32_t prev_ch = -1;
    int32_t ch;
-   bool hold;
 
-   hold = al_is_bitmap_drawing_held();
-   al_hold_bitmap_drawing(true);
+   run->generation = data->cache_generation;
+   run->complete = true;
+   _al_vector_init(&run->batches, sizeof(TTF_RUN_BATCH));
 
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
       int ft_index = FT_Get_Char_Index(face, ch);
-      advance += render_glyph(f, color, prev_ft_index, ft_index, prev_ch, ch,
-         x + advance, y);
+      ALLEGRO_TTF_GLYPH_DATA *glyph;
+      ALLEGRO_GLYPH info;
+
+      if (!get_glyph(data, ft_index, &glyph) && f->fallback) {
+         run->complete = false;
+         break;
+      }
+
+      if (ttf_get_glyph_worker(f, prev_ft_index, ft_index, prev_ch, ch,
+            &info)) {
+         if (info.bitmap) {
+            TTF_RUN_BATCH *batch = get_run_batch(run, info.bitmap);
+            ALLEGRO_SPRITE_INSTANCE *in = _al_vector_alloc_back(&batch->instances);
+            float *offset = _al_vector_alloc_back(&batch->offsets);
+
+            memset(in, 0, sizeof *in);
+            in->sx = info.x - 1;
+            in->sy = info.y - 1;
+            in->sw = info.w + 2;
+            in->sh = info.h + 2;
+            in->xscale = 1;
+            in->yscale = 1;
+            offset[0] = run->advance + info.offset_x + info.kerning - 1;
+            offset[1] = info.offset_y - 1;
+            batch->glyph = glyph;
+         }
+         else if (glyph->region.x >= 0) {
+            run->complete = false;
+            break;
+         }
+         run->advance += info.advance;
+      }
+
       prev_ft_index = ft_index;
       prev_ch = ch;
    }
 
+   /* Caching the later glyphs may have evicted the pages of earlier ones. */
+   if (data->cache_generation != run->generation) {
+      run->generation = data->cache_generation;
+      run->complete = false;
+   }
+
+   if (!run->complete)
+      free_run_batches(run);
+
+   return run;
+}
+
+
+/* Returns the run laid out again if glyphs left the pages since. */
+static TTF_RUN *update_run(ALLEGRO_FONT const *f, TTF_RUN *run,
+   const ALLEGRO_USTR *text)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+
+   if (run && run->generation == data->cache_generation)
+      return run;
+
+   destroy_run(run);
+   return layout_run(f, text);
+}
+
+
+static void draw_run(ALLEGRO_TTF_FONT_DATA *data, TTF_RUN *run,
+   ALLEGRO_COLOR color, float x, float y)
+{
+   bool fill = !run->filled || x != run->x || y != run->y ||
+      memcmp(&color, &run->color, sizeof color);
+   int i, j;
+
+   for (i = 0; i < (int)_al_vector_size(&run->batches); i++) {
+      TTF_RUN_BATCH *batch = _al_vector_ref(&run->batches, i);
+      ALLEGRO_SPRITE_INSTANCE *in = _al_vector_ref_front(&batch->instances);
+      int count = _al_vector_size(&batch->instances);
+
+      if (fill) {
+         float *offset = _al_vector_ref_front(&batch->offsets);
+         for (j = 0; j < count; j++) {
+            in[j].dx = x + offset[2 * j];
+            in[j].dy = y + offset[2 * j + 1];
+            in[j].tint = color;
+         }
+      }
+
+      /* Keep the page in use for eviction. */
+      batch->glyph->last_use = ++data->use_clock;
+      al_draw_bitmap_instances(batch->page, in, count, 0);
+   }
+
+   run->filled = true;
+   run->color = color;
+   run->x = x;
+   run->y = y;
+}
+
+
+static uint32_t hash_ustr(const ALLEGRO_USTR *text)
+{
+   const char *s = al_cstr(text);
+   size_t size = al_ustr_size(text);
+   uint32_t hash = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < size; i++) {
+      hash ^= (unsigned char)s[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+
+/* Looks the string up in the cache of recently drawn strings. Strings are
+ * only laid out when drawn a second time, so text which changes every frame
+ * doesn't pay for it.
+ */
+static TTF_RUN *get_cached_run(ALLEGRO_FONT const *f,
+   const ALLEGRO_USTR *text)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   RUN_CACHE_ENTRY *entry;
+   uint32_t hash;
+   int i, lru = 0;
+
+   if (data->run_cache_size == 0)
+      return NULL;
+
+   hash = hash_ustr(text);
+   for (i = 0; i < data->run_cache_size; i++) {
+      entry = &data->run_cache[i];
+      if (entry->text && entry->hash == hash &&
+            al_ustr_equal(entry->text, text)) {
+         entry->last_use = ++data->run_clock;
+         entry->run = update_run(f, entry->run, text);
+         return entry->run;
+      }
+      if (entry->last_use < data->run_cache[lru].last_use)
+         lru = i;
+   }
+
+   entry = &data->run_cache[lru];
+   destroy_run(entry->run);
+   entry->run = NULL;
+   if (entry->text)
+      al_ustr_assign(entry->text, text);
+   else
+      entry->text = al_ustr_dup(text);
+   entry->hash = hash;
+   entry->last_use = ++data->run_clock;
+   return NULL;
+}
+
+
+static int render_text(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
+   const ALLEGRO_USTR *text, TTF_RUN *run, float x, float y)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   FT_Face face = data->face;
+   int pos = 0;
+   int advance = 0;
+   int prev_ft_index = -1;
+   int32_t prev_ch = -1;
+   int32_t ch;
+   bool hold = false;
+   SDF_DRAWING sdf;
+
+   if (data->flags & ALLEGRO_TTF_SDF) {
+      begin_sdf_drawing(data, x, y, &sdf);
+      x = 0;
+      y = 0;
+   }
+   else {
+      hold = al_is_bitmap_drawing_held();
+      al_hold_bitmap_drawing(true);
+   }
+
+   if (run && run->complete) {
+      draw_run(data, run, color, x, y);
+      advance = run->advance;
+   }
+   else {
+      GLYPH_BATCH batch;
+
+      batch.page = NULL;
+      batch.color = color;
+      batch.count = 0;
+      while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
+         int ft_index = FT_Get_Char_Index(face, ch);
+         advance += batch_glyph(f, &batch, prev_ft_index, ft_index, prev_ch,
+            ch, x + advance, y);
+         prev_ft_index = ft_index;
+         prev_ch = ch;
+      }
+      flush_glyph_batch(&batch);
+   }
+
+   if (data->flags & ALLEGRO_TTF_SDF) {
+      end_sdf_drawing(&sdf);
+      return scale_sdf(data, advance);
+   }
+
    al_hold_bitmap_drawing(hold);
 
    return advance;
 }
 
 
+static int ttf_render(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
+   const ALLEGRO_USTR *text, float x, float y)
+{
+   return render_text(f, color, text, get_cached_run(f, text), x, y);
+}
+
+
+static int ttf_render_run(ALLEGRO_FONT const *f, ALLEGRO_TEXT_RUN *run,
+   ALLEGRO_COLOR color, float x, float y)
+{
+   run->data = update_run(f, run->data, run->text);
+   return render_text(f, color, run->text, run->data, x, y);
+}
+
+
+static void ttf_destroy_run(ALLEGRO_TEXT_RUN *run)
+{
+   destroy_run(run->data);
+}
+
+
+static int ttf_get_text_quads(ALLEGRO_FONT const *f, const ALLEGRO_USTR *text,
+   ALLEGRO_COLOR color, float x, float y, _AL_VECTOR *quads)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   int generation = data->cache_generation;
+   TTF_RUN *run, *layout = NULL;
+   int i, j;
+
+   /* These need the SDF shader and scaling. */
+   if (data->flags & ALLEGRO_TTF_SDF)
+      return 0;
+
+   run = get_cached_run(f, text);
+   if (!run)
+      run = layout = layout_run(f, text);
+
+   if (data->cache_generation != generation) {
+      destroy_run(layout);
+      return -1;
+   }
+   if (!run->complete) {
+      destroy_run(layout);
+      return 0;
+   }
+
+   for (i = 0; i < (int)_al_vector_size(&run->batches); i++) {
+      TTF_RUN_BATCH *batch = _al_vector_ref(&run->batches, i);
+      ALLEGRO_SPRITE_INSTANCE *in = _al_vector_ref_front(&batch->instances);
+      float *offset = _al_vector_ref_front(&batch->offsets);
+
+      for (j = 0; j < (int)_al_vector_size(&batch->instances); j++) {
+         ALLEGRO_TEXT_QUAD *q = _al_vector_alloc_back(quads);
+         q->bitmap = batch->page;
+         q->sx = in[j].sx;
+         q->sy = in[j].sy;
+         q->sw = in[j].sw;
+         q->sh = in[j].sh;
+         q->dx = x + offset[2 * j];
+         q->dy = y + offset[2 * j + 1];
+         q->color = color;
+      }
+      batch->glyph->last_use = ++data->use_clock;
+   }
+
+   destroy_run(layout);
+   return 1;
+}
+
+
 static int ttf_text_length(ALLEGRO_FONT const *f, const ALLEGRO_USTR *text)
 {
    int pos = 0;
@@ -759,46 +2072,387 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
          x += al_get_glyph_advance(f, ch, nch);
       }
 
-      if (gy < ymin) {
-         ymin = gy;
-      }
+      if (gy < ymin) {
+         ymin = gy;
+      }
+
+      if (gh+gy > ymax) {
+         ymax = gh + gy;
+      }
+
+      if (first) {
+         *bbx = gx;
+         first = false;
+      }
+   }
+
+   *bby = ymin;
+   *bbw = x - *bbx;
+   *bbh = ymax - ymin;
+}
+
+
+/* Hashes the whole font file, so a glyph cache file is not used with a
+ * different font of the same name.
+ */
+static uint64_t get_file_hash(ALLEGRO_TTF_FONT_DATA *data)
+{
+   unsigned char buf[4096];
+   unsigned long left = data->stream.size;
+   uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+   if (data->have_file_hash)
+      return data->file_hash;
+
+   if (data->file_mutex)
+      al_lock_mutex(data->file_mutex);
+   al_fseek(data->file, data->base_offset, ALLEGRO_SEEK_SET);
+   while (left > 0) {
+      size_t n = al_fread(data->file, buf,
+         left < sizeof buf ? left : sizeof buf);
+      size_t i;
+      if (n == 0)
+         break;
+      for (i = 0; i < n; i++) {
+         hash ^= buf[i];
+         hash *= UINT64_C(0x100000001b3);
+      }
+      left -= n;
+   }
+   /* Where ftread will find the file. */
+   data->offset = data->stream.size - left;
+   if (data->file_mutex)
+      al_unlock_mutex(data->file_mutex);
+
+   data->file_hash = hash;
+   data->have_file_hash = true;
+   return hash;
+}
+
+
+/* Everything the rasterized glyphs depend on. */
+static void get_glyph_cache_key(ALLEGRO_TTF_FONT_DATA *data, int32_t *key)
+{
+   uint64_t hash = get_file_hash(data);
+
+   key[0] = (int32_t)hash;
+   key[1] = (int32_t)(hash >> 32);
+   key[2] = data->size_w;
+   key[3] = data->size_h;
+   key[4] = data->flags;
+   key[5] = FREETYPE_MAJOR;
+   key[6] = FREETYPE_MINOR;
+   key[7] = FREETYPE_PATCH;
+}
+
+
+/* Glyph pixels are stored as alpha only, as the color follows from it. */
+static bool write_glyph_page(ALLEGRO_FILE *f, ALLEGRO_BITMAP *page,
+   unsigned char *row)
+{
+   int w = al_get_bitmap_width(page);
+   int h = al_get_bitmap_height(page);
+   ALLEGRO_LOCKED_REGION *lr;
+   int x, y;
+
+   lr = al_lock_bitmap(page, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      ALLEGRO_LOCK_READONLY);
+   if (!lr)
+      return false;
+
+   al_fwrite32le(f, w);
+   al_fwrite32le(f, h);
+   for (y = 0; y < h; y++) {
+      unsigned char const *ptr = (unsigned char *)lr->data + y * lr->pitch;
+      for (x = 0; x < w; x++)
+         row[x] = ptr[x * 4 + 3];
+      al_fwrite(f, row, w);
+   }
+   al_unlock_bitmap(page);
+   return true;
+}
+
+
+static ALLEGRO_BITMAP *read_glyph_page(ALLEGRO_TTF_FONT_DATA *data,
+   ALLEGRO_FILE *f, unsigned char **row)
+{
+   int w = al_fread32le(f);
+   int h = al_fread32le(f);
+   ALLEGRO_BITMAP *page;
+   ALLEGRO_LOCKED_REGION *lr;
+   int x, y;
+
+   if (al_feof(f) || w <= 0 || h <= 0 || w > data->max_page_size ||
+         h > data->max_page_size)
+      return NULL;
+
+   page = create_page(data, w, h);
+   if (!page)
+      return NULL;
+   lr = al_lock_bitmap(page, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      ALLEGRO_LOCK_WRITEONLY);
+   if (!lr) {
+      al_destroy_bitmap(page);
+      return NULL;
+   }
+
+   *row = al_realloc(*row, w);
+   for (y = 0; y < h; y++) {
+      unsigned char *dptr = (unsigned char *)lr->data + y * lr->pitch;
+      if (al_fread(f, *row, w) != (size_t)w)
+         break;
+      for (x = 0; x < w; x++) {
+         unsigned char c = (*row)[x];
+         if (data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
+            *dptr++ = 255;
+            *dptr++ = 255;
+            *dptr++ = 255;
+         }
+         else {
+            *dptr++ = c;
+            *dptr++ = c;
+            *dptr++ = c;
+         }
+         *dptr++ = c;
+      }
+   }
+   al_unlock_bitmap(page);
+
+   if (y < h) {
+      al_destroy_bitmap(page);
+      return NULL;
+   }
+   return page;
+}
+
+
+static bool write_glyph_cache(ALLEGRO_TTF_FONT_DATA *data, ALLEGRO_FILE *f)
+{
+   int32_t key[GLYPH_CACHE_KEY_SIZE];
+   int num_pages = _al_vector_size(&data->page_bitmaps);
+   int num_glyphs = 0;
+   unsigned char *row = NULL;
+   bool ok = true;
+   int i, j, k;
+
+   get_glyph_cache_key(data, key);
+   al_fwrite(f, GLYPH_CACHE_MAGIC, 8);
+   for (i = 0; i < GLYPH_CACHE_KEY_SIZE; i++)
+      al_fwrite32le(f, key[i]);
+
+   al_fwrite32le(f, data->page_pos_x);
+   al_fwrite32le(f, data->page_pos_y);
+   al_fwrite32le(f, data->page_line_height);
+   al_fwrite32le(f, num_pages);
+   for (i = 0; i < num_pages && ok; i++) {
+      ALLEGRO_BITMAP **page = _al_vector_ref(&data->page_bitmaps, i);
+      row = al_realloc(row, al_get_bitmap_width(*page));
+      ok = write_glyph_page(f, *page, row);
+   }
+   al_free(row);
+   if (!ok)
+      return false;
+
+   /* Glyphs with no pixels are written too, as they are cached as well. */
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         if (range->glyphs[j].page_bitmap || range->glyphs[j].region.x < 0)
+            num_glyphs++;
+      }
+   }
+   al_fwrite32le(f, num_glyphs);
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         int page = -1;
+         if (!glyph->page_bitmap && glyph->region.x >= 0)
+            continue;
+         for (k = 0; k < num_pages; k++) {
+            ALLEGRO_BITMAP **bmp = _al_vector_ref(&data->page_bitmaps, k);
+            if (*bmp == glyph->page_bitmap)
+               page = k;
+         }
+         al_fwrite32le(f, range->range_start + j);
+         al_fwrite32le(f, page);
+         al_fwrite16le(f, glyph->region.x);
+         al_fwrite16le(f, glyph->region.y);
+         al_fwrite16le(f, glyph->region.w);
+         al_fwrite16le(f, glyph->region.h);
+         al_fwrite16le(f, glyph->offset_x);
+         al_fwrite16le(f, glyph->offset_y);
+         al_fwrite16le(f, glyph->advance);
+      }
+   }
+
+   return !al_ferror(f);
+}
 
-      if (gh+gy > ymax) {
-         ymax = gh + gy;
+
+typedef struct CACHED_GLYPH
+{
+   int ft_index;
+   int page;
+   ALLEGRO_TTF_GLYPH_DATA glyph;
+} CACHED_GLYPH;
+
+
+/* Replaces the pages and the cached glyphs with the ones in the file, if
+ * it was written for the same font.
+ */
+static bool read_glyph_cache(ALLEGRO_TTF_FONT_DATA *data, ALLEGRO_FILE *f)
+{
+   int32_t key[GLYPH_CACHE_KEY_SIZE];
+   char magic[8];
+   _AL_VECTOR pages;  /* of ALLEGRO_BITMAP pointers */
+   _AL_VECTOR glyphs;  /* of CACHED_GLYPH */
+   unsigned char *row = NULL;
+   int page_pos_x, page_pos_y, page_line_height;
+   int num_pages, num_glyphs;
+   bool ok = false;
+   int i;
+
+   get_glyph_cache_key(data, key);
+   if (al_fread(f, magic, 8) != 8 || memcmp(magic, GLYPH_CACHE_MAGIC, 8))
+      return false;
+   for (i = 0; i < GLYPH_CACHE_KEY_SIZE; i++) {
+      if (al_fread32le(f) != key[i]) {
+         ALLEGRO_DEBUG("Glyph cache is for another font.\n");
+         return false;
       }
+   }
 
-      if (first) {
-         *bbx = gx;
-         first = false;
+   _al_vector_init(&pages, sizeof(ALLEGRO_BITMAP *));
+   _al_vector_init(&glyphs, sizeof(CACHED_GLYPH));
+
+   page_pos_x = al_fread32le(f);
+   page_pos_y = al_fread32le(f);
+   page_line_height = al_fread32le(f);
+   num_pages = al_fread32le(f);
+   if (al_feof(f) || num_pages < 0)
+      goto done;
+   for (i = 0; i < num_pages; i++) {
+      ALLEGRO_BITMAP *page = read_glyph_page(data, f, &row);
+      if (!page)
+         goto done;
+      *(ALLEGRO_BITMAP **)_al_vector_alloc_back(&pages) = page;
+   }
+
+   num_glyphs = al_fread32le(f);
+   if (al_feof(f) || num_glyphs < 0 || num_glyphs > data->face->num_glyphs)
+      goto done;
+   for (i = 0; i < num_glyphs; i++) {
+      CACHED_GLYPH *c = _al_vector_alloc_back(&glyphs);
+      REGION *r = &c->glyph.region;
+      memset(c, 0, sizeof *c);
+      c->ft_index = al_fread32le(f);
+      c->page = al_fread32le(f);
+      r->x = al_fread16le(f);
+      r->y = al_fread16le(f);
+      r->w = al_fread16le(f);
+      r->h = al_fread16le(f);
+      c->glyph.offset_x = al_fread16le(f);
+      c->glyph.offset_y = al_fread16le(f);
+      c->glyph.advance = al_fread16le(f);
+      if (al_feof(f) || c->ft_index < 0 ||
+            c->ft_index >= data->face->num_glyphs ||
+            c->page < -1 || c->page >= num_pages)
+         goto done;
+      if (c->page >= 0) {
+         ALLEGRO_BITMAP **page = _al_vector_ref(&pages, c->page);
+         if (r->x < 0 || r->y < 0 ||
+               r->x + r->w > al_get_bitmap_width(*page) ||
+               r->y + r->h > al_get_bitmap_height(*page))
+            goto done;
+         c->glyph.page_bitmap = *page;
       }
+      else if (r->x >= 0) {
+         goto done;
+      }
+   }
+   ok = true;
+
+done:
+   al_free(row);
+   if (!ok) {
+      ALLEGRO_WARN("Invalid glyph cache file.\n");
+      for (i = 0; i < (int)_al_vector_size(&pages); i++)
+         al_destroy_bitmap(*(ALLEGRO_BITMAP **)_al_vector_ref(&pages, i));
+      _al_vector_free(&pages);
+      _al_vector_free(&glyphs);
+      return false;
    }
 
-   *bby = ymin;
-   *bbw = x - *bbx;
-   *bbh = ymax - ymin;
+   /* Pending draws may refer to the old pages. */
+   if (al_is_bitmap_drawing_held()) {
+      al_hold_bitmap_drawing(false);
+      al_hold_bitmap_drawing(true);
+   }
+   forget_page_glyphs(data, NULL);
+   for (i = _al_vector_size(&data->page_bitmaps) - 1; i >= 0; i--) {
+      ALLEGRO_BITMAP **bmp = _al_vector_ref(&data->page_bitmaps, i);
+      al_destroy_bitmap(*bmp);
+   }
+   _al_vector_free(&data->page_bitmaps);
+   data->page_bitmaps = pages;
+
+   for (i = 0; i < num_glyphs; i++) {
+      CACHED_GLYPH *c = _al_vector_ref(&glyphs, i);
+      ALLEGRO_TTF_GLYPH_DATA *glyph;
+      get_glyph(data, c->ft_index, &glyph);
+      *glyph = c->glyph;
+   }
+   _al_vector_free(&glyphs);
+
+   if (num_pages > 0) {
+      data->page_pos_x = page_pos_x;
+      data->page_pos_y = page_pos_y;
+      data->page_line_height = page_line_height;
+   }
+   data->glyph_cache_dirty = false;
+   ALLEGRO_DEBUG("Read %d glyphs on %d pages from the glyph cache.\n",
+      num_glyphs, num_pages);
+   return true;
 }
 
 
-#ifdef DEBUG_CACHE
-#include "allegro5/allegro_image.h"
-static void debug_cache(ALLEGRO_FONT *f)
+static bool save_glyph_cache(ALLEGRO_TTF_FONT_DATA *data,
+   const char *filename)
 {
-   ALLEGRO_TTF_FONT_DATA *data = f->data;
-   _AL_VECTOR *v = &data->page_bitmaps;
-   static int j = 0;
-   int i;
+   ALLEGRO_FILE *f = al_fopen(filename, "wb");
+   bool ok;
+
+   if (!f) {
+      ALLEGRO_ERROR("Unable to open %s for writing.\n", filename);
+      return false;
+   }
+   ok = write_glyph_cache(data, f);
+   al_fclose(f);
+   if (!ok) {
+      ALLEGRO_ERROR("Failed writing the glyph cache to %s.\n", filename);
+      al_remove_filename(filename);
+      return false;
+   }
+   data->glyph_cache_dirty = false;
+   return true;
+}
 
-   al_init_image_addon();
 
-   for (i = 0; i < (int)_al_vector_size(v); i++) {
-      ALLEGRO_BITMAP **bmp = _al_vector_ref(v, i);
-      ALLEGRO_USTR *u = al_ustr_newf("font%d_%d.png", j, i);
-      al_save_bitmap(al_cstr(u), *bmp);
-      al_ustr_free(u);
+static bool load_glyph_cache(ALLEGRO_TTF_FONT_DATA *data,
+   const char *filename)
+{
+   ALLEGRO_FILE *f = al_fopen(filename, "rb");
+   bool ok;
+
+   if (!f) {
+      ALLEGRO_DEBUG("No glyph cache at %s.\n", filename);
+      return false;
    }
-   j++;
+   ok = read_glyph_cache(data, f);
+   al_fclose(f);
+   return ok;
 }
-#endif
 
 
 static void ttf_destroy(ALLEGRO_FONT *f)
@@ -806,13 +2460,43 @@ static void ttf_destroy(ALLEGRO_FONT *f)
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    int i;
 
+   if (data->prewarm) {
+      destroy_prewarm(data);
+   }
+
    unlock_current_page(data);
 
-#ifdef DEBUG_CACHE
-   debug_cache(f);
-#endif
+   if (data->glyph_cache_path) {
+      if (data->glyph_cache_dirty) {
+         save_glyph_cache(data, al_path_cstr(data->glyph_cache_path,
+            ALLEGRO_NATIVE_PATH_SEP));
+      }
+      al_destroy_path(data->glyph_cache_path);
+   }
+
+   ALLEGRO_DEBUG("Destroying font: %d pages, %d hits, %d misses, "
+      "%d evictions\n", (int)_al_vector_size(&data->page_bitmaps),
+      (int)data->hits, (int)data->misses, (int)data->evictions);
+
+   for (i = 0; i < data->run_cache_size; i++) {
+      al_ustr_free(data->run_cache[i].text);
+      destroy_run(data->run_cache[i].run);
+   }
+   al_free(data->run_cache);
+   al_free(data->kerning_table);
+   al_free(data->kerning_pairs);
+   if (data->metrics_pages) {
+      for (i = 0; i <= data->face->num_glyphs / METRICS_PAGE_SIZE; i++)
+         al_free(data->metrics_pages[i]);
+      al_free(data->metrics_pages);
+   }
 
    FT_Done_Face(data->face);
+   al_free(data->sdf_scratch);
+   if (data->file_mutex) {
+      al_destroy_mutex(data->file_mutex);
+   }
+   al_destroy_user_event_source(&data->es);
    for (i = _al_vector_size(&data->glyph_ranges) - 1; i >= 0; i--) {
       ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
       al_free(range->glyphs);
@@ -837,10 +2521,15 @@ static unsigned long ftread(FT_Stream stream, unsigned long offset,
     if (count == 0)
        return 0;
 
+    /* The file is shared with the face of a prewarm thread, if any. */
+    if (data->file_mutex)
+       al_lock_mutex(data->file_mutex);
     if (offset != data->offset)
        al_fseek(data->file, data->base_offset + offset, ALLEGRO_SEEK_SET);
     bytes = al_fread(data->file, buffer, count);
     data->offset = offset + bytes;
+    if (data->file_mutex)
+       al_unlock_mutex(data->file_mutex);
     return bytes;
 }
 
@@ -852,6 +2541,37 @@ static void ftclose(FT_Stream  stream)
     data->file = NULL;
 }
 
+static void set_sdf_spread(FT_Library library)
+{
+#ifdef HAVE_FT_SDF
+    FT_Int spread = SDF_SPREAD;
+    FT_Property_Set(library, "sdf", "spread", &spread);
+#else
+    (void)library;
+#endif
+}
+
+static void set_face_size(FT_Face face, int w, int h)
+{
+    if (h > 0) {
+       FT_Set_Pixel_Sizes(face, w, h);
+    }
+    else {
+       /* Set the "real dimension" of the font to be the passed size,
+        * in pixels.
+        */
+       FT_Size_RequestRec req;
+       ASSERT(w <= 0);
+       ASSERT(h <= 0);
+       req.type = FT_SIZE_REQUEST_TYPE_REAL_DIM;
+       req.width = (-w) << 6;
+       req.height = (-h) << 6;
+       req.horiResolution = 0;
+       req.vertResolution = 0;
+       FT_Request_Size(face, &req);
+    }
+}
+
 /* Function: al_load_ttf_font_f
  */
 ALLEGRO_FONT *al_load_ttf_font_f(ALLEGRO_FILE *file,
@@ -881,6 +2601,14 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
       al_get_config_value(system_cfg, "ttf", "cache_text");
     const char* skip_cache_misses_str =
       al_get_config_value(system_cfg, "ttf", "skip_cache_misses");
+    const char* cache_budget_str =
+      al_get_config_value(system_cfg, "ttf", "cache_budget");
+    const char* sdf_size_str =
+      al_get_config_value(system_cfg, "ttf", "sdf_size");
+    const char* run_cache_str =
+      al_get_config_value(system_cfg, "ttf", "run_cache_size");
+    const char* glyph_cache_dir_str =
+      al_get_config_value(system_cfg, "ttf", "glyph_cache_dir");
 
     if ((h > 0 && w < 0) || (h < 0 && w > 0)) {
        ALLEGRO_ERROR("Height/width have opposite signs (w = %d, h = %d).\n", w, h);
@@ -917,6 +2645,41 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
        data->skip_cache_misses = true;
     }
 
+    if (cache_budget_str) {
+      int64_t cache_budget = strtoll(cache_budget_str, NULL, 10);
+      if (cache_budget > 0) {
+         data->cache_budget = cache_budget;
+      }
+    }
+
+    data->run_cache_size = 32;
+    if (run_cache_str && atoi(run_cache_str) >= 0) {
+       data->run_cache_size = atoi(run_cache_str);
+    }
+    if (data->run_cache_size > 0) {
+       data->run_cache = al_calloc(data->run_cache_size,
+          sizeof *data->run_cache);
+    }
+
+    data->sdf_scale = 1;
+    if ((flags & ALLEGRO_TTF_SDF) && h == 0) {
+       ALLEGRO_WARN("Ignoring ALLEGRO_TTF_SDF for a font of size 0.\n");
+       flags &= ~ALLEGRO_TTF_SDF;
+    }
+    if (flags & ALLEGRO_TTF_SDF) {
+       /* The glyphs are rasterized once at the base size, whatever size
+        * was asked for, and scaled when drawn.
+        */
+       int sdf_size = 32;
+       if (sdf_size_str && atoi(sdf_size_str) > 0) {
+          sdf_size = atoi(sdf_size_str);
+       }
+       data->sdf_scale = abs(h) / (float)sdf_size;
+       w = w * sdf_size / abs(h);
+       h = h > 0 ? sdf_size : -sdf_size;
+       data->bitmap_flags |= ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR;
+    }
+
     memset(&args, 0, sizeof args);
     args.flags = FT_OPEN_STREAM;
     args.stream = &data->stream;
@@ -925,6 +2688,7 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
         ALLEGRO_ERROR("Reading %s failed. Freetype error code %d\n", filename,
           result);
         // Note: Freetype already closed the file for us.
+        al_free(data->run_cache);
         al_free(data);
         return NULL;
     }
@@ -950,23 +2714,7 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
     }
     al_destroy_path(path);
 
-    if (h > 0) {
-       FT_Set_Pixel_Sizes(face, w, h);
-    }
-    else {
-       /* Set the "real dimension" of the font to be the passed size,
-        * in pixels.
-        */
-       FT_Size_RequestRec req;
-       ASSERT(w <= 0);
-       ASSERT(h <= 0);
-       req.type = FT_SIZE_REQUEST_TYPE_REAL_DIM;
-       req.width = (-w) << 6;
-       req.height = (-h) << 6;
-       req.horiResolution = 0;
-       req.vertResolution = 0;
-       FT_Request_Size(face, &req);
-    }
+    set_face_size(face, w, h);
 
     ALLEGRO_DEBUG("Font %s loaded with pixel size %d x %d.\n", filename,
         w, h);
@@ -977,10 +2725,32 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
 
     data->face = face;
     data->flags = flags;
+    data->size_w = w;
+    data->size_h = h;
+    al_init_user_event_source(&data->es);
 
     _al_vector_init(&data->glyph_ranges, sizeof(ALLEGRO_TTF_GLYPH_RANGE));
     _al_vector_init(&data->page_bitmaps, sizeof(ALLEGRO_BITMAP*));
 
+    if (glyph_cache_dir_str && glyph_cache_dir_str[0]) {
+       int32_t key[GLYPH_CACHE_KEY_SIZE];
+       uint32_t hash = 2166136261u;
+       char name[32];
+       int i;
+
+       /* The file is named after the hash of its key. */
+       get_glyph_cache_key(data, key);
+       for (i = 0; i < GLYPH_CACHE_KEY_SIZE; i++) {
+          hash ^= (uint32_t)key[i];
+          hash *= 16777619u;
+       }
+       snprintf(name, sizeof name, "%08x.glyphs", (unsigned)hash);
+       data->glyph_cache_path = al_create_path_for_directory(glyph_cache_dir_str);
+       al_set_path_filename(data->glyph_cache_path, name);
+       load_glyph_cache(data, al_path_cstr(data->glyph_cache_path,
+          ALLEGRO_NATIVE_PATH_SEP));
+    }
+
     if (data->skip_cache_misses) {
        cache_glyphs(data, "\0", 1);
     }
@@ -990,7 +2760,7 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
     unlock_current_page(data);
 
     f = al_calloc(sizeof *f, 1);
-    f->height = face->size->metrics.height >> 6;
+    f->height = scale_metric(data, face->size->metrics.height);
     f->vtable = &vt;
     f->data = data;
 
@@ -1070,6 +2840,7 @@ static bool ttf_get_glyph_dimensions(ALLEGRO_FONT const *f,
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    ALLEGRO_TTF_GLYPH_DATA *glyph;
+   GLYPH_METRICS *m;
    FT_Face face = data->face;
    int ft_index = FT_Get_Char_Index(face, codepoint);
    if (!get_glyph(data, ft_index, &glyph)) {
@@ -1078,15 +2849,22 @@ static bool ttf_get_glyph_dimensions(ALLEGRO_FONT const *f,
             bbx, bby, bbw, bbh);
       }
       else {
-         get_glyph(data, 0, &glyph);
          ft_index = 0;
       }
    }
-   cache_glyph(data, face, ft_index, glyph, false);
-   *bbx = glyph->offset_x;
-   *bbw = glyph->region.w - 4;
-   *bbh = glyph->region.h - 4;
-   *bby = glyph->offset_y;
+   m = get_glyph_metrics(data, face, ft_index);
+   *bbx = m->offset_x;
+   *bbw = m->w;
+   *bbh = m->h;
+   *bby = m->offset_y;
+
+   if (data->flags & ALLEGRO_TTF_SDF) {
+      /* Leave out the padding of the distance field. */
+      *bbx = scale_sdf(data, *bbx + SDF_SPREAD);
+      *bby = scale_sdf(data, *bby + SDF_SPREAD);
+      *bbw = scale_sdf(data, _ALLEGRO_MAX(*bbw - 2 * SDF_SPREAD, 0));
+      *bbh = scale_sdf(data, _ALLEGRO_MAX(*bbh - 2 * SDF_SPREAD, 0));
+   }
 
    return true;
 }
@@ -1110,11 +2888,9 @@ static int ttf_get_glyph_advance(ALLEGRO_FONT const *f, int codepoint1,
          return al_get_glyph_advance(f->fallback, codepoint1, codepoint2);
       }
       else {
-         get_glyph(data, 0, &glyph);
          ft_index = 0;
       }
    }
-   cache_glyph(data, face, ft_index, glyph, false);
 
    if (codepoint2 != ALLEGRO_NO_KERNING) {
       int ft_index1 = FT_Get_Char_Index(face, codepoint1);
@@ -1122,11 +2898,365 @@ static int ttf_get_glyph_advance(ALLEGRO_FONT const *f, int codepoint1,
       kerning = get_kerning(data, face, ft_index1, ft_index2);
    }
 
-   advance = glyph->advance;
-   return advance + kerning;
+   advance = get_glyph_metrics(data, face, ft_index)->advance;
+   return scale_sdf(data, advance + kerning);
+}
+
+
+
+static void *prewarm_thread(ALLEGRO_THREAD *thread, void *arg)
+{
+   PREWARM_JOB *job = arg;
+   FT_Face face = job->face;
+   ALLEGRO_EVENT event;
+   int i;
+
+   for (i = 0; i < job->ranges_count; i++) {
+      int ch = job->ranges[i * 2 + 0];
+      int last = job->ranges[i * 2 + 1];
+
+      for (; ch <= last; ch++) {
+         PREWARM_GLYPH pg, *back;
+         FT_Bitmap bitmap;
+         int ft_index, left, top;
+         size_t size;
+
+         if (al_get_thread_should_stop(thread))
+            return NULL;
+
+         ft_index = FT_Get_Char_Index(face, ch);
+         if (ft_index == 0)
+            continue;
+         if (load_glyph_bitmap(face, ft_index, job->ft_load_flags, job->sdf,
+               &job->sdf_scratch, &bitmap, &left, &top)) {
+            ALLEGRO_WARN("Failed loading glyph %d.\n", ft_index);
+            continue;
+         }
+
+         pg.ft_index = ft_index;
+         pg.offset_x = left;
+         pg.offset_y = (face->size->metrics.ascender >> 6) - top;
+         pg.advance = face->glyph->advance.x >> 6;
+         pg.bitmap = bitmap;
+         size = (size_t)abs(pg.bitmap.pitch) * pg.bitmap.rows;
+         pg.bitmap.buffer = NULL;
+         if (size > 0) {
+            pg.bitmap.buffer = al_malloc(size);
+            memcpy(pg.bitmap.buffer, bitmap.buffer, size);
+         }
+
+         al_lock_mutex(job->mutex);
+         back = _al_vector_alloc_back(&job->glyphs);
+         *back = pg;
+         al_unlock_mutex(job->mutex);
+      }
+   }
+
+   al_lock_mutex(job->mutex);
+   job->finished = true;
+   al_unlock_mutex(job->mutex);
+
+   memset(&event, 0, sizeof event);
+   event.user.type = ALLEGRO_EVENT_TTF_PREWARM_FINISHED;
+   event.user.data1 = (intptr_t)job->font;
+   al_emit_user_event(job->es, &event, NULL);
+
+   return NULL;
+}
+
+
+/* Function: al_prewarm_ttf_glyphs
+ */
+bool al_prewarm_ttf_glyphs(ALLEGRO_FONT *font, int ranges_count,
+   const int *ranges)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   PREWARM_JOB *job;
+   FT_Open_Args args;
+   int i;
+   ASSERT(font);
+   ASSERT(ranges || ranges_count == 0);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return false;
+   }
+   data = font->data;
+
+   if (data->prewarm) {
+      ALLEGRO_WARN("Font is already being prewarmed.\n");
+      return false;
+   }
+
+   if (!data->file_mutex) {
+      data->file_mutex = al_create_mutex();
+      if (!data->file_mutex)
+         return false;
+   }
+
+   job = al_calloc(1, sizeof *job);
+   job->font = font;
+   job->es = &data->es;
+   job->ft_load_flags = get_load_flags(data);
+   job->sdf = data->flags & ALLEGRO_TTF_SDF;
+   job->ranges = al_malloc(2 * sizeof(int) * (ranges_count > 0 ? ranges_count : 1));
+   for (i = 0; i < ranges_count; i++) {
+      job->ranges[i * 2 + 0] = ranges[i * 2 + 0];
+      job->ranges[i * 2 + 1] = _ALLEGRO_MIN(ranges[i * 2 + 1], 0x10FFFF);
+   }
+   job->ranges_count = ranges_count;
+   _al_vector_init(&job->glyphs, sizeof(PREWARM_GLYPH));
+
+   if (FT_Init_FreeType(&job->library) != 0) {
+      ALLEGRO_ERROR("Unable to initialise FreeType for prewarming.\n");
+      goto error;
+   }
+   set_sdf_spread(job->library);
+
+   job->stream.read = ftread;
+   job->stream.pathname.pointer = data;
+   job->stream.size = data->stream.size;
+
+   memset(&args, 0, sizeof args);
+   args.flags = FT_OPEN_STREAM;
+   args.stream = &job->stream;
+
+   if (FT_Open_Face(job->library, &args, 0, &job->face) != 0) {
+      ALLEGRO_ERROR("Unable to open a second face for prewarming.\n");
+      goto error;
+   }
+   set_face_size(job->face, data->size_w, data->size_h);
+
+   job->mutex = al_create_mutex();
+   job->thread = al_create_thread(prewarm_thread, job);
+   if (!job->mutex || !job->thread) {
+      ALLEGRO_ERROR("Unable to create the prewarm thread.\n");
+      goto error;
+   }
+   /* Prewarming is background work, the render thread comes first. */
+   al_set_thread_name(job->thread, "al-ttf-prewarm");
+   al_set_thread_priority(job->thread, ALLEGRO_THREAD_PRIORITY_LOW);
+
+   data->prewarm = job;
+   al_start_thread(job->thread);
+   return true;
+
+error:
+   if (job->mutex)
+      al_destroy_mutex(job->mutex);
+   if (job->face)
+      FT_Done_Face(job->face);
+   if (job->library)
+      FT_Done_FreeType(job->library);
+   al_free(job->ranges);
+   al_free(job);
+   return false;
+}
+
+
+/* Function: al_get_ttf_font_event_source
+ */
+ALLEGRO_EVENT_SOURCE *al_get_ttf_font_event_source(ALLEGRO_FONT *font)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   ASSERT(font);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return NULL;
+   }
+   data = font->data;
+   return &data->es;
+}
+
+
+/* Function: al_set_ttf_cache_budget
+ */
+bool al_set_ttf_cache_budget(ALLEGRO_FONT *font, int64_t bytes)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   ASSERT(font);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return false;
+   }
+   data = font->data;
+
+   data->cache_budget = bytes > 0 ? bytes : 0;
+   unlock_current_page(data);
+   evict_pages(data, 0, 0);
+   return true;
+}
+
+
+static int compare_glyph_height(const void *a, const void *b)
+{
+   const int *ga = a;
+   const int *gb = b;
+   /* Tallest first, ties in glyph order. */
+   if (ga[1] != gb[1])
+      return gb[1] - ga[1];
+   return ga[0] - gb[0];
+}
+
+
+/* Function: al_compact_ttf_cache
+ */
+bool al_compact_ttf_cache(ALLEGRO_FONT *font)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   _AL_VECTOR keep;  /* of pairs of ft_index and height */
+   int64_t hits, misses;
+   int i, j;
+   ASSERT(font);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return false;
+   }
+   data = font->data;
+
+   if (data->prewarm)
+      flush_prewarm(data);
+   unlock_current_page(data);
+
+   /* Collect the glyphs used since the last compaction, or all cached
+    * glyphs if cache misses are skipped as those could never come back.
+    */
+   _al_vector_init(&keep, 2 * sizeof(int));
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         if (glyph->page_bitmap && (data->skip_cache_misses ||
+               glyph->last_use > data->compact_clock)) {
+            int *k = _al_vector_alloc_back(&keep);
+            k[0] = range->range_start + j;
+            k[1] = glyph->region.h;
+         }
+      }
+   }
+   if (!_al_vector_is_empty(&keep)) {
+      qsort(_al_vector_ref_front(&keep), _al_vector_size(&keep),
+         2 * sizeof(int), compare_glyph_height);
+   }
+
+   if (al_is_bitmap_drawing_held()) {
+      al_hold_bitmap_drawing(false);
+      al_hold_bitmap_drawing(true);
+   }
+
+   forget_page_glyphs(data, NULL);
+   for (i = _al_vector_size(&data->page_bitmaps) - 1; i >= 0; i--) {
+      ALLEGRO_BITMAP **bmp = _al_vector_ref(&data->page_bitmaps, i);
+      al_destroy_bitmap(*bmp);
+   }
+   _al_vector_free(&data->page_bitmaps);
+
+   /* Rasterizing again is simpler than reading back the pages, and the
+    * glyphs are packed tallest first, so the lines waste little space.
+    * The pages are sized for the median glyph, not the tallest one which
+    * comes first.
+    */
+   if (!_al_vector_is_empty(&keep)) {
+      int *k = _al_vector_ref(&keep, _al_vector_size(&keep) / 2);
+      data->repack_size = align4(k[1]);
+   }
+   hits = data->hits;
+   misses = data->misses;
+   for (i = 0; i < (int)_al_vector_size(&keep); i++) {
+      int *k = _al_vector_ref(&keep, i);
+      ALLEGRO_TTF_GLYPH_DATA *glyph;
+      get_glyph(data, k[0], &glyph);
+      cache_glyph(data, data->face, k[0], glyph, true);
+   }
+   unlock_current_page(data);
+   data->repack_size = 0;
+   data->hits = hits;
+   data->misses = misses;
+   data->compact_clock = data->use_clock;
+
+   ALLEGRO_DEBUG("Compacted cache to %d glyphs on %d pages.\n",
+      (int)_al_vector_size(&keep), (int)_al_vector_size(&data->page_bitmaps));
+   _al_vector_free(&keep);
+   return true;
+}
+
+
+/* Function: al_get_ttf_cache_stats
+ */
+bool al_get_ttf_cache_stats(ALLEGRO_FONT *font, ALLEGRO_TTF_CACHE_STATS *stats)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   int i, j;
+   ASSERT(font);
+   ASSERT(stats);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return false;
+   }
+   data = font->data;
+
+   memset(stats, 0, sizeof *stats);
+   stats->pages = _al_vector_size(&data->page_bitmaps);
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         if (range->glyphs[j].page_bitmap)
+            stats->glyphs++;
+      }
+   }
+   stats->memory = get_cache_memory(data);
+   stats->hits = data->hits;
+   stats->misses = data->misses;
+   stats->evictions = data->evictions;
+   return true;
+}
+
+
+/* Function: al_save_ttf_glyph_cache
+ */
+bool al_save_ttf_glyph_cache(ALLEGRO_FONT *font, const char *filename)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   ASSERT(font);
+   ASSERT(filename);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return false;
+   }
+   data = font->data;
+
+   if (data->prewarm)
+      flush_prewarm(data);
+   unlock_current_page(data);
+   return save_glyph_cache(data, filename);
 }
 
 
+/* Function: al_load_ttf_glyph_cache
+ */
+bool al_load_ttf_glyph_cache(ALLEGRO_FONT *font, const char *filename)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   ASSERT(font);
+   ASSERT(filename);
+
+   if (font->vtable != &vt) {
+      ALLEGRO_ERROR("Not a TTF font.\n");
+      return false;
+   }
+   data = font->data;
+
+   if (data->prewarm)
+      flush_prewarm(data);
+   unlock_current_page(data);
+   return load_glyph_cache(data, filename);
+}
+
 
 /* Function: al_init_ttf_addon
  */
@@ -1138,6 +3268,11 @@ bool al_init_ttf_addon(void)
    }
 
    FT_Init_FreeType(&ft);
+   set_sdf_spread(ft);
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+   if (!sdf_mutex)
+      sdf_mutex = al_create_mutex();
+#endif
    vt.font_height = ttf_font_height;
    vt.font_ascent = ttf_font_ascent;
    vt.font_descent = ttf_font_descent;
@@ -1151,6 +3286,9 @@ bool al_init_ttf_addon(void)
    vt.get_glyph_dimensions = ttf_get_glyph_dimensions;
    vt.get_glyph_advance = ttf_get_glyph_advance;
    vt.get_glyph = ttf_get_glyph;
+   vt.render_run = ttf_render_run;
+   vt.destroy_run = ttf_destroy_run;
+   vt.get_text_quads = ttf_get_text_quads;
 
    al_register_font_loader(".ttf", al_load_ttf_font);
 
@@ -1184,6 +3322,7 @@ void al_shutdown_ttf_addon(void)
 
    al_register_font_loader(".ttf", NULL);
 
+   shutdown_sdf_shaders();
    FT_Done_FreeType(ft);
 
    ttf_inited = false;
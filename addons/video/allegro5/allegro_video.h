@@ -74,6 +74,12 @@ ALLEGRO_VIDEO_FUNC(uint32_t, al_get_allegro_video_version, (void));
 ALLEGRO_VIDEO_FUNC(char const *, al_identify_video_f, (ALLEGRO_FILE *fp));
 ALLEGRO_VIDEO_FUNC(char const *, al_identify_video, (char const *filename));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_VIDEO_SRC)
+ALLEGRO_VIDEO_FUNC(bool, al_set_video_planar, (ALLEGRO_VIDEO *video, bool planar));
+ALLEGRO_VIDEO_FUNC(bool, al_get_video_frame_planes, (ALLEGRO_VIDEO *video, ALLEGRO_BITMAP *planes[3]));
+ALLEGRO_VIDEO_FUNC(uint64_t, al_get_video_dropped_frames, (ALLEGRO_VIDEO *video));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
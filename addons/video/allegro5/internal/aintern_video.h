@@ -6,6 +6,9 @@ typedef struct ALLEGRO_VIDEO_INTERFACE {
    bool (*set_video_playing)(ALLEGRO_VIDEO *video);
    bool (*seek_video)(ALLEGRO_VIDEO *video, double seek_to);
    bool (*update_video)(ALLEGRO_VIDEO *video);
+   /* Optional. */
+   bool (*set_video_planar)(ALLEGRO_VIDEO *video, bool planar);
+   bool (*get_video_planes)(ALLEGRO_VIDEO *video, ALLEGRO_BITMAP *planes[3]);
 } ALLEGRO_VIDEO_INTERFACE;
 
 struct ALLEGRO_VIDEO {
@@ -14,6 +17,7 @@ struct ALLEGRO_VIDEO {
    /* video */
    ALLEGRO_BITMAP *current_frame;
    double video_position;
+   uint64_t dropped_frames;
    double fps;
    float scaled_width;
    float scaled_height;
@@ -42,3 +46,16 @@ void _al_compute_scaled_dimensions(int frame_w, int frame_h, float aspect_ratio,
 
 ALLEGRO_VIDEO_INTERFACE *_al_video_ogv_vtable(void);
 bool _al_video_identify_ogv(ALLEGRO_FILE *f);
+
+/* Hardware decoding handlers, for the containers below. */
+ALLEGRO_VIDEO_INTERFACE *_al_video_gstreamer_vtable(void);
+ALLEGRO_VIDEO_INTERFACE *_al_video_mf_vtable(void);
+bool _al_video_identify_mp4(ALLEGRO_FILE *f);
+bool _al_video_identify_mkv(ALLEGRO_FILE *f);
+
+/* Converts a row of Y'CbCr pixels to RGBA, with one chroma sample per
+ * 1 << xshift pixels across. Picked by _al_ogv_init_ycbcr.
+ */
+extern void (*_al_ogv_ycbcr_row)(uint8_t *dst, const uint8_t *y,
+   const uint8_t *cb, const uint8_t *cr, int width, int xshift);
+void _al_ogv_init_ycbcr(void);
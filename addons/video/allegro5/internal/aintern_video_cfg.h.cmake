@@ -1 +1,3 @@
 #cmakedefine ALLEGRO_CFG_VIDEO_HAVE_OGV
+#cmakedefine ALLEGRO_CFG_VIDEO_HAVE_GSTREAMER
+#cmakedefine ALLEGRO_CFG_VIDEO_HAVE_MF
@@ -0,0 +1,585 @@
+/* GStreamer video backend
+ *
+ * Playback is left to a playbin pipeline, which picks the decoders with
+ * the highest rank for the streams in the file. Where the VA-API, VDPAU
+ * or NVDEC plugins are installed those are the hardware decoders, so that
+ * H.264, HEVC and VP9 are decoded on the GPU. Frames come out of an appsink
+ * as RGBA in step with the pipeline clock and are uploaded to the frame
+ * bitmap when asked for. Audio comes out of a second appsink and is fed to
+ * an Allegro audio stream, so it goes through the mixer like any other.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include "allegro5/allegro5.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/allegro_video.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_video.h"
+
+ALLEGRO_DEBUG_CHANNEL("video")
+
+
+static const int NUM_FRAGS    = 2;
+static const int FRAG_SAMPLES = 4096;
+static const int CHANNELS     = 2;
+static const int RGB_PIXEL_FORMAT = ALLEGRO_PIXEL_FORMAT_ABGR_8888;
+
+
+typedef struct GST_VIDEO GST_VIDEO;
+
+struct GST_VIDEO {
+   GstElement *playbin;
+   GstElement *video_sink;          /* owned by playbin */
+   GstElement *audio_sink;          /* owned by playbin */
+   bool has_audio;
+
+   ALLEGRO_MUTEX *mutex;
+   GstSample *sample;               /* Newest frame, not uploaded yet. */
+   ALLEGRO_BITMAP *frame_bmp;
+   ALLEGRO_BITMAP *pic_bmp;         /* frame_bmp, or subbitmap thereof */
+
+   ALLEGRO_THREAD *audio_thread;
+};
+
+
+static bool init_gstreamer(void)
+{
+   GError *error = NULL;
+
+   if (gst_is_initialized())
+      return true;
+
+   if (!gst_init_check(NULL, NULL, &error)) {
+      ALLEGRO_ERROR("Could not initialise GStreamer: %s\n",
+         error ? error->message : "unknown error");
+      g_clear_error(&error);
+      return false;
+   }
+   return true;
+}
+
+static GstElement *create_app_sink(const char *caps_string, bool sync)
+{
+   GstElement *sink = gst_element_factory_make("appsink", NULL);
+   GstCaps *caps;
+
+   if (!sink)
+      return NULL;
+
+   caps = gst_caps_from_string(caps_string);
+   g_object_set(sink,
+      "caps", caps,
+      "sync", sync,
+      "max-buffers", 2,
+      NULL);
+   gst_caps_unref(caps);
+
+   return sink;
+}
+
+
+/* Video frames. */
+
+static GstFlowReturn new_video_sample(GstAppSink *sink, gpointer data)
+{
+   ALLEGRO_VIDEO *video = data;
+   GST_VIDEO *gv = video->data;
+   GstSample *sample;
+   GstBuffer *buffer;
+   ALLEGRO_EVENT event;
+
+   sample = gst_app_sink_pull_sample(sink);
+   if (!sample)
+      return GST_FLOW_OK;
+
+   al_lock_mutex(gv->mutex);
+
+   if (gv->sample) {
+      /* The previous frame was never asked for. */
+      gst_sample_unref(gv->sample);
+      video->dropped_frames++;
+   }
+   gv->sample = sample;
+
+   buffer = gst_sample_get_buffer(sample);
+   if (buffer && GST_BUFFER_PTS_IS_VALID(buffer)) {
+      video->video_position = (double)GST_BUFFER_PTS(buffer) / GST_SECOND;
+   }
+
+   event.type = ALLEGRO_EVENT_VIDEO_FRAME_SHOW;
+   event.user.data1 = (intptr_t)video;
+   al_emit_user_event(&video->es, &event, NULL);
+
+   al_unlock_mutex(gv->mutex);
+
+   return GST_FLOW_OK;
+}
+
+static void video_eos(GstAppSink *sink, gpointer data)
+{
+   ALLEGRO_VIDEO *video = data;
+   ALLEGRO_EVENT event;
+   (void)sink;
+
+   video->playing = false;
+
+   event.type = ALLEGRO_EVENT_VIDEO_FINISHED;
+   event.user.data1 = (intptr_t)video;
+   al_emit_user_event(&video->es, &event, NULL);
+}
+
+/* Copies a frame into frame_bmp. Frames of a different size than the
+ * first one are skipped.
+ */
+static bool upload_sample(GST_VIDEO *gv, GstSample *sample)
+{
+   GstVideoInfo info;
+   GstVideoFrame frame;
+   ALLEGRO_LOCKED_REGION *lr;
+   const unsigned char *src;
+   int stride;
+   int w, h, y;
+
+   if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample)))
+      return false;
+
+   w = GST_VIDEO_INFO_WIDTH(&info);
+   h = GST_VIDEO_INFO_HEIGHT(&info);
+   if (w != al_get_bitmap_width(gv->frame_bmp) ||
+       h != al_get_bitmap_height(gv->frame_bmp)) {
+      ALLEGRO_WARN("Skipping %dx%d frame.\n", w, h);
+      return false;
+   }
+
+   if (!gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample),
+         GST_MAP_READ)) {
+      ALLEGRO_ERROR("Failed to map frame.\n");
+      return false;
+   }
+
+   lr = al_lock_bitmap(gv->frame_bmp, RGB_PIXEL_FORMAT,
+      ALLEGRO_LOCK_WRITEONLY);
+   if (lr) {
+      src = GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+      stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+      for (y = 0; y < h; y++) {
+         memcpy((unsigned char*)lr->data + y * lr->pitch, src + y * stride,
+            w * 4);
+      }
+      al_unlock_bitmap(gv->frame_bmp);
+   }
+   else {
+      ALLEGRO_ERROR("Failed to lock bitmap.\n");
+   }
+
+   gst_video_frame_unmap(&frame);
+   return lr != NULL;
+}
+
+/* Sets up the frame bitmap and the video properties from the first
+ * frame, which the pipeline has decoded by the time it is paused.
+ */
+static bool setup_frame(ALLEGRO_VIDEO *video, GST_VIDEO *gv)
+{
+   GstSample *sample;
+   GstVideoInfo info;
+   GstVideoCropMeta *crop = NULL;
+   int w, h;
+   int pic_x = 0, pic_y = 0, pic_w, pic_h;
+   float aspect_ratio;
+
+   sample = gst_app_sink_pull_preroll(GST_APP_SINK(gv->video_sink));
+   if (!sample)
+      return false;
+
+   if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample))) {
+      gst_sample_unref(sample);
+      return false;
+   }
+
+   w = pic_w = GST_VIDEO_INFO_WIDTH(&info);
+   h = pic_h = GST_VIDEO_INFO_HEIGHT(&info);
+   if (gst_sample_get_buffer(sample))
+      crop = gst_buffer_get_video_crop_meta(gst_sample_get_buffer(sample));
+   if (crop && crop->width > 0 && crop->height > 0 &&
+         crop->x + crop->width <= (unsigned)w &&
+         crop->y + crop->height <= (unsigned)h) {
+      pic_x = crop->x;
+      pic_y = crop->y;
+      pic_w = crop->width;
+      pic_h = crop->height;
+   }
+
+   gv->frame_bmp = al_create_bitmap(w, h);
+   if (!gv->frame_bmp) {
+      gst_sample_unref(sample);
+      return false;
+   }
+   if (pic_w == w && pic_h == h) {
+      gv->pic_bmp = gv->frame_bmp;
+   }
+   else {
+      gv->pic_bmp = al_create_sub_bitmap(gv->frame_bmp,
+         pic_x, pic_y, pic_w, pic_h);
+   }
+
+   /* The preroll frame is the first one shown. */
+   gv->sample = sample;
+
+   if (GST_VIDEO_INFO_FPS_D(&info) != 0) {
+      video->fps = (double)GST_VIDEO_INFO_FPS_N(&info) /
+         (double)GST_VIDEO_INFO_FPS_D(&info);
+   }
+
+   aspect_ratio = (double)(pic_w * GST_VIDEO_INFO_PAR_N(&info)) /
+      (double)(pic_h * GST_VIDEO_INFO_PAR_D(&info));
+   _al_compute_scaled_dimensions(pic_w, pic_h, aspect_ratio,
+      &video->scaled_width, &video->scaled_height);
+
+   ALLEGRO_INFO("Frame size: %dx%d\n", w, h);
+   ALLEGRO_INFO("Picture size: %dx%d\n", pic_w, pic_h);
+   ALLEGRO_INFO("FPS: %f\n", video->fps);
+   return true;
+}
+
+
+/* Audio. */
+
+static bool setup_audio(ALLEGRO_VIDEO *video, GST_VIDEO *gv)
+{
+   GstSample *sample;
+   GstStructure *structure;
+   int rate = 0;
+
+   sample = gst_app_sink_pull_preroll(GST_APP_SINK(gv->audio_sink));
+   if (!sample)
+      return false;
+
+   structure = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+   gst_structure_get_int(structure, "rate", &rate);
+   gst_sample_unref(sample);
+
+   if (rate <= 0)
+      return false;
+
+   video->audio_rate = rate;
+   ALLEGRO_INFO("Audio rate: %f\n", video->audio_rate);
+   return true;
+}
+
+static ALLEGRO_AUDIO_STREAM *create_audio_stream(const ALLEGRO_VIDEO *video)
+{
+   ALLEGRO_AUDIO_STREAM *audio;
+   bool rc;
+
+   audio = al_create_audio_stream(NUM_FRAGS, FRAG_SAMPLES,
+      video->audio_rate, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+   if (!audio) {
+      ALLEGRO_ERROR("Could not create audio stream.\n");
+      return NULL;
+   }
+
+   if (video->mixer) {
+      rc = al_attach_audio_stream_to_mixer(audio, video->mixer);
+   }
+   else if (video->voice) {
+      rc = al_attach_audio_stream_to_voice(audio, video->voice);
+   }
+   else {
+      rc = al_attach_audio_stream_to_mixer(audio, al_get_default_mixer());
+   }
+
+   if (!rc) {
+      ALLEGRO_ERROR("Could not attach audio stream.\n");
+      al_destroy_audio_stream(audio);
+      return NULL;
+   }
+
+   return audio;
+}
+
+/* Fills audio stream fragments from the audio sink. The sink does not
+ * sync to the clock, so the audio stream sets the pace of the audio.
+ */
+static void *audio_thread_func(ALLEGRO_THREAD *thread, void *_video)
+{
+   ALLEGRO_VIDEO * const video = _video;
+   GST_VIDEO * const gv = video->data;
+   GstAppSink * const sink = GST_APP_SINK(gv->audio_sink);
+   const size_t frag_bytes = FRAG_SAMPLES * CHANNELS * sizeof(float);
+   ALLEGRO_EVENT_QUEUE *queue;
+   GstBuffer *buffer = NULL;
+   GstMapInfo map;
+   size_t used = 0;
+
+   queue = al_create_event_queue();
+   al_register_event_source(queue,
+      al_get_audio_stream_event_source(video->audio));
+
+   while (!al_get_thread_should_stop(thread)) {
+      ALLEGRO_EVENT ev;
+      unsigned char *frag;
+      size_t pos = 0;
+
+      if (!al_wait_for_event_timed(queue, &ev, 0.1))
+         continue;
+
+      frag = al_get_audio_stream_fragment(video->audio);
+      if (!frag)
+         continue;
+
+      while (pos < frag_bytes && video->playing) {
+         size_t n;
+
+         if (!buffer) {
+            GstSample *sample = gst_app_sink_try_pull_sample(sink,
+               10 * GST_MSECOND);
+            if (!sample)
+               break;
+            buffer = gst_buffer_ref(gst_sample_get_buffer(sample));
+            gst_sample_unref(sample);
+            if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+               gst_buffer_unref(buffer);
+               buffer = NULL;
+               continue;
+            }
+            used = 0;
+         }
+
+         n = _ALLEGRO_MIN(frag_bytes - pos, map.size - used);
+         memcpy(frag + pos, map.data + used, n);
+         pos += n;
+         used += n;
+
+         if (used == map.size) {
+            gst_buffer_unmap(buffer, &map);
+            gst_buffer_unref(buffer);
+            buffer = NULL;
+         }
+      }
+
+      if (pos < frag_bytes) {
+         memset(frag + pos, 0, frag_bytes - pos);
+      }
+      al_set_audio_stream_fragment(video->audio, frag);
+
+      if (video->playing) {
+         video->audio_position += (double)FRAG_SAMPLES / video->audio_rate;
+      }
+   }
+
+   if (buffer) {
+      gst_buffer_unmap(buffer, &map);
+      gst_buffer_unref(buffer);
+   }
+   al_destroy_event_queue(queue);
+
+   return NULL;
+}
+
+
+/* Video interface. */
+
+static bool gstreamer_close_video(ALLEGRO_VIDEO *video);
+
+static bool gstreamer_open_video(ALLEGRO_VIDEO *video)
+{
+   const char *filename;
+   GstAppSinkCallbacks callbacks;
+   GstStateChangeReturn ret;
+   GST_VIDEO *gv;
+   gchar *uri;
+   gint n_video = 0;
+   gint n_audio = 0;
+
+   if (!init_gstreamer())
+      return false;
+
+   filename = al_path_cstr(video->filename, ALLEGRO_NATIVE_PATH_SEP);
+   uri = gst_filename_to_uri(filename, NULL);
+   if (!uri)
+      return false;
+
+   gv = al_calloc(1, sizeof(GST_VIDEO));
+   if (!gv) {
+      ALLEGRO_ERROR("Out of memory.\n");
+      g_free(uri);
+      return false;
+   }
+   video->data = gv;
+
+   gv->mutex = al_create_mutex();
+   gv->playbin = gst_element_factory_make("playbin", NULL);
+   gv->video_sink = create_app_sink("video/x-raw,format=RGBA", true);
+   gv->audio_sink = create_app_sink(
+      "audio/x-raw,format=F32LE,layout=interleaved,channels=2", false);
+   if (!gv->playbin || !gv->video_sink || !gv->audio_sink) {
+      ALLEGRO_ERROR("Could not create playbin.\n");
+      if (gv->video_sink)
+         gst_object_unref(gst_object_ref_sink(gv->video_sink));
+      if (gv->audio_sink)
+         gst_object_unref(gst_object_ref_sink(gv->audio_sink));
+      gv->video_sink = gv->audio_sink = NULL;
+      g_free(uri);
+      gstreamer_close_video(video);
+      return false;
+   }
+
+   g_object_set(gv->playbin,
+      "uri", uri,
+      "video-sink", gv->video_sink,
+      "audio-sink", gv->audio_sink,
+      NULL);
+   g_free(uri);
+
+   memset(&callbacks, 0, sizeof(callbacks));
+   callbacks.eos = video_eos;
+   callbacks.new_sample = new_video_sample;
+   gst_app_sink_set_callbacks(GST_APP_SINK(gv->video_sink), &callbacks,
+      video, NULL);
+
+   /* Pausing makes the pipeline decode the first frame. */
+   gst_element_set_state(gv->playbin, GST_STATE_PAUSED);
+   ret = gst_element_get_state(gv->playbin, NULL, NULL, 10 * GST_SECOND);
+   if (ret != GST_STATE_CHANGE_SUCCESS &&
+       ret != GST_STATE_CHANGE_NO_PREROLL) {
+      ALLEGRO_WARN("Could not play %s.\n", filename);
+      gstreamer_close_video(video);
+      return false;
+   }
+
+   g_object_get(gv->playbin, "n-video", &n_video, "n-audio", &n_audio, NULL);
+   if (n_video == 0 || !setup_frame(video, gv)) {
+      ALLEGRO_WARN("No video stream in %s.\n", filename);
+      gstreamer_close_video(video);
+      return false;
+   }
+   gv->has_audio = n_audio > 0 && setup_audio(video, gv);
+
+   return true;
+}
+
+static bool gstreamer_close_video(ALLEGRO_VIDEO *video)
+{
+   GST_VIDEO *gv = video->data;
+
+   if (gv) {
+      if (gv->audio_thread) {
+         al_join_thread(gv->audio_thread, NULL);
+         al_destroy_thread(gv->audio_thread);
+      }
+      if (gv->playbin) {
+         gst_element_set_state(gv->playbin, GST_STATE_NULL);
+         gst_object_unref(gv->playbin);
+      }
+      if (video->audio) {
+         al_destroy_audio_stream(video->audio);
+         video->audio = NULL;
+      }
+      if (gv->sample) {
+         gst_sample_unref(gv->sample);
+      }
+      if (gv->pic_bmp != gv->frame_bmp) {
+         al_destroy_bitmap(gv->pic_bmp);
+      }
+      al_destroy_bitmap(gv->frame_bmp);
+      if (gv->mutex) {
+         al_destroy_mutex(gv->mutex);
+      }
+      al_free(gv);
+   }
+
+   video->data = NULL;
+
+   return true;
+}
+
+static bool gstreamer_start_video(ALLEGRO_VIDEO *video)
+{
+   GST_VIDEO *gv = video->data;
+
+   if (gv->has_audio && !video->audio) {
+      video->audio = create_audio_stream(video);
+      if (video->audio) {
+         gv->audio_thread = al_create_thread(audio_thread_func, video);
+         al_set_thread_name(gv->audio_thread, "al-video-audio");
+         al_start_thread(gv->audio_thread);
+      }
+   }
+
+   gst_element_set_state(gv->playbin,
+      video->playing ? GST_STATE_PLAYING : GST_STATE_PAUSED);
+   return true;
+}
+
+static bool gstreamer_set_video_playing(ALLEGRO_VIDEO *video)
+{
+   GST_VIDEO *gv = video->data;
+
+   gst_element_set_state(gv->playbin,
+      video->playing ? GST_STATE_PLAYING : GST_STATE_PAUSED);
+   return true;
+}
+
+static bool gstreamer_seek_video(ALLEGRO_VIDEO *video, double seek_to)
+{
+   GST_VIDEO *gv = video->data;
+
+   if (!gst_element_seek_simple(gv->playbin, GST_FORMAT_TIME,
+         GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
+         (gint64)(seek_to * GST_SECOND))) {
+      return false;
+   }
+
+   video->position = seek_to;
+   video->audio_position = seek_to;
+   return true;
+}
+
+static bool gstreamer_update_video(ALLEGRO_VIDEO *video)
+{
+   GST_VIDEO *gv = video->data;
+   GstSample *sample;
+   gint64 position;
+   bool ret = true;
+
+   if (gst_element_query_position(gv->playbin, GST_FORMAT_TIME, &position)) {
+      video->position = (double)position / GST_SECOND;
+   }
+
+   al_lock_mutex(gv->mutex);
+   sample = gv->sample;
+   gv->sample = NULL;
+   al_unlock_mutex(gv->mutex);
+
+   if (sample) {
+      ret = upload_sample(gv, sample);
+      gst_sample_unref(sample);
+   }
+
+   video->current_frame = gv->pic_bmp;
+   return ret;
+}
+
+static ALLEGRO_VIDEO_INTERFACE gstreamer_vtable = {
+   gstreamer_open_video,
+   gstreamer_close_video,
+   gstreamer_start_video,
+   gstreamer_set_video_playing,
+   gstreamer_seek_video,
+   gstreamer_update_video,
+   NULL,
+   NULL,
+};
+
+ALLEGRO_VIDEO_INTERFACE *_al_video_gstreamer_vtable(void)
+{
+   return &gstreamer_vtable;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,27 @@
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_video.h"
+#include "allegro5/internal/aintern_video.h"
+
+/* ISO base media files (MP4, MOV) start with an "ftyp" box. */
+bool _al_video_identify_mp4(ALLEGRO_FILE *f)
+{
+   uint8_t x[8];
+   if (al_fread(f, x, 8) < 8)
+      return false;
+   if (memcmp(x + 4, "ftyp", 4) != 0)
+      return false;
+   return true;
+}
+
+/* Matroska and WebM files start with an EBML header. */
+bool _al_video_identify_mkv(ALLEGRO_FILE *f)
+{
+   uint8_t x[4];
+   if (al_fread(f, x, 4) < 4)
+      return false;
+   if (memcmp(x, "\x1a\x45\xdf\xa3", 4) != 0)
+      return false;
+   return true;
+}
+
+/* vim: set sts=3 sw=3 et: */
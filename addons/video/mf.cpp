@@ -0,0 +1,974 @@
+/* Media Foundation video backend
+ *
+ * Files are read with an IMFSourceReader, which picks the decoder MFTs
+ * registered for the streams in the file. Given a Direct3D 11 device
+ * manager the H.264, HEVC and VP9 decoders use DXVA, so decoding is done on
+ * the GPU; the reader's video processor then converts the frames to RGB32.
+ * Without one (Windows 7, or no suitable adapter) the reader falls back to
+ * software decoders.
+ *
+ * The source reader is only ever touched from the decode thread, which
+ * also initialises COM and Media Foundation for itself.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0602
+#endif
+
+#ifndef WINVER
+#define WINVER 0x0602
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+#include <d3d10.h>
+#include <d3d11.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/allegro_video.h"
+
+extern "C" {
+
+ALLEGRO_DEBUG_CHANNEL("video")
+
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_video.h"
+#include "allegro5/internal/aintern_wunicode.h"
+
+/* Missing from older MinGW headers. */
+#ifndef MF_SOURCE_READER_ENABLE_ADVANCED_VIDEO_PROCESSING
+static const GUID MF_SOURCE_READER_ENABLE_ADVANCED_VIDEO_PROCESSING = { 0x0f81da2c, 0xb537, 0x4672, { 0xa8, 0xb2, 0xa6, 0x81, 0xb1, 0x73, 0x07, 0xa3 } };
+#endif
+
+typedef HRESULT (WINAPI *MF_CREATE_DXGI_DEVICE_MANAGER)(UINT *,
+   IMFDXGIDeviceManager **);
+
+#define VIDEO_STREAM ((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM)
+#define AUDIO_STREAM ((DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM)
+
+#define MF_EVENT_START  ALLEGRO_GET_EVENT_TYPE('M', 'F', 'S', 'T')
+#define MF_EVENT_QUIT   ALLEGRO_GET_EVENT_TYPE('M', 'F', 'Q', 'U')
+
+static const int NUM_FRAGS    = 2;
+static const int FRAG_SAMPLES = 4096;
+static const double UNITS_PER_SECOND = 1.0e7;
+
+
+typedef enum MF_STATUS {
+   MF_STATUS_INIT,
+   MF_STATUS_READY,
+   MF_STATUS_FAILED
+} MF_STATUS;
+
+typedef struct MF_VIDEO MF_VIDEO;
+
+struct MF_VIDEO {
+   ALLEGRO_MUTEX *mutex;
+   ALLEGRO_COND *cond;
+   MF_STATUS status;
+   int seek_counter;
+
+   /* Set up by the decode thread before status becomes MF_STATUS_READY. */
+   int width;
+   int height;
+   int pic_x, pic_y, pic_w, pic_h;
+   bool has_audio;
+   int channels;
+
+   /* The current frame in XRGB_8888, uploaded by the update method. */
+   unsigned char *pixels;
+   bool have_frame;
+   bool frame_stale;
+   ALLEGRO_BITMAP *frame_bmp;
+   ALLEGRO_BITMAP *pic_bmp;
+
+   ALLEGRO_THREAD *thread;
+   ALLEGRO_EVENT_QUEUE *queue;
+   ALLEGRO_EVENT_SOURCE evtsrc;
+
+   /* Decode thread only. */
+   ID3D11Device *device;
+   IMFDXGIDeviceManager *manager;
+   IMFSourceReader *reader;
+   LONG stride;
+   double frame_duration;
+   IMFSample *next_sample;
+   LONGLONG next_time;
+   bool video_eof;
+   bool audio_eof;
+   LONGLONG skip_until;
+   float *audio_data;
+   size_t audio_size;
+   size_t audio_len;
+   size_t audio_pos;
+};
+
+
+/* Setup. */
+
+static void release_reader(MF_VIDEO *mv)
+{
+   if (mv->next_sample) {
+      mv->next_sample->Release();
+      mv->next_sample = NULL;
+   }
+   if (mv->reader) {
+      mv->reader->Release();
+      mv->reader = NULL;
+   }
+   if (mv->manager) {
+      mv->manager->Release();
+      mv->manager = NULL;
+   }
+   if (mv->device) {
+      mv->device->Release();
+      mv->device = NULL;
+   }
+}
+
+/* Creates a Direct3D 11 device for the decoders to use. This needs
+ * Windows 8 for MFCreateDXGIDeviceManager and video support in the driver.
+ */
+static bool create_device_manager(MF_VIDEO *mv)
+{
+   MF_CREATE_DXGI_DEVICE_MANAGER create_manager;
+   ID3D10Multithread *multithread;
+   UINT token;
+   HRESULT hr;
+
+   create_manager = (MF_CREATE_DXGI_DEVICE_MANAGER)GetProcAddress(
+      GetModuleHandleW(L"mfplat.dll"), "MFCreateDXGIDeviceManager");
+   if (!create_manager) {
+      ALLEGRO_INFO("MFCreateDXGIDeviceManager not available.\n");
+      return false;
+   }
+
+   hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL,
+      D3D11_CREATE_DEVICE_VIDEO_SUPPORT | D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+      NULL, 0, D3D11_SDK_VERSION, &mv->device, NULL, NULL);
+   if (FAILED(hr)) {
+      ALLEGRO_INFO("D3D11CreateDevice failed: 0x%08lx\n", (unsigned long)hr);
+      return false;
+   }
+
+   /* The decoders call into the device from their own threads. */
+   hr = mv->device->QueryInterface(__uuidof(ID3D10Multithread),
+      (void **)&multithread);
+   if (SUCCEEDED(hr)) {
+      multithread->SetMultithreadProtected(TRUE);
+      multithread->Release();
+   }
+
+   hr = create_manager(&token, &mv->manager);
+   if (SUCCEEDED(hr))
+      hr = mv->manager->ResetDevice(mv->device, token);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("Setting up the device manager failed: 0x%08lx\n",
+         (unsigned long)hr);
+      release_reader(mv);
+      return false;
+   }
+
+   return true;
+}
+
+static bool create_reader(MF_VIDEO *mv, const char *filename, bool hardware)
+{
+   IMFAttributes *attr;
+   wchar_t *wfilename;
+   HRESULT hr;
+
+   hr = MFCreateAttributes(&attr, 3);
+   if (FAILED(hr))
+      return false;
+
+   if (hardware && create_device_manager(mv)) {
+      attr->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+      attr->SetUnknown(MF_SOURCE_READER_D3D_MANAGER, mv->manager);
+      attr->SetUINT32(MF_SOURCE_READER_ENABLE_ADVANCED_VIDEO_PROCESSING, TRUE);
+   }
+   else {
+      attr->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
+   }
+
+   wfilename = _al_win_utf8_to_utf16(filename);
+   hr = wfilename ? MFCreateSourceReaderFromURL(wfilename, attr, &mv->reader)
+      : E_OUTOFMEMORY;
+   al_free(wfilename);
+   attr->Release();
+
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("MFCreateSourceReaderFromURL failed: 0x%08lx\n",
+         (unsigned long)hr);
+      release_reader(mv);
+      return false;
+   }
+
+   return true;
+}
+
+/* Reads the frame geometry of the current RGB32 output type. */
+static bool read_video_format(ALLEGRO_VIDEO *video, MF_VIDEO *mv)
+{
+   IMFMediaType *type;
+   UINT32 w, h, stride;
+   UINT32 num, den;
+   UINT32 par_num = 1, par_den = 1;
+   MFVideoArea area;
+   HRESULT hr;
+
+   hr = mv->reader->GetCurrentMediaType(VIDEO_STREAM, &type);
+   if (FAILED(hr))
+      return false;
+
+   hr = MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &w, &h);
+   if (FAILED(hr) || w == 0 || h == 0) {
+      type->Release();
+      return false;
+   }
+   mv->width = w;
+   mv->height = h;
+
+   if (FAILED(type->GetUINT32(MF_MT_DEFAULT_STRIDE, &stride)))
+      stride = w * 4;
+   mv->stride = (LONG)stride;
+
+   if (SUCCEEDED(MFGetAttributeRatio(type, MF_MT_FRAME_RATE, &num, &den)) &&
+         num > 0 && den > 0) {
+      video->fps = (double)num / den;
+   }
+   else {
+      video->fps = 30.0;
+   }
+   mv->frame_duration = 1.0 / video->fps;
+
+   MFGetAttributeRatio(type, MF_MT_PIXEL_ASPECT_RATIO, &par_num, &par_den);
+   if (par_num == 0 || par_den == 0)
+      par_num = par_den = 1;
+
+   mv->pic_x = mv->pic_y = 0;
+   mv->pic_w = w;
+   mv->pic_h = h;
+   hr = type->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE, (UINT8 *)&area,
+      sizeof(area), NULL);
+   if (SUCCEEDED(hr) && area.Area.cx > 0 && area.Area.cy > 0 &&
+         area.OffsetX.value + area.Area.cx <= (LONG)w &&
+         area.OffsetY.value + area.Area.cy <= (LONG)h) {
+      mv->pic_x = area.OffsetX.value;
+      mv->pic_y = area.OffsetY.value;
+      mv->pic_w = area.Area.cx;
+      mv->pic_h = area.Area.cy;
+   }
+
+   _al_compute_scaled_dimensions(mv->pic_w, mv->pic_h,
+      (double)(mv->pic_w * par_num) / (mv->pic_h * par_den),
+      &video->scaled_width, &video->scaled_height);
+
+   type->Release();
+   return true;
+}
+
+static bool set_video_type(ALLEGRO_VIDEO *video, MF_VIDEO *mv)
+{
+   IMFMediaType *type;
+   HRESULT hr;
+
+   hr = MFCreateMediaType(&type);
+   if (FAILED(hr))
+      return false;
+   type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+   type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
+   hr = mv->reader->SetCurrentMediaType(VIDEO_STREAM, NULL, type);
+   type->Release();
+
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("No RGB32 video output: 0x%08lx\n", (unsigned long)hr);
+      return false;
+   }
+
+   return read_video_format(video, mv);
+}
+
+/* Asks for interleaved float samples, as stereo if the decoder can mix
+ * down to it.
+ */
+static bool set_audio_type(ALLEGRO_VIDEO *video, MF_VIDEO *mv)
+{
+   IMFMediaType *type;
+   UINT32 channels, rate;
+   HRESULT hr;
+   int i;
+
+   for (i = 0; i < 2; i++) {
+      hr = MFCreateMediaType(&type);
+      if (FAILED(hr))
+         return false;
+      type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+      type->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float);
+      if (i == 0)
+         type->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, 2);
+      hr = mv->reader->SetCurrentMediaType(AUDIO_STREAM, NULL, type);
+      type->Release();
+      if (SUCCEEDED(hr))
+         break;
+   }
+   if (FAILED(hr))
+      return false;
+
+   hr = mv->reader->GetCurrentMediaType(AUDIO_STREAM, &type);
+   if (FAILED(hr))
+      return false;
+   channels = MFGetAttributeUINT32(type, MF_MT_AUDIO_NUM_CHANNELS, 0);
+   rate = MFGetAttributeUINT32(type, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
+   type->Release();
+
+   if (rate == 0 || channels < 1 || channels > 2) {
+      ALLEGRO_WARN("Unsupported audio format: %u channels at %u Hz.\n",
+         channels, rate);
+      return false;
+   }
+
+   mv->channels = channels;
+   video->audio_rate = rate;
+   return true;
+}
+
+static bool open_reader(ALLEGRO_VIDEO *video, MF_VIDEO *mv, bool hardware)
+{
+   const char *filename = al_path_cstr(video->filename, ALLEGRO_NATIVE_PATH_SEP);
+
+   if (!create_reader(mv, filename, hardware))
+      return false;
+
+   mv->reader->SetStreamSelection((DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE);
+
+   if (FAILED(mv->reader->SetStreamSelection(VIDEO_STREAM, TRUE)) ||
+         !set_video_type(video, mv)) {
+      release_reader(mv);
+      return false;
+   }
+
+   mv->has_audio = SUCCEEDED(mv->reader->SetStreamSelection(AUDIO_STREAM,
+      TRUE)) && set_audio_type(video, mv);
+   if (!mv->has_audio) {
+      /* Otherwise the reader queues up the audio we never read. */
+      mv->reader->SetStreamSelection(AUDIO_STREAM, FALSE);
+   }
+
+   ALLEGRO_INFO("Opened %s with %s decoding.\n", filename,
+      mv->manager ? "hardware" : "software");
+   return true;
+}
+
+
+/* Video frames. */
+
+static void copy_rows(MF_VIDEO *mv, const BYTE *scan0, LONG pitch)
+{
+   int y;
+
+   for (y = 0; y < mv->height; y++) {
+      memcpy(mv->pixels + y * mv->width * 4, scan0 + y * pitch,
+         mv->width * 4);
+   }
+}
+
+static void copy_sample(MF_VIDEO *mv, IMFSample *sample)
+{
+   IMFMediaBuffer *buffer;
+   IMF2DBuffer *buffer2d;
+   BYTE *data;
+   LONG pitch;
+   DWORD len;
+
+   if (FAILED(sample->ConvertToContiguousBuffer(&buffer)))
+      return;
+
+   al_lock_mutex(mv->mutex);
+
+   if (SUCCEEDED(buffer->QueryInterface(__uuidof(IMF2DBuffer),
+         (void **)&buffer2d))) {
+      if (SUCCEEDED(buffer2d->Lock2D(&data, &pitch))) {
+         copy_rows(mv, data, pitch);
+         mv->frame_stale = true;
+         buffer2d->Unlock2D();
+      }
+      buffer2d->Release();
+   }
+   else if (SUCCEEDED(buffer->Lock(&data, NULL, &len))) {
+      /* A negative stride means the image is stored bottom-up. */
+      pitch = mv->stride;
+      if (len >= (DWORD)(abs(pitch) * mv->height)) {
+         if (pitch < 0)
+            data += (mv->height - 1) * -pitch;
+         copy_rows(mv, data, pitch);
+         mv->frame_stale = true;
+      }
+      buffer->Unlock();
+   }
+
+   if (mv->frame_stale)
+      mv->have_frame = true;
+
+   al_unlock_mutex(mv->mutex);
+
+   buffer->Release();
+}
+
+/* Reads the next video sample into next_sample. Returns false at the end
+ * of the stream.
+ */
+static bool read_video_sample(MF_VIDEO *mv)
+{
+   IMFSample *sample = NULL;
+   DWORD flags = 0;
+   LONGLONG time;
+   HRESULT hr;
+
+   hr = mv->reader->ReadSample(VIDEO_STREAM, 0, NULL, &flags, &time, &sample);
+   if (FAILED(hr) || (flags & (MF_SOURCE_READERF_ENDOFSTREAM |
+         MF_SOURCE_READERF_ERROR))) {
+      if (FAILED(hr))
+         ALLEGRO_ERROR("ReadSample failed: 0x%08lx\n", (unsigned long)hr);
+      if (sample)
+         sample->Release();
+      mv->video_eof = true;
+      return false;
+   }
+
+   if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
+      IMFMediaType *type;
+      UINT32 w, h, stride;
+
+      if (SUCCEEDED(mv->reader->GetCurrentMediaType(VIDEO_STREAM, &type))) {
+         if (SUCCEEDED(MFGetAttributeSize(type, MF_MT_FRAME_SIZE, &w, &h)) &&
+               ((int)w != mv->width || (int)h != mv->height)) {
+            /* The bitmaps were made for the first size. */
+            ALLEGRO_ERROR("Frame size changed to %ux%u.\n", w, h);
+            type->Release();
+            if (sample)
+               sample->Release();
+            mv->video_eof = true;
+            return false;
+         }
+         if (SUCCEEDED(type->GetUINT32(MF_MT_DEFAULT_STRIDE, &stride)))
+            mv->stride = (LONG)stride;
+         type->Release();
+      }
+   }
+
+   if (sample) {
+      mv->next_sample = sample;
+      mv->next_time = time;
+   }
+   return true;
+}
+
+/* Shows the latest frame that is due at the current position. Frames that
+ * were due but never shown are dropped, except while catching up after a
+ * seek.
+ */
+static void show_due_frame(ALLEGRO_VIDEO *video, MF_VIDEO *mv)
+{
+   const LONGLONG now = (LONGLONG)((video->position - 0.5 * mv->frame_duration)
+      * UNITS_PER_SECOND);
+   IMFSample *due = NULL;
+   LONGLONG due_time = 0;
+   ALLEGRO_EVENT event;
+
+   while (!mv->next_sample || mv->next_time <= now) {
+      if (!mv->next_sample) {
+         if (mv->video_eof || !read_video_sample(mv))
+            break;
+         continue;
+      }
+      if (due) {
+         if (due_time >= mv->skip_until)
+            video->dropped_frames++;
+         due->Release();
+      }
+      due = mv->next_sample;
+      due_time = mv->next_time;
+      mv->next_sample = NULL;
+   }
+
+   if (!due)
+      return;
+
+   copy_sample(mv, due);
+   due->Release();
+   video->video_position = due_time / UNITS_PER_SECOND;
+
+   event.type = ALLEGRO_EVENT_VIDEO_FRAME_SHOW;
+   event.user.data1 = (intptr_t)video;
+   al_emit_user_event(&video->es, &event, NULL);
+}
+
+static bool is_finished(MF_VIDEO *mv)
+{
+   return mv->video_eof && !mv->next_sample;
+}
+
+
+/* Audio. */
+
+static ALLEGRO_AUDIO_STREAM *create_audio_stream(const ALLEGRO_VIDEO *video,
+   const MF_VIDEO *mv)
+{
+   ALLEGRO_AUDIO_STREAM *audio;
+   bool rc;
+
+   audio = al_create_audio_stream(NUM_FRAGS, FRAG_SAMPLES,
+      video->audio_rate, ALLEGRO_AUDIO_DEPTH_FLOAT32,
+      mv->channels == 1 ? ALLEGRO_CHANNEL_CONF_1 : ALLEGRO_CHANNEL_CONF_2);
+   if (!audio) {
+      ALLEGRO_ERROR("Could not create audio stream.\n");
+      return NULL;
+   }
+
+   if (video->mixer) {
+      rc = al_attach_audio_stream_to_mixer(audio, video->mixer);
+   }
+   else if (video->voice) {
+      rc = al_attach_audio_stream_to_voice(audio, video->voice);
+   }
+   else {
+      rc = al_attach_audio_stream_to_mixer(audio, al_get_default_mixer());
+   }
+
+   if (!rc) {
+      ALLEGRO_ERROR("Could not attach audio stream.\n");
+      al_destroy_audio_stream(audio);
+      return NULL;
+   }
+
+   return audio;
+}
+
+/* Reads the next audio sample into audio_data, leaving out anything before
+ * skip_until. Returns false at the end of the stream.
+ */
+static bool read_audio_sample(ALLEGRO_VIDEO *video, MF_VIDEO *mv)
+{
+   IMFSample *sample = NULL;
+   IMFMediaBuffer *buffer;
+   DWORD flags = 0;
+   LONGLONG time;
+   BYTE *data;
+   DWORD len;
+   size_t skip;
+   HRESULT hr;
+
+   hr = mv->reader->ReadSample(AUDIO_STREAM, 0, NULL, &flags, &time, &sample);
+   if (FAILED(hr) || (flags & (MF_SOURCE_READERF_ENDOFSTREAM |
+         MF_SOURCE_READERF_ERROR))) {
+      if (sample)
+         sample->Release();
+      mv->audio_eof = true;
+      return false;
+   }
+   if (!sample)
+      return true;
+
+   mv->audio_len = 0;
+   mv->audio_pos = 0;
+
+   if (SUCCEEDED(sample->ConvertToContiguousBuffer(&buffer))) {
+      if (SUCCEEDED(buffer->Lock(&data, NULL, &len))) {
+         size_t n = len / sizeof(float);
+         if (n > mv->audio_size) {
+            float *tmp = (float *)al_realloc(mv->audio_data, n * sizeof(float));
+            if (tmp) {
+               mv->audio_data = tmp;
+               mv->audio_size = n;
+            }
+         }
+         if (n <= mv->audio_size) {
+            memcpy(mv->audio_data, data, n * sizeof(float));
+            mv->audio_len = n;
+         }
+         buffer->Unlock();
+      }
+      buffer->Release();
+   }
+   sample->Release();
+
+   if (time < mv->skip_until) {
+      skip = (size_t)((mv->skip_until - time) / UNITS_PER_SECOND *
+         video->audio_rate) * mv->channels;
+      mv->audio_pos = _ALLEGRO_MIN(skip, mv->audio_len);
+   }
+
+   return true;
+}
+
+static void fill_audio_fragment(ALLEGRO_VIDEO *video, MF_VIDEO *mv)
+{
+   const size_t want = FRAG_SAMPLES * mv->channels;
+   float *frag;
+   size_t pos = 0;
+   size_t n;
+
+   frag = (float *)al_get_audio_stream_fragment(video->audio);
+   if (!frag)
+      return;
+
+   while (video->playing && pos < want) {
+      if (mv->audio_pos == mv->audio_len) {
+         if (mv->audio_eof || !read_audio_sample(video, mv))
+            break;
+         continue;
+      }
+      n = _ALLEGRO_MIN(want - pos, mv->audio_len - mv->audio_pos);
+      memcpy(frag + pos, mv->audio_data + mv->audio_pos, n * sizeof(float));
+      mv->audio_pos += n;
+      pos += n;
+   }
+
+   memset(frag + pos, 0, (want - pos) * sizeof(float));
+
+   if (!al_set_audio_stream_fragment(video->audio, frag)) {
+      ALLEGRO_ERROR("Error setting stream fragment.\n");
+   }
+}
+
+
+/* Decode thread. */
+
+static void seek_reader(ALLEGRO_VIDEO *video, MF_VIDEO *mv, double seek_to)
+{
+   PROPVARIANT var;
+   HRESULT hr;
+
+   PropVariantInit(&var);
+   var.vt = VT_I8;
+   var.hVal.QuadPart = (LONGLONG)(seek_to * UNITS_PER_SECOND);
+
+   /* Lands on the keyframe before the target; the frames and audio up to
+    * the target are skipped as they are read.
+    */
+   hr = mv->reader->SetCurrentPosition(GUID_NULL, var);
+   if (FAILED(hr)) {
+      ALLEGRO_ERROR("SetCurrentPosition failed: 0x%08lx\n", (unsigned long)hr);
+      return;
+   }
+
+   if (mv->next_sample) {
+      mv->next_sample->Release();
+      mv->next_sample = NULL;
+   }
+   mv->video_eof = false;
+   mv->audio_eof = false;
+   mv->audio_len = 0;
+   mv->audio_pos = 0;
+   mv->skip_until = var.hVal.QuadPart;
+
+   video->position = seek_to;
+   video->audio_position = seek_to;
+}
+
+static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
+{
+   ALLEGRO_VIDEO * const video = (ALLEGRO_VIDEO *)_video;
+   MF_VIDEO * const mv = (MF_VIDEO *)video->data;
+   bool com = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+   bool mf = SUCCEEDED(MFStartup(MF_VERSION, MFSTARTUP_LITE));
+   bool opened = false;
+   ALLEGRO_TIMER *timer = NULL;
+   double timer_dur = 0.0;
+   ALLEGRO_EVENT ev;
+
+   if (mf) {
+      opened = open_reader(video, mv, true) || open_reader(video, mv, false);
+   }
+
+   al_lock_mutex(mv->mutex);
+   mv->status = opened ? MF_STATUS_READY : MF_STATUS_FAILED;
+   al_broadcast_cond(mv->cond);
+   al_unlock_mutex(mv->mutex);
+
+   if (!opened)
+      goto done;
+
+   while (!al_get_thread_should_stop(thread)) {
+      al_wait_for_event(mv->queue, &ev);
+
+      if (ev.type == MF_EVENT_QUIT)
+         break;
+
+      if (ev.type == MF_EVENT_START) {
+         if (mv->has_audio && !video->audio) {
+            video->audio = create_audio_stream(video, mv);
+            if (video->audio) {
+               al_register_event_source(mv->queue,
+                  al_get_audio_stream_event_source(video->audio));
+            }
+         }
+         timer_dur = mv->frame_duration;
+         if (video->audio && timer_dur > (double)FRAG_SAMPLES /
+               video->audio_rate / NUM_FRAGS) {
+            timer_dur = (double)FRAG_SAMPLES / video->audio_rate / NUM_FRAGS;
+         }
+         if (!timer) {
+            timer = al_create_timer(timer_dur);
+            if (timer) {
+               al_register_event_source(mv->queue,
+                  al_get_timer_event_source(timer));
+               al_start_timer(timer);
+            }
+         }
+         continue;
+      }
+
+      if (ev.type == _ALLEGRO_EVENT_VIDEO_SEEK) {
+         al_lock_mutex(mv->mutex);
+         seek_reader(video, mv, ev.user.data1 / 1.0e6);
+         mv->seek_counter++;
+         al_broadcast_cond(mv->cond);
+         al_unlock_mutex(mv->mutex);
+         continue;
+      }
+
+      if (ev.type == ALLEGRO_EVENT_TIMER) {
+         if (video->playing && !video->audio && !is_finished(mv)) {
+            video->position += timer_dur;
+         }
+         show_due_frame(video, mv);
+         if (video->playing && is_finished(mv)) {
+            video->playing = false;
+            ev.type = ALLEGRO_EVENT_VIDEO_FINISHED;
+            ev.user.data1 = (intptr_t)video;
+            al_emit_user_event(&video->es, &ev, NULL);
+         }
+         continue;
+      }
+
+      if (ev.type == ALLEGRO_EVENT_AUDIO_STREAM_FRAGMENT) {
+         if (video->playing && !is_finished(mv)) {
+            double step = (double)FRAG_SAMPLES / video->audio_rate;
+            video->audio_position += step;
+            video->position = video->audio_position - NUM_FRAGS * step;
+         }
+         fill_audio_fragment(video, mv);
+         continue;
+      }
+   }
+
+   if (timer)
+      al_destroy_timer(timer);
+   if (video->audio) {
+      al_destroy_audio_stream(video->audio);
+      video->audio = NULL;
+   }
+
+done:
+   release_reader(mv);
+   if (mf)
+      MFShutdown();
+   if (com)
+      CoUninitialize();
+
+   return NULL;
+}
+
+
+/* Video interface. */
+
+static bool mf_close_video(ALLEGRO_VIDEO *video);
+
+static bool mf_open_video(ALLEGRO_VIDEO *video)
+{
+   MF_VIDEO *mv;
+   bool ready;
+
+   mv = (MF_VIDEO *)al_calloc(1, sizeof(MF_VIDEO));
+   if (!mv)
+      return false;
+   video->data = mv;
+
+   mv->mutex = al_create_mutex();
+   mv->cond = al_create_cond();
+   mv->queue = al_create_event_queue();
+   if (!mv->mutex || !mv->cond || !mv->queue) {
+      mf_close_video(video);
+      return false;
+   }
+   al_init_user_event_source(&mv->evtsrc);
+   al_register_event_source(mv->queue, &mv->evtsrc);
+
+   mv->thread = al_create_thread(decode_thread_func, video);
+   if (!mv->thread) {
+      mf_close_video(video);
+      return false;
+   }
+   al_set_thread_name(mv->thread, "al-video");
+   al_start_thread(mv->thread);
+
+   al_lock_mutex(mv->mutex);
+   while (mv->status == MF_STATUS_INIT)
+      al_wait_cond(mv->cond, mv->mutex);
+   ready = (mv->status == MF_STATUS_READY);
+   al_unlock_mutex(mv->mutex);
+
+   if (ready) {
+      mv->pixels = (unsigned char *)al_malloc(mv->width * mv->height * 4);
+      mv->frame_bmp = al_create_bitmap(mv->width, mv->height);
+      if (mv->frame_bmp && (mv->pic_x != 0 || mv->pic_y != 0 ||
+            mv->pic_w != mv->width || mv->pic_h != mv->height)) {
+         mv->pic_bmp = al_create_sub_bitmap(mv->frame_bmp,
+            mv->pic_x, mv->pic_y, mv->pic_w, mv->pic_h);
+      }
+      else {
+         mv->pic_bmp = mv->frame_bmp;
+      }
+      ready = mv->pixels && mv->frame_bmp && mv->pic_bmp;
+   }
+
+   if (!ready) {
+      mf_close_video(video);
+      return false;
+   }
+
+   return true;
+}
+
+static bool mf_close_video(ALLEGRO_VIDEO *video)
+{
+   MF_VIDEO *mv = (MF_VIDEO *)video->data;
+   ALLEGRO_EVENT ev;
+
+   if (mv) {
+      if (mv->thread) {
+         al_set_thread_should_stop(mv->thread);
+         ev.user.type = MF_EVENT_QUIT;
+         al_emit_user_event(&mv->evtsrc, &ev, NULL);
+         al_join_thread(mv->thread, NULL);
+         al_destroy_thread(mv->thread);
+      }
+      if (mv->queue) {
+         al_destroy_user_event_source(&mv->evtsrc);
+         al_destroy_event_queue(mv->queue);
+      }
+      if (mv->pic_bmp != mv->frame_bmp) {
+         al_destroy_bitmap(mv->pic_bmp);
+      }
+      al_destroy_bitmap(mv->frame_bmp);
+      al_free(mv->pixels);
+      al_free(mv->audio_data);
+      if (mv->cond) {
+         al_destroy_cond(mv->cond);
+      }
+      if (mv->mutex) {
+         al_destroy_mutex(mv->mutex);
+      }
+      al_free(mv);
+   }
+
+   video->data = NULL;
+
+   return true;
+}
+
+static bool mf_start_video(ALLEGRO_VIDEO *video)
+{
+   MF_VIDEO *mv = (MF_VIDEO *)video->data;
+   ALLEGRO_EVENT ev;
+
+   ev.user.type = MF_EVENT_START;
+   al_emit_user_event(&mv->evtsrc, &ev, NULL);
+   return true;
+}
+
+static bool mf_set_video_playing(ALLEGRO_VIDEO *video)
+{
+   (void)video;
+   return true;
+}
+
+static bool mf_seek_video(ALLEGRO_VIDEO *video, double seek_to)
+{
+   MF_VIDEO *mv = (MF_VIDEO *)video->data;
+   ALLEGRO_EVENT ev;
+   int seek_counter;
+
+   al_lock_mutex(mv->mutex);
+
+   seek_counter = mv->seek_counter;
+
+   ev.user.type = _ALLEGRO_EVENT_VIDEO_SEEK;
+   ev.user.data1 = (intptr_t)(seek_to * 1.0e6);
+   ev.user.data2 = 0;
+   ev.user.data3 = 0;
+   ev.user.data4 = 0;
+   al_emit_user_event(&mv->evtsrc, &ev, NULL);
+
+   while (seek_counter == mv->seek_counter) {
+      al_wait_cond(mv->cond, mv->mutex);
+   }
+
+   al_unlock_mutex(mv->mutex);
+
+   return true;
+}
+
+static bool mf_update_video(ALLEGRO_VIDEO *video)
+{
+   MF_VIDEO *mv = (MF_VIDEO *)video->data;
+   ALLEGRO_LOCKED_REGION *lr;
+   int y;
+   bool ret = true;
+
+   al_lock_mutex(mv->mutex);
+
+   if (mv->frame_stale) {
+      lr = al_lock_bitmap(mv->frame_bmp, ALLEGRO_PIXEL_FORMAT_XRGB_8888,
+         ALLEGRO_LOCK_WRITEONLY);
+      if (lr) {
+         for (y = 0; y < mv->height; y++) {
+            memcpy((unsigned char *)lr->data + y * lr->pitch,
+               mv->pixels + y * mv->width * 4, mv->width * 4);
+         }
+         al_unlock_bitmap(mv->frame_bmp);
+         mv->frame_stale = false;
+      }
+      else {
+         ALLEGRO_ERROR("Failed to lock bitmap.\n");
+         ret = false;
+      }
+   }
+
+   video->current_frame = mv->have_frame ? mv->pic_bmp : NULL;
+
+   al_unlock_mutex(mv->mutex);
+
+   return ret;
+}
+
+static ALLEGRO_VIDEO_INTERFACE mf_vtable = {
+   mf_open_video,
+   mf_close_video,
+   mf_start_video,
+   mf_set_video_playing,
+   mf_seek_video,
+   mf_update_video,
+   NULL,
+   NULL
+};
+
+ALLEGRO_VIDEO_INTERFACE *_al_video_mf_vtable(void)
+{
+   return &mf_vtable;
+}
+
+} /* extern "C" */
+
+/* vim: set sts=3 sw=3 et: */
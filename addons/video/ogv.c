@@ -3,7 +3,6 @@
  * TODO:
  * - seeking
  * - generate video frame events
- * - better ycbcr->rgb
  * - improve frame skipping
  * - Ogg Skeleton support
  * - pass Theora test suite
@@ -13,7 +12,10 @@
  * difference.
  */
 
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include <stdio.h>
+#include <stdlib.h>
 #include "allegro5/allegro5.h"
 #include "allegro5/allegro_audio.h"
 #include "allegro5/allegro_video.h"
@@ -32,6 +34,7 @@ ALLEGRO_DEBUG_CHANNEL("video")
 static const int NUM_FRAGS    = 2;
 static const int FRAG_SAMPLES = 4096;
 static const int RGB_PIXEL_FORMAT = ALLEGRO_PIXEL_FORMAT_ABGR_8888;
+static const int DEFAULT_DECODE_AHEAD = 4;
 
 
 typedef struct OGG_VIDEO OGG_VIDEO;
@@ -39,6 +42,7 @@ typedef struct STREAM STREAM;
 typedef struct THEORA_STREAM THEORA_STREAM;
 typedef struct VORBIS_STREAM VORBIS_STREAM;
 typedef struct PACKET_NODE PACKET_NODE;
+typedef struct FRAME FRAME;
 
 enum {
    STREAM_TYPE_UNKNOWN = 0,
@@ -46,9 +50,22 @@ enum {
    STREAM_TYPE_VORBIS
 };
 
+/* Where a Theora stream is in finding its feet after a seek. */
+enum {
+   SEEK_NONE = 0,
+   SEEK_NEED_GRANULE,               /* Frame numbers not known yet. */
+   SEEK_NEED_KEYFRAME
+};
+
+/* Nodes are recycled through the stream's free list along with their
+ * payload buffer, which is kept at the size of the largest packet it has
+ * held.
+ */
 struct PACKET_NODE {
    PACKET_NODE *next;
-   ogg_packet pkt;
+   ogg_packet pkt;                  /* pkt.packet points into data */
+   unsigned char *data;
+   long capacity;
 };
 
 struct THEORA_STREAM {
@@ -58,6 +75,8 @@ struct THEORA_STREAM {
    th_dec_ctx *ctx;
    ogg_int64_t prev_framenum;
    double frame_duration;
+   int seek_state;
+   ogg_int64_t seek_framenum;       /* Frames before this are not shown. */
 };
 
 struct VORBIS_STREAM {
@@ -69,6 +88,19 @@ struct VORBIS_STREAM {
    int channels;
    float *next_fragment;            /* channels * FRAG_SAMPLES elements */
    int next_fragment_pos;
+   ogg_int64_t seek_sample;         /* Samples before this are dropped; -1 */
+   ogg_int64_t sample_pos;          /* Sample after the decoded ones, or -1 */
+};
+
+/* A decoded frame waiting to be shown, in the output mode it was decoded
+ * in. The buffers are allocated on first use and swapped with the current
+ * ones in OGG_VIDEO when the frame is shown.
+ */
+struct FRAME {
+   double pts;
+   bool planar;
+   unsigned char *rgb_data;
+   unsigned char *plane_data[3];
 };
 
 struct STREAM {
@@ -77,6 +109,7 @@ struct STREAM {
    bool headers_done;
    ogg_stream_state state;
    PACKET_NODE *packet_queue;
+   PACKET_NODE *free_packets;
    union {
       THEORA_STREAM theora;
       VORBIS_STREAM vorbis;
@@ -92,14 +125,38 @@ struct OGG_VIDEO {
    STREAM *selected_audio_stream;   /* one of the streams */
    int seek_counter;
 
-   /* Video output. */
+   /* Video output. The current frame is in rgb_data or plane_data. */
    th_pixel_fmt pixel_fmt;
-   th_ycbcr_buffer buffer;
+   th_ycbcr_buffer buffer;          /* Decoder output, decode thread only. */
+   bool have_frame;                 /* A frame has been shown. */
    bool buffer_dirty;
    unsigned char* rgb_data;
    ALLEGRO_BITMAP *frame_bmp;
    ALLEGRO_BITMAP *pic_bmp;         /* frame_bmp, or subbitmap thereof */
 
+   /* Planar output, see al_set_video_planar. The decode thread copies the
+    * Y', Cb and Cr planes instead of converting them, and they are uploaded
+    * as they are and converted by a shader drawing into frame_bmp.
+    */
+   bool planar;
+   bool buffer_planar;              /* The mode the last frame was decoded in. */
+   bool frame_stale;                /* Planes newer than frame_bmp. */
+   unsigned char *plane_data[3];
+   int plane_w[3];
+   int plane_h[3];
+   ALLEGRO_BITMAP *plane_bmp[3];
+   ALLEGRO_BITMAP *pic_plane_bmp[3]; /* plane_bmp, or subbitmaps thereof */
+   ALLEGRO_SHADER *shader;
+
+   /* Frames decoded ahead of the play position, so that a frame which is
+    * slow to decode does not hold up the ones after it. A ring buffer only
+    * used by the decode thread.
+    */
+   FRAME *frames;
+   int frames_size;
+   int frames_head;
+   int frames_count;
+
    ALLEGRO_EVENT_SOURCE evtsrc;
    ALLEGRO_EVENT_QUEUE *queue;
    ALLEGRO_MUTEX *mutex;
@@ -114,24 +171,47 @@ static bool ogv_close_video(ALLEGRO_VIDEO *video);
 
 /* Packet queue. */
 
-static PACKET_NODE *create_packet_node(ogg_packet *packet)
+static PACKET_NODE *create_packet_node(STREAM *stream, ogg_packet *packet)
 {
-   PACKET_NODE *node = al_malloc(sizeof(PACKET_NODE));
+   PACKET_NODE *node = stream->free_packets;
+
+   if (node) {
+      stream->free_packets = node->next;
+   }
+   else {
+      node = al_calloc(1, sizeof(PACKET_NODE));
+   }
+
+   if (node->capacity < packet->bytes) {
+      al_free(node->data);
+      node->data = al_malloc(packet->bytes);
+      node->capacity = packet->bytes;
+   }
 
    node->next = NULL;
    node->pkt = *packet;
-   node->pkt.packet = al_malloc(packet->bytes);
+   node->pkt.packet = node->data;
    memcpy(node->pkt.packet, packet->packet, packet->bytes);
 
    return node;
 }
 
-static void free_packet_node(PACKET_NODE *node)
+static void free_packet_node(STREAM *stream, PACKET_NODE *node)
 {
    ASSERT(node->next == NULL);
 
-   al_free(node->pkt.packet);
-   al_free(node);
+   node->next = stream->free_packets;
+   stream->free_packets = node;
+}
+
+static void free_packet_pool(STREAM *stream)
+{
+   while (stream->free_packets) {
+      PACKET_NODE *node = stream->free_packets;
+      stream->free_packets = node->next;
+      al_free(node->data);
+      al_free(node);
+   }
 }
 
 static void add_tail_packet(STREAM *stream, PACKET_NODE *node)
@@ -186,7 +266,7 @@ static void free_packet_queue(STREAM *stream)
       PACKET_NODE *node = stream->packet_queue;
       stream->packet_queue = node->next;
       node->next = NULL;
-      free_packet_node(node);
+      free_packet_node(stream, node);
    }
 }
 
@@ -194,6 +274,7 @@ static void deactivate_stream(STREAM *stream)
 {
    stream->active = false;
    free_packet_queue(stream);
+   free_packet_pool(stream);
 }
 
 
@@ -210,6 +291,7 @@ static STREAM *create_stream(OGG_VIDEO *ogv, int serial)
    stream->headers_done = false;
    ogg_stream_init(&stream->state, serial);
    stream->packet_queue = NULL;
+   stream->free_packets = NULL;
 
    slot = _al_vector_alloc_back(&ogv->streams);
    (*slot) = stream;
@@ -240,6 +322,7 @@ static void free_stream(STREAM *stream)
    ogg_stream_clear(&stream->state);
 
    free_packet_queue(stream);
+   free_packet_pool(stream);
 
    switch (stream->stream_type) {
       case STREAM_TYPE_UNKNOWN:
@@ -355,7 +438,7 @@ static bool try_decode_theora_header(STREAM *stream, ogg_packet *packet)
    }
 
    if (stream->headers_done) {
-      add_tail_packet(stream, create_packet_node(packet));
+      add_tail_packet(stream, create_packet_node(stream, packet));
       return true;
    }
 
@@ -373,7 +456,7 @@ static bool try_decode_theora_header(STREAM *stream, ogg_packet *packet)
 
    if (rc == 0) {
       /* First Theora data packet. */
-      add_tail_packet(stream, create_packet_node(packet));
+      add_tail_packet(stream, create_packet_node(stream, packet));
       stream->headers_done = true;
       return true;
    }
@@ -413,7 +496,7 @@ static int try_decode_vorbis_header(STREAM *stream, ogg_packet *packet)
 
    if (stream->stream_type == STREAM_TYPE_VORBIS && rc == OV_ENOTVORBIS) {
       /* First data packet. */
-      add_tail_packet(stream, create_packet_node(packet));
+      add_tail_packet(stream, create_packet_node(stream, packet));
       stream->headers_done = true;
       return true;
    }
@@ -534,11 +617,48 @@ static void setup_vorbis_stream_decode(ALLEGRO_VIDEO *video, STREAM *stream)
 
    vstream->next_fragment =
       al_calloc(vstream->channels * FRAG_SAMPLES, sizeof(float));
+   vstream->seek_sample = -1;
 
    ALLEGRO_INFO("Audio rate: %f\n", video->audio_rate);
    ALLEGRO_INFO("Audio channels: %d\n", vstream->channels);
 }
 
+/* After a seek, drops the decoded samples before the target sample. Where
+ * they are is only known from the first packet with a granule position.
+ */
+static void skip_to_seek_sample(VORBIS_STREAM *vstream, ogg_packet *packet)
+{
+   float **pcm;
+   int samples;
+   ogg_int64_t drop;
+   int rc;
+
+   samples = vorbis_synthesis_pcmout(&vstream->dsp, &pcm);
+
+   if (packet->granulepos >= 0) {
+      vstream->sample_pos = packet->granulepos;
+   }
+   else if (vstream->sample_pos >= 0) {
+      vstream->sample_pos += samples;
+   }
+
+   if (vstream->sample_pos < 0) {
+      drop = samples;
+   }
+   else {
+      drop = vstream->seek_sample - (vstream->sample_pos - samples);
+      if (drop > samples)
+         drop = samples;
+      if (vstream->sample_pos >= vstream->seek_sample)
+         vstream->seek_sample = -1;
+   }
+
+   if (drop > 0) {
+      rc = vorbis_synthesis_read(&vstream->dsp, drop);
+      ASSERT(rc == 0);
+   }
+}
+
 static void handle_vorbis_data(VORBIS_STREAM *vstream, ogg_packet *packet)
 {
    int rc;
@@ -554,6 +674,10 @@ static void handle_vorbis_data(VORBIS_STREAM *vstream, ogg_packet *packet)
       ALLEGRO_ERROR("vorbis_synthesis_blockin returned %d\n", rc);
       return;
    }
+
+   if (vstream->seek_sample >= 0) {
+      skip_to_seek_sample(vstream, packet);
+   }
 }
 
 static bool generate_next_audio_fragment(VORBIS_STREAM *vstream)
@@ -620,7 +744,7 @@ static void poll_vorbis_decode(OGG_VIDEO *ogv, STREAM *vstream_outer)
       if (node) {
          handle_vorbis_data(vstream, &node->pkt);
          generate_next_audio_fragment(vstream);
-         free_packet_node(node);
+         free_packet_node(vstream_outer, node);
       }
       else if (read_packet(ogv, vstream_outer, &packet)) {
          handle_vorbis_data(vstream, &packet);
@@ -710,6 +834,44 @@ static void update_audio_fragment(ALLEGRO_AUDIO_STREAM *audio_stream,
 
 /* Theora streams. */
 
+/* How many times smaller than the luma plane the chroma planes are, as
+ * powers of two.
+ */
+static bool get_chroma_shifts(th_pixel_fmt fmt, int *xshift, int *yshift)
+{
+   switch (fmt) {
+      case TH_PF_420:
+         *xshift = 1;
+         *yshift = 1;
+         return true;
+      case TH_PF_422:
+         *xshift = 1;
+         *yshift = 0;
+         return true;
+      case TH_PF_444:
+         *xshift = 0;
+         *yshift = 0;
+         return true;
+      default:
+         ALLEGRO_ERROR("Unsupported pixel format.\n");
+         return false;
+   }
+}
+
+/* The number of frames to decode ahead of the play position. */
+static int get_decode_ahead(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "video",
+      "decode_ahead_frames");
+   int frames = DEFAULT_DECODE_AHEAD;
+
+   if (value && value[0] != '\0')
+      frames = atoi(value);
+   if (frames < 1)
+      frames = 1;
+   return frames;
+}
+
 static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
    STREAM *tstream_outer)
 {
@@ -721,6 +883,8 @@ static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
    int pic_w = tstream->info.pic_width;
    int pic_h = tstream->info.pic_height;
    float aspect_ratio = 1.0;
+   int xshift, yshift;
+   int i;
 
    tstream->ctx = th_decode_alloc(&tstream->info, tstream->setup);
    ASSERT(tstream->ctx);
@@ -739,6 +903,19 @@ static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
    ogv->rgb_data =
       al_malloc(al_get_pixel_size(RGB_PIXEL_FORMAT) * frame_w * frame_h);
 
+   if (get_chroma_shifts(ogv->pixel_fmt, &xshift, &yshift)) {
+      /* Theora frame sizes are multiples of 16, so this is exact. */
+      for (i = 0; i < 3; i++) {
+         ogv->plane_w[i] = frame_w >> (i ? xshift : 0);
+         ogv->plane_h[i] = frame_h >> (i ? yshift : 0);
+      }
+   }
+
+   ogv->frames_size = get_decode_ahead();
+   ogv->frames = al_calloc(ogv->frames_size, sizeof(FRAME));
+   if (!ogv->frames)
+      ogv->frames_size = 0;
+
    video->fps =
       (double)tstream->info.fps_numerator /
       (double)tstream->info.fps_denominator;
@@ -762,6 +939,7 @@ static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
    ALLEGRO_INFO("Scaled size: %fx%f\n", video->scaled_width, video->scaled_height);
    ALLEGRO_INFO("FPS: %f\n", video->fps);
    ALLEGRO_INFO("Frame_duration: %f\n", tstream->frame_duration);
+   ALLEGRO_INFO("Decode ahead: %d frames\n", ogv->frames_size);
 }
 
 static int64_t get_theora_framenum(THEORA_STREAM *tstream, ogg_packet *packet)
@@ -773,6 +951,35 @@ static int64_t get_theora_framenum(THEORA_STREAM *tstream, ogg_packet *packet)
    return tstream->prev_framenum + 1;
 }
 
+/* After seeking into the middle of the stream, packets are skipped until
+ * one with a granule position gives the frame numbers, and then until a
+ * keyframe, which can be decoded without the frames before it.
+ */
+static bool reached_seek_keyframe(THEORA_STREAM *tstream, ogg_packet *packet)
+{
+   int64_t framenum;
+
+   if (packet->granulepos >= 0) {
+      framenum = th_granule_frame(&tstream->info, packet->granulepos);
+   }
+   else if (tstream->seek_state == SEEK_NEED_KEYFRAME) {
+      framenum = tstream->prev_framenum + 1;
+   }
+   else {
+      return false;
+   }
+
+   if (th_packet_iskeyframe(packet) != 1) {
+      tstream->prev_framenum = framenum;
+      tstream->seek_state = SEEK_NEED_KEYFRAME;
+      return false;
+   }
+
+   tstream->prev_framenum = framenum - 1;
+   tstream->seek_state = SEEK_NONE;
+   return true;
+}
+
 static bool handle_theora_data(ALLEGRO_VIDEO *video, THEORA_STREAM *tstream,
    ogg_packet *packet, bool *ret_new_frame)
 {
@@ -780,6 +987,11 @@ static bool handle_theora_data(ALLEGRO_VIDEO *video, THEORA_STREAM *tstream,
    int64_t framenum;
    int rc;
 
+   if (tstream->seek_state != SEEK_NONE &&
+         !reached_seek_keyframe(tstream, packet)) {
+      return true;
+   }
+
    expected_framenum = tstream->prev_framenum + 1;
    framenum = get_theora_framenum(tstream, packet);
 
@@ -815,140 +1027,302 @@ static bool handle_theora_data(ALLEGRO_VIDEO *video, THEORA_STREAM *tstream,
    return true;
 }
 
-/* Y'CrCb to RGB conversion. */
-/* XXX simple slow implementation */
+/* Y'CrCb to RGB conversion, a row at a time; see ogv_simd.c. */
+static void convert_buffer_to_rgba(OGG_VIDEO *ogv, unsigned char *rgb_data)
+{
+   const int pixel_size = al_get_pixel_size(RGB_PIXEL_FORMAT);
+   const int pitch = pixel_size * al_get_bitmap_width(ogv->frame_bmp);
+   const th_img_plane *planes = ogv->buffer;
+   const int w = planes[0].width;
+   const int h = planes[0].height;
+   int xshift, yshift;
+   int y;
 
-static unsigned char clamp(int x)
+   ASSERT(pixel_size == 4);
+
+   if (!get_chroma_shifts(ogv->pixel_fmt, &xshift, &yshift))
+      return;
+
+   for (y = 0; y < h; y++) {
+      const int y2 = y >> yshift;
+      _al_ogv_ycbcr_row(rgb_data + y * pitch,
+         planes[0].data + y * planes[0].stride,
+         planes[1].data + y2 * planes[1].stride,
+         planes[2].data + y2 * planes[2].stride,
+         w, xshift);
+   }
+}
+
+/* Keeps a copy of the decoded planes for planar output, as the decoder
+ * reuses its buffers.
+ */
+static void copy_buffer_planes(OGG_VIDEO *ogv, unsigned char *plane_data[3])
 {
-   if (x < 0)
-      return 0;
-   if (x > 255)
-      return 255;
-   return x;
+   int i, y;
+
+   for (i = 0; i < 3; i++) {
+      const th_img_plane *plane = &ogv->buffer[i];
+
+      ASSERT(plane->width == ogv->plane_w[i]);
+      ASSERT(plane->height == ogv->plane_h[i]);
+
+      for (y = 0; y < ogv->plane_h[i]; y++) {
+         memcpy(plane_data[i] + y * ogv->plane_w[i],
+            plane->data + y * plane->stride, ogv->plane_w[i]);
+      }
+   }
 }
 
-static INLINE void ycbcr_to_rgb(th_ycbcr_buffer buffer,
-   unsigned char* rgb_data, int pixel_size, int pitch, int xshift, int yshift)
+/* Takes the decoder output into a frame, in the current output mode. */
+static bool take_decoded_frame(OGG_VIDEO *ogv, THEORA_STREAM *tstream,
+   FRAME *frame)
 {
-   const int w = buffer[0].width;
-   const int h = buffer[0].height;
-   int x, y;
+   int rc;
+   int i;
 
-   for (y = 0; y < h; y++) {
-      const int y2 = y >> yshift;
-      for (x = 0; x < w; x++) {
-         const int x2 = x >> xshift;
-         unsigned char * const data = rgb_data + y * pitch + x * pixel_size;
-         const int yp = buffer[0].data[y  * buffer[0].stride + x ];
-         const int cb = buffer[1].data[y2 * buffer[1].stride + x2];
-         const int cr = buffer[2].data[y2 * buffer[2].stride + x2];
-         const int C = yp - 16;
-         const int D = cb - 128;
-         const int E = cr - 128;
-
-         data[0] = clamp((298*C         + 409*E + 128) >> 8);
-         data[1] = clamp((298*C - 100*D - 208*E + 128) >> 8);
-         data[2] = clamp((298*C + 516*D         + 128) >> 8);
-         data[3] = 0xff;
+   rc = th_decode_ycbcr_out(tstream->ctx, ogv->buffer);
+   ASSERT(rc == 0);
+
+   al_lock_mutex(ogv->mutex);
+   frame->planar = ogv->planar;
+   al_unlock_mutex(ogv->mutex);
+
+   if (frame->planar) {
+      for (i = 0; i < 3; i++) {
+         if (!frame->plane_data[i])
+            frame->plane_data[i] = al_malloc(ogv->plane_w[i] * ogv->plane_h[i]);
+         if (!frame->plane_data[i])
+            return false;
+      }
+      copy_buffer_planes(ogv, frame->plane_data);
+   }
+   else {
+      if (!frame->rgb_data) {
+         frame->rgb_data = al_malloc(al_get_pixel_size(RGB_PIXEL_FORMAT) *
+            al_get_bitmap_width(ogv->frame_bmp) *
+            al_get_bitmap_height(ogv->frame_bmp));
       }
+      if (!frame->rgb_data)
+         return false;
+      convert_buffer_to_rgba(ogv, frame->rgb_data);
    }
+
+   return true;
 }
 
-static void convert_buffer_to_rgba(OGG_VIDEO *ogv)
+/* Makes the last due frame in the queue the current one, dropping any due
+ * frames before it. A frame is due half a frame period after its time, so
+ * that rounding in the play position does not make two frames due at once.
+ */
+static void show_due_frame(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
+   THEORA_STREAM *tstream)
 {
-   const int pixel_size = al_get_pixel_size(RGB_PIXEL_FORMAT);
-   const int pitch = pixel_size * al_get_bitmap_width(ogv->frame_bmp);
+   FRAME *frame = NULL;
+   ALLEGRO_EVENT event;
+   unsigned char *tmp;
+   int i;
 
-   switch (ogv->pixel_fmt) {
-      case TH_PF_420:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 1, 1);
-         break;
-      case TH_PF_422:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 1, 0);
-         break;
-      case TH_PF_444:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 0, 0);
-         break;
-      default:
-         ALLEGRO_ERROR("Unsupported pixel format.\n");
+   while (ogv->frames_count > 0) {
+      FRAME *head = &ogv->frames[ogv->frames_head];
+
+      if (head->pts > video->position - 0.5 * tstream->frame_duration)
          break;
+      if (frame)
+         video->dropped_frames++;
+      frame = head;
+      ogv->frames_head = (ogv->frames_head + 1) % ogv->frames_size;
+      ogv->frames_count--;
    }
+
+   if (!frame)
+      return;
+
+   al_lock_mutex(ogv->mutex);
+
+   if (frame->planar) {
+      for (i = 0; i < 3; i++) {
+         tmp = ogv->plane_data[i];
+         ogv->plane_data[i] = frame->plane_data[i];
+         frame->plane_data[i] = tmp;
+      }
+   }
+   else {
+      tmp = ogv->rgb_data;
+      ogv->rgb_data = frame->rgb_data;
+      frame->rgb_data = tmp;
+   }
+   ogv->buffer_planar = frame->planar;
+   ogv->buffer_dirty = true;
+   ogv->have_frame = true;
+
+   event.type = ALLEGRO_EVENT_VIDEO_FRAME_SHOW;
+   event.user.data1 = (intptr_t)video;
+   al_emit_user_event(&video->es, &event, NULL);
+
+   al_unlock_mutex(ogv->mutex);
 }
 
-static int poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
+static void poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
 {
    OGG_VIDEO * const ogv = video->data;
    THEORA_STREAM * const tstream = &tstream_outer->u.theora;
-   bool new_frame = false;
-   int num_frames = 0;
-   int rc;
 
-   while (video->video_position < video->position) {
+   while (ogv->frames_count < ogv->frames_size) {
       PACKET_NODE *node;
       ogg_packet packet;
+      bool new_frame = false;
 
       node = take_head_packet(tstream_outer);
       if (node) {
          if (handle_theora_data(video, tstream, &node->pkt, &new_frame)) {
-            free_packet_node(node);
-            num_frames++;
+            free_packet_node(tstream_outer, node);
          }
          else {
             add_head_packet(tstream_outer, node);
          }
       }
       else if (read_packet(ogv, tstream_outer, &packet)) {
-         if (handle_theora_data(video, tstream, &packet, &new_frame)) {
-            num_frames++;
-         }
-         else {
-            add_head_packet(tstream_outer, create_packet_node(&packet));
+         if (!handle_theora_data(video, tstream, &packet, &new_frame)) {
+            add_head_packet(tstream_outer,
+               create_packet_node(tstream_outer, &packet));
          }
       }
       else {
          break;
       }
 
+      if (!new_frame)
+         continue;
+
+      /* Decoded only for the frames after it, following a seek. */
+      if (tstream->prev_framenum < tstream->seek_framenum)
+         continue;
+
       /* Only skip frames if we are really falling behind, not just slightly
        * ahead of the target position.
        * XXX improve frame skipping algorithm
        */
       if (video->video_position
-            >= video->position - 3.0*tstream->frame_duration) {
-         break;
+            < video->position - 3.0*tstream->frame_duration) {
+         video->dropped_frames++;
+      }
+      else {
+         FRAME *frame = &ogv->frames[(ogv->frames_head + ogv->frames_count) %
+            ogv->frames_size];
+
+         if (take_decoded_frame(ogv, tstream, frame)) {
+            frame->pts = video->video_position;
+            ogv->frames_count++;
+         }
+         else {
+            ALLEGRO_ERROR("Out of memory.\n");
+            video->dropped_frames++;
+         }
       }
    }
 
-   if (new_frame) {
-      ALLEGRO_EVENT event;
-      al_lock_mutex(ogv->mutex);
+   show_due_frame(video, ogv, tstream);
+}
 
-      rc = th_decode_ycbcr_out(tstream->ctx, ogv->buffer);
-      ASSERT(rc == 0);
+/* True once the whole file is read and every queued frame was shown. */
+static bool is_finished(OGG_VIDEO *ogv)
+{
+   return ogv->reached_eof && ogv->frames_count == 0;
+}
 
-      convert_buffer_to_rgba(ogv);
 
-      ogv->buffer_dirty = true;
+/* Seeking. */
 
-      event.type = ALLEGRO_EVENT_VIDEO_FRAME_SHOW;
-      event.user.data1 = (intptr_t)video;
-      al_emit_user_event(&video->es, &event, NULL);
+/* What a granule position counts in: frames for Theora, samples for
+ * Vorbis.
+ */
+static int64_t granule_to_index(STREAM *stream, ogg_int64_t granulepos)
+{
+   if (stream->stream_type == STREAM_TYPE_THEORA) {
+      return th_granule_frame(&stream->u.theora.info, granulepos);
+   }
+   return granulepos;
+}
 
-      al_unlock_mutex(ogv->mutex);
+/* Returns the offset of the first page of the stream starting in
+ * [offset, limit) that has a granule position, or -1.
+ */
+static int64_t find_granule_page(OGG_VIDEO *ogv, STREAM *stream,
+   int64_t offset, int64_t limit, ogg_int64_t *granulepos)
+{
+   const int buffer_size = 4096;
+   int64_t pos = offset;
+   ogg_page page;
+   long n;
+
+   ogg_sync_reset(&ogv->sync_state);
+   if (!al_fseek(ogv->fp, offset, SEEK_SET)) {
+      return -1;
+   }
+
+   while (pos < limit) {
+      n = ogg_sync_pageseek(&ogv->sync_state, &page);
+      if (n < 0) {
+         /* Skipped bytes looking for a page. */
+         pos -= n;
+      }
+      else if (n == 0) {
+         char *buffer = ogg_sync_buffer(&ogv->sync_state, buffer_size);
+         size_t bytes = al_fread(ogv->fp, buffer, buffer_size);
+
+         if (bytes == 0) {
+            break;
+         }
+         ogg_sync_wrote(&ogv->sync_state, bytes);
+      }
+      else {
+         if (ogg_page_serialno(&page) == stream->state.serialno &&
+               ogg_page_granulepos(&page) >= 0) {
+            *granulepos = ogg_page_granulepos(&page);
+            return pos;
+         }
+         pos += n;
+      }
    }
 
-   return num_frames;
+   return -1;
 }
 
+/* Bisects the file for the last page of the stream with a granule position
+ * before the target, returning its offset or -1.
+ */
+static int64_t find_page_before(OGG_VIDEO *ogv, STREAM *stream,
+   int64_t target, ogg_int64_t *ret_granulepos)
+{
+   int64_t lo = 0;
+   int64_t hi = al_fsize(ogv->fp);
+   int64_t best = -1;
+
+   while (lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      ogg_int64_t granulepos;
+      int64_t offset = find_granule_page(ogv, stream, mid, hi, &granulepos);
+
+      if (offset >= 0 && granule_to_index(stream, granulepos) < target) {
+         best = offset;
+         *ret_granulepos = granulepos;
+         lo = offset + 1;
+      }
+      else {
+         hi = mid;
+      }
+   }
 
-/* Seeking. */
+   return best;
+}
 
-static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
-   THEORA_STREAM *tstream)
+/* Drops everything read so far, to read on from the current file
+ * position.
+ */
+static void reset_streams(OGG_VIDEO *ogv)
 {
    unsigned i;
    int rc;
-   bool seeked;
 
    for (i = 0; i < _al_vector_size(&ogv->streams); i++) {
       STREAM **slot = _al_vector_ref(&ogv->streams, i);
@@ -958,6 +1332,27 @@ static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
       free_packet_queue(stream);
    }
 
+   ogv->frames_head = 0;
+   ogv->frames_count = 0;
+
+   rc = ogg_sync_reset(&ogv->sync_state);
+   ASSERT(rc == 0);
+
+   ogv->reached_eof = false;
+}
+
+static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
+   THEORA_STREAM *tstream)
+{
+   int rc;
+   bool seeked;
+
+   seeked = al_fseek(ogv->fp, 0, SEEK_SET);
+   ASSERT(seeked);
+   /* XXX read enough file data to get into position */
+
+   reset_streams(ogv);
+
    if (tstream) {
       ogg_int64_t granpos = 0;
 
@@ -966,16 +1361,10 @@ static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
       ASSERT(rc == 0);
 
       tstream->prev_framenum = -1;
+      tstream->seek_state = SEEK_NONE;
+      tstream->seek_framenum = 0;
    }
 
-   rc = ogg_sync_reset(&ogv->sync_state);
-   ASSERT(rc == 0);
-
-   seeked = al_fseek(ogv->fp, 0, SEEK_SET);
-   ASSERT(seeked);
-   /* XXX read enough file data to get into position */
-
-   ogv->reached_eof = false;
    video->audio_position = 0.0;
    video->video_position = 0.0;
    video->position = 0.0;
@@ -983,6 +1372,66 @@ static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
    /* XXX maybe clear backlog of time and stream fragment events */
 }
 
+/* Moves the demuxer straight to a page before the keyframe preceding the
+ * target time, found by bisection, and has the decoders skip up to the
+ * target from there. If there is no such page, decodes from the beginning.
+ */
+static void seek_to_time(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
+   STREAM *tstream_outer, STREAM *vstream_outer, double seek_to)
+{
+   THEORA_STREAM *tstream = NULL;
+   int64_t target_frame = 0;
+   int64_t offset = -1;
+   ogg_int64_t granulepos;
+
+   if (tstream_outer) {
+      tstream = &tstream_outer->u.theora;
+      target_frame = seek_to / tstream->frame_duration;
+
+      if (find_page_before(ogv, tstream_outer, target_frame + 1,
+            &granulepos) >= 0) {
+         const int shift = tstream->info.keyframe_granule_shift;
+         const int64_t keyframe = th_granule_frame(&tstream->info,
+            (granulepos >> shift) << shift);
+
+         offset = find_page_before(ogv, tstream_outer, keyframe, &granulepos);
+      }
+   }
+   else if (vstream_outer) {
+      offset = find_page_before(ogv, vstream_outer,
+         seek_to * vstream_outer->u.vorbis.info.rate, &granulepos);
+   }
+
+   if (offset < 0 || !al_fseek(ogv->fp, offset, SEEK_SET)) {
+      seek_to_beginning(video, ogv, tstream);
+   }
+   else {
+      reset_streams(ogv);
+      if (tstream) {
+         tstream->seek_state = SEEK_NEED_GRANULE;
+      }
+   }
+
+   if (tstream) {
+      tstream->seek_framenum = target_frame;
+   }
+
+   if (vstream_outer) {
+      VORBIS_STREAM *vstream = &vstream_outer->u.vorbis;
+
+      vorbis_synthesis_restart(&vstream->dsp);
+      vstream->next_fragment_pos = 0;
+      vstream->seek_sample = seek_to * vstream->info.rate;
+      vstream->sample_pos = -1;
+   }
+
+   ALLEGRO_DEBUG("Seeked to %f from offset %ld\n", seek_to, (long)offset);
+
+   video->audio_position = seek_to;
+   video->video_position = seek_to;
+   video->position = seek_to;
+}
+
 /* Decode thread. */
 
 static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
@@ -1051,10 +1500,13 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
 
       if (ev.type == _ALLEGRO_EVENT_VIDEO_SEEK) {
          double seek_to = ev.user.data1 / 1.0e6;
-         /* XXX we only know how to seek to start of video */
-         ASSERT(seek_to <= 0.0);
          al_lock_mutex(ogv->mutex);
-         seek_to_beginning(video, ogv, tstream);
+         if (seek_to > 0.0) {
+            seek_to_time(video, ogv, tstream_outer, vstream_outer, seek_to);
+         }
+         else {
+            seek_to_beginning(video, ogv, tstream);
+         }
          ogv->seek_counter++;
          al_broadcast_cond(ogv->cond);
          al_unlock_mutex(ogv->mutex);
@@ -1067,7 +1519,7 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
          }
 
          /* If no audio then video is master. */
-         if (!video->audio && video->playing && !ogv->reached_eof) {
+         if (!video->audio && video->playing && !is_finished(ogv)) {
             video->position += tstream->frame_duration;
          }
 
@@ -1075,7 +1527,7 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
             poll_theora_decode(video, tstream_outer);
          }
 
-         if (video->playing && ogv->reached_eof) {
+         if (video->playing && is_finished(ogv)) {
             ALLEGRO_EVENT event;
             video->playing = false;
 
@@ -1092,7 +1544,7 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
           * fragment events which pushes the position field ahead of the
           * real audio position.
           */
-         if (video->playing && !ogv->reached_eof) {
+         if (video->playing && !is_finished(ogv)) {
             video->audio_position += audio_pos_step;
             video->position = video->audio_position - NUM_FRAGS * audio_pos_step;
          }
@@ -1138,6 +1590,233 @@ static bool update_frame_bmp(OGG_VIDEO *ogv)
 }
 
 
+static bool upload_planes(OGG_VIDEO *ogv)
+{
+   ALLEGRO_LOCKED_REGION *lr;
+   int i, y;
+
+   for (i = 0; i < 3; i++) {
+      lr = al_lock_bitmap(ogv->plane_bmp[i],
+         ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8, ALLEGRO_LOCK_WRITEONLY);
+      if (!lr) {
+         ALLEGRO_ERROR("Failed to lock plane bitmap.\n");
+         return false;
+      }
+
+      for (y = 0; y < ogv->plane_h[i]; y++) {
+         memcpy((unsigned char*)lr->data + y * lr->pitch,
+            ogv->plane_data[i] + y * ogv->plane_w[i], ogv->plane_w[i]);
+      }
+
+      al_unlock_bitmap(ogv->plane_bmp[i]);
+   }
+
+   return true;
+}
+
+
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+
+#define CB_SAMPLER "al_video_cb"
+#define CR_SAMPLER "al_video_cr"
+
+/* The same conversion as ogv_simd.c, in normalised values. The chroma
+ * planes are smaller, but cover the same texture coordinates.
+ */
+static const char *planar_pixel_source =
+   "#ifdef GL_ES\n"
+   "precision mediump float;\n"
+   "#endif\n"
+   "uniform sampler2D " ALLEGRO_SHADER_VAR_TEX ";\n"
+   "uniform sampler2D " CB_SAMPLER ";\n"
+   "uniform sampler2D " CR_SAMPLER ";\n"
+   "varying vec4 varying_color;\n"
+   "varying vec2 varying_texcoord;\n"
+   "void main()\n"
+   "{\n"
+   "  float c = texture2D(" ALLEGRO_SHADER_VAR_TEX ", varying_texcoord).r - 16.0 / 255.0;\n"
+   "  float d = texture2D(" CB_SAMPLER ", varying_texcoord).r - 128.0 / 255.0;\n"
+   "  float e = texture2D(" CR_SAMPLER ", varying_texcoord).r - 128.0 / 255.0;\n"
+   "  vec3 rgb = vec3(\n"
+   "    298.0 * c + 409.0 * e,\n"
+   "    298.0 * c - 100.0 * d - 208.0 * e,\n"
+   "    298.0 * c + 516.0 * d) / 256.0;\n"
+   "  gl_FragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);\n"
+   "}\n";
+
+static ALLEGRO_SHADER *create_planar_shader(void)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ALLEGRO_SHADER *shader;
+   int flags;
+
+   if (!display)
+      return NULL;
+   flags = al_get_display_flags(display);
+   if (!(flags & ALLEGRO_OPENGL) || !(flags & ALLEGRO_PROGRAMMABLE_PIPELINE))
+      return NULL;
+
+   shader = al_create_shader(ALLEGRO_SHADER_GLSL);
+   if (!shader)
+      return NULL;
+
+   if (!al_attach_shader_source(shader, ALLEGRO_VERTEX_SHADER,
+         al_get_default_shader_source(ALLEGRO_SHADER_GLSL,
+            ALLEGRO_VERTEX_SHADER)) ||
+       !al_attach_shader_source(shader, ALLEGRO_PIXEL_SHADER,
+         planar_pixel_source) ||
+       !al_build_shader(shader)) {
+      ALLEGRO_ERROR("Building the planar video shader failed: %s\n",
+         al_get_shader_log(shader));
+      al_destroy_shader(shader);
+      return NULL;
+   }
+   return shader;
+}
+
+/* Draws the uploaded planes into frame_bmp through the shader. */
+static bool convert_planes(OGG_VIDEO *ogv)
+{
+   ALLEGRO_STATE state;
+   bool hold = al_is_bitmap_drawing_held();
+   bool ret;
+
+   al_hold_bitmap_drawing(false);
+   al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+
+   al_set_target_bitmap(ogv->frame_bmp);
+   ret = al_use_shader(ogv->shader);
+   if (ret) {
+      al_set_shader_sampler(CB_SAMPLER, ogv->plane_bmp[1], 1);
+      al_set_shader_sampler(CR_SAMPLER, ogv->plane_bmp[2], 2);
+      al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+      al_draw_bitmap(ogv->plane_bmp[0], 0, 0, 0);
+      al_use_shader(NULL);
+   }
+
+   al_restore_state(&state);
+   al_hold_bitmap_drawing(hold);
+   return ret;
+}
+
+#else
+
+static ALLEGRO_SHADER *create_planar_shader(void)
+{
+   return NULL;
+}
+
+static bool convert_planes(OGG_VIDEO *ogv)
+{
+   (void)ogv;
+   return false;
+}
+
+#endif
+
+
+static void free_planes(OGG_VIDEO *ogv)
+{
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      if (ogv->pic_plane_bmp[i] != ogv->plane_bmp[i])
+         al_destroy_bitmap(ogv->pic_plane_bmp[i]);
+      al_destroy_bitmap(ogv->plane_bmp[i]);
+      ogv->pic_plane_bmp[i] = NULL;
+      ogv->plane_bmp[i] = NULL;
+   }
+   if (ogv->shader) {
+      al_destroy_shader(ogv->shader);
+      ogv->shader = NULL;
+   }
+}
+
+
+/* Sets up what planar output needs on the display of frame_bmp, once. */
+static bool init_planes(OGG_VIDEO *ogv)
+{
+   const th_info *info = &ogv->selected_video_stream->u.theora.info;
+   ALLEGRO_STATE state;
+   int xshift, yshift;
+   int i;
+   bool ok = true;
+
+   if (ogv->shader)
+      return true;
+   if (!get_chroma_shifts(ogv->pixel_fmt, &xshift, &yshift))
+      return false;
+   if (al_get_bitmap_flags(ogv->frame_bmp) & ALLEGRO_MEMORY_BITMAP)
+      return false;
+
+   al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP |
+      ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   al_set_target_bitmap(ogv->frame_bmp);
+   al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8);
+   al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
+
+   for (i = 0; i < 3 && ok; i++) {
+      const int xs = i ? xshift : 0;
+      const int ys = i ? yshift : 0;
+
+      ogv->plane_bmp[i] = al_create_bitmap(ogv->plane_w[i], ogv->plane_h[i]);
+      ok = ogv->plane_bmp[i] != NULL;
+
+      if (ok && ogv->pic_bmp != ogv->frame_bmp) {
+         const int x1 = info->pic_x >> xs;
+         const int y1 = info->pic_y >> ys;
+         const int x2 = (info->pic_x + info->pic_width + (1 << xs) - 1) >> xs;
+         const int y2 = (info->pic_y + info->pic_height + (1 << ys) - 1) >> ys;
+         ogv->pic_plane_bmp[i] = al_create_sub_bitmap(ogv->plane_bmp[i],
+            x1, y1, x2 - x1, y2 - y1);
+         ok = ogv->pic_plane_bmp[i] != NULL;
+      }
+      else {
+         ogv->pic_plane_bmp[i] = ogv->plane_bmp[i];
+      }
+   }
+
+   if (ok)
+      ogv->shader = create_planar_shader();
+
+   al_restore_state(&state);
+
+   if (!ogv->shader) {
+      ALLEGRO_WARN("Planar video output is not available.\n");
+      free_planes(ogv);
+      return false;
+   }
+   return true;
+}
+
+/* Brings frame_bmp, or with 'rgb' false just the planes in planar mode, up
+ * to date with the last decoded frame. The caller holds the mutex.
+ */
+static bool update_frame(OGG_VIDEO *ogv, bool rgb)
+{
+   bool ret = true;
+
+   if (ogv->buffer_dirty) {
+      if (ogv->buffer_planar) {
+         ret = upload_planes(ogv);
+         ogv->frame_stale = ret;
+      }
+      else {
+         ret = update_frame_bmp(ogv);
+         ogv->frame_stale = false;
+      }
+      ogv->buffer_dirty = false;
+   }
+
+   if (rgb && ogv->frame_stale) {
+      ret = convert_planes(ogv);
+      ogv->frame_stale = false;
+   }
+
+   return ret;
+}
+
+
 /* Video interface. */
 
 static bool do_open_video(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv)
@@ -1208,6 +1887,23 @@ static bool ogv_open_video(ALLEGRO_VIDEO *video)
    return true;
 }
 
+static void free_frames(OGG_VIDEO *ogv)
+{
+   int i, j;
+
+   if (!ogv->frames)
+      return;
+
+   for (i = 0; i < ogv->frames_size; i++) {
+      al_free(ogv->frames[i].rgb_data);
+      for (j = 0; j < 3; j++) {
+         al_free(ogv->frames[i].plane_data[j]);
+      }
+   }
+   al_free(ogv->frames);
+   ogv->frames = NULL;
+}
+
 static bool ogv_close_video(ALLEGRO_VIDEO *video)
 {
    OGG_VIDEO *ogv;
@@ -1234,9 +1930,14 @@ static bool ogv_close_video(ALLEGRO_VIDEO *video)
       if (ogv->pic_bmp != ogv->frame_bmp) {
          al_destroy_bitmap(ogv->pic_bmp);
       }
+      free_planes(ogv);
       al_destroy_bitmap(ogv->frame_bmp);
 
       al_free(ogv->rgb_data);
+      for (i = 0; i < 3; i++) {
+         al_free(ogv->plane_data[i]);
+      }
+      free_frames(ogv);
 
       al_free(ogv);
    }
@@ -1260,6 +1961,7 @@ static bool ogv_start_video(ALLEGRO_VIDEO *video)
       ALLEGRO_ERROR("Could not create thread.\n");
       return false;
    }
+   al_set_thread_name(ogv->thread, "al-video");
 
    al_init_user_event_source(&ogv->evtsrc);
    ogv->queue = al_create_event_queue();
@@ -1275,7 +1977,7 @@ static bool ogv_start_video(ALLEGRO_VIDEO *video)
 static bool ogv_set_video_playing(ALLEGRO_VIDEO *video)
 {
    OGG_VIDEO * const ogv = video->data;
-   if (ogv->reached_eof) {
+   if (is_finished(ogv)) {
       video->playing = false;
    }
    return true;
@@ -1287,11 +1989,6 @@ static bool ogv_seek_video(ALLEGRO_VIDEO *video, double seek_to)
    ALLEGRO_EVENT ev;
    int seek_counter;
 
-   /* XXX we only know how to seek to beginning */
-   if (seek_to > 0.0) {
-      return false;
-   }
-
    al_lock_mutex(ogv->mutex);
 
    seek_counter = ogv->seek_counter;
@@ -1315,26 +2012,12 @@ static bool ogv_seek_video(ALLEGRO_VIDEO *video, double seek_to)
 static bool ogv_update_video(ALLEGRO_VIDEO *video)
 {
    OGG_VIDEO *ogv = video->data;
-   int w, h;
    bool ret;
 
    al_lock_mutex(ogv->mutex);
 
-   w = ogv->buffer[0].width;
-   h = ogv->buffer[0].height;
-
-   if (w > 0 && h && h > 0 && ogv->frame_bmp) {
-      ASSERT(w == al_get_bitmap_width(ogv->frame_bmp));
-      ASSERT(h == al_get_bitmap_height(ogv->frame_bmp));
-
-      if (ogv->buffer_dirty) {
-         ret = update_frame_bmp(ogv);
-         ogv->buffer_dirty = false;
-      }
-      else {
-         ret = true;
-      }
-
+   if (ogv->have_frame && ogv->frame_bmp) {
+      ret = update_frame(ogv, true);
       video->current_frame = ogv->pic_bmp;
    }
    else {
@@ -1347,6 +2030,47 @@ static bool ogv_update_video(ALLEGRO_VIDEO *video)
    return ret;
 }
 
+static bool ogv_set_video_planar(ALLEGRO_VIDEO *video, bool planar)
+{
+   OGG_VIDEO *ogv = video->data;
+
+   if (planar && (!ogv->selected_video_stream || !init_planes(ogv)))
+      return false;
+
+   /* The mutex only exists once the video is started. */
+   if (ogv->mutex)
+      al_lock_mutex(ogv->mutex);
+   ogv->planar = planar;
+   if (ogv->mutex)
+      al_unlock_mutex(ogv->mutex);
+
+   return true;
+}
+
+static bool ogv_get_video_planes(ALLEGRO_VIDEO *video,
+   ALLEGRO_BITMAP *planes[3])
+{
+   OGG_VIDEO *ogv = video->data;
+   bool ret = false;
+   int i;
+
+   if (!ogv->mutex)
+      return false;
+
+   al_lock_mutex(ogv->mutex);
+
+   /* Only frames decoded in planar mode have planes. */
+   if (ogv->buffer_planar) {
+      ret = update_frame(ogv, false);
+      for (i = 0; i < 3; i++)
+         planes[i] = ogv->pic_plane_bmp[i];
+   }
+
+   al_unlock_mutex(ogv->mutex);
+
+   return ret;
+}
+
 static ALLEGRO_VIDEO_INTERFACE ogv_vtable = {
    ogv_open_video,
    ogv_close_video,
@@ -1354,6 +2078,8 @@ static ALLEGRO_VIDEO_INTERFACE ogv_vtable = {
    ogv_set_video_playing,
    ogv_seek_video,
    ogv_update_video,
+   ogv_set_video_planar,
+   ogv_get_video_planes,
 };
 
 ALLEGRO_VIDEO_INTERFACE *_al_video_ogv_vtable(void)
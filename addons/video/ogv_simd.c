@@ -0,0 +1,332 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Vectorised Y'CbCr to RGB conversion for the Theora video backend.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#define ALLEGRO_INTERNAL_UNSTABLE
+
+#include <string.h>
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/allegro_video.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_cpu.h"
+#include "allegro5/internal/aintern_video.h"
+
+ALLEGRO_DEBUG_CHANNEL("video")
+
+/*
+ * Each row of a decoded frame is converted with
+ *
+ *    R = (298*C         + 409*E + 128) >> 8
+ *    G = (298*C - 100*D - 208*E + 128) >> 8
+ *    B = (298*C + 516*D         + 128) >> 8
+ *
+ * where C = Y' - 16, D = Cb - 128 and E = Cr - 128, clamped to 0..255. The
+ * vector versions do the same sums in 32-bit integers, so they give exactly
+ * the same pixels as the scalar loop, which converts whatever is left over at
+ * the end of a row.
+ *
+ * The chroma planes have one sample per 1 << xshift luma samples across; for
+ * 4:2:0 video the caller passes the same chroma row for two luma rows.
+ */
+
+static unsigned char clamp(int x)
+{
+   if (x < 0)
+      return 0;
+   if (x > 255)
+      return 255;
+   return x;
+}
+
+
+static void row_generic(uint8_t *dst, const uint8_t *y, const uint8_t *cb,
+   const uint8_t *cr, int x, int width, int xshift)
+{
+   for (; x < width; x++) {
+      const int x2 = x >> xshift;
+      const int C = y[x] - 16;
+      const int D = cb[x2] - 128;
+      const int E = cr[x2] - 128;
+      uint8_t * const data = dst + x * 4;
+
+      data[0] = clamp((298*C         + 409*E + 128) >> 8);
+      data[1] = clamp((298*C - 100*D - 208*E + 128) >> 8);
+      data[2] = clamp((298*C + 516*D         + 128) >> 8);
+      data[3] = 0xff;
+   }
+}
+
+
+static void ycbcr_row_generic(uint8_t *dst, const uint8_t *y,
+   const uint8_t *cb, const uint8_t *cr, int width, int xshift)
+{
+   row_generic(dst, y, cb, cr, 0, width, xshift);
+}
+
+
+/* Reads the 4 chroma samples for 8 pixels of a 4:2:2 or 4:2:0 row. */
+static uint32_t load_chroma4(const uint8_t *p)
+{
+   uint32_t v;
+   memcpy(&v, p, 4);
+   return v;
+}
+
+
+#if defined(_AL_SIMD_X86)
+
+/* Two 16-bit multipliers for _mm_madd_epi16. */
+#define PAIR(a, b) \
+   _mm_set1_epi32((int)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+#define PAIR256(a, b) \
+   _mm256_set1_epi32((int)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+
+/* Converts 8 pixels whose Y', Cb and Cr values are in the low 8 bytes. */
+_AL_TARGET_SSE2
+static void convert8_sse2(uint8_t *dst, __m128i y, __m128i cb, __m128i cr)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i round = _mm_set1_epi32(128);
+   const __m128i c = _mm_sub_epi16(_mm_unpacklo_epi8(y, zero),
+      _mm_set1_epi16(16));
+   const __m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero),
+      _mm_set1_epi16(128));
+   const __m128i e = _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero),
+      _mm_set1_epi16(128));
+   const __m128i ce_lo = _mm_unpacklo_epi16(c, e);
+   const __m128i ce_hi = _mm_unpackhi_epi16(c, e);
+   const __m128i cd_lo = _mm_unpacklo_epi16(c, d);
+   const __m128i cd_hi = _mm_unpackhi_epi16(c, d);
+   /* Cr paired with 1 to add the rounding term along with it. */
+   const __m128i e1_lo = _mm_unpacklo_epi16(e, _mm_set1_epi16(1));
+   const __m128i e1_hi = _mm_unpackhi_epi16(e, _mm_set1_epi16(1));
+   __m128i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+   __m128i r, g, b, rg, ba;
+
+   r_lo = _mm_add_epi32(_mm_madd_epi16(ce_lo, PAIR(298, 409)), round);
+   r_hi = _mm_add_epi32(_mm_madd_epi16(ce_hi, PAIR(298, 409)), round);
+   g_lo = _mm_add_epi32(_mm_madd_epi16(cd_lo, PAIR(298, -100)),
+      _mm_madd_epi16(e1_lo, PAIR(-208, 128)));
+   g_hi = _mm_add_epi32(_mm_madd_epi16(cd_hi, PAIR(298, -100)),
+      _mm_madd_epi16(e1_hi, PAIR(-208, 128)));
+   b_lo = _mm_add_epi32(_mm_madd_epi16(cd_lo, PAIR(298, 516)), round);
+   b_hi = _mm_add_epi32(_mm_madd_epi16(cd_hi, PAIR(298, 516)), round);
+
+   /* The shifted sums fit in 16 bits; the unsigned saturation clamps. */
+   r = _mm_packs_epi32(_mm_srai_epi32(r_lo, 8), _mm_srai_epi32(r_hi, 8));
+   g = _mm_packs_epi32(_mm_srai_epi32(g_lo, 8), _mm_srai_epi32(g_hi, 8));
+   b = _mm_packs_epi32(_mm_srai_epi32(b_lo, 8), _mm_srai_epi32(b_hi, 8));
+   r = _mm_packus_epi16(r, r);
+   g = _mm_packus_epi16(g, g);
+   b = _mm_packus_epi16(b, b);
+
+   rg = _mm_unpacklo_epi8(r, g);
+   ba = _mm_unpacklo_epi8(b, _mm_set1_epi8(-1));
+   _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(rg, ba));
+   _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+
+_AL_TARGET_SSE2
+static void ycbcr_row_sse2(uint8_t *dst, const uint8_t *y,
+   const uint8_t *cb, const uint8_t *cr, int width, int xshift)
+{
+   int x;
+
+   for (x = 0; x + 8 <= width; x += 8) {
+      const __m128i yv = _mm_loadl_epi64((const __m128i *)(y + x));
+      __m128i cbv, crv;
+
+      if (xshift) {
+         cbv = _mm_cvtsi32_si128((int)load_chroma4(cb + x / 2));
+         crv = _mm_cvtsi32_si128((int)load_chroma4(cr + x / 2));
+         cbv = _mm_unpacklo_epi8(cbv, cbv);
+         crv = _mm_unpacklo_epi8(crv, crv);
+      }
+      else {
+         cbv = _mm_loadl_epi64((const __m128i *)(cb + x));
+         crv = _mm_loadl_epi64((const __m128i *)(cr + x));
+      }
+      convert8_sse2(dst + x * 4, yv, cbv, crv);
+   }
+
+   row_generic(dst, y, cb, cr, x, width, xshift);
+}
+
+
+/* Converts 16 pixels. The unpacks work within each 128-bit lane, which the
+ * packs undo, so only the final store has to put the lanes in order.
+ */
+_AL_TARGET_AVX2
+static void convert16_avx2(uint8_t *dst, __m128i y, __m128i cb, __m128i cr)
+{
+   const __m256i round = _mm256_set1_epi32(128);
+   const __m256i c = _mm256_sub_epi16(_mm256_cvtepu8_epi16(y),
+      _mm256_set1_epi16(16));
+   const __m256i d = _mm256_sub_epi16(_mm256_cvtepu8_epi16(cb),
+      _mm256_set1_epi16(128));
+   const __m256i e = _mm256_sub_epi16(_mm256_cvtepu8_epi16(cr),
+      _mm256_set1_epi16(128));
+   const __m256i ce_lo = _mm256_unpacklo_epi16(c, e);
+   const __m256i ce_hi = _mm256_unpackhi_epi16(c, e);
+   const __m256i cd_lo = _mm256_unpacklo_epi16(c, d);
+   const __m256i cd_hi = _mm256_unpackhi_epi16(c, d);
+   const __m256i e1_lo = _mm256_unpacklo_epi16(e, _mm256_set1_epi16(1));
+   const __m256i e1_hi = _mm256_unpackhi_epi16(e, _mm256_set1_epi16(1));
+   __m256i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+   __m256i r, g, b, rg, ba, lo, hi;
+
+   r_lo = _mm256_add_epi32(_mm256_madd_epi16(ce_lo, PAIR256(298, 409)), round);
+   r_hi = _mm256_add_epi32(_mm256_madd_epi16(ce_hi, PAIR256(298, 409)), round);
+   g_lo = _mm256_add_epi32(_mm256_madd_epi16(cd_lo, PAIR256(298, -100)),
+      _mm256_madd_epi16(e1_lo, PAIR256(-208, 128)));
+   g_hi = _mm256_add_epi32(_mm256_madd_epi16(cd_hi, PAIR256(298, -100)),
+      _mm256_madd_epi16(e1_hi, PAIR256(-208, 128)));
+   b_lo = _mm256_add_epi32(_mm256_madd_epi16(cd_lo, PAIR256(298, 516)), round);
+   b_hi = _mm256_add_epi32(_mm256_madd_epi16(cd_hi, PAIR256(298, 516)), round);
+
+   r = _mm256_packs_epi32(_mm256_srai_epi32(r_lo, 8),
+      _mm256_srai_epi32(r_hi, 8));
+   g = _mm256_packs_epi32(_mm256_srai_epi32(g_lo, 8),
+      _mm256_srai_epi32(g_hi, 8));
+   b = _mm256_packs_epi32(_mm256_srai_epi32(b_lo, 8),
+      _mm256_srai_epi32(b_hi, 8));
+   r = _mm256_packus_epi16(r, r);
+   g = _mm256_packus_epi16(g, g);
+   b = _mm256_packus_epi16(b, b);
+
+   rg = _mm256_unpacklo_epi8(r, g);
+   ba = _mm256_unpacklo_epi8(b, _mm256_set1_epi8(-1));
+   lo = _mm256_unpacklo_epi16(rg, ba);
+   hi = _mm256_unpackhi_epi16(rg, ba);
+   _mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+   _mm256_storeu_si256((__m256i *)(dst + 32),
+      _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+
+_AL_TARGET_AVX2
+static void ycbcr_row_avx2(uint8_t *dst, const uint8_t *y,
+   const uint8_t *cb, const uint8_t *cr, int width, int xshift)
+{
+   int x;
+
+   for (x = 0; x + 16 <= width; x += 16) {
+      const __m128i yv = _mm_loadu_si128((const __m128i *)(y + x));
+      __m128i cbv, crv;
+
+      if (xshift) {
+         cbv = _mm_loadl_epi64((const __m128i *)(cb + x / 2));
+         crv = _mm_loadl_epi64((const __m128i *)(cr + x / 2));
+         cbv = _mm_unpacklo_epi8(cbv, cbv);
+         crv = _mm_unpacklo_epi8(crv, crv);
+      }
+      else {
+         cbv = _mm_loadu_si128((const __m128i *)(cb + x));
+         crv = _mm_loadu_si128((const __m128i *)(cr + x));
+      }
+      convert16_avx2(dst + x * 4, yv, cbv, crv);
+   }
+
+   ycbcr_row_sse2(dst + x * 4, y + x, cb + (x >> xshift), cr + (x >> xshift),
+      width - x, xshift);
+}
+
+#undef PAIR
+#undef PAIR256
+
+#elif defined(_AL_SIMD_NEON)
+
+/* One colour channel of 8 pixels, (298*C + kd*D + ke*E + 128) >> 8. */
+static INLINE uint8x8_t channel_neon(int16x8_t c, int16x8_t d, int16x8_t e,
+   int16_t kd, int16_t ke)
+{
+   int32x4_t lo = vmlal_n_s16(vdupq_n_s32(128), vget_low_s16(c), 298);
+   int32x4_t hi = vmlal_n_s16(vdupq_n_s32(128), vget_high_s16(c), 298);
+
+   lo = vmlal_n_s16(lo, vget_low_s16(d), kd);
+   hi = vmlal_n_s16(hi, vget_high_s16(d), kd);
+   lo = vmlal_n_s16(lo, vget_low_s16(e), ke);
+   hi = vmlal_n_s16(hi, vget_high_s16(e), ke);
+
+   return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, 8), vshrn_n_s32(hi, 8)));
+}
+
+
+static void ycbcr_row_neon(uint8_t *dst, const uint8_t *y,
+   const uint8_t *cb, const uint8_t *cr, int width, int xshift)
+{
+   int x;
+
+   for (x = 0; x + 8 <= width; x += 8) {
+      uint8x8_t cbv, crv;
+      int16x8_t c, d, e;
+      uint8x8x4_t px;
+
+      if (xshift) {
+         cbv = vreinterpret_u8_u32(vdup_n_u32(load_chroma4(cb + x / 2)));
+         crv = vreinterpret_u8_u32(vdup_n_u32(load_chroma4(cr + x / 2)));
+         cbv = vzip_u8(cbv, cbv).val[0];
+         crv = vzip_u8(crv, crv).val[0];
+      }
+      else {
+         cbv = vld1_u8(cb + x);
+         crv = vld1_u8(cr + x);
+      }
+
+      c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + x))),
+         vdupq_n_s16(16));
+      d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(cbv)), vdupq_n_s16(128));
+      e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(crv)), vdupq_n_s16(128));
+
+      px.val[0] = channel_neon(c, d, e, 0, 409);
+      px.val[1] = channel_neon(c, d, e, -100, -208);
+      px.val[2] = channel_neon(c, d, e, 516, 0);
+      px.val[3] = vdup_n_u8(0xff);
+      vst4_u8(dst + x * 4, px);
+   }
+
+   row_generic(dst, y, cb, cr, x, width, xshift);
+}
+
+#endif
+
+
+void (*_al_ogv_ycbcr_row)(uint8_t *dst, const uint8_t *y, const uint8_t *cb,
+   const uint8_t *cr, int width, int xshift) = ycbcr_row_generic;
+
+
+void _al_ogv_init_ycbcr(void)
+{
+   int features = al_get_cpu_features();
+   (void)features;
+
+#if defined(_AL_SIMD_X86)
+   if (features & ALLEGRO_CPU_SSE2) {
+      _al_ogv_ycbcr_row = ycbcr_row_sse2;
+      if (features & ALLEGRO_CPU_AVX2)
+         _al_ogv_ycbcr_row = ycbcr_row_avx2;
+   }
+   ALLEGRO_DEBUG("Vector Y'CbCr conversion (SSE2: %d, AVX2: %d).\n",
+      (features & ALLEGRO_CPU_SSE2) != 0, (features & ALLEGRO_CPU_AVX2) != 0);
+#elif defined(_AL_SIMD_NEON)
+   if (features & ALLEGRO_CPU_NEON)
+      _al_ogv_ycbcr_row = ycbcr_row_neon;
+   ALLEGRO_DEBUG("Vector Y'CbCr conversion (NEON: %d).\n",
+      (features & ALLEGRO_CPU_NEON) != 0);
+#endif
+}
+
+/* vim: set sts=3 sw=3 et: */
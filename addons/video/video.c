@@ -38,12 +38,15 @@
  *   has to be done by the driver.
  */
  
+#define ALLEGRO_INTERNAL_UNSTABLE
+
 #include "allegro5/allegro5.h"
 #include "allegro5/allegro_video.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_video.h"
 #include "allegro5/internal/aintern_video_cfg.h"
 #include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_extmap.h"
 #include "allegro5/internal/aintern_vector.h"
 
 ALLEGRO_DEBUG_CHANNEL("video")
@@ -56,50 +59,128 @@ typedef struct VideoHandler {
    const char *extension;
    ALLEGRO_VIDEO_INTERFACE *vtable;
    ALLEGRO_VIDEO_IDENTIFIER_FUNCTION identifier;
+   int next;   /* the next handler for the same extension, or -1 */
 } VideoHandler;
 
 static _AL_VECTOR handlers = _AL_VECTOR_INITIALIZER(VideoHandler);
+static _AL_EXTMAP handler_map = _AL_EXTMAP_INITIALIZER;
 
 static const char* identify_video(ALLEGRO_FILE *f)
 {
+   int64_t pos = al_ftell(f);
+   ALLEGRO_FILE *buffered = NULL;
+   const char *ext = NULL;
+   void *base;
+   int64_t size;
    size_t i;
+
+   /* The identifiers all read the start of the file. */
+   if (pos >= 0 && !al_get_file_mapping(f, &base, &size))
+      buffered = al_fopen_buffered(f, 4096);
+
    for (i = 0; i < _al_vector_size(&handlers); i++) {
       VideoHandler *l = _al_vector_ref(&handlers, i);
-      if (l->identifier(f)) {
-         return l->extension;
+      ALLEGRO_FILE *fp = buffered ? buffered : f;
+      bool identified;
+      if (!l->identifier)
+         continue;
+      identified = l->identifier(fp);
+      al_fseek(fp, pos, ALLEGRO_SEEK_SET);
+      if (identified) {
+         ext = l->extension;
+         break;
       }
    }
-   return NULL;
+
+   if (buffered) {
+      al_fclose(buffered);
+      al_fseek(f, pos, ALLEGRO_SEEK_SET);
+   }
+   return ext;
 }
 
-static ALLEGRO_VIDEO_INTERFACE *find_handler(const char *extension)
+/* Several handlers may take the same extension, in which case they are
+ * tried in the order they were added; see al_init_video_addon. start is
+ * zero for the first one, and is updated for finding the next.
+ */
+static VideoHandler *find_handler(const char *extension, size_t *start)
 {
-   size_t i;
-   for (i = 0; i < _al_vector_size(&handlers); i++) {
-      VideoHandler *l = _al_vector_ref(&handlers, i);
-      if (0 == _al_stricmp(extension, l->extension)) {
-         return l->vtable;
-      }
+   VideoHandler *l;
+   int i;
+
+   if (*start == 0) {
+      i = _al_extmap_find(&handler_map, extension);
+   }
+   else {
+      l = _al_vector_ref(&handlers, *start - 1);
+      i = l->next;
    }
-   return NULL;
+   if (i < 0)
+      return NULL;
+
+   *start = i + 1;
+   return _al_vector_ref(&handlers, i);
 }
 
 static void add_handler(const char *extension, ALLEGRO_VIDEO_INTERFACE *vtable,
                         ALLEGRO_VIDEO_IDENTIFIER_FUNCTION identifier)
 {
-   VideoHandler *v = _al_vector_alloc_back(&handlers);
+   int index = _al_vector_size(&handlers);
+   int i = _al_extmap_find(&handler_map, extension);
+   VideoHandler *v;
+
+   if (i < 0) {
+      if (!_al_extmap_insert(&handler_map, extension, index))
+         return;
+   }
+   else {
+      VideoHandler *l = _al_vector_ref(&handlers, i);
+      while (l->next >= 0)
+         l = _al_vector_ref(&handlers, l->next);
+      l->next = index;
+   }
+
+   v = _al_vector_alloc_back(&handlers);
    v->extension = extension;
    v->vtable = vtable;
    v->identifier = identifier;
+   v->next = -1;
 }
 
+#if defined(ALLEGRO_CFG_VIDEO_HAVE_MF) || defined(ALLEGRO_CFG_VIDEO_HAVE_GSTREAMER)
+#define HAVE_HARDWARE_HANDLERS
+
+/* Registers a hardware decoding handler for the containers it is used
+ * for. Only the first extension of each container is identified, as
+ * identification gives the same handlers either way.
+ */
+static void add_container_handlers(ALLEGRO_VIDEO_INTERFACE *vtable)
+{
+   add_handler(".mp4", vtable, _al_video_identify_mp4);
+   add_handler(".m4v", vtable, NULL);
+   add_handler(".mov", vtable, NULL);
+   add_handler(".mkv", vtable, _al_video_identify_mkv);
+   add_handler(".webm", vtable, NULL);
+}
+
+static bool want_hardware_decode(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "video",
+      "hardware_decode");
+
+   return !value || _al_stricmp(value, "false") != 0;
+}
+#endif
+
 /* Function: al_open_video
  */
 ALLEGRO_VIDEO *al_open_video(char const *filename)
 {
    ALLEGRO_VIDEO *video;
+   VideoHandler *handler;
    const char *ext;
-   video = al_calloc(1, sizeof *video);
+   size_t start = 0;
+   bool opened = false;
 
    ASSERT(filename);
    ext = al_identify_video(filename);
@@ -107,22 +188,32 @@ ALLEGRO_VIDEO *al_open_video(char const *filename)
       ext = strrchr(filename, '.');
       if (!ext) {
          ALLEGRO_ERROR("Could not identify video %s!\n", filename);
+         return NULL;
       }
    }
 
-   video->vtable = find_handler(ext);
-   if (video->vtable == NULL) {
-      ALLEGRO_ERROR("No handler for video extension %s - "
-         "therefore not trying to load %s.\n", ext, filename);
-      al_free(video);
-      return NULL;
-   }
-
+   video = al_calloc(1, sizeof *video);
    video->filename = al_create_path(filename);
-   video->playing = true;
 
-   if (!video->vtable->open_video(video)) {
-      ALLEGRO_ERROR("Could not open %s.\n", filename);
+   while ((handler = find_handler(ext, &start))) {
+      video->vtable = handler->vtable;
+      video->playing = true;
+      if (video->vtable->open_video(video)) {
+         opened = true;
+         break;
+      }
+      ALLEGRO_DEBUG("Handler %u for %s could not open %s.\n",
+         (unsigned)start - 1, ext, filename);
+   }
+
+   if (!opened) {
+      if (!video->vtable) {
+         ALLEGRO_ERROR("No handler for video extension %s - "
+            "therefore not trying to load %s.\n", ext, filename);
+      }
+      else {
+         ALLEGRO_ERROR("Could not open %s.\n", filename);
+      }
       al_destroy_path(video->filename);
       al_free(video);
       return NULL;
@@ -209,6 +300,29 @@ ALLEGRO_BITMAP *al_get_video_frame(ALLEGRO_VIDEO *video)
    return video->current_frame;
 }
 
+/* Function: al_set_video_planar
+ */
+bool al_set_video_planar(ALLEGRO_VIDEO *video, bool planar)
+{
+   ASSERT(video);
+
+   if (!video->vtable->set_video_planar)
+      return !planar;
+   return video->vtable->set_video_planar(video, planar);
+}
+
+/* Function: al_get_video_frame_planes
+ */
+bool al_get_video_frame_planes(ALLEGRO_VIDEO *video, ALLEGRO_BITMAP *planes[3])
+{
+   ASSERT(video);
+   ASSERT(planes);
+
+   if (!video->vtable->get_video_planes)
+      return false;
+   return video->vtable->get_video_planes(video, planes);
+}
+
 /* Function: al_get_video_position
  */
 double al_get_video_position(ALLEGRO_VIDEO *video, ALLEGRO_VIDEO_POSITION_TYPE which)
@@ -222,6 +336,15 @@ double al_get_video_position(ALLEGRO_VIDEO *video, ALLEGRO_VIDEO_POSITION_TYPE w
    return video->position;
 }
 
+/* Function: al_get_video_dropped_frames
+ */
+uint64_t al_get_video_dropped_frames(ALLEGRO_VIDEO *video)
+{
+   ASSERT(video);
+
+   return video->dropped_frames;
+}
+
 /* Function: al_seek_video
  */
 bool al_seek_video(ALLEGRO_VIDEO *video, double pos_in_seconds)
@@ -270,7 +393,22 @@ bool al_init_video_addon(void)
    if (video_inited)
       return true;
 
+#ifdef HAVE_HARDWARE_HANDLERS
+   /* Hardware decoding handlers come first, so that software ones are
+    * only used for what they cannot open.
+    */
+   if (want_hardware_decode()) {
+#ifdef ALLEGRO_CFG_VIDEO_HAVE_MF
+      add_container_handlers(_al_video_mf_vtable());
+#endif
+#ifdef ALLEGRO_CFG_VIDEO_HAVE_GSTREAMER
+      add_container_handlers(_al_video_gstreamer_vtable());
+#endif
+   }
+#endif
+
 #ifdef ALLEGRO_CFG_VIDEO_HAVE_OGV
+   _al_ogv_init_ycbcr();
    add_handler(".ogv", _al_video_ogv_vtable(), _al_video_identify_ogv);
 #endif
 
@@ -301,6 +439,7 @@ void al_shutdown_video_addon(void)
       return;
 
    _al_vector_free(&handlers);
+   _al_extmap_free(&handler_map);
 
    video_inited = false;
 }
@@ -0,0 +1,1248 @@
+/*
+ *    Benchmark suite for Allegro.
+ *
+ *    Runs a fixed set of workloads without any interaction and writes the
+ *    median and 95th percentile of their timings as JSON, so that builds
+ *    can be compared.  Video workloads draw into an offscreen bitmap of a
+ *    display, which may be a headless one.
+ *
+ *    With --baseline, the fastest runs are also checked against the ones
+ *    stored in a configuration file, which is how the 'perf' CTest tests
+ *    work.  The fastest run is the one least disturbed by whatever else
+ *    the machine was doing.  The stored timings are scaled by a
+ *    calibration workload which does not use Allegro, so that a baseline
+ *    recorded on one machine roughly carries over to another.
+ */
+
+#define ALLEGRO_UNSTABLE
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_image.h>
+#include <allegro5/allegro_memfile.h>
+#include <allegro5/allegro_opengl.h>
+#include <allegro5/allegro_primitives.h>
+#include <allegro5/allegro_ttf.h>
+
+#define TARGET_SIZE     512
+#define SPRITE_SIZE     32
+#define IMAGE_SIZE      256
+#define MEMFILE_SIZE    (4 * 1024 * 1024)
+#define CALIBRATE_SIZE  (1024 * 1024)
+#define DEFAULT_TOLERANCE  1.5
+
+typedef void (*BenchFunc)(void *data, int ops);
+
+typedef struct {
+   char           *name;
+   char           *skipped;
+   int            ops;
+   double         min;
+   double         median;
+   double         p95;
+} BenchResult;
+
+typedef struct {
+   int            format;
+   char const     *name;
+} Format;
+
+int               runs = 20;
+char const        *output = "bench.json";
+char const        *filter = NULL;
+char const        *data_dir = "../examples/data";
+char const        *baseline = NULL;
+char const        *new_baseline = NULL;
+int               retries = 0;
+double            calibration;
+bool              quiet = false;
+bool              want_display = true;
+ALLEGRO_DISPLAY   *display;
+bool              have_audio = false;
+BenchResult       *results = NULL;
+int               num_results = 0;
+
+/* Per-workload state, set up before measuring. */
+ALLEGRO_BITMAP    *target;
+ALLEGRO_BITMAP    *source;
+ALLEGRO_BITMAP    *sprites[16];
+ALLEGRO_FONT      *font;
+ALLEGRO_EVENT_SOURCE user_source;
+ALLEGRO_EVENT_QUEUE *queue;
+void              *memfile_data;
+int64_t           memfile_size;
+char const        *memfile_ident;
+
+#define streq(a, b)  (0 == strcmp((a), (b)))
+
+static const Format formats[] = {
+   { ALLEGRO_PIXEL_FORMAT_ARGB_8888, "ARGB_8888" },
+   { ALLEGRO_PIXEL_FORMAT_RGBA_8888, "RGBA_8888" },
+   { ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, "ABGR_8888_LE" },
+   { ALLEGRO_PIXEL_FORMAT_XRGB_8888, "XRGB_8888" },
+   { ALLEGRO_PIXEL_FORMAT_RGB_888, "RGB_888" },
+   { ALLEGRO_PIXEL_FORMAT_RGB_565, "RGB_565" },
+   { ALLEGRO_PIXEL_FORMAT_RGBA_4444, "RGBA_4444" },
+   { ALLEGRO_PIXEL_FORMAT_ABGR_F32, "ABGR_F32" },
+   { ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8, "SINGLE_CHANNEL_8" }
+};
+
+#define NUM_FORMATS  (int)(sizeof(formats) / sizeof(formats[0]))
+
+static void fatal_error(char const *msg, ...)
+{
+   va_list ap;
+
+   va_start(ap, msg);
+   fprintf(stderr, "allegro_bench: ");
+   vfprintf(stderr, msg, ap);
+   fprintf(stderr, "\n");
+   va_end(ap);
+   exit(EXIT_FAILURE);
+}
+
+static char *copy_string(char const *s)
+{
+   char *copy = malloc(strlen(s) + 1);
+
+   if (!copy)
+      fatal_error("out of memory");
+   strcpy(copy, s);
+   return copy;
+}
+
+static bool wanted(char const *name)
+{
+   return !filter || strstr(name, filter);
+}
+
+static BenchResult *find_result(char const *name)
+{
+   int i;
+
+   for (i = 0; i < num_results; i++) {
+      if (streq(results[i].name, name))
+         return &results[i];
+   }
+   return NULL;
+}
+
+static BenchResult *add_result(char const *name)
+{
+   BenchResult *r;
+
+   r = realloc(results, (num_results + 1) * sizeof(BenchResult));
+   if (!r)
+      fatal_error("out of memory");
+   results = r;
+   r = &results[num_results++];
+   memset(r, 0, sizeof(*r));
+   r->name = copy_string(name);
+   return r;
+}
+
+static void skip(char const *name, char const *reason)
+{
+   if (!wanted(name) || find_result(name))
+      return;
+
+   add_result(name)->skipped = copy_string(reason);
+   if (!quiet)
+      printf("%-44s skipped: %s\n", name, reason);
+}
+
+static int compare_times(const void *a, const void *b)
+{
+   double x = *(const double *)a;
+   double y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+/* Records the minimum, median and 95th percentile of n times. If the
+ * benchmark ran before, only a faster minimum is taken from this run.
+ */
+static void record(char const *name, int ops, double *times, int n)
+{
+   BenchResult *r = find_result(name);
+
+   qsort(times, n, sizeof(double), compare_times);
+   if (r) {
+      if (!r->skipped && times[0] < r->min)
+         r->min = times[0];
+      return;
+   }
+
+   r = add_result(name);
+   r->ops = ops;
+   r->min = times[0];
+   if (n % 2)
+      r->median = times[n / 2];
+   else
+      r->median = (times[n / 2 - 1] + times[n / 2]) / 2;
+   /* Nearest rank. */
+   r->p95 = times[(int)ceil(0.95 * n) - 1];
+
+   if (!quiet) {
+      printf("%-44s median %9.4f ms  p95 %9.4f ms\n", name,
+         r->median * 1000.0, r->p95 * 1000.0);
+   }
+}
+
+/* Waits for the GPU to finish drawing into a video bitmap. */
+static void sync_bitmap(ALLEGRO_BITMAP *bmp)
+{
+   if (!bmp || (al_get_bitmap_flags(bmp) & ALLEGRO_MEMORY_BITMAP))
+      return;
+   /* Reading back a pixel waits for the GPU to finish drawing. */
+   al_lock_bitmap_region(bmp, 0, 0, 1, 1, ALLEGRO_PIXEL_FORMAT_ANY,
+      ALLEGRO_LOCK_READONLY);
+   al_unlock_bitmap(bmp);
+}
+
+/* Times runs of func doing ops operations each, after one warm-up run. */
+static void measure(char const *name, BenchFunc func, void *data, int ops,
+   ALLEGRO_BITMAP *sync)
+{
+   double *times;
+   int i;
+
+   if (!wanted(name))
+      return;
+
+   times = calloc(runs, sizeof(double));
+   if (!times)
+      fatal_error("out of memory");
+
+   func(data, ops);
+   sync_bitmap(sync);
+
+   for (i = 0; i < runs; i++) {
+      double t0 = al_get_time();
+      func(data, ops);
+      sync_bitmap(sync);
+      times[i] = al_get_time() - t0;
+   }
+
+   record(name, ops, times, runs);
+   free(times);
+}
+
+static void print_json_string(FILE *f, char const *s)
+{
+   fputc('"', f);
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         fprintf(f, "\\%c", *s);
+      else if ((unsigned char)*s < 0x20)
+         fprintf(f, "\\u%04x", *s);
+      else
+         fputc(*s, f);
+   }
+   fputc('"', f);
+}
+
+static void write_environment(FILE *f)
+{
+   uint32_t version = al_get_allegro_version();
+   ALLEGRO_SYSTEM_ID id = al_get_system_id();
+   char system[5];
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      char c = (id >> (24 - 8 * i)) & 0xff;
+      system[i] = (c >= ' ' && c <= '~') ? c : '?';
+   }
+   system[4] = '\0';
+
+   fprintf(f, "  \"environment\": {\n");
+   fprintf(f, "    \"allegro_version\": \"%d.%d.%d.%d\",\n",
+      version >> 24, (version >> 16) & 255, (version >> 8) & 255,
+      version & 255);
+   fprintf(f, "    \"system\": ");
+   print_json_string(f, system);
+   fprintf(f, ",\n    \"cpu_count\": %d,\n    \"ram_mb\": %d,\n",
+      al_get_cpu_count(), al_get_ram_size());
+   if (display) {
+      int flags = al_get_display_flags(display);
+
+      fprintf(f, "    \"display\": {\"driver\": ");
+#ifdef ALLEGRO_CFG_OPENGL
+      if (flags & ALLEGRO_OPENGL) {
+         uint32_t gl = al_get_opengl_version();
+         fprintf(f, "\"%s\", \"version\": \"%d.%d\"",
+            al_get_opengl_variant() == ALLEGRO_OPENGL_ES ? "OpenGL ES"
+            : "OpenGL", gl >> 24, (gl >> 16) & 255);
+      }
+      else
+#endif
+      {
+         fprintf(f, "\"%s\"", (flags & ALLEGRO_DIRECT3D_INTERNAL) ? "Direct3D"
+            : "unknown");
+      }
+      fprintf(f, ", \"programmable\": %s, \"format\": %d}",
+         (flags & ALLEGRO_PROGRAMMABLE_PIPELINE) ? "true" : "false",
+         al_get_display_format(display));
+   }
+   else {
+      fprintf(f, "    \"display\": null");
+   }
+   fprintf(f, ",\n    \"audio\": %s,\n    \"calibration_ms\": %.4f\n  },\n",
+      have_audio ? "true" : "false", calibration * 1000.0);
+}
+
+static void write_results(void)
+{
+   FILE *f;
+   int i;
+
+   if (streq(output, "-"))
+      f = stdout;
+   else
+      f = fopen(output, "w");
+   if (!f)
+      fatal_error("failed to write %s", output);
+
+   fprintf(f, "{\n  \"runs\": %d,\n", runs);
+   write_environment(f);
+   fprintf(f, "  \"benchmarks\": [");
+   for (i = 0; i < num_results; i++) {
+      BenchResult *r = &results[i];
+
+      fprintf(f, "%s\n    {\"name\": ", i > 0 ? "," : "");
+      print_json_string(f, r->name);
+      if (r->skipped) {
+         fprintf(f, ", \"skipped\": ");
+         print_json_string(f, r->skipped);
+      }
+      else {
+         fprintf(f, ", \"ops\": %d, \"min_ms\": %.4f, \"median_ms\": %.4f, "
+            "\"p95_ms\": %.4f", r->ops, r->min * 1000.0, r->median * 1000.0,
+            r->p95 * 1000.0);
+      }
+      fprintf(f, "}");
+
+      free(r->name);
+      free(r->skipped);
+   }
+   fprintf(f, "\n  ]\n}\n");
+   if (f != stdout) {
+      fclose(f);
+      if (!quiet)
+         printf("benchmark results written to %s\n", output);
+   }
+
+   free(results);
+   results = NULL;
+   num_results = 0;
+}
+
+/* Mixes integers through a buffer larger than most L2 caches, standing in
+ * for both arithmetic and memory speed.
+ */
+static void calibrate_work(void *data, int ops)
+{
+   uint32_t *buf = data;
+   uint32_t x = 1;
+   uint32_t j;
+   int i;
+
+   for (i = 0; i < ops; i++) {
+      for (j = 0; j < CALIBRATE_SIZE; j++) {
+         x = x * 1103515245 + 12345 + buf[(j * 7919) & (CALIBRATE_SIZE - 1)];
+         buf[j] ^= x >> 7;
+      }
+   }
+}
+
+static void calibrate(void)
+{
+   uint32_t *buf = calloc(CALIBRATE_SIZE, sizeof(uint32_t));
+   double *times = calloc(runs, sizeof(double));
+   int i;
+
+   if (!buf || !times)
+      fatal_error("out of memory");
+
+   calibrate_work(buf, 1);
+   for (i = 0; i < runs; i++) {
+      double t0 = al_get_time();
+      calibrate_work(buf, 4);
+      times[i] = al_get_time() - t0;
+   }
+   qsort(times, runs, sizeof(double), compare_times);
+   if (calibration == 0 || times[0] < calibration)
+      calibration = times[0];
+
+   free(times);
+   free(buf);
+}
+
+static double config_double(ALLEGRO_CONFIG *cfg, char const *section,
+   char const *key, double def)
+{
+   char const *value = al_get_config_value(cfg, section, key);
+   return value ? atof(value) : def;
+}
+
+/* Compares the fastest runs with the baseline, scaled by the calibration.
+ * Returns how many are slower than the tolerance of their benchmark allows.
+ * Benchmarks missing from the baseline, or skipped now, are not checked.
+ */
+static int check_baseline(void)
+{
+   ALLEGRO_CONFIG *cfg = al_load_config_file(baseline);
+   /* Keep JSON written to stdout valid. */
+   FILE *report = streq(output, "-") ? stderr : stdout;
+   double scale = 1.0;
+   double base_calibration;
+   double def_tolerance;
+   int checked = 0;
+   int failed = 0;
+   int i;
+
+   if (!cfg)
+      fatal_error("failed to read %s", baseline);
+
+   base_calibration = config_double(cfg, NULL, "calibration_ms", 0);
+   if (base_calibration > 0)
+      scale = calibration * 1000.0 / base_calibration;
+   def_tolerance = config_double(cfg, NULL, "tolerance", DEFAULT_TOLERANCE);
+
+   fprintf(report, "baseline %s, timings scaled by %.2f for this machine\n",
+      baseline, scale);
+
+   for (i = 0; i < num_results; i++) {
+      BenchResult *r = &results[i];
+      double expected, tolerance, ratio;
+
+      if (r->skipped)
+         continue;
+      expected = config_double(cfg, r->name, "min_ms", 0) * scale;
+      if (expected <= 0)
+         continue;
+      tolerance = config_double(cfg, r->name, "tolerance", def_tolerance);
+      ratio = r->min * 1000.0 / expected;
+      checked++;
+
+      if (ratio > tolerance) {
+         fprintf(report, "%-44s FAIL %5.2fx the baseline (tolerance %.2fx)\n",
+            r->name, ratio, tolerance);
+         failed++;
+      }
+      else if (!quiet) {
+         fprintf(report, "%-44s ok   %5.2fx the baseline\n", r->name, ratio);
+      }
+   }
+
+   fprintf(report, "%d of %d benchmarks within tolerance\n",
+      checked - failed, checked);
+   al_destroy_config(cfg);
+   return failed;
+}
+
+/* Stores the fastest runs in a baseline file. An existing file is updated, so
+ * that tolerances and benchmarks which did not run are kept.
+ */
+static void save_baseline(void)
+{
+   ALLEGRO_CONFIG *cfg = al_load_config_file(new_baseline);
+   char value[32];
+   int i;
+
+   if (!cfg) {
+      cfg = al_create_config();
+      al_add_config_comment(cfg, NULL,
+         "Timings for the perf tests, written by allegro_bench "
+         "--write-baseline.");
+      al_add_config_comment(cfg, NULL,
+         "Each section may set its own tolerance, the factor by which it "
+         "may get slower.");
+      snprintf(value, sizeof(value), "%.2f", DEFAULT_TOLERANCE);
+      al_set_config_value(cfg, NULL, "tolerance", value);
+   }
+
+   snprintf(value, sizeof(value), "%.4f", calibration * 1000.0);
+   al_set_config_value(cfg, NULL, "calibration_ms", value);
+
+   for (i = 0; i < num_results; i++) {
+      BenchResult *r = &results[i];
+
+      if (r->skipped)
+         continue;
+      snprintf(value, sizeof(value), "%.4f", r->min * 1000.0);
+      al_set_config_value(cfg, r->name, "min_ms", value);
+   }
+
+   if (!al_save_config_file(new_baseline, cfg))
+      fatal_error("failed to write %s", new_baseline);
+   al_destroy_config(cfg);
+   if (!quiet)
+      printf("baseline written to %s\n", new_baseline);
+}
+
+/* Fills a bitmap with a gradient and some noise, with partly transparent
+ * pixels, so that neither blending nor compression has an easy time.
+ */
+static void fill_test_pattern(ALLEGRO_BITMAP *bmp)
+{
+   ALLEGRO_LOCKED_REGION *lr;
+   int w = al_get_bitmap_width(bmp);
+   int h = al_get_bitmap_height(bmp);
+   unsigned seed = 1;
+   int x, y;
+
+   lr = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      ALLEGRO_LOCK_WRITEONLY);
+   if (!lr)
+      fatal_error("failed to lock a bitmap");
+   for (y = 0; y < h; y++) {
+      unsigned char *p = (unsigned char *)lr->data + y * lr->pitch;
+      for (x = 0; x < w; x++) {
+         seed = seed * 1103515245 + 12345;
+         p[0] = x * 255 / w;
+         p[1] = y * 255 / h;
+         p[2] = (seed >> 16) & 255;
+         p[3] = (x + y) % 64 < 48 ? 255 : 128;
+         p += 4;
+      }
+   }
+   al_unlock_bitmap(bmp);
+}
+
+static ALLEGRO_BITMAP *create_bitmap(int w, int h, int flags, int format)
+{
+   ALLEGRO_BITMAP *bmp;
+
+   al_set_new_bitmap_flags(flags);
+   al_set_new_bitmap_format(format);
+   bmp = al_create_bitmap(w, h);
+   al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   if (!bmp)
+      fatal_error("failed to create a %dx%d bitmap", w, h);
+   return bmp;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Blitting                                                                  */
+/*---------------------------------------------------------------------------*/
+
+static void blit_plain(void *data, int ops)
+{
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   for (i = 0; i < ops; i++)
+      al_draw_bitmap(source, (i * 37) % TARGET_SIZE - 64,
+         (i * 53) % TARGET_SIZE - 64, 0);
+}
+
+static void blit_scaled_rotated(void *data, int ops)
+{
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   for (i = 0; i < ops; i++)
+      al_draw_scaled_rotated_bitmap(source, IMAGE_SIZE / 2, IMAGE_SIZE / 2,
+         (i * 37) % TARGET_SIZE, (i * 53) % TARGET_SIZE, 0.75, 0.75,
+         i * 0.1, 0);
+}
+
+static void blit_tinted(void *data, int ops)
+{
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   for (i = 0; i < ops; i++)
+      al_draw_tinted_bitmap(source, al_map_rgba_f(0.5, 0.75, 1, 0.8),
+         (i * 37) % TARGET_SIZE - 64, (i * 53) % TARGET_SIZE - 64, 0);
+}
+
+static void bench_blits(char const *kind, int flags)
+{
+   char name[80];
+
+   target = create_bitmap(TARGET_SIZE, TARGET_SIZE, flags,
+      ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   source = create_bitmap(IMAGE_SIZE, IMAGE_SIZE, flags,
+      ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   fill_test_pattern(source);
+
+   al_set_target_bitmap(target);
+   al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+   snprintf(name, sizeof(name), "blit/%s/copy", kind);
+   measure(name, blit_plain, NULL, 100, target);
+
+   al_set_target_bitmap(target);
+   al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+   snprintf(name, sizeof(name), "blit/%s/alpha", kind);
+   measure(name, blit_plain, NULL, 100, target);
+
+   snprintf(name, sizeof(name), "blit/%s/tinted", kind);
+   measure(name, blit_tinted, NULL, 100, target);
+
+   snprintf(name, sizeof(name), "blit/%s/scaled_rotated", kind);
+   measure(name, blit_scaled_rotated, NULL, 100, target);
+
+   al_destroy_bitmap(source);
+   al_destroy_bitmap(target);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Held drawing                                                              */
+/*---------------------------------------------------------------------------*/
+
+static void held_sprites(void *data, int ops)
+{
+   int n = (int)(sizeof(sprites) / sizeof(sprites[0]));
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   al_hold_bitmap_drawing(true);
+   for (i = 0; i < ops; i++)
+      al_draw_bitmap(sprites[i % n], (i * 37) % TARGET_SIZE,
+         (i * 53) % TARGET_SIZE, 0);
+   al_hold_bitmap_drawing(false);
+}
+
+static void bench_held_drawing(void)
+{
+   int n = (int)(sizeof(sprites) / sizeof(sprites[0]));
+   int i;
+
+   if (!display) {
+      skip("held/sprites", "no display");
+      return;
+   }
+
+   target = create_bitmap(TARGET_SIZE, TARGET_SIZE, ALLEGRO_VIDEO_BITMAP,
+      ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   source = create_bitmap(IMAGE_SIZE, IMAGE_SIZE, ALLEGRO_VIDEO_BITMAP,
+      ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   fill_test_pattern(source);
+   for (i = 0; i < n; i++) {
+      sprites[i] = al_create_sub_bitmap(source, (i % 8) * SPRITE_SIZE,
+         (i / 8) * SPRITE_SIZE, SPRITE_SIZE, SPRITE_SIZE);
+   }
+
+   al_set_target_bitmap(target);
+   al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+   measure("held/sprites", held_sprites, NULL, 10000, target);
+
+   for (i = 0; i < n; i++)
+      al_destroy_bitmap(sprites[i]);
+   al_destroy_bitmap(source);
+   al_destroy_bitmap(target);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Primitives                                                                */
+/*---------------------------------------------------------------------------*/
+
+static void prim_filled_circles(void *data, int ops)
+{
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   for (i = 0; i < ops; i++)
+      al_draw_filled_circle((i * 37) % TARGET_SIZE, (i * 53) % TARGET_SIZE,
+         4 + i % 16, al_map_rgba_f(0.2, 0.4, 0.6, 0.5));
+}
+
+static void prim_thick_lines(void *data, int ops)
+{
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   for (i = 0; i < ops; i++)
+      al_draw_line((i * 37) % TARGET_SIZE, (i * 53) % TARGET_SIZE,
+         (i * 71) % TARGET_SIZE, (i * 29) % TARGET_SIZE,
+         al_map_rgba_f(0.6, 0.4, 0.2, 1), 3);
+}
+
+static void prim_triangles(void *data, int ops)
+{
+   ALLEGRO_VERTEX *v = data;
+
+   al_set_target_bitmap(target);
+   al_draw_prim(v, NULL, NULL, 0, ops * 3, ALLEGRO_PRIM_TRIANGLE_LIST);
+}
+
+static void bench_primitives(char const *kind, int flags)
+{
+   ALLEGRO_VERTEX *v;
+   char name[80];
+   int n = 1000;
+   int i;
+
+   v = calloc(n * 3, sizeof(ALLEGRO_VERTEX));
+   if (!v)
+      fatal_error("out of memory");
+   for (i = 0; i < n * 3; i++) {
+      v[i].x = (i * 37) % TARGET_SIZE;
+      v[i].y = (i * 53) % TARGET_SIZE;
+      v[i].color = al_map_rgba_f((i % 3) / 2.0, 0.5, 0.5, 0.75);
+   }
+
+   target = create_bitmap(TARGET_SIZE, TARGET_SIZE, flags,
+      ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   al_set_target_bitmap(target);
+   al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+
+   snprintf(name, sizeof(name), "prim/%s/filled_circles", kind);
+   measure(name, prim_filled_circles, NULL, 1000, target);
+   snprintf(name, sizeof(name), "prim/%s/thick_lines", kind);
+   measure(name, prim_thick_lines, NULL, 1000, target);
+   snprintf(name, sizeof(name), "prim/%s/triangles", kind);
+   measure(name, prim_triangles, v, n, target);
+
+   al_destroy_bitmap(target);
+   free(v);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Text                                                                      */
+/*---------------------------------------------------------------------------*/
+
+static const char *text_line =
+   "The quick brown fox jumps over the lazy dog 0123456789";
+
+static const char *text_paragraph =
+   "Pack my box with five dozen liquor jugs. How vexingly quick daft zebras "
+   "jump! The five boxing wizards jump quickly.\nSphinx of black quartz, "
+   "judge my vow. Jackdaws love my big sphinx of quartz.";
+
+static void text_draw(void *data, int ops)
+{
+   int h = al_get_font_line_height(font);
+   int i;
+   (void)data;
+
+   al_set_target_bitmap(target);
+   for (i = 0; i < ops; i++)
+      al_draw_text(font, al_map_rgb(255, 255, 255), 0,
+         (i * h) % TARGET_SIZE, 0, text_line);
+}
+
+static void text_measure(void *data, int ops)
+{
+   volatile int w = 0;
+   int i;
+   (void)data;
+
+   for (i = 0; i < ops; i++)
+      w += al_get_text_width(font, text_line);
+}
+
+static bool text_count_line(int line_num, char const *line, int size,
+   void *extra)
+{
+   (void)line_num;
+   (void)line;
+   (void)size;
+   (*(int *)extra)++;
+   return true;
+}
+
+static void text_wrap(void *data, int ops)
+{
+   int lines = 0;
+   int i;
+   (void)data;
+
+   for (i = 0; i < ops; i++)
+      al_do_multiline_text(font, 150, text_paragraph, text_count_line, &lines);
+}
+
+/* Measuring and wrapping text needs no display, only the glyph sizes. */
+static void bench_text(void)
+{
+   char path[1024];
+
+   if (display) {
+      target = create_bitmap(TARGET_SIZE, TARGET_SIZE, ALLEGRO_VIDEO_BITMAP,
+         ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+      al_set_target_bitmap(target);
+      al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+
+      font = al_create_builtin_font();
+      if (font) {
+         measure("text/builtin/draw", text_draw, NULL, 200, target);
+         al_destroy_font(font);
+      }
+      else {
+         skip("text/builtin/draw", "failed to create the builtin font");
+      }
+   }
+   else {
+      skip("text/builtin/draw", "no display");
+      skip("text/ttf/draw", "no display");
+   }
+
+   snprintf(path, sizeof(path), "%s/DejaVuSans.ttf", data_dir);
+   al_set_new_bitmap_flags(display ? ALLEGRO_VIDEO_BITMAP
+      : ALLEGRO_MEMORY_BITMAP);
+   font = al_load_ttf_font(path, 16, 0);
+   if (font) {
+      if (display) {
+         al_set_target_bitmap(target);
+         measure("text/ttf/draw", text_draw, NULL, 200, target);
+      }
+      measure("text/ttf/measure", text_measure, NULL, 1000, NULL);
+      measure("text/ttf/wrap", text_wrap, NULL, 100, NULL);
+      al_destroy_font(font);
+   }
+   else {
+      if (display)
+         skip("text/ttf/draw", "failed to load DejaVuSans.ttf");
+      skip("text/ttf/measure", "failed to load DejaVuSans.ttf");
+      skip("text/ttf/wrap", "failed to load DejaVuSans.ttf");
+   }
+   font = NULL;
+
+   if (display)
+      al_destroy_bitmap(target);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Pixel format conversion                                                   */
+/*---------------------------------------------------------------------------*/
+
+/* Locking a memory bitmap in another format converts all of it. */
+static void convert_lock(void *data, int ops)
+{
+   int format = *(int *)data;
+   int i;
+
+   for (i = 0; i < ops; i++) {
+      if (!al_lock_bitmap(source, format, ALLEGRO_LOCK_READONLY))
+         fatal_error("failed to lock a bitmap");
+      al_unlock_bitmap(source);
+   }
+}
+
+static void bench_convert(void)
+{
+   char name[80];
+   int i, j;
+
+   for (i = 0; i < NUM_FORMATS; i++) {
+      source = create_bitmap(IMAGE_SIZE, IMAGE_SIZE, ALLEGRO_MEMORY_BITMAP,
+         formats[i].format);
+      fill_test_pattern(source);
+
+      for (j = 0; j < NUM_FORMATS; j++) {
+         int format = formats[j].format;
+
+         if (i == j)
+            continue;
+         snprintf(name, sizeof(name), "convert/%s/%s", formats[i].name,
+            formats[j].name);
+         measure(name, convert_lock, &format, 40, NULL);
+      }
+
+      al_destroy_bitmap(source);
+   }
+}
+
+/*---------------------------------------------------------------------------*/
+/* Events                                                                    */
+/*---------------------------------------------------------------------------*/
+
+static void events_user(void *data, int ops)
+{
+   ALLEGRO_EVENT event;
+   int i;
+   (void)data;
+
+   for (i = 0; i < ops; i++) {
+      event.user.type = ALLEGRO_GET_EVENT_TYPE('B', 'N', 'C', 'H');
+      event.user.data1 = i;
+      al_emit_user_event(&user_source, &event, NULL);
+   }
+   while (al_get_next_event(queue, &event))
+      ;
+}
+
+static void events_interleaved(void *data, int ops)
+{
+   ALLEGRO_EVENT event;
+   int i;
+   (void)data;
+
+   for (i = 0; i < ops; i++) {
+      event.user.type = ALLEGRO_GET_EVENT_TYPE('B', 'N', 'C', 'H');
+      event.user.data1 = i;
+      al_emit_user_event(&user_source, &event, NULL);
+      al_get_next_event(queue, &event);
+   }
+}
+
+static void bench_events(void)
+{
+   queue = al_create_event_queue();
+   if (!queue)
+      fatal_error("failed to create an event queue");
+   al_init_user_event_source(&user_source);
+   al_register_event_source(queue, &user_source);
+
+   measure("events/user/burst", events_user, NULL, 10000, NULL);
+   measure("events/user/interleaved", events_interleaved, NULL, 10000,
+      NULL);
+
+   al_destroy_event_queue(queue);
+   al_destroy_user_event_source(&user_source);
+   queue = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Audio mixing                                                              */
+/*---------------------------------------------------------------------------*/
+
+static ALLEGRO_SAMPLE *create_tone(void)
+{
+   unsigned int freq = 44100;
+   float *buf = al_malloc(freq * 2 * sizeof(float));
+   unsigned int i;
+
+   if (!buf)
+      return NULL;
+   for (i = 0; i < freq; i++) {
+      buf[2 * i] = sin(i * 2 * ALLEGRO_PI * 440 / freq) * 0.1;
+      buf[2 * i + 1] = sin(i * 2 * ALLEGRO_PI * 660 / freq) * 0.1;
+   }
+   return al_create_sample(buf, freq, freq, ALLEGRO_AUDIO_DEPTH_FLOAT32,
+      ALLEGRO_CHANNEL_CONF_2, true);
+}
+
+/* Audio uses the null driver, so the voice is mixed only when asked to
+ * and as fast as it can be, one buffer of 1024 frames per operation.
+ */
+static void mix_render(void *data, int ops)
+{
+   static int16_t buf[1024 * 2];
+   ALLEGRO_VOICE *voice = data;
+   int i;
+
+   for (i = 0; i < ops; i++) {
+      if (!al_render_voice(voice, buf, 1024))
+         fatal_error("failed to render the voice");
+   }
+}
+
+static void bench_mixer(char const *name, ALLEGRO_VOICE *voice,
+   ALLEGRO_SAMPLE *sample, ALLEGRO_MIXER_QUALITY quality)
+{
+   enum { NUM_INSTANCES = 32 };
+   ALLEGRO_SAMPLE_INSTANCE *instances[NUM_INSTANCES];
+   ALLEGRO_MIXER *mixer;
+   int i;
+
+   if (!wanted(name))
+      return;
+
+   mixer = al_create_mixer(al_get_voice_frequency(voice),
+      ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+   if (!mixer || !al_set_mixer_quality(mixer, quality) ||
+         !al_attach_mixer_to_voice(mixer, voice)) {
+      if (mixer)
+         al_destroy_mixer(mixer);
+      skip(name, "failed to set up the mixer");
+      return;
+   }
+
+   for (i = 0; i < NUM_INSTANCES; i++) {
+      instances[i] = al_create_sample_instance(sample);
+      al_set_sample_instance_playmode(instances[i], ALLEGRO_PLAYMODE_LOOP);
+      /* Resample, so that the quality makes a difference. */
+      al_set_sample_instance_speed(instances[i], 0.9 + i * 0.01);
+      al_set_sample_instance_gain(instances[i], 1.0 / NUM_INSTANCES);
+      al_attach_sample_instance_to_mixer(instances[i], mixer);
+      al_play_sample_instance(instances[i]);
+   }
+
+   measure(name, mix_render, voice, 16, NULL);
+
+   al_detach_mixer(mixer);
+   for (i = 0; i < NUM_INSTANCES; i++)
+      al_destroy_sample_instance(instances[i]);
+   al_destroy_mixer(mixer);
+}
+
+static void bench_audio(void)
+{
+   static const struct {
+      ALLEGRO_MIXER_QUALITY quality;
+      char const *name;
+   } qualities[] = {
+      { ALLEGRO_MIXER_QUALITY_POINT, "audio/mix/point" },
+      { ALLEGRO_MIXER_QUALITY_LINEAR, "audio/mix/linear" },
+      { ALLEGRO_MIXER_QUALITY_CUBIC, "audio/mix/cubic" },
+      { ALLEGRO_MIXER_QUALITY_SINC, "audio/mix/sinc" }
+   };
+   int n = (int)(sizeof(qualities) / sizeof(qualities[0]));
+   ALLEGRO_VOICE *voice = NULL;
+   ALLEGRO_SAMPLE *sample = NULL;
+   int i;
+
+   if (have_audio) {
+      voice = al_create_voice(44100, ALLEGRO_AUDIO_DEPTH_INT16,
+         ALLEGRO_CHANNEL_CONF_2);
+      sample = create_tone();
+   }
+
+   for (i = 0; i < n; i++) {
+      if (!have_audio)
+         skip(qualities[i].name, "audio not available");
+      else if (!voice || !sample)
+         skip(qualities[i].name, "failed to create a voice");
+      else
+         bench_mixer(qualities[i].name, voice, sample, qualities[i].quality);
+   }
+
+   if (voice)
+      al_destroy_voice(voice);
+   if (sample)
+      al_destroy_sample(sample);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Image decoding                                                            */
+/*---------------------------------------------------------------------------*/
+
+static void image_decode(void *data, int ops)
+{
+   int i;
+   (void)data;
+
+   al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+   for (i = 0; i < ops; i++) {
+      ALLEGRO_FILE *fp = al_open_memfile(memfile_data, memfile_size, "r");
+      ALLEGRO_BITMAP *bmp = al_load_bitmap_f(fp, memfile_ident);
+
+      if (!bmp)
+         fatal_error("failed to decode %s", memfile_ident);
+      al_destroy_bitmap(bmp);
+      al_fclose(fp);
+   }
+}
+
+static void bench_images(void)
+{
+   static char const *idents[] = {
+      ".bmp", ".pcx", ".tga", ".png", ".jpg", ".webp"
+   };
+   int n = (int)(sizeof(idents) / sizeof(idents[0]));
+   char name[80];
+   int i;
+
+   memfile_data = malloc(MEMFILE_SIZE);
+   if (!memfile_data)
+      fatal_error("out of memory");
+   source = create_bitmap(IMAGE_SIZE, IMAGE_SIZE, ALLEGRO_MEMORY_BITMAP,
+      ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+   fill_test_pattern(source);
+
+   for (i = 0; i < n; i++) {
+      ALLEGRO_FILE *fp;
+      bool ok;
+
+      snprintf(name, sizeof(name), "image/decode/%s", idents[i] + 1);
+      if (!wanted(name))
+         continue;
+
+      fp = al_open_memfile(memfile_data, MEMFILE_SIZE, "w");
+      ok = al_save_bitmap_f(fp, idents[i], source);
+      memfile_size = al_ftell(fp);
+      al_fclose(fp);
+      if (!ok) {
+         skip(name, "no encoder for this format");
+         continue;
+      }
+
+      memfile_ident = idents[i];
+      measure(name, image_decode, NULL, 10, NULL);
+   }
+
+   al_destroy_bitmap(source);
+   free(memfile_data);
+   memfile_data = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void run_benchmarks(void)
+{
+   bench_blits("memory", ALLEGRO_MEMORY_BITMAP);
+   if (display) {
+      bench_blits("video", ALLEGRO_VIDEO_BITMAP);
+   }
+   else {
+      skip("blit/video/copy", "no display");
+      skip("blit/video/alpha", "no display");
+      skip("blit/video/tinted", "no display");
+      skip("blit/video/scaled_rotated", "no display");
+   }
+   bench_held_drawing();
+   bench_primitives("memory", ALLEGRO_MEMORY_BITMAP);
+   if (display) {
+      bench_primitives("video", ALLEGRO_VIDEO_BITMAP);
+   }
+   else {
+      skip("prim/video/filled_circles", "no display");
+      skip("prim/video/thick_lines", "no display");
+      skip("prim/video/triangles", "no display");
+   }
+   bench_text();
+   bench_convert();
+   bench_events();
+   bench_audio();
+   bench_images();
+}
+
+static void print_usage(void)
+{
+   printf("Usage: allegro_bench [OPTION]...\n\n"
+      "Options:\n"
+      "  -r, --runs N       time each benchmark N times (default %d)\n"
+      "  -o, --output FILE  write JSON to FILE, or - for stdout "
+         "(default %s)\n"
+      "  -f, --filter TEXT  only run benchmarks whose name contains TEXT\n"
+      "  -d, --data DIR     directory with DejaVuSans.ttf (default %s)\n"
+      "  -n, --no-display   skip the benchmarks which need a display\n"
+      "  -q, --quiet        do not print results as they come\n"
+      "  -b, --baseline FILE\n"
+      "                     fail if benchmarks are slower than in FILE\n"
+      "  -w, --write-baseline FILE\n"
+      "                     store the results in FILE, for --baseline\n"
+      "  --retries N        run up to N more times while the baseline "
+         "check fails\n",
+      runs, output, data_dir);
+}
+
+int main(int argc, char *argv[])
+{
+   int failed = 0;
+
+   argc--;
+   argv++;
+
+   if (!al_init()) {
+      fatal_error("failed to initialise Allegro");
+   }
+   al_init_image_addon();
+   al_init_font_addon();
+   al_init_ttf_addon();
+   al_init_primitives_addon();
+
+   for (; argc > 0; argc--, argv++) {
+      char const *opt = argv[0];
+      if (streq(opt, "-r") || streq(opt, "--runs")) {
+         if (argc < 2 || (runs = atoi(argv[1])) <= 0)
+            fatal_error("%s requires a positive number of runs", opt);
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "-o") || streq(opt, "--output")) {
+         if (argc < 2)
+            fatal_error("%s requires a file name", opt);
+         output = argv[1];
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "-f") || streq(opt, "--filter")) {
+         if (argc < 2)
+            fatal_error("%s requires an argument", opt);
+         filter = argv[1];
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "-d") || streq(opt, "--data")) {
+         if (argc < 2)
+            fatal_error("%s requires a directory", opt);
+         data_dir = argv[1];
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "-n") || streq(opt, "--no-display")) {
+         want_display = false;
+      }
+      else if (streq(opt, "-q") || streq(opt, "--quiet")) {
+         quiet = true;
+      }
+      else if (streq(opt, "-b") || streq(opt, "--baseline")) {
+         if (argc < 2)
+            fatal_error("%s requires a file name", opt);
+         baseline = argv[1];
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "--retries")) {
+         if (argc < 2 || (retries = atoi(argv[1])) < 0)
+            fatal_error("%s requires a number of retries", opt);
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "-w") || streq(opt, "--write-baseline")) {
+         if (argc < 2)
+            fatal_error("%s requires a file name", opt);
+         new_baseline = argv[1];
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "-h") || streq(opt, "--help")) {
+         print_usage();
+         return 0;
+      }
+      else {
+         fatal_error("unknown option %s\nSee --help for usage", opt);
+      }
+   }
+
+   /* Results to stdout would be mixed up with the progress. */
+   if (streq(output, "-"))
+      quiet = true;
+
+   if (want_display) {
+      display = al_create_display(320, 200);
+      if (!display && !quiet)
+         printf("no display, skipping the video benchmarks\n");
+   }
+
+   al_set_config_value(al_get_system_config(), "audio", "driver", "null");
+   have_audio = al_install_audio();
+
+   calibrate();
+   run_benchmarks();
+   if (baseline) {
+      /* A real slowdown shows up every time, a busy machine does not. */
+      while ((failed = check_baseline()) > 0 && retries-- > 0) {
+         if (!quiet)
+            printf("running again to see if that holds\n");
+         calibrate();
+         run_benchmarks();
+      }
+   }
+   if (new_baseline)
+      save_baseline();
+   write_results();
+
+   if (have_audio)
+      al_uninstall_audio();
+   if (display)
+      al_destroy_display(display);
+
+   return failed ? EXIT_FAILURE : 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -1,16 +1,23 @@
 set(ALLEGRO_SRC_FILES
     src/allegro.c
     src/bitmap.c
+    src/bitmap_atlas.c
+    src/bitmap_compress.c
     src/bitmap_draw.c
     src/bitmap_io.c
     src/bitmap_lock.c
     src/bitmap_pixel.c
+    src/bitmap_pool.c
     src/bitmap_type.c
     src/blenders.c
     src/clipboard.c
+    src/command_list.c
     src/config.c
+    src/config_index.c
     src/convert.c
+    src/convert_simd.c
     src/cpu.c
+    src/cpu_zone.c
     src/debug.c
     src/display.c
     src/display_settings.c
@@ -20,20 +27,30 @@ set(ALLEGRO_SRC_FILES
     src/evtsrc.c
     src/exitfunc.c
     src/file.c
+    src/file_async.c
+    src/file_buffered.c
+    src/file_mapped.c
+    src/file_pack.c
     src/file_slice.c
     src/file_stdio.c
+    src/frame_timing.c
     src/fshook.c
     src/fshook_stdio.c
+    src/fshook_walk.c
     src/fullscreen_mode.c
+    src/gpu_zone.c
     src/haptic.c
     src/inline.c
+    src/jobs.c
     src/joynu.c
     src/keybdnu.c
     src/libc.c
     src/math.c
     src/memblit.c
+    src/memblit_span.c
     src/memdraw.c
     src/memory.c
+    src/memory_pool.c
     src/monitor.c
     src/mousenu.c
     src/mouse_cursor.c
@@ -50,6 +67,7 @@ set(ALLEGRO_SRC_FILES
     src/utf8.c
     src/misc/aatree.c
     src/misc/bstrlib.c
+    src/misc/extmap.c
     src/misc/list.c
     src/misc/vector.c
     )
@@ -90,11 +108,15 @@ set(ALLEGRO_SRC_OPENGL_FILES
     src/opengl/ogl_bitmap.c
     src/opengl/ogl_display.c
     src/opengl/ogl_draw.c
+    src/opengl/ogl_egl.c
     src/opengl/ogl_fbo.c
+    src/opengl/ogl_gpu_timer.c
+    src/opengl/ogl_instances.c
     src/opengl/ogl_lock.c
     src/opengl/ogl_lock_es.c
     src/opengl/ogl_render_state.c
     src/opengl/ogl_shader.c
+    src/opengl/ogl_upload.c
     )
 
 set(ALLEGRO_SRC_WGL_FILES
@@ -122,6 +144,7 @@ set(ALLEGRO_SRC_X_FILES
     src/x/xevents.c
     src/x/xfullscreen.c
     src/x/xglx_config.c
+    src/x/xheadless.c
     src/x/xkeyboard.c
     src/x/xmousenu.c
     src/x/xrandr.c
@@ -4,6 +4,7 @@
 #  WEBP_FOUND - system has WebP.
 #  WEBP_INCLUDE_DIRS - the WebP. include directories
 #  WEBP_LIBRARIES - link these to use WebP.
+#  WEBPDEMUX_LIBRARY - link this as well to use the animation API.
 #
 # Copyright (C) 2012 Raphael Kubo da Costa <rakuco@webkit.org>
 # Copyright (C) 2013 Igalia S.L.
@@ -59,6 +60,14 @@ if (SHARPYUV_LIBRARY)
   list(APPEND WEBP_LIBRARIES ${SHARPYUV_LIBRARY})
 endif()
 
+# The animation decoder lives in its own library.
+find_library(
+    WEBPDEMUX_LIBRARY
+    NAMES webpdemux
+    HINTS ${PC_WEBP_LIBDIR} ${PC_WEBP_LIBRARY_DIRS}
+)
+mark_as_advanced(WEBPDEMUX_LIBRARY)
+
 set(WEBP_LIBRARIES ${WEBP_LIBRARIES} CACHE STRING "WebP libraries")
 mark_as_advanced(WEBP_LIBRARIES)
 
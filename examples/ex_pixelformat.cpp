@@ -51,6 +51,8 @@ const FORMAT formats[ALLEGRO_NUM_PIXEL_FORMATS] = {
    {ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1, "RGBA_DXT1"},
    {ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3, "RGBA_DXT3"},
    {ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5, "RGBA_DXT5"},
+   {ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1, "RED_RGTC1"},
+   {ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2, "RG_RGTC2"},
 };
 
 #define NUM_FORMATS ALLEGRO_NUM_PIXEL_FORMATS
@@ -206,6 +206,11 @@ AL_FUNC(void,                  al_get_opengl_texture_position,   (ALLEGRO_BITMAP
 AL_FUNC(GLuint,                al_get_opengl_program_object,     (ALLEGRO_SHADER *shader));
 AL_FUNC(void,                  al_set_current_opengl_context,    (ALLEGRO_DISPLAY *display));
 AL_FUNC(int,                   al_get_opengl_variant,            (void));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void,                  al_invalidate_opengl_state,       (void));
+AL_FUNC(int,                   al_get_opengl_fbo_pool_size,      (void));
+AL_FUNC(bool,                  al_set_opengl_fbo_pool_size,      (int size));
+#endif
 
 #ifdef __cplusplus
    }
@@ -37,7 +37,12 @@ enum {
    ALLEGRO_MIPMAP                   = 0x0100,
    _ALLEGRO_NO_PREMULTIPLIED_ALPHA  = 0x0200,	/* now a bitmap loader flag */
    ALLEGRO_VIDEO_BITMAP             = 0x0400,
-   ALLEGRO_CONVERT_BITMAP           = 0x1000
+   ALLEGRO_CONVERT_BITMAP           = 0x1000,
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+   ALLEGRO_SRGB                     = 0x2000,
+   ALLEGRO_NO_AUTO_RESOLVE          = 0x8000,
+   ALLEGRO_STREAMING_BITMAP         = 0x20000
+#endif
 };
 
 
@@ -54,6 +59,8 @@ AL_FUNC(int, al_get_new_bitmap_samples, (void));
 AL_FUNC(void, al_set_new_bitmap_samples, (int samples));
 AL_FUNC(void, al_get_new_bitmap_wrap, (ALLEGRO_BITMAP_WRAP *u, ALLEGRO_BITMAP_WRAP *v));
 AL_FUNC(void, al_set_new_bitmap_wrap, (ALLEGRO_BITMAP_WRAP u, ALLEGRO_BITMAP_WRAP v));
+AL_FUNC(void, al_get_new_bitmap_load_size, (int *w, int *h));
+AL_FUNC(void, al_set_new_bitmap_load_size, (int w, int h));
 #endif
 
 AL_FUNC(int, al_get_bitmap_width, (ALLEGRO_BITMAP *bitmap));
@@ -64,6 +71,7 @@ AL_FUNC(int, al_get_bitmap_flags, (ALLEGRO_BITMAP *bitmap));
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
 AL_FUNC(int, al_get_bitmap_depth, (ALLEGRO_BITMAP *bitmap));
 AL_FUNC(int, al_get_bitmap_samples, (ALLEGRO_BITMAP *bitmap));
+AL_FUNC(void, al_resolve_bitmap, (ALLEGRO_BITMAP *bitmap));
 #endif
 
 AL_FUNC(ALLEGRO_BITMAP*, al_create_bitmap, (int w, int h));
@@ -73,6 +81,13 @@ AL_FUNC(void, al_put_pixel, (int x, int y, ALLEGRO_COLOR color));
 AL_FUNC(void, al_put_blended_pixel, (int x, int y, ALLEGRO_COLOR color));
 AL_FUNC(ALLEGRO_COLOR, al_get_pixel, (ALLEGRO_BITMAP *bitmap, int x, int y));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_get_pixel_row, (ALLEGRO_BITMAP *bitmap, int x, int y, int n, ALLEGRO_COLOR *out));
+AL_FUNC(void, al_put_pixel_row, (int x, int y, int n, const ALLEGRO_COLOR *colors));
+AL_FUNC(void, al_get_pixel_row_u32, (ALLEGRO_BITMAP *bitmap, int x, int y, int n, uint32_t *out));
+AL_FUNC(void, al_put_pixel_row_u32, (int x, int y, int n, const uint32_t *pixels));
+#endif
+
 /* Masking */
 AL_FUNC(void, al_convert_mask_to_alpha, (ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR mask_color));
 
@@ -101,12 +116,42 @@ AL_FUNC(int, al_get_bitmap_y, (ALLEGRO_BITMAP *bitmap));
 AL_FUNC(void, al_reparent_bitmap, (ALLEGRO_BITMAP *bitmap,
    ALLEGRO_BITMAP *parent, int x, int y, int w, int h));
 
+/* Atlases */
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_ATLAS
+ */
+typedef struct ALLEGRO_ATLAS ALLEGRO_ATLAS;
+
+AL_FUNC(ALLEGRO_ATLAS *, al_create_atlas, (int page_w, int page_h));
+AL_FUNC(void, al_destroy_atlas, (ALLEGRO_ATLAS *atlas));
+AL_FUNC(ALLEGRO_BITMAP *, al_create_atlas_bitmap, (ALLEGRO_ATLAS *atlas, int w, int h));
+AL_FUNC(ALLEGRO_BITMAP *, al_add_atlas_bitmap, (ALLEGRO_ATLAS *atlas, ALLEGRO_BITMAP *bitmap));
+AL_FUNC(int, al_get_atlas_num_pages, (ALLEGRO_ATLAS *atlas));
+AL_FUNC(ALLEGRO_BITMAP *, al_get_atlas_page, (ALLEGRO_ATLAS *atlas, int index));
+#endif
+
+/* Pools */
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_BITMAP_POOL
+ */
+typedef struct ALLEGRO_BITMAP_POOL ALLEGRO_BITMAP_POOL;
+
+AL_FUNC(ALLEGRO_BITMAP_POOL *, al_create_bitmap_pool, (int max_idle));
+AL_FUNC(void, al_destroy_bitmap_pool, (ALLEGRO_BITMAP_POOL *pool));
+AL_FUNC(ALLEGRO_BITMAP *, al_create_pooled_bitmap, (ALLEGRO_BITMAP_POOL *pool, int w, int h));
+#endif
+
 /* Miscellaneous */
 AL_FUNC(ALLEGRO_BITMAP *, al_clone_bitmap, (ALLEGRO_BITMAP *bitmap));
 AL_FUNC(void, al_convert_bitmap, (ALLEGRO_BITMAP *bitmap));
 AL_FUNC(void, al_convert_memory_bitmaps, (void));
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
 AL_FUNC(void, al_backup_dirty_bitmap, (ALLEGRO_BITMAP *bitmap));
+AL_FUNC(void, al_set_bitmap_restore_callback, (ALLEGRO_BITMAP *bitmap,
+   bool (*callback)(ALLEGRO_BITMAP *bitmap, void *arg), void *arg));
+AL_FUNC(bool, al_queue_bitmap_upload, (ALLEGRO_BITMAP *bitmap));
+AL_FUNC(bool, al_is_bitmap_upload_done, (ALLEGRO_BITMAP *bitmap));
+AL_FUNC(void, al_wait_for_bitmap_upload, (ALLEGRO_BITMAP *bitmap));
 #endif
 
 #ifdef __cplusplus
@@ -34,6 +34,36 @@ AL_FUNC(void, al_draw_tinted_scaled_rotated_bitmap_region, (
    float cx, float cy, float dx, float dy, float xscale, float yscale,
    float angle, int flags));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_SPRITE_INSTANCE
+ */
+typedef struct ALLEGRO_SPRITE_INSTANCE ALLEGRO_SPRITE_INSTANCE;
+
+struct ALLEGRO_SPRITE_INSTANCE
+{
+   float sx, sy, sw, sh;
+   float cx, cy;
+   float dx, dy;
+   float xscale, yscale;
+   float angle;
+   ALLEGRO_COLOR tint;
+};
+
+AL_FUNC(void, al_draw_bitmap_instances, (ALLEGRO_BITMAP *bitmap,
+   const ALLEGRO_SPRITE_INSTANCE *instances, int num_instances, int flags));
+
+/* Type: ALLEGRO_COMMAND_LIST
+ */
+typedef struct ALLEGRO_COMMAND_LIST ALLEGRO_COMMAND_LIST;
+
+AL_FUNC(ALLEGRO_COMMAND_LIST *, al_create_command_list, (void));
+AL_FUNC(void, al_destroy_command_list, (ALLEGRO_COMMAND_LIST *list));
+AL_FUNC(void, al_clear_command_list, (ALLEGRO_COMMAND_LIST *list));
+AL_FUNC(void, al_set_target_command_list, (ALLEGRO_COMMAND_LIST *list));
+AL_FUNC(ALLEGRO_COMMAND_LIST *, al_get_target_command_list, (void));
+AL_FUNC(void, al_draw_command_list, (ALLEGRO_COMMAND_LIST *list));
+#endif
+
 
 #ifdef __cplusplus
    }
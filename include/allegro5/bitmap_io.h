@@ -2,6 +2,7 @@
 #define __al_included_allegro5_bitmap_io_h
 
 #include "allegro5/bitmap.h"
+#include "allegro5/events.h"
 #include "allegro5/file.h"
 
 #ifdef __cplusplus
@@ -17,6 +18,41 @@ enum {
    ALLEGRO_KEEP_INDEX               = 0x0800
 };
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+enum {
+   ALLEGRO_COMPRESS_TEXTURE         = 0x4000,
+   ALLEGRO_RELOAD_ON_RESTORE        = 0x10000
+};
+
+/* Enum: ALLEGRO_BITMAP_IO_EVENT_TYPE
+ */
+enum ALLEGRO_BITMAP_IO_EVENT_TYPE
+{
+   ALLEGRO_EVENT_BITMAP_LOADED      = 70,
+   ALLEGRO_EVENT_BITMAP_SAVED       = 72
+};
+
+/* Type: ALLEGRO_BITMAP_LOADER
+ */
+typedef struct ALLEGRO_BITMAP_LOADER ALLEGRO_BITMAP_LOADER;
+
+/* Type: ALLEGRO_BITMAP_INFO
+ */
+typedef struct ALLEGRO_BITMAP_INFO ALLEGRO_BITMAP_INFO;
+
+struct ALLEGRO_BITMAP_INFO
+{
+   int width;
+   int height;
+   int channels;
+   int bit_depth;
+   int frames;
+   int format;
+};
+
+typedef bool (*ALLEGRO_IIO_PROBER_FUNCTION)(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info);
+#endif
+
 typedef ALLEGRO_BITMAP *(*ALLEGRO_IIO_LOADER_FUNCTION)(const char *filename, int flags);
 typedef ALLEGRO_BITMAP *(*ALLEGRO_IIO_FS_LOADER_FUNCTION)(ALLEGRO_FILE *fp, int flags);
 typedef bool (*ALLEGRO_IIO_SAVER_FUNCTION)(const char *filename, ALLEGRO_BITMAP *bitmap);
@@ -38,6 +74,19 @@ AL_FUNC(bool, al_save_bitmap_f, (ALLEGRO_FILE *fp, const char *ident, ALLEGRO_BI
 AL_FUNC(char const *, al_identify_bitmap_f, (ALLEGRO_FILE *fp));
 AL_FUNC(char const *, al_identify_bitmap, (char const *filename));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_BITMAP_LOADER *, al_load_bitmaps_async, (const char * const *paths, int n, int flags, ALLEGRO_EVENT_QUEUE *queue));
+AL_FUNC(ALLEGRO_BITMAP *, al_get_loaded_bitmap, (ALLEGRO_BITMAP_LOADER *loader, int index));
+AL_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_bitmap_loader_event_source, (ALLEGRO_BITMAP_LOADER *loader));
+AL_FUNC(void, al_destroy_bitmap_loader, (ALLEGRO_BITMAP_LOADER *loader));
+AL_FUNC(int, al_save_bitmap_async, (const char *filename, ALLEGRO_BITMAP *bitmap, ALLEGRO_EVENT_QUEUE *queue));
+AL_FUNC(bool, al_register_bitmap_prober, (const char *ext,
+   ALLEGRO_IIO_PROBER_FUNCTION prober));
+AL_FUNC(bool, al_probe_bitmap, (const char *filename, ALLEGRO_BITMAP_INFO *info));
+AL_FUNC(bool, al_probe_bitmap_f, (ALLEGRO_FILE *fp, const char *ident,
+   ALLEGRO_BITMAP_INFO *info));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
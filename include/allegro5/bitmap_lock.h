@@ -37,6 +37,11 @@ AL_FUNC(ALLEGRO_LOCKED_REGION*, al_lock_bitmap_region_blocked, (ALLEGRO_BITMAP *
 AL_FUNC(void, al_unlock_bitmap, (ALLEGRO_BITMAP *bitmap));
 AL_FUNC(bool, al_is_bitmap_locked, (ALLEGRO_BITMAP *bitmap));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(bool, al_request_bitmap_readback, (ALLEGRO_BITMAP *bitmap, int x, int y, int width, int height, int format));
+AL_FUNC(bool, al_is_bitmap_readback_ready, (ALLEGRO_BITMAP *bitmap));
+#endif
+
 
 #ifdef __cplusplus
    }
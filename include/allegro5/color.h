@@ -53,6 +53,8 @@ typedef enum ALLEGRO_PIXEL_FORMAT
    ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1  = 28,
    ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3  = 29,
    ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5  = 30,
+   ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1  = 31,
+   ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2   = 32,
    ALLEGRO_NUM_PIXEL_FORMATS
 } ALLEGRO_PIXEL_FORMAT;
 
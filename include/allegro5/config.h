@@ -42,6 +42,11 @@ AL_FUNC(char const *, al_get_first_config_entry, (ALLEGRO_CONFIG const *config,
 	ALLEGRO_CONFIG_ENTRY **iterator));
 AL_FUNC(char const *, al_get_next_config_entry, (ALLEGRO_CONFIG_ENTRY **iterator));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_CONFIG*, al_load_config_file_indexed, (const char *filename));
+AL_FUNC(ALLEGRO_CONFIG*, al_load_config_file_indexed_f, (ALLEGRO_FILE *file));
+#endif
+
 #ifdef __cplusplus
 }
 #endif
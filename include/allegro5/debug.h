@@ -63,6 +63,17 @@ AL_FUNC(void, al_register_assert_handler, (void (*handler)(char const *expr,
 
 AL_FUNC(void, al_register_trace_handler, (void (*handler)(char const *)));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* CPU trace zones. */
+AL_FUNC(bool, al_start_cpu_trace, (void));
+AL_FUNC(void, al_stop_cpu_trace, (void));
+AL_FUNC(bool, al_save_cpu_trace, (char const *filename));
+AL_FUNC(void, al_begin_cpu_zone, (char const *name));
+AL_FUNC(void, al_end_cpu_zone, (void));
+AL_FUNC(void, al_set_cpu_zone_handler, (void (*handler)(char const *name,
+   bool begin)));
+#endif
+
 #ifdef __clang_analyzer__
    /* Clang doesn't understand _al_user_assert_handler, so we simplify the
     * definition for analysis purposes. */
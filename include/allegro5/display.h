@@ -30,6 +30,7 @@ enum {
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
    ALLEGRO_OPENGL_CORE_PROFILE         = 1 << 15,
    ALLEGRO_DRAG_AND_DROP               = 1 << 16,
+   ALLEGRO_SRGB_FRAMEBUFFER            = 1 << 17,
 #endif
 };
 
@@ -74,6 +75,7 @@ enum ALLEGRO_DISPLAY_OPTIONS {
    ALLEGRO_OPENGL_MAJOR_VERSION = 33,
    ALLEGRO_OPENGL_MINOR_VERSION = 34,
    ALLEGRO_DEFAULT_SHADER_PLATFORM = 35,
+   ALLEGRO_HELD_BITMAP_TEXTURES = 36,
    ALLEGRO_DISPLAY_OPTIONS_COUNT
 };
 
@@ -101,6 +103,47 @@ enum ALLEGRO_DISPLAY_ORIENTATION
 };
 
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Enum: ALLEGRO_DISPLAY_STAT
+ */
+enum ALLEGRO_DISPLAY_STAT
+{
+   ALLEGRO_DISPLAY_STAT_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_TEXTURE_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_FORMAT_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_FULL_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_UNHELD_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_RELEASE_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES,
+   ALLEGRO_DISPLAY_STAT_VERTICES,
+   ALLEGRO_DISPLAY_STAT_TEXTURE_BINDS,
+   ALLEGRO_DISPLAY_STAT_TARGET_CHANGES,
+   ALLEGRO_DISPLAY_STAT_SHADER_CHANGES,
+   ALLEGRO_DISPLAY_STAT_FBO_HITS,
+   ALLEGRO_DISPLAY_STAT_FBO_MISSES,
+   ALLEGRO_DISPLAY_STAT_CULLED_DRAWS,
+   ALLEGRO_DISPLAY_STAT_MULTISAMPLE_RESOLVES,
+   ALLEGRO_DISPLAY_STAT_MIPMAP_UPDATES,
+   ALLEGRO_DISPLAY_STAT_COUNT
+};
+#endif
+
+
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_FRAME_TIMING
+ */
+typedef struct ALLEGRO_FRAME_TIMING ALLEGRO_FRAME_TIMING;
+
+struct ALLEGRO_FRAME_TIMING
+{
+   double submit_time;
+   double swap_time;
+   double vsync_interval;
+   double present_time;
+};
+#endif
+
+
 /* Formally part of the primitives addon. */
 enum
 {
@@ -180,12 +223,25 @@ AL_FUNC(int, al_get_display_option, (ALLEGRO_DISPLAY *display, int option));
 /*Deferred drawing*/
 AL_FUNC(void, al_hold_bitmap_drawing, (bool hold));
 AL_FUNC(bool, al_is_bitmap_drawing_held, (void));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_hold_bitmap_drawing_sorted, (bool hold));
+#endif
 
 /* Miscellaneous */
 AL_FUNC(void, al_acknowledge_drawing_halt, (ALLEGRO_DISPLAY *display));
 AL_FUNC(void, al_acknowledge_drawing_resume, (ALLEGRO_DISPLAY *display));
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
 AL_FUNC(void, al_backup_dirty_bitmaps, (ALLEGRO_DISPLAY *display));
+AL_FUNC(int, al_get_display_buffer_age, (ALLEGRO_DISPLAY *display));
+
+AL_FUNC(bool, al_begin_gpu_zone, (const char *name));
+AL_FUNC(void, al_end_gpu_zone, (void));
+AL_FUNC(bool, al_get_gpu_zone_time, (ALLEGRO_DISPLAY *display, const char *name, double *seconds));
+
+AL_FUNC(int, al_get_display_stat, (ALLEGRO_DISPLAY *display, int stat, bool previous_frame));
+
+AL_FUNC(bool, al_get_display_frame_timing, (ALLEGRO_DISPLAY *display, int frames_ago, ALLEGRO_FRAME_TIMING *timing));
+AL_FUNC(void, al_set_display_late_latch, (ALLEGRO_DISPLAY *display, double margin));
 #endif
 
 #ifdef __cplusplus
@@ -13,6 +13,11 @@ AL_FUNC(void, al_clear_to_color, (ALLEGRO_COLOR color));
 AL_FUNC(void, al_clear_depth_buffer, (float x));
 AL_FUNC(void, al_draw_pixel, (float x, float y, ALLEGRO_COLOR color));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_clear_region_to_color, (int x, int y, int width, int height,
+   ALLEGRO_COLOR color));
+#endif
+
 
 #ifdef __cplusplus
    }
@@ -52,6 +52,10 @@ enum
    ALLEGRO_EVENT_DISPLAY_DISCONNECTED        = 61,
 
    ALLEGRO_EVENT_DROP                        = 62,
+
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+   ALLEGRO_EVENT_DISPLAY_CONFIGURATION       = 63,
+#endif
 };
 
 
@@ -257,6 +261,22 @@ AL_FUNC(intptr_t, al_get_event_source_data, (const ALLEGRO_EVENT_SOURCE*));
  */
 typedef struct ALLEGRO_EVENT_QUEUE ALLEGRO_EVENT_QUEUE;
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_EVENT_QUEUE_STATS
+ */
+typedef struct ALLEGRO_EVENT_QUEUE_STATS ALLEGRO_EVENT_QUEUE_STATS;
+
+struct ALLEGRO_EVENT_QUEUE_STATS
+{
+   int depth;
+   int max_depth;
+   int num_growths;
+   unsigned int num_events;
+   double latency_p50;
+   double latency_p99;
+};
+#endif
+
 AL_FUNC(ALLEGRO_EVENT_QUEUE*, al_create_event_queue, (void));
 AL_FUNC(void, al_destroy_event_queue, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(bool, al_is_event_source_registered, (ALLEGRO_EVENT_QUEUE *, 
@@ -279,6 +299,21 @@ AL_FUNC(bool, al_wait_for_event_until, (ALLEGRO_EVENT_QUEUE *queue,
                                         ALLEGRO_EVENT *ret_event,
                                         ALLEGRO_TIMEOUT *timeout));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_set_event_queue_coalescing, (ALLEGRO_EVENT_QUEUE*, bool));
+AL_FUNC(bool, al_get_event_queue_coalescing, (const ALLEGRO_EVENT_QUEUE*));
+AL_FUNC(int, al_get_next_events, (ALLEGRO_EVENT_QUEUE*,
+                                  ALLEGRO_EVENT *ret_events, int max));
+AL_FUNC(int, al_wait_for_events_timed, (ALLEGRO_EVENT_QUEUE*,
+                                        ALLEGRO_EVENT *ret_events, int max,
+                                        float secs));
+AL_FUNC(void, al_enable_event_queue_stats, (ALLEGRO_EVENT_QUEUE*, bool));
+AL_FUNC(bool, al_get_event_queue_stats, (ALLEGRO_EVENT_QUEUE*,
+                                         ALLEGRO_EVENT_QUEUE_STATS *ret_stats));
+AL_FUNC(void, al_reset_event_queue_stats, (ALLEGRO_EVENT_QUEUE*));
+AL_FUNC(unsigned int, al_get_event_source_event_count, (ALLEGRO_EVENT_SOURCE*));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
@@ -2,6 +2,7 @@
 #define __al_included_allegro5_file_h
 
 #include "allegro5/base.h"
+#include "allegro5/events.h"
 #include "allegro5/path.h"
 #include "allegro5/utf8.h"
 
@@ -84,10 +85,62 @@ AL_FUNC(ALLEGRO_FILE*, al_fopen_fd, (int fd, const char *mode));
 AL_FUNC(ALLEGRO_FILE*, al_make_temp_file, (const char *tmpl,
       ALLEGRO_PATH **ret_path));
 
+/* Specific to memory mapped files. */
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_FILE*, al_fopen_mapped, (const char *path));
+AL_FUNC(bool, al_get_file_mapping, (ALLEGRO_FILE *f, void **ptr,
+      int64_t *size));
+#endif
+
 /* Specific to slices. */
 AL_FUNC(ALLEGRO_FILE*, al_fopen_slice, (ALLEGRO_FILE *fp,
       size_t initial_size, const char *mode));
 
+/* Asynchronous reads. */
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Enum: ALLEGRO_FILE_EVENT_TYPE
+ */
+enum ALLEGRO_FILE_EVENT_TYPE
+{
+   ALLEGRO_EVENT_FILE_READ          = 71
+};
+
+/* Type: ALLEGRO_FILE_REQUEST
+ */
+typedef struct ALLEGRO_FILE_REQUEST ALLEGRO_FILE_REQUEST;
+
+AL_FUNC(ALLEGRO_FILE_REQUEST *, al_read_file_async, (const char *path,
+      int64_t offset, size_t size, void *buffer, ALLEGRO_EVENT_QUEUE *queue));
+AL_FUNC(ALLEGRO_FILE_REQUEST *, al_read_file_async_f, (ALLEGRO_FILE *fp,
+      int64_t offset, size_t size, void *buffer, ALLEGRO_EVENT_QUEUE *queue));
+AL_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_file_request_event_source,
+      (ALLEGRO_FILE_REQUEST *req));
+AL_FUNC(bool, al_is_file_request_done, (ALLEGRO_FILE_REQUEST *req));
+AL_FUNC(int64_t, al_wait_for_file_request, (ALLEGRO_FILE_REQUEST *req));
+AL_FUNC(void, al_destroy_file_request, (ALLEGRO_FILE_REQUEST *req));
+#endif
+
+/* Pack files. */
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_PACK
+ */
+typedef struct ALLEGRO_PACK ALLEGRO_PACK;
+
+AL_FUNC(ALLEGRO_PACK *, al_open_pack, (const char *path));
+AL_FUNC(void, al_close_pack, (ALLEGRO_PACK *pack));
+AL_FUNC(bool, al_mount_pack, (ALLEGRO_PACK *pack));
+AL_FUNC(void, al_unmount_pack, (ALLEGRO_PACK *pack));
+AL_FUNC(const void *, al_get_pack_entry_data, (ALLEGRO_PACK *pack,
+      const char *name, size_t *size));
+AL_FUNC(void, al_set_pack_file_interface, (void));
+AL_FUNC(bool, al_save_pack, (const char *filename, const char *dir));
+#endif
+
+/* Specific to buffering wrappers. */
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_FILE*, al_fopen_buffered, (ALLEGRO_FILE *fp, size_t size));
+#endif
+
 /* Thread-local state. */
 AL_FUNC(const ALLEGRO_FILE_INTERFACE *, al_get_new_file_interface, (void));
 AL_FUNC(void, al_set_new_file_interface, (const ALLEGRO_FILE_INTERFACE *
@@ -132,6 +132,32 @@ AL_FUNC(int,  al_for_each_fs_entry, (ALLEGRO_FS_ENTRY *dir,
                                      int (*callback)(ALLEGRO_FS_ENTRY *entry, void *extra),
                                      void *extra));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_FS_WALK_ENTRY
+ */
+typedef struct ALLEGRO_FS_WALK_ENTRY ALLEGRO_FS_WALK_ENTRY;
+
+struct ALLEGRO_FS_WALK_ENTRY {
+   const char *path;
+   const char *name;
+   uint32_t mode;
+   off_t size;
+   time_t mtime;
+};
+
+/* Enum: ALLEGRO_FS_WALK_FLAGS
+ */
+enum ALLEGRO_FS_WALK_FLAGS
+{
+   ALLEGRO_FS_WALK_SINGLE_THREAD = 1
+};
+
+AL_FUNC(int,  al_walk_fs_tree, (const char *path, int flags,
+                                int (*callback)(const ALLEGRO_FS_WALK_ENTRY *entries,
+                                                int count, void *extra),
+                                void *extra));
+#endif
+
 
 /* Thread-local state. */
 AL_FUNC(const ALLEGRO_FS_INTERFACE *, al_get_fs_interface, (void));
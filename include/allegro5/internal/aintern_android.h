@@ -7,6 +7,7 @@
 #include "allegro5/allegro_opengl.h"
 
 #include <jni.h>
+#include <android/asset_manager.h>
 
 typedef struct ALLEGRO_SYSTEM_ANDROID {
    ALLEGRO_SYSTEM system;
@@ -32,6 +33,8 @@ typedef struct ALLEGRO_DISPLAY_ANDROID {
 
 ALLEGRO_SYSTEM_INTERFACE *_al_system_android_interface(void);
 const ALLEGRO_FILE_INTERFACE *_al_get_apk_file_vtable(void);
+bool _al_android_get_apk_file_mapping(ALLEGRO_FILE *f, void **ptr,
+   int64_t *size);
 
 ALLEGRO_DISPLAY_INTERFACE *_al_get_android_display_driver(void);
 ALLEGRO_KEYBOARD_DRIVER *_al_get_android_keyboard_driver(void);
@@ -155,6 +158,7 @@ jclass _al_android_apk_stream_class(void);
 jclass _al_android_image_loader_class(void);
 jclass _al_android_clipboard_class(void);
 jclass _al_android_apk_fs_class(void);
+AAssetManager *_al_android_asset_manager(void);
 
 void _al_android_generate_mouse_event(unsigned int type, int x, int y,
    unsigned int button, ALLEGRO_DISPLAY *d);
@@ -164,8 +168,6 @@ void _al_android_generate_accelerometer_event(float x, float y, float z);
 void _al_android_generate_joystick_axis_event(int index, int stick, int axis, float value);
 void _al_android_generate_joystick_button_event(int index, int button, bool down);
 
-GLint _al_android_get_curr_fbo(void);
-void _al_android_set_curr_fbo(GLint fbo);
 bool _al_android_is_os_2_1(void);
 void _al_android_thread_created(void);
 void _al_android_thread_ended(void);
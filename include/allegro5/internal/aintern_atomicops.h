@@ -19,6 +19,72 @@
       return __sync_sub_and_fetch(ptr, 1);
    })
 
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_atomic_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+   #ifdef __ATOMIC_ACQUIRE
+      return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+   #else
+      _AL_ATOMIC value = *ptr;
+      __sync_synchronize();
+      return value;
+   #endif
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+   #ifdef __ATOMIC_RELEASE
+      __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+   #else
+      __sync_synchronize();
+      *ptr = value;
+   #endif
+   })
+
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_fetch_and_add, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      return __sync_fetch_and_add(ptr, value);
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC expected,
+         _AL_ATOMIC desired),
+   {
+      return __sync_bool_compare_and_swap(ptr, expected, desired);
+   })
+
+   AL_INLINE_STATIC(void *,
+      _al_atomic_load_ptr_acquire, (void *volatile *ptr),
+   {
+   #ifdef __ATOMIC_ACQUIRE
+      return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+   #else
+      void *value = *ptr;
+      __sync_synchronize();
+      return value;
+   #endif
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_ptr_release, (void *volatile *ptr, void *value),
+   {
+   #ifdef __ATOMIC_RELEASE
+      __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+   #else
+      __sync_synchronize();
+      *ptr = value;
+   #endif
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap_ptr, (void *volatile *ptr, void *expected,
+         void *desired),
+   {
+      return __sync_bool_compare_and_swap(ptr, expected, desired);
+   })
+
 #elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
    /* gcc, x86 or x86-64 */
@@ -49,9 +115,77 @@
       return old - 1;
    })
 
-#elif defined(_MSC_VER) && _M_IX86 >= 400
+   /* x86 does not reorder loads with loads or stores with stores, only the
+    * compiler has to be kept from doing so.
+    */
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_atomic_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      __asm__ __volatile__ ("" : : : "memory");
+      return value;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __asm__ __volatile__ ("" : : : "memory");
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_fetch_and_add, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      _AL_ATOMIC result;
+      __al_fetch_and_add(ptr, value, result);
+      return result;
+   })
+
+   /* Without a size suffix, cmpxchg takes the size of the register. */
+   #define __al_compare_and_swap(ptr, expected, desired, prev)                \
+      __asm__ __volatile__ (                                                  \
+         "lock; cmpxchg %2, %1"                                               \
+         : "=a" (prev), "+m" (*ptr)                                           \
+         : "r" (desired), "0" (expected)                                      \
+         : "memory"                                                           \
+      )
 
-   /* MSVC, x86 */
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC expected,
+         _AL_ATOMIC desired),
+   {
+      _AL_ATOMIC prev;
+      __al_compare_and_swap(ptr, expected, desired, prev);
+      return prev == expected;
+   })
+
+   AL_INLINE_STATIC(void *,
+      _al_atomic_load_ptr_acquire, (void *volatile *ptr),
+   {
+      void *value = *ptr;
+      __asm__ __volatile__ ("" : : : "memory");
+      return value;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_ptr_release, (void *volatile *ptr, void *value),
+   {
+      __asm__ __volatile__ ("" : : : "memory");
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap_ptr, (void *volatile *ptr, void *expected,
+         void *desired),
+   {
+      void *prev;
+      __al_compare_and_swap(ptr, expected, desired, prev);
+      return prev == expected;
+   })
+
+#elif defined(_MSC_VER) && (_M_IX86 >= 400 || defined(_M_X64))
+
+   /* MSVC, x86 or x86-64 */
    /* MinGW supports these too, but we already have asm code above. */
 
    typedef LONG _AL_ATOMIC;
@@ -68,6 +202,52 @@
       return InterlockedDecrement(ptr);
    })
 
+   /* Volatile accesses have acquire and release semantics in MSVC. */
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_atomic_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      return *ptr;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_fetch_and_add, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      return InterlockedExchangeAdd(ptr, value);
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC expected,
+         _AL_ATOMIC desired),
+   {
+      return InterlockedCompareExchange(ptr, desired, expected) == expected;
+   })
+
+   AL_INLINE_STATIC(void *,
+      _al_atomic_load_ptr_acquire, (void *volatile *ptr),
+   {
+      return *ptr;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_ptr_release, (void *volatile *ptr, void *value),
+   {
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap_ptr, (void *volatile *ptr, void *expected,
+         void *desired),
+   {
+      return InterlockedCompareExchangePointer(ptr, desired, expected) ==
+         expected;
+   })
+
 #elif defined(ALLEGRO_HAVE_OSATOMIC_H)
 
    /* OS X, GCC < 4.1
@@ -93,6 +273,57 @@
       return OSAtomicDecrement32Barrier((_AL_ATOMIC *)ptr);
    })
 
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_atomic_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      OSMemoryBarrier();
+      return value;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      OSMemoryBarrier();
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_fetch_and_add, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      return OSAtomicAdd32Barrier(value, (_AL_ATOMIC *)ptr) - value;
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC expected,
+         _AL_ATOMIC desired),
+   {
+      return OSAtomicCompareAndSwap32Barrier(expected, desired,
+         (_AL_ATOMIC *)ptr);
+   })
+
+   AL_INLINE_STATIC(void *,
+      _al_atomic_load_ptr_acquire, (void *volatile *ptr),
+   {
+      void *value = *ptr;
+      OSMemoryBarrier();
+      return value;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_ptr_release, (void *volatile *ptr, void *value),
+   {
+      OSMemoryBarrier();
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap_ptr, (void *volatile *ptr, void *expected,
+         void *desired),
+   {
+      return OSAtomicCompareAndSwapPtrBarrier(expected, desired, ptr);
+   })
+
 
 #else
 
@@ -113,6 +344,75 @@
       return --(*ptr);
    })
 
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_atomic_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      return *ptr;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(_AL_ATOMIC,
+      _al_fetch_and_add, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      _AL_ATOMIC old = *ptr;
+      *ptr = old + value;
+      return old;
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC expected,
+         _AL_ATOMIC desired),
+   {
+      if (*ptr != expected)
+         return false;
+      *ptr = desired;
+      return true;
+   })
+
+   AL_INLINE_STATIC(void *,
+      _al_atomic_load_ptr_acquire, (void *volatile *ptr),
+   {
+      return *ptr;
+   })
+
+   AL_INLINE_STATIC(void,
+      _al_atomic_store_ptr_release, (void *volatile *ptr, void *value),
+   {
+      *ptr = value;
+   })
+
+   AL_INLINE_STATIC(bool,
+      _al_compare_and_swap_ptr, (void *volatile *ptr, void *expected,
+         void *desired),
+   {
+      if (*ptr != expected)
+         return false;
+      *ptr = desired;
+      return true;
+   })
+
+#endif
+
+
+/* Tells the CPU that we are busy waiting, which saves power and lets the
+ * other hardware thread of the core run.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   #define _al_spin_pause()   __asm__ __volatile__ ("rep; nop" : : : "memory")
+#elif defined(__GNUC__) && (defined(__aarch64__) || \
+      (defined(__ARM_ARCH) && __ARM_ARCH >= 7))
+   #define _al_spin_pause()   __asm__ __volatile__ ("yield" : : : "memory")
+#elif defined(_MSC_VER)
+   #define _al_spin_pause()   YieldProcessor()
+#elif defined(__GNUC__)
+   #define _al_spin_pause()   __asm__ __volatile__ ("" : : : "memory")
+#else
+   #define _al_spin_pause()   ((void)0)
 #endif
 
 #endif
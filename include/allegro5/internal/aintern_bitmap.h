@@ -14,6 +14,15 @@ extern "C" {
 #endif
 
 typedef struct ALLEGRO_BITMAP_INTERFACE ALLEGRO_BITMAP_INTERFACE;
+struct ALLEGRO_TRANSFORMED_QUAD;
+
+/* More dirty regions than this are merged into their bounding box. */
+#define _AL_MAX_DIRTY_RECTS 8
+
+typedef struct _AL_DIRTY_RECT
+{
+   int x, y, w, h;
+} _AL_DIRTY_RECT;
 
 struct ALLEGRO_BITMAP
 {
@@ -83,6 +92,8 @@ struct ALLEGRO_BITMAP
    ALLEGRO_TRANSFORM transform;
    ALLEGRO_TRANSFORM inverse_transform;
    bool              inverse_transform_dirty;
+   /* One of the _AL_TRANSFORM_* classes of transform, computed lazily. */
+   int               transform_kind;
    ALLEGRO_TRANSFORM proj_transform;
 
    /* Blender for this bitmap (if not set, use TLS) */
@@ -107,8 +118,30 @@ struct ALLEGRO_BITMAP
 
    _AL_LIST_ITEM *dtor_item;
 
+   /* The pool al_destroy_bitmap returns this bitmap to, or NULL. */
+   ALLEGRO_BITMAP_POOL *pool;
+
+   /* The display a background upload of this memory bitmap is queued on,
+    * see al_queue_bitmap_upload, or NULL.
+    */
+   ALLEGRO_DISPLAY *upload_display;
+
    /* set_target_bitmap and lock_bitmap mark bitmaps as dirty for preservation */
    bool dirty;
+   /* The regions modified since the last backup, see _al_mark_bitmap_dirty.
+    * While dirty is set, no regions means the whole bitmap.
+    */
+   int num_dirty_rects;
+   _AL_DIRTY_RECT dirty_rects[_AL_MAX_DIRTY_RECTS];
+
+   /* Set by al_set_bitmap_restore_callback. Lost textures of bitmaps with
+    * a callback are refilled by it instead of from the memory copy, which
+    * backends then need not keep. restore_arg_dtor frees restore_arg if
+    * it is owned by Allegro, as for ALLEGRO_RELOAD_ON_RESTORE.
+    */
+   bool (*restore)(ALLEGRO_BITMAP *bitmap, void *arg);
+   void *restore_arg;
+   void (*restore_arg_dtor)(void *arg);
 };
 
 struct ALLEGRO_BITMAP_INTERFACE
@@ -139,11 +172,49 @@ struct ALLEGRO_BITMAP_INTERFACE
 
    void (*unlock_compressed_region)(ALLEGRO_BITMAP *bitmap);
 
+   /* Replaces the texture with num_levels mipmap levels of compressed
+    * blocks, stored one after the other with rows top to bottom. May modify
+    * the data. Returns false if the bitmap can't take them. Optional.
+    */
+   bool (*upload_compressed_levels)(ALLEGRO_BITMAP *bitmap, int num_levels,
+      void *data);
+
    /* Used to update any dangling pointers the bitmap driver might keep. */
    void (*bitmap_pointer_changed)(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *old);
 
    /* Back up texture to system RAM */
    void (*backup_dirty_bitmap)(ALLEGRO_BITMAP *bitmap);
+
+   /* Start an asynchronous read of a region which a later read lock of the
+    * same region and format completes. Optional.
+    */
+   bool (*request_readback)(ALLEGRO_BITMAP *bitmap,
+      int x, int y, int w, int h, int format);
+   bool (*is_readback_ready)(ALLEGRO_BITMAP *bitmap);
+
+   /* Draws all instances with a single call if the driver can, otherwise
+    * returns false without drawing anything. Optional.
+    */
+   bool (*draw_bitmap_instances)(ALLEGRO_BITMAP *bitmap,
+      const struct ALLEGRO_SPRITE_INSTANCE *instances, int num_instances,
+      int flags);
+
+   /* Draws quads recorded by a command list while drawing is held, or
+    * returns false without drawing anything. Optional.
+    */
+   bool (*draw_transformed_quads)(ALLEGRO_BITMAP *bitmap,
+      const struct ALLEGRO_TRANSFORMED_QUAD *quads, int num_quads);
+
+   /* Copies all of src, which has the same size, format and display, into
+    * the bitmap without going through system memory. Returns false without
+    * copying anything if the driver can't. Optional.
+    */
+   bool (*copy_bitmap)(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *src);
+
+   /* Makes drawing into a multisampled bitmap visible in its texture.
+    * Optional.
+    */
+   void (*resolve)(ALLEGRO_BITMAP *bitmap);
 };
 
 ALLEGRO_BITMAP *_al_create_bitmap_params(ALLEGRO_DISPLAY *current_display,
@@ -152,17 +223,32 @@ ALLEGRO_BITMAP *_al_create_bitmap_params(ALLEGRO_DISPLAY *current_display,
 AL_FUNC(ALLEGRO_DISPLAY*, _al_get_bitmap_display, (ALLEGRO_BITMAP *bitmap));
 AL_FUNC(void, _al_get_bitmap_wrap, (ALLEGRO_BITMAP *bitmap,
    ALLEGRO_BITMAP_WRAP *wrap_u, ALLEGRO_BITMAP_WRAP *wrap_v));
+bool _al_release_pooled_bitmap(ALLEGRO_BITMAP *bitmap);
+AL_FUNC(bool, _al_upload_compressed_bitmap_levels, (ALLEGRO_BITMAP *bitmap,
+   int num_levels, void *data));
+
+/* An unscaled region of a bitmap and where to draw it, e.g. a glyph. */
+typedef struct ALLEGRO_BITMAP_REGION
+{
+   float sx, sy, sw, sh;
+   float dx, dy;
+} ALLEGRO_BITMAP_REGION;
+
+AL_FUNC(void, _al_draw_bitmap_regions, (ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_COLOR tint, const ALLEGRO_BITMAP_REGION *regions,
+   int num_regions));
 
 extern void (*_al_convert_funcs[ALLEGRO_NUM_PIXEL_FORMATS]
    [ALLEGRO_NUM_PIXEL_FORMATS])(const void *, int, void *, int,
    int, int, int, int, int, int);
+void _al_init_convert_simd(void);
 
 /* Bitmap conversion */
-void _al_convert_bitmap_data(
+AL_FUNC(void, _al_convert_bitmap_data, (
 	const void *src, int src_format, int src_pitch,
 	void *dst, int dst_format, int dst_pitch,
 	int sx, int sy, int dx, int dy,
-	int width, int height);
+	int width, int height));
 
 void _al_copy_bitmap_data(
    const void *src, int src_pitch, void *dst, int dst_pitch,
@@ -173,14 +259,37 @@ void _al_copy_bitmap_data(
 void _al_init_convert_bitmap_list(void);
 void _al_register_convert_bitmap(ALLEGRO_BITMAP *bitmap);
 void _al_unregister_convert_bitmap(ALLEGRO_BITMAP *bitmap);
+void _al_adopt_bitmap(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *clone);
 void _al_convert_to_display_bitmap(ALLEGRO_BITMAP *bitmap);
 void _al_convert_to_memory_bitmap(ALLEGRO_BITMAP *bitmap);
 
 /* Simple bitmap drawing */
 void _al_put_pixel(ALLEGRO_BITMAP *bitmap, int x, int y, ALLEGRO_COLOR color);
 
+/* Dirty regions */
+void _al_mark_bitmap_dirty(ALLEGRO_BITMAP *bitmap, int x, int y, int w, int h);
+void _al_mark_bitmap_all_dirty(ALLEGRO_BITMAP *bitmap);
+
+/* Restoring lost textures */
+void _al_set_bitmap_restore(ALLEGRO_BITMAP *bitmap,
+   bool (*restore)(ALLEGRO_BITMAP *bitmap, void *arg), void *arg,
+   void (*arg_dtor)(void *arg));
+/* Calls the restore callbacks of the display's bitmaps, after all their
+ * textures have been recreated.
+ */
+void _al_restore_display_bitmaps(ALLEGRO_DISPLAY *display);
+
 /* Bitmap I/O */
 void _al_init_iio_table(void);
+/* Starts encoding saves of al_save_bitmap_async whose readback completed,
+ * out of those of bitmap or else of the bitmaps of display. With wait
+ * they are started even if that has to wait for the readback.
+ */
+void _al_update_bitmap_saves(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap,
+   bool wait);
+/* A quick check without locking whether any save waits for a readback. */
+bool _al_has_bitmap_saves(void);
+ALLEGRO_BITMAP *_al_compress_loaded_bitmap(ALLEGRO_BITMAP *bmp, int flags);
 
 
 int _al_get_bitmap_memory_format(ALLEGRO_BITMAP *bitmap);
@@ -245,6 +245,27 @@ void _al_blend_inline(
 void _al_blend_memory(ALLEGRO_COLOR *src_color, ALLEGRO_BITMAP *dest,
    int dx, int dy, ALLEGRO_COLOR *result);
 
+typedef struct _AL_BLENDER _AL_BLENDER;
+
+/* Blends n source colours into dst, in place. */
+typedef void (*_AL_BLEND_SPAN_FUNC)(const _AL_BLENDER *blender,
+   const ALLEGRO_COLOR *src, ALLEGRO_COLOR *dst, int n);
+
+/* The current blender, looked up once for a span or a whole primitive
+ * instead of for every pixel.
+ */
+struct _AL_BLENDER
+{
+   int op, src_mode, dst_mode;
+   int op_alpha, src_alpha, dst_alpha;
+   ALLEGRO_COLOR const_color;
+   _AL_BLEND_SPAN_FUNC blend_span;
+};
+
+AL_FUNC(void, _al_get_blender, (_AL_BLENDER *blender));
+AL_FUNC(void, _al_blend_span_memory, (const _AL_BLENDER *blender,
+   const ALLEGRO_COLOR *src, ALLEGRO_BITMAP *dest, int dx, int dy, int n));
+
 
 #ifdef __cplusplus
    }
@@ -0,0 +1,43 @@
+#ifndef __al_included_allegro5_aintern_command_list_h
+#define __al_included_allegro5_aintern_command_list_h
+
+#include "allegro5/bitmap_draw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A bitmap region with its corners already transformed into target
+ * coordinates. The corners are top-left, top-right, bottom-right and
+ * bottom-left of the source region, which is in the parent bitmap.
+ */
+typedef struct ALLEGRO_TRANSFORMED_QUAD
+{
+   float x[4], y[4];
+   float sx, sy, sw, sh;
+   ALLEGRO_COLOR tint;
+} ALLEGRO_TRANSFORMED_QUAD;
+
+void _al_command_list_add_bitmap(ALLEGRO_COMMAND_LIST *list,
+   ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR tint,
+   float sx, float sy, float sw, float sh);
+const ALLEGRO_TRANSFORM *_al_get_command_list_transform(
+   ALLEGRO_COMMAND_LIST *list);
+void _al_set_command_list_transform(ALLEGRO_COMMAND_LIST *list,
+   const ALLEGRO_TRANSFORM *trans);
+
+/* Records a call to replay(data) made with the recorded blender, the
+ * identity transform and bitmap drawing not held. The list takes ownership
+ * of data and passes it to destroy when it is cleared.
+ */
+AL_FUNC(void, _al_command_list_add_callback, (ALLEGRO_COMMAND_LIST *list,
+   void (*replay)(void *data), void (*destroy)(void *data), void *data));
+
+void _al_draw_transformed_quads(ALLEGRO_BITMAP *bitmap,
+   const ALLEGRO_TRANSFORMED_QUAD *quads, int num_quads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,12 +18,35 @@ struct ALLEGRO_CONFIG_SECTION {
    ALLEGRO_CONFIG_SECTION *prev, *next;
 };
 
+typedef struct _AL_CONFIG_INDEX _AL_CONFIG_INDEX;
+
 struct ALLEGRO_CONFIG {
    ALLEGRO_CONFIG_SECTION *head;
    ALLEGRO_CONFIG_SECTION *last;
    _AL_AATREE *tree;
+   _AL_CONFIG_INDEX *index;   /* replaces the above until modified */
 };
 
+typedef enum _AL_CONFIG_LINE_TYPE {
+   _AL_CONFIG_LINE_COMMENT,
+   _AL_CONFIG_LINE_SECTION,
+   _AL_CONFIG_LINE_KEY
+} _AL_CONFIG_LINE_TYPE;
+
+typedef struct _AL_CONFIG_LINE {
+   _AL_CONFIG_LINE_TYPE type;
+   const char *str;     /* comment, section name or key */
+   size_t len;          /* not NUL terminated */
+   const char *value;
+} _AL_CONFIG_LINE;
+
+_AL_CONFIG_INDEX *_al_config_index_load(ALLEGRO_FILE *file);
+const char *_al_config_index_get(const _AL_CONFIG_INDEX *idx,
+   const char *section, const char *key);
+bool _al_config_index_read_line(const _AL_CONFIG_INDEX *idx, size_t *pos,
+   _AL_CONFIG_LINE *line);
+void _al_config_index_destroy(_AL_CONFIG_INDEX *idx);
+
 
 #endif
 
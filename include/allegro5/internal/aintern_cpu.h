@@ -0,0 +1,30 @@
+#ifndef __al_included_allegro5_aintern_cpu_h
+#define __al_included_allegro5_aintern_cpu_h
+
+/* For the vector kernels, which are chosen at run time with
+ * al_get_cpu_features. With GCC and Clang each x86 kernel is tagged with
+ * the instruction set it uses, so it can be compiled without raising the
+ * target of the whole file. MSVC needs no tag.
+ */
+#if defined(ALLEGRO_LITTLE_ENDIAN) && defined(__GNUC__) && \
+   (defined(__i386__) || defined(__x86_64__))
+   #define _AL_SIMD_X86
+   #define _AL_TARGET_SSE2 __attribute__((target("sse2")))
+   #define _AL_TARGET_SSSE3 __attribute__((target("ssse3")))
+   #define _AL_TARGET_AVX2 __attribute__((target("avx2")))
+   #include <immintrin.h>
+#elif defined(ALLEGRO_LITTLE_ENDIAN) && defined(_MSC_VER) && \
+   (defined(_M_IX86) || defined(_M_X64))
+   #define _AL_SIMD_X86
+   #define _AL_TARGET_SSE2
+   #define _AL_TARGET_SSSE3
+   #define _AL_TARGET_AVX2
+   #include <immintrin.h>
+#elif defined(ALLEGRO_LITTLE_ENDIAN) && defined(__ARM_NEON)
+   #define _AL_SIMD_NEON
+   #include <arm_neon.h>
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -9,6 +9,18 @@
 void _al_configure_logging(void);
 void _al_shutdown_logging(void);
 
+/* Zones around Allegro's own hot paths, see cpu_zone.c. While no trace is
+ * being recorded they cost a load and a branch.
+ */
+AL_VAR(volatile int, _al_cpu_trace_enabled);
+AL_FUNC(void, _al_begin_cpu_zone, (char const *name));
+AL_FUNC(void, _al_end_cpu_zone, (void));
+
+#define _AL_BEGIN_CPU_ZONE(name) \
+   do { if (_al_cpu_trace_enabled) _al_begin_cpu_zone(name); } while (0)
+#define _AL_END_CPU_ZONE() \
+   do { if (_al_cpu_trace_enabled) _al_end_cpu_zone(); } while (0)
+
 
 #ifdef __cplusplus
 }
@@ -30,8 +30,32 @@ typedef struct ALLEGRO_BITMAP_EXTRA_D3D
    IDirect3DSurface9 *render_target;
 
    bool dirty;
+
+   /* The current lock reads from a readback staging surface. */
+   bool locked_readback;
 } ALLEGRO_BITMAP_EXTRA_D3D;
 
+/* Number of readbacks which can be in flight per display. */
+#define _AL_D3D_READBACK_RING 4
+
+/* One al_request_bitmap_readback slot. The region is copied into a render
+ * target on the GPU and the query marks when that copy has finished; only
+ * then is it fetched into the system memory surface, which does not stall.
+ */
+typedef struct ALLEGRO_D3D_READBACK
+{
+   LPDIRECT3DSURFACE9 copy;
+   LPDIRECT3DSURFACE9 staging;
+   IDirect3DQuery9 *query;
+   UINT surface_w;
+   UINT surface_h;
+   D3DFORMAT surface_format;
+
+   ALLEGRO_BITMAP *bitmap; /* NULL if the slot is free. */
+   int x, y, w, h;
+   int format;
+} ALLEGRO_D3D_READBACK;
+
 typedef struct ALLEGRO_DISPLAY_D3D
 {
    ALLEGRO_DISPLAY_WIN win_display; /* This must be the first member. */
@@ -75,6 +99,18 @@ typedef struct ALLEGRO_DISPLAY_D3D
 
    RECT scissor_state;
 
+   /* Dynamic vertex buffer the held drawing vertex cache is streamed into.
+    * It is filled front to back and discarded when full, so the GPU can
+    * keep reading the batches before the current one.
+    */
+   IDirect3DVertexBuffer9 *vertex_buffer;
+   UINT vertex_buffer_size;
+   UINT vertex_buffer_pos;
+
+   /* Asynchronous readbacks, used round robin. */
+   ALLEGRO_D3D_READBACK readbacks[_AL_D3D_READBACK_RING];
+   int next_readback;
+
 #ifdef ALLEGRO_CFG_SHADER_HLSL
    LPD3DXEFFECT effect;
 #endif
@@ -13,6 +13,13 @@ extern "C" {
 
 typedef struct ALLEGRO_DISPLAY_INTERFACE ALLEGRO_DISPLAY_INTERFACE;
 
+/* Laid out like ALLEGRO_VERTEX of the primitives addon. */
+typedef struct _AL_PRIM_VERTEX {
+   float x, y, z;
+   float u, v;
+   ALLEGRO_COLOR color;
+} _AL_PRIM_VERTEX;
+
 struct ALLEGRO_DISPLAY_INTERFACE
 {
    int id;
@@ -84,6 +91,45 @@ struct ALLEGRO_DISPLAY_INTERFACE
 
    /* Issue #725 */
    void (*apply_window_constraints)(ALLEGRO_DISPLAY *display, bool onoff);
+
+   /* Background bitmap uploads, see al_queue_bitmap_upload. The upload
+    * context is a context sharing resources with the display's, made
+    * current on the upload thread.
+    */
+   bool (*queue_bitmap_upload)(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
+   bool (*finish_bitmap_upload)(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap, bool wait);
+   void (*cancel_bitmap_upload)(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
+   bool (*create_upload_context)(ALLEGRO_DISPLAY *display);
+   bool (*set_upload_context_current)(ALLEGRO_DISPLAY *display, bool current);
+   void (*destroy_upload_context)(ALLEGRO_DISPLAY *display);
+
+   /* GPU timer queries, see al_begin_gpu_zone. get_gpu_timer_result must
+    * not wait; it returns false while the result is pending and sets a
+    * negative time if the measurement turned out to be unreliable.
+    */
+   void *(*create_gpu_timer)(ALLEGRO_DISPLAY *display);
+   void (*begin_gpu_timer)(ALLEGRO_DISPLAY *display, void *timer);
+   void (*end_gpu_timer)(ALLEGRO_DISPLAY *display, void *timer);
+   bool (*get_gpu_timer_result)(ALLEGRO_DISPLAY *display, void *timer, double *seconds);
+   void (*destroy_gpu_timer)(ALLEGRO_DISPLAY *display, void *timer);
+
+   /* Time of the most recent vertical retrace, in al_get_time time, and
+    * the refresh interval. Returns false if unknown. Optional.
+    */
+   bool (*get_vsync_timing)(ALLEGRO_DISPLAY *display, double *last_vsync,
+      double *interval);
+
+   /* Age of the back buffer in frames, 0 if unknown. The current context
+    * is the display's. Optional.
+    */
+   int (*get_buffer_age)(ALLEGRO_DISPLAY *display);
+
+   /* Adds a list of triangles, in target coordinates and with texture
+    * coordinates in pixels, to the held drawing batch. The texture may be
+    * NULL. Returns false if they can't join the batch. Optional.
+    */
+   bool (*draw_held_triangles)(ALLEGRO_DISPLAY *display,
+      ALLEGRO_BITMAP *texture, const _AL_PRIM_VERTEX *vtxs, int num_vtx);
 };
 
 
@@ -121,6 +167,24 @@ typedef struct
    int index, score;
 } ALLEGRO_EXTRA_DISPLAY_SETTINGS;
 
+/* Upper limit for ALLEGRO_DISPLAY_STAT_COUNT, which addons may not see. */
+#define _ALLEGRO_MAX_DISPLAY_STATS 16
+
+/* Number of frames al_get_display_frame_timing can look back. */
+#define _AL_FRAME_TIMING_HISTORY 8
+
+/* The fields of ALLEGRO_FRAME_TIMING, which addons may not see. */
+typedef struct _AL_FRAME_TIMING
+{
+   double submit_time;
+   double swap_time;
+   double vsync_interval;
+   double present_time;
+} _AL_FRAME_TIMING;
+
+/* Upper limit for ALLEGRO_HELD_BITMAP_TEXTURES. */
+#define _ALLEGRO_MAX_HELD_TEXTURES 16
+
 struct ALLEGRO_DISPLAY
 {
    /* Must be first, so the display can be used as event source. */
@@ -145,10 +209,19 @@ struct ALLEGRO_DISPLAY
    int vertex_cache_size;
    void* vertex_cache;
    uintptr_t cache_texture;
+   /* Held bitmap draws are buffered in sorted_draws until drawing is
+    * released, see al_hold_bitmap_drawing_sorted.
+    */
+   bool cache_sorted;
+   _AL_VECTOR sorted_draws;
 
    ALLEGRO_BLENDER cur_blender;
 
    ALLEGRO_SHADER* default_shader;
+   /* Created on first use by drivers drawing al_draw_bitmap_instances with
+    * instancing.
+    */
+   ALLEGRO_SHADER* instance_shader;
 
    ALLEGRO_TRANSFORM projview_transform;
 
@@ -159,6 +232,23 @@ struct ALLEGRO_DISPLAY
 
    /* Issue #725 */
    bool use_constraints;
+
+   /* Counters for the frame being drawn and the one before it, indexed by
+    * ALLEGRO_DISPLAY_STAT. Advanced by al_flip_display.
+    */
+   int stats[_ALLEGRO_MAX_DISPLAY_STATS];
+   int last_stats[_ALLEGRO_MAX_DISPLAY_STATS];
+
+   /* GPU timer zones and the timers measuring them, see gpu_zone.c. */
+   _AL_VECTOR gpu_zones;
+   _AL_VECTOR gpu_timers;
+   int open_gpu_timer;
+
+   /* The last presented frames, see frame_timing.c. */
+   _AL_FRAME_TIMING frame_timings[_AL_FRAME_TIMING_HISTORY];
+   int num_frame_timings;
+   double present_start_time;
+   double late_latch;
 };
 
 int  _al_score_display_settings(ALLEGRO_EXTRA_DISPLAY_SETTINGS *eds, ALLEGRO_EXTRA_DISPLAY_SETTINGS *ref);
@@ -180,6 +270,29 @@ AL_FUNC(void, _al_remove_display_invalidated_callback, (ALLEGRO_DISPLAY *display
 AL_FUNC(void, _al_remove_display_validated_callback, (ALLEGRO_DISPLAY *display,
    void (*display_validated)(ALLEGRO_DISPLAY*)));
 
+/* Submits the vertex cache, counting the flush under the given
+ * ALLEGRO_DISPLAY_STAT_*_FLUSHES reason.
+ */
+AL_FUNC(void, _al_flush_vertex_cache, (ALLEGRO_DISPLAY *display, int reason));
+
+/* Defined in bitmap_draw.c */
+void _al_init_sorted_draws(ALLEGRO_DISPLAY *display);
+void _al_destroy_sorted_draws(ALLEGRO_DISPLAY *display);
+void _al_draw_sorted_bitmaps(ALLEGRO_DISPLAY *display);
+
+/* This is called from the primitives addon. */
+AL_FUNC(bool, _al_draw_held_triangles, (ALLEGRO_BITMAP *texture,
+   const _AL_PRIM_VERTEX *vtxs, int num_vtx));
+
+/* Defined in gpu_zone.c */
+void _al_init_gpu_zones(ALLEGRO_DISPLAY *display);
+void _al_destroy_gpu_zones(ALLEGRO_DISPLAY *display);
+
+/* Defined in frame_timing.c */
+void _al_init_frame_timing(ALLEGRO_DISPLAY *display);
+void _al_begin_frame_present(ALLEGRO_DISPLAY *display);
+void _al_end_frame_present(ALLEGRO_DISPLAY *display);
+
 /* Defined in tls.c */
 bool _al_set_current_display_only(ALLEGRO_DISPLAY *display);
 void _al_set_new_display_settings(ALLEGRO_EXTRA_DISPLAY_SETTINGS *settings);
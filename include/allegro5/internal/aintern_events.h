@@ -2,6 +2,7 @@
 #define __al_included_allegro5_aintern_events_h
 
 #include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_vector.h"
 
 #ifdef __cplusplus
@@ -16,16 +17,21 @@ struct ALLEGRO_EVENT_SOURCE_REAL
    _AL_MUTEX mutex;
    _AL_VECTOR queues;
    intptr_t data;
+   unsigned int num_events;   /* events emitted */
 };
 
 typedef struct ALLEGRO_USER_EVENT_DESCRIPTOR
 {
    void (*dtor)(ALLEGRO_USER_EVENT *event);
-   int refcount;
+   _AL_ATOMIC refcount;
+   bool pooled;
 } ALLEGRO_USER_EVENT_DESCRIPTOR;
 
 
 void _al_init_events(void);
+ALLEGRO_USER_EVENT_DESCRIPTOR *_al_create_user_event_descriptor(
+   void (*dtor)(ALLEGRO_USER_EVENT *));
+void _al_free_user_event_descriptor(ALLEGRO_USER_EVENT_DESCRIPTOR *descr);
 
 void _al_event_source_init(ALLEGRO_EVENT_SOURCE*);
 void _al_event_source_free(ALLEGRO_EVENT_SOURCE*);
@@ -0,0 +1,36 @@
+#ifndef __al_included_allegro5_aintern_extmap_h
+#define __al_included_allegro5_aintern_extmap_h
+
+#ifdef __cplusplus
+   extern "C" {
+#endif
+
+
+typedef struct _AL_EXTMAP_SLOT _AL_EXTMAP_SLOT;
+
+/* Maps file name extensions, compared case-insensitively, to integers,
+ * usually indices into a handler vector.
+ */
+typedef struct _AL_EXTMAP
+{
+   /* private */
+   _AL_EXTMAP_SLOT *_slots;
+   unsigned int _capacity;  /* zero or a power of two */
+   unsigned int _count;
+} _AL_EXTMAP;
+
+#define _AL_EXTMAP_INITIALIZER { NULL, 0, 0 }
+
+
+AL_FUNC(bool, _al_extmap_insert, (_AL_EXTMAP *map, const char *ext, int value));
+AL_FUNC(int,  _al_extmap_find, (const _AL_EXTMAP *map, const char *ext));
+AL_FUNC(void, _al_extmap_free, (_AL_EXTMAP *map));
+
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif
+
+/* vi ts=8 sts=3 sw=3 et */
@@ -6,7 +6,17 @@
 #endif
 
 
-extern const ALLEGRO_FILE_INTERFACE _al_file_interface_stdio;
+AL_VAR(const ALLEGRO_FILE_INTERFACE, _al_file_interface_stdio);
+AL_VAR(const ALLEGRO_FILE_INTERFACE, _al_file_interface_mapped);
+
+AL_FUNC(ALLEGRO_FILE *, _al_fopen_for_reading, (const char *path,
+   const char *mode));
+AL_FUNC(ALLEGRO_FILE *, _al_fopen_buffered_owner, (ALLEGRO_FILE *fp));
+AL_FUNC(bool, _al_file_stdio_read_at, (ALLEGRO_FILE *f, int64_t offset,
+   void *ptr, size_t size, int64_t *ret));
+
+void _al_init_file_async(void);
+void _al_init_packs(void);
 
 #define ALLEGRO_UNGETC_SIZE 16
 
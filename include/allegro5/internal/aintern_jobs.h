@@ -0,0 +1,17 @@
+#ifndef __al_included_allegro5_aintern_jobs_h
+#define __al_included_allegro5_aintern_jobs_h
+
+#ifdef __cplusplus
+   extern "C" {
+#endif
+
+void _al_init_jobs(void);
+AL_FUNC(ALLEGRO_JOB_POOL *, _al_get_job_pool, (void));
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -24,6 +24,7 @@ typedef struct ALLEGRO_JOYSTICK_DRIVER
    AL_METHOD(void, get_joystick_state, (ALLEGRO_JOYSTICK *joy, ALLEGRO_JOYSTICK_STATE *ret_state));
    AL_METHOD(const char *, get_name, (ALLEGRO_JOYSTICK *joy));
    AL_METHOD(bool, get_active, (ALLEGRO_JOYSTICK *joy));
+   AL_METHOD(void, poll_joysticks, (void));
 } ALLEGRO_JOYSTICK_DRIVER;
 
 
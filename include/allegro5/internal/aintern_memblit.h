@@ -10,6 +10,19 @@ void _al_draw_bitmap_region_memory(ALLEGRO_BITMAP *bitmap,
    ALLEGRO_COLOR tint,
    int sx, int sy, int sw, int sh, int dx, int dy, int flags);
 
+extern void (*_al_blit_span_swap_rb_8888)(uint32_t *dst, const uint32_t *src,
+   int n);
+extern void (*_al_blit_span_blend_8888)(uint32_t *dst, const uint32_t *src,
+   int n, const float *tint);
+extern void (*_al_blit_span_gather_8888)(uint32_t *dst, const uint32_t *src,
+   int pitch, int32_t u, int32_t v, int32_t du, int32_t dv, int n);
+void _al_blit_span_gather_linear_8888(uint32_t *dst, const uint32_t *src,
+   int pitch, int w, int h, int32_t u, int32_t v, int32_t du, int32_t dv,
+   int n);
+extern void (*_al_blit_fill_32)(void *dst, int pitch, int w, int h,
+   uint32_t value);
+void _al_init_memblit_spans(void);
+
 
 #ifdef __cplusplus
    }
@@ -5,6 +5,10 @@
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_display.h"
 
+#if defined(ALLEGRO_ANDROID) || defined(ALLEGRO_RASPBERRYPI)
+#include <EGL/egl.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,10 +29,34 @@ enum {
    _ALLEGRO_OPENGL_VERSION_3_1   = 0x03010000,
    _ALLEGRO_OPENGL_VERSION_3_2   = 0x03020000,
    _ALLEGRO_OPENGL_VERSION_3_3   = 0x03030000,
-   _ALLEGRO_OPENGL_VERSION_4_0   = 0x04000000
+   _ALLEGRO_OPENGL_VERSION_4_0   = 0x04000000,
+   _ALLEGRO_OPENGL_VERSION_4_1   = 0x04010000,
+   _ALLEGRO_OPENGL_VERSION_4_2   = 0x04020000,
+   _ALLEGRO_OPENGL_VERSION_4_3   = 0x04030000,
+   _ALLEGRO_OPENGL_VERSION_4_4   = 0x04040000
 };
 
-#define ALLEGRO_MAX_OPENGL_FBOS 8
+/* Transient FBOs are recycled among render targets from a pool of
+ * ALLEGRO_DEFAULT_OPENGL_FBOS entries, which al_set_opengl_fbo_pool_size can
+ * change up to ALLEGRO_MAX_OPENGL_FBOS.
+ */
+#define ALLEGRO_DEFAULT_OPENGL_FBOS 8
+#define ALLEGRO_MAX_OPENGL_FBOS 64
+
+/* A bitmap which had to get a new transient FBO this many times is given a
+ * persistent one instead, unless overridden in allegro5.cfg.
+ */
+#define ALLEGRO_OPENGL_FBO_PERSIST_MISSES 4
+
+/* The streaming vertex buffer used for the held drawing vertex cache is
+ * split into this many segments, each protected by its own fence.
+ */
+#define ALLEGRO_OGL_VBO_SEGMENTS 4
+
+/* Number of pixel buffers write-only locks of ALLEGRO_STREAMING_BITMAP
+ * bitmaps rotate through.
+ */
+#define ALLEGRO_OGL_STREAM_BUFFERS 3
 
 enum {
    FBO_INFO_UNUSED      = 0,
@@ -67,6 +95,16 @@ typedef struct ALLEGRO_FBO_INFO
       
    ALLEGRO_BITMAP *owner;
    double last_use_time;
+
+   /* The texture attached as color buffer and known to make the FBO
+    * complete, 0 if none. Saves reattaching it every time it is bound.
+    */
+   GLuint texture;
+
+   /* Whether the multisample buffer may hold drawing that is not yet
+    * resolved into the texture, see _al_ogl_resolve_bitmap.
+    */
+   bool unresolved;
 } ALLEGRO_FBO_INFO;
 
 typedef struct ALLEGRO_BITMAP_EXTRA_OPENGL
@@ -79,6 +117,13 @@ typedef struct ALLEGRO_BITMAP_EXTRA_OPENGL
    GLuint texture; /* 0 means, not uploaded yet. */
 
    ALLEGRO_FBO_INFO *fbo_info;
+   /* How often the bitmap had to be given a new transient FBO. */
+   int fbo_misses;
+
+   /* The texture changed since the mipmaps were generated, see
+    * _al_ogl_update_mipmaps.
+    */
+   bool mipmaps_dirty;
 
    /* When an OpenGL bitmap is locked, the locked region is usually backed by a
     * temporary memory buffer pointed to by lock_buffer.
@@ -92,6 +137,30 @@ typedef struct ALLEGRO_BITMAP_EXTRA_OPENGL
 
    float left, top, right, bottom; /* Texture coordinates. */
    bool is_backbuffer; /* This is not a real bitmap, but the backbuffer. */
+
+#ifndef ALLEGRO_CFG_OPENGLES
+   /* Region read back into readback_pbo by al_request_bitmap_readback,
+    * readback_fence is signalled once it can be mapped without stalling.
+    * The pixel buffer is kept around for the next request.
+    */
+   GLuint readback_pbo;
+   int readback_pbo_size;
+   GLsync readback_fence;
+   int readback_x, readback_y, readback_w, readback_h;
+   int readback_format;
+
+   /* Write-only locks of ALLEGRO_STREAMING_BITMAP bitmaps map one of these
+    * pixel unpack buffers in turn and upload from it when unlocked.
+    * stream_fences[i] is signalled once the upload from buffer i is done.
+    * stream_index is the buffer used last, stream_locked is set while it
+    * is mapped.
+    */
+   GLuint stream_pbos[ALLEGRO_OGL_STREAM_BUFFERS];
+   int stream_pbo_sizes[ALLEGRO_OGL_STREAM_BUFFERS];
+   GLsync stream_fences[ALLEGRO_OGL_STREAM_BUFFERS];
+   int stream_index;
+   bool stream_locked;
+#endif
 } ALLEGRO_BITMAP_EXTRA_OPENGL;
 
 typedef struct OPENGL_INFO {
@@ -122,15 +191,68 @@ typedef struct ALLEGRO_OGL_VARLOCS
    GLint alpha_test_loc;
    GLint alpha_func_loc;
    GLint alpha_test_val_loc;
+   GLint held_tex_loc;
+   GLint tex_unit_loc;
    GLint user_attr_loc[_ALLEGRO_PRIM_MAX_USER_ATTR];
 } ALLEGRO_OGL_VARLOCS;
 
+/* Texture units whose bindings are shadowed in ALLEGRO_OGL_STATE. */
+#define _ALLEGRO_OGL_STATE_TEXTURE_UNITS  _ALLEGRO_MAX_HELD_TEXTURES
+/* Marks a shadowed texture binding or program as unknown. */
+#define _ALLEGRO_OGL_UNKNOWN_TEXTURE      ((GLuint)-1)
+#define _ALLEGRO_OGL_UNKNOWN_PROGRAM      ((GLuint)-1)
+
+/* Shadow copy of the state Allegro sets in a context, so that redundant
+ * calls never reach the driver. Each part is only used while its valid flag
+ * is set, see _al_ogl_invalidate_state.
+ */
+typedef struct ALLEGRO_OGL_STATE
+{
+   /* Allegro blender values, not GL enums. */
+   bool blend_valid;
+   int blend_src_color, blend_dst_color;
+   int blend_src_alpha, blend_dst_alpha;
+   int blend_op, blend_op_alpha;
+   ALLEGRO_COLOR blend_color;
+
+   bool render_state_valid;
+   _ALLEGRO_RENDER_STATE render_state;
+   /* The program the alpha test uniforms were last set for. */
+   GLuint render_program;
+
+   /* -1 if unknown. */
+   int active_texture;
+   GLuint textures[_ALLEGRO_OGL_STATE_TEXTURE_UNITS];
+
+   /* Whether GL_FRAMEBUFFER_SRGB is enabled, -1 if unknown. */
+   int framebuffer_srgb;
+
+   /* The framebuffer bound to GL_FRAMEBUFFER, -1 if unknown. */
+   GLint framebuffer;
+
+   bool viewport_valid;
+   GLint viewport[4];
+
+   /* Whether GL_SCISSOR_TEST is enabled, -1 if unknown. */
+   int scissor_test;
+   bool scissor_valid;
+   GLint scissor[4];
+
+   GLuint program;
+} ALLEGRO_OGL_STATE;
+
+typedef struct ALLEGRO_OGL_EXT_CACHE ALLEGRO_OGL_EXT_CACHE;
+
 typedef struct ALLEGRO_OGL_EXTRAS
 {
    /* A list of extensions supported by Allegro, for this context. */
    ALLEGRO_OGL_EXT_LIST *extension_list;
-   /* A list of extension API, loaded by Allegro, for this context. */
+   /* A list of extension API, loaded by Allegro, for this context.
+    * Shared with other displays using the same implementation.
+    */
    ALLEGRO_OGL_EXT_API *extension_api;
+   /* The extensions and API table shared by such displays. */
+   ALLEGRO_OGL_EXT_CACHE *extension_cache;
    /* Various info about OpenGL implementation. */
    OPENGL_INFO ogl_info;
 
@@ -141,7 +263,28 @@ typedef struct ALLEGRO_OGL_EXTRAS
    /* True if display resources are shared among displays. */
    bool is_shared;
 
+   ALLEGRO_OGL_STATE state;
+
    ALLEGRO_FBO_INFO fbos[ALLEGRO_MAX_OPENGL_FBOS];
+   /* Number of fbos in use as the pool, 0 until first needed. */
+   int fbo_pool_size;
+   int fbo_persist_misses;
+
+   /* Whether draw_quad drops held bitmap draws outside the clipping
+    * rectangle, from the cull_held_draws config key.
+    */
+   bool cull_held_draws;
+
+   /* Whether draw_quad clips held bitmap draws itself, so that the clipping
+    * rectangle can change without ending the batch, from the
+    * clip_held_draws config key. held_scissor_stale is set while the
+    * scissor test does not match the clipping rectangle, and
+    * held_scissor_needed while the vertex cache holds quads which rely on
+    * the scissor test.
+    */
+   bool clip_held_draws;
+   bool held_scissor_stale;
+   bool held_scissor_needed;
 
    /* In non-programmable pipe mode this should be zero.
     * In programmable pipeline mode this should be non-zero.
@@ -149,9 +292,68 @@ typedef struct ALLEGRO_OGL_EXTRAS
    GLuint program_object;
    ALLEGRO_OGL_VARLOCS varlocs;
 
+   /* The program whose projview uniform is known to hold the display's
+    * projview_transform, or 0 if unknown. Lets redundant uploads be skipped.
+    */
+   GLuint projview_program;
+
    /* For OpenGL 3.0+ we use a single vao and vbo. */
    GLuint vao, vbo;
 
+#ifndef ALLEGRO_CFG_OPENGLES
+   /* If fence syncs are available the vbo is used as a ring buffer, see
+    * ogl_draw.c. All sizes and offsets are in bytes. vbo_map is the
+    * persistent mapping of the whole buffer if ARB_buffer_storage is
+    * supported, NULL otherwise.
+    */
+   bool vbo_ring;
+   int vbo_size;
+   int vbo_head;
+   int vbo_seg;
+   int vbo_unfenced;
+   void *vbo_map;
+   GLsync vbo_fences[ALLEGRO_OGL_VBO_SEGMENTS];
+
+   /* A batch too large for the mapped ring is collected in the vertex
+    * cache instead and uploaded into vbo_heap on flush.
+    */
+   bool vbo_heap_batch;
+   GLuint vbo_heap;
+
+   /* Background texture uploads, see ogl_upload.c. */
+   struct ALLEGRO_OGL_UPLOAD_QUEUE *upload_queue;
+
+   /* Instanced drawing, see ogl_instances.c. The corner vbo holds the
+    * unit square, the instance vbo ALLEGRO_OGL_INSTANCE_VERTEX items.
+    * instance_vbo_size is -1 if the instance shader could not be built.
+    */
+   GLuint instance_vao, instance_corner_vbo, instance_vbo;
+   int instance_vbo_size;
+#else
+   /* Programs packing readbacks into each pixel format, see
+    * ogl_lock_es.c. 0 if not built yet, _ALLEGRO_OGL_UNKNOWN_PROGRAM if
+    * the format cannot be packed.
+    */
+   GLuint lock_pack_programs[ALLEGRO_NUM_PIXEL_FORMATS];
+#endif
+
+   /* Textures referenced by the held drawing batch when the shader samples
+    * several of them, see ALLEGRO_HELD_BITMAP_TEXTURES. The texture in
+    * held_textures[i] is bound to texture unit i when the batch is flushed.
+    */
+   GLuint held_textures[_ALLEGRO_MAX_HELD_TEXTURES];
+   int num_held_textures;
+
+   /* True if the vertices in the held drawing batch are
+    * ALLEGRO_OGL_PACKED_BITMAP_VERTEX instead of ALLEGRO_OGL_BITMAP_VERTEX.
+    */
+   bool packed_vertices;
+
+   /* A white 1x1 texture, sampled by untextured triangles in the held
+    * drawing batch. 0 until first needed.
+    */
+   GLuint white_texture;
+
 } ALLEGRO_OGL_EXTRAS;
 
 typedef struct ALLEGRO_OGL_BITMAP_VERTEX
@@ -159,26 +361,62 @@ typedef struct ALLEGRO_OGL_BITMAP_VERTEX
    float x, y, z;
    float tx, ty;
    float r, g, b, a;
+   float unit;
 } ALLEGRO_OGL_BITMAP_VERTEX;
 
+/* Used when all tints in a batch are representable with 8 bits per
+ * component, which is almost always.
+ */
+typedef struct ALLEGRO_OGL_PACKED_BITMAP_VERTEX
+{
+   float x, y, z;
+   float tx, ty;
+   unsigned char r, g, b, a;
+   unsigned char unit;
+} ALLEGRO_OGL_PACKED_BITMAP_VERTEX;
+
+/* One sprite drawn by al_draw_bitmap_instances. The texture coordinates
+ * are left, top, right, bottom, already swapped for flipping.
+ */
+typedef struct ALLEGRO_OGL_INSTANCE_VERTEX
+{
+   float tex_l, tex_t, tex_r, tex_b;
+   float sw, sh, cx, cy;
+   float dx, dy, xscale, yscale;
+   float angle;
+   float r, g, b, a;
+} ALLEGRO_OGL_INSTANCE_VERTEX;
+
 
 /* extensions */
 int  _al_ogl_look_for_an_extension(const char *name, const GLubyte *extensions);
 void _al_ogl_set_extensions(ALLEGRO_OGL_EXT_API *ext);
 void _al_ogl_manage_extensions(ALLEGRO_DISPLAY *disp);
 void _al_ogl_unmanage_extensions(ALLEGRO_DISPLAY *disp);
+void _al_ogl_init_extensions(void);
+void _al_ogl_shutdown_extensions(void);
 
 /* bitmap */
 int _al_ogl_get_glformat(int format, int component);
+int _al_ogl_get_bitmap_glformat(ALLEGRO_BITMAP *bitmap, int format);
 ALLEGRO_BITMAP *_al_ogl_create_bitmap(ALLEGRO_DISPLAY *d, int w, int h,
     int format, int flags);
 void _al_ogl_upload_bitmap_memory(ALLEGRO_BITMAP *bitmap, int format, void *ptr);
+void _al_ogl_invalidate_mipmaps(ALLEGRO_BITMAP *bitmap);
+void _al_ogl_update_mipmaps(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
+bool _al_ogl_draw_held_triangles(ALLEGRO_DISPLAY *display,
+   ALLEGRO_BITMAP *texture, const _AL_PRIM_VERTEX *vtxs, int num_vtx);
 
 /* locking */
 #ifndef ALLEGRO_CFG_OPENGLES
    ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_new(ALLEGRO_BITMAP *bitmap,
       int x, int y, int w, int h, int format, int flags);
    void _al_ogl_unlock_region_new(ALLEGRO_BITMAP *bitmap);
+   bool _al_ogl_request_readback(ALLEGRO_BITMAP *bitmap,
+      int x, int y, int w, int h, int format);
+   bool _al_ogl_is_readback_ready(ALLEGRO_BITMAP *bitmap);
+   void _al_ogl_destroy_readback(ALLEGRO_BITMAP *bitmap);
+   void _al_ogl_destroy_stream_buffers(ALLEGRO_BITMAP *bitmap);
 #else
    ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_gles(ALLEGRO_BITMAP *bitmap,
       int x, int y, int w, int h, int format, int flags);
@@ -187,6 +425,24 @@ void _al_ogl_upload_bitmap_memory(ALLEGRO_BITMAP *bitmap, int format, void *ptr)
 
 int _al_ogl_pixel_alignment(int pixel_size, bool compressed);
 
+/* instanced drawing */
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+   bool _al_ogl_draw_bitmap_instances(ALLEGRO_BITMAP *bitmap,
+      const struct ALLEGRO_SPRITE_INSTANCE *instances, int num_instances,
+      int flags);
+#endif
+
+/* background uploads */
+#ifndef ALLEGRO_CFG_OPENGLES
+   bool _al_ogl_queue_bitmap_upload(ALLEGRO_DISPLAY *display,
+      ALLEGRO_BITMAP *bitmap);
+   bool _al_ogl_finish_bitmap_upload(ALLEGRO_DISPLAY *display,
+      ALLEGRO_BITMAP *bitmap, bool wait);
+   void _al_ogl_cancel_bitmap_upload(ALLEGRO_DISPLAY *display,
+      ALLEGRO_BITMAP *bitmap);
+   void _al_ogl_destroy_upload_queue(ALLEGRO_DISPLAY *display);
+#endif
+
 /* framebuffer objects */
 GLint _al_ogl_bind_framebuffer(GLint fbo);
 void _al_ogl_reset_fbo_info(ALLEGRO_FBO_INFO *info);
@@ -201,19 +457,45 @@ void _al_ogl_del_fbo(ALLEGRO_FBO_INFO *info);
 /* common driver */
 void _al_ogl_setup_gl(ALLEGRO_DISPLAY *d);
 void _al_ogl_set_target_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
-void _al_ogl_unset_target_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
-void _al_ogl_finalize_fbo(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
-void _al_ogl_setup_bitmap_clipping(const ALLEGRO_BITMAP *bitmap);
+void _al_ogl_resolve_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
+void _al_ogl_auto_resolve_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap);
+void _al_ogl_setup_bitmap_clipping(ALLEGRO_DISPLAY *display,
+   const ALLEGRO_BITMAP *bitmap);
 ALLEGRO_BITMAP *_al_ogl_get_backbuffer(ALLEGRO_DISPLAY *d);
 ALLEGRO_BITMAP* _al_ogl_create_backbuffer(ALLEGRO_DISPLAY *disp);
 void _al_ogl_destroy_backbuffer(ALLEGRO_BITMAP *b);
 bool _al_ogl_resize_backbuffer(ALLEGRO_BITMAP *b, int w, int h);
 void _al_opengl_backup_dirty_bitmaps(ALLEGRO_DISPLAY *d, bool flip);
+AL_FUNC(GLuint, _al_ogl_get_texture, (ALLEGRO_BITMAP *bitmap));
+
+/* state cache */
+void _al_ogl_invalidate_state(ALLEGRO_DISPLAY *display);
+void _al_ogl_forget_texture(GLuint texture);
+AL_FUNC(bool, _al_ogl_bind_texture, (ALLEGRO_DISPLAY *display, int unit,
+   GLuint texture));
+void _al_ogl_set_framebuffer_srgb(ALLEGRO_DISPLAY *display, bool enable);
+void _al_ogl_set_viewport(ALLEGRO_DISPLAY *display, int x, int y, int w, int h);
+void _al_ogl_set_scissor(ALLEGRO_DISPLAY *display, bool enable,
+   int x, int y, int w, int h);
+bool _al_ogl_use_program(ALLEGRO_DISPLAY *display, GLuint program);
+void _al_ogl_forget_program(GLuint program);
+AL_FUNC(GLuint, _al_ogl_get_program_object, (ALLEGRO_SHADER *shader));
 
 /* draw */
 struct ALLEGRO_DISPLAY_INTERFACE;
 void _al_ogl_add_drawing_functions(struct ALLEGRO_DISPLAY_INTERFACE *vt);
 
+/* gpu timers */
+void _al_ogl_add_gpu_timer_functions(struct ALLEGRO_DISPLAY_INTERFACE *vt);
+
+/* EGL partial presents */
+#if defined(ALLEGRO_ANDROID) || defined(ALLEGRO_RASPBERRYPI)
+bool _al_egl_have_swap_with_damage(EGLDisplay dpy);
+bool _al_egl_swap_buffers_with_damage(EGLDisplay dpy, EGLSurface surface,
+   int surface_w, int surface_h, int x, int y, int w, int h);
+int _al_egl_get_buffer_age(EGLDisplay dpy, EGLSurface surface);
+#endif
+
 AL_FUNC(bool, _al_opengl_set_blender, (ALLEGRO_DISPLAY *disp));
 AL_FUNC(char const *, _al_gl_error_string, (GLenum e));
 
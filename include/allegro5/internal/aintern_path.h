@@ -2,11 +2,14 @@
 #define __al_included_allegro5_aintern_path_h
 
 struct ALLEGRO_PATH {
-   ALLEGRO_USTR *drive;
+   ALLEGRO_USTR *drive;       /* NULL while empty */
    ALLEGRO_USTR *filename;
-   _AL_VECTOR segments;    /* vector of ALLEGRO_USTR * */
-   ALLEGRO_USTR *basename;
-   ALLEGRO_USTR *full_string;
+   ALLEGRO_USTR *dirs;        /* all directory components, each NUL ended */
+   _AL_VECTOR offsets;        /* of int, where each component starts */
+   ALLEGRO_USTR *basename;    /* created when first asked for */
+   ALLEGRO_USTR *full_string; /* created when first asked for */
+   bool full_string_valid;    /* full_string is up to date for full_delim */
+   char full_delim;
 };
 
 #endif
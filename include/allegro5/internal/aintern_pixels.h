@@ -255,6 +255,8 @@
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1:                                 \
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3:                                 \
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5:                                 \
+         case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:                                 \
+         case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2:                                  \
             ALLEGRO_ERROR("INLINE_GET got compressed format: %d\n", format); \
             abort();                                                          \
             break;                                                            \
@@ -470,6 +472,8 @@
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1:                      \
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3:                      \
          case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5:                      \
+         case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:                      \
+         case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2:                       \
             ALLEGRO_ERROR("INLINE_PUT got compressed format: %d\n", format); \
             abort();                                                          \
             break;                                                            \
@@ -491,6 +495,7 @@ AL_FUNC(bool, _al_pixel_format_has_alpha, (int format));
 AL_FUNC(bool, _al_pixel_format_is_real, (int format));
 AL_FUNC(bool, _al_pixel_format_is_video_only, (int format));
 AL_FUNC(bool, _al_pixel_format_is_compressed, (int format));
+AL_FUNC(bool, _al_get_pixel_format_byte_offsets, (int format, int offsets[4]));
 AL_FUNC(int, _al_get_real_pixel_format, (ALLEGRO_DISPLAY *display, int format));
 AL_FUNC(char const*, _al_pixel_format_name, (ALLEGRO_PIXEL_FORMAT format));
 
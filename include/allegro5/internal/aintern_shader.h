@@ -33,6 +33,25 @@ struct ALLEGRO_SHADER_INTERFACE
    bool (*set_shader_float_vector)(ALLEGRO_SHADER *shader, const char *name,
          int elem_size, const float *f, int num_elems);
    bool (*set_shader_bool)(ALLEGRO_SHADER *shader, const char *name, bool b);
+
+   /* Optional. The data holds num_elems values of num_components ints or
+    * floats, or of 4x4 matrices.
+    */
+   int (*get_uniform_handle)(ALLEGRO_SHADER *shader, const char *name);
+   bool (*set_uniform_h)(ALLEGRO_SHADER *shader, int handle, int type,
+         int num_components, const void *data, int num_elems);
+
+   /* Optional, for shaders with an ALLEGRO_COMPUTE_SHADER. */
+   bool (*set_shader_image)(ALLEGRO_SHADER *shader, const char *name,
+         ALLEGRO_BITMAP *bitmap, int unit);
+   bool (*dispatch_compute)(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *dpy,
+         int groups_x, int groups_y, int groups_z);
+};
+
+enum {
+   _ALLEGRO_UNIFORM_INT,
+   _ALLEGRO_UNIFORM_FLOAT,
+   _ALLEGRO_UNIFORM_MATRIX
 };
 
 struct ALLEGRO_SHADER
@@ -52,6 +71,13 @@ void _al_register_shader_bitmap(ALLEGRO_SHADER *shader, ALLEGRO_BITMAP *bmp);
 void _al_unregister_shader_bitmap(ALLEGRO_SHADER *shader, ALLEGRO_BITMAP *bmp);
 
 ALLEGRO_SHADER *_al_create_default_shader(ALLEGRO_DISPLAY *display);
+ALLEGRO_SHADER *_al_create_instance_shader(ALLEGRO_DISPLAY *display);
+
+/* Per-instance attributes of the instance shader. */
+#define _ALLEGRO_SHADER_VAR_INSTANCE_TEXCOORDS  "al_instance_texcoords"
+#define _ALLEGRO_SHADER_VAR_INSTANCE_SIZE       "al_instance_size"
+#define _ALLEGRO_SHADER_VAR_INSTANCE_POSITION   "al_instance_position"
+#define _ALLEGRO_SHADER_VAR_INSTANCE_ANGLE      "al_instance_angle"
 
 #ifdef ALLEGRO_CFG_SHADER_GLSL
 ALLEGRO_SHADER *_al_create_shader_glsl(ALLEGRO_SHADER_PLATFORM platform);
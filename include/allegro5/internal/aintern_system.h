@@ -52,6 +52,12 @@ struct ALLEGRO_SYSTEM_INTERFACE
    double (*get_time)(void);
    void (*rest)(double seconds);
    void (*init_timeout)(ALLEGRO_TIMEOUT *timeout, double seconds);
+   /* Optional. Blocks in the native event loop until it has dispatched
+    * new events, wake_event_wait is called or the timeout passes. Returns
+    * false without waiting if the calling thread cannot pump events.
+    */
+   bool (*wait_for_events)(ALLEGRO_TIMEOUT *timeout, bool *timed_out);
+   void (*wake_event_wait)(void);
 };
 
 struct ALLEGRO_SYSTEM
@@ -74,6 +80,11 @@ AL_FUNC(void *, _al_import_symbol, (void *library, const char *symbol));
 AL_FUNC(void, _al_close_library, (void *library));
 AL_FUNC(uint32_t, _al_get_joystick_compat_version, (void));
 
+void _al_init_display_modes(void);
+void _al_init_monitors(void);
+int _al_get_display_config_generation(void);
+AL_FUNC(void, _al_display_config_changed, (void));
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@
 typedef struct _AL_THREAD _AL_THREAD;
 typedef struct _AL_MUTEX _AL_MUTEX;
 typedef struct _AL_COND _AL_COND;
+typedef struct _AL_RWLOCK _AL_RWLOCK;
 
 
 void _al_thread_create(_AL_THREAD*, void (*proc)(_AL_THREAD*, void*), void *arg);
@@ -19,14 +20,30 @@ void _al_thread_set_should_stop(_AL_THREAD *);
 /* static inline bool _al_get_thread_should_stop(_AL_THREAD *); */
 void _al_thread_join(_AL_THREAD*);
 void _al_thread_detach(_AL_THREAD*);
+/* These may only work when called by the thread itself on some platforms. */
+bool _al_thread_set_priority(_AL_THREAD*, int priority);
+bool _al_thread_set_affinity(_AL_THREAD*, uint64_t cpu_mask);
+bool _al_thread_set_name(_AL_THREAD*, const char *name);
 
 
 void _al_mutex_init(_AL_MUTEX*);
 void _al_mutex_init_recursive(_AL_MUTEX*);
+/* Spins for a while before blocking, where the platform supports it. */
+void _al_mutex_init_adaptive(_AL_MUTEX*);
 void _al_mutex_destroy(_AL_MUTEX*);
 /* static inline void _al_mutex_lock(_AL_MUTEX*); */
 /* static inline void _al_mutex_unlock(_AL_MUTEX*); */
 
+void _al_rwlock_init(_AL_RWLOCK*);
+void _al_rwlock_destroy(_AL_RWLOCK*);
+/* Inline except on Windows. */
+#ifdef ALLEGRO_WINDOWS
+void _al_rwlock_lock_read(_AL_RWLOCK*);
+void _al_rwlock_unlock_read(_AL_RWLOCK*);
+void _al_rwlock_lock_write(_AL_RWLOCK*);
+void _al_rwlock_unlock_write(_AL_RWLOCK*);
+#endif
+
 /* All 5 functions below are declared inline in aintuthr.h.
  * FIXME: Why are they all inline? And if they have to be, why not treat them
  * the same as the two functions above?
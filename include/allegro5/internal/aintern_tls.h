@@ -10,6 +10,8 @@ void _al_tls_init_once(void);
 void _al_reinitialize_tls_values(void);
 
 int *_al_tls_get_dtor_owner_count(void);
+void **_al_tls_get_job_worker(void);
+void **_al_tls_get_pool_caches(void);
 
 
 #ifdef __cplusplus
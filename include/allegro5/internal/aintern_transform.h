@@ -2,8 +2,26 @@
 #define __al_included_allegro5_aintern_transform_h
 
 
+/* Transform classes, from least to most general. Each class is a special
+ * case of the ones after it. _AL_TRANSFORM_UNKNOWN is zero so that a zeroed
+ * bitmap starts out unclassified.
+ */
+enum {
+   _AL_TRANSFORM_UNKNOWN = 0,
+   _AL_TRANSFORM_IDENTITY,
+   _AL_TRANSFORM_TRANSLATE,
+   _AL_TRANSFORM_SCALE_TRANSLATE,
+   _AL_TRANSFORM_AFFINE,
+   _AL_TRANSFORM_PROJECTIVE
+};
+
 bool _al_transform_is_translation(const ALLEGRO_TRANSFORM* trans,
    float *dx, float *dy);
 
+AL_FUNC(int, _al_classify_transform, (const ALLEGRO_TRANSFORM *trans));
+AL_FUNC(int, _al_get_current_transform_kind, (void));
+AL_FUNC(void, _al_transform_coordinates_kind_n, (const ALLEGRO_TRANSFORM *trans,
+   int kind, float *xyz, int stride, int n, bool with_z));
+
 
 #endif
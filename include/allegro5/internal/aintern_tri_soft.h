@@ -23,5 +23,7 @@ AL_FUNC(void, _al_draw_soft_triangle, (
    void (*first)(uintptr_t, int, int, int, int),
    void (*step)(uintptr_t, int),
    void (*draw)(uintptr_t, int, int, int)));
+AL_FUNC(void, _al_draw_soft_triangles, (ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* vtx,
+   const int* indices, int num_triangles));
 
 #endif
@@ -42,6 +42,7 @@ AL_FUNC(void*, _al_vector_alloc_mid, (_AL_VECTOR*, unsigned int index));
 AL_FUNC(int,  _al_vector_find, (const _AL_VECTOR*, const void *ptr_item));
 AL_FUNC(bool, _al_vector_contains, (const _AL_VECTOR*, const void *ptr_item));
 AL_FUNC(void, _al_vector_delete_at, (_AL_VECTOR*, unsigned int index));
+AL_FUNC(void, _al_vector_delete_at_unordered, (_AL_VECTOR*, unsigned int index));
 AL_FUNC(bool, _al_vector_find_and_delete, (_AL_VECTOR*, const void *ptr_item));
 AL_FUNC(void, _al_vector_free, (_AL_VECTOR*));
 
@@ -33,7 +33,17 @@ struct ALLEGRO_DISPLAY_XGLX
    Atom wm_delete_window_atom;
    XVisualInfo *xvinfo; /* Used when selecting the X11 visual to use. */
    GLXFBConfig *fbc; /* Used when creating the OpenGL context. */
+   /* Shared context used by the background upload thread and its drawable,
+    * which is upload_pbuffer if the config supports pbuffers.
+    */
+   GLXContext upload_context;
+   GLXDrawable upload_drawable;
+   GLXPbuffer upload_pbuffer;
    int glx_version; /* 130 means 1 major and 3 minor, aka 1.3 */
+   /* Set when the last frame was presented by copying a region to the
+    * front buffer, which leaves the back buffer as it was.
+    */
+   bool back_buffer_kept;
 
    /* Points to a structure if this display is contained by a GTK top-level
     * window, otherwise it is NULL.
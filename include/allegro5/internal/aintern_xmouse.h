@@ -9,6 +9,8 @@ void _al_xwin_mouse_button_release_handler(int button, ALLEGRO_DISPLAY *d);
 void _al_xwin_mouse_motion_notify_handler(int x, int y, ALLEGRO_DISPLAY *d);
 void _al_xwin_mouse_switch_handler(ALLEGRO_DISPLAY *display,
    const XCrossingEvent *event);
+bool _al_xwin_mouse_generic_event_handler(XEvent *event);
+void _al_xwin_mouse_flush_raw_motion(void);
 bool _al_xwin_grab_mouse(ALLEGRO_DISPLAY *display);
 bool _al_xwin_ungrab_mouse(void);
 
@@ -88,6 +88,10 @@ AL_FUNC(void,           al_get_joystick_state,  (ALLEGRO_JOYSTICK *, ALLEGRO_JOY
 
 AL_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_joystick_event_source, (void));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void,           al_poll_joysticks,      (void));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
@@ -68,6 +68,55 @@ AL_FUNC(void *, al_calloc_with_context, (size_t count, size_t n,
    int line, const char *file, const char *func));
 
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+
+/* Enum: ALLEGRO_MEMORY_TAG
+ */
+typedef enum ALLEGRO_MEMORY_TAG {
+   ALLEGRO_MEMORY_TAG_OTHER,
+   ALLEGRO_MEMORY_TAG_BITMAP,
+   ALLEGRO_MEMORY_TAG_AUDIO,
+   ALLEGRO_MEMORY_TAG_FONT,
+   ALLEGRO_MEMORY_TAG_PRIMITIVES,
+   ALLEGRO_MEMORY_TAG_EVENTS,
+   ALLEGRO_NUM_MEMORY_TAGS
+} ALLEGRO_MEMORY_TAG;
+
+/* Type: ALLEGRO_MEMORY_USAGE
+ */
+typedef struct ALLEGRO_MEMORY_USAGE {
+   int64_t live_bytes;
+   int64_t peak_bytes;
+   int64_t live_allocations;
+   int64_t total_allocations;
+} ALLEGRO_MEMORY_USAGE;
+
+/* Type: ALLEGRO_MEMORY_SNAPSHOT
+ */
+typedef struct ALLEGRO_MEMORY_SNAPSHOT {
+   ALLEGRO_MEMORY_USAGE tags[ALLEGRO_NUM_MEMORY_TAGS];
+   ALLEGRO_MEMORY_USAGE total;
+} ALLEGRO_MEMORY_SNAPSHOT;
+
+AL_FUNC(void, al_set_memory_tracking, (bool enable));
+AL_FUNC(bool, al_get_memory_tracking, (void));
+AL_FUNC(void, al_get_memory_snapshot, (ALLEGRO_MEMORY_SNAPSHOT *snapshot));
+AL_FUNC(void, al_diff_memory_snapshots, (const ALLEGRO_MEMORY_SNAPSHOT *before,
+   const ALLEGRO_MEMORY_SNAPSHOT *after, ALLEGRO_MEMORY_SNAPSHOT *diff));
+AL_FUNC(const char *, al_get_memory_tag_name, (ALLEGRO_MEMORY_TAG tag));
+
+/* Type: ALLEGRO_MEMORY_POOL
+ */
+typedef struct ALLEGRO_MEMORY_POOL ALLEGRO_MEMORY_POOL;
+
+AL_FUNC(ALLEGRO_MEMORY_POOL *, al_create_memory_pool, (size_t object_size));
+AL_FUNC(void, al_destroy_memory_pool, (ALLEGRO_MEMORY_POOL *pool));
+AL_FUNC(void *, al_alloc_from_memory_pool, (ALLEGRO_MEMORY_POOL *pool));
+AL_FUNC(void, al_free_to_memory_pool, (ALLEGRO_MEMORY_POOL *pool, void *ptr));
+
+#endif
+
+
 #ifdef __cplusplus
    }
 #endif
@@ -988,6 +988,11 @@
 #define glGetQueryIndexediv _al_glGetQueryIndexediv
 #endif
 
+#if defined _ALLEGRO_GL_ARB_get_program_binary
+#define glGetProgramBinary _al_glGetProgramBinary
+#define glProgramBinary _al_glProgramBinary
+#endif
+
 
 /*</ARB>*/
 
@@ -2609,3 +2614,12 @@
 #if defined _ALLEGRO_GL_NV_texture_barrier
 #define glTextureBarrierNV _al_glTextureBarrierNV
 #endif
+
+#if defined _ALLEGRO_GL_ARB_buffer_storage
+#define glBufferStorage _al_glBufferStorage
+#endif
+
+#if defined _ALLEGRO_GL_ARB_shader_image_load_store
+#define glBindImageTexture _al_glBindImageTexture
+#define glMemoryBarrier _al_glMemoryBarrier
+#endif
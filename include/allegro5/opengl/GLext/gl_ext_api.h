@@ -764,7 +764,7 @@ AGL_API(void, VertexAttribDivisor, (GLuint, GLuint))
 #endif
 
 #if defined _ALLEGRO_GL_ARB_map_buffer_range
-AGL_API(void, MapBufferRange, (GLenum, GLintptr, GLsizeiptr, GLbitfield))
+AGL_API(GLvoid*, MapBufferRange, (GLenum, GLintptr, GLsizeiptr, GLbitfield))
 AGL_API(void, FlushMappedBufferRange, (GLenum, GLintptr, GLsizeiptr))
 #endif
 
@@ -987,6 +987,12 @@ AGL_API(void, EndQueryIndexed, (GLenum target, GLuint index))
 AGL_API(void, GetQueryIndexediv, (GLenum target, GLuint index, GLenum pname, GLint *params))
 #endif
 
+#if defined _ALLEGRO_GL_ARB_get_program_binary
+AGL_API(void, GetProgramBinary, (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary))
+AGL_API(void, ProgramBinary, (GLuint program, GLenum binaryFormat, const void *binary, GLsizei length))
+/* reuse glProgramParameteri from OpenGL 3.2 */
+#endif
+
 
 /* </ARB> */
 
@@ -2608,3 +2614,12 @@ AGL_API(void, GetIntegerui64i_vNV, (GLenum value, GLuint index, GLuint64EXT *res
 #if defined _ALLEGRO_GL_NV_texture_barrier
 AGL_API(void, TextureBarrierNV, (void))
 #endif
+
+#if defined _ALLEGRO_GL_ARB_buffer_storage
+AGL_API(void, BufferStorage, (GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags))
+#endif
+
+#if defined _ALLEGRO_GL_ARB_shader_image_load_store
+AGL_API(void, BindImageTexture, (GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format))
+AGL_API(void, MemoryBarrier, (GLbitfield barriers))
+#endif
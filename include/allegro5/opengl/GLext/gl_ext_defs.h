@@ -2141,6 +2141,15 @@ typedef struct __GLsync *GLsync;
 #define GL_MAX_TRANSFORM_FEEDBACK_BUFFERS 0x8E70
 #endif
 
+#ifndef GL_ARB_get_program_binary
+#define GL_ARB_get_program_binary
+#define _ALLEGRO_GL_ARB_get_program_binary
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH          0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS     0x87FE
+#define GL_PROGRAM_BINARY_FORMATS         0x87FF
+#endif
+
 
 /* </ARB> */
 
@@ -5462,3 +5471,47 @@ typedef uint64_t GLuint64EXT;
 #define GL_AMD_conservative_depth
 #define _ALLEGRO_GL_AMD_conservative_depth
 #endif
+
+#ifndef GL_ARB_buffer_storage
+#define GL_ARB_buffer_storage
+#define _ALLEGRO_GL_ARB_buffer_storage
+#define GL_MAP_PERSISTENT_BIT             0x0040
+#define GL_MAP_COHERENT_BIT               0x0080
+#define GL_DYNAMIC_STORAGE_BIT            0x0100
+#define GL_CLIENT_STORAGE_BIT             0x0200
+#define GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT 0x00004000
+#define GL_BUFFER_IMMUTABLE_STORAGE       0x821F
+#define GL_BUFFER_STORAGE_FLAGS           0x8220
+#endif
+
+#ifndef GL_ARB_shader_image_load_store
+#define GL_ARB_shader_image_load_store
+#define _ALLEGRO_GL_ARB_shader_image_load_store
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#define GL_ELEMENT_ARRAY_BARRIER_BIT      0x00000002
+#define GL_UNIFORM_BARRIER_BIT            0x00000004
+#define GL_TEXTURE_FETCH_BARRIER_BIT      0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_COMMAND_BARRIER_BIT            0x00000040
+#define GL_PIXEL_BUFFER_BARRIER_BIT       0x00000080
+#define GL_TEXTURE_UPDATE_BARRIER_BIT     0x00000100
+#define GL_BUFFER_UPDATE_BARRIER_BIT      0x00000200
+#define GL_FRAMEBUFFER_BARRIER_BIT        0x00000400
+#define GL_TRANSFORM_FEEDBACK_BARRIER_BIT 0x00000800
+#define GL_ATOMIC_COUNTER_BARRIER_BIT     0x00001000
+#define GL_ALL_BARRIER_BITS               0xFFFFFFFF
+#define GL_MAX_IMAGE_UNITS                0x8F38
+#define GL_IMAGE_BINDING_NAME             0x8F3A
+#endif
+
+#ifndef GL_ARB_compute_shader
+#define GL_ARB_compute_shader
+#define _ALLEGRO_GL_ARB_compute_shader
+/* reuse the GL 4.3 tokens and entry points */
+#endif
+
+#ifndef GL_ARB_shader_storage_buffer_object
+#define GL_ARB_shader_storage_buffer_object
+#define _ALLEGRO_GL_ARB_shader_storage_buffer_object
+/* reuse the GL 4.3 tokens and entry points */
+#endif
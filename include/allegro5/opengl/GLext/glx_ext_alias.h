@@ -215,3 +215,7 @@
 #ifdef _ALLEGRO_GLX_EXT_create_context_es_profile
 //nofunctions
 #endif
+
+#ifdef _ALLEGRO_GLX_EXT_buffer_age
+//nofunctions
+#endif
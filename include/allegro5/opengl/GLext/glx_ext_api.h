@@ -214,3 +214,7 @@ AGL_API(void, CopyImageSubDataNV, (Display *dpy, GLXContext srcCtx, GLuint srcNa
 #ifdef _ALLEGRO_GLX_EXT_create_context_es_profile
 // no functions
 #endif
+
+#ifdef _ALLEGRO_GLX_EXT_buffer_age
+// no functions
+#endif
@@ -513,3 +513,9 @@ typedef XID GLXVideoCaptureDeviceNV;
 #define GLX_CONTEXT_ES_PROFILE_BIT_EXT		0x00000004
 #define GLX_CONTEXT_ES2_PROFILE_BIT_EXT		0x00000004
 #endif
+
+#ifndef GLX_EXT_buffer_age
+#define GLX_EXT_buffer_age
+#define _ALLEGRO_GLX_EXT_buffer_age
+#define GLX_BACK_BUFFER_AGE_EXT            0x20F4
+#endif
@@ -21,6 +21,10 @@ struct _AL_THREAD
    bool should_stop;
    void (*proc)(struct _AL_THREAD *self, void *arg);
    void *arg;
+   /* Linux only: the kernel thread ID once the thread runs, and the nice
+    * value it applies to itself when it was set before that. */
+   pid_t tid;
+   int nice;
 };
 
 struct _AL_MUTEX
@@ -38,6 +42,11 @@ struct _AL_COND
    pthread_cond_t cond;
 };
 
+struct _AL_RWLOCK
+{
+   pthread_rwlock_t rwlock;
+};
+
 typedef struct ALLEGRO_TIMEOUT_UNIX ALLEGRO_TIMEOUT_UNIX;
 struct ALLEGRO_TIMEOUT_UNIX
 {
@@ -68,6 +77,23 @@ AL_INLINE(void, _al_mutex_unlock, (struct _AL_MUTEX *m),
       pthread_mutex_unlock(&m->mutex);
 })
 
+AL_INLINE(void, _al_rwlock_lock_read, (struct _AL_RWLOCK *l),
+{
+   pthread_rwlock_rdlock(&l->rwlock);
+})
+AL_INLINE(void, _al_rwlock_unlock_read, (struct _AL_RWLOCK *l),
+{
+   pthread_rwlock_unlock(&l->rwlock);
+})
+AL_INLINE(void, _al_rwlock_lock_write, (struct _AL_RWLOCK *l),
+{
+   pthread_rwlock_wrlock(&l->rwlock);
+})
+AL_INLINE(void, _al_rwlock_unlock_write, (struct _AL_RWLOCK *l),
+{
+   pthread_rwlock_unlock(&l->rwlock);
+})
+
 AL_INLINE(void, _al_cond_init, (struct _AL_COND *cond),
 {
    pthread_cond_init(&cond->cond, NULL);
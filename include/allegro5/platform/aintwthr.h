@@ -40,6 +40,15 @@ struct _AL_COND
    CRITICAL_SECTION mtxUnblockLock;
 };
 
+/* Slim reader-writer locks are only there since Vista. Without them, this
+ * falls back to a critical section, so readers exclude each other too.
+ */
+struct _AL_RWLOCK
+{
+   void *srw;
+   PCRITICAL_SECTION cs;
+};
+
 typedef struct ALLEGRO_TIMEOUT_WIN ALLEGRO_TIMEOUT_WIN;
 struct ALLEGRO_TIMEOUT_WIN
 {
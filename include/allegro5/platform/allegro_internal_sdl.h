@@ -11,6 +11,9 @@ typedef struct
 {
    ALLEGRO_SYSTEM system;
    ALLEGRO_MUTEX *mutex;
+   SDL_threadID event_thread; /* the thread allowed to pump events */
+   Uint32 wake_event;         /* SDL_RegisterEvents type, or 0 */
+   SDL_atomic_t wake_pending;
    #ifdef __EMSCRIPTEN__
       double timer_time;
    #endif
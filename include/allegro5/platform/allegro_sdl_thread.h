@@ -30,10 +30,17 @@ struct _AL_COND
    SDL_cond *cond;
 };
 
+/* SDL 2 has no reader-writer locks, so readers exclude each other too. */
+struct _AL_RWLOCK
+{
+   SDL_mutex *mutex;
+};
+
 typedef struct ALLEGRO_TIMEOUT_SDL ALLEGRO_TIMEOUT_SDL;
 struct ALLEGRO_TIMEOUT_SDL
 {
    int ms;
+   double deadline;
 };
 
 AL_INLINE(bool, _al_get_thread_should_stop, (struct _AL_THREAD *t),
@@ -55,6 +62,23 @@ AL_INLINE(void, _al_mutex_unlock, (struct _AL_MUTEX *m),
       SDL_UnlockMutex(m->mutex);
 })
 
+AL_INLINE(void, _al_rwlock_lock_read, (struct _AL_RWLOCK *l),
+{
+   SDL_LockMutex(l->mutex);
+})
+AL_INLINE(void, _al_rwlock_unlock_read, (struct _AL_RWLOCK *l),
+{
+   SDL_UnlockMutex(l->mutex);
+})
+AL_INLINE(void, _al_rwlock_lock_write, (struct _AL_RWLOCK *l),
+{
+   SDL_LockMutex(l->mutex);
+})
+AL_INLINE(void, _al_rwlock_unlock_write, (struct _AL_RWLOCK *l),
+{
+   SDL_UnlockMutex(l->mutex);
+})
+
 AL_INLINE(void, _al_cond_init, (struct _AL_COND *cond),
 {
    cond->cond = SDL_CreateCond();
@@ -52,9 +52,13 @@
 #cmakedefine ALLEGRO_HAVE_SYS_TYPES_H
 #cmakedefine ALLEGRO_HAVE_OSATOMIC_H
 #cmakedefine ALLEGRO_HAVE_SYS_INOTIFY_H
+#cmakedefine ALLEGRO_HAVE_SYS_EPOLL_H
+#cmakedefine ALLEGRO_HAVE_SYS_TIMERFD_H
 #cmakedefine ALLEGRO_HAVE_SAL_H
 
 /* Define to 1 if the corresponding functions are available. */
+#cmakedefine ALLEGRO_HAVE_FDOPENDIR
+#cmakedefine ALLEGRO_HAVE_FSTATAT
 #cmakedefine ALLEGRO_HAVE_GETEXECNAME
 #cmakedefine ALLEGRO_HAVE_MKSTEMP
 #cmakedefine ALLEGRO_HAVE_MMAP
@@ -111,6 +115,9 @@
 /* Define if XInput 2.2 X11 extension is supported. */
 #cmakedefine ALLEGRO_XWINDOWS_WITH_XINPUT2
 
+/* Define if the headless EGL display driver is built. */
+#cmakedefine ALLEGRO_XWINDOWS_WITH_EGL_HEADLESS
+
 
 /*---------------------------------------------------------------------------*/
 
@@ -15,7 +15,10 @@ typedef struct ALLEGRO_SHADER ALLEGRO_SHADER;
 
 enum ALLEGRO_SHADER_TYPE {
    ALLEGRO_VERTEX_SHADER = 1,
-   ALLEGRO_PIXEL_SHADER = 2
+   ALLEGRO_PIXEL_SHADER = 2,
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+   ALLEGRO_COMPUTE_SHADER = 4
+#endif
 };
 
 /* Enum: ALLEGRO_SHADER_TYPE
@@ -49,6 +52,8 @@ typedef enum ALLEGRO_SHADER_PLATFORM ALLEGRO_SHADER_PLATFORM;
 #define ALLEGRO_SHADER_VAR_ALPHA_TEST        "al_alpha_test"
 #define ALLEGRO_SHADER_VAR_ALPHA_FUNCTION    "al_alpha_func"
 #define ALLEGRO_SHADER_VAR_ALPHA_TEST_VALUE  "al_alpha_test_val"
+#define ALLEGRO_SHADER_VAR_HELD_TEX          "al_held_tex"
+#define ALLEGRO_SHADER_VAR_TEX_UNIT          "al_tex_unit"
 
 AL_FUNC(ALLEGRO_SHADER *, al_create_shader, (ALLEGRO_SHADER_PLATFORM platform));
 AL_FUNC(bool, al_attach_shader_source, (ALLEGRO_SHADER *shader,
@@ -74,6 +79,24 @@ AL_FUNC(bool, al_set_shader_float_vector, (const char *name, int num_components,
    const float *f, int num_elems));
 AL_FUNC(bool, al_set_shader_bool, (const char *name, bool b));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(int, al_get_shader_uniform_handle, (ALLEGRO_SHADER *shader,
+   const char *name));
+AL_FUNC(bool, al_set_shader_matrix_h, (int handle,
+   const ALLEGRO_TRANSFORM *matrix));
+AL_FUNC(bool, al_set_shader_int_h, (int handle, int i));
+AL_FUNC(bool, al_set_shader_float_h, (int handle, float f));
+AL_FUNC(bool, al_set_shader_int_vector_h, (int handle, int num_components,
+   const int *i, int num_elems));
+AL_FUNC(bool, al_set_shader_float_vector_h, (int handle, int num_components,
+   const float *f, int num_elems));
+AL_FUNC(bool, al_set_shader_bool_h, (int handle, bool b));
+AL_FUNC(bool, al_set_shader_image, (const char *name, ALLEGRO_BITMAP *bitmap,
+   int unit));
+AL_FUNC(bool, al_dispatch_compute, (int groups_x, int groups_y,
+   int groups_z));
+#endif
+
 AL_FUNC(char const *, al_get_default_shader_source, (ALLEGRO_SHADER_PLATFORM platform,
    ALLEGRO_SHADER_TYPE type));
 
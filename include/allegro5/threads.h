@@ -34,6 +34,29 @@ typedef struct ALLEGRO_MUTEX ALLEGRO_MUTEX;
  */
 typedef struct ALLEGRO_COND ALLEGRO_COND;
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_JOB_POOL
+ */
+typedef struct ALLEGRO_JOB_POOL ALLEGRO_JOB_POOL;
+
+/* Type: ALLEGRO_JOB_COUNTER
+ */
+typedef struct ALLEGRO_JOB_COUNTER ALLEGRO_JOB_COUNTER;
+
+/* Type: ALLEGRO_RWLOCK
+ */
+typedef struct ALLEGRO_RWLOCK ALLEGRO_RWLOCK;
+
+/* Enum: ALLEGRO_THREAD_PRIORITY
+ */
+typedef enum ALLEGRO_THREAD_PRIORITY {
+   ALLEGRO_THREAD_PRIORITY_LOW,
+   ALLEGRO_THREAD_PRIORITY_NORMAL,
+   ALLEGRO_THREAD_PRIORITY_HIGH,
+   ALLEGRO_THREAD_PRIORITY_REALTIME
+} ALLEGRO_THREAD_PRIORITY;
+#endif
+
 
 AL_FUNC(ALLEGRO_THREAD *, al_create_thread,
    (void *(*proc)(ALLEGRO_THREAD *thread, void *arg), void *arg));
@@ -47,9 +70,19 @@ AL_FUNC(void, al_set_thread_should_stop, (ALLEGRO_THREAD *outer));
 AL_FUNC(bool, al_get_thread_should_stop, (ALLEGRO_THREAD *outer));
 AL_FUNC(void, al_destroy_thread, (ALLEGRO_THREAD *thread));
 AL_FUNC(void, al_run_detached_thread, (void *(*proc)(void *arg), void *arg));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(bool, al_set_thread_priority, (ALLEGRO_THREAD *thread,
+   ALLEGRO_THREAD_PRIORITY priority));
+AL_FUNC(bool, al_set_thread_affinity, (ALLEGRO_THREAD *thread,
+   uint64_t cpu_mask));
+AL_FUNC(bool, al_set_thread_name, (ALLEGRO_THREAD *thread, const char *name));
+#endif
 
 AL_FUNC(ALLEGRO_MUTEX *, al_create_mutex, (void));
 AL_FUNC(ALLEGRO_MUTEX *, al_create_mutex_recursive, (void));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_MUTEX *, al_create_mutex_adaptive, (void));
+#endif
 AL_FUNC(void, al_lock_mutex, (ALLEGRO_MUTEX *mutex));
 AL_FUNC(void, al_unlock_mutex, (ALLEGRO_MUTEX *mutex));
 AL_FUNC(void, al_destroy_mutex, (ALLEGRO_MUTEX *mutex));
@@ -62,6 +95,43 @@ AL_FUNC(int, al_wait_cond_until, (ALLEGRO_COND *cond, ALLEGRO_MUTEX *mutex,
 AL_FUNC(void, al_broadcast_cond, (ALLEGRO_COND *cond));
 AL_FUNC(void, al_signal_cond, (ALLEGRO_COND *cond));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_RWLOCK *, al_create_rwlock, (void));
+AL_FUNC(void, al_destroy_rwlock, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_lock_rwlock_read, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_unlock_rwlock_read, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_lock_rwlock_write, (ALLEGRO_RWLOCK *rwlock));
+AL_FUNC(void, al_unlock_rwlock_write, (ALLEGRO_RWLOCK *rwlock));
+
+AL_FUNC(int, al_atomic_load, (volatile int *ptr));
+AL_FUNC(void, al_atomic_store, (volatile int *ptr, int value));
+AL_FUNC(int, al_atomic_fetch_add, (volatile int *ptr, int value));
+AL_FUNC(bool, al_atomic_compare_exchange, (volatile int *ptr, int expected,
+   int desired));
+AL_FUNC(void *, al_atomic_load_ptr, (void *volatile *ptr));
+AL_FUNC(void, al_atomic_store_ptr, (void *volatile *ptr, void *value));
+AL_FUNC(bool, al_atomic_compare_exchange_ptr, (void *volatile *ptr,
+   void *expected, void *desired));
+AL_FUNC(void, al_spin_pause, (void));
+#endif
+
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(ALLEGRO_JOB_POOL *, al_create_job_pool, (int num_workers));
+AL_FUNC(void, al_destroy_job_pool, (ALLEGRO_JOB_POOL *pool));
+AL_FUNC(int, al_get_job_pool_workers, (const ALLEGRO_JOB_POOL *pool));
+AL_FUNC(ALLEGRO_JOB_COUNTER *, al_create_job_counter, (void));
+AL_FUNC(void, al_destroy_job_counter, (ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(int, al_get_job_counter_value, (ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(bool, al_add_job, (ALLEGRO_JOB_POOL *pool, void (*func)(void *arg),
+                    void *arg, ALLEGRO_JOB_COUNTER *after,
+                    ALLEGRO_JOB_COUNTER *done));
+AL_FUNC(void, al_wait_for_job_counter, (ALLEGRO_JOB_POOL *pool,
+                    ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(void, al_parallel_for, (ALLEGRO_JOB_POOL *pool, int begin, int end,
+                    int grain, void (*func)(int begin, int end, void *arg),
+                    void *arg));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
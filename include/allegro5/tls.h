@@ -35,6 +35,10 @@ typedef enum ALLEGRO_STATE_FLAGS
     ALLEGRO_STATE_NEW_FILE_INTERFACE     = 0x0020,
     ALLEGRO_STATE_TRANSFORM              = 0x0040,
     ALLEGRO_STATE_PROJECTION_TRANSFORM   = 0x0100,
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+    ALLEGRO_STATE_SHADER                 = 0x0200,
+    ALLEGRO_STATE_CLIPPING_RECTANGLE     = 0x0400,
+#endif
 
     ALLEGRO_STATE_BITMAP                 = ALLEGRO_STATE_TARGET_BITMAP +\
                                            ALLEGRO_STATE_NEW_BITMAP_PARAMETERS,
@@ -58,6 +62,16 @@ struct ALLEGRO_STATE
 AL_FUNC(void, al_store_state, (ALLEGRO_STATE *state, int flags));
 AL_FUNC(void, al_restore_state, (ALLEGRO_STATE const *state));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_RENDER_STATE_BLOCK
+ */
+typedef struct ALLEGRO_RENDER_STATE_BLOCK ALLEGRO_RENDER_STATE_BLOCK;
+
+AL_FUNC(ALLEGRO_RENDER_STATE_BLOCK *, al_create_render_state_block, (int flags));
+AL_FUNC(void, al_destroy_render_state_block, (ALLEGRO_RENDER_STATE_BLOCK *block));
+AL_FUNC(void, al_apply_render_state_block, (ALLEGRO_RENDER_STATE_BLOCK const *block));
+#endif
+
 
 #ifdef __cplusplus
    }
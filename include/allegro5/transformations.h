@@ -50,6 +50,17 @@ AL_FUNC(void, al_perspective_transform, (ALLEGRO_TRANSFORM *trans, float left, f
 AL_FUNC(void, al_horizontal_shear_transform, (ALLEGRO_TRANSFORM *trans, float theta));
 AL_FUNC(void, al_vertical_shear_transform, (ALLEGRO_TRANSFORM *trans, float theta));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_transform_coordinates_n, (const ALLEGRO_TRANSFORM *trans,
+   float *xy, int stride, int n));
+AL_FUNC(void, al_transform_coordinates_3d_n, (const ALLEGRO_TRANSFORM *trans,
+   float *xyz, int stride, int n));
+AL_FUNC(void, al_transform_coordinates_4d_n, (const ALLEGRO_TRANSFORM *trans,
+   float *xyzw, int stride, int n));
+AL_FUNC(void, al_transform_coordinates_3d_projective_n, (const ALLEGRO_TRANSFORM *trans,
+   float *xyz, int stride, int n));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
@@ -47,6 +47,22 @@ AL_FUNC(const ALLEGRO_USTR *, al_ref_ustr, (ALLEGRO_USTR_INFO *info,
       const ALLEGRO_USTR *us, int start_pos, int end_pos));
 AL_FUNC(const ALLEGRO_USTR *, al_ref_info, (const ALLEGRO_USTR_INFO *info));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_USTR_ARENA
+ */
+typedef struct ALLEGRO_USTR_ARENA ALLEGRO_USTR_ARENA;
+
+/* Strings in arenas */
+AL_FUNC(ALLEGRO_USTR_ARENA *, al_create_ustr_arena, (void));
+AL_FUNC(void, al_destroy_ustr_arena, (ALLEGRO_USTR_ARENA *arena));
+AL_FUNC(const ALLEGRO_USTR *, al_ustr_arena_new, (ALLEGRO_USTR_ARENA *arena,
+      const char *s));
+AL_FUNC(const ALLEGRO_USTR *, al_ustr_arena_new_from_buffer,
+      (ALLEGRO_USTR_ARENA *arena, const char *s, size_t size));
+AL_FUNC(const ALLEGRO_USTR *, al_ustr_arena_dup, (ALLEGRO_USTR_ARENA *arena,
+      const ALLEGRO_USTR *us));
+#endif
+
 /* Sizes and offsets */
 AL_FUNC(size_t, al_ustr_size, (const ALLEGRO_USTR *us));
 AL_FUNC(size_t, al_ustr_length, (const ALLEGRO_USTR *us));
@@ -1,3 +1,15 @@
+/* APK assets are read through the NDK's AAssetManager where possible, which
+ * needs no JNI calls after opening and seeks natively. Assets stored
+ * uncompressed in the APK are mapped from its file descriptor, which gives
+ * al_get_file_mapping direct access to them. The Java AllegroAPKStream is
+ * only used if the asset manager can't be obtained.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <android/asset_manager.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_android.h"
 #include "allegro5/internal/aintern_android.h"
@@ -11,7 +23,14 @@ typedef struct ALLEGRO_FILE_APK ALLEGRO_FILE_APK;
 
 struct ALLEGRO_FILE_APK
 {
-   jobject apk;
+   jobject apk;         /* Java stream, or NULL */
+   AAsset *asset;       /* native asset, or NULL */
+   char *map;           /* page aligned start of the mapping, or NULL */
+   size_t map_len;
+   char *base;          /* start of the asset within the mapping */
+   int64_t size;
+   int64_t pos;         /* only kept for mapped assets */
+   bool eof_indicator;
    bool error_indicator;
 };
 
@@ -113,30 +132,120 @@ static long APK_size(jobject apk_stream)
 }
 
 
-static void *file_apk_fopen(const char *filename, const char *mode)
+/* AAssetManager does not interpret the path, so do what Path.simplifyPath
+ * does for the Java stream: drop empty and "." components and resolve "..".
+ */
+static char *simplify_path(const char *filename)
 {
-   ALLEGRO_FILE_APK *fp;
-   jobject apk;
+   char *out = al_malloc(strlen(filename) + 1);
+   size_t len = 0;
 
-   if (streq(mode, "r") || streq(mode, "rb"))
-      apk = APK_openRead(filename);
-   else
+   if (!out)
       return NULL;
 
-   if (!apk) {
-      apk_set_errno(NULL);
+   while (*filename) {
+      const char *end = strchr(filename, '/');
+      size_t n = end ? (size_t)(end - filename) : strlen(filename);
+
+      if (n == 0 || (n == 1 && filename[0] == '.')) {
+         /* skip */
+      }
+      else if (n == 2 && filename[0] == '.' && filename[1] == '.') {
+         while (len > 0 && out[len - 1] != '/')
+            len--;
+         if (len > 0)
+            len--;
+      }
+      else {
+         if (len > 0)
+            out[len++] = '/';
+         memcpy(out + len, filename, n);
+         len += n;
+      }
+
+      filename += n;
+      if (*filename == '/')
+         filename++;
+   }
+
+   out[len] = '\0';
+   return out;
+}
+
+
+static AAsset *asset_open(const char *filename)
+{
+   AAssetManager *mgr = _al_android_asset_manager();
+   AAsset *asset;
+   char *fn;
+
+   fn = simplify_path(filename);
+   if (!fn)
       return NULL;
+   asset = AAssetManager_open(mgr, fn, AASSET_MODE_RANDOM);
+   al_free(fn);
+   return asset;
+}
+
+
+/* Maps an asset which is stored uncompressed. The mapping is private and
+ * writable, like those made by al_fopen_mapped.
+ */
+static void asset_map(ALLEGRO_FILE_APK *fp)
+{
+   off64_t start, length, page_offset;
+   void *map;
+   int fd;
+
+   fd = AAsset_openFileDescriptor64(fp->asset, &start, &length);
+   if (fd < 0)
+      return;
+
+   if (length > 0 && (uint64_t)length <= SIZE_MAX / 2) {
+      page_offset = start % sysconf(_SC_PAGESIZE);
+      map = mmap(NULL, page_offset + length, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE, fd, start - page_offset);
+      if (map != MAP_FAILED) {
+         fp->map = map;
+         fp->map_len = page_offset + length;
+         fp->base = fp->map + page_offset;
+      }
    }
+   close(fd);
+}
 
-   fp = al_malloc(sizeof(*fp));
+
+static void *file_apk_fopen(const char *filename, const char *mode)
+{
+   ALLEGRO_FILE_APK *fp;
+
+   if (!streq(mode, "r") && !streq(mode, "rb"))
+      return NULL;
+
+   fp = al_calloc(1, sizeof(*fp));
    if (!fp) {
       al_set_errno(ENOMEM);
-      APK_close(apk);
       return NULL;
    }
 
-   fp->apk = apk;
-   fp->error_indicator = false;
+   if (_al_android_asset_manager()) {
+      fp->asset = asset_open(filename);
+      if (!fp->asset) {
+         apk_set_errno(NULL);
+         al_free(fp);
+         return NULL;
+      }
+      fp->size = AAsset_getLength64(fp->asset);
+      asset_map(fp);
+      return fp;
+   }
+
+   fp->apk = APK_openRead(filename);
+   if (!fp->apk) {
+      apk_set_errno(NULL);
+      al_free(fp);
+      return NULL;
+   }
 
    return fp;
 }
@@ -145,9 +254,14 @@ static void *file_apk_fopen(const char *filename, const char *mode)
 static bool file_apk_fclose(ALLEGRO_FILE *f)
 {
    ALLEGRO_FILE_APK *fp = cast_stream(f);
-   bool ret;
+   bool ret = true;
 
-   ret = APK_close(fp->apk);
+   if (fp->map)
+      munmap(fp->map, fp->map_len);
+   if (fp->asset)
+      AAsset_close(fp->asset);
+   if (fp->apk)
+      ret = APK_close(fp->apk);
 
    al_free(fp);
 
@@ -163,6 +277,34 @@ static size_t file_apk_fread(ALLEGRO_FILE *f, void *buf, size_t buf_size)
    if (buf_size == 0)
       return 0;
 
+   if (fp->base) {
+      size_t left = (fp->pos < fp->size) ? (size_t)(fp->size - fp->pos) : 0;
+      if (buf_size > left) {
+         buf_size = left;
+         fp->eof_indicator = true;
+      }
+      memcpy(buf, fp->base + fp->pos, buf_size);
+      fp->pos += buf_size;
+      return buf_size;
+   }
+
+   if (fp->asset) {
+      size_t total = 0;
+      while (total < buf_size) {
+         n = AAsset_read(fp->asset, (char *)buf + total, buf_size - total);
+         if (n < 0) {
+            apk_set_errno(fp);
+            break;
+         }
+         if (n == 0) {
+            fp->eof_indicator = true;
+            break;
+         }
+         total += n;
+      }
+      return total;
+   }
+
    n = APK_read(fp->apk, buf, buf_size);
    if (n < 0) {
       apk_set_errno(fp);
@@ -194,6 +336,11 @@ static bool file_apk_fflush(ALLEGRO_FILE *f)
 static int64_t file_apk_ftell(ALLEGRO_FILE *f)
 {
    ALLEGRO_FILE_APK *fp = cast_stream(f);
+
+   if (fp->base)
+      return fp->pos;
+   if (fp->asset)
+      return fp->size - AAsset_getRemainingLength64(fp->asset);
    return APK_tell(fp->apk);
 }
 
@@ -203,6 +350,31 @@ static bool file_apk_seek(ALLEGRO_FILE *f, int64_t offset, int whence)
    ALLEGRO_FILE_APK *fp = cast_stream(f);
    long base;
 
+   if (fp->asset) {
+      int64_t pos;
+
+      switch (whence) {
+         case ALLEGRO_SEEK_SET: pos = offset; break;
+         case ALLEGRO_SEEK_CUR: pos = file_apk_ftell(f) + offset; break;
+         case ALLEGRO_SEEK_END: pos = fp->size + offset; break;
+         default:
+            al_set_errno(EINVAL);
+            return false;
+      }
+      if (pos < 0) {
+         al_set_errno(EINVAL);
+         return false;
+      }
+      if (fp->base)
+         fp->pos = pos;
+      else if (AAsset_seek64(fp->asset, pos, SEEK_SET) < 0) {
+         apk_set_errno(fp);
+         return false;
+      }
+      fp->eof_indicator = false;
+      return true;
+   }
+
    switch (whence) {
       case ALLEGRO_SEEK_SET:
          base = 0;
@@ -241,7 +413,12 @@ static bool file_apk_seek(ALLEGRO_FILE *f, int64_t offset, int whence)
 static bool file_apk_feof(ALLEGRO_FILE *f)
 {
    ALLEGRO_FILE_APK *fp = cast_stream(f);
-   jboolean res = _jni_callBooleanMethodV(_al_android_get_jnienv(), fp->apk,
+   jboolean res;
+
+   if (fp->asset)
+      return fp->eof_indicator;
+
+   res = _jni_callBooleanMethodV(_al_android_get_jnienv(), fp->apk,
       "eof", "()Z");
    return res;
 }
@@ -267,12 +444,16 @@ static void file_apk_fclearerr(ALLEGRO_FILE *f)
    ALLEGRO_FILE_APK *fp = cast_stream(f);
 
    fp->error_indicator = false;
+   fp->eof_indicator = false;
 }
 
 
 static off_t file_apk_fsize(ALLEGRO_FILE *f)
 {
    ALLEGRO_FILE_APK *fp = cast_stream(f);
+
+   if (fp->asset)
+      return fp->size;
    return APK_size(fp->apk);
 }
 
@@ -301,6 +482,25 @@ const ALLEGRO_FILE_INTERFACE *_al_get_apk_file_vtable(void)
 }
 
 
+/* _al_android_get_apk_file_mapping:
+ *  The al_get_file_mapping part for APK files: succeeds for assets which are
+ *  stored uncompressed and could be mapped.
+ */
+bool _al_android_get_apk_file_mapping(ALLEGRO_FILE *f, void **ptr,
+   int64_t *size)
+{
+   ALLEGRO_FILE_APK *fp = cast_stream(f);
+
+   if (!fp->base)
+      return false;
+   if (ptr)
+      *ptr = fp->base;
+   if (size)
+      *size = fp->size;
+   return true;
+}
+
+
 /* Function: al_android_set_apk_file_interface
  */
 void al_android_set_apk_file_interface(void)
@@ -317,6 +317,9 @@ static bool _al_android_init_display(JNIEnv *env,
 
    _al_ogl_setup_gl(d);
 
+   d->extra_settings.settings[ALLEGRO_UPDATE_DISPLAY_REGION] =
+      _al_egl_have_swap_with_damage(eglGetCurrentDisplay());
+
    return true;
 }
 
@@ -700,15 +703,21 @@ static void android_unset_current_display(ALLEGRO_DISPLAY *dpy)
       (ALLEGRO_DISPLAY_ANDROID *)dpy);
 }
 
-static void android_flip_display(ALLEGRO_DISPLAY *dpy)
+static void android_present(ALLEGRO_DISPLAY *dpy, bool region, int x, int y,
+   int width, int height)
 {
    // Some Androids crash if you swap buffers with an fbo bound
    // so temporarily change target to the backbuffer.
    ALLEGRO_BITMAP *old_target = al_get_target_bitmap();
    al_set_target_backbuffer(dpy);
 
-   _jni_callVoidMethod(_al_android_get_jnienv(),
-      ((ALLEGRO_DISPLAY_ANDROID *)dpy)->surface_object, "egl_SwapBuffers");
+   /* The surface belongs to the Java side, but is current here. */
+   if (!region || !_al_egl_swap_buffers_with_damage(eglGetCurrentDisplay(),
+         eglGetCurrentSurface(EGL_DRAW), dpy->w, dpy->h,
+         x, y, width, height)) {
+      _jni_callVoidMethod(_al_android_get_jnienv(),
+         ((ALLEGRO_DISPLAY_ANDROID *)dpy)->surface_object, "egl_SwapBuffers");
+   }
 
    al_set_target_bitmap(old_target);
 
@@ -718,14 +727,22 @@ static void android_flip_display(ALLEGRO_DISPLAY *dpy)
    al_backup_dirty_bitmaps(dpy);
 }
 
+static void android_flip_display(ALLEGRO_DISPLAY *dpy)
+{
+   android_present(dpy, false, 0, 0, 0, 0);
+}
+
 static void android_update_display_region(ALLEGRO_DISPLAY *dpy, int x, int y,
    int width, int height)
 {
-   (void)x;
-   (void)y;
-   (void)width;
-   (void)height;
-   android_flip_display(dpy);
+   android_present(dpy, true, x, y, width, height);
+}
+
+static int android_get_buffer_age(ALLEGRO_DISPLAY *dpy)
+{
+   (void)dpy;
+   return _al_egl_get_buffer_age(eglGetCurrentDisplay(),
+      eglGetCurrentSurface(EGL_DRAW));
 }
 
 static bool android_acknowledge_resize(ALLEGRO_DISPLAY *dpy)
@@ -852,6 +869,7 @@ static void android_acknowledge_drawing_halt(ALLEGRO_DISPLAY *dpy)
          ALLEGRO_BITMAP_EXTRA_OPENGL *extra = bmp->extra;
          al_remove_opengl_fbo(bmp);
          glDeleteTextures(1, &extra->texture);
+         _al_ogl_forget_texture(extra->texture);
          extra->texture = 0;
       }
    }
@@ -897,7 +915,8 @@ static void android_acknowledge_drawing_resume(ALLEGRO_DISPLAY *dpy)
    // Bitmaps can still have stale shaders attached.
    _al_glsl_unuse_shaders();
 
-   // Restore the transformations.
+   // Restore the transformations. The new context has no uniforms set yet.
+   dpy->ogl_extras->projview_program = 0;
    dpy->vt->update_transformation(dpy, al_get_target_bitmap());
 
    // Restore bitmaps
@@ -913,7 +932,7 @@ static void android_acknowledge_drawing_resume(ALLEGRO_DISPLAY *dpy)
          int format = al_get_bitmap_format(bmp);
          format = _al_pixel_format_is_compressed(format) ? ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE : format;
 
-         if (!(bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE))
+         if (!(bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE) && !bmp->restore)
             _al_ogl_upload_bitmap_memory(bmp, format, bmp->memory);
          else
             _al_ogl_upload_bitmap_memory(bmp, format, NULL);
@@ -922,6 +941,9 @@ static void android_acknowledge_drawing_resume(ALLEGRO_DISPLAY *dpy)
       }
    }
 
+   // Refill the bitmaps without a memory copy, now that all textures exist.
+   _al_restore_display_bitmaps(dpy);
+
    android_broadcast_resume(d);
 
    ALLEGRO_DEBUG("acknowledge_drawing_resume end");
@@ -952,6 +974,7 @@ ALLEGRO_DISPLAY_INTERFACE *_al_get_android_display_driver(void)
    vt->unset_current_display = android_unset_current_display;
    vt->flip_display = android_flip_display;
    vt->update_display_region = android_update_display_region;
+   vt->get_buffer_age = android_get_buffer_age;
    vt->acknowledge_resize = android_acknowledge_resize;
    vt->create_bitmap = _al_ogl_create_bitmap;
    vt->get_backbuffer = _al_ogl_get_backbuffer;
@@ -25,6 +25,7 @@
 
 #include <dlfcn.h>
 #include <jni.h>
+#include <android/asset_manager_jni.h>
 
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern_opengl.h"
@@ -40,6 +41,8 @@ struct system_data_t {
    jclass image_loader_class;
    jclass clipboard_class;
    jclass apk_fs_class;
+   jobject asset_manager_object;
+   AAssetManager *asset_manager;
 
    ALLEGRO_SYSTEM_ANDROID *system;
    ALLEGRO_MUTEX *mutex;
@@ -99,6 +102,11 @@ jclass _al_android_clipboard_class(void)
    return system_data.clipboard_class;
 }
 
+AAssetManager *_al_android_asset_manager(void)
+{
+   return system_data.asset_manager;
+}
+
 jobject _al_android_activity_object()
 {
    return system_data.activity_object;
@@ -177,6 +185,7 @@ JNI_FUNC(bool, AllegroActivity, nativeOnCreate, (JNIEnv *env, jobject obj))
    jclass iae;
    jclass aisc;
    jclass asc;
+   jobject res, am;
 
    ALLEGRO_DEBUG("entered nativeOnCreate");
 
@@ -213,6 +222,22 @@ JNI_FUNC(bool, AllegroActivity, nativeOnCreate, (JNIEnv *env, jobject obj))
    asc = (*env)->FindClass(env, ALLEGRO_ANDROID_PACKAGE_NAME_SLASH "/AllegroAPKList");
    system_data.apk_fs_class = (*env)->NewGlobalRef(env, asc);
 
+   /* The native asset manager is only valid while the Java one is alive. */
+   ALLEGRO_DEBUG("get asset manager");
+   res = _jni_callObjectMethod(env, system_data.activity_object,
+      "getResources", "()Landroid/content/res/Resources;");
+   if (res) {
+      am = _jni_callObjectMethod(env, res, "getAssets",
+         "()Landroid/content/res/AssetManager;");
+      if (am) {
+         system_data.asset_manager_object = (*env)->NewGlobalRef(env, am);
+         system_data.asset_manager = AAssetManager_fromJava(env,
+            system_data.asset_manager_object);
+         _jni_callv(env, DeleteLocalRef, am);
+      }
+      _jni_callv(env, DeleteLocalRef, res);
+   }
+
    ALLEGRO_DEBUG("create mutex and cond objects");
    system_data.mutex = al_create_mutex();
    system_data.cond  = al_create_cond();
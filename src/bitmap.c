@@ -23,10 +23,13 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_jobs.h"
 #include "allegro5/internal/aintern_pixels.h"
 #include "allegro5/internal/aintern_shader.h"
 #include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_transform.h"
 
 ALLEGRO_DEBUG_CHANNEL("bitmap")
 
@@ -69,6 +72,7 @@ static ALLEGRO_BITMAP *create_memory_bitmap(ALLEGRO_DISPLAY *current_display,
    al_identity_transform(&bitmap->transform);
    al_identity_transform(&bitmap->inverse_transform);
    bitmap->inverse_transform_dirty = false;
+   bitmap->transform_kind = _AL_TRANSFORM_IDENTITY;
    al_identity_transform(&bitmap->proj_transform);
    al_orthographic_transform(&bitmap->proj_transform, 0, 0, -1.0, w, h, 1.0);
    bitmap->parent = NULL;
@@ -144,6 +148,7 @@ ALLEGRO_BITMAP *_al_create_bitmap_params(ALLEGRO_DISPLAY *current_display,
    al_identity_transform(&bitmap->transform);
    al_identity_transform(&bitmap->inverse_transform);
    bitmap->inverse_transform_dirty = false;
+   bitmap->transform_kind = _AL_TRANSFORM_IDENTITY;
    al_identity_transform(&bitmap->proj_transform);
    al_orthographic_transform(&bitmap->proj_transform, 0, 0, -1.0, w, h, 1.0);
    bitmap->parent = NULL;
@@ -151,6 +156,7 @@ ALLEGRO_BITMAP *_al_create_bitmap_params(ALLEGRO_DISPLAY *current_display,
    bitmap->yofs = 0;
    bitmap->_flags |= ALLEGRO_VIDEO_BITMAP;
    bitmap->dirty = !(bitmap->_flags & ALLEGRO_NO_PRESERVE_TEXTURE);
+   bitmap->num_dirty_rects = 0;
    bitmap->_depth = depth;
    bitmap->_samples = samples;
    bitmap->use_bitmap_blender = false;
@@ -162,7 +168,9 @@ ALLEGRO_BITMAP *_al_create_bitmap_params(ALLEGRO_DISPLAY *current_display,
     */
 
    ASSERT(bitmap->pitch >= w * al_get_pixel_size(bitmap->_format));
+   _AL_BEGIN_CPU_ZONE("upload_bitmap");
    result = bitmap->vt->upload_bitmap(bitmap);
+   _AL_END_CPU_ZONE();
 
    if (!result) {
       al_destroy_bitmap(bitmap);
@@ -222,11 +230,29 @@ void al_destroy_bitmap(ALLEGRO_BITMAP *bitmap)
 
    _al_set_bitmap_shader_field(bitmap, NULL);
 
+   /* Saves of the bitmap which wait for its readback copy it now. */
+   if (_al_has_bitmap_saves())
+      _al_update_bitmap_saves(NULL, bitmap, true);
+
    _al_unregister_destructor(_al_dtor_list, bitmap->dtor_item);
 
+   if (bitmap->restore_arg_dtor)
+      bitmap->restore_arg_dtor(bitmap->restore_arg);
+   bitmap->restore = NULL;
+   bitmap->restore_arg = NULL;
+   bitmap->restore_arg_dtor = NULL;
+
+   if (bitmap->pool && _al_release_pooled_bitmap(bitmap))
+      return;
+
    if (!al_is_sub_bitmap(bitmap)) {
       ALLEGRO_DISPLAY* disp = _al_get_bitmap_display(bitmap);
       if (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) {
+         /* The upload thread may still be reading the pixels. */
+         if (bitmap->upload_display) {
+            bitmap->upload_display->vt->cancel_bitmap_upload(
+               bitmap->upload_display, bitmap);
+         }
          destroy_memory_bitmap(bitmap);
          return;
       }
@@ -366,6 +392,21 @@ int al_get_bitmap_samples(ALLEGRO_BITMAP *bitmap)
       return bitmap->_samples;
 }
 
+
+/* Function: al_resolve_bitmap
+ */
+void al_resolve_bitmap(ALLEGRO_BITMAP *bitmap)
+{
+   if (bitmap->parent)
+      bitmap = bitmap->parent;
+
+   if (bitmap->_samples == 0 || bitmap->locked || !bitmap->vt ||
+         !bitmap->vt->resolve)
+      return;
+
+   bitmap->vt->resolve(bitmap);
+}
+
 /* Function: al_get_bitmap_blend_color
  */
 ALLEGRO_COLOR al_get_bitmap_blend_color(void)
@@ -516,6 +557,9 @@ void al_set_clipping_rectangle(int x, int y, int width, int height)
    bitmap->cr_excl = x + width;
    bitmap->cb_excl = y + height;
 
+   /* Drawing into the target can only change the clipped region. */
+   _al_mark_bitmap_dirty(bitmap, x, y, width, height);
+
    if (bitmap->vt && bitmap->vt->update_clipping_rectangle) {
       bitmap->vt->update_clipping_rectangle(bitmap);
    }
@@ -588,6 +632,7 @@ ALLEGRO_BITMAP *al_create_sub_bitmap(ALLEGRO_BITMAP *parent,
    al_identity_transform(&bitmap->transform);
    al_identity_transform(&bitmap->inverse_transform);
    bitmap->inverse_transform_dirty = false;
+   bitmap->transform_kind = _AL_TRANSFORM_IDENTITY;
    al_identity_transform(&bitmap->proj_transform);
    al_orthographic_transform(&bitmap->proj_transform, 0, 0, -1.0, w, h, 1.0);
    bitmap->shader = NULL;
@@ -663,6 +708,66 @@ int al_get_bitmap_y(ALLEGRO_BITMAP *bitmap)
 }
 
 
+/* Copies a video bitmap into another one of the same display without a
+ * round trip through system memory, either with the driver's copy_bitmap
+ * if the formats are the same or by drawing it. Returns false without
+ * touching dst if neither can be used.
+ */
+static bool transfer_bitmap_data_gpu(ALLEGRO_BITMAP *src, ALLEGRO_BITMAP *dst)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ALLEGRO_BITMAP *src_parent = src->parent ? src->parent : src;
+   int src_flags = al_get_bitmap_flags(src);
+   int dst_flags = al_get_bitmap_flags(dst);
+   int dst_format = al_get_bitmap_format(dst);
+   _ALLEGRO_RENDER_STATE render_state;
+   ALLEGRO_STATE state;
+
+   if (!display ||
+       _al_get_bitmap_display(src) != display ||
+       _al_get_bitmap_display(dst) != display ||
+       src_parent == al_get_backbuffer(display) ||
+       al_is_bitmap_locked(src) || al_is_bitmap_locked(dst) ||
+       _al_pixel_format_is_compressed(dst_format) ||
+       ((src_flags ^ dst_flags) & ALLEGRO_SRGB))
+      return false;
+
+   if (al_get_bitmap_format(src) == dst_format && dst->vt->copy_bitmap &&
+       dst->vt->copy_bitmap(dst, src)) {
+      _al_mark_bitmap_dirty(dst, 0, 0, dst->w, dst->h);
+      ALLEGRO_DEBUG("Copied bitmap on the GPU.\n");
+      return true;
+   }
+
+   /* Drawing doesn't update mipmaps and can't happen in the middle of held
+    * or recorded drawing.
+    */
+   if ((dst_flags & ALLEGRO_MIPMAP) || al_is_bitmap_drawing_held() ||
+       al_get_target_command_list())
+      return false;
+
+   al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+   render_state = display->render_state;
+   display->render_state.write_mask = ALLEGRO_MASK_RGBA;
+   display->render_state.depth_test = false;
+   display->render_state.alpha_test = false;
+   if (display->vt->update_render_state)
+      display->vt->update_render_state(display);
+
+   al_set_target_bitmap(dst);
+   al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+   al_draw_bitmap(src, 0, 0, 0);
+
+   al_restore_state(&state);
+   display->render_state = render_state;
+   if (display->vt->update_render_state)
+      display->vt->update_render_state(display);
+
+   ALLEGRO_DEBUG("Converted bitmap on the GPU.\n");
+   return true;
+}
+
+
 static bool transfer_bitmap_data(ALLEGRO_BITMAP *src, ALLEGRO_BITMAP *dst)
 {
    ALLEGRO_LOCKED_REGION *dst_region;
@@ -674,6 +779,12 @@ static bool transfer_bitmap_data(ALLEGRO_BITMAP *src, ALLEGRO_BITMAP *dst)
    int copy_w = src->w;
    int copy_h = src->h;
 
+   if (!((al_get_bitmap_flags(src) | al_get_bitmap_flags(dst)) &
+         ALLEGRO_MEMORY_BITMAP) &&
+       transfer_bitmap_data_gpu(src, dst)) {
+      return true;
+   }
+
    if (src_compressed && dst_compressed && src_format == dst_format) {
       int block_width = al_get_pixel_block_width(src_format);
       int block_height = al_get_pixel_block_height(src_format);
@@ -719,7 +830,25 @@ static bool transfer_bitmap_data(ALLEGRO_BITMAP *src, ALLEGRO_BITMAP *dst)
 }
 
 
-void _al_copy_bitmap_data(
+/* Conversions of at least this many pixels are split into bands of rows
+ * which are done by the worker threads.
+ */
+#define PARALLEL_MIN_PIXELS (512 * 512)
+#define MIN_BAND_ROWS       32
+
+typedef struct BITMAP_DATA_JOB {
+   const void *src;
+   int src_format;
+   int src_pitch;
+   void *dst;
+   int dst_format;
+   int dst_pitch;
+   int sx, sy, dx, dy, width, height;
+   int band_h;
+} BITMAP_DATA_JOB;
+
+
+static void copy_bitmap_data(
    const void *src, int src_pitch, void *dst, int dst_pitch,
    int sx, int sy, int dx, int dy, int width, int height,
    int format)
@@ -762,11 +891,95 @@ void _al_copy_bitmap_data(
    }
 }
 
+static void convert_rows(const BITMAP_DATA_JOB *job, int y, int height)
+{
+   if (job->src_format == job->dst_format) {
+      copy_bitmap_data(job->src, job->src_pitch, job->dst, job->dst_pitch,
+         job->sx, job->sy + y, job->dx, job->dy + y, job->width, height,
+         job->src_format);
+   }
+   else {
+      (_al_convert_funcs[job->src_format][job->dst_format])(
+         job->src, job->src_pitch, job->dst, job->dst_pitch,
+         job->sx, job->sy + y, job->dx, job->dy + y, job->width, height);
+   }
+}
+
+
+static void convert_bands(int begin, int end, void *arg)
+{
+   const BITMAP_DATA_JOB *job = arg;
+   int band;
+
+   for (band = begin; band < end; band++) {
+      int y = band * job->band_h;
+      convert_rows(job, y, _ALLEGRO_MIN(job->band_h, job->height - y));
+   }
+}
+
+
+static void convert_job(BITMAP_DATA_JOB *job)
+{
+   int block_height = al_get_pixel_block_height(job->src_format);
+   ALLEGRO_JOB_POOL *pool;
+   int num_threads, num_bands;
+
+   if ((int64_t)job->width * job->height < PARALLEL_MIN_PIXELS ||
+         !(pool = _al_get_job_pool()) ||
+         (num_threads = al_get_job_pool_workers(pool)) < 2) {
+      convert_rows(job, 0, job->height);
+      return;
+   }
+
+   num_bands = _ALLEGRO_MIN(num_threads * 2, job->height / MIN_BAND_ROWS);
+   if (num_bands < 2) {
+      convert_rows(job, 0, job->height);
+      return;
+   }
+
+   /* Compressed formats can only be split between blocks. */
+   job->band_h = (job->height + num_bands - 1) / num_bands;
+   job->band_h = (job->band_h + block_height - 1) / block_height *
+      block_height;
+   num_bands = (job->height + job->band_h - 1) / job->band_h;
+
+   al_parallel_for(pool, 0, num_bands, 1, convert_bands, job);
+}
+
+
+void _al_copy_bitmap_data(
+   const void *src, int src_pitch, void *dst, int dst_pitch,
+   int sx, int sy, int dx, int dy, int width, int height,
+   int format)
+{
+   BITMAP_DATA_JOB job;
+
+   if ((src == dst) && (src_pitch == dst_pitch)) {
+      return;
+   }
+
+   job.src = src;
+   job.src_format = format;
+   job.src_pitch = src_pitch;
+   job.dst = dst;
+   job.dst_format = format;
+   job.dst_pitch = dst_pitch;
+   job.sx = sx;
+   job.sy = sy;
+   job.dx = dx;
+   job.dy = dy;
+   job.width = width;
+   job.height = height;
+   convert_job(&job);
+}
+
 void _al_convert_bitmap_data(
    const void *src, int src_format, int src_pitch,
    void *dst, int dst_format, int dst_pitch,
    int sx, int sy, int dx, int dy, int width, int height)
 {
+   BITMAP_DATA_JOB job;
+
    ASSERT(src);
    ASSERT(dst);
    ASSERT(_al_pixel_format_is_real(dst_format));
@@ -783,8 +996,19 @@ void _al_convert_bitmap_data(
    ASSERT(!_al_pixel_format_is_video_only(src_format));
    ASSERT(!_al_pixel_format_is_video_only(dst_format));
 
-   (_al_convert_funcs[src_format][dst_format])(src, src_pitch,
-      dst, dst_pitch, sx, sy, dx, dy, width, height);
+   job.src = src;
+   job.src_format = src_format;
+   job.src_pitch = src_pitch;
+   job.dst = dst;
+   job.dst_format = dst_format;
+   job.dst_pitch = dst_pitch;
+   job.sx = sx;
+   job.sy = sy;
+   job.dx = dx;
+   job.dy = dy;
+   job.width = width;
+   job.height = height;
+   convert_job(&job);
 }
 
 
@@ -815,6 +1039,170 @@ void al_backup_dirty_bitmap(ALLEGRO_BITMAP *bitmap)
 }
 
 
+/* Function: al_set_bitmap_restore_callback
+ */
+void al_set_bitmap_restore_callback(ALLEGRO_BITMAP *bitmap,
+   bool (*callback)(ALLEGRO_BITMAP *bitmap, void *arg), void *arg)
+{
+   ASSERT(bitmap);
+   ASSERT(!bitmap->parent);
+
+   _al_set_bitmap_restore(bitmap, callback, arg, NULL);
+}
+
+
+void _al_set_bitmap_restore(ALLEGRO_BITMAP *bitmap,
+   bool (*restore)(ALLEGRO_BITMAP *bitmap, void *arg), void *arg,
+   void (*arg_dtor)(void *arg))
+{
+   if (bitmap->restore_arg_dtor)
+      bitmap->restore_arg_dtor(bitmap->restore_arg);
+
+   bitmap->restore = restore;
+   bitmap->restore_arg = arg;
+   bitmap->restore_arg_dtor = arg_dtor;
+
+   /* Backends drop the memory copy of a bitmap with a callback when asked
+    * to back it up, or recreate it from the whole bitmap without one.
+    */
+   if (!restore)
+      _al_mark_bitmap_all_dirty(bitmap);
+   al_backup_dirty_bitmap(bitmap);
+}
+
+
+void _al_restore_display_bitmaps(ALLEGRO_DISPLAY *display)
+{
+   unsigned i;
+
+   /* Callbacks may create bitmaps, which appends to the vector. */
+   for (i = 0; i < _al_vector_size(&display->bitmaps); i++) {
+      ALLEGRO_BITMAP **bptr = _al_vector_ref(&display->bitmaps, i);
+      ALLEGRO_BITMAP *bmp = *bptr;
+
+      if (!bmp->restore || bmp->parent ||
+            (al_get_bitmap_flags(bmp) & ALLEGRO_MEMORY_BITMAP))
+         continue;
+
+      if (!bmp->restore(bmp, bmp->restore_arg))
+         ALLEGRO_WARN("Failed to restore bitmap %p\n", bmp);
+      bmp->dirty = false;
+      bmp->num_dirty_rects = 0;
+   }
+}
+
+
+/* Adds a region, in the coordinates of bitmap, to the ones which
+ * al_backup_dirty_bitmap has to read back.
+ */
+void _al_mark_bitmap_dirty(ALLEGRO_BITMAP *bitmap, int x, int y, int w, int h)
+{
+   _AL_DIRTY_RECT *r;
+   int i;
+
+   if (bitmap->parent) {
+      x += bitmap->xofs;
+      y += bitmap->yofs;
+      bitmap = bitmap->parent;
+   }
+
+   /* Memory bitmaps are never backed up. This also keeps threads drawing
+    * to one from writing here at the same time.
+    */
+   if (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP)
+      return;
+
+   if (bitmap->dirty && bitmap->num_dirty_rects == 0)
+      return;
+
+   if (x < 0) {
+      w += x;
+      x = 0;
+   }
+   if (y < 0) {
+      h += y;
+      y = 0;
+   }
+   if (x + w > bitmap->w)
+      w = bitmap->w - x;
+   if (y + h > bitmap->h)
+      h = bitmap->h - y;
+   if (w <= 0 || h <= 0)
+      return;
+
+   if (w == bitmap->w && h == bitmap->h) {
+      _al_mark_bitmap_all_dirty(bitmap);
+      return;
+   }
+
+   if (!bitmap->dirty) {
+      bitmap->dirty = true;
+      bitmap->num_dirty_rects = 0;
+   }
+
+   for (i = 0; i < bitmap->num_dirty_rects; i++) {
+      r = &bitmap->dirty_rects[i];
+      if (x >= r->x && y >= r->y &&
+            x + w <= r->x + r->w && y + h <= r->y + r->h)
+         return;
+   }
+
+   if (bitmap->num_dirty_rects == _AL_MAX_DIRTY_RECTS) {
+      int x2 = x + w;
+      int y2 = y + h;
+      for (i = 0; i < bitmap->num_dirty_rects; i++) {
+         r = &bitmap->dirty_rects[i];
+         x2 = _ALLEGRO_MAX(x2, r->x + r->w);
+         y2 = _ALLEGRO_MAX(y2, r->y + r->h);
+         x = _ALLEGRO_MIN(x, r->x);
+         y = _ALLEGRO_MIN(y, r->y);
+      }
+      w = x2 - x;
+      h = y2 - y;
+      bitmap->num_dirty_rects = 0;
+   }
+
+   r = &bitmap->dirty_rects[bitmap->num_dirty_rects++];
+   r->x = x;
+   r->y = y;
+   r->w = w;
+   r->h = h;
+}
+
+
+void _al_mark_bitmap_all_dirty(ALLEGRO_BITMAP *bitmap)
+{
+   if (bitmap->parent)
+      bitmap = bitmap->parent;
+   bitmap->dirty = true;
+   bitmap->num_dirty_rects = 0;
+}
+
+
+/* Uploads a whole chain of compressed mipmap levels, bypassing locking.
+ * The data may be modified. Returns false if the bitmap can't take them,
+ * in which case the caller should fall back to al_lock_bitmap_blocked.
+ */
+bool _al_upload_compressed_bitmap_levels(ALLEGRO_BITMAP *bitmap,
+   int num_levels, void *data)
+{
+   ASSERT(bitmap);
+   ASSERT(data);
+
+   if (bitmap->parent || bitmap->locked || !bitmap->vt ||
+         !bitmap->vt->upload_compressed_levels ||
+         !_al_pixel_format_is_compressed(al_get_bitmap_format(bitmap))) {
+      return false;
+   }
+
+   if (!bitmap->vt->upload_compressed_levels(bitmap, num_levels, data))
+      return false;
+
+   _al_mark_bitmap_all_dirty(bitmap);
+   return true;
+}
+
+
 void _al_get_bitmap_wrap(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP_WRAP *wrap_u, ALLEGRO_BITMAP_WRAP *wrap_v)
 {
    ASSERT(bitmap);
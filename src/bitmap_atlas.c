@@ -0,0 +1,391 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Texture atlases.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+/* Title: Texture atlases
+ */
+
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_dtor.h"
+#include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("atlas")
+
+
+/* Every region is surrounded by a border of this many pixels, which is
+ * filled with the outermost pixels of the region so filtering at the edges
+ * does not pick up the neighbours.
+ */
+#define ATLAS_BORDER 1
+
+
+/* A page is packed with the skyline bottom-left heuristic. The skyline is
+ * a list of horizontal segments, sorted by x, covering the page width. Each
+ * segment is the top edge of the used area below it.
+ */
+typedef struct ATLAS_SEGMENT
+{
+   int x, y, w;
+} ATLAS_SEGMENT;
+
+typedef struct ATLAS_PAGE
+{
+   ALLEGRO_BITMAP *bitmap;
+   _AL_VECTOR skyline;
+} ATLAS_PAGE;
+
+struct ALLEGRO_ATLAS
+{
+   int page_w, page_h;
+   int format, flags;
+   _AL_VECTOR pages;    /* ATLAS_PAGE */
+   _AL_VECTOR bitmaps;  /* ALLEGRO_BITMAP *, the regions handed out */
+   _AL_LIST_ITEM *dtor_item;
+};
+
+
+/* Returns the y position a w x h rectangle would have when placed on the
+ * skyline starting at segment i, or -1 if it does not fit there.
+ */
+static int skyline_fit(ATLAS_PAGE *page, int page_h, unsigned i, int w, int h)
+{
+   ATLAS_SEGMENT *seg = _al_vector_ref(&page->skyline, i);
+   int x = seg->x;
+   int page_w = al_get_bitmap_width(page->bitmap);
+   int width_left = w;
+   int y = 0;
+
+   if (x + w > page_w)
+      return -1;
+
+   while (width_left > 0) {
+      ASSERT(i < _al_vector_size(&page->skyline));
+      seg = _al_vector_ref(&page->skyline, i);
+      if (seg->y > y)
+         y = seg->y;
+      if (y + h > page_h)
+         return -1;
+      width_left -= seg->w;
+      i++;
+   }
+
+   return y;
+}
+
+
+/* Finds the lowest position for a w x h rectangle, preferring the narrowest
+ * segment on ties. Returns the segment index or -1.
+ */
+static int skyline_find(ATLAS_PAGE *page, int w, int h, int *ret_y)
+{
+   int page_h = al_get_bitmap_height(page->bitmap);
+   int best = -1;
+   int best_bottom = 0;
+   int best_w = 0;
+   unsigned i;
+
+   for (i = 0; i < _al_vector_size(&page->skyline); i++) {
+      ATLAS_SEGMENT *seg = _al_vector_ref(&page->skyline, i);
+      int y = skyline_fit(page, page_h, i, w, h);
+      if (y < 0)
+         continue;
+      if (best < 0 || y + h < best_bottom ||
+            (y + h == best_bottom && seg->w < best_w)) {
+         best = i;
+         best_bottom = y + h;
+         best_w = seg->w;
+         *ret_y = y;
+      }
+   }
+
+   return best;
+}
+
+
+/* Raises the skyline over a w x h rectangle placed at segment i. */
+static void skyline_add(ATLAS_PAGE *page, unsigned i, int y, int w, int h)
+{
+   ATLAS_SEGMENT *seg;
+   ATLAS_SEGMENT *prev;
+   int x = ((ATLAS_SEGMENT *)_al_vector_ref(&page->skyline, i))->x;
+
+   seg = _al_vector_alloc_mid(&page->skyline, i);
+   seg->x = x;
+   seg->y = y + h;
+   seg->w = w;
+
+   /* Cut away the segments now covered by the new one. */
+   for (i++; i < _al_vector_size(&page->skyline);) {
+      int shrink;
+      prev = _al_vector_ref(&page->skyline, i - 1);
+      seg = _al_vector_ref(&page->skyline, i);
+      if (seg->x >= prev->x + prev->w)
+         break;
+      shrink = prev->x + prev->w - seg->x;
+      seg->x += shrink;
+      seg->w -= shrink;
+      if (seg->w > 0)
+         break;
+      _al_vector_delete_at(&page->skyline, i);
+   }
+
+   /* Merge neighbours at the same height. */
+   for (i = 1; i < _al_vector_size(&page->skyline);) {
+      prev = _al_vector_ref(&page->skyline, i - 1);
+      seg = _al_vector_ref(&page->skyline, i);
+      if (prev->y == seg->y) {
+         prev->w += seg->w;
+         _al_vector_delete_at(&page->skyline, i);
+      }
+      else {
+         i++;
+      }
+   }
+}
+
+
+static ATLAS_PAGE *push_new_page(ALLEGRO_ATLAS *atlas)
+{
+   ATLAS_PAGE *page;
+   ATLAS_SEGMENT *seg;
+   ALLEGRO_BITMAP *bitmap;
+   ALLEGRO_STATE state;
+
+   /* The pages are destroyed together with the atlas so it is not safe to
+    * register destructors for them.
+    */
+   _al_push_destructor_owner();
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS |
+      ALLEGRO_STATE_TARGET_BITMAP);
+   al_set_new_bitmap_format(atlas->format);
+   al_set_new_bitmap_flags(atlas->flags);
+   bitmap = al_create_bitmap(atlas->page_w, atlas->page_h);
+   if (bitmap) {
+      al_set_target_bitmap(bitmap);
+      al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+   }
+   al_restore_state(&state);
+   _al_pop_destructor_owner();
+
+   if (!bitmap) {
+      ALLEGRO_ERROR("Unable to create a %dx%d atlas page.\n",
+         atlas->page_w, atlas->page_h);
+      return NULL;
+   }
+
+   page = _al_vector_alloc_back(&atlas->pages);
+   page->bitmap = bitmap;
+   _al_vector_init(&page->skyline, sizeof(ATLAS_SEGMENT));
+   seg = _al_vector_alloc_back(&page->skyline);
+   seg->x = 0;
+   seg->y = 0;
+   seg->w = atlas->page_w;
+
+   ALLEGRO_DEBUG("New atlas page %d: %p\n",
+      (int)_al_vector_size(&atlas->pages) - 1, bitmap);
+
+   return page;
+}
+
+
+/* Function: al_create_atlas
+ */
+ALLEGRO_ATLAS *al_create_atlas(int page_w, int page_h)
+{
+   ALLEGRO_ATLAS *atlas;
+
+   ASSERT(page_w > 2 * ATLAS_BORDER);
+   ASSERT(page_h > 2 * ATLAS_BORDER);
+
+   atlas = al_calloc(1, sizeof *atlas);
+   if (!atlas)
+      return NULL;
+
+   atlas->page_w = page_w;
+   atlas->page_h = page_h;
+   atlas->format = al_get_new_bitmap_format();
+   atlas->flags = al_get_new_bitmap_flags();
+   _al_vector_init(&atlas->pages, sizeof(ATLAS_PAGE));
+   _al_vector_init(&atlas->bitmaps, sizeof(ALLEGRO_BITMAP *));
+
+   atlas->dtor_item = _al_register_destructor(_al_dtor_list, "atlas", atlas,
+      (void (*)(void *))al_destroy_atlas);
+
+   return atlas;
+}
+
+
+/* Function: al_destroy_atlas
+ */
+void al_destroy_atlas(ALLEGRO_ATLAS *atlas)
+{
+   unsigned i;
+
+   if (!atlas)
+      return;
+
+   _al_unregister_destructor(_al_dtor_list, atlas->dtor_item);
+
+   for (i = 0; i < _al_vector_size(&atlas->bitmaps); i++) {
+      ALLEGRO_BITMAP **bmp = _al_vector_ref(&atlas->bitmaps, i);
+      al_destroy_bitmap(*bmp);
+   }
+   _al_vector_free(&atlas->bitmaps);
+
+   for (i = 0; i < _al_vector_size(&atlas->pages); i++) {
+      ATLAS_PAGE *page = _al_vector_ref(&atlas->pages, i);
+      al_destroy_bitmap(page->bitmap);
+      _al_vector_free(&page->skyline);
+   }
+   _al_vector_free(&atlas->pages);
+
+   al_free(atlas);
+}
+
+
+/* Function: al_create_atlas_bitmap
+ */
+ALLEGRO_BITMAP *al_create_atlas_bitmap(ALLEGRO_ATLAS *atlas, int w, int h)
+{
+   int bw = w + 2 * ATLAS_BORDER;
+   int bh = h + 2 * ATLAS_BORDER;
+   ATLAS_PAGE *page = NULL;
+   ALLEGRO_BITMAP *sub;
+   ALLEGRO_BITMAP **back;
+   int seg = -1;
+   int y = 0;
+   unsigned i;
+
+   ASSERT(atlas);
+   ASSERT(w > 0 && h > 0);
+
+   if (bw > atlas->page_w || bh > atlas->page_h) {
+      ALLEGRO_WARN("Region too large for the atlas: %dx%d > %dx%d\n",
+         bw, bh, atlas->page_w, atlas->page_h);
+      return NULL;
+   }
+
+   for (i = 0; i < _al_vector_size(&atlas->pages); i++) {
+      page = _al_vector_ref(&atlas->pages, i);
+      seg = skyline_find(page, bw, bh, &y);
+      if (seg >= 0)
+         break;
+   }
+
+   if (seg < 0) {
+      page = push_new_page(atlas);
+      if (!page)
+         return NULL;
+      seg = skyline_find(page, bw, bh, &y);
+      ASSERT(seg == 0);
+   }
+
+   _al_push_destructor_owner();
+   sub = al_create_sub_bitmap(page->bitmap,
+      ((ATLAS_SEGMENT *)_al_vector_ref(&page->skyline, seg))->x + ATLAS_BORDER,
+      y + ATLAS_BORDER, w, h);
+   _al_pop_destructor_owner();
+
+   if (!sub)
+      return NULL;
+
+   skyline_add(page, seg, y, bw, bh);
+
+   back = _al_vector_alloc_back(&atlas->bitmaps);
+   *back = sub;
+
+   return sub;
+}
+
+
+/* Function: al_add_atlas_bitmap
+ */
+ALLEGRO_BITMAP *al_add_atlas_bitmap(ALLEGRO_ATLAS *atlas,
+   ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP *sub;
+   ALLEGRO_STATE state;
+   int w, h;
+
+   ASSERT(atlas);
+   ASSERT(bitmap);
+
+   w = al_get_bitmap_width(bitmap);
+   h = al_get_bitmap_height(bitmap);
+
+   sub = al_create_atlas_bitmap(atlas, w, h);
+   if (!sub)
+      return NULL;
+
+   /* Drawing outside of the sub-bitmap would be clipped, so the region and
+    * its border are filled through the page.
+    */
+   al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+   al_set_target_bitmap(al_get_parent_bitmap(sub));
+   al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+   al_set_clipping_rectangle(
+      al_get_bitmap_x(sub) - ATLAS_BORDER, al_get_bitmap_y(sub) - ATLAS_BORDER,
+      w + 2 * ATLAS_BORDER, h + 2 * ATLAS_BORDER);
+   {
+      float x = al_get_bitmap_x(sub);
+      float y = al_get_bitmap_y(sub);
+      const float b = ATLAS_BORDER;
+
+      al_draw_bitmap(bitmap, x, y, 0);
+      al_draw_scaled_bitmap(bitmap, 0, 0, 1, h, x - b, y, b, h, 0);
+      al_draw_scaled_bitmap(bitmap, w - 1, 0, 1, h, x + w, y, b, h, 0);
+      al_draw_scaled_bitmap(bitmap, 0, 0, w, 1, x, y - b, w, b, 0);
+      al_draw_scaled_bitmap(bitmap, 0, h - 1, w, 1, x, y + h, w, b, 0);
+      al_draw_scaled_bitmap(bitmap, 0, 0, 1, 1, x - b, y - b, b, b, 0);
+      al_draw_scaled_bitmap(bitmap, w - 1, 0, 1, 1, x + w, y - b, b, b, 0);
+      al_draw_scaled_bitmap(bitmap, 0, h - 1, 1, 1, x - b, y + h, b, b, 0);
+      al_draw_scaled_bitmap(bitmap, w - 1, h - 1, 1, 1, x + w, y + h, b, b, 0);
+   }
+   al_reset_clipping_rectangle();
+
+   al_restore_state(&state);
+
+   return sub;
+}
+
+
+/* Function: al_get_atlas_num_pages
+ */
+int al_get_atlas_num_pages(ALLEGRO_ATLAS *atlas)
+{
+   ASSERT(atlas);
+
+   return _al_vector_size(&atlas->pages);
+}
+
+
+/* Function: al_get_atlas_page
+ */
+ALLEGRO_BITMAP *al_get_atlas_page(ALLEGRO_ATLAS *atlas, int index)
+{
+   ATLAS_PAGE *page;
+
+   ASSERT(atlas);
+   ASSERT(index >= 0 && index < (int)_al_vector_size(&atlas->pages));
+
+   page = _al_vector_ref(&atlas->pages, index);
+   return page->bitmap;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
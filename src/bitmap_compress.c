@@ -0,0 +1,340 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Texture compression of loaded bitmaps.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_pixels.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+ALLEGRO_DEBUG_CHANNEL("bitmap")
+
+/*
+ * ALLEGRO_COMPRESS_TEXTURE encodes a freshly loaded bitmap to DXT1, or to
+ * DXT5 if it has any translucent pixels. The encoder takes the end points
+ * of each 4x4 block from a diagonal of the box bounding its colours and
+ * picks the nearest palette entry per pixel. That is much
+ * faster than an exhaustive search and good enough for most textures,
+ * which is what matters when doing it at load time.
+ */
+
+typedef struct BLOCK
+{
+   unsigned char rgba[16][4];
+} BLOCK;
+
+
+static void fetch_block(const unsigned char *data, int pitch, int w, int h,
+   int bx, int by, BLOCK *block)
+{
+   int x, y;
+
+   /* Pixels beyond the edge repeat the last row or column. */
+   for (y = 0; y < 4; y++) {
+      int sy = _ALLEGRO_MIN(by + y, h - 1);
+      const unsigned char *row = data + sy * pitch;
+      for (x = 0; x < 4; x++) {
+         int sx = _ALLEGRO_MIN(bx + x, w - 1);
+         memcpy(block->rgba[y * 4 + x], row + sx * 4, 4);
+      }
+   }
+}
+
+
+static unsigned int pack_565(const int c[3])
+{
+   return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+}
+
+
+static void unpack_565(unsigned int p, int c[3])
+{
+   int r = (p >> 11) & 31;
+   int g = (p >> 5) & 63;
+   int b = p & 31;
+
+   c[0] = (r << 3) | (r >> 2);
+   c[1] = (g << 2) | (g >> 4);
+   c[2] = (b << 3) | (b >> 2);
+}
+
+
+static void put_le16(unsigned char *out, unsigned int v)
+{
+   out[0] = v & 0xff;
+   out[1] = (v >> 8) & 0xff;
+}
+
+
+static void select_diagonal(const BLOCK *block, int lo[3], int hi[3])
+{
+   int mean[3];
+   int widest = 0;
+   int i, j;
+
+   for (j = 0; j < 3; j++) {
+      int sum = 0;
+      for (i = 0; i < 16; i++)
+         sum += block->rgba[i][j];
+      mean[j] = sum / 16;
+      if (hi[j] - lo[j] > hi[widest] - lo[widest])
+         widest = j;
+   }
+
+   for (j = 0; j < 3; j++) {
+      int cov = 0;
+      if (j == widest)
+         continue;
+      for (i = 0; i < 16; i++) {
+         cov += (block->rgba[i][widest] - mean[widest]) *
+            (block->rgba[i][j] - mean[j]);
+      }
+      if (cov < 0) {
+         int t = lo[j];
+         lo[j] = hi[j];
+         hi[j] = t;
+      }
+   }
+}
+
+
+static void encode_color_block(const BLOCK *block, unsigned char *out)
+{
+   int lo[3] = {255, 255, 255};
+   int hi[3] = {0, 0, 0};
+   int palette[4][3];
+   unsigned int c0, c1;
+   unsigned int indices = 0;
+   int i, j;
+
+   for (i = 0; i < 16; i++) {
+      for (j = 0; j < 3; j++) {
+         lo[j] = _ALLEGRO_MIN(lo[j], block->rgba[i][j]);
+         hi[j] = _ALLEGRO_MAX(hi[j], block->rgba[i][j]);
+      }
+   }
+
+   /* Move the end points in a little, the extremes are rarely hit exactly
+    * once quantized and the interpolated entries then fit better.
+    */
+   for (j = 0; j < 3; j++) {
+      int inset = (hi[j] - lo[j]) >> 4;
+      lo[j] += inset;
+      hi[j] -= inset;
+   }
+
+   /* The box has two diagonals through each channel. Channels which fall
+    * while the widest one rises go from hi to lo instead.
+    */
+   select_diagonal(block, lo, hi);
+
+   c0 = pack_565(hi);
+   c1 = pack_565(lo);
+
+   if (c0 != c1) {
+      /* Four colour mode needs c0 > c1. */
+      if (c0 < c1) {
+         unsigned int t = c0;
+         c0 = c1;
+         c1 = t;
+      }
+
+      unpack_565(c0, palette[0]);
+      unpack_565(c1, palette[1]);
+      for (j = 0; j < 3; j++) {
+         palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+         palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+      }
+
+      for (i = 15; i >= 0; i--) {
+         int best = 0;
+         int best_dist = INT_MAX;
+         int k;
+         for (k = 0; k < 4; k++) {
+            int dr = block->rgba[i][0] - palette[k][0];
+            int dg = block->rgba[i][1] - palette[k][1];
+            int db = block->rgba[i][2] - palette[k][2];
+            int dist = dr * dr + dg * dg + db * db;
+            if (dist < best_dist) {
+               best_dist = dist;
+               best = k;
+            }
+         }
+         indices = (indices << 2) | best;
+      }
+   }
+
+   put_le16(out, c0);
+   put_le16(out + 2, c1);
+   put_le16(out + 4, indices & 0xffff);
+   put_le16(out + 6, indices >> 16);
+}
+
+
+static void encode_alpha_block(const BLOCK *block, unsigned char *out)
+{
+   int a0 = 0;
+   int a1 = 255;
+   int palette[8];
+   uint64_t indices = 0;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      a0 = _ALLEGRO_MAX(a0, block->rgba[i][3]);
+      a1 = _ALLEGRO_MIN(a1, block->rgba[i][3]);
+   }
+
+   if (a0 != a1) {
+      /* Eight value mode, as a0 > a1. */
+      palette[0] = a0;
+      palette[1] = a1;
+      for (i = 2; i < 8; i++) {
+         palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+      }
+
+      for (i = 15; i >= 0; i--) {
+         int best = 0;
+         int best_dist = INT_MAX;
+         int k;
+         for (k = 0; k < 8; k++) {
+            int dist = abs(block->rgba[i][3] - palette[k]);
+            if (dist < best_dist) {
+               best_dist = dist;
+               best = k;
+            }
+         }
+         indices = (indices << 3) | best;
+      }
+   }
+
+   out[0] = a0;
+   out[1] = a1;
+   for (i = 0; i < 6; i++) {
+      out[2 + i] = (indices >> (8 * i)) & 0xff;
+   }
+}
+
+
+static bool is_opaque(const unsigned char *data, int pitch, int w, int h)
+{
+   int x, y;
+
+   for (y = 0; y < h; y++) {
+      const unsigned char *row = data + y * pitch;
+      for (x = 0; x < w; x++) {
+         if (row[x * 4 + 3] != 255)
+            return false;
+      }
+   }
+   return true;
+}
+
+
+static void encode(const ALLEGRO_LOCKED_REGION *src, int w, int h,
+   const ALLEGRO_LOCKED_REGION *dst, int format)
+{
+   const unsigned char *data = src->data;
+   BLOCK block;
+   int bx, by;
+
+   for (by = 0; by < h; by += 4) {
+      unsigned char *out = (unsigned char *)dst->data + (by / 4) * dst->pitch;
+      for (bx = 0; bx < w; bx += 4) {
+         fetch_block(data, src->pitch, w, h, bx, by, &block);
+         if (format == ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5) {
+            encode_alpha_block(&block, out);
+            out += 8;
+         }
+         encode_color_block(&block, out);
+         out += 8;
+      }
+   }
+}
+
+
+/* Returns the compressed replacement for bmp, destroying bmp, or bmp itself
+ * if it cannot or need not be compressed.
+ */
+ALLEGRO_BITMAP *_al_compress_loaded_bitmap(ALLEGRO_BITMAP *bmp, int flags)
+{
+   ALLEGRO_STATE state;
+   ALLEGRO_LOCKED_REGION *src;
+   ALLEGRO_LOCKED_REGION *dst;
+   ALLEGRO_BITMAP *compressed;
+   int w, h;
+   int format;
+
+   if (!bmp || !(flags & ALLEGRO_COMPRESS_TEXTURE))
+      return bmp;
+
+   if (al_get_bitmap_flags(bmp) & ALLEGRO_MEMORY_BITMAP) {
+      ALLEGRO_DEBUG("Not compressing a memory bitmap.\n");
+      return bmp;
+   }
+   if (_al_pixel_format_is_compressed(al_get_bitmap_format(bmp)))
+      return bmp;
+
+   w = al_get_bitmap_width(bmp);
+   h = al_get_bitmap_height(bmp);
+
+   src = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE,
+      ALLEGRO_LOCK_READONLY);
+   if (!src)
+      return bmp;
+
+   if (is_opaque(src->data, src->pitch, w, h))
+      format = ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1;
+   else
+      format = ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5;
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   al_set_new_bitmap_flags(al_get_bitmap_flags(bmp));
+   al_set_new_bitmap_format(format);
+   compressed = al_create_bitmap(w, h);
+   al_restore_state(&state);
+
+   if (compressed && al_get_bitmap_format(compressed) != format) {
+      al_destroy_bitmap(compressed);
+      compressed = NULL;
+   }
+   if (!compressed) {
+      ALLEGRO_WARN("Compressed textures not supported, keeping %s.\n",
+         _al_pixel_format_name(al_get_bitmap_format(bmp)));
+      al_unlock_bitmap(bmp);
+      return bmp;
+   }
+
+   dst = al_lock_bitmap_blocked(compressed, ALLEGRO_LOCK_WRITEONLY);
+   if (!dst) {
+      ALLEGRO_WARN("Could not lock the compressed bitmap.\n");
+      al_destroy_bitmap(compressed);
+      al_unlock_bitmap(bmp);
+      return bmp;
+   }
+
+   encode(src, w, h, dst, format);
+
+   al_unlock_bitmap(compressed);
+   al_unlock_bitmap(bmp);
+   al_destroy_bitmap(bmp);
+
+   ALLEGRO_DEBUG("Compressed %dx%d bitmap to %s.\n", w, h,
+      _al_pixel_format_name(format));
+   return compressed;
+}
+
+/* vim: set sts=3 sw=3 et: */
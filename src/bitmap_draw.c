@@ -14,25 +14,204 @@
  */
 
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_command_list.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_memblit.h"
 #include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_transform.h"
 
 
 static ALLEGRO_COLOR solid_white = {1, 1, 1, 1};
 
 
+/* A draw buffered by al_hold_bitmap_drawing_sorted, with the blender it was
+ * made with and its position in the sequence of draws as the last sort key.
+ */
+typedef struct SORTED_DRAW
+{
+   ALLEGRO_BITMAP *bitmap;
+   ALLEGRO_BLENDER blender;
+   int order;
+   ALLEGRO_TRANSFORMED_QUAD quad;
+} SORTED_DRAW;
+
+
+static void get_blender(ALLEGRO_BLENDER *b)
+{
+   al_get_separate_blender(&b->blend_op, &b->blend_source, &b->blend_dest,
+      &b->blend_alpha_op, &b->blend_alpha_source, &b->blend_alpha_dest);
+   b->blend_color = al_get_blend_color();
+}
+
+
+static void set_blender(const ALLEGRO_BLENDER *b)
+{
+   al_set_separate_blender(b->blend_op, b->blend_source, b->blend_dest,
+      b->blend_alpha_op, b->blend_alpha_source, b->blend_alpha_dest);
+   al_set_blend_color(b->blend_color);
+}
+
+
+/* Whether the current transform maps a bitmap to a flat quad which its four
+ * 2D corners describe completely.
+ */
+static bool corners_suffice(void)
+{
+   const float (*m)[4] = al_get_current_transform()->m;
+
+   return _al_get_current_transform_kind() != _AL_TRANSFORM_PROJECTIVE &&
+      m[0][2] == 0 && m[1][2] == 0 && m[3][2] == 0;
+}
+
+
+/* Records the draw with its corners transformed, the same way a command
+ * list does.
+ */
+static void add_sorted_draw(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_COLOR tint, float sx, float sy, float sw, float sh)
+{
+   const ALLEGRO_TRANSFORM *trans = al_get_current_transform();
+   SORTED_DRAW *draw = _al_vector_alloc_back(&display->sorted_draws);
+   ALLEGRO_TRANSFORMED_QUAD *q = &draw->quad;
+
+   draw->bitmap = bitmap;
+   get_blender(&draw->blender);
+   draw->order = _al_vector_size(&display->sorted_draws) - 1;
+
+   q->x[0] = 0;
+   q->y[0] = 0;
+   q->x[1] = sw;
+   q->y[1] = 0;
+   q->x[2] = sw;
+   q->y[2] = sh;
+   q->x[3] = 0;
+   q->y[3] = sh;
+   al_transform_coordinates(trans, &q->x[0], &q->y[0]);
+   al_transform_coordinates(trans, &q->x[1], &q->y[1]);
+   al_transform_coordinates(trans, &q->x[2], &q->y[2]);
+   al_transform_coordinates(trans, &q->x[3], &q->y[3]);
+   q->sx = sx;
+   q->sy = sy;
+   q->sw = sw;
+   q->sh = sh;
+   q->tint = tint;
+}
+
+
+/* Groups draws by blender, then by bitmap, keeping their order otherwise.
+ * The order of the groups themselves does not matter.
+ */
+static int compare_sorted_draws(const void *a, const void *b)
+{
+   const SORTED_DRAW *da = a;
+   const SORTED_DRAW *db = b;
+   int c = memcmp(&da->blender, &db->blender, sizeof da->blender);
+
+   if (c != 0)
+      return c;
+   if (da->bitmap != db->bitmap)
+      return (uintptr_t)da->bitmap < (uintptr_t)db->bitmap ? -1 : 1;
+   return da->order - db->order;
+}
+
+
+void _al_init_sorted_draws(ALLEGRO_DISPLAY *display)
+{
+   _al_vector_init(&display->sorted_draws, sizeof(SORTED_DRAW));
+}
+
+
+void _al_destroy_sorted_draws(ALLEGRO_DISPLAY *display)
+{
+   _al_vector_free(&display->sorted_draws);
+}
+
+
+/* Draws the buffered draws into the vertex cache, which must be held, and
+ * forgets them.
+ */
+void _al_draw_sorted_bitmaps(ALLEGRO_DISPLAY *display)
+{
+   unsigned int num = _al_vector_size(&display->sorted_draws);
+   SORTED_DRAW *draws;
+   ALLEGRO_TRANSFORM backup;
+   ALLEGRO_TRANSFORM identity;
+   ALLEGRO_BLENDER old_blender;
+   ALLEGRO_BLENDER blender;
+   unsigned int i;
+   ASSERT(display->cache_enabled);
+   ASSERT(!display->cache_sorted);
+
+   if (num == 0)
+      return;
+
+   draws = _al_vector_ref_front(&display->sorted_draws);
+   qsort(draws, num, sizeof *draws, compare_sorted_draws);
+
+   /* While held this only changes the transform applied to new draws. */
+   al_copy_transform(&backup, al_get_current_transform());
+   al_identity_transform(&identity);
+   al_use_transform(&identity);
+   get_blender(&old_blender);
+   blender = old_blender;
+
+   for (i = 0; i < num; i++) {
+      SORTED_DRAW *draw = &draws[i];
+
+      /* Held vertices are drawn with the blender current when they are
+       * flushed.
+       */
+      if (memcmp(&draw->blender, &blender, sizeof blender) != 0) {
+         _al_flush_vertex_cache(display, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+         blender = draw->blender;
+         set_blender(&blender);
+      }
+      _al_draw_transformed_quads(draw->bitmap, &draw->quad, 1);
+   }
+
+   if (memcmp(&old_blender, &blender, sizeof blender) != 0) {
+      _al_flush_vertex_cache(display, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+      set_blender(&old_blender);
+   }
+   al_use_transform(&backup);
+
+   _al_vector_free(&display->sorted_draws);
+}
+
+
 static void _bitmap_drawer(ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR tint,
    float sx, float sy, float sw, float sh, int flags)
 {
-   ALLEGRO_BITMAP *dest = al_get_target_bitmap();
-   ALLEGRO_DISPLAY *display = _al_get_bitmap_display(dest);
+   ALLEGRO_COMMAND_LIST *list = al_get_target_command_list();
+   ALLEGRO_BITMAP *dest;
+   ALLEGRO_DISPLAY *display;
    ASSERT(bitmap->parent == NULL);
    ASSERT(!(flags & (ALLEGRO_FLIP_HORIZONTAL | ALLEGRO_FLIP_VERTICAL)));
+
+   /* The current transform is the command list's, so this records the
+    * region exactly where it would have been drawn.
+    */
+   if (list) {
+      _al_command_list_add_bitmap(list, bitmap, tint, sx, sy, sw, sh);
+      return;
+   }
+
+   dest = al_get_target_bitmap();
+   display = _al_get_bitmap_display(dest);
    ASSERT(bitmap != dest && bitmap != dest->parent);
 
+   /* Draws the driver can replay from their corners are buffered. */
+   if (display && display->cache_sorted && bitmap->vt &&
+         bitmap->vt->draw_transformed_quads && corners_suffice()) {
+      add_sorted_draw(display, bitmap, tint, sx, sy, sw, sh);
+      return;
+   }
+
    /* If destination is memory, do a memory blit */
    if (al_get_bitmap_flags(dest) & ALLEGRO_MEMORY_BITMAP ||
        _al_pixel_format_is_compressed(al_get_bitmap_format(dest))) {
@@ -112,6 +291,15 @@ static void _draw_tinted_rotated_scaled_bitmap_region(ALLEGRO_BITMAP *bitmap,
    al_scale_transform(&t, xscale, yscale);
    al_rotate_transform(&t, angle);
    al_translate_transform(&t, dx, dy);
+
+   /* Drawing a whole bitmap at the origin, or a region that ends up there,
+    * needs no change of transform at all.
+    */
+   if (_al_classify_transform(&t) == _AL_TRANSFORM_IDENTITY) {
+      _bitmap_drawer(parent, tint, sx, sy, sw, sh, flags);
+      return;
+   }
+
    al_compose_transform(&t, &backup);
 
    al_use_transform(&t);
@@ -250,4 +438,225 @@ void al_draw_scaled_rotated_bitmap(ALLEGRO_BITMAP *bitmap,
 }
 
 
+/* Whether the driver of a display bitmap gets to draw it itself. */
+static bool can_draw_accelerated(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP *dest = al_get_target_bitmap();
+   ALLEGRO_BITMAP *parent = bitmap->parent ? bitmap->parent : bitmap;
+   ALLEGRO_BITMAP *dest_parent = dest->parent ? dest->parent : dest;
+
+   if (al_get_bitmap_flags(dest) & ALLEGRO_MEMORY_BITMAP ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(dest)))
+      return false;
+   if (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP ||
+       !al_is_compatible_bitmap(bitmap))
+      return false;
+   if (parent->locked || dest_parent->locked || parent == dest_parent)
+      return false;
+   return true;
+}
+
+
+/* Function: al_draw_bitmap_instances
+ */
+void al_draw_bitmap_instances(ALLEGRO_BITMAP *bitmap,
+   const ALLEGRO_SPRITE_INSTANCE *instances, int num_instances, int flags)
+{
+   ALLEGRO_BITMAP *parent;
+   bool held;
+   int i;
+   ASSERT(bitmap);
+   ASSERT(instances || num_instances == 0);
+
+   if (num_instances <= 0)
+      return;
+
+   parent = bitmap->parent ? bitmap->parent : bitmap;
+   if (parent->vt && parent->vt->draw_bitmap_instances &&
+         !al_get_target_command_list() && can_draw_accelerated(bitmap) &&
+         parent->vt->draw_bitmap_instances(bitmap, instances, num_instances,
+            flags)) {
+      return;
+   }
+
+   /* Otherwise this is the same as drawing each instance, batched. */
+   held = al_is_bitmap_drawing_held();
+   if (!held)
+      al_hold_bitmap_drawing(true);
+   for (i = 0; i < num_instances; i++) {
+      const ALLEGRO_SPRITE_INSTANCE *in = &instances[i];
+      _draw_tinted_rotated_scaled_bitmap_region(bitmap, in->tint,
+         in->cx, in->cy, in->angle, in->xscale, in->yscale,
+         in->sx, in->sy, in->sw, in->sh, in->dx, in->dy, flags);
+   }
+   if (!held)
+      al_hold_bitmap_drawing(false);
+}
+
+
+/* Draws quads recorded by a command list. They are drawn while held and with
+ * the identity transform, so the corners are used as they are.
+ */
+void _al_draw_transformed_quads(ALLEGRO_BITMAP *bitmap,
+   const ALLEGRO_TRANSFORMED_QUAD *quads, int num_quads)
+{
+   ALLEGRO_TRANSFORM backup;
+   ALLEGRO_TRANSFORM t;
+   int i;
+   ASSERT(bitmap->parent == NULL);
+
+   if (bitmap->vt && bitmap->vt->draw_transformed_quads &&
+         can_draw_accelerated(bitmap) &&
+         bitmap->vt->draw_transformed_quads(bitmap, quads, num_quads)) {
+      return;
+   }
+
+   /* Otherwise draw each quad with the transform mapping the source region
+    * onto its corners.
+    */
+   al_copy_transform(&backup, al_get_current_transform());
+   for (i = 0; i < num_quads; i++) {
+      const ALLEGRO_TRANSFORMED_QUAD *q = &quads[i];
+      al_identity_transform(&t);
+      t.m[0][0] = (q->x[1] - q->x[0]) / q->sw;
+      t.m[0][1] = (q->y[1] - q->y[0]) / q->sw;
+      t.m[1][0] = (q->x[3] - q->x[0]) / q->sh;
+      t.m[1][1] = (q->y[3] - q->y[0]) / q->sh;
+      t.m[3][0] = q->x[0];
+      t.m[3][1] = q->y[0];
+      al_compose_transform(&t, &backup);
+      al_use_transform(&t);
+      _bitmap_drawer(bitmap, q->tint, q->sx, q->sy, q->sw, q->sh, 0);
+   }
+   al_use_transform(&backup);
+}
+
+
+/* Draws unscaled regions of one bitmap, like a call of
+ * al_draw_tinted_bitmap_region for each. While drawing is held on an
+ * accelerated target the corners are transformed here and handed to the
+ * driver in chunks, which appends them to the vertex cache without changing
+ * the transform for every region.
+ */
+void _al_draw_bitmap_regions(ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR tint,
+   const ALLEGRO_BITMAP_REGION *regions, int num_regions)
+{
+   ALLEGRO_TRANSFORMED_QUAD quads[64];
+   ALLEGRO_BITMAP *parent;
+   ALLEGRO_DISPLAY *display;
+   const float (*m)[4];
+   int i, n;
+   ASSERT(bitmap);
+   ASSERT(regions || num_regions == 0);
+
+   if (num_regions <= 0)
+      return;
+
+   parent = bitmap->parent ? bitmap->parent : bitmap;
+   display = _al_get_bitmap_display(al_get_target_bitmap());
+   if (!parent->vt || !parent->vt->draw_transformed_quads ||
+         al_get_target_command_list() || !display ||
+         !display->cache_enabled || display->cache_sorted ||
+         !can_draw_accelerated(bitmap) || !corners_suffice()) {
+      goto fallback;
+   }
+
+   m = al_get_current_transform()->m;
+   while (num_regions > 0) {
+      for (n = 0, i = 0; i < num_regions && n < 64; i++) {
+         const ALLEGRO_BITMAP_REGION *r = &regions[i];
+         ALLEGRO_TRANSFORMED_QUAD *q = &quads[n];
+         float sx = r->sx + bitmap->xofs;
+         float sy = r->sy + bitmap->yofs;
+         float sw = r->sw;
+         float sh = r->sh;
+         float dx = r->dx;
+         float dy = r->dy;
+         float x, y;
+
+         /* Clip to the parent as _draw_tinted_rotated_scaled_bitmap_region
+          * does.
+          */
+         if (sx < 0) {
+            sw += sx;
+            dx -= sx;
+            sx = 0;
+         }
+         if (sy < 0) {
+            sh += sy;
+            dy -= sy;
+            sy = 0;
+         }
+         if (sx + sw > parent->w)
+            sw = parent->w - sx;
+         if (sy + sh > parent->h)
+            sh = parent->h - sy;
+         if (sw <= 0 || sh <= 0)
+            continue;
+
+         x = m[0][0] * dx + m[1][0] * dy + m[3][0];
+         y = m[0][1] * dx + m[1][1] * dy + m[3][1];
+         q->x[0] = x;
+         q->y[0] = y;
+         q->x[1] = x + m[0][0] * sw;
+         q->y[1] = y + m[0][1] * sw;
+         q->x[2] = q->x[1] + m[1][0] * sh;
+         q->y[2] = q->y[1] + m[1][1] * sh;
+         q->x[3] = x + m[1][0] * sh;
+         q->y[3] = y + m[1][1] * sh;
+         q->sx = sx;
+         q->sy = sy;
+         q->sw = sw;
+         q->sh = sh;
+         q->tint = tint;
+         n++;
+      }
+
+      if (n > 0 && !parent->vt->draw_transformed_quads(parent, quads, n))
+         goto fallback;
+      regions += i;
+      num_regions -= i;
+   }
+   return;
+
+fallback:
+   for (i = 0; i < num_regions; i++) {
+      const ALLEGRO_BITMAP_REGION *r = &regions[i];
+      _draw_tinted_rotated_scaled_bitmap_region(bitmap, tint, 0, 0, 0, 1, 1,
+         r->sx, r->sy, r->sw, r->sh, r->dx, r->dy, 0);
+   }
+}
+
+
+
+/* Adds triangles of the primitives addon to the held drawing batch of the
+ * target's display, so that they are drawn in order with the held bitmaps.
+ * Their positions are already transformed. Returns false if the driver
+ * can't add them, after flushing the batch, so that the caller can draw
+ * them right away instead.
+ */
+bool _al_draw_held_triangles(ALLEGRO_BITMAP *texture,
+   const _AL_PRIM_VERTEX *vtxs, int num_vtx)
+{
+   ALLEGRO_BITMAP *dest = al_get_target_bitmap();
+   ALLEGRO_DISPLAY *display = _al_get_bitmap_display(dest);
+   ALLEGRO_BITMAP *dest_parent;
+
+   if (!display || !display->cache_enabled || display->cache_sorted ||
+         display != al_get_current_display())
+      return false;
+
+   dest_parent = dest->parent ? dest->parent : dest;
+   if (!display->vt->draw_held_triangles ||
+         al_get_bitmap_flags(dest) & ALLEGRO_MEMORY_BITMAP ||
+         _al_pixel_format_is_compressed(al_get_bitmap_format(dest)) ||
+         dest_parent->locked ||
+         (texture && !can_draw_accelerated(texture)) ||
+         !display->vt->draw_held_triangles(display, texture, vtxs, num_vtx)) {
+      _al_flush_vertex_cache(display, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+      return false;
+   }
+   return true;
+}
+
 /* vim: set ts=8 sts=3 sw=3 et: */
@@ -16,7 +16,11 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_extmap.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_thread.h"
 #include "allegro5/internal/aintern_vector.h"
 
 #include <string.h>
@@ -25,6 +29,13 @@ ALLEGRO_DEBUG_CHANNEL("bitmap")
 
 #define MAX_EXTENSION   (32)
 
+#define MAX_LOADER_THREADS   32
+
+/* Read ahead while identifying files, since each identifier reads the
+ * header again.
+ */
+#define IDENTIFY_BUFFER_SIZE  4096
+
 
 typedef struct Handler
 {
@@ -34,17 +45,82 @@ typedef struct Handler
    ALLEGRO_IIO_FS_LOADER_FUNCTION fs_loader;
    ALLEGRO_IIO_FS_SAVER_FUNCTION fs_saver;
    ALLEGRO_IIO_IDENTIFIER_FUNCTION identifier;
+   ALLEGRO_IIO_PROBER_FUNCTION prober;
 } Handler;
 
 
+/* Files decoded into memory bitmaps by worker threads. The bitmaps are
+ * converted to the requested kind when they are collected, on the thread
+ * which collects them.
+ */
+struct ALLEGRO_BITMAP_LOADER
+{
+   ALLEGRO_EVENT_SOURCE es;
+   _AL_MUTEX mutex;
+   _AL_THREAD threads[MAX_LOADER_THREADS];
+   int num_threads;
+
+   char **paths;
+   int count;
+   int next;  /* the next file to decode */
+   bool quit;
+
+   /* Protected by mutex. Decoded memory bitmaps, NULL before a file is
+    * decoded, after it was collected or if it failed to load.
+    */
+   ALLEGRO_BITMAP **bitmaps;
+
+   /* The caller's state, which the worker threads take on. */
+   int flags;
+   int new_bitmap_flags;
+   int new_bitmap_format;
+   int load_w, load_h;
+   const ALLEGRO_FILE_INTERFACE *file_interface;
+   const ALLEGRO_FS_INTERFACE *fs_interface;
+};
+
+
+/* A save started by al_save_bitmap_async. It waits in pending_saves for
+ * the readback of bitmap until copy holds the pixels, then it becomes a job
+ * encoding copy into fp.
+ */
+typedef struct ASYNC_SAVE
+{
+   int id;
+   ALLEGRO_BITMAP *bitmap;
+   ALLEGRO_BITMAP *copy;
+   ALLEGRO_FILE *fp;
+   char ident[MAX_EXTENSION];
+} ASYNC_SAVE;
+
+
+/* The file a bitmap loaded with ALLEGRO_RELOAD_ON_RESTORE is restored from.
+ * It is allocated together with the filename.
+ */
+typedef struct RELOAD_SOURCE
+{
+   int flags;
+   char *filename;
+} RELOAD_SOURCE;
+
+
 /* globals */
 static _AL_VECTOR iio_table = _AL_VECTOR_INITIALIZER(Handler);
+static _AL_EXTMAP iio_map = _AL_EXTMAP_INITIALIZER;
+
+/* Protected by save_mutex. */
+static _AL_MUTEX save_mutex = _AL_MUTEX_UNINITED;
+static _AL_VECTOR pending_saves = _AL_VECTOR_INITIALIZER(ASYNC_SAVE *);
+static int last_save_id;
+static ALLEGRO_EVENT_SOURCE save_es;
 
 
 static Handler *add_iio_table_f(const char *ext)
 {
    Handler *ent;
 
+   if (!_al_extmap_insert(&iio_map, ext, _al_vector_size(&iio_table)))
+      return NULL;
    ent = _al_vector_alloc_back(&iio_table);
    strcpy(ent->extension, ext);
    ent->loader = NULL;
@@ -52,6 +128,7 @@ static Handler *add_iio_table_f(const char *ext)
    ent->fs_loader = NULL;
    ent->fs_saver = NULL;
    ent->identifier = NULL;
+   ent->prober = NULL;
 
    return ent;
 }
@@ -59,7 +136,7 @@ static Handler *add_iio_table_f(const char *ext)
 
 static Handler *find_handler(const char *extension, bool create_if_not)
 {
-   unsigned i;
+   int i;
 
    ASSERT(extension);
 
@@ -67,12 +144,9 @@ static Handler *find_handler(const char *extension, bool create_if_not)
       return NULL;
    }
 
-   for (i = 0; i < _al_vector_size(&iio_table); i++) {
-      Handler *l = _al_vector_ref(&iio_table, i);
-      if (0 == _al_stricmp(extension, l->extension)) {
-         return l;
-      }
-   }
+   i = _al_extmap_find(&iio_map, extension);
+   if (i >= 0)
+      return _al_vector_ref(&iio_table, i);
 
    if (create_if_not)
       return add_iio_table_f(extension);
@@ -83,39 +157,84 @@ static Handler *find_handler(const char *extension, bool create_if_not)
 
 static Handler *find_handler_for_file(ALLEGRO_FILE *f)
 {
+   ALLEGRO_FILE *buffered = NULL;
+   Handler *found = NULL;
+   int64_t pos;
+   void *base;
+   int64_t size;
    unsigned i;
 
    ASSERT(f);
 
+   /* Identifiers all read the start of the file, so keep it in a buffer
+    * rather than reading it again from f for each one. Mapped files don't
+    * need that.
+    */
+   pos = al_ftell(f);
+   if (pos >= 0 && !al_get_file_mapping(f, &base, &size))
+      buffered = al_fopen_buffered(f, IDENTIFY_BUFFER_SIZE);
+
    for (i = 0; i < _al_vector_size(&iio_table); i++) {
       Handler *l = _al_vector_ref(&iio_table, i);
       if (l->identifier) {
-         int64_t pos = al_ftell(f);
-         bool identified = l->identifier(f);
-         al_fseek(f, pos, ALLEGRO_SEEK_SET);
-         if (identified)
-            return l;
+         ALLEGRO_FILE *fp = buffered ? buffered : f;
+         bool identified = l->identifier(fp);
+         al_fseek(fp, pos, ALLEGRO_SEEK_SET);
+         if (identified) {
+            found = l;
+            break;
+         }
       }
    }
-   return NULL;
+
+   if (buffered) {
+      al_fclose(buffered);
+      al_fseek(f, pos, ALLEGRO_SEEK_SET);
+   }
+   return found;
 }
 
 
 static void free_iio_table(void)
 {
+   _al_extmap_free(&iio_map);
    _al_vector_free(&iio_table);
 }
 
 
+/* Encoding jobs are done by now, the shared job pool was shut down before.
+ * Saves still waiting for a readback are dropped.
+ */
+static void shutdown_bitmap_saves(void)
+{
+   unsigned i;
+
+   for (i = 0; i < _al_vector_size(&pending_saves); i++) {
+      ASYNC_SAVE **s = _al_vector_ref(&pending_saves, i);
+      al_fclose((*s)->fp);
+      al_free(*s);
+   }
+   _al_vector_free(&pending_saves);
+   al_destroy_user_event_source(&save_es);
+   _al_mutex_destroy(&save_mutex);
+}
+
+
 void _al_init_iio_table(void)
 {
+   _al_mutex_init(&save_mutex);
+   al_init_user_event_source(&save_es);
    _al_add_exit_func(free_iio_table, "free_iio_table");
+   _al_add_exit_func(shutdown_bitmap_saves, "shutdown_bitmap_saves");
 }
 
 #define REGISTER(function) \
    Handler *ent = find_handler(extension, function != NULL); \
+   if (!ent) { \
+      return false; \
+   } \
    if (!function) { \
-      if (!ent || !ent->function) { \
+      if (!ent->function) { \
          return false; /* Nothing to remove. */ \
       } \
    } \
@@ -168,6 +287,15 @@ bool al_register_bitmap_identifier(const char *extension,
 }
 
 
+/* Function: al_register_bitmap_prober
+ */
+bool al_register_bitmap_prober(const char *extension,
+   bool (*prober)(ALLEGRO_FILE *f, ALLEGRO_BITMAP_INFO *info))
+{
+   REGISTER(prober)
+}
+
+
 /* Function: al_load_bitmap
  */
 ALLEGRO_BITMAP *al_load_bitmap(const char *filename)
@@ -185,6 +313,72 @@ ALLEGRO_BITMAP *al_load_bitmap(const char *filename)
 }
 
 
+/* Restore callback of bitmaps loaded with ALLEGRO_RELOAD_ON_RESTORE. */
+static bool reload_bitmap(ALLEGRO_BITMAP *bitmap, void *arg)
+{
+   RELOAD_SOURCE *source = arg;
+   ALLEGRO_STATE state;
+   ALLEGRO_BITMAP *tmp;
+   ALLEGRO_LOCKED_REGION *src;
+   ALLEGRO_LOCKED_REGION *dst;
+   int w = al_get_bitmap_width(bitmap);
+   int h = al_get_bitmap_height(bitmap);
+   bool ok = false;
+
+   ALLEGRO_DEBUG("Reloading bitmap %p from %s\n", bitmap, source->filename);
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+   tmp = al_load_bitmap_flags(source->filename, source->flags);
+   al_restore_state(&state);
+   if (!tmp)
+      return false;
+
+   if (al_get_bitmap_width(tmp) != w || al_get_bitmap_height(tmp) != h) {
+      ALLEGRO_ERROR("%s changed size since it was loaded.\n",
+         source->filename);
+      al_destroy_bitmap(tmp);
+      return false;
+   }
+
+   src = al_lock_bitmap(tmp, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+   dst = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ANY,
+      ALLEGRO_LOCK_WRITEONLY);
+   if (src && dst) {
+      _al_convert_bitmap_data(src->data, src->format, src->pitch,
+         dst->data, dst->format, dst->pitch, 0, 0, 0, 0, w, h);
+      ok = true;
+   }
+   if (dst)
+      al_unlock_bitmap(bitmap);
+   al_destroy_bitmap(tmp);
+   return ok;
+}
+
+
+static void destroy_reload_source(void *arg)
+{
+   al_free(arg);
+}
+
+
+static void set_reload_source(ALLEGRO_BITMAP *bitmap, const char *filename,
+   int flags)
+{
+   size_t len = strlen(filename);
+   RELOAD_SOURCE *source = al_malloc(sizeof *source + len + 1);
+
+   if (!source)
+      return;
+   source->flags = flags &
+      ~(ALLEGRO_RELOAD_ON_RESTORE | ALLEGRO_COMPRESS_TEXTURE);
+   source->filename = (char *)(source + 1);
+   memcpy(source->filename, filename, len + 1);
+   _al_set_bitmap_restore(bitmap, reload_bitmap, source,
+      destroy_reload_source);
+}
+
+
 /* Function: al_load_bitmap_flags
  */
 ALLEGRO_BITMAP *al_load_bitmap_flags(const char *filename, int flags)
@@ -204,10 +398,16 @@ ALLEGRO_BITMAP *al_load_bitmap_flags(const char *filename, int flags)
 
    h = find_handler(ext, false);
    if (h && h->loader) {
+      _AL_BEGIN_CPU_ZONE("al_load_bitmap");
       ret = h->loader(filename, flags);
       if (!ret)
          ALLEGRO_ERROR("Failed loading bitmap %s with %s handler.\n",
             filename, ext);
+      else
+         ret = _al_compress_loaded_bitmap(ret, flags);
+      if (ret && (flags & ALLEGRO_RELOAD_ON_RESTORE))
+         set_reload_source(ret, filename, flags);
+      _AL_END_CPU_ZONE();
    }
    else {
       ALLEGRO_ERROR("No handler for bitmap %s!\n", filename);
@@ -264,14 +464,18 @@ ALLEGRO_BITMAP *al_load_bitmap_flags_f(ALLEGRO_FILE *fp,
    const char *ident, int flags)
 {
    Handler *h;
+   ALLEGRO_BITMAP *ret;
    if (ident)
       h = find_handler(ident, false);
    else
       h = find_handler_for_file(fp);
-   if (h && h->fs_loader)
-      return h->fs_loader(fp, flags);
-   else
+   if (!h || !h->fs_loader)
       return NULL;
+
+   _AL_BEGIN_CPU_ZONE("al_load_bitmap_f");
+   ret = _al_compress_loaded_bitmap(h->fs_loader(fp, flags), flags);
+   _AL_END_CPU_ZONE();
+   return ret;
 }
 
 
@@ -315,4 +519,419 @@ char const *al_identify_bitmap(char const *filename)
 }
 
 
+static bool probe_with_handler(Handler *h, ALLEGRO_FILE *fp,
+   ALLEGRO_BITMAP_INFO *info)
+{
+   int64_t pos;
+   bool ret;
+
+   if (!h || !h->prober)
+      return false;
+
+   memset(info, 0, sizeof(*info));
+   info->frames = 1;
+   info->format = ALLEGRO_PIXEL_FORMAT_ANY;
+
+   pos = al_ftell(fp);
+   ret = h->prober(fp, info);
+   al_fseek(fp, pos, ALLEGRO_SEEK_SET);
+
+   return ret;
+}
+
+
+/* Function: al_probe_bitmap_f
+ */
+bool al_probe_bitmap_f(ALLEGRO_FILE *fp, const char *ident,
+   ALLEGRO_BITMAP_INFO *info)
+{
+   Handler *h;
+   ASSERT(fp);
+   ASSERT(info);
+
+   h = find_handler_for_file(fp);
+   if (!h && ident)
+      h = find_handler(ident, false);
+   return probe_with_handler(h, fp, info);
+}
+
+
+/* Function: al_probe_bitmap
+ */
+bool al_probe_bitmap(const char *filename, ALLEGRO_BITMAP_INFO *info)
+{
+   ALLEGRO_FILE *fp;
+   bool ret;
+   ASSERT(filename);
+   ASSERT(info);
+
+   fp = al_fopen(filename, "rb");
+   if (!fp)
+      return false;
+   ret = al_probe_bitmap_f(fp, strrchr(filename, '.'), info);
+   al_fclose(fp);
+   return ret;
+}
+
+
+static void loader_thread(_AL_THREAD *thread, void *arg)
+{
+   ALLEGRO_BITMAP_LOADER *loader = arg;
+
+   _al_thread_set_name(thread, "al-bitmap-load");
+
+   al_set_new_file_interface(loader->file_interface);
+   al_set_fs_interface(loader->fs_interface);
+   al_set_new_bitmap_flags((loader->new_bitmap_flags | ALLEGRO_MEMORY_BITMAP) &
+      ~ALLEGRO_VIDEO_BITMAP);
+   al_set_new_bitmap_format(loader->new_bitmap_format);
+   al_set_new_bitmap_load_size(loader->load_w, loader->load_h);
+
+   while (true) {
+      ALLEGRO_BITMAP *bmp;
+      ALLEGRO_EVENT event;
+      int i;
+
+      _al_mutex_lock(&loader->mutex);
+      if (loader->quit || loader->next >= loader->count) {
+         _al_mutex_unlock(&loader->mutex);
+         break;
+      }
+      i = loader->next++;
+      _al_mutex_unlock(&loader->mutex);
+
+      /* Compression needs the display, so it is done when collecting. */
+      bmp = al_load_bitmap_flags(loader->paths[i],
+         loader->flags & ~ALLEGRO_COMPRESS_TEXTURE);
+
+      _al_mutex_lock(&loader->mutex);
+      loader->bitmaps[i] = bmp;
+      _al_mutex_unlock(&loader->mutex);
+
+      memset(&event, 0, sizeof event);
+      event.user.type = ALLEGRO_EVENT_BITMAP_LOADED;
+      event.user.data1 = (intptr_t)loader;
+      event.user.data2 = i;
+      event.user.data3 = bmp != NULL;
+      al_emit_user_event(&loader->es, &event, NULL);
+   }
+}
+
+
+/* Function: al_load_bitmaps_async
+ */
+ALLEGRO_BITMAP_LOADER *al_load_bitmaps_async(const char * const *paths,
+   int n, int flags, ALLEGRO_EVENT_QUEUE *queue)
+{
+   ALLEGRO_BITMAP_LOADER *loader;
+   ALLEGRO_JOB_POOL *pool;
+   int i;
+   ASSERT(paths || n == 0);
+   ASSERT(n >= 0);
+
+   loader = al_calloc(1, sizeof *loader);
+   if (!loader)
+      return NULL;
+
+   loader->count = n;
+   loader->paths = al_calloc(n > 0 ? n : 1, sizeof *loader->paths);
+   loader->bitmaps = al_calloc(n > 0 ? n : 1, sizeof *loader->bitmaps);
+   if (!loader->paths || !loader->bitmaps) {
+      al_free(loader->paths);
+      al_free(loader->bitmaps);
+      al_free(loader);
+      return NULL;
+   }
+   for (i = 0; i < n; i++) {
+      loader->paths[i] = al_malloc(strlen(paths[i]) + 1);
+      strcpy(loader->paths[i], paths[i]);
+   }
+
+   loader->flags = flags;
+   loader->new_bitmap_flags = al_get_new_bitmap_flags();
+   loader->new_bitmap_format = al_get_new_bitmap_format();
+   al_get_new_bitmap_load_size(&loader->load_w, &loader->load_h);
+   loader->file_interface = al_get_new_file_interface();
+   loader->fs_interface = al_get_fs_interface();
+
+   al_init_user_event_source(&loader->es);
+   if (queue)
+      al_register_event_source(queue, &loader->es);
+
+   _al_mutex_init(&loader->mutex);
+   pool = _al_get_job_pool();
+   loader->num_threads = _ALLEGRO_MIN(n, _ALLEGRO_MIN(
+      pool ? al_get_job_pool_workers(pool) : 1, MAX_LOADER_THREADS));
+   for (i = 0; i < loader->num_threads; i++)
+      _al_thread_create(&loader->threads[i], loader_thread, loader);
+
+   ALLEGRO_DEBUG("Loading %d bitmaps on %d threads.\n", n,
+      loader->num_threads);
+   return loader;
+}
+
+
+/* Function: al_get_loaded_bitmap
+ */
+ALLEGRO_BITMAP *al_get_loaded_bitmap(ALLEGRO_BITMAP_LOADER *loader, int index)
+{
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_STATE state;
+   ASSERT(loader);
+   ASSERT(index >= 0 && index < loader->count);
+
+   _al_mutex_lock(&loader->mutex);
+   bmp = loader->bitmaps[index];
+   loader->bitmaps[index] = NULL;
+   _al_mutex_unlock(&loader->mutex);
+
+   if (!bmp || (loader->new_bitmap_flags & ALLEGRO_MEMORY_BITMAP))
+      return bmp;
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   al_set_new_bitmap_flags(loader->new_bitmap_flags);
+   al_set_new_bitmap_format(loader->new_bitmap_format);
+   al_convert_bitmap(bmp);
+   al_restore_state(&state);
+
+   return _al_compress_loaded_bitmap(bmp, loader->flags);
+}
+
+
+/* Function: al_get_bitmap_loader_event_source
+ */
+ALLEGRO_EVENT_SOURCE *al_get_bitmap_loader_event_source(
+   ALLEGRO_BITMAP_LOADER *loader)
+{
+   ASSERT(loader);
+   return &loader->es;
+}
+
+
+/* Function: al_destroy_bitmap_loader
+ */
+void al_destroy_bitmap_loader(ALLEGRO_BITMAP_LOADER *loader)
+{
+   int i;
+
+   if (!loader)
+      return;
+
+   _al_mutex_lock(&loader->mutex);
+   loader->quit = true;
+   _al_mutex_unlock(&loader->mutex);
+
+   /* A file which is being decoded is finished first. */
+   for (i = 0; i < loader->num_threads; i++)
+      _al_thread_join(&loader->threads[i]);
+
+   al_destroy_user_event_source(&loader->es);
+   _al_mutex_destroy(&loader->mutex);
+
+   for (i = 0; i < loader->count; i++) {
+      al_destroy_bitmap(loader->bitmaps[i]);
+      al_free(loader->paths[i]);
+   }
+   al_free(loader->bitmaps);
+   al_free(loader->paths);
+   al_free(loader);
+}
+
+
+/* Returns a memory bitmap with the pixels of bitmap, in the format locking it
+ * gives, which uses a completed readback.
+ */
+static ALLEGRO_BITMAP *copy_to_memory(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_LOCKED_REGION *src, *dst;
+   ALLEGRO_BITMAP *copy = NULL;
+   ALLEGRO_STATE state;
+   int w = al_get_bitmap_width(bitmap);
+   int h = al_get_bitmap_height(bitmap);
+   int y;
+
+   src = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ANY,
+      ALLEGRO_LOCK_READONLY);
+   if (!src)
+      return NULL;
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+   al_set_new_bitmap_format(src->format);
+   copy = al_create_bitmap(w, h);
+   al_restore_state(&state);
+
+   if (copy) {
+      dst = al_lock_bitmap(copy, src->format, ALLEGRO_LOCK_WRITEONLY);
+      for (y = 0; y < h; y++) {
+         memcpy((char *)dst->data + y * dst->pitch,
+            (char *)src->data + y * src->pitch, w * src->pixel_size);
+      }
+      al_unlock_bitmap(copy);
+   }
+
+   al_unlock_bitmap(bitmap);
+   return copy;
+}
+
+
+static void emit_saved_event(int id, bool ok)
+{
+   ALLEGRO_EVENT event;
+
+   memset(&event, 0, sizeof event);
+   event.user.type = ALLEGRO_EVENT_BITMAP_SAVED;
+   event.user.data1 = id;
+   event.user.data2 = ok;
+   al_emit_user_event(&save_es, &event, NULL);
+}
+
+
+static void save_job(void *arg)
+{
+   ASYNC_SAVE *s = arg;
+   bool ok;
+
+   ok = al_save_bitmap_f(s->fp, s->ident, s->copy);
+   ok = al_fclose(s->fp) && ok;
+   if (!ok)
+      ALLEGRO_ERROR("Failed saving bitmap %d.\n", s->id);
+   al_destroy_bitmap(s->copy);
+   emit_saved_event(s->id, ok);
+   al_free(s);
+}
+
+
+/* Takes the pixels of the save's bitmap and encodes them on the shared job
+ * pool, or right here if that fails.
+ */
+static void start_encoding(ASYNC_SAVE *s)
+{
+   s->copy = copy_to_memory(s->bitmap);
+   s->bitmap = NULL;
+   if (!s->copy) {
+      ALLEGRO_ERROR("Failed copying bitmap %d for saving.\n", s->id);
+      al_fclose(s->fp);
+      emit_saved_event(s->id, false);
+      al_free(s);
+      return;
+   }
+
+   if (!al_add_job(_al_get_job_pool(), save_job, s, NULL, NULL))
+      save_job(s);
+}
+
+
+bool _al_has_bitmap_saves(void)
+{
+   /* Only saves of bitmaps the caller uses matter, and those were added on
+    * its own thread or before it got the bitmap, so this is up to date.
+    */
+   return !_al_vector_is_empty(&pending_saves);
+}
+
+
+void _al_update_bitmap_saves(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap,
+   bool wait)
+{
+   ASYNC_SAVE *ready[16];
+   int num_ready;
+   int i;
+
+   /* Saves are taken out of the list in small groups, to lock and copy
+    * their bitmaps without holding the mutex.
+    */
+   do {
+      num_ready = 0;
+      _al_mutex_lock(&save_mutex);
+      for (i = 0; i < (int)_al_vector_size(&pending_saves) &&
+            num_ready < 16; i++) {
+         ASYNC_SAVE **s = _al_vector_ref(&pending_saves, i);
+         ALLEGRO_BITMAP *b = (*s)->bitmap;
+
+         if (bitmap) {
+            if (b != bitmap && b->parent != bitmap)
+               continue;
+         }
+         else if (_al_get_bitmap_display(b) != display &&
+               !(al_get_bitmap_flags(b) & ALLEGRO_MEMORY_BITMAP)) {
+            /* Converted to a memory bitmap in the meantime. */
+            continue;
+         }
+
+         if (!wait && (al_is_bitmap_locked(b) ||
+               !al_is_bitmap_readback_ready(b)))
+            continue;
+
+         ready[num_ready++] = *s;
+         _al_vector_delete_at(&pending_saves, i);
+         i--;
+      }
+      _al_mutex_unlock(&save_mutex);
+
+      for (i = 0; i < num_ready; i++)
+         start_encoding(ready[i]);
+   } while (num_ready == 16);
+}
+
+
+/* Function: al_save_bitmap_async
+ */
+int al_save_bitmap_async(const char *filename, ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_EVENT_QUEUE *queue)
+{
+   const char *ext;
+   Handler *h;
+   ASYNC_SAVE *s;
+   bool pending;
+   int id;
+   ASSERT(filename);
+   ASSERT(bitmap);
+
+   ext = strrchr(filename, '.');
+   h = ext ? find_handler(ext, false) : NULL;
+   if (!h || !h->fs_saver) {
+      ALLEGRO_ERROR("No handler for image %s found\n", filename);
+      return 0;
+   }
+
+   s = al_calloc(1, sizeof *s);
+   if (!s)
+      return 0;
+   strcpy(s->ident, h->extension);
+   s->bitmap = bitmap;
+   s->fp = al_fopen(filename, "wb");
+   if (!s->fp) {
+      ALLEGRO_ERROR("Unable to open %s for writing.\n", filename);
+      al_free(s);
+      return 0;
+   }
+
+   if (queue)
+      al_register_event_source(queue, &save_es);
+
+   /* Video bitmaps are read back without waiting for the GPU. The pixels
+    * are copied later, once al_flip_display finds the readback complete.
+    */
+   pending = !(al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) &&
+      al_request_bitmap_readback(bitmap, 0, 0, al_get_bitmap_width(bitmap),
+         al_get_bitmap_height(bitmap), ALLEGRO_PIXEL_FORMAT_ANY);
+
+   /* Once it is pending or encoding, s may be freed at any time. */
+   _al_mutex_lock(&save_mutex);
+   if (++last_save_id <= 0)
+      last_save_id = 1;
+   id = s->id = last_save_id;
+   if (pending) {
+      ASYNC_SAVE **slot = _al_vector_alloc_back(&pending_saves);
+      *slot = s;
+   }
+   _al_mutex_unlock(&save_mutex);
+
+   if (!pending)
+      start_encoding(s);
+   return id;
+}
+
+
 /* vim: set sts=3 sw=3 et: */
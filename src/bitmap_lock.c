@@ -53,7 +53,7 @@ ALLEGRO_LOCKED_REGION *al_lock_bitmap_region(ALLEGRO_BITMAP *bitmap,
 
    if (!(bitmap_flags & ALLEGRO_MEMORY_BITMAP) &&
          !(flags & ALLEGRO_LOCK_READONLY))
-      bitmap->dirty = true;
+      _al_mark_bitmap_dirty(bitmap, x, y, width, height);
 
    ASSERT(x+width <= bitmap->w);
    ASSERT(y+height <= bitmap->h);
@@ -121,6 +121,65 @@ ALLEGRO_LOCKED_REGION *al_lock_bitmap_region(ALLEGRO_BITMAP *bitmap,
 }
 
 
+/* Function: al_request_bitmap_readback
+ */
+bool al_request_bitmap_readback(ALLEGRO_BITMAP *bitmap,
+   int x, int y, int width, int height, int format)
+{
+   int bitmap_format = al_get_bitmap_format(bitmap);
+   int block_width = al_get_pixel_block_width(bitmap_format);
+   int block_height = al_get_pixel_block_height(bitmap_format);
+   int xc, yc, wc, hc;
+   ASSERT(x >= 0);
+   ASSERT(y >= 0);
+   ASSERT(width >= 0);
+   ASSERT(height >= 0);
+   ASSERT(!_al_pixel_format_is_video_only(format));
+
+   /* For sub-bitmaps */
+   if (bitmap->parent) {
+      x += bitmap->xofs;
+      y += bitmap->yofs;
+      bitmap = bitmap->parent;
+   }
+
+   if (bitmap->locked)
+      return false;
+
+   if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) ||
+         !bitmap->vt->request_readback)
+      return false;
+
+   ASSERT(x+width <= bitmap->w);
+   ASSERT(y+height <= bitmap->h);
+
+   /* Must match what al_lock_bitmap_region passes to the driver. */
+   xc = (x / block_width) * block_width;
+   yc = (y / block_height) * block_height;
+   wc = _al_get_least_multiple(x + width, block_width) - xc;
+   hc = _al_get_least_multiple(y + height, block_height) - yc;
+
+   return bitmap->vt->request_readback(bitmap, xc, yc, wc, hc, format);
+}
+
+
+/* Function: al_is_bitmap_readback_ready
+ */
+bool al_is_bitmap_readback_ready(ALLEGRO_BITMAP *bitmap)
+{
+   /* For sub-bitmaps */
+   if (bitmap->parent) {
+      bitmap = bitmap->parent;
+   }
+
+   if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) ||
+         !bitmap->vt->is_readback_ready)
+      return true;
+
+   return bitmap->vt->is_readback_ready(bitmap);
+}
+
+
 /* Function: al_lock_bitmap
  */
 ALLEGRO_LOCKED_REGION *al_lock_bitmap(ALLEGRO_BITMAP *bitmap,
@@ -222,8 +281,11 @@ ALLEGRO_LOCKED_REGION *al_lock_bitmap_region_blocked(ALLEGRO_BITMAP *bitmap,
    if (bitmap->locked)
       return NULL;
 
-   if (!(flags & ALLEGRO_LOCK_READONLY))
-      bitmap->dirty = true;
+   if (!(flags & ALLEGRO_LOCK_READONLY)) {
+      _al_mark_bitmap_dirty(bitmap, x_block * block_width,
+         y_block * block_height, width_block * block_width,
+         height_block * block_height);
+   }
 
    ASSERT(x_block + width_block
       <= _al_get_least_multiple(bitmap->w, block_width) / block_width);
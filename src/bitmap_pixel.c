@@ -15,6 +15,7 @@
 
 #include <string.h> /* for memset */
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_blend.h"
 #include "allegro5/internal/aintern_pixels.h"
@@ -138,10 +139,254 @@ void al_put_pixel(int x, int y, ALLEGRO_COLOR color)
  */
 void al_put_blended_pixel(int x, int y, ALLEGRO_COLOR color)
 {
-   ALLEGRO_COLOR result;
-   ALLEGRO_BITMAP* bitmap = al_get_target_bitmap();
-   _al_blend_memory(&color, bitmap, x, y, &result);
-   _al_put_pixel(bitmap, x, y, result);
+   _AL_BLENDER blender;
+   _al_get_blender(&blender);
+   _al_blend_span_memory(&blender, &color, al_get_target_bitmap(), x, y, 1);
+}
+
+
+/* The formats the inline pixel macros know about. Expanding a macro with a
+ * constant format compiles to a loop with no per-pixel dispatch.
+ */
+#define FOR_EACH_ROW_FORMAT(M)                                                \
+   M(ALLEGRO_PIXEL_FORMAT_ARGB_8888)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_RGBA_8888)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_ARGB_4444)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_RGB_888)                                            \
+   M(ALLEGRO_PIXEL_FORMAT_RGB_565)                                            \
+   M(ALLEGRO_PIXEL_FORMAT_RGB_555)                                            \
+   M(ALLEGRO_PIXEL_FORMAT_RGBA_5551)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_ARGB_1555)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_ABGR_8888)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_XBGR_8888)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_BGR_888)                                            \
+   M(ALLEGRO_PIXEL_FORMAT_BGR_565)                                            \
+   M(ALLEGRO_PIXEL_FORMAT_BGR_555)                                            \
+   M(ALLEGRO_PIXEL_FORMAT_RGBX_8888)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_XRGB_8888)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_ABGR_F32)                                           \
+   M(ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE)                                       \
+   M(ALLEGRO_PIXEL_FORMAT_RGBA_4444)                                          \
+   M(ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8)
+
+
+/* The part of a row of pixels which can be accessed, locked if it wasn't
+ * already.
+ */
+typedef struct PIXEL_ROW {
+   ALLEGRO_BITMAP *bitmap;
+   char *data;
+   int format;
+   int skip;
+   int count;
+   bool unlock;
+} PIXEL_ROW;
+
+
+static bool begin_row(ALLEGRO_BITMAP *bitmap, int x, int y, int n,
+   bool write, PIXEL_ROW *row)
+{
+   ALLEGRO_LOCKED_REGION *lr;
+   int x1, y1, x2, y2;
+
+   if (bitmap->parent) {
+      x += bitmap->xofs;
+      y += bitmap->yofs;
+      bitmap = bitmap->parent;
+   }
+
+   if (write) {
+      x1 = bitmap->cl;
+      y1 = bitmap->ct;
+      x2 = bitmap->cr_excl;
+      y2 = bitmap->cb_excl;
+   }
+   else {
+      x1 = 0;
+      y1 = 0;
+      x2 = bitmap->w;
+      y2 = bitmap->h;
+   }
+
+   if (bitmap->locked) {
+      if (_al_pixel_format_is_video_only(bitmap->locked_region.format)) {
+         ALLEGRO_ERROR("Invalid lock format.");
+         return false;
+      }
+      x1 = _ALLEGRO_MAX(x1, bitmap->lock_x);
+      y1 = _ALLEGRO_MAX(y1, bitmap->lock_y);
+      x2 = _ALLEGRO_MIN(x2, bitmap->lock_x + bitmap->lock_w);
+      y2 = _ALLEGRO_MIN(y2, bitmap->lock_y + bitmap->lock_h);
+   }
+
+   if (y < y1 || y >= y2)
+      return false;
+   row->skip = _ALLEGRO_MAX(0, x1 - x);
+   row->count = _ALLEGRO_MIN(x + n, x2) - (x + row->skip);
+   if (row->count <= 0)
+      return false;
+   x += row->skip;
+
+   row->bitmap = bitmap;
+   if (bitmap->locked) {
+      row->format = bitmap->locked_region.format;
+      row->data = bitmap->locked_region.data;
+      row->data += (y - bitmap->lock_y) * bitmap->locked_region.pitch;
+      row->data += (x - bitmap->lock_x) * al_get_pixel_size(row->format);
+      row->unlock = false;
+   }
+   else {
+      lr = al_lock_bitmap_region(bitmap, x, y, row->count, 1,
+         ALLEGRO_PIXEL_FORMAT_ANY,
+         write ? ALLEGRO_LOCK_WRITEONLY : ALLEGRO_LOCK_READONLY);
+      if (!lr)
+         return false;
+      row->format = lr->format;
+      row->data = lr->data;
+      row->unlock = true;
+   }
+   return true;
+}
+
+
+static void end_row(PIXEL_ROW *row)
+{
+   if (row->unlock)
+      al_unlock_bitmap(row->bitmap);
+}
+
+
+static void get_row(int format, char *data, int n, ALLEGRO_COLOR *out)
+{
+   int i;
+
+   switch (format) {
+#define GET_ROW(f)                                                            \
+      case f:                                                                 \
+         for (i = 0; i < n; i++) {                                            \
+            _AL_INLINE_GET_PIXEL(f, data, out[i], true);                      \
+         }                                                                    \
+         break;
+      FOR_EACH_ROW_FORMAT(GET_ROW)
+#undef GET_ROW
+      default:
+         ALLEGRO_ERROR("Invalid lock format.");
+         break;
+   }
+}
+
+
+static void put_row(int format, char *data, int n, const ALLEGRO_COLOR *in)
+{
+   int i;
+
+   switch (format) {
+#define PUT_ROW(f)                                                            \
+      case f:                                                                 \
+         for (i = 0; i < n; i++) {                                            \
+            _AL_INLINE_PUT_PIXEL(f, data, in[i], true);                       \
+         }                                                                    \
+         break;
+      FOR_EACH_ROW_FORMAT(PUT_ROW)
+#undef PUT_ROW
+      default:
+         ALLEGRO_ERROR("Invalid lock format.");
+         break;
+   }
+}
+
+
+/* Function: al_get_pixel_row
+ */
+void al_get_pixel_row(ALLEGRO_BITMAP *bitmap, int x, int y, int n,
+   ALLEGRO_COLOR *out)
+{
+   ALLEGRO_COLOR zero = al_map_rgba_f(0, 0, 0, 0);
+   PIXEL_ROW row;
+   int i;
+   ASSERT(bitmap);
+   ASSERT(out);
+
+   if (n <= 0)
+      return;
+
+   if (!begin_row(bitmap, x, y, n, false, &row)) {
+      row.skip = n;
+      row.count = 0;
+   }
+   else {
+      get_row(row.format, row.data, row.count, out + row.skip);
+      end_row(&row);
+   }
+
+   for (i = 0; i < row.skip; i++)
+      out[i] = zero;
+   for (i = row.skip + row.count; i < n; i++)
+      out[i] = zero;
+}
+
+
+/* Function: al_put_pixel_row
+ */
+void al_put_pixel_row(int x, int y, int n, const ALLEGRO_COLOR *colors)
+{
+   PIXEL_ROW row;
+   ASSERT(colors);
+
+   if (n <= 0)
+      return;
+
+   if (begin_row(al_get_target_bitmap(), x, y, n, true, &row)) {
+      put_row(row.format, row.data, row.count, colors + row.skip);
+      end_row(&row);
+   }
+}
+
+
+/* Function: al_get_pixel_row_u32
+ */
+void al_get_pixel_row_u32(ALLEGRO_BITMAP *bitmap, int x, int y, int n,
+   uint32_t *out)
+{
+   PIXEL_ROW row;
+   ASSERT(bitmap);
+   ASSERT(out);
+
+   if (n <= 0)
+      return;
+
+   if (!begin_row(bitmap, x, y, n, false, &row)) {
+      memset(out, 0, n * sizeof(*out));
+      return;
+   }
+
+   _al_convert_bitmap_data(row.data, row.format, 0,
+      out + row.skip, ALLEGRO_PIXEL_FORMAT_ARGB_8888, 0,
+      0, 0, 0, 0, row.count, 1);
+   end_row(&row);
+
+   memset(out, 0, row.skip * sizeof(*out));
+   memset(out + row.skip + row.count, 0,
+      (n - row.skip - row.count) * sizeof(*out));
+}
+
+
+/* Function: al_put_pixel_row_u32
+ */
+void al_put_pixel_row_u32(int x, int y, int n, const uint32_t *pixels)
+{
+   PIXEL_ROW row;
+   ASSERT(pixels);
+
+   if (n <= 0)
+      return;
+
+   if (begin_row(al_get_target_bitmap(), x, y, n, true, &row)) {
+      _al_convert_bitmap_data(pixels + row.skip,
+         ALLEGRO_PIXEL_FORMAT_ARGB_8888, 0, row.data, row.format, 0,
+         0, 0, 0, 0, row.count, 1);
+      end_row(&row);
+   }
 }
 
 
@@ -0,0 +1,252 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Bitmap pools.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+/* Title: Bitmap pools
+ */
+
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_dtor.h"
+#include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_transform.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("bitmap")
+
+
+/* What a pooled bitmap was created with. A bitmap is only handed out again
+ * for the exact same request.
+ */
+typedef struct POOL_ENTRY
+{
+   ALLEGRO_BITMAP *bitmap;
+   ALLEGRO_DISPLAY *display;
+   int w, h;
+   int format, flags, depth, samples;
+   /* Whether it ended up as a memory bitmap. If that changes, e.g. because
+    * the display was destroyed, the bitmap no longer fits the request.
+    */
+   bool memory;
+} POOL_ENTRY;
+
+struct ALLEGRO_BITMAP_POOL
+{
+   int max_idle;
+   _AL_VECTOR live;  /* POOL_ENTRY, handed out */
+   _AL_VECTOR idle;  /* POOL_ENTRY, least recently released first */
+   _AL_LIST_ITEM *dtor_item;
+};
+
+
+static bool is_memory_bitmap(ALLEGRO_BITMAP *bitmap)
+{
+   return (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) != 0;
+}
+
+
+static bool entry_matches(const POOL_ENTRY *e, const POOL_ENTRY *want)
+{
+   return e->display == want->display &&
+      e->w == want->w && e->h == want->h &&
+      e->format == want->format && e->flags == want->flags &&
+      e->depth == want->depth && e->samples == want->samples;
+}
+
+
+static void destroy_idle(ALLEGRO_BITMAP_POOL *pool, unsigned i)
+{
+   POOL_ENTRY *e = _al_vector_ref(&pool->idle, i);
+
+   e->bitmap->pool = NULL;
+   al_destroy_bitmap(e->bitmap);
+   _al_vector_delete_at(&pool->idle, i);
+}
+
+
+/* Puts a recycled bitmap back into the state al_create_bitmap leaves new
+ * bitmaps in. The contents are left as they are.
+ */
+static void reset_bitmap(ALLEGRO_BITMAP *bitmap)
+{
+   bitmap->cl = 0;
+   bitmap->ct = 0;
+   bitmap->cr_excl = bitmap->w;
+   bitmap->cb_excl = bitmap->h;
+   al_identity_transform(&bitmap->transform);
+   al_identity_transform(&bitmap->inverse_transform);
+   bitmap->inverse_transform_dirty = false;
+   bitmap->transform_kind = _AL_TRANSFORM_IDENTITY;
+   al_identity_transform(&bitmap->proj_transform);
+   al_orthographic_transform(&bitmap->proj_transform, 0, 0, -1.0,
+      bitmap->w, bitmap->h, 1.0);
+   bitmap->use_bitmap_blender = false;
+   bitmap->blender.blend_color = al_map_rgba(0, 0, 0, 0);
+   al_get_new_bitmap_wrap(&bitmap->_wrap_u, &bitmap->_wrap_v);
+}
+
+
+/* Called by al_destroy_bitmap. Returns true if the pool took the bitmap
+ * back, false if it should be destroyed as usual.
+ */
+bool _al_release_pooled_bitmap(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_POOL *pool = bitmap->pool;
+   POOL_ENTRY entry;
+   unsigned i;
+
+   ASSERT(pool);
+
+   for (i = 0; i < _al_vector_size(&pool->live); i++) {
+      POOL_ENTRY *e = _al_vector_ref(&pool->live, i);
+      if (e->bitmap == bitmap)
+         break;
+   }
+   if (i == _al_vector_size(&pool->live)) {
+      bitmap->pool = NULL;
+      return false;
+   }
+
+   entry = *(POOL_ENTRY *)_al_vector_ref(&pool->live, i);
+   _al_vector_delete_at(&pool->live, i);
+
+   if (is_memory_bitmap(bitmap) != entry.memory) {
+      bitmap->pool = NULL;
+      return false;
+   }
+
+   if (bitmap->locked)
+      al_unlock_bitmap(bitmap);
+
+   /* al_destroy_bitmap unregistered it already. */
+   bitmap->dtor_item = NULL;
+
+   *(POOL_ENTRY *)_al_vector_alloc_back(&pool->idle) = entry;
+   if ((int)_al_vector_size(&pool->idle) > pool->max_idle)
+      destroy_idle(pool, 0);
+
+   return true;
+}
+
+
+/* Function: al_create_bitmap_pool
+ */
+ALLEGRO_BITMAP_POOL *al_create_bitmap_pool(int max_idle)
+{
+   ALLEGRO_BITMAP_POOL *pool;
+
+   ASSERT(max_idle > 0);
+
+   pool = al_calloc(1, sizeof *pool);
+   if (!pool)
+      return NULL;
+
+   pool->max_idle = max_idle;
+   _al_vector_init(&pool->live, sizeof(POOL_ENTRY));
+   _al_vector_init(&pool->idle, sizeof(POOL_ENTRY));
+
+   pool->dtor_item = _al_register_destructor(_al_dtor_list, "bitmap_pool",
+      pool, (void (*)(void *))al_destroy_bitmap_pool);
+
+   return pool;
+}
+
+
+/* Function: al_destroy_bitmap_pool
+ */
+void al_destroy_bitmap_pool(ALLEGRO_BITMAP_POOL *pool)
+{
+   unsigned i;
+
+   if (!pool)
+      return;
+
+   _al_unregister_destructor(_al_dtor_list, pool->dtor_item);
+
+   /* Bitmaps still in use become ordinary bitmaps. */
+   for (i = 0; i < _al_vector_size(&pool->live); i++) {
+      POOL_ENTRY *e = _al_vector_ref(&pool->live, i);
+      e->bitmap->pool = NULL;
+   }
+   _al_vector_free(&pool->live);
+
+   while (!_al_vector_is_empty(&pool->idle))
+      destroy_idle(pool, _al_vector_size(&pool->idle) - 1);
+   _al_vector_free(&pool->idle);
+
+   al_free(pool);
+}
+
+
+/* Function: al_create_pooled_bitmap
+ */
+ALLEGRO_BITMAP *al_create_pooled_bitmap(ALLEGRO_BITMAP_POOL *pool,
+   int w, int h)
+{
+   ALLEGRO_BITMAP *bitmap = NULL;
+   POOL_ENTRY want;
+   unsigned i;
+
+   ASSERT(pool);
+
+   want.display = al_get_current_display();
+   want.w = w;
+   want.h = h;
+   want.format = al_get_new_bitmap_format();
+   want.flags = al_get_new_bitmap_flags();
+   want.depth = al_get_new_bitmap_depth();
+   want.samples = al_get_new_bitmap_samples();
+
+   /* Prefer the most recently released bitmap, it is the most likely to
+    * still be in the caches.
+    */
+   i = _al_vector_size(&pool->idle);
+   while (i-- > 0) {
+      POOL_ENTRY *e = _al_vector_ref(&pool->idle, i);
+
+      if (is_memory_bitmap(e->bitmap) != e->memory) {
+         destroy_idle(pool, i);
+         continue;
+      }
+      if (entry_matches(e, &want)) {
+         bitmap = e->bitmap;
+         want.memory = e->memory;
+         _al_vector_delete_at(&pool->idle, i);
+         reset_bitmap(bitmap);
+         break;
+      }
+   }
+
+   if (!bitmap) {
+      bitmap = _al_create_bitmap_params(want.display, w, h, want.format,
+         want.flags, want.depth, want.samples);
+      if (!bitmap)
+         return NULL;
+      want.memory = is_memory_bitmap(bitmap);
+      bitmap->pool = pool;
+   }
+
+   want.bitmap = bitmap;
+   *(POOL_ENTRY *)_al_vector_alloc_back(&pool->live) = want;
+
+   bitmap->dtor_item = _al_register_destructor(_al_dtor_list, "bitmap",
+      bitmap, (void (*)(void *))al_destroy_bitmap);
+
+   return bitmap;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
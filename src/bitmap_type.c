@@ -87,6 +87,8 @@ static void swap_bitmaps(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *other)
    ALLEGRO_BITMAP temp;
    _AL_LIST_ITEM *bitmap_dtor_item = bitmap->dtor_item;
    _AL_LIST_ITEM *other_dtor_item = other->dtor_item;
+   ALLEGRO_BITMAP_POOL *bitmap_pool = bitmap->pool;
+   ALLEGRO_BITMAP_POOL *other_pool = other->pool;
    ALLEGRO_DISPLAY *bitmap_display, *other_display;
 
    _al_unregister_convert_bitmap(bitmap);
@@ -101,11 +103,13 @@ static void swap_bitmaps(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *other)
    *bitmap = *other;
    *other = temp;
 
-   /* Re-associate the destructors back, as they are tied to the object
-    * pointers.
+   /* Re-associate the destructors and pools back, as they are tied to the
+    * object pointers.
     */
    bitmap->dtor_item = bitmap_dtor_item;
    other->dtor_item = other_dtor_item;
+   bitmap->pool = bitmap_pool;
+   other->pool = other_pool;
 
    bitmap_display = _al_get_bitmap_display(bitmap);
    other_display = _al_get_bitmap_display(other);
@@ -149,6 +153,53 @@ static void swap_bitmaps(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *other)
 }
 
 
+/* Replaces the contents of bitmap by those of clone, which must have the
+ * same size, keeping the bitmap's clipping and transformation state. The
+ * clone is destroyed.
+ */
+void _al_adopt_bitmap(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *clone)
+{
+   bool clone_memory = (al_get_bitmap_flags(clone) & ALLEGRO_MEMORY_BITMAP) != 0;
+   ALLEGRO_BITMAP *target_bitmap;
+
+   swap_bitmaps(bitmap, clone);
+
+   /* Preserve bitmap state. */
+   bitmap->cl = clone->cl;
+   bitmap->ct = clone->ct;
+   bitmap->cr_excl = clone->cr_excl;
+   bitmap->cb_excl = clone->cb_excl;
+   bitmap->transform = clone->transform;
+   bitmap->inverse_transform = clone->inverse_transform;
+   bitmap->inverse_transform_dirty = clone->inverse_transform_dirty;
+   bitmap->transform_kind = clone->transform_kind;
+
+   /* Memory bitmaps do not support custom projection transforms,
+    * so reset it to the orthographic transform. */
+   if (clone_memory) {
+      al_identity_transform(&bitmap->proj_transform);
+      al_orthographic_transform(&bitmap->proj_transform, 0, 0, -1.0, bitmap->w, bitmap->h, 1.0);
+   } else {
+      bitmap->proj_transform = clone->proj_transform;
+   }
+
+   /* If we just converted this bitmap, and the backing bitmap is the same
+    * as the target's backing bitmap, then the viewports and transformations
+    * will be messed up. Detect this, and just re-call al_set_target_bitmap
+    * on the current target. */
+   target_bitmap = al_get_target_bitmap();
+   if (target_bitmap) {
+      ALLEGRO_BITMAP *target_parent =
+         target_bitmap->parent ? target_bitmap->parent : target_bitmap;
+      if (bitmap == target_parent || bitmap->parent == target_parent) {
+         al_set_target_bitmap(target_bitmap);
+      }
+   }
+
+   al_destroy_bitmap(clone);
+}
+
+
 /* Function: al_convert_bitmap
  */
 void al_convert_bitmap(ALLEGRO_BITMAP *bitmap)
@@ -158,7 +209,6 @@ void al_convert_bitmap(ALLEGRO_BITMAP *bitmap)
    int new_bitmap_flags = al_get_new_bitmap_flags();
    bool want_memory = (new_bitmap_flags & ALLEGRO_MEMORY_BITMAP) != 0;
    bool clone_memory;
-   ALLEGRO_BITMAP *target_bitmap;
    
    bitmap_flags &= ~_ALLEGRO_INTERNAL_OPENGL;
 
@@ -189,40 +239,61 @@ void al_convert_bitmap(ALLEGRO_BITMAP *bitmap)
       return;
    }
 
-   swap_bitmaps(bitmap, clone);
+   _al_adopt_bitmap(bitmap, clone);
+}
 
-   /* Preserve bitmap state. */
-   bitmap->cl = clone->cl;
-   bitmap->ct = clone->ct;
-   bitmap->cr_excl = clone->cr_excl;
-   bitmap->cb_excl = clone->cb_excl;
-   bitmap->transform = clone->transform;
-   bitmap->inverse_transform = clone->inverse_transform;
-   bitmap->inverse_transform_dirty = clone->inverse_transform_dirty;
 
-   /* Memory bitmaps do not support custom projection transforms,
-    * so reset it to the orthographic transform. */
-   if (new_bitmap_flags & ALLEGRO_MEMORY_BITMAP) {
-      al_identity_transform(&bitmap->proj_transform);
-      al_orthographic_transform(&bitmap->proj_transform, 0, 0, -1.0, bitmap->w, bitmap->h, 1.0);
-   } else {
-      bitmap->proj_transform = clone->proj_transform;
-   }
+/* Function: al_queue_bitmap_upload
+ */
+bool al_queue_bitmap_upload(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ASSERT(bitmap);
 
-   /* If we just converted this bitmap, and the backing bitmap is the same
-    * as the target's backing bitmap, then the viewports and transformations
-    * will be messed up. Detect this, and just re-call al_set_target_bitmap
-    * on the current target. */
-   target_bitmap = al_get_target_bitmap();
-   if (target_bitmap) {
-      ALLEGRO_BITMAP *target_parent =
-         target_bitmap->parent ? target_bitmap->parent : target_bitmap;
-      if (bitmap == target_parent || bitmap->parent == target_parent) {
-         al_set_target_bitmap(target_bitmap);
-      }
+   if (bitmap->parent)
+      bitmap = bitmap->parent;
+
+   if (display && display->vt->queue_bitmap_upload &&
+         (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) &&
+         !(al_get_new_bitmap_flags() & ALLEGRO_MEMORY_BITMAP)) {
+      if (display->vt->queue_bitmap_upload(display, bitmap))
+         return true;
    }
 
-   al_destroy_bitmap(clone);
+   /* The display cannot upload in the background, do it right away. */
+   al_convert_bitmap(bitmap);
+   return !(al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP);
+}
+
+
+/* Function: al_is_bitmap_upload_done
+ */
+bool al_is_bitmap_upload_done(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ASSERT(bitmap);
+
+   if (bitmap->parent)
+      bitmap = bitmap->parent;
+
+   if (!display || !display->vt->finish_bitmap_upload)
+      return true;
+   return display->vt->finish_bitmap_upload(display, bitmap, false);
+}
+
+
+/* Function: al_wait_for_bitmap_upload
+ */
+void al_wait_for_bitmap_upload(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ASSERT(bitmap);
+
+   if (bitmap->parent)
+      bitmap = bitmap->parent;
+
+   if (display && display->vt->finish_bitmap_upload)
+      display->vt->finish_bitmap_upload(display, bitmap, true);
 }
 
 
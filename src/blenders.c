@@ -20,8 +20,11 @@
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_blend.h"
 #include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_pixels.h"
 #include <string.h>
 
+ALLEGRO_DEBUG_CHANNEL("bitmap")
+
 void _al_blend_memory(ALLEGRO_COLOR *scol,
    ALLEGRO_BITMAP *dest,
    int dx, int dy, ALLEGRO_COLOR *result)
@@ -40,3 +43,165 @@ void _al_blend_memory(ALLEGRO_COLOR *scol,
                     &constcol, result);
    (void) _al_blend_alpha_inline; // silence compiler
 }
+
+
+/* Span blenders for the common modes. Passing the modes as constants lets
+ * the compiler drop the mode switches from the inner loop.
+ */
+#define SPAN_BLENDER(name, src_mode, dst_mode)                                \
+static void name(const _AL_BLENDER *blender,                                  \
+   const ALLEGRO_COLOR *src, ALLEGRO_COLOR *dst, int n)                       \
+{                                                                             \
+   ALLEGRO_COLOR result;                                                      \
+   int i;                                                                     \
+   (void)blender;                                                             \
+   for (i = 0; i < n; i++) {                                                  \
+      _al_blend_alpha_inline(&src[i], &dst[i],                                \
+         ALLEGRO_ADD, src_mode, dst_mode, ALLEGRO_ADD, src_mode, dst_mode,    \
+         NULL, &result);                                                      \
+      dst[i] = result;                                                        \
+   }                                                                          \
+}
+
+SPAN_BLENDER(blend_span_premultiplied, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA)
+SPAN_BLENDER(blend_span_alpha, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA)
+SPAN_BLENDER(blend_span_additive, ALLEGRO_ONE, ALLEGRO_ONE)
+
+#undef SPAN_BLENDER
+
+
+static void blend_span_copy(const _AL_BLENDER *blender,
+   const ALLEGRO_COLOR *src, ALLEGRO_COLOR *dst, int n)
+{
+   (void)blender;
+   memcpy(dst, src, n * sizeof(*dst));
+}
+
+
+static void blend_span_generic(const _AL_BLENDER *blender,
+   const ALLEGRO_COLOR *src, ALLEGRO_COLOR *dst, int n)
+{
+   ALLEGRO_COLOR constcol = blender->const_color;
+   ALLEGRO_COLOR result;
+   int i;
+
+   for (i = 0; i < n; i++) {
+      _al_blend_inline(&src[i], &dst[i],
+         blender->op, blender->src_mode, blender->dst_mode,
+         blender->op_alpha, blender->src_alpha, blender->dst_alpha,
+         &constcol, &result);
+      dst[i] = result;
+   }
+}
+
+
+void _al_get_blender(_AL_BLENDER *blender)
+{
+   int op, src_mode, dst_mode, op_alpha, src_alpha, dst_alpha;
+
+   al_get_separate_bitmap_blender(&op, &src_mode, &dst_mode,
+      &op_alpha, &src_alpha, &dst_alpha);
+   blender->op = op;
+   blender->src_mode = src_mode;
+   blender->dst_mode = dst_mode;
+   blender->op_alpha = op_alpha;
+   blender->src_alpha = src_alpha;
+   blender->dst_alpha = dst_alpha;
+   blender->const_color = al_get_blend_color();
+
+   if (op == ALLEGRO_ADD && op_alpha == ALLEGRO_ADD &&
+         src_mode == src_alpha && dst_mode == dst_alpha) {
+      if (src_mode == ALLEGRO_ONE && dst_mode == ALLEGRO_INVERSE_ALPHA) {
+         blender->blend_span = blend_span_premultiplied;
+         return;
+      }
+      if (src_mode == ALLEGRO_ALPHA && dst_mode == ALLEGRO_INVERSE_ALPHA) {
+         blender->blend_span = blend_span_alpha;
+         return;
+      }
+      if (src_mode == ALLEGRO_ONE && dst_mode == ALLEGRO_ONE) {
+         blender->blend_span = blend_span_additive;
+         return;
+      }
+   }
+
+   if (_AL_DEST_IS_ZERO && _AL_SRC_NOT_MODIFIED) {
+      blender->blend_span = blend_span_copy;
+      return;
+   }
+
+   blender->blend_span = blend_span_generic;
+}
+
+
+#define SPAN_CHUNK 64
+
+/* Blends a row of n colours into dest starting at (dx, dy). Pixels outside
+ * the clipping rectangle are left alone, like with al_put_blended_pixel.
+ * If dest is locked, the span must lie in the locked region.
+ */
+void _al_blend_span_memory(const _AL_BLENDER *blender,
+   const ALLEGRO_COLOR *src, ALLEGRO_BITMAP *dest, int dx, int dy, int n)
+{
+   ALLEGRO_COLOR dst[SPAN_CHUNK];
+   ALLEGRO_LOCKED_REGION *lr;
+   bool need_unlock = false;
+   char *row;
+   int format;
+   int x1, x2;
+   int i, j;
+
+   if (dest->parent) {
+      dx += dest->xofs;
+      dy += dest->yofs;
+      dest = dest->parent;
+   }
+
+   if (dy < dest->ct || dy >= dest->cb_excl)
+      return;
+   x1 = _ALLEGRO_MAX(dx, dest->cl);
+   x2 = _ALLEGRO_MIN(dx + n, dest->cr_excl);
+
+   if (dest->locked) {
+      if (_al_pixel_format_is_video_only(dest->locked_region.format))
+         return;
+      if (dy < dest->lock_y || dy >= dest->lock_y + dest->lock_h)
+         return;
+      x1 = _ALLEGRO_MAX(x1, dest->lock_x);
+      x2 = _ALLEGRO_MIN(x2, dest->lock_x + dest->lock_w);
+      if (x1 >= x2)
+         return;
+      lr = &dest->locked_region;
+      row = (char *)lr->data + (dy - dest->lock_y) * lr->pitch
+         + (x1 - dest->lock_x) * lr->pixel_size;
+   }
+   else {
+      if (x1 >= x2)
+         return;
+      lr = al_lock_bitmap_region(dest, x1, dy, x2 - x1, 1,
+         ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READWRITE);
+      if (!lr)
+         return;
+      need_unlock = true;
+      row = lr->data;
+   }
+
+   format = lr->format;
+   src += x1 - dx;
+
+   for (i = 0; i < x2 - x1; i += SPAN_CHUNK) {
+      int len = _ALLEGRO_MIN(SPAN_CHUNK, x2 - x1 - i);
+      char *data = row;
+
+      for (j = 0; j < len; j++) {
+         _AL_INLINE_GET_PIXEL(format, data, dst[j], true);
+      }
+      blender->blend_span(blender, src + i, dst, len);
+      for (j = 0; j < len; j++) {
+         _AL_INLINE_PUT_PIXEL(format, row, dst[j], true);
+      }
+   }
+
+   if (need_unlock)
+      al_unlock_bitmap(dest);
+}
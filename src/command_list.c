@@ -0,0 +1,284 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Thread-recordable command lists.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_command_list.h"
+#include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_vector.h"
+
+/*
+ * A command list is a sequence of commands, each with the blender that was
+ * current when it was recorded. Bitmap drawing is stored as runs of quads
+ * whose corners are already transformed, so the recording thread does all
+ * the per-vertex work and replaying only copies them into the display's
+ * vertex cache. Consecutive quads from the same parent bitmap with the same
+ * blender share a run. Addons record anything else as callbacks.
+ */
+enum {
+   COMMAND_QUADS,
+   COMMAND_CALLBACK
+};
+
+typedef struct COMMAND
+{
+   int type;
+   ALLEGRO_BLENDER blender;
+   /* COMMAND_QUADS */
+   ALLEGRO_BITMAP *bitmap;
+   int first_quad;
+   int num_quads;
+   /* COMMAND_CALLBACK */
+   void (*replay)(void *data);
+   void (*destroy)(void *data);
+   void *data;
+} COMMAND;
+
+struct ALLEGRO_COMMAND_LIST
+{
+   _AL_VECTOR commands;
+   _AL_VECTOR quads;
+   ALLEGRO_TRANSFORM transform;
+};
+
+
+static void get_blender(ALLEGRO_BLENDER *b)
+{
+   al_get_separate_blender(&b->blend_op, &b->blend_source, &b->blend_dest,
+      &b->blend_alpha_op, &b->blend_alpha_source, &b->blend_alpha_dest);
+   b->blend_color = al_get_blend_color();
+}
+
+
+static void set_blender(const ALLEGRO_BLENDER *b)
+{
+   al_set_separate_blender(b->blend_op, b->blend_source, b->blend_dest,
+      b->blend_alpha_op, b->blend_alpha_source, b->blend_alpha_dest);
+   al_set_blend_color(b->blend_color);
+}
+
+
+static bool same_blender(const ALLEGRO_BLENDER *a, const ALLEGRO_BLENDER *b)
+{
+   return a->blend_op == b->blend_op &&
+      a->blend_source == b->blend_source &&
+      a->blend_dest == b->blend_dest &&
+      a->blend_alpha_op == b->blend_alpha_op &&
+      a->blend_alpha_source == b->blend_alpha_source &&
+      a->blend_alpha_dest == b->blend_alpha_dest &&
+      a->blend_color.r == b->blend_color.r &&
+      a->blend_color.g == b->blend_color.g &&
+      a->blend_color.b == b->blend_color.b &&
+      a->blend_color.a == b->blend_color.a;
+}
+
+
+/* Function: al_create_command_list
+ */
+ALLEGRO_COMMAND_LIST *al_create_command_list(void)
+{
+   ALLEGRO_COMMAND_LIST *list = al_calloc(1, sizeof *list);
+   if (!list)
+      return NULL;
+
+   _al_vector_init(&list->commands, sizeof(COMMAND));
+   _al_vector_init(&list->quads, sizeof(ALLEGRO_TRANSFORMED_QUAD));
+   al_identity_transform(&list->transform);
+   return list;
+}
+
+
+/* Function: al_destroy_command_list
+ */
+void al_destroy_command_list(ALLEGRO_COMMAND_LIST *list)
+{
+   if (!list)
+      return;
+
+   if (al_get_target_command_list() == list)
+      al_set_target_command_list(NULL);
+
+   al_clear_command_list(list);
+   al_free(list);
+}
+
+
+/* Function: al_clear_command_list
+ */
+void al_clear_command_list(ALLEGRO_COMMAND_LIST *list)
+{
+   unsigned int i;
+   ASSERT(list);
+
+   for (i = 0; i < _al_vector_size(&list->commands); i++) {
+      COMMAND *cmd = _al_vector_ref(&list->commands, i);
+      if (cmd->type == COMMAND_CALLBACK && cmd->destroy)
+         cmd->destroy(cmd->data);
+   }
+   _al_vector_free(&list->commands);
+   _al_vector_free(&list->quads);
+   al_identity_transform(&list->transform);
+}
+
+
+const ALLEGRO_TRANSFORM *_al_get_command_list_transform(
+   ALLEGRO_COMMAND_LIST *list)
+{
+   return &list->transform;
+}
+
+
+void _al_set_command_list_transform(ALLEGRO_COMMAND_LIST *list,
+   const ALLEGRO_TRANSFORM *trans)
+{
+   if (trans != &list->transform)
+      al_copy_transform(&list->transform, trans);
+}
+
+
+void _al_command_list_add_bitmap(ALLEGRO_COMMAND_LIST *list,
+   ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR tint,
+   float sx, float sy, float sw, float sh)
+{
+   ALLEGRO_TRANSFORMED_QUAD *q;
+   ALLEGRO_BLENDER blender;
+   COMMAND *cmd = NULL;
+   ASSERT(bitmap->parent == NULL);
+
+   if (sw <= 0 || sh <= 0)
+      return;
+
+   get_blender(&blender);
+   if (_al_vector_is_nonempty(&list->commands)) {
+      cmd = _al_vector_ref_back(&list->commands);
+      if (cmd->type != COMMAND_QUADS || cmd->bitmap != bitmap ||
+            !same_blender(&cmd->blender, &blender))
+         cmd = NULL;
+   }
+   if (!cmd) {
+      cmd = _al_vector_alloc_back(&list->commands);
+      memset(cmd, 0, sizeof *cmd);
+      cmd->type = COMMAND_QUADS;
+      cmd->blender = blender;
+      cmd->bitmap = bitmap;
+      cmd->first_quad = _al_vector_size(&list->quads);
+   }
+   cmd->num_quads++;
+
+   q = _al_vector_alloc_back(&list->quads);
+   q->x[0] = 0;
+   q->y[0] = 0;
+   q->x[1] = sw;
+   q->y[1] = 0;
+   q->x[2] = sw;
+   q->y[2] = sh;
+   q->x[3] = 0;
+   q->y[3] = sh;
+   al_transform_coordinates(&list->transform, &q->x[0], &q->y[0]);
+   al_transform_coordinates(&list->transform, &q->x[1], &q->y[1]);
+   al_transform_coordinates(&list->transform, &q->x[2], &q->y[2]);
+   al_transform_coordinates(&list->transform, &q->x[3], &q->y[3]);
+   q->sx = sx;
+   q->sy = sy;
+   q->sw = sw;
+   q->sh = sh;
+   q->tint = tint;
+}
+
+
+void _al_command_list_add_callback(ALLEGRO_COMMAND_LIST *list,
+   void (*replay)(void *data), void (*destroy)(void *data), void *data)
+{
+   COMMAND *cmd;
+   ASSERT(list);
+   ASSERT(replay);
+
+   cmd = _al_vector_alloc_back(&list->commands);
+   memset(cmd, 0, sizeof *cmd);
+   cmd->type = COMMAND_CALLBACK;
+   get_blender(&cmd->blender);
+   cmd->replay = replay;
+   cmd->destroy = destroy;
+   cmd->data = data;
+}
+
+
+/* Function: al_draw_command_list
+ */
+void al_draw_command_list(ALLEGRO_COMMAND_LIST *list)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ALLEGRO_TRANSFORM backup;
+   ALLEGRO_TRANSFORM identity;
+   ALLEGRO_BLENDER old_blender;
+   ALLEGRO_BLENDER blender;
+   bool held;
+   unsigned int i;
+   ASSERT(list);
+   ASSERT(al_get_target_command_list() == NULL);
+
+   if (!al_get_target_bitmap() || _al_vector_is_empty(&list->commands))
+      return;
+
+   al_copy_transform(&backup, al_get_current_transform());
+   get_blender(&old_blender);
+   blender = old_blender;
+   held = al_is_bitmap_drawing_held();
+
+   /* The corners were transformed while recording. Setting the transform
+    * before holding keeps the hardware one at the identity as well.
+    */
+   al_identity_transform(&identity);
+   al_use_transform(&identity);
+
+   for (i = 0; i < _al_vector_size(&list->commands); i++) {
+      COMMAND *cmd = _al_vector_ref(&list->commands, i);
+
+      if (!same_blender(&cmd->blender, &blender)) {
+         /* Held vertices are drawn with the blender current when they are
+          * flushed.
+          */
+         if (display && display->num_cache_vertices > 0)
+            _al_flush_vertex_cache(display,
+               ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+         blender = cmd->blender;
+         set_blender(&blender);
+      }
+
+      if (cmd->type == COMMAND_QUADS) {
+         if (!al_is_bitmap_drawing_held())
+            al_hold_bitmap_drawing(true);
+         _al_draw_transformed_quads(cmd->bitmap,
+            _al_vector_ref(&list->quads, cmd->first_quad), cmd->num_quads);
+      }
+      else {
+         if (al_is_bitmap_drawing_held())
+            al_hold_bitmap_drawing(false);
+         cmd->replay(cmd->data);
+      }
+   }
+
+   if (al_is_bitmap_drawing_held() != held)
+      al_hold_bitmap_drawing(held);
+   if (!same_blender(&old_blender, &blender)) {
+      if (display && display->num_cache_vertices > 0)
+         _al_flush_vertex_cache(display, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+      set_blender(&old_blender);
+   }
+   al_use_transform(&backup);
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -19,10 +19,12 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_aatree.h"
 #include "allegro5/internal/aintern_config.h"
+#include "allegro5/internal/aintern_file.h"
 
 
 
@@ -57,6 +59,9 @@ static ALLEGRO_CONFIG_ENTRY *find_entry(const ALLEGRO_CONFIG_SECTION *section,
 }
 
 
+static void config_unindex(const ALLEGRO_CONFIG *config);
+
+
 static void get_key_and_value(const ALLEGRO_USTR *buf,
    ALLEGRO_USTR *key, ALLEGRO_USTR *value)
 {
@@ -112,6 +117,7 @@ void al_add_config_section(ALLEGRO_CONFIG *config, const char *name)
    ALLEGRO_USTR_INFO name_info;
    const ALLEGRO_USTR *uname;
 
+   config_unindex(config);
    uname = al_ref_cstr(&name_info, name);
    config_add_section(config, uname);
 }
@@ -182,6 +188,7 @@ void al_set_config_value(ALLEGRO_CONFIG *config,
    ukey = al_ref_cstr(&key_info, key);
    uvalue = al_ref_cstr(&value_info, value);
 
+   config_unindex(config);
    config_set_value(config, usection, ukey, uvalue);
 }
 
@@ -239,6 +246,7 @@ void al_add_config_comment(ALLEGRO_CONFIG *config,
    usection = al_ref_cstr(&section_info, section);
    ucomment = al_ref_cstr(&comment_info, comment);
 
+   config_unindex(config);
    config_add_comment(config, usection, ucomment);
 }
 
@@ -278,6 +286,9 @@ const char *al_get_config_value(const ALLEGRO_CONFIG *config,
       section = "";
    }
 
+   if (config->index)
+      return _al_config_index_get(config->index, section, key);
+
    usection = al_ref_cstr(&section_info, section);
    ukey = al_ref_cstr(&key_info, key);
 
@@ -291,6 +302,25 @@ const char *al_get_config_value(const ALLEGRO_CONFIG *config,
 static bool readline(ALLEGRO_FILE *file, ALLEGRO_USTR *line)
 {
    char buf[128];
+   void *base;
+   int64_t size;
+
+   /* Mapped files can be scanned in place. */
+   if (al_get_file_mapping(file, &base, &size)) {
+      ALLEGRO_USTR_INFO info;
+      int64_t pos = al_ftell(file);
+      const char *start;
+      const char *end;
+
+      if (pos < 0 || pos >= size)
+         return false;
+
+      start = (const char *)base + pos;
+      end = memchr(start, '\n', size - pos);
+      end = end ? end + 1 : (const char *)base + size;
+      al_ustr_append(line, al_ref_buffer(&info, start, end - start));
+      return al_fseek(file, pos + (end - start), ALLEGRO_SEEK_SET);
+   }
 
    if (!al_fgets(file, buf, sizeof(buf))) {
       return false;
@@ -313,7 +343,7 @@ ALLEGRO_CONFIG *al_load_config_file(const char *filename)
    ALLEGRO_FILE *file;
    ALLEGRO_CONFIG *cfg = NULL;
 
-   file = al_fopen(filename, "r");
+   file = _al_fopen_for_reading(filename, "r");
    if (file) {
       cfg = al_load_config_file_f(file);
       al_fclose(file);
@@ -385,6 +415,91 @@ ALLEGRO_CONFIG *al_load_config_file_f(ALLEGRO_FILE *file)
 }
 
 
+/* Function: al_load_config_file_indexed
+ */
+ALLEGRO_CONFIG *al_load_config_file_indexed(const char *filename)
+{
+   ALLEGRO_FILE *file;
+   ALLEGRO_CONFIG *cfg = NULL;
+
+   file = _al_fopen_for_reading(filename, "r");
+   if (file) {
+      cfg = al_load_config_file_indexed_f(file);
+      al_fclose(file);
+   }
+
+   return cfg;
+}
+
+
+/* Function: al_load_config_file_indexed_f
+ */
+ALLEGRO_CONFIG *al_load_config_file_indexed_f(ALLEGRO_FILE *file)
+{
+   ALLEGRO_CONFIG *config;
+   int64_t pos;
+   ASSERT(file);
+
+   pos = al_ftell(file);
+   config = al_create_config();
+   if (!config) {
+      return NULL;
+   }
+
+   config->index = _al_config_index_load(file);
+   if (config->index)
+      return config;
+
+   /* Fall back to parsing it normally, if we can get back to the start. */
+   al_destroy_config(config);
+   if (pos < 0 || !al_fseek(file, pos, ALLEGRO_SEEK_SET))
+      return NULL;
+   return al_load_config_file_f(file);
+}
+
+
+/* config_unindex:
+ *  Replaces the index of a config loaded with al_load_config_file_indexed
+ *  with the usual trees, before it is modified or iterated over. Logically
+ *  the config doesn't change, hence the const.
+ */
+static void config_unindex(const ALLEGRO_CONFIG *cconfig)
+{
+   ALLEGRO_CONFIG *config = (ALLEGRO_CONFIG *)cconfig;
+   _AL_CONFIG_INDEX *idx = config->index;
+   const ALLEGRO_USTR *section = al_ustr_empty_string();
+   ALLEGRO_USTR_INFO section_info;
+   ALLEGRO_USTR_INFO str_info;
+   ALLEGRO_USTR_INFO value_info;
+   _AL_CONFIG_LINE line;
+   size_t pos = 0;
+
+   if (!idx)
+      return;
+   config->index = NULL;
+
+   while (_al_config_index_read_line(idx, &pos, &line)) {
+      const ALLEGRO_USTR *str = al_ref_buffer(&str_info, line.str, line.len);
+
+      switch (line.type) {
+         case _AL_CONFIG_LINE_COMMENT:
+            config_add_comment(config, section, str);
+            break;
+         case _AL_CONFIG_LINE_SECTION:
+            section = al_ref_buffer(&section_info, line.str, line.len);
+            config_add_section(config, section);
+            break;
+         case _AL_CONFIG_LINE_KEY:
+            config_set_value(config, section, str,
+               al_ref_cstr(&value_info, line.value));
+            break;
+      }
+   }
+
+   _al_config_index_destroy(idx);
+}
+
+
 static bool config_write_section(ALLEGRO_FILE *file,
    const ALLEGRO_CONFIG_SECTION *s)
 {
@@ -450,6 +565,8 @@ bool al_save_config_file_f(ALLEGRO_FILE *file, const ALLEGRO_CONFIG *config)
 {
    ALLEGRO_CONFIG_SECTION *s;
 
+   config_unindex(config);
+
    /* Save global section */
    s = config->head;
    while (s != NULL) {
@@ -491,6 +608,9 @@ static void do_config_merge_into(ALLEGRO_CONFIG *master,
       return;
    }
 
+   config_unindex(master);
+   config_unindex(add);
+
    /* Save each section */
    s = add->head;
    while (s != NULL) {
@@ -572,6 +692,7 @@ void al_destroy_config(ALLEGRO_CONFIG *config)
    }
 
    _al_aa_free(config->tree);
+   _al_config_index_destroy(config->index);
    al_free(config);
 }
 
@@ -585,6 +706,7 @@ char const *al_get_first_config_section(ALLEGRO_CONFIG const *config,
 
    if (!config)
       return NULL;
+   config_unindex(config);
    s = config->head;
    if (iterator) *iterator = s;
    return s ? al_cstr(s->name) : NULL;
@@ -623,6 +745,7 @@ char const *al_get_first_config_entry(ALLEGRO_CONFIG const *config,
    if (section == NULL)
       section = "";
 
+   config_unindex(config);
    usection = al_ref_cstr(&section_info, section);
    s = find_section(config, usection);
    if (!s)
@@ -665,6 +788,7 @@ bool al_remove_config_section(ALLEGRO_CONFIG *config, char const *section)
    if (section == NULL)
       section = "";
 
+   config_unindex(config);
    usection = al_ref_cstr(&section_info, section);
 
    value = NULL;
@@ -710,6 +834,7 @@ bool al_remove_config_key(ALLEGRO_CONFIG *config, char const *section,
    if (section == NULL)
       section = "";
 
+   config_unindex(config);
    usection = al_ref_cstr(&section_info, section);
 
    ALLEGRO_CONFIG_SECTION *s = find_section(config, usection);
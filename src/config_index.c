@@ -0,0 +1,472 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Hash indexed configuration files.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+/* An indexed config keeps the whole file in one buffer. Loading compacts
+ * each line in place into a record and adds keys to an open addressing
+ * hash table of offsets, so nothing is allocated per key. The records are:
+ *
+ *    comment or blank line:  text NUL
+ *    section:                '[' name NUL
+ *    key = value:            key NUL value NUL
+ *    = value (empty key):    '=' value NUL
+ *    key (no '='):           key '\n'
+ *
+ * None of these is longer than the line it came from, plus one byte for a
+ * final line without a newline. Keys never start with '#', '[' or '=', and
+ * no record but the last kind contains a newline, so the records can be
+ * read back in order to build a normal config when it is modified.
+ */
+
+
+#include <ctype.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_config.h"
+
+ALLEGRO_DEBUG_CHANNEL("config")
+
+#define NONE            UINT32_MAX
+#define MIN_SLOTS       1024
+
+
+typedef struct INDEX_SLOT {
+   uint32_t hash;       /* 0 for unused slots */
+   uint32_t section;    /* offset of section name, or NONE */
+   uint32_t key;        /* offset of key record */
+   uint32_t value;      /* offset of value, or NONE */
+} INDEX_SLOT;
+
+struct _AL_CONFIG_INDEX {
+   char *arena;
+   size_t size;         /* bytes of records */
+   INDEX_SLOT *slots;
+   uint32_t num_slots;  /* power of two */
+   uint32_t count;
+};
+
+
+
+static uint32_t hash_bytes(uint32_t h, const char *s, size_t len)
+{
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      h ^= (unsigned char)s[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+
+static uint32_t hash_key(const char *section, size_t section_len,
+   const char *key, size_t key_len)
+{
+   uint32_t h = 2166136261u;
+
+   h = hash_bytes(h, section, section_len);
+   /* Separate the section from the key, as "ab" + "c" != "a" + "bc". */
+   h = hash_bytes(h, "]", 1);
+   h = hash_bytes(h, key, key_len);
+   return h ? h : 1;
+}
+
+
+
+static const char *section_name(const _AL_CONFIG_INDEX *idx, uint32_t off)
+{
+   return off == NONE ? "" : idx->arena + off;
+}
+
+
+
+static bool key_equals(const char *rec, const char *key, size_t len)
+{
+   if (*rec == '=')
+      return len == 0;
+   /* The arena ends with a NUL, so this can't run past it. */
+   return strncmp(rec, key, len) == 0 && (rec[len] == '\0' || rec[len] == '\n');
+}
+
+
+
+static INDEX_SLOT *find_slot(const _AL_CONFIG_INDEX *idx, uint32_t hash,
+   const char *section, const char *key, size_t key_len)
+{
+   uint32_t mask = idx->num_slots - 1;
+   uint32_t i = hash & mask;
+
+   while (idx->slots[i].hash) {
+      INDEX_SLOT *slot = &idx->slots[i];
+      if (slot->hash == hash
+            && key_equals(idx->arena + slot->key, key, key_len)
+            && strcmp(section_name(idx, slot->section), section) == 0) {
+         return slot;
+      }
+      i = (i + 1) & mask;
+   }
+
+   return &idx->slots[i];
+}
+
+
+
+static bool grow_slots(_AL_CONFIG_INDEX *idx)
+{
+   INDEX_SLOT *old = idx->slots;
+   uint32_t old_num = idx->num_slots;
+   uint32_t num = old_num ? old_num * 2 : MIN_SLOTS;
+   uint32_t i;
+
+   if (num < old_num)
+      return false;
+   idx->slots = al_calloc(num, sizeof(INDEX_SLOT));
+   if (!idx->slots) {
+      idx->slots = old;
+      return false;
+   }
+   idx->num_slots = num;
+
+   for (i = 0; i < old_num; i++) {
+      uint32_t j;
+      if (!old[i].hash)
+         continue;
+      for (j = old[i].hash & (num - 1); idx->slots[j].hash; j = (j + 1) & (num - 1))
+         ;
+      idx->slots[j] = old[i];
+   }
+
+   al_free(old);
+   return true;
+}
+
+
+
+/* Later values replace earlier ones, as with al_set_config_value. */
+static bool add_key(_AL_CONFIG_INDEX *idx, uint32_t section,
+   uint32_t key, size_t key_len, uint32_t value)
+{
+   const char *name = section_name(idx, section);
+   const char *k = (key_len > 0) ? idx->arena + key : "";
+   uint32_t hash = hash_key(name, strlen(name), k, key_len);
+   INDEX_SLOT *slot;
+
+   /* Keep the load factor under 3/4. */
+   if ((idx->count + 1) * (uint64_t)4 > idx->num_slots * (uint64_t)3) {
+      if (!grow_slots(idx))
+         return false;
+   }
+
+   slot = find_slot(idx, hash, name, k, key_len);
+   if (!slot->hash) {
+      slot->hash = hash;
+      slot->section = section;
+      slot->key = key;
+      idx->count++;
+   }
+   slot->value = value;
+   return true;
+}
+
+
+
+static bool is_ws(char c)
+{
+   return isspace((unsigned char)c);
+}
+
+
+
+/* scan:
+ *  Compacts the n bytes of text at the start of the arena into records,
+ *  indexing the keys. The arena must have room for n + 2 bytes.
+ */
+static bool scan(_AL_CONFIG_INDEX *idx, size_t n)
+{
+   char *a = idx->arena;
+   size_t r = 0;     /* read position */
+   size_t w = 0;     /* write position, never past r + 1 */
+   uint32_t section = NONE;
+
+   while (r < n) {
+      char *line = a + r;
+      char *nl = memchr(line, '\n', n - r);
+      char *s = line;
+      char *e = nl ? nl : a + n;
+
+      r = (nl ? nl + 1 : e) - a;
+
+      while (s < e && is_ws(*s))
+         s++;
+      while (e > s && is_ws(e[-1]))
+         e--;
+
+      if (s == e || *s == '#') {
+         memmove(a + w, s, e - s);
+         w += e - s;
+         a[w++] = '\0';
+      }
+      else if (*s == '[') {
+         char *rb = e;
+         while (rb > s + 1 && rb[-1] != ']')
+            rb--;
+         if (rb == s + 1)
+            rb = e;
+         else
+            rb--;
+         a[w++] = '[';
+         section = w;
+         memmove(a + w, s + 1, rb - (s + 1));
+         w += rb - (s + 1);
+         a[w++] = '\0';
+      }
+      else {
+         char *eq = memchr(s, '=', e - s);
+         char *ke = eq ? eq : e;
+         uint32_t key = w;
+         uint32_t value;
+         size_t key_len;
+
+         while (ke > s && is_ws(ke[-1]))
+            ke--;
+         key_len = ke - s;
+
+         if (!eq) {
+            memmove(a + w, s, key_len);
+            w += key_len;
+            a[w++] = '\n';
+            value = NONE;
+         }
+         else {
+            char *v = eq + 1;
+            while (v < e && is_ws(*v))
+               v++;
+            if (key_len == 0) {
+               a[w++] = '=';
+            }
+            else {
+               memmove(a + w, s, key_len);
+               w += key_len;
+               a[w++] = '\0';
+            }
+            value = w;
+            memmove(a + w, v, e - v);
+            w += e - v;
+            a[w++] = '\0';
+         }
+
+         if (!add_key(idx, section, key, key_len, value))
+            return false;
+      }
+   }
+
+   idx->size = w;
+   a[w] = '\0';
+   return true;
+}
+
+
+
+/* read_all:
+ *  Reads the rest of the file into a buffer with two spare bytes.
+ */
+static char *read_all(ALLEGRO_FILE *file, size_t *ret_size)
+{
+   void *base;
+   int64_t map_size;
+   int64_t pos = al_ftell(file);
+   int64_t fsize = al_fsize(file);
+   size_t cap, n = 0;
+   char *buf;
+
+   if (al_get_file_mapping(file, &base, &map_size) && pos >= 0) {
+      if (pos > map_size)
+         pos = map_size;
+      n = map_size - pos;
+      if (n >= NONE - 2)
+         return NULL;
+      buf = al_malloc(n + 2);
+      if (!buf)
+         return NULL;
+      memcpy(buf, (char *)base + pos, n);
+      al_fseek(file, pos + n, ALLEGRO_SEEK_SET);
+      *ret_size = n;
+      return buf;
+   }
+
+   cap = (pos >= 0 && fsize > pos && fsize - pos < NONE) ? fsize - pos : 4096;
+   buf = al_malloc(cap + 2);
+   if (!buf)
+      return NULL;
+
+   while (true) {
+      n += al_fread(file, buf + n, cap - n);
+      if (n < cap)
+         break;
+      /* The size was unknown or wrong; check for more with a spare byte. */
+      if (al_fread(file, buf + n, 1) == 0)
+         break;
+      n++;
+      if (cap >= NONE / 2) {
+         al_free(buf);
+         return NULL;
+      }
+      cap *= 2;
+      base = al_realloc(buf, cap + 2);
+      if (!base) {
+         al_free(buf);
+         return NULL;
+      }
+      buf = base;
+   }
+
+   if (al_ferror(file)) {
+      al_free(buf);
+      return NULL;
+   }
+
+   *ret_size = n;
+   return buf;
+}
+
+
+
+/* _al_config_index_load:
+ *  Reads and indexes the rest of the file. Returns NULL if it could not be
+ *  read, or can't be indexed, e.g. because it contains NUL bytes.
+ */
+_AL_CONFIG_INDEX *_al_config_index_load(ALLEGRO_FILE *file)
+{
+   _AL_CONFIG_INDEX *idx;
+   size_t n;
+
+   idx = al_calloc(1, sizeof(*idx));
+   if (!idx)
+      return NULL;
+
+   idx->arena = read_all(file, &n);
+   if (!idx->arena) {
+      al_free(idx);
+      return NULL;
+   }
+
+   if (memchr(idx->arena, '\0', n)) {
+      ALLEGRO_DEBUG("Not indexing a config with NUL bytes.\n");
+      _al_config_index_destroy(idx);
+      return NULL;
+   }
+
+   if (!grow_slots(idx) || !scan(idx, n)) {
+      _al_config_index_destroy(idx);
+      return NULL;
+   }
+
+   ALLEGRO_DEBUG("Indexed %u keys in %u slots.\n", idx->count,
+      idx->num_slots);
+
+   /* Give back what compacting saved, if worth it. */
+   if (idx->size + 1 < n / 2) {
+      char *arena = al_realloc(idx->arena, idx->size + 1);
+      if (arena)
+         idx->arena = arena;
+   }
+
+   return idx;
+}
+
+
+
+/* _al_config_index_get:
+ *  Returns the value of the key, or NULL.
+ */
+const char *_al_config_index_get(const _AL_CONFIG_INDEX *idx,
+   const char *section, const char *key)
+{
+   size_t key_len = strlen(key);
+   uint32_t hash = hash_key(section, strlen(section), key, key_len);
+   INDEX_SLOT *slot = find_slot(idx, hash, section, key, key_len);
+
+   if (!slot->hash)
+      return NULL;
+   return slot->value == NONE ? "" : idx->arena + slot->value;
+}
+
+
+
+/* _al_config_index_read_line:
+ *  Reads the line starting at *pos back from the records, advancing *pos.
+ *  Returns false at the end.
+ */
+bool _al_config_index_read_line(const _AL_CONFIG_INDEX *idx, size_t *pos,
+   _AL_CONFIG_LINE *line)
+{
+   const char *p = idx->arena + *pos;
+   size_t len;
+
+   if (*pos >= idx->size)
+      return false;
+
+   len = strcspn(p, "\n");
+   line->value = "";
+
+   if (*p == '\0' || *p == '#') {
+      line->type = _AL_CONFIG_LINE_COMMENT;
+      line->str = p;
+   }
+   else if (*p == '[') {
+      line->type = _AL_CONFIG_LINE_SECTION;
+      line->str = p + 1;
+      len--;
+   }
+   else if (*p == '=') {
+      line->type = _AL_CONFIG_LINE_KEY;
+      line->str = p;
+      line->value = p + 1;
+      len = 0;
+      *pos += strlen(p) + 1;
+      line->len = len;
+      return true;
+   }
+   else {
+      line->type = _AL_CONFIG_LINE_KEY;
+      line->str = p;
+      if (p[len] == '\0') {
+         line->value = p + len + 1;
+         *pos += strlen(line->value) + 1;
+      }
+   }
+
+   line->len = len;
+   *pos += (line->str - p) + len + 1;
+   return true;
+}
+
+
+
+/* _al_config_index_destroy:
+ */
+void _al_config_index_destroy(_AL_CONFIG_INDEX *idx)
+{
+   if (!idx)
+      return;
+   al_free(idx->slots);
+   al_free(idx->arena);
+   al_free(idx);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,453 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      SIMD pixel format conversion.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_cpu.h"
+#include <string.h>
+
+ALLEGRO_DEBUG_CHANNEL("bitmap")
+
+/*
+ * Vector versions of the most used entries of _al_convert_funcs. They
+ * replace the generated converters when the system is installed, if the CPU
+ * supports them, and hand any pixels left at the end of a row back to the
+ * generated code. The results are the same bit for bit.
+ *
+ * Every format here is read into, or written from, 4 pixels in the
+ * ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE byte order: red, green, blue, alpha.
+ * Formats made of whole bytes are just a reordering of those, so converting
+ * between two of them takes a single byte shuffle. The NEON shuffle,
+ * vqtbl1q_u8, only exists on AArch64.
+ */
+#if defined(_AL_SIMD_X86) || (defined(_AL_SIMD_NEON) && defined(__aarch64__))
+
+typedef void (*CONVERT_FUNC)(const void *, int, void *, int,
+   int, int, int, int, int, int);
+
+enum {
+   KIND_BYTES,
+   KIND_565,
+   KIND_F32
+};
+
+typedef struct SIMD_FORMAT {
+   int format;
+   int kind;
+   int size;
+   /* Byte offsets of red, green, blue and alpha, -1 if missing. */
+   int rgba[4];
+} SIMD_FORMAT;
+
+typedef struct SIMD_PAIR {
+   const SIMD_FORMAT *src;
+   const SIMD_FORMAT *dst;
+   /* Source to RGBA bytes, then alpha is or'ed in if the source has none. */
+   uint8_t load[16];
+   uint8_t load_alpha[16];
+   /* RGBA bytes to destination. */
+   uint8_t store[16];
+   /* Both of the above at once. */
+   uint8_t shuffle[16];
+   uint8_t shuffle_alpha[16];
+} SIMD_PAIR;
+
+#define NUM_SIMD_FORMATS 11
+
+static const SIMD_FORMAT simd_formats[NUM_SIMD_FORMATS] = {
+   {ALLEGRO_PIXEL_FORMAT_ARGB_8888, KIND_BYTES, 4, {2, 1, 0, 3}},
+   {ALLEGRO_PIXEL_FORMAT_RGBA_8888, KIND_BYTES, 4, {3, 2, 1, 0}},
+   {ALLEGRO_PIXEL_FORMAT_ABGR_8888, KIND_BYTES, 4, {0, 1, 2, 3}},
+   {ALLEGRO_PIXEL_FORMAT_XBGR_8888, KIND_BYTES, 4, {0, 1, 2, -1}},
+   {ALLEGRO_PIXEL_FORMAT_RGBX_8888, KIND_BYTES, 4, {3, 2, 1, -1}},
+   {ALLEGRO_PIXEL_FORMAT_XRGB_8888, KIND_BYTES, 4, {2, 1, 0, -1}},
+   {ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, KIND_BYTES, 4, {0, 1, 2, 3}},
+   {ALLEGRO_PIXEL_FORMAT_RGB_888, KIND_BYTES, 3, {2, 1, 0, -1}},
+   {ALLEGRO_PIXEL_FORMAT_BGR_888, KIND_BYTES, 3, {0, 1, 2, -1}},
+   {ALLEGRO_PIXEL_FORMAT_RGB_565, KIND_565, 2, {-1, -1, -1, -1}},
+   {ALLEGRO_PIXEL_FORMAT_ABGR_F32, KIND_F32, 16, {-1, -1, -1, -1}}
+};
+
+static int simd_index[ALLEGRO_NUM_PIXEL_FORMATS];
+static SIMD_PAIR simd_pairs[NUM_SIMD_FORMATS][NUM_SIMD_FORMATS];
+static CONVERT_FUNC fallback_funcs[NUM_SIMD_FORMATS][NUM_SIMD_FORMATS];
+#ifdef _AL_SIMD_X86
+static bool use_ssse3 = false;
+static bool use_avx2 = false;
+#endif
+
+
+static void init_pair(SIMD_PAIR *pair, const SIMD_FORMAT *src,
+   const SIMD_FORMAT *dst)
+{
+   int p, c, j;
+
+   pair->src = src;
+   pair->dst = dst;
+   memset(pair->load, 0x80, 16);
+   memset(pair->load_alpha, 0, 16);
+   memset(pair->store, 0x80, 16);
+   memset(pair->shuffle, 0x80, 16);
+   memset(pair->shuffle_alpha, 0, 16);
+
+   for (p = 0; p < 4; p++) {
+      for (c = 0; c < 4; c++) {
+         if (src->rgba[c] >= 0)
+            pair->load[p * 4 + c] = p * src->size + src->rgba[c];
+         else if (c == 3)
+            pair->load_alpha[p * 4 + c] = 0xff;
+         if (dst->rgba[c] >= 0)
+            pair->store[p * dst->size + dst->rgba[c]] = p * 4 + c;
+      }
+   }
+
+   for (j = 0; j < 16; j++) {
+      int from = pair->store[j];
+      if (from == 0x80)
+         continue;
+      pair->shuffle[j] = pair->load[from];
+      pair->shuffle_alpha[j] = pair->load_alpha[from];
+   }
+}
+
+
+#ifdef _AL_SIMD_X86
+
+_AL_TARGET_SSSE3
+static __m128i load_rgba_ssse3(const SIMD_PAIR *pair, const uint8_t *s)
+{
+   const __m128i zero = _mm_setzero_si128();
+
+   if (pair->src->kind == KIND_BYTES) {
+      __m128i x = _mm_loadu_si128((const __m128i *)s);
+      x = _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *)pair->load));
+      return _mm_or_si128(x,
+         _mm_loadu_si128((const __m128i *)pair->load_alpha));
+   }
+   else if (pair->src->kind == KIND_565) {
+      /* Scaled like _al_rgb_scale_5/6: x * 255 / 31 and x * 255 / 63,
+       * rounded down.
+       */
+      __m128i x = _mm_unpacklo_epi16(
+         _mm_loadl_epi64((const __m128i *)s), zero);
+      __m128i r = _mm_srli_epi32(x, 11);
+      __m128i g = _mm_and_si128(_mm_srli_epi32(x, 5), _mm_set1_epi32(63));
+      __m128i b = _mm_and_si128(x, _mm_set1_epi32(31));
+      r = _mm_mulhi_epu16(_mm_slli_epi32(r, 9), _mm_set1_epi32(1053));
+      g = _mm_mulhi_epu16(_mm_slli_epi32(g, 6), _mm_set1_epi32(4145));
+      b = _mm_mulhi_epu16(_mm_slli_epi32(b, 9), _mm_set1_epi32(1053));
+      return _mm_or_si128(
+         _mm_or_si128(r, _mm_slli_epi32(g, 8)),
+         _mm_or_si128(_mm_slli_epi32(b, 16),
+            _mm_set1_epi32((int)0xff000000)));
+   }
+   else {
+      /* Truncated, as in the generated code. */
+      const __m128 scale = _mm_set1_ps(255);
+      const float *f = (const float *)s;
+      __m128i p0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(f), scale));
+      __m128i p1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(f + 4), scale));
+      __m128i p2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(f + 8), scale));
+      __m128i p3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(f + 12), scale));
+      return _mm_packus_epi16(_mm_packs_epi32(p0, p1),
+         _mm_packs_epi32(p2, p3));
+   }
+}
+
+
+_AL_TARGET_SSSE3
+static void store_rgba_ssse3(const SIMD_PAIR *pair, uint8_t *d, __m128i x)
+{
+   const __m128i zero = _mm_setzero_si128();
+
+   if (pair->dst->kind == KIND_BYTES) {
+      x = _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *)pair->store));
+      if (pair->dst->size == 4) {
+         _mm_storeu_si128((__m128i *)d, x);
+      }
+      else {
+         int last;
+         _mm_storel_epi64((__m128i *)d, x);
+         last = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+         memcpy(d + 8, &last, 4);
+      }
+   }
+   else if (pair->dst->kind == KIND_565) {
+      __m128i r = _mm_slli_epi32(_mm_and_si128(x, _mm_set1_epi32(0xf8)), 8);
+      __m128i g = _mm_slli_epi32(
+         _mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0xfc)), 3);
+      __m128i b = _mm_srli_epi32(
+         _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(0xf8)), 3);
+      x = _mm_or_si128(r, _mm_or_si128(g, b));
+      x = _mm_shuffle_epi8(x, _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+         -1, -1, -1, -1, -1, -1, -1, -1));
+      _mm_storel_epi64((__m128i *)d, x);
+   }
+   else {
+      /* Divided like _al_u8_to_float. */
+      const __m128 scale = _mm_set1_ps(255);
+      float *f = (float *)d;
+      __m128i lo = _mm_unpacklo_epi8(x, zero);
+      __m128i hi = _mm_unpackhi_epi8(x, zero);
+      _mm_storeu_ps(f, _mm_div_ps(
+         _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+      _mm_storeu_ps(f + 4, _mm_div_ps(
+         _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+      _mm_storeu_ps(f + 8, _mm_div_ps(
+         _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+      _mm_storeu_ps(f + 12, _mm_div_ps(
+         _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+   }
+}
+
+
+_AL_TARGET_SSSE3
+static int convert_row_ssse3(const SIMD_PAIR *pair, const uint8_t *s,
+   uint8_t *d, int i, int n)
+{
+   const int ss = pair->src->size;
+   const int ds = pair->dst->size;
+
+   if (pair->src->kind == KIND_BYTES && pair->dst->kind == KIND_BYTES) {
+      const __m128i shuffle = _mm_loadu_si128((const __m128i *)pair->shuffle);
+      const __m128i alpha =
+         _mm_loadu_si128((const __m128i *)pair->shuffle_alpha);
+      for (; i + 4 <= n; i += 4) {
+         __m128i x = _mm_loadu_si128((const __m128i *)(s + i * ss));
+         x = _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha);
+         if (ds == 4) {
+            _mm_storeu_si128((__m128i *)(d + i * ds), x);
+         }
+         else {
+            int last;
+            _mm_storel_epi64((__m128i *)(d + i * ds), x);
+            last = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+            memcpy(d + i * ds + 8, &last, 4);
+         }
+      }
+      return i;
+   }
+
+   for (; i + 4 <= n; i += 4)
+      store_rgba_ssse3(pair, d + i * ds, load_rgba_ssse3(pair, s + i * ss));
+   return i;
+}
+
+
+_AL_TARGET_AVX2
+static int convert_row_avx2(const SIMD_PAIR *pair, const uint8_t *s,
+   uint8_t *d, int n)
+{
+   /* The shuffle stays within each 128-bit lane, which only works out
+    * when both sides have 4 pixels per lane.
+    */
+   const __m256i shuffle = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)pair->shuffle));
+   const __m256i alpha = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)pair->shuffle_alpha));
+   int i;
+
+   for (i = 0; i + 8 <= n; i += 8) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(s + i * 4));
+      x = _mm256_or_si256(_mm256_shuffle_epi8(x, shuffle), alpha);
+      _mm256_storeu_si256((__m256i *)(d + i * 4), x);
+   }
+   return i;
+}
+
+#endif /* _AL_SIMD_X86 */
+
+
+#ifdef _AL_SIMD_NEON
+
+static int convert_row_neon(const SIMD_PAIR *pair, const uint8_t *s,
+   uint8_t *d, int n)
+{
+   const int ss = pair->src->size;
+   const int ds = pair->dst->size;
+   const uint8x16_t shuffle = vld1q_u8(pair->shuffle);
+   const uint8x16_t alpha = vld1q_u8(pair->shuffle_alpha);
+   int i;
+
+   for (i = 0; i + 4 <= n; i += 4) {
+      uint8x16_t x = vorrq_u8(vqtbl1q_u8(vld1q_u8(s + i * ss), shuffle),
+         alpha);
+      if (ds == 4) {
+         vst1q_u8(d + i * ds, x);
+      }
+      else {
+         vst1_u8(d + i * ds, vget_low_u8(x));
+         vst1q_lane_u32((uint32_t *)(d + i * ds + 8),
+            vreinterpretq_u32_u8(x), 2);
+      }
+   }
+   return i;
+}
+
+#endif /* _AL_SIMD_NEON */
+
+
+static int convert_row(const SIMD_PAIR *pair, const uint8_t *s, uint8_t *d,
+   int n)
+{
+   int i = 0;
+
+   /* 16 bytes are read at a time, which is more than 4 pixels of 3. */
+   if (pair->src->size == 3)
+      n -= 2;
+
+#ifdef _AL_SIMD_X86
+   if (use_avx2 && pair->src->size == 4 && pair->dst->size == 4)
+      i = convert_row_avx2(pair, s, d, n);
+   if (use_ssse3)
+      i = convert_row_ssse3(pair, s, d, i, n);
+#else
+   if (pair->src->kind == KIND_BYTES && pair->dst->kind == KIND_BYTES)
+      i = convert_row_neon(pair, s, d, n);
+#endif
+
+   return i;
+}
+
+
+static void convert_simd(int src_format, int dst_format,
+   const void *src, int src_pitch, void *dst, int dst_pitch,
+   int sx, int sy, int dx, int dy, int width, int height)
+{
+   const int si = simd_index[src_format];
+   const int di = simd_index[dst_format];
+   const SIMD_PAIR *pair = &simd_pairs[si][di];
+   CONVERT_FUNC fallback = fallback_funcs[si][di];
+   int y;
+
+   for (y = 0; y < height; y++) {
+      const uint8_t *s = (const uint8_t *)src + (sy + y) * src_pitch +
+         sx * pair->src->size;
+      uint8_t *d = (uint8_t *)dst + (dy + y) * dst_pitch +
+         dx * pair->dst->size;
+      int done = convert_row(pair, s, d, width);
+
+      if (done < width) {
+         fallback(src, src_pitch, dst, dst_pitch, sx + done, sy + y,
+            dx + done, dy + y, width - done, 1);
+      }
+   }
+}
+
+
+#define FOR_EACH_SIMD_FORMAT(M, a) \
+   M(a, ARGB_8888) M(a, RGBA_8888) M(a, ABGR_8888) M(a, XBGR_8888) \
+   M(a, RGBX_8888) M(a, XRGB_8888) M(a, ABGR_8888_LE) M(a, RGB_888) \
+   M(a, BGR_888) M(a, RGB_565) M(a, ABGR_F32)
+
+#define FOR_EACH_SIMD_SOURCE(M) \
+   M(ARGB_8888) M(RGBA_8888) M(ABGR_8888) M(XBGR_8888) \
+   M(RGBX_8888) M(XRGB_8888) M(ABGR_8888_LE) M(RGB_888) \
+   M(BGR_888) M(RGB_565) M(ABGR_F32)
+
+#define DEFINE_CONVERTER(s, d) \
+   static void s##_to_##d(const void *src, int src_pitch, \
+      void *dst, int dst_pitch, \
+      int sx, int sy, int dx, int dy, int width, int height) \
+   { \
+      convert_simd(ALLEGRO_PIXEL_FORMAT_##s, ALLEGRO_PIXEL_FORMAT_##d, \
+         src, src_pitch, dst, dst_pitch, sx, sy, dx, dy, width, height); \
+   }
+#define DEFINE_CONVERTERS(s) FOR_EACH_SIMD_FORMAT(DEFINE_CONVERTER, s)
+
+#define CONVERTER_ENTRY(s, d) \
+   {ALLEGRO_PIXEL_FORMAT_##s, ALLEGRO_PIXEL_FORMAT_##d, s##_to_##d},
+#define CONVERTER_ENTRIES(s) FOR_EACH_SIMD_FORMAT(CONVERTER_ENTRY, s)
+
+FOR_EACH_SIMD_SOURCE(DEFINE_CONVERTERS)
+
+static const struct {
+   int src;
+   int dst;
+   CONVERT_FUNC func;
+} simd_converters[] = {
+   FOR_EACH_SIMD_SOURCE(CONVERTER_ENTRIES)
+};
+
+
+static bool supports_pair(const SIMD_FORMAT *src, const SIMD_FORMAT *dst)
+{
+   if (src == dst)
+      return false;
+   /* The generated code scales floats straight to 5 and 6 bits. */
+   if (src->kind == KIND_F32 && dst->kind == KIND_565)
+      return false;
+#ifdef _AL_SIMD_X86
+   return use_ssse3;
+#else
+   return src->kind == KIND_BYTES && dst->kind == KIND_BYTES;
+#endif
+}
+
+
+void _al_init_convert_simd(void)
+{
+   static bool done = false;
+   unsigned int i;
+   int n = 0;
+
+   if (done)
+      return;
+   done = true;
+
+#ifdef _AL_SIMD_X86
+   use_ssse3 = (al_get_cpu_features() & ALLEGRO_CPU_SSSE3) != 0;
+   use_avx2 = use_ssse3 && (al_get_cpu_features() & ALLEGRO_CPU_AVX2);
+#else
+   if (!(al_get_cpu_features() & ALLEGRO_CPU_NEON))
+      return;
+#endif
+
+   for (i = 0; i < NUM_SIMD_FORMATS; i++)
+      simd_index[simd_formats[i].format] = i;
+
+   for (i = 0; i < sizeof(simd_converters) / sizeof(simd_converters[0]); i++) {
+      int src = simd_converters[i].src;
+      int dst = simd_converters[i].dst;
+      int si = simd_index[src];
+      int di = simd_index[dst];
+
+      if (!supports_pair(&simd_formats[si], &simd_formats[di]))
+         continue;
+      init_pair(&simd_pairs[si][di], &simd_formats[si], &simd_formats[di]);
+      fallback_funcs[si][di] = _al_convert_funcs[src][dst];
+      _al_convert_funcs[src][dst] = simd_converters[i].func;
+      n++;
+   }
+
+#ifdef _AL_SIMD_X86
+   ALLEGRO_DEBUG("Using %d vector pixel converters (SSSE3: %d, AVX2: %d).\n",
+      n, use_ssse3, use_avx2);
+#else
+   ALLEGRO_DEBUG("Using %d vector pixel converters (NEON).\n", n);
+#endif
+}
+
+#else
+
+void _al_init_convert_simd(void)
+{
+}
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
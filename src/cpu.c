@@ -44,6 +44,14 @@
 #include <windows.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CPU_X86
+#include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define CPU_X86
+#include <intrin.h>
+#endif
+
 
 /* Function: al_get_cpu_count
  */
@@ -107,5 +115,201 @@ int al_get_ram_size(void)
 }
 
 
+#ifdef CPU_X86
+
+static void x86_cpuid(unsigned int leaf, unsigned int subleaf,
+   unsigned int regs[4])
+{
+#if defined(__GNUC__)
+   __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#else
+   int info[4];
+   __cpuidex(info, (int)leaf, (int)subleaf);
+   regs[0] = info[0];
+   regs[1] = info[1];
+   regs[2] = info[2];
+   regs[3] = info[3];
+#endif
+}
+
+static uint64_t x86_xgetbv(void)
+{
+#if defined(__GNUC__)
+   uint32_t eax, edx;
+   __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+   return ((uint64_t)edx << 32) | eax;
+#else
+   return _xgetbv(0);
+#endif
+}
+
+static int x86_features(void)
+{
+   unsigned int regs[4];
+   unsigned int max_leaf, ecx1;
+   uint64_t xcr0 = 0;
+   int features = 0;
+
+   x86_cpuid(0, 0, regs);
+   max_leaf = regs[0];
+   if (max_leaf < 1)
+      return 0;
+
+   x86_cpuid(1, 0, regs);
+   ecx1 = regs[2];
+   if (regs[3] & (1u << 26))
+      features |= ALLEGRO_CPU_SSE2;
+   if (ecx1 & (1u << 9))
+      features |= ALLEGRO_CPU_SSSE3;
+   if (ecx1 & (1u << 19))
+      features |= ALLEGRO_CPU_SSE41;
+
+   /* The AVX family also needs the OS to save the wider registers. */
+   if (ecx1 & (1u << 27))
+      xcr0 = x86_xgetbv();
+   if ((xcr0 & 6) != 6 || !(ecx1 & (1u << 28)))
+      return features;
+
+   if (ecx1 & (1u << 29))
+      features |= ALLEGRO_CPU_F16C;
+   if (max_leaf >= 7) {
+      x86_cpuid(7, 0, regs);
+      if (regs[1] & (1u << 5))
+         features |= ALLEGRO_CPU_AVX2;
+      if ((xcr0 & 0xe6) == 0xe6 && (regs[1] & (1u << 16)))
+         features |= ALLEGRO_CPU_AVX512F;
+   }
+   return features;
+}
+
+/* Size in bytes of the level 1 data or the level 2 cache, from the
+ * deterministic cache parameters (Intel) or the extended leaves (AMD).
+ */
+static int x86_cache_size(int level)
+{
+   unsigned int regs[4];
+   unsigned int i;
+
+   x86_cpuid(0, 0, regs);
+   if (regs[0] >= 4) {
+      for (i = 0; i < 16; i++) {
+         unsigned int type, cache_level;
+         x86_cpuid(4, i, regs);
+         type = regs[0] & 0x1f;
+         cache_level = (regs[0] >> 5) & 7;
+         if (type == 0)
+            break;
+         /* Data or unified. */
+         if ((type == 1 || type == 3) && (int)cache_level == level) {
+            return ((regs[1] >> 22) + 1) * (((regs[1] >> 12) & 0x3ff) + 1) *
+               ((regs[1] & 0xfff) + 1) * (regs[2] + 1);
+         }
+      }
+   }
+
+   x86_cpuid(0x80000000, 0, regs);
+   if (level == 1 && regs[0] >= 0x80000005) {
+      x86_cpuid(0x80000005, 0, regs);
+      return (regs[2] >> 24) * 1024;
+   }
+   if (level == 2 && regs[0] >= 0x80000006) {
+      x86_cpuid(0x80000006, 0, regs);
+      return (regs[2] >> 16) * 1024;
+   }
+   return -1;
+}
+
+#endif
+
+#if defined(ALLEGRO_HAVE_SYSCTL) && defined(ALLEGRO_MACOSX)
+static int sysctl_int(const char *name)
+{
+   int64_t value = 0;
+   size_t len = sizeof(value);
+   if (sysctlbyname(name, &value, &len, NULL, 0) == 0 && value > 0)
+      return (int)value;
+   return -1;
+}
+#endif
+
+/* Function: al_get_cpu_features
+ */
+int al_get_cpu_features(void)
+{
+   static int features = -1;
+
+   if (features < 0) {
+      int f = 0;
+#if defined(CPU_X86)
+      f = x86_features();
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+      f = ALLEGRO_CPU_NEON;
+#endif
+      features = f;
+   }
+   return features;
+}
+
+/* Function: al_get_cpu_cache_line_size
+ */
+int al_get_cpu_cache_line_size(void)
+{
+#if defined(ALLEGRO_HAVE_SYSCONF) && defined(_SC_LEVEL1_DCACHE_LINESIZE)
+   long size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+   if (size > 0)
+      return (int)size;
+#elif defined(ALLEGRO_HAVE_SYSCTL) && defined(ALLEGRO_MACOSX)
+   int size = sysctl_int("hw.cachelinesize");
+   if (size > 0)
+      return size;
+#endif
+#if defined(CPU_X86)
+   {
+      unsigned int regs[4];
+      x86_cpuid(1, 0, regs);
+      if (regs[3] & (1u << 19))
+         return ((regs[1] >> 8) & 0xff) * 8;
+   }
+#elif defined(__aarch64__) && defined(__GNUC__)
+   {
+      uint64_t ctr;
+      __asm__ __volatile__("mrs %0, ctr_el0" : "=r"(ctr));
+      return 4 << ((ctr >> 16) & 0xf);
+   }
+#endif
+   return -1;
+}
+
+/* Function: al_get_cpu_cache_size
+ */
+int al_get_cpu_cache_size(int level)
+{
+   if (level != 1 && level != 2)
+      return -1;
+
+#if defined(ALLEGRO_HAVE_SYSCONF) && defined(_SC_LEVEL1_DCACHE_SIZE) && \
+   defined(_SC_LEVEL2_CACHE_SIZE)
+   {
+      long size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE :
+         _SC_LEVEL2_CACHE_SIZE);
+      if (size > 0)
+         return (int)size;
+   }
+#elif defined(ALLEGRO_HAVE_SYSCTL) && defined(ALLEGRO_MACOSX)
+   {
+      int size = sysctl_int(level == 1 ? "hw.l1dcachesize" :
+         "hw.l2cachesize");
+      if (size > 0)
+         return size;
+   }
+#endif
+#if defined(CPU_X86)
+   return x86_cache_size(level);
+#else
+   return -1;
+#endif
+}
+
+
 /* vi: set ts=4 sw=4 expandtab: */
       
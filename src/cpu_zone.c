@@ -0,0 +1,316 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      CPU trace zones.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_debug.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_thread.h"
+
+ALLEGRO_DEBUG_CHANNEL("system")
+
+/* Like asynchronous tracing in debug.c, zones need a buffer per thread. */
+#if defined(ALLEGRO_MSVC)
+   #define ZONE_THREAD_LOCAL __declspec(thread)
+   #define SUPPORT_CPU_ZONES
+#elif defined(__GNUC__) && !defined(ALLEGRO_MINGW32)
+   #define ZONE_THREAD_LOCAL __thread
+   #define SUPPORT_CPU_ZONES
+#endif
+
+/*
+ * Every thread records its finished zones into a ring of its own, without
+ * taking any lock, and the rings are only read when the trace is saved.
+ * When a ring is full the oldest zones are overwritten, so a trace always
+ * holds the last few thousand zones of each thread.
+ *
+ * A zone is begun and ended on the same thread. Zones nested deeper than
+ * ZONE_MAX_DEPTH are not recorded, but still have to be ended.
+ */
+#define ZONE_RING_SIZE  8192
+#define ZONE_MAX_DEPTH  32
+
+typedef struct ZONE
+{
+   char const *name;
+   double start;
+   double duration;
+} ZONE;
+
+typedef struct ZONE_THREAD ZONE_THREAD;
+
+struct ZONE_THREAD
+{
+   ZONE zones[ZONE_RING_SIZE];
+   _AL_ATOMIC head;           /* zones recorded so far */
+   char const *open_names[ZONE_MAX_DEPTH];
+   double open_starts[ZONE_MAX_DEPTH];
+   int depth;
+   int id;
+   ZONE_THREAD *next;
+};
+
+typedef struct CPU_TRACE
+{
+   bool initialized;
+   int generation;            /* invalidates the threads of a previous trace */
+   int next_id;
+   double start_time;
+   _AL_MUTEX mutex;           /* guards threads */
+   ZONE_THREAD *threads;
+   void (*handler)(char const *name, bool begin);
+} CPU_TRACE;
+
+volatile int _al_cpu_trace_enabled = 0;
+
+static CPU_TRACE cpu_trace;
+
+#ifdef SUPPORT_CPU_ZONES
+static ZONE_THREAD_LOCAL ZONE_THREAD *thread_zones;
+static ZONE_THREAD_LOCAL int thread_zones_generation;
+#endif
+
+
+static void free_zone_threads(void)
+{
+   while (cpu_trace.threads) {
+      ZONE_THREAD *t = cpu_trace.threads;
+      cpu_trace.threads = t->next;
+      al_free(t);
+   }
+}
+
+
+static void shutdown_cpu_trace(void)
+{
+   _al_cpu_trace_enabled = 0;
+   free_zone_threads();
+   cpu_trace.generation++;
+   cpu_trace.handler = NULL;
+   _al_mutex_destroy(&cpu_trace.mutex);
+   cpu_trace.initialized = false;
+}
+
+
+#ifdef SUPPORT_CPU_ZONES
+/* get_zone_thread:
+ *  Return the zones of the calling thread, creating them if necessary.
+ */
+static ZONE_THREAD *get_zone_thread(void)
+{
+   ZONE_THREAD *t;
+
+   if (thread_zones && thread_zones_generation == cpu_trace.generation)
+      return thread_zones;
+
+   t = al_calloc(1, sizeof *t);
+   if (!t)
+      return NULL;
+
+   _al_mutex_lock(&cpu_trace.mutex);
+   t->id = cpu_trace.next_id++;
+   t->next = cpu_trace.threads;
+   cpu_trace.threads = t;
+   _al_mutex_unlock(&cpu_trace.mutex);
+
+   thread_zones = t;
+   thread_zones_generation = cpu_trace.generation;
+   return t;
+}
+#endif
+
+
+void _al_begin_cpu_zone(char const *name)
+{
+#ifdef SUPPORT_CPU_ZONES
+   ZONE_THREAD *t = get_zone_thread();
+
+   if (!t)
+      return;
+
+   if (cpu_trace.handler)
+      cpu_trace.handler(name, true);
+
+   if (t->depth < ZONE_MAX_DEPTH) {
+      t->open_names[t->depth] = name;
+      t->open_starts[t->depth] = al_get_time();
+   }
+   t->depth++;
+#else
+   (void)name;
+#endif
+}
+
+
+void _al_end_cpu_zone(void)
+{
+#ifdef SUPPORT_CPU_ZONES
+   ZONE_THREAD *t = thread_zones;
+   char const *name = NULL;
+   double end;
+
+   /* The zone may have been begun before this trace was started. */
+   if (!t || thread_zones_generation != cpu_trace.generation || t->depth == 0)
+      return;
+
+   end = al_get_time();
+   t->depth--;
+   if (t->depth < ZONE_MAX_DEPTH) {
+      unsigned int head = t->head;
+      ZONE *z = &t->zones[head % ZONE_RING_SIZE];
+      name = t->open_names[t->depth];
+      z->name = name;
+      z->start = t->open_starts[t->depth];
+      z->duration = end - z->start;
+      _al_atomic_store_release(&t->head, head + 1);
+   }
+
+   if (cpu_trace.handler)
+      cpu_trace.handler(name, false);
+#endif
+}
+
+
+/* Function: al_start_cpu_trace
+ */
+bool al_start_cpu_trace(void)
+{
+#ifdef SUPPORT_CPU_ZONES
+   if (!al_is_system_installed())
+      return false;
+   if (_al_cpu_trace_enabled)
+      return true;
+
+   if (!cpu_trace.initialized) {
+      _al_mutex_init(&cpu_trace.mutex);
+      _al_add_exit_func(shutdown_cpu_trace, "shutdown_cpu_trace");
+      cpu_trace.initialized = true;
+   }
+
+   _al_mutex_lock(&cpu_trace.mutex);
+   free_zone_threads();
+   cpu_trace.generation++;
+   cpu_trace.next_id = 1;
+   cpu_trace.start_time = al_get_time();
+   _al_mutex_unlock(&cpu_trace.mutex);
+
+   _al_cpu_trace_enabled = 1;
+   return true;
+#else
+   ALLEGRO_WARN("CPU zones are not supported by this build.\n");
+   return false;
+#endif
+}
+
+
+/* Function: al_stop_cpu_trace
+ */
+void al_stop_cpu_trace(void)
+{
+   _al_cpu_trace_enabled = 0;
+}
+
+
+static void write_json_string(ALLEGRO_FILE *f, char const *s)
+{
+   al_fputc(f, '"');
+   for (; s && *s; s++) {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+         al_fprintf(f, "\\%c", c);
+      else if (c < 0x20)
+         al_fprintf(f, "\\u%04x", c);
+      else
+         al_fputc(f, c);
+   }
+   al_fputc(f, '"');
+}
+
+
+/* Function: al_save_cpu_trace
+ */
+bool al_save_cpu_trace(char const *filename)
+{
+   ALLEGRO_FILE *f;
+   ZONE_THREAD *t;
+   bool first = true;
+   bool ok;
+   ASSERT(filename);
+
+   if (!cpu_trace.initialized)
+      return false;
+
+   f = al_fopen(filename, "w");
+   if (!f) {
+      ALLEGRO_ERROR("Unable to open %s for writing.\n", filename);
+      return false;
+   }
+
+   /* The Trace Event Format read by chrome://tracing and Perfetto, with
+    * one complete event per zone and times in microseconds.
+    */
+   al_fputs(f, "{\"traceEvents\":[\n");
+   _al_mutex_lock(&cpu_trace.mutex);
+   for (t = cpu_trace.threads; t; t = t->next) {
+      unsigned int head = _al_atomic_load_acquire(&t->head);
+      unsigned int i = head > ZONE_RING_SIZE ? head - ZONE_RING_SIZE : 0;
+
+      for (; i < head; i++) {
+         ZONE *z = &t->zones[i % ZONE_RING_SIZE];
+         al_fputs(f, first ? "{\"name\":" : ",\n{\"name\":");
+         write_json_string(f, z->name);
+         al_fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f}", t->id,
+            (z->start - cpu_trace.start_time) * 1e6, z->duration * 1e6);
+         first = false;
+      }
+   }
+   _al_mutex_unlock(&cpu_trace.mutex);
+   al_fputs(f, "\n]}\n");
+
+   ok = !al_ferror(f);
+   if (!al_fclose(f))
+      ok = false;
+   return ok;
+}
+
+
+/* Function: al_begin_cpu_zone
+ */
+void al_begin_cpu_zone(char const *name)
+{
+   ASSERT(name);
+   _AL_BEGIN_CPU_ZONE(name);
+}
+
+
+/* Function: al_end_cpu_zone
+ */
+void al_end_cpu_zone(void)
+{
+   _AL_END_CPU_ZONE();
+}
+
+
+/* Function: al_set_cpu_zone_handler
+ */
+void al_set_cpu_zone_handler(void (*handler)(char const *name, bool begin))
+{
+   cpu_trace.handler = handler;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -18,7 +18,9 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern_debug.h"
+#include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_vector.h"
 
 #ifdef ALLEGRO_WINDOWS
@@ -30,6 +32,15 @@
 #include <android/log.h>
 #endif
 
+/* Asynchronous tracing needs a buffer per thread. */
+#if defined(ALLEGRO_MSVC)
+   #define TRACE_THREAD_LOCAL __declspec(thread)
+   #define SUPPORT_ASYNC_TRACE
+#elif defined(__GNUC__) && !defined(ALLEGRO_MINGW32)
+   #define TRACE_THREAD_LOCAL __thread
+   #define SUPPORT_ASYNC_TRACE
+#endif
+
 
 /* tracing */
 typedef struct TRACE_INFO
@@ -48,6 +59,8 @@ typedef struct TRACE_INFO
    _AL_VECTOR excluded;
    /* Whether settings have been read from allegro5.cfg or not. */
    bool configured;
+   /* Whether to hand messages to a writer thread. */
+   bool async;
 } TRACE_INFO;
 
 
@@ -61,11 +74,63 @@ static TRACE_INFO trace_info =
    7,
    _AL_VECTOR_INITIALIZER(ALLEGRO_USTR *),
    _AL_VECTOR_INITIALIZER(ALLEGRO_USTR *),
+   false,
    false
 };
 
 static char static_trace_buffer[2048];
 
+
+#ifdef SUPPORT_ASYNC_TRACE
+/* In asynchronous mode every thread formats its messages into a ring of
+ * its own, without taking any lock, and a writer thread drains the rings
+ * into the log. A thread which logs faster than that drops messages, and
+ * the writer reports how many.
+ */
+
+/* Size of one message, including the prefix. Longer ones are truncated. */
+#define TRACE_RECORD_SIZE  512
+
+/* Messages buffered per thread. */
+#define TRACE_RING_SIZE    64
+
+/* How often the writer thread looks for messages, in seconds. */
+#define TRACE_WRITER_INTERVAL 0.01
+
+typedef struct TRACE_RING TRACE_RING;
+
+struct TRACE_RING
+{
+   char records[TRACE_RING_SIZE][TRACE_RECORD_SIZE];
+   _AL_ATOMIC head;           /* advanced by the logging thread */
+   _AL_ATOMIC tail;           /* advanced by the writer thread */
+   _AL_ATOMIC dropped;        /* counted by the logging thread */
+   _AL_ATOMIC reported_dropped;
+   TRACE_RING *next;
+};
+
+typedef struct ASYNC_TRACE
+{
+   bool running;
+   bool started;              /* not restarted until logging shuts down */
+   int generation;            /* invalidates the rings of a previous run */
+   _AL_THREAD thread;
+   _AL_MUTEX mutex;           /* guards rings */
+   _AL_COND cond;
+   TRACE_RING *rings;
+} ASYNC_TRACE;
+
+static ASYNC_TRACE async_trace;
+
+static TRACE_THREAD_LOCAL TRACE_RING *thread_ring;
+static TRACE_THREAD_LOCAL int thread_ring_generation;
+/* The record being written by this thread, between _al_trace_prefix and
+ * _al_trace_suffix.
+ */
+static TRACE_THREAD_LOCAL char *thread_record;
+
+#endif
+
 /* run-time assertions */
 void (*_al_user_assert_handler)(char const *expr, char const *file,
    int line, char const *func);
@@ -165,6 +230,9 @@ void _al_configure_logging(void)
    else
       trace_info.flags &= ~1;
 
+   v = al_get_config_value(config, "trace", "async");
+   trace_info.async = (v && !strcmp(v, "1"));
+
    if (!trace_info.configured)
       _al_mutex_init(&trace_info.trace_mutex);
 
@@ -200,20 +268,265 @@ static void open_trace_file(void)
 }
 
 
+/* write_trace:
+ *  Send a complete message to wherever the log goes.
+ */
+static void write_trace(const char *text)
+{
+   if (_al_user_trace_handler) {
+      _al_user_trace_handler(text);
+   }
+   else {
+#ifdef ALLEGRO_ANDROID
+      (void)__android_log_print(ANDROID_LOG_INFO, "allegro", "%s", text);
+#endif
+#if defined(ALLEGRO_IPHONE) || defined(__EMSCRIPTEN__)
+      fprintf(stderr, "%s", text);
+      fflush(stderr);
+#endif
+#ifdef ALLEGRO_WINDOWS
+      {
+         TCHAR *windows_output = _twin_utf8_to_tchar(text);
+         OutputDebugString(windows_output);
+         al_free(windows_output);
+      }
+#endif
+
+      /* We're intentially still writing to a file if it's set even with the
+       * additional logging options above. */
+      if (trace_info.trace_file) {
+         fprintf(trace_info.trace_file, "%s", text);
+      }
+   }
+}
+
+
+/* trace_buffer:
+ *  Return the buffer the message of this thread is being formatted into.
+ */
+static char *trace_buffer(size_t *size)
+{
+#ifdef SUPPORT_ASYNC_TRACE
+   if (thread_record) {
+      *size = TRACE_RECORD_SIZE;
+      return thread_record;
+   }
+#endif
+   *size = sizeof(static_trace_buffer);
+   return static_trace_buffer;
+}
+
+
 static void do_trace(const char *msg, ...)
 {
    va_list ap;
-   int s = strlen(static_trace_buffer);
+   size_t size;
+   char *buffer = trace_buffer(&size);
+   int s = strlen(buffer);
    va_start(ap, msg);
-   vsnprintf(static_trace_buffer + s, sizeof(static_trace_buffer) - s,
-      msg, ap);
+   vsnprintf(buffer + s, size - s, msg, ap);
    va_end(ap);
 }
 
 
+#ifdef SUPPORT_ASYNC_TRACE
+/* get_thread_ring:
+ *  Return the ring of the calling thread, creating it if necessary.
+ */
+static TRACE_RING *get_thread_ring(void)
+{
+   TRACE_RING *ring;
+
+   if (thread_ring && thread_ring_generation == async_trace.generation)
+      return thread_ring;
+
+   ring = calloc(1, sizeof *ring);
+   if (!ring)
+      return NULL;
+
+   _al_mutex_lock(&async_trace.mutex);
+   ring->next = async_trace.rings;
+   async_trace.rings = ring;
+   _al_mutex_unlock(&async_trace.mutex);
+
+   thread_ring = ring;
+   thread_ring_generation = async_trace.generation;
+   return ring;
+}
+
+
+/* begin_async_record:
+ *  Claim the next free record in the ring of the calling thread, or count
+ *  the message as dropped if there is none.
+ */
+static bool begin_async_record(void)
+{
+   TRACE_RING *ring = get_thread_ring();
+   unsigned int head, tail;
+
+   if (!ring)
+      return false;
+
+   head = ring->head;
+   tail = _al_atomic_load_acquire(&ring->tail);
+   if (head - tail >= TRACE_RING_SIZE) {
+      _al_atomic_store_release(&ring->dropped, ring->dropped + 1);
+      return false;
+   }
+
+   thread_record = ring->records[head % TRACE_RING_SIZE];
+   thread_record[0] = '\0';
+   return true;
+}
+
+
+/* end_async_record:
+ *  Hand the record claimed by begin_async_record over to the writer.
+ */
+static void end_async_record(void)
+{
+   TRACE_RING *ring = thread_ring;
+
+   thread_record = NULL;
+   _al_atomic_store_release(&ring->head, ring->head + 1);
+}
+
+
+/* drain_async_trace: [writer thread]
+ *  Write out all messages in the rings.
+ */
+static void drain_async_trace(void)
+{
+   TRACE_RING *ring;
+   bool wrote = false;
+
+   if (!_al_user_trace_handler)
+      open_trace_file();
+
+   _al_mutex_lock(&async_trace.mutex);
+   for (ring = async_trace.rings; ring; ring = ring->next) {
+      unsigned int tail = ring->tail;
+      unsigned int head = _al_atomic_load_acquire(&ring->head);
+      int dropped = _al_atomic_load_acquire(&ring->dropped);
+
+      while (tail != head) {
+         write_trace(ring->records[tail % TRACE_RING_SIZE]);
+         tail++;
+         _al_atomic_store_release(&ring->tail, tail);
+         wrote = true;
+      }
+
+      if (dropped != ring->reported_dropped) {
+         char text[64];
+         snprintf(text, sizeof(text), "%-8s W %d messages dropped\n",
+            "trace", dropped - ring->reported_dropped);
+         write_trace(text);
+         ring->reported_dropped = dropped;
+         wrote = true;
+      }
+   }
+   _al_mutex_unlock(&async_trace.mutex);
+
+   if (wrote && !_al_user_trace_handler && trace_info.trace_file)
+      fflush(trace_info.trace_file);
+}
+
+
+static void async_trace_thread_func(_AL_THREAD *self, void *unused)
+{
+   ALLEGRO_TIMEOUT timeout;
+   (void)unused;
+
+   _al_thread_set_name(self, "al-trace");
+
+   while (!_al_get_thread_should_stop(self)) {
+      drain_async_trace();
+
+      al_init_timeout(&timeout, TRACE_WRITER_INTERVAL);
+      _al_mutex_lock(&async_trace.mutex);
+      if (!_al_get_thread_should_stop(self))
+         _al_cond_timedwait(&async_trace.cond, &async_trace.mutex, &timeout);
+      _al_mutex_unlock(&async_trace.mutex);
+   }
+
+   drain_async_trace();
+}
+
+
+static void stop_async_trace(void)
+{
+   if (!async_trace.running)
+      return;
+
+   async_trace.running = false;
+
+   _al_thread_set_should_stop(&async_trace.thread);
+   _al_mutex_lock(&async_trace.mutex);
+   _al_cond_signal(&async_trace.cond);
+   _al_mutex_unlock(&async_trace.mutex);
+   _al_thread_join(&async_trace.thread);
+
+   while (async_trace.rings) {
+      TRACE_RING *ring = async_trace.rings;
+      async_trace.rings = ring->next;
+      free(ring);
+   }
+   async_trace.generation++;
+
+   _al_cond_destroy(&async_trace.cond);
+   _al_mutex_destroy(&async_trace.mutex);
+}
+
+
+/* start_async_trace:
+ *  Start the writer thread. It needs the system driver for its timeouts, so
+ *  this waits until the system is installed, and the writer is stopped
+ *  again before the system driver is shut down. Messages logged outside
+ *  that time are written synchronously.
+ */
+static void start_async_trace(void)
+{
+   _al_mutex_lock(&trace_info.trace_mutex);
+   if (!async_trace.started) {
+      _al_mutex_init(&async_trace.mutex);
+      _al_cond_init(&async_trace.cond);
+      async_trace.rings = NULL;
+      _al_thread_create(&async_trace.thread, async_trace_thread_func, NULL);
+      _al_add_exit_func(stop_async_trace, "stop_async_trace");
+      async_trace.running = true;
+      async_trace.started = true;
+   }
+   _al_mutex_unlock(&trace_info.trace_mutex);
+}
+#endif
+
+
+/* begin_record:
+ *  Prepare for formatting a message. Returns false if it must be dropped.
+ */
+static bool begin_record(void)
+{
+#ifdef SUPPORT_ASYNC_TRACE
+   if (trace_info.async && !async_trace.started && al_is_system_installed())
+      start_async_trace();
+   if (async_trace.running)
+      return begin_async_record();
+#endif
+
+   /* Avoid interleaved output from different threads. */
+   _al_mutex_lock(&trace_info.trace_mutex);
+
+   if (!_al_user_trace_handler)
+      open_trace_file();
+
+   return true;
+}
+
+
 /* _al_trace_prefix:
  *  Conditionally write the initial part of a trace message.  If we do, return true
- *  and continue to hold the trace_mutex lock.
+ *  and continue to hold the trace_mutex lock, or in asynchronous mode, the
+ *  record of this thread.
  */
 bool _al_trace_prefix(char const *channel, int level,
    char const *file, int line, char const *function)
@@ -252,11 +565,8 @@ channel_included:
       }
    }
 
-   /* Avoid interleaved output from different threads. */
-   _al_mutex_lock(&trace_info.trace_mutex);
-
-   if (!_al_user_trace_handler)
-      open_trace_file();
+   if (!begin_record())
+      return false;
 
    do_trace("%-8s ", channel);
    if (level == 0) do_trace("D ");
@@ -302,39 +612,24 @@ void _al_trace_suffix(const char *msg, ...)
 {
    int olderr = errno;
    va_list ap;
-   int s = strlen(static_trace_buffer);
+   size_t size;
+   char *buffer = trace_buffer(&size);
+   int s = strlen(buffer);
    va_start(ap, msg);
-   vsnprintf(static_trace_buffer + s, sizeof(static_trace_buffer) - s,
-      msg, ap);
+   vsnprintf(buffer + s, size - s, msg, ap);
    va_end(ap);
 
-   if (_al_user_trace_handler) {
-      _al_user_trace_handler(static_trace_buffer);
+#ifdef SUPPORT_ASYNC_TRACE
+   if (buffer != static_trace_buffer) {
+      end_async_record();
+      errno = olderr;
+      return;
    }
-   else {
-#ifdef ALLEGRO_ANDROID
-      (void)__android_log_print(ANDROID_LOG_INFO, "allegro", "%s",
-         static_trace_buffer);
-#endif
-#if defined(ALLEGRO_IPHONE) || defined(__EMSCRIPTEN__)
-      fprintf(stderr, "%s", static_trace_buffer);
-      fflush(stderr);
-#endif
-#ifdef ALLEGRO_WINDOWS
-      {
-         TCHAR *windows_output = _twin_utf8_to_tchar(static_trace_buffer);
-         OutputDebugString(windows_output);
-         al_free(windows_output);
-      }
 #endif
 
-      /* We're intentially still writing to a file if it's set even with the
-       * additional logging options above. */
-      if (trace_info.trace_file) {
-         fprintf(trace_info.trace_file, "%s", static_trace_buffer);
-         fflush(trace_info.trace_file);
-      }
-   }
+   write_trace(static_trace_buffer);
+   if (!_al_user_trace_handler && trace_info.trace_file)
+      fflush(trace_info.trace_file);
    static_trace_buffer[0] = '\0';
    errno = olderr;
 
@@ -344,6 +639,11 @@ void _al_trace_suffix(const char *msg, ...)
 
 void _al_shutdown_logging(void)
 {
+#ifdef SUPPORT_ASYNC_TRACE
+   stop_async_trace();
+   async_trace.started = false;
+#endif
+
    if (trace_info.configured) {
       _al_mutex_destroy(&trace_info.trace_mutex);
 
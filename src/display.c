@@ -25,6 +25,7 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_shader.h"
 #include "allegro5/internal/aintern_system.h"
@@ -32,6 +33,9 @@
 
 ALLEGRO_DEBUG_CHANNEL("display")
 
+ALLEGRO_STATIC_ASSERT(display,
+   ALLEGRO_DISPLAY_STAT_COUNT <= _ALLEGRO_MAX_DISPLAY_STATS);
+
 
 /* Function: al_create_display
  */
@@ -77,9 +81,12 @@ ALLEGRO_DISPLAY *al_create_display(int w, int h)
    display->cache_enabled = false;
    display->vertex_cache_size = 0;
    display->cache_texture = 0;
+   display->cache_sorted = false;
+   _al_init_sorted_draws(display);
    al_identity_transform(&display->projview_transform);
 
    display->default_shader = NULL;
+   display->instance_shader = NULL;
 
    _al_vector_init(&display->display_invalidated_callbacks, sizeof(void *));
    _al_vector_init(&display->display_validated_callbacks, sizeof(void *));
@@ -93,6 +100,12 @@ ALLEGRO_DISPLAY *al_create_display(int w, int h)
 
    _al_vector_init(&display->bitmaps, sizeof(ALLEGRO_BITMAP*));
 
+   memset(display->stats, 0, sizeof(display->stats));
+   memset(display->last_stats, 0, sizeof(display->last_stats));
+
+   _al_init_gpu_zones(display);
+   _al_init_frame_timing(display);
+
    if (settings->settings[ALLEGRO_COMPATIBLE_DISPLAY]) {
       al_set_target_bitmap(al_get_backbuffer(display));
    }
@@ -142,6 +155,29 @@ ALLEGRO_DISPLAY *al_create_display(int w, int h)
 void al_destroy_display(ALLEGRO_DISPLAY *display)
 {
    if (display) {
+      if (_al_vector_size(&display->gpu_timers) > 0) {
+         /* The timers are objects of the display's context. */
+         ALLEGRO_DISPLAY *old = al_get_current_display();
+         if (old != display)
+            _al_set_current_display_only(display);
+         _al_destroy_gpu_zones(display);
+         if (old != display)
+            _al_set_current_display_only(old);
+      }
+      else {
+         _al_destroy_gpu_zones(display);
+      }
+
+      /* Pending saves read their bitmaps, which needs the display. */
+      if (_al_has_bitmap_saves()) {
+         ALLEGRO_DISPLAY *old = al_get_current_display();
+         if (old != display)
+            _al_set_current_display_only(display);
+         _al_update_bitmap_saves(display, NULL, true);
+         if (old != display)
+            _al_set_current_display_only(old);
+      }
+
       /* This causes warnings and potential errors on Android because
        * it clears the context and Android needs this thread to have
        * the context bound in its destroy function and to destroy the
@@ -161,6 +197,22 @@ void al_destroy_display(ALLEGRO_DISPLAY *display)
          _al_set_current_display_only(NULL);
 #endif
 
+      /* Let the addons drop what they keep for this display. Direct3D
+       * displays are invalidated by the driver when they are destroyed.
+       */
+      if (!(display->flags & ALLEGRO_DIRECT3D_INTERNAL)) {
+         unsigned int i;
+         for (i = 0; i < _al_vector_size(&display->display_invalidated_callbacks); i++) {
+            void (**callback)(ALLEGRO_DISPLAY *) =
+               _al_vector_ref(&display->display_invalidated_callbacks, i);
+            (*callback)(display);
+         }
+      }
+
+      _al_destroy_sorted_draws(display);
+
+      al_destroy_shader(display->instance_shader);
+      display->instance_shader = NULL;
       al_destroy_shader(display->default_shader);
       display->default_shader = NULL;
 
@@ -184,6 +236,40 @@ ALLEGRO_BITMAP *al_get_backbuffer(ALLEGRO_DISPLAY *display)
 
 
 
+static void next_stats_frame(ALLEGRO_DISPLAY *display)
+{
+   memcpy(display->last_stats, display->stats, sizeof(display->stats));
+   memset(display->stats, 0, sizeof(display->stats));
+}
+
+
+
+/* Function: al_get_display_stat
+ */
+int al_get_display_stat(ALLEGRO_DISPLAY *display, int stat,
+   bool previous_frame)
+{
+   ASSERT(display);
+   ASSERT(stat >= 0 && stat < ALLEGRO_DISPLAY_STAT_COUNT);
+
+   return previous_frame ? display->last_stats[stat] : display->stats[stat];
+}
+
+
+
+/* Function: al_get_display_buffer_age
+ */
+int al_get_display_buffer_age(ALLEGRO_DISPLAY *display)
+{
+   ASSERT(display);
+
+   if (!display->vt->get_buffer_age || display != al_get_current_display())
+      return 0;
+   return display->vt->get_buffer_age(display);
+}
+
+
+
 /* Function: al_flip_display
  */
 void al_flip_display(void)
@@ -192,7 +278,14 @@ void al_flip_display(void)
 
    if (display) {
       ASSERT(display->vt);
+      _AL_BEGIN_CPU_ZONE("al_flip_display");
+      _al_begin_frame_present(display);
       display->vt->flip_display(display);
+      next_stats_frame(display);
+      _al_end_frame_present(display);
+      if (_al_has_bitmap_saves())
+         _al_update_bitmap_saves(display, NULL, false);
+      _AL_END_CPU_ZONE();
    }
 }
 
@@ -206,7 +299,12 @@ void al_update_display_region(int x, int y, int width, int height)
 
    if (display) {
       ASSERT(display->vt);
+      _al_begin_frame_present(display);
       display->vt->update_display_region(display, x, y, width, height);
+      next_stats_frame(display);
+      _al_end_frame_present(display);
+      if (_al_has_bitmap_saves())
+         _al_update_bitmap_saves(display, NULL, false);
    }
 }
 
@@ -504,13 +602,39 @@ ALLEGRO_EVENT_SOURCE *al_get_display_event_source(ALLEGRO_DISPLAY *display)
    return &display->es;
 }
 
+void _al_flush_vertex_cache(ALLEGRO_DISPLAY *display, int reason)
+{
+   ASSERT(reason >= ALLEGRO_DISPLAY_STAT_TEXTURE_FLUSHES &&
+      reason <= ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+
+   if (display->num_cache_vertices > 0) {
+      display->stats[ALLEGRO_DISPLAY_STAT_FLUSHES]++;
+      display->stats[reason]++;
+      display->stats[ALLEGRO_DISPLAY_STAT_VERTICES] +=
+         display->num_cache_vertices;
+   }
+   display->vt->flush_vertex_cache(display);
+}
+
 /* Function: al_hold_bitmap_drawing
  */
 void al_hold_bitmap_drawing(bool hold)
 {
    ALLEGRO_DISPLAY *current_display = al_get_current_display();
 
+   /* Recording a command list does not draw anything to hold. */
+   if (al_get_target_command_list())
+      return;
+
    if (current_display) {
+      /* Sorted draws were only buffered so far. Clearing the flag first
+       * makes them go to the vertex cache when they are drawn now.
+       */
+      if (!hold && current_display->cache_sorted) {
+         current_display->cache_sorted = false;
+         _al_draw_sorted_bitmaps(current_display);
+      }
+
       if (hold && !current_display->cache_enabled) {
          /*
           * Set the hardware transformation to identity, but keep the bitmap
@@ -531,7 +655,8 @@ void al_hold_bitmap_drawing(bool hold)
       }
 
       if (!hold) {
-         current_display->vt->flush_vertex_cache(current_display);
+         _al_flush_vertex_cache(current_display,
+            ALLEGRO_DISPLAY_STAT_RELEASE_FLUSHES);
          /*
           * Reset the hardware transform to match the stored transform.
           */
@@ -540,6 +665,19 @@ void al_hold_bitmap_drawing(bool hold)
    }
 }
 
+/* Function: al_hold_bitmap_drawing_sorted
+ */
+void al_hold_bitmap_drawing_sorted(bool hold)
+{
+   ALLEGRO_DISPLAY *current_display = al_get_current_display();
+
+   al_hold_bitmap_drawing(hold);
+
+   /* Nothing is held while recording a command list. */
+   if (hold && current_display && current_display->cache_enabled)
+      current_display->cache_sorted = true;
+}
+
 /* Function: al_is_bitmap_drawing_held
  */
 bool al_is_bitmap_drawing_held(void)
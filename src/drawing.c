@@ -15,6 +15,7 @@
 
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_memdraw.h"
@@ -41,6 +42,31 @@ void al_clear_to_color(ALLEGRO_COLOR color)
 }
 
 
+/* Function: al_clear_region_to_color
+ */
+void al_clear_region_to_color(int x, int y, int width, int height,
+   ALLEGRO_COLOR color)
+{
+   int cx, cy, cw, ch;
+   int x1, y1, x2, y2;
+
+   al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+   x1 = _ALLEGRO_MAX(x, cx);
+   y1 = _ALLEGRO_MAX(y, cy);
+   x2 = _ALLEGRO_MIN(x + width, cx + cw);
+   y2 = _ALLEGRO_MIN(y + height, cy + ch);
+   if (x1 >= x2 || y1 >= y2)
+      return;
+
+   /* Clearing only ever touches the clipping rectangle, and only that part
+    * of a memory bitmap gets locked.
+    */
+   al_set_clipping_rectangle(x1, y1, x2 - x1, y2 - y1);
+   al_clear_to_color(color);
+   al_set_clipping_rectangle(cx, cy, cw, ch);
+}
+
+
 /* Function: al_clear_depth_buffer
  */
 void al_clear_depth_buffer(float z)
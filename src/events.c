@@ -22,10 +22,12 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_events.h"
@@ -33,6 +35,20 @@
 
 
 
+/* Number of most recent event latencies kept for the percentiles. */
+#define LATENCY_SAMPLES  1024
+
+
+typedef struct EVENT_QUEUE_STATS
+{
+   int max_depth;
+   int num_growths;
+   unsigned int num_events;
+   unsigned int num_latencies;   /* ever recorded; latencies is a ring */
+   float latencies[LATENCY_SAMPLES];
+} EVENT_QUEUE_STATS;
+
+
 struct ALLEGRO_EVENT_QUEUE
 {
    _AL_VECTOR sources;  /* vector of (ALLEGRO_EVENT_SOURCE *) */
@@ -40,22 +56,30 @@ struct ALLEGRO_EVENT_QUEUE
    unsigned int events_head;  /* write end of circular array */
    unsigned int events_tail;  /* read end of circular array */
    bool paused;
+   bool coalesce;
    _AL_MUTEX mutex;
    _AL_COND cond;
+   int waiters;               /* threads blocked on cond */
+   int system_waiters;        /* threads blocked in wait_for_events */
+   EVENT_QUEUE_STATS *stats;  /* NULL unless enabled */
    _AL_LIST_ITEM *dtor_item;
 };
 
 
 
-/* to prevent concurrent modification of user event reference counts */
-static _AL_MUTEX user_event_refcount_mutex = _AL_MUTEX_UNINITED;
-
+/* Descriptors of user events with destructors, which are created for every
+ * such event emitted.
+ */
+static ALLEGRO_MEMORY_POOL *descriptor_pool = NULL;
 
 
 /* forward declarations */
 static void shutdown_events(void);
 static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
    ALLEGRO_EVENT *ret_event, ALLEGRO_TIMEOUT *timeout);
+static bool wait_for_nonempty_queue(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_TIMEOUT *timeout);
+static int queue_depth(const ALLEGRO_EVENT_QUEUE *queue);
 static void copy_event(ALLEGRO_EVENT *dest, const ALLEGRO_EVENT *src);
 static void ref_if_user_event(ALLEGRO_EVENT *event);
 static void unref_if_user_event(ALLEGRO_EVENT *event);
@@ -69,7 +93,9 @@ static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
  */
 void _al_init_events(void)
 {
-   _al_mutex_init(&user_event_refcount_mutex);
+   if (!descriptor_pool)
+      descriptor_pool = al_create_memory_pool(
+         sizeof(ALLEGRO_USER_EVENT_DESCRIPTOR));
    _al_add_exit_func(shutdown_events, "shutdown_events");
 }
 
@@ -80,7 +106,49 @@ void _al_init_events(void)
  */
 static void shutdown_events(void)
 {
-   _al_mutex_destroy(&user_event_refcount_mutex);
+   /* The event queues were destroyed already, and with them any user events
+    * still referring to descriptors.
+    */
+   al_destroy_memory_pool(descriptor_pool);
+   descriptor_pool = NULL;
+}
+
+
+
+/* _al_create_user_event_descriptor:
+ *  Allocates the descriptor of a user event with a destructor.
+ */
+ALLEGRO_USER_EVENT_DESCRIPTOR *_al_create_user_event_descriptor(
+   void (*dtor)(ALLEGRO_USER_EVENT *))
+{
+   ALLEGRO_USER_EVENT_DESCRIPTOR *descr = NULL;
+   bool pooled = false;
+
+   if (descriptor_pool) {
+      descr = al_alloc_from_memory_pool(descriptor_pool);
+      pooled = (descr != NULL);
+   }
+   if (!descr)
+      descr = al_malloc(sizeof *descr);
+   if (descr) {
+      descr->dtor = dtor;
+      descr->refcount = 0;
+      descr->pooled = pooled;
+   }
+   return descr;
+}
+
+
+
+/* _al_free_user_event_descriptor:
+ *  Frees a descriptor from _al_create_user_event_descriptor.
+ */
+void _al_free_user_event_descriptor(ALLEGRO_USER_EVENT_DESCRIPTOR *descr)
+{
+   if (descr && descr->pooled)
+      al_free_to_memory_pool(descriptor_pool, descr);
+   else
+      al_free(descr);
 }
 
 
@@ -101,6 +169,10 @@ ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
       queue->events_head = 0;
       queue->events_tail = 0;
       queue->paused = false;
+      queue->coalesce = false;
+      queue->waiters = 0;
+      queue->system_waiters = 0;
+      queue->stats = NULL;
 
       _AL_MARK_MUTEX_UNINITED(queue->mutex);
       _al_mutex_init(&queue->mutex);
@@ -137,6 +209,7 @@ void al_destroy_event_queue(ALLEGRO_EVENT_QUEUE *queue)
       _al_cond_destroy(&queue->cond);
       _al_mutex_destroy(&queue->mutex);
 
+      al_free(queue->stats);
       al_free(queue);
    }
 }
@@ -227,6 +300,114 @@ bool al_is_event_queue_paused(const ALLEGRO_EVENT_QUEUE *queue)
 
 
 
+/* Function: al_set_event_queue_coalescing
+ */
+void al_set_event_queue_coalescing(ALLEGRO_EVENT_QUEUE *queue, bool coalesce)
+{
+   ASSERT(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   queue->coalesce = coalesce;
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+
+/* Function: al_get_event_queue_coalescing
+ */
+bool al_get_event_queue_coalescing(const ALLEGRO_EVENT_QUEUE *queue)
+{
+   ASSERT(queue);
+
+   return queue->coalesce;
+}
+
+
+
+/* Function: al_enable_event_queue_stats
+ */
+void al_enable_event_queue_stats(ALLEGRO_EVENT_QUEUE *queue, bool enable)
+{
+   ASSERT(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   if (enable && !queue->stats) {
+      queue->stats = al_calloc(1, sizeof *queue->stats);
+   }
+   else if (!enable) {
+      al_free(queue->stats);
+      queue->stats = NULL;
+   }
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+
+static int compare_latencies(const void *a, const void *b)
+{
+   const float x = *(const float *)a;
+   const float y = *(const float *)b;
+   return (x > y) - (x < y);
+}
+
+
+
+/* Function: al_get_event_queue_stats
+ */
+bool al_get_event_queue_stats(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_QUEUE_STATS *ret_stats)
+{
+   float *latencies = NULL;
+   unsigned int n = 0;
+   ASSERT(queue);
+   ASSERT(ret_stats);
+
+   memset(ret_stats, 0, sizeof *ret_stats);
+
+   _al_mutex_lock(&queue->mutex);
+   if (!queue->stats) {
+      _al_mutex_unlock(&queue->mutex);
+      return false;
+   }
+   ret_stats->depth = queue_depth(queue);
+   ret_stats->max_depth = queue->stats->max_depth;
+   ret_stats->num_growths = queue->stats->num_growths;
+   ret_stats->num_events = queue->stats->num_events;
+   n = _ALLEGRO_MIN(queue->stats->num_latencies, LATENCY_SAMPLES);
+   if (n > 0 && (latencies = al_malloc(n * sizeof *latencies))) {
+      memcpy(latencies, queue->stats->latencies, n * sizeof *latencies);
+   }
+   _al_mutex_unlock(&queue->mutex);
+
+   /* Sort outside the lock, so the sources are not held up. */
+   if (latencies) {
+      qsort(latencies, n, sizeof *latencies, compare_latencies);
+      ret_stats->latency_p50 = latencies[(n - 1) * 50 / 100];
+      ret_stats->latency_p99 = latencies[(n - 1) * 99 / 100];
+      al_free(latencies);
+   }
+
+   return true;
+}
+
+
+
+/* Function: al_reset_event_queue_stats
+ */
+void al_reset_event_queue_stats(ALLEGRO_EVENT_QUEUE *queue)
+{
+   ASSERT(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   if (queue->stats) {
+      memset(queue->stats, 0, sizeof *queue->stats);
+      queue->stats->max_depth = queue_depth(queue);
+   }
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+
 static void heartbeat(void)
 {
    ALLEGRO_SYSTEM *system = al_get_system_driver();
@@ -243,6 +424,32 @@ static bool is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
 
 
 
+/* wait_in_system:
+ *  Let the system driver block in its native event loop, if it can, so
+ *  that input is dispatched as soon as it arrives rather than on the next
+ *  heartbeat. Returns false if the calling thread has to wait on the
+ *  condition variable instead. The event queue must be locked.
+ */
+static bool wait_in_system(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_TIMEOUT *timeout, bool *timed_out)
+{
+   ALLEGRO_SYSTEM *system = al_get_system_driver();
+   bool waited;
+
+   if (!system->vt->wait_for_events)
+      return false;
+
+   queue->system_waiters++;
+   _al_mutex_unlock(&queue->mutex);
+   waited = system->vt->wait_for_events(timeout, timed_out);
+   _al_mutex_lock(&queue->mutex);
+   queue->system_waiters--;
+
+   return waited;
+}
+
+
+
 /* Function: al_is_event_queue_empty
  */
 bool al_is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
@@ -259,6 +466,59 @@ bool al_is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
 
 
 
+/* queue_depth:
+ *  Return the number of events in the queue. The event queue must be
+ *  locked.
+ */
+static int queue_depth(const ALLEGRO_EVENT_QUEUE *queue)
+{
+   const unsigned int size = _al_vector_size(&queue->events);
+   return (queue->events_head + size - queue->events_tail) % size;
+}
+
+
+
+/* record_latencies:
+ *  If statistics are enabled, record how long the given events, which
+ *  were just taken out of the queue, have waited since they were
+ *  generated. The event queue must be locked.
+ */
+static void record_latencies(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *events, int count)
+{
+   EVENT_QUEUE_STATS *stats = queue->stats;
+   double now;
+   int i;
+
+   if (!stats || count == 0)
+      return;
+
+   now = al_get_time();
+   for (i = 0; i < count; i++) {
+      if (events[i].any.timestamp > 0) {
+         stats->latencies[stats->num_latencies % LATENCY_SAMPLES] =
+            now - events[i].any.timestamp;
+         stats->num_latencies++;
+      }
+   }
+}
+
+
+
+/* wake_next_waiter:
+ *  Pushing an event wakes a single waiter. If a waiter leaves an event
+ *  in the queue, e.g. because it was not asked to take one or it timed
+ *  out just as it was woken, the wakeup is passed on to the next one.
+ *  The event queue must be locked.
+ */
+static void wake_next_waiter(ALLEGRO_EVENT_QUEUE *queue)
+{
+   if (queue->waiters > 0 && !is_event_queue_empty(queue))
+      _al_cond_signal(&queue->cond);
+}
+
+
+
 /* circ_array_next:
  *  Return the next index in a circular array.
  */
@@ -288,6 +548,7 @@ static ALLEGRO_EVENT *get_next_event_if_any(ALLEGRO_EVENT_QUEUE *queue,
    event = _al_vector_ref(&queue->events, queue->events_tail);
    if (delete) {
       queue->events_tail = circ_array_next(&queue->events, queue->events_tail);
+      record_latencies(queue, event, 1);
    }
    return event;
 }
@@ -319,6 +580,57 @@ bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
 
 
+/* take_events:
+ *  Moves up to max events out of the queue into ret_events, copying the
+ *  at most two spans of the circular array in one go each. Returns the
+ *  number of events taken. The event queue must be locked.
+ */
+static int take_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_events,
+   int max)
+{
+   const unsigned int size = _al_vector_size(&queue->events);
+   unsigned int tail = queue->events_tail;
+   int count = 0;
+
+   while (count < max && tail != queue->events_head) {
+      unsigned int end = (queue->events_head > tail) ? queue->events_head
+         : size;
+      unsigned int n = _ALLEGRO_MIN(end - tail, (unsigned int)(max - count));
+
+      memcpy(ret_events + count, _al_vector_ref(&queue->events, tail),
+         n * sizeof(ALLEGRO_EVENT));
+      count += n;
+      tail = (tail + n) % size;
+   }
+
+   queue->events_tail = tail;
+   record_latencies(queue, ret_events, count);
+   return count;
+}
+
+
+
+/* Function: al_get_next_events
+ */
+int al_get_next_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_events,
+   int max)
+{
+   int count;
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max >= 0);
+
+   heartbeat();
+
+   _al_mutex_lock(&queue->mutex);
+   count = take_events(queue, ret_events, max);
+   _al_mutex_unlock(&queue->mutex);
+
+   return count;
+}
+
+
+
 /* Function: al_peek_next_event
  */
 bool al_peek_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
@@ -405,19 +717,32 @@ void al_wait_for_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
    _al_mutex_lock(&queue->mutex);
    {
+      bool in_system = true;
+
+      _AL_BEGIN_CPU_ZONE("al_wait_for_event");
       while (is_event_queue_empty(queue)) {
          #ifdef ALLEGRO_WAIT_EVENT_SLEEP
+         (void)in_system;
          al_rest(0.001);
          heartbeat();
          #else
+         if (in_system) {
+            in_system = wait_in_system(queue, NULL, NULL);
+            continue;
+         }
+         queue->waiters++;
          _al_cond_wait(&queue->cond, &queue->mutex);
+         queue->waiters--;
          #endif
       }
+      _AL_END_CPU_ZONE();
 
       if (ret_event) {
          next_event = get_next_event_if_any(queue, true);
          copy_event(ret_event, next_event);
       }
+
+      wake_next_waiter(queue);
    }
    _al_mutex_unlock(&queue->mutex);
 }
@@ -447,6 +772,40 @@ bool al_wait_for_event_timed(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* Function: al_wait_for_events_timed
+ */
+int al_wait_for_events_timed(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_events, int max, float secs)
+{
+   ALLEGRO_TIMEOUT timeout;
+   int count = 0;
+
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max >= 0);
+   ASSERT(secs >= 0);
+
+   heartbeat();
+
+   if (secs < 0.0)
+      al_init_timeout(&timeout, 0);
+   else
+      al_init_timeout(&timeout, secs);
+
+   _al_mutex_lock(&queue->mutex);
+   {
+      if (wait_for_nonempty_queue(queue, &timeout))
+         count = take_events(queue, ret_events, max);
+
+      wake_next_waiter(queue);
+   }
+   _al_mutex_unlock(&queue->mutex);
+
+   return count;
+}
+
+
+
 /* Function: al_wait_for_event_until
  */
 bool al_wait_for_event_until(ALLEGRO_EVENT_QUEUE *queue,
@@ -461,6 +820,40 @@ bool al_wait_for_event_until(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* wait_for_nonempty_queue:
+ *  Blocks until the queue is non-empty, returning false if the timeout
+ *  passes first. The event queue must be locked.
+ */
+static bool wait_for_nonempty_queue(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_TIMEOUT *timeout)
+{
+   int result = 0;
+   bool in_system = true;
+
+   /* Is the queue is non-empty?  If not, block on a condition
+    * variable, which will be signaled when an event is placed into
+    * the queue.
+    */
+   _AL_BEGIN_CPU_ZONE("al_wait_for_event");
+   while (is_event_queue_empty(queue) && (result != -1)) {
+      if (in_system) {
+         bool timed_out = false;
+         in_system = wait_in_system(queue, timeout, &timed_out);
+         if (timed_out && is_event_queue_empty(queue))
+            result = -1;
+         continue;
+      }
+      queue->waiters++;
+      result = _al_cond_timedwait(&queue->cond, &queue->mutex, timeout);
+      queue->waiters--;
+   }
+   _AL_END_CPU_ZONE();
+
+   return result != -1;
+}
+
+
+
 static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
    ALLEGRO_EVENT *ret_event, ALLEGRO_TIMEOUT *timeout)
 {
@@ -469,22 +862,14 @@ static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
 
    _al_mutex_lock(&queue->mutex);
    {
-      int result = 0;
-
-      /* Is the queue is non-empty?  If not, block on a condition
-       * variable, which will be signaled when an event is placed into
-       * the queue.
-       */
-      while (is_event_queue_empty(queue) && (result != -1)) {
-         result = _al_cond_timedwait(&queue->cond, &queue->mutex, timeout);
-      }
-
-      if (result == -1)
+      if (!wait_for_nonempty_queue(queue, timeout))
          timed_out = true;
       else if (ret_event) {
          next_event = get_next_event_if_any(queue, true);
          copy_event(ret_event, next_event);
       }
+
+      wake_next_waiter(queue);
    }
    _al_mutex_unlock(&queue->mutex);
 
@@ -519,6 +904,9 @@ static void expand_events_array(ALLEGRO_EVENT_QUEUE *queue)
       }
       queue->events_head += old_size;
    }
+
+   if (queue->stats)
+      queue->stats->num_growths++;
 }
 
 
@@ -567,9 +955,7 @@ static void ref_if_user_event(ALLEGRO_EVENT *event)
    if (ALLEGRO_EVENT_TYPE_IS_USER(event->type)) {
       ALLEGRO_USER_EVENT_DESCRIPTOR *descr = event->user.__internal__descr;
       if (descr) {
-         _al_mutex_lock(&user_event_refcount_mutex);
-         descr->refcount++;
-         _al_mutex_unlock(&user_event_refcount_mutex);
+         _al_fetch_and_add1(&descr->refcount);
       }
    }
 }
@@ -588,6 +974,62 @@ static void unref_if_user_event(ALLEGRO_EVENT *event)
 
 
 
+/* coalesce_event:
+ *  Merges the event into the last one in the queue, if both are mouse
+ *  motion, touch motion or timer events from the same source and of the
+ *  same kind. Returns true if it did. The event queue must be locked.
+ */
+static bool coalesce_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   const unsigned int size = _al_vector_size(&queue->events);
+   ALLEGRO_EVENT *last;
+
+   if (!queue->coalesce || is_event_queue_empty(queue))
+      return false;
+
+   last = _al_vector_ref(&queue->events, (queue->events_head + size - 1) % size);
+   if (last->any.type != event->any.type ||
+         last->any.source != event->any.source) {
+      return false;
+   }
+
+   switch (event->type) {
+      case ALLEGRO_EVENT_MOUSE_AXES: {
+         ALLEGRO_MOUSE_EVENT merged = event->mouse;
+         if (last->mouse.display != event->mouse.display)
+            return false;
+         merged.dx += last->mouse.dx;
+         merged.dy += last->mouse.dy;
+         merged.dz += last->mouse.dz;
+         merged.dw += last->mouse.dw;
+         last->mouse = merged;
+         return true;
+      }
+
+      case ALLEGRO_EVENT_TOUCH_MOVE: {
+         ALLEGRO_TOUCH_EVENT merged = event->touch;
+         if (last->touch.id != event->touch.id ||
+               last->touch.display != event->touch.display) {
+            return false;
+         }
+         merged.dx += last->touch.dx;
+         merged.dy += last->touch.dy;
+         last->touch = merged;
+         return true;
+      }
+
+      case ALLEGRO_EVENT_TIMER:
+         /* The jump in count shows how many ticks were merged. */
+         last->timer = event->timer;
+         return true;
+   }
+
+   return false;
+}
+
+
+
 /* Internal function: _al_event_queue_push_event
  *  Event sources call this function when they have something to add to
  *  the queue.  If a queue cannot accept the event, the event's
@@ -600,6 +1042,7 @@ void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE *queue,
    const ALLEGRO_EVENT *orig_event)
 {
    ALLEGRO_EVENT *new_event;
+   bool wake_system;
    ASSERT(queue);
    ASSERT(orig_event);
 
@@ -608,16 +1051,37 @@ void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE *queue,
 
    _al_mutex_lock(&queue->mutex);
    {
+      if (coalesce_event(queue, orig_event)) {
+         _al_mutex_unlock(&queue->mutex);
+         return;
+      }
+
       new_event = alloc_event(queue);
       copy_event(new_event, orig_event);
       ref_if_user_event(new_event);
 
-      /* Wake up threads that are waiting for an event to be placed in
-       * the queue.
+      if (queue->stats) {
+         int depth = queue_depth(queue);
+         if (depth > queue->stats->max_depth)
+            queue->stats->max_depth = depth;
+         queue->stats->num_events++;
+      }
+
+      /* Wake up a thread that is waiting for an event to be placed in
+       * the queue, if there is one.
        */
-      _al_cond_broadcast(&queue->cond);
+      if (queue->waiters > 0)
+         _al_cond_signal(&queue->cond);
+      wake_system = (queue->system_waiters > 0);
    }
    _al_mutex_unlock(&queue->mutex);
+
+   /* Or a thread waiting for it in the system driver's event loop. */
+   if (wake_system) {
+      ALLEGRO_SYSTEM *system = al_get_system_driver();
+      if (system->vt->wake_event_wait)
+         system->vt->wake_event_wait();
+   }
 }
 
 
@@ -717,14 +1181,12 @@ void al_unref_user_event(ALLEGRO_USER_EVENT *event)
 
    descr = event->__internal__descr;
    if (descr) {
-      _al_mutex_lock(&user_event_refcount_mutex);
-      ASSERT(descr->refcount > 0);
-      refcount = --descr->refcount;
-      _al_mutex_unlock(&user_event_refcount_mutex);
+      refcount = _al_sub1_and_fetch(&descr->refcount);
+      ASSERT(refcount >= 0);
 
       if (refcount == 0) {
          (descr->dtor)(event);
-         al_free(descr);
+         _al_free_user_event_descriptor(descr);
       }
    }
 }
@@ -43,6 +43,7 @@ void _al_event_source_init(ALLEGRO_EVENT_SOURCE *es)
    _al_mutex_init(&this->mutex);
    _al_vector_init(&this->queues, sizeof(ALLEGRO_EVENT_QUEUE *));
    this->data = 0;
+   this->num_events = 0;
 }
 
 
@@ -172,6 +173,7 @@ void _al_event_source_emit_event(ALLEGRO_EVENT_SOURCE *es, ALLEGRO_EVENT *event)
    ALLEGRO_EVENT_SOURCE_REAL *this = (ALLEGRO_EVENT_SOURCE_REAL *)es;
 
    event->any.source = es;
+   this->num_events++;
 
    /* Push the event to all the queues that this event source is
     * registered to.
@@ -224,9 +226,13 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
    ASSERT(event);
 
    if (dtor) {
-      ALLEGRO_USER_EVENT_DESCRIPTOR *descr = al_malloc(sizeof(*descr));
-      descr->refcount = 0;
-      descr->dtor = dtor;
+      ALLEGRO_USER_EVENT_DESCRIPTOR *descr =
+         _al_create_user_event_descriptor(dtor);
+      if (!descr) {
+         event->user.__internal__descr = NULL;
+         dtor(&event->user);
+         return false;
+      }
       event->user.__internal__descr = descr;
    }
    else {
@@ -251,7 +257,7 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
 
    if (dtor && !rc) {
       dtor(&event->user);
-      al_free(event->user.__internal__descr);
+      _al_free_user_event_descriptor(event->user.__internal__descr);
    }
 
    return rc;
@@ -279,6 +285,22 @@ intptr_t al_get_event_source_data(const ALLEGRO_EVENT_SOURCE *source)
 
 
 
+/* Function: al_get_event_source_event_count
+ */
+unsigned int al_get_event_source_event_count(ALLEGRO_EVENT_SOURCE *source)
+{
+   ALLEGRO_EVENT_SOURCE_REAL *const rsource = (ALLEGRO_EVENT_SOURCE_REAL *)source;
+   unsigned int count;
+
+   _al_event_source_lock(source);
+   count = rsource->num_events;
+   _al_event_source_unlock(source);
+
+   return count;
+}
+
+
+
 /*
  * Local Variables:
  * c-basic-offset: 3
@@ -0,0 +1,411 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Asynchronous file reads.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+/* Requests are queued for a small, fixed set of I/O threads, so any number
+ * of reads may be in flight without a thread each. Reads of stdio files
+ * are positional (pread on Unix, ReadFile with an offset on Windows), so
+ * the threads can read the same file concurrently. Other file interfaces
+ * have a single file position, so reads of the same ALLEGRO_FILE through
+ * them are serialised.
+ *
+ * The I/O threads are separate from the job pools, which are meant for
+ * computation and should not be blocked waiting for the disk.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_file.h"
+#include "allegro5/internal/aintern_thread.h"
+
+ALLEGRO_DEBUG_CHANNEL("file")
+
+#define DEFAULT_IO_THREADS    4
+#define MAX_IO_THREADS        64
+#define NUM_FILE_LOCKS        16
+
+
+typedef enum REQUEST_STATE {
+   REQUEST_PENDING,
+   REQUEST_RUNNING,
+   REQUEST_DONE
+} REQUEST_STATE;
+
+struct ALLEGRO_FILE_REQUEST {
+   ALLEGRO_EVENT_SOURCE es;
+   char *path;             /* NULL when reading from fp */
+   ALLEGRO_FILE *fp;
+   int64_t offset;
+   size_t size;
+   void *buffer;
+   const ALLEGRO_FILE_INTERFACE *file_interface;
+   const ALLEGRO_FS_INTERFACE *fs_interface;
+   REQUEST_STATE state;
+   int64_t result;
+   ALLEGRO_FILE_REQUEST *next;
+};
+
+static struct {
+   _AL_MUTEX mutex;
+   _AL_COND work_cond;     /* I/O threads wait for requests on this */
+   _AL_COND done_cond;     /* signalled when any request completes */
+   ALLEGRO_FILE_REQUEST *head;
+   ALLEGRO_FILE_REQUEST *tail;
+   _AL_THREAD threads[MAX_IO_THREADS];
+   int num_threads;
+   bool quit;
+   _AL_MUTEX file_locks[NUM_FILE_LOCKS];
+} io;
+
+
+
+static int64_t read_at(ALLEGRO_FILE *fp, int64_t offset, void *buffer,
+   size_t size)
+{
+   _AL_MUTEX *lock;
+   void *base;
+   int64_t map_size;
+   int64_t ret;
+
+   if (al_get_file_mapping(fp, &base, &map_size)) {
+      if (offset >= map_size)
+         return 0;
+      if ((uint64_t)(map_size - offset) < size)
+         size = map_size - offset;
+      memcpy(buffer, (char *)base + offset, size);
+      return size;
+   }
+
+   if (_al_file_stdio_read_at(fp, offset, buffer, size, &ret))
+      return ret;
+
+   lock = &io.file_locks[((uintptr_t)fp / sizeof(void *)) % NUM_FILE_LOCKS];
+   _al_mutex_lock(lock);
+   if (!al_fseek(fp, offset, ALLEGRO_SEEK_SET)) {
+      ret = -1;
+   }
+   else {
+      ret = al_fread(fp, buffer, size);
+      if ((size_t)ret < size && al_ferror(fp))
+         ret = -1;
+   }
+   _al_mutex_unlock(lock);
+
+   return ret;
+}
+
+
+
+static int64_t do_request(ALLEGRO_FILE_REQUEST *req)
+{
+   ALLEGRO_FILE *fp;
+   int64_t ret;
+
+   if (!req->path)
+      return read_at(req->fp, req->offset, req->buffer, req->size);
+
+   al_set_new_file_interface(req->file_interface);
+   al_set_fs_interface(req->fs_interface);
+
+   fp = al_fopen(req->path, "rb");
+   if (!fp) {
+      ALLEGRO_WARN("Could not open %s.\n", req->path);
+      return -1;
+   }
+   ret = read_at(fp, req->offset, req->buffer, req->size);
+   al_fclose(fp);
+
+   return ret;
+}
+
+
+
+static void io_thread(_AL_THREAD *thread, void *arg)
+{
+   (void)arg;
+
+   _al_thread_set_name(thread, "al-async-io");
+
+   _al_mutex_lock(&io.mutex);
+
+   while (true) {
+      ALLEGRO_FILE_REQUEST *req;
+      ALLEGRO_EVENT event;
+      int64_t result;
+
+      while (!io.head && !io.quit)
+         _al_cond_wait(&io.work_cond, &io.mutex);
+      if (io.quit)
+         break;
+
+      req = io.head;
+      io.head = req->next;
+      if (!io.head)
+         io.tail = NULL;
+      req->state = REQUEST_RUNNING;
+      _al_mutex_unlock(&io.mutex);
+
+      result = do_request(req);
+
+      memset(&event, 0, sizeof event);
+      event.user.type = ALLEGRO_EVENT_FILE_READ;
+      event.user.data1 = (intptr_t)req;
+      event.user.data2 = (intptr_t)(result > 0 ? result : 0);
+      event.user.data3 = result >= 0;
+      al_emit_user_event(&req->es, &event, NULL);
+
+      /* The request may be freed as soon as it is marked done. */
+      _al_mutex_lock(&io.mutex);
+      req->result = result;
+      req->state = REQUEST_DONE;
+      _al_cond_broadcast(&io.done_cond);
+   }
+
+   _al_mutex_unlock(&io.mutex);
+}
+
+
+
+static int num_io_threads(void)
+{
+   const char *value;
+   int n = DEFAULT_IO_THREADS;
+
+   value = al_get_config_value(al_get_system_config(), "jobs", "io_threads");
+   if (value && atoi(value) > 0)
+      n = atoi(value);
+
+   return _ALLEGRO_MIN(n, MAX_IO_THREADS);
+}
+
+
+
+/* Must be called with io.mutex held. */
+static void start_io_threads(void)
+{
+   int n = num_io_threads();
+
+   for (io.num_threads = 0; io.num_threads < n; io.num_threads++)
+      _al_thread_create(&io.threads[io.num_threads], io_thread, NULL);
+
+   ALLEGRO_DEBUG("Started %d I/O threads.\n", io.num_threads);
+}
+
+
+
+static ALLEGRO_FILE_REQUEST *submit(ALLEGRO_FILE_REQUEST *req,
+   ALLEGRO_EVENT_QUEUE *queue)
+{
+   al_init_user_event_source(&req->es);
+   if (queue)
+      al_register_event_source(queue, &req->es);
+
+   req->file_interface = al_get_new_file_interface();
+   req->fs_interface = al_get_fs_interface();
+   req->state = REQUEST_PENDING;
+   req->result = -1;
+
+   _al_mutex_lock(&io.mutex);
+   if (io.num_threads == 0)
+      start_io_threads();
+   if (io.tail)
+      io.tail->next = req;
+   else
+      io.head = req;
+   io.tail = req;
+   _al_cond_signal(&io.work_cond);
+   _al_mutex_unlock(&io.mutex);
+
+   return req;
+}
+
+
+
+/* Function: al_read_file_async
+ */
+ALLEGRO_FILE_REQUEST *al_read_file_async(const char *path, int64_t offset,
+   size_t size, void *buffer, ALLEGRO_EVENT_QUEUE *queue)
+{
+   ALLEGRO_FILE_REQUEST *req;
+   ASSERT(path);
+   ASSERT(offset >= 0);
+   ASSERT(buffer || size == 0);
+
+   req = al_calloc(1, sizeof *req);
+   if (!req)
+      return NULL;
+   req->path = al_malloc(strlen(path) + 1);
+   if (!req->path) {
+      al_free(req);
+      return NULL;
+   }
+   strcpy(req->path, path);
+   req->offset = offset;
+   req->size = size;
+   req->buffer = buffer;
+
+   return submit(req, queue);
+}
+
+
+
+/* Function: al_read_file_async_f
+ */
+ALLEGRO_FILE_REQUEST *al_read_file_async_f(ALLEGRO_FILE *fp, int64_t offset,
+   size_t size, void *buffer, ALLEGRO_EVENT_QUEUE *queue)
+{
+   ALLEGRO_FILE_REQUEST *req;
+   ASSERT(fp);
+   ASSERT(offset >= 0);
+   ASSERT(buffer || size == 0);
+
+   req = al_calloc(1, sizeof *req);
+   if (!req)
+      return NULL;
+   req->fp = fp;
+   req->offset = offset;
+   req->size = size;
+   req->buffer = buffer;
+
+   return submit(req, queue);
+}
+
+
+
+/* Function: al_get_file_request_event_source
+ */
+ALLEGRO_EVENT_SOURCE *al_get_file_request_event_source(
+   ALLEGRO_FILE_REQUEST *req)
+{
+   ASSERT(req);
+   return &req->es;
+}
+
+
+
+/* Function: al_is_file_request_done
+ */
+bool al_is_file_request_done(ALLEGRO_FILE_REQUEST *req)
+{
+   bool done;
+   ASSERT(req);
+
+   _al_mutex_lock(&io.mutex);
+   done = (req->state == REQUEST_DONE);
+   _al_mutex_unlock(&io.mutex);
+
+   return done;
+}
+
+
+
+/* Function: al_wait_for_file_request
+ */
+int64_t al_wait_for_file_request(ALLEGRO_FILE_REQUEST *req)
+{
+   int64_t result;
+   ASSERT(req);
+
+   _al_mutex_lock(&io.mutex);
+   while (req->state != REQUEST_DONE)
+      _al_cond_wait(&io.done_cond, &io.mutex);
+   result = req->result;
+   _al_mutex_unlock(&io.mutex);
+
+   return result;
+}
+
+
+
+/* Function: al_destroy_file_request
+ */
+void al_destroy_file_request(ALLEGRO_FILE_REQUEST *req)
+{
+   if (!req)
+      return;
+
+   _al_mutex_lock(&io.mutex);
+   if (req->state == REQUEST_PENDING) {
+      /* Not started yet, so just take it off the queue. */
+      ALLEGRO_FILE_REQUEST **p = &io.head;
+      ALLEGRO_FILE_REQUEST *prev = NULL;
+      while (*p != req) {
+         prev = *p;
+         p = &(*p)->next;
+      }
+      *p = req->next;
+      if (io.tail == req)
+         io.tail = prev;
+   }
+   else {
+      while (req->state != REQUEST_DONE)
+         _al_cond_wait(&io.done_cond, &io.mutex);
+   }
+   _al_mutex_unlock(&io.mutex);
+
+   al_destroy_user_event_source(&req->es);
+   al_free(req->path);
+   al_free(req);
+}
+
+
+
+static void shutdown_file_async(void)
+{
+   ALLEGRO_FILE_REQUEST *req;
+   int i;
+
+   _al_mutex_lock(&io.mutex);
+   io.quit = true;
+   _al_cond_broadcast(&io.work_cond);
+   _al_mutex_unlock(&io.mutex);
+
+   for (i = 0; i < io.num_threads; i++)
+      _al_thread_join(&io.threads[i]);
+
+   /* Requests which never started fail, without events. */
+   for (req = io.head; req; req = req->next)
+      req->state = REQUEST_DONE;
+   io.head = io.tail = NULL;
+   io.num_threads = 0;
+
+   for (i = 0; i < NUM_FILE_LOCKS; i++)
+      _al_mutex_destroy(&io.file_locks[i]);
+   _al_cond_destroy(&io.done_cond);
+   _al_cond_destroy(&io.work_cond);
+   _al_mutex_destroy(&io.mutex);
+}
+
+
+
+void _al_init_file_async(void)
+{
+   int i;
+
+   memset(&io, 0, sizeof io);
+   _al_mutex_init(&io.mutex);
+   _al_cond_init(&io.work_cond);
+   _al_cond_init(&io.done_cond);
+   for (i = 0; i < NUM_FILE_LOCKS; i++)
+      _al_mutex_init(&io.file_locks[i]);
+   _al_add_exit_func(shutdown_file_async, "shutdown_file_async");
+}
+
+
+/* vim: set sts=3 sw=3 et: */
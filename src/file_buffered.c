@@ -0,0 +1,373 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Buffering wrapper for ALLEGRO_FILE.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
+
+#define DEFAULT_BUFFER_SIZE   16384
+
+/* The buffer holds either data read ahead from the parent, or data not yet
+ * written to it, never both. The parent is positioned at the end of the
+ * buffered data when reading, and at its start when writing.
+ */
+typedef struct BUFFERED_DATA
+{
+   ALLEGRO_FILE *fp;       /* parent file */
+   bool close_parent;
+   unsigned char *buf;
+   size_t size;            /* capacity of buf */
+   size_t len;             /* bytes of valid data in buf */
+   size_t cur;             /* read position within buf */
+   bool writing;           /* buf holds data to be written */
+   int64_t pos;            /* parent position of buf[0] */
+   bool eof;
+} BUFFERED_DATA;
+
+
+/* flush_writes:
+ *  Write out pending data.
+ */
+static bool flush_writes(BUFFERED_DATA *b)
+{
+   size_t n;
+
+   if (!b->writing)
+      return true;
+
+   n = b->len ? al_fwrite(b->fp, b->buf, b->len) : 0;
+   b->pos += n;
+   if (n < b->len) {
+      /* Keep what didn't make it, so that a later flush may retry. */
+      memmove(b->buf, b->buf + n, b->len - n);
+      b->len -= n;
+      return false;
+   }
+   b->len = 0;
+   b->writing = false;
+   return true;
+}
+
+
+/* drop_read_ahead:
+ *  Forget data read ahead, moving the parent back to the logical position.
+ */
+static bool drop_read_ahead(BUFFERED_DATA *b)
+{
+   if (b->writing || b->len == 0)
+      return true;
+
+   b->pos += b->cur;
+   b->len = 0;
+   b->cur = 0;
+   return al_fseek(b->fp, b->pos, ALLEGRO_SEEK_SET);
+}
+
+
+static bool buffered_fclose(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   bool ret;
+
+   ret = flush_writes(b);
+   if (!drop_read_ahead(b))
+      ret = false;
+   if (b->close_parent && !al_fclose(b->fp))
+      ret = false;
+
+   al_free(b->buf);
+   al_free(b);
+
+   return ret;
+}
+
+
+static size_t buffered_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   unsigned char *dst = ptr;
+   size_t done = 0;
+
+   if (!flush_writes(b))
+      return 0;
+
+   while (done < size) {
+      size_t avail = b->len - b->cur;
+      size_t n;
+
+      if (avail > 0) {
+         n = _ALLEGRO_MIN(avail, size - done);
+         memcpy(dst + done, b->buf + b->cur, n);
+         b->cur += n;
+         done += n;
+         continue;
+      }
+
+      /* The buffer is empty; start it at the current position. */
+      b->pos += b->len;
+      b->len = 0;
+      b->cur = 0;
+
+      /* Large reads bypass the buffer. */
+      if (size - done >= b->size) {
+         n = al_fread(b->fp, dst + done, size - done);
+         b->pos += n;
+         done += n;
+         if (n == 0 || done < size)
+            b->eof = al_feof(b->fp);
+         break;
+      }
+
+      n = al_fread(b->fp, b->buf, b->size);
+      b->len = n;
+      if (n == 0) {
+         b->eof = al_feof(b->fp);
+         break;
+      }
+   }
+
+   return done;
+}
+
+
+static size_t buffered_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   const unsigned char *src = ptr;
+   size_t done = 0;
+
+   if (!drop_read_ahead(b))
+      return 0;
+
+   if (!b->writing) {
+      b->pos += b->len;
+      b->len = 0;
+      b->cur = 0;
+      b->writing = true;
+   }
+
+   while (done < size) {
+      size_t n;
+
+      if (b->len == b->size && !flush_writes(b))
+         break;
+      b->writing = true;
+
+      /* Large writes bypass the buffer. */
+      if (b->len == 0 && size - done >= b->size) {
+         n = al_fwrite(b->fp, src + done, size - done);
+         b->pos += n;
+         done += n;
+         break;
+      }
+
+      n = _ALLEGRO_MIN(b->size - b->len, size - done);
+      memcpy(b->buf + b->len, src + done, n);
+      b->len += n;
+      done += n;
+   }
+
+   return done;
+}
+
+
+static bool buffered_fflush(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   if (!flush_writes(b))
+      return false;
+   return al_fflush(b->fp);
+}
+
+
+static int64_t buffered_ftell(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   if (b->writing)
+      return b->pos + b->len;
+   return b->pos + b->cur;
+}
+
+
+static bool buffered_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   int64_t target;
+   bool ok;
+
+   if (whence == ALLEGRO_SEEK_CUR) {
+      offset += buffered_ftell(f);
+      whence = ALLEGRO_SEEK_SET;
+   }
+
+   /* Seeks within the read-ahead data need not touch the parent. */
+   if (whence == ALLEGRO_SEEK_SET && !b->writing &&
+         offset >= b->pos && offset <= b->pos + (int64_t)b->len) {
+      b->cur = offset - b->pos;
+      b->eof = false;
+      return true;
+   }
+
+   if (!flush_writes(b))
+      return false;
+
+   ok = al_fseek(b->fp, offset, whence);
+
+   /* The parent may clamp the position, or have moved on failure. */
+   target = al_ftell(b->fp);
+   if (target < 0) {
+      target = b->pos + b->cur;
+      ok = false;
+   }
+
+   b->pos = target;
+   b->len = 0;
+   b->cur = 0;
+   if (ok)
+      b->eof = false;
+   return ok;
+}
+
+
+static bool buffered_feof(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   return b->eof && b->cur == b->len;
+}
+
+
+static int buffered_ferror(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   return al_ferror(b->fp);
+}
+
+
+static const char *buffered_ferrmsg(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   return al_ferrmsg(b->fp);
+}
+
+
+static void buffered_fclearerr(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+
+   b->eof = false;
+   al_fclearerr(b->fp);
+}
+
+
+static off_t buffered_fsize(ALLEGRO_FILE *f)
+{
+   BUFFERED_DATA *b = al_get_file_userdata(f);
+   int64_t size;
+
+   /* Pending writes may extend the file. */
+   size = al_fsize(b->fp);
+   if (size >= 0 && b->writing && b->pos + (int64_t)b->len > size)
+      size = b->pos + b->len;
+   return size;
+}
+
+
+static const ALLEGRO_FILE_INTERFACE buffered_vtable =
+{
+   NULL,
+   buffered_fclose,
+   buffered_fread,
+   buffered_fwrite,
+   buffered_fflush,
+   buffered_ftell,
+   buffered_fseek,
+   buffered_feof,
+   buffered_ferror,
+   buffered_ferrmsg,
+   buffered_fclearerr,
+   NULL,
+   buffered_fsize
+};
+
+
+static ALLEGRO_FILE *open_buffered(ALLEGRO_FILE *fp, size_t size,
+   bool close_parent)
+{
+   BUFFERED_DATA *b;
+   ALLEGRO_FILE *f;
+
+   ASSERT(fp);
+
+   b = al_calloc(1, sizeof(*b));
+   if (!b) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   b->size = size ? size : DEFAULT_BUFFER_SIZE;
+   b->buf = al_malloc(b->size);
+   if (!b->buf) {
+      al_set_errno(ENOMEM);
+      al_free(b);
+      return NULL;
+   }
+
+   b->fp = fp;
+   b->close_parent = close_parent;
+   b->pos = al_ftell(fp);
+   if (b->pos < 0)
+      b->pos = 0;
+
+   f = al_create_file_handle(&buffered_vtable, b);
+   if (!f) {
+      al_free(b->buf);
+      al_free(b);
+   }
+   return f;
+}
+
+
+/* Function: al_fopen_buffered
+ */
+ALLEGRO_FILE *al_fopen_buffered(ALLEGRO_FILE *fp, size_t size)
+{
+   return open_buffered(fp, size, false);
+}
+
+
+/* _al_fopen_buffered_owner:
+ *  Like al_fopen_buffered, but closing the returned file also closes fp.
+ *  On failure fp is returned unbuffered.
+ */
+ALLEGRO_FILE *_al_fopen_buffered_owner(ALLEGRO_FILE *fp)
+{
+   ALLEGRO_FILE *f;
+
+   if (!fp)
+      return NULL;
+
+   f = open_buffered(fp, 0, true);
+   return f ? f : fp;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,343 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Memory mapped file I/O.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_file.h"
+
+#ifdef ALLEGRO_ANDROID
+   #include "allegro5/internal/aintern_android.h"
+#endif
+
+#if defined(ALLEGRO_WINDOWS)
+   #include <windows.h>
+   #include "allegro5/internal/aintern_wunicode.h"
+#else
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+#endif
+
+ALLEGRO_DEBUG_CHANNEL("stdio")
+
+
+typedef struct
+{
+   char *base;       /* NULL for empty files */
+   int64_t size;
+   int64_t pos;
+   bool eof;
+} USERDATA;
+
+
+/* map_file:
+ *  Maps the whole file copy-on-write, so that the mapping may be written to
+ *  without changing the file.
+ */
+static bool map_file(USERDATA *m, const char *path)
+{
+#ifdef ALLEGRO_WINDOWS
+   wchar_t *wpath;
+   HANDLE file;
+   HANDLE mapping;
+   LARGE_INTEGER file_size;
+
+   wpath = _al_win_utf8_to_utf16(path);
+   if (!wpath)
+      return false;
+   file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   al_free(wpath);
+   if (file == INVALID_HANDLE_VALUE) {
+      al_set_errno(ENOENT);
+      return false;
+   }
+   if (!GetFileSizeEx(file, &file_size)) {
+      CloseHandle(file);
+      return false;
+   }
+   m->size = file_size.QuadPart;
+   if (m->size > 0 && (uint64_t)m->size <= SIZE_MAX) {
+      mapping = CreateFileMappingW(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+      if (mapping) {
+         m->base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+         CloseHandle(mapping);
+      }
+   }
+   CloseHandle(file);
+#else
+   struct stat st;
+   int fd;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      al_set_errno(errno);
+      return false;
+   }
+   /* Pipes and devices can't be mapped. */
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      close(fd);
+      return false;
+   }
+   m->size = st.st_size;
+   if (m->size > 0 && (uint64_t)m->size <= SIZE_MAX) {
+      m->base = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+         fd, 0);
+      if (m->base == MAP_FAILED)
+         m->base = NULL;
+   }
+   close(fd);
+#endif
+
+   if (m->size > 0 && !m->base) {
+      ALLEGRO_WARN("Could not map %s.\n", path);
+      return false;
+   }
+   return true;
+}
+
+
+static void *file_mapped_fopen(const char *path, const char *mode)
+{
+   USERDATA *m;
+
+   ALLEGRO_DEBUG("mapping %s %s\n", path, mode);
+
+   /* Writes would never reach the file. */
+   if (strpbrk(mode, "wa+")) {
+      al_set_errno(EINVAL);
+      return NULL;
+   }
+
+   m = al_calloc(1, sizeof(USERDATA));
+   if (!m) {
+      al_set_errno(ENOMEM);
+      return NULL;
+   }
+
+   if (!map_file(m, path)) {
+      al_free(m);
+      return NULL;
+   }
+
+   return m;
+}
+
+
+static bool file_mapped_fclose(ALLEGRO_FILE *f)
+{
+   USERDATA *m = al_get_file_userdata(f);
+
+   if (m->base) {
+#ifdef ALLEGRO_WINDOWS
+      UnmapViewOfFile(m->base);
+#else
+      munmap(m->base, m->size);
+#endif
+   }
+   al_free(m);
+   return true;
+}
+
+
+static size_t file_mapped_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   USERDATA *m = al_get_file_userdata(f);
+
+   if (m->pos >= m->size) {
+      size = 0;
+      m->eof = true;
+   }
+   else if ((uint64_t)(m->size - m->pos) < size) {
+      size = m->size - m->pos;
+      m->eof = true;
+   }
+
+   if (size > 0) {
+      memcpy(ptr, m->base + m->pos, size);
+      m->pos += size;
+   }
+   return size;
+}
+
+
+static size_t file_mapped_fwrite(ALLEGRO_FILE *f, const void *ptr,
+   size_t size)
+{
+   (void)f;
+   (void)ptr;
+   (void)size;
+   al_set_errno(EBADF);
+   return 0;
+}
+
+
+static bool file_mapped_fflush(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return true;
+}
+
+
+static int64_t file_mapped_ftell(ALLEGRO_FILE *f)
+{
+   USERDATA *m = al_get_file_userdata(f);
+
+   return m->pos;
+}
+
+
+static bool file_mapped_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   USERDATA *m = al_get_file_userdata(f);
+   int64_t pos;
+
+   switch (whence) {
+      case ALLEGRO_SEEK_SET: pos = offset; break;
+      case ALLEGRO_SEEK_CUR: pos = m->pos + offset; break;
+      case ALLEGRO_SEEK_END: pos = m->size + offset; break;
+      default: return false;
+   }
+
+   if (pos < 0) {
+      al_set_errno(EINVAL);
+      return false;
+   }
+
+   /* Like stdio, allow seeking past the end; reads will then fail. */
+   m->pos = pos;
+   m->eof = false;
+   return true;
+}
+
+
+static bool file_mapped_feof(ALLEGRO_FILE *f)
+{
+   USERDATA *m = al_get_file_userdata(f);
+
+   return m->eof;
+}
+
+
+static int file_mapped_ferror(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return 0;
+}
+
+
+static const char *file_mapped_ferrmsg(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return "";
+}
+
+
+static void file_mapped_fclearerr(ALLEGRO_FILE *f)
+{
+   USERDATA *m = al_get_file_userdata(f);
+
+   m->eof = false;
+}
+
+
+static off_t file_mapped_fsize(ALLEGRO_FILE *f)
+{
+   USERDATA *m = al_get_file_userdata(f);
+
+   return m->size;
+}
+
+
+const struct ALLEGRO_FILE_INTERFACE _al_file_interface_mapped =
+{
+   file_mapped_fopen,
+   file_mapped_fclose,
+   file_mapped_fread,
+   file_mapped_fwrite,
+   file_mapped_fflush,
+   file_mapped_ftell,
+   file_mapped_fseek,
+   file_mapped_feof,
+   file_mapped_ferror,
+   file_mapped_ferrmsg,
+   file_mapped_fclearerr,
+   NULL,   /* ungetc */
+   file_mapped_fsize
+};
+
+
+/* Function: al_fopen_mapped
+ */
+ALLEGRO_FILE *al_fopen_mapped(const char *path)
+{
+   return al_fopen_interface(&_al_file_interface_mapped, path, "rb");
+}
+
+
+/* Function: al_get_file_mapping
+ */
+bool al_get_file_mapping(ALLEGRO_FILE *f, void **ptr, int64_t *size)
+{
+   USERDATA *m;
+
+   ASSERT(f);
+
+#ifdef ALLEGRO_ANDROID
+   if (f->vtable == _al_get_apk_file_vtable())
+      return _al_android_get_apk_file_mapping(f, ptr, size);
+#endif
+
+   if (f->vtable != &_al_file_interface_mapped)
+      return false;
+
+   m = al_get_file_userdata(f);
+   if (ptr)
+      *ptr = m->base;
+   if (size)
+      *size = m->size;
+   return true;
+}
+
+
+/* _al_fopen_for_reading:
+ *  Opens a file for loading. If it would be opened with the standard file
+ *  interface it is mapped, so that it is read without system calls or
+ *  copies through stdio's buffer. Other interfaces (e.g. PhysFS) may do
+ *  no buffering of their own, so they get a read-ahead buffer instead,
+ *  unless they mapped the file themselves (e.g. uncompressed APK assets).
+ */
+ALLEGRO_FILE *_al_fopen_for_reading(const char *path, const char *mode)
+{
+   ALLEGRO_FILE *f;
+
+   if (al_get_new_file_interface() == &_al_file_interface_stdio) {
+      f = al_fopen_mapped(path);
+      if (!f)
+         f = al_fopen(path, mode);
+      return f;
+   }
+
+   f = al_fopen(path, mode);
+   if (f && al_get_file_mapping(f, NULL, NULL))
+      return f;
+   return _al_fopen_buffered_owner(f);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
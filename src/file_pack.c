@@ -0,0 +1,1390 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Pack files.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+/* Pack file layout, all integers little endian:
+ *
+ *    header, PACK_HEADER_SIZE bytes
+ *       "A5PK", version, entry count, bucket count (32 bit each),
+ *       index offset, index size (64 bit each)
+ *    file data, each blob starting at a multiple of PACK_ALIGN
+ *    index
+ *       buckets: bucket count 32 bit values, entry number + 1 or 0
+ *       entries: entry count * PACK_ENTRY_SIZE bytes
+ *          data offset, stored size, size (64 bit each),
+ *          name offset, name length, flags, name hash (32 bit each)
+ *       names: UTF-8, relative to the root, '/' separated, not terminated
+ *
+ * An entry is found by hashing its name with FNV-1a and probing linearly
+ * from bucket (hash & (bucket count - 1)). Directories have entries of
+ * their own, with no data. Blobs are stored as is, or compressed in the
+ * LZ4 block format.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_file.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("pack")
+
+#define PACK_MAGIC         "A5PK"
+#define PACK_VERSION       1
+#define PACK_HEADER_SIZE   32
+#define PACK_ENTRY_SIZE    40
+#define PACK_ALIGN         4096
+
+enum {
+   PACK_ENTRY_DIR = 1,
+   PACK_ENTRY_LZ4 = 2
+};
+
+struct ALLEGRO_PACK
+{
+   char *path;
+   ALLEGRO_FILE *mapped;      /* NULL if the pack couldn't be mapped */
+   const unsigned char *base; /* start of the mapping */
+   int64_t file_size;
+   time_t mtime;
+   unsigned char *index_buf;  /* the index, if not mapped */
+   uint32_t num_entries;
+   uint32_t num_buckets;
+   const unsigned char *buckets;
+   const unsigned char *entries;
+   const unsigned char *names;
+   uint64_t names_size;
+};
+
+typedef struct PACK_ENTRY
+{
+   uint64_t offset;
+   uint64_t stored_size;
+   uint64_t size;
+   const char *name;
+   uint32_t name_len;
+   uint32_t flags;
+} PACK_ENTRY;
+
+/* An opened entry. Data is either in memory (mapped or decompressed) or
+ * read through a slice of a handle of the pack file of its own.
+ */
+typedef struct PACK_FILE
+{
+   const unsigned char *data;
+   unsigned char *owned;      /* decompressed data */
+   ALLEGRO_FILE *parent;
+   ALLEGRO_FILE *slice;
+   int64_t size;
+   int64_t pos;
+   bool eof;
+} PACK_FILE;
+
+typedef struct PACK_FS_ENTRY
+{
+   ALLEGRO_FS_ENTRY fs_entry; /* must be first */
+   char *path;                /* absolute, as returned by the entry name */
+   bool exists;
+   bool is_dir;
+   int64_t size;
+   time_t mtime;
+
+   /* For directory listing. */
+   ALLEGRO_PACK **dir_packs;  /* the mounted packs when opened, last first */
+   int dir_num_packs;
+   int dir_pack;
+   uint32_t dir_pos;
+} PACK_FS_ENTRY;
+
+static _AL_MUTEX mount_mutex = _AL_MUTEX_UNINITED;
+static _AL_VECTOR mounted = _AL_VECTOR_INITIALIZER(ALLEGRO_PACK *);
+
+/* Current directory, relative to the root, without slashes at either end.
+ * Like the PhysFS addon, this is shared by all threads.
+ */
+static char pack_cwd[1024] = "";
+
+/* forward declarations */
+static const ALLEGRO_FILE_INTERFACE pack_file_vtable;
+static const ALLEGRO_FS_INTERFACE pack_fs_vtable;
+
+
+
+static uint32_t get32(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint64_t get64(const unsigned char *p)
+{
+   return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+
+static void put32(unsigned char *p, uint32_t v)
+{
+   p[0] = v;
+   p[1] = v >> 8;
+   p[2] = v >> 16;
+   p[3] = v >> 24;
+}
+
+
+static void put64(unsigned char *p, uint64_t v)
+{
+   put32(p, (uint32_t)v);
+   put32(p + 4, (uint32_t)(v >> 32));
+}
+
+
+static uint32_t hash_name(const char *name, size_t len)
+{
+   uint32_t hash = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      hash ^= (unsigned char)name[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+
+
+/* lz4_decompress:
+ *  Decodes an LZ4 block which must expand to exactly dst_len bytes.
+ */
+static bool lz4_decompress(const unsigned char *src, size_t src_len,
+   unsigned char *dst, size_t dst_len)
+{
+   const unsigned char *ip = src;
+   const unsigned char *iend = src + src_len;
+   unsigned char *op = dst;
+   unsigned char *oend = dst + dst_len;
+
+   while (ip < iend) {
+      unsigned token = *ip++;
+      size_t len = token >> 4;
+      size_t offset;
+
+      if (len == 15) {
+         unsigned b;
+         do {
+            if (ip >= iend)
+               return false;
+            b = *ip++;
+            len += b;
+         } while (b == 255);
+      }
+      if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+         return false;
+      memcpy(op, ip, len);
+      ip += len;
+      op += len;
+
+      /* The last sequence has only literals. */
+      if (ip >= iend)
+         break;
+
+      if (iend - ip < 2)
+         return false;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - dst))
+         return false;
+
+      len = token & 15;
+      if (len == 15) {
+         unsigned b;
+         do {
+            if (ip >= iend)
+               return false;
+            b = *ip++;
+            len += b;
+         } while (b == 255);
+      }
+      len += 4;
+      if ((size_t)(oend - op) < len)
+         return false;
+
+      /* The match may overlap the output, so copy bytewise. */
+      while (len-- > 0) {
+         *op = *(op - offset);
+         op++;
+      }
+   }
+
+   return op == oend;
+}
+
+
+
+static bool get_entry(const ALLEGRO_PACK *pack, uint32_t i, PACK_ENTRY *e)
+{
+   const unsigned char *p = pack->entries + (size_t)i * PACK_ENTRY_SIZE;
+   uint32_t name_offset = get32(p + 24);
+
+   e->offset = get64(p);
+   e->stored_size = get64(p + 8);
+   e->size = get64(p + 16);
+   e->name_len = get32(p + 28);
+   e->flags = get32(p + 32);
+   e->name = (const char *)pack->names + name_offset;
+
+   if ((uint64_t)name_offset + e->name_len > pack->names_size)
+      return false;
+   if (!(e->flags & PACK_ENTRY_DIR) &&
+         (e->offset > (uint64_t)pack->file_size ||
+          e->stored_size > (uint64_t)pack->file_size - e->offset))
+      return false;
+   return true;
+}
+
+
+/* find_entry:
+ *  Returns the number of the entry with the given name, or -1.
+ */
+static int64_t find_entry(const ALLEGRO_PACK *pack, const char *name,
+   size_t len, PACK_ENTRY *e)
+{
+   uint32_t hash = hash_name(name, len);
+   uint32_t mask = pack->num_buckets - 1;
+   uint32_t b;
+   uint32_t probes;
+
+   for (b = hash & mask, probes = 0; probes < pack->num_buckets;
+         b = (b + 1) & mask, probes++) {
+      uint32_t n = get32(pack->buckets + (size_t)b * 4);
+      const unsigned char *p;
+
+      if (n == 0 || n > pack->num_entries)
+         return -1;
+      p = pack->entries + (size_t)(n - 1) * PACK_ENTRY_SIZE;
+      if (get32(p + 36) != hash || get32(p + 28) != len)
+         continue;
+      if (get_entry(pack, n - 1, e) && memcmp(e->name, name, len) == 0)
+         return n - 1;
+   }
+
+   return -1;
+}
+
+
+static bool is_child(const PACK_ENTRY *e, const char *dir, size_t dir_len)
+{
+   const char *rest;
+   size_t rest_len;
+
+   if (dir_len == 0) {
+      rest = e->name;
+      rest_len = e->name_len;
+   }
+   else {
+      if (e->name_len <= dir_len + 1 ||
+            memcmp(e->name, dir, dir_len) != 0 || e->name[dir_len] != '/')
+         return false;
+      rest = e->name + dir_len + 1;
+      rest_len = e->name_len - dir_len - 1;
+   }
+
+   return rest_len > 0 && !memchr(rest, '/', rest_len);
+}
+
+
+
+/* normalize_path:
+ *  Makes the path absolute, resolves "." and ".." and returns it without
+ *  slashes at either end, as pack entries are named.
+ */
+static char *normalize_path(const char *path)
+{
+   size_t size = strlen(pack_cwd) + strlen(path) + 2;
+   char *in = al_malloc(size);
+   char *out = al_malloc(size);
+   size_t out_len = 0;
+   char *s;
+
+   if (!in || !out) {
+      al_free(in);
+      al_free(out);
+      return NULL;
+   }
+
+   if (path[0] == '/' || path[0] == '\\')
+      strcpy(in, path);
+   else
+      snprintf(in, size, "%s/%s", pack_cwd, path);
+
+   for (s = in; *s; s++) {
+      if (*s == '\\')
+         *s = '/';
+   }
+
+   out[0] = '\0';
+   s = in;
+   while (*s) {
+      char *end = s + strcspn(s, "/");
+      size_t len = end - s;
+
+      if ((len == 1 && s[0] == '.') || len == 0) {
+         /* nothing */
+      }
+      else if (len == 2 && s[0] == '.' && s[1] == '.') {
+         char *slash = strrchr(out, '/');
+         out_len = slash ? (size_t)(slash - out) : 0;
+         out[out_len] = '\0';
+      }
+      else {
+         if (out_len > 0)
+            out[out_len++] = '/';
+         memcpy(out + out_len, s, len);
+         out_len += len;
+         out[out_len] = '\0';
+      }
+
+      s = (*end == '/') ? end + 1 : end;
+   }
+
+   al_free(in);
+   return out;
+}
+
+
+/* lookup:
+ *  Finds a normalised name in the mounted packs, later mounts first.
+ *  The root directory always exists and has no pack.
+ */
+static bool lookup(const char *name, ALLEGRO_PACK **pack_ret,
+   PACK_ENTRY *e)
+{
+   size_t len = strlen(name);
+   bool found = false;
+   int i;
+
+   if (len == 0) {
+      memset(e, 0, sizeof *e);
+      e->flags = PACK_ENTRY_DIR;
+      e->name = "";
+      *pack_ret = NULL;
+      return true;
+   }
+
+   _al_mutex_lock(&mount_mutex);
+   for (i = _al_vector_size(&mounted) - 1; i >= 0 && !found; i--) {
+      ALLEGRO_PACK *pack = *(ALLEGRO_PACK **)_al_vector_ref(&mounted, i);
+      if (find_entry(pack, name, len, e) >= 0) {
+         *pack_ret = pack;
+         found = true;
+      }
+   }
+   _al_mutex_unlock(&mount_mutex);
+
+   return found;
+}
+
+
+
+/* Function: al_open_pack
+ */
+ALLEGRO_PACK *al_open_pack(const char *path)
+{
+   ALLEGRO_PACK *pack;
+   ALLEGRO_FS_ENTRY *fse;
+   const ALLEGRO_FS_INTERFACE *fs_interface;
+   unsigned char header[PACK_HEADER_SIZE];
+   const unsigned char *index;
+   uint64_t index_offset;
+   uint64_t index_size;
+   uint64_t tables_size;
+   ASSERT(path);
+
+   pack = al_calloc(1, sizeof *pack);
+   if (!pack)
+      return NULL;
+   pack->path = al_malloc(strlen(path) + 1);
+   if (!pack->path)
+      goto fail;
+   strcpy(pack->path, path);
+
+   /* Mapped packs are read without copies. */
+   pack->mapped = al_fopen_mapped(path);
+   if (pack->mapped) {
+      void *base;
+      al_get_file_mapping(pack->mapped, &base, &pack->file_size);
+      pack->base = base;
+      if (pack->file_size < PACK_HEADER_SIZE)
+         goto bad;
+      memcpy(header, pack->base, PACK_HEADER_SIZE);
+   }
+   else {
+      ALLEGRO_FILE *fp = al_fopen_interface(&_al_file_interface_stdio, path,
+         "rb");
+      if (!fp)
+         goto fail;
+      pack->file_size = al_fsize(fp);
+      if (al_fread(fp, header, PACK_HEADER_SIZE) != PACK_HEADER_SIZE) {
+         al_fclose(fp);
+         goto bad;
+      }
+      index_offset = get64(header + 16);
+      index_size = get64(header + 24);
+      if (pack->file_size < 0 || index_offset > (uint64_t)pack->file_size ||
+            index_size > (uint64_t)pack->file_size - index_offset ||
+            (uint64_t)(size_t)index_size != index_size) {
+         al_fclose(fp);
+         goto bad;
+      }
+      pack->index_buf = al_malloc(index_size ? index_size : 1);
+      if (!pack->index_buf || !al_fseek(fp, index_offset, ALLEGRO_SEEK_SET) ||
+            al_fread(fp, pack->index_buf, index_size) != index_size) {
+         al_fclose(fp);
+         goto bad;
+      }
+      al_fclose(fp);
+   }
+
+   if (memcmp(header, PACK_MAGIC, 4) != 0 ||
+         get32(header + 4) != PACK_VERSION)
+      goto bad;
+
+   pack->num_entries = get32(header + 8);
+   pack->num_buckets = get32(header + 12);
+   index_offset = get64(header + 16);
+   index_size = get64(header + 24);
+   if (index_offset > (uint64_t)pack->file_size ||
+         index_size > (uint64_t)pack->file_size - index_offset)
+      goto bad;
+
+   /* There must be an empty bucket for lookups to stop at. */
+   if (pack->num_buckets == 0 ||
+         (pack->num_buckets & (pack->num_buckets - 1)) != 0 ||
+         pack->num_buckets <= pack->num_entries)
+      goto bad;
+   tables_size = (uint64_t)pack->num_buckets * 4 +
+      (uint64_t)pack->num_entries * PACK_ENTRY_SIZE;
+   if (tables_size > index_size)
+      goto bad;
+
+   index = pack->index_buf ? pack->index_buf : pack->base + index_offset;
+   pack->buckets = index;
+   pack->entries = index + (size_t)pack->num_buckets * 4;
+   pack->names = index + tables_size;
+   pack->names_size = index_size - tables_size;
+
+   fs_interface = al_get_fs_interface();
+   al_set_standard_fs_interface();
+   fse = al_create_fs_entry(path);
+   pack->mtime = fse ? al_get_fs_entry_mtime(fse) : 0;
+   al_destroy_fs_entry(fse);
+   al_set_fs_interface(fs_interface);
+
+   ALLEGRO_DEBUG("Opened pack %s with %u entries%s.\n", path,
+      pack->num_entries, pack->mapped ? ", mapped" : "");
+   return pack;
+
+bad:
+   ALLEGRO_ERROR("%s is not a valid pack file.\n", path);
+   al_set_errno(EINVAL);
+fail:
+   al_close_pack(pack);
+   return NULL;
+}
+
+
+
+/* Function: al_close_pack
+ */
+void al_close_pack(ALLEGRO_PACK *pack)
+{
+   if (!pack)
+      return;
+
+   al_unmount_pack(pack);
+   if (pack->mapped)
+      al_fclose(pack->mapped);
+   al_free(pack->index_buf);
+   al_free(pack->path);
+   al_free(pack);
+}
+
+
+
+/* Function: al_mount_pack
+ */
+bool al_mount_pack(ALLEGRO_PACK *pack)
+{
+   ALLEGRO_PACK **slot;
+   ASSERT(pack);
+
+   _al_mutex_lock(&mount_mutex);
+   if (!_al_vector_contains(&mounted, &pack)) {
+      slot = _al_vector_alloc_back(&mounted);
+      if (!slot) {
+         _al_mutex_unlock(&mount_mutex);
+         return false;
+      }
+      *slot = pack;
+   }
+   _al_mutex_unlock(&mount_mutex);
+
+   return true;
+}
+
+
+
+/* Function: al_unmount_pack
+ */
+void al_unmount_pack(ALLEGRO_PACK *pack)
+{
+   ASSERT(pack);
+
+   _al_mutex_lock(&mount_mutex);
+   _al_vector_find_and_delete(&mounted, &pack);
+   _al_mutex_unlock(&mount_mutex);
+}
+
+
+
+/* Function: al_get_pack_entry_data
+ */
+const void *al_get_pack_entry_data(ALLEGRO_PACK *pack, const char *name,
+   size_t *size)
+{
+   PACK_ENTRY e;
+   ASSERT(pack);
+   ASSERT(name);
+
+   while (*name == '/')
+      name++;
+
+   if (!pack->mapped || find_entry(pack, name, strlen(name), &e) < 0 ||
+         (e.flags & (PACK_ENTRY_DIR | PACK_ENTRY_LZ4)))
+      return NULL;
+
+   if (size)
+      *size = e.size;
+   return pack->base + e.offset;
+}
+
+
+
+/* Function: al_set_pack_file_interface
+ */
+void al_set_pack_file_interface(void)
+{
+   al_set_new_file_interface(&pack_file_vtable);
+   al_set_fs_interface(&pack_fs_vtable);
+}
+
+
+
+/*
+ * File interface
+ */
+
+
+static void *pack_fopen(const char *path, const char *mode)
+{
+   ALLEGRO_PACK *pack;
+   PACK_ENTRY e;
+   PACK_FILE *pf;
+   char *name;
+   bool found;
+
+   if (strpbrk(mode, "wa+")) {
+      al_set_errno(EACCES);
+      return NULL;
+   }
+
+   name = normalize_path(path);
+   if (!name)
+      return NULL;
+   found = lookup(name, &pack, &e);
+   al_free(name);
+   if (!found || (e.flags & PACK_ENTRY_DIR)) {
+      al_set_errno(ENOENT);
+      return NULL;
+   }
+
+   pf = al_calloc(1, sizeof *pf);
+   if (!pf)
+      return NULL;
+   pf->size = e.size;
+
+   if (e.flags & PACK_ENTRY_LZ4) {
+      unsigned char *src = NULL;
+      const unsigned char *packed;
+
+      pf->owned = al_malloc(e.size ? e.size : 1);
+      if (!pf->owned)
+         goto fail;
+
+      if (pack->mapped) {
+         packed = pack->base + e.offset;
+      }
+      else {
+         ALLEGRO_FILE *fp = al_fopen_interface(&_al_file_interface_stdio,
+            pack->path, "rb");
+         src = al_malloc(e.stored_size ? e.stored_size : 1);
+         if (!fp || !src || !al_fseek(fp, e.offset, ALLEGRO_SEEK_SET) ||
+               al_fread(fp, src, e.stored_size) != e.stored_size) {
+            if (fp)
+               al_fclose(fp);
+            al_free(src);
+            goto fail;
+         }
+         al_fclose(fp);
+         packed = src;
+      }
+
+      if (!lz4_decompress(packed, e.stored_size, pf->owned, e.size)) {
+         ALLEGRO_ERROR("Corrupt LZ4 data for %.*s in %s.\n",
+            (int)e.name_len, e.name, pack->path);
+         al_free(src);
+         goto fail;
+      }
+      al_free(src);
+      pf->data = pf->owned;
+   }
+   else if (pack->mapped) {
+      pf->data = pack->base + e.offset;
+   }
+   else {
+      /* Every open entry gets a handle of its own, so that they can be
+       * read independently.
+       */
+      pf->parent = al_fopen_interface(&_al_file_interface_stdio, pack->path,
+         "rb");
+      if (!pf->parent || !al_fseek(pf->parent, e.offset, ALLEGRO_SEEK_SET))
+         goto fail;
+      pf->slice = al_fopen_slice(pf->parent, e.size, "rn");
+      if (!pf->slice)
+         goto fail;
+   }
+
+   return pf;
+
+fail:
+   if (pf->parent)
+      al_fclose(pf->parent);
+   al_free(pf->owned);
+   al_free(pf);
+   return NULL;
+}
+
+
+static bool pack_fclose(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      al_fclose(pf->slice);
+   if (pf->parent)
+      al_fclose(pf->parent);
+   al_free(pf->owned);
+   al_free(pf);
+   return true;
+}
+
+
+static size_t pack_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      return al_fread(pf->slice, ptr, size);
+
+   if (pf->pos >= pf->size) {
+      size = 0;
+      pf->eof = true;
+   }
+   else if ((uint64_t)(pf->size - pf->pos) < size) {
+      size = pf->size - pf->pos;
+      pf->eof = true;
+   }
+   if (size > 0) {
+      memcpy(ptr, pf->data + pf->pos, size);
+      pf->pos += size;
+   }
+   return size;
+}
+
+
+static size_t pack_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   (void)f;
+   (void)ptr;
+   (void)size;
+   al_set_errno(EBADF);
+   return 0;
+}
+
+
+static bool pack_fflush(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return true;
+}
+
+
+static int64_t pack_ftell(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      return al_ftell(pf->slice);
+   return pf->pos;
+}
+
+
+static bool pack_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+   int64_t pos;
+
+   if (pf->slice)
+      return al_fseek(pf->slice, offset, whence);
+
+   switch (whence) {
+      case ALLEGRO_SEEK_SET: pos = offset; break;
+      case ALLEGRO_SEEK_CUR: pos = pf->pos + offset; break;
+      case ALLEGRO_SEEK_END: pos = pf->size + offset; break;
+      default: return false;
+   }
+   if (pos < 0) {
+      al_set_errno(EINVAL);
+      return false;
+   }
+
+   pf->pos = pos;
+   pf->eof = false;
+   return true;
+}
+
+
+static bool pack_feof(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      return al_feof(pf->slice);
+   return pf->eof;
+}
+
+
+static int pack_ferror(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      return al_ferror(pf->slice);
+   return 0;
+}
+
+
+static const char *pack_ferrmsg(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      return al_ferrmsg(pf->slice);
+   return "";
+}
+
+
+static void pack_fclearerr(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   if (pf->slice)
+      al_fclearerr(pf->slice);
+   pf->eof = false;
+}
+
+
+static off_t pack_fsize(ALLEGRO_FILE *f)
+{
+   PACK_FILE *pf = al_get_file_userdata(f);
+
+   return pf->size;
+}
+
+
+static const ALLEGRO_FILE_INTERFACE pack_file_vtable =
+{
+   pack_fopen,
+   pack_fclose,
+   pack_fread,
+   pack_fwrite,
+   pack_fflush,
+   pack_ftell,
+   pack_fseek,
+   pack_feof,
+   pack_ferror,
+   pack_ferrmsg,
+   pack_fclearerr,
+   NULL,   /* ungetc */
+   pack_fsize
+};
+
+
+
+/*
+ * File system interface
+ */
+
+
+static void fill_fs_entry(PACK_FS_ENTRY *e)
+{
+   ALLEGRO_PACK *pack;
+   PACK_ENTRY pe;
+
+   e->exists = lookup(e->path + 1, &pack, &pe);
+   e->is_dir = e->exists && (pe.flags & PACK_ENTRY_DIR);
+   e->size = (e->exists && !e->is_dir) ? (int64_t)pe.size : 0;
+   e->mtime = (e->exists && pack) ? pack->mtime : 0;
+}
+
+
+static PACK_FS_ENTRY *create_fs_entry_normalized(const char *name)
+{
+   PACK_FS_ENTRY *e = al_calloc(1, sizeof *e);
+
+   if (!e)
+      return NULL;
+   e->fs_entry.vtable = &pack_fs_vtable;
+   e->path = al_malloc(strlen(name) + 2);
+   if (!e->path) {
+      al_free(e);
+      return NULL;
+   }
+   e->path[0] = '/';
+   strcpy(e->path + 1, name);
+   fill_fs_entry(e);
+   return e;
+}
+
+
+static ALLEGRO_FS_ENTRY *pack_create_entry(const char *path)
+{
+   PACK_FS_ENTRY *e;
+   char *name = normalize_path(path);
+
+   if (!name)
+      return NULL;
+   e = create_fs_entry_normalized(name);
+   al_free(name);
+   return e ? &e->fs_entry : NULL;
+}
+
+
+static bool pack_close_directory(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   al_free(e->dir_packs);
+   e->dir_packs = NULL;
+   e->dir_num_packs = 0;
+   return true;
+}
+
+
+static void pack_destroy_entry(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   pack_close_directory(fse);
+   al_free(e->path);
+   al_free(e);
+}
+
+
+static const char *pack_entry_name(ALLEGRO_FS_ENTRY *fse)
+{
+   return ((PACK_FS_ENTRY *)fse)->path;
+}
+
+
+static bool pack_update_entry(ALLEGRO_FS_ENTRY *fse)
+{
+   fill_fs_entry((PACK_FS_ENTRY *)fse);
+   return true;
+}
+
+
+static uint32_t pack_entry_mode(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+
+   if (!e->exists)
+      return 0;
+   if (e->is_dir)
+      return ALLEGRO_FILEMODE_READ | ALLEGRO_FILEMODE_ISDIR |
+         ALLEGRO_FILEMODE_EXECUTE;
+   return ALLEGRO_FILEMODE_READ | ALLEGRO_FILEMODE_ISFILE;
+}
+
+
+static time_t pack_entry_time(ALLEGRO_FS_ENTRY *fse)
+{
+   return ((PACK_FS_ENTRY *)fse)->mtime;
+}
+
+
+static off_t pack_entry_size(ALLEGRO_FS_ENTRY *fse)
+{
+   return ((PACK_FS_ENTRY *)fse)->size;
+}
+
+
+static bool pack_entry_exists(ALLEGRO_FS_ENTRY *fse)
+{
+   return ((PACK_FS_ENTRY *)fse)->exists;
+}
+
+
+static bool pack_remove_entry(ALLEGRO_FS_ENTRY *fse)
+{
+   (void)fse;
+   al_set_errno(EACCES);
+   return false;
+}
+
+
+static bool pack_open_directory(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   int n;
+   int i;
+
+   if (!e->is_dir)
+      return false;
+
+   pack_close_directory(fse);
+
+   _al_mutex_lock(&mount_mutex);
+   n = _al_vector_size(&mounted);
+   e->dir_packs = al_malloc((n > 0 ? n : 1) * sizeof *e->dir_packs);
+   if (e->dir_packs) {
+      for (i = 0; i < n; i++)
+         e->dir_packs[i] = *(ALLEGRO_PACK **)_al_vector_ref(&mounted,
+            n - 1 - i);
+      e->dir_num_packs = n;
+   }
+   _al_mutex_unlock(&mount_mutex);
+
+   e->dir_pack = 0;
+   e->dir_pos = 0;
+   return e->dir_packs != NULL;
+}
+
+
+static ALLEGRO_FS_ENTRY *pack_read_directory(ALLEGRO_FS_ENTRY *fse)
+{
+   PACK_FS_ENTRY *e = (PACK_FS_ENTRY *)fse;
+   const char *dir = e->path + 1;
+   size_t dir_len = strlen(dir);
+
+   while (e->dir_pack < e->dir_num_packs) {
+      ALLEGRO_PACK *pack = e->dir_packs[e->dir_pack];
+
+      while (e->dir_pos < pack->num_entries) {
+         PACK_ENTRY pe;
+         PACK_ENTRY other;
+         PACK_FS_ENTRY *child;
+         char *name;
+         bool shadowed = false;
+         int i;
+
+         if (!get_entry(pack, e->dir_pos++, &pe) ||
+               !is_child(&pe, dir, dir_len))
+            continue;
+
+         /* Skip names already listed from packs mounted later. */
+         for (i = 0; i < e->dir_pack && !shadowed; i++) {
+            shadowed = find_entry(e->dir_packs[i], pe.name, pe.name_len,
+               &other) >= 0;
+         }
+         if (shadowed)
+            continue;
+
+         name = al_malloc(pe.name_len + 1);
+         if (!name)
+            return NULL;
+         memcpy(name, pe.name, pe.name_len);
+         name[pe.name_len] = '\0';
+         child = create_fs_entry_normalized(name);
+         al_free(name);
+         return child ? &child->fs_entry : NULL;
+      }
+
+      e->dir_pack++;
+      e->dir_pos = 0;
+   }
+
+   return NULL;
+}
+
+
+static bool pack_filename_exists(const char *path)
+{
+   ALLEGRO_PACK *pack;
+   PACK_ENTRY e;
+   char *name = normalize_path(path);
+   bool ret;
+
+   if (!name)
+      return false;
+   ret = lookup(name, &pack, &e);
+   al_free(name);
+   return ret;
+}
+
+
+static bool pack_remove_filename(const char *path)
+{
+   (void)path;
+   al_set_errno(EACCES);
+   return false;
+}
+
+
+static char *pack_get_current_directory(void)
+{
+   char *s = al_malloc(strlen(pack_cwd) + 2);
+
+   if (s) {
+      s[0] = '/';
+      strcpy(s + 1, pack_cwd);
+   }
+   return s;
+}
+
+
+static bool pack_change_directory(const char *path)
+{
+   ALLEGRO_PACK *pack;
+   PACK_ENTRY e;
+   char *name = normalize_path(path);
+   bool ret;
+
+   if (!name)
+      return false;
+
+   ret = lookup(name, &pack, &e) && (e.flags & PACK_ENTRY_DIR) &&
+      strlen(name) < sizeof(pack_cwd);
+   if (ret)
+      strcpy(pack_cwd, name);
+   al_free(name);
+   return ret;
+}
+
+
+static bool pack_make_directory(const char *path)
+{
+   (void)path;
+   al_set_errno(EACCES);
+   return false;
+}
+
+
+static ALLEGRO_FILE *pack_open_file(ALLEGRO_FS_ENTRY *fse, const char *mode)
+{
+   return al_fopen_interface(&pack_file_vtable, pack_entry_name(fse), mode);
+}
+
+
+static const ALLEGRO_FS_INTERFACE pack_fs_vtable =
+{
+   pack_create_entry,
+   pack_destroy_entry,
+   pack_entry_name,
+   pack_update_entry,
+   pack_entry_mode,
+   pack_entry_time,
+   pack_entry_time,
+   pack_entry_time,
+   pack_entry_size,
+   pack_entry_exists,
+   pack_remove_entry,
+
+   pack_open_directory,
+   pack_read_directory,
+   pack_close_directory,
+
+   pack_filename_exists,
+   pack_remove_filename,
+   pack_get_current_directory,
+   pack_change_directory,
+   pack_make_directory,
+
+   pack_open_file
+};
+
+
+
+/*
+ * Writing packs
+ */
+
+
+typedef struct PACK_WRITER
+{
+   ALLEGRO_FILE *out;
+   _AL_VECTOR entries;        /* of PACK_WRITER_ENTRY */
+   ALLEGRO_USTR *names;
+   bool ok;
+} PACK_WRITER;
+
+typedef struct PACK_WRITER_ENTRY
+{
+   uint64_t offset;
+   uint64_t size;
+   uint32_t name_offset;
+   uint32_t name_len;
+   uint32_t flags;
+} PACK_WRITER_ENTRY;
+
+
+static bool pad_to_alignment(ALLEGRO_FILE *out)
+{
+   static const unsigned char zeros[PACK_ALIGN];
+   int64_t pos = al_ftell(out);
+   size_t pad;
+
+   if (pos < 0)
+      return false;
+   pad = (PACK_ALIGN - pos % PACK_ALIGN) % PACK_ALIGN;
+   return al_fwrite(out, zeros, pad) == pad;
+}
+
+
+static bool add_writer_entry(PACK_WRITER *w, const char *name,
+   uint32_t flags, uint64_t offset, uint64_t size)
+{
+   PACK_WRITER_ENTRY *we = _al_vector_alloc_back(&w->entries);
+
+   if (!we)
+      return false;
+   we->offset = offset;
+   we->size = size;
+   we->name_offset = al_ustr_size(w->names);
+   we->name_len = strlen(name);
+   we->flags = flags;
+   al_ustr_append_cstr(w->names, name);
+   return true;
+}
+
+
+static bool copy_file_into_pack(PACK_WRITER *w, ALLEGRO_FS_ENTRY *src,
+   const char *name)
+{
+   unsigned char buf[16384];
+   ALLEGRO_FILE *in;
+   int64_t offset;
+   uint64_t size = 0;
+   size_t n;
+
+   if (!pad_to_alignment(w->out))
+      return false;
+   offset = al_ftell(w->out);
+
+   in = al_open_fs_entry(src, "rb");
+   if (!in) {
+      ALLEGRO_ERROR("Could not open %s.\n", al_get_fs_entry_name(src));
+      return false;
+   }
+   while ((n = al_fread(in, buf, sizeof buf)) > 0) {
+      if (al_fwrite(w->out, buf, n) != n) {
+         al_fclose(in);
+         return false;
+      }
+      size += n;
+   }
+   if (al_ferror(in)) {
+      al_fclose(in);
+      return false;
+   }
+   al_fclose(in);
+
+   return add_writer_entry(w, name, 0, offset, size);
+}
+
+
+static bool add_directory_to_pack(PACK_WRITER *w, ALLEGRO_FS_ENTRY *dir,
+   const char *prefix)
+{
+   ALLEGRO_FS_ENTRY *child;
+   bool ok = true;
+
+   if (!al_open_directory(dir))
+      return false;
+
+   while (ok && (child = al_read_directory(dir))) {
+      ALLEGRO_PATH *path = al_create_path(al_get_fs_entry_name(child));
+      const char *base = al_get_path_filename(path);
+      ALLEGRO_USTR *name;
+
+      if (base[0] == '\0' && al_get_path_num_components(path) > 0)
+         base = al_get_path_component(path, -1);
+      name = al_ustr_newf("%s%s%s", prefix, prefix[0] ? "/" : "", base);
+
+      if (al_get_fs_entry_mode(child) & ALLEGRO_FILEMODE_ISDIR) {
+         ok = add_writer_entry(w, al_cstr(name), PACK_ENTRY_DIR, 0, 0) &&
+            add_directory_to_pack(w, child, al_cstr(name));
+      }
+      else {
+         ok = copy_file_into_pack(w, child, al_cstr(name));
+      }
+
+      al_ustr_free(name);
+      al_destroy_path(path);
+      al_destroy_fs_entry(child);
+   }
+
+   al_close_directory(dir);
+   return ok;
+}
+
+
+static bool write_pack_index(PACK_WRITER *w)
+{
+   unsigned char header[PACK_HEADER_SIZE];
+   unsigned char *index;
+   uint32_t num_entries = _al_vector_size(&w->entries);
+   uint32_t num_buckets = 16;
+   size_t tables_size;
+   size_t index_size;
+   int64_t index_offset;
+   uint32_t i;
+   bool ok;
+
+   /* Keep the hash table at most half full. */
+   while (num_buckets < 2 * num_entries)
+      num_buckets *= 2;
+
+   tables_size = (size_t)num_buckets * 4 +
+      (size_t)num_entries * PACK_ENTRY_SIZE;
+   index_size = tables_size + al_ustr_size(w->names);
+   index = al_calloc(1, index_size);
+   if (!index)
+      return false;
+
+   for (i = 0; i < num_entries; i++) {
+      PACK_WRITER_ENTRY *we = _al_vector_ref(&w->entries, i);
+      unsigned char *p = index + (size_t)num_buckets * 4 +
+         (size_t)i * PACK_ENTRY_SIZE;
+      const char *name = al_cstr(w->names) + we->name_offset;
+      uint32_t hash = hash_name(name, we->name_len);
+      uint32_t b;
+
+      put64(p, we->offset);
+      put64(p + 8, we->size);
+      put64(p + 16, we->size);
+      put32(p + 24, we->name_offset);
+      put32(p + 28, we->name_len);
+      put32(p + 32, we->flags);
+      put32(p + 36, hash);
+
+      for (b = hash & (num_buckets - 1); get32(index + (size_t)b * 4);
+            b = (b + 1) & (num_buckets - 1))
+         ;
+      put32(index + (size_t)b * 4, i + 1);
+   }
+   memcpy(index + tables_size, al_cstr(w->names), al_ustr_size(w->names));
+
+   ok = pad_to_alignment(w->out);
+   index_offset = al_ftell(w->out);
+   ok = ok && index_offset >= 0 &&
+      al_fwrite(w->out, index, index_size) == index_size;
+   al_free(index);
+
+   memcpy(header, PACK_MAGIC, 4);
+   put32(header + 4, PACK_VERSION);
+   put32(header + 8, num_entries);
+   put32(header + 12, num_buckets);
+   put64(header + 16, index_offset);
+   put64(header + 24, index_size);
+   return ok && al_fseek(w->out, 0, ALLEGRO_SEEK_SET) &&
+      al_fwrite(w->out, header, PACK_HEADER_SIZE) == PACK_HEADER_SIZE;
+}
+
+
+/* Function: al_save_pack
+ */
+bool al_save_pack(const char *filename, const char *dir)
+{
+   PACK_WRITER w;
+   ALLEGRO_FS_ENTRY *root;
+   ASSERT(filename);
+   ASSERT(dir);
+
+   root = al_create_fs_entry(dir);
+   if (!root)
+      return false;
+   if (!(al_get_fs_entry_mode(root) & ALLEGRO_FILEMODE_ISDIR)) {
+      al_destroy_fs_entry(root);
+      al_set_errno(ENOTDIR);
+      return false;
+   }
+
+   memset(&w, 0, sizeof w);
+   w.out = al_fopen_interface(&_al_file_interface_stdio, filename, "wb");
+   if (!w.out) {
+      al_destroy_fs_entry(root);
+      return false;
+   }
+   _al_vector_init(&w.entries, sizeof(PACK_WRITER_ENTRY));
+   w.names = al_ustr_new("");
+
+   /* The header is written last, once the index offset is known. */
+   w.ok = al_fseek(w.out, PACK_HEADER_SIZE, ALLEGRO_SEEK_SET) &&
+      add_directory_to_pack(&w, root, "") &&
+      write_pack_index(&w);
+
+   if (!al_fclose(w.out))
+      w.ok = false;
+   al_destroy_fs_entry(root);
+   _al_vector_free(&w.entries);
+   al_ustr_free(w.names);
+
+   if (!w.ok)
+      ALLEGRO_ERROR("Could not write pack %s.\n", filename);
+   return w.ok;
+}
+
+
+
+static void shutdown_packs(void)
+{
+   _al_vector_free(&mounted);
+   _al_mutex_destroy(&mount_mutex);
+}
+
+
+void _al_init_packs(void)
+{
+   _al_mutex_init(&mount_mutex);
+   _al_vector_init(&mounted, sizeof(ALLEGRO_PACK *));
+   _al_add_exit_func(shutdown_packs, "shutdown_packs");
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_file.h"
@@ -36,6 +37,13 @@
 #include <sys/stat.h>
 #endif
 
+#if defined(ALLEGRO_WINDOWS)
+#include <windows.h>
+#include <io.h>
+#elif defined(ALLEGRO_UNIX)
+#include <unistd.h>
+#endif
+
 ALLEGRO_DEBUG_CHANNEL("stdio")
 
 /* forward declaration */
@@ -377,6 +385,90 @@ const struct ALLEGRO_FILE_INTERFACE _al_file_interface_stdio =
 };
 
 
+/* _al_file_stdio_read_at:
+ *  Reads from the given position of a stdio file straight through its
+ *  descriptor, bypassing the stdio buffer and file position, so that
+ *  several threads may read the same file at once. Returns false if f
+ *  isn't a stdio file or the platform can't do this. Otherwise stores the
+ *  number of bytes read, or -1 on error, in *ret.
+ *
+ *  On Windows the file position of the descriptor moves.
+ */
+bool _al_file_stdio_read_at(ALLEGRO_FILE *f, int64_t offset, void *ptr,
+   size_t size, int64_t *ret)
+{
+#if defined(ALLEGRO_WINDOWS)
+   USERDATA *userdata;
+   HANDLE handle;
+   char *dst = ptr;
+   size_t done = 0;
+
+   if (f->vtable != &_al_file_interface_stdio)
+      return false;
+   userdata = get_userdata(f);
+   handle = (HANDLE)_get_osfhandle(_fileno(userdata->fp));
+   if (handle == INVALID_HANDLE_VALUE)
+      return false;
+
+   while (done < size) {
+      OVERLAPPED ov;
+      DWORD chunk = (DWORD)_ALLEGRO_MIN(size - done, 1u << 30);
+      DWORD n;
+      int64_t pos = offset + done;
+
+      memset(&ov, 0, sizeof ov);
+      ov.Offset = (DWORD)pos;
+      ov.OffsetHigh = (DWORD)(pos >> 32);
+      if (!ReadFile(handle, dst + done, chunk, &n, &ov)) {
+         if (GetLastError() == ERROR_HANDLE_EOF)
+            break;
+         *ret = -1;
+         return true;
+      }
+      if (n == 0)
+         break;
+      done += n;
+   }
+
+   *ret = done;
+   return true;
+#elif defined(ALLEGRO_UNIX)
+   USERDATA *userdata;
+   char *dst = ptr;
+   size_t done = 0;
+   int fd;
+
+   if (f->vtable != &_al_file_interface_stdio)
+      return false;
+   userdata = get_userdata(f);
+   fd = fileno(userdata->fp);
+
+   while (done < size) {
+      ssize_t n = pread(fd, dst + done, size - done, offset + done);
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+         *ret = -1;
+         return true;
+      }
+      if (n == 0)
+         break;
+      done += n;
+   }
+
+   *ret = done;
+   return true;
+#else
+   (void)f;
+   (void)offset;
+   (void)ptr;
+   (void)size;
+   (void)ret;
+   return false;
+#endif
+}
+
+
 /* Function: al_set_standard_file_interface
  */
 void al_set_standard_file_interface(void)
@@ -0,0 +1,122 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Frame pacing.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include <math.h>
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_display.h"
+
+/*
+ * al_flip_display and al_update_display_region are timed by the display
+ * itself. When the driver can say when the last vertical retrace happened,
+ * the frame is assumed to become visible at the first retrace after the
+ * swap returned. Otherwise the time the swap returned is the best guess.
+ */
+
+/* Swaps returning this soon after a retrace were waiting for it. */
+#define VSYNC_SLACK 0.001
+
+
+void _al_init_frame_timing(ALLEGRO_DISPLAY *display)
+{
+   memset(display->frame_timings, 0, sizeof(display->frame_timings));
+   display->num_frame_timings = 0;
+   display->present_start_time = 0;
+   display->late_latch = 0;
+}
+
+
+void _al_begin_frame_present(ALLEGRO_DISPLAY *display)
+{
+   display->present_start_time = al_get_time();
+}
+
+
+void _al_end_frame_present(ALLEGRO_DISPLAY *display)
+{
+   _AL_FRAME_TIMING *t;
+   double now = al_get_time();
+   double last_vsync;
+   double interval;
+   double wake;
+
+   t = &display->frame_timings[display->num_frame_timings %
+      _AL_FRAME_TIMING_HISTORY];
+   display->num_frame_timings++;
+
+   t->submit_time = display->present_start_time;
+   t->swap_time = now - display->present_start_time;
+   t->vsync_interval = 0;
+   t->present_time = now;
+
+   if (display->vt->get_vsync_timing &&
+         display->vt->get_vsync_timing(display, &last_vsync, &interval) &&
+         interval > 0) {
+      t->vsync_interval = interval;
+      if (now - last_vsync <= VSYNC_SLACK)
+         t->present_time = last_vsync;
+      else
+         t->present_time = last_vsync +
+            ceil((now - last_vsync) / interval) * interval;
+   }
+   else if (display->refresh_rate > 0) {
+      t->vsync_interval = 1.0 / display->refresh_rate;
+   }
+
+   if (display->late_latch <= 0 || t->vsync_interval <= 0)
+      return;
+
+   /* Return to the caller only when there is just enough time left to
+    * read input and draw the next frame.
+    */
+   wake = t->present_time + t->vsync_interval - display->late_latch;
+   if (wake > now)
+      al_rest(wake - now);
+}
+
+
+/* Function: al_get_display_frame_timing
+ */
+bool al_get_display_frame_timing(ALLEGRO_DISPLAY *display, int frames_ago,
+   ALLEGRO_FRAME_TIMING *timing)
+{
+   _AL_FRAME_TIMING *t;
+   ASSERT(display);
+   ASSERT(timing);
+
+   if (frames_ago < 0 || frames_ago >= _AL_FRAME_TIMING_HISTORY ||
+         frames_ago >= display->num_frame_timings)
+      return false;
+
+   t = &display->frame_timings[(display->num_frame_timings - 1 -
+      frames_ago) % _AL_FRAME_TIMING_HISTORY];
+   timing->submit_time = t->submit_time;
+   timing->swap_time = t->swap_time;
+   timing->vsync_interval = t->vsync_interval;
+   timing->present_time = t->present_time;
+   return true;
+}
+
+
+/* Function: al_set_display_late_latch
+ */
+void al_set_display_late_latch(ALLEGRO_DISPLAY *display, double margin)
+{
+   ASSERT(display);
+
+   display->late_latch = _ALLEGRO_MAX(margin, 0.0);
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,790 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Recursive directory walker which reads directories on the job
+ *      pool and hands entries to the caller in batches.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#define _UNICODE
+#endif
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_fshook.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_vector.h"
+#include "allegro5/internal/aintern_wunicode.h"
+#include ALLEGRO_INTERNAL_HEADER
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(ALLEGRO_WINDOWS)
+   #define NATIVE_WALK
+#elif defined(ALLEGRO_HAVE_FSTATAT) && defined(ALLEGRO_HAVE_FDOPENDIR)
+   #define NATIVE_WALK
+   #include <dirent.h>
+   #include <fcntl.h>
+   #include <sys/stat.h>
+   #include <unistd.h>
+   #ifndef O_CLOEXEC
+      #define O_CLOEXEC 0
+   #endif
+   #ifndef O_DIRECTORY
+      #define O_DIRECTORY 0
+   #endif
+#endif
+
+#ifdef ALLEGRO_WINDOWS
+   /* Only declared when targetting Windows 7 and later. */
+   #ifndef FIND_FIRST_EX_LARGE_FETCH
+      #define FIND_FIRST_EX_LARGE_FETCH 2
+   #endif
+   #define FIND_EX_INFO_BASIC ((FINDEX_INFO_LEVELS)1)
+#endif
+
+
+#define BATCH_SIZE            256
+/* How far the workers may get ahead of the callback. */
+#define MAX_QUEUED_BATCHES    64
+#define MAX_WORKERS           8
+
+
+typedef struct WALK_BATCH WALK_BATCH;
+
+struct WALK_BATCH {
+   WALK_BATCH *next;
+   int count;
+   ALLEGRO_FS_WALK_ENTRY entries[BATCH_SIZE];
+   /* The names buffer may move while the batch fills up, so the strings
+    * are kept as offsets until the batch is handed out.
+    */
+   size_t path_pos[BATCH_SIZE];
+   size_t name_pos[BATCH_SIZE];
+   char *names;
+   size_t names_used;
+   size_t names_size;
+};
+
+typedef struct WALK {
+   char *root;             /* without trailing separators */
+   size_t root_len;
+   bool native;
+   bool threaded;
+#if defined(NATIVE_WALK) && !defined(ALLEGRO_WINDOWS)
+   int root_fd;
+#endif
+   int (*callback)(const ALLEGRO_FS_WALK_ENTRY *entries, int count,
+      void *extra);
+   void *extra;
+
+   /* The rest is protected by the mutex if threaded. */
+   _AL_MUTEX mutex;
+   _AL_COND dirs_cond;     /* signalled when dirs grows or the walk ends */
+   _AL_COND batches_cond;  /* signalled when a batch is queued */
+   _AL_COND room_cond;     /* signalled when a queued batch is taken */
+   _AL_VECTOR dirs;        /* of char *, still to be read */
+   int busy;               /* number of directories being read */
+   WALK_BATCH *first_batch;
+   WALK_BATCH *last_batch;
+   int num_batches;
+   bool done;
+   bool quit;
+   int result;
+   int error;
+} WALK;
+
+
+static void lock_walk(WALK *walk)
+{
+   if (walk->threaded)
+      _al_mutex_lock(&walk->mutex);
+}
+
+
+static void unlock_walk(WALK *walk)
+{
+   if (walk->threaded)
+      _al_mutex_unlock(&walk->mutex);
+}
+
+
+/* Ends the walk with the given result. The mutex must be held. */
+static void quit_walk(WALK *walk, int result, int error)
+{
+   if (!walk->quit) {
+      walk->quit = true;
+      walk->result = result;
+      walk->error = error;
+   }
+   if (walk->threaded) {
+      _al_cond_broadcast(&walk->dirs_cond);
+      _al_cond_broadcast(&walk->room_cond);
+      _al_cond_signal(&walk->batches_cond);
+   }
+}
+
+
+static void walk_failed(WALK *walk, int error)
+{
+   lock_walk(walk);
+   quit_walk(walk, ALLEGRO_FOR_EACH_FS_ENTRY_ERROR, error);
+   unlock_walk(walk);
+}
+
+
+static void destroy_batch(WALK_BATCH *batch)
+{
+   if (batch) {
+      al_free(batch->names);
+      al_free(batch);
+   }
+}
+
+
+/* Makes the entries point into the names buffer. */
+static void seal_batch(WALK_BATCH *batch)
+{
+   int i;
+
+   for (i = 0; i < batch->count; i++) {
+      batch->entries[i].path = batch->names + batch->path_pos[i];
+      batch->entries[i].name = batch->names + batch->name_pos[i];
+   }
+}
+
+
+static bool call_back(WALK *walk, WALK_BATCH *batch)
+{
+   int result;
+
+   seal_batch(batch);
+   result = walk->callback(batch->entries, batch->count, walk->extra);
+   destroy_batch(batch);
+
+   if (result == ALLEGRO_FOR_EACH_FS_ENTRY_STOP ||
+         result == ALLEGRO_FOR_EACH_FS_ENTRY_ERROR) {
+      lock_walk(walk);
+      quit_walk(walk, result, 0);
+      unlock_walk(walk);
+      return false;
+   }
+   return true;
+}
+
+
+/* Takes ownership of the batch. Returns false if the walk should end. */
+static bool send_batch(WALK *walk, WALK_BATCH *batch)
+{
+   if (!walk->threaded)
+      return call_back(walk, batch);
+
+   _al_mutex_lock(&walk->mutex);
+   while (walk->num_batches >= MAX_QUEUED_BATCHES && !walk->quit)
+      _al_cond_wait(&walk->room_cond, &walk->mutex);
+   if (walk->quit) {
+      _al_mutex_unlock(&walk->mutex);
+      destroy_batch(batch);
+      return false;
+   }
+   if (walk->last_batch)
+      walk->last_batch->next = batch;
+   else
+      walk->first_batch = batch;
+   walk->last_batch = batch;
+   walk->num_batches++;
+   _al_cond_signal(&walk->batches_cond);
+   _al_mutex_unlock(&walk->mutex);
+   return true;
+}
+
+
+/* Appends dir_path, a separator and name to the batch, sending the batch off
+ * first if it is full.
+ */
+static bool add_entry(WALK *walk, WALK_BATCH **pbatch,
+   const char *dir_path, size_t dir_len, const char *name,
+   uint32_t mode, off_t size, time_t mtime)
+{
+   WALK_BATCH *batch = *pbatch;
+   size_t name_len = strlen(name);
+   size_t needed = dir_len + 1 + name_len + 1;
+   ALLEGRO_FS_WALK_ENTRY *entry;
+   char *p;
+
+   if (batch && batch->count == BATCH_SIZE) {
+      *pbatch = NULL;
+      if (!send_batch(walk, batch))
+         return false;
+      batch = NULL;
+   }
+
+   if (!batch) {
+      batch = al_calloc(1, sizeof(*batch));
+      if (!batch) {
+         walk_failed(walk, ENOMEM);
+         return false;
+      }
+      *pbatch = batch;
+   }
+
+   if (batch->names_used + needed > batch->names_size) {
+      size_t new_size = batch->names_size ? batch->names_size * 2 : 16384;
+      char *names;
+
+      while (new_size < batch->names_used + needed)
+         new_size *= 2;
+      names = al_realloc(batch->names, new_size);
+      if (!names) {
+         walk_failed(walk, ENOMEM);
+         return false;
+      }
+      batch->names = names;
+      batch->names_size = new_size;
+   }
+
+   p = batch->names + batch->names_used;
+   memcpy(p, dir_path, dir_len);
+   p[dir_len] = ALLEGRO_NATIVE_PATH_SEP;
+   memcpy(p + dir_len + 1, name, name_len + 1);
+
+   batch->path_pos[batch->count] = batch->names_used;
+   batch->name_pos[batch->count] = batch->names_used + dir_len + 1;
+   entry = &batch->entries[batch->count];
+   entry->mode = mode;
+   entry->size = size;
+   entry->mtime = mtime;
+   batch->count++;
+   batch->names_used += needed;
+   return true;
+}
+
+
+/* Queues the directory dir_path, a separator and name for reading, or just
+ * name if dir_path is NULL.
+ */
+static bool add_dir(WALK *walk, const char *dir_path, const char *name)
+{
+   size_t dir_len = dir_path ? strlen(dir_path) : 0;
+   size_t name_len = strlen(name);
+   char *path = al_malloc(dir_len + 1 + name_len + 1);
+   char **slot;
+
+   if (!path) {
+      walk_failed(walk, ENOMEM);
+      return false;
+   }
+   if (dir_path) {
+      memcpy(path, dir_path, dir_len);
+      path[dir_len++] = ALLEGRO_NATIVE_PATH_SEP;
+   }
+   memcpy(path + dir_len, name, name_len + 1);
+
+   lock_walk(walk);
+   slot = _al_vector_alloc_back(&walk->dirs);
+   if (slot)
+      *slot = path;
+   if (walk->threaded)
+      _al_cond_signal(&walk->dirs_cond);
+   unlock_walk(walk);
+
+   if (!slot) {
+      al_free(path);
+      walk_failed(walk, ENOMEM);
+      return false;
+   }
+   return true;
+}
+
+
+/* Reads a directory through the current file system interface. The queued
+ * paths are the names the interface gave to the directories.
+ */
+static bool read_dir_fshook(WALK *walk, const char *path,
+   WALK_BATCH **batch)
+{
+   ALLEGRO_FS_ENTRY *dir = al_create_fs_entry(path);
+   ALLEGRO_FS_ENTRY *entry;
+   size_t path_len = strlen(path);
+   bool ok = true;
+
+   if (!dir || !al_open_directory(dir)) {
+      al_destroy_fs_entry(dir);
+      walk_failed(walk, ENOENT);
+      return false;
+   }
+
+   while (ok && (entry = al_read_directory(dir))) {
+      const char *entry_name = al_get_fs_entry_name(entry);
+      const char *name = entry_name + strlen(entry_name);
+      uint32_t mode = al_get_fs_entry_mode(entry);
+
+      while (name > entry_name && name[-1] != '/' &&
+            name[-1] != ALLEGRO_NATIVE_PATH_SEP)
+         name--;
+
+      ok = add_entry(walk, batch, path, path_len, name, mode,
+         al_get_fs_entry_size(entry), al_get_fs_entry_mtime(entry));
+      if (ok && (mode & ALLEGRO_FILEMODE_ISDIR))
+         ok = add_dir(walk, NULL, entry_name);
+
+      al_destroy_fs_entry(entry);
+   }
+
+   al_close_directory(dir);
+   al_destroy_fs_entry(dir);
+   return ok;
+}
+
+
+#ifdef NATIVE_WALK
+static bool is_dot_name(const char *name)
+{
+   return name[0] == '.' &&
+      (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+
+#endif
+
+
+#if defined(NATIVE_WALK) && defined(ALLEGRO_WINDOWS)
+
+static time_t filetime_to_time(const FILETIME *ft)
+{
+   ULARGE_INTEGER t;
+
+   t.LowPart = ft->dwLowDateTime;
+   t.HighPart = ft->dwHighDateTime;
+   /* 100ns intervals since 1601. */
+   return (time_t)((t.QuadPart - 116444736000000000ULL) / 10000000);
+}
+
+
+static bool is_executable_name(const wchar_t *name)
+{
+   const wchar_t *ext = wcsrchr(name, L'.');
+
+   return ext && (_wcsicmp(ext, L".exe") == 0 || _wcsicmp(ext, L".com") == 0 ||
+      _wcsicmp(ext, L".bat") == 0 || _wcsicmp(ext, L".cmd") == 0);
+}
+
+
+/* Matches what _wstat reports, which the stdio interface goes by. */
+static uint32_t find_data_mode(const WIN32_FIND_DATAW *fd)
+{
+   uint32_t mode = ALLEGRO_FILEMODE_READ;
+
+   if (fd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      mode |= ALLEGRO_FILEMODE_ISDIR | ALLEGRO_FILEMODE_EXECUTE;
+   else {
+      mode |= ALLEGRO_FILEMODE_ISFILE;
+      if (is_executable_name(fd->cFileName))
+         mode |= ALLEGRO_FILEMODE_EXECUTE;
+   }
+   if (!(fd->dwFileAttributes & FILE_ATTRIBUTE_READONLY))
+      mode |= ALLEGRO_FILEMODE_WRITE;
+   if (fd->dwFileAttributes & FILE_ATTRIBUTE_HIDDEN)
+      mode |= ALLEGRO_FILEMODE_HIDDEN;
+   return mode;
+}
+
+
+/* rel is relative to the root, or empty for the root itself. */
+static bool read_dir_native(WALK *walk, const char *rel, WALK_BATCH **batch)
+{
+   ALLEGRO_USTR *path = al_ustr_new(walk->root);
+   WIN32_FIND_DATAW fd;
+   wchar_t *pattern;
+   HANDLE h;
+   size_t path_len;
+   bool ok = true;
+
+   if (rel[0])
+      al_ustr_appendf(path, "%c%s", ALLEGRO_NATIVE_PATH_SEP, rel);
+   path_len = al_ustr_size(path);
+   al_ustr_append_cstr(path, "\\*");
+   pattern = _al_win_ustr_to_utf16(path);
+   al_ustr_truncate(path, path_len);
+
+   h = INVALID_HANDLE_VALUE;
+   if (pattern) {
+      h = FindFirstFileExW(pattern, FIND_EX_INFO_BASIC, &fd,
+         FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+      if (h == INVALID_HANDLE_VALUE &&
+            GetLastError() == ERROR_INVALID_PARAMETER) {
+         /* Windows Vista and earlier. */
+         h = FindFirstFileExW(pattern, FindExInfoStandard, &fd,
+            FindExSearchNameMatch, NULL, 0);
+      }
+      al_free(pattern);
+   }
+   if (h == INVALID_HANDLE_VALUE) {
+      al_ustr_free(path);
+      walk_failed(walk, ENOENT);
+      return false;
+   }
+
+   do {
+      char name[MAX_PATH * 3];
+      ULARGE_INTEGER size;
+
+      if (!_al_win_copy_utf16_to_utf8(name, fd.cFileName, sizeof(name)) ||
+            is_dot_name(name))
+         continue;
+
+      size.LowPart = fd.nFileSizeLow;
+      size.HighPart = fd.nFileSizeHigh;
+      ok = add_entry(walk, batch, al_cstr(path), path_len, name,
+         find_data_mode(&fd), (off_t)size.QuadPart,
+         filetime_to_time(&fd.ftLastWriteTime));
+
+      /* Junctions and symbolic links are not followed, they may loop. */
+      if (ok && (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+            !(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+         ok = add_dir(walk, rel[0] ? rel : NULL, name);
+   } while (ok && FindNextFileW(h, &fd));
+
+   FindClose(h);
+   al_ustr_free(path);
+   return ok;
+}
+
+#elif defined(NATIVE_WALK)
+
+/* Matches fs_update_stat_mode in fshook_stdio.c. */
+static uint32_t stat_mode(const struct stat *st, const char *name)
+{
+   uint32_t mode = 0;
+
+   if (S_ISDIR(st->st_mode))
+      mode |= ALLEGRO_FILEMODE_ISDIR;
+   else
+      mode |= ALLEGRO_FILEMODE_ISFILE;
+   if (st->st_mode & (S_IRUSR | S_IRGRP))
+      mode |= ALLEGRO_FILEMODE_READ;
+   if (st->st_mode & (S_IWUSR | S_IWGRP))
+      mode |= ALLEGRO_FILEMODE_WRITE;
+   if (st->st_mode & (S_IXUSR | S_IXGRP))
+      mode |= ALLEGRO_FILEMODE_EXECUTE;
+#if defined(ALLEGRO_MACOSX) && defined(UF_HIDDEN)
+   if (st->st_flags & UF_HIDDEN)
+      mode |= ALLEGRO_FILEMODE_HIDDEN;
+#endif
+   if (name[0] == '.')
+      mode |= ALLEGRO_FILEMODE_HIDDEN;
+   return mode;
+}
+
+
+/* rel is relative to the root, or empty for the root itself. Everything is
+ * opened and stat'ed relative to the directory's descriptor, which saves the
+ * kernel from walking the whole path again for every entry.
+ */
+static bool read_dir_native(WALK *walk, const char *rel, WALK_BATCH **batch)
+{
+   ALLEGRO_USTR *path;
+   struct dirent *ent;
+   DIR *dir;
+   int fd;
+   bool ok = true;
+
+   fd = openat(walk->root_fd, rel[0] ? rel : ".",
+      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd == -1) {
+      walk_failed(walk, errno);
+      return false;
+   }
+   dir = fdopendir(fd);
+   if (!dir) {
+      walk_failed(walk, errno);
+      close(fd);
+      return false;
+   }
+
+   path = al_ustr_new(walk->root);
+   if (rel[0])
+      al_ustr_appendf(path, "%c%s", ALLEGRO_NATIVE_PATH_SEP, rel);
+
+   while (ok && (ent = readdir(dir))) {
+      struct stat st;
+      bool is_dir;
+
+      if (is_dot_name(ent->d_name))
+         continue;
+      /* Entries removed since the directory was read are left out. */
+      if (fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+         continue;
+
+      /* Symbolic links report what they point to, like stat() does, but
+       * are not descended into as they may loop.
+       */
+      is_dir = S_ISDIR(st.st_mode);
+      if (S_ISLNK(st.st_mode))
+         fstatat(fd, ent->d_name, &st, 0);
+
+      ok = add_entry(walk, batch, al_cstr(path), al_ustr_size(path),
+         ent->d_name, stat_mode(&st, ent->d_name), st.st_size, st.st_mtime);
+      if (ok && is_dir)
+         ok = add_dir(walk, rel[0] ? rel : NULL, ent->d_name);
+   }
+
+   closedir(dir);
+   al_ustr_free(path);
+   return ok;
+}
+
+#endif
+
+
+/* Reads queued directories until there are none left and no other thread
+ * is reading one which could add more.
+ */
+static void walk_dirs(WALK *walk)
+{
+   WALK_BATCH *batch = NULL;
+
+   lock_walk(walk);
+   while (!walk->quit) {
+      char *dir;
+
+      if (_al_vector_is_empty(&walk->dirs)) {
+         if (batch) {
+            /* Don't sit on entries while waiting. Stay busy meanwhile so
+             * that the walk can't be seen as done before they arrive.
+             */
+            walk->busy++;
+            unlock_walk(walk);
+            send_batch(walk, batch);
+            batch = NULL;
+            lock_walk(walk);
+            walk->busy--;
+            continue;
+         }
+         if (walk->busy == 0) {
+            walk->done = true;
+            if (walk->threaded) {
+               _al_cond_broadcast(&walk->dirs_cond);
+               _al_cond_signal(&walk->batches_cond);
+            }
+            break;
+         }
+         ASSERT(walk->threaded);
+         _al_cond_wait(&walk->dirs_cond, &walk->mutex);
+         continue;
+      }
+
+      dir = *(char **)_al_vector_ref_back(&walk->dirs);
+      _al_vector_delete_at(&walk->dirs, _al_vector_size(&walk->dirs) - 1);
+      walk->busy++;
+      unlock_walk(walk);
+
+#ifdef NATIVE_WALK
+      if (walk->native)
+         read_dir_native(walk, dir, &batch);
+      else
+#endif
+         read_dir_fshook(walk, dir, &batch);
+      al_free(dir);
+
+      lock_walk(walk);
+      walk->busy--;
+   }
+   unlock_walk(walk);
+
+   destroy_batch(batch);
+}
+
+
+static void walk_job(void *arg)
+{
+   walk_dirs(arg);
+}
+
+
+/* Hands the batches the workers queue to the callback until the walk ends. */
+static void receive_batches(WALK *walk)
+{
+   _al_mutex_lock(&walk->mutex);
+   for (;;) {
+      WALK_BATCH *batch;
+
+      while (!walk->first_batch && !walk->done && !walk->quit)
+         _al_cond_wait(&walk->batches_cond, &walk->mutex);
+      if (walk->quit || !walk->first_batch)
+         break;
+
+      batch = walk->first_batch;
+      walk->first_batch = batch->next;
+      if (!walk->first_batch)
+         walk->last_batch = NULL;
+      walk->num_batches--;
+      _al_cond_signal(&walk->room_cond);
+      _al_mutex_unlock(&walk->mutex);
+
+      call_back(walk, batch);
+
+      _al_mutex_lock(&walk->mutex);
+   }
+   _al_mutex_unlock(&walk->mutex);
+}
+
+
+static void run_walk(WALK *walk)
+{
+   ALLEGRO_JOB_POOL *pool = NULL;
+   ALLEGRO_JOB_COUNTER *counter = NULL;
+   int n = 0;
+   int i;
+
+   if (walk->threaded) {
+      pool = _al_get_job_pool();
+      counter = al_create_job_counter();
+      if (!pool || !counter)
+         walk->threaded = false;
+   }
+
+   if (!walk->threaded) {
+      al_destroy_job_counter(counter);
+      walk_dirs(walk);
+      return;
+   }
+
+   _al_mutex_init(&walk->mutex);
+   _al_cond_init(&walk->dirs_cond);
+   _al_cond_init(&walk->batches_cond);
+   _al_cond_init(&walk->room_cond);
+
+   /* Jobs which only start once the walk is done return right away. */
+   n = _ALLEGRO_MIN(al_get_job_pool_workers(pool), MAX_WORKERS);
+   for (i = 0; i < n; i++) {
+      if (!al_add_job(pool, walk_job, walk, NULL, counter))
+         break;
+   }
+   if (i == 0) {
+      /* Nobody to read the directories but this thread. */
+      walk->threaded = false;
+      walk_dirs(walk);
+      walk->threaded = true;
+   }
+
+   receive_batches(walk);
+
+   al_wait_for_job_counter(pool, counter);
+   al_destroy_job_counter(counter);
+
+   while (walk->first_batch) {
+      WALK_BATCH *batch = walk->first_batch;
+      walk->first_batch = batch->next;
+      destroy_batch(batch);
+   }
+
+   _al_cond_destroy(&walk->room_cond);
+   _al_cond_destroy(&walk->batches_cond);
+   _al_cond_destroy(&walk->dirs_cond);
+   _al_mutex_destroy(&walk->mutex);
+}
+
+
+/* Function: al_walk_fs_tree
+ */
+int al_walk_fs_tree(const char *path, int flags,
+   int (*callback)(const ALLEGRO_FS_WALK_ENTRY *entries, int count,
+      void *extra),
+   void *extra)
+{
+   WALK walk;
+   char **slot;
+   char *first_dir;
+   unsigned int i;
+
+   ASSERT(path);
+   ASSERT(callback);
+
+   memset(&walk, 0, sizeof(walk));
+   walk.callback = callback;
+   walk.extra = extra;
+   walk.result = ALLEGRO_FOR_EACH_FS_ENTRY_OK;
+   _al_vector_init(&walk.dirs, sizeof(char *));
+
+#ifdef NATIVE_WALK
+   /* Other interfaces may keep thread local state, so they are only used
+    * from this thread.
+    */
+   walk.native = (al_get_fs_interface() == &_al_fs_interface_stdio);
+#endif
+   walk.threaded = walk.native && !(flags & ALLEGRO_FS_WALK_SINGLE_THREAD);
+
+   walk.root = al_malloc(strlen(path) + 1);
+   if (!walk.root) {
+      al_set_errno(ENOMEM);
+      return ALLEGRO_FOR_EACH_FS_ENTRY_ERROR;
+   }
+   strcpy(walk.root, path);
+   walk.root_len = strlen(path);
+   if (walk.native) {
+      /* A lone separator is the root directory, and the separator put
+       * before each name makes up for it.
+       */
+      while (walk.root_len > 0 &&
+            (walk.root[walk.root_len - 1] == '/' ||
+             walk.root[walk.root_len - 1] == ALLEGRO_NATIVE_PATH_SEP))
+         walk.root[--walk.root_len] = '\0';
+   }
+
+#if defined(NATIVE_WALK) && !defined(ALLEGRO_WINDOWS)
+   walk.root_fd = -1;
+   if (walk.native) {
+      walk.root_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (walk.root_fd == -1) {
+         al_set_errno(errno);
+         al_free(walk.root);
+         return ALLEGRO_FOR_EACH_FS_ENTRY_ERROR;
+      }
+   }
+#endif
+
+   /* Natively the queued directories are relative to the root. */
+   first_dir = al_malloc(strlen(path) + 1);
+   slot = _al_vector_alloc_back(&walk.dirs);
+   if (!first_dir || !slot) {
+      al_free(first_dir);
+      walk.result = ALLEGRO_FOR_EACH_FS_ENTRY_ERROR;
+      walk.error = ENOMEM;
+   }
+   else {
+      strcpy(first_dir, walk.native ? "" : path);
+      *slot = first_dir;
+      run_walk(&walk);
+   }
+
+   for (i = 0; i < _al_vector_size(&walk.dirs); i++) {
+      char **dir = _al_vector_ref(&walk.dirs, i);
+      al_free(*dir);
+   }
+   _al_vector_free(&walk.dirs);
+#if defined(NATIVE_WALK) && !defined(ALLEGRO_WINDOWS)
+   if (walk.root_fd != -1)
+      close(walk.root_fd);
+#endif
+   al_free(walk.root);
+
+   if (walk.result == ALLEGRO_FOR_EACH_FS_ENTRY_ERROR && walk.error)
+      al_set_errno(walk.error);
+   return walk.result;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
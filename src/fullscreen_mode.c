@@ -13,17 +13,124 @@
  *      See LICENSE.txt for copyright information.
  */
 
+#include <string.h>
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_vector.h"
+
+
+/* Querying the modes can take server round-trips (XRandR), and some
+ * programs ask for them every frame, so the list for each combination of
+ * new display parameters is kept until the system reports a display
+ * configuration change.
+ */
+typedef struct MODE_LIST
+{
+   int adapter;
+   int flags;
+   int refresh_rate;
+   int format;
+   _AL_VECTOR modes;    /* of CACHED_MODE */
+} MODE_LIST;
+
+typedef struct CACHED_MODE
+{
+   ALLEGRO_DISPLAY_MODE mode;
+   bool valid;
+} CACHED_MODE;
+
+static _AL_MUTEX mode_lists_mutex = _AL_MUTEX_UNINITED;
+static _AL_VECTOR mode_lists = _AL_VECTOR_INITIALIZER(MODE_LIST);
+static int mode_lists_generation;
+
+
+static void free_mode_lists(void)
+{
+   unsigned i;
+
+   for (i = 0; i < _al_vector_size(&mode_lists); i++) {
+      MODE_LIST *list = _al_vector_ref(&mode_lists, i);
+      _al_vector_free(&list->modes);
+   }
+   _al_vector_free(&mode_lists);
+}
+
+
+static void shutdown_display_modes(void)
+{
+   free_mode_lists();
+   _al_mutex_destroy(&mode_lists_mutex);
+}
+
+
+/* _al_init_display_modes:
+ *  Called from al_install_system.
+ */
+void _al_init_display_modes(void)
+{
+   _al_mutex_init(&mode_lists_mutex);
+   _al_add_exit_func(shutdown_display_modes, "shutdown_display_modes");
+}
+
+
+/* Returns the mode list for the current new display parameters, querying
+ * the system driver if there is none yet. Call with mode_lists_mutex held.
+ */
+static MODE_LIST *get_mode_list(void)
+{
+   ALLEGRO_SYSTEM *system = al_get_system_driver();
+   int adapter = al_get_new_display_adapter();
+   int flags = al_get_new_display_flags();
+   int refresh_rate = al_get_new_display_refresh_rate();
+   int format = _al_deduce_color_format(_al_get_new_display_settings());
+   int generation = _al_get_display_config_generation();
+   MODE_LIST *list;
+   int i, n;
+
+   if (generation != mode_lists_generation) {
+      free_mode_lists();
+      mode_lists_generation = generation;
+   }
+
+   for (i = 0; i < (int)_al_vector_size(&mode_lists); i++) {
+      list = _al_vector_ref(&mode_lists, i);
+      if (list->adapter == adapter && list->flags == flags &&
+            list->refresh_rate == refresh_rate && list->format == format)
+         return list;
+   }
+
+   list = _al_vector_alloc_back(&mode_lists);
+   list->adapter = adapter;
+   list->flags = flags;
+   list->refresh_rate = refresh_rate;
+   list->format = format;
+   _al_vector_init(&list->modes, sizeof(CACHED_MODE));
+
+   n = system->vt->get_num_display_modes();
+   for (i = 0; i < n; i++) {
+      CACHED_MODE *cached = _al_vector_alloc_back(&list->modes);
+      memset(&cached->mode, 0, sizeof cached->mode);
+      cached->valid = system->vt->get_display_mode(i, &cached->mode) != NULL;
+   }
+
+   return list;
+}
 
 
 /* Function: al_get_num_display_modes
  */
 int al_get_num_display_modes(void)
 {
-   ALLEGRO_SYSTEM *system = al_get_system_driver();
-   return system->vt->get_num_display_modes();
+   int n;
+
+   _al_mutex_lock(&mode_lists_mutex);
+   n = _al_vector_size(&get_mode_list()->modes);
+   _al_mutex_unlock(&mode_lists_mutex);
+
+   return n;
 }
 
 
@@ -31,8 +138,22 @@ int al_get_num_display_modes(void)
  */
 ALLEGRO_DISPLAY_MODE *al_get_display_mode(int index, ALLEGRO_DISPLAY_MODE *mode)
 {
-   ALLEGRO_SYSTEM *system = al_get_system_driver();
-   return system->vt->get_display_mode(index, mode);
+   MODE_LIST *list;
+   CACHED_MODE *cached;
+   bool valid;
+
+   _al_mutex_lock(&mode_lists_mutex);
+   list = get_mode_list();
+   if (index < 0 || index >= (int)_al_vector_size(&list->modes)) {
+      _al_mutex_unlock(&mode_lists_mutex);
+      return NULL;
+   }
+   cached = _al_vector_ref(&list->modes, index);
+   *mode = cached->mode;
+   valid = cached->valid;
+   _al_mutex_unlock(&mode_lists_mutex);
+
+   return valid ? mode : NULL;
 }
 
 
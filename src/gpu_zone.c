@@ -0,0 +1,225 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      GPU timer zones.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_vector.h"
+
+ALLEGRO_DEBUG_CHANNEL("display")
+
+/*
+ * Each al_begin_gpu_zone/al_end_gpu_zone pair takes a timer from the
+ * display's pool. The timer stays pending until the driver says its result
+ * is available, which is polled without waiting whenever a zone is begun or
+ * queried. A zone's time is therefore a few frames old, but measuring never
+ * stalls the pipeline. When the whole pool is pending new zones are dropped.
+ */
+#define MAX_GPU_TIMERS 64
+
+typedef struct GPU_ZONE
+{
+   ALLEGRO_USTR *name;
+   double seconds;
+   bool has_result;
+} GPU_ZONE;
+
+typedef struct GPU_TIMER
+{
+   void *timer;
+   int zone;
+   bool pending;
+} GPU_TIMER;
+
+
+void _al_init_gpu_zones(ALLEGRO_DISPLAY *display)
+{
+   _al_vector_init(&display->gpu_zones, sizeof(GPU_ZONE));
+   _al_vector_init(&display->gpu_timers, sizeof(GPU_TIMER));
+   display->open_gpu_timer = -1;
+}
+
+
+void _al_destroy_gpu_zones(ALLEGRO_DISPLAY *display)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&display->gpu_timers); i++) {
+      GPU_TIMER *t = _al_vector_ref(&display->gpu_timers, i);
+      display->vt->destroy_gpu_timer(display, t->timer);
+   }
+   for (i = 0; i < _al_vector_size(&display->gpu_zones); i++) {
+      GPU_ZONE *z = _al_vector_ref(&display->gpu_zones, i);
+      al_ustr_free(z->name);
+   }
+   _al_vector_free(&display->gpu_timers);
+   _al_vector_free(&display->gpu_zones);
+   display->open_gpu_timer = -1;
+}
+
+
+static int find_zone(ALLEGRO_DISPLAY *display, const char *name)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&display->gpu_zones); i++) {
+      GPU_ZONE *z = _al_vector_ref(&display->gpu_zones, i);
+      if (strcmp(al_cstr(z->name), name) == 0)
+         return i;
+   }
+   return -1;
+}
+
+
+static void collect_results(ALLEGRO_DISPLAY *display)
+{
+   unsigned int i;
+   double seconds;
+
+   for (i = 0; i < _al_vector_size(&display->gpu_timers); i++) {
+      GPU_TIMER *t = _al_vector_ref(&display->gpu_timers, i);
+      if (!t->pending)
+         continue;
+      if (!display->vt->get_gpu_timer_result(display, t->timer, &seconds))
+         continue;
+      t->pending = false;
+      /* Negative means the measurement was unreliable. */
+      if (seconds >= 0) {
+         GPU_ZONE *z = _al_vector_ref(&display->gpu_zones, t->zone);
+         z->seconds = seconds;
+         z->has_result = true;
+      }
+   }
+}
+
+
+static int get_free_timer(ALLEGRO_DISPLAY *display)
+{
+   unsigned int i;
+   GPU_TIMER *t;
+   void *timer;
+
+   for (i = 0; i < _al_vector_size(&display->gpu_timers); i++) {
+      t = _al_vector_ref(&display->gpu_timers, i);
+      if (!t->pending)
+         return i;
+   }
+
+   if (_al_vector_size(&display->gpu_timers) >= MAX_GPU_TIMERS)
+      return -1;
+
+   timer = display->vt->create_gpu_timer(display);
+   if (!timer)
+      return -1;
+   t = _al_vector_alloc_back(&display->gpu_timers);
+   t->timer = timer;
+   t->pending = false;
+   return _al_vector_size(&display->gpu_timers) - 1;
+}
+
+
+/* Function: al_begin_gpu_zone
+ */
+bool al_begin_gpu_zone(const char *name)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   GPU_TIMER *t;
+   int zone;
+   int i;
+   ASSERT(name);
+
+   if (!display || !display->vt->create_gpu_timer)
+      return false;
+   if (display->open_gpu_timer >= 0) {
+      ALLEGRO_WARN("GPU zone %s begun inside another zone.\n", name);
+      return false;
+   }
+
+   collect_results(display);
+
+   zone = find_zone(display, name);
+   if (zone < 0) {
+      GPU_ZONE *z = _al_vector_alloc_back(&display->gpu_zones);
+      z->name = al_ustr_new(name);
+      z->seconds = 0;
+      z->has_result = false;
+      zone = _al_vector_size(&display->gpu_zones) - 1;
+   }
+
+   i = get_free_timer(display);
+   if (i < 0)
+      return false;
+
+   /* Drawing held back so far belongs to whatever came before the zone. */
+   if (display->vt->flush_vertex_cache)
+      _al_flush_vertex_cache(display, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+
+   t = _al_vector_ref(&display->gpu_timers, i);
+   t->zone = zone;
+   display->vt->begin_gpu_timer(display, t->timer);
+   display->open_gpu_timer = i;
+   return true;
+}
+
+
+/* Function: al_end_gpu_zone
+ */
+void al_end_gpu_zone(void)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   GPU_TIMER *t;
+
+   if (!display || display->open_gpu_timer < 0)
+      return;
+
+   if (display->vt->flush_vertex_cache)
+      _al_flush_vertex_cache(display, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+
+   t = _al_vector_ref(&display->gpu_timers, display->open_gpu_timer);
+   display->vt->end_gpu_timer(display, t->timer);
+   t->pending = true;
+   display->open_gpu_timer = -1;
+}
+
+
+/* Function: al_get_gpu_zone_time
+ */
+bool al_get_gpu_zone_time(ALLEGRO_DISPLAY *display, const char *name,
+   double *seconds)
+{
+   GPU_ZONE *z;
+   int zone;
+   ASSERT(display);
+   ASSERT(name);
+   ASSERT(seconds);
+
+   if (!display->vt->create_gpu_timer)
+      return false;
+
+   /* The driver can only be asked from the display's own context. */
+   if (display == al_get_current_display())
+      collect_results(display);
+
+   zone = find_zone(display, name);
+   if (zone < 0)
+      return false;
+   z = _al_vector_ref(&display->gpu_zones, zone);
+   if (!z->has_result)
+      return false;
+   *seconds = z->seconds;
+   return true;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -134,7 +134,8 @@ static ALLEGRO_JOYSTICK_DRIVER iphone_joystick_driver = {
     ijoy_release_joystick,
     ijoy_get_joystick_state,
     ijoy_get_name,
-    ijoy_get_active
+    ijoy_get_active,
+    NULL
 };
 
 ALLEGRO_JOYSTICK_DRIVER *_al_get_iphone_joystick_driver(void)
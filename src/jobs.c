@@ -0,0 +1,647 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Job pools.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+/* Each worker thread owns a deque of runnable jobs. A worker pushes and
+ * pops at the bottom of its own deque, so recently submitted (and likely
+ * still cached) work is run first, and steals from the top of the other
+ * deques when its own is empty. Every deque has its own mutex, so workers
+ * only contend with each other when stealing.
+ *
+ * Jobs may wait for a counter to reach zero before they become runnable.
+ * Until then they sit on a list in the counter, and whoever brings the
+ * counter to zero pushes them.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_tls.h"
+
+ALLEGRO_DEBUG_CHANNEL("jobs")
+
+
+typedef struct JOB JOB;
+typedef struct WORKER WORKER;
+
+struct JOB {
+   void (*func)(void *arg);
+   void *arg;
+   ALLEGRO_JOB_POOL *pool;
+   ALLEGRO_JOB_COUNTER *done;
+   JOB *next;           /* in the waiting list of a counter */
+};
+
+struct WORKER {
+   ALLEGRO_JOB_POOL *pool;
+   _AL_THREAD thread;
+   _AL_MUTEX mutex;
+   JOB **jobs;          /* ring buffer, capacity is a power of two */
+   unsigned int capacity;
+   unsigned int top;    /* stolen from here */
+   unsigned int bottom; /* pushed and popped by the owner here */
+};
+
+struct ALLEGRO_JOB_POOL {
+   WORKER *workers;
+   int num_workers;
+   _AL_ATOMIC queued;   /* runnable jobs in all the deques */
+   _AL_ATOMIC next_worker;
+   _AL_MUTEX mutex;     /* idle workers sleep on cond */
+   _AL_COND cond;
+   bool quit;
+};
+
+struct ALLEGRO_JOB_COUNTER {
+   _AL_MUTEX mutex;
+   _AL_COND cond;
+   int count;
+   JOB *waiting;
+};
+
+
+/* Split al_parallel_for ranges into about this many chunks per worker, so
+ * uneven chunks still balance out.
+ */
+#define CHUNKS_PER_WORKER  4
+
+/* Jobs tend to come in bursts, so an idle worker polls for this many rounds
+ * before it goes to sleep, unless there is only one CPU to spin on.
+ */
+#define IDLE_SPINS         128
+
+static ALLEGRO_JOB_POOL *shared_pool = NULL;
+static _AL_MUTEX shared_pool_mutex = _AL_MUTEX_UNINITED;
+
+
+
+static WORKER *current_worker(ALLEGRO_JOB_POOL *pool)
+{
+   WORKER *worker = *_al_tls_get_job_worker();
+
+   if (worker && worker->pool == pool)
+      return worker;
+   return NULL;
+}
+
+
+
+static bool deque_push(WORKER *worker, JOB *job)
+{
+   _al_mutex_lock(&worker->mutex);
+
+   if (worker->bottom - worker->top == worker->capacity) {
+      unsigned int new_capacity = worker->capacity ? worker->capacity * 2 : 64;
+      JOB **jobs = al_malloc(new_capacity * sizeof *jobs);
+      unsigned int i;
+
+      if (!jobs) {
+         _al_mutex_unlock(&worker->mutex);
+         return false;
+      }
+      for (i = worker->top; i != worker->bottom; i++) {
+         jobs[i & (new_capacity - 1)] =
+            worker->jobs[i & (worker->capacity - 1)];
+      }
+      al_free(worker->jobs);
+      worker->jobs = jobs;
+      worker->capacity = new_capacity;
+   }
+
+   worker->jobs[worker->bottom & (worker->capacity - 1)] = job;
+   worker->bottom++;
+
+   _al_mutex_unlock(&worker->mutex);
+   return true;
+}
+
+
+
+static JOB *deque_pop(WORKER *worker)
+{
+   JOB *job = NULL;
+
+   _al_mutex_lock(&worker->mutex);
+   if (worker->bottom != worker->top) {
+      worker->bottom--;
+      job = worker->jobs[worker->bottom & (worker->capacity - 1)];
+   }
+   _al_mutex_unlock(&worker->mutex);
+
+   return job;
+}
+
+
+
+static JOB *deque_steal(WORKER *worker)
+{
+   JOB *job = NULL;
+
+   _al_mutex_lock(&worker->mutex);
+   if (worker->bottom != worker->top) {
+      job = worker->jobs[worker->top & (worker->capacity - 1)];
+      worker->top++;
+   }
+   _al_mutex_unlock(&worker->mutex);
+
+   return job;
+}
+
+
+
+/* Make a job runnable. Workers push onto their own deque, other threads
+ * spread their jobs over all the deques.
+ */
+static bool push_job(ALLEGRO_JOB_POOL *pool, JOB *job)
+{
+   WORKER *worker = current_worker(pool);
+
+   if (!worker) {
+      unsigned int i = (unsigned int)_al_fetch_and_add1(&pool->next_worker);
+      worker = &pool->workers[i % pool->num_workers];
+   }
+
+   if (!deque_push(worker, job))
+      return false;
+
+   _al_fetch_and_add1(&pool->queued);
+
+   _al_mutex_lock(&pool->mutex);
+   _al_cond_signal(&pool->cond);
+   _al_mutex_unlock(&pool->mutex);
+
+   return true;
+}
+
+
+
+static JOB *find_job(ALLEGRO_JOB_POOL *pool, WORKER *self)
+{
+   JOB *job = NULL;
+   int start = 0;
+   int i;
+
+   if (_al_atomic_load_acquire(&pool->queued) == 0)
+      return NULL;
+
+   if (self) {
+      job = deque_pop(self);
+      start = (int)(self - pool->workers) + 1;
+   }
+
+   for (i = 0; !job && i < pool->num_workers; i++) {
+      WORKER *victim = &pool->workers[(start + i) % pool->num_workers];
+      if (victim != self)
+         job = deque_steal(victim);
+   }
+
+   if (job)
+      _al_sub1_and_fetch(&pool->queued);
+   return job;
+}
+
+
+
+static void finish_job(ALLEGRO_JOB_COUNTER *counter)
+{
+   JOB *released = NULL;
+
+   _al_mutex_lock(&counter->mutex);
+   ASSERT(counter->count > 0);
+   if (--counter->count == 0) {
+      released = counter->waiting;
+      counter->waiting = NULL;
+      _al_cond_broadcast(&counter->cond);
+   }
+   _al_mutex_unlock(&counter->mutex);
+
+   /* The counter may be gone by now, only the released jobs are ours. */
+   while (released) {
+      JOB *job = released;
+      released = job->next;
+      if (!push_job(job->pool, job)) {
+         ALLEGRO_ERROR("Out of memory, running released job directly.\n");
+         job->func(job->arg);
+         if (job->done)
+            finish_job(job->done);
+         al_free(job);
+      }
+   }
+}
+
+
+
+static void run_job(JOB *job)
+{
+   ALLEGRO_JOB_COUNTER *done = job->done;
+
+   job->func(job->arg);
+   al_free(job);
+
+   if (done)
+      finish_job(done);
+}
+
+
+
+static void worker_proc(_AL_THREAD *thread, void *arg)
+{
+   WORKER *worker = arg;
+   ALLEGRO_JOB_POOL *pool = worker->pool;
+   int max_spins = al_get_cpu_count() > 1 ? IDLE_SPINS : 0;
+
+   _al_thread_set_name(thread, "al-job-worker");
+
+   *_al_tls_get_job_worker() = worker;
+
+   for (;;) {
+      JOB *job = find_job(pool, worker);
+      bool quit;
+      int spins;
+
+      if (job) {
+         run_job(job);
+         continue;
+      }
+
+      for (spins = 0; spins < max_spins; spins++) {
+         if (_al_atomic_load_acquire(&pool->queued) != 0)
+            break;
+         _al_spin_pause();
+      }
+      if (spins < max_spins)
+         continue;
+
+      _al_mutex_lock(&pool->mutex);
+      while (_al_atomic_load_acquire(&pool->queued) == 0 && !pool->quit)
+         _al_cond_wait(&pool->cond, &pool->mutex);
+      quit = pool->quit && _al_atomic_load_acquire(&pool->queued) == 0;
+      _al_mutex_unlock(&pool->mutex);
+
+      if (quit)
+         break;
+   }
+
+   *_al_tls_get_job_worker() = NULL;
+}
+
+
+
+static int default_num_workers(void)
+{
+   const char *value;
+   int num_workers = al_get_cpu_count();
+
+   if (num_workers < 1)
+      num_workers = 1;
+
+   value = al_get_config_value(al_get_system_config(), "jobs", "max_workers");
+   if (value && atoi(value) > 0 && num_workers > atoi(value))
+      num_workers = atoi(value);
+
+   return num_workers;
+}
+
+
+
+/* Function: al_create_job_pool
+ */
+ALLEGRO_JOB_POOL *al_create_job_pool(int num_workers)
+{
+   ALLEGRO_JOB_POOL *pool;
+   int i;
+
+   if (num_workers <= 0)
+      num_workers = default_num_workers();
+
+   pool = al_calloc(1, sizeof *pool);
+   if (!pool)
+      return NULL;
+   pool->workers = al_calloc(num_workers, sizeof *pool->workers);
+   if (!pool->workers) {
+      al_free(pool);
+      return NULL;
+   }
+   pool->num_workers = num_workers;
+   _al_mutex_init(&pool->mutex);
+   _al_cond_init(&pool->cond);
+
+   for (i = 0; i < num_workers; i++) {
+      pool->workers[i].pool = pool;
+      /* Deque operations are short, so spin rather than sleep. */
+      _al_mutex_init_adaptive(&pool->workers[i].mutex);
+   }
+   for (i = 0; i < num_workers; i++) {
+      _al_thread_create(&pool->workers[i].thread, worker_proc,
+         &pool->workers[i]);
+   }
+
+   ALLEGRO_DEBUG("Created job pool with %d workers.\n", num_workers);
+
+   return pool;
+}
+
+
+
+/* Function: al_destroy_job_pool
+ */
+void al_destroy_job_pool(ALLEGRO_JOB_POOL *pool)
+{
+   int i;
+
+   if (!pool)
+      return;
+
+   _al_mutex_lock(&pool->mutex);
+   pool->quit = true;
+   _al_cond_broadcast(&pool->cond);
+   _al_mutex_unlock(&pool->mutex);
+
+   for (i = 0; i < pool->num_workers; i++)
+      _al_thread_join(&pool->workers[i].thread);
+
+   ASSERT(pool->queued == 0);
+
+   for (i = 0; i < pool->num_workers; i++) {
+      _al_mutex_destroy(&pool->workers[i].mutex);
+      al_free(pool->workers[i].jobs);
+   }
+   _al_cond_destroy(&pool->cond);
+   _al_mutex_destroy(&pool->mutex);
+   al_free(pool->workers);
+   al_free(pool);
+}
+
+
+
+/* Function: al_get_job_pool_workers
+ */
+int al_get_job_pool_workers(const ALLEGRO_JOB_POOL *pool)
+{
+   ASSERT(pool);
+   return pool->num_workers;
+}
+
+
+
+/* Function: al_create_job_counter
+ */
+ALLEGRO_JOB_COUNTER *al_create_job_counter(void)
+{
+   ALLEGRO_JOB_COUNTER *counter = al_calloc(1, sizeof *counter);
+
+   if (!counter)
+      return NULL;
+   _al_mutex_init(&counter->mutex);
+   _al_cond_init(&counter->cond);
+   return counter;
+}
+
+
+
+/* Function: al_destroy_job_counter
+ */
+void al_destroy_job_counter(ALLEGRO_JOB_COUNTER *counter)
+{
+   if (!counter)
+      return;
+
+   ASSERT(counter->count == 0);
+   ASSERT(counter->waiting == NULL);
+
+   _al_cond_destroy(&counter->cond);
+   _al_mutex_destroy(&counter->mutex);
+   al_free(counter);
+}
+
+
+
+/* Function: al_get_job_counter_value
+ */
+int al_get_job_counter_value(ALLEGRO_JOB_COUNTER *counter)
+{
+   int count;
+
+   ASSERT(counter);
+
+   _al_mutex_lock(&counter->mutex);
+   count = counter->count;
+   _al_mutex_unlock(&counter->mutex);
+
+   return count;
+}
+
+
+
+/* Function: al_add_job
+ */
+bool al_add_job(ALLEGRO_JOB_POOL *pool, void (*func)(void *arg), void *arg,
+   ALLEGRO_JOB_COUNTER *after, ALLEGRO_JOB_COUNTER *done)
+{
+   JOB *job;
+
+   ASSERT(pool);
+   ASSERT(func);
+
+   job = al_malloc(sizeof *job);
+   if (!job)
+      return false;
+   job->func = func;
+   job->arg = arg;
+   job->pool = pool;
+   job->done = done;
+   job->next = NULL;
+
+   if (done) {
+      _al_mutex_lock(&done->mutex);
+      done->count++;
+      _al_mutex_unlock(&done->mutex);
+   }
+
+   if (after) {
+      _al_mutex_lock(&after->mutex);
+      if (after->count > 0) {
+         job->next = after->waiting;
+         after->waiting = job;
+         job = NULL;
+      }
+      _al_mutex_unlock(&after->mutex);
+   }
+
+   if (job && !push_job(pool, job)) {
+      al_free(job);
+      if (done)
+         finish_job(done);
+      return false;
+   }
+
+   return true;
+}
+
+
+
+/* Function: al_wait_for_job_counter
+ */
+void al_wait_for_job_counter(ALLEGRO_JOB_POOL *pool,
+   ALLEGRO_JOB_COUNTER *counter)
+{
+   WORKER *self;
+
+   ASSERT(pool);
+   ASSERT(counter);
+
+   self = current_worker(pool);
+
+   /* Rather than block, run other jobs in the meantime. This is also what
+    * keeps a job waiting on its own sub-jobs from deadlocking the pool.
+    */
+   while (al_get_job_counter_value(counter) > 0) {
+      JOB *job = find_job(pool, self);
+
+      if (job) {
+         run_job(job);
+         continue;
+      }
+
+      /* Nothing to steal; the remaining jobs are running elsewhere or
+       * waiting for another counter. Wake up now and then in case that
+       * changes.
+       */
+      _al_mutex_lock(&counter->mutex);
+      if (counter->count > 0) {
+         ALLEGRO_TIMEOUT timeout;
+         al_init_timeout(&timeout, 0.001);
+         _al_cond_timedwait(&counter->cond, &counter->mutex, &timeout);
+      }
+      _al_mutex_unlock(&counter->mutex);
+   }
+}
+
+
+
+typedef struct PARALLEL_FOR_CHUNK {
+   void (*func)(int begin, int end, void *arg);
+   void *arg;
+   int begin;
+   int end;
+} PARALLEL_FOR_CHUNK;
+
+
+static void parallel_for_job(void *arg)
+{
+   PARALLEL_FOR_CHUNK *chunk = arg;
+   chunk->func(chunk->begin, chunk->end, chunk->arg);
+}
+
+
+
+/* Function: al_parallel_for
+ */
+void al_parallel_for(ALLEGRO_JOB_POOL *pool, int begin, int end, int grain,
+   void (*func)(int begin, int end, void *arg), void *arg)
+{
+   ALLEGRO_JOB_COUNTER counter;
+   PARALLEL_FOR_CHUNK *chunks;
+   int num_chunks;
+   int i;
+
+   ASSERT(pool);
+   ASSERT(func);
+
+   if (end <= begin)
+      return;
+
+   if (grain <= 0) {
+      grain = (end - begin) / (pool->num_workers * CHUNKS_PER_WORKER);
+      if (grain < 1)
+         grain = 1;
+   }
+   num_chunks = (end - begin - 1) / grain + 1;
+
+   if (num_chunks == 1 ||
+         !(chunks = al_malloc(num_chunks * sizeof *chunks))) {
+      func(begin, end, arg);
+      return;
+   }
+
+   memset(&counter, 0, sizeof counter);
+   _al_mutex_init(&counter.mutex);
+   _al_cond_init(&counter.cond);
+
+   for (i = 0; i < num_chunks; i++) {
+      chunks[i].func = func;
+      chunks[i].arg = arg;
+      chunks[i].begin = begin + i * grain;
+      chunks[i].end = (i == num_chunks - 1) ? end : chunks[i].begin + grain;
+   }
+
+   /* The calling thread takes the first chunk itself. */
+   for (i = 1; i < num_chunks; i++) {
+      if (!al_add_job(pool, parallel_for_job, &chunks[i], NULL, &counter))
+         parallel_for_job(&chunks[i]);
+   }
+   parallel_for_job(&chunks[0]);
+
+   al_wait_for_job_counter(pool, &counter);
+
+   _al_cond_destroy(&counter.cond);
+   _al_mutex_destroy(&counter.mutex);
+   al_free(chunks);
+}
+
+
+
+static void shutdown_jobs(void)
+{
+   al_destroy_job_pool(shared_pool);
+   shared_pool = NULL;
+   _al_mutex_destroy(&shared_pool_mutex);
+}
+
+
+
+void _al_init_jobs(void)
+{
+   _al_mutex_init(&shared_pool_mutex);
+   _al_add_exit_func(shutdown_jobs, "shutdown_jobs");
+}
+
+
+
+/* Internal function: _al_get_job_pool
+ *  Returns the pool shared by Allegro's own subsystems and addons, creating
+ *  it on first use. It has the default number of workers.
+ */
+ALLEGRO_JOB_POOL *_al_get_job_pool(void)
+{
+   ALLEGRO_JOB_POOL *pool;
+
+   _al_mutex_lock(&shared_pool_mutex);
+   if (!shared_pool)
+      shared_pool = al_create_job_pool(0);
+   pool = shared_pool;
+   _al_mutex_unlock(&shared_pool_mutex);
+
+   return pool;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
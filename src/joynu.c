@@ -111,6 +111,16 @@ bool al_reconfigure_joysticks(void)
 
 
 
+/* Function: al_poll_joysticks
+ */
+void al_poll_joysticks(void)
+{
+   if (new_joystick_driver && new_joystick_driver->poll_joysticks)
+      new_joystick_driver->poll_joysticks();
+}
+
+
+
 /* Function: al_get_joystick_event_source
  */
 ALLEGRO_EVENT_SOURCE *al_get_joystick_event_source(void)
@@ -42,9 +42,10 @@
 #include <sys/types.h>
 #include <linux/input.h>
 
-#if defined(ALLEGRO_HAVE_SYS_INOTIFY_H)
+#if defined(ALLEGRO_HAVE_SYS_INOTIFY_H) && defined(ALLEGRO_HAVE_SYS_TIMERFD_H)
    #define SUPPORT_HOTPLUG
    #include <sys/inotify.h>
+   #include <sys/timerfd.h>
 #endif
 
 #ifndef KEY_CNT
@@ -123,20 +124,19 @@ ALLEGRO_JOYSTICK_DRIVER _al_joydrv_linux =
    ljoy_release_joystick,
    ljoy_get_joystick_state,
    ljoy_get_name,
-   ljoy_get_active
+   ljoy_get_active,
+   NULL
 };
 
 
 static unsigned num_joysticks;   /* number of joysticks known to the user */
 static _AL_VECTOR joysticks;     /* of ALLEGRO_JOYSTICK_LINUX pointers */
 static volatile bool config_needs_merging;
-static ALLEGRO_MUTEX *config_mutex;
+/* Taken for reading to look up joysticks, for writing to change the list. */
+static ALLEGRO_RWLOCK *config_lock;
 #ifdef SUPPORT_HOTPLUG
 static int inotify_fd = -1;
-static ALLEGRO_THREAD *hotplug_thread;
-static ALLEGRO_MUTEX *hotplug_mutex;
-static ALLEGRO_COND *hotplug_cond;
-static bool hotplug_ended = false;
+static int hotplug_timer_fd = -1;
 #endif
 
 
@@ -646,6 +646,7 @@ static void ljoy_merge(void)
 static void ljoy_config_dev_changed(void *data)
 {
    char buf[128];
+   struct itimerspec spec;
    (void)data;
 
    /* Empty the event buffer. We only care that some inotify event was sent but it
@@ -655,31 +656,42 @@ static void ljoy_config_dev_changed(void *data)
    while (read(inotify_fd, buf, sizeof(buf)) > 0) {
    }
 
-   al_signal_cond(hotplug_cond);
+   /* Devices take a moment to become usable after their node appears, so
+    * (re)start a one second timer and scan when it fires.
+    */
+   memset(&spec, 0, sizeof spec);
+   spec.it_value.tv_sec = 1;
+   timerfd_settime(hotplug_timer_fd, 0, &spec, NULL);
 }
 
-static void *hotplug_proc(ALLEGRO_THREAD *thread, void *data)
+
+
+/* ljoy_config_rescan: [fdwatch thread]
+ *  Called when the timer started by ljoy_config_dev_changed expires.
+ */
+static void ljoy_config_rescan(void *data)
 {
+   uint64_t expirations;
    (void)data;
 
-   while (!al_get_thread_should_stop(thread)) {
-      if (!hotplug_ended) {
-         al_wait_cond(hotplug_cond, hotplug_mutex);
-      }
-      if (hotplug_ended) {
-         break;
-      }
+   while (read(hotplug_timer_fd, &expirations, sizeof(expirations)) > 0) {
+   }
 
-      al_rest(1);
+   al_lock_rwlock_write(config_lock);
+   ljoy_scan(true);
+   al_unlock_rwlock_write(config_lock);
+}
 
-      al_lock_mutex(config_mutex);
-      ljoy_scan(true);
-      al_unlock_mutex(config_mutex);
-   }
 
-   hotplug_ended = false;
 
-   return NULL;
+/* ljoy_want_background_scan:
+ *  Whether the initial scan should be left to the fdwatch thread.
+ */
+static bool ljoy_want_background_scan(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(),
+      "joystick", "scan_in_background");
+   return value && atoi(value) != 0;
 }
 #endif
 
@@ -693,40 +705,36 @@ static bool ljoy_init_joystick(void)
    _al_vector_init(&joysticks, sizeof(ALLEGRO_JOYSTICK_LINUX *));
    num_joysticks = 0;
 
-   if (!(config_mutex = al_create_mutex())) {
+   if (!(config_lock = al_create_rwlock())) {
       return false;
    }
 
-   // Scan for joysticks
-   ljoy_scan(false);
-   ljoy_merge();
-
 #ifdef SUPPORT_HOTPLUG
-   if (!(hotplug_mutex = al_create_mutex())) {
-      al_destroy_mutex(config_mutex);
-      return false;
-   }
-   if (!(hotplug_cond = al_create_cond())) {
-      al_destroy_mutex(config_mutex);
-      al_destroy_mutex(hotplug_mutex);
-      return false;
-   }
-   if (!(hotplug_thread = al_create_thread(hotplug_proc, NULL))) {
-      al_destroy_mutex(config_mutex);
-      al_destroy_mutex(hotplug_mutex);
-      al_destroy_cond(hotplug_cond);
-      return false;
-   }
-
-   al_start_thread(hotplug_thread);
-
+   /* Both the inotify fd and the timer are served by the fdwatch thread,
+    * along with the joystick devices themselves.
+    */
    inotify_fd = inotify_init();
-   if (inotify_fd != -1) {
+   hotplug_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+   if (inotify_fd != -1 && hotplug_timer_fd != -1) {
       fcntl(inotify_fd, F_SETFL, O_NONBLOCK);
       /* Modern Linux probably only needs to monitor /dev/input. */
       inotify_add_watch(inotify_fd, "/dev/input", IN_CREATE|IN_DELETE);
       _al_unix_start_watching_fd(inotify_fd, ljoy_config_dev_changed, NULL);
+      _al_unix_start_watching_fd(hotplug_timer_fd, ljoy_config_rescan, NULL);
       ALLEGRO_INFO("Hotplugging enabled\n");
+
+      if (ljoy_want_background_scan()) {
+         /* Let the fdwatch thread do the first scan too, as if every
+          * device had just been plugged in. Opening some HID devices
+          * takes a long time, which we would otherwise spend here.
+          */
+         struct itimerspec spec;
+         memset(&spec, 0, sizeof spec);
+         spec.it_value.tv_nsec = 1;
+         timerfd_settime(hotplug_timer_fd, 0, &spec, NULL);
+         ALLEGRO_INFO("Scanning for joysticks in the background\n");
+         return true;
+      }
    }
    else {
       ALLEGRO_WARN("Hotplugging not enabled\n");
@@ -734,9 +742,19 @@ static bool ljoy_init_joystick(void)
          close(inotify_fd);
          inotify_fd = -1;
       }
+      if (hotplug_timer_fd != -1) {
+         close(hotplug_timer_fd);
+         hotplug_timer_fd = -1;
+      }
    }
 #endif
 
+   // Scan for joysticks
+   al_lock_rwlock_write(config_lock);
+   ljoy_scan(false);
+   ljoy_merge();
+   al_unlock_rwlock_write(config_lock);
+
    return true;
 }
 
@@ -755,13 +773,15 @@ static void ljoy_exit_joystick(void)
       close(inotify_fd);
       inotify_fd = -1;
    }
-   hotplug_ended = true;
-   al_signal_cond(hotplug_cond);
-   al_join_thread(hotplug_thread, NULL);
+   if (hotplug_timer_fd != -1) {
+      _al_unix_stop_watching_fd(hotplug_timer_fd);
+      close(hotplug_timer_fd);
+      hotplug_timer_fd = -1;
+   }
 #endif
 
-   al_destroy_mutex(config_mutex);
-   config_mutex = NULL;
+   al_destroy_rwlock(config_lock);
+   config_lock = NULL;
 
    for (i = 0; i < (int)_al_vector_size(&joysticks); i++) {
       ALLEGRO_JOYSTICK_LINUX **slot = _al_vector_ref(&joysticks, i);
@@ -780,14 +800,14 @@ static bool ljoy_reconfigure_joysticks(void)
 {
    bool ret = false;
 
-   al_lock_mutex(config_mutex);
+   al_lock_rwlock_write(config_lock);
 
    if (config_needs_merging) {
       ljoy_merge();
       ret = true;
    }
 
-   al_unlock_mutex(config_mutex);
+   al_unlock_rwlock_write(config_lock);
 
    return ret;
 }
@@ -816,7 +836,7 @@ static ALLEGRO_JOYSTICK *ljoy_get_joystick(int num)
    unsigned i;
    ASSERT(num >= 0);
 
-   al_lock_mutex(config_mutex);
+   al_lock_rwlock_write(config_lock);
 
    for (i = 0; i < _al_vector_size(&joysticks); i++) {
       ALLEGRO_JOYSTICK_LINUX **slot = _al_vector_ref(&joysticks, i);
@@ -831,7 +851,7 @@ static ALLEGRO_JOYSTICK *ljoy_get_joystick(int num)
       }
    }
 
-   al_unlock_mutex(config_mutex);
+   al_unlock_rwlock_write(config_lock);
 
    return ret;
 }
@@ -922,7 +942,7 @@ static void ljoy_process_new_data(void *data)
 
    _al_event_source_lock(es);
    {
-      struct input_event input_events[32];
+      struct input_event input_events[64];
       int bytes, nr, i;
 
       while ((bytes = read(joy->fd, &input_events, sizeof input_events)) > 0) {
@@ -387,7 +387,10 @@ static bool lkeybd_init_keyboard(void)
    /* Initialise the keyboard object for use as an event source. */
    _al_event_source_init(&the_keyboard.parent.es);
 
-   /* Start watching for data on the fd. */
+   /* Start watching for data on the fd. The callback reads until there is
+    * nothing left, so the fd must not block.
+    */
+   fcntl(the_keyboard.fd, F_SETFL, fcntl(the_keyboard.fd, F_GETFL) | O_NONBLOCK);
    _al_unix_start_watching_fd(the_keyboard.fd, process_new_data, NULL);
 
    /* Get the pid, which we use for the three finger salute */
@@ -501,12 +504,16 @@ static void process_new_data(void *unused)
    _al_event_source_lock(&the_keyboard.parent.es);
    {
       unsigned char buf[128];
-      size_t bytes_read;
-      unsigned int ch;
-
-      bytes_read = read(the_keyboard.fd, &buf, sizeof(buf));
-      for (ch = 0; ch < bytes_read; ch++)
-         process_character(buf[ch]);
+      ssize_t bytes_read;
+      ssize_t ch;
+
+      /* The fdwatch thread only calls us again for new data, so read
+       * everything there is.
+       */
+      while ((bytes_read = read(the_keyboard.fd, &buf, sizeof(buf))) > 0) {
+         for (ch = 0; ch < bytes_read; ch++)
+            process_character(buf[ch]);
+      }
    }
    _al_event_source_unlock(&the_keyboard.parent.es);
 
@@ -764,7 +764,7 @@ static void process_new_data(void *data)
    
    _al_event_source_lock(&the_mouse.parent.es);
    {
-      struct input_event events[32];
+      struct input_event events[64];
       int bytes, nr, i;
 
       while ((bytes = read(the_mouse.fd, &events, sizeof events)) > 0) {
@@ -33,6 +33,20 @@ static void _al_draw_transformed_scaled_bitmap_memory(
 static void _al_draw_bitmap_region_memory_fast(ALLEGRO_BITMAP *bitmap,
    int sx, int sy, int sw, int sh,
    int dx, int dy, int flags);
+static void _al_draw_bitmap_region_memory_blend(ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_COLOR tint, int sx, int sy, int sw, int sh, int dx, int dy);
+
+/* The default blender, which the span functions implement. */
+#define IS_PREMULTIPLIED_ALPHA_BLENDER \
+   (op == ALLEGRO_ADD && op_alpha == ALLEGRO_ADD && \
+   src_mode == ALLEGRO_ONE && src_alpha == ALLEGRO_ONE && \
+   dst_mode == ALLEGRO_INVERSE_ALPHA && dst_alpha == ALLEGRO_INVERSE_ALPHA)
+
+static bool is_span_format(int format)
+{
+   return format == ALLEGRO_PIXEL_FORMAT_ARGB_8888 ||
+      format == ALLEGRO_PIXEL_FORMAT_ABGR_8888;
+}
 
 
 /* The CLIPPER macro takes pre-clipped coordinates for both the source
@@ -130,6 +144,24 @@ static void _al_draw_bitmap_region_memory_fast(ALLEGRO_BITMAP *bitmap,
 }
 
 
+static bool is_translation(float *xtrans, float *ytrans)
+{
+   const ALLEGRO_TRANSFORM *trans;
+
+   /* The transform is a translation in x and y if its class is no more
+    * general than _AL_TRANSFORM_TRANSLATE. Translation in z makes no
+    * difference for memory bitmaps.
+    */
+   if (_al_get_current_transform_kind() > _AL_TRANSFORM_TRANSLATE)
+      return false;
+
+   trans = al_get_current_transform();
+   *xtrans = trans->m[3][0];
+   *ytrans = trans->m[3][1];
+   return true;
+}
+
+
 void _al_draw_bitmap_region_memory(ALLEGRO_BITMAP *src,
    ALLEGRO_COLOR tint,
    int sx, int sy, int sw, int sh,
@@ -145,13 +177,23 @@ void _al_draw_bitmap_region_memory(ALLEGRO_BITMAP *src,
       &src_mode, &dst_mode, &op_alpha, &src_alpha, &dst_alpha);
 
    if (_AL_DEST_IS_ZERO && _AL_SRC_NOT_MODIFIED_TINT_WHITE &&
-      _al_transform_is_translation(al_get_current_transform(), &xtrans, &ytrans))
+      is_translation(&xtrans, &ytrans))
    {
       _al_draw_bitmap_region_memory_fast(src, sx, sy, sw, sh,
          dx + xtrans, dy + ytrans, flags);
       return;
    }
 
+   if (flags == 0 && IS_PREMULTIPLIED_ALPHA_BLENDER &&
+      is_span_format(al_get_bitmap_format(src)) &&
+      al_get_bitmap_format(src) == al_get_bitmap_format(al_get_target_bitmap()) &&
+      is_translation(&xtrans, &ytrans))
+   {
+      _al_draw_bitmap_region_memory_blend(src, tint, sx, sy, sw, sh,
+         dx + xtrans, dy + ytrans);
+      return;
+   }
+
    /* We used to have special cases for translation/scaling only, but the
     * general version received much more optimisation and ended up being
     * faster.
@@ -292,11 +334,89 @@ static void _al_draw_bitmap_region_memory_fast(ALLEGRO_BITMAP *bitmap,
       return;
    }
 
-   /* will detect if no conversion is needed */
-   _al_convert_bitmap_data(
-      src_region->data, src_region->format, src_region->pitch,
-      dst_region->data, dst_region->format, dst_region->pitch,
-      0, 0, 0, 0, sw, sh);
+   if (is_span_format(src_region->format) &&
+         is_span_format(dst_region->format) &&
+         src_region->format != dst_region->format) {
+      int y;
+      for (y = 0; y < sh; y++) {
+         _al_blit_span_swap_rb_8888(
+            (uint32_t *)((char *)dst_region->data + y * dst_region->pitch),
+            (uint32_t *)((char *)src_region->data + y * src_region->pitch),
+            sw);
+      }
+   }
+   else {
+      /* will detect if no conversion is needed */
+      _al_convert_bitmap_data(
+         src_region->data, src_region->format, src_region->pitch,
+         dst_region->data, dst_region->format, dst_region->pitch,
+         0, 0, 0, 0, sw, sh);
+   }
+
+   al_unlock_bitmap(bitmap);
+   al_unlock_bitmap(dest);
+}
+
+
+/* The tint factors for each byte of a pixel, or NULL if there is no tint. */
+static const float *get_tint_factors(ALLEGRO_COLOR tint, int format,
+   float *factors)
+{
+   if (tint.r == 1 && tint.g == 1 && tint.b == 1 && tint.a == 1)
+      return NULL;
+
+   if (format == ALLEGRO_PIXEL_FORMAT_ARGB_8888) {
+      factors[0] = tint.b;
+      factors[2] = tint.r;
+   }
+   else {
+      factors[0] = tint.r;
+      factors[2] = tint.b;
+   }
+   factors[1] = tint.g;
+   factors[3] = tint.a;
+   return factors;
+}
+
+
+/* Untransformed drawing with the default blender, between two bitmaps of
+ * the same 32-bit format.
+ */
+static void _al_draw_bitmap_region_memory_blend(ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_COLOR tint, int sx, int sy, int sw, int sh, int dx, int dy)
+{
+   ALLEGRO_LOCKED_REGION *src_region;
+   ALLEGRO_LOCKED_REGION *dst_region;
+   ALLEGRO_BITMAP *dest = al_get_target_bitmap();
+   int format = al_get_bitmap_format(bitmap);
+   int dw = sw, dh = sh;
+   float factors[4];
+   const float *tint_factors;
+   int y;
+
+   ASSERT(bitmap->parent == NULL);
+   ASSERT(format == al_get_bitmap_format(dest));
+
+   CLIPPER(bitmap, sx, sy, sw, sh, dest, dx, dy, dw, dh, 1, 1, 0)
+
+   if (!(src_region = al_lock_bitmap_region(bitmap, sx, sy, sw, sh,
+         format, ALLEGRO_LOCK_READONLY))) {
+      return;
+   }
+
+   if (!(dst_region = al_lock_bitmap_region(dest, dx, dy, sw, sh,
+         format, ALLEGRO_LOCK_READWRITE))) {
+      al_unlock_bitmap(bitmap);
+      return;
+   }
+
+   tint_factors = get_tint_factors(tint, format, factors);
+   for (y = 0; y < sh; y++) {
+      _al_blit_span_blend_8888(
+         (uint32_t *)((char *)dst_region->data + y * dst_region->pitch),
+         (uint32_t *)((char *)src_region->data + y * src_region->pitch),
+         sw, tint_factors);
+   }
 
    al_unlock_bitmap(bitmap);
    al_unlock_bitmap(dest);
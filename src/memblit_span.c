@@ -0,0 +1,458 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Vectorised spans for memory bitmap drawing.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_cpu.h"
+#include "allegro5/internal/aintern_memblit.h"
+#include "allegro5/internal/aintern_pixels.h"
+
+/*
+ * These work on 32-bit pixels with alpha in the top byte, i.e. both
+ * ALLEGRO_PIXEL_FORMAT_ARGB_8888 and ALLEGRO_PIXEL_FORMAT_ABGR_8888. As the
+ * blend treats all colour channels alike, the order of the other three does
+ * not matter as long as source, destination and tint agree.
+ *
+ * The blend does the same float operations in the same order as the scanline
+ * drawers and _al_blend_alpha_inline, eight bit values divided by 255 and
+ * results truncated when multiplied back, so that pixels come out exactly as
+ * they did when these draws went through the triangle rasteriser.
+ *
+ * The vector versions are picked by _al_init_memblit_spans from
+ * al_get_cpu_features, so that 32-bit x86 builds can use SSE2 without
+ * requiring it. The scalar loops do the remaining pixels and everything on
+ * other CPUs.
+ */
+
+static INLINE uint32_t blend_pixel(uint32_t s, uint32_t d, const float *tint)
+{
+   float sc[4], inv;
+   uint32_t r = 0;
+   int c;
+
+   for (c = 0; c < 4; c++) {
+      sc[c] = _al_u8_to_float[(s >> (8 * c)) & 0xff];
+      if (tint)
+         sc[c] *= tint[c];
+   }
+   inv = 1 - sc[3];
+   for (c = 0; c < 4; c++) {
+      float dc = _al_u8_to_float[(d >> (8 * c)) & 0xff];
+      float rc = _ALLEGRO_MIN(1, sc[c] + dc * inv);
+      r |= (uint32_t)_al_fast_float_to_int(rc * 255) << (8 * c);
+   }
+   return r;
+}
+
+
+#ifdef _AL_SIMD_X86
+
+/* Channel c of four pixels as floats in [0, 1]. */
+#define CHANNEL_PS(p, c) \
+   _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32((p), 8 * (c)), \
+      _mm_set1_epi32(0xff))), _mm_set1_ps(255.0f))
+
+#endif
+
+
+static void swap_rb_scalar(uint32_t *dst, const uint32_t *src, int i, int n)
+{
+   for (; i < n; i++) {
+      uint32_t p = src[i];
+      dst[i] = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+   }
+}
+
+
+static void blend_scalar(uint32_t *dst, const uint32_t *src, int i, int n,
+   const float *tint)
+{
+   for (; i < n; i++)
+      dst[i] = blend_pixel(src[i], dst[i], tint);
+}
+
+
+static void swap_rb_generic(uint32_t *dst, const uint32_t *src, int n)
+{
+   swap_rb_scalar(dst, src, 0, n);
+}
+
+
+static void blend_generic(uint32_t *dst, const uint32_t *src, int n,
+   const float *tint)
+{
+   blend_scalar(dst, src, 0, n, tint);
+}
+
+
+static void gather_scalar(uint32_t *dst, const uint32_t *src, int pitch,
+   int32_t u, int32_t v, int32_t du, int32_t dv, int i, int n)
+{
+   u += i * du;
+   v += i * dv;
+   for (; i < n; i++) {
+      dst[i] = src[(v >> 16) * pitch + (u >> 16)];
+      u += du;
+      v += dv;
+   }
+}
+
+
+static void gather_generic(uint32_t *dst, const uint32_t *src, int pitch,
+   int32_t u, int32_t v, int32_t du, int32_t dv, int n)
+{
+   gather_scalar(dst, src, pitch, u, v, du, dv, 0, n);
+}
+
+
+/* Fills larger than this are done with non-temporal stores where we have
+ * them, as they would only push everything else out of the caches.
+ */
+static int64_t stream_fill_size = INT64_MAX;
+
+
+static void fill_generic(void *dst, int pitch, int w, int h, uint32_t value)
+{
+   unsigned char *line = dst;
+   bool bytes_equal = (value >> 8 == (value & 0xffffff));
+   int x, y;
+
+   for (y = 0; y < h; y++) {
+      uint32_t *p = (uint32_t *)line;
+      if (bytes_equal) {
+         memset(p, value & 0xff, w * 4);
+      }
+      else {
+         for (x = 0; x < w; x++)
+            p[x] = value;
+      }
+      line += pitch;
+   }
+}
+
+
+/* a + (b - a) * f / 256 for each byte, f in [0, 256]. */
+static INLINE uint32_t lerp_8888(uint32_t a, uint32_t b, uint32_t f)
+{
+   uint32_t rb = ((a & 0xff00ff) * (256 - f) + (b & 0xff00ff) * f +
+      0x800080) >> 8;
+   uint32_t ag = ((a >> 8) & 0xff00ff) * (256 - f) +
+      ((b >> 8) & 0xff00ff) * f + 0x800080;
+   return (rb & 0xff00ff) | (ag & 0xff00ff00);
+}
+
+
+void _al_blit_span_gather_linear_8888(uint32_t *dst, const uint32_t *src,
+   int pitch, int w, int h, int32_t u, int32_t v, int32_t du, int32_t dv,
+   int n)
+{
+   int i;
+
+   /* Sample between the four texels around each pixel centre. */
+   u -= 0x8000;
+   v -= 0x8000;
+   for (i = 0; i < n; i++) {
+      int x0 = u >> 16;
+      int y0 = v >> 16;
+      int x1 = _ALLEGRO_CLAMP(0, x0 + 1, w - 1);
+      int y1 = _ALLEGRO_CLAMP(0, y0 + 1, h - 1);
+      const uint32_t *row0, *row1;
+
+      x0 = _ALLEGRO_CLAMP(0, x0, w - 1);
+      y0 = _ALLEGRO_CLAMP(0, y0, h - 1);
+      row0 = src + y0 * pitch;
+      row1 = src + y1 * pitch;
+      dst[i] = lerp_8888(
+         lerp_8888(row0[x0], row0[x1], (u >> 8) & 0xff),
+         lerp_8888(row1[x0], row1[x1], (u >> 8) & 0xff),
+         (v >> 8) & 0xff);
+      u += du;
+      v += dv;
+   }
+}
+
+
+#ifdef _AL_SIMD_X86
+
+_AL_TARGET_SSE2
+static void swap_rb_sse2(uint32_t *dst, const uint32_t *src, int n)
+{
+   const __m128i ag = _mm_set1_epi32(0xff00ff00);
+   const __m128i lo = _mm_set1_epi32(0xff);
+   int i;
+
+   for (i = 0; i + 4 <= n; i += 4) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i r = _mm_or_si128(_mm_and_si128(p, ag),
+         _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), lo),
+            _mm_slli_epi32(_mm_and_si128(p, lo), 16)));
+      _mm_storeu_si128((__m128i *)(dst + i), r);
+   }
+   swap_rb_scalar(dst, src, i, n);
+}
+
+
+_AL_TARGET_SSE2
+static void blend_sse2(uint32_t *dst, const uint32_t *src, int n,
+   const float *tint)
+{
+   const __m128 one = _mm_set1_ps(1.0f);
+   const __m128 k255 = _mm_set1_ps(255.0f);
+   __m128 t[4];
+   int i, c;
+
+   for (c = 0; c < 4; c++)
+      t[c] = _mm_set1_ps(tint ? tint[c] : 1.0f);
+
+   for (i = 0; i + 4 <= n; i += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+      __m128 sc[4], dc[4], inv;
+      __m128i r = _mm_setzero_si128();
+
+      sc[0] = CHANNEL_PS(s, 0);
+      sc[1] = CHANNEL_PS(s, 1);
+      sc[2] = CHANNEL_PS(s, 2);
+      sc[3] = CHANNEL_PS(s, 3);
+      dc[0] = CHANNEL_PS(d, 0);
+      dc[1] = CHANNEL_PS(d, 1);
+      dc[2] = CHANNEL_PS(d, 2);
+      dc[3] = CHANNEL_PS(d, 3);
+      if (tint) {
+         for (c = 0; c < 4; c++)
+            sc[c] = _mm_mul_ps(sc[c], t[c]);
+      }
+      inv = _mm_sub_ps(one, sc[3]);
+
+      for (c = 0; c < 4; c++) {
+         __m128 rc = _mm_min_ps(one,
+            _mm_add_ps(sc[c], _mm_mul_ps(dc[c], inv)));
+         dc[c] = _mm_mul_ps(rc, k255);
+      }
+      r = _mm_cvttps_epi32(dc[0]);
+      r = _mm_or_si128(r, _mm_slli_epi32(_mm_cvttps_epi32(dc[1]), 8));
+      r = _mm_or_si128(r, _mm_slli_epi32(_mm_cvttps_epi32(dc[2]), 16));
+      r = _mm_or_si128(r, _mm_slli_epi32(_mm_cvttps_epi32(dc[3]), 24));
+      _mm_storeu_si128((__m128i *)(dst + i), r);
+   }
+   blend_scalar(dst, src, i, n, tint);
+}
+
+
+_AL_TARGET_SSE2
+static void fill_sse2(void *dst, int pitch, int w, int h, uint32_t value)
+{
+   const __m128i v = _mm_set1_epi32((int)value);
+   const bool stream = (int64_t)w * h * 4 >= stream_fill_size;
+   unsigned char *line = dst;
+   int x, y;
+
+   for (y = 0; y < h; y++) {
+      uint32_t *p = (uint32_t *)line;
+
+      x = 0;
+      while (x < w && ((uintptr_t)(p + x) & 15))
+         p[x++] = value;
+      if (stream) {
+         for (; x + 16 <= w; x += 16) {
+            _mm_stream_si128((__m128i *)(p + x), v);
+            _mm_stream_si128((__m128i *)(p + x + 4), v);
+            _mm_stream_si128((__m128i *)(p + x + 8), v);
+            _mm_stream_si128((__m128i *)(p + x + 12), v);
+         }
+      }
+      for (; x + 4 <= w; x += 4)
+         _mm_store_si128((__m128i *)(p + x), v);
+      for (; x < w; x++)
+         p[x] = value;
+      line += pitch;
+   }
+
+   if (stream)
+      _mm_sfence();
+}
+
+
+_AL_TARGET_AVX2
+static void gather_avx2(uint32_t *dst, const uint32_t *src, int pitch,
+   int32_t u, int32_t v, int32_t du, int32_t dv, int n)
+{
+   const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+   const __m256i vpitch = _mm256_set1_epi32(pitch);
+   const __m256i step_u = _mm256_set1_epi32(du * 8);
+   const __m256i step_v = _mm256_set1_epi32(dv * 8);
+   __m256i uu = _mm256_add_epi32(_mm256_set1_epi32(u),
+      _mm256_mullo_epi32(_mm256_set1_epi32(du), lanes));
+   __m256i vv = _mm256_add_epi32(_mm256_set1_epi32(v),
+      _mm256_mullo_epi32(_mm256_set1_epi32(dv), lanes));
+   int i;
+
+   for (i = 0; i + 8 <= n; i += 8) {
+      __m256i idx = _mm256_add_epi32(
+         _mm256_mullo_epi32(_mm256_srai_epi32(vv, 16), vpitch),
+         _mm256_srai_epi32(uu, 16));
+      __m256i p = _mm256_i32gather_epi32((const int *)src, idx, 4);
+      _mm256_storeu_si256((__m256i *)(dst + i), p);
+      uu = _mm256_add_epi32(uu, step_u);
+      vv = _mm256_add_epi32(vv, step_v);
+   }
+   gather_scalar(dst, src, pitch, u, v, du, dv, i, n);
+}
+
+#endif /* _AL_SIMD_X86 */
+
+
+#ifdef _AL_SIMD_NEON
+
+static void swap_rb_neon(uint32_t *dst, const uint32_t *src, int n)
+{
+   int i;
+
+   for (i = 0; i + 8 <= n; i += 8) {
+      uint8x8x4_t p = vld4_u8((const uint8_t *)(src + i));
+      uint8x8_t t = p.val[0];
+      p.val[0] = p.val[2];
+      p.val[2] = t;
+      vst4_u8((uint8_t *)(dst + i), p);
+   }
+   swap_rb_scalar(dst, src, i, n);
+}
+
+
+static void fill_neon(void *dst, int pitch, int w, int h, uint32_t value)
+{
+   const uint32x4_t v = vdupq_n_u32(value);
+   unsigned char *line = dst;
+   int x, y;
+
+   for (y = 0; y < h; y++) {
+      uint32_t *p = (uint32_t *)line;
+      for (x = 0; x + 4 <= w; x += 4)
+         vst1q_u32(p + x, v);
+      for (; x < w; x++)
+         p[x] = value;
+      line += pitch;
+   }
+}
+
+
+#ifdef __aarch64__
+
+/* Channel c of four pixels as floats in [0, 1]. */
+#define CHANNEL_F32(p, c) \
+   vdivq_f32(vcvtq_f32_u32(vandq_u32(vshrq_n_u32((p), 8 * (c)), \
+      vdupq_n_u32(0xff))), vdupq_n_f32(255.0f))
+
+static void blend_neon(uint32_t *dst, const uint32_t *src, int n,
+   const float *tint)
+{
+   const float32x4_t one = vdupq_n_f32(1.0f);
+   const float32x4_t k255 = vdupq_n_f32(255.0f);
+   int i, c;
+
+   for (i = 0; i + 4 <= n; i += 4) {
+      uint32x4_t s = vld1q_u32(src + i);
+      uint32x4_t d = vld1q_u32(dst + i);
+      float32x4_t sc[4], dc[4], inv;
+      uint32x4_t r;
+
+      sc[0] = vcvtq_f32_u32(vandq_u32(s, vdupq_n_u32(0xff)));
+      sc[0] = vdivq_f32(sc[0], k255);
+      sc[1] = CHANNEL_F32(s, 1);
+      sc[2] = CHANNEL_F32(s, 2);
+      sc[3] = vdivq_f32(vcvtq_f32_u32(vshrq_n_u32(s, 24)), k255);
+      dc[0] = vdivq_f32(vcvtq_f32_u32(vandq_u32(d, vdupq_n_u32(0xff))), k255);
+      dc[1] = CHANNEL_F32(d, 1);
+      dc[2] = CHANNEL_F32(d, 2);
+      dc[3] = vdivq_f32(vcvtq_f32_u32(vshrq_n_u32(d, 24)), k255);
+      if (tint) {
+         for (c = 0; c < 4; c++)
+            sc[c] = vmulq_f32(sc[c], vdupq_n_f32(tint[c]));
+      }
+      inv = vsubq_f32(one, sc[3]);
+
+      for (c = 0; c < 4; c++) {
+         float32x4_t rc = vminq_f32(one,
+            vaddq_f32(sc[c], vmulq_f32(dc[c], inv)));
+         dc[c] = vmulq_f32(rc, k255);
+      }
+      r = vcvtq_u32_f32(dc[0]);
+      r = vorrq_u32(r, vshlq_n_u32(vcvtq_u32_f32(dc[1]), 8));
+      r = vorrq_u32(r, vshlq_n_u32(vcvtq_u32_f32(dc[2]), 16));
+      r = vorrq_u32(r, vshlq_n_u32(vcvtq_u32_f32(dc[3]), 24));
+      vst1q_u32(dst + i, r);
+   }
+   blend_scalar(dst, src, i, n, tint);
+}
+
+#endif /* __aarch64__ */
+
+#endif /* _AL_SIMD_NEON */
+
+
+/* Converts between ARGB_8888 and ABGR_8888. */
+void (*_al_blit_span_swap_rb_8888)(uint32_t *dst, const uint32_t *src,
+   int n) = swap_rb_generic;
+
+/* Draws premultiplied src over dst, i.e. with the default blender. Unless
+ * tint is NULL the source is first multiplied by it, one factor for each
+ * byte of the pixel starting with the least significant.
+ */
+void (*_al_blit_span_blend_8888)(uint32_t *dst, const uint32_t *src, int n,
+   const float *tint) = blend_generic;
+
+
+/* Fetches the texels at n points starting at (u, v) and stepping by (du, dv),
+ * all 16.16 fixed point. pitch is in pixels. Every point must be inside the
+ * bitmap.
+ */
+void (*_al_blit_span_gather_8888)(uint32_t *dst, const uint32_t *src,
+   int pitch, int32_t u, int32_t v, int32_t du, int32_t dv,
+   int n) = gather_generic;
+
+
+/* Fills h rows of w 32-bit pixels with value. pitch is in bytes. */
+void (*_al_blit_fill_32)(void *dst, int pitch, int w, int h,
+   uint32_t value) = fill_generic;
+
+
+void _al_init_memblit_spans(void)
+{
+   int features = al_get_cpu_features();
+   int l2 = al_get_cpu_cache_size(2);
+   (void)features;
+
+   stream_fill_size = 4 * (int64_t)(l2 > 0 ? l2 : 1 << 20);
+
+#if defined(_AL_SIMD_X86)
+   if (features & ALLEGRO_CPU_SSE2) {
+      _al_blit_span_swap_rb_8888 = swap_rb_sse2;
+      _al_blit_span_blend_8888 = blend_sse2;
+      _al_blit_fill_32 = fill_sse2;
+   }
+   if (features & ALLEGRO_CPU_AVX2)
+      _al_blit_span_gather_8888 = gather_avx2;
+#elif defined(_AL_SIMD_NEON)
+   if (features & ALLEGRO_CPU_NEON) {
+      _al_blit_span_swap_rb_8888 = swap_rb_neon;
+      _al_blit_fill_32 = fill_neon;
+#ifdef __aarch64__
+      _al_blit_span_blend_8888 = blend_neon;
+#endif
+   }
+#endif
+}
+
+/* vim: set sts=3 sw=3 et: */
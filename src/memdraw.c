@@ -19,9 +19,12 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_blend.h"
+#include "allegro5/internal/aintern_memblit.h"
 #include "allegro5/internal/aintern_memdraw.h"
 #include "allegro5/internal/aintern_pixels.h"
 
+ALLEGRO_DEBUG_CHANNEL("memdraw")
+
 /* generic versions of the video memory access helpers */
 /* FIXME: why do we need macros for this? */
 #define bmp_write16(addr, c)        (*((uint16_t *)(addr)) = (c))
@@ -38,7 +41,7 @@ typedef struct {
 void _al_draw_pixel_memory(ALLEGRO_BITMAP *bitmap, float x, float y,
    ALLEGRO_COLOR *color)
 {
-   ALLEGRO_COLOR result;
+   _AL_BLENDER blender;
    int ix, iy;
    /*
     * Probably not worth it to check for identity
@@ -46,17 +49,72 @@ void _al_draw_pixel_memory(ALLEGRO_BITMAP *bitmap, float x, float y,
    al_transform_coordinates(al_get_current_transform(), &x, &y);
    ix = (int)x;
    iy = (int)y;
-   _al_blend_memory(color, bitmap, ix, iy, &result);
-   _al_put_pixel(bitmap, ix, iy, result);
+   _al_get_blender(&blender);
+   _al_blend_span_memory(&blender, color, bitmap, ix, iy, 1);
+}
+
+
+/* Fills h rows of w pixels of any size by writing the first pixel and then
+ * doubling it along the first row, which is then copied to the others.
+ */
+static void fill_by_copying(unsigned char *line_ptr, int pitch,
+   int pixel_size, int w, int h, const void *pixel)
+{
+   const int row_size = w * pixel_size;
+   unsigned char *first = line_ptr;
+   int n, y;
+
+   memcpy(first, pixel, pixel_size);
+   for (n = pixel_size; n < row_size; n *= 2)
+      memcpy(first + n, first, _ALLEGRO_MIN(n, row_size - n));
+
+   for (y = 1; y < h; y++) {
+      line_ptr += pitch;
+      memcpy(line_ptr, first, row_size);
+   }
+}
+
+
+/* 16-bit pixels are filled two at a time, except for a column on either side
+ * if the rows don't start or end on a 32-bit boundary.
+ */
+static void fill_16(unsigned char *line_ptr, int pitch, int w, int h,
+   uint16_t pixel_value)
+{
+   const uint32_t pair = pixel_value | ((uint32_t)pixel_value << 16);
+   const int rows = (pitch % 4 == 0) ? h : 1;
+   int x, y;
+
+   for (y = 0; y < h; y += rows) {
+      unsigned char *data = line_ptr + y * pitch;
+      int head = ((uintptr_t)data & 2) ? 1 : 0;
+      int pairs = (w - head) / 2;
+      int tail = w - head - pairs * 2;
+
+      for (x = 0; x < rows; x++) {
+         if (head)
+            bmp_write16(data + x * pitch, pixel_value);
+         if (tail)
+            bmp_write16(data + x * pitch + (w - 1) * 2, pixel_value);
+      }
+      if (pairs > 0)
+         _al_blit_fill_32(data + head * 2, pitch, pairs, rows, pair);
+   }
 }
 
 
 void _al_clear_bitmap_by_locking(ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR *color)
 {
+   ALLEGRO_BITMAP *parent = bitmap->parent ? bitmap->parent : bitmap;
    ALLEGRO_LOCKED_REGION *lr;
    int x1, y1, w, h;
-   int x, y;
    unsigned char *line_ptr;
+   bool unlock = false;
+   union {
+      uint16_t u16;
+      uint32_t u32;
+      float4 f4;
+   } pixel;
 
    /* This function is not just used on memory bitmaps, but also on OpenGL
     * video bitmaps which are not the current target, or when locked.
@@ -73,90 +131,68 @@ void _al_clear_bitmap_by_locking(ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR *color)
    if (w <= 0 || h <= 0)
       return;
 
-   /* XXX what about pre-locked bitmaps? */
-   lr = al_lock_bitmap_region(bitmap, x1, y1, w, h, ALLEGRO_PIXEL_FORMAT_ANY, 0);
-   if (!lr)
-      return;
+   if (parent->locked) {
+      /* Clear the part of the clipping rectangle that is locked. */
+      int x2, y2;
 
-   /* Write a single pixel so we can get the raw value. */
-   _al_put_pixel(bitmap, x1, y1, *color);
-
-   /* Fill in the region. */
-   line_ptr = lr->data;
-   switch (lr->pixel_size) {
-      case 2: {
-         int pixel_value = bmp_read16(line_ptr);
-         for (y = y1; y < y1 + h; y++) {
-            if (pixel_value == 0) {    /* fast path */
-               memset(line_ptr, 0, 2 * w);
-            }
-            else {
-               uint16_t *data = (uint16_t *)line_ptr;
-               for (x = 0; x < w; x++) {
-                  bmp_write16(data, pixel_value);
-                  data++;
-               }
-            }
-            line_ptr += lr->pitch;
-         }
-         break;
+      if (bitmap->parent) {
+         x1 += bitmap->xofs;
+         y1 += bitmap->yofs;
       }
+      x2 = _ALLEGRO_MIN(x1 + w, parent->lock_x + parent->lock_w);
+      y2 = _ALLEGRO_MIN(y1 + h, parent->lock_y + parent->lock_h);
+      x1 = _ALLEGRO_MAX(x1, parent->lock_x);
+      y1 = _ALLEGRO_MAX(y1, parent->lock_y);
+      w = x2 - x1;
+      h = y2 - y1;
+      if (w <= 0 || h <= 0)
+         return;
+
+      lr = &parent->locked_region;
+      if (_al_pixel_format_is_compressed(lr->format))
+         return;
+      line_ptr = (unsigned char *)lr->data +
+         (y1 - parent->lock_y) * lr->pitch +
+         (x1 - parent->lock_x) * lr->pixel_size;
+   }
+   else {
+      /* The whole region is overwritten, so there is no need to read it,
+       * except for compressed bitmaps which are locked in whole blocks.
+       */
+      int flags = _al_pixel_format_is_compressed(al_get_bitmap_format(bitmap)) ?
+         0 : ALLEGRO_LOCK_WRITEONLY;
+      lr = al_lock_bitmap_region(bitmap, x1, y1, w, h,
+         ALLEGRO_PIXEL_FORMAT_ANY, flags);
+      if (!lr)
+         return;
+      line_ptr = lr->data;
+      unlock = true;
+   }
 
-      case 3: {
-         int pixel_value = _AL_READ3BYTES(line_ptr);
-         for (y = y1; y < y1 + h; y++) {
-            unsigned char *data = (unsigned char *)line_ptr;
-            if (pixel_value == 0) {    /* fast path */
-               memset(data, 0, 3 * w);
-            }
-            else {
-               for (x = 0; x < w; x++) {
-                  _AL_WRITE3BYTES(data, pixel_value);
-                  data += 3;
-               }
-            }
-            line_ptr += lr->pitch;
-         }
-         break;
-      }
+   /* Get the raw value of a single pixel. */
+   {
+      unsigned char *data = (unsigned char *)&pixel;
+      _AL_INLINE_PUT_PIXEL(lr->format, data, (*color), false);
+   }
 
-      case 4: {
-         int pixel_value = bmp_read32(line_ptr);
-         for (y = y1; y < y1 + h; y++) {
-            uint32_t *data = (uint32_t *)line_ptr;
-            /* Special casing pixel_value == 0 doesn't seem to make any
-             * difference to speed, so don't bother.
-             */
-            for (x = 0; x < w; x++) {
-               bmp_write32(data, pixel_value);
-               data++;
-            }
-            line_ptr += lr->pitch;
-         }
+   /* Fill in the region. */
+   switch (lr->pixel_size) {
+      case 2:
+         fill_16(line_ptr, lr->pitch, w, h, pixel.u16);
          break;
-      }
 
-      case sizeof(float4): {
-         float4 *data = (float4 *)line_ptr;
-         float4 pixel_value = *data;
-
-         for (y = y1; y < y1 + h; y++) {
-            data = (float4 *)line_ptr;
-            for (x = 0; x < w; x++) {
-               *data = pixel_value;
-               data++;
-            }
-            line_ptr += lr->pitch;
-         }
+      case 4:
+         _al_blit_fill_32(line_ptr, lr->pitch, w, h, pixel.u32);
          break;
-      }
 
       default:
-        ASSERT(false);
-        break;
+         ASSERT(lr->pixel_size <= (int)sizeof(pixel));
+         fill_by_copying(line_ptr, lr->pitch, lr->pixel_size, w, h, &pixel);
+         break;
    }
 
-   al_unlock_bitmap(bitmap);
+   if (unlock)
+      al_unlock_bitmap(bitmap);
 }
 
 /* vim: set sts=3 sw=3 et: */
@@ -16,12 +16,247 @@
  */
 
 
+#include <string.h>
+
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_thread.h"
+
+
+/* Tracked blocks live in an open addressing hash table keyed by address,
+ * allocated with malloc() directly so that it is not tracked itself. Blocks
+ * allocated while tracking was off are simply not found when freed.
+ */
+typedef struct TRACKED_BLOCK {
+   void *ptr;
+   size_t size;
+   int tag;
+} TRACKED_BLOCK;
+
+#define TAG_CACHE_SIZE  64
 
 
 /* globals */
 static ALLEGRO_MEMORY_INTERFACE *mem = NULL;
 
+static struct {
+   bool enabled;
+   bool inited;         /* the mutex is usable; never reset */
+   _AL_MUTEX mutex;
+   TRACKED_BLOCK *blocks;
+   size_t capacity;     /* zero or a power of two */
+   size_t count;
+   ALLEGRO_MEMORY_SNAPSHOT stats;
+   struct {
+      const char *file;
+      int tag;
+   } tag_cache[TAG_CACHE_SIZE];
+} track;
+
+static const char *tag_names[ALLEGRO_NUM_MEMORY_TAGS] = {
+   "other",
+   "bitmap",
+   "audio",
+   "font",
+   "primitives",
+   "events"
+};
+
+
+
+/* Works out the subsystem from the path of the source file. */
+static int tag_from_path(const char *file)
+{
+   static const char *bitmap_files[] = {
+      "bitmap", "blenders", "convert", "memblit", "memdraw", "pixels",
+      "tri_soft", "ogl_bitmap", "ogl_fbo", "ogl_lock", "ogl_upload",
+      "d3d_bmp", "d3d_lock", NULL
+   };
+   const char *base;
+   const char *addon;
+   const char *p;
+   int i;
+
+   if (!file)
+      return ALLEGRO_MEMORY_TAG_OTHER;
+
+   base = file;
+   for (p = file; *p; p++) {
+      if (*p == '/' || *p == '\\')
+         base = p + 1;
+   }
+
+   addon = strstr(file, "addons");
+   if (addon && (addon[6] == '/' || addon[6] == '\\')) {
+      addon += 7;
+      if (!strncmp(addon, "audio", 5) || !strncmp(addon, "acodec", 6))
+         return ALLEGRO_MEMORY_TAG_AUDIO;
+      if (!strncmp(addon, "font", 4) || !strncmp(addon, "ttf", 3))
+         return ALLEGRO_MEMORY_TAG_FONT;
+      if (!strncmp(addon, "primitives", 10))
+         return ALLEGRO_MEMORY_TAG_PRIMITIVES;
+      if (!strncmp(addon, "image", 5))
+         return ALLEGRO_MEMORY_TAG_BITMAP;
+      return ALLEGRO_MEMORY_TAG_OTHER;
+   }
+
+   for (i = 0; bitmap_files[i]; i++) {
+      if (!strncmp(base, bitmap_files[i], strlen(bitmap_files[i])))
+         return ALLEGRO_MEMORY_TAG_BITMAP;
+   }
+   if (!strcmp(base, "events.c") || !strcmp(base, "evtsrc.c"))
+      return ALLEGRO_MEMORY_TAG_EVENTS;
+
+   return ALLEGRO_MEMORY_TAG_OTHER;
+}
+
+
+
+/* file is normally __FILE__, which is the same pointer for every call from
+ * one source file, so remember the tags by pointer.
+ */
+static int get_tag(const char *file)
+{
+   int i = ((uintptr_t)file >> 4) % TAG_CACHE_SIZE;
+
+   if (!file || track.tag_cache[i].file != file) {
+      track.tag_cache[i].file = file;
+      track.tag_cache[i].tag = tag_from_path(file);
+   }
+   return track.tag_cache[i].tag;
+}
+
+
+
+static size_t slot_of(const void *ptr)
+{
+   uintptr_t h = (uintptr_t)ptr;
+   h ^= h >> 17;
+   h *= 0x9E3779B1u;
+   return (h ^ (h >> 15)) & (track.capacity - 1);
+}
+
+
+
+static bool grow_blocks(void)
+{
+   size_t capacity = track.capacity ? track.capacity * 2 : 1024;
+   TRACKED_BLOCK *old = track.blocks;
+   size_t old_capacity = track.capacity;
+   size_t i;
+
+   track.blocks = calloc(capacity, sizeof *track.blocks);
+   if (!track.blocks) {
+      track.blocks = old;
+      return false;
+   }
+   track.capacity = capacity;
+
+   for (i = 0; i < old_capacity; i++) {
+      if (old[i].ptr) {
+         size_t j = slot_of(old[i].ptr);
+         while (track.blocks[j].ptr)
+            j = (j + 1) & (capacity - 1);
+         track.blocks[j] = old[i];
+      }
+   }
+   free(old);
+   return true;
+}
+
+
+
+static void count_alloc(ALLEGRO_MEMORY_USAGE *u, size_t size)
+{
+   u->live_bytes += size;
+   u->live_allocations++;
+   u->total_allocations++;
+   if (u->live_bytes > u->peak_bytes)
+      u->peak_bytes = u->live_bytes;
+}
+
+
+
+/* Must be called with the mutex held. */
+static void add_block(void *ptr, size_t size, int tag)
+{
+   size_t i;
+
+   if ((track.count + 1) * 2 > track.capacity && !grow_blocks())
+      return;
+
+   i = slot_of(ptr);
+   while (track.blocks[i].ptr)
+      i = (i + 1) & (track.capacity - 1);
+   track.blocks[i].ptr = ptr;
+   track.blocks[i].size = size;
+   track.blocks[i].tag = tag;
+   track.count++;
+
+   count_alloc(&track.stats.tags[tag], size);
+   count_alloc(&track.stats.total, size);
+}
+
+
+
+/* Must be called with the mutex held. Returns false if ptr is not tracked.
+ */
+static bool remove_block(void *ptr, TRACKED_BLOCK *out)
+{
+   size_t mask = track.capacity - 1;
+   size_t i, j;
+
+   if (track.count == 0)
+      return false;
+
+   for (i = slot_of(ptr); track.blocks[i].ptr != ptr; i = (i + 1) & mask) {
+      if (!track.blocks[i].ptr)
+         return false;
+   }
+   *out = track.blocks[i];
+   track.count--;
+   track.stats.tags[out->tag].live_bytes -= out->size;
+   track.stats.tags[out->tag].live_allocations--;
+   track.stats.total.live_bytes -= out->size;
+   track.stats.total.live_allocations--;
+
+   /* Move later blocks of the same run back, so no run has a hole. */
+   for (j = (i + 1) & mask; track.blocks[j].ptr; j = (j + 1) & mask) {
+      size_t home = slot_of(track.blocks[j].ptr);
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+         track.blocks[i] = track.blocks[j];
+         i = j;
+      }
+   }
+   track.blocks[i].ptr = NULL;
+   return true;
+}
+
+
+
+static void track_alloc(void *ptr, size_t size, const char *file)
+{
+   if (!ptr)
+      return;
+   _al_mutex_lock(&track.mutex);
+   if (track.enabled)
+      add_block(ptr, size, get_tag(file));
+   _al_mutex_unlock(&track.mutex);
+}
+
+
+
+static void track_free(void *ptr)
+{
+   TRACKED_BLOCK b;
+
+   if (!ptr)
+      return;
+   _al_mutex_lock(&track.mutex);
+   remove_block(ptr, &b);
+   _al_mutex_unlock(&track.mutex);
+}
+
 
 
 /* Function: al_set_memory_interface
@@ -38,10 +273,16 @@ void al_set_memory_interface(ALLEGRO_MEMORY_INTERFACE *memory_interface)
 void *al_malloc_with_context(size_t n,
    int line, const char *file, const char *func)
 {
+   void *ptr;
+
    if (mem)
-      return mem->mi_malloc(n, line, file, func);
+      ptr = mem->mi_malloc(n, line, file, func);
    else
-      return malloc(n);
+      ptr = malloc(n);
+
+   if (track.enabled)
+      track_alloc(ptr, n, file);
+   return ptr;
 }
 
 
@@ -51,6 +292,12 @@ void *al_malloc_with_context(size_t n,
 void al_free_with_context(void *ptr,
    int line, const char *file, const char *func)
 {
+   /* Forget the block before it is freed, as another thread could be given
+    * the same address straight after.
+    */
+   if (track.inited)
+      track_free(ptr);
+
    if (mem)
       mem->mi_free(ptr, line, file, func);
    else
@@ -64,10 +311,37 @@ void al_free_with_context(void *ptr,
 void *al_realloc_with_context(void *ptr, size_t n,
    int line, const char *file, const char *func)
 {
+   TRACKED_BLOCK old;
+   bool tracked = false;
+   void *ret;
+
+   if (track.inited && ptr) {
+      _al_mutex_lock(&track.mutex);
+      tracked = remove_block(ptr, &old);
+      _al_mutex_unlock(&track.mutex);
+   }
+
    if (mem)
-      return mem->mi_realloc(ptr, n, line, file, func);
+      ret = mem->mi_realloc(ptr, n, line, file, func);
    else
-      return realloc(ptr, n);
+      ret = realloc(ptr, n);
+
+   if (ret) {
+      if (track.enabled) {
+         _al_mutex_lock(&track.mutex);
+         if (track.enabled)
+            add_block(ret, n, tracked ? old.tag : get_tag(file));
+         _al_mutex_unlock(&track.mutex);
+      }
+   }
+   else if (tracked && n > 0) {
+      /* The old block is still there. */
+      _al_mutex_lock(&track.mutex);
+      if (track.enabled)
+         add_block(ptr, old.size, old.tag);
+      _al_mutex_unlock(&track.mutex);
+   }
+   return ret;
 }
 
 
@@ -77,10 +351,110 @@ void *al_realloc_with_context(void *ptr, size_t n,
 void *al_calloc_with_context(size_t count, size_t n,
    int line, const char *file, const char *func)
 {
+   void *ptr;
+
    if (mem)
-      return mem->mi_calloc(count, n, line, file, func);
+      ptr = mem->mi_calloc(count, n, line, file, func);
    else
-      return calloc(count, n);
+      ptr = calloc(count, n);
+
+   if (track.enabled)
+      track_alloc(ptr, count * n, file);
+   return ptr;
+}
+
+
+
+/* Function: al_set_memory_tracking
+ */
+void al_set_memory_tracking(bool enable)
+{
+   if (!track.inited) {
+      if (!enable)
+         return;
+      _al_mutex_init(&track.mutex);
+      track.inited = true;
+   }
+
+   _al_mutex_lock(&track.mutex);
+   if (enable && !track.enabled) {
+      memset(&track.stats, 0, sizeof track.stats);
+   }
+   else if (!enable) {
+      free(track.blocks);
+      track.blocks = NULL;
+      track.capacity = 0;
+      track.count = 0;
+   }
+   track.enabled = enable;
+   _al_mutex_unlock(&track.mutex);
+}
+
+
+
+/* Function: al_get_memory_tracking
+ */
+bool al_get_memory_tracking(void)
+{
+   return track.enabled;
+}
+
+
+
+/* Function: al_get_memory_snapshot
+ */
+void al_get_memory_snapshot(ALLEGRO_MEMORY_SNAPSHOT *snapshot)
+{
+   ASSERT(snapshot);
+
+   if (!track.inited) {
+      memset(snapshot, 0, sizeof *snapshot);
+      return;
+   }
+
+   _al_mutex_lock(&track.mutex);
+   *snapshot = track.stats;
+   _al_mutex_unlock(&track.mutex);
+}
+
+
+
+static void diff_usage(const ALLEGRO_MEMORY_USAGE *before,
+   const ALLEGRO_MEMORY_USAGE *after, ALLEGRO_MEMORY_USAGE *diff)
+{
+   diff->live_bytes = after->live_bytes - before->live_bytes;
+   diff->peak_bytes = after->peak_bytes - before->peak_bytes;
+   diff->live_allocations = after->live_allocations - before->live_allocations;
+   diff->total_allocations = after->total_allocations -
+      before->total_allocations;
+}
+
+
+
+/* Function: al_diff_memory_snapshots
+ */
+void al_diff_memory_snapshots(const ALLEGRO_MEMORY_SNAPSHOT *before,
+   const ALLEGRO_MEMORY_SNAPSHOT *after, ALLEGRO_MEMORY_SNAPSHOT *diff)
+{
+   int i;
+   ASSERT(before);
+   ASSERT(after);
+   ASSERT(diff);
+
+   for (i = 0; i < ALLEGRO_NUM_MEMORY_TAGS; i++)
+      diff_usage(&before->tags[i], &after->tags[i], &diff->tags[i]);
+   diff_usage(&before->total, &after->total, &diff->total);
+}
+
+
+
+/* Function: al_get_memory_tag_name
+ */
+const char *al_get_memory_tag_name(ALLEGRO_MEMORY_TAG tag)
+{
+   if (tag < 0 || tag >= ALLEGRO_NUM_MEMORY_TAGS)
+      return NULL;
+   return tag_names[tag];
 }
 
 
@@ -0,0 +1,277 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Fixed size memory pools.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+/* Objects are carved out of large chunks and kept on free lists. Each
+ * thread keeps a few free objects of each pool it uses, so most allocations
+ * and frees touch no lock; objects move between a thread and the pool's
+ * shared free list in batches.
+ *
+ * The per-thread caches belong to the pools, which free them when they are
+ * destroyed. A thread finds its caches through a small table in its thread
+ * local state, indexed by the pool's serial number. The serial number also
+ * tells apart a pool from an earlier one at the same address. If two pools
+ * a thread uses share a table entry, the thread finds its cache again by
+ * searching the pool's list of caches. Objects cached by a thread which has
+ * exited stay in their pool until it is destroyed, unless a new thread
+ * happens to take over the same table.
+ */
+
+
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_tls.h"
+
+#define CHUNK_SIZE      16384
+#define OBJECT_ALIGN    16
+#define CACHE_BATCH     16    /* objects moved at once */
+#define CACHE_MAX       32    /* objects a thread keeps before giving back */
+#define THREAD_CACHES   8     /* entries in each thread's table */
+
+
+typedef struct POOL_OBJECT {
+   struct POOL_OBJECT *next;
+} POOL_OBJECT;
+
+/* The free objects of one pool cached by one thread. */
+typedef struct POOL_CACHE {
+   void *owner;               /* the thread's table */
+   POOL_OBJECT *head;
+   int count;
+   struct POOL_CACHE *next;   /* the pool's next cache */
+} POOL_CACHE;
+
+typedef struct THREAD_CACHE {
+   ALLEGRO_MEMORY_POOL *pool;
+   int serial;
+   POOL_CACHE *cache;
+} THREAD_CACHE;
+
+struct ALLEGRO_MEMORY_POOL {
+   _AL_MUTEX mutex;
+   size_t object_size;
+   int serial;
+   POOL_OBJECT *free_list;
+   void *chunks;              /* each starts with a pointer to the next */
+   POOL_CACHE *caches;
+};
+
+
+static volatile _AL_ATOMIC next_serial = 0;
+
+
+
+/* Must be called with the mutex held. */
+static bool add_chunk(ALLEGRO_MEMORY_POOL *pool)
+{
+   size_t n = (CHUNK_SIZE - OBJECT_ALIGN) / pool->object_size;
+   char *chunk;
+   char *p;
+   size_t i;
+
+   if (n < CACHE_BATCH)
+      n = CACHE_BATCH;
+
+   chunk = al_malloc(OBJECT_ALIGN + n * pool->object_size);
+   if (!chunk)
+      return false;
+   *(void **)chunk = pool->chunks;
+   pool->chunks = chunk;
+
+   p = chunk + OBJECT_ALIGN;
+   for (i = 0; i < n; i++, p += pool->object_size) {
+      POOL_OBJECT *obj = (POOL_OBJECT *)p;
+      obj->next = pool->free_list;
+      pool->free_list = obj;
+   }
+   return true;
+}
+
+
+
+/* Returns the calling thread's cache for the pool, or NULL if the thread
+ * local state is not available.
+ */
+static POOL_CACHE *get_cache(ALLEGRO_MEMORY_POOL *pool)
+{
+   void **table_ptr = _al_tls_get_pool_caches();
+   THREAD_CACHE *table;
+   THREAD_CACHE *entry;
+   POOL_CACHE *cache;
+
+   if (!table_ptr)
+      return NULL;
+   if (!*table_ptr) {
+      *table_ptr = al_calloc(THREAD_CACHES, sizeof(THREAD_CACHE));
+      if (!*table_ptr)
+         return NULL;
+   }
+   table = *table_ptr;
+
+   entry = &table[pool->serial % THREAD_CACHES];
+   if (entry->pool == pool && entry->serial == pool->serial)
+      return entry->cache;
+
+   _al_mutex_lock(&pool->mutex);
+   for (cache = pool->caches; cache; cache = cache->next) {
+      if (cache->owner == table)
+         break;
+   }
+   if (!cache) {
+      cache = al_calloc(1, sizeof *cache);
+      if (cache) {
+         cache->owner = table;
+         cache->next = pool->caches;
+         pool->caches = cache;
+      }
+   }
+   _al_mutex_unlock(&pool->mutex);
+
+   if (cache) {
+      entry->pool = pool;
+      entry->serial = pool->serial;
+      entry->cache = cache;
+   }
+   return cache;
+}
+
+
+
+/* Function: al_create_memory_pool
+ */
+ALLEGRO_MEMORY_POOL *al_create_memory_pool(size_t object_size)
+{
+   ALLEGRO_MEMORY_POOL *pool;
+
+   pool = al_calloc(1, sizeof *pool);
+   if (!pool)
+      return NULL;
+
+   if (object_size < sizeof(POOL_OBJECT))
+      object_size = sizeof(POOL_OBJECT);
+   pool->object_size = (object_size + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1);
+   pool->serial = _al_fetch_and_add1(&next_serial) + 1;
+   _al_mutex_init(&pool->mutex);
+
+   return pool;
+}
+
+
+
+/* Function: al_destroy_memory_pool
+ */
+void al_destroy_memory_pool(ALLEGRO_MEMORY_POOL *pool)
+{
+   if (!pool)
+      return;
+
+   while (pool->caches) {
+      POOL_CACHE *next = pool->caches->next;
+      al_free(pool->caches);
+      pool->caches = next;
+   }
+   while (pool->chunks) {
+      void *next = *(void **)pool->chunks;
+      al_free(pool->chunks);
+      pool->chunks = next;
+   }
+   _al_mutex_destroy(&pool->mutex);
+   al_free(pool);
+}
+
+
+
+/* Function: al_alloc_from_memory_pool
+ */
+void *al_alloc_from_memory_pool(ALLEGRO_MEMORY_POOL *pool)
+{
+   POOL_CACHE *cache;
+   POOL_OBJECT *obj;
+   ASSERT(pool);
+
+   cache = get_cache(pool);
+   if (cache && cache->head) {
+      obj = cache->head;
+      cache->head = obj->next;
+      cache->count--;
+      return obj;
+   }
+
+   _al_mutex_lock(&pool->mutex);
+   if (!pool->free_list && !add_chunk(pool)) {
+      _al_mutex_unlock(&pool->mutex);
+      return NULL;
+   }
+   obj = pool->free_list;
+   pool->free_list = obj->next;
+   if (cache) {
+      /* Take a batch for later. */
+      while (pool->free_list && cache->count < CACHE_BATCH) {
+         POOL_OBJECT *o = pool->free_list;
+         pool->free_list = o->next;
+         o->next = cache->head;
+         cache->head = o;
+         cache->count++;
+      }
+   }
+   _al_mutex_unlock(&pool->mutex);
+
+   return obj;
+}
+
+
+
+/* Function: al_free_to_memory_pool
+ */
+void al_free_to_memory_pool(ALLEGRO_MEMORY_POOL *pool, void *ptr)
+{
+   POOL_CACHE *cache;
+   POOL_OBJECT *obj = ptr;
+   ASSERT(pool);
+
+   if (!ptr)
+      return;
+
+   cache = get_cache(pool);
+   if (cache) {
+      obj->next = cache->head;
+      cache->head = obj;
+      if (++cache->count <= CACHE_MAX)
+         return;
+
+      /* Give a batch back, keeping the most recently freed objects. */
+      _al_mutex_lock(&pool->mutex);
+      while (cache->count > CACHE_MAX - CACHE_BATCH) {
+         POOL_OBJECT *o = cache->head->next;
+         cache->head->next = o->next;
+         o->next = pool->free_list;
+         pool->free_list = o;
+         cache->count--;
+      }
+      _al_mutex_unlock(&pool->mutex);
+      return;
+   }
+
+   _al_mutex_lock(&pool->mutex);
+   obj->next = pool->free_list;
+   pool->free_list = obj;
+   _al_mutex_unlock(&pool->mutex);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -97,6 +97,33 @@ static int snapUpSize (int i) {
 	return i;
 }
 
+/* Allegro: strings whose buffer is no bigger than this are allocated in one
+   block with their header, with data pointing just past it.  Growing such a
+   string moves its data to a separate block. */
+#define BSTR_INLINE_MAX 32
+
+#define bstr__isinline(b) ((b)->data == (unsigned char *) ((b) + 1))
+
+static _al_bstring bstr__new (int mlen) {
+_al_bstring b;
+
+	if (mlen <= BSTR_INLINE_MAX) {
+		b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring) + mlen);
+		if (b == NULL) return NULL;
+		b->data = (unsigned char *) (b + 1);
+	} else {
+		b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+		if (b == NULL) return NULL;
+		b->data = (unsigned char *) bstr__alloc ((size_t) mlen);
+		if (b->data == NULL) {
+			bstr__free (b);
+			return NULL;
+		}
+	}
+	b->mlen = mlen;
+	return b;
+}
+
 /*  int _al_balloc (_al_bstring b, int len)
  *
  *  Increase the size of the memory backing the _al_bstring b to at least len.
@@ -113,8 +140,20 @@ int _al_balloc (_al_bstring b, int olen) {
 
 		if ((len = snapUpSize (olen)) <= b->mlen) return _AL_BSTR_OK;
 
+		if (bstr__isinline (b)) {
+
+			/* The data can't be reallocated along with the header, as
+			   the header must not move */
+
+			if (NULL == (x = (unsigned char *) bstr__alloc ((size_t) len))) {
+				if (NULL == (x = (unsigned char *) bstr__alloc ((size_t) (len = olen)))) {
+					return _AL_BSTR_ERR;
+				}
+			}
+			if (b->slen) bstr__memcpy ((char *) x, (char *) b->data, (size_t) b->slen);
+
 		/* Assume probability of a non-moving realloc is 0.125 */
-		if (7 * b->mlen < 8 * b->slen) {
+		} else if (7 * b->mlen < 8 * b->slen) {
 
 			/* If slen is close to mlen in size then use realloc to reduce
 			   the memory defragmentation */
@@ -173,7 +212,16 @@ int _al_ballocmin (_al_bstring b, int len) {
 
 	if (len < b->slen + 1) len = b->slen + 1;
 
-	if (len != b->mlen) {
+	if (bstr__isinline (b)) {
+		/* Inline storage can't shrink, nor grow in place */
+		if (len <= b->mlen) return _AL_BSTR_OK;
+		s = (unsigned char *) bstr__alloc ((size_t) len);
+		if (NULL == s) return _AL_BSTR_ERR;
+		if (b->slen) bstr__memcpy ((char *) s, (char *) b->data, (size_t) b->slen);
+		s[b->slen] = (unsigned char) '\0';
+		b->data = s;
+		b->mlen = len;
+	} else if (len != b->mlen) {
 		s = (unsigned char *) bstr__realloc (b->data, (size_t) len);
 		if (NULL == s) return _AL_BSTR_ERR;
 		s[b->slen] = (unsigned char) '\0';
@@ -199,13 +247,9 @@ size_t j;
 	i = snapUpSize ((int) (j + (2 - (j != 0))));
 	if (i <= (int) j) return NULL;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = bstr__new (i);
 	if (NULL == b) return NULL;
 	b->slen = (int) j;
-	if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-		bstr__free (b);
-		return NULL;
-	}
 
 	bstr__memcpy (b->data, str, j+1);
 	return b;
@@ -227,15 +271,11 @@ size_t j;
 	i = snapUpSize ((int) (j + (2 - (j != 0))));
 	if (i <= (int) j) return NULL;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
-	if (b == NULL) return NULL;
-	b->slen = (int) j;
 	if (i < mlen) i = mlen;
 
-	if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-		bstr__free (b);
-		return NULL;
-	}
+	b = bstr__new (i);
+	if (b == NULL) return NULL;
+	b->slen = (int) j;
 
 	bstr__memcpy (b->data, str, j+1);
 	return b;
@@ -251,20 +291,13 @@ _al_bstring b;
 int i;
 
 	if (blk == NULL || len < 0) return NULL;
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
-	if (b == NULL) return NULL;
-	b->slen = len;
 
 	i = len + (2 - (len != 0));
 	i = snapUpSize (i);
 
-	b->mlen = i;
-
-	b->data = (unsigned char *) bstr__alloc ((size_t) b->mlen);
-	if (b->data == NULL) {
-		bstr__free (b);
-		return NULL;
-	}
+	b = bstr__new (i);
+	if (b == NULL) return NULL;
+	b->slen = len;
 
 	if (len > 0) bstr__memcpy (b->data, blk, (size_t) len);
 	b->data[len] = (unsigned char) '\0';
@@ -420,27 +453,18 @@ int i,j;
 	/* Attempted to copy an invalid string? */
 	if (b == NULL || b->slen < 0 || b->data == NULL) return NULL;
 
-	b0 = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
-	if (b0 == NULL) {
-		/* Unable to allocate memory for string header */
-		return NULL;
-	}
-
 	i = b->slen;
 	j = snapUpSize (i + 1);
 
-	b0->data = (unsigned char *) bstr__alloc (j);
-	if (b0->data == NULL) {
-		j = i + 1;
-		b0->data = (unsigned char *) bstr__alloc (j);
-		if (b0->data == NULL) {
-			/* Unable to allocate memory for string data */
-			bstr__free (b0);
+	b0 = bstr__new (j);
+	if (b0 == NULL) {
+		b0 = bstr__new (i + 1);
+		if (b0 == NULL) {
+			/* Unable to allocate memory for string */
 			return NULL;
 		}
 	}
 
-	b0->mlen = j;
 	b0->slen = i;
 
 	if (i) bstr__memcpy ((char *) b0->data, (char *) b->data, i);
@@ -1003,7 +1027,7 @@ int _al_bdestroy (_al_bstring b) {
 	    b->data == NULL)
 		return _AL_BSTR_ERR;
 
-	bstr__free (b->data);
+	if (!bstr__isinline (b)) bstr__free (b->data);
 
 	/* In case there is any stale usage, there is one more chance to 
 	   notice this error. */
@@ -2253,15 +2277,9 @@ int i, c, v;
 
 	if (sep != NULL) c += (bl->qty - 1) * sep->slen;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = bstr__new (c);
 	if (NULL == b) return NULL; /* Out of memory */
-	b->data = (unsigned char *) bstr__alloc (c);
-	if (b->data == NULL) {
-		bstr__free (b);
-		return NULL;
-	}
 
-	b->mlen = c;
 	b->slen = c-1;
 
 	for (i = 0, c = 0; i < bl->qty; i++) {
@@ -0,0 +1,171 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Extension maps.
+ *
+ *      See LICENSE.txt for copyright information.
+ *
+ *
+ *      A small open addressing hash table from file name extensions to
+ *      integers, used by the loader registries so that finding the handler
+ *      for a file does not compare its extension with every registered
+ *      one. Extensions are compared case-insensitively, like _al_stricmp.
+ *      Entries are never removed; registries which delete handlers free
+ *      the map and insert the remaining ones again.
+ *
+ *      This module is NOT thread-safe.
+ */
+
+/* Internal Title: Extension maps
+ */
+
+
+#include <ctype.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_extmap.h"
+
+
+#define MIN_CAPACITY    16
+
+
+struct _AL_EXTMAP_SLOT
+{
+   uint32_t hash;
+   int value;
+   char *ext;     /* lower case; NULL for an empty slot */
+};
+
+
+static uint32_t hash_ext(const char *ext)
+{
+   uint32_t h = 2166136261u;
+
+   while (*ext) {
+      h ^= (unsigned char)tolower((unsigned char)*ext++);
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+static _AL_EXTMAP_SLOT *find_slot(_AL_EXTMAP_SLOT *slots,
+   unsigned int capacity, uint32_t hash, const char *ext)
+{
+   unsigned int mask = capacity - 1;
+   unsigned int i = hash & mask;
+
+   while (slots[i].ext) {
+      if (slots[i].hash == hash && _al_stricmp(slots[i].ext, ext) == 0)
+         break;
+      i = (i + 1) & mask;
+   }
+   return &slots[i];
+}
+
+
+static bool grow(_AL_EXTMAP *map)
+{
+   unsigned int capacity = map->_capacity ? map->_capacity * 2 : MIN_CAPACITY;
+   _AL_EXTMAP_SLOT *slots;
+   unsigned int i;
+
+   slots = al_calloc(capacity, sizeof *slots);
+   if (!slots)
+      return false;
+
+   for (i = 0; i < map->_capacity; i++) {
+      _AL_EXTMAP_SLOT *old = &map->_slots[i];
+      if (old->ext)
+         *find_slot(slots, capacity, old->hash, old->ext) = *old;
+   }
+
+   al_free(map->_slots);
+   map->_slots = slots;
+   map->_capacity = capacity;
+   return true;
+}
+
+
+/* Internal function: _al_extmap_insert
+ *  Maps ext to value, replacing any previous value.
+ */
+bool _al_extmap_insert(_AL_EXTMAP *map, const char *ext, int value)
+{
+   _AL_EXTMAP_SLOT *slot;
+   uint32_t hash;
+   char *p;
+
+   ASSERT(map);
+   ASSERT(ext);
+
+   /* Keep the load factor at most 3/4. */
+   if ((map->_count + 1) * 4 > map->_capacity * 3 && !grow(map))
+      return false;
+
+   hash = hash_ext(ext);
+   slot = find_slot(map->_slots, map->_capacity, hash, ext);
+   if (slot->ext) {
+      slot->value = value;
+      return true;
+   }
+
+   slot->ext = al_malloc(strlen(ext) + 1);
+   if (!slot->ext)
+      return false;
+   for (p = slot->ext; *ext; ext++)
+      *p++ = tolower((unsigned char)*ext);
+   *p = '\0';
+   slot->hash = hash;
+   slot->value = value;
+   map->_count++;
+   return true;
+}
+
+
+/* Internal function: _al_extmap_find
+ *  Returns the value mapped to ext, or -1.
+ */
+int _al_extmap_find(const _AL_EXTMAP *map, const char *ext)
+{
+   _AL_EXTMAP_SLOT *slot;
+
+   ASSERT(map);
+   ASSERT(ext);
+
+   if (map->_count == 0)
+      return -1;
+
+   slot = find_slot(map->_slots, map->_capacity, hash_ext(ext), ext);
+   return slot->ext ? slot->value : -1;
+}
+
+
+/* Internal function: _al_extmap_free
+ *  Removes all entries and frees the memory used by the map.
+ */
+void _al_extmap_free(_AL_EXTMAP *map)
+{
+   unsigned int i;
+
+   ASSERT(map);
+
+   for (i = 0; i < map->_capacity; i++)
+      al_free(map->_slots[i].ext);
+   al_free(map->_slots);
+   map->_slots = NULL;
+   map->_capacity = 0;
+   map->_count = 0;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
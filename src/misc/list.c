@@ -44,6 +44,7 @@ struct _AL_LIST {
    _AL_LIST_ITEM* next_free;
    void*          user_data;
    _AL_LIST_DTOR  dtor;
+   ALLEGRO_MEMORY_POOL* item_pool; /* for items of dynamic lists */
 };
 
 /* List item, holds user data and destructor. */
@@ -122,6 +123,13 @@ static _AL_LIST* list_do_create(size_t capacity, size_t extra_item_size)
    list->next_free            = (_AL_LIST_ITEM*)memory_ptr;
    list->user_data            = NULL;
    list->dtor                 = NULL;
+   list->item_pool            = NULL;
+
+   /* Items of dynamic lists come from a pool, which is cheaper than
+    * allocating each one. Without it they are allocated one by one.
+    */
+   if (0 == capacity)
+      list->item_pool = al_create_memory_pool(list->item_size_with_extra);
 
    /* Initialize free item list.
     */
@@ -194,9 +202,13 @@ static _AL_LIST_ITEM* list_create_item(_AL_LIST* list)
    }
    else {
 
-      item = (_AL_LIST_ITEM*)al_malloc(list->item_size_with_extra);
+      if (list->item_pool)
+         item = (_AL_LIST_ITEM*)al_alloc_from_memory_pool(list->item_pool);
+      else
+         item = (_AL_LIST_ITEM*)al_malloc(list->item_size_with_extra);
 
-      item->list = list;
+      if (NULL != item)
+         item->list = list;
    }
 
    return item;
@@ -218,6 +230,8 @@ static void list_destroy_item(_AL_LIST* list, _AL_LIST_ITEM* item)
       item->next      = list->next_free;
       list->next_free = item;
    }
+   else if (list->item_pool)
+      al_free_to_memory_pool(list->item_pool, item);
    else
       al_free(item);
 }
@@ -268,6 +282,7 @@ void _al_list_destroy(_AL_LIST* list)
 
    _al_list_clear(list);
 
+   al_destroy_memory_pool(list->item_pool);
    al_free(list);
 }
 
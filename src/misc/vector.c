@@ -315,6 +315,29 @@ void _al_vector_delete_at(_AL_VECTOR *vec, unsigned int idx)
 
 
 
+/* Internal function: _al_vector_delete_at_unordered
+ *
+ *  Delete the slot given by index by moving the last item into it, which
+ *  takes constant time but changes the order of the items.  Callers which
+ *  keep the index of each item in the item itself must update the index of
+ *  the item now at idx, if any.
+ */
+void _al_vector_delete_at_unordered(_AL_VECTOR *vec, unsigned int idx)
+{
+   ASSERT(vec);
+   ASSERT(idx < vec->_size);
+   {
+      unsigned int last = vec->_size - 1;
+      if (idx != last)
+         memcpy(ITEM_START(vec, idx), ITEM_START(vec, last), vec->_itemsize);
+      vec->_size--;
+      vec->_unused++;
+      memset(ITEM_START(vec, vec->_size), 0, vec->_itemsize);
+   }
+}
+
+
+
 /* Internal function: _al_vector_find_and_delete
  *
  *  Similar to _al_vector_delete_at(_al_vector_find(vec, ptr_item)) but is
@@ -15,20 +15,147 @@
 
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_events.h"
+#include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_vector.h"
 
 
-/* Function: al_get_num_video_adapters
+/* Like the mode lists in fullscreen_mode.c, the adapter count and monitor
+ * rectangles are kept until the system reports a configuration change.
+ * On Windows they depend on the new display flags (Direct3D or OpenGL).
  */
-int al_get_num_video_adapters(void)
+typedef struct CACHED_MONITOR
+{
+   ALLEGRO_MONITOR_INFO info;
+   bool valid;
+} CACHED_MONITOR;
+
+static _AL_MUTEX monitors_mutex = _AL_MUTEX_UNINITED;
+static bool monitors_cached = false;
+static int monitors_generation;
+static int monitors_flags;
+static _AL_VECTOR monitors = _AL_VECTOR_INITIALIZER(CACHED_MONITOR);
+
+/* Bumped on every change. The caches compare it rather than being cleared
+ * by the notifying thread, which may hold locks (like the X11 system lock)
+ * that the queries need themselves.
+ */
+static volatile _AL_ATOMIC display_config_generation;
+
+
+static void shutdown_monitors(void)
+{
+   _al_vector_free(&monitors);
+   monitors_cached = false;
+   _al_mutex_destroy(&monitors_mutex);
+}
+
+
+/* _al_init_monitors:
+ *  Called from al_install_system.
+ */
+void _al_init_monitors(void)
+{
+   _al_mutex_init(&monitors_mutex);
+   _al_add_exit_func(shutdown_monitors, "shutdown_monitors");
+}
+
+
+/* Fills the monitor table if it is not current. Call with monitors_mutex
+ * held.
+ */
+static void cache_monitors(void)
 {
    ALLEGRO_SYSTEM *system = al_get_system_driver();
+   int generation = _al_get_display_config_generation();
+   int flags = al_get_new_display_flags();
+   int i, n = 0;
+
+   if (monitors_cached && monitors_generation == generation &&
+         monitors_flags == flags)
+      return;
 
-   if (system && system->vt && system->vt->get_num_video_adapters) {
-      return system->vt->get_num_video_adapters();
+   _al_vector_free(&monitors);
+   if (!system || !system->vt)
+      return;
+
+   if (system->vt->get_num_video_adapters) {
+      n = system->vt->get_num_video_adapters();
    }
 
-   return 0;
+   for (i = 0; i < n; i++) {
+      CACHED_MONITOR *cached = _al_vector_alloc_back(&monitors);
+      cached->info.x1 = cached->info.y1 = INT_MAX;
+      cached->info.x2 = cached->info.y2 = INT_MAX;
+      cached->valid = false;
+      if (system->vt->get_monitor_info) {
+         cached->valid = system->vt->get_monitor_info(i, &cached->info);
+      }
+   }
+
+   monitors_cached = true;
+   monitors_generation = generation;
+   monitors_flags = flags;
+}
+
+
+/* _al_get_display_config_generation:
+ *  Returns a number that changes whenever _al_display_config_changed is
+ *  called.
+ */
+int _al_get_display_config_generation(void)
+{
+   return _al_atomic_load_acquire(&display_config_generation);
+}
+
+
+/* _al_display_config_changed:
+ *  Called by the system drivers when monitors or their modes change.
+ *  Marks the cached tables as stale and sends
+ *  ALLEGRO_EVENT_DISPLAY_CONFIGURATION to every display. May be called
+ *  from any thread.
+ */
+void _al_display_config_changed(void)
+{
+   ALLEGRO_SYSTEM *system = al_get_system_driver();
+   unsigned i;
+
+   _al_fetch_and_add1(&display_config_generation);
+
+   if (!system)
+      return;
+
+   for (i = 0; i < _al_vector_size(&system->displays); i++) {
+      ALLEGRO_DISPLAY **dptr = _al_vector_ref(&system->displays, i);
+      ALLEGRO_EVENT_SOURCE *es = &(*dptr)->es;
+
+      _al_event_source_lock(es);
+      if (_al_event_source_needs_to_generate_event(es)) {
+         ALLEGRO_EVENT event;
+         event.display.type = ALLEGRO_EVENT_DISPLAY_CONFIGURATION;
+         event.display.timestamp = al_get_time();
+         _al_event_source_emit_event(es, &event);
+      }
+      _al_event_source_unlock(es);
+   }
+}
+
+
+/* Function: al_get_num_video_adapters
+ */
+int al_get_num_video_adapters(void)
+{
+   int n;
+
+   _al_mutex_lock(&monitors_mutex);
+   cache_monitors();
+   n = _al_vector_size(&monitors);
+   _al_mutex_unlock(&monitors_mutex);
+
+   return n;
 }
 
 /* Function: al_get_monitor_refresh_rate
@@ -52,12 +179,26 @@ int al_get_monitor_refresh_rate(int adapter)
 bool al_get_monitor_info(int adapter, ALLEGRO_MONITOR_INFO *info)
 {
    ALLEGRO_SYSTEM *system = al_get_system_driver();
+   CACHED_MONITOR *cached;
+   bool valid;
 
-   if (adapter < al_get_num_video_adapters()) {
+   if (adapter < 0) {
       if (system && system->vt && system->vt->get_monitor_info) {
          return system->vt->get_monitor_info(adapter, info);
       }
    }
+   else {
+      _al_mutex_lock(&monitors_mutex);
+      cache_monitors();
+      if (adapter < (int)_al_vector_size(&monitors)) {
+         cached = _al_vector_ref(&monitors, adapter);
+         *info = cached->info;
+         valid = cached->valid;
+         _al_mutex_unlock(&monitors_mutex);
+         return valid;
+      }
+      _al_mutex_unlock(&monitors_mutex);
+   }
 
    info->x1 = info->y1 = info->x2 = info->y2 = INT_MAX;
    return false;
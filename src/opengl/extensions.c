@@ -26,7 +26,9 @@
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_opengl.h"
 #include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_extmap.h"
 #include "allegro5/internal/aintern_system.h"
+#include "allegro5/internal/aintern_thread.h"
 
 /* We need some driver specific details not worth of a vtable entry. */
 #if defined ALLEGRO_WINDOWS
@@ -167,47 +169,45 @@ static uint32_t _al_ogl_version(void)
 
 
 
-/* print_extensions:
- * Given a string containing extensions (i.e. a NULL terminated string where
- * each extension are separated by a space and which names do not contain any
- * space)
+/* Resolving the entry points and parsing the extension strings is slow on
+ * some implementations, and gives the same result for all contexts of the
+ * same driver, version and profile. So the results are kept until shutdown
+ * and shared by all such displays, which also makes recreating a display
+ * cheap.
  */
-static void print_extensions(char const *extension)
+struct ALLEGRO_OGL_EXT_CACHE
 {
-   char buf[80];
-   char *start;
-   ASSERT(extension);
-
-   while (*extension != '\0') {
-      start = buf;
-      _al_sane_strncpy(buf, extension, 80);
-      while ((*start != ' ') && (*start != '\0')) {
-         extension++;
-         start++;
-      }
-      *start = '\0';
-      if (*extension != '\0')
-         extension++;
-      ALLEGRO_DEBUG("%s\n", buf);
-   }
-}
+   ALLEGRO_USTR *key;
+   ALLEGRO_OGL_EXT_API *api;
+   _AL_EXTMAP extensions;
+};
 
+static _AL_MUTEX ext_cache_mutex = _AL_MUTEX_UNINITED;
+static _AL_VECTOR ext_caches = _AL_VECTOR_INITIALIZER(ALLEGRO_OGL_EXT_CACHE *);
 
 
-#if !defined ALLEGRO_CFG_OPENGLES
-/* Print all extensions the OpenGL 3.0 way. */ 
-static void print_extensions_3_0(void)
+
+/* add_extension_string:
+ *  Adds the names in a space separated extension string to the set.
+ */
+static void add_extension_string(_AL_EXTMAP *set, char const *list)
 {
-   int i;
-   GLint n;
-   GLubyte const *name;
-   glGetIntegerv(GL_NUM_EXTENSIONS, &n);
-   for (i = 0; i < n; i++) {
-      name = glGetStringi(GL_EXTENSIONS, i);
-      ALLEGRO_DEBUG("%s\n", name);
+   char buf[128];
+   size_t n;
+
+   while (*list != '\0') {
+      n = strcspn(list, " ");
+      if (n > 0 && n < sizeof(buf)) {
+         memcpy(buf, list, n);
+         buf[n] = '\0';
+         ALLEGRO_DEBUG("%s\n", buf);
+         _al_extmap_insert(set, buf, 1);
+      }
+      list += n;
+      while (*list == ' ')
+         list++;
    }
 }
-#endif
 
 
 
@@ -454,70 +454,12 @@ int _al_ogl_look_for_an_extension(const char *name, const GLubyte *extensions)
 static bool _ogl_is_extension_supported(const char *extension,
                                        ALLEGRO_DISPLAY *disp)
 {
-   int ret = 0;
-   GLubyte const *ext_str;
-#if !defined ALLEGRO_CFG_OPENGLES
-   int v = al_get_opengl_version();
-#endif
-   (void)disp;
-
-#if !defined ALLEGRO_CFG_OPENGLES
-   if (disp->flags & ALLEGRO_OPENGL_3_0 || v >= _ALLEGRO_OPENGL_VERSION_3_0) {
-      int i;
-      GLint ext_cnt;
-      glGetIntegerv(GL_NUM_EXTENSIONS, &ext_cnt);
-      for (i = 0; i < ext_cnt; i++) {
-         ext_str = glGetStringi(GL_EXTENSIONS, i);
-         if (ext_str && !strcmp(extension, (char*)ext_str)) {
-            ret = 1;
-            break;
-         }
-      }
-   }
-   else
-#endif
-   {
-      ext_str = glGetString(GL_EXTENSIONS);
-      if (!ext_str)
-         return false;
-      ret = _al_ogl_look_for_an_extension(extension, ext_str);
-   }
-
-#ifdef ALLEGRO_WINDOWS
-   if (!ret && strncmp(extension, "WGL", 3) == 0) {
-      ALLEGRO_DISPLAY_WGL *wgl_disp = (void*)disp;
-      _ALLEGRO_wglGetExtensionsStringARB_t _wglGetExtensionsStringARB;
-
-      if (!wgl_disp->dc)
-         return false;
-
-      _wglGetExtensionsStringARB = (void *)
-         wglGetProcAddress("wglGetExtensionsStringARB");
-      if (_wglGetExtensionsStringARB) {
-         ret = _al_ogl_look_for_an_extension(extension, (const GLubyte *)
-                                     _wglGetExtensionsStringARB(wgl_disp->dc));
-      }
-   }
+   ALLEGRO_OGL_EXT_CACHE *cache = disp->ogl_extras->extension_cache;
 
-#elif defined ALLEGRO_UNIX && !defined ALLEGRO_EXCLUDE_GLX
-   if (!ret && strncmp(extension, "GLX", 3) == 0) {
-      ALLEGRO_SYSTEM_XGLX *sys = (void*)al_get_system_driver();
-      ALLEGRO_DISPLAY_XGLX *glx_disp = (void*)disp;
-      char const *ext;
-
-      if (!sys->gfxdisplay)
-         return false;
-
-      ext = glXQueryExtensionsString(sys->gfxdisplay, glx_disp->xscreen);
-      if (!ext) {
-         /* work around driver bugs? */
-         ext = "";
-      }
-      ret = _al_ogl_look_for_an_extension(extension, (const GLubyte *)ext);
-   }
-#endif
+   if (!cache || strchr(extension, ' '))
+      return false;
 
-   return ret;
+   return _al_extmap_find(&cache->extensions, extension) >= 0;
 }
 
 
@@ -703,6 +645,124 @@ static void fill_in_info_struct(const GLubyte *rendereru, OPENGL_INFO *info)
 
 
 
+/* read_extensions:
+ *  Fills the cache's extension set from the current context.
+ */
+static void read_extensions(ALLEGRO_OGL_EXT_CACHE *cache,
+   ALLEGRO_DISPLAY *gl_disp)
+{
+   ALLEGRO_DEBUG("OpenGL Extensions:\n");
+#if !defined ALLEGRO_CFG_OPENGLES
+   if (gl_disp->flags & ALLEGRO_OPENGL_3_0 ||
+         gl_disp->ogl_extras->ogl_info.version >= _ALLEGRO_OPENGL_VERSION_3_0) {
+      GLint i, n = 0;
+      glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+      for (i = 0; i < n; i++) {
+         char const *name = (char const *)glGetStringi(GL_EXTENSIONS, i);
+         if (name) {
+            ALLEGRO_DEBUG("%s\n", name);
+            _al_extmap_insert(&cache->extensions, name, 1);
+         }
+      }
+   }
+   else
+#endif
+   {
+      char const *ext = (char const *)glGetString(GL_EXTENSIONS);
+      if (ext)
+         add_extension_string(&cache->extensions, ext);
+   }
+
+#ifdef ALLEGRO_WINDOWS
+   {
+      ALLEGRO_DISPLAY_WGL *wgl_disp = (void*)gl_disp;
+      _ALLEGRO_wglGetExtensionsStringARB_t _wglGetExtensionsStringARB;
+      char const *ext;
+
+      _wglGetExtensionsStringARB = (void *)
+         wglGetProcAddress("wglGetExtensionsStringARB");
+      if (wgl_disp->dc && _wglGetExtensionsStringARB) {
+         ALLEGRO_DEBUG("WGL Extensions:\n");
+         ext = _wglGetExtensionsStringARB(wgl_disp->dc);
+         if (ext)
+            add_extension_string(&cache->extensions, ext);
+      }
+   }
+#elif defined ALLEGRO_UNIX && !defined ALLEGRO_EXCLUDE_GLX
+   {
+      ALLEGRO_SYSTEM_XGLX *glx_sys = (void*)al_get_system_driver();
+      ALLEGRO_DISPLAY_XGLX *glx_disp = (void *)gl_disp;
+      char const *ext;
+
+      /* There is no X connection for headless displays. */
+      if (glx_sys->gfxdisplay) {
+         ALLEGRO_DEBUG("GLX Extensions:\n");
+         ext = glXQueryExtensionsString(glx_sys->gfxdisplay, glx_disp->xscreen);
+         if (ext)
+            add_extension_string(&cache->extensions, ext);
+      }
+   }
+#endif
+}
+
+
+
+/* get_extension_cache:
+ *  Returns the cache entry for the current context, filling a new one if
+ *  there is none yet.
+ */
+static ALLEGRO_OGL_EXT_CACHE *get_extension_cache(ALLEGRO_DISPLAY *gl_disp)
+{
+   const int profile_flags = ALLEGRO_OPENGL_3_0 |
+      ALLEGRO_OPENGL_FORWARD_COMPATIBLE | ALLEGRO_OPENGL_CORE_PROFILE |
+      ALLEGRO_OPENGL_ES_PROFILE;
+   char const *vendor = (char const *)glGetString(GL_VENDOR);
+   char const *renderer = (char const *)glGetString(GL_RENDERER);
+   char const *version = (char const *)glGetString(GL_VERSION);
+   ALLEGRO_OGL_EXT_CACHE *cache = NULL;
+   ALLEGRO_OGL_EXT_CACHE **slot;
+   ALLEGRO_USTR *key;
+   unsigned int i;
+
+   key = al_ustr_newf("%s\n%s\n%s\n%x", vendor ? vendor : "",
+      renderer ? renderer : "", version ? version : "",
+      gl_disp->flags & profile_flags);
+
+   _al_mutex_lock(&ext_cache_mutex);
+
+   for (i = 0; i < _al_vector_size(&ext_caches); i++) {
+      slot = _al_vector_ref(&ext_caches, i);
+      if (al_ustr_equal((*slot)->key, key)) {
+         cache = *slot;
+         break;
+      }
+   }
+
+   if (cache) {
+      ALLEGRO_DEBUG("Reusing the extensions of an earlier context.\n");
+      al_ustr_free(key);
+   }
+   else {
+      cache = al_calloc(1, sizeof *cache);
+      cache->key = key;
+      cache->api = create_extension_api_table();
+      load_extensions(cache->api);
+#if !defined ALLEGRO_CFG_OPENGLES
+      /* Need that symbol already so can't wait until it is assigned later. */
+      glGetStringi = cache->api->GetStringi;
+#endif
+      read_extensions(cache, gl_disp);
+      slot = _al_vector_alloc_back(&ext_caches);
+      *slot = cache;
+   }
+
+   _al_mutex_unlock(&ext_cache_mutex);
+
+   return cache;
+}
+
+
+
 /* _al_ogl_manage_extensions:
  * This functions fills the extensions API table and extension list
  * structures and displays on the log file which extensions are available.
@@ -713,21 +773,13 @@ void _al_ogl_manage_extensions(ALLEGRO_DISPLAY *gl_disp)
 #if defined ALLEGRO_MACOSX
    CFURLRef bundle_url;
 #endif
+   ALLEGRO_OGL_EXT_CACHE *cache;
    ALLEGRO_OGL_EXT_API *ext_api;
    ALLEGRO_OGL_EXT_LIST *ext_list;
 
    /* Some functions depend on knowing the version of opengl in use */
    fill_in_info_struct(glGetString(GL_RENDERER), &(gl_disp->ogl_extras->ogl_info));
 
-   /* Print out OpenGL extensions
-    * We should use glGetStringi(GL_EXTENSIONS, i) for OpenGL 3.0+
-    * but it doesn't seem to work until later.
-    */
-   if (gl_disp->ogl_extras->ogl_info.version < _ALLEGRO_OPENGL_VERSION_3_0) {
-      ALLEGRO_DEBUG("OpenGL Extensions:\n");
-      print_extensions((char const *)glGetString(GL_EXTENSIONS));
-   }
-
    /* Print out GLU version */
    //buf = gluGetString(GLU_VERSION);
    //ALLEGRO_INFO("GLU Version : %s\n", buf);
@@ -769,33 +821,11 @@ void _al_ogl_manage_extensions(ALLEGRO_DISPLAY *gl_disp)
    CFRelease(bundle_url);
 #endif
 
-#if defined ALLEGRO_UNIX && !defined ALLEGRO_EXCLUDE_GLX
-   ALLEGRO_DEBUG("GLX Extensions:\n");
-   ALLEGRO_SYSTEM_XGLX *glx_sys = (void*)al_get_system_driver();
-   ALLEGRO_DISPLAY_XGLX *glx_disp = (void *)gl_disp;
-   char const *ext = glXQueryExtensionsString(
-      glx_sys->gfxdisplay, glx_disp->xscreen);
-   if (!ext) {
-      /* work around driver bugs? */
-      ext = "";
-   }
-   print_extensions(ext);
-#endif
-
-   /* Create & load extension API table */
-   ext_api = create_extension_api_table();
-   load_extensions(ext_api);
+   /* Find or fill the extension API table and extension set. */
+   cache = get_extension_cache(gl_disp);
+   ext_api = cache->api;
+   gl_disp->ogl_extras->extension_cache = cache;
    gl_disp->ogl_extras->extension_api = ext_api;
-   
-#if !defined ALLEGRO_CFG_OPENGLES
-   /* Need that symbol already so can't wait until it is assigned later. */
-   glGetStringi = ext_api->GetStringi;
-
-   if (gl_disp->ogl_extras->ogl_info.version >= _ALLEGRO_OPENGL_VERSION_3_0) {
-      ALLEGRO_DEBUG("OpenGL Extensions:\n");
-      print_extensions_3_0();
-   }
-#endif
 
    /* Create the list of supported extensions. */
    ext_list = create_extension_list();
@@ -869,8 +899,8 @@ void _al_ogl_manage_extensions(ALLEGRO_DISPLAY *gl_disp)
          if (gl_disp->ogl_extras->ogl_info.version >= _ALLEGRO_OPENGL_VERSION_3_0) {
             /* Assume okay. */
          }
-         else if (!strstr((const char *)glGetString(GL_EXTENSIONS),
-               "GL_ARB_texture_non_power_of_two")
+         else if (!_ogl_is_extension_supported(
+               "GL_ARB_texture_non_power_of_two", gl_disp)
              && gl_disp->ogl_extras->ogl_info.version >= _ALLEGRO_OPENGL_VERSION_2_0) {
             ext_list->ALLEGRO_GL_ARB_texture_non_power_of_two = 0;
          }
@@ -887,6 +917,21 @@ void _al_ogl_manage_extensions(ALLEGRO_DISPLAY *gl_disp)
       s[ALLEGRO_SUPPORT_NPOT_BITMAP] =
          ext_list->ALLEGRO_GL_ARB_texture_non_power_of_two ||
          ext_list->ALLEGRO_GL_OES_texture_npot;
+
+      /* Sampling several textures from one batch is done by the default
+       * GLSL shader, so it is limited by the fragment texture units.
+       */
+      s[ALLEGRO_HELD_BITMAP_TEXTURES] = 0;
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+      if (gl_disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
+         int n = _al_get_new_display_settings()->settings[ALLEGRO_HELD_BITMAP_TEXTURES];
+         GLint units = 0;
+         glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+         n = _ALLEGRO_MIN(n, _ALLEGRO_MIN(units, _ALLEGRO_MAX_HELD_TEXTURES));
+         if (n > 1)
+            s[ALLEGRO_HELD_BITMAP_TEXTURES] = n;
+      }
+#endif
    ALLEGRO_INFO("Use of non-power-of-two textures %s.\n",
       s[ALLEGRO_SUPPORT_NPOT_BITMAP] ? "enabled" : "disabled");
 #if defined ALLEGRO_CFG_OPENGLES
@@ -908,6 +953,12 @@ void _al_ogl_manage_extensions(ALLEGRO_DISPLAY *gl_disp)
       "disabled");
 #endif
    }
+
+#if defined ALLEGRO_CFG_OPENGLES
+   /* The context is new, programs built for an old one are gone. */
+   memset(gl_disp->ogl_extras->lock_pack_programs, 0,
+      sizeof(gl_disp->ogl_extras->lock_pack_programs));
+#endif
 }
 
 
@@ -932,8 +983,9 @@ ALLEGRO_OGL_EXT_LIST *al_get_opengl_extension_list(void)
 
 void _al_ogl_unmanage_extensions(ALLEGRO_DISPLAY *gl_disp)
 {
-   destroy_extension_api_table(gl_disp->ogl_extras->extension_api);
+   /* The API table stays in the cache. */
    destroy_extension_list(gl_disp->ogl_extras->extension_list);
+   gl_disp->ogl_extras->extension_cache = NULL;
    gl_disp->ogl_extras->extension_api = NULL;
    gl_disp->ogl_extras->extension_list = NULL;
 
@@ -948,4 +1000,29 @@ void _al_ogl_unmanage_extensions(ALLEGRO_DISPLAY *gl_disp)
 #endif
 }
 
+
+
+void _al_ogl_init_extensions(void)
+{
+   _al_mutex_init(&ext_cache_mutex);
+   _al_vector_init(&ext_caches, sizeof(ALLEGRO_OGL_EXT_CACHE *));
+}
+
+
+
+void _al_ogl_shutdown_extensions(void)
+{
+   while (!_al_vector_is_empty(&ext_caches)) {
+      ALLEGRO_OGL_EXT_CACHE **slot = _al_vector_ref_back(&ext_caches);
+      ALLEGRO_OGL_EXT_CACHE *cache = *slot;
+      al_ustr_free(cache->key);
+      destroy_extension_api_table(cache->api);
+      _al_extmap_free(&cache->extensions);
+      al_free(cache);
+      _al_vector_delete_at(&ext_caches, _al_vector_size(&ext_caches) - 1);
+   }
+   _al_vector_free(&ext_caches);
+   _al_mutex_destroy(&ext_cache_mutex);
+}
+
 /* vim: set sts=3 sw=3 et: */
@@ -15,12 +15,14 @@
  *
  */
 
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_command_list.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_memblit.h"
 #include "allegro5/internal/aintern_opengl.h"
@@ -122,6 +124,8 @@ int _al_ogl_get_glformat(int format, int component)
       {GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_UNSIGNED_INT_8_8_8_8, GL_RGBA}, /* RGBA_DXT1 */
       {GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_UNSIGNED_INT_8_8_8_8, GL_RGBA}, /* RGBA_DXT3 */
       {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_UNSIGNED_INT_8_8_8_8, GL_RGBA}, /* RGBA_DXT5 */
+      {GL_COMPRESSED_RED_RGTC1, GL_UNSIGNED_INT_8_8_8_8, GL_RGBA}, /* RED_RGTC1 */
+      {GL_COMPRESSED_RG_RGTC2, GL_UNSIGNED_INT_8_8_8_8, GL_RGBA}, /* RG_RGTC2 */
    };
   
    if (al_get_opengl_version() >= _ALLEGRO_OPENGL_VERSION_3_0) {
@@ -164,12 +168,57 @@ int _al_ogl_get_glformat(int format, int component)
       {0, 0, 0},
       {0, 0, 0},
       {0, 0, 0},
+      {0, 0, 0},
+      {0, 0, 0},
    };
    #endif
    
    return glformats[format][component];
 }
 
+/* Returns the sRGB variant of the internal format for the pixel format, or
+ * 0 if there is none or sRGB textures are not supported.
+ */
+static int get_srgb_glformat(int format)
+{
+#if !defined ALLEGRO_CFG_OPENGLES
+   if (!al_get_opengl_extension_list()->ALLEGRO_GL_EXT_texture_sRGB)
+      return 0;
+
+   switch (get_glformat(format, 0)) {
+      case GL_RGBA8:
+      case GL_RGBA:
+         return GL_SRGB8_ALPHA8;
+      case GL_RGB8:
+         return GL_SRGB8;
+      case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+         return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+      case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+         return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+      case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+         return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+   }
+#else
+   (void)format;
+#endif
+   return 0;
+}
+
+/* The internal format of textures and render buffers for the bitmap, in
+ * the given pixel format. For ALLEGRO_SRGB bitmaps this is an sRGB format,
+ * so that the GPU converts texels to linear when sampling and back when
+ * writing with GL_FRAMEBUFFER_SRGB enabled.
+ */
+int _al_ogl_get_bitmap_glformat(ALLEGRO_BITMAP *bitmap, int format)
+{
+   if (al_get_bitmap_flags(bitmap) & ALLEGRO_SRGB) {
+      int srgb = get_srgb_glformat(format);
+      if (srgb)
+         return srgb;
+   }
+   return get_glformat(format, 0);
+}
+
 static ALLEGRO_BITMAP_INTERFACE glbmp_vt;
 
 
@@ -196,30 +245,296 @@ char const *_al_gl_error_string(GLenum e)
 }
 #undef ERR
 
-static INLINE void transform_vertex(float* x, float* y, float* z)
+/* Returns the texture unit the held drawing batch samples the texture from,
+ * flushing the batch first if all units are taken. Returns -1 if the current
+ * shader samples a single texture, see ALLEGRO_HELD_BITMAP_TEXTURES.
+ */
+static int held_texture_unit(ALLEGRO_DISPLAY *disp, GLuint texture)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   int max = disp->extra_settings.settings[ALLEGRO_HELD_BITMAP_TEXTURES];
+   int i;
+
+   if (max < 2 || !(disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) ||
+         o->varlocs.held_tex_loc < 0 || o->varlocs.tex_unit_loc < 0) {
+      return -1;
+   }
+
+   if (disp->num_cache_vertices == 0)
+      o->num_held_textures = 0;
+
+   for (i = 0; i < o->num_held_textures; i++) {
+      if (o->held_textures[i] == texture)
+         return i;
+   }
+
+   if (o->num_held_textures == _ALLEGRO_MIN(max, _ALLEGRO_MAX_HELD_TEXTURES)) {
+      _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_TEXTURE_FLUSHES);
+   }
+   o->held_textures[o->num_held_textures] = texture;
+   return o->num_held_textures++;
+}
+
+/* Returns true if the tint is stored exactly enough in 8 bits per
+ * component, so that ALLEGRO_OGL_PACKED_BITMAP_VERTEX can be used.
+ */
+static bool tint_fits_bytes(ALLEGRO_COLOR tint)
+{
+   const float c[4] = {tint.r, tint.g, tint.b, tint.a};
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      float f = c[i] * 255.0f;
+      if (!(f >= 0.0f && f <= 255.0f))
+         return false;
+      if (fabsf(f - (int)(f + 0.5f)) > 0.01f)
+         return false;
+   }
+   return true;
+}
+
+static void pack_vertex(ALLEGRO_OGL_PACKED_BITMAP_VERTEX *v,
+   const ALLEGRO_OGL_BITMAP_VERTEX *src)
+{
+   v->x = src->x;
+   v->y = src->y;
+   v->z = src->z;
+   v->tx = src->tx;
+   v->ty = src->ty;
+   v->r = (unsigned char)(src->r * 255.0f + 0.5f);
+   v->g = (unsigned char)(src->g * 255.0f + 0.5f);
+   v->b = (unsigned char)(src->b * 255.0f + 0.5f);
+   v->a = (unsigned char)(src->a * 255.0f + 0.5f);
+   v->unit = (unsigned char)src->unit;
+}
+
+/* Maps a vertex to pixels of the target, whose top row is at y = 0. */
+static void target_pixel(const ALLEGRO_BITMAP *target,
+   const ALLEGRO_OGL_BITMAP_VERTEX *v, float *x, float *y)
+{
+   const float (*m)[4] = target->proj_transform.m;
+
+   /* Normalized device coordinates to pixels. */
+   *x = (m[0][0] * v->x + m[1][0] * v->y + m[2][0] * v->z + m[3][0] + 1.0f) *
+      target->w * 0.5f;
+   *y = (1.0f - (m[0][1] * v->x + m[1][1] * v->y + m[2][1] * v->z +
+      m[3][1])) * target->h * 0.5f;
+}
+
+/* Returns true if the quad, whose corners are in the space the projection
+ * transform of the target is applied to, can't cover any pixel within the
+ * clipping rectangle. Any shader but the default one might move the
+ * vertices, and a projection with perspective could flip them, so those
+ * are never culled.
+ */
+static bool quad_is_clipped(ALLEGRO_DISPLAY *disp,
+   const ALLEGRO_OGL_BITMAP_VERTEX *quad)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   float min_x, min_y, max_x, max_y;
+   int i;
+
+   if (!disp->ogl_extras->cull_held_draws || target->shader ||
+         _al_classify_transform(&target->proj_transform) ==
+            _AL_TRANSFORM_PROJECTIVE)
+      return false;
+
+   min_x = min_y = FLT_MAX;
+   max_x = max_y = -FLT_MAX;
+   for (i = 0; i < 4; i++) {
+      float x, y;
+      target_pixel(target, &quad[i], &x, &y);
+      min_x = _ALLEGRO_MIN(min_x, x);
+      max_x = _ALLEGRO_MAX(max_x, x);
+      min_y = _ALLEGRO_MIN(min_y, y);
+      max_y = _ALLEGRO_MAX(max_y, y);
+   }
+
+   return max_x <= target->cl || min_x >= target->cr_excl ||
+      max_y <= target->ct || min_y >= target->cb_excl;
+}
+
+/* Moves the vertices at indices a0 and a1 and those at b0 and b1 towards
+ * each other, so that their pixel coordinates pa and pb along one axis lie
+ * within [lo, hi]. The position and texture coordinate along that axis are
+ * interpolated alike. Returns false if nothing is left.
+ */
+static bool clip_quad_axis(ALLEGRO_OGL_BITMAP_VERTEX *quad, bool vertical,
+   int a0, int a1, int b0, int b1, float pa, float pb, float lo, float hi)
+{
+   float ca, cb, fa, fb;
+
+   if (_ALLEGRO_MAX(pa, pb) <= lo || _ALLEGRO_MIN(pa, pb) >= hi)
+      return false;
+   if (pa == pb)
+      return true;
+
+   ca = _ALLEGRO_CLAMP(lo, pa, hi);
+   cb = _ALLEGRO_CLAMP(lo, pb, hi);
+   if (ca == pa && cb == pb)
+      return true;
+
+   fa = (ca - pa) / (pb - pa);
+   fb = (cb - pa) / (pb - pa);
+
+   if (!vertical) {
+      float x = quad[a0].x, dx = quad[b0].x - x;
+      float tx = quad[a0].tx, dtx = quad[b0].tx - tx;
+      quad[a0].x = quad[a1].x = x + fa * dx;
+      quad[b0].x = quad[b1].x = x + fb * dx;
+      quad[a0].tx = quad[a1].tx = tx + fa * dtx;
+      quad[b0].tx = quad[b1].tx = tx + fb * dtx;
+   }
+   else {
+      float y = quad[a0].y, dy = quad[b0].y - y;
+      float ty = quad[a0].ty, dty = quad[b0].ty - ty;
+      quad[a0].y = quad[a1].y = y + fa * dy;
+      quad[b0].y = quad[b1].y = y + fb * dy;
+      quad[a0].ty = quad[a1].ty = ty + fa * dty;
+      quad[b0].ty = quad[b1].ty = ty + fb * dty;
+   }
+   return true;
+}
+
+/* Clips the quad to the clipping rectangle of the target, if it is a
+ * rectangle aligned to the pixel grid and the projection maps x and y to
+ * pixels independently. Returns 1 if that worked, 0 if nothing is left of
+ * the quad, or -1 if the scissor test has to clip it instead.
+ */
+static int clip_quad(ALLEGRO_OGL_BITMAP_VERTEX *quad)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   const float (*m)[4] = target->proj_transform.m;
+   float px[4], py[4];
+   int i;
+
+   if (target->shader || _al_classify_transform(&target->proj_transform) ==
+         _AL_TRANSFORM_PROJECTIVE)
+      return -1;
+   if (m[1][0] != 0 || m[2][0] != 0 || m[0][1] != 0 || m[2][1] != 0)
+      return -1;
+
+   /* Corners 0 and 1 are on the left edge of the source, 2 and 3 on the
+    * right one, 0 and 2 at the bottom and 1 and 3 at the top.
+    */
+   for (i = 0; i < 4; i++)
+      target_pixel(target, &quad[i], &px[i], &py[i]);
+   if (px[0] != px[1] || px[2] != px[3] || py[0] != py[2] || py[1] != py[3])
+      return -1;
+
+   if (!clip_quad_axis(quad, false, 0, 1, 2, 3, px[0], px[2],
+         target->cl, target->cr_excl))
+      return 0;
+   if (!clip_quad_axis(quad, true, 1, 3, 0, 2, py[1], py[0],
+         target->ct, target->cb_excl))
+      return 0;
+   return 1;
+}
+
+/* Sets the scissor test to the clipping rectangle for held vertices which
+ * can't be clipped by clip_quad, see clip_held_quad.
+ */
+static void use_held_scissor(ALLEGRO_DISPLAY *disp)
 {
-   al_transform_coordinates_3d(al_get_current_transform(), x, y, z);
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+
+   if (o->held_scissor_stale) {
+      if (disp->num_cache_vertices != 0) {
+         _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+      }
+      _al_ogl_setup_bitmap_clipping(disp, al_get_target_bitmap());
+   }
+   o->held_scissor_needed = true;
 }
 
+/* With clip_held_draws, the clipping rectangle is not given to the scissor
+ * test while drawing is held, so that changing it does not end the batch.
+ * Quads which can be clipped by clip_quad are drawn with the scissor test
+ * off, others with it set to the current clipping rectangle. Switching
+ * between the two flushes only if vertices in the cache depend on it.
+ * Returns false if the quad is clipped away entirely.
+ */
+static bool clip_held_quad(ALLEGRO_DISPLAY *disp,
+   ALLEGRO_OGL_BITMAP_VERTEX *quad)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   int clipped = clip_quad(quad);
+
+   if (disp->num_cache_vertices == 0)
+      o->held_scissor_needed = false;
+
+   if (clipped == 0)
+      return false;
+
+   if (clipped > 0) {
+      if (o->state.scissor_test) {
+         if (disp->num_cache_vertices != 0 && o->held_scissor_needed) {
+            _al_flush_vertex_cache(disp,
+               ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+         }
+         _al_ogl_set_scissor(disp, false, 0, 0, 0, 0);
+         o->held_scissor_stale = true;
+      }
+      return true;
+   }
+
+   use_held_scissor(disp);
+   return true;
+}
+
+/* Prepares the vertex cache for vertices sampling the texture, flushing it
+ * if they can't join the vertices already in it. Returns the texture unit
+ * to give them.
+ */
+static int begin_cache_vertices(ALLEGRO_DISPLAY *disp, GLuint texture,
+   bool packed)
+{
+   int unit;
+
+   /* A batch uses a single vertex layout. Packed batches are only started
+    * on an empty cache, and a tint needing floats ends them.
+    */
+   if (disp->num_cache_vertices != 0 && disp->ogl_extras->packed_vertices &&
+         !packed) {
+      _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_FORMAT_FLUSHES);
+   }
+
+   unit = held_texture_unit(disp, texture);
+   if (unit < 0) {
+      if (disp->num_cache_vertices != 0 && texture != disp->cache_texture) {
+         _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_TEXTURE_FLUSHES);
+      }
+      disp->cache_texture = texture;
+      unit = 0;
+   }
+
+   if (disp->num_cache_vertices == 0)
+      disp->ogl_extras->packed_vertices = packed;
+   return unit;
+}
+
+/* If tq is not NULL it gives the corners already transformed. */
 static void draw_quad(ALLEGRO_BITMAP *bitmap,
     ALLEGRO_COLOR tint,
     float sx, float sy, float sw, float sh,
-    int flags)
+    int flags, const ALLEGRO_TRANSFORMED_QUAD *tq)
 {
    float tex_l, tex_t, tex_r, tex_b, w, h, true_w, true_h;
    float dw = sw, dh = sh;
    ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = bitmap->extra;
+   ALLEGRO_OGL_BITMAP_VERTEX quad[4];
    ALLEGRO_OGL_BITMAP_VERTEX *verts;
    ALLEGRO_DISPLAY *disp = al_get_current_display();
+   bool packed = tint_fits_bytes(tint);
+   int unit;
+   int i;
    
    (void)flags;
 
-   if (disp->num_cache_vertices != 0 && ogl_bitmap->texture != disp->cache_texture) {
-      disp->vt->flush_vertex_cache(disp);
-   }
-   disp->cache_texture = ogl_bitmap->texture;
-
-   verts = disp->vt->prepare_vertex_cache(disp, 6);
+   if (ogl_bitmap->fbo_info && ogl_bitmap->fbo_info->unresolved)
+      _al_ogl_auto_resolve_bitmap(disp, bitmap);
+   if (ogl_bitmap->mipmaps_dirty)
+      _al_ogl_update_mipmaps(disp, bitmap);
 
    tex_l = ogl_bitmap->left;
    tex_r = ogl_bitmap->right;
@@ -236,58 +551,106 @@ static void draw_quad(ALLEGRO_BITMAP *bitmap,
    tex_r -= (w - sx - sw) / true_w;
    tex_b += (h - sy - sh) / true_h;
 
-   verts[0].x = 0;
-   verts[0].y = dh;
-   verts[0].z = 0;
-   verts[0].tx = tex_l;
-   verts[0].ty = tex_b;
-   verts[0].r = tint.r;
-   verts[0].g = tint.g;
-   verts[0].b = tint.b;
-   verts[0].a = tint.a;
-   
-   verts[1].x = 0;
-   verts[1].y = 0;
-   verts[1].z = 0;
-   verts[1].tx = tex_l;
-   verts[1].ty = tex_t;
-   verts[1].r = tint.r;
-   verts[1].g = tint.g;
-   verts[1].b = tint.b;
-   verts[1].a = tint.a;
+   quad[0].x = 0;
+   quad[0].y = dh;
+   quad[0].z = 0;
+   quad[0].tx = tex_l;
+   quad[0].ty = tex_b;
+   quad[0].r = tint.r;
+   quad[0].g = tint.g;
+   quad[0].b = tint.b;
+   quad[0].a = tint.a;
    
-   verts[2].x = dw;
-   verts[2].y = dh;
-   verts[2].z = 0;
-   verts[2].tx = tex_r;
-   verts[2].ty = tex_b;
-   verts[2].r = tint.r;
-   verts[2].g = tint.g;
-   verts[2].b = tint.b;
-   verts[2].a = tint.a;
+   quad[1].x = 0;
+   quad[1].y = 0;
+   quad[1].z = 0;
+   quad[1].tx = tex_l;
+   quad[1].ty = tex_t;
+   quad[1].r = tint.r;
+   quad[1].g = tint.g;
+   quad[1].b = tint.b;
+   quad[1].a = tint.a;
    
-   verts[4].x = dw;
-   verts[4].y = 0;
-   verts[4].z = 0;
-   verts[4].tx = tex_r;
-   verts[4].ty = tex_t;
-   verts[4].r = tint.r;
-   verts[4].g = tint.g;
-   verts[4].b = tint.b;
-   verts[4].a = tint.a;
+   quad[2].x = dw;
+   quad[2].y = dh;
+   quad[2].z = 0;
+   quad[2].tx = tex_r;
+   quad[2].ty = tex_b;
+   quad[2].r = tint.r;
+   quad[2].g = tint.g;
+   quad[2].b = tint.b;
+   quad[2].a = tint.a;
    
-   if (disp->cache_enabled) {
+   quad[3].x = dw;
+   quad[3].y = 0;
+   quad[3].z = 0;
+   quad[3].tx = tex_r;
+   quad[3].ty = tex_t;
+   quad[3].r = tint.r;
+   quad[3].g = tint.g;
+   quad[3].b = tint.b;
+   quad[3].a = tint.a;
+
+   if (tq) {
+      quad[0].x = tq->x[3];
+      quad[0].y = tq->y[3];
+      quad[1].x = tq->x[0];
+      quad[1].y = tq->y[0];
+      quad[2].x = tq->x[2];
+      quad[2].y = tq->y[2];
+      quad[3].x = tq->x[1];
+      quad[3].y = tq->y[1];
+   }
+   else if (disp->cache_enabled) {
       /* If drawing is batched, we apply transformations manually. */
-      transform_vertex(&verts[0].x, &verts[0].y, &verts[0].z);
-      transform_vertex(&verts[1].x, &verts[1].y, &verts[1].z);
-      transform_vertex(&verts[2].x, &verts[2].y, &verts[2].z);
-      transform_vertex(&verts[4].x, &verts[4].y, &verts[4].z);
+      _al_transform_coordinates_kind_n(al_get_current_transform(),
+         _al_get_current_transform_kind(), &quad[0].x, sizeof(quad[0]), 4,
+         true);
+   }
+
+   /* With the corners known in target space, quads which would be clipped
+    * away entirely can be dropped before they cause any flush.
+    */
+   if ((tq || disp->cache_enabled) && quad_is_clipped(disp, quad)) {
+      disp->stats[ALLEGRO_DISPLAY_STAT_CULLED_DRAWS]++;
+      return;
+   }
+
+   if (disp->cache_enabled && disp->ogl_extras->clip_held_draws &&
+         !clip_held_quad(disp, quad)) {
+      disp->stats[ALLEGRO_DISPLAY_STAT_CULLED_DRAWS]++;
+      return;
+   }
+
+   unit = begin_cache_vertices(disp, ogl_bitmap->texture, packed);
+   for (i = 0; i < 4; i++)
+      quad[i].unit = unit;
+
+   /* The vertex cache may be mapped GPU memory, so we only ever write to it
+    * and never read back.
+    */
+   if (disp->ogl_extras->packed_vertices) {
+      ALLEGRO_OGL_PACKED_BITMAP_VERTEX *pverts;
+      pverts = disp->vt->prepare_vertex_cache(disp, 6);
+      pack_vertex(&pverts[0], &quad[0]);
+      pack_vertex(&pverts[1], &quad[1]);
+      pack_vertex(&pverts[2], &quad[2]);
+      pack_vertex(&pverts[3], &quad[1]);
+      pack_vertex(&pverts[4], &quad[3]);
+      pack_vertex(&pverts[5], &quad[2]);
+   }
+   else {
+      verts = disp->vt->prepare_vertex_cache(disp, 6);
+      verts[0] = quad[0];
+      verts[1] = quad[1];
+      verts[2] = quad[2];
+      verts[3] = quad[1];
+      verts[4] = quad[3];
+      verts[5] = quad[2];
    }
-   verts[3] = verts[1];
-   verts[5] = verts[2];
    
    if (!disp->cache_enabled)
-      disp->vt->flush_vertex_cache(disp);
+      _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_UNHELD_FLUSHES);
 }
 #undef SWAP
 
@@ -355,7 +718,8 @@ static void ogl_draw_bitmap_region(ALLEGRO_BITMAP *bitmap,
              * correct to ignore them here.
              */
 
-            glBindTexture(GL_TEXTURE_2D, ogl_target->texture);
+            _al_ogl_bind_texture(al_get_current_display(), 0,
+               ogl_target->texture);
             glCopyTexSubImage2D(GL_TEXTURE_2D, 0,
                 xtrans, target->h - ytrans - sh,
                 sx, bitmap->h - sy - sh,
@@ -371,7 +735,7 @@ static void ogl_draw_bitmap_region(ALLEGRO_BITMAP *bitmap,
       }
    }
    if (disp->ogl_extras->opengl_target == target) {
-      draw_quad(bitmap, tint, sx, sy, sw, sh, flags);
+      draw_quad(bitmap, tint, sx, sy, sw, sh, flags, NULL);
       return;
    }
 
@@ -380,6 +744,162 @@ static void ogl_draw_bitmap_region(ALLEGRO_BITMAP *bitmap,
 }
 
 
+static bool ogl_draw_transformed_quads(ALLEGRO_BITMAP *bitmap,
+   const ALLEGRO_TRANSFORMED_QUAD *quads, int num_quads)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   ALLEGRO_DISPLAY *disp = _al_get_bitmap_display(target);
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_source = bitmap->extra;
+   int i;
+
+   if (target->parent)
+      target = target->parent;
+
+   if (!disp->cache_enabled || ogl_source->is_backbuffer ||
+         disp->ogl_extras->opengl_target != target)
+      return false;
+
+   for (i = 0; i < num_quads; i++) {
+      const ALLEGRO_TRANSFORMED_QUAD *q = &quads[i];
+      draw_quad(bitmap, q->tint, q->sx, q->sy, q->sw, q->sh, 0, q);
+   }
+   return true;
+}
+
+
+/* The texture untextured triangles in the held drawing batch sample. */
+static GLuint white_texture(ALLEGRO_DISPLAY *disp)
+{
+   static const unsigned char white[4] = {255, 255, 255, 255};
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+
+   if (o->white_texture == 0) {
+      glGenTextures(1, &o->white_texture);
+      _al_ogl_bind_texture(disp, 0, o->white_texture);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA,
+         GL_UNSIGNED_BYTE, white);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   }
+   return o->white_texture;
+}
+
+
+/* The primitives addon repeats textures whose wrap mode is
+ * ALLEGRO_BITMAP_WRAP_DEFAULT, while the held batch samples them clamped.
+ * Returns true if that makes no difference for the vertices.
+ */
+static bool wrap_matches(ALLEGRO_BITMAP *texture,
+   const _AL_PRIM_VERTEX *vtxs, int num_vtx)
+{
+   ALLEGRO_BITMAP_WRAP wrap_u, wrap_v;
+   float w = texture->w;
+   float h = texture->h;
+   int i;
+
+   _al_get_bitmap_wrap(texture, &wrap_u, &wrap_v);
+   if (wrap_u != ALLEGRO_BITMAP_WRAP_DEFAULT &&
+         wrap_v != ALLEGRO_BITMAP_WRAP_DEFAULT)
+      return true;
+
+   /* Filtering reads beyond the edges. */
+   if (al_get_bitmap_flags(texture) & (ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR))
+      return false;
+
+   for (i = 0; i < num_vtx; i++) {
+      if (wrap_u == ALLEGRO_BITMAP_WRAP_DEFAULT &&
+            !(vtxs[i].u >= 0 && vtxs[i].u <= w))
+         return false;
+      if (wrap_v == ALLEGRO_BITMAP_WRAP_DEFAULT &&
+            !(vtxs[i].v >= 0 && vtxs[i].v <= h))
+         return false;
+   }
+   return true;
+}
+
+
+/* Adds triangles of the primitives addon to the held drawing batch, see
+ * _al_draw_held_triangles. Untextured ones sample a white texel, so they
+ * only share a batch with bitmaps if the shader samples several textures.
+ */
+bool _al_ogl_draw_held_triangles(ALLEGRO_DISPLAY *disp,
+   ALLEGRO_BITMAP *texture, const _AL_PRIM_VERTEX *vtxs, int num_vtx)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   ALLEGRO_OGL_BITMAP_VERTEX *verts = NULL;
+   ALLEGRO_OGL_PACKED_BITMAP_VERTEX *pverts = NULL;
+   ALLEGRO_OGL_BITMAP_VERTEX v;
+   float tex_x = 0, tex_y = 0, tex_h = 1, true_w = 1, true_h = 1;
+   bool packed = true;
+   GLuint gl_texture;
+   int unit;
+   int i;
+
+   if (target->parent)
+      target = target->parent;
+   if (disp->ogl_extras->opengl_target != target)
+      return false;
+
+   if (texture) {
+      ALLEGRO_BITMAP *parent = texture->parent ? texture->parent : texture;
+      ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = parent->extra;
+
+      if (ogl_bitmap->is_backbuffer || !wrap_matches(texture, vtxs, num_vtx))
+         return false;
+
+      if (ogl_bitmap->fbo_info && ogl_bitmap->fbo_info->unresolved)
+         _al_ogl_auto_resolve_bitmap(disp, parent);
+      if (ogl_bitmap->mipmaps_dirty)
+         _al_ogl_update_mipmaps(disp, parent);
+
+      /* The same mapping as the texture matrix of the primitives addon. */
+      if (texture->parent) {
+         tex_x = texture->xofs;
+         tex_y = texture->yofs;
+      }
+      tex_h = parent->h;
+      true_w = ogl_bitmap->true_w;
+      true_h = ogl_bitmap->true_h;
+      gl_texture = ogl_bitmap->texture;
+   }
+   else {
+      gl_texture = white_texture(disp);
+   }
+
+   if (disp->ogl_extras->clip_held_draws)
+      use_held_scissor(disp);
+
+   for (i = 0; i < num_vtx && packed; i++)
+      packed = tint_fits_bytes(vtxs[i].color);
+   unit = begin_cache_vertices(disp, gl_texture, packed);
+
+   /* The vertex cache may be mapped GPU memory, so it is only written. */
+   if (disp->ogl_extras->packed_vertices)
+      pverts = disp->vt->prepare_vertex_cache(disp, num_vtx);
+   else
+      verts = disp->vt->prepare_vertex_cache(disp, num_vtx);
+
+   v.unit = unit;
+   for (i = 0; i < num_vtx; i++) {
+      const _AL_PRIM_VERTEX *in = &vtxs[i];
+      v.x = in->x;
+      v.y = in->y;
+      v.z = in->z;
+      v.tx = texture ? (tex_x + in->u) / true_w : 0.5f;
+      v.ty = texture ? (tex_h - tex_y - in->v) / true_h : 0.5f;
+      v.r = in->color.r;
+      v.g = in->color.g;
+      v.b = in->color.b;
+      v.a = in->color.a;
+      if (pverts)
+         pack_vertex(&pverts[i], &v);
+      else
+         verts[i] = v;
+   }
+   return true;
+}
+
+
 /* Helper to get smallest fitting power of two. */
 static int pot(int x)
 {
@@ -437,7 +957,7 @@ static bool ogl_upload_bitmap(ALLEGRO_BITMAP *bitmap)
                     _al_pixel_format_name(bitmap_format));
       }
    }
-   glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
+   _al_ogl_bind_texture(al_get_current_display(), 0, ogl_bitmap->texture);
    e = glGetError();
    if (e) {
       ALLEGRO_ERROR("glBindTexture for texture %d failed (%s).\n",
@@ -507,14 +1027,16 @@ static bool ogl_upload_bitmap(ALLEGRO_BITMAP *bitmap)
          unsigned char *buf;
          buf = al_calloc(ogl_bitmap->true_h, ogl_bitmap->true_w);
          glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-         glTexImage2D(GL_TEXTURE_2D, 0, get_glformat(bitmap_format, 0),
+         glTexImage2D(GL_TEXTURE_2D, 0,
+            _al_ogl_get_bitmap_glformat(bitmap, bitmap_format),
             ogl_bitmap->true_w, ogl_bitmap->true_h, 0,
             GL_ALPHA, GL_UNSIGNED_BYTE, buf);
          e = glGetError();
          al_free(buf);
       }
       else {
-         glTexImage2D(GL_TEXTURE_2D, 0, get_glformat(bitmap_format, 0),
+         glTexImage2D(GL_TEXTURE_2D, 0,
+            _al_ogl_get_bitmap_glformat(bitmap, bitmap_format),
             ogl_bitmap->true_w, ogl_bitmap->true_h, 0,
             get_glformat(bitmap_format, 2), get_glformat(bitmap_format, 1),
             NULL);
@@ -527,7 +1049,8 @@ static bool ogl_upload_bitmap(ALLEGRO_BITMAP *bitmap)
       buf = al_calloc(pix_size,
          ogl_bitmap->true_h * ogl_bitmap->true_w);
       glPixelStorei(GL_UNPACK_ALIGNMENT, pix_size);
-      glTexImage2D(GL_TEXTURE_2D, 0, get_glformat(bitmap_format, 0),
+      glTexImage2D(GL_TEXTURE_2D, 0,
+         _al_ogl_get_bitmap_glformat(bitmap, bitmap_format),
          ogl_bitmap->true_w, ogl_bitmap->true_h, 0,
          get_glformat(bitmap_format, 2),
          get_glformat(bitmap_format, 1), buf);
@@ -541,6 +1064,7 @@ static bool ogl_upload_bitmap(ALLEGRO_BITMAP *bitmap)
          ogl_bitmap->true_w, ogl_bitmap->true_h,
          _al_gl_error_string(e));
       glDeleteTextures(1, &ogl_bitmap->texture);
+      _al_ogl_forget_texture(ogl_bitmap->texture);
       ogl_bitmap->texture = 0;
       // FIXME: Should we convert it into a memory bitmap? Or if the size is
       // the problem try to use multiple textures?
@@ -548,12 +1072,7 @@ static bool ogl_upload_bitmap(ALLEGRO_BITMAP *bitmap)
    }
 
    if (post_generate_mipmap) {
-      glGenerateMipmapEXT(GL_TEXTURE_2D);
-      e = glGetError();
-      if (e) {
-         ALLEGRO_ERROR("glGenerateMipmapEXT for texture %d failed (%s).\n",
-            ogl_bitmap->texture, _al_gl_error_string(e));
-      }
+      ogl_bitmap->mipmaps_dirty = true;
    }
    
    ogl_bitmap->left = 0;
@@ -576,7 +1095,12 @@ static void ogl_update_clipping_rectangle(ALLEGRO_BITMAP *bitmap)
    }
 
    if (ogl_disp->ogl_extras->opengl_target == target_bitmap) {
-      _al_ogl_setup_bitmap_clipping(bitmap);
+      /* Held quads are clipped as they are drawn, see clip_held_quad. */
+      if (ogl_disp->cache_enabled && ogl_disp->ogl_extras->clip_held_draws) {
+         ogl_disp->ogl_extras->held_scissor_stale = true;
+         return;
+      }
+      _al_ogl_setup_bitmap_clipping(ogl_disp, bitmap);
    }
 }
 
@@ -603,10 +1127,19 @@ static void ogl_destroy_bitmap(ALLEGRO_BITMAP *bitmap)
      bmp_disp->ogl_extras->opengl_target = NULL;
    }
 
+   /* No point resolving what is about to be deleted. */
+   if (ogl_bitmap->fbo_info)
+      ogl_bitmap->fbo_info->unresolved = false;
    al_remove_opengl_fbo(bitmap);
 
+#ifndef ALLEGRO_CFG_OPENGLES
+   _al_ogl_destroy_readback(bitmap);
+   _al_ogl_destroy_stream_buffers(bitmap);
+#endif
+
    if (ogl_bitmap->texture) {
       glDeleteTextures(1, &ogl_bitmap->texture);
+      _al_ogl_forget_texture(ogl_bitmap->texture);
       ogl_bitmap->texture = 0;
    }
 
@@ -630,12 +1163,31 @@ static void ogl_bitmap_pointer_changed(ALLEGRO_BITMAP *bitmap,
 }
 
 
+static void ogl_resolve(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_DISPLAY *bmp_disp = _al_get_bitmap_display(bitmap);
+   ALLEGRO_DISPLAY *disp = al_get_current_display();
+
+   if (!disp ||
+       (bmp_disp->ogl_extras->is_shared == false && bmp_disp != disp)) {
+      _al_set_current_display_only(bmp_disp);
+      _al_ogl_resolve_bitmap(bmp_disp, bitmap);
+      _al_set_current_display_only(disp);
+   }
+   else {
+      _al_ogl_resolve_bitmap(disp, bitmap);
+   }
+}
+
+
 static bool can_flip_blocks(ALLEGRO_PIXEL_FORMAT format)
 {
    switch (format) {
       case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1:
       case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3:
       case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5:
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2:
          return true;
       default:
          return false;
@@ -643,6 +1195,28 @@ static bool can_flip_blocks(ALLEGRO_PIXEL_FORMAT format)
 }
 
 
+/* Flips the 3-bit indices of a DXT5 alpha block, which RGTC blocks are
+ * made of as well. row points past the two end points.
+ */
+static void flip_alpha_bits(unsigned char *row)
+{
+   uint16_t bit_row0, bit_row1, bit_row2, bit_row3;
+
+   bit_row0 = (((uint16_t)row[0]) | (uint16_t)row[1] << 8) << 4;
+   bit_row1 = (((uint16_t)row[1]) | (uint16_t)row[2] << 8) >> 4;
+   bit_row2 = (((uint16_t)row[3]) | (uint16_t)row[4] << 8) << 4;
+   bit_row3 = (((uint16_t)row[4]) | (uint16_t)row[5] << 8) >> 4;
+
+   row[0] = (unsigned char)(bit_row3 & 0x00ff);
+   row[1] = (unsigned char)((bit_row2 & 0x00ff) | ((bit_row3 & 0xff00) >> 8));
+   row[2] = (unsigned char)((bit_row2 & 0xff00) >> 8);
+
+   row[3] = (unsigned char)(bit_row1 & 0x00ff);
+   row[4] = (unsigned char)((bit_row0 & 0x00ff) | ((bit_row1 & 0xff00) >> 8));
+   row[5] = (unsigned char)((bit_row0 & 0xff00) >> 8);
+}
+
+
 static void ogl_flip_blocks(ALLEGRO_LOCKED_REGION *lr, int wc, int hc)
 {
 #define SWAP(x, y) do { unsigned char t = x; x = y; y = t; } while (0)
@@ -699,23 +1273,10 @@ static void ogl_flip_blocks(ALLEGRO_LOCKED_REGION *lr, int wc, int hc)
          for (y = 0; y < hc; y++) {
             unsigned char* row = data;
             for (x = 0; x < wc; x++) {
-               uint16_t bit_row0, bit_row1, bit_row2, bit_row3;
-
                /* Skip the alpha table */
                row += 2;
 
-               bit_row0 = (((uint16_t)row[0]) | (uint16_t)row[1] << 8) << 4;
-               bit_row1 = (((uint16_t)row[1]) | (uint16_t)row[2] << 8) >> 4;
-               bit_row2 = (((uint16_t)row[3]) | (uint16_t)row[4] << 8) << 4;
-               bit_row3 = (((uint16_t)row[4]) | (uint16_t)row[5] << 8) >> 4;
-
-               row[0] = (unsigned char)(bit_row3 & 0x00ff);
-               row[1] = (unsigned char)((bit_row2 & 0x00ff) | ((bit_row3 & 0xff00) >> 8));
-               row[2] = (unsigned char)((bit_row2 & 0xff00) >> 8);
-
-               row[3] = (unsigned char)(bit_row1 & 0x00ff);
-               row[4] = (unsigned char)((bit_row0 & 0x00ff) | ((bit_row1 & 0xff00) >> 8));
-               row[5] = (unsigned char)((bit_row0 & 0xff00) >> 8);
+               flip_alpha_bits(row);
 
                /* Skip the alpha bit-map */
                row += 6;
@@ -734,6 +1295,24 @@ static void ogl_flip_blocks(ALLEGRO_LOCKED_REGION *lr, int wc, int hc)
          }
          break;
       }
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2: {
+         int channels = lr->format == ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2 ? 2 : 1;
+         for (y = 0; y < hc; y++) {
+            unsigned char* row = data;
+            for (x = 0; x < wc * channels; x++) {
+               /* Skip the end points */
+               row += 2;
+
+               flip_alpha_bits(row);
+
+               /* Skip the bit-map */
+               row += 6;
+            }
+            data += lr->pitch;
+         }
+         break;
+      }
       default:
          (void)x;
          (void)y;
@@ -815,7 +1394,8 @@ static ALLEGRO_LOCKED_REGION *ogl_lock_compressed_region(ALLEGRO_BITMAP *bitmap,
       ogl_bitmap->lock_buffer = al_malloc(true_wc * true_hc * block_size);
 
       if (ogl_bitmap->lock_buffer != NULL) {
-         glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
+         _al_ogl_bind_texture(al_get_current_display(), 0,
+            ogl_bitmap->texture);
          glGetCompressedTexImage(GL_TEXTURE_2D, 0, ogl_bitmap->lock_buffer);
          e = glGetError();
          if (e) {
@@ -937,11 +1517,11 @@ static void ogl_unlock_compressed_region(ALLEGRO_BITMAP *bitmap)
       }
    }
 
-   glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
+   _al_ogl_bind_texture(al_get_current_display(), 0, ogl_bitmap->texture);
    glCompressedTexSubImage2D(GL_TEXTURE_2D, 0,
       bitmap->lock_x, gl_y,
       bitmap->lock_w, bitmap->lock_h,
-      get_glformat(lock_format, 0),
+      _al_ogl_get_bitmap_glformat(bitmap, lock_format),
       data_size,
       ogl_bitmap->lock_buffer);
 
@@ -967,45 +1547,242 @@ EXIT:
 #endif
 }
 
+static bool ogl_upload_compressed_levels(ALLEGRO_BITMAP *bitmap,
+   int num_levels, void *data)
+{
+#if !defined ALLEGRO_CFG_OPENGLES
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = bitmap->extra;
+   int format = al_get_bitmap_format(bitmap);
+   int block_width = al_get_pixel_block_width(format);
+   int block_height = al_get_pixel_block_height(format);
+   int block_size = al_get_pixel_block_size(format);
+   ALLEGRO_DISPLAY *old_disp = NULL;
+   ALLEGRO_DISPLAY *disp;
+   unsigned char *level = data;
+   unsigned char *tmp;
+   GLenum e = 0;
+   int w = bitmap->w;
+   int h = bitmap->h;
+   int i;
+
+   /* The levels are stored top to bottom, so the blocks have to be flipped,
+    * which only lines up if the texture is not padded and the height of
+    * every level is a whole number of blocks. Smaller levels are left out.
+    */
+   if (!can_flip_blocks(format) ||
+       ogl_bitmap->true_w != w || ogl_bitmap->true_h != h ||
+       h % block_height != 0) {
+      return false;
+   }
+
+   if (!(al_get_bitmap_flags(bitmap) & ALLEGRO_MIPMAP))
+      num_levels = 1;
+
+   tmp = al_malloc((w + block_width - 1) / block_width * block_size);
+   if (!tmp)
+      return false;
+
+   disp = al_get_current_display();
+
+   /* Change OpenGL context if necessary. */
+   if (!disp ||
+      (_al_get_bitmap_display(bitmap)->ogl_extras->is_shared == false &&
+       _al_get_bitmap_display(bitmap) != disp))
+   {
+      old_disp = disp;
+      _al_set_current_display_only(_al_get_bitmap_display(bitmap));
+   }
+
+   _al_ogl_bind_texture(al_get_current_display(), 0, ogl_bitmap->texture);
+
+   for (i = 0; i < num_levels && h % block_height == 0; i++) {
+      int wc = (w + block_width - 1) / block_width;
+      int hc = h / block_height;
+      int pitch = wc * block_size;
+      ALLEGRO_LOCKED_REGION lr;
+      int y;
+
+      for (y = 0; y < hc / 2; y++) {
+         unsigned char *a = level + y * pitch;
+         unsigned char *b = level + (hc - 1 - y) * pitch;
+         memcpy(tmp, a, pitch);
+         memcpy(a, b, pitch);
+         memcpy(b, tmp, pitch);
+      }
+      lr.data = level;
+      lr.format = format;
+      lr.pitch = pitch;
+      lr.pixel_size = block_size;
+      ogl_flip_blocks(&lr, wc, hc);
+
+      glCompressedTexImage2D(GL_TEXTURE_2D, i,
+         _al_ogl_get_bitmap_glformat(bitmap, format),
+         w, h, 0, pitch * hc, level);
+      e = glGetError();
+      if (e) {
+         ALLEGRO_ERROR("glCompressedTexImage2D for format %s, level %d failed (%s).\n",
+            _al_pixel_format_name(format), i, _al_gl_error_string(e));
+         break;
+      }
+
+      level += pitch * hc;
+      w = _ALLEGRO_MAX(w / 2, 1);
+      h = _ALLEGRO_MAX(h / 2, 1);
+   }
+
+   if (!e) {
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, i - 1);
+   }
+
+   if (old_disp) {
+      _al_set_current_display_only(old_disp);
+   }
+
+   al_free(tmp);
+   return e == 0;
+#else
+   (void)bitmap;
+   (void)num_levels;
+   (void)data;
+   return false;
+#endif
+}
+
+static bool backup_dirty_rect(ALLEGRO_BITMAP *b, int x, int y, int w, int h)
+{
+   ALLEGRO_LOCKED_REGION *lr;
+   int pixel_size;
+   int line_size;
+   int row;
+
+   lr = al_lock_bitmap_region(b, x, y, w, h,
+      _al_get_bitmap_memory_format(b), ALLEGRO_LOCK_READONLY);
+   if (!lr)
+      return false;
+
+   /* The memory copy is stored upside down. */
+   pixel_size = al_get_pixel_size(lr->format);
+   line_size = pixel_size * b->w;
+   for (row = 0; row < h; row++) {
+      unsigned char *p = ((unsigned char *)lr->data) + lr->pitch * row;
+      unsigned char *p2;
+      p2 = ((unsigned char *)b->memory) + line_size * (b->h-1-(y+row)) +
+         pixel_size * x;
+      memcpy(p2, p, pixel_size * w);
+   }
+   al_unlock_bitmap(b);
+   return true;
+}
+
 static void ogl_backup_dirty_bitmap(ALLEGRO_BITMAP *b)
 {
    ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = b->extra;
-   ALLEGRO_LOCKED_REGION *lr;
    int bitmap_flags = al_get_bitmap_flags(b);
+   int i;
 
    if (b->parent)
       return;
 
    if ((bitmap_flags & ALLEGRO_MEMORY_BITMAP) ||
       (bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE) ||
-      !b->dirty ||
       ogl_bitmap->is_backbuffer)
       return;
 
-   ALLEGRO_DEBUG("Backing up dirty bitmap %p\n", b);
+   /* The callback refills the texture, so no copy is kept. */
+   if (b->restore) {
+      al_free(b->memory);
+      b->memory = NULL;
+      b->dirty = false;
+      b->num_dirty_rects = 0;
+      return;
+   }
 
-   lr = al_lock_bitmap(
-      b,
-      _al_get_bitmap_memory_format(b),
-      ALLEGRO_LOCK_READONLY
-   );
+   if (!b->memory) {
+      b->memory = al_calloc(1,
+         al_get_pixel_size(b->_memory_format) * b->w * b->h);
+      if (!b->memory)
+         return;
+      _al_mark_bitmap_all_dirty(b);
+   }
 
-   if (lr) {
-      int line_size = al_get_pixel_size(lr->format) * b->w;
-      int y;
-      for (y = 0; y < b->h; y++) {
-         unsigned char *p = ((unsigned char *)lr->data) + lr->pitch * y;
-         unsigned char *p2;
-         p2 = ((unsigned char *)b->memory) + line_size * (b->h-1-y);
-         memcpy(p2, p, line_size);
+   if (!b->dirty)
+      return;
+
+   /* Regions of compressed bitmaps would have to be aligned to blocks. */
+   if (_al_pixel_format_is_compressed(al_get_bitmap_format(b)))
+      b->num_dirty_rects = 0;
+
+   ALLEGRO_DEBUG("Backing up dirty bitmap %p (%d regions)\n", b,
+      b->num_dirty_rects);
+
+   if (b->num_dirty_rects == 0) {
+      if (!backup_dirty_rect(b, 0, 0, b->w, b->h)) {
+         ALLEGRO_WARN("Failed to lock dirty bitmap %p\n", b);
+         return;
       }
-      al_unlock_bitmap(b);
-      b->dirty = false;
    }
-   else {
-      ALLEGRO_WARN("Failed to lock dirty bitmap %p\n", b);
+
+   for (i = 0; i < b->num_dirty_rects; i++) {
+      _AL_DIRTY_RECT *r = &b->dirty_rects[i];
+      if (!backup_dirty_rect(b, r->x, r->y, r->w, r->h)) {
+         ALLEGRO_WARN("Failed to lock dirty bitmap %p\n", b);
+         /* Keep the regions not backed up yet. */
+         memmove(b->dirty_rects, r,
+            (b->num_dirty_rects - i) * sizeof(*r));
+         b->num_dirty_rects -= i;
+         return;
+      }
+   }
+
+   b->dirty = false;
+   b->num_dirty_rects = 0;
+}
+
+#if !defined(ALLEGRO_CFG_OPENGLES)
+/* Both textures are upside down, so the rows a bitmap covers start at
+ * parent height - y - height.
+ */
+static bool ogl_copy_bitmap(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *src)
+{
+   ALLEGRO_BITMAP *src_parent = src->parent ? src->parent : src;
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = bitmap->extra;
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_src = src_parent->extra;
+   int format = al_get_bitmap_format(bitmap);
+   GLenum e;
+
+   if (!al_get_opengl_extension_list()->ALLEGRO_GL_ARB_copy_image ||
+       !glCopyImageSubData)
+      return false;
+
+   /* Multisampled bitmaps are drawn to a renderbuffer, not the texture. */
+   if (bitmap->parent || ogl_src->is_backbuffer ||
+       al_get_bitmap_samples(bitmap) || al_get_bitmap_samples(src) ||
+       _al_pixel_format_is_compressed(format) ||
+       _al_ogl_get_bitmap_glformat(bitmap, format) !=
+       _al_ogl_get_bitmap_glformat(src_parent, al_get_bitmap_format(src)))
+      return false;
+
+   /* Without glGenerateMipmapEXT the mipmaps would go stale. */
+   if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MIPMAP) &&
+       !al_get_opengl_extension_list()->ALLEGRO_GL_EXT_framebuffer_object)
+      return false;
+
+   glCopyImageSubData(ogl_src->texture, GL_TEXTURE_2D, 0,
+      src->xofs, src_parent->h - src->yofs - src->h, 0,
+      ogl_bitmap->texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+      src->w, src->h, 1);
+   e = glGetError();
+   if (e) {
+      ALLEGRO_ERROR("glCopyImageSubData failed (%s).\n",
+         _al_gl_error_string(e));
+      return false;
    }
+
+   _al_ogl_invalidate_mipmaps(bitmap);
+
+   return true;
 }
+#endif
 
 /* Obtain a reference to this driver. */
 static ALLEGRO_BITMAP_INTERFACE *ogl_bitmap_driver(void)
@@ -1015,20 +1792,29 @@ static ALLEGRO_BITMAP_INTERFACE *ogl_bitmap_driver(void)
    }
 
    glbmp_vt.draw_bitmap_region = ogl_draw_bitmap_region;
+   glbmp_vt.draw_transformed_quads = ogl_draw_transformed_quads;
    glbmp_vt.upload_bitmap = ogl_upload_bitmap;
    glbmp_vt.update_clipping_rectangle = ogl_update_clipping_rectangle;
    glbmp_vt.destroy_bitmap = ogl_destroy_bitmap;
    glbmp_vt.bitmap_pointer_changed = ogl_bitmap_pointer_changed;
+   glbmp_vt.resolve = ogl_resolve;
 #if defined(ALLEGRO_CFG_OPENGLES)
    glbmp_vt.lock_region = _al_ogl_lock_region_gles;
    glbmp_vt.unlock_region = _al_ogl_unlock_region_gles;
 #else
    glbmp_vt.lock_region = _al_ogl_lock_region_new;
    glbmp_vt.unlock_region = _al_ogl_unlock_region_new;
+   glbmp_vt.request_readback = _al_ogl_request_readback;
+   glbmp_vt.is_readback_ready = _al_ogl_is_readback_ready;
+   glbmp_vt.copy_bitmap = ogl_copy_bitmap;
 #endif
    glbmp_vt.lock_compressed_region = ogl_lock_compressed_region;
    glbmp_vt.unlock_compressed_region = ogl_unlock_compressed_region;
+   glbmp_vt.upload_compressed_levels = ogl_upload_compressed_levels;
    glbmp_vt.backup_dirty_bitmap = ogl_backup_dirty_bitmap;
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+   glbmp_vt.draw_bitmap_instances = _al_ogl_draw_bitmap_instances;
+#endif
 
    return &glbmp_vt;
 }
@@ -1055,11 +1841,31 @@ ALLEGRO_BITMAP *_al_ogl_create_bitmap(ALLEGRO_DISPLAY *d, int w, int h,
    true_w = _al_get_least_multiple(w, block_width);
    true_h = _al_get_least_multiple(h, block_height);
 
-   if (_al_pixel_format_is_compressed(format)) {
-      if (!al_get_opengl_extension_list()->ALLEGRO_GL_EXT_texture_compression_s3tc) {
-         ALLEGRO_DEBUG("Device does not support S3TC compressed textures.\n");
-         return NULL;
-      }
+   switch (format) {
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1:
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3:
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5:
+         if (!al_get_opengl_extension_list()->ALLEGRO_GL_EXT_texture_compression_s3tc) {
+            ALLEGRO_DEBUG("Device does not support S3TC compressed textures.\n");
+            return NULL;
+         }
+         break;
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1:
+      case ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2:
+         if (!al_get_opengl_extension_list()->ALLEGRO_GL_ARB_texture_compression_rgtc &&
+             !al_get_opengl_extension_list()->ALLEGRO_GL_EXT_texture_compression_rgtc) {
+            ALLEGRO_DEBUG("Device does not support RGTC compressed textures.\n");
+            return NULL;
+         }
+         break;
+      default:
+         break;
+   }
+
+   if ((flags & ALLEGRO_SRGB) && !get_srgb_glformat(format)) {
+      ALLEGRO_WARN("No sRGB texture format for %s, ignoring ALLEGRO_SRGB.\n",
+         _al_pixel_format_name(format));
+      flags &= ~ALLEGRO_SRGB;
    }
 
    if (!d->extra_settings.settings[ALLEGRO_SUPPORT_NPOT_BITMAP]) {
@@ -1157,9 +1963,51 @@ void _al_ogl_upload_bitmap_memory(ALLEGRO_BITMAP *bitmap, int format, void *ptr)
    al_destroy_bitmap(tmp);
 }
 
-/* Function: al_get_opengl_texture
+/* Marks the mipmaps of an ALLEGRO_MIPMAP bitmap as stale after its texture
+ * changed. They are only regenerated by _al_ogl_update_mipmaps when the
+ * bitmap is next drawn, so many changes in a row cost a single update.
+ * Without glGenerateMipmapEXT the driver keeps them up to date itself.
  */
-GLuint al_get_opengl_texture(ALLEGRO_BITMAP *bitmap)
+void _al_ogl_invalidate_mipmaps(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = bitmap->extra;
+
+   if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MIPMAP) &&
+       (al_get_opengl_extension_list()->ALLEGRO_GL_EXT_framebuffer_object ||
+        al_get_opengl_extension_list()->ALLEGRO_GL_OES_framebuffer_object ||
+        IS_OPENGLES /* FIXME */)) {
+      ogl_bitmap->mipmaps_dirty = true;
+   }
+}
+
+
+void _al_ogl_update_mipmaps(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = bitmap->extra;
+   GLenum e;
+
+   if (!ogl_bitmap->mipmaps_dirty)
+      return;
+
+   /* The target may still be drawn into after this. */
+   ogl_bitmap->mipmaps_dirty =
+      _al_get_bitmap_display(bitmap)->ogl_extras->opengl_target == bitmap;
+
+   _al_ogl_bind_texture(display, 0, ogl_bitmap->texture);
+   glGenerateMipmapEXT(GL_TEXTURE_2D);
+   e = glGetError();
+   if (e) {
+      ALLEGRO_ERROR("glGenerateMipmapEXT for texture %d failed (%s).\n",
+         ogl_bitmap->texture, _al_gl_error_string(e));
+   }
+   display->stats[ALLEGRO_DISPLAY_STAT_MIPMAP_UPDATES]++;
+}
+
+
+/* Returns the texture of the bitmap, like al_get_opengl_texture, without
+ * dropping the state shadow. This is what Allegro itself uses for drawing.
+ */
+GLuint _al_ogl_get_texture(ALLEGRO_BITMAP *bitmap)
 {
    ALLEGRO_BITMAP_EXTRA_OPENGL *extra;
    if (bitmap->parent)
@@ -1167,9 +2015,22 @@ GLuint al_get_opengl_texture(ALLEGRO_BITMAP *bitmap)
    if (!(al_get_bitmap_flags(bitmap) & _ALLEGRO_INTERNAL_OPENGL))
       return 0;
    extra = bitmap->extra;
+   if (extra->fbo_info && extra->fbo_info->unresolved)
+      _al_ogl_auto_resolve_bitmap(al_get_current_display(), bitmap);
+   if (extra->mipmaps_dirty)
+      _al_ogl_update_mipmaps(al_get_current_display(), bitmap);
    return extra->texture;
 }
 
+/* Function: al_get_opengl_texture
+ */
+GLuint al_get_opengl_texture(ALLEGRO_BITMAP *bitmap)
+{
+   /* The caller is about to use the texture with OpenGL calls of its own. */
+   al_invalidate_opengl_state();
+   return _al_ogl_get_texture(bitmap);
+}
+
 /* Function: al_remove_opengl_fbo
  */
 void al_remove_opengl_fbo(ALLEGRO_BITMAP *bitmap)
@@ -1210,6 +2071,9 @@ GLuint al_get_opengl_fbo(ALLEGRO_BITMAP *bitmap)
 
    ogl_bitmap = bitmap->extra;
 
+   /* The caller is about to render into the FBO with its own calls. */
+   al_invalidate_opengl_state();
+
    if (!ogl_bitmap->fbo_info) {
       if (!_al_ogl_create_persistent_fbo(bitmap)) {
          return 0;
@@ -37,6 +37,17 @@ ALLEGRO_DEBUG_CHANNEL("opengl")
 void _al_ogl_setup_gl(ALLEGRO_DISPLAY *d)
 {
    ALLEGRO_OGL_EXTRAS *ogl = d->ogl_extras;
+   const char *value;
+
+   /* The context is new or was recreated, so nothing is known about it. */
+   _al_ogl_invalidate_state(d);
+
+   value = al_get_config_value(al_get_system_config(), "opengl",
+      "cull_held_draws");
+   ogl->cull_held_draws = !value || strcmp(value, "false") != 0;
+   value = al_get_config_value(al_get_system_config(), "opengl",
+      "clip_held_draws");
+   ogl->clip_held_draws = value && strcmp(value, "true") == 0;
 
    if (ogl->backbuffer) {
       ALLEGRO_BITMAP *target = al_get_target_bitmap();
@@ -71,20 +82,11 @@ void _al_ogl_set_target_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap)
 
    _al_ogl_setup_fbo(display, bitmap);
    if (display->ogl_extras->opengl_target == target) {
-      _al_ogl_setup_bitmap_clipping(bitmap);
+      _al_ogl_setup_bitmap_clipping(display, bitmap);
    }
 }
 
 
-void _al_ogl_unset_target_bitmap(ALLEGRO_DISPLAY *display,
-   ALLEGRO_BITMAP *target)
-{
-   if (!target)
-      return;
-   _al_ogl_finalize_fbo(display, target);
-}
-
-
 /* Function: al_set_current_opengl_context
  */
 void al_set_current_opengl_context(ALLEGRO_DISPLAY *display)
@@ -106,11 +108,14 @@ void al_set_current_opengl_context(ALLEGRO_DISPLAY *display)
 }
 
 
-void _al_ogl_setup_bitmap_clipping(const ALLEGRO_BITMAP *bitmap)
+void _al_ogl_setup_bitmap_clipping(ALLEGRO_DISPLAY *display,
+   const ALLEGRO_BITMAP *bitmap)
 {
    int x_1, y_1, x_2, y_2, h;
    bool use_scissor = true;
 
+   display->ogl_extras->held_scissor_stale = false;
+
    x_1 = bitmap->cl;
    y_1 = bitmap->ct;
    x_2 = bitmap->cr_excl;
@@ -142,16 +147,17 @@ void _al_ogl_setup_bitmap_clipping(const ALLEGRO_BITMAP *bitmap)
       }
    }
    if (!use_scissor) {
-      glDisable(GL_SCISSOR_TEST);
+      _al_ogl_set_scissor(display, false, 0, 0, 0, 0);
    }
    else {
-      glEnable(GL_SCISSOR_TEST);
-       
       #ifdef ALLEGRO_IPHONE
+      _al_ogl_set_scissor(display, true, 0, 0, 0, 0);
       _al_iphone_clip(bitmap, x_1, y_1, x_2, y_2);
+      display->ogl_extras->state.scissor_valid = false;
       #else
       /* OpenGL is upside down, so must adjust y_2 to the height. */
-      glScissor(x_1, h - y_2, x_2 - x_1, y_2 - y_1);
+      _al_ogl_set_scissor(display, true,
+         x_1, h - y_2, x_2 - x_1, y_2 - y_1);
       #endif
    }
 }
@@ -15,6 +15,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_memdraw.h"
 #include "allegro5/internal/aintern_opengl.h"
@@ -69,12 +70,23 @@ bool _al_opengl_set_blender(ALLEGRO_DISPLAY *ogl_disp)
    const int blend_equations[3] = {
       GL_FUNC_ADD, GL_FUNC_SUBTRACT, GL_FUNC_REVERSE_SUBTRACT
    };
-
-   (void)ogl_disp;
+   ALLEGRO_OGL_STATE *s = &ogl_disp->ogl_extras->state;
 
    al_get_separate_bitmap_blender(&op, &src_color, &dst_color,
       &op_alpha, &src_alpha, &dst_alpha);
    const_color = al_get_bitmap_blend_color();
+
+   /* Most batches are drawn with the blender of the previous one. */
+   if (s->blend_valid &&
+         s->blend_op == op && s->blend_op_alpha == op_alpha &&
+         s->blend_src_color == src_color && s->blend_dst_color == dst_color &&
+         s->blend_src_alpha == src_alpha && s->blend_dst_alpha == dst_alpha &&
+         s->blend_color.r == const_color.r &&
+         s->blend_color.g == const_color.g &&
+         s->blend_color.b == const_color.b &&
+         s->blend_color.a == const_color.a) {
+      return true;
+   }
    /* glBlendFuncSeparate was only included with OpenGL 1.4 */
 #if !defined ALLEGRO_CFG_OPENGLES
    if (ogl_disp->ogl_extras->ogl_info.version >= _ALLEGRO_OPENGL_VERSION_1_4) {
@@ -115,6 +127,15 @@ bool _al_opengl_set_blender(ALLEGRO_DISPLAY *ogl_disp)
          return false;
       }
    }
+
+   s->blend_valid = true;
+   s->blend_op = op;
+   s->blend_op_alpha = op_alpha;
+   s->blend_src_color = src_color;
+   s->blend_dst_color = dst_color;
+   s->blend_src_alpha = src_alpha;
+   s->blend_dst_alpha = dst_alpha;
+   s->blend_color = const_color;
    return true;
 }
 
@@ -162,7 +183,7 @@ static void color_ptr_on(ALLEGRO_DISPLAY *display, int n, GLint t, int stride, v
    if (display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
 #ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
       if (display->ogl_extras->varlocs.color_loc >= 0) {
-         glVertexAttribPointer(display->ogl_extras->varlocs.color_loc, n, t, false, stride, v);
+         glVertexAttribPointer(display->ogl_extras->varlocs.color_loc, n, t, t != GL_FLOAT, stride, v);
          glEnableVertexAttribArray(display->ogl_extras->varlocs.color_loc);
       }
 #endif
@@ -241,7 +262,7 @@ static void ogl_clear(ALLEGRO_DISPLAY *d, ALLEGRO_COLOR *color)
          ogl_disp->ogl_extras->opengl_target != target)
       || target->locked)
    {
-      _al_clear_bitmap_by_locking(target, color);
+      _al_clear_bitmap_by_locking(al_get_target_bitmap(), color);
       return;
    }
 
@@ -296,9 +317,236 @@ static void ogl_draw_pixel(ALLEGRO_DISPLAY *d, float x, float y,
    color_ptr_off(d);
 }
 
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+/* With OpenGL 3.0+ the held drawing vertex cache is streamed through a
+ * single vbo used as a ring buffer. The ring is split into
+ * ALLEGRO_OGL_VBO_SEGMENTS segments. Once all vertices in a segment have
+ * been submitted a fence is inserted behind them, and we wait for that fence
+ * before writing into the segment again after wrapping around. This means we
+ * never have to re-allocate the buffer or wait for the GPU in the common
+ * case.
+ *
+ * With ARB_buffer_storage the whole ring is persistently mapped and
+ * ogl_prepare_vertex_cache hands out pointers straight into it. Otherwise
+ * vertices are still collected in disp->vertex_cache and copied into the
+ * ring with an unsynchronized glMapBufferRange on flush.
+ */
+#define VBO_RING_SIZE   \
+   (ALLEGRO_OGL_VBO_SEGMENTS * 32768 * (int)sizeof(ALLEGRO_OGL_BITMAP_VERTEX))
+
+static int vbo_ring_segment(ALLEGRO_OGL_EXTRAS *o, int offset)
+{
+   return offset / (o->vbo_size / ALLEGRO_OGL_VBO_SEGMENTS);
+}
+
+static void vbo_ring_wait(ALLEGRO_OGL_EXTRAS *o, int seg)
+{
+   GLsync fence = o->vbo_fences[seg];
+   GLenum ret;
+
+   if (!fence)
+      return;
+
+   do {
+      ret = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+   } while (ret == GL_TIMEOUT_EXPIRED);
+
+   if (ret == GL_WAIT_FAILED) {
+      ALLEGRO_WARN("glClientWaitSync failed.\n");
+   }
+
+   glDeleteSync(fence);
+   o->vbo_fences[seg] = NULL;
+}
+
+/* Fence all segments before 'seg' not fenced so far. */
+static void vbo_ring_fence(ALLEGRO_OGL_EXTRAS *o, int seg)
+{
+   for (; o->vbo_unfenced < seg; o->vbo_unfenced++) {
+      ASSERT(!o->vbo_fences[o->vbo_unfenced]);
+      o->vbo_fences[o->vbo_unfenced] =
+         glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   }
+}
+
+/* Start writing at the beginning of the ring again. Everything written so
+ * far must already have been submitted.
+ */
+static void vbo_ring_wrap(ALLEGRO_OGL_EXTRAS *o)
+{
+   vbo_ring_fence(o, o->vbo_seg + 1);
+   o->vbo_head = 0;
+   o->vbo_seg = 0;
+   o->vbo_unfenced = 0;
+   vbo_ring_wait(o, 0);
+}
+
+/* Make sure all segments up to byte 'end' (exclusive) are safe to write. */
+static void vbo_ring_advance(ALLEGRO_OGL_EXTRAS *o, int end)
+{
+   while (vbo_ring_segment(o, end - 1) > o->vbo_seg) {
+      o->vbo_seg++;
+      vbo_ring_wait(o, o->vbo_seg);
+   }
+}
+
+static void vbo_ring_resize(ALLEGRO_OGL_EXTRAS *o, int size)
+{
+   int seg;
+
+   /* Orphaning the old storage means no pending draw can still use
+    * the memory we write to, so the old fences are not needed any longer.
+    */
+   for (seg = 0; seg < ALLEGRO_OGL_VBO_SEGMENTS; seg++) {
+      if (o->vbo_fences[seg]) {
+         glDeleteSync(o->vbo_fences[seg]);
+         o->vbo_fences[seg] = NULL;
+      }
+   }
+
+   glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+   o->vbo_size = size;
+   o->vbo_head = 0;
+   o->vbo_seg = 0;
+   o->vbo_unfenced = 0;
+}
+
+static void setup_vbo(ALLEGRO_DISPLAY *disp)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   ALLEGRO_OGL_EXT_LIST *ext = o->extension_list;
+
+   glGenBuffers(1, &o->vbo);
+   ALLEGRO_DEBUG("new VBO: %u\n", o->vbo);
+
+   if (!ext->ALLEGRO_GL_ARB_sync || !ext->ALLEGRO_GL_ARB_map_buffer_range)
+      return;
+
+   glBindBuffer(GL_ARRAY_BUFFER, o->vbo);
+
+   if (ext->ALLEGRO_GL_ARB_buffer_storage) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+         GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_ARRAY_BUFFER, VBO_RING_SIZE, NULL, flags);
+      o->vbo_map = glMapBufferRange(GL_ARRAY_BUFFER, 0, VBO_RING_SIZE, flags);
+      if (o->vbo_map) {
+         ALLEGRO_DEBUG("Persistently mapped VBO ring.\n");
+         o->vbo_size = VBO_RING_SIZE;
+      }
+      else {
+         /* The storage is immutable, so we need a new buffer. */
+         ALLEGRO_WARN("Mapping VBO persistently failed.\n");
+         glBindBuffer(GL_ARRAY_BUFFER, 0);
+         glDeleteBuffers(1, &o->vbo);
+         glGenBuffers(1, &o->vbo);
+         glBindBuffer(GL_ARRAY_BUFFER, o->vbo);
+      }
+   }
+
+   if (!o->vbo_map) {
+      vbo_ring_resize(o, VBO_RING_SIZE);
+   }
+
+   o->vbo_ring = true;
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+#endif
+
+/* The size of the vertices in the held drawing batch. */
+static int vertex_cache_stride(ALLEGRO_DISPLAY *disp)
+{
+   if (disp->ogl_extras->packed_vertices)
+      return sizeof(ALLEGRO_OGL_PACKED_BITMAP_VERTEX);
+   return sizeof(ALLEGRO_OGL_BITMAP_VERTEX);
+}
+
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+static void *prepare_mapped_vertices(ALLEGRO_DISPLAY *disp,
+   int num_new_vertices)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   int stride = vertex_cache_stride(disp);
+   int start;
+
+   if (o->vbo_heap_batch)
+      return NULL;
+
+   /* A batch which cannot fit into the ring even on its own goes to the
+    * heap vertex cache.
+    */
+   if ((disp->num_cache_vertices + num_new_vertices) * stride > o->vbo_size) {
+      _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_FULL_FLUSHES);
+      if (num_new_vertices * stride > o->vbo_size) {
+         o->vbo_heap_batch = true;
+         return NULL;
+      }
+   }
+
+   /* The vertices of a batch must be contiguous, so submit what we have so
+    * far if the new ones would not fit.
+    */
+   if (o->vbo_head + (disp->num_cache_vertices + num_new_vertices) * stride >
+         o->vbo_size) {
+      _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_FULL_FLUSHES);
+      vbo_ring_wrap(o);
+   }
+
+   start = o->vbo_head + disp->num_cache_vertices * stride;
+   vbo_ring_advance(o, start + num_new_vertices * stride);
+   disp->num_cache_vertices += num_new_vertices;
+
+   return (char *)o->vbo_map + start;
+}
+
+/* Copies the vertex cache into the ring, returns its offset. */
+static int upload_vertex_cache(ALLEGRO_DISPLAY *disp)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   int bytes = disp->num_cache_vertices * vertex_cache_stride(disp);
+   void *ptr;
+
+   if (bytes > o->vbo_size) {
+      int size = o->vbo_size;
+      while (size < bytes)
+         size *= 2;
+      vbo_ring_resize(o, size);
+   }
+   else if (o->vbo_head + bytes > o->vbo_size) {
+      vbo_ring_wrap(o);
+   }
+
+   vbo_ring_advance(o, o->vbo_head + bytes);
+
+   ptr = glMapBufferRange(GL_ARRAY_BUFFER, o->vbo_head, bytes,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+   if (ptr) {
+      memcpy(ptr, disp->vertex_cache, bytes);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+   }
+   else {
+      glBufferSubData(GL_ARRAY_BUFFER, o->vbo_head, bytes, disp->vertex_cache);
+   }
+
+   return o->vbo_head;
+}
+#endif
+
 static void* ogl_prepare_vertex_cache(ALLEGRO_DISPLAY* disp, 
                                       int num_new_vertices)
 {
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+   if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
+      if (disp->ogl_extras->vbo == 0)
+         setup_vbo(disp);
+      if (disp->ogl_extras->vbo_map) {
+         void *ptr = prepare_mapped_vertices(disp, num_new_vertices);
+         if (ptr)
+            return ptr;
+      }
+   }
+#endif
+
    disp->num_cache_vertices += num_new_vertices;
    if (!disp->vertex_cache) {
       disp->vertex_cache = al_malloc(num_new_vertices * sizeof(ALLEGRO_OGL_BITMAP_VERTEX));
@@ -310,23 +558,70 @@ static void* ogl_prepare_vertex_cache(ALLEGRO_DISPLAY* disp,
                               
       disp->vertex_cache_size = 2 * disp->num_cache_vertices;
    }
-   return (ALLEGRO_OGL_BITMAP_VERTEX*)disp->vertex_cache + 
-         (disp->num_cache_vertices - num_new_vertices);
+   /* The cache is sized for the larger vertices, so the batch fits whatever
+    * layout it uses.
+    */
+   return (char *)disp->vertex_cache +
+         (disp->num_cache_vertices - num_new_vertices) *
+         vertex_cache_stride(disp);
 }
 
-static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
+/* Binds the textures of a batch sampling several of them, see
+ * held_texture_unit in ogl_bitmap.c. Returns false for ordinary batches.
+ */
+static bool bind_held_textures(ALLEGRO_DISPLAY *disp)
 {
-   GLuint current_texture;
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
    ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   GLint units[_ALLEGRO_MAX_HELD_TEXTURES];
+   int i;
+
+   if (o->num_held_textures == 0 || o->varlocs.held_tex_loc < 0)
+      return false;
+
+   /* In reverse so that unit 0 is left active. */
+   for (i = o->num_held_textures - 1; i >= 0; i--) {
+      _al_ogl_bind_texture(disp, i, o->held_textures[i]);
+      units[i] = i;
+   }
+   glUniform1iv(o->varlocs.held_tex_loc, o->num_held_textures, units);
+   return true;
+#else
+   (void)disp;
+   return false;
+#endif
+}
+
+static void draw_vertex_cache(ALLEGRO_DISPLAY *disp)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   int stride = vertex_cache_stride(disp);
+   GLenum color_type = GL_FLOAT;
+   size_t color_ofs = offsetof(ALLEGRO_OGL_BITMAP_VERTEX, r);
+   GLenum unit_type = GL_FLOAT;
+   size_t unit_ofs = offsetof(ALLEGRO_OGL_BITMAP_VERTEX, unit);
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+   int bytes = disp->num_cache_vertices * stride;
+   int first = 0; /* Offset of the batch in the vbo. */
+#endif
    (void)o; /* not used in all ports */
    
-   if (!disp->vertex_cache)
-      return;
    if (disp->num_cache_vertices == 0)
       return;
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+   if (!disp->vertex_cache && !o->vbo_map)
+      return;
+#else
+   if (!disp->vertex_cache)
+      return;
+#endif
 
    if (!_al_opengl_set_blender(disp)) {
       disp->num_cache_vertices = 0;
+      o->num_held_textures = 0;
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+      o->vbo_heap_batch = false;
+#endif
       return;
    }
 
@@ -344,24 +639,27 @@ static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
       glEnable(GL_TEXTURE_2D);
    }
 
-   glGetIntegerv(GL_TEXTURE_BINDING_2D, (GLint*)&current_texture);
-   if (current_texture != disp->cache_texture) {
-      if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
+   if (o->packed_vertices) {
+      color_type = GL_UNSIGNED_BYTE;
+      color_ofs = offsetof(ALLEGRO_OGL_PACKED_BITMAP_VERTEX, r);
+      unit_type = GL_UNSIGNED_BYTE;
+      unit_ofs = offsetof(ALLEGRO_OGL_PACKED_BITMAP_VERTEX, unit);
+   }
+
+   if (!bind_held_textures(disp)) {
+      /* Use texture unit 0 */
+      if (_al_ogl_bind_texture(disp, 0, disp->cache_texture)) {
+         if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
 #ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
-         /* Use texture unit 0 */
-         glActiveTexture(GL_TEXTURE0);
-         if (disp->ogl_extras->varlocs.tex_loc >= 0)
-            glUniform1i(disp->ogl_extras->varlocs.tex_loc, 0);
+            if (disp->ogl_extras->varlocs.tex_loc >= 0)
+               glUniform1i(disp->ogl_extras->varlocs.tex_loc, 0);
 #endif
+         }
       }
-      glBindTexture(GL_TEXTURE_2D, disp->cache_texture);
    }
 
 #if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
    if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
-      int stride = sizeof(ALLEGRO_OGL_BITMAP_VERTEX);
-      int bytes = disp->num_cache_vertices * stride;
-
       /* We create the VAO and VBO on first use. */
       if (o->vao == 0) {
          glGenVertexArrays(1, &o->vao);
@@ -370,44 +668,74 @@ static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
       glBindVertexArray(o->vao);
 
       if (o->vbo == 0) {
-         glGenBuffers(1, &o->vbo);
-         ALLEGRO_DEBUG("new VBO: %u\n", o->vbo);
+         setup_vbo(disp);
       }
       glBindBuffer(GL_ARRAY_BUFFER, o->vbo);
 
-      /* Then we upload data into it. */
-      glBufferData(GL_ARRAY_BUFFER, bytes, disp->vertex_cache, GL_STREAM_DRAW);
+      /* Then we upload data into it, unless we wrote straight into the
+       * mapped buffer already.
+       */
+      if (o->vbo_heap_batch) {
+         if (o->vbo_heap == 0)
+            glGenBuffers(1, &o->vbo_heap);
+         glBindBuffer(GL_ARRAY_BUFFER, o->vbo_heap);
+         glBufferData(GL_ARRAY_BUFFER, bytes, disp->vertex_cache, GL_STREAM_DRAW);
+      }
+      else if (o->vbo_map) {
+         first = o->vbo_head;
+      }
+      else if (o->vbo_ring) {
+         first = upload_vertex_cache(disp);
+      }
+      else {
+         glBufferData(GL_ARRAY_BUFFER, bytes, disp->vertex_cache, GL_STREAM_DRAW);
+      }
 
       /* Finally set the "pos", "texccord" and "color" attributes used by our
        * shader and enable them.
        */
       if (o->varlocs.pos_loc >= 0)  {
          glVertexAttribPointer(o->varlocs.pos_loc, 3, GL_FLOAT, false, stride,
-            (void *)offsetof(ALLEGRO_OGL_BITMAP_VERTEX, x));
+            (void *)(first + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, x)));
          glEnableVertexAttribArray(o->varlocs.pos_loc);
       }
 
       if (o->varlocs.texcoord_loc >= 0) {
          glVertexAttribPointer(o->varlocs.texcoord_loc, 2, GL_FLOAT, false, stride,
-            (void *)offsetof(ALLEGRO_OGL_BITMAP_VERTEX, tx));
+            (void *)(first + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, tx)));
          glEnableVertexAttribArray(o->varlocs.texcoord_loc);
       }
       
       if (o->varlocs.color_loc >= 0) {
-         glVertexAttribPointer(o->varlocs.color_loc, 4, GL_FLOAT, false, stride,
-            (void *)offsetof(ALLEGRO_OGL_BITMAP_VERTEX, r));
+         glVertexAttribPointer(o->varlocs.color_loc, 4, color_type,
+            color_type != GL_FLOAT, stride, (void *)(first + color_ofs));
          glEnableVertexAttribArray(o->varlocs.color_loc);
       }
+
+      if (o->varlocs.tex_unit_loc >= 0) {
+         glVertexAttribPointer(o->varlocs.tex_unit_loc, 1, unit_type, false,
+            stride, (void *)(first + unit_ofs));
+         glEnableVertexAttribArray(o->varlocs.tex_unit_loc);
+      }
    }
    else
 #endif
    {
-      vert_ptr_on(disp, 3, GL_FLOAT, sizeof(ALLEGRO_OGL_BITMAP_VERTEX),
-         (char *)(disp->vertex_cache) + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, x));
-      tex_ptr_on(disp, 2, GL_FLOAT, sizeof(ALLEGRO_OGL_BITMAP_VERTEX),
-         (char*)(disp->vertex_cache) + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, tx));
-      color_ptr_on(disp, 4, GL_FLOAT, sizeof(ALLEGRO_OGL_BITMAP_VERTEX),
-         (char*)(disp->vertex_cache) + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, r));
+      char *base = disp->vertex_cache;
+
+      vert_ptr_on(disp, 3, GL_FLOAT, stride,
+         base + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, x));
+      tex_ptr_on(disp, 2, GL_FLOAT, stride,
+         base + offsetof(ALLEGRO_OGL_BITMAP_VERTEX, tx));
+      color_ptr_on(disp, 4, color_type, stride, base + color_ofs);
+
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+      if ((disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) && o->varlocs.tex_unit_loc >= 0) {
+         glVertexAttribPointer(o->varlocs.tex_unit_loc, 1, unit_type, false,
+            stride, base + unit_ofs);
+         glEnableVertexAttribArray(o->varlocs.tex_unit_loc);
+      }
+#endif
 
 #ifdef ALLEGRO_CFG_OPENGL_FIXED_FUNCTION
       if (!(disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE))
@@ -435,8 +763,18 @@ static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
          glDisableVertexAttribArray(o->varlocs.texcoord_loc);
       if (o->varlocs.color_loc >= 0)
          glDisableVertexAttribArray(o->varlocs.color_loc);
+      if (o->varlocs.tex_unit_loc >= 0)
+         glDisableVertexAttribArray(o->varlocs.tex_unit_loc);
       glBindBuffer(GL_ARRAY_BUFFER, 0);
       glBindVertexArray(0);
+
+      if (o->vbo_heap_batch) {
+         o->vbo_heap_batch = false;
+      }
+      else if (o->vbo_ring) {
+         o->vbo_head = first + bytes;
+         vbo_ring_fence(o, o->vbo_seg);
+      }
    }
    else
 #endif
@@ -444,9 +782,14 @@ static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
       vert_ptr_off(disp);
       tex_ptr_off(disp);
       color_ptr_off(disp);
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+      if ((disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) && o->varlocs.tex_unit_loc >= 0)
+         glDisableVertexAttribArray(o->varlocs.tex_unit_loc);
+#endif
    }
 
    disp->num_cache_vertices = 0;
+   o->num_held_textures = 0;
 
    if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
 #ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
@@ -459,19 +802,47 @@ static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
    }
 }
 
+static void ogl_flush_vertex_cache(ALLEGRO_DISPLAY *disp)
+{
+   _AL_BEGIN_CPU_ZONE("ogl_flush_vertex_cache");
+   draw_vertex_cache(disp);
+
+   /* With clip_held_draws the scissor test may not match the clipping
+    * rectangle, which is only allowed while drawing is held.
+    */
+   if (!disp->cache_enabled && disp->ogl_extras->held_scissor_stale) {
+      ALLEGRO_BITMAP *target = al_get_target_bitmap();
+      if (target && target->vt && target->vt->update_clipping_rectangle)
+         target->vt->update_clipping_rectangle(target);
+   }
+   _AL_END_CPU_ZONE();
+}
+
 static void ogl_update_transformation(ALLEGRO_DISPLAY* disp,
    ALLEGRO_BITMAP *target)
 {
    if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
 #ifdef ALLEGRO_CFG_SHADER_GLSL
       GLint loc = disp->ogl_extras->varlocs.projview_matrix_loc;
+      GLuint program = disp->ogl_extras->program_object;
       ALLEGRO_TRANSFORM projview;
       al_copy_transform(&projview, &target->transform);
       al_compose_transform(&projview, &target->proj_transform);
-      al_copy_transform(&disp->projview_transform, &projview);
 
-      if (disp->ogl_extras->program_object > 0 && loc >= 0) {
-         _al_glsl_set_projview_matrix(loc, &disp->projview_transform);
+      /* Drawing code often sets the same transform again, e.g. restoring it
+       * after every bitmap draw, so skip the upload if nothing changed.
+       */
+      if (program == 0 || disp->ogl_extras->projview_program != program ||
+            memcmp(&projview, &disp->projview_transform, sizeof(projview)) != 0) {
+         al_copy_transform(&disp->projview_transform, &projview);
+
+         if (program > 0 && loc >= 0) {
+            _al_glsl_set_projview_matrix(loc, &disp->projview_transform);
+            disp->ogl_extras->projview_program = program;
+         }
+         else {
+            disp->ogl_extras->projview_program = 0;
+         }
       }
 #endif
    } else {
@@ -486,9 +857,10 @@ static void ogl_update_transformation(ALLEGRO_DISPLAY* disp,
    if (target->parent) {
       ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_extra = target->parent->extra;
       /* glViewport requires the bottom-left coordinate of the corner. */
-      glViewport(target->xofs, ogl_extra->true_h - (target->yofs + target->h), target->w, target->h);
+      _al_ogl_set_viewport(disp, target->xofs,
+         ogl_extra->true_h - (target->yofs + target->h), target->w, target->h);
    } else {
-      glViewport(0, 0, target->w, target->h);
+      _al_ogl_set_viewport(disp, 0, 0, target->w, target->h);
    }
 }
 
@@ -517,7 +889,10 @@ void _al_ogl_add_drawing_functions(ALLEGRO_DISPLAY_INTERFACE *vt)
    
    vt->flush_vertex_cache = ogl_flush_vertex_cache;
    vt->prepare_vertex_cache = ogl_prepare_vertex_cache;
+   vt->draw_held_triangles = _al_ogl_draw_held_triangles;
    vt->update_transformation = ogl_update_transformation;
+
+   _al_ogl_add_gpu_timer_functions(vt);
 }
 
 /* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,146 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      EGL partial presents.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include <string.h>
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_opengl.h"
+
+#if defined(ALLEGRO_ANDROID) || defined(ALLEGRO_RASPBERRYPI)
+
+#include <EGL/eglext.h>
+
+ALLEGRO_DEBUG_CHANNEL("opengl")
+
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+
+typedef EGLBoolean (*SWAP_WITH_DAMAGE_PROC)(EGLDisplay dpy,
+   EGLSurface surface, const EGLint *rects, EGLint n_rects);
+
+static bool checked_extensions;
+static SWAP_WITH_DAMAGE_PROC swap_with_damage;
+static bool have_buffer_age;
+
+
+static bool has_extension(const char *list, const char *name)
+{
+   size_t len = strlen(name);
+   const char *p = list;
+
+   while ((p = strstr(p, name))) {
+      if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+         return true;
+      p += len;
+   }
+   return false;
+}
+
+
+static void check_extensions(EGLDisplay dpy)
+{
+   const char *ext;
+
+   if (checked_extensions)
+      return;
+   checked_extensions = true;
+
+   ext = eglQueryString(dpy, EGL_EXTENSIONS);
+   if (!ext)
+      return;
+
+   if (has_extension(ext, "EGL_KHR_swap_buffers_with_damage")) {
+      swap_with_damage = (SWAP_WITH_DAMAGE_PROC)
+         eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+   }
+   else if (has_extension(ext, "EGL_EXT_swap_buffers_with_damage")) {
+      swap_with_damage = (SWAP_WITH_DAMAGE_PROC)
+         eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+   }
+   have_buffer_age = has_extension(ext, "EGL_EXT_buffer_age");
+
+   ALLEGRO_INFO("Swap with damage: %s, buffer age: %s\n",
+      swap_with_damage ? "yes" : "no", have_buffer_age ? "yes" : "no");
+}
+
+
+/* Returns whether _al_egl_swap_buffers_with_damage can present less than
+ * the whole surface.
+ */
+bool _al_egl_have_swap_with_damage(EGLDisplay dpy)
+{
+   check_extensions(dpy);
+   return swap_with_damage != NULL;
+}
+
+
+/* Swaps the buffers of the surface, telling the compositor that only the
+ * given region in Allegro coordinates changed. Returns false without
+ * swapping if that is not supported or the region is empty.
+ */
+bool _al_egl_swap_buffers_with_damage(EGLDisplay dpy, EGLSurface surface,
+   int surface_w, int surface_h, int x, int y, int w, int h)
+{
+   EGLint rect[4];
+
+   if (!_al_egl_have_swap_with_damage(dpy))
+      return false;
+
+   if (x < 0) {
+      w += x;
+      x = 0;
+   }
+   if (y < 0) {
+      h += y;
+      y = 0;
+   }
+   w = _ALLEGRO_MIN(w, surface_w - x);
+   h = _ALLEGRO_MIN(h, surface_h - y);
+   if (w <= 0 || h <= 0)
+      return false;
+
+   /* EGL counts rows from the bottom. */
+   rect[0] = x;
+   rect[1] = surface_h - (y + h);
+   rect[2] = w;
+   rect[3] = h;
+   if (!swap_with_damage(dpy, surface, rect, 1)) {
+      ALLEGRO_WARN("eglSwapBuffersWithDamage failed (%#x)\n", eglGetError());
+      return false;
+   }
+   return true;
+}
+
+
+/* Returns the age of the back buffer of the surface in frames, or 0 if it
+ * is unknown.
+ */
+int _al_egl_get_buffer_age(EGLDisplay dpy, EGLSurface surface)
+{
+   EGLint age;
+
+   check_extensions(dpy);
+   if (!have_buffer_age)
+      return 0;
+   if (!eglQuerySurface(dpy, surface, EGL_BUFFER_AGE_EXT, &age))
+      return 0;
+   return age;
+}
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
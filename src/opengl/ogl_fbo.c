@@ -40,55 +40,53 @@ static void use_fbo_for_bitmap(ALLEGRO_DISPLAY *display,
    ALLEGRO_BITMAP *bitmap, ALLEGRO_FBO_INFO *info);
 
 
-/* glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT..) not supported on some Androids.
- * We keep track of it manually.
+/* Binds fbo in the context of the current display and returns the one bound
+ * before. The binding is shadowed in the display's state, so binding the
+ * same FBO again costs nothing and it only has to be queried when unknown.
+ * glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT..) is not supported on some
+ * Androids, which assume 0 then.
  */
-#ifdef ALLEGRO_ANDROID
-
-static GLint _al_gl_curr_fbo = 0;
-
-GLint _al_android_get_curr_fbo(void)
+GLint _al_ogl_bind_framebuffer(GLint fbo)
 {
-   return _al_gl_curr_fbo;
-}
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   ALLEGRO_OGL_STATE *s = NULL;
+   GLint old_fbo = 0;
 
-void _al_android_set_curr_fbo(GLint fbo)
-{
-   _al_gl_curr_fbo = fbo;
-}
+   if (display && (display->flags & ALLEGRO_OPENGL) && display->ogl_extras)
+      s = &display->ogl_extras->state;
 
-GLint _al_ogl_bind_framebuffer(GLint fbo)
-{
-   GLint old_fbo = _al_android_get_curr_fbo();
-   GLint e;
+   if (s && s->framebuffer >= 0) {
+      old_fbo = s->framebuffer;
+      if (old_fbo == fbo)
+         return old_fbo;
+   }
+   else {
+#ifndef ALLEGRO_ANDROID
+      glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &old_fbo);
+#endif
+   }
 
-   if (ANDROID_PROGRAMMABLE_PIPELINE(al_get_current_display())) {
+#ifdef ALLEGRO_ANDROID
+   if (ANDROID_PROGRAMMABLE_PIPELINE(display)) {
       glBindFramebuffer(GL_FRAMEBUFFER, fbo);
    }
    else {
       glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
    }
-   e = glGetError();
+   GLint e = glGetError();
    if (e) {
       ALLEGRO_DEBUG("glBindFramebufferEXT failed (%s)",
          _al_gl_error_string(e));
    }
-   _al_android_set_curr_fbo(fbo);
-   return old_fbo;
-}
-
-#else /* !ALLEGRO_ANDROID */
-
-GLint _al_ogl_bind_framebuffer(GLint fbo)
-{
-   GLint old_fbo;
-   glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &old_fbo);
+#else
    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+#endif
+
+   if (s)
+      s->framebuffer = fbo;
    return old_fbo;
 }
 
-#endif /* !ALLEGRO_ANDROID */
-
 
 void _al_ogl_reset_fbo_info(ALLEGRO_FBO_INFO *info)
 {
@@ -102,6 +100,8 @@ void _al_ogl_reset_fbo_info(ALLEGRO_FBO_INFO *info)
    info->buffers.mh = 0;
    info->owner = NULL;
    info->last_use_time = 0.0;
+   info->texture = 0;
+   info->unresolved = false;
 }
 
 
@@ -267,8 +267,8 @@ static void attach_multisample_buffer(ALLEGRO_FBO_INFO *info)
       check_gl_error();
 
       glRenderbufferStorageMultisampleEXT(GL_RENDERBUFFER_EXT,
-         samples, _al_ogl_get_glformat(
-            al_get_bitmap_format(info->owner), 0), w, h);
+         samples, _al_ogl_get_bitmap_glformat(info->owner,
+            al_get_bitmap_format(info->owner)), w, h);
       info->buffers.multisample_buffer = rb;
       info->buffers.mw = w;
       info->buffers.mh = h;
@@ -285,6 +285,7 @@ static void attach_multisample_buffer(ALLEGRO_FBO_INFO *info)
 
       glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT,
          GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, rb);
+      info->texture = 0;
 
       if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
          ALLEGRO_ERROR("attaching multisample renderbuffer failed\n");
@@ -322,6 +323,7 @@ bool _al_ogl_create_persistent_fbo(ALLEGRO_BITMAP *bitmap)
    ASSERT(!ogl_bitmap->fbo_info);
 
    info = al_malloc(sizeof(ALLEGRO_FBO_INFO));
+   _al_ogl_reset_fbo_info(info);
    info->owner = bitmap;
    if (ANDROID_PROGRAMMABLE_PIPELINE(al_get_current_display())) {
       glGenFramebuffers(1, &info->fbo);
@@ -368,6 +370,7 @@ bool _al_ogl_create_persistent_fbo(ALLEGRO_BITMAP *bitmap)
 
    _al_ogl_bind_framebuffer(old_fbo);
 
+   info->texture = ogl_bitmap->texture;
    info->fbo_state = FBO_INFO_PERSISTENT;
    info->last_use_time = al_get_time();
    ogl_bitmap->fbo_info = info;
@@ -399,6 +402,48 @@ ALLEGRO_FBO_INFO *_al_ogl_persist_fbo(ALLEGRO_DISPLAY *display,
 }
 
 
+static void init_fbo_pool(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_OGL_EXTRAS *extras = display->ogl_extras;
+   const char *value;
+
+   if (extras->fbo_pool_size > 0)
+      return;
+
+   extras->fbo_pool_size = ALLEGRO_DEFAULT_OPENGL_FBOS;
+   value = al_get_config_value(al_get_system_config(),
+      "opengl", "fbo_pool_size");
+   if (value) {
+      extras->fbo_pool_size = _ALLEGRO_CLAMP(1, atoi(value),
+         ALLEGRO_MAX_OPENGL_FBOS);
+   }
+
+   extras->fbo_persist_misses = ALLEGRO_OPENGL_FBO_PERSIST_MISSES;
+   value = al_get_config_value(al_get_system_config(),
+      "opengl", "fbo_persist_misses");
+   if (value)
+      extras->fbo_persist_misses = atoi(value);
+}
+
+
+/* Release what is left over from before the pool was made smaller, except
+ * for the FBO of keep.
+ */
+static void release_extra_fbos(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *keep)
+{
+   ALLEGRO_OGL_EXTRAS *extras = display->ogl_extras;
+   int i;
+
+   for (i = extras->fbo_pool_size; i < ALLEGRO_MAX_OPENGL_FBOS; i++) {
+      ALLEGRO_FBO_INFO *info = &extras->fbos[i];
+      if (info->fbo_state == FBO_INFO_TRANSIENT && info->owner != keep) {
+         _al_ogl_del_fbo(info);
+         _al_ogl_reset_fbo_info(info);
+      }
+   }
+}
+
+
 static ALLEGRO_FBO_INFO *ogl_find_unused_fbo(ALLEGRO_DISPLAY *display)
 {
    ALLEGRO_OGL_EXTRAS *extras = display->ogl_extras;
@@ -406,7 +451,10 @@ static ALLEGRO_FBO_INFO *ogl_find_unused_fbo(ALLEGRO_DISPLAY *display)
    int min_time_index = -1;
    int i;
 
-   for (i = 0; i < ALLEGRO_MAX_OPENGL_FBOS; i++) {
+   init_fbo_pool(display);
+   release_extra_fbos(display, NULL);
+
+   for (i = 0; i < extras->fbo_pool_size; i++) {
       if (extras->fbos[i].fbo_state == FBO_INFO_UNUSED)
          return &extras->fbos[i];
       if (extras->fbos[i].last_use_time < min_time) {
@@ -422,15 +470,27 @@ static ALLEGRO_FBO_INFO *ogl_find_unused_fbo(ALLEGRO_DISPLAY *display)
 void _al_ogl_del_fbo(ALLEGRO_FBO_INFO *info)
 {
    ALLEGRO_BITMAP_EXTRA_OPENGL *extra = info->owner->extra;
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+
+   /* The multisample buffer goes with the FBO, keep what was drawn. */
+   if (info->unresolved && display)
+      _al_ogl_resolve_bitmap(display, info->owner);
+
    extra->fbo_info = NULL;
    ALLEGRO_DEBUG("Deleting FBO: %u\n", info->fbo);
-   if (ANDROID_PROGRAMMABLE_PIPELINE(al_get_current_display())) {
+   if (ANDROID_PROGRAMMABLE_PIPELINE(display)) {
       glDeleteFramebuffers(1, &info->fbo);
    }
    else {
       glDeleteFramebuffersEXT(1, &info->fbo);
    }
 
+   /* Deleting the bound FBO binds the default framebuffer. */
+   if (display && (display->flags & ALLEGRO_OPENGL) && display->ogl_extras &&
+         display->ogl_extras->state.framebuffer == (GLint)info->fbo) {
+      display->ogl_extras->state.framebuffer = 0;
+   }
+
    detach_depth_buffer(info);
    detach_multisample_buffer(info);
 
@@ -487,12 +547,19 @@ void _al_ogl_setup_fbo(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap)
    if (false && display->ogl_extras->opengl_target == bitmap)
       return;
 
-   _al_ogl_unset_target_bitmap(display, display->ogl_extras->opengl_target);
+   if (display->ogl_extras->opengl_target != bitmap)
+      display->stats[ALLEGRO_DISPLAY_STAT_TARGET_CHANGES]++;
 
-   if (ogl_bitmap->is_backbuffer)
+   if (ogl_bitmap->is_backbuffer) {
       setup_fbo_backbuffer(display, bitmap);
-   else
+      _al_ogl_set_framebuffer_srgb(display,
+         display->flags & ALLEGRO_SRGB_FRAMEBUFFER);
+   }
+   else {
       _al_ogl_setup_fbo_non_backbuffer(display, bitmap);
+      _al_ogl_set_framebuffer_srgb(display,
+         al_get_bitmap_flags(bitmap) & ALLEGRO_SRGB);
+   }
 }
 
 
@@ -501,44 +568,73 @@ void _al_ogl_setup_fbo(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitmap)
  * framebuffer_blit extension. [1]
  *
  * This is what we do in this function - if there is a multisample
- * buffer, downsample it back into the texture.
+ * buffer with drawing not resolved yet, downsample it back into the
+ * texture. Changing the target does not do this, so a bitmap re-targeted
+ * several times is only resolved once it is drawn, locked or its texture
+ * is asked for. The current target stays unresolved, as more may be
+ * drawn into it.
  *
  * [1] https://www.opengl.org/registry/specs/EXT/framebuffer_multisample.txt 
  */
-void _al_ogl_finalize_fbo(ALLEGRO_DISPLAY *display,
+void _al_ogl_resolve_bitmap(ALLEGRO_DISPLAY *display,
    ALLEGRO_BITMAP *bitmap)
 {
    ALLEGRO_BITMAP_EXTRA_OPENGL *extra = bitmap->extra;
    if (!extra)
       return;
    ALLEGRO_FBO_INFO *info = extra->fbo_info;
-   (void)display;
-   if (!info)
+   if (!info || !info->unresolved)
       return;
+   info->unresolved =
+      _al_get_bitmap_display(bitmap)->ogl_extras->opengl_target == bitmap;
    if (!info->buffers.multisample_buffer)
       return;
    #ifndef ALLEGRO_CFG_OPENGLES
    int w = al_get_bitmap_width(bitmap);
    int h = al_get_bitmap_height(bitmap);
+   GLboolean scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+   GLint old_fbo;
 
    GLuint blit_fbo;
    glGenFramebuffersEXT(1, &blit_fbo);
-   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, blit_fbo);
+   old_fbo = _al_ogl_bind_framebuffer(blit_fbo);
    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
       GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, extra->texture, 0);
 
+   /* The blit would be clipped to the scissor box of the target. */
+   if (scissor_test)
+      glDisable(GL_SCISSOR_TEST);
    glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, info->fbo);
-   glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, blit_fbo);
    glBlitFramebufferEXT(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
    check_gl_error();
+   if (scissor_test)
+      glEnable(GL_SCISSOR_TEST);
 
+   /* The blit left info->fbo bound for reading only. */
+   display->ogl_extras->state.framebuffer = -1;
+   _al_ogl_bind_framebuffer(old_fbo);
    glDeleteFramebuffersEXT(1, &blit_fbo);
+
+   display->stats[ALLEGRO_DISPLAY_STAT_MULTISAMPLE_RESOLVES]++;
+   _al_ogl_invalidate_mipmaps(bitmap);
    #else
+   (void)display;
    (void)bitmap;
    #endif
 }
 
 
+/* Resolves bitmap before its texture is read, unless the user does that
+ * with al_resolve_bitmap.
+ */
+void _al_ogl_auto_resolve_bitmap(ALLEGRO_DISPLAY *display,
+   ALLEGRO_BITMAP *bitmap)
+{
+   if (!(al_get_bitmap_flags(bitmap) & ALLEGRO_NO_AUTO_RESOLVE))
+      _al_ogl_resolve_bitmap(display, bitmap);
+}
+
+
 static void setup_fbo_backbuffer(ALLEGRO_DISPLAY *display,
    ALLEGRO_BITMAP *bitmap)
 {
@@ -554,6 +650,8 @@ static void setup_fbo_backbuffer(ALLEGRO_DISPLAY *display,
 
 #ifdef ALLEGRO_IPHONE
    _al_iphone_setup_opengl_view(display, false);
+   /* That binds the view's framebuffer instead of 0. */
+   display->ogl_extras->state.framebuffer = -1;
 #endif
 }
 
@@ -568,7 +666,10 @@ bool _al_ogl_setup_fbo_non_backbuffer(ALLEGRO_DISPLAY *display,
 
    /* When a bitmap is set as target bitmap, we try to create an FBO for it. */
    info = ogl_bitmap->fbo_info;
-   if (!info) {
+   if (info) {
+      display->stats[ALLEGRO_DISPLAY_STAT_FBO_HITS]++;
+   }
+   else {
       /* FIXME The IS_OPENGLES part is quite a hack but I don't know how the
        * Allegro extension manager works to fix this properly (getting
        * extensions properly reported on iphone). All iOS devices support
@@ -579,6 +680,8 @@ bool _al_ogl_setup_fbo_non_backbuffer(ALLEGRO_DISPLAY *display,
          al_get_opengl_extension_list()->ALLEGRO_GL_OES_framebuffer_object)
       {
          info = ogl_new_fbo(display);
+         display->stats[ALLEGRO_DISPLAY_STAT_FBO_MISSES]++;
+         ogl_bitmap->fbo_misses++;
       }
    }
 
@@ -587,6 +690,15 @@ bool _al_ogl_setup_fbo_non_backbuffer(ALLEGRO_DISPLAY *display,
    }
 
    use_fbo_for_bitmap(display, bitmap, info);
+
+   /* A bitmap which keeps losing its FBO to other render targets is drawn
+    * into often enough to keep one of its own.
+    */
+   if (info->fbo_state == FBO_INFO_TRANSIENT &&
+         display->ogl_extras->fbo_persist_misses > 0 &&
+         ogl_bitmap->fbo_misses >= display->ogl_extras->fbo_persist_misses) {
+      ogl_bitmap->fbo_info = _al_ogl_persist_fbo(display, info);
+   }
    return true; /* state changed */
 }
 
@@ -595,6 +707,8 @@ static void use_fbo_for_bitmap(ALLEGRO_DISPLAY *display,
    ALLEGRO_BITMAP *bitmap, ALLEGRO_FBO_INFO *info)
 {
    ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = bitmap->extra;
+   GLuint depth_buffer = info->buffers.depth_buffer;
+   GLuint multisample_buffer = info->buffers.multisample_buffer;
    GLint e;
 
    if (info->fbo_state == FBO_INFO_UNUSED)
@@ -609,6 +723,23 @@ static void use_fbo_for_bitmap(ALLEGRO_DISPLAY *display,
    attach_multisample_buffer(info);
    attach_depth_buffer(info);
 
+   /* Whatever is drawn now goes to the multisample buffer. It is only
+    * resolved into the texture when needed, see _al_ogl_resolve_bitmap.
+    */
+   if (info->buffers.multisample_buffer)
+      info->unresolved = true;
+   _al_ogl_invalidate_mipmaps(bitmap);
+
+   /* Nothing to do if the FBO was already complete with these attachments,
+    * as is usual when switching back and forth between a few targets.
+    */
+   if (info->buffers.depth_buffer == depth_buffer &&
+         info->buffers.multisample_buffer == multisample_buffer &&
+         (multisample_buffer || info->texture == ogl_bitmap->texture)) {
+      display->ogl_extras->opengl_target = bitmap;
+      return;
+   }
+
    /* If we have a multisample renderbuffer, we can only syncronize
     * it back to the texture once we stop drawing into it - i.e.
     * when the target bitmap is changed to something else.
@@ -664,9 +795,45 @@ static void use_fbo_for_bitmap(ALLEGRO_DISPLAY *display,
       ogl_bitmap->fbo_info = NULL;
    }
    else {
+      if (!info->buffers.multisample_buffer)
+         info->texture = ogl_bitmap->texture;
       display->ogl_extras->opengl_target = bitmap;
    }
 }
 
 
+/* Function: al_get_opengl_fbo_pool_size
+ */
+int al_get_opengl_fbo_pool_size(void)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+
+   if (!display || !(display->flags & ALLEGRO_OPENGL))
+      return 0;
+
+   init_fbo_pool(display);
+   return display->ogl_extras->fbo_pool_size;
+}
+
+
+/* Function: al_set_opengl_fbo_pool_size
+ */
+bool al_set_opengl_fbo_pool_size(int size)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+
+   if (!display || !(display->flags & ALLEGRO_OPENGL))
+      return false;
+   if (size < 1 || size > ALLEGRO_MAX_OPENGL_FBOS) {
+      ALLEGRO_ERROR("Invalid FBO pool size %d.\n", size);
+      return false;
+   }
+
+   init_fbo_pool(display);
+   display->ogl_extras->fbo_pool_size = size;
+   /* The current target keeps its FBO until the target is changed. */
+   release_extra_fbos(display, display->ogl_extras->opengl_target);
+   return true;
+}
+
 /* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,113 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      OpenGL timer queries for GPU zones.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_opengl.h"
+
+#if !defined(ALLEGRO_CFG_OPENGLES)
+
+ALLEGRO_DEBUG_CHANNEL("opengl")
+
+/* GL_TIME_ELAPSED queries cannot be nested, which matches the zones. */
+typedef struct OGL_GPU_TIMER
+{
+   GLuint query;
+} OGL_GPU_TIMER;
+
+
+static void *ogl_create_gpu_timer(ALLEGRO_DISPLAY *display)
+{
+   OGL_GPU_TIMER *timer;
+
+   if (!display->ogl_extras->extension_list->ALLEGRO_GL_ARB_timer_query) {
+      ALLEGRO_DEBUG("No timer queries.\n");
+      return NULL;
+   }
+
+   timer = al_calloc(1, sizeof *timer);
+   if (!timer)
+      return NULL;
+   glGenQueries(1, &timer->query);
+   return timer;
+}
+
+
+static void ogl_begin_gpu_timer(ALLEGRO_DISPLAY *display, void *timer)
+{
+   OGL_GPU_TIMER *t = timer;
+   (void)display;
+
+   glBeginQuery(GL_TIME_ELAPSED, t->query);
+}
+
+
+static void ogl_end_gpu_timer(ALLEGRO_DISPLAY *display, void *timer)
+{
+   (void)display;
+   (void)timer;
+
+   glEndQuery(GL_TIME_ELAPSED);
+}
+
+
+static bool ogl_get_gpu_timer_result(ALLEGRO_DISPLAY *display, void *timer,
+   double *seconds)
+{
+   OGL_GPU_TIMER *t = timer;
+   GLint available = 0;
+   GLuint64 ns;
+   (void)display;
+
+   glGetQueryObjectiv(t->query, GL_QUERY_RESULT_AVAILABLE, &available);
+   if (!available)
+      return false;
+   glGetQueryObjectui64v(t->query, GL_QUERY_RESULT, &ns);
+   *seconds = ns / 1e9;
+   return true;
+}
+
+
+static void ogl_destroy_gpu_timer(ALLEGRO_DISPLAY *display, void *timer)
+{
+   OGL_GPU_TIMER *t = timer;
+   (void)display;
+
+   glDeleteQueries(1, &t->query);
+   al_free(t);
+}
+
+
+void _al_ogl_add_gpu_timer_functions(ALLEGRO_DISPLAY_INTERFACE *vt)
+{
+   vt->create_gpu_timer = ogl_create_gpu_timer;
+   vt->begin_gpu_timer = ogl_begin_gpu_timer;
+   vt->end_gpu_timer = ogl_end_gpu_timer;
+   vt->get_gpu_timer_result = ogl_get_gpu_timer_result;
+   vt->destroy_gpu_timer = ogl_destroy_gpu_timer;
+}
+
+#else
+
+void _al_ogl_add_gpu_timer_functions(ALLEGRO_DISPLAY_INTERFACE *vt)
+{
+   (void)vt;
+}
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,257 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      OpenGL instanced bitmap drawing.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_opengl.h"
+#include "allegro5/internal/aintern_shader.h"
+
+/*
+ * al_draw_bitmap_instances uploads one ALLEGRO_OGL_INSTANCE_VERTEX per
+ * sprite and draws them all with glDrawArraysInstanced over a shared unit
+ * square. The corners are placed by the instance shader, so the CPU does no
+ * per-vertex work at all. This is only used while the default shader is
+ * current, as a user shader would not know about the instance attributes.
+ */
+#if !defined(ALLEGRO_CFG_OPENGLES) && !defined(ALLEGRO_MACOSX)
+
+ALLEGRO_DEBUG_CHANNEL("opengl")
+
+/* The same triangles as draw_quad in ogl_bitmap.c. */
+static const float corners[6][2] = {
+   {0, 1}, {0, 0}, {1, 1}, {0, 0}, {1, 0}, {1, 1}
+};
+
+static const struct {
+   const char *name;
+   int size;
+   size_t ofs;
+} instance_attribs[] = {
+   {_ALLEGRO_SHADER_VAR_INSTANCE_TEXCOORDS, 4,
+      offsetof(ALLEGRO_OGL_INSTANCE_VERTEX, tex_l)},
+   {_ALLEGRO_SHADER_VAR_INSTANCE_SIZE, 4,
+      offsetof(ALLEGRO_OGL_INSTANCE_VERTEX, sw)},
+   {_ALLEGRO_SHADER_VAR_INSTANCE_POSITION, 4,
+      offsetof(ALLEGRO_OGL_INSTANCE_VERTEX, dx)},
+   {_ALLEGRO_SHADER_VAR_INSTANCE_ANGLE, 1,
+      offsetof(ALLEGRO_OGL_INSTANCE_VERTEX, angle)},
+   {ALLEGRO_SHADER_VAR_COLOR, 4,
+      offsetof(ALLEGRO_OGL_INSTANCE_VERTEX, r)}
+};
+
+
+static bool setup_instancing(ALLEGRO_DISPLAY *disp)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   GLuint program;
+   GLint loc;
+   unsigned int i;
+
+   if (o->instance_vao)
+      return true;
+
+   disp->instance_shader = _al_create_instance_shader(disp);
+   if (!disp->instance_shader) {
+      o->instance_vbo_size = -1;
+      return false;
+   }
+   program = _al_ogl_get_program_object(disp->instance_shader);
+
+   glGenVertexArrays(1, &o->instance_vao);
+   glBindVertexArray(o->instance_vao);
+
+   glGenBuffers(1, &o->instance_corner_vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, o->instance_corner_vbo);
+   glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+   loc = glGetAttribLocation(program, ALLEGRO_SHADER_VAR_POS);
+   if (loc >= 0) {
+      glEnableVertexAttribArray(loc);
+      glVertexAttribPointer(loc, 2, GL_FLOAT, false, 0, 0);
+   }
+
+   glGenBuffers(1, &o->instance_vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, o->instance_vbo);
+   o->instance_vbo_size = 0;
+   for (i = 0; i < sizeof(instance_attribs) / sizeof(instance_attribs[0]); i++) {
+      loc = glGetAttribLocation(program, instance_attribs[i].name);
+      if (loc < 0)
+         continue;
+      glEnableVertexAttribArray(loc);
+      glVertexAttribPointer(loc, instance_attribs[i].size, GL_FLOAT, false,
+         sizeof(ALLEGRO_OGL_INSTANCE_VERTEX),
+         (void *)instance_attribs[i].ofs);
+      glVertexAttribDivisor(loc, 1);
+   }
+
+   glBindVertexArray(0);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   ALLEGRO_DEBUG("Instanced drawing set up\n");
+   return true;
+}
+
+
+static bool can_draw_instanced(ALLEGRO_DISPLAY *disp,
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap)
+{
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   ALLEGRO_OGL_EXT_LIST *ext = o->extension_list;
+
+   if (!(disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE))
+      return false;
+   if (!ext->ALLEGRO_GL_ARB_instanced_arrays ||
+         !ext->ALLEGRO_GL_ARB_draw_instanced ||
+         !ext->ALLEGRO_GL_ARB_map_buffer_range)
+      return false;
+   if (ogl_bitmap->is_backbuffer)
+      return false;
+   if (!disp->default_shader || o->program_object !=
+         _al_ogl_get_program_object(disp->default_shader))
+      return false;
+   /* Don't try to build the shader again every frame. */
+   if (o->instance_vbo_size < 0)
+      return false;
+   return true;
+}
+
+
+bool _al_ogl_draw_bitmap_instances(ALLEGRO_BITMAP *bitmap,
+   const ALLEGRO_SPRITE_INSTANCE *instances, int num_instances, int flags)
+{
+   ALLEGRO_DISPLAY *disp = al_get_current_display();
+   ALLEGRO_OGL_EXTRAS *o = disp->ogl_extras;
+   ALLEGRO_BITMAP *parent = bitmap->parent ? bitmap->parent : bitmap;
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = parent->extra;
+   ALLEGRO_OGL_INSTANCE_VERTEX *v;
+   ALLEGRO_SHADER *shader;
+   ALLEGRO_TRANSFORM projview;
+   float xofs = 0, yofs = 0;
+   int size;
+   int i;
+
+   if (!can_draw_instanced(disp, ogl_bitmap))
+      return false;
+
+   if (bitmap->parent) {
+      xofs = bitmap->xofs;
+      yofs = bitmap->yofs;
+   }
+
+   /* Source regions are clipped by the other drawing functions; leave
+    * anything needing that to them.
+    */
+   for (i = 0; i < num_instances; i++) {
+      const ALLEGRO_SPRITE_INSTANCE *in = &instances[i];
+      if (in->sx < 0 || in->sy < 0 ||
+            xofs + in->sx + in->sw > parent->w ||
+            yofs + in->sy + in->sh > parent->h)
+         return false;
+   }
+
+   if (!setup_instancing(disp)) {
+      ALLEGRO_WARN("Instanced drawing not available.\n");
+      return false;
+   }
+   shader = disp->instance_shader;
+
+   /* Keep the order with any held drawing. */
+   if (disp->num_cache_vertices > 0)
+      _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+
+   _al_ogl_auto_resolve_bitmap(disp, parent);
+   _al_ogl_update_mipmaps(disp, parent);
+
+   size = num_instances * sizeof(ALLEGRO_OGL_INSTANCE_VERTEX);
+   glBindBuffer(GL_ARRAY_BUFFER, o->instance_vbo);
+   if (size > o->instance_vbo_size)
+      o->instance_vbo_size = size;
+   glBufferData(GL_ARRAY_BUFFER, o->instance_vbo_size, NULL, GL_STREAM_DRAW);
+   v = glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+   if (!v) {
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      return false;
+   }
+
+   for (i = 0; i < num_instances; i++) {
+      const ALLEGRO_SPRITE_INSTANCE *in = &instances[i];
+      float l = ogl_bitmap->left + (xofs + in->sx) / ogl_bitmap->true_w;
+      float t = ogl_bitmap->top - (yofs + in->sy) / ogl_bitmap->true_h;
+      float r = l + in->sw / ogl_bitmap->true_w;
+      float b = t - in->sh / ogl_bitmap->true_h;
+
+      if (flags & ALLEGRO_FLIP_HORIZONTAL) {
+         v[i].tex_l = r;
+         v[i].tex_r = l;
+      }
+      else {
+         v[i].tex_l = l;
+         v[i].tex_r = r;
+      }
+      if (flags & ALLEGRO_FLIP_VERTICAL) {
+         v[i].tex_t = b;
+         v[i].tex_b = t;
+      }
+      else {
+         v[i].tex_t = t;
+         v[i].tex_b = b;
+      }
+      v[i].sw = in->sw;
+      v[i].sh = in->sh;
+      v[i].cx = in->cx;
+      v[i].cy = in->cy;
+      v[i].dx = in->dx;
+      v[i].dy = in->dy;
+      v[i].xscale = in->xscale;
+      v[i].yscale = in->yscale;
+      v[i].angle = in->angle;
+      v[i].r = in->tint.r;
+      v[i].g = in->tint.g;
+      v[i].b = in->tint.b;
+      v[i].a = in->tint.a;
+   }
+   glUnmapBuffer(GL_ARRAY_BUFFER);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+   shader->vt->use_shader(shader, disp, false);
+
+   if (_al_opengl_set_blender(disp)) {
+      /* While drawing is held the hardware transform is the identity, so
+       * build the full one here.
+       */
+      al_copy_transform(&projview, al_get_current_transform());
+      al_compose_transform(&projview, al_get_current_projection_transform());
+      _al_glsl_set_projview_matrix(o->varlocs.projview_matrix_loc, &projview);
+
+      if (o->varlocs.use_tex_loc >= 0)
+         glUniform1i(o->varlocs.use_tex_loc, 1);
+      _al_ogl_bind_texture(disp, 0, ogl_bitmap->texture);
+      if (o->varlocs.tex_loc >= 0)
+         glUniform1i(o->varlocs.tex_loc, 0);
+
+      glBindVertexArray(o->instance_vao);
+      glDrawArraysInstanced(GL_TRIANGLES, 0, 6, num_instances);
+      glBindVertexArray(0);
+   }
+
+   disp->default_shader->vt->use_shader(disp->default_shader, disp, true);
+   return true;
+}
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -13,6 +13,8 @@
  *      See LICENSE.txt for copyright information.
  */
 
+#include <string.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern.h"
@@ -89,21 +91,19 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
 static bool ogl_lock_region_nonbb_readwrite_nonfbo(
    ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
    int x, int gl_y, int w, int h, int format);
+static bool ogl_readback_matches(ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int x, int y, int w, int h, int format, int flags);
+static bool ogl_lock_region_readback(
+   ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int w, int h, int format);
+static bool ogl_can_stream(ALLEGRO_BITMAP *bitmap, int format);
+static bool ogl_lock_region_stream(
+   ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int w, int h, int format);
 
 
-ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_new(ALLEGRO_BITMAP *bitmap,
-   int x, int y, int w, int h, int format, int flags)
+static int ogl_lock_format(ALLEGRO_BITMAP *bitmap, int format)
 {
-   ALLEGRO_BITMAP_EXTRA_OPENGL * const ogl_bitmap = bitmap->extra;
-   const GLint gl_y = bitmap->h - y - h;
-   ALLEGRO_DISPLAY *disp;
-   ALLEGRO_DISPLAY *old_disp = NULL;
-   ALLEGRO_BITMAP *old_target = al_get_target_bitmap();
-   GLenum e;
-   bool ok;
-   bool restore_fbo = false;
-   bool reset_alignment = false;
-
    if (format == ALLEGRO_PIXEL_FORMAT_ANY) {
       /* Never pick compressed formats with ANY, as it interacts weirdly with
        * existing code (e.g. al_get_pixel_size() etc) */
@@ -117,8 +117,42 @@ ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_new(ALLEGRO_BITMAP *bitmap,
       }
    }
 
+   return _al_get_real_pixel_format(al_get_current_display(), format);
+}
+
+
+/* Restores the target after _al_ogl_setup_fbo_non_backbuffer changed it. */
+static void ogl_restore_fbo(ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP *old_target)
+{
+   if (!old_target) {
+      /* Old target was NULL; release the context. */
+      _al_set_current_display_only(NULL);
+   }
+   else if (!_al_get_bitmap_display(old_target)) {
+      /* Old target was memory bitmap; leave the current display alone. */
+   }
+   else if (old_target != bitmap) {
+      /* Old target was another OpenGL bitmap. */
+      _al_ogl_setup_fbo(_al_get_bitmap_display(old_target), old_target);
+   }
+}
+
+
+ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_new(ALLEGRO_BITMAP *bitmap,
+   int x, int y, int w, int h, int format, int flags)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL * const ogl_bitmap = bitmap->extra;
+   const GLint gl_y = bitmap->h - y - h;
+   ALLEGRO_DISPLAY *disp;
+   ALLEGRO_DISPLAY *old_disp = NULL;
+   ALLEGRO_BITMAP *old_target = al_get_target_bitmap();
+   GLenum e;
+   bool ok;
+   bool restore_fbo = false;
+   bool reset_alignment = false;
+
    disp = al_get_current_display();
-   format = _al_get_real_pixel_format(disp, format);
+   format = ogl_lock_format(bitmap, format);
 
    /* Change OpenGL context if necessary. */
    if (!disp ||
@@ -153,12 +187,25 @@ ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_new(ALLEGRO_BITMAP *bitmap,
       }
    }
 
+   if (ok && !ogl_bitmap->is_backbuffer && !(flags & ALLEGRO_LOCK_WRITEONLY)) {
+      _al_ogl_auto_resolve_bitmap(al_get_current_display(), bitmap);
+   }
+
    if (ok) {
-      if (ogl_bitmap->is_backbuffer) {
+      if (ogl_readback_matches(ogl_bitmap, x, y, w, h, format, flags)) {
+         ALLEGRO_DEBUG("Locking from readback\n");
+         ok = ogl_lock_region_readback(bitmap, ogl_bitmap, w, h, format);
+      }
+      else if (ogl_bitmap->is_backbuffer) {
          ALLEGRO_DEBUG("Locking backbuffer\n");
          ok = ogl_lock_region_backbuffer(bitmap, ogl_bitmap,
             x, gl_y, w, h, format, flags);
       }
+      else if ((flags & ALLEGRO_LOCK_WRITEONLY) &&
+            ogl_can_stream(bitmap, format) &&
+            ogl_lock_region_stream(bitmap, ogl_bitmap, w, h, format)) {
+         ALLEGRO_DEBUG("Locked non-backbuffer WRITEONLY into pixel buffer\n");
+      }
       else if (flags & ALLEGRO_LOCK_WRITEONLY) {
          ALLEGRO_DEBUG("Locking non-backbuffer WRITEONLY\n");
          ok = ogl_lock_region_nonbb_writeonly(bitmap, ogl_bitmap,
@@ -177,17 +224,7 @@ ALLEGRO_LOCKED_REGION *_al_ogl_lock_region_new(ALLEGRO_BITMAP *bitmap,
 
    /* Restore state after switching FBO. */
    if (restore_fbo) {
-      if (!old_target) {
-         /* Old target was NULL; release the context. */
-         _al_set_current_display_only(NULL);
-      }
-      else if (!_al_get_bitmap_display(old_target)) {
-         /* Old target was memory bitmap; leave the current display alone. */
-      }
-      else if (old_target != bitmap) {
-         /* Old target was another OpenGL bitmap. */
-         _al_ogl_setup_fbo(_al_get_bitmap_display(old_target), old_target);
-      }
+      ogl_restore_fbo(bitmap, old_target);
    }
 
    ASSERT(al_get_target_bitmap() == old_target);
@@ -274,6 +311,15 @@ static bool ogl_lock_region_nonbb_readwrite(
    ASSERT(bitmap->locked == false);
    ASSERT(_al_get_bitmap_display(bitmap) == al_get_current_display());
 
+   /* The FBO of a multisampled bitmap can't be read, the texture holds
+    * what was resolved.
+    */
+   if (al_get_bitmap_samples(bitmap)) {
+      ALLEGRO_DEBUG("Locking multisampled non-backbuffer READWRITE\n");
+      return ogl_lock_region_nonbb_readwrite_nonfbo(bitmap, ogl_bitmap,
+         x, gl_y, w, h, format);
+   }
+
    /* Try to create an FBO if there isn't one. */
    *restore_fbo =
       _al_ogl_setup_fbo_non_backbuffer(_al_get_bitmap_display(bitmap), bitmap);
@@ -303,17 +349,9 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
    GLenum e;
    bool ok;
 
-   glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &old_fbo);
-   e = glGetError();
-   if (e) {
-      ALLEGRO_ERROR("glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT) failed (%s).\n",
-         _al_gl_error_string(e));
-      return false;
-   }
-
    ok = true;
 
-   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, ogl_bitmap->fbo_info->fbo);
+   old_fbo = _al_ogl_bind_framebuffer(ogl_bitmap->fbo_info->fbo);
    e = glGetError();
    if (e) {
       ALLEGRO_ERROR("glBindFramebufferEXT failed (%s).\n",
@@ -340,7 +378,7 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
       }
    }
 
-   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, old_fbo);
+   _al_ogl_bind_framebuffer(old_fbo);
 
    if (ok) {
       bitmap->locked_region.data = ogl_bitmap->lock_buffer + pitch * (h - 1);
@@ -374,7 +412,7 @@ static bool ogl_lock_region_nonbb_readwrite_nonfbo(
 
    ok = true;
 
-   glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
+   _al_ogl_bind_texture(al_get_current_display(), 0, ogl_bitmap->texture);
    glGetTexImage(GL_TEXTURE_2D, 0,
       get_glformat(format, 2),
       get_glformat(format, 1),
@@ -402,6 +440,362 @@ static bool ogl_lock_region_nonbb_readwrite_nonfbo(
 
 
 
+/*
+ * Asynchronous readback
+ *
+ * al_request_bitmap_readback reads the region into a pixel buffer object and
+ * inserts a fence after it. A later read lock of the same region and format
+ * only has to map the buffer, which does not stall once the fence is
+ * signalled.
+ */
+
+static ALLEGRO_DISPLAY *ogl_readback_begin(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_DISPLAY *disp = al_get_current_display();
+
+   /* Change OpenGL context if necessary. */
+   if (!disp ||
+      (_al_get_bitmap_display(bitmap)->ogl_extras->is_shared == false &&
+       _al_get_bitmap_display(bitmap) != disp))
+   {
+      _al_set_current_display_only(_al_get_bitmap_display(bitmap));
+      return disp;
+   }
+
+   return NULL;
+}
+
+
+static void ogl_readback_end(ALLEGRO_DISPLAY *old_disp)
+{
+   if (old_disp != NULL) {
+      _al_set_current_display_only(old_disp);
+   }
+}
+
+
+static void ogl_delete_readback_fence(ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap)
+{
+   if (ogl_bitmap->readback_fence) {
+      glDeleteSync(ogl_bitmap->readback_fence);
+      ogl_bitmap->readback_fence = NULL;
+   }
+}
+
+
+bool _al_ogl_request_readback(ALLEGRO_BITMAP *bitmap,
+   int x, int y, int w, int h, int format)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL * const ogl_bitmap = bitmap->extra;
+   const GLint gl_y = bitmap->h - y - h;
+   ALLEGRO_OGL_EXT_LIST *ext_list;
+   ALLEGRO_BITMAP *old_target = al_get_target_bitmap();
+   ALLEGRO_DISPLAY *old_disp;
+   GLint old_fbo = 0;
+   GLint previous_alignment;
+   int pixel_size;
+   int size;
+   bool restore_fbo = false;
+   bool ok = true;
+   GLenum e;
+
+   /* Resolve the format as _al_ogl_lock_region_new does, before changing
+    * the context, so that the lock matches.
+    */
+   format = ogl_lock_format(bitmap, format);
+   old_disp = ogl_readback_begin(bitmap);
+   pixel_size = al_get_pixel_size(format);
+   size = ogl_pitch(w, pixel_size) * h;
+
+   ext_list = _al_get_bitmap_display(bitmap)->ogl_extras->extension_list;
+   if (!ext_list->ALLEGRO_GL_ARB_sync ||
+       !ext_list->ALLEGRO_GL_ARB_pixel_buffer_object) {
+      ALLEGRO_DEBUG("No pixel buffer objects or fences, not reading back\n");
+      ogl_readback_end(old_disp);
+      return false;
+   }
+
+   /* See ogl_lock_region_nonbb_readwrite. */
+   if (al_get_bitmap_samples(bitmap)) {
+      ALLEGRO_DEBUG("Multisampled bitmap, not reading back\n");
+      ogl_readback_end(old_disp);
+      return false;
+   }
+
+   if (!ogl_bitmap->is_backbuffer) {
+      restore_fbo = _al_ogl_setup_fbo_non_backbuffer(
+         _al_get_bitmap_display(bitmap), bitmap);
+      if (ogl_bitmap->fbo_info) {
+         old_fbo = _al_ogl_bind_framebuffer(ogl_bitmap->fbo_info->fbo);
+      }
+      else {
+         ALLEGRO_DEBUG("No FBO, not reading back\n");
+         ok = false;
+      }
+   }
+
+   if (ok) {
+      if (ogl_bitmap->readback_pbo == 0) {
+         glGenBuffers(1, &ogl_bitmap->readback_pbo);
+         ogl_bitmap->readback_pbo_size = 0;
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, ogl_bitmap->readback_pbo);
+      if (size > ogl_bitmap->readback_pbo_size) {
+         glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+         ogl_bitmap->readback_pbo_size = size;
+      }
+
+      glGetIntegerv(GL_PACK_ALIGNMENT, &previous_alignment);
+      glPixelStorei(GL_PACK_ALIGNMENT, ogl_pixel_alignment(pixel_size));
+      glReadPixels(x, gl_y, w, h,
+         get_glformat(format, 2),
+         get_glformat(format, 1),
+         NULL);
+      glPixelStorei(GL_PACK_ALIGNMENT, previous_alignment);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+      e = glGetError();
+      if (e) {
+         ALLEGRO_ERROR("glReadPixels into PBO for format %s failed (%s).\n",
+            _al_pixel_format_name(format), _al_gl_error_string(e));
+         ok = false;
+      }
+   }
+
+   ogl_delete_readback_fence(ogl_bitmap);
+   if (ok) {
+      ogl_bitmap->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      ogl_bitmap->readback_x = x;
+      ogl_bitmap->readback_y = y;
+      ogl_bitmap->readback_w = w;
+      ogl_bitmap->readback_h = h;
+      ogl_bitmap->readback_format = format;
+   }
+
+   if (ogl_bitmap->fbo_info && !ogl_bitmap->is_backbuffer) {
+      _al_ogl_bind_framebuffer(old_fbo);
+   }
+   if (restore_fbo) {
+      ogl_restore_fbo(bitmap, old_target);
+   }
+
+   ogl_readback_end(old_disp);
+   return ok;
+}
+
+
+bool _al_ogl_is_readback_ready(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL * const ogl_bitmap = bitmap->extra;
+   ALLEGRO_DISPLAY *old_disp;
+   GLenum ret;
+
+   if (!ogl_bitmap->readback_fence)
+      return true;
+
+   old_disp = ogl_readback_begin(bitmap);
+   ret = glClientWaitSync(ogl_bitmap->readback_fence,
+      GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+   ogl_readback_end(old_disp);
+
+   return ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED;
+}
+
+
+void _al_ogl_destroy_readback(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL * const ogl_bitmap = bitmap->extra;
+
+   ogl_delete_readback_fence(ogl_bitmap);
+   if (ogl_bitmap->readback_pbo) {
+      glDeleteBuffers(1, &ogl_bitmap->readback_pbo);
+      ogl_bitmap->readback_pbo = 0;
+      ogl_bitmap->readback_pbo_size = 0;
+   }
+}
+
+
+static bool ogl_readback_matches(ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int x, int y, int w, int h, int format, int flags)
+{
+   return ogl_bitmap->readback_fence
+      && !(flags & ALLEGRO_LOCK_WRITEONLY)
+      && ogl_bitmap->readback_x == x
+      && ogl_bitmap->readback_y == y
+      && ogl_bitmap->readback_w == w
+      && ogl_bitmap->readback_h == h
+      && ogl_bitmap->readback_format == format;
+}
+
+
+static bool ogl_lock_region_readback(
+   ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int w, int h, int format)
+{
+   const int pixel_size = al_get_pixel_size(format);
+   const int pitch = ogl_pitch(w, pixel_size);
+   GLenum ret;
+   void *ptr;
+
+   /* This only blocks if the lock comes too early. */
+   do {
+      ret = glClientWaitSync(ogl_bitmap->readback_fence,
+         GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+   } while (ret == GL_TIMEOUT_EXPIRED);
+   ogl_delete_readback_fence(ogl_bitmap);
+
+   if (ret == GL_WAIT_FAILED) {
+      ALLEGRO_ERROR("glClientWaitSync failed.\n");
+      return false;
+   }
+
+   ogl_bitmap->lock_buffer = al_malloc(pitch * h);
+   if (ogl_bitmap->lock_buffer == NULL) {
+      return false;
+   }
+
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, ogl_bitmap->readback_pbo);
+   ptr = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+   if (ptr) {
+      memcpy(ogl_bitmap->lock_buffer, ptr, pitch * h);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   if (!ptr) {
+      ALLEGRO_ERROR("glMapBuffer for readback failed (%s).\n",
+         _al_gl_error_string(glGetError()));
+      al_free(ogl_bitmap->lock_buffer);
+      ogl_bitmap->lock_buffer = NULL;
+      return false;
+   }
+
+   bitmap->locked_region.data = ogl_bitmap->lock_buffer + pitch * (h - 1);
+   bitmap->locked_region.format = format;
+   bitmap->locked_region.pitch = -pitch;
+   bitmap->locked_region.pixel_size = pixel_size;
+   return true;
+}
+
+
+
+
+/*
+ * Streaming bitmaps
+ *
+ * A write-only lock of an ALLEGRO_STREAMING_BITMAP bitmap hands out a mapped
+ * pixel unpack buffer instead of lock_buffer, and the unlock uploads from it
+ * with glTexSubImage2D, which returns without waiting for the transfer.
+ * The bitmap has several such buffers used in turn, so the next lock can be
+ * written while the last upload is still in flight. Should the GPU fall so
+ * far behind that the buffer is still in use, its storage is orphaned
+ * rather than waited for.
+ */
+
+static bool ogl_can_stream(ALLEGRO_BITMAP *bitmap, int format)
+{
+   ALLEGRO_DISPLAY *disp = _al_get_bitmap_display(bitmap);
+   ALLEGRO_OGL_EXT_LIST *ext_list = disp->ogl_extras->extension_list;
+
+   if (!(al_get_bitmap_flags(bitmap) & ALLEGRO_STREAMING_BITMAP))
+      return false;
+
+   if (!ext_list->ALLEGRO_GL_ARB_pixel_buffer_object ||
+       !ext_list->ALLEGRO_GL_ARB_map_buffer_range ||
+       !ext_list->ALLEGRO_GL_ARB_sync) {
+      return false;
+   }
+
+   /* Other formats are converted when unlocking, see
+    * ogl_unlock_region_nonbb_fbo_writeonly.
+    */
+   return format == _al_get_real_pixel_format(disp,
+      _al_get_bitmap_memory_format(bitmap));
+}
+
+
+static void ogl_delete_stream_fence(ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int i)
+{
+   if (ogl_bitmap->stream_fences[i]) {
+      glDeleteSync(ogl_bitmap->stream_fences[i]);
+      ogl_bitmap->stream_fences[i] = NULL;
+   }
+}
+
+
+static bool ogl_lock_region_stream(
+   ALLEGRO_BITMAP *bitmap, ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap,
+   int w, int h, int format)
+{
+   const int pixel_size = al_get_pixel_size(format);
+   const int pitch = ogl_pitch(w, pixel_size);
+   const int size = pitch * h;
+   const int i = (ogl_bitmap->stream_index + 1) % ALLEGRO_OGL_STREAM_BUFFERS;
+   unsigned char *ptr;
+   GLenum ret;
+
+   if (ogl_bitmap->stream_pbos[i] == 0) {
+      glGenBuffers(1, &ogl_bitmap->stream_pbos[i]);
+      ogl_bitmap->stream_pbo_sizes[i] = 0;
+   }
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ogl_bitmap->stream_pbos[i]);
+
+   if (ogl_bitmap->stream_fences[i]) {
+      ret = glClientWaitSync(ogl_bitmap->stream_fences[i],
+         GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+      if (ret != GL_ALREADY_SIGNALED && ret != GL_CONDITION_SATISFIED) {
+         ALLEGRO_DEBUG("Pixel buffer %d still in use, orphaning it\n", i);
+         ogl_bitmap->stream_pbo_sizes[i] = 0;
+      }
+      ogl_delete_stream_fence(ogl_bitmap, i);
+   }
+
+   if (size > ogl_bitmap->stream_pbo_sizes[i]) {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+      ogl_bitmap->stream_pbo_sizes[i] = size;
+   }
+
+   /* Nothing can read the buffer any more, so don't let the driver check. */
+   ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+      GL_MAP_UNSYNCHRONIZED_BIT);
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+   if (!ptr) {
+      ALLEGRO_WARN("glMapBufferRange for streaming failed (%s).\n",
+         _al_gl_error_string(glGetError()));
+      return false;
+   }
+
+   ogl_bitmap->stream_index = i;
+   ogl_bitmap->stream_locked = true;
+
+   bitmap->locked_region.data = ptr + pitch * (h - 1);
+   bitmap->locked_region.format = format;
+   bitmap->locked_region.pitch = -pitch;
+   bitmap->locked_region.pixel_size = pixel_size;
+   return true;
+}
+
+
+void _al_ogl_destroy_stream_buffers(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_EXTRA_OPENGL * const ogl_bitmap = bitmap->extra;
+   int i;
+
+   for (i = 0; i < ALLEGRO_OGL_STREAM_BUFFERS; i++) {
+      ogl_delete_stream_fence(ogl_bitmap, i);
+      if (ogl_bitmap->stream_pbos[i]) {
+         glDeleteBuffers(1, &ogl_bitmap->stream_pbos[i]);
+         ogl_bitmap->stream_pbos[i] = 0;
+         ogl_bitmap->stream_pbo_sizes[i] = 0;
+      }
+   }
+}
+
+
+
 /*
  * Unlocking
  */
@@ -418,6 +812,8 @@ static void ogl_unlock_region_nonbb_fbo_readwrite(ALLEGRO_BITMAP *bitmap,
    ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap, int gl_y);
 static void ogl_unlock_region_nonbb_nonfbo(ALLEGRO_BITMAP *bitmap,
    ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap, int gl_y);
+static void ogl_unlock_region_stream(ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap, int gl_y);
 
 
 void _al_ogl_unlock_region_new(ALLEGRO_BITMAP *bitmap)
@@ -489,8 +885,13 @@ static void ogl_unlock_region_non_readonly(ALLEGRO_BITMAP *bitmap,
       ogl_unlock_region_backbuffer(bitmap, ogl_bitmap, gl_y);
    }
    else {
-      glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
-      if (ogl_bitmap->fbo_info) {
+      _al_ogl_bind_texture(al_get_current_display(), 0, ogl_bitmap->texture);
+      if (ogl_bitmap->stream_locked) {
+         ALLEGRO_DEBUG("Unlocking non-backbuffer from pixel buffer\n");
+         ogl_unlock_region_stream(bitmap, ogl_bitmap, gl_y);
+      }
+      /* Multisampled bitmaps were locked as without FBO. */
+      else if (ogl_bitmap->fbo_info && !al_get_bitmap_samples(bitmap)) {
          ALLEGRO_DEBUG("Unlocking non-backbuffer (FBO)\n");
          ogl_unlock_region_nonbb_fbo(bitmap, ogl_bitmap, gl_y, orig_format);
       }
@@ -499,18 +900,7 @@ static void ogl_unlock_region_non_readonly(ALLEGRO_BITMAP *bitmap,
          ogl_unlock_region_nonbb_nonfbo(bitmap, ogl_bitmap, gl_y);
       }
 
-      /* If using FBOs, we need to regenerate mipmaps explicitly now. */
-      /* XXX why don't we check ogl_bitmap->fbo_info? */
-      if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MIPMAP) &&
-         al_get_opengl_extension_list()->ALLEGRO_GL_EXT_framebuffer_object)
-      {
-         glGenerateMipmapEXT(GL_TEXTURE_2D);
-         e = glGetError();
-         if (e) {
-            ALLEGRO_ERROR("glGenerateMipmapEXT for texture %d failed (%s).\n",
-               ogl_bitmap->texture, _al_gl_error_string(e));
-         }
-      }
+      _al_ogl_invalidate_mipmaps(bitmap);
    }
 
    if (biased_alpha) {
@@ -567,6 +957,7 @@ static void ogl_unlock_region_backbuffer(ALLEGRO_BITMAP *bitmap,
 
    glDisable(GL_TEXTURE_2D);
    glDisable(GL_BLEND);
+   al_get_current_display()->ogl_extras->state.blend_valid = false;
    glDrawPixels(bitmap->lock_w, bitmap->lock_h,
       get_glformat(lock_format, 2),
       get_glformat(lock_format, 1),
@@ -608,9 +999,27 @@ static void ogl_unlock_region_nonbb_fbo_writeonly(ALLEGRO_BITMAP *bitmap,
    const int lock_format = bitmap->locked_region.format;
    const int orig_pixel_size = al_get_pixel_size(orig_format);
    const int dst_pitch = bitmap->lock_w * orig_pixel_size;
-   unsigned char * const tmpbuf = al_malloc(dst_pitch * bitmap->lock_h);
+   unsigned char *tmpbuf;
    GLenum e;
 
+   /* The lock buffer already holds the texture's format, upload it as is. */
+   if (lock_format == orig_format) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0,
+         bitmap->lock_x, gl_y,
+         bitmap->lock_w, bitmap->lock_h,
+         get_glformat(lock_format, 2),
+         get_glformat(lock_format, 1),
+         ogl_bitmap->lock_buffer);
+      e = glGetError();
+      if (e) {
+         ALLEGRO_ERROR("glTexSubImage2D for format %s failed (%s).\n",
+            _al_pixel_format_name(lock_format), _al_gl_error_string(e));
+      }
+      return;
+   }
+
+   tmpbuf = al_malloc(dst_pitch * bitmap->lock_h);
+
    _al_convert_bitmap_data(
       ogl_bitmap->lock_buffer,
       bitmap->locked_region.format,
@@ -696,6 +1105,42 @@ static void ogl_unlock_region_nonbb_nonfbo(ALLEGRO_BITMAP *bitmap,
 }
 
 
+static void ogl_unlock_region_stream(ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap, int gl_y)
+{
+   const int lock_format = bitmap->locked_region.format;
+   const int i = ogl_bitmap->stream_index;
+   GLenum e;
+
+   ogl_bitmap->stream_locked = false;
+
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ogl_bitmap->stream_pbos[i]);
+   if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+      /* The contents were lost, e.g. by a mode switch. */
+      ALLEGRO_ERROR("glUnmapBuffer for streaming failed.\n");
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return;
+   }
+
+   glTexSubImage2D(GL_TEXTURE_2D, 0,
+      bitmap->lock_x, gl_y,
+      bitmap->lock_w, bitmap->lock_h,
+      get_glformat(lock_format, 2),
+      get_glformat(lock_format, 1),
+      NULL);
+   e = glGetError();
+   if (e) {
+      ALLEGRO_ERROR("glTexSubImage2D from pixel buffer for format %s failed (%s).\n",
+         _al_pixel_format_name(lock_format), _al_gl_error_string(e));
+   }
+   else {
+      ogl_bitmap->stream_fences[i] =
+         glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   }
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
 #endif
 
 /* vim: set sts=3 sw=3 et: */
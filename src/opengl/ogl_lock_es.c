@@ -13,6 +13,10 @@
  *      See LICENSE.txt for copyright information.
  */
 
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern.h"
@@ -67,6 +71,343 @@ static int ogl_pitch(int w, int pixel_size)
 
 
 
+/*
+ * Shader packing of readbacks
+ *
+ * GLES can only read back RGBA bytes, which then have to be converted to
+ * the lock format on the CPU. For formats with 1, 2 or 4 byte pixels we can
+ * instead render the bitmap into a temporary texture with a shader that
+ * writes the bytes of the packed pixels, four per texel, and read that back
+ * directly.
+ */
+
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+
+typedef struct PACK_LAYOUT {
+   /* Lowest bit and bit count of the r, g, b and a channels in the pixel
+    * read as a little endian integer. shift is -1 if the channel is absent.
+    */
+   int shift[4];
+   int bits[4];
+} PACK_LAYOUT;
+
+
+static int pack_pixel(int format, int pixel_size, const unsigned char *rgba)
+{
+   unsigned char dst[4];
+   int v = 0;
+   int i;
+
+   _al_convert_bitmap_data(rgba, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, 4,
+      dst, format, pixel_size, 0, 0, 0, 0, 1, 1);
+   for (i = 0; i < pixel_size; i++)
+      v |= dst[i] << (8 * i);
+   return v;
+}
+
+
+/* Find out where the converter puts each channel by converting probe pixels.
+ * Only layouts the shader can reproduce are accepted: contiguous channels
+ * holding the top bits of the 8 bit value, and zero padding.
+ */
+static bool probe_pack_layout(int format, PACK_LAYOUT *layout)
+{
+   const int pixel_size = al_get_pixel_size(format);
+   unsigned char rgba[4] = {0, 0, 0, 0};
+   unsigned int used = 0;
+   int c;
+
+   if (pack_pixel(format, pixel_size, rgba) != 0)
+      return false;
+
+   for (c = 0; c < 4; c++) {
+      unsigned int mask;
+      int shift = 0;
+      int bits = 0;
+
+      memset(rgba, 0, sizeof(rgba));
+      rgba[c] = 0xff;
+      mask = pack_pixel(format, pixel_size, rgba);
+      if (mask == 0) {
+         layout->shift[c] = -1;
+         layout->bits[c] = 0;
+         continue;
+      }
+      while (!(mask & (1u << shift)))
+         shift++;
+      while (shift + bits < 32 && (mask & (1u << (shift + bits))))
+         bits++;
+      if (bits > 8 || (mask >> shift) != (1u << bits) - 1 || (mask & used))
+         return false;
+      used |= mask;
+
+      rgba[c] = 0xa5;
+      if (pack_pixel(format, pixel_size, rgba) !=
+            (int)((0xa5u >> (8 - bits)) << shift))
+         return false;
+
+      layout->shift[c] = shift;
+      layout->bits[c] = bits;
+   }
+
+   return true;
+}
+
+
+static GLuint compile_pack_shader(GLenum type, const char *source)
+{
+   GLuint shader = glCreateShader(type);
+   GLint status;
+
+   glShaderSource(shader, 1, &source, NULL);
+   glCompileShader(shader);
+   glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+   if (!status) {
+      char log[512];
+      glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      ALLEGRO_WARN("Pack shader failed to compile: %s\n", log);
+      glDeleteShader(shader);
+      return 0;
+   }
+   return shader;
+}
+
+
+static GLuint create_pack_program(int format)
+{
+   static const char *vertex_source =
+      "attribute vec2 pos;\n"
+      "void main()\n"
+      "{\n"
+      "   gl_Position = vec4(pos, 0.0, 1.0);\n"
+      "}\n";
+   const char *channels = "rgba";
+   const int pixel_size = al_get_pixel_size(format);
+   PACK_LAYOUT layout;
+   char source[4096];
+   size_t n;
+   GLuint vs, fs, program;
+   GLint range[2], precision;
+   GLint status;
+   int j, c;
+
+   /* The shader works with values up to 2^31, which needs highp. */
+   glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range,
+      &precision);
+   if (precision < 23) {
+      ALLEGRO_DEBUG("No highp in fragment shaders, not packing readbacks.\n");
+      return 0;
+   }
+
+   if (!probe_pack_layout(format, &layout)) {
+      ALLEGRO_DEBUG("Cannot pack format %s in a shader.\n",
+         _al_pixel_format_name(format));
+      return 0;
+   }
+
+   n = snprintf(source, sizeof(source),
+      "precision highp float;\n"
+      "uniform sampler2D tex;\n"
+      "uniform vec2 origin;\n"
+      "uniform vec2 tex_size;\n"
+      "vec4 fetch(float k)\n"
+      "{\n"
+      "   vec2 p = vec2(floor(gl_FragCoord.x) * %d.0 + k, floor(gl_FragCoord.y));\n"
+      "   return floor(texture2D(tex, (origin + p + 0.5) / tex_size) * 255.0 + 0.5);\n"
+      "}\n"
+      "void main()\n"
+      "{\n"
+      "   vec4 b = vec4(0.0);\n",
+      4 / pixel_size);
+
+   for (j = 0; j < 4 / pixel_size; j++) {
+      n += snprintf(source + n, sizeof(source) - n,
+         "   vec4 p%d = fetch(%d.0);\n", j, j);
+   }
+
+   /* Byte j of the output texel is byte j % pixel_size of pixel
+    * j / pixel_size. Sum the parts of all channels overlapping it; since
+    * they have disjoint bits no carries happen.
+    */
+   for (j = 0; j < 4; j++) {
+      const int i = j % pixel_size;
+      for (c = 0; c < 4; c++) {
+         const int shift = layout.shift[c];
+         const int bits = layout.bits[c];
+         if (shift < 0 || shift >= 8 * (i + 1) || shift + bits <= 8 * i)
+            continue;
+         n += snprintf(source + n, sizeof(source) - n,
+            "   b.%c += mod(floor(floor(p%d.%c / %.1f) * %.9g), 256.0);\n",
+            channels[j], j / pixel_size, channels[c],
+            ldexp(1.0, 8 - bits), ldexp(1.0, shift - 8 * i));
+      }
+   }
+
+   n += snprintf(source + n, sizeof(source) - n,
+      "   gl_FragColor = b / 255.0;\n"
+      "}\n");
+   ASSERT(n < sizeof(source));
+
+   vs = compile_pack_shader(GL_VERTEX_SHADER, vertex_source);
+   fs = compile_pack_shader(GL_FRAGMENT_SHADER, source);
+   if (!vs || !fs) {
+      glDeleteShader(vs);
+      glDeleteShader(fs);
+      return 0;
+   }
+
+   program = glCreateProgram();
+   glAttachShader(program, vs);
+   glAttachShader(program, fs);
+   glBindAttribLocation(program, 0, "pos");
+   glLinkProgram(program);
+   glDeleteShader(vs);
+   glDeleteShader(fs);
+   glGetProgramiv(program, GL_LINK_STATUS, &status);
+   if (!status) {
+      ALLEGRO_WARN("Pack shader failed to link.\n");
+      glDeleteProgram(program);
+      return 0;
+   }
+
+   return program;
+}
+
+
+/* Get the packing program for format, or 0 if there is none. Failures are
+ * remembered so the shader is only tried once per context.
+ */
+static GLuint get_pack_program(ALLEGRO_DISPLAY *disp, int format)
+{
+   GLuint *program = &disp->ogl_extras->lock_pack_programs[format];
+
+   if (*program == 0) {
+      *program = create_pack_program(format);
+      if (*program == 0)
+         *program = _ALLEGRO_OGL_UNKNOWN_PROGRAM;
+   }
+   return *program == _ALLEGRO_OGL_UNKNOWN_PROGRAM ? 0 : *program;
+}
+
+
+/* Read the region into buffer in real_format, bottom row first, using the
+ * packing shader. Returns false if that is not possible, in which case the
+ * caller does the conversion on the CPU.
+ */
+static bool pack_region(ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap, int x, int gl_y, int w, int h,
+   int real_format, unsigned char *buffer)
+{
+   static const GLfloat corners[8] = {-1, -1, 1, -1, -1, 1, 1, 1};
+   ALLEGRO_DISPLAY *disp = al_get_current_display();
+   ALLEGRO_OGL_STATE *state = &disp->ogl_extras->state;
+   const int pixel_size = al_get_pixel_size(real_format);
+   const int pitch = ogl_pitch(w, pixel_size);
+   const int out_w = (pitch + 3) / 4;
+   GLuint program, tex, fbo;
+   GLint old_program, viewport[4], scissor[4];
+   GLint min_filter, mag_filter;
+   GLboolean scissor_test;
+   GLenum e;
+   bool ok;
+   int row;
+
+   if (!(disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) ||
+         (al_get_bitmap_flags(bitmap) & ALLEGRO_SRGB) ||
+         ogl_bitmap->texture == 0 ||
+         (pixel_size != 1 && pixel_size != 2 && pixel_size != 4))
+      return false;
+
+   program = get_pack_program(disp, real_format);
+   if (program == 0)
+      return false;
+
+   glGetError(); /* clear error */
+
+   glGenTextures(1, &tex);
+   _al_ogl_bind_texture(disp, 0, tex);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, out_w, h, 0, GL_RGBA,
+      GL_UNSIGNED_BYTE, NULL);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+   glGenFramebuffers(1, &fbo);
+   _al_ogl_bind_framebuffer(fbo);
+   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, tex, 0);
+   ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+   if (ok) {
+      glGetIntegerv(GL_VIEWPORT, viewport);
+      glGetIntegerv(GL_SCISSOR_BOX, scissor);
+      scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+      glGetIntegerv(GL_CURRENT_PROGRAM, &old_program);
+
+      _al_ogl_set_viewport(disp, 0, 0, out_w, h);
+      _al_ogl_set_scissor(disp, false, 0, 0, 0, 0);
+      glDisable(GL_BLEND);
+      state->blend_valid = false;
+      glDisable(GL_DEPTH_TEST);
+      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+      state->render_state_valid = false;
+
+      _al_ogl_use_program(disp, program);
+      glUniform1i(glGetUniformLocation(program, "tex"), 0);
+      glUniform2f(glGetUniformLocation(program, "origin"), x, gl_y);
+      glUniform2f(glGetUniformLocation(program, "tex_size"),
+         ogl_bitmap->true_w, ogl_bitmap->true_h);
+
+      _al_ogl_bind_texture(disp, 0, ogl_bitmap->texture);
+      glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &min_filter);
+      glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &mag_filter);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, corners);
+      glEnableVertexAttribArray(0);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      glDisableVertexAttribArray(0);
+
+      glReadPixels(0, 0, out_w, h, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
+
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+      _al_ogl_use_program(disp, (GLuint)old_program);
+      _al_ogl_set_viewport(disp, viewport[0], viewport[1], viewport[2],
+         viewport[3]);
+      _al_ogl_set_scissor(disp, scissor_test, scissor[0], scissor[1],
+         scissor[2], scissor[3]);
+
+      e = glGetError();
+      if (e) {
+         ALLEGRO_WARN("Packing readback failed (%s).\n",
+            _al_gl_error_string(e));
+         ok = false;
+      }
+   }
+
+   _al_ogl_bind_framebuffer(ogl_bitmap->fbo_info->fbo);
+   glDeleteFramebuffers(1, &fbo);
+   _al_ogl_forget_texture(tex);
+   glDeleteTextures(1, &tex);
+
+   if (!ok)
+      return false;
+
+   /* Rows were read with a stride of whole texels. */
+   if (out_w * 4 != pitch) {
+      for (row = 1; row < h; row++)
+         memmove(buffer + row * pitch, buffer + row * out_w * 4, pitch);
+   }
+
+   return true;
+}
+
+#endif
+
+
+
 /*
  * Locking
  */
@@ -403,6 +744,7 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
    GLint old_fbo;
    GLenum e;
    bool ok;
+   bool packed = false;
 
    ASSERT(ogl_bitmap->fbo_info);
 
@@ -429,6 +771,14 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
    }
 
    if (ok) {
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+      packed = real_format != ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE &&
+         pack_region(bitmap, ogl_bitmap, x, gl_y, w, h, real_format,
+            ogl_bitmap->lock_buffer);
+#endif
+   }
+
+   if (ok && !packed) {
       /* NOTE: GLES can only read 4 byte pixels (or one other implementation
        * defined format), we have to convert
        */
@@ -445,7 +795,7 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
       }
    }
 
-   if (ok) {
+   if (ok && !packed) {
       ALLEGRO_DEBUG("Converting from format %d -> %d\n",
          ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, real_format);
 
@@ -460,12 +810,13 @@ static bool ogl_lock_region_nonbb_readwrite_fbo(
          pitch,
          0, 0, 0, 0,
          w, h);
+   }
 
+   if (ok) {
       bitmap->locked_region.data = ogl_bitmap->lock_buffer + pitch * (start_h - 1);
       bitmap->locked_region.format = real_format;
       bitmap->locked_region.pitch = -pitch;
       bitmap->locked_region.pixel_size = pixel_size;
-      ok = true;
    }
 
    _al_ogl_bind_framebuffer(old_fbo);
@@ -564,7 +915,6 @@ static void ogl_unlock_region_nonbb(ALLEGRO_BITMAP *bitmap,
    ALLEGRO_DISPLAY *old_disp = NULL;
    ALLEGRO_DISPLAY *disp;
    int orig_format;
-   GLenum e;
 
    disp = al_get_current_display();
    orig_format = _al_get_real_pixel_format(disp, al_get_bitmap_format(bitmap));
@@ -582,19 +932,7 @@ static void ogl_unlock_region_nonbb(ALLEGRO_BITMAP *bitmap,
 
    ogl_unlock_region_nonbb_2(bitmap, ogl_bitmap, gl_y, orig_format);
 
-   /* If using FBOs, we need to regenerate mipmaps explicitly now. */
-   /* XXX why don't we check ogl_bitmap->fbo_info? */
-   if ((al_get_bitmap_flags(bitmap) & ALLEGRO_MIPMAP) &&
-       (al_get_opengl_extension_list()->ALLEGRO_GL_OES_framebuffer_object ||
-        IS_OPENGLES) /* FIXME */)
-   {
-      glGenerateMipmapEXT(GL_TEXTURE_2D);
-      e = glGetError();
-      if (e) {
-         ALLEGRO_ERROR("glGenerateMipmapEXT for texture %d failed (%s).\n",
-            ogl_bitmap->texture, _al_gl_error_string(e));
-      }
-   }
+   _al_ogl_invalidate_mipmaps(bitmap);
 
    if (old_disp) {
       _al_set_current_display_only(old_disp);
@@ -608,17 +946,9 @@ static void ogl_unlock_region_nonbb_2(ALLEGRO_BITMAP *bitmap,
    GLint fbo;
    GLenum e;
 
-#ifdef ALLEGRO_ANDROID
-   fbo = _al_android_get_curr_fbo();
-#else
-   glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &fbo);
-#endif
-   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-#ifdef ALLEGRO_ANDROID
-   _al_android_set_curr_fbo(0);
-#endif
+   fbo = _al_ogl_bind_framebuffer(0);
 
-   glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
+   _al_ogl_bind_texture(al_get_current_display(), 0, ogl_bitmap->texture);
    e = glGetError();
    if (e) {
       ALLEGRO_ERROR("glBindTexture failed (%s).\n", _al_gl_error_string(e));
@@ -639,10 +969,7 @@ static void ogl_unlock_region_nonbb_2(ALLEGRO_BITMAP *bitmap,
          orig_format);
    }
 
-   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-#ifdef ALLEGRO_ANDROID
-   _al_android_set_curr_fbo(fbo);
-#endif
+   _al_ogl_bind_framebuffer(fbo);
 }
 
 
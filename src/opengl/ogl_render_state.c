@@ -2,6 +2,7 @@
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_opengl.h"
+#include "allegro5/internal/aintern_system.h"
 
 ALLEGRO_DEBUG_CHANNEL("opengl")
 
@@ -20,44 +21,299 @@ static int _gl_funcs[] = {
 void _al_ogl_update_render_state(ALLEGRO_DISPLAY *display)
 {
    _ALLEGRO_RENDER_STATE *r = &display->render_state;
-
-   /* TODO: We could store the previous state and/or mark updated states to
-    * avoid so many redundant OpenGL calls.
-    */
+   ALLEGRO_OGL_STATE *s = &display->ogl_extras->state;
+   /* The previous state, or NULL if everything has to be set. */
+   _ALLEGRO_RENDER_STATE *p = s->render_state_valid ? &s->render_state : NULL;
 
    if (display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
 #ifdef ALLEGRO_CFG_SHADER_GLSL
+      GLuint program = display->ogl_extras->program_object;
       GLint atloc = display->ogl_extras->varlocs.alpha_test_loc;
       GLint floc = display->ogl_extras->varlocs.alpha_func_loc;
       GLint tvloc = display->ogl_extras->varlocs.alpha_test_val_loc;
 
-      if (display->ogl_extras->program_object > 0 && floc >= 0 && tvloc >= 0) {
-         glUniform1i(atloc, r->alpha_test);
-         glUniform1i(floc, r->alpha_function);
-         glUniform1f(tvloc, (float)r->alpha_test_value / 255.0);
+      if (program > 0 && floc >= 0 && tvloc >= 0) {
+         if (!p || s->render_program != program ||
+               p->alpha_test != r->alpha_test ||
+               p->alpha_function != r->alpha_function ||
+               p->alpha_test_value != r->alpha_test_value) {
+            glUniform1i(atloc, r->alpha_test);
+            glUniform1i(floc, r->alpha_function);
+            glUniform1f(tvloc, (float)r->alpha_test_value / 255.0);
+            s->render_program = program;
+         }
       }
 #endif
    }
    else {
 #ifdef ALLEGRO_CFG_OPENGL_FIXED_FUNCTION
-      if (r->alpha_test == 0)
-         glDisable(GL_ALPHA_TEST);
-      else
-         glEnable(GL_ALPHA_TEST);
-      glAlphaFunc(_gl_funcs[r->alpha_function], (float)r->alpha_test_value / 255.0);
+      if (!p || p->alpha_test != r->alpha_test) {
+         if (r->alpha_test == 0)
+            glDisable(GL_ALPHA_TEST);
+         else
+            glEnable(GL_ALPHA_TEST);
+      }
+      if (!p || p->alpha_function != r->alpha_function ||
+            p->alpha_test_value != r->alpha_test_value) {
+         glAlphaFunc(_gl_funcs[r->alpha_function], (float)r->alpha_test_value / 255.0);
+      }
 #endif
    }
 
-   if (r->depth_test == 0)
-      glDisable(GL_DEPTH_TEST);
+   if (!p || p->depth_test != r->depth_test) {
+      if (r->depth_test == 0)
+         glDisable(GL_DEPTH_TEST);
+      else
+         glEnable(GL_DEPTH_TEST);
+   }
+   if (!p || p->depth_function != r->depth_function) {
+      glDepthFunc(_gl_funcs[r->depth_function]);
+   }
+
+   if (!p || (p->write_mask & ALLEGRO_MASK_DEPTH) !=
+         (r->write_mask & ALLEGRO_MASK_DEPTH)) {
+      glDepthMask((r->write_mask & ALLEGRO_MASK_DEPTH) ? GL_TRUE : GL_FALSE);
+   }
+   if (!p || (p->write_mask & ALLEGRO_MASK_RGBA) !=
+         (r->write_mask & ALLEGRO_MASK_RGBA)) {
+      glColorMask(
+         (r->write_mask & ALLEGRO_MASK_RED) ? GL_TRUE : GL_FALSE,
+         (r->write_mask & ALLEGRO_MASK_GREEN) ? GL_TRUE : GL_FALSE,
+         (r->write_mask & ALLEGRO_MASK_BLUE) ? GL_TRUE : GL_FALSE,
+         (r->write_mask & ALLEGRO_MASK_ALPHA) ? GL_TRUE : GL_FALSE);
+   }
+
+   s->render_state = *r;
+   s->render_state_valid = true;
+}
+
+
+/* Forgets the shadowed state of the display's context, so that everything
+ * is set again the next time it is needed. This must be called whenever
+ * anything else may have changed it.
+ */
+void _al_ogl_invalidate_state(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_OGL_STATE *s = &display->ogl_extras->state;
+   int i;
+
+   s->blend_valid = false;
+   s->render_state_valid = false;
+   s->active_texture = -1;
+   for (i = 0; i < _ALLEGRO_OGL_STATE_TEXTURE_UNITS; i++)
+      s->textures[i] = _ALLEGRO_OGL_UNKNOWN_TEXTURE;
+   s->framebuffer_srgb = -1;
+   s->framebuffer = -1;
+   s->viewport_valid = false;
+   s->scissor_test = -1;
+   s->scissor_valid = false;
+   s->program = _ALLEGRO_OGL_UNKNOWN_PROGRAM;
+   display->ogl_extras->projview_program = 0;
+}
+
+
+/* Enables or disables sRGB encoding of writes to the current framebuffer,
+ * for sRGB targets. This does nothing for framebuffers which are not sRGB
+ * capable, but some drivers treat the default framebuffer as one anyway,
+ * so it is only enabled when the target asks for it.
+ */
+void _al_ogl_set_framebuffer_srgb(ALLEGRO_DISPLAY *display, bool enable)
+{
+#if !defined ALLEGRO_CFG_OPENGLES
+   ALLEGRO_OGL_STATE *s = &display->ogl_extras->state;
+   ALLEGRO_OGL_EXT_LIST *ext = display->ogl_extras->extension_list;
+
+   if (s->framebuffer_srgb == (int)enable)
+      return;
+   if (!ext->ALLEGRO_GL_ARB_framebuffer_sRGB &&
+         !ext->ALLEGRO_GL_EXT_framebuffer_sRGB)
+      return;
+
+   if (enable)
+      glEnable(GL_FRAMEBUFFER_SRGB);
    else
-      glEnable(GL_DEPTH_TEST);
-   glDepthFunc(_gl_funcs[r->depth_function]);
+      glDisable(GL_FRAMEBUFFER_SRGB);
+   s->framebuffer_srgb = enable;
+#else
+   (void)display;
+   (void)enable;
+#endif
+}
+
+
+void _al_ogl_set_viewport(ALLEGRO_DISPLAY *display, int x, int y, int w, int h)
+{
+   ALLEGRO_OGL_STATE *s = &display->ogl_extras->state;
+
+   if (s->viewport_valid && s->viewport[0] == x && s->viewport[1] == y &&
+         s->viewport[2] == w && s->viewport[3] == h)
+      return;
+
+   glViewport(x, y, w, h);
+   s->viewport[0] = x;
+   s->viewport[1] = y;
+   s->viewport[2] = w;
+   s->viewport[3] = h;
+   s->viewport_valid = true;
+}
+
+
+/* The box is ignored if enable is false. */
+void _al_ogl_set_scissor(ALLEGRO_DISPLAY *display, bool enable,
+   int x, int y, int w, int h)
+{
+   ALLEGRO_OGL_STATE *s = &display->ogl_extras->state;
+
+   if (s->scissor_test != (int)enable) {
+      if (enable)
+         glEnable(GL_SCISSOR_TEST);
+      else
+         glDisable(GL_SCISSOR_TEST);
+      s->scissor_test = enable;
+   }
+
+   if (!enable)
+      return;
+   if (s->scissor_valid && s->scissor[0] == x && s->scissor[1] == y &&
+         s->scissor[2] == w && s->scissor[3] == h)
+      return;
+
+   glScissor(x, y, w, h);
+   s->scissor[0] = x;
+   s->scissor[1] = y;
+   s->scissor[2] = w;
+   s->scissor[3] = h;
+   s->scissor_valid = true;
+}
+
+
+/* Makes the program current in the display's context unless it already is.
+ * Returns false if glUseProgram failed.
+ */
+bool _al_ogl_use_program(ALLEGRO_DISPLAY *display, GLuint program)
+{
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+   ALLEGRO_OGL_STATE *s = &display->ogl_extras->state;
+   GLenum e;
+
+   if (s->program == program)
+      return true;
 
-   glDepthMask((r->write_mask & ALLEGRO_MASK_DEPTH) ? GL_TRUE : GL_FALSE);
-   glColorMask(
-      (r->write_mask & ALLEGRO_MASK_RED) ? GL_TRUE : GL_FALSE,
-      (r->write_mask & ALLEGRO_MASK_GREEN) ? GL_TRUE : GL_FALSE,
-      (r->write_mask & ALLEGRO_MASK_BLUE) ? GL_TRUE : GL_FALSE,
-      (r->write_mask & ALLEGRO_MASK_ALPHA) ? GL_TRUE : GL_FALSE);
+   glGetError(); /* clear error */
+   glUseProgram(program);
+   e = glGetError();
+   if (e != GL_NO_ERROR) {
+      ALLEGRO_WARN("glUseProgram(%u) failed: %s\n", program,
+         _al_gl_error_string(e));
+      s->program = _ALLEGRO_OGL_UNKNOWN_PROGRAM;
+      return false;
+   }
+   s->program = program;
+   return true;
+#else
+   (void)display;
+   (void)program;
+   return false;
+#endif
+}
+
+
+/* Binds the texture to the given unit of the display's context, which must
+ * be current, and leaves that unit active. The fixed function pipeline
+ * only ever uses unit 0. Returns true if the binding changed.
+ */
+bool _al_ogl_bind_texture(ALLEGRO_DISPLAY *display, int unit, GLuint texture)
+{
+   ALLEGRO_OGL_STATE *s;
+
+   if (!display) {
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+      if (unit != 0)
+         glActiveTexture(GL_TEXTURE0 + unit);
+#endif
+      glBindTexture(GL_TEXTURE_2D, texture);
+      return true;
+   }
+   s = &display->ogl_extras->state;
+
+   if (display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
+#ifdef ALLEGRO_CFG_OPENGL_PROGRAMMABLE_PIPELINE
+      if (s->active_texture != unit) {
+         glActiveTexture(GL_TEXTURE0 + unit);
+         s->active_texture = unit;
+      }
+#endif
+   }
+   else {
+      ASSERT(unit == 0);
+   }
+
+   if (unit < _ALLEGRO_OGL_STATE_TEXTURE_UNITS) {
+      if (s->textures[unit] == texture)
+         return false;
+      s->textures[unit] = texture;
+   }
+   glBindTexture(GL_TEXTURE_2D, texture);
+   display->stats[ALLEGRO_DISPLAY_STAT_TEXTURE_BINDS]++;
+   return true;
 }
+
+
+/* Must be called when a texture is deleted, as its name may be reused by a
+ * new texture which is not bound or attached anywhere.
+ */
+void _al_ogl_forget_texture(GLuint texture)
+{
+   ALLEGRO_SYSTEM *system = al_get_system_driver();
+   unsigned int i;
+   int j;
+
+   for (i = 0; i < _al_vector_size(&system->displays); i++) {
+      ALLEGRO_DISPLAY **d = _al_vector_ref(&system->displays, i);
+      ALLEGRO_OGL_STATE *s;
+      if (!((*d)->flags & ALLEGRO_OPENGL) || !(*d)->ogl_extras)
+         continue;
+      s = &(*d)->ogl_extras->state;
+      for (j = 0; j < _ALLEGRO_OGL_STATE_TEXTURE_UNITS; j++) {
+         if (s->textures[j] == texture)
+            s->textures[j] = _ALLEGRO_OGL_UNKNOWN_TEXTURE;
+      }
+      for (j = 0; j < ALLEGRO_MAX_OPENGL_FBOS; j++) {
+         if ((*d)->ogl_extras->fbos[j].texture == texture)
+            (*d)->ogl_extras->fbos[j].texture = 0;
+      }
+   }
+}
+
+
+/* Must be called when a program is deleted, as its name may be reused. */
+void _al_ogl_forget_program(GLuint program)
+{
+   ALLEGRO_SYSTEM *system = al_get_system_driver();
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&system->displays); i++) {
+      ALLEGRO_DISPLAY **d = _al_vector_ref(&system->displays, i);
+      ALLEGRO_OGL_EXTRAS *extras;
+      if (!((*d)->flags & ALLEGRO_OPENGL) || !(*d)->ogl_extras)
+         continue;
+      extras = (*d)->ogl_extras;
+      if (extras->state.program == program)
+         extras->state.program = _ALLEGRO_OGL_UNKNOWN_PROGRAM;
+      if (extras->projview_program == program)
+         extras->projview_program = 0;
+   }
+}
+
+
+/* Function: al_invalidate_opengl_state
+ */
+void al_invalidate_opengl_state(void)
+{
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+
+   if (display && (display->flags & ALLEGRO_OPENGL))
+      _al_ogl_invalidate_state(display);
+}
+
+/* vim: set sts=3 sw=3 et: */
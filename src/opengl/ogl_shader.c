@@ -14,18 +14,29 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_opengl.h"
+#include "allegro5/internal/aintern_pixels.h"
 #include "allegro5/internal/aintern_shader.h"
 
 #ifdef ALLEGRO_MSVC
    #define snprintf _snprintf
 #endif
 
+/* OpenGL ES 2 only has the OES extension version of program binaries. */
+#if !defined(ALLEGRO_CFG_OPENGLES) || defined(ALLEGRO_CFG_OPENGLES3)
+   #define HAVE_PROGRAM_BINARY
+#endif
+
+#ifndef ALLEGRO_CFG_OPENGLES
+   #define HAVE_COMPUTE_SHADER
+#endif
+
 #ifdef ALLEGRO_CFG_SHADER_GLSL
 
 ALLEGRO_DEBUG_CHANNEL("shader")
@@ -40,14 +51,44 @@ struct ALLEGRO_SHADER_GLSL_S
    ALLEGRO_SHADER shader;
    GLuint vertex_shader;
    GLuint pixel_shader;
+   GLuint compute_shader;
    GLuint program_object;
    ALLEGRO_OGL_VARLOCS varlocs;
+   /* Sources whose compilation waits for al_build_shader, to be skipped if
+    * the program binary cache has the linked program.
+    */
+   ALLEGRO_USTR *vertex_source;
+   ALLEGRO_USTR *pixel_source;
+   ALLEGRO_USTR *compute_source;
+   /* Whether a compute shader is attached, even if only as a source. */
+   bool is_compute;
+   /* GLSL_UNIFORM, indexed by uniform handles */
+   _AL_VECTOR uniforms;
 };
 
+/* The last value uploaded is kept to skip setting it again, except for
+ * Allegro's own uniforms which are also set behind the user's back.
+ */
+#define MAX_CACHED_UNIFORM_SIZE (16 * sizeof(float))
+
+typedef struct GLSL_UNIFORM
+{
+   char *name;
+   uint64_t hash;
+   GLint location;
+   bool cacheable;
+   int value_type;
+   int value_components;
+   size_t value_size;
+   unsigned char value[MAX_CACHED_UNIFORM_SIZE];
+} GLSL_UNIFORM;
+
 
 /* forward declarations */
 static struct ALLEGRO_SHADER_INTERFACE shader_glsl_vt;
 static void lookup_varlocs(ALLEGRO_OGL_VARLOCS *varlocs, GLuint program);
+static void build_uniform_table(ALLEGRO_SHADER_GLSL_S *gl_shader);
+static void free_uniform_table(ALLEGRO_SHADER_GLSL_S *gl_shader);
 
 
 static bool check_gl_error(const char* name)
@@ -71,6 +112,7 @@ ALLEGRO_SHADER *_al_create_shader_glsl(ALLEGRO_SHADER_PLATFORM platform)
    shader->shader.platform = platform;
    shader->shader.vt = &shader_glsl_vt;
    _al_vector_init(&shader->shader.bitmaps, sizeof(ALLEGRO_BITMAP *));
+   _al_vector_init(&shader->uniforms, sizeof(GLSL_UNIFORM));
 
    al_lock_mutex(shaders_mutex);
    {
@@ -82,90 +124,418 @@ ALLEGRO_SHADER *_al_create_shader_glsl(ALLEGRO_SHADER_PLATFORM platform)
    return (ALLEGRO_SHADER *)shader;
 }
 
-static bool glsl_attach_shader_source(ALLEGRO_SHADER *shader,
-   ALLEGRO_SHADER_TYPE type, const char *source)
+/* Returns the directory of the program binary cache if it is enabled and
+ * the driver can save programs, otherwise NULL.
+ */
+static const char *get_binary_cache_dir(ALLEGRO_DISPLAY *display)
+{
+#ifndef HAVE_PROGRAM_BINARY
+   (void)display;
+   return NULL;
+#else
+   const char *dir = al_get_config_value(al_get_system_config(), "shader",
+      "program_binary_cache");
+   GLint num_formats = 0;
+
+   if (!dir || dir[0] == '\0')
+      return NULL;
+#if defined(ALLEGRO_CFG_OPENGLES3)
+   if (display->ogl_extras->ogl_info.version < _ALLEGRO_OPENGL_VERSION_3_0)
+      return NULL;
+#else
+   if (!display->ogl_extras->extension_list->ALLEGRO_GL_ARB_get_program_binary)
+      return NULL;
+#endif
+   glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+   if (num_formats <= 0)
+      return NULL;
+   return dir;
+#endif
+}
+
+static bool compute_shaders_supported(ALLEGRO_DISPLAY *display)
+{
+#ifdef HAVE_COMPUTE_SHADER
+   return display->ogl_extras->extension_list->ALLEGRO_GL_ARB_compute_shader;
+#else
+   (void)display;
+   return false;
+#endif
+}
+
+/* Returns the shader object and the deferred source of a stage. */
+static GLuint *get_stage(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   ALLEGRO_SHADER_TYPE type, ALLEGRO_USTR ***source)
+{
+   switch (type) {
+      case ALLEGRO_VERTEX_SHADER:
+         *source = &gl_shader->vertex_source;
+         return &gl_shader->vertex_shader;
+      case ALLEGRO_COMPUTE_SHADER:
+         *source = &gl_shader->compute_source;
+         return &gl_shader->compute_shader;
+      default:
+         *source = &gl_shader->pixel_source;
+         return &gl_shader->pixel_shader;
+   }
+}
+
+static bool compile_shader(ALLEGRO_SHADER *shader, ALLEGRO_SHADER_TYPE type,
+   const char *source)
 {
    GLint status;
    GLchar error_buf[4096];
+   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
+   ALLEGRO_USTR **deferred;
+   GLuint *handle = get_stage(gl_shader, type, &deferred);
+   GLenum gl_type;
+
+   switch (type) {
+      case ALLEGRO_VERTEX_SHADER:
+         gl_type = GL_VERTEX_SHADER;
+         break;
+#ifdef HAVE_COMPUTE_SHADER
+      case ALLEGRO_COMPUTE_SHADER:
+         gl_type = GL_COMPUTE_SHADER;
+         break;
+#endif
+      default:
+         gl_type = GL_FRAGMENT_SHADER;
+         break;
+   }
+   *handle = glCreateShader(gl_type);
+   if ((*handle) == 0) {
+      return false;
+   }
+   glShaderSource(*handle, 1, &source, NULL);
+   glCompileShader(*handle);
+   glGetShaderiv(*handle, GL_COMPILE_STATUS, &status);
+   if (status == 0) {
+      glGetShaderInfoLog(*handle, sizeof(error_buf), NULL, error_buf);
+      if (shader->log) {
+         al_ustr_truncate(shader->log, 0);
+         al_ustr_append_cstr(shader->log, error_buf);
+      }
+      else {
+         shader->log = al_ustr_new(error_buf);
+      }
+      ALLEGRO_ERROR("Compile error: %s\n", error_buf);
+      glDeleteShader(*handle);
+      *handle = 0;
+      return false;
+   }
+
+   return true;
+}
+
+static bool glsl_attach_shader_source(ALLEGRO_SHADER *shader,
+   ALLEGRO_SHADER_TYPE type, const char *source)
+{
    ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
    ALLEGRO_DISPLAY *display = al_get_current_display();
+   ALLEGRO_USTR **deferred;
+   GLuint *handle;
    ASSERT(display);
    ASSERT(display->flags & ALLEGRO_OPENGL);
 
+   handle = get_stage(gl_shader, type, &deferred);
+   al_ustr_free(*deferred);
+   *deferred = NULL;
+
    if (source == NULL) {
-      if (type == ALLEGRO_VERTEX_SHADER) {
-         if (gl_shader->vertex_shader) {
-            glDetachShader(gl_shader->program_object, gl_shader->vertex_shader);
-            glDeleteShader(gl_shader->vertex_shader);
-            gl_shader->vertex_shader = 0;
-         }
-      }
-      else {
-         if (gl_shader->pixel_shader) {
-            glDetachShader(gl_shader->program_object, gl_shader->pixel_shader);
-            glDeleteShader(gl_shader->pixel_shader);
-            gl_shader->pixel_shader = 0;
-         }
+      if (*handle) {
+         glDetachShader(gl_shader->program_object, *handle);
+         glDeleteShader(*handle);
+         *handle = 0;
       }
+      if (type == ALLEGRO_COMPUTE_SHADER)
+         gl_shader->is_compute = false;
       return true;
    }
-   else {
-      GLuint *handle;
-      GLenum gl_type;
-      if (type == ALLEGRO_VERTEX_SHADER) {
-         handle = &(gl_shader->vertex_shader);
-         gl_type = GL_VERTEX_SHADER;
-      }
-      else {
-         handle = &(gl_shader->pixel_shader);
-         gl_type = GL_FRAGMENT_SHADER;
-      }
-      *handle = glCreateShader(gl_type);
-      if ((*handle) == 0) {
+
+   if (type == ALLEGRO_COMPUTE_SHADER) {
+      if (!compute_shaders_supported(display)) {
+         al_ustr_free(shader->log);
+         shader->log = al_ustr_new("Compute shaders are not supported");
+         ALLEGRO_ERROR("Compute shaders are not supported\n");
          return false;
       }
-      glShaderSource(*handle, 1, &source, NULL);
-      glCompileShader(*handle);
-      glGetShaderiv(*handle, GL_COMPILE_STATUS, &status);
-      if (status == 0) {
-         glGetShaderInfoLog(*handle, sizeof(error_buf), NULL, error_buf);
-         if (shader->log) {
-            al_ustr_truncate(shader->log, 0);
-            al_ustr_append_cstr(shader->log, error_buf);
-         }
-         else {
-            shader->log = al_ustr_new(error_buf);
+      gl_shader->is_compute = true;
+   }
+
+   /* With the binary cache the source is only compiled if it turns out to
+    * be needed, so compile errors are reported by al_build_shader.
+    */
+   if (get_binary_cache_dir(display)) {
+      *deferred = al_ustr_new(source);
+      return true;
+   }
+
+   return compile_shader(shader, type, source);
+}
+
+/* FNV-1a */
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+   const unsigned char *p = (const unsigned char *)str;
+
+   /* Include the terminator so that "ab" + "c" differs from "a" + "bc". */
+   do {
+      hash ^= *p;
+      hash *= UINT64_C(0x100000001b3);
+   } while (*p++);
+   return hash;
+}
+
+#ifdef HAVE_PROGRAM_BINARY
+
+/* The cached binary is only valid for the same sources and driver. */
+static ALLEGRO_PATH *get_binary_cache_path(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   const char *dir)
+{
+   uint64_t hash = UINT64_C(0xcbf29ce484222325);
+   const char *vs = gl_shader->vertex_source ?
+      al_cstr(gl_shader->vertex_source) : "";
+   const char *ps = gl_shader->pixel_source ?
+      al_cstr(gl_shader->pixel_source) : "";
+   const char *cs = gl_shader->compute_source ?
+      al_cstr(gl_shader->compute_source) : "";
+   const char *vendor = (const char *)glGetString(GL_VENDOR);
+   const char *renderer = (const char *)glGetString(GL_RENDERER);
+   const char *version = (const char *)glGetString(GL_VERSION);
+   ALLEGRO_PATH *path;
+   char name[32];
+
+   hash = hash_string(hash, vs);
+   hash = hash_string(hash, ps);
+   hash = hash_string(hash, cs);
+   hash = hash_string(hash, vendor ? vendor : "");
+   hash = hash_string(hash, renderer ? renderer : "");
+   hash = hash_string(hash, version ? version : "");
+
+   snprintf(name, sizeof(name), "%08x%08x.glsl.bin",
+      (unsigned)(hash >> 32), (unsigned)(hash & 0xffffffff));
+   path = al_create_path_for_directory(dir);
+   al_set_path_filename(path, name);
+   return path;
+}
+
+#define BINARY_CACHE_MAGIC 0x42504c41 /* "ALPB" */
+
+static bool load_program_binary(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   const ALLEGRO_PATH *path)
+{
+   const char *filename = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
+   ALLEGRO_FILE *fp;
+   GLenum format = 0;
+   int32_t size = 0;
+   void *binary = NULL;
+   GLint status = 0;
+
+   if (!al_filename_exists(filename))
+      return false;
+   fp = al_fopen(filename, "rb");
+   if (!fp)
+      return false;
+
+   if (al_fread32le(fp) == BINARY_CACHE_MAGIC) {
+      format = (GLenum)al_fread32le(fp);
+      size = al_fread32le(fp);
+      if (size > 0 && !al_feof(fp))
+         binary = al_malloc(size);
+      if (binary && al_fread(fp, binary, size) != (size_t)size) {
+         al_free(binary);
+         binary = NULL;
+      }
+   }
+   al_fclose(fp);
+
+   if (binary) {
+      gl_shader->program_object = glCreateProgram();
+      if (gl_shader->program_object) {
+         glProgramBinary(gl_shader->program_object, format, binary, size);
+         glGetProgramiv(gl_shader->program_object, GL_LINK_STATUS, &status);
+         if (status == 0) {
+            glDeleteProgram(gl_shader->program_object);
+            gl_shader->program_object = 0;
          }
-         ALLEGRO_ERROR("Compile error: %s\n", error_buf);
-         glDeleteShader(*handle);
-         return false;
       }
+      al_free(binary);
    }
 
+   /* The driver was updated or the file is damaged, so compile the sources
+    * and overwrite it.
+    */
+   if (status == 0) {
+      ALLEGRO_WARN("Program binary %s rejected\n", filename);
+      glGetError(); /* clear error */
+      return false;
+   }
+
+   ALLEGRO_DEBUG("Loaded program binary %s\n", filename);
    return true;
 }
 
+static void save_program_binary(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   const ALLEGRO_PATH *path)
+{
+   const char *filename = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
+   ALLEGRO_PATH *dir;
+   ALLEGRO_FILE *fp;
+   GLint size = 0;
+   GLsizei length = 0;
+   GLenum format = 0;
+   void *binary;
+
+   glGetProgramiv(gl_shader->program_object, GL_PROGRAM_BINARY_LENGTH, &size);
+   if (size <= 0)
+      return;
+   binary = al_malloc(size);
+   if (!binary)
+      return;
+   glGetProgramBinary(gl_shader->program_object, size, &length, &format,
+      binary);
+   if (!check_gl_error("glGetProgramBinary") || length <= 0) {
+      al_free(binary);
+      return;
+   }
+
+   dir = al_clone_path(path);
+   al_set_path_filename(dir, NULL);
+   al_make_directory(al_path_cstr(dir, ALLEGRO_NATIVE_PATH_SEP));
+   al_destroy_path(dir);
+
+   fp = al_fopen(filename, "wb");
+   if (fp) {
+      bool ok = al_fwrite32le(fp, BINARY_CACHE_MAGIC) == 4 &&
+         al_fwrite32le(fp, (int32_t)format) == 4 &&
+         al_fwrite32le(fp, length) == 4 &&
+         al_fwrite(fp, binary, length) == (size_t)length;
+      ok = al_fclose(fp) && ok;
+      /* An incomplete file would only be rejected every time. */
+      if (!ok)
+         al_remove_filename(filename);
+      else
+         ALLEGRO_DEBUG("Saved program binary %s\n", filename);
+   }
+   al_free(binary);
+}
+
+#else
+
+static ALLEGRO_PATH *get_binary_cache_path(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   const char *dir)
+{
+   (void)gl_shader;
+   (void)dir;
+   return NULL;
+}
+
+static bool load_program_binary(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   const ALLEGRO_PATH *path)
+{
+   (void)gl_shader;
+   (void)path;
+   return false;
+}
+
+static void save_program_binary(ALLEGRO_SHADER_GLSL_S *gl_shader,
+   const ALLEGRO_PATH *path)
+{
+   (void)gl_shader;
+   (void)path;
+}
+
+#endif
+
 static bool glsl_build_shader(ALLEGRO_SHADER *shader)
 {
    GLint status;
    ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
    GLchar error_buf[4096];
+   ALLEGRO_PATH *cache_path = NULL;
+   const char *cache_dir;
 
-   if (gl_shader->vertex_shader == 0 && gl_shader->pixel_shader == 0)
+   if (gl_shader->vertex_shader == 0 && gl_shader->pixel_shader == 0 &&
+         gl_shader->compute_shader == 0 && !gl_shader->vertex_source &&
+         !gl_shader->pixel_source && !gl_shader->compute_source)
       return false;
 
    if (gl_shader->program_object != 0) {
       glDeleteProgram(gl_shader->program_object);
+      gl_shader->program_object = 0;
+   }
+
+   /* The key is made from the sources, so a shader compiled when it was
+    * attached, without the cache, rules it out.
+    */
+   cache_dir = get_binary_cache_dir(al_get_current_display());
+   if (cache_dir &&
+         (gl_shader->vertex_shader == 0 || gl_shader->vertex_source) &&
+         (gl_shader->pixel_shader == 0 || gl_shader->pixel_source) &&
+         (gl_shader->compute_shader == 0 || gl_shader->compute_source)) {
+      cache_path = get_binary_cache_path(gl_shader, cache_dir);
+      if (load_program_binary(gl_shader, cache_path)) {
+         al_destroy_path(cache_path);
+         lookup_varlocs(&gl_shader->varlocs, gl_shader->program_object);
+         build_uniform_table(gl_shader);
+         return true;
+      }
+   }
+
+   if (gl_shader->vertex_source) {
+      if (gl_shader->vertex_shader) {
+         glDeleteShader(gl_shader->vertex_shader);
+         gl_shader->vertex_shader = 0;
+      }
+      if (!compile_shader(shader, ALLEGRO_VERTEX_SHADER,
+            al_cstr(gl_shader->vertex_source))) {
+         al_destroy_path(cache_path);
+         return false;
+      }
+   }
+   if (gl_shader->pixel_source) {
+      if (gl_shader->pixel_shader) {
+         glDeleteShader(gl_shader->pixel_shader);
+         gl_shader->pixel_shader = 0;
+      }
+      if (!compile_shader(shader, ALLEGRO_PIXEL_SHADER,
+            al_cstr(gl_shader->pixel_source))) {
+         al_destroy_path(cache_path);
+         return false;
+      }
+   }
+   if (gl_shader->compute_source) {
+      if (gl_shader->compute_shader) {
+         glDeleteShader(gl_shader->compute_shader);
+         gl_shader->compute_shader = 0;
+      }
+      if (!compile_shader(shader, ALLEGRO_COMPUTE_SHADER,
+            al_cstr(gl_shader->compute_source))) {
+         al_destroy_path(cache_path);
+         return false;
+      }
    }
 
    gl_shader->program_object = glCreateProgram();
-   if (gl_shader->program_object == 0)
+   if (gl_shader->program_object == 0) {
+      al_destroy_path(cache_path);
       return false;
+   }
 
    if (gl_shader->vertex_shader)
       glAttachShader(gl_shader->program_object, gl_shader->vertex_shader);
    if (gl_shader->pixel_shader)
       glAttachShader(gl_shader->program_object, gl_shader->pixel_shader);
+   if (gl_shader->compute_shader)
+      glAttachShader(gl_shader->program_object, gl_shader->compute_shader);
+
+#ifdef HAVE_PROGRAM_BINARY
+   if (cache_path) {
+      glProgramParameteri(gl_shader->program_object,
+         GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+   }
+#endif
 
    glLinkProgram(gl_shader->program_object);
 
@@ -183,11 +553,19 @@ static bool glsl_build_shader(ALLEGRO_SHADER *shader)
       }
       ALLEGRO_ERROR("Link error: %s\n", error_buf);
       glDeleteProgram(gl_shader->program_object);
+      gl_shader->program_object = 0;
+      al_destroy_path(cache_path);
       return false;
    }
 
+   if (cache_path) {
+      save_program_binary(gl_shader, cache_path);
+      al_destroy_path(cache_path);
+   }
+
    /* Look up variable locations. */
    lookup_varlocs(&gl_shader->varlocs, gl_shader->program_object);
+   build_uniform_table(gl_shader);
 
    return true;
 }
@@ -197,7 +575,6 @@ static bool glsl_use_shader(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *display,
 {
    ALLEGRO_SHADER_GLSL_S *gl_shader;
    GLuint program_object;
-   GLenum err;
 
    if (!(display->flags & ALLEGRO_OPENGL)) {
       return false;
@@ -206,12 +583,13 @@ static bool glsl_use_shader(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *display,
    gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
    program_object = gl_shader->program_object;
 
-   glGetError(); /* clear error */
-   glUseProgram(program_object);
-   err = glGetError();
-   if (err != GL_NO_ERROR) {
-      ALLEGRO_WARN("glUseProgram(%u) failed: %s\n", program_object,
-         _al_gl_error_string(err));
+   if (display->ogl_extras->program_object != program_object)
+      display->stats[ALLEGRO_DISPLAY_STAT_SHADER_CHANGES]++;
+
+   /* Setting a target bitmap uses its shader again, which is often the
+    * one already in use.
+    */
+   if (!_al_ogl_use_program(display, program_object)) {
       display->ogl_extras->program_object = 0;
       return false;
    }
@@ -221,13 +599,17 @@ static bool glsl_use_shader(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *display,
    /* Copy variable locations. */
    display->ogl_extras->varlocs = gl_shader->varlocs;
 
-   /* Optionally set projview matrix.  We skip this when it is known that the
-    * matrices in the display are out of date and are about to be clobbered
-    * itself.
+   /* Optionally set projview matrix, unless the program still has it.  We
+    * skip this when it is known that the matrices in the display are out of
+    * date and are about to be clobbered itself.
     */
-   if (set_projview_matrix_from_display) {
-      _al_glsl_set_projview_matrix(
-         display->ogl_extras->varlocs.projview_matrix_loc, &display->projview_transform);
+   if (set_projview_matrix_from_display &&
+         display->ogl_extras->projview_program != program_object) {
+      if (_al_glsl_set_projview_matrix(
+            display->ogl_extras->varlocs.projview_matrix_loc,
+            &display->projview_transform)) {
+         display->ogl_extras->projview_program = program_object;
+      }
    }
 
    /* Alpha testing may be done in the shader and so when a shader is
@@ -241,8 +623,7 @@ static bool glsl_use_shader(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *display,
 static void glsl_unuse_shader(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *display)
 {
    (void)shader;
-   (void)display;
-   glUseProgram(0);
+   _al_ogl_use_program(display, 0);
 }
 
 static void glsl_destroy_shader(ALLEGRO_SHADER *shader)
@@ -255,165 +636,364 @@ static void glsl_destroy_shader(ALLEGRO_SHADER *shader)
 
    glDeleteShader(gl_shader->vertex_shader);
    glDeleteShader(gl_shader->pixel_shader);
+   glDeleteShader(gl_shader->compute_shader);
    glDeleteProgram(gl_shader->program_object);
+   _al_ogl_forget_program(gl_shader->program_object);
+   al_ustr_free(gl_shader->vertex_source);
+   al_ustr_free(gl_shader->pixel_source);
+   al_ustr_free(gl_shader->compute_source);
+   free_uniform_table(gl_shader);
    al_free(shader);
 }
 
-static bool glsl_set_shader_sampler(ALLEGRO_SHADER *shader,
-   const char *name, ALLEGRO_BITMAP *bitmap, int unit)
+static void free_uniform_table(ALLEGRO_SHADER_GLSL_S *gl_shader)
 {
-   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
-   GLint handle;
-   GLuint texture;
+   unsigned i;
 
-   if (bitmap && al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) {
-      ALLEGRO_WARN("Cannot use memory bitmap for sampler\n");
-      return false;
+   for (i = 0; i < _al_vector_size(&gl_shader->uniforms); i++) {
+      GLSL_UNIFORM *u = _al_vector_ref(&gl_shader->uniforms, i);
+      al_free(u->name);
    }
+   _al_vector_free(&gl_shader->uniforms);
+}
 
-   handle = glGetUniformLocation(gl_shader->program_object, name);
+static int add_uniform(ALLEGRO_SHADER_GLSL_S *gl_shader, const char *name,
+   GLint location)
+{
+   GLSL_UNIFORM *u = _al_vector_alloc_back(&gl_shader->uniforms);
+   size_t len = strlen(name);
+
+   memset(u, 0, sizeof *u);
+   u->name = al_malloc(len + 1);
+   memcpy(u->name, name, len + 1);
+   u->hash = hash_string(UINT64_C(0xcbf29ce484222325), name);
+   u->location = location;
+   u->cacheable = strncmp(name, "al_", 3) != 0;
+   return _al_vector_size(&gl_shader->uniforms) - 1;
+}
 
-   if (handle < 0) {
-      ALLEGRO_WARN("No uniform variable '%s' in shader program\n", name);
-      return false;
+/* Records the location of every active uniform after linking, so that
+ * setting one does not have to ask the driver.
+ */
+static void build_uniform_table(ALLEGRO_SHADER_GLSL_S *gl_shader)
+{
+   GLuint program = gl_shader->program_object;
+   GLint count = 0;
+   GLint max_length = 0;
+   GLchar *name;
+   GLint i;
+
+   free_uniform_table(gl_shader);
+
+   glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+   glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+   if (count <= 0 || max_length <= 0)
+      return;
+   name = al_malloc(max_length + 1);
+   if (!name)
+      return;
+
+   for (i = 0; i < count; i++) {
+      GLsizei length = 0;
+      GLint size;
+      GLenum type;
+      GLint location;
+
+      glGetActiveUniform(program, i, max_length + 1, &length, &size, &type,
+         name);
+      /* Arrays are reported as "name[0]" but set by their plain name. */
+      if (length > 3 && strcmp(name + length - 3, "[0]") == 0)
+         name[length - 3] = '\0';
+      location = glGetUniformLocation(program, name);
+      /* Uniform block members have no location. */
+      if (location >= 0)
+         add_uniform(gl_shader, name, location);
    }
+   al_free(name);
 
-   glActiveTexture(GL_TEXTURE0 + unit);
+   check_gl_error("glGetActiveUniform");
+}
 
-   texture = bitmap ? al_get_opengl_texture(bitmap) : 0;
-   glBindTexture(GL_TEXTURE_2D, texture);
+static int find_uniform(ALLEGRO_SHADER_GLSL_S *gl_shader, const char *name)
+{
+   uint64_t hash = hash_string(UINT64_C(0xcbf29ce484222325), name);
+   GLint location;
+   unsigned i;
 
-   glUniform1i(handle, unit);
+   for (i = 0; i < _al_vector_size(&gl_shader->uniforms); i++) {
+      GLSL_UNIFORM *u = _al_vector_ref(&gl_shader->uniforms, i);
+      if (u->hash == hash && strcmp(u->name, name) == 0)
+         return i;
+   }
 
-   return check_gl_error(name);
+   /* Names like "array[2]" or "light.color" are not in the table until
+    * they are first used.
+    */
+   location = glGetUniformLocation(gl_shader->program_object, name);
+   if (location < 0)
+      return -1;
+   return add_uniform(gl_shader, name, location);
 }
 
-static bool glsl_set_shader_matrix(ALLEGRO_SHADER *shader,
-   const char *name, const ALLEGRO_TRANSFORM *matrix)
+static int glsl_get_uniform_handle(ALLEGRO_SHADER *shader, const char *name)
 {
    ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
-   GLint handle;
+   int handle = find_uniform(gl_shader, name);
 
-   handle = glGetUniformLocation(gl_shader->program_object, name);
-
-   if (handle < 0) {
+   if (handle < 0)
       ALLEGRO_WARN("No uniform variable '%s' in shader program\n", name);
+   return handle;
+}
+
+static bool glsl_set_uniform_h(ALLEGRO_SHADER *shader, int handle,
+   int type, int num_components, const void *data, int num_elems)
+{
+   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
+   GLSL_UNIFORM *u;
+   size_t size;
+
+   if (handle < 0 || handle >= (int)_al_vector_size(&gl_shader->uniforms))
       return false;
+   u = _al_vector_ref(&gl_shader->uniforms, handle);
+
+   if (type == _ALLEGRO_UNIFORM_MATRIX)
+      num_components = 16;
+   size = num_components * num_elems * sizeof(float);
+   if (u->cacheable && u->value_size == size && u->value_type == type &&
+         u->value_components == num_components &&
+         memcmp(u->value, data, size) == 0) {
+      return true;
    }
 
-   glUniformMatrix4fv(handle, 1, false, (const float *)matrix->m);
+   if (type == _ALLEGRO_UNIFORM_MATRIX) {
+      /* Setting the projview matrix by hand makes the display's record of
+       * what is uploaded out of date.
+       */
+      if (u->location == gl_shader->varlocs.projview_matrix_loc) {
+         ALLEGRO_DISPLAY *display = al_get_current_display();
+         if (display && (display->flags & ALLEGRO_OPENGL) &&
+               display->ogl_extras->projview_program ==
+                  gl_shader->program_object) {
+            display->ogl_extras->projview_program = 0;
+         }
+      }
+      glUniformMatrix4fv(u->location, num_elems, false, data);
+   }
+   else if (type == _ALLEGRO_UNIFORM_INT) {
+      switch (num_components) {
+         case 1:
+            glUniform1iv(u->location, num_elems, data);
+            break;
+         case 2:
+            glUniform2iv(u->location, num_elems, data);
+            break;
+         case 3:
+            glUniform3iv(u->location, num_elems, data);
+            break;
+         case 4:
+            glUniform4iv(u->location, num_elems, data);
+            break;
+         default:
+            ASSERT(false);
+            break;
+      }
+   }
+   else {
+      switch (num_components) {
+         case 1:
+            glUniform1fv(u->location, num_elems, data);
+            break;
+         case 2:
+            glUniform2fv(u->location, num_elems, data);
+            break;
+         case 3:
+            glUniform3fv(u->location, num_elems, data);
+            break;
+         case 4:
+            glUniform4fv(u->location, num_elems, data);
+            break;
+         default:
+            ASSERT(false);
+            break;
+      }
+   }
+
+   if (!check_gl_error(u->name)) {
+      u->value_size = 0;
+      return false;
+   }
 
-   return check_gl_error(name);
+   if (u->cacheable && size <= sizeof(u->value)) {
+      memcpy(u->value, data, size);
+      u->value_size = size;
+      u->value_type = type;
+      u->value_components = num_components;
+   }
+   else {
+      u->value_size = 0;
+   }
+   return true;
 }
 
-static bool glsl_set_shader_int(ALLEGRO_SHADER *shader,
-   const char *name, int i)
+static bool glsl_set_shader_sampler(ALLEGRO_SHADER *shader,
+   const char *name, ALLEGRO_BITMAP *bitmap, int unit)
 {
-   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
-   GLint handle;
-
-   handle = glGetUniformLocation(gl_shader->program_object, name);
+   int handle;
+   GLuint texture;
 
-   if (handle < 0) {
-      ALLEGRO_WARN("No uniform variable '%s' in shader program\n", name);
+   if (bitmap && al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) {
+      ALLEGRO_WARN("Cannot use memory bitmap for sampler\n");
       return false;
    }
 
-   glUniform1i(handle, i);
+   handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
+      return false;
 
-   return check_gl_error(name);
+   texture = bitmap ? _al_ogl_get_texture(bitmap) : 0;
+   _al_ogl_bind_texture(al_get_current_display(), unit, texture);
+
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_INT, 1, &unit, 1);
 }
 
-static bool glsl_set_shader_float(ALLEGRO_SHADER *shader,
-   const char *name, float f)
+static bool glsl_set_shader_matrix(ALLEGRO_SHADER *shader,
+   const char *name, const ALLEGRO_TRANSFORM *matrix)
 {
-   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
-   GLint handle;
+   int handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
+      return false;
 
-   handle = glGetUniformLocation(gl_shader->program_object, name);
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_MATRIX, 16,
+      matrix->m, 1);
+}
 
-   if (handle < 0) {
-      ALLEGRO_WARN("No uniform variable '%s' in shader program\n", name);
+static bool glsl_set_shader_int(ALLEGRO_SHADER *shader,
+   const char *name, int i)
+{
+   int handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
       return false;
-   }
 
-   glUniform1f(handle, f);
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_INT, 1, &i, 1);
+}
+
+static bool glsl_set_shader_float(ALLEGRO_SHADER *shader,
+   const char *name, float f)
+{
+   int handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
+      return false;
 
-   return check_gl_error(name);
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_FLOAT, 1, &f, 1);
 }
 
 static bool glsl_set_shader_int_vector(ALLEGRO_SHADER *shader,
    const char *name, int num_components, const int *i, int num_elems)
 {
-   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
-   GLint handle;
-
-   handle = glGetUniformLocation(gl_shader->program_object, name);
-
-   if (handle < 0) {
-      ALLEGRO_WARN("No uniform variable '%s' in shader program\n", name);
+   int handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
       return false;
-   }
 
-   switch (num_components) {
-      case 1:
-         glUniform1iv(handle, num_elems, i);
-         break;
-      case 2:
-         glUniform2iv(handle, num_elems, i);
-         break;
-      case 3:
-         glUniform3iv(handle, num_elems, i);
-         break;
-      case 4:
-         glUniform4iv(handle, num_elems, i);
-         break;
-      default:
-         ASSERT(false);
-         break;
-   }
-
-   return check_gl_error(name);
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_INT,
+      num_components, i, num_elems);
 }
 
 static bool glsl_set_shader_float_vector(ALLEGRO_SHADER *shader,
    const char *name, int num_components, const float *f, int num_elems)
 {
-   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
-   GLint handle;
+   int handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
+      return false;
 
-   handle = glGetUniformLocation(gl_shader->program_object, name);
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_FLOAT,
+      num_components, f, num_elems);
+}
 
-   if (handle < 0) {
-      ALLEGRO_WARN("No uniform variable '%s' in shader program\n", name);
+static bool glsl_set_shader_bool(ALLEGRO_SHADER *shader,
+   const char *name, bool b)
+{
+   return glsl_set_shader_int(shader, name, b);
+}
+
+static bool glsl_set_shader_image(ALLEGRO_SHADER *shader,
+   const char *name, ALLEGRO_BITMAP *bitmap, int unit)
+{
+#ifdef HAVE_COMPUTE_SHADER
+   ALLEGRO_DISPLAY *display = al_get_current_display();
+   GLuint texture = 0;
+   GLenum format = GL_RGBA8;
+   int handle;
+
+   if (!display->ogl_extras->extension_list->
+         ALLEGRO_GL_ARB_shader_image_load_store) {
+      ALLEGRO_WARN("Image load/store is not supported\n");
       return false;
    }
 
-   switch (num_components) {
-      case 1:
-         glUniform1fv(handle, num_elems, f);
-         break;
-      case 2:
-         glUniform2fv(handle, num_elems, f);
-         break;
-      case 3:
-         glUniform3fv(handle, num_elems, f);
-         break;
-      case 4:
-         glUniform4fv(handle, num_elems, f);
-         break;
-      default:
-         ASSERT(false);
-         break;
+   if (bitmap) {
+      if (al_get_bitmap_flags(bitmap) & ALLEGRO_MEMORY_BITMAP) {
+         ALLEGRO_WARN("Cannot use memory bitmap for image\n");
+         return false;
+      }
+      /* Images can't be sRGB, compressed or of an unsized format. */
+      format = _al_ogl_get_glformat(al_get_bitmap_format(bitmap), 0);
+      if ((format != GL_RGBA8 && format != GL_RGBA32F) ||
+            (al_get_bitmap_flags(bitmap) & ALLEGRO_SRGB)) {
+         ALLEGRO_WARN("Cannot use bitmap of format %s for image\n",
+            _al_pixel_format_name(al_get_bitmap_format(bitmap)));
+         return false;
+      }
+      texture = _al_ogl_get_texture(bitmap);
    }
 
-   return check_gl_error(name);
+   handle = glsl_get_uniform_handle(shader, name);
+   if (handle < 0)
+      return false;
+
+   glBindImageTexture(unit, texture, 0, GL_FALSE, 0, GL_READ_WRITE, format);
+   if (!check_gl_error("glBindImageTexture"))
+      return false;
+
+   return glsl_set_uniform_h(shader, handle, _ALLEGRO_UNIFORM_INT, 1, &unit, 1);
+#else
+   (void)shader;
+   (void)name;
+   (void)bitmap;
+   (void)unit;
+   return false;
+#endif
 }
 
-static bool glsl_set_shader_bool(ALLEGRO_SHADER *shader,
-   const char *name, bool b)
+static bool glsl_dispatch_compute(ALLEGRO_SHADER *shader,
+   ALLEGRO_DISPLAY *display, int groups_x, int groups_y, int groups_z)
 {
-   return glsl_set_shader_int(shader, name, b);
+#ifdef HAVE_COMPUTE_SHADER
+   ALLEGRO_SHADER_GLSL_S *gl_shader = (ALLEGRO_SHADER_GLSL_S *)shader;
+
+   if (!gl_shader->is_compute || gl_shader->program_object == 0) {
+      ALLEGRO_WARN("Shader has no compute shader\n");
+      return false;
+   }
+   if (!_al_ogl_use_program(display, gl_shader->program_object))
+      return false;
+
+   glDispatchCompute(groups_x, groups_y, groups_z);
+   if (!check_gl_error("glDispatchCompute"))
+      return false;
+
+   /* Whatever reads the results next, be it drawing, sampling, a vertex
+    * buffer draw or a lock, sees them.
+    */
+   glMemoryBarrier(GL_ALL_BARRIER_BITS);
+   return true;
+#else
+   (void)shader;
+   (void)display;
+   (void)groups_x;
+   (void)groups_y;
+   (void)groups_z;
+   return false;
+#endif
 }
 
 static struct ALLEGRO_SHADER_INTERFACE shader_glsl_vt =
@@ -431,7 +1011,11 @@ static struct ALLEGRO_SHADER_INTERFACE shader_glsl_vt =
    glsl_set_shader_float,
    glsl_set_shader_int_vector,
    glsl_set_shader_float_vector,
-   glsl_set_shader_bool
+   glsl_set_shader_bool,
+   glsl_get_uniform_handle,
+   glsl_set_uniform_h,
+   glsl_set_shader_image,
+   glsl_dispatch_compute
 };
 
 static void lookup_varlocs(ALLEGRO_OGL_VARLOCS *varlocs, GLuint program)
@@ -449,6 +1033,8 @@ static void lookup_varlocs(ALLEGRO_OGL_VARLOCS *varlocs, GLuint program)
    varlocs->alpha_test_loc = glGetUniformLocation(program, ALLEGRO_SHADER_VAR_ALPHA_TEST);
    varlocs->alpha_func_loc = glGetUniformLocation(program, ALLEGRO_SHADER_VAR_ALPHA_FUNCTION);
    varlocs->alpha_test_val_loc = glGetUniformLocation(program, ALLEGRO_SHADER_VAR_ALPHA_TEST_VALUE);
+   varlocs->held_tex_loc = glGetUniformLocation(program, ALLEGRO_SHADER_VAR_HELD_TEX);
+   varlocs->tex_unit_loc = glGetAttribLocation(program, ALLEGRO_SHADER_VAR_TEX_UNIT);
 
    for (i = 0; i < _ALLEGRO_PRIM_MAX_USER_ATTR; i++) {
       /* al_user_attr_##0 */
@@ -506,9 +1092,10 @@ void _al_glsl_unuse_shaders(void)
 
 #endif
 
-/* Function: al_get_opengl_program_object
+/* Returns the program object of the shader without dropping the state
+ * shadow, unlike al_get_opengl_program_object.
  */
-GLuint al_get_opengl_program_object(ALLEGRO_SHADER *shader)
+GLuint _al_ogl_get_program_object(ALLEGRO_SHADER *shader)
 {
    ASSERT(shader);
 #ifdef ALLEGRO_CFG_SHADER_GLSL
@@ -521,5 +1108,14 @@ GLuint al_get_opengl_program_object(ALLEGRO_SHADER *shader)
 #endif
 }
 
+/* Function: al_get_opengl_program_object
+ */
+GLuint al_get_opengl_program_object(ALLEGRO_SHADER *shader)
+{
+   /* The caller is about to use the program with its own OpenGL calls. */
+   al_invalidate_opengl_state();
+   return _al_ogl_get_program_object(shader);
+}
+
 
 /* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,422 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      OpenGL background texture uploads.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_display.h"
+#include "allegro5/internal/aintern_dtor.h"
+#include "allegro5/internal/aintern_opengl.h"
+#include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_vector.h"
+
+/*
+ * A memory bitmap queued with al_queue_bitmap_upload gets an empty texture
+ * of its final size right away, which is cheap. The pixels are then copied
+ * into a pixel buffer object and transferred into that texture by a thread
+ * owning a second context in the display's share group, ending with a fence.
+ * Once the fence has signalled the bitmap adopts the texture on the user's
+ * thread, exactly as al_convert_bitmap would have done.
+ */
+#if !defined(ALLEGRO_CFG_OPENGLES)
+
+ALLEGRO_DEBUG_CHANNEL("opengl")
+
+#define get_glformat(f, c) _al_ogl_get_glformat((f), (c))
+
+
+typedef enum UPLOAD_STATE {
+   UPLOAD_QUEUED,
+   UPLOAD_RUNNING,
+   UPLOAD_ISSUED,
+   UPLOAD_FAILED
+} UPLOAD_STATE;
+
+typedef struct UPLOAD_JOB {
+   ALLEGRO_BITMAP *bitmap;  /* The memory bitmap being promoted. */
+   ALLEGRO_BITMAP *clone;   /* The video bitmap receiving its pixels. */
+   UPLOAD_STATE state;
+   GLsync fence;
+} UPLOAD_JOB;
+
+typedef struct ALLEGRO_OGL_UPLOAD_QUEUE {
+   ALLEGRO_DISPLAY *display;
+   _AL_THREAD thread;
+   _AL_MUTEX mutex;
+   _AL_COND cond;
+   _AL_VECTOR jobs;         /* UPLOAD_JOB * */
+   bool quit;
+   bool failed;
+   GLuint pbo;
+} ALLEGRO_OGL_UPLOAD_QUEUE;
+
+
+/* Runs on the upload thread. */
+static bool upload_job(ALLEGRO_OGL_UPLOAD_QUEUE *queue, UPLOAD_JOB *job)
+{
+   ALLEGRO_BITMAP *src = job->bitmap;
+   ALLEGRO_BITMAP *dst = job->clone;
+   ALLEGRO_BITMAP_EXTRA_OPENGL *ogl_bitmap = dst->extra;
+   const int format = al_get_bitmap_format(dst);
+   const int pitch = dst->w * al_get_pixel_size(format);
+   uint8_t *ptr;
+   GLenum e;
+
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, queue->pbo);
+   /* Orphan the previous upload's storage so that mapping never waits for
+    * it to be consumed.
+    */
+   glBufferData(GL_PIXEL_UNPACK_BUFFER, pitch * dst->h, NULL,
+      GL_STREAM_DRAW);
+   ptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+   if (!ptr) {
+      ALLEGRO_ERROR("glMapBuffer failed (%s).\n",
+         _al_gl_error_string(glGetError()));
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return false;
+   }
+
+   /* Textures are stored upside down. */
+   _al_convert_bitmap_data(src->memory, al_get_bitmap_format(src),
+      src->pitch, ptr + pitch * (dst->h - 1), format, -pitch,
+      0, 0, 0, 0, dst->w, dst->h);
+   glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+   glBindTexture(GL_TEXTURE_2D, ogl_bitmap->texture);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dst->w, dst->h,
+      get_glformat(format, 2), get_glformat(format, 1), NULL);
+   if (al_get_bitmap_flags(dst) & ALLEGRO_MIPMAP) {
+      glGenerateMipmapEXT(GL_TEXTURE_2D);
+   }
+   glBindTexture(GL_TEXTURE_2D, 0);
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+   e = glGetError();
+   if (e) {
+      ALLEGRO_ERROR("Uploading texture %d failed (%s).\n",
+         ogl_bitmap->texture, _al_gl_error_string(e));
+      return false;
+   }
+
+   job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   /* The fence has to reach the server before other contexts can wait on
+    * it.
+    */
+   glFlush();
+   return job->fence != NULL;
+}
+
+
+static UPLOAD_JOB *next_queued_job(ALLEGRO_OGL_UPLOAD_QUEUE *queue)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&queue->jobs); i++) {
+      UPLOAD_JOB **job = _al_vector_ref(&queue->jobs, i);
+      if ((*job)->state == UPLOAD_QUEUED)
+         return *job;
+   }
+   return NULL;
+}
+
+
+static void upload_thread_proc(_AL_THREAD *thread, void *arg)
+{
+   ALLEGRO_OGL_UPLOAD_QUEUE *queue = arg;
+   ALLEGRO_DISPLAY *display = queue->display;
+   UPLOAD_JOB *job;
+   unsigned int i;
+   bool ok;
+
+   _al_thread_set_name(thread, "al-gl-upload");
+
+   ok = display->vt->set_upload_context_current(display, true);
+
+   _al_mutex_lock(&queue->mutex);
+   if (!ok) {
+      ALLEGRO_ERROR("Could not make the upload context current.\n");
+      queue->failed = true;
+   }
+   else {
+      glGenBuffers(1, &queue->pbo);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   }
+
+   while (!queue->quit) {
+      job = queue->failed ? NULL : next_queued_job(queue);
+      if (!job) {
+         /* Fails all jobs queued after the context was lost. */
+         while ((job = next_queued_job(queue)) != NULL)
+            job->state = UPLOAD_FAILED;
+         _al_cond_broadcast(&queue->cond);
+         _al_cond_wait(&queue->cond, &queue->mutex);
+         continue;
+      }
+
+      job->state = UPLOAD_RUNNING;
+      _al_mutex_unlock(&queue->mutex);
+      ok = upload_job(queue, job);
+      _al_mutex_lock(&queue->mutex);
+      job->state = ok ? UPLOAD_ISSUED : UPLOAD_FAILED;
+      _al_cond_broadcast(&queue->cond);
+   }
+
+   if (!queue->failed) {
+      for (i = 0; i < _al_vector_size(&queue->jobs); i++) {
+         UPLOAD_JOB **job = _al_vector_ref(&queue->jobs, i);
+         if ((*job)->fence) {
+            glDeleteSync((*job)->fence);
+            (*job)->fence = NULL;
+         }
+      }
+      glDeleteBuffers(1, &queue->pbo);
+      display->vt->set_upload_context_current(display, false);
+   }
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+static ALLEGRO_OGL_UPLOAD_QUEUE *create_upload_queue(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_OGL_UPLOAD_QUEUE *queue;
+
+   if (!display->vt->create_upload_context(display)) {
+      ALLEGRO_WARN("Could not create an upload context.\n");
+      return NULL;
+   }
+
+   queue = al_calloc(1, sizeof *queue);
+   queue->display = display;
+   _al_mutex_init(&queue->mutex);
+   _al_cond_init(&queue->cond);
+   _al_vector_init(&queue->jobs, sizeof(UPLOAD_JOB *));
+   _al_thread_create(&queue->thread, upload_thread_proc, queue);
+
+   ALLEGRO_DEBUG("Started the upload thread.\n");
+   return queue;
+}
+
+
+static int find_job(ALLEGRO_OGL_UPLOAD_QUEUE *queue, ALLEGRO_BITMAP *bitmap)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&queue->jobs); i++) {
+      UPLOAD_JOB **job = _al_vector_ref(&queue->jobs, i);
+      if ((*job)->bitmap == bitmap)
+         return i;
+   }
+   return -1;
+}
+
+
+bool _al_ogl_queue_bitmap_upload(ALLEGRO_DISPLAY *display,
+   ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_OGL_EXTRAS *ogl = display->ogl_extras;
+   ALLEGRO_OGL_UPLOAD_QUEUE *queue = ogl->upload_queue;
+   ALLEGRO_BITMAP *clone;
+   UPLOAD_JOB **slot;
+   UPLOAD_JOB *job;
+   bool queued;
+
+   if (!display->vt->create_upload_context ||
+       !ogl->extension_list->ALLEGRO_GL_ARB_sync ||
+       !ogl->extension_list->ALLEGRO_GL_ARB_pixel_buffer_object) {
+      return false;
+   }
+
+   if (!queue) {
+      queue = ogl->upload_queue = create_upload_queue(display);
+      if (!queue)
+         return false;
+   }
+
+   _al_mutex_lock(&queue->mutex);
+   queued = find_job(queue, bitmap) >= 0;
+   _al_mutex_unlock(&queue->mutex);
+   if (queued)
+      return true;
+
+   /* The clone is owned by the queue until the bitmap adopts it. */
+   _al_push_destructor_owner();
+   clone = al_create_bitmap(bitmap->w, bitmap->h);
+   _al_pop_destructor_owner();
+   if (!clone)
+      return false;
+   if (!(al_get_bitmap_flags(clone) & _ALLEGRO_INTERNAL_OPENGL) ||
+         _al_pixel_format_is_compressed(al_get_bitmap_format(clone))) {
+      al_destroy_bitmap(clone);
+      return false;
+   }
+
+   job = al_calloc(1, sizeof *job);
+   job->bitmap = bitmap;
+   job->clone = clone;
+   job->state = UPLOAD_QUEUED;
+
+   _al_mutex_lock(&queue->mutex);
+   slot = _al_vector_alloc_back(&queue->jobs);
+   *slot = job;
+   bitmap->upload_display = display;
+   _al_cond_broadcast(&queue->cond);
+   _al_mutex_unlock(&queue->mutex);
+
+   return true;
+}
+
+
+bool _al_ogl_finish_bitmap_upload(ALLEGRO_DISPLAY *display,
+   ALLEGRO_BITMAP *bitmap, bool wait)
+{
+   ALLEGRO_OGL_UPLOAD_QUEUE *queue = display->ogl_extras->upload_queue;
+   UPLOAD_JOB **slot;
+   UPLOAD_JOB *job;
+   int i;
+
+   if (!queue)
+      return true;
+
+   _al_mutex_lock(&queue->mutex);
+   i = find_job(queue, bitmap);
+   if (i < 0) {
+      _al_mutex_unlock(&queue->mutex);
+      return true;
+   }
+   slot = _al_vector_ref(&queue->jobs, i);
+   job = *slot;
+
+   while (wait && job->state < UPLOAD_ISSUED)
+      _al_cond_wait(&queue->cond, &queue->mutex);
+   if (job->state < UPLOAD_ISSUED) {
+      _al_mutex_unlock(&queue->mutex);
+      return false;
+   }
+
+   if (job->state == UPLOAD_ISSUED) {
+      if (wait) {
+         /* Only the GPU has to wait, later commands are ordered after the
+          * upload.
+          */
+         glWaitSync(job->fence, 0, GL_TIMEOUT_IGNORED);
+      }
+      else {
+         GLenum r = glClientWaitSync(job->fence, 0, 0);
+         if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) {
+            _al_mutex_unlock(&queue->mutex);
+            return false;
+         }
+      }
+      glDeleteSync(job->fence);
+   }
+
+   _al_vector_delete_at(&queue->jobs, i);
+   _al_mutex_unlock(&queue->mutex);
+   bitmap->upload_display = NULL;
+
+   if (job->state == UPLOAD_ISSUED) {
+      ALLEGRO_DEBUG("Promoting memory bitmap %p to texture %d\n", bitmap,
+         ((ALLEGRO_BITMAP_EXTRA_OPENGL *)job->clone->extra)->texture);
+      _al_mark_bitmap_all_dirty(job->clone);
+      _al_adopt_bitmap(bitmap, job->clone);
+   }
+   else {
+      ALLEGRO_WARN("Upload of bitmap %p failed, converting it directly.\n",
+         bitmap);
+      al_destroy_bitmap(job->clone);
+      al_convert_bitmap(bitmap);
+   }
+   al_free(job);
+
+   return true;
+}
+
+
+/* Called when the memory bitmap of a pending job is destroyed. */
+void _al_ogl_cancel_bitmap_upload(ALLEGRO_DISPLAY *display,
+   ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_OGL_UPLOAD_QUEUE *queue = display->ogl_extras->upload_queue;
+   ALLEGRO_DISPLAY *old_display;
+   UPLOAD_JOB *job;
+   int i;
+
+   bitmap->upload_display = NULL;
+   if (!queue)
+      return;
+
+   _al_mutex_lock(&queue->mutex);
+   i = find_job(queue, bitmap);
+   if (i < 0) {
+      _al_mutex_unlock(&queue->mutex);
+      return;
+   }
+   job = *(UPLOAD_JOB **)_al_vector_ref(&queue->jobs, i);
+   /* Once the job is no longer running the thread won't touch it again. */
+   while (job->state == UPLOAD_RUNNING)
+      _al_cond_wait(&queue->cond, &queue->mutex);
+   _al_vector_delete_at(&queue->jobs, i);
+   _al_mutex_unlock(&queue->mutex);
+
+   ALLEGRO_DEBUG("Cancelled the upload of bitmap %p.\n", bitmap);
+
+   old_display = al_get_current_display();
+   if (old_display != display)
+      _al_set_current_display_only(display);
+   if (job->fence)
+      glDeleteSync(job->fence);
+   al_destroy_bitmap(job->clone);
+   if (old_display != display)
+      _al_set_current_display_only(old_display);
+   al_free(job);
+}
+
+
+void _al_ogl_destroy_upload_queue(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_OGL_UPLOAD_QUEUE *queue = display->ogl_extras->upload_queue;
+   unsigned int i;
+
+   if (!queue)
+      return;
+
+   _al_mutex_lock(&queue->mutex);
+   queue->quit = true;
+   _al_cond_broadcast(&queue->cond);
+   _al_mutex_unlock(&queue->mutex);
+   _al_thread_join(&queue->thread);
+
+   /* Pending bitmaps simply stay memory bitmaps. */
+   for (i = 0; i < _al_vector_size(&queue->jobs); i++) {
+      UPLOAD_JOB **job = _al_vector_ref(&queue->jobs, i);
+      (*job)->bitmap->upload_display = NULL;
+      al_destroy_bitmap((*job)->clone);
+      al_free(*job);
+   }
+   _al_vector_free(&queue->jobs);
+   _al_cond_destroy(&queue->cond);
+   _al_mutex_destroy(&queue->mutex);
+   display->vt->destroy_upload_context(display);
+   al_free(queue);
+   display->ogl_extras->upload_queue = NULL;
+
+   ALLEGRO_DEBUG("Stopped the upload thread.\n");
+}
+
+#endif
+
+/* vim: set sts=3 sw=3 et: */
@@ -19,19 +19,43 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_vector.h"
 #include "allegro5/internal/aintern_path.h"
 
 
-/* get_segment:
- *  Return the i'th directory component of a path.
+/* Directory components are stored one after another in a single string,
+ * each followed by a NUL so it can be handed out as a C string, along with
+ * where each of them starts. This saves allocating a string for every
+ * component, and lets al_join_paths copy all of them at once.
  */
-static ALLEGRO_USTR *get_segment(const ALLEGRO_PATH *path, unsigned i)
+
+static unsigned num_segments(const ALLEGRO_PATH *path)
+{
+   return _al_vector_size(&path->offsets);
+}
+
+
+/* segment_start:
+ *  Return where the i'th directory component starts in path->dirs.
+ */
+static int segment_start(const ALLEGRO_PATH *path, unsigned i)
+{
+   const int *start = _al_vector_ref(&path->offsets, i);
+   return *start;
+}
+
+
+/* segment_size:
+ *  Return the size of the i'th directory component in bytes.
+ */
+static int segment_size(const ALLEGRO_PATH *path, unsigned i)
 {
-   ALLEGRO_USTR **seg = _al_vector_ref(&path->segments, i);
-   return *seg;
+   int end = (i + 1 < num_segments(path)) ?
+      segment_start(path, i + 1) : (int)al_ustr_size(path->dirs);
+   return end - segment_start(path, i) - 1;
 }
 
 
@@ -40,7 +64,68 @@ static ALLEGRO_USTR *get_segment(const ALLEGRO_PATH *path, unsigned i)
  */
 static const char *get_segment_cstr(const ALLEGRO_PATH *path, unsigned i)
 {
-   return al_cstr(get_segment(path, i));
+   return al_cstr(path->dirs) + segment_start(path, i);
+}
+
+
+/* shift_segments:
+ *  Move where the directory components from the i'th on start by delta.
+ */
+static void shift_segments(ALLEGRO_PATH *path, unsigned i, int delta)
+{
+   for (; i < num_segments(path); i++) {
+      int *start = _al_vector_ref(&path->offsets, i);
+      *start += delta;
+   }
+}
+
+
+/* insert_segment:
+ *  Insert s as the i'th directory component. s may point into the path.
+ */
+static void insert_segment(ALLEGRO_PATH *path, unsigned i,
+   const ALLEGRO_USTR *s)
+{
+   ALLEGRO_USTR_INFO nul_info;
+   const ALLEGRO_USTR *nul = al_ref_buffer(&nul_info, "", 1);
+   int pos = (i < num_segments(path)) ?
+      segment_start(path, i) : (int)al_ustr_size(path->dirs);
+   int size = al_ustr_size(s);
+   int *slot;
+
+   /* s goes in first, while it is still where it was. */
+   al_ustr_insert(path->dirs, pos, s);
+   al_ustr_insert(path->dirs, pos + size, nul);
+   shift_segments(path, i, size + 1);
+
+   slot = _al_vector_alloc_mid(&path->offsets, i);
+   *slot = pos;
+   path->full_string_valid = false;
+}
+
+
+/* remove_segment:
+ *  Remove the i'th directory component.
+ */
+static void remove_segment(ALLEGRO_PATH *path, unsigned i)
+{
+   int start = segment_start(path, i);
+   int size = segment_size(path, i) + 1;
+
+   al_ustr_remove_range(path->dirs, start, start + size);
+   _al_vector_delete_at(&path->offsets, i);
+   shift_segments(path, i, -size);
+   path->full_string_valid = false;
+}
+
+
+/* segment_equals:
+ *  Return whether the i'th directory component is s.
+ */
+static bool segment_equals(const ALLEGRO_PATH *path, unsigned i,
+   const char *s)
+{
+   return strcmp(get_segment_cstr(path, i), s) == 0;
 }
 
 
@@ -80,10 +165,11 @@ static bool parse_path_string(const ALLEGRO_USTR *str, ALLEGRO_PATH *path)
 {
    ALLEGRO_USTR_INFO    dot_info;
    ALLEGRO_USTR_INFO    dotdot_info;
+   ALLEGRO_USTR_INFO    piece_info;
    const ALLEGRO_USTR *  dot = al_ref_cstr(&dot_info, ".");
    const ALLEGRO_USTR *  dotdot = al_ref_cstr(&dotdot_info, "..");
+   const ALLEGRO_USTR *  piece;
 
-   ALLEGRO_USTR *piece = al_ustr_new("");
    int pos = 0;
    bool on_windows;
 
@@ -101,9 +187,9 @@ static bool parse_path_string(const ALLEGRO_USTR *str, ALLEGRO_PATH *path)
          int slash = al_ustr_find_chr(str, 2, '/');
          if (slash == -1 || slash == 2) {
             /* Missing slash or server component is empty. */
-            goto Error;
+            return false;
          }
-         al_ustr_assign_substr(path->drive, str, pos, slash);
+         path->drive = al_ustr_dup_substr(str, pos, slash);
          // Note: The slash will be parsed again, so we end up with
          // "//server/share" and not "//servershare"!
          pos = slash;
@@ -113,7 +199,7 @@ static bool parse_path_string(const ALLEGRO_USTR *str, ALLEGRO_PATH *path)
          int colon = al_ustr_offset(str, 1);
          if (colon > -1 && al_ustr_get(str, colon) == ':') {
             /* Include the colon in the drive string. */
-            al_ustr_assign_substr(path->drive, str, 0, colon + 1);
+            path->drive = al_ustr_dup_substr(str, 0, colon + 1);
             pos = colon + 1;
          }
       }
@@ -124,9 +210,9 @@ static bool parse_path_string(const ALLEGRO_USTR *str, ALLEGRO_PATH *path)
 
       if (slash == -1) {
          /* Last component. */
-         al_ustr_assign_substr(piece, str, pos, al_ustr_size(str));
+         piece = al_ref_ustr(&piece_info, str, pos, al_ustr_size(str));
          if (al_ustr_equal(piece, dot) || al_ustr_equal(piece, dotdot)) {
-            al_append_path_component(path, al_cstr(piece));
+            insert_segment(path, num_segments(path), piece);
          }
          else {
             /* This might be an empty string, but that's okay. */
@@ -136,18 +222,12 @@ static bool parse_path_string(const ALLEGRO_USTR *str, ALLEGRO_PATH *path)
       }
 
       /* Non-last component. */
-      al_ustr_assign_substr(piece, str, pos, slash);
-      al_append_path_component(path, al_cstr(piece));
+      piece = al_ref_ustr(&piece_info, str, pos, slash);
+      insert_segment(path, num_segments(path), piece);
       pos = slash + 1;
    }
 
-   al_ustr_free(piece);
    return true;
-
-Error:
-
-   al_ustr_free(piece);
-   return false;
 }
 
 
@@ -157,21 +237,26 @@ ALLEGRO_PATH *al_create_path(const char *str)
 {
    ALLEGRO_PATH *path;
 
-   path = al_malloc(sizeof(ALLEGRO_PATH));
+   path = al_calloc(1, sizeof(ALLEGRO_PATH));
    if (!path)
       return NULL;
 
-   path->drive = al_ustr_new("");
    path->filename = al_ustr_new("");
-   _al_vector_init(&path->segments, sizeof(ALLEGRO_USTR *));
-   path->basename = al_ustr_new("");
-   path->full_string = al_ustr_new("");
+   path->dirs = al_ustr_new("");
+   _al_vector_init(&path->offsets, sizeof(int));
 
    if (str != NULL) {
-      ALLEGRO_USTR *copy = al_ustr_new(str);
-      replace_backslashes(copy);
+      ALLEGRO_USTR_INFO info;
+      const ALLEGRO_USTR *ref = al_ref_cstr(&info, str);
+      ALLEGRO_USTR *copy = NULL;
+
+      if (strchr(str, '\\')) {
+         copy = al_ustr_new(str);
+         replace_backslashes(copy);
+         ref = copy;
+      }
 
-      if (!parse_path_string(copy, path)) {
+      if (!parse_path_string(ref, path)) {
          al_destroy_path(path);
          path = NULL;
       }
@@ -189,10 +274,8 @@ ALLEGRO_PATH *al_create_path_for_directory(const char *str)
 {
    ALLEGRO_PATH *path = al_create_path(str);
    if (al_ustr_length(path->filename)) {
-      ALLEGRO_USTR *last = path->filename;
-      path->filename = al_ustr_new("");
-      al_append_path_component(path, al_cstr(last));
-      al_ustr_free(last);
+      insert_segment(path, num_segments(path), path->filename);
+      al_ustr_truncate(path->filename, 0);
    }
    return path;
 }
@@ -212,12 +295,14 @@ ALLEGRO_PATH *al_clone_path(const ALLEGRO_PATH *path)
       return NULL;
    }
 
-   al_ustr_assign(clone->drive, path->drive);
+   if (path->drive)
+      clone->drive = al_ustr_dup(path->drive);
    al_ustr_assign(clone->filename, path->filename);
+   al_ustr_assign(clone->dirs, path->dirs);
 
-   for (i = 0; i < _al_vector_size(&path->segments); i++) {
-      ALLEGRO_USTR **slot = _al_vector_alloc_back(&clone->segments);
-      (*slot) = al_ustr_dup(get_segment(path, i));
+   for (i = 0; i < num_segments(path); i++) {
+      int *slot = _al_vector_alloc_back(&clone->offsets);
+      (*slot) = segment_start(path, i);
    }
 
    return clone;
@@ -230,7 +315,7 @@ int al_get_path_num_components(const ALLEGRO_PATH *path)
 {
    ASSERT(path);
 
-   return _al_vector_size(&path->segments);
+   return num_segments(path);
 }
 
 
@@ -239,10 +324,10 @@ int al_get_path_num_components(const ALLEGRO_PATH *path)
 const char *al_get_path_component(const ALLEGRO_PATH *path, int i)
 {
    ASSERT(path);
-   ASSERT(i < (int)_al_vector_size(&path->segments));
+   ASSERT(i < (int)num_segments(path));
 
    if (i < 0)
-      i = _al_vector_size(&path->segments) + i;
+      i = num_segments(path) + i;
 
    ASSERT(i >= 0);
 
@@ -254,16 +339,26 @@ const char *al_get_path_component(const ALLEGRO_PATH *path, int i)
  */
 void al_replace_path_component(ALLEGRO_PATH *path, int i, const char *s)
 {
+   ALLEGRO_USTR_INFO info;
+   const ALLEGRO_USTR *us;
+   int start;
+   int size;
+
    ASSERT(path);
    ASSERT(s);
-   ASSERT(i < (int)_al_vector_size(&path->segments));
+   ASSERT(i < (int)num_segments(path));
 
    if (i < 0)
-      i = _al_vector_size(&path->segments) + i;
+      i = num_segments(path) + i;
 
    ASSERT(i >= 0);
 
-   al_ustr_assign_cstr(get_segment(path, i), s);
+   us = al_ref_cstr(&info, s);
+   start = segment_start(path, i);
+   size = segment_size(path, i);
+   al_ustr_replace_range(path->dirs, start, start + size, us);
+   shift_segments(path, i + 1, (int)al_ustr_size(us) - size);
+   path->full_string_valid = false;
 }
 
 
@@ -272,15 +367,14 @@ void al_replace_path_component(ALLEGRO_PATH *path, int i, const char *s)
 void al_remove_path_component(ALLEGRO_PATH *path, int i)
 {
    ASSERT(path);
-   ASSERT(i < (int)_al_vector_size(&path->segments));
+   ASSERT(i < (int)num_segments(path));
 
    if (i < 0)
-      i = _al_vector_size(&path->segments) + i;
+      i = num_segments(path) + i;
 
    ASSERT(i >= 0);
 
-   al_ustr_free(get_segment(path, i));
-   _al_vector_delete_at(&path->segments, i);
+   remove_segment(path, i);
 }
 
 
@@ -288,17 +382,16 @@ void al_remove_path_component(ALLEGRO_PATH *path, int i)
  */
 void al_insert_path_component(ALLEGRO_PATH *path, int i, const char *s)
 {
-   ALLEGRO_USTR **slot;
+   ALLEGRO_USTR_INFO info;
    ASSERT(path);
-   ASSERT(i <= (int)_al_vector_size(&path->segments));
+   ASSERT(i <= (int)num_segments(path));
 
    if (i < 0)
-      i = _al_vector_size(&path->segments) + i;
+      i = num_segments(path) + i;
 
    ASSERT(i >= 0);
 
-   slot = _al_vector_alloc_mid(&path->segments, i);
-   (*slot) = al_ustr_new(s);
+   insert_segment(path, i, al_ref_cstr(&info, s));
 }
 
 
@@ -329,16 +422,15 @@ void al_drop_path_tail(ALLEGRO_PATH *path)
  */
 void al_append_path_component(ALLEGRO_PATH *path, const char *s)
 {
-   ALLEGRO_USTR **slot = _al_vector_alloc_back(&path->segments);
-   (*slot) = al_ustr_new(s);
+   ALLEGRO_USTR_INFO info;
+   insert_segment(path, num_segments(path), al_ref_cstr(&info, s));
 }
 
 
 static bool path_is_absolute(const ALLEGRO_PATH *path)
 {
    /* If the first segment is empty, we have an absolute path. */
-   return (_al_vector_size(&path->segments) > 0)
-      && (al_ustr_size(get_segment(path, 0)) == 0);
+   return (num_segments(path) > 0) && (segment_size(path, 0) == 0);
 }
 
 
@@ -346,7 +438,9 @@ static bool path_is_absolute(const ALLEGRO_PATH *path)
  */
 bool al_join_paths(ALLEGRO_PATH *path, const ALLEGRO_PATH *tail)
 {
+   unsigned n;
    unsigned i;
+   int base;
    ASSERT(path);
    ASSERT(tail);
 
@@ -361,10 +455,17 @@ bool al_join_paths(ALLEGRO_PATH *path, const ALLEGRO_PATH *tail)
 
    al_ustr_assign(path->filename, tail->filename);
 
-   for (i = 0; i < _al_vector_size(&tail->segments); i++) {
-      al_append_path_component(path, get_segment_cstr(tail, i));
+   /* The components of the tail keep their layout, only moved to the end. */
+   n = num_segments(tail);
+   base = al_ustr_size(path->dirs);
+   for (i = 0; i < n; i++) {
+      int start = segment_start(tail, i);
+      int *slot = _al_vector_alloc_back(&path->offsets);
+      (*slot) = base + start;
    }
+   al_ustr_append(path->dirs, tail->dirs);
 
+   path->full_string_valid = false;
    return true;
 }
 
@@ -384,10 +485,14 @@ bool al_rebase_path(const ALLEGRO_PATH *head, ALLEGRO_PATH *tail)
 
    al_set_path_drive(tail, al_get_path_drive(head));
 
-   for (i = 0; i < _al_vector_size(&head->segments); i++) {
-      al_insert_path_component(tail, i, get_segment_cstr(head, i));
+   shift_segments(tail, 0, al_ustr_size(head->dirs));
+   al_ustr_insert(tail->dirs, 0, head->dirs);
+   for (i = 0; i < num_segments(head); i++) {
+      int *slot = _al_vector_alloc_mid(&tail->offsets, i);
+      (*slot) = segment_start(head, i);
    }
 
+   tail->full_string_valid = false;
    return true;
 }
 
@@ -397,10 +502,15 @@ static void path_to_ustr(const ALLEGRO_PATH *path, int32_t delim,
 {
    unsigned i;
 
-   al_ustr_assign(str, path->drive);
+   if (path->drive)
+      al_ustr_assign(str, path->drive);
+   else
+      al_ustr_truncate(str, 0);
 
-   for (i = 0; i < _al_vector_size(&path->segments); i++) {
-      al_ustr_append(str, get_segment(path, i));
+   for (i = 0; i < num_segments(path); i++) {
+      ALLEGRO_USTR_INFO info;
+      al_ustr_append(str, al_ref_buffer(&info, get_segment_cstr(path, i),
+         segment_size(path, i)));
       al_ustr_append_chr(str, delim);
    }
 
@@ -419,8 +529,19 @@ const char *al_path_cstr(const ALLEGRO_PATH *path, char delim)
  */
 const ALLEGRO_USTR *al_path_ustr(const ALLEGRO_PATH *path, char delim)
 {
-   path_to_ustr(path, delim, path->full_string);
-   return path->full_string;
+   /* The string is kept until the path changes, as it is often asked for
+    * more than once, so the path is only logically const.
+    */
+   ALLEGRO_PATH *cache = (ALLEGRO_PATH *)path;
+
+   if (!cache->full_string)
+      cache->full_string = al_ustr_new("");
+   if (!cache->full_string_valid || cache->full_delim != delim) {
+      path_to_ustr(path, delim, cache->full_string);
+      cache->full_string_valid = true;
+      cache->full_delim = delim;
+   }
+   return cache->full_string;
 }
 
 
@@ -428,36 +549,16 @@ const ALLEGRO_USTR *al_path_ustr(const ALLEGRO_PATH *path, char delim)
  */
 void al_destroy_path(ALLEGRO_PATH *path)
 {
-   unsigned i;
-
    if (!path) {
       return;
    }
 
-   if (path->drive) {
-      al_ustr_free(path->drive);
-      path->drive = NULL;
-   }
-
-   if (path->filename) {
-      al_ustr_free(path->filename);
-      path->filename = NULL;
-   }
-
-   for (i = 0; i < _al_vector_size(&path->segments); i++) {
-      al_ustr_free(get_segment(path, i));
-   }
-   _al_vector_free(&path->segments);
-
-   if (path->basename) {
-      al_ustr_free(path->basename);
-      path->basename = NULL;
-   }
-
-   if (path->full_string) {
-      al_ustr_free(path->full_string);
-      path->full_string = NULL;
-   }
+   al_ustr_free(path->drive);
+   al_ustr_free(path->filename);
+   al_ustr_free(path->dirs);
+   _al_vector_free(&path->offsets);
+   al_ustr_free(path->basename);
+   al_ustr_free(path->full_string);
 
    al_free(path);
 }
@@ -469,10 +570,16 @@ void al_set_path_drive(ALLEGRO_PATH *path, const char *drive)
 {
    ASSERT(path);
 
-   if (drive)
-      al_ustr_assign_cstr(path->drive, drive);
-   else
+   if (drive && drive[0]) {
+      if (path->drive)
+         al_ustr_assign_cstr(path->drive, drive);
+      else
+         path->drive = al_ustr_new(drive);
+   }
+   else if (path->drive) {
       al_ustr_truncate(path->drive, 0);
+   }
+   path->full_string_valid = false;
 }
 
 
@@ -482,7 +589,7 @@ const char *al_get_path_drive(const ALLEGRO_PATH *path)
 {
    ASSERT(path);
 
-   return al_cstr(path->drive);
+   return path->drive ? al_cstr(path->drive) : "";
 }
 
 
@@ -496,6 +603,7 @@ void al_set_path_filename(ALLEGRO_PATH *path, const char *filename)
       al_ustr_assign_cstr(path->filename, filename);
    else
       al_ustr_truncate(path->filename, 0);
+   path->full_string_valid = false;
 }
 
 
@@ -540,6 +648,7 @@ bool al_set_path_extension(ALLEGRO_PATH *path, char const *extension)
       al_ustr_truncate(path->filename, dot);
    }
    al_ustr_append_cstr(path->filename, extension);
+   path->full_string_valid = false;
    return true;
 }
 
@@ -553,7 +662,10 @@ const char *al_get_path_basename(const ALLEGRO_PATH *path)
 
    dot = al_ustr_rfind_chr(path->filename, al_ustr_size(path->filename), '.');
    if (dot >= 0) {
-      al_ustr_assign_substr(path->basename, path->filename, 0, dot);
+      ALLEGRO_PATH *cache = (ALLEGRO_PATH *)path;
+      if (!cache->basename)
+         cache->basename = al_ustr_new("");
+      al_ustr_assign_substr(cache->basename, path->filename, 0, dot);
       return al_cstr(path->basename);
    }
 
@@ -568,21 +680,17 @@ bool al_make_path_canonical(ALLEGRO_PATH *path)
    unsigned i;
    ASSERT(path);
 
-   for (i = 0; i < _al_vector_size(&path->segments); ) {
-      if (strcmp(get_segment_cstr(path, i), ".") == 0)
-         al_remove_path_component(path, i);
+   for (i = 0; i < num_segments(path); ) {
+      if (segment_equals(path, i, "."))
+         remove_segment(path, i);
       else
          i++;
    }
 
    /* Remove leading '..'s on absolute paths. */
-   if (_al_vector_size(&path->segments) >= 1 &&
-      al_ustr_size(get_segment(path, 0)) == 0)
-   {
-      while (_al_vector_size(&path->segments) >= 2 &&
-         strcmp(get_segment_cstr(path, 1), "..") == 0)
-      {
-         al_remove_path_component(path, 1);
+   if (path_is_absolute(path)) {
+      while (num_segments(path) >= 2 && segment_equals(path, 1, "..")) {
+         remove_segment(path, 1);
       }
    }
 
@@ -56,6 +56,8 @@ static int pixel_sizes[] = {
    0,
    0,
    0,
+   0,
+   0,
 };
 
 static int pixel_bits[] = {
@@ -90,6 +92,8 @@ static int pixel_bits[] = {
    0,
    0,
    0,
+   0,
+   0,
 };
 
 static int pixel_block_widths[] = {
@@ -123,6 +127,7 @@ static int pixel_block_widths[] = {
    1, /* ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8 */
    4,
    4,
+   4,   4,
    4,
 };
 
@@ -157,6 +162,7 @@ static int pixel_block_heights[] = {
    1, /* ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8 */
    4,
    4,
+   4,   4,
    4,
 };
 
@@ -192,6 +198,8 @@ static int pixel_block_sizes[] = {
    8,
    16,
    16,
+   8,
+   16,
 };
 
 static bool format_alpha_table[ALLEGRO_NUM_PIXEL_FORMATS] = {
@@ -225,7 +233,8 @@ static bool format_alpha_table[ALLEGRO_NUM_PIXEL_FORMATS] = {
    false, /* ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8 */
    true,
    true,
-   true,
+   true,   false,
+   false,
 };
 
 static char const *pixel_format_names[ALLEGRO_NUM_PIXEL_FORMATS + 1] = {
@@ -260,6 +269,8 @@ static char const *pixel_format_names[ALLEGRO_NUM_PIXEL_FORMATS + 1] = {
    "RGBA_DXT1",
    "RGBA_DXT3",
    "RGBA_DXT5",
+   "RED_RGTC1",
+   "RG_RGTC2",
    "INVALID"
 };
 
@@ -296,6 +307,8 @@ static bool format_is_real[ALLEGRO_NUM_PIXEL_FORMATS] =
    true,
    true,
    true,
+   true,
+   true,
 };
 
 static bool format_is_video_only[ALLEGRO_NUM_PIXEL_FORMATS] =
@@ -330,6 +343,7 @@ static bool format_is_video_only[ALLEGRO_NUM_PIXEL_FORMATS] =
    false, /* ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8 */
    true,
    true,
+   true,   true,
    true,
 };
 
@@ -365,6 +379,7 @@ static bool format_is_compressed[ALLEGRO_NUM_PIXEL_FORMATS] =
    false, /* ALLEGRO_PIXEL_FORMAT_SINGLE_CHANNEL_8 */
    true,
    true,
+   true,   true,
    true,
 };
 
@@ -440,6 +455,49 @@ bool _al_pixel_format_is_compressed(int format)
 }
 
 
+/* If each pixel of format is four bytes of 8-bit channels, stores the byte
+ * offsets of red, green, blue and alpha (or the unused byte) within a pixel
+ * in offsets and returns true. Loaders use this to write pixels in the
+ * format of the bitmap, so unlocking it needs no conversion.
+ */
+bool _al_get_pixel_format_byte_offsets(int format, int offsets[4])
+{
+   /* Bit positions of red, green, blue and alpha in a 32-bit pixel. */
+   int shifts[4];
+   int i;
+
+   switch (format) {
+      case ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE:
+         for (i = 0; i < 4; i++)
+            offsets[i] = i;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_ARGB_8888:
+      case ALLEGRO_PIXEL_FORMAT_XRGB_8888:
+         shifts[0] = 16; shifts[1] = 8; shifts[2] = 0; shifts[3] = 24;
+         break;
+      case ALLEGRO_PIXEL_FORMAT_ABGR_8888:
+      case ALLEGRO_PIXEL_FORMAT_XBGR_8888:
+         shifts[0] = 0; shifts[1] = 8; shifts[2] = 16; shifts[3] = 24;
+         break;
+      case ALLEGRO_PIXEL_FORMAT_RGBA_8888:
+      case ALLEGRO_PIXEL_FORMAT_RGBX_8888:
+         shifts[0] = 24; shifts[1] = 16; shifts[2] = 8; shifts[3] = 0;
+         break;
+      default:
+         return false;
+   }
+
+   for (i = 0; i < 4; i++) {
+#ifdef ALLEGRO_BIG_ENDIAN
+      offsets[i] = 3 - shifts[i] / 8;
+#else
+      offsets[i] = shifts[i] / 8;
+#endif
+   }
+   return true;
+}
+
+
 /* We use al_get_display_format() as a hint for the preferred RGB ordering when
  * nothing else is specified.
  */
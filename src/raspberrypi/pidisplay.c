@@ -2,6 +2,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_opengl.h"
 #include "allegro5/internal/aintern_vector.h"
 #include "allegro5/internal/aintern_raspberrypi.h"
@@ -396,6 +397,27 @@ static bool pi_create_display(ALLEGRO_DISPLAY *display)
    return true;
 }
 
+/* The dispmanx element is stretched over the whole screen by the hardware
+ * scaler anyway, so rendering to a smaller surface saves fill rate without
+ * costing any GPU time for the scaling.
+ */
+static void apply_render_scale(ALLEGRO_DISPLAY *display)
+{
+   const char *value = al_get_config_value(al_get_system_config(),
+      "raspberrypi", "render_scale");
+   double scale;
+
+   if (!value)
+      return;
+
+   scale = atof(value);
+   if (scale <= 0.0 || scale >= 1.0)
+      return;
+
+   display->w = _ALLEGRO_MAX(1, (int)(display->w * scale + 0.5));
+   display->h = _ALLEGRO_MAX(1, (int)(display->h * scale + 0.5));
+}
+
 static ALLEGRO_DISPLAY *raspberrypi_create_display(int w, int h)
 {
     ALLEGRO_DISPLAY_RASPBERRYPI *d = al_calloc(1, sizeof *d);
@@ -419,6 +441,7 @@ static ALLEGRO_DISPLAY *raspberrypi_create_display(int w, int h)
 
    display->w = w;
    display->h = h;
+   apply_render_scale(display);
 
    display->flags |= ALLEGRO_OPENGL;
 #ifdef ALLEGRO_CFG_OPENGLES2
@@ -488,6 +511,9 @@ static ALLEGRO_DISPLAY *raspberrypi_create_display(int w, int h)
    display->extra_settings.settings[ALLEGRO_OPENGL_MAJOR_VERSION] = (v >> 24) & 0xFF;
    display->extra_settings.settings[ALLEGRO_OPENGL_MINOR_VERSION] = (v >> 16) & 0xFF;
 
+   display->extra_settings.settings[ALLEGRO_UPDATE_DISPLAY_REGION] =
+      _al_egl_have_swap_with_damage(egl_display);
+
    return display;
 }
 
@@ -648,11 +674,21 @@ static void raspberrypi_flip_display(ALLEGRO_DISPLAY *disp)
 static void raspberrypi_update_display_region(ALLEGRO_DISPLAY *d, int x, int y,
                                        int w, int h)
 {
-    (void)x;
-    (void)y;
-    (void)w;
-    (void)h;
-    raspberrypi_flip_display(d);
+   if (!_al_egl_swap_buffers_with_damage(egl_display, egl_window,
+         d->w, d->h, x, y, w, h)) {
+      raspberrypi_flip_display(d);
+      return;
+   }
+
+   if (cursor_added) {
+      show_cursor((ALLEGRO_DISPLAY_RASPBERRYPI *)d);
+   }
+}
+
+static int raspberrypi_get_buffer_age(ALLEGRO_DISPLAY *d)
+{
+   (void)d;
+   return _al_egl_get_buffer_age(egl_display, egl_window);
 }
 
 static bool raspberrypi_acknowledge_resize(ALLEGRO_DISPLAY *d)
@@ -724,6 +760,7 @@ ALLEGRO_DISPLAY_INTERFACE *_al_get_raspberrypi_display_interface(void)
     vt->set_current_display = raspberrypi_set_current_display;
     vt->flip_display = raspberrypi_flip_display;
     vt->update_display_region = raspberrypi_update_display_region;
+    vt->get_buffer_age = raspberrypi_get_buffer_age;
     vt->acknowledge_resize = raspberrypi_acknowledge_resize;
     vt->create_bitmap = _al_ogl_create_bitmap;
     vt->get_backbuffer = _al_ogl_get_backbuffer;
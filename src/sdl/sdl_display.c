@@ -398,8 +398,9 @@ static void recreate_textures(ALLEGRO_DISPLAY *display)
       if (bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE)
          continue;
       _al_ogl_upload_bitmap_memory(bitmap, _al_get_bitmap_memory_format(
-         bitmap), bitmap->memory);
+         bitmap), bitmap->restore ? NULL : bitmap->memory);
    }
+   _al_restore_display_bitmaps(display);
 }
 
 static bool sdl_acknowledge_resize(ALLEGRO_DISPLAY *display)
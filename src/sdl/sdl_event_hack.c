@@ -21,6 +21,8 @@
 
 /* This is a thread which wakes up event queues from time to time (with fake
  * timer events) to prevent a deadlock in an unbound al_wait_for_event.
+ * Elsewhere al_wait_for_event waits in SDL itself (sdl_wait_for_events), so
+ * this is only needed on emscripten, which cannot block in SDL.
  */
 
 static ALLEGRO_THREAD *thread;
@@ -64,7 +66,8 @@ static void _uninstall_sdl_event_hack(void)
 
 void _al_sdl_event_hack(void)
 {
-   if (thread)
+   ALLEGRO_SYSTEM *system = al_get_system_driver();
+   if (thread || system->vt->wait_for_events)
       return;
    _al_add_exit_func(_uninstall_sdl_event_hack, "uninstall_sdl_event_hack");
    thread = al_create_thread(wakeup_thread, NULL);
@@ -126,6 +126,11 @@ static void sdl_heartbeat(void)
                      _al_sdl_display_event(&events[i]);
                      break;
                }
+               break;
+            default:
+               if (s->wake_event && events[i].type == s->wake_event)
+                  SDL_AtomicSet(&s->wake_pending, 0);
+               break;
          }
       }
    }
@@ -138,6 +143,55 @@ static void sdl_heartbeat(void)
    al_unlock_mutex(s->mutex);
 }
 
+#ifndef __EMSCRIPTEN__
+/* Instead of polling on every heartbeat, a thread waiting for an empty
+ * event queue sleeps in SDL until there is input, which is then dispatched
+ * right away. Events pushed into the queue from other threads, e.g. by
+ * timers, interrupt the wait through sdl_wake_event_wait.
+ */
+static bool sdl_wait_for_events(ALLEGRO_TIMEOUT *timeout, bool *timed_out)
+{
+   ALLEGRO_SYSTEM_SDL *s = (void *)al_get_system_driver();
+   ALLEGRO_TIMEOUT_SDL *timeout_sdl = (void *)timeout;
+
+   if (!s->wake_event || SDL_ThreadID() != s->event_thread)
+      return false;
+
+   if (!timeout_sdl) {
+      SDL_WaitEvent(NULL);
+   }
+   else {
+      double left = timeout_sdl->deadline - _al_sdl_get_time();
+      if (left > 3600)
+         SDL_WaitEventTimeout(NULL, 3600 * 1000);
+      else if (left > 0)
+         SDL_WaitEventTimeout(NULL, (int)(left * 1000) + 1);
+      if (_al_sdl_get_time() >= timeout_sdl->deadline)
+         *timed_out = true;
+   }
+
+   sdl_heartbeat();
+   return true;
+}
+
+static void sdl_wake_event_wait(void)
+{
+   ALLEGRO_SYSTEM_SDL *s = (void *)al_get_system_driver();
+   SDL_Event event;
+
+   /* The event thread cannot be waiting if it is the one emitting. */
+   if (!s->wake_event || SDL_ThreadID() == s->event_thread)
+      return;
+   if (!SDL_AtomicCAS(&s->wake_pending, 0, 1))
+      return;
+
+   SDL_zero(event);
+   event.type = s->wake_event;
+   if (SDL_PushEvent(&event) != 1)
+      SDL_AtomicSet(&s->wake_pending, 0);
+}
+#endif
+
 static ALLEGRO_SYSTEM *sdl_initialize(int flags)
 {
    (void)flags;
@@ -171,6 +225,15 @@ static void sdl_heartbeat_init(void)
     */
    s->mutex = al_create_mutex();
 
+   /* Only the thread which initialised SDL may pump its events, so that is
+    * the one thread which can wait for them in sdl_wait_for_events.
+    */
+   s->event_thread = SDL_ThreadID();
+   s->wake_event = SDL_RegisterEvents(1);
+   if (s->wake_event == (Uint32)-1)
+      s->wake_event = 0;
+   SDL_AtomicSet(&s->wake_pending, 0);
+
 #ifdef __EMSCRIPTEN__
    s->timer_time = al_get_time();
 #endif
@@ -436,6 +499,10 @@ ALLEGRO_SYSTEM_INTERFACE *_al_sdl_system_driver(void)
    vt->get_time = _al_sdl_get_time;
    vt->rest = _al_sdl_rest;
    vt->init_timeout = _al_sdl_init_timeout;
+#ifndef __EMSCRIPTEN__
+   vt->wait_for_events = sdl_wait_for_events;
+   vt->wake_event_wait = sdl_wake_event_wait;
+#endif
 
    return vt;
 }
@@ -75,6 +75,55 @@ void _al_thread_detach(_AL_THREAD *thread)
    SDL_DetachThread(thread->thread);
 }
 
+bool _al_thread_set_priority(_AL_THREAD *thread, int priority)
+{
+   SDL_ThreadPriority p;
+
+   ASSERT(thread);
+
+   /* SDL can only change the priority of the calling thread. */
+   if (SDL_ThreadID() != SDL_GetThreadID(thread->thread))
+      return false;
+
+   switch (priority) {
+      case ALLEGRO_THREAD_PRIORITY_LOW:
+         p = SDL_THREAD_PRIORITY_LOW;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_NORMAL:
+         p = SDL_THREAD_PRIORITY_NORMAL;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_HIGH:
+         p = SDL_THREAD_PRIORITY_HIGH;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_REALTIME:
+#if SDL_VERSION_ATLEAST(2,0,9)
+         p = SDL_THREAD_PRIORITY_TIME_CRITICAL;
+#else
+         p = SDL_THREAD_PRIORITY_HIGH;
+#endif
+         break;
+      default:
+         return false;
+   }
+
+   return SDL_SetThreadPriority(p) == 0;
+}
+
+bool _al_thread_set_affinity(_AL_THREAD *thread, uint64_t cpu_mask)
+{
+   (void)thread;
+   (void)cpu_mask;
+   return false;
+}
+
+bool _al_thread_set_name(_AL_THREAD *thread, const char *name)
+{
+   /* SDL only names threads when creating them. */
+   (void)thread;
+   (void)name;
+   return false;
+}
+
 /* mutexes */
 
 void _al_mutex_init(_AL_MUTEX *mutex)
@@ -89,6 +138,12 @@ void _al_mutex_init_recursive(_AL_MUTEX *mutex)
    _al_mutex_init(mutex);
 }
 
+void _al_mutex_init_adaptive(_AL_MUTEX *mutex)
+{
+   _al_mutex_init(mutex);
+}
+
+
 void _al_mutex_destroy(_AL_MUTEX *mutex)
 {
    ASSERT(mutex);
@@ -99,6 +154,26 @@ void _al_mutex_destroy(_AL_MUTEX *mutex)
    }
 }
 
+
+
+void _al_rwlock_init(_AL_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   rwlock->mutex = SDL_CreateMutex();
+}
+
+
+void _al_rwlock_destroy(_AL_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   if (rwlock->mutex) {
+      SDL_DestroyMutex(rwlock->mutex);
+      rwlock->mutex = NULL;
+   }
+}
+
 /* condition variables */
 /* most of the condition variable implementation is actually inline */
 
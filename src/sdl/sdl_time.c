@@ -38,6 +38,7 @@ void _al_sdl_init_timeout(ALLEGRO_TIMEOUT *timeout, double seconds)
 {
    ALLEGRO_TIMEOUT_SDL *timeout_sdl = (void *)timeout;
    timeout_sdl->ms = seconds * 1000;
+   timeout_sdl->deadline = _al_sdl_get_time() + seconds;
 }
 
 /* vim: set sts=3 sw=3 et */
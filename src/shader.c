@@ -14,6 +14,7 @@
  */
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_dtor.h"
@@ -409,6 +410,118 @@ bool al_set_shader_bool(const char *name, bool b)
    }
 }
 
+/* Function: al_get_shader_uniform_handle
+ */
+int al_get_shader_uniform_handle(ALLEGRO_SHADER *shader, const char *name)
+{
+   ASSERT(shader);
+   ASSERT(name);
+
+   if (!shader->vt->get_uniform_handle)
+      return -1;
+   return shader->vt->get_uniform_handle(shader, name);
+}
+
+static bool set_uniform_h(int handle, int type, int num_components,
+   const void *data, int num_elems)
+{
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_SHADER *shader;
+
+   if ((bmp = al_get_target_bitmap()) == NULL)
+      return false;
+   if ((shader = bmp->shader) == NULL || !shader->vt->set_uniform_h)
+      return false;
+   return shader->vt->set_uniform_h(shader, handle, type, num_components,
+      data, num_elems);
+}
+
+/* Function: al_set_shader_matrix_h
+ */
+bool al_set_shader_matrix_h(int handle, const ALLEGRO_TRANSFORM *matrix)
+{
+   ASSERT(matrix);
+   return set_uniform_h(handle, _ALLEGRO_UNIFORM_MATRIX, 16, matrix->m, 1);
+}
+
+/* Function: al_set_shader_int_h
+ */
+bool al_set_shader_int_h(int handle, int i)
+{
+   return set_uniform_h(handle, _ALLEGRO_UNIFORM_INT, 1, &i, 1);
+}
+
+/* Function: al_set_shader_float_h
+ */
+bool al_set_shader_float_h(int handle, float f)
+{
+   return set_uniform_h(handle, _ALLEGRO_UNIFORM_FLOAT, 1, &f, 1);
+}
+
+/* Function: al_set_shader_int_vector_h
+ */
+bool al_set_shader_int_vector_h(int handle, int num_components,
+   const int *i, int num_elems)
+{
+   return set_uniform_h(handle, _ALLEGRO_UNIFORM_INT, num_components, i,
+      num_elems);
+}
+
+/* Function: al_set_shader_float_vector_h
+ */
+bool al_set_shader_float_vector_h(int handle, int num_components,
+   const float *f, int num_elems)
+{
+   return set_uniform_h(handle, _ALLEGRO_UNIFORM_FLOAT, num_components, f,
+      num_elems);
+}
+
+/* Function: al_set_shader_bool_h
+ */
+bool al_set_shader_bool_h(int handle, bool b)
+{
+   int i = b;
+   return set_uniform_h(handle, _ALLEGRO_UNIFORM_INT, 1, &i, 1);
+}
+
+/* Function: al_set_shader_image
+ */
+bool al_set_shader_image(const char *name, ALLEGRO_BITMAP *bitmap, int unit)
+{
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_SHADER *shader;
+
+   if ((bmp = al_get_target_bitmap()) == NULL)
+      return false;
+   if ((shader = bmp->shader) == NULL || !shader->vt->set_shader_image)
+      return false;
+   return shader->vt->set_shader_image(shader, name, bitmap, unit);
+}
+
+/* Function: al_dispatch_compute
+ */
+bool al_dispatch_compute(int groups_x, int groups_y, int groups_z)
+{
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_SHADER *shader;
+   ALLEGRO_DISPLAY *disp;
+
+   if ((bmp = al_get_target_bitmap()) == NULL)
+      return false;
+   if ((shader = bmp->shader) == NULL || !shader->vt->dispatch_compute)
+      return false;
+   if (groups_x <= 0 || groups_y <= 0 || groups_z <= 0)
+      return false;
+   disp = _al_get_bitmap_display(bmp);
+   ASSERT(disp);
+
+   /* Held drawing comes before the dispatch, which may read what it draws. */
+   _al_flush_vertex_cache(disp, ALLEGRO_DISPLAY_STAT_OTHER_FLUSHES);
+
+   return shader->vt->dispatch_compute(shader, disp, groups_x, groups_y,
+      groups_z);
+}
+
 /* Function: al_get_default_shader_source
  */
 char const *al_get_default_shader_source(ALLEGRO_SHADER_PLATFORM platform,
@@ -423,6 +536,8 @@ char const *al_get_default_shader_source(ALLEGRO_SHADER_PLATFORM platform,
                return default_glsl_vertex_source;
             case ALLEGRO_PIXEL_SHADER:
                return default_glsl_pixel_source;
+            default:
+               break;
          }
 #endif
          break;
@@ -433,6 +548,8 @@ char const *al_get_default_shader_source(ALLEGRO_SHADER_PLATFORM platform,
                return default_glsl_vertex_source;
             case ALLEGRO_PIXEL_SHADER:
                return default_glsl_minimal_pixel_source;
+            default:
+               break;
          }
 #endif
          break;
@@ -445,6 +562,8 @@ char const *al_get_default_shader_source(ALLEGRO_SHADER_PLATFORM platform,
                return default_hlsl_vertex_source;
             case ALLEGRO_PIXEL_SHADER:
                return default_hlsl_pixel_source;
+            default:
+               break;
          }
 #endif
          break;
@@ -490,6 +609,36 @@ void _al_unregister_shader_bitmap(ALLEGRO_SHADER *shader, ALLEGRO_BITMAP *bmp)
    ASSERT(deleted);
 }
 
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+/* Completes the default pixel shader for ALLEGRO_HELD_BITMAP_TEXTURES with
+ * a sampler array of the given size. GLSL before 4.0 does not allow indexing
+ * sampler arrays with a variable, so the function is unrolled.
+ */
+static ALLEGRO_USTR *create_held_pixel_source(ALLEGRO_SHADER_PLATFORM platform,
+   int num_textures)
+{
+   ALLEGRO_USTR *source;
+   int i;
+
+   if (platform == ALLEGRO_SHADER_GLSL_MINIMAL)
+      source = al_ustr_new(default_glsl_held_minimal_pixel_source);
+   else
+      source = al_ustr_new(default_glsl_held_pixel_source);
+
+   al_ustr_appendf(source, "\nuniform sampler2D " ALLEGRO_SHADER_VAR_HELD_TEX
+      "[%d];\n", num_textures);
+   al_ustr_append_cstr(source, "\nvec4 held_texture(float unit, vec2 uv)\n{\n");
+   for (i = 0; i < num_textures - 1; i++) {
+      al_ustr_appendf(source, "  if (unit < %d.5) return texture2D("
+         ALLEGRO_SHADER_VAR_HELD_TEX "[%d], uv);\n", i, i);
+   }
+   al_ustr_appendf(source, "  return texture2D(" ALLEGRO_SHADER_VAR_HELD_TEX
+      "[%d], uv);\n}\n", i);
+
+   return source;
+}
+#endif
+
 ALLEGRO_SHADER *_al_create_default_shader(ALLEGRO_DISPLAY *display)
 {
    ALLEGRO_SHADER *shader;
@@ -497,6 +646,11 @@ ALLEGRO_SHADER *_al_create_default_shader(ALLEGRO_DISPLAY *display)
       display,
       display->extra_settings.settings[ALLEGRO_DEFAULT_SHADER_PLATFORM]
    );
+   int num_held_textures =
+      display->extra_settings.settings[ALLEGRO_HELD_BITMAP_TEXTURES];
+   const char *vertex_source;
+   const char *pixel_source;
+   ALLEGRO_USTR *held_pixel_source = NULL;
 
    _al_push_destructor_owner();
    shader = al_create_shader(platform);
@@ -506,14 +660,28 @@ ALLEGRO_SHADER *_al_create_default_shader(ALLEGRO_DISPLAY *display)
       ALLEGRO_ERROR("Error creating default shader.\n");
       return false;
    }
-   if (!al_attach_shader_source(shader, ALLEGRO_VERTEX_SHADER,
-         al_get_default_shader_source(platform, ALLEGRO_VERTEX_SHADER))) {
+
+   vertex_source = al_get_default_shader_source(platform, ALLEGRO_VERTEX_SHADER);
+   pixel_source = al_get_default_shader_source(platform, ALLEGRO_PIXEL_SHADER);
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+   if (num_held_textures > 1 && (platform == ALLEGRO_SHADER_GLSL ||
+         platform == ALLEGRO_SHADER_GLSL_MINIMAL)) {
+      num_held_textures = _ALLEGRO_MIN(num_held_textures,
+         _ALLEGRO_MAX_HELD_TEXTURES);
+      held_pixel_source = create_held_pixel_source(platform, num_held_textures);
+      vertex_source = default_glsl_held_vertex_source;
+      pixel_source = al_cstr(held_pixel_source);
+   }
+#else
+   (void)num_held_textures;
+#endif
+
+   if (!al_attach_shader_source(shader, ALLEGRO_VERTEX_SHADER, vertex_source)) {
       ALLEGRO_ERROR("al_attach_shader_source for vertex shader failed: %s\n",
          al_get_shader_log(shader));
       goto fail;
    }
-   if (!al_attach_shader_source(shader, ALLEGRO_PIXEL_SHADER,
-         al_get_default_shader_source(platform, ALLEGRO_PIXEL_SHADER))) {
+   if (!al_attach_shader_source(shader, ALLEGRO_PIXEL_SHADER, pixel_source)) {
       ALLEGRO_ERROR("al_attach_shader_source for pixel shader failed: %s\n",
          al_get_shader_log(shader));
       goto fail;
@@ -522,11 +690,52 @@ ALLEGRO_SHADER *_al_create_default_shader(ALLEGRO_DISPLAY *display)
       ALLEGRO_ERROR("al_build_shader failed: %s\n", al_get_shader_log(shader));
       goto fail;
    }
+   al_ustr_free(held_pixel_source);
    return shader;
 
 fail:
+   al_ustr_free(held_pixel_source);
    al_destroy_shader(shader);
    return NULL;
 }
 
+ALLEGRO_SHADER *_al_create_instance_shader(ALLEGRO_DISPLAY *display)
+{
+#ifdef ALLEGRO_CFG_SHADER_GLSL
+   ALLEGRO_SHADER *shader;
+   ALLEGRO_SHADER_PLATFORM platform = resolve_platform(
+      display,
+      display->extra_settings.settings[ALLEGRO_DEFAULT_SHADER_PLATFORM]
+   );
+   const char *pixel_source;
+
+   if (platform != ALLEGRO_SHADER_GLSL && platform != ALLEGRO_SHADER_GLSL_MINIMAL)
+      return NULL;
+
+   _al_push_destructor_owner();
+   shader = al_create_shader(platform);
+   _al_pop_destructor_owner();
+
+   if (!shader) {
+      ALLEGRO_ERROR("Error creating instance shader.\n");
+      return NULL;
+   }
+
+   pixel_source = al_get_default_shader_source(platform, ALLEGRO_PIXEL_SHADER);
+   if (!al_attach_shader_source(shader, ALLEGRO_VERTEX_SHADER,
+         default_glsl_instance_vertex_source) ||
+         !al_attach_shader_source(shader, ALLEGRO_PIXEL_SHADER, pixel_source) ||
+         !al_build_shader(shader)) {
+      ALLEGRO_ERROR("Building instance shader failed: %s\n",
+         al_get_shader_log(shader));
+      al_destroy_shader(shader);
+      return NULL;
+   }
+   return shader;
+#else
+   (void)display;
+   return NULL;
+#endif
+}
+
 /* vim: set sts=3 sw=3 et: */
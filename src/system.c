@@ -20,7 +20,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
-#ifdef ALLEGRO_CFG_SHADER_GLSL
+#ifdef ALLEGRO_CFG_OPENGL
 #include "allegro5/allegro_opengl.h"
 #include "allegro5/internal/aintern_opengl.h"
 #endif
@@ -29,6 +29,9 @@
 #include "allegro5/internal/aintern_debug.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_file.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_memblit.h"
 #include "allegro5/internal/aintern_pixels.h"
 #include "allegro5/internal/aintern_system.h"
 #include "allegro5/internal/aintern_thread.h"
@@ -284,8 +287,26 @@ bool al_install_system(int version, int (*atexit_ptr)(void (*)(void)))
    
    _al_init_convert_bitmap_list();
 
+   _al_init_convert_simd();
+
+   _al_init_memblit_spans();
+
    _al_init_timers();
 
+   _al_init_display_modes();
+
+   _al_init_monitors();
+
+   _al_init_jobs();
+
+   _al_init_file_async();
+
+   _al_init_packs();
+
+#ifdef ALLEGRO_CFG_OPENGL
+   _al_ogl_init_extensions();
+#endif
+
 #ifdef ALLEGRO_CFG_SHADER_GLSL
    _al_glsl_init_shaders();
 #endif
@@ -329,6 +350,10 @@ void al_uninstall_system(void)
    _al_glsl_shutdown_shaders();
 #endif
 
+#ifdef ALLEGRO_CFG_OPENGL
+   _al_ogl_shutdown_extensions();
+#endif
+
    _al_shutdown_logging();
 
    /* shutdown_system_driver is registered as an exit func so we don't need
@@ -18,6 +18,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_thread.h"
 #include "allegro5/internal/aintern_system.h"
 
@@ -42,6 +43,7 @@ struct ALLEGRO_THREAD {
    void *proc;
    void *arg;
    void *retval;
+   char name[16];
 };
 
 
@@ -55,11 +57,15 @@ struct ALLEGRO_COND {
 };
 
 
+struct ALLEGRO_RWLOCK {
+   _AL_RWLOCK rwlock;
+};
+
+
 static void thread_func_trampoline(_AL_THREAD *inner, void *_outer)
 {
    ALLEGRO_THREAD *outer = (ALLEGRO_THREAD *) _outer;
    ALLEGRO_SYSTEM *system = al_get_system_driver();
-   (void)inner;
 
    if (system && system->vt && system->vt->thread_init) {
       system->vt->thread_init(outer);
@@ -72,6 +78,9 @@ static void thread_func_trampoline(_AL_THREAD *inner, void *_outer)
    while (outer->thread_state == THREAD_STATE_CREATED) {
       _al_cond_wait(&outer->cond, &outer->mutex);
    }
+   /* Some platforms only let a thread name itself. */
+   if (outer->name[0])
+      _al_thread_set_name(inner, outer->name);
    _al_mutex_unlock(&outer->mutex);
 
    if (outer->thread_state == THREAD_STATE_STARTING) {
@@ -106,6 +115,7 @@ static ALLEGRO_THREAD *create_thread(void)
    }
    _AL_MARK_MUTEX_UNINITED(outer->mutex); /* required */
    outer->retval = NULL;
+   outer->name[0] = '\0';
    return outer;
 }
 
@@ -291,6 +301,60 @@ void al_destroy_thread(ALLEGRO_THREAD *thread)
 }
 
 
+static bool is_running(ALLEGRO_THREAD *thread)
+{
+   return thread->thread_state == THREAD_STATE_CREATED ||
+      thread->thread_state == THREAD_STATE_STARTING ||
+      thread->thread_state == THREAD_STATE_STARTED;
+}
+
+
+/* Function: al_set_thread_priority
+ */
+bool al_set_thread_priority(ALLEGRO_THREAD *thread,
+   ALLEGRO_THREAD_PRIORITY priority)
+{
+   ASSERT(thread);
+   ASSERT(is_running(thread));
+
+   return _al_thread_set_priority(&thread->thread, priority);
+}
+
+
+/* Function: al_set_thread_affinity
+ */
+bool al_set_thread_affinity(ALLEGRO_THREAD *thread, uint64_t cpu_mask)
+{
+   ASSERT(thread);
+   ASSERT(is_running(thread));
+
+   if (cpu_mask == 0)
+      return false;
+   return _al_thread_set_affinity(&thread->thread, cpu_mask);
+}
+
+
+/* Function: al_set_thread_name
+ */
+bool al_set_thread_name(ALLEGRO_THREAD *thread, const char *name)
+{
+   bool ret = true;
+
+   ASSERT(thread);
+   ASSERT(name);
+   ASSERT(is_running(thread));
+
+   /* Until it is started, the thread names itself when it is. */
+   _al_mutex_lock(&thread->mutex);
+   _al_sane_strncpy(thread->name, name, sizeof(thread->name));
+   if (thread->thread_state != THREAD_STATE_CREATED)
+      ret = _al_thread_set_name(&thread->thread, thread->name);
+   _al_mutex_unlock(&thread->mutex);
+
+   return ret;
+}
+
+
 /* Function: al_create_mutex
  */
 ALLEGRO_MUTEX *al_create_mutex(void)
@@ -317,6 +381,19 @@ ALLEGRO_MUTEX *al_create_mutex_recursive(void)
 }
 
 
+/* Function: al_create_mutex_adaptive
+ */
+ALLEGRO_MUTEX *al_create_mutex_adaptive(void)
+{
+   ALLEGRO_MUTEX *mutex = al_malloc(sizeof(*mutex));
+   if (mutex) {
+      _AL_MARK_MUTEX_UNINITED(mutex->mutex);
+      _al_mutex_init_adaptive(&mutex->mutex);
+   }
+   return mutex;
+}
+
+
 /* Function: al_lock_mutex
  */
 void al_lock_mutex(ALLEGRO_MUTEX *mutex)
@@ -414,4 +491,134 @@ void al_signal_cond(ALLEGRO_COND *cond)
 }
 
 
+/* Function: al_create_rwlock
+ */
+ALLEGRO_RWLOCK *al_create_rwlock(void)
+{
+   ALLEGRO_RWLOCK *rwlock = al_malloc(sizeof(*rwlock));
+   if (rwlock)
+      _al_rwlock_init(&rwlock->rwlock);
+   return rwlock;
+}
+
+
+/* Function: al_destroy_rwlock
+ */
+void al_destroy_rwlock(ALLEGRO_RWLOCK *rwlock)
+{
+   if (rwlock) {
+      _al_rwlock_destroy(&rwlock->rwlock);
+      al_free(rwlock);
+   }
+}
+
+
+/* Function: al_lock_rwlock_read
+ */
+void al_lock_rwlock_read(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+   _al_rwlock_lock_read(&rwlock->rwlock);
+}
+
+
+/* Function: al_unlock_rwlock_read
+ */
+void al_unlock_rwlock_read(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+   _al_rwlock_unlock_read(&rwlock->rwlock);
+}
+
+
+/* Function: al_lock_rwlock_write
+ */
+void al_lock_rwlock_write(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+   _al_rwlock_lock_write(&rwlock->rwlock);
+}
+
+
+/* Function: al_unlock_rwlock_write
+ */
+void al_unlock_rwlock_write(ALLEGRO_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+   _al_rwlock_unlock_write(&rwlock->rwlock);
+}
+
+
+/* Function: al_atomic_load
+ */
+int al_atomic_load(volatile int *ptr)
+{
+   ASSERT(ptr);
+   return _al_atomic_load_acquire((volatile _AL_ATOMIC *)ptr);
+}
+
+
+/* Function: al_atomic_store
+ */
+void al_atomic_store(volatile int *ptr, int value)
+{
+   ASSERT(ptr);
+   _al_atomic_store_release((volatile _AL_ATOMIC *)ptr, value);
+}
+
+
+/* Function: al_atomic_fetch_add
+ */
+int al_atomic_fetch_add(volatile int *ptr, int value)
+{
+   ASSERT(ptr);
+   return _al_fetch_and_add((volatile _AL_ATOMIC *)ptr, value);
+}
+
+
+/* Function: al_atomic_compare_exchange
+ */
+bool al_atomic_compare_exchange(volatile int *ptr, int expected, int desired)
+{
+   ASSERT(ptr);
+   return _al_compare_and_swap((volatile _AL_ATOMIC *)ptr, expected, desired);
+}
+
+
+/* Function: al_atomic_load_ptr
+ */
+void *al_atomic_load_ptr(void *volatile *ptr)
+{
+   ASSERT(ptr);
+   return _al_atomic_load_ptr_acquire(ptr);
+}
+
+
+/* Function: al_atomic_store_ptr
+ */
+void al_atomic_store_ptr(void *volatile *ptr, void *value)
+{
+   ASSERT(ptr);
+   _al_atomic_store_ptr_release(ptr, value);
+}
+
+
+/* Function: al_atomic_compare_exchange_ptr
+ */
+bool al_atomic_compare_exchange_ptr(void *volatile *ptr, void *expected,
+   void *desired)
+{
+   ASSERT(ptr);
+   return _al_compare_and_swap_ptr(ptr, expected, desired);
+}
+
+
+/* Function: al_spin_pause
+ */
+void al_spin_pause(void)
+{
+   _al_spin_pause();
+}
+
+
 /* vim: set sts=3 sw=3 et: */
@@ -16,6 +16,10 @@
  */
 
 
+#if defined(_WIN32) && !defined(_WIN32_WINNT)
+#define _WIN32_WINNT 0x0600
+#endif
+
 #include <stdlib.h>
 
 #include "allegro5/allegro.h"
@@ -32,6 +36,13 @@
 #endif
 #endif
 
+#if defined(ALLEGRO_LINUX)
+   #include <errno.h>
+   #include <time.h>
+#elif defined(ALLEGRO_WINDOWS)
+   #include <windows.h>
+#endif
+
 
 /* forward declarations */
 static void timer_handle_tick(ALLEGRO_TIMER *timer);
@@ -43,7 +54,9 @@ struct ALLEGRO_TIMER
    bool started;
    double speed_secs;
    int64_t count;
-   double counter;		/* counts down to zero=blastoff */
+   double counter;		/* time left while stopped */
+   double deadline;		/* on the timer clock, while started */
+   unsigned int heap_index;	/* in active_timers, while started */
    _AL_LIST_ITEM *dtor_item;
 };
 
@@ -59,6 +72,22 @@ static _AL_THREAD * volatile timer_thread = NULL;
 static ALLEGRO_COND *timer_cond = NULL;
 static bool destroy_thread = false;
 
+/* The timer clock only advances in _al_timer_thread_handle_tick, so that
+ * deadlines are unaffected by how late the ticks are handled.
+ */
+static double timer_clock = 0.0;
+static double last_tick_time;
+
+/* How long before a deadline the timer thread stops waiting on timer_cond,
+ * which is only as precise as the system tick, and sleeps precisely
+ * instead.
+ */
+#ifdef ALLEGRO_WINDOWS
+#define PRECISE_SLEEP_SLACK 0.020
+#else
+#define PRECISE_SLEEP_SLACK 0.002
+#endif
+
 // Allegro's al_get_time measures "the time since Allegro started", and so does
 // not ignore time spent in a suspended state. Further, some implementations
 // currently use a calendar clock, which changes based on the system clock.
@@ -76,14 +105,14 @@ static bool destroy_thread = false;
 struct timespec _al_initial_uptime;
 #endif
 
-static void _init_get_uptime()
+static void _init_get_uptime(void)
 {
 #ifdef USE_UPTIME
    clock_gettime(CLOCK_UPTIME_RAW, &_al_initial_uptime);
 #endif
 }
 
-static double _al_get_uptime()
+static double _al_get_uptime(void)
 {
 #ifdef USE_UPTIME
    struct timespec now;
@@ -99,6 +128,95 @@ static double _al_get_uptime()
 }
 
 
+/* Precise sleeping, for the last stretch before a deadline. */
+#if defined(ALLEGRO_LINUX)
+
+static void init_precise_sleep(void)
+{
+}
+
+static void precise_sleep(double seconds)
+{
+   struct timespec until;
+
+   clock_gettime(CLOCK_MONOTONIC, &until);
+   until.tv_sec += (time_t)seconds;
+   until.tv_nsec += (long)((seconds - (time_t)seconds) * 1.0e9);
+   if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+   }
+
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+         == EINTR) {
+   }
+}
+
+static void shutdown_precise_sleep(void)
+{
+}
+
+#elif defined(ALLEGRO_WINDOWS)
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static HANDLE sleep_timer = NULL;
+
+static void init_precise_sleep(void)
+{
+   /* High resolution waitable timers need Windows 10 1803; older versions
+    * get one with the usual resolution of the system tick.
+    */
+   sleep_timer = CreateWaitableTimerExW(NULL, NULL,
+      CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+   if (!sleep_timer)
+      sleep_timer = CreateWaitableTimerW(NULL, TRUE, NULL);
+}
+
+static void precise_sleep(double seconds)
+{
+   LARGE_INTEGER due;
+
+   /* Negative for a relative time, in units of 100 ns. */
+   due.QuadPart = -(LONGLONG)(seconds * 1.0e7);
+   if (sleep_timer && SetWaitableTimer(sleep_timer, &due, 0, NULL, NULL,
+         FALSE)) {
+      WaitForSingleObject(sleep_timer, INFINITE);
+   }
+   else {
+      al_rest(seconds);
+   }
+}
+
+static void shutdown_precise_sleep(void)
+{
+   if (sleep_timer) {
+      CloseHandle(sleep_timer);
+      sleep_timer = NULL;
+   }
+}
+
+#else
+
+static void init_precise_sleep(void)
+{
+}
+
+static void precise_sleep(double seconds)
+{
+   al_rest(seconds);
+}
+
+static void shutdown_precise_sleep(void)
+{
+}
+
+#endif
+
+
+
 /* timer_thread_proc: [timer thread]
  *  The timer thread procedure itself.
  */
@@ -118,48 +236,145 @@ static void timer_thread_proc(_AL_THREAD *self, void *unused)
    }
 #endif
 
-   _init_get_uptime();
-   double old_time = _al_get_uptime();
-   double new_time;
-   double interval = 0.032768;
+   ALLEGRO_TIMEOUT timeout;
+   double delay;
 
-   while (!_al_get_thread_should_stop(self)) {
-      al_lock_mutex(timers_mutex);
-      while (_al_vector_size(&active_timers) == 0 && !destroy_thread) {
+   _al_thread_set_name(self, "al-timers");
+   init_precise_sleep();
+
+   al_lock_mutex(timers_mutex);
+
+   while (!_al_get_thread_should_stop(self) && !destroy_thread) {
+      if (_al_vector_size(&active_timers) == 0) {
          al_wait_cond(timer_cond, timers_mutex);
-         old_time = _al_get_uptime() - interval;
+         continue;
       }
-      al_unlock_mutex(timers_mutex);
-
-      al_rest(interval);
 
-      al_lock_mutex(timers_mutex);
-      {
-         /* Calculate actual time elapsed.  */
-         new_time = _al_get_uptime();
-         interval = new_time - old_time;
-         old_time = new_time;
+      delay = _al_timer_thread_handle_tick(_al_get_uptime() - last_tick_time);
 
-         /* Handle a tick.  */
-         interval = _al_timer_thread_handle_tick(interval);
+      if (delay > PRECISE_SLEEP_SLACK) {
+         /* Starting or changing a timer signals timer_cond, in case its
+          * deadline is sooner.
+          */
+         al_init_timeout(&timeout, delay - PRECISE_SLEEP_SLACK);
+         al_wait_cond_until(timer_cond, timers_mutex, &timeout);
+      }
+      else {
+         al_unlock_mutex(timers_mutex);
+         precise_sleep(delay);
+         al_lock_mutex(timers_mutex);
       }
-      al_unlock_mutex(timers_mutex);
    }
 
+   al_unlock_mutex(timers_mutex);
+
+   shutdown_precise_sleep();
+
    (void)unused;
 }
 
 
 
+/*
+ * The active timers are kept in a binary min-heap on their deadlines,
+ * so that only the timers which are due need to be looked at.
+ */
+
+static ALLEGRO_TIMER *heap_get(unsigned int i)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   return *slot;
+}
+
+static void heap_set(unsigned int i, ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   *slot = timer;
+   timer->heap_index = i;
+}
+
+static void heap_sift_up(ALLEGRO_TIMER *timer)
+{
+   unsigned int i = timer->heap_index;
+
+   while (i > 0) {
+      unsigned int parent = (i - 1) / 2;
+      ALLEGRO_TIMER *p = heap_get(parent);
+      if (p->deadline <= timer->deadline)
+         break;
+      heap_set(i, p);
+      i = parent;
+   }
+
+   heap_set(i, timer);
+}
+
+static void heap_sift_down(ALLEGRO_TIMER *timer)
+{
+   unsigned int n = _al_vector_size(&active_timers);
+   unsigned int i = timer->heap_index;
+
+   for (;;) {
+      unsigned int child = 2 * i + 1;
+      ALLEGRO_TIMER *c;
+
+      if (child >= n)
+         break;
+      c = heap_get(child);
+      if (child + 1 < n && heap_get(child + 1)->deadline < c->deadline) {
+         child++;
+         c = heap_get(child);
+      }
+      if (timer->deadline <= c->deadline)
+         break;
+      heap_set(i, c);
+      i = child;
+   }
+
+   heap_set(i, timer);
+}
+
+static void heap_insert(ALLEGRO_TIMER *timer)
+{
+   _al_vector_alloc_back(&active_timers);
+   heap_set(_al_vector_size(&active_timers) - 1, timer);
+   heap_sift_up(timer);
+}
+
+static void heap_remove(ALLEGRO_TIMER *timer)
+{
+   unsigned int last = _al_vector_size(&active_timers) - 1;
+   ALLEGRO_TIMER *moved = heap_get(last);
+
+   _al_vector_delete_at(&active_timers, last);
+
+   if (moved != timer) {
+      heap_set(timer->heap_index, moved);
+      heap_sift_up(moved);
+      heap_sift_down(moved);
+   }
+}
+
+/* Returns the time on the timer clock as of now, which is ahead of
+ * timer_clock by however long ago the last tick was handled.
+ */
+static double get_timer_clock(void)
+{
+   double elapsed = _al_get_uptime() - last_tick_time;
+
+   return timer_clock + _ALLEGRO_CLAMP(0, elapsed, 10.0);
+}
+
+
+
 /* timer_thread_handle_tick: [timer thread]
- *  Call handle_tick() method of every timer in active_timers, and
- *  returns the duration that the timer thread should try to sleep
- *  next time.
+ *  Advance the timer clock by interval, and call handle_tick() for every
+ *  timer which is due, as often as it is due. Returns the duration that
+ *  the timer thread should try to sleep next time.
  */
 double _al_timer_thread_handle_tick(double interval)
 {
    double new_delay = 0.032768;
-   unsigned int i;
 
    /* Never allow negative time, or greater than 10 seconds delta.
     * This is to handle clock changes on platforms not using a monotonic,
@@ -167,19 +382,21 @@ double _al_timer_thread_handle_tick(double interval)
     */
    interval = _ALLEGRO_CLAMP(0, interval, 10.0);
 
-   for (i = 0; i < _al_vector_size(&active_timers); i++) {
-      ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
-      ALLEGRO_TIMER *timer = *slot;
+   timer_clock += interval;
+   last_tick_time = _al_get_uptime();
 
-      timer->counter -= interval;
+   while (_al_vector_size(&active_timers) > 0) {
+      ALLEGRO_TIMER *timer = heap_get(0);
 
-      while (timer->counter <= 0) {
-         timer_handle_tick(timer);
-         timer->counter += timer->speed_secs;
+      if (timer->deadline > timer_clock) {
+         new_delay = timer->deadline - timer_clock;
+         break;
       }
 
-      if ((timer->counter > 0) && (timer->counter < new_delay))
-         new_delay = timer->counter;
+      timer->counter = timer->deadline - timer_clock;
+      timer_handle_tick(timer);
+      timer->deadline += timer->speed_secs;
+      heap_sift_down(timer);
    }
 
    return new_delay;
@@ -226,15 +443,13 @@ static void enable_timer(ALLEGRO_TIMER *timer, bool reset_counter)
 
       al_lock_mutex(timers_mutex);
       {
-         ALLEGRO_TIMER **slot;
-
          timer->started = true;
 
          if (reset_counter)
             timer->counter = timer->speed_secs;
 
-         slot = _al_vector_alloc_back(&active_timers);
-         *slot = timer;
+         timer->deadline = get_timer_clock() + timer->counter;
+         heap_insert(timer);
 
          al_signal_cond(timer_cond);
       }
@@ -254,6 +469,8 @@ void _al_init_timers(void)
 {
    timers_mutex = al_create_mutex();
    timer_cond = al_create_cond();
+   _init_get_uptime();
+   last_tick_time = _al_get_uptime();
    _al_add_exit_func(shutdown_timers, "shutdown_timers");
 }
 
@@ -342,7 +559,8 @@ void al_stop_timer(ALLEGRO_TIMER *timer)
 
       al_lock_mutex(timers_mutex);
       {
-         _al_vector_find_and_delete(&active_timers, &timer);
+         heap_remove(timer);
+         timer->counter = timer->deadline - get_timer_clock();
          timer->started = false;
       }
       al_unlock_mutex(timers_mutex);
@@ -383,8 +601,11 @@ void al_set_timer_speed(ALLEGRO_TIMER *timer, double new_speed_secs)
    al_lock_mutex(timers_mutex);
    {
       if (timer->started) {
-         timer->counter -= timer->speed_secs;
-         timer->counter += new_speed_secs;
+         timer->deadline -= timer->speed_secs;
+         timer->deadline += new_speed_secs;
+         heap_sift_up(timer);
+         heap_sift_down(timer);
+         al_signal_cond(timer_cond);
       }
 
       timer->speed_secs = new_speed_secs;
@@ -44,6 +44,7 @@
 #include "allegro5/internal/aintern_fshook.h"
 #include "allegro5/internal/aintern_shader.h"
 #include "allegro5/internal/aintern_tls.h"
+#include "allegro5/internal/aintern_transform.h"
 
 #ifdef ALLEGRO_ANDROID
 #include "allegro5/internal/aintern_android.h"
@@ -82,6 +83,9 @@ typedef struct thread_local_state {
    /* Target bitmap */
    ALLEGRO_BITMAP *target_bitmap;
 
+   /* Command list being recorded, overriding the target bitmap */
+   ALLEGRO_COMMAND_LIST *target_command_list;
+
    /* Blender */
    ALLEGRO_BLENDER current_blender;
 
@@ -90,6 +94,8 @@ typedef struct thread_local_state {
    int new_bitmap_flags;
    int new_bitmap_wrap_u;
    int new_bitmap_wrap_v;
+   int new_bitmap_load_w;
+   int new_bitmap_load_h;
 
    /* Files */
    const ALLEGRO_FILE_INTERFACE *new_file_interface;
@@ -109,6 +115,12 @@ typedef struct thread_local_state {
 
    /* Destructor ownership count */
    int dtor_owner_count;
+
+   /* Job pool worker running on this thread */
+   void *job_worker;
+
+   /* This thread's memory pool caches; see memory_pool.c */
+   void *pool_caches;
 } thread_local_state;
 
 
@@ -175,9 +187,13 @@ static void initialize_tls_values(thread_local_state *tls)
 void _al_reinitialize_tls_values(void)
 {
    thread_local_state *tls;
+   void *pool_caches;
    if ((tls = tls_get()) == NULL)
       return;
+   /* Memory pools may still refer to the caches. */
+   pool_caches = tls->pool_caches;
    initialize_tls_values(tls);
+   tls->pool_caches = pool_caches;
 }
 
 
@@ -408,13 +424,12 @@ void al_set_target_bitmap(ALLEGRO_BITMAP *bitmap)
 
    ASSERT(!al_is_bitmap_drawing_held());
 
+   /* Drawing can only change the clipped region, see also
+    * al_set_clipping_rectangle.
+    */
    if (bitmap) {
-      if (bitmap->parent) {
-         bitmap->parent->dirty = true;
-      }
-      else {
-         bitmap->dirty = true;
-      }
+      _al_mark_bitmap_dirty(bitmap, bitmap->cl, bitmap->ct,
+         bitmap->cr_excl - bitmap->cl, bitmap->cb_excl - bitmap->ct);
    }
 
    if ((tls = tls_get()) == NULL)
@@ -513,6 +528,32 @@ ALLEGRO_BITMAP *al_get_target_bitmap(void)
 
 
 
+/* Function: al_set_target_command_list
+ */
+void al_set_target_command_list(ALLEGRO_COMMAND_LIST *list)
+{
+   thread_local_state *tls;
+
+   if ((tls = tls_get()) == NULL)
+      return;
+   tls->target_command_list = list;
+}
+
+
+
+/* Function: al_get_target_command_list
+ */
+ALLEGRO_COMMAND_LIST *al_get_target_command_list(void)
+{
+   thread_local_state *tls;
+
+   if ((tls = tls_get()) == NULL)
+      return NULL;
+   return tls->target_command_list;
+}
+
+
+
 /* Function: al_set_blender
  */
 void al_set_blender(int op, int src, int dst)
@@ -718,6 +759,8 @@ void al_store_state(ALLEGRO_STATE *state, int flags)
       _STORE(new_bitmap_flags);
       _STORE(new_bitmap_wrap_u);
       _STORE(new_bitmap_wrap_v);
+      _STORE(new_bitmap_load_w);
+      _STORE(new_bitmap_load_h);
    }
 
    if (flags & ALLEGRO_STATE_DISPLAY) {
@@ -789,6 +832,8 @@ void al_restore_state(ALLEGRO_STATE const *state)
       _RESTORE(new_bitmap_flags);
       _RESTORE(new_bitmap_wrap_u);
       _RESTORE(new_bitmap_wrap_v);
+      _RESTORE(new_bitmap_load_w);
+      _RESTORE(new_bitmap_load_h);
    }
 
    if (flags & ALLEGRO_STATE_DISPLAY) {
@@ -831,6 +876,203 @@ void al_restore_state(ALLEGRO_STATE const *state)
 
 
 
+struct ALLEGRO_RENDER_STATE_BLOCK
+{
+   int flags;
+   ALLEGRO_BITMAP *target_bitmap;
+   ALLEGRO_BLENDER blender;
+   ALLEGRO_TRANSFORM transform;
+   ALLEGRO_TRANSFORM projection_transform;
+   ALLEGRO_SHADER *shader;
+   int clip_x, clip_y, clip_w, clip_h;
+};
+
+#define RENDER_STATE_BLOCK_FLAGS (ALLEGRO_STATE_TARGET_BITMAP | \
+   ALLEGRO_STATE_BLENDER | ALLEGRO_STATE_TRANSFORM | \
+   ALLEGRO_STATE_PROJECTION_TRANSFORM | ALLEGRO_STATE_SHADER | \
+   ALLEGRO_STATE_CLIPPING_RECTANGLE)
+
+/* State which belongs to the target bitmap rather than to the thread. */
+#define RENDER_STATE_BLOCK_TARGET_FLAGS (ALLEGRO_STATE_TRANSFORM | \
+   ALLEGRO_STATE_PROJECTION_TRANSFORM | ALLEGRO_STATE_SHADER | \
+   ALLEGRO_STATE_CLIPPING_RECTANGLE)
+
+
+static bool blenders_equal(ALLEGRO_BLENDER const *a, ALLEGRO_BLENDER const *b)
+{
+   return a->blend_op == b->blend_op &&
+      a->blend_source == b->blend_source &&
+      a->blend_dest == b->blend_dest &&
+      a->blend_alpha_op == b->blend_alpha_op &&
+      a->blend_alpha_source == b->blend_alpha_source &&
+      a->blend_alpha_dest == b->blend_alpha_dest &&
+      !memcmp(&a->blend_color, &b->blend_color, sizeof(ALLEGRO_COLOR));
+}
+
+
+
+/* Function: al_create_render_state_block
+ */
+ALLEGRO_RENDER_STATE_BLOCK *al_create_render_state_block(int flags)
+{
+   thread_local_state *tls;
+   ALLEGRO_RENDER_STATE_BLOCK *block;
+   ALLEGRO_BITMAP *target;
+
+   if ((tls = tls_get()) == NULL)
+      return NULL;
+
+   block = al_calloc(1, sizeof *block);
+   if (!block)
+      return NULL;
+
+   flags &= RENDER_STATE_BLOCK_FLAGS;
+   target = tls->target_bitmap;
+
+   if (!target) {
+      flags &= ~RENDER_STATE_BLOCK_TARGET_FLAGS;
+   }
+   else if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP) {
+      /* Memory bitmaps have neither projections nor shaders. */
+      flags &= ~(ALLEGRO_STATE_PROJECTION_TRANSFORM | ALLEGRO_STATE_SHADER);
+   }
+
+   block->flags = flags;
+   block->target_bitmap = target;
+   block->blender = tls->current_blender;
+
+   if (flags & ALLEGRO_STATE_TRANSFORM)
+      block->transform = target->transform;
+
+   if (flags & ALLEGRO_STATE_PROJECTION_TRANSFORM)
+      block->projection_transform = target->proj_transform;
+
+   if (flags & ALLEGRO_STATE_SHADER)
+      block->shader = target->shader;
+
+   if (flags & ALLEGRO_STATE_CLIPPING_RECTANGLE) {
+      block->clip_x = target->cl;
+      block->clip_y = target->ct;
+      block->clip_w = target->cr_excl - target->cl;
+      block->clip_h = target->cb_excl - target->ct;
+   }
+
+   return block;
+}
+
+
+
+/* Function: al_destroy_render_state_block
+ */
+void al_destroy_render_state_block(ALLEGRO_RENDER_STATE_BLOCK *block)
+{
+   al_free(block);
+}
+
+
+
+/* Function: al_apply_render_state_block
+ */
+void al_apply_render_state_block(ALLEGRO_RENDER_STATE_BLOCK const *block)
+{
+   thread_local_state *tls;
+   ALLEGRO_BITMAP *target;
+   ALLEGRO_DISPLAY *display;
+   int flags;
+   bool memory;
+   bool change_target, change_blender, change_transform;
+   bool change_projection, change_shader, change_clipping;
+   bool held;
+
+   ASSERT(block);
+
+   if ((tls = tls_get()) == NULL)
+      return;
+
+   flags = block->flags;
+   target = tls->target_bitmap;
+
+   /* Work out what actually differs first, so that applying a block which
+    * matches the current state costs nothing, and any other block flushes
+    * held drawing only once.
+    */
+   change_target = (flags & ALLEGRO_STATE_TARGET_BITMAP) &&
+      block->target_bitmap != target;
+   if (flags & ALLEGRO_STATE_TARGET_BITMAP)
+      target = block->target_bitmap;
+   if (!target)
+      flags &= ~RENDER_STATE_BLOCK_TARGET_FLAGS;
+   memory = target && (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP);
+
+   change_blender = (flags & ALLEGRO_STATE_BLENDER) &&
+      !blenders_equal(&tls->current_blender, &block->blender);
+   change_transform = (flags & ALLEGRO_STATE_TRANSFORM) &&
+      (tls->target_command_list ||
+       memcmp(&target->transform, &block->transform,
+         sizeof(ALLEGRO_TRANSFORM)));
+   change_projection = (flags & ALLEGRO_STATE_PROJECTION_TRANSFORM) &&
+      !memory &&
+      memcmp(&target->proj_transform, &block->projection_transform,
+         sizeof(ALLEGRO_TRANSFORM));
+   change_shader = (flags & ALLEGRO_STATE_SHADER) && !memory &&
+      target->shader != block->shader;
+   change_clipping = (flags & ALLEGRO_STATE_CLIPPING_RECTANGLE) &&
+      (target->cl != block->clip_x ||
+       target->ct != block->clip_y ||
+       target->cr_excl - target->cl != block->clip_w ||
+       target->cb_excl - target->ct != block->clip_h);
+
+   if (!change_target && !change_blender && !change_transform &&
+         !change_projection && !change_shader && !change_clipping)
+      return;
+
+   held = al_is_bitmap_drawing_held();
+   if (held)
+      al_hold_bitmap_drawing(false);
+
+   if (change_target)
+      al_set_target_bitmap(target);
+
+   if (change_blender)
+      tls->current_blender = block->blender;
+
+   if (change_transform && tls->target_command_list) {
+      al_use_transform(&block->transform);
+      change_transform = false;
+   }
+
+   if (change_transform) {
+      al_copy_transform(&target->transform, &block->transform);
+      target->inverse_transform_dirty = true;
+      target->transform_kind = _AL_TRANSFORM_UNKNOWN;
+   }
+
+   if (change_projection)
+      al_copy_transform(&target->proj_transform, &block->projection_transform);
+
+   /* The shader must be in use before the transformation is updated, which
+    * also sets its al_projview_matrix variable.
+    */
+   if (change_shader)
+      al_use_shader(block->shader);
+
+   if (change_transform || change_projection || change_shader) {
+      display = _al_get_bitmap_display(target);
+      if (display)
+         display->vt->update_transformation(display, target);
+   }
+
+   if (change_clipping) {
+      al_set_clipping_rectangle(block->clip_x, block->clip_y,
+         block->clip_w, block->clip_h);
+   }
+
+   if (held)
+      al_hold_bitmap_drawing(true);
+}
+
+
+
 /* Function: al_get_new_file_interface
  * FIXME: added a work-around for the situation where TLS has not yet been
  * initialised when this function is called. This may happen if Allegro
@@ -979,6 +1221,32 @@ void al_set_new_bitmap_wrap(ALLEGRO_BITMAP_WRAP u, ALLEGRO_BITMAP_WRAP v)
    tls->new_bitmap_wrap_v = v;
 }
 
+/* Function: al_get_new_bitmap_load_size
+ */
+void al_get_new_bitmap_load_size(int *w, int *h)
+{
+   ASSERT(w);
+   ASSERT(h);
+
+   thread_local_state *tls;
+   if ((tls = tls_get()) == NULL)
+      return;
+
+   *w = tls->new_bitmap_load_w;
+   *h = tls->new_bitmap_load_h;
+}
+
+/* Function: al_set_new_bitmap_load_size
+ */
+void al_set_new_bitmap_load_size(int w, int h)
+{
+   thread_local_state *tls;
+   if ((tls = tls_get()) == NULL)
+      return;
+   tls->new_bitmap_load_w = _ALLEGRO_MAX(w, 0);
+   tls->new_bitmap_load_h = _ALLEGRO_MAX(h, 0);
+}
+
 #ifdef ALLEGRO_ANDROID
 JNIEnv *_al_android_get_jnienv(void)
 GETTER(jnienv, 0)
@@ -997,4 +1265,25 @@ int *_al_tls_get_dtor_owner_count(void)
 }
 
 
+
+void **_al_tls_get_job_worker(void)
+{
+   thread_local_state *tls;
+
+   tls = tls_get();
+   return &tls->job_worker;
+}
+
+
+
+void **_al_tls_get_pool_caches(void)
+{
+   thread_local_state *tls;
+
+   if ((tls = tls_get()) == NULL)
+      return NULL;
+   return &tls->pool_caches;
+}
+
+
 /* vim: set sts=3 sw=3 et: */
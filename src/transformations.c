@@ -18,11 +18,21 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_command_list.h"
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_system.h"
 #include "allegro5/internal/aintern_transform.h"
 #include <math.h>
 
+#if defined(__SSE__) || defined(_M_X64) || \
+   (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+   #define USE_SSE
+   #include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+   #define USE_NEON
+   #include <arm_neon.h>
+#endif
+
 /* ALLEGRO_DEBUG_CHANNEL("transformations") */
 
 /* Function: al_copy_transform
@@ -39,9 +49,15 @@ void al_copy_transform(ALLEGRO_TRANSFORM *dest, const ALLEGRO_TRANSFORM *src)
  */
 void al_use_transform(const ALLEGRO_TRANSFORM *trans)
 {
+   ALLEGRO_COMMAND_LIST *list = al_get_target_command_list();
    ALLEGRO_BITMAP *target = al_get_target_bitmap();
    ALLEGRO_DISPLAY *display;
 
+   if (list) {
+      _al_set_command_list_transform(list, trans);
+      return;
+   }
+
    if (!target)
       return;
 
@@ -55,6 +71,7 @@ void al_use_transform(const ALLEGRO_TRANSFORM *trans)
       al_copy_transform(&target->transform, trans);
 
       target->inverse_transform_dirty = true;
+      target->transform_kind = _AL_TRANSFORM_UNKNOWN;
    }
 
    /*
@@ -103,8 +120,12 @@ void al_use_projection_transform(const ALLEGRO_TRANSFORM *trans)
  */
 const ALLEGRO_TRANSFORM *al_get_current_transform(void)
 {
+   ALLEGRO_COMMAND_LIST *list = al_get_target_command_list();
    ALLEGRO_BITMAP *target = al_get_target_bitmap();
 
+   if (list)
+      return _al_get_command_list_transform(list);
+
    if (!target)
       return NULL;
 
@@ -490,6 +511,260 @@ void al_transform_coordinates_3d_projective(const ALLEGRO_TRANSFORM *trans,
    *z /= w;
 }
 
+/* The batch functions below do the same float operations in the same order
+ * as the functions for a single point, so the results are identical. With
+ * SSE or NEON the matrix rows stay in registers, and each point is
+ * transformed with a few vector multiplies and adds.
+ */
+#define POINT(base, i, stride) \
+   ((float *)((char *)(base) + (size_t)(i) * (stride)))
+
+#ifdef USE_SSE
+
+typedef __m128 ROWS[4];
+
+static INLINE void load_rows(ROWS r, const ALLEGRO_TRANSFORM *trans)
+{
+   int i;
+   for (i = 0; i < 4; i++)
+      r[i] = _mm_loadu_ps(trans->m[i]);
+}
+
+/* x * m[0] + y * m[1] + z * m[2] + w * m[3], or + m[3] if w is NULL. */
+static INLINE __m128 transform_point(const ROWS r, float x, float y,
+   float z, const float *w)
+{
+   __m128 v = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(x), r[0]),
+      _mm_mul_ps(_mm_set1_ps(y), r[1]));
+   v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(z), r[2]));
+   if (w)
+      return _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(*w), r[3]));
+   return _mm_add_ps(v, r[3]);
+}
+
+static INLINE void store_3(float *p, __m128 v)
+{
+   _mm_storel_pi((__m64 *)p, v);
+   _mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+static INLINE void store_4(float *p, __m128 v)
+{
+   _mm_storeu_ps(p, v);
+}
+
+#elif defined(USE_NEON)
+
+typedef float32x4_t ROWS[4];
+
+static INLINE void load_rows(ROWS r, const ALLEGRO_TRANSFORM *trans)
+{
+   int i;
+   for (i = 0; i < 4; i++)
+      r[i] = vld1q_f32(trans->m[i]);
+}
+
+static INLINE float32x4_t transform_point(const ROWS r, float x, float y,
+   float z, const float *w)
+{
+   float32x4_t v = vaddq_f32(vmulq_n_f32(r[0], x), vmulq_n_f32(r[1], y));
+   v = vaddq_f32(v, vmulq_n_f32(r[2], z));
+   if (w)
+      return vaddq_f32(v, vmulq_n_f32(r[3], *w));
+   return vaddq_f32(v, r[3]);
+}
+
+static INLINE void store_3(float *p, float32x4_t v)
+{
+   vst1_f32(p, vget_low_f32(v));
+   vst1q_lane_f32(p + 2, v, 2);
+}
+
+static INLINE void store_4(float *p, float32x4_t v)
+{
+   vst1q_f32(p, v);
+}
+
+#endif
+
+/* Function: al_transform_coordinates_n
+ */
+void al_transform_coordinates_n(const ALLEGRO_TRANSFORM *trans, float *xy,
+   int stride, int n)
+{
+   int i = 0;
+   ASSERT(trans);
+   ASSERT(xy || n == 0);
+   ASSERT(stride >= (int)(2 * sizeof(float)));
+
+#if defined(USE_SSE) || defined(USE_NEON)
+   if (stride == (int)(2 * sizeof(float))) {
+      /* Tightly packed, so two points fit in one vector. */
+      const float *m0 = trans->m[0], *m1 = trans->m[1], *m3 = trans->m[3];
+#ifdef USE_SSE
+      const __m128 c0 = _mm_setr_ps(m0[0], m0[1], m0[0], m0[1]);
+      const __m128 c1 = _mm_setr_ps(m1[0], m1[1], m1[0], m1[1]);
+      const __m128 c3 = _mm_setr_ps(m3[0], m3[1], m3[0], m3[1]);
+      for (; i + 2 <= n; i += 2) {
+         float *p = xy + 2 * i;
+         __m128 v = _mm_loadu_ps(p);
+         __m128 xs = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0));
+         __m128 ys = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1));
+         v = _mm_add_ps(_mm_mul_ps(xs, c0), _mm_mul_ps(ys, c1));
+         _mm_storeu_ps(p, _mm_add_ps(v, c3));
+      }
+#else
+      const float32x4_t c0 = vcombine_f32(vld1_f32(m0), vld1_f32(m0));
+      const float32x4_t c1 = vcombine_f32(vld1_f32(m1), vld1_f32(m1));
+      const float32x4_t c3 = vcombine_f32(vld1_f32(m3), vld1_f32(m3));
+      for (; i + 2 <= n; i += 2) {
+         float *p = xy + 2 * i;
+         float32x4_t v = vld1q_f32(p);
+         float32x4x2_t t = vtrnq_f32(v, v);
+         v = vaddq_f32(vmulq_f32(t.val[0], c0), vmulq_f32(t.val[1], c1));
+         vst1q_f32(p, vaddq_f32(v, c3));
+      }
+#endif
+   }
+#endif
+
+   for (; i < n; i++) {
+      float *p = POINT(xy, i, stride);
+      al_transform_coordinates(trans, &p[0], &p[1]);
+   }
+}
+
+/* Function: al_transform_coordinates_3d_n
+ */
+void al_transform_coordinates_3d_n(const ALLEGRO_TRANSFORM *trans,
+   float *xyz, int stride, int n)
+{
+#if defined(USE_SSE) || defined(USE_NEON)
+   ROWS r;
+#endif
+   int i;
+   ASSERT(trans);
+   ASSERT(xyz || n == 0);
+   ASSERT(stride >= (int)(3 * sizeof(float)));
+
+#if defined(USE_SSE) || defined(USE_NEON)
+   load_rows(r, trans);
+   for (i = 0; i < n; i++) {
+      float *p = POINT(xyz, i, stride);
+      store_3(p, transform_point(r, p[0], p[1], p[2], NULL));
+   }
+#else
+   for (i = 0; i < n; i++) {
+      float *p = POINT(xyz, i, stride);
+      al_transform_coordinates_3d(trans, &p[0], &p[1], &p[2]);
+   }
+#endif
+}
+
+/* Function: al_transform_coordinates_4d_n
+ */
+void al_transform_coordinates_4d_n(const ALLEGRO_TRANSFORM *trans,
+   float *xyzw, int stride, int n)
+{
+#if defined(USE_SSE) || defined(USE_NEON)
+   ROWS r;
+#endif
+   int i;
+   ASSERT(trans);
+   ASSERT(xyzw || n == 0);
+   ASSERT(stride >= (int)(4 * sizeof(float)));
+
+#if defined(USE_SSE) || defined(USE_NEON)
+   load_rows(r, trans);
+   for (i = 0; i < n; i++) {
+      float *p = POINT(xyzw, i, stride);
+      store_4(p, transform_point(r, p[0], p[1], p[2], &p[3]));
+   }
+#else
+   for (i = 0; i < n; i++) {
+      float *p = POINT(xyzw, i, stride);
+      al_transform_coordinates_4d(trans, &p[0], &p[1], &p[2], &p[3]);
+   }
+#endif
+}
+
+/* Function: al_transform_coordinates_3d_projective_n
+ */
+void al_transform_coordinates_3d_projective_n(const ALLEGRO_TRANSFORM *trans,
+   float *xyz, int stride, int n)
+{
+#if defined(USE_SSE) || defined(USE_NEON)
+   const float one = 1;
+   float v[4];
+   ROWS r;
+#endif
+   int i;
+   ASSERT(trans);
+   ASSERT(xyz || n == 0);
+   ASSERT(stride >= (int)(3 * sizeof(float)));
+
+#if defined(USE_SSE) || defined(USE_NEON)
+   load_rows(r, trans);
+   for (i = 0; i < n; i++) {
+      float *p = POINT(xyz, i, stride);
+      store_4(v, transform_point(r, p[0], p[1], p[2], &one));
+      p[0] = v[0] / v[3];
+      p[1] = v[1] / v[3];
+      p[2] = v[2] / v[3];
+   }
+#else
+   for (i = 0; i < n; i++) {
+      float *p = POINT(xyz, i, stride);
+      al_transform_coordinates_3d_projective(trans, &p[0], &p[1], &p[2]);
+   }
+#endif
+}
+
+/* Like al_transform_coordinates_n or al_transform_coordinates_3d_n (if
+ * with_z is set), but takes a shortcut if the transform class allows it.
+ * The result is the same as the full multiplication.
+ */
+void _al_transform_coordinates_kind_n(const ALLEGRO_TRANSFORM *trans,
+   int kind, float *xyz, int stride, int n, bool with_z)
+{
+   const float (*m)[4] = trans->m;
+   int i;
+
+   switch (kind) {
+      case _AL_TRANSFORM_IDENTITY:
+         return;
+
+      case _AL_TRANSFORM_TRANSLATE:
+         for (i = 0; i < n; i++) {
+            float *p = POINT(xyz, i, stride);
+            p[0] += m[3][0];
+            p[1] += m[3][1];
+            if (with_z)
+               p[2] += m[3][2];
+         }
+         return;
+
+      case _AL_TRANSFORM_SCALE_TRANSLATE:
+         for (i = 0; i < n; i++) {
+            float *p = POINT(xyz, i, stride);
+            p[0] = p[0] * m[0][0] + m[3][0];
+            p[1] = p[1] * m[1][1] + m[3][1];
+            if (with_z)
+               p[2] = p[2] * m[2][2] + m[3][2];
+         }
+         return;
+
+      default:
+         if (with_z)
+            al_transform_coordinates_3d_n(trans, xyz, stride, n);
+         else
+            al_transform_coordinates_n(trans, xyz, stride, n);
+         return;
+   }
+}
+
+#undef POINT
+
 /* Function: al_compose_transform
  */
 void al_compose_transform(ALLEGRO_TRANSFORM *trans, const ALLEGRO_TRANSFORM *other)
@@ -536,6 +811,47 @@ bool _al_transform_is_translation(const ALLEGRO_TRANSFORM* trans,
    return false;
 }
 
+int _al_classify_transform(const ALLEGRO_TRANSFORM *trans)
+{
+   const float (*m)[4] = trans->m;
+
+   if (m[0][3] != 0 || m[1][3] != 0 || m[2][3] != 0 || m[3][3] != 1)
+      return _AL_TRANSFORM_PROJECTIVE;
+
+   if (m[1][0] != 0 || m[2][0] != 0 ||
+       m[0][1] != 0 || m[2][1] != 0 ||
+       m[0][2] != 0 || m[1][2] != 0)
+      return _AL_TRANSFORM_AFFINE;
+
+   if (m[0][0] != 1 || m[1][1] != 1 || m[2][2] != 1)
+      return _AL_TRANSFORM_SCALE_TRANSLATE;
+
+   if (m[3][0] != 0 || m[3][1] != 0 || m[3][2] != 0)
+      return _AL_TRANSFORM_TRANSLATE;
+
+   return _AL_TRANSFORM_IDENTITY;
+}
+
+/* Returns the class of al_get_current_transform(). For bitmaps the result
+ * is cached until the transform changes.
+ */
+int _al_get_current_transform_kind(void)
+{
+   ALLEGRO_COMMAND_LIST *list = al_get_target_command_list();
+   ALLEGRO_BITMAP *target;
+
+   if (list)
+      return _al_classify_transform(_al_get_command_list_transform(list));
+
+   target = al_get_target_bitmap();
+   if (!target)
+      return _AL_TRANSFORM_PROJECTIVE;
+
+   if (target->transform_kind == _AL_TRANSFORM_UNKNOWN)
+      target->transform_kind = _al_classify_transform(&target->transform);
+   return target->transform_kind;
+}
+
 /* Function: al_orthographic_transform
  */
 void al_orthographic_transform(ALLEGRO_TRANSFORM *trans,
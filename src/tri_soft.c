@@ -21,8 +21,11 @@
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_blend.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_memblit.h"
 #include "allegro5/internal/aintern_pixels.h"
 #include "allegro5/internal/aintern_tri_soft.h"
+#include <limits.h>
 #include <math.h>
 
 ALLEGRO_DEBUG_CHANNEL("tri_soft")
@@ -408,10 +411,674 @@ static void shader_texture_grad_any_step(uintptr_t state, int minor)
 /* Include generated routines. */
 #include "scanline_drawers.inc"
 
+/*----------------------------------------------------------------------------*/
+
+/*
+A flat tinted texture between 32-bit RGBA bitmaps, copied or drawn with the
+default premultiplied blender, is what every transformed memory bitmap draw
+turns into. These get a drawer of their own which fetches the texels of a
+whole run with the span kernels and then copies or blends the run at once.
+The edges, the texture coordinates and the stepping are the same as in the
+generic drawers, so nearest sampling gives the same pixels.
+
+If the texture has ALLEGRO_MAG_LINEAR or ALLEGRO_MIN_LINEAR and the triangle
+magnifies or minifies it, the texels are filtered bilinearly instead.
+*/
+
+#define SPAN_RUN 256
+
+enum {
+   SPAN_COPY,
+   SPAN_BLEND
+};
+
+typedef struct {
+   state_texture_solid_any_2d solid;
+   int mode;
+   bool swap_rb;
+   bool linear;
+   const float *tint;
+   float tint_factors[4];
+} state_texture_span_2d;
+
+static void shader_texture_span_init(uintptr_t state, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3)
+{
+   state_texture_span_2d* s = (state_texture_span_2d*)state;
+   int flags = al_get_bitmap_flags(s->solid.texture);
+   float area;
+
+   shader_texture_solid_any_init(state, v1, v2, v3);
+
+   /* Texels covered by one pixel. */
+   area = fabsf(s->solid.du_dx * s->solid.dv_dy - s->solid.du_dy * s->solid.dv_dx);
+   if (area <= 1.0f)
+      s->linear = (flags & ALLEGRO_MAG_LINEAR) != 0;
+   else
+      s->linear = (flags & ALLEGRO_MIN_LINEAR) != 0;
+}
+
+#define SPAN_WRAP(uu, w)   \
+   if (uu < 0)             \
+      uu += w;             \
+   else if (uu >= w)       \
+      uu -= w;
+
+/* Fetches n texels, wrapping after every step like the generic drawers. */
+static void fetch_texels(const state_texture_span_2d* s, uint32_t *texels,
+   const uint32_t *src, int pitch, al_fixed *uu, al_fixed *vv,
+   al_fixed du, al_fixed dv, al_fixed w, al_fixed h, int n)
+{
+   const int64_t last_u = *uu + (int64_t)du * (n - 1);
+   const int64_t last_v = *vv + (int64_t)dv * (n - 1);
+   int i;
+
+   if (last_u >= 0 && last_u < w && last_v >= 0 && last_v < h) {
+      /* No wrap inside the run. */
+      if (s->linear) {
+         _al_blit_span_gather_linear_8888(texels, src, pitch,
+            s->solid.w, s->solid.h, *uu, *vv, du, dv, n);
+      }
+      else {
+         _al_blit_span_gather_8888(texels, src, pitch, *uu, *vv, du, dv, n);
+      }
+      *uu += du * n;
+      *vv += dv * n;
+      SPAN_WRAP(*uu, w)
+      SPAN_WRAP(*vv, h)
+      return;
+   }
+
+   for (i = 0; i < n; i++) {
+      if (s->linear) {
+         _al_blit_span_gather_linear_8888(texels + i, src, pitch,
+            s->solid.w, s->solid.h, *uu, *vv, 0, 0, 1);
+      }
+      else {
+         texels[i] = src[(*vv >> 16) * pitch + (*uu >> 16)];
+      }
+      *uu += du;
+      *vv += dv;
+      SPAN_WRAP(*uu, w)
+      SPAN_WRAP(*vv, h)
+   }
+}
+
+static void shader_texture_span_draw(uintptr_t state, int x1, int y, int x2)
+{
+   state_texture_span_2d* s = (state_texture_span_2d*)state;
+   ALLEGRO_BITMAP *target = s->solid.target;
+   ALLEGRO_BITMAP *texture = s->solid.texture;
+   const uint32_t *src;
+   uint32_t *dst;
+   uint32_t buf[SPAN_RUN];
+   int offset_x = 0, offset_y = 0;
+   int src_pitch;
+   float u = s->solid.u;
+   float v = s->solid.v;
+   al_fixed uu, vv, du, dv, w, h;
+   bool wrap = true;
+
+   if (target->parent) {
+      x1 += target->xofs;
+      x2 += target->xofs;
+      y += target->yofs;
+      target = target->parent;
+   }
+
+   x1 -= target->lock_x;
+   x2 -= target->lock_x;
+   y -= target->lock_y;
+   y--;
+
+   if (y < 0 || y >= target->lock_h) {
+      return;
+   }
+
+   if (x1 < 0) {
+      u += s->solid.du_dx * -x1;
+      v += s->solid.dv_dx * -x1;
+      x1 = 0;
+   }
+
+   if (x2 > target->lock_w - 1) {
+      x2 = target->lock_w - 1;
+   }
+
+   if (texture->parent) {
+      offset_x = texture->xofs;
+      offset_y = texture->yofs;
+      texture = texture->parent;
+   }
+
+   /* Ensure u in [0, s->w) and v in [0, s->h). */
+   while (u < 0)
+      u += s->solid.w;
+   while (v < 0)
+      v += s->solid.h;
+   u = fmodf(u, s->solid.w);
+   v = fmodf(v, s->solid.h);
+
+   if (s->mode == SPAN_COPY && !s->swap_rb && !s->linear) {
+      /* The copying drawer doesn't wrap at all when the row ends inside the
+       * texture, even if the fixed point steps run a little past it.
+       */
+      const float steps = x2 - x1 + 1;
+      const float end_u = u + steps * s->solid.du_dx;
+      const float end_v = v + steps * s->solid.dv_dx;
+      if (end_u >= 0 && end_u < s->solid.w && end_v >= 0 && end_v < s->solid.h)
+         wrap = false;
+   }
+
+   src_pitch = texture->locked_region.pitch / 4;
+   src = (const uint32_t *)texture->locked_region.data +
+      (offset_y - texture->lock_y) * src_pitch + (offset_x - texture->lock_x);
+   dst = (uint32_t *)((uint8_t *)target->lock_data +
+      y * target->locked_region.pitch) + x1;
+
+   uu = al_ftofix(u);
+   vv = al_ftofix(v);
+   du = al_ftofix(s->solid.du_dx);
+   dv = al_ftofix(s->solid.dv_dx);
+   w = al_ftofix(s->solid.w);
+   h = al_ftofix(s->solid.h);
+
+   if (!wrap) {
+      if (x2 >= x1)
+         _al_blit_span_gather_8888(dst, src, src_pitch, uu, vv, du, dv, x2 - x1 + 1);
+      return;
+   }
+
+   while (x1 <= x2) {
+      const int n = MIN(x2 - x1 + 1, SPAN_RUN);
+
+      if (s->mode == SPAN_COPY) {
+         if (s->swap_rb) {
+            fetch_texels(s, buf, src, src_pitch, &uu, &vv, du, dv, w, h, n);
+            _al_blit_span_swap_rb_8888(dst, buf, n);
+         }
+         else {
+            fetch_texels(s, dst, src, src_pitch, &uu, &vv, du, dv, w, h, n);
+         }
+      }
+      else {
+         fetch_texels(s, buf, src, src_pitch, &uu, &vv, du, dv, w, h, n);
+         if (s->swap_rb)
+            _al_blit_span_swap_rb_8888(buf, buf, n);
+         _al_blit_span_blend_8888(dst, buf, n, s->tint);
+      }
+
+      dst += n;
+      x1 += n;
+   }
+}
+
+#undef SPAN_WRAP
+
+static bool is_span_format(int format)
+{
+   return format == ALLEGRO_PIXEL_FORMAT_ARGB_8888 ||
+      format == ALLEGRO_PIXEL_FORMAT_ABGR_8888;
+}
+
+/* Sets up s for the span drawer, or returns false if it can't draw this. */
+static bool setup_span_state(state_texture_span_2d* s, ALLEGRO_BITMAP* texture,
+   ALLEGRO_COLOR tint, int shade, int white)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   ALLEGRO_BITMAP *tex = texture->parent ? texture->parent : texture;
+   int op, src_mode, dst_mode, op_alpha, src_alpha, dst_alpha;
+   int src_format, dst_format;
+
+   if (target->parent)
+      target = target->parent;
 
+   if (!tex->locked || tex->locked_region.pixel_size != 4 ||
+         tex->locked_region.pitch % 4 != 0)
+      return false;
+   src_format = tex->locked_region.format;
+
+   if (target->locked) {
+      if (target->locked_region.pitch % 4 != 0)
+         return false;
+      dst_format = target->locked_region.format;
+   }
+   else if (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP) {
+      dst_format = al_get_bitmap_format(target);
+   }
+   else {
+      return false;
+   }
+
+   if (!is_span_format(src_format) || !is_span_format(dst_format))
+      return false;
+
+   al_get_separate_bitmap_blender(&op,
+      &src_mode, &dst_mode, &op_alpha, &src_alpha, &dst_alpha);
+
+   if (!shade && white) {
+      s->mode = SPAN_COPY;
+   }
+   else if (shade && op == ALLEGRO_ADD && src_mode == ALLEGRO_ONE &&
+         src_alpha == ALLEGRO_ONE && op_alpha == ALLEGRO_ADD &&
+         dst_mode == ALLEGRO_INVERSE_ALPHA &&
+         dst_alpha == ALLEGRO_INVERSE_ALPHA) {
+      s->mode = SPAN_BLEND;
+   }
+   else {
+      return false;
+   }
+
+   s->solid.texture = texture;
+   s->swap_rb = src_format != dst_format;
+   s->tint = NULL;
+   if (!white) {
+      /* One factor per byte of a destination pixel, lowest byte first. */
+      bool bgr = dst_format == ALLEGRO_PIXEL_FORMAT_ARGB_8888;
+      s->tint_factors[0] = bgr ? tint.b : tint.r;
+      s->tint_factors[1] = tint.g;
+      s->tint_factors[2] = bgr ? tint.r : tint.b;
+      s->tint_factors[3] = tint.a;
+      s->tint = s->tint_factors;
+   }
+   return true;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+Drawers for the common blenders. The blender is looked up once per triangle
+instead of on every row, and the blending is inlined with constant modes so
+that each drawer only does the arithmetic its preset needs. The rows of the
+usual 32-bit formats get their own loops too. Other blenders and wrap modes
+are left to the generic drawers, which give the same pixels. Opaque copying
+already has its own drawers.
+*/
+
+enum {
+   BLEND_PRESET_NONE = -1,
+   BLEND_PRESET_PREMUL,
+   BLEND_PRESET_ALPHA,
+   BLEND_PRESET_ADD,
+   BLEND_PRESET_MULTIPLY
+};
+
+static int get_blend_preset(int op, int src_mode, int dst_mode,
+   int op_alpha, int src_alpha, int dst_alpha)
+{
+   if (op != ALLEGRO_ADD || op_alpha != ALLEGRO_ADD ||
+         src_mode != src_alpha || dst_mode != dst_alpha)
+      return BLEND_PRESET_NONE;
+
+   if (src_mode == ALLEGRO_ONE && dst_mode == ALLEGRO_INVERSE_ALPHA)
+      return BLEND_PRESET_PREMUL;
+   if (src_mode == ALLEGRO_ALPHA && dst_mode == ALLEGRO_INVERSE_ALPHA)
+      return BLEND_PRESET_ALPHA;
+   if (src_mode == ALLEGRO_ONE && dst_mode == ALLEGRO_ONE)
+      return BLEND_PRESET_ADD;
+   if (src_mode == ALLEGRO_DEST_COLOR && dst_mode == ALLEGRO_ZERO)
+      return BLEND_PRESET_MULTIPLY;
+   return BLEND_PRESET_NONE;
+}
+
+static _AL_ALWAYS_INLINE void blend_preset(int preset,
+   const ALLEGRO_COLOR *src_color, const ALLEGRO_COLOR *dst_color,
+   ALLEGRO_COLOR *result)
+{
+   switch (preset) {
+      case BLEND_PRESET_PREMUL:
+         _al_blend_inline(src_color, dst_color,
+            ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA,
+            ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA, NULL, result);
+         break;
+      case BLEND_PRESET_ALPHA:
+         _al_blend_inline(src_color, dst_color,
+            ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA,
+            ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA, NULL, result);
+         break;
+      case BLEND_PRESET_ADD:
+         _al_blend_inline(src_color, dst_color,
+            ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ONE,
+            ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ONE, NULL, result);
+         break;
+      case BLEND_PRESET_MULTIPLY:
+         _al_blend_inline(src_color, dst_color,
+            ALLEGRO_ADD, ALLEGRO_DEST_COLOR, ALLEGRO_ZERO,
+            ALLEGRO_ADD, ALLEGRO_DEST_COLOR, ALLEGRO_ZERO, NULL, result);
+         break;
+   }
+}
+
+#define STEP_COLOR(c, dx, n)  \
+   c.r += dx.r * (n);         \
+   c.g += dx.g * (n);         \
+   c.b += dx.b * (n);         \
+   c.a += dx.a * (n);
+
+static _AL_ALWAYS_INLINE void flat_loop(uint8_t *dst_data, int dst_format,
+   int n, ALLEGRO_COLOR cur_color, const ALLEGRO_COLOR *color_dx, int preset)
+{
+   int i;
+
+   for (i = 0; i < n; i++) {
+      ALLEGRO_COLOR dst_color;
+      ALLEGRO_COLOR result;
+      _AL_INLINE_GET_PIXEL(dst_format, dst_data, dst_color, false);
+      blend_preset(preset, &cur_color, &dst_color, &result);
+      _AL_INLINE_PUT_PIXEL(dst_format, dst_data, result, true);
+      if (color_dx) {
+         STEP_COLOR(cur_color, (*color_dx), 1)
+      }
+   }
+}
+
+static _AL_ALWAYS_INLINE void draw_flat_row(uintptr_t state,
+   int x1, int y, int x2, bool grad, int preset)
+{
+   state_solid_any_2d *s = (state_solid_any_2d *)state;
+   const ALLEGRO_COLOR *color_dx = grad ? &((state_grad_any_2d *)state)->color_dx : NULL;
+   ALLEGRO_COLOR cur_color = s->cur_color;
+   ALLEGRO_BITMAP *target = s->target;
+   int dst_format;
+   uint8_t *dst_data;
+
+   if (target->parent) {
+      x1 += target->xofs;
+      x2 += target->xofs;
+      y += target->yofs;
+      target = target->parent;
+   }
+
+   x1 -= target->lock_x;
+   x2 -= target->lock_x;
+   y -= target->lock_y;
+   y--;
+
+   if (y < 0 || y >= target->lock_h) {
+      return;
+   }
+
+   if (x1 < 0) {
+      if (grad) {
+         STEP_COLOR(cur_color, (*color_dx), -x1)
+      }
+      x1 = 0;
+   }
+
+   if (x2 > target->lock_w - 1) {
+      x2 = target->lock_w - 1;
+   }
+
+   /* The row may lie entirely outside the locked region. */
+   if (x2 < x1) {
+      return;
+   }
+
+   dst_format = target->locked_region.format;
+   dst_data = (uint8_t *)target->lock_data + y * target->locked_region.pitch
+      + x1 * target->locked_region.pixel_size;
+
+   if (!grad && preset == BLEND_PRESET_PREMUL && is_span_format(dst_format)) {
+      /* Opaque white texels tinted by the colour are exactly the colour, so
+       * the span blender can do these rows.
+       */
+      bool bgr = dst_format == ALLEGRO_PIXEL_FORMAT_ARGB_8888;
+      float factors[4];
+      uint32_t ones[SPAN_RUN];
+      int n = x2 - x1 + 1;
+
+      factors[0] = bgr ? cur_color.b : cur_color.r;
+      factors[1] = cur_color.g;
+      factors[2] = bgr ? cur_color.r : cur_color.b;
+      factors[3] = cur_color.a;
+      memset(ones, 0xff, sizeof(ones[0]) * MIN(n, SPAN_RUN));
+      while (n > 0) {
+         int run = MIN(n, SPAN_RUN);
+         _al_blit_span_blend_8888((uint32_t *)dst_data, ones, run, factors);
+         dst_data += run * 4;
+         n -= run;
+      }
+      return;
+   }
+
+   switch (dst_format) {
+      case ALLEGRO_PIXEL_FORMAT_ARGB_8888:
+         flat_loop(dst_data, ALLEGRO_PIXEL_FORMAT_ARGB_8888, x2 - x1 + 1,
+            cur_color, color_dx, preset);
+         break;
+      case ALLEGRO_PIXEL_FORMAT_ABGR_8888:
+         flat_loop(dst_data, ALLEGRO_PIXEL_FORMAT_ABGR_8888, x2 - x1 + 1,
+            cur_color, color_dx, preset);
+         break;
+      default:
+         flat_loop(dst_data, dst_format, x2 - x1 + 1,
+            cur_color, color_dx, preset);
+         break;
+   }
+}
+
+typedef struct {
+   const uint8_t *lock_data;
+   int src_pitch;
+   int uu_ofs, vv_ofs;
+   al_fixed uu, vv, du_dx, dv_dx, w, h;
+} texture_walk;
+
+static _AL_ALWAYS_INLINE void texture_loop(const texture_walk *t,
+   uint8_t *dst_data, int dst_format, int src_format, int src_size, int n,
+   ALLEGRO_COLOR cur_color, const ALLEGRO_COLOR *color_dx, bool white,
+   int preset)
+{
+   al_fixed uu = t->uu;
+   al_fixed vv = t->vv;
+   int i;
+
+   for (i = 0; i < n; i++) {
+      const int src_x = (uu >> 16) + t->uu_ofs;
+      const int src_y = (vv >> 16) + t->vv_ofs;
+      const uint8_t *src_data = t->lock_data + src_y * t->src_pitch + src_x * src_size;
+      ALLEGRO_COLOR src_color;
+      ALLEGRO_COLOR dst_color;
+      ALLEGRO_COLOR result;
+
+      _AL_INLINE_GET_PIXEL(src_format, src_data, src_color, false);
+      if (!white) {
+         SHADE_COLORS(src_color, cur_color);
+      }
+      _AL_INLINE_GET_PIXEL(dst_format, dst_data, dst_color, false);
+      blend_preset(preset, &src_color, &dst_color, &result);
+      _AL_INLINE_PUT_PIXEL(dst_format, dst_data, result, true);
+
+      uu += t->du_dx;
+      vv += t->dv_dx;
+      if (_AL_EXPECT_FAIL(uu < 0))
+         uu += t->w;
+      else if (_AL_EXPECT_FAIL(uu >= t->w))
+         uu -= t->w;
+      if (_AL_EXPECT_FAIL(vv < 0))
+         vv += t->h;
+      else if (_AL_EXPECT_FAIL(vv >= t->h))
+         vv -= t->h;
+
+      if (color_dx) {
+         STEP_COLOR(cur_color, (*color_dx), 1)
+      }
+   }
+}
+
+/* Only for repeating textures. */
+static _AL_ALWAYS_INLINE void draw_texture_row(uintptr_t state,
+   int x1, int y, int x2, bool grad, bool white, int preset)
+{
+   state_texture_solid_any_2d *s = (state_texture_solid_any_2d *)state;
+   const ALLEGRO_COLOR *color_dx = grad ? &((state_texture_grad_any_2d *)state)->color_dx : NULL;
+   ALLEGRO_COLOR cur_color = s->cur_color;
+   ALLEGRO_BITMAP *target = s->target;
+   ALLEGRO_BITMAP *texture = s->texture;
+   int offset_x = 0, offset_y = 0;
+   float u = s->u;
+   float v = s->v;
+   int src_format, dst_format, n;
+   uint8_t *dst_data;
+   texture_walk t;
+
+   if (target->parent) {
+      x1 += target->xofs;
+      x2 += target->xofs;
+      y += target->yofs;
+      target = target->parent;
+   }
+
+   x1 -= target->lock_x;
+   x2 -= target->lock_x;
+   y -= target->lock_y;
+   y--;
+
+   if (y < 0 || y >= target->lock_h) {
+      return;
+   }
+
+   if (x1 < 0) {
+      u += s->du_dx * -x1;
+      v += s->dv_dx * -x1;
+      if (grad) {
+         STEP_COLOR(cur_color, (*color_dx), -x1)
+      }
+      x1 = 0;
+   }
+
+   if (x2 > target->lock_w - 1) {
+      x2 = target->lock_w - 1;
+   }
+
+   if (texture->parent) {
+      offset_x = texture->xofs;
+      offset_y = texture->yofs;
+      texture = texture->parent;
+   }
+
+   /* Ensure u in [0, s->w) and v in [0, s->h). */
+   while (u < 0)
+      u += s->w;
+   while (v < 0)
+      v += s->h;
+   u = fmodf(u, s->w);
+   v = fmodf(v, s->h);
+
+   t.lock_data = texture->locked_region.data;
+   t.src_pitch = texture->locked_region.pitch;
+   t.uu_ofs = offset_x - texture->lock_x;
+   t.vv_ofs = offset_y - texture->lock_y;
+   t.uu = al_ftofix(u);
+   t.vv = al_ftofix(v);
+   t.du_dx = al_ftofix(s->du_dx);
+   t.dv_dx = al_ftofix(s->dv_dx);
+   t.w = al_ftofix(s->w);
+   t.h = al_ftofix(s->h);
+
+   src_format = texture->locked_region.format;
+   dst_format = target->locked_region.format;
+   dst_data = (uint8_t *)target->lock_data + y * target->locked_region.pitch
+      + x1 * target->locked_region.pixel_size;
+   n = x2 - x1 + 1;
+
+   if (src_format == ALLEGRO_PIXEL_FORMAT_ARGB_8888 &&
+         dst_format == ALLEGRO_PIXEL_FORMAT_ARGB_8888) {
+      texture_loop(&t, dst_data, ALLEGRO_PIXEL_FORMAT_ARGB_8888,
+         ALLEGRO_PIXEL_FORMAT_ARGB_8888, 4, n, cur_color, color_dx, white,
+         preset);
+   }
+   else if (src_format == ALLEGRO_PIXEL_FORMAT_ABGR_8888 &&
+         dst_format == ALLEGRO_PIXEL_FORMAT_ABGR_8888) {
+      texture_loop(&t, dst_data, ALLEGRO_PIXEL_FORMAT_ABGR_8888,
+         ALLEGRO_PIXEL_FORMAT_ABGR_8888, 4, n, cur_color, color_dx, white,
+         preset);
+   }
+   else {
+      texture_loop(&t, dst_data, dst_format, src_format,
+         texture->locked_region.pixel_size, n, cur_color, color_dx, white,
+         preset);
+   }
+}
+
+#undef STEP_COLOR
+
+#define MAKE_BLEND_DRAWERS(NAME, PRESET)                                      \
+static void shader_solid_any_draw_##NAME(uintptr_t state,                     \
+   int x1, int y, int x2)                                                     \
+{                                                                             \
+   draw_flat_row(state, x1, y, x2, false, PRESET);                            \
+}                                                                             \
+                                                                              \
+static void shader_grad_any_draw_##NAME(uintptr_t state,                      \
+   int x1, int y, int x2)                                                     \
+{                                                                             \
+   draw_flat_row(state, x1, y, x2, true, PRESET);                             \
+}                                                                             \
+                                                                              \
+static void shader_texture_solid_any_draw_##NAME##_white_repeat(              \
+   uintptr_t state, int x1, int y, int x2)                                    \
+{                                                                             \
+   draw_texture_row(state, x1, y, x2, false, true, PRESET);                   \
+}                                                                             \
+                                                                              \
+static void shader_texture_solid_any_draw_##NAME##_repeat(uintptr_t state,    \
+   int x1, int y, int x2)                                                     \
+{                                                                             \
+   draw_texture_row(state, x1, y, x2, false, false, PRESET);                  \
+}                                                                             \
+                                                                              \
+static void shader_texture_grad_any_draw_##NAME##_repeat(uintptr_t state,     \
+   int x1, int y, int x2)                                                     \
+{                                                                             \
+   draw_texture_row(state, x1, y, x2, true, false, PRESET);                   \
+}
+
+MAKE_BLEND_DRAWERS(premul, BLEND_PRESET_PREMUL)
+MAKE_BLEND_DRAWERS(alpha, BLEND_PRESET_ALPHA)
+MAKE_BLEND_DRAWERS(add, BLEND_PRESET_ADD)
+MAKE_BLEND_DRAWERS(multiply, BLEND_PRESET_MULTIPLY)
+
+#undef MAKE_BLEND_DRAWERS
+
+typedef struct {
+   shader_draw solid;
+   shader_draw grad;
+   shader_draw texture_solid_white;
+   shader_draw texture_solid;
+   shader_draw texture_grad;
+} blend_drawers;
+
+#define BLEND_DRAWERS(NAME) {                                                 \
+   shader_solid_any_draw_##NAME,                                              \
+   shader_grad_any_draw_##NAME,                                               \
+   shader_texture_solid_any_draw_##NAME##_white_repeat,                       \
+   shader_texture_solid_any_draw_##NAME##_repeat,                             \
+   shader_texture_grad_any_draw_##NAME##_repeat                               \
+}
+
+/* Indexed by BLEND_PRESET_*. */
+static const blend_drawers preset_drawers[] = {
+   BLEND_DRAWERS(premul),
+   BLEND_DRAWERS(alpha),
+   BLEND_DRAWERS(add),
+   BLEND_DRAWERS(multiply)
+};
+
+#undef BLEND_DRAWERS
+
+/* The scanline drawers put the row at y - 1. */
+#define IN_BAND(y)   ((y) - 1 >= band_y1 && (y) - 1 < band_y2)
+#define PAST_BAND(y) ((y) - 1 >= band_y2)
+
+
+/*
+Only the rows in [band_y1, band_y2) are drawn, the edges are still walked from
+the top so that the shader state is the same as when drawing everything.
+*/
 static void triangle_stepper(uintptr_t state,
    shader_init init, shader_first first, shader_step step, shader_draw draw,
-   ALLEGRO_VERTEX* vtx1, ALLEGRO_VERTEX* vtx2, ALLEGRO_VERTEX* vtx3)
+   ALLEGRO_VERTEX* vtx1, ALLEGRO_VERTEX* vtx2, ALLEGRO_VERTEX* vtx3,
+   int band_y1, int band_y2)
 {
    float Coords[6] = {vtx1->x - 0.5f, vtx1->y + 0.5f, vtx2->x - 0.5f, vtx2->y + 0.5f, vtx3->x - 0.5f, vtx3->y + 0.5f};
    float *V1 = Coords, *V2 = &Coords[2], *V3 = &Coords[4], *s;
@@ -555,7 +1222,7 @@ static void triangle_stepper(uintptr_t state,
 
          first(state, left_x, cur_y, left_step, left_step - 1);
 
-         if (right_x >= left_x) {
+         if (right_x >= left_x && IN_BAND(cur_y)) {
             draw(state, left_x, cur_y, right_x);
          }
 
@@ -568,6 +1235,9 @@ static void triangle_stepper(uintptr_t state,
       ...and then continue taking normal steps until we finish the segment
       */
       while (cur_y < mid_y) {
+         if (PAST_BAND(cur_y))
+            return;
+
          left_error += left_d_er;
          left_x += left_step;
 
@@ -591,7 +1261,7 @@ static void triangle_stepper(uintptr_t state,
             right_x -= 1;
          }
 
-         if (right_x >= left_x) {
+         if (right_x >= left_x && IN_BAND(cur_y)) {
             draw(state, left_x, cur_y, right_x);
          }
 
@@ -645,7 +1315,7 @@ static void triangle_stepper(uintptr_t state,
 
          first(state, left_x, cur_y, left_step, left_step - 1);
 
-         if (right_x >= left_x) {
+         if (right_x >= left_x && IN_BAND(cur_y)) {
             draw(state, left_x, cur_y, right_x);
          }
 
@@ -655,6 +1325,9 @@ static void triangle_stepper(uintptr_t state,
       }
 
       while (cur_y < end_y) {
+         if (PAST_BAND(cur_y))
+            return;
+
          left_error += left_d_er;
          left_x += left_step;
 
@@ -673,7 +1346,7 @@ static void triangle_stepper(uintptr_t state,
             right_x -= 1;
          }
 
-         if (right_x >= left_x) {
+         if (right_x >= left_x && IN_BAND(cur_y)) {
             draw(state, left_x, cur_y, right_x);
          }
 
@@ -684,15 +1357,23 @@ static void triangle_stepper(uintptr_t state,
    }
 }
 
+static void draw_soft_triangle(
+   ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3,
+   int band_y1, int band_y2, uintptr_t state,
+   shader_init init, shader_first first, shader_step step, shader_draw draw);
+
 /*
 This one will check to see what exactly we need to draw...
 I.e. this will call all of the actual renderers and set the appropriate callbacks
 */
-void _al_triangle_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3)
+static void triangle_2d(ALLEGRO_BITMAP* texture,
+   ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3,
+   int band_y1, int band_y2)
 {
    int shade = 1;
    int grad = 1;
    int op, src_mode, dst_mode, op_alpha, src_alpha, dst_alpha;
+   int preset;
    ALLEGRO_COLOR v1c, v2c, v3c;
 
    v1c = v1->color;
@@ -704,6 +1385,7 @@ void _al_triangle_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX
    if (_AL_DEST_IS_ZERO && _AL_SRC_NOT_MODIFIED) {
       shade = 0;
    }
+   preset = get_blend_preset(op, src_mode, dst_mode, op_alpha, src_alpha, dst_alpha);
 
    if ((v1c.r == v2c.r && v2c.r == v3c.r) &&
          (v1c.g == v2c.g && v2c.g == v3c.g) &&
@@ -727,60 +1409,80 @@ void _al_triangle_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX
          state_texture_grad_any_2d state;
          state.solid.texture = texture;
 
-         if (shade) {
-            _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_grad_any_init, shader_texture_grad_any_first, shader_texture_grad_any_step, shader_texture_grad_any_draw_shade);
+         if (shade && repeat && preset != BLEND_PRESET_NONE) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_grad_any_init, shader_texture_grad_any_first, shader_texture_grad_any_step, preset_drawers[preset].texture_grad);
+         } else if (shade) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_grad_any_init, shader_texture_grad_any_first, shader_texture_grad_any_step, shader_texture_grad_any_draw_shade);
          } else {
-            _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_grad_any_init, shader_texture_grad_any_first, shader_texture_grad_any_step, shader_texture_grad_any_draw_opaque);
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_grad_any_init, shader_texture_grad_any_first, shader_texture_grad_any_step, shader_texture_grad_any_draw_opaque);
          }
       } else {
          int white = 0;
          state_texture_solid_any_2d state;
+         state_texture_span_2d span;
 
          if (v1c.r == 1 && v1c.g == 1 && v1c.b == 1 && v1c.a == 1) {
             white = 1;
          }
          state.texture = texture;
-         if (shade) {
+         if (repeat && setup_span_state(&span, texture, v1c, shade, white)) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&span, shader_texture_span_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_span_draw);
+         } else if (shade && repeat && preset != BLEND_PRESET_NONE) {
+            if (white) {
+               draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, preset_drawers[preset].texture_solid_white);
+            } else {
+               draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, preset_drawers[preset].texture_solid);
+            }
+         } else if (shade) {
             if (white) {
                if (repeat) {
-                  _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade_white_repeat);
+                  draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade_white_repeat);
                } else {
-                  _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade_white);
+                  draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade_white);
                }
             } else {
                if (repeat) {
-                  _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade_repeat);
+                  draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade_repeat);
                } else {
-                  _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade);
+                  draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_shade);
                }
             }
          } else {
             if (white) {
-               _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_opaque_white);
+               draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_opaque_white);
             } else {
-               _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_opaque);
+               draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_texture_solid_any_init, shader_texture_solid_any_first, shader_texture_solid_any_step, shader_texture_solid_any_draw_opaque);
             }
          }
       }
    } else {
       if (grad) {
          state_grad_any_2d state;
-         if (shade) {
-            _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_grad_any_init, shader_grad_any_first, shader_grad_any_step, shader_grad_any_draw_shade);
+         if (shade && preset != BLEND_PRESET_NONE) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_grad_any_init, shader_grad_any_first, shader_grad_any_step, preset_drawers[preset].grad);
+         } else if (shade) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_grad_any_init, shader_grad_any_first, shader_grad_any_step, shader_grad_any_draw_shade);
          } else {
-            _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_grad_any_init, shader_grad_any_first, shader_grad_any_step, shader_grad_any_draw_opaque);
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_grad_any_init, shader_grad_any_first, shader_grad_any_step, shader_grad_any_draw_opaque);
          }
       } else {
          state_solid_any_2d state;
-         if (shade) {
-            _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_solid_any_init, shader_solid_any_first, shader_solid_any_step, shader_solid_any_draw_shade);
+         if (shade && preset != BLEND_PRESET_NONE) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_solid_any_init, shader_solid_any_first, shader_solid_any_step, preset_drawers[preset].solid);
+         } else if (shade) {
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_solid_any_init, shader_solid_any_first, shader_solid_any_step, shader_solid_any_draw_shade);
          } else {
-            _al_draw_soft_triangle(v1, v2, v3, (uintptr_t)&state, shader_solid_any_init, shader_solid_any_first, shader_solid_any_step, shader_solid_any_draw_opaque);
+            draw_soft_triangle(v1, v2, v3, band_y1, band_y2, (uintptr_t)&state, shader_solid_any_init, shader_solid_any_first, shader_solid_any_step, shader_solid_any_draw_opaque);
          }
       }
    }
 }
 
+void _al_triangle_2d(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3)
+{
+   triangle_2d(texture, v1, v2, v3, INT_MIN, INT_MAX);
+}
+
 static int bitmap_region_is_locked(ALLEGRO_BITMAP* bmp, int x1, int y1, int w, int h)
 {
    ASSERT(bmp);
@@ -792,12 +1494,10 @@ static int bitmap_region_is_locked(ALLEGRO_BITMAP* bmp, int x1, int y1, int w, i
    return 0;
 }
 
-void _al_draw_soft_triangle(
-   ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3, uintptr_t state,
-   void (*init)(uintptr_t, ALLEGRO_VERTEX*, ALLEGRO_VERTEX*, ALLEGRO_VERTEX*),
-   void (*first)(uintptr_t, int, int, int, int),
-   void (*step)(uintptr_t, int),
-   void (*draw)(uintptr_t, int, int, int))
+static void draw_soft_triangle(
+   ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3,
+   int band_y1, int band_y2, uintptr_t state,
+   shader_init init, shader_first first, shader_step step, shader_draw draw)
 {
    /*
    ALLEGRO_VERTEX copy_v1, copy_v2; <- may be needed for clipping later on
@@ -830,6 +1530,9 @@ void _al_draw_soft_triangle(
    max_x = (int)ceilf(MAX(vtx1->x, MAX(vtx2->x, vtx3->x))) + 1;
    max_y = (int)ceilf(MAX(vtx1->y, MAX(vtx2->y, vtx3->y))) + 1;
 
+   if (min_y >= band_y2 || max_y < band_y1)
+      return;
+
    /*
    TODO: This bit is temporary, the min max's will be guaranteed to be within the bitmap
    once clipping is implemented
@@ -848,7 +1551,15 @@ void _al_draw_soft_triangle(
    if (min_y < clip_min_y)
       min_y = clip_min_y;
 
-   if (al_is_bitmap_locked(target)) {
+   /* Locking a sub-bitmap locks its parent, as _al_draw_soft_triangles
+    * does for the bands of a batch, and the drawers write to the parent.
+    */
+   if (target->parent && al_is_bitmap_locked(target->parent)) {
+      if (!bitmap_region_is_locked(target->parent, min_x + target->xofs,
+            min_y + target->yofs, max_x - min_x, max_y - min_y) ||
+          _al_pixel_format_is_video_only(target->parent->locked_region.format))
+         return;
+   } else if (al_is_bitmap_locked(target)) {
       if (!bitmap_region_is_locked(target, min_x, min_y, max_x - min_x, max_y - min_y) ||
           _al_pixel_format_is_video_only(target->locked_region.format))
          return;
@@ -858,10 +1569,187 @@ void _al_draw_soft_triangle(
       need_unlock = 1;
    }
 
-   triangle_stepper(state, init, first, step, draw, v1, v2, v3);
+   triangle_stepper(state, init, first, step, draw, v1, v2, v3, band_y1, band_y2);
 
    if (need_unlock)
       al_unlock_bitmap(target);
 }
 
+void _al_draw_soft_triangle(
+   ALLEGRO_VERTEX* v1, ALLEGRO_VERTEX* v2, ALLEGRO_VERTEX* v3, uintptr_t state,
+   void (*init)(uintptr_t, ALLEGRO_VERTEX*, ALLEGRO_VERTEX*, ALLEGRO_VERTEX*),
+   void (*first)(uintptr_t, int, int, int, int),
+   void (*step)(uintptr_t, int),
+   void (*draw)(uintptr_t, int, int, int))
+{
+   draw_soft_triangle(v1, v2, v3, INT_MIN, INT_MAX, state, init, first, step, draw);
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+Batches of triangles drawn to a memory bitmap are split into horizontal bands
+of the target, which are shaded in parallel. The bands are the tiles: the
+scanline drawers work a row at a time, so cutting the target by rows lets each
+thread reuse them unchanged. Every band draws all of the triangles in order,
+clipped to its rows. Since no two threads touch the same pixel, the result is
+the same as drawing the batch serially.
+
+The target is locked once for the whole batch by the calling thread.
+*/
+#define MIN_BAND_ROWS    32
+#define BANDS_PER_THREAD 2
+
+typedef struct TRI_BATCH {
+   ALLEGRO_BITMAP *texture;
+   ALLEGRO_BITMAP *target;
+   ALLEGRO_VERTEX *vtx;
+   const int *indices;
+   int num_triangles;
+
+   int op, src_mode, dst_mode;
+   int op_alpha, src_alpha, dst_alpha;
+   ALLEGRO_COLOR blend_color;
+
+   int y1, band_h;
+} TRI_BATCH;
+
+
+static void draw_band(TRI_BATCH *batch, int band)
+{
+   int y1 = batch->y1 + band * batch->band_h;
+   int y2 = y1 + batch->band_h;
+   int ii;
+
+   for (ii = 0; ii < batch->num_triangles; ii++) {
+      const int *idx = &batch->indices[ii * 3];
+      ALLEGRO_VERTEX *v1 = &batch->vtx[idx[0]];
+      ALLEGRO_VERTEX *v2 = &batch->vtx[idx[1]];
+      ALLEGRO_VERTEX *v3 = &batch->vtx[idx[2]];
+
+      /* Skip the shader setup for triangles outside of the band, with the
+       * same bounds as draw_soft_triangle.
+       */
+      if ((int)floorf(MIN(v1->y, MIN(v2->y, v3->y))) - 1 >= y2 ||
+            (int)ceilf(MAX(v1->y, MAX(v2->y, v3->y))) + 1 < y1)
+         continue;
+
+      triangle_2d(batch->texture, v1, v2, v3, y1, y2);
+   }
+}
+
+
+static void draw_bands(int begin, int end, void *arg)
+{
+   TRI_BATCH *batch = arg;
+   ALLEGRO_STATE state;
+   int band;
+
+   if (al_get_target_bitmap() == batch->target) {
+      for (band = begin; band < end; band++)
+         draw_band(batch, band);
+      return;
+   }
+
+   /* On a worker thread, or on a thread which picked up the bands while
+    * waiting for jobs of its own. The shaders and the blender read their
+    * state from the TLS, so mirror the calling thread's, and put back what
+    * was there before, so that a waiting thread keeps its own target and a
+    * worker keeps no target which may be destroyed.
+    */
+   al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+   al_set_target_bitmap(batch->target);
+   al_set_separate_blender(batch->op, batch->src_mode, batch->dst_mode,
+      batch->op_alpha, batch->src_alpha, batch->dst_alpha);
+   al_set_blend_color(batch->blend_color);
+   for (band = begin; band < end; band++)
+      draw_band(batch, band);
+   al_restore_state(&state);
+}
+
+
+static void draw_triangles_serial(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* vtx,
+   const int* indices, int num_triangles)
+{
+   int ii;
+
+   for (ii = 0; ii < num_triangles; ii++) {
+      const int *idx = &indices[ii * 3];
+      _al_triangle_2d(texture, &vtx[idx[0]], &vtx[idx[1]], &vtx[idx[2]]);
+   }
+}
+
+
+void _al_draw_soft_triangles(ALLEGRO_BITMAP* texture, ALLEGRO_VERTEX* vtx,
+   const int* indices, int num_triangles)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   TRI_BATCH batch;
+   float fmin_x, fmin_y, fmax_x, fmax_y;
+   int min_x, max_x, min_y, max_y;
+   int clip_min_x, clip_min_y, clip_max_x, clip_max_y;
+   ALLEGRO_JOB_POOL *pool;
+   int num_threads, num_bands;
+   int ii;
+
+   if (num_triangles <= 0)
+      return;
+
+   pool = _al_get_job_pool();
+   num_threads = pool ? al_get_job_pool_workers(pool) : 1;
+   if (!(al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP) ||
+         al_is_bitmap_locked(target) || num_threads < 2) {
+      draw_triangles_serial(texture, vtx, indices, num_triangles);
+      return;
+   }
+
+   fmin_x = fmax_x = vtx[indices[0]].x;
+   fmin_y = fmax_y = vtx[indices[0]].y;
+   for (ii = 1; ii < num_triangles * 3; ii++) {
+      const ALLEGRO_VERTEX *v = &vtx[indices[ii]];
+      fmin_x = MIN(fmin_x, v->x);
+      fmin_y = MIN(fmin_y, v->y);
+      fmax_x = MAX(fmax_x, v->x);
+      fmax_y = MAX(fmax_y, v->y);
+   }
+
+   /* The same bounds as draw_soft_triangle uses for each triangle. */
+   al_get_clipping_rectangle(&clip_min_x, &clip_min_y, &clip_max_x, &clip_max_y);
+   clip_max_x += clip_min_x;
+   clip_max_y += clip_min_y;
+   min_x = MAX((int)floorf(fmin_x) - 1, clip_min_x);
+   min_y = MAX((int)floorf(fmin_y) - 1, clip_min_y);
+   max_x = MIN((int)ceilf(fmax_x) + 1, clip_max_x);
+   max_y = MIN((int)ceilf(fmax_y) + 1, clip_max_y);
+   if (min_x >= max_x || min_y >= max_y)
+      return;
+
+   num_bands = (max_y - min_y) / MIN_BAND_ROWS;
+   if (num_bands > num_threads * BANDS_PER_THREAD)
+      num_bands = num_threads * BANDS_PER_THREAD;
+   if (num_bands < 2) {
+      draw_triangles_serial(texture, vtx, indices, num_triangles);
+      return;
+   }
+
+   if (!al_lock_bitmap_region(target, min_x, min_y, max_x - min_x,
+         max_y - min_y, ALLEGRO_PIXEL_FORMAT_ANY, 0))
+      return;
+
+   batch.texture = texture;
+   batch.target = target;
+   batch.vtx = vtx;
+   batch.indices = indices;
+   batch.num_triangles = num_triangles;
+   al_get_separate_blender(&batch.op, &batch.src_mode, &batch.dst_mode,
+      &batch.op_alpha, &batch.src_alpha, &batch.dst_alpha);
+   batch.blend_color = al_get_blend_color();
+   batch.y1 = min_y;
+   batch.band_h = (max_y - min_y + num_bands - 1) / num_bands;
+
+   al_parallel_for(pool, 0, num_bands, 1, draw_bands, &batch);
+
+   al_unlock_bitmap(target);
+}
+
 /* vim: set sts=3 sw=3 et: */
@@ -20,10 +20,11 @@
  */
 
 
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <unistd.h>
 
 #include "allegro5/allegro.h"
@@ -32,6 +33,18 @@
 #include "allegro5/internal/aintern_vector.h"
 #include "allegro5/platform/aintunix.h"
 
+/* With epoll the fds stay registered with the kernel between waits and
+ * are edge-triggered, so a fd which keeps receiving data does not cost
+ * any more than one wakeup per batch. Elsewhere we fall back to select(),
+ * rebuilding the fd set on every wakeup.
+ */
+#ifdef ALLEGRO_HAVE_SYS_EPOLL_H
+   #define USE_EPOLL
+   #include <sys/epoll.h>
+#else
+   #include <sys/select.h>
+#endif
+
 
 
 typedef struct WATCH_ITEM
@@ -42,9 +55,107 @@ typedef struct WATCH_ITEM
 } WATCH_ITEM;
 
 
+/* The most fds handled per wakeup. */
+#define MAX_READY_FDS   16
+
 static _AL_THREAD fd_watch_thread;
 static _AL_MUTEX fd_watch_mutex = _AL_MUTEX_UNINITED;
+static _AL_COND fd_watch_cond;
 static _AL_VECTOR fd_watch_list = _AL_VECTOR_INITIALIZER(WATCH_ITEM);
+static int running_fd = -1;      /* fd whose callback is running */
+static int wake_pipe[2] = { -1, -1 };
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+#endif
+
+
+
+/* find_watch_item:
+ *  Return the watch item for fd, or NULL. The mutex must be locked.
+ */
+static WATCH_ITEM *find_watch_item(int fd, unsigned int *index)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
+      WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+      if (wi->fd == fd) {
+         if (index)
+            *index = i;
+         return wi;
+      }
+   }
+
+   return NULL;
+}
+
+
+
+/* drain_wake_pipe: [fdwatch thread]
+ *  Read off the bytes written to wake the thread up.
+ */
+static void drain_wake_pipe(void)
+{
+   char buf[16];
+
+   while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+   }
+}
+
+
+
+/* wait_for_ready_fds: [fdwatch thread]
+ *  Block until one or more of the watched fds, or the wake pipe, have
+ *  data. Returns the number of watched fds stored in ready_fds.
+ */
+static int wait_for_ready_fds(int ready_fds[MAX_READY_FDS])
+{
+   int num_ready = 0;
+
+#ifdef USE_EPOLL
+   struct epoll_event events[MAX_READY_FDS];
+   int n, i;
+
+   n = epoll_wait(epoll_fd, events, MAX_READY_FDS, -1);
+   for (i = 0; i < n; i++) {
+      if (events[i].data.fd == wake_pipe[0])
+         drain_wake_pipe();
+      else
+         ready_fds[num_ready++] = events[i].data.fd;
+   }
+#else
+   fd_set rfds;
+   int max_fd = wake_pipe[0];
+   unsigned int i;
+
+   FD_ZERO(&rfds);
+   FD_SET(wake_pipe[0], &rfds);
+
+   _al_mutex_lock(&fd_watch_mutex);
+   for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
+      WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+      FD_SET(wi->fd, &rfds);
+      if (wi->fd > max_fd)
+         max_fd = wi->fd;
+   }
+   _al_mutex_unlock(&fd_watch_mutex);
+
+   if (select(max_fd+1, &rfds, NULL, NULL, NULL) < 1)
+      return 0;
+   if (FD_ISSET(wake_pipe[0], &rfds))
+      drain_wake_pipe();
+
+   _al_mutex_lock(&fd_watch_mutex);
+   for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
+      WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+      if (FD_ISSET(wi->fd, &rfds) && num_ready < MAX_READY_FDS)
+         ready_fds[num_ready++] = wi->fd;
+   }
+   _al_mutex_unlock(&fd_watch_mutex);
+#endif
+
+   return num_ready;
+}
 
 
 
@@ -55,60 +166,104 @@ static void fd_watch_thread_func(_AL_THREAD *self, void *unused)
 {
    (void)unused;
 
+   _al_thread_set_name(self, "al-fd-watch");
+
    while (!_al_get_thread_should_stop(self)) {
+      int ready_fds[MAX_READY_FDS];
+      int num_ready;
+      int i;
 
-      fd_set rfds;
-      int max_fd;
+      num_ready = wait_for_ready_fds(ready_fds);
 
-      /* set up max_fd and rfds */
-      _al_mutex_lock(&fd_watch_mutex);
-      {
+      for (i = 0; i < num_ready; i++) {
          WATCH_ITEM *wi;
-         unsigned int i;
+         void (*callback)(void *) = NULL;
+         void *cb_data = NULL;
+
+         /* The fd may have stopped being watched since the wait. */
+         _al_mutex_lock(&fd_watch_mutex);
+         wi = find_watch_item(ready_fds[i], NULL);
+         if (wi) {
+            callback = wi->callback;
+            cb_data = wi->cb_data;
+            running_fd = wi->fd;
+         }
+         _al_mutex_unlock(&fd_watch_mutex);
 
-         FD_ZERO(&rfds);
-         max_fd = -1;
+         if (!callback)
+            continue;
 
-         for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
-            wi = _al_vector_ref(&fd_watch_list, i);
-            FD_SET(wi->fd, &rfds);
-            if (wi->fd > max_fd)
-               max_fd = wi->fd;
-         }
+         /* The callback runs unlocked, so it may modify the watch list.
+          * _al_unix_stop_watching_fd waits for it to return if it is
+          * stopping this fd from another thread.
+          */
+         callback(cb_data);
+
+         _al_mutex_lock(&fd_watch_mutex);
+         running_fd = -1;
+         _al_cond_broadcast(&fd_watch_cond);
+         _al_mutex_unlock(&fd_watch_mutex);
       }
-      _al_mutex_unlock(&fd_watch_mutex);
+   }
+}
 
-      /* wait for something to happen on one of the fds */
-      {
-         struct timeval tv;
-         int retval;
 
-         tv.tv_sec = 0;
-         tv.tv_usec = 250000;
 
-         retval = select(max_fd+1, &rfds, NULL, NULL, &tv);
-         if (retval < 1)
-            continue;
-      }
+/* start_thread: [primary thread]
+ *  Set up the wake pipe and the epoll instance, and start the thread.
+ */
+static bool start_thread(void)
+{
+   if (pipe(wake_pipe) != 0)
+      return false;
+   fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+
+#ifdef USE_EPOLL
+   epoll_fd = epoll_create(MAX_READY_FDS);
+   if (epoll_fd == -1) {
+      close(wake_pipe[0]);
+      close(wake_pipe[1]);
+      return false;
+   }
+   {
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.fd = wake_pipe[0];
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev);
+   }
+#endif
 
-      /* one or more of the fds has activity */
-      _al_mutex_lock(&fd_watch_mutex);
-      {
-         WATCH_ITEM *wi;
-         unsigned int i;
-
-         for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
-            wi = _al_vector_ref(&fd_watch_list, i);
-            if (FD_ISSET(wi->fd, &rfds)) {
-               /* The callback is allowed to modify the watch list so the mutex
-                * must be recursive.
-                */
-               wi->callback(wi->cb_data);
-            }
-         }
-      }
-      _al_mutex_unlock(&fd_watch_mutex);
+   _al_mutex_init(&fd_watch_mutex);
+   _al_cond_init(&fd_watch_cond);
+   _al_thread_create(&fd_watch_thread, fd_watch_thread_func, NULL);
+   return true;
+}
+
+
+
+/* stop_thread: [primary thread]
+ *  Stop the thread and undo start_thread.
+ */
+static void stop_thread(void)
+{
+   char c = 0;
+
+   _al_thread_set_should_stop(&fd_watch_thread);
+   while (write(wake_pipe[1], &c, 1) < 0 && errno == EINTR) {
    }
+   _al_thread_join(&fd_watch_thread);
+
+#ifdef USE_EPOLL
+   close(epoll_fd);
+   epoll_fd = -1;
+#endif
+   close(wake_pipe[0]);
+   close(wake_pipe[1]);
+   wake_pipe[0] = wake_pipe[1] = -1;
+
+   _al_cond_destroy(&fd_watch_cond);
+   _al_mutex_destroy(&fd_watch_mutex);
+   _al_vector_free(&fd_watch_list);
 }
 
 
@@ -118,7 +273,10 @@ static void fd_watch_thread_func(_AL_THREAD *self, void *unused)
  *  Start watching for data on file descriptor `fd'.  This is done in
  *  a background thread, which is started if necessary.  When there is
  *  data waiting to be read on fd, `callback' is applied to `cb_data'.
- *  The callback function should read as much data off fd as possible.
+ *
+ *  The callback is only called again once more data arrives, so it
+ *  must read all the data off fd, until read() fails with EAGAIN.  The
+ *  fd must therefore be non-blocking.
  *
  *  Note: the callback is run from the background thread.  You can
  *  assume there is only one callback being called from the fdwatch
@@ -131,11 +289,8 @@ void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
 
    /* start the background thread if necessary */
    if (_al_vector_size(&fd_watch_list) == 0) {
-      /* We need a recursive mutex to allow callbacks to modify the fd watch
-       * list.
-       */
-      _al_mutex_init_recursive(&fd_watch_mutex);
-      _al_thread_create(&fd_watch_thread, fd_watch_thread_func, NULL);
+      if (!start_thread())
+         return;
    }
 
    /* now add the watch item to the list */
@@ -146,6 +301,22 @@ void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
       wi->fd = fd;
       wi->callback = callback;
       wi->cb_data = cb_data;
+
+#ifdef USE_EPOLL
+      {
+         struct epoll_event ev;
+         ev.events = EPOLLIN | EPOLLET;
+         ev.data.fd = fd;
+         epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+      }
+#else
+      {
+         /* Interrupt select() so that it picks up the new fd. */
+         char c = 0;
+         while (write(wake_pipe[1], &c, 1) < 0 && errno == EINTR) {
+         }
+      }
+#endif
    }
    _al_mutex_unlock(&fd_watch_mutex);
 }
@@ -157,7 +328,8 @@ void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
  *  Stop watching for data on `fd'.  Once there are no more file
  *  descriptors to watch, the background thread will be stopped.  This
  *  function is synchronised with the background thread, so you don't
- *  have to do any locking before calling it.
+ *  have to do any locking before calling it, and the callback for fd
+ *  will not be running once it returns.
  */
 void _al_unix_stop_watching_fd(int fd)
 {
@@ -166,25 +338,29 @@ void _al_unix_stop_watching_fd(int fd)
    /* find the fd in the watch list and remove it */
    _al_mutex_lock(&fd_watch_mutex);
    {
-      WATCH_ITEM *wi;
       unsigned int i;
 
-      for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
-         wi = _al_vector_ref(&fd_watch_list, i);
-         if (wi->fd == fd) {
-            _al_vector_delete_at(&fd_watch_list, i);
-            list_empty = _al_vector_is_empty(&fd_watch_list);
-            break;
-         }
+      if (find_watch_item(fd, &i)) {
+         _al_vector_delete_at(&fd_watch_list, i);
+         list_empty = _al_vector_is_empty(&fd_watch_list);
+#ifdef USE_EPOLL
+         epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+      }
+
+      /* Callbacks may stop watching fds themselves, which must not wait
+       * for their own return.
+       */
+      if (!pthread_equal(pthread_self(), fd_watch_thread.thread)) {
+         while (running_fd == fd)
+            _al_cond_wait(&fd_watch_cond, &fd_watch_mutex);
       }
    }
    _al_mutex_unlock(&fd_watch_mutex);
 
    /* if no more fd's are being watched, stop the background thread */
    if (list_empty) {
-      _al_thread_join(&fd_watch_thread);
-      _al_mutex_destroy(&fd_watch_mutex);
-      _al_vector_free(&fd_watch_list);
+      stop_thread();
    }
 }
 
@@ -18,8 +18,20 @@
 
 #define _XOPEN_SOURCE 500       /* for Unix98 recursive mutexes */
                                 /* XXX: added configure test */
+#define _GNU_SOURCE             /* for pthread_setaffinity_np */
+#ifdef __APPLE__
+#define _DARWIN_C_SOURCE        /* for pthread_setname_np */
+#endif
 
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
@@ -30,6 +42,11 @@
 #include "allegro5/internal/aintern_android.h"
 #endif
 
+ALLEGRO_DEBUG_CHANNEL("thread")
+
+/* Nice value of ALLEGRO_THREAD_PRIORITY_LOW threads on Linux. */
+#define LOW_PRIORITY_NICE  10
+
 
 
 /* threads */
@@ -37,6 +54,16 @@
 static void *thread_proc_trampoline(void *data)
 {
    _AL_THREAD *thread = data;
+#ifdef __linux__
+   int nice;
+
+   pthread_mutex_lock(&thread->mutex);
+   thread->tid = syscall(SYS_gettid);
+   nice = thread->nice;
+   pthread_mutex_unlock(&thread->mutex);
+   if (nice != 0)
+      setpriority(PRIO_PROCESS, 0, nice);
+#endif
    /* Android is special and needs to attach/detach threads with Java */
 #ifdef ALLEGRO_ANDROID
    _al_android_thread_created();
@@ -61,6 +88,8 @@ void _al_thread_create(_AL_THREAD *thread, void (*proc)(_AL_THREAD*, void*), voi
       thread->should_stop = false;
       thread->proc = proc;
       thread->arg = arg;
+      thread->tid = 0;
+      thread->nice = 0;
 
       status = pthread_create(&thread->thread, NULL, thread_proc_trampoline, thread);
       ASSERT(status == 0);
@@ -85,6 +114,8 @@ void _al_thread_create_with_stacksize(_AL_THREAD* thread, void (*proc)(_AL_THREA
       thread->should_stop = false;
       thread->proc = proc;
       thread->arg = arg;
+      thread->tid = 0;
+      thread->nice = 0;
 
       pthread_attr_t thread_attr;
       int result = 0;
@@ -136,6 +167,144 @@ void _al_thread_detach(_AL_THREAD *thread)
 }
 
 
+/* Sets the nice value of a thread, which Linux keeps per thread. A thread
+ * which has not run yet applies it itself when it starts.
+ */
+static bool set_thread_nice(_AL_THREAD *thread, int nice)
+{
+#ifdef __linux__
+   pid_t tid;
+
+   pthread_mutex_lock(&thread->mutex);
+   if (thread->nice == nice) {
+      pthread_mutex_unlock(&thread->mutex);
+      return true;
+   }
+   thread->nice = nice;
+   tid = thread->tid;
+   pthread_mutex_unlock(&thread->mutex);
+   if (tid == 0)
+      return true;
+   if (setpriority(PRIO_PROCESS, tid, nice) != 0) {
+      ALLEGRO_DEBUG("setpriority failed: %s\n", strerror(errno));
+      return false;
+   }
+   return true;
+#else
+   (void)thread;
+   return nice == 0;
+#endif
+}
+
+
+bool _al_thread_set_priority(_AL_THREAD *thread, int priority)
+{
+   struct sched_param param;
+   int policy;
+   int min, max;
+   int err;
+
+   ASSERT(thread);
+
+   /* The real-time policies usually need CAP_SYS_NICE or an rtprio limit
+    * on Linux, so asking for HIGH or REALTIME may fail.
+    *
+    * LOW is not SCHED_IDLE, as an idle thread may wait indefinitely for
+    * the CPU while holding a lock which other threads need. It stays with
+    * SCHED_OTHER and a positive nice value instead, which only gives it a
+    * smaller share of a busy CPU.
+    */
+   switch (priority) {
+      case ALLEGRO_THREAD_PRIORITY_LOW:
+         policy = SCHED_OTHER;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_NORMAL:
+         policy = SCHED_OTHER;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_HIGH:
+         policy = SCHED_RR;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_REALTIME:
+         policy = SCHED_FIFO;
+         break;
+      default:
+         return false;
+   }
+
+   min = sched_get_priority_min(policy);
+   max = sched_get_priority_max(policy);
+   memset(&param, 0, sizeof(param));
+   if (priority == ALLEGRO_THREAD_PRIORITY_LOW ||
+         priority == ALLEGRO_THREAD_PRIORITY_HIGH)
+      param.sched_priority = min;
+   else
+      param.sched_priority = min + (max - min) / 2;
+
+   err = pthread_setschedparam(thread->thread, policy, &param);
+   if (err != 0) {
+      ALLEGRO_DEBUG("pthread_setschedparam failed: %s\n", strerror(err));
+      return false;
+   }
+   if (priority == ALLEGRO_THREAD_PRIORITY_LOW)
+      return set_thread_nice(thread, LOW_PRIORITY_NICE);
+   if (priority == ALLEGRO_THREAD_PRIORITY_NORMAL)
+      return set_thread_nice(thread, 0);
+   return true;
+}
+
+
+bool _al_thread_set_affinity(_AL_THREAD *thread, uint64_t cpu_mask)
+{
+   ASSERT(thread);
+
+#if defined(__GLIBC__) || defined(ALLEGRO_ANDROID)
+   {
+      cpu_set_t set;
+      int i;
+
+      CPU_ZERO(&set);
+      for (i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+         if (cpu_mask & ((uint64_t)1 << i))
+            CPU_SET(i, &set);
+      }
+#ifdef ALLEGRO_ANDROID
+      /* Bionic has no pthread_setaffinity_np. */
+      return sched_setaffinity(pthread_gettid_np(thread->thread),
+         sizeof(set), &set) == 0;
+#else
+      return pthread_setaffinity_np(thread->thread, sizeof(set), &set) == 0;
+#endif
+   }
+#else
+   (void)cpu_mask;
+   return false;
+#endif
+}
+
+
+bool _al_thread_set_name(_AL_THREAD *thread, const char *name)
+{
+   /* Linux allows 15 bytes. */
+   char buf[16];
+
+   ASSERT(thread);
+   ASSERT(name);
+
+   _al_sane_strncpy(buf, name, sizeof(buf));
+
+#if defined(__APPLE__)
+   if (!pthread_equal(pthread_self(), thread->thread))
+      return false;
+   return pthread_setname_np(buf) == 0;
+#elif defined(__GLIBC__) || defined(ALLEGRO_ANDROID)
+   return pthread_setname_np(thread->thread, buf) == 0;
+#else
+   (void)buf;
+   return false;
+#endif
+}
+
+
 /* mutexes */
 
 void _al_mutex_init(_AL_MUTEX *mutex)
@@ -166,6 +335,25 @@ void _al_mutex_init_recursive(_AL_MUTEX *mutex)
 }
 
 
+void _al_mutex_init_adaptive(_AL_MUTEX *mutex)
+{
+#if defined(__GLIBC__) && defined(PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP)
+   pthread_mutexattr_t attr;
+
+   ASSERT(mutex);
+
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+   pthread_mutex_init(&mutex->mutex, &attr);
+   mutex->inited = true;
+
+   pthread_mutexattr_destroy(&attr);
+#else
+   _al_mutex_init(mutex);
+#endif
+}
+
+
 void _al_mutex_destroy(_AL_MUTEX *mutex)
 {
    ASSERT(mutex);
@@ -177,6 +365,23 @@ void _al_mutex_destroy(_AL_MUTEX *mutex)
 }
 
 
+
+void _al_rwlock_init(_AL_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   pthread_rwlock_init(&rwlock->rwlock, NULL);
+}
+
+
+void _al_rwlock_destroy(_AL_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   pthread_rwlock_destroy(&rwlock->rwlock);
+}
+
+
 /* condition variables */
 /* most of the condition variable implementation is actually inline */
 
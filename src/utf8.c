@@ -17,6 +17,7 @@
 
 
 #include <stdarg.h>
+#include <string.h>
 #include "allegro5/allegro.h"
 #include "allegro5/utf8.h"
 #include "allegro5/internal/bstrlib.h"
@@ -29,6 +30,19 @@ ALLEGRO_STATIC_ASSERT(utf8,
    #pragma warning (disable: 4066)
 #endif
 
+/* The scanning below is only vectorised where the instructions can be
+ * assumed, as these functions may be used before al_install_system and so
+ * can't wait for CPU detection.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || \
+   (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #define USE_SSE2
+   #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+   #define USE_NEON
+   #include <arm_neon.h>
+#endif
+
 #ifndef ALLEGRO_HAVE_VA_COPY
    /* If va_copy() is not defined we assume that a simple assignment suffices.
     * From a few web searches, this appears to be true for MSVC 7.
@@ -41,12 +55,74 @@ ALLEGRO_STATIC_ASSERT(utf8,
 #define IS_LEAD_BYTE(c)    (((unsigned)(c) - 0xC0) < 0x3E)
 #define IS_TRAIL_BYTE(c)   (((unsigned)(c) & 0xC0) == 0x80)
 
+/* Bytes at which al_ustr_next stops. */
+#define IS_START_BYTE(c)   (IS_SINGLE_BYTE(c) || IS_LEAD_BYTE(c))
+
+
+/* Returns true if the 16 bytes at data are all ASCII. */
+static INLINE bool ascii16(const unsigned char *data)
+{
+#if defined(USE_SSE2)
+   __m128i v = _mm_loadu_si128((const __m128i *)data);
+   return _mm_movemask_epi8(v) == 0;
+#else
+   uint64_t w[2];
+   memcpy(w, data, 16);
+   return ((w[0] | w[1]) & UINT64_C(0x8080808080808080)) == 0;
+#endif
+}
+
+
+#if defined(USE_SSE2)
+static INLINE int popcount16(unsigned int m)
+{
+   m = m - ((m >> 1) & 0x5555);
+   m = (m & 0x3333) + ((m >> 2) & 0x3333);
+   m = (m + (m >> 4)) & 0x0F0F;
+   return (m + (m >> 8)) & 0x1F;
+}
+#endif
+
+
+/* Returns the number of start bytes among the 16 bytes at data. */
+static INLINE int count_starts16(const unsigned char *data)
+{
+#if defined(USE_SSE2)
+   /* As signed bytes, ASCII is >= 0 and lead bytes are -64 to -3. */
+   __m128i v = _mm_loadu_si128((const __m128i *)data);
+   __m128i ascii = _mm_cmpgt_epi8(v, _mm_set1_epi8(-1));
+   __m128i lead = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65)),
+      _mm_cmplt_epi8(v, _mm_set1_epi8(-2)));
+   return popcount16(_mm_movemask_epi8(_mm_or_si128(ascii, lead)));
+#elif defined(USE_NEON)
+   int8x16_t v = vreinterpretq_s8_u8(vld1q_u8(data));
+   uint8x16_t ascii = vcgeq_s8(v, vdupq_n_s8(0));
+   uint8x16_t lead = vandq_u8(vcgeq_s8(v, vdupq_n_s8(-64)),
+      vcleq_s8(v, vdupq_n_s8(-3)));
+   uint8x16_t ones = vandq_u8(vorrq_u8(ascii, lead), vdupq_n_u8(1));
+   uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(ones)));
+   return (int)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#else
+   int i, n = 0;
+   if (ascii16(data))
+      return 16;
+   for (i = 0; i < 16; i++)
+      n += IS_START_BYTE(data[i]);
+   return n;
+#endif
+}
+
 
 static bool all_ascii(const ALLEGRO_USTR *us)
 {
    const unsigned char *data = (const unsigned char *) _al_bdata(us);
    int size = _al_blength(us);
 
+   for (; size >= 16; data += 16, size -= 16) {
+      if (!ascii16(data))
+         return false;
+   }
+
    while (size-- > 0) {
       if (*data > 127)
          return false;
@@ -57,6 +133,32 @@ static bool all_ascii(const ALLEGRO_USTR *us)
 }
 
 
+/* find_start:
+ *  Returns the position of the n-th start byte (n > 0) after position 0,
+ *  or size if there are fewer. This is where al_ustr_next called n times
+ *  from position 0 would end up.
+ */
+static int find_start(const unsigned char *data, int size, int n)
+{
+   int pos = 1;
+
+   while (size - pos >= 16) {
+      int c = count_starts16(data + pos);
+      if (c >= n)
+         break;
+      n -= c;
+      pos += 16;
+   }
+
+   for (; pos < size; pos++) {
+      if (IS_START_BYTE(data[pos]) && --n == 0)
+         return pos;
+   }
+
+   return size;
+}
+
+
 /* Function: al_ustr_new
  */
 ALLEGRO_USTR *al_ustr_new(const char *s)
@@ -199,6 +301,138 @@ const ALLEGRO_USTR *al_ref_info(const ALLEGRO_USTR_INFO *info)
    return info;
 }
 
+/* Strings in an arena are carved out of large blocks, header followed by
+ * data, so that creating one is usually just a pointer bump and they are
+ * all freed at once. They are write protected like static strings, since
+ * growing one would need a separate allocation which nothing would free.
+ */
+
+#define ARENA_BLOCK_SIZE   16384
+#define ARENA_ALIGN        sizeof(void *)
+
+typedef struct ARENA_BLOCK ARENA_BLOCK;
+
+struct ARENA_BLOCK {
+   ARENA_BLOCK *next;
+   /* Followed by the strings. */
+};
+
+struct ALLEGRO_USTR_ARENA {
+   ARENA_BLOCK *blocks;
+   char *ptr;
+   size_t left;
+};
+
+
+/* Function: al_create_ustr_arena
+ */
+ALLEGRO_USTR_ARENA *al_create_ustr_arena(void)
+{
+   return al_calloc(1, sizeof(ALLEGRO_USTR_ARENA));
+}
+
+
+/* Function: al_destroy_ustr_arena
+ */
+void al_destroy_ustr_arena(ALLEGRO_USTR_ARENA *arena)
+{
+   ARENA_BLOCK *block;
+
+   if (!arena)
+      return;
+
+   while ((block = arena->blocks)) {
+      arena->blocks = block->next;
+      al_free(block);
+   }
+   al_free(arena);
+}
+
+
+static void *arena_alloc(ALLEGRO_USTR_ARENA *arena, size_t size)
+{
+   ARENA_BLOCK *block;
+   size_t block_size;
+   void *p;
+
+   size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+   if (size > arena->left) {
+      /* Big strings get a block of their own, keeping the current one. */
+      if (size > ARENA_BLOCK_SIZE / 4)
+         block_size = size;
+      else
+         block_size = ARENA_BLOCK_SIZE;
+
+      block = al_malloc(sizeof(ARENA_BLOCK) + block_size);
+      if (!block)
+         return NULL;
+
+      if (block_size == size && arena->blocks) {
+         block->next = arena->blocks->next;
+         arena->blocks->next = block;
+         return block + 1;
+      }
+
+      block->next = arena->blocks;
+      arena->blocks = block;
+      arena->ptr = (char *)(block + 1);
+      arena->left = block_size;
+   }
+
+   p = arena->ptr;
+   arena->ptr += size;
+   arena->left -= size;
+   return p;
+}
+
+
+/* Function: al_ustr_arena_new_from_buffer
+ */
+const ALLEGRO_USTR *al_ustr_arena_new_from_buffer(ALLEGRO_USTR_ARENA *arena,
+   const char *s, size_t size)
+{
+   struct _al_tagbstring *tb;
+   ASSERT(arena);
+   ASSERT(s || size == 0);
+
+   if (size >= INT_MAX)
+      return NULL;
+
+   tb = arena_alloc(arena, sizeof(*tb) + size + 1);
+   if (!tb)
+      return NULL;
+
+   tb->mlen = -1;
+   tb->slen = size;
+   tb->data = (unsigned char *)(tb + 1);
+   if (size > 0)
+      memcpy(tb->data, s, size);
+   tb->data[size] = '\0';
+   return tb;
+}
+
+
+/* Function: al_ustr_arena_new
+ */
+const ALLEGRO_USTR *al_ustr_arena_new(ALLEGRO_USTR_ARENA *arena,
+   const char *s)
+{
+   ASSERT(s);
+   return al_ustr_arena_new_from_buffer(arena, s, strlen(s));
+}
+
+
+/* Function: al_ustr_arena_dup
+ */
+const ALLEGRO_USTR *al_ustr_arena_dup(ALLEGRO_USTR_ARENA *arena,
+   const ALLEGRO_USTR *us)
+{
+   return al_ustr_arena_new_from_buffer(arena, _al_bdata(us),
+      _al_blength(us));
+}
+
+
 /* Function: al_ustr_size
  */
 size_t al_ustr_size(const ALLEGRO_USTR *us)
@@ -211,11 +445,20 @@ size_t al_ustr_size(const ALLEGRO_USTR *us)
  */
 size_t al_ustr_length(const ALLEGRO_USTR *us)
 {
-   int pos = 0;
-   int c = 0;
+   const unsigned char *data = (const unsigned char *) _al_bdata(us);
+   int size = _al_blength(us);
+   int pos;
+   size_t c;
 
-   while (al_ustr_next(us, &pos))
-      c++;
+   if (size <= 0)
+      return 0;
+
+   /* The first byte always counts, whatever it is. */
+   c = 1;
+   for (pos = 1; size - pos >= 16; pos += 16)
+      c += count_starts16(data + pos);
+   for (; pos < size; pos++)
+      c += IS_START_BYTE(data[pos]);
 
    return c;
 }
@@ -225,17 +468,15 @@ size_t al_ustr_length(const ALLEGRO_USTR *us)
  */
 int al_ustr_offset(const ALLEGRO_USTR *us, int index)
 {
-   int pos = 0;
+   int size = _al_blength(us);
 
    if (index < 0)
       index += al_ustr_length(us);
 
-   while (index-- > 0) {
-      if (!al_ustr_next(us, &pos))
-         return pos;
-   }
+   if (index <= 0 || size <= 0)
+      return 0;
 
-   return pos;
+   return find_start((const unsigned char *) _al_bdata(us), size, index);
 }
 
 
@@ -374,7 +615,18 @@ int32_t al_ustr_get(const ALLEGRO_USTR *ub, int pos)
  */
 int32_t al_ustr_get_next(const ALLEGRO_USTR *us, int *pos)
 {
-   int32_t c = al_ustr_get(us, *pos);
+   int32_t c;
+
+   /* Plain ASCII needs no decoding. */
+   if (*pos >= 0 && *pos < _al_blength(us)) {
+      c = ((const unsigned char *) _al_bdata(us))[*pos];
+      if (IS_SINGLE_BYTE(c)) {
+         (*pos)++;
+         return c;
+      }
+   }
+
+   c = al_ustr_get(us, *pos);
 
    if (c >= 0) {
       (*pos) += al_utf8_width(c);
@@ -156,7 +156,7 @@ static void d3d_draw_textured_quad(
    ALLEGRO_DISPLAY* aldisp = (ALLEGRO_DISPLAY*)disp;
 
    if (aldisp->num_cache_vertices != 0 && (uintptr_t)bmp != aldisp->cache_texture) {
-      aldisp->vt->flush_vertex_cache(aldisp);
+      _al_flush_vertex_cache(aldisp, ALLEGRO_DISPLAY_STAT_TEXTURE_FLUSHES);
    }
    aldisp->cache_texture = (uintptr_t)bmp;
 
@@ -234,7 +234,7 @@ static void d3d_draw_textured_quad(
    }
 
    if (!aldisp->cache_enabled)
-      aldisp->vt->flush_vertex_cache(aldisp);
+      _al_flush_vertex_cache(aldisp, ALLEGRO_DISPLAY_STAT_UNHELD_FLUSHES);
 }
 
 /* Copy texture memory to bitmap->memory */
@@ -573,6 +573,7 @@ static void d3d_backup_dirty_bitmap(ALLEGRO_BITMAP *bitmap)
       (bitmap_flags & ALLEGRO_MEMORY_BITMAP) ||
       (bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE) ||
       !bitmap->dirty ||
+      bitmap->restore ||
       extra->is_backbuffer ||
       bitmap->parent
       ))
@@ -647,7 +648,7 @@ void _al_d3d_refresh_texture_memory(ALLEGRO_DISPLAY *display)
       d3d_create_textures(bmps_display, extra->texture_w,
          extra->texture_h, bitmap_flags,
          &extra->video_texture, /*&bmp->system_texture*/0, al_get_bitmap_format(bmp), 0);
-      if (!(bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE)) {
+      if (!(bitmap_flags & ALLEGRO_NO_PRESERVE_TEXTURE) && !bmp->restore) {
          int block_width = al_get_pixel_block_width(al_get_bitmap_format(bmp));
          int block_height = al_get_pixel_block_height(al_get_bitmap_format(bmp));
          d3d_sync_bitmap_texture(bmp,
@@ -820,6 +821,245 @@ static void d3d_draw_bitmap_region(
       sx, sy, sw, sh, flags);
 }
 
+/*
+ * Asynchronous readback
+ *
+ * al_request_bitmap_readback copies the region into a render target with
+ * StretchRect, which is queued like drawing, and issues an event query
+ * after it. GetRenderTargetData into the system memory surface is only
+ * called when the region is locked, by which time the query has usually
+ * been signalled so it does not stall.
+ */
+
+static void d3d_release_readback(ALLEGRO_D3D_READBACK *rb)
+{
+   if (rb->copy) {
+      rb->copy->Release();
+      rb->copy = NULL;
+   }
+   if (rb->staging) {
+      rb->staging->Release();
+      rb->staging = NULL;
+   }
+   if (rb->query) {
+      rb->query->Release();
+      rb->query = NULL;
+   }
+   rb->surface_w = 0;
+   rb->surface_h = 0;
+   rb->bitmap = NULL;
+}
+
+
+/* Called before the device is reset or destroyed. The pending readbacks are
+ * dropped, later locks read synchronously.
+ */
+void _al_d3d_release_readbacks(ALLEGRO_DISPLAY_D3D *disp)
+{
+   int i;
+
+   for (i = 0; i < _AL_D3D_READBACK_RING; i++) {
+      d3d_release_readback(&disp->readbacks[i]);
+   }
+   disp->next_readback = 0;
+}
+
+
+static ALLEGRO_D3D_READBACK *d3d_find_readback(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_DISPLAY_D3D *disp = get_extra(bitmap)->display;
+   int i;
+
+   for (i = 0; i < _AL_D3D_READBACK_RING; i++) {
+      if (disp->readbacks[i].bitmap == bitmap)
+         return &disp->readbacks[i];
+   }
+   return NULL;
+}
+
+
+static bool d3d_prepare_readback(ALLEGRO_DISPLAY_D3D *disp,
+   ALLEGRO_D3D_READBACK *rb, UINT w, UINT h, D3DFORMAT format)
+{
+   if (rb->copy && rb->surface_w == w && rb->surface_h == h &&
+         rb->surface_format == format) {
+      return true;
+   }
+
+   d3d_release_readback(rb);
+
+   if (disp->device->CreateRenderTarget(w, h, format, D3DMULTISAMPLE_NONE, 0,
+         FALSE, &rb->copy, NULL) != D3D_OK) {
+      ALLEGRO_ERROR("d3d_prepare_readback: CreateRenderTarget failed.\n");
+      return false;
+   }
+   if (disp->device->CreateOffscreenPlainSurface(w, h, format,
+         D3DPOOL_SYSTEMMEM, &rb->staging, NULL) != D3D_OK) {
+      ALLEGRO_ERROR("d3d_prepare_readback: CreateOffscreenPlainSurface failed.\n");
+      d3d_release_readback(rb);
+      return false;
+   }
+   if (disp->device->CreateQuery(D3DQUERYTYPE_EVENT, &rb->query) != D3D_OK) {
+      ALLEGRO_DEBUG("d3d_prepare_readback: No event queries.\n");
+      d3d_release_readback(rb);
+      return false;
+   }
+
+   rb->surface_w = w;
+   rb->surface_h = h;
+   rb->surface_format = format;
+   return true;
+}
+
+
+static bool d3d_request_readback(ALLEGRO_BITMAP *bitmap,
+   int x, int y, int w, int h, int format)
+{
+   ALLEGRO_BITMAP_EXTRA_D3D *d3d_bmp = get_extra(bitmap);
+   ALLEGRO_DISPLAY_D3D *disp = d3d_bmp->display;
+   ALLEGRO_D3D_READBACK *rb;
+   LPDIRECT3DSURFACE9 source;
+   D3DSURFACE_DESC desc;
+   RECT rect;
+   bool ok;
+   int f;
+
+   if (disp->device_lost)
+      return false;
+
+   if (_al_pixel_format_is_compressed(al_get_bitmap_format(bitmap)))
+      return false;
+
+   /* Use the format d3d_lock_region will be asked for. */
+   f = _al_get_real_pixel_format(al_get_current_display(), format);
+   if (f < 0)
+      return false;
+
+   if (d3d_bmp->is_backbuffer) {
+      source = disp->render_target;
+      source->AddRef();
+   }
+   else {
+      if (!_al_d3d_render_to_texture_supported() || !d3d_bmp->video_texture)
+         return false;
+      if (d3d_bmp->video_texture->GetSurfaceLevel(0, &source) != D3D_OK) {
+         ALLEGRO_ERROR("d3d_request_readback: GetSurfaceLevel failed.\n");
+         return false;
+      }
+   }
+
+   /* A new request replaces the previous one for this bitmap. */
+   rb = d3d_find_readback(bitmap);
+   if (rb) {
+      rb->bitmap = NULL;
+   }
+
+   /* Take the oldest slot. If another bitmap's readback is still in it, that
+    * one is dropped and its lock reads synchronously.
+    */
+   rb = &disp->readbacks[disp->next_readback];
+   disp->next_readback = (disp->next_readback + 1) % _AL_D3D_READBACK_RING;
+   rb->bitmap = NULL;
+
+   source->GetDesc(&desc);
+   ok = d3d_prepare_readback(disp, rb, w, h, desc.Format);
+
+   if (ok) {
+      rect.left = x;
+      rect.top = y;
+      rect.right = x + w;
+      rect.bottom = y + h;
+      if (disp->device->StretchRect(source, &rect, rb->copy, NULL,
+            D3DTEXF_NONE) != D3D_OK) {
+         ALLEGRO_ERROR("d3d_request_readback: StretchRect failed.\n");
+         ok = false;
+      }
+   }
+
+   source->Release();
+
+   if (ok) {
+      rb->query->Issue(D3DISSUE_END);
+      rb->bitmap = bitmap;
+      rb->x = x;
+      rb->y = y;
+      rb->w = w;
+      rb->h = h;
+      rb->format = f;
+   }
+
+   return ok;
+}
+
+
+static bool d3d_is_readback_ready(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_D3D_READBACK *rb = d3d_find_readback(bitmap);
+
+   if (!rb || get_extra(bitmap)->display->device_lost)
+      return true;
+
+   /* S_FALSE means still pending. Errors (a lost device) are not worth
+    * waiting for, the lock will find out.
+    */
+   return rb->query->GetData(NULL, 0, D3DGETDATA_FLUSH) != S_FALSE;
+}
+
+
+/* Locks the readback for the region, if there is one. The system memory
+ * surface is in the same format as the bitmap, so the rest of
+ * d3d_lock_region treats it like the system texture.
+ */
+static bool d3d_lock_readback(ALLEGRO_BITMAP *bitmap,
+   int x, int y, int w, int h, int format, int flags)
+{
+   ALLEGRO_BITMAP_EXTRA_D3D *d3d_bmp = get_extra(bitmap);
+   ALLEGRO_D3D_READBACK *rb;
+
+   /* Only read-only locks, as nothing is uploaded from the staging
+    * surface when unlocking.
+    */
+   if (!(flags & ALLEGRO_LOCK_READONLY))
+      return false;
+
+   rb = d3d_find_readback(bitmap);
+   if (!rb || rb->x != x || rb->y != y || rb->w != w || rb->h != h ||
+         rb->format != format) {
+      return false;
+   }
+
+   /* This only blocks if the lock comes too early. */
+   if (d3d_bmp->display->device->GetRenderTargetData(rb->copy,
+         rb->staging) != D3D_OK) {
+      ALLEGRO_ERROR("d3d_lock_readback: GetRenderTargetData failed.\n");
+      rb->bitmap = NULL;
+      return false;
+   }
+   if (rb->staging->LockRect(&d3d_bmp->locked_rect, NULL,
+         D3DLOCK_READONLY) != D3D_OK) {
+      ALLEGRO_ERROR("d3d_lock_readback: LockRect failed.\n");
+      rb->bitmap = NULL;
+      return false;
+   }
+
+   d3d_bmp->locked_readback = true;
+   return true;
+}
+
+
+static void d3d_unlock_readback(ALLEGRO_BITMAP *bitmap)
+{
+   ALLEGRO_BITMAP_EXTRA_D3D *d3d_bmp = get_extra(bitmap);
+   ALLEGRO_D3D_READBACK *rb = d3d_find_readback(bitmap);
+
+   ASSERT(rb);
+   rb->staging->UnlockRect();
+   /* The readback is used up, free the slot. */
+   rb->bitmap = NULL;
+   d3d_bmp->locked_readback = false;
+}
+
+
 static ALLEGRO_LOCKED_REGION *d3d_lock_region(ALLEGRO_BITMAP *bitmap,
    int x, int y, int w, int h, int format,
    int flags)
@@ -843,7 +1083,10 @@ static ALLEGRO_LOCKED_REGION *d3d_lock_region(ALLEGRO_BITMAP *bitmap,
    rect.top = y;
    rect.bottom = y + h;
 
-   if (d3d_bmp->is_backbuffer) {
+   if (d3d_lock_readback(bitmap, x, y, w, h, f, flags)) {
+      ALLEGRO_DEBUG("Locking from readback\n");
+   }
+   else if (d3d_bmp->is_backbuffer) {
       ALLEGRO_DISPLAY_D3D *d3d_disp =
          (ALLEGRO_DISPLAY_D3D *)_al_get_bitmap_display(bitmap);
       if (d3d_disp->render_target->LockRect(&d3d_bmp->locked_rect, &rect, Flags) != D3D_OK) {
@@ -921,7 +1164,10 @@ static void d3d_unlock_region(ALLEGRO_BITMAP *bitmap)
       al_free(bitmap->locked_region.data);
    }
 
-   if (d3d_bmp->is_backbuffer) {
+   if (d3d_bmp->locked_readback) {
+      d3d_unlock_readback(bitmap);
+   }
+   else if (d3d_bmp->is_backbuffer) {
       ALLEGRO_DISPLAY_D3D *d3d_disp =
          (ALLEGRO_DISPLAY_D3D *)_al_get_bitmap_display(bitmap);
       d3d_disp->render_target->UnlockRect();
@@ -1028,6 +1274,8 @@ ALLEGRO_BITMAP_INTERFACE *_al_bitmap_d3d_driver(void)
    vt->unlock_compressed_region = d3d_unlock_compressed_region;
    vt->update_clipping_rectangle = d3d_update_clipping_rectangle;
    vt->backup_dirty_bitmap = d3d_backup_dirty_bitmap;
+   vt->request_readback = d3d_request_readback;
+   vt->is_readback_ready = d3d_is_readback_ready;
 
    return vt;
 }
@@ -597,8 +597,20 @@ static bool d3d_create_fullscreen_device(ALLEGRO_DISPLAY_D3D *d,
    return 1;
 }
 
+static void d3d_release_vertex_buffer(ALLEGRO_DISPLAY_D3D *disp)
+{
+   if (disp->vertex_buffer) {
+      disp->vertex_buffer->Release();
+      disp->vertex_buffer = NULL;
+   }
+   disp->vertex_buffer_size = 0;
+   disp->vertex_buffer_pos = 0;
+}
+
 static void d3d_destroy_device(ALLEGRO_DISPLAY_D3D *disp)
 {
+   d3d_release_vertex_buffer(disp);
+   _al_d3d_release_readbacks(disp);
    while (disp->device->Release() != 0) {
       ALLEGRO_WARN("d3d_destroy_device: ref count not 0\n");
    }
@@ -955,6 +967,8 @@ void _al_d3d_prepare_for_reset(ALLEGRO_DISPLAY_D3D *disp)
    d3d_call_callbacks(&al_display->display_invalidated_callbacks, al_display);
 
    _al_d3d_release_default_pool_textures((ALLEGRO_DISPLAY *)disp);
+   d3d_release_vertex_buffer(disp);
+   _al_d3d_release_readbacks(disp);
    while (disp->render_target && disp->render_target->Release() != 0) {
       ALLEGRO_WARN("_al_d3d_prepare_for_reset: (bb) ref count not 0\n");
    }
@@ -1132,6 +1146,9 @@ static bool _al_d3d_reset_device(ALLEGRO_DISPLAY_D3D *d3d_display)
 
    al_unlock_mutex(_al_d3d_lost_device_mutex);
 
+   /* Refill the bitmaps restored without their memory copy. */
+   _al_restore_display_bitmaps(al_display);
+
    return 1;
 }
 
@@ -2010,6 +2027,103 @@ static void d3d_clear_depth_buffer(ALLEGRO_DISPLAY *al_display, float z)
 
 
 
+/* A zone is timed with two timestamps. The disjoint query tells whether the
+ * counter kept its frequency while they were taken, e.g. because the GPU
+ * changed clocks; such measurements are thrown away.
+ */
+typedef struct D3D_GPU_TIMER
+{
+   LPDIRECT3DQUERY9 disjoint;
+   LPDIRECT3DQUERY9 freq;
+   LPDIRECT3DQUERY9 begin;
+   LPDIRECT3DQUERY9 end;
+} D3D_GPU_TIMER;
+
+static void d3d_destroy_gpu_timer(ALLEGRO_DISPLAY *al_display, void *timer)
+{
+   D3D_GPU_TIMER *t = (D3D_GPU_TIMER *)timer;
+   (void)al_display;
+
+   if (t->disjoint)
+      t->disjoint->Release();
+   if (t->freq)
+      t->freq->Release();
+   if (t->begin)
+      t->begin->Release();
+   if (t->end)
+      t->end->Release();
+   al_free(t);
+}
+
+static void *d3d_create_gpu_timer(ALLEGRO_DISPLAY *al_display)
+{
+   ALLEGRO_DISPLAY_D3D *d3d_display = (ALLEGRO_DISPLAY_D3D *)al_display;
+   LPDIRECT3DDEVICE9 device = d3d_display->device;
+   D3D_GPU_TIMER *t;
+
+   if (!device || d3d_display->device_lost)
+      return NULL;
+
+   t = (D3D_GPU_TIMER *)al_calloc(1, sizeof *t);
+   if (!t)
+      return NULL;
+   if (device->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, &t->disjoint) != D3D_OK ||
+         device->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, &t->freq) != D3D_OK ||
+         device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &t->begin) != D3D_OK ||
+         device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &t->end) != D3D_OK) {
+      ALLEGRO_WARN("Timestamp queries not supported\n");
+      d3d_destroy_gpu_timer(al_display, t);
+      return NULL;
+   }
+   return t;
+}
+
+static void d3d_begin_gpu_timer(ALLEGRO_DISPLAY *al_display, void *timer)
+{
+   D3D_GPU_TIMER *t = (D3D_GPU_TIMER *)timer;
+   (void)al_display;
+
+   t->disjoint->Issue(D3DISSUE_BEGIN);
+   t->begin->Issue(D3DISSUE_END);
+}
+
+static void d3d_end_gpu_timer(ALLEGRO_DISPLAY *al_display, void *timer)
+{
+   D3D_GPU_TIMER *t = (D3D_GPU_TIMER *)timer;
+   (void)al_display;
+
+   t->end->Issue(D3DISSUE_END);
+   t->freq->Issue(D3DISSUE_END);
+   t->disjoint->Issue(D3DISSUE_END);
+}
+
+static bool d3d_get_gpu_timer_result(ALLEGRO_DISPLAY *al_display, void *timer,
+   double *seconds)
+{
+   D3D_GPU_TIMER *t = (D3D_GPU_TIMER *)timer;
+   BOOL disjoint;
+   UINT64 freq, begin, end;
+   HRESULT hr;
+   (void)al_display;
+
+   /* The disjoint query ends last, so the others are done once it is. */
+   hr = t->disjoint->GetData(&disjoint, sizeof disjoint, 0);
+   if (hr == S_FALSE)
+      return false;
+   if (hr != S_OK ||
+         t->freq->GetData(&freq, sizeof freq, 0) != S_OK ||
+         t->begin->GetData(&begin, sizeof begin, 0) != S_OK ||
+         t->end->GetData(&end, sizeof end, 0) != S_OK ||
+         disjoint || freq == 0 || end < begin) {
+      /* Includes a lost device, which loses the results. */
+      *seconds = -1;
+      return true;
+   }
+   *seconds = (double)(end - begin) / (double)freq;
+   return true;
+}
+
+
 // FIXME: does this need a programmable pipeline path?
 static void d3d_draw_pixel(ALLEGRO_DISPLAY *disp, float x, float y, ALLEGRO_COLOR *color)
 {
@@ -2424,6 +2538,11 @@ void _al_d3d_destroy_bitmap(ALLEGRO_BITMAP *bitmap)
 
    ALLEGRO_BITMAP_EXTRA_D3D *d3d_bmp = get_extra(bitmap);
 
+   for (int i = 0; i < _AL_D3D_READBACK_RING; i++) {
+      if (d3d_display->readbacks[i].bitmap == bitmap)
+         d3d_display->readbacks[i].bitmap = NULL;
+   }
+
    if (d3d_bmp->video_texture) {
       if (d3d_bmp->video_texture->Release() != 0) {
          ALLEGRO_WARN("d3d_destroy_bitmap: Release video texture failed.\n");
@@ -2450,6 +2569,7 @@ static void d3d_set_target_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitm
    ALLEGRO_BITMAP_EXTRA_D3D *d3d_target;
    ALLEGRO_BITMAP_EXTRA_D3D *old_target = NULL;
    ALLEGRO_DISPLAY_D3D *d3d_display = (ALLEGRO_DISPLAY_D3D *)display;
+   bool srgb_write;
 
    if (d3d_display->device_lost)
       return;
@@ -2480,6 +2600,9 @@ static void d3d_set_target_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitm
    }
    d3d_display->target_bitmap = NULL;
 
+   if (old_target != d3d_target)
+      display->stats[ALLEGRO_DISPLAY_STAT_TARGET_CHANGES]++;
+
    /* Set the render target */
    if (d3d_target->is_backbuffer) {
       d3d_display = d3d_target->display;
@@ -2522,6 +2645,14 @@ static void d3d_set_target_bitmap(ALLEGRO_DISPLAY *display, ALLEGRO_BITMAP *bitm
 
    d3d_reset_state(d3d_display);
 
+   /* sRGB targets get linear colors, which are encoded when written. */
+   if (d3d_target->is_backbuffer)
+      srgb_write = display->flags & ALLEGRO_SRGB_FRAMEBUFFER;
+   else
+      srgb_write = al_get_bitmap_flags(target) & ALLEGRO_SRGB;
+   d3d_display->device->SetRenderState(D3DRS_SRGBWRITEENABLE,
+      srgb_write ? TRUE : FALSE);
+
    _al_d3d_set_bitmap_clip(bitmap);
 }
 
@@ -2738,6 +2869,52 @@ void _al_set_d3d_sampler_state(IDirect3DDevice9* device, int sampler,
    else {
       device->SetSamplerState(sampler, D3DSAMP_MIPFILTER, D3DTEXF_NONE);
    }
+   device->SetSamplerState(sampler, D3DSAMP_SRGBTEXTURE,
+      (bitmap_flags & ALLEGRO_SRGB) ? TRUE : FALSE);
+}
+
+/* Copies the vertex cache into the dynamic vertex buffer and returns the
+ * index of its first vertex there, or -1 on failure.
+ */
+static int d3d_upload_vertex_cache(ALLEGRO_DISPLAY_D3D *d3d_disp, int stride)
+{
+   ALLEGRO_DISPLAY *disp = (ALLEGRO_DISPLAY *)d3d_disp;
+   UINT bytes = disp->num_cache_vertices * stride;
+   UINT pos;
+   DWORD lock_flags = D3DLOCK_NOOVERWRITE;
+   void *data;
+
+   if (bytes > d3d_disp->vertex_buffer_size) {
+      UINT size = _ALLEGRO_MAX(bytes, 64 * 1024);
+      d3d_release_vertex_buffer(d3d_disp);
+      if (d3d_disp->device->CreateVertexBuffer(size,
+            D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT,
+            &d3d_disp->vertex_buffer, NULL) != D3D_OK) {
+         ALLEGRO_ERROR("d3d_upload_vertex_cache: CreateVertexBuffer failed.\n");
+         d3d_disp->vertex_buffer = NULL;
+         return -1;
+      }
+      d3d_disp->vertex_buffer_size = size;
+      d3d_disp->vertex_buffer_pos = 0;
+   }
+
+   /* Batches start at a whole vertex so they can be drawn by index. */
+   pos = (d3d_disp->vertex_buffer_pos + stride - 1) / stride * stride;
+   if (pos + bytes > d3d_disp->vertex_buffer_size) {
+      pos = 0;
+      lock_flags = D3DLOCK_DISCARD;
+   }
+
+   if (d3d_disp->vertex_buffer->Lock(pos, bytes, &data, lock_flags) != D3D_OK) {
+      ALLEGRO_ERROR("d3d_upload_vertex_cache: Lock failed.\n");
+      return -1;
+   }
+   memcpy(data, disp->vertex_cache, bytes);
+   d3d_disp->vertex_buffer->Unlock();
+
+   d3d_disp->vertex_buffer_pos = pos + bytes;
+   d3d_disp->device->SetStreamSource(0, d3d_disp->vertex_buffer, 0, stride);
+   return pos / stride;
 }
 
 static void d3d_flush_vertex_cache(ALLEGRO_DISPLAY* disp)
@@ -2774,16 +2951,27 @@ static void d3d_flush_vertex_cache(ALLEGRO_DISPLAY* disp)
       ALLEGRO_ERROR("d3d_flush_vertex_cache: SetTexture failed.\n");
       return;
    }
+   disp->stats[ALLEGRO_DISPLAY_STAT_TEXTURE_BINDS]++;
 
    int size;
+   int first;
 
 #ifdef ALLEGRO_CFG_SHADER_HLSL
    if (disp->flags & ALLEGRO_PROGRAMMABLE_PIPELINE) {
       size = sizeof(ALLEGRO_VERTEX);
+      first = d3d_upload_vertex_cache(d3d_disp, size);
       for (unsigned int i = 0; i < required_passes; i++) {
+         HRESULT hr;
          d3d_disp->effect->BeginPass(i);
-         if (d3d_disp->device->DrawPrimitiveUP(D3DPT_TRIANGLELIST, disp->num_cache_vertices / 3,
-            (void *)disp->vertex_cache, size) != D3D_OK) {
+         if (first >= 0) {
+            hr = d3d_disp->device->DrawPrimitive(D3DPT_TRIANGLELIST, first,
+               disp->num_cache_vertices / 3);
+         }
+         else {
+            hr = d3d_disp->device->DrawPrimitiveUP(D3DPT_TRIANGLELIST,
+               disp->num_cache_vertices / 3, (void *)disp->vertex_cache, size);
+         }
+         if (hr != D3D_OK) {
             ALLEGRO_ERROR("d3d_flush_vertex_cache: DrawPrimitive failed.\n");
             return;
          }
@@ -2793,10 +2981,19 @@ static void d3d_flush_vertex_cache(ALLEGRO_DISPLAY* disp)
    else
 #endif
    {
+      HRESULT hr;
       d3d_disp->device->SetFVF(D3DFVF_FIXED_VERTEX);
       size = sizeof(D3D_FIXED_VERTEX);
-      if (d3d_disp->device->DrawPrimitiveUP(D3DPT_TRIANGLELIST, disp->num_cache_vertices / 3,
-         (void *)disp->vertex_cache, size) != D3D_OK) {
+      first = d3d_upload_vertex_cache(d3d_disp, size);
+      if (first >= 0) {
+         hr = d3d_disp->device->DrawPrimitive(D3DPT_TRIANGLELIST, first,
+            disp->num_cache_vertices / 3);
+      }
+      else {
+         hr = d3d_disp->device->DrawPrimitiveUP(D3DPT_TRIANGLELIST,
+            disp->num_cache_vertices / 3, (void *)disp->vertex_cache, size);
+      }
+      if (hr != D3D_OK) {
          ALLEGRO_ERROR("d3d_flush_vertex_cache: DrawPrimitive failed.\n");
          return;
       }
@@ -2933,6 +3130,12 @@ ALLEGRO_DISPLAY_INTERFACE *_al_display_d3d_driver(void)
 
    vt->update_render_state = _al_d3d_update_render_state;
 
+   vt->create_gpu_timer = d3d_create_gpu_timer;
+   vt->begin_gpu_timer = d3d_begin_gpu_timer;
+   vt->end_gpu_timer = d3d_end_gpu_timer;
+   vt->get_gpu_timer_result = d3d_get_gpu_timer_result;
+   vt->destroy_gpu_timer = d3d_destroy_gpu_timer;
+
    _al_win_add_clipboard_functions(vt);
 
    return vt;
@@ -351,6 +351,8 @@ static bool hlsl_use_shader(ALLEGRO_SHADER *shader, ALLEGRO_DISPLAY *display,
       }
    }
 
+   if (d3d_disp->effect != hlsl_shader->hlsl_shader)
+      display->stats[ALLEGRO_DISPLAY_STAT_SHADER_CHANGES]++;
    d3d_disp->effect = hlsl_shader->hlsl_shader;
    return true;
 }
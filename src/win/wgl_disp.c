@@ -542,6 +542,21 @@ static ALLEGRO_EXTRA_DISPLAY_SETTINGS* read_pixel_format_ext(_ALLEGRO_wglGetExte
 }
 
 
+/* Returns true if the pixel format can encode writes to sRGB. */
+static bool is_pixel_format_srgb_capable(int fmt, HDC dc)
+{
+   int attrib = WGL_FRAMEBUFFER_SRGB_CAPABLE_EXT;
+   int value = 0;
+
+   if (_wglGetPixelFormatAttribivARB)
+      _wglGetPixelFormatAttribivARB(dc, fmt+1, 0, 1, &attrib, &value);
+   else if (_wglGetPixelFormatAttribivEXT)
+      _wglGetPixelFormatAttribivEXT(dc, fmt+1, 0, 1, &attrib, &value);
+
+   return value != 0;
+}
+
+
 static bool change_display_mode(ALLEGRO_DISPLAY *d)
 {
    DEVMODE dm;
@@ -695,6 +710,7 @@ static ALLEGRO_EXTRA_DISPLAY_SETTINGS** get_available_pixel_formats_ext(int *cou
    ALLEGRO_EXTRA_DISPLAY_SETTINGS *ref;
    int maxindex;
    int i, j;
+   bool want_srgb;
 
    *count = 0;
    ref =  _al_get_new_display_settings();
@@ -733,6 +749,12 @@ static ALLEGRO_EXTRA_DISPLAY_SETTINGS** get_available_pixel_formats_ext(int *cou
 
    ALLEGRO_INFO("Got %i visuals.\n", maxindex);
 
+   want_srgb = (al_get_new_display_flags() & ALLEGRO_SRGB_FRAMEBUFFER) &&
+      (is_wgl_extension_supported(_wglGetExtensionsStringARB,
+         "WGL_ARB_framebuffer_sRGB", testdc) ||
+       is_wgl_extension_supported(_wglGetExtensionsStringARB,
+         "WGL_EXT_framebuffer_sRGB", testdc));
+
    eds_list = al_calloc(maxindex, sizeof(*eds_list));
    if (!eds_list)
       goto bail;
@@ -752,6 +774,8 @@ static ALLEGRO_EXTRA_DISPLAY_SETTINGS** get_available_pixel_formats_ext(int *cou
          eds_list[j] = NULL;
          continue;
       }
+      if (want_srgb && is_pixel_format_srgb_capable(i, testdc))
+         eds_list[j]->score += 128;
       /* In WinAPI first index is 1 ::) */
       eds_list[j]->index = i+1;
       j++;
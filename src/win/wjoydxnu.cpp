@@ -138,7 +138,8 @@ ALLEGRO_JOYSTICK_DRIVER _al_joydrv_directx =
    joydx_release_joystick,
    joydx_get_joystick_state,
    joydx_get_name,
-   joydx_get_active
+   joydx_get_active,
+   NULL
 };
 
 
@@ -1138,6 +1139,18 @@ static void joydx_merge(void)
 }
 
 
+/* joydx_want_background_scan:
+ *  Whether the initial enumeration should be left to the joystick thread.
+ */
+static bool joydx_want_background_scan(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(),
+      "joystick", "scan_in_background");
+   return value && atoi(value) != 0;
+}
+
+
+
 /* joydx_init_joystick: [primary thread]
  *
  *  Initialises the DirectInput joystick devices.
@@ -1189,11 +1202,20 @@ static bool joydx_init_joystick(void)
    /* initialise the lock for the background thread */
    InitializeCriticalSection(&joydx_thread_cs);
 
-   // This initializes present joystick state
-   joydx_scan(false);
+   if (joydx_want_background_scan()) {
+      /* Leave the enumeration to the background thread, which reports the
+       * devices it finds with a configuration event.
+       */
+      ALLEGRO_INFO("Enumerating joysticks in the background\n");
+      need_device_enumeration = true;
+   }
+   else {
+      // This initializes present joystick state
+      joydx_scan(false);
 
-   // This copies present state to user state
-   joydx_merge();
+      // This copies present state to user state
+      joydx_merge();
+   }
 
    /* create the dedicated thread stopping event */
    STOP_EVENT = CreateEvent(NULL, false, false, NULL);
@@ -1400,6 +1422,16 @@ static unsigned __stdcall joydx_thread_proc(LPVOID unused)
    /* XXX is this needed? */
    _al_win_thread_init();
 
+   /* Do the first enumeration right away if joydx_init_joystick left it
+    * to us, instead of after the first one second wait.
+    */
+   EnterCriticalSection(&joydx_thread_cs);
+   if (need_device_enumeration) {
+      joydx_scan(true);
+      need_device_enumeration = false;
+   }
+   LeaveCriticalSection(&joydx_thread_cs);
+
    while (true) {
       DWORD result;
       result = WaitForMultipleObjects(joydx_num_joysticks + 1, /* +1 for STOP_EVENT */
@@ -41,9 +41,15 @@
    #undef MAKEFOURCC
 #endif
 
-/* Poll connected joysticks frequently and non-connected ones infrequently. */
-#ifndef ALLEGRO_XINPUT_POLL_DELAY
-#define ALLEGRO_XINPUT_POLL_DELAY 0.01
+/* Poll connected joysticks frequently and non-connected ones infrequently.
+ * The rate for connected joysticks can be changed in allegro5.cfg.
+ */
+#ifndef ALLEGRO_XINPUT_POLL_RATE
+#define ALLEGRO_XINPUT_POLL_RATE 100
+#endif
+
+#ifndef ALLEGRO_XINPUT_MAX_POLL_RATE
+#define ALLEGRO_XINPUT_MAX_POLL_RATE 1000
 #endif
 
 #ifndef ALLEGRO_XINPUT_DISCONNECTED_POLL_DELAY
@@ -86,6 +92,7 @@ static void joyxi_release_joystick(ALLEGRO_JOYSTICK *joy);
 static void joyxi_get_joystick_state(ALLEGRO_JOYSTICK *joy, ALLEGRO_JOYSTICK_STATE *ret_state);
 static const char *joyxi_get_name(ALLEGRO_JOYSTICK *joy);
 static bool joyxi_get_active(ALLEGRO_JOYSTICK *joy);
+static void joyxi_poll_joysticks(void);
 
 
 /* the driver vtable */
@@ -103,7 +110,8 @@ ALLEGRO_JOYSTICK_DRIVER _al_joydrv_xinput =
    joyxi_release_joystick,
    joyxi_get_joystick_state,
    joyxi_get_name,
-   joyxi_get_active
+   joyxi_get_active,
+   joyxi_poll_joysticks
 };
 
 #define XINPUT_MIN_VERSION   3
@@ -146,6 +154,12 @@ static ALLEGRO_MUTEX  *joyxi_mutex = NULL;
    frequent polling*/
 static ALLEGRO_COND   *joyxi_cond = NULL;
 static ALLEGRO_COND   *joyxi_disconnected_cond = NULL;
+/* Delay between polls of the connected joysticks, or 0 if the application
+ * polls them with al_poll_joysticks.
+ */
+static double joyxi_poll_delay = 0.0;
+/* Whether we raised the system timer resolution for fast polling. */
+static bool joyxi_timer_period_set = false;
 
 /* Names for things in because XInput doesn't provide them. */
 
@@ -454,18 +468,13 @@ static void joyxi_poll_connected_joystick(ALLEGRO_JOYSTICK_XINPUT *xjoy)
 
 
 /* Polling function for a joystick that is currently not active.  Care is taken to do this infrequently so
-   performance doesn't suffer too much. */
-static void joyxi_poll_disconnected_joystick(ALLEGRO_JOYSTICK_XINPUT *xjoy)
+   performance doesn't suffer too much. Returns true if it got connected. */
+static bool joyxi_poll_disconnected_joystick(DWORD index)
 {
    XINPUT_CAPABILITIES xicapas;
    DWORD res;
-   res = _imp_XInputGetCapabilities(xjoy->index, 0, &xicapas);
-   if (res == ERROR_SUCCESS) {
-      /* Got capabilities, joystick was connected, need to reconfigure. */
-      joyxi_generate_reconfigure_event();
-      return;
-   }
-   /* Nothing to do if we get here. */
+   res = _imp_XInputGetCapabilities(index, 0, &xicapas);
+   return (res == ERROR_SUCCESS);
 }
 
 
@@ -481,15 +490,30 @@ static void joyxi_poll_connected_joysticks(void)
    }
 }
 
-/** Polls all disconnected joysticks. */
+/** Polls all disconnected joysticks. The mutex must be locked. */
 static void joyxi_poll_disconnected_joysticks(void)
 {
+   bool disconnected[MAX_JOYSTICKS];
+   bool connected = false;
    int index;
 
    for (index = 0; index < MAX_JOYSTICKS; index++) {
-      if (!((joyxi_joysticks + index)->active)) {
-         joyxi_poll_disconnected_joystick(joyxi_joysticks + index);
-      }
+      disconnected[index] = !joyxi_joysticks[index].active;
+   }
+
+   /* Probing an empty slot can take a long time, so do not hold up the
+    * polling of the connected joysticks meanwhile.
+    */
+   al_unlock_mutex(joyxi_mutex);
+   for (index = 0; index < MAX_JOYSTICKS; index++) {
+      if (disconnected[index] && joyxi_poll_disconnected_joystick(index))
+         connected = true;
+   }
+   al_lock_mutex(joyxi_mutex);
+
+   if (connected) {
+      /* Joystick was connected, need to reconfigure. */
+      joyxi_generate_reconfigure_event();
    }
 }
 
@@ -500,7 +524,14 @@ static void *joyxi_poll_thread(ALLEGRO_THREAD *thread, void *arg)
    al_lock_mutex(joyxi_mutex);
    /* Poll once every so much time, 10ms by default. */
    while (!al_get_thread_should_stop(thread)) {
-      al_init_timeout(&timeout, ALLEGRO_XINPUT_POLL_DELAY);
+      /* Nothing to poll until a joystick is connected and the joysticks
+       * are reconfigured, which signals the condition.
+       */
+      if (joyxi_get_num_joysticks() == 0) {
+         al_wait_cond(joyxi_cond, joyxi_mutex);
+         continue;
+      }
+      al_init_timeout(&timeout, joyxi_poll_delay);
       /* Wait for the condition for the polling time in stead of using
          al_rest to allows the polling thread to be awoken when needed. */
       al_wait_cond_until(joyxi_cond, joyxi_mutex, &timeout);
@@ -559,6 +590,34 @@ static void joyxi_init_joystick_info(ALLEGRO_JOYSTICK_XINPUT *xjoy)
    }
 }
 
+/* Reads the polling rate of connected joysticks from the configuration. */
+static void joyxi_init_poll_delay(void)
+{
+   const char *value;
+   int rate = ALLEGRO_XINPUT_POLL_RATE;
+
+   value = al_get_config_value(al_get_system_config(),
+      "joystick", "xinput_poll_rate");
+   if (value && value[0] != '\0')
+      rate = atoi(value);
+   if (rate > ALLEGRO_XINPUT_MAX_POLL_RATE)
+      rate = ALLEGRO_XINPUT_MAX_POLL_RATE;
+
+   if (rate <= 0) {
+      ALLEGRO_INFO("Connected joysticks are polled by the application.\n");
+      joyxi_poll_delay = 0.0;
+      return;
+   }
+
+   ALLEGRO_INFO("Polling connected joysticks at %d Hz.\n", rate);
+   joyxi_poll_delay = 1.0 / rate;
+
+   /* The default timer resolution of about 15 ms would limit the rate. */
+   if (joyxi_poll_delay < 0.015) {
+      joyxi_timer_period_set = (timeBeginPeriod(1) == TIMERR_NOERROR);
+   }
+}
+
 /* Initialization API function. */
 static bool joyxi_init_joystick(void)
 {
@@ -567,6 +626,8 @@ static bool joyxi_init_joystick(void)
    if (!load_xinput_module())
       return false;
 
+   joyxi_init_poll_delay();
+
    /* Create the mutex and two condition variables. */
    joyxi_mutex = al_create_mutex_recursive();
    if (!joyxi_mutex)
@@ -604,7 +665,8 @@ static bool joyxi_init_joystick(void)
     * thread will poll the inactive joysticks infrequently.
     * This is done like this to preserve performance.
     */
-   joyxi_thread = al_create_thread(joyxi_poll_thread, NULL);
+   if (joyxi_poll_delay > 0.0)
+      joyxi_thread = al_create_thread(joyxi_poll_thread, NULL);
    joyxi_disconnected_thread = al_create_thread(joyxi_poll_disconnected_thread, NULL);
 
    al_unlock_mutex(joyxi_mutex);
@@ -612,7 +674,8 @@ static bool joyxi_init_joystick(void)
    if (joyxi_thread) al_start_thread(joyxi_thread);
    if (joyxi_disconnected_thread) al_start_thread(joyxi_disconnected_thread);
 
-   return (joyxi_thread != NULL) && (joyxi_disconnected_thread != NULL);
+   return (joyxi_thread != NULL || joyxi_poll_delay == 0.0) &&
+      (joyxi_disconnected_thread != NULL);
 }
 
 
@@ -622,21 +685,37 @@ static void joyxi_exit_joystick(void)
    void *ret_value = NULL;
    if (!joyxi_mutex) return;
    if (!joyxi_cond) return;
-   if (!joyxi_thread) return;
-   /* Request the event thread to shut down, signal the condition, then join the thread. */
-   al_set_thread_should_stop(joyxi_thread);
-   al_signal_cond(joyxi_cond);
-   al_join_thread(joyxi_thread, &ret_value);
+   if (!joyxi_disconnected_thread) return;
+   /* Request the event threads to shut down, signal the conditions, then
+    * join the threads. The mutex is held while signalling, as the polling
+    * thread may wait without a timeout.
+    */
+   if (joyxi_thread) {
+      al_lock_mutex(joyxi_mutex);
+      al_set_thread_should_stop(joyxi_thread);
+      al_signal_cond(joyxi_cond);
+      al_unlock_mutex(joyxi_mutex);
+      al_join_thread(joyxi_thread, &ret_value);
+   }
    al_set_thread_should_stop(joyxi_disconnected_thread);
    al_signal_cond(joyxi_disconnected_cond);
    al_join_thread(joyxi_disconnected_thread, &ret_value);
 
    /* clean it all up. */
    al_destroy_thread(joyxi_disconnected_thread);
+   joyxi_disconnected_thread = NULL;
    al_destroy_cond(joyxi_disconnected_cond);
-   al_destroy_thread(joyxi_thread);
+   if (joyxi_thread) {
+      al_destroy_thread(joyxi_thread);
+      joyxi_thread = NULL;
+   }
    al_destroy_cond(joyxi_cond);
 
+   if (joyxi_timer_period_set) {
+      timeEndPeriod(1);
+      joyxi_timer_period_set = false;
+   }
+
    al_lock_mutex(joyxi_mutex);
    /* Disable xinput */
    _imp_XInputEnable(FALSE);
@@ -663,9 +742,9 @@ static bool joyxi_reconfigure_joysticks(void)
          joyxi_joysticks[index].active = (res == ERROR_SUCCESS);
       }
    }
-   al_unlock_mutex(joyxi_mutex);
    /** Signal the conditions so new events are sent immediately for the new joysticks. */
    al_signal_cond(joyxi_cond);
+   al_unlock_mutex(joyxi_mutex);
    /** Signal the disconnected thread in case another joystick got connected. */
    al_signal_cond(joyxi_disconnected_cond);
    return true;
@@ -815,4 +894,18 @@ static bool joyxi_get_active(ALLEGRO_JOYSTICK *joy)
 }
 
 
+/* Polls the connected joysticks right away, so that an application can
+ * pick up input at the start of each frame instead of waiting for the
+ * polling thread.
+ */
+static void joyxi_poll_joysticks(void)
+{
+   if (!joyxi_mutex)
+      return;
+   al_lock_mutex(joyxi_mutex);
+   joyxi_poll_connected_joysticks();
+   al_unlock_mutex(joyxi_mutex);
+}
+
+
 #endif /* #ifdef ALLEGRO_CFG_XINPUT */
@@ -41,6 +41,7 @@
 #include "allegro5/internal/aintern_display.h"
 #include "allegro5/internal/aintern_wunicode.h"
 #include "allegro5/internal/aintern_joystick.h"
+#include "allegro5/internal/aintern_system.h"
 #include "allegro5/internal/aintern_wjoydxnu.h"
 #include "allegro5/platform/aintwin.h"
 
@@ -1027,6 +1028,13 @@ static LRESULT CALLBACK window_callback(HWND hWnd, UINT message,
       case WM_DEVICECHANGE:
         _al_win_joystick_dinput_trigger_enumeration();
         break;
+      case WM_DISPLAYCHANGE:
+        /* Every top-level window gets this, but the change needs to be
+         * reported only once.
+         */
+        if (d == *(ALLEGRO_DISPLAY **)_al_vector_ref(&system->displays, 0))
+           _al_display_config_changed();
+        break;
    }
 
    return DefWindowProc(hWnd,message,wParam,lParam);
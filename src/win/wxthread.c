@@ -19,6 +19,7 @@
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_wunicode.h"
 
 #include <mmsystem.h>
 #include <process.h>
@@ -109,6 +110,69 @@ void _al_thread_detach(_AL_THREAD *thread)
 
 
 
+bool _al_thread_set_priority(_AL_THREAD *thread, int priority)
+{
+   int p;
+
+   ASSERT(thread);
+
+   switch (priority) {
+      case ALLEGRO_THREAD_PRIORITY_LOW:
+         p = THREAD_PRIORITY_BELOW_NORMAL;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_NORMAL:
+         p = THREAD_PRIORITY_NORMAL;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_HIGH:
+         p = THREAD_PRIORITY_HIGHEST;
+         break;
+      case ALLEGRO_THREAD_PRIORITY_REALTIME:
+         p = THREAD_PRIORITY_TIME_CRITICAL;
+         break;
+      default:
+         return false;
+   }
+
+   return SetThreadPriority(thread->thread, p) != 0;
+}
+
+
+bool _al_thread_set_affinity(_AL_THREAD *thread, uint64_t cpu_mask)
+{
+   ASSERT(thread);
+
+   /* Only the first processor group can be used this way. */
+   return SetThreadAffinityMask(thread->thread, (DWORD_PTR)cpu_mask) != 0;
+}
+
+
+bool _al_thread_set_name(_AL_THREAD *thread, const char *name)
+{
+   /* Only there since Windows 10 1607. */
+   typedef HRESULT (WINAPI *SET_THREAD_DESCRIPTION)(HANDLE, PCWSTR);
+   SET_THREAD_DESCRIPTION set_description;
+   wchar_t *wname;
+   HRESULT hr;
+
+   ASSERT(thread);
+   ASSERT(name);
+
+   set_description = (SET_THREAD_DESCRIPTION)GetProcAddress(
+      GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription");
+   if (!set_description)
+      return false;
+
+   wname = _al_win_utf8_to_utf16(name);
+   if (!wname)
+      return false;
+   hr = set_description(thread->thread, wname);
+   al_free(wname);
+
+   return SUCCEEDED(hr);
+}
+
+
+
 /* mutexes */
 
 void _al_mutex_init(_AL_MUTEX *mutex)
@@ -132,6 +196,20 @@ void _al_mutex_init_recursive(_AL_MUTEX *mutex)
 }
 
 
+void _al_mutex_init_adaptive(_AL_MUTEX *mutex)
+{
+   ASSERT(mutex);
+
+   if (!mutex->cs)
+      mutex->cs = al_malloc(sizeof *mutex->cs);
+   ASSERT(mutex->cs);
+   if (mutex->cs)
+      InitializeCriticalSectionAndSpinCount(mutex->cs, 4000);
+   else
+      abort();
+}
+
+
 void _al_mutex_destroy(_AL_MUTEX *mutex)
 {
    ASSERT(mutex);
@@ -144,6 +222,106 @@ void _al_mutex_destroy(_AL_MUTEX *mutex)
 }
 
 
+
+/* reader-writer locks */
+
+typedef VOID (WINAPI *SRW_FUNC)(void *);
+
+static SRW_FUNC acquire_srw_shared;
+static SRW_FUNC release_srw_shared;
+static SRW_FUNC acquire_srw_exclusive;
+static SRW_FUNC release_srw_exclusive;
+
+
+static bool have_srw_locks(void)
+{
+   static bool checked = false;
+
+   /* Racing threads all find the same functions. */
+   if (!checked) {
+      HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+      acquire_srw_shared = (SRW_FUNC)GetProcAddress(kernel32,
+         "AcquireSRWLockShared");
+      release_srw_shared = (SRW_FUNC)GetProcAddress(kernel32,
+         "ReleaseSRWLockShared");
+      acquire_srw_exclusive = (SRW_FUNC)GetProcAddress(kernel32,
+         "AcquireSRWLockExclusive");
+      release_srw_exclusive = (SRW_FUNC)GetProcAddress(kernel32,
+         "ReleaseSRWLockExclusive");
+      checked = true;
+   }
+
+   return acquire_srw_shared && release_srw_shared &&
+      acquire_srw_exclusive && release_srw_exclusive;
+}
+
+
+void _al_rwlock_init(_AL_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   rwlock->srw = NULL;  /* SRWLOCK_INIT */
+   rwlock->cs = NULL;
+   if (have_srw_locks())
+      return;
+
+   rwlock->cs = al_malloc(sizeof *rwlock->cs);
+   ASSERT(rwlock->cs);
+   if (rwlock->cs)
+      InitializeCriticalSection(rwlock->cs);
+   else
+      abort();
+}
+
+
+void _al_rwlock_destroy(_AL_RWLOCK *rwlock)
+{
+   ASSERT(rwlock);
+
+   if (rwlock->cs) {
+      DeleteCriticalSection(rwlock->cs);
+      al_free(rwlock->cs);
+      rwlock->cs = NULL;
+   }
+}
+
+
+void _al_rwlock_lock_read(_AL_RWLOCK *rwlock)
+{
+   if (rwlock->cs)
+      EnterCriticalSection(rwlock->cs);
+   else
+      acquire_srw_shared(&rwlock->srw);
+}
+
+
+void _al_rwlock_unlock_read(_AL_RWLOCK *rwlock)
+{
+   if (rwlock->cs)
+      LeaveCriticalSection(rwlock->cs);
+   else
+      release_srw_shared(&rwlock->srw);
+}
+
+
+void _al_rwlock_lock_write(_AL_RWLOCK *rwlock)
+{
+   if (rwlock->cs)
+      EnterCriticalSection(rwlock->cs);
+   else
+      acquire_srw_exclusive(&rwlock->srw);
+}
+
+
+void _al_rwlock_unlock_write(_AL_RWLOCK *rwlock)
+{
+   if (rwlock->cs)
+      LeaveCriticalSection(rwlock->cs);
+   else
+      release_srw_exclusive(&rwlock->srw);
+}
+
+
 /* condition variables */
 
 /*
@@ -1,5 +1,6 @@
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_opengl.h"
 #include "allegro5/internal/aintern_x.h"
@@ -525,6 +526,11 @@ static ALLEGRO_DISPLAY_XGLX *xdpy_create_display_locked(
    if (display->extra_settings.settings[ALLEGRO_COMPATIBLE_DISPLAY])
       _al_ogl_setup_gl(display);
 
+   /* Partial presents */
+   display->extra_settings.settings[ALLEGRO_UPDATE_DISPLAY_REGION] =
+      !display->extra_settings.settings[ALLEGRO_SINGLE_BUFFER] &&
+      display->ogl_extras->extension_list->ALLEGRO_GLX_MESA_copy_sub_buffer;
+
    /* vsync */
    int vsync_setting = _al_get_new_display_settings()->settings[ALLEGRO_VSYNC];
    vsync_setting = xdpy_swap_control(display, vsync_setting);
@@ -759,6 +765,10 @@ static void xdpy_destroy_display(ALLEGRO_DISPLAY *d)
 
    ALLEGRO_DEBUG("destroying display.\n");
 
+#ifndef ALLEGRO_CFG_OPENGLES
+   _al_ogl_destroy_upload_queue(d);
+#endif
+
    /* If we're the last display, convert all bitmaps to display independent
     * (memory) bitmaps. Otherwise, pass all bitmaps to any other living
     * display. We assume all displays are compatible.)
@@ -843,6 +853,81 @@ static void xdpy_unset_current_display(ALLEGRO_DISPLAY *d)
 }
 
 
+#ifndef ALLEGRO_CFG_OPENGLES
+static bool xdpy_create_upload_context(ALLEGRO_DISPLAY *d)
+{
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_XGLX *glx = (ALLEGRO_DISPLAY_XGLX *)d;
+
+   if (glx->fbc) {
+      int drawable_type = 0;
+      glx->upload_context = glXCreateNewContext(system->gfxdisplay, *glx->fbc,
+         GLX_RGBA_TYPE, glx->context, True);
+      glXGetFBConfigAttrib(system->gfxdisplay, *glx->fbc, GLX_DRAWABLE_TYPE,
+         &drawable_type);
+      if (drawable_type & GLX_PBUFFER_BIT) {
+         int attribs[] = {GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None};
+         glx->upload_pbuffer = glXCreatePbuffer(system->gfxdisplay,
+            *glx->fbc, attribs);
+         glx->upload_drawable = glx->upload_pbuffer;
+      }
+      else {
+         glx->upload_drawable = glx->glxwindow;
+      }
+   }
+   else {
+      glx->upload_context = glXCreateContext(system->gfxdisplay, glx->xvinfo,
+         glx->context, True);
+      glx->upload_drawable = glx->glxwindow;
+   }
+
+   if (!glx->upload_context || !glx->upload_drawable) {
+      ALLEGRO_ERROR("Failed to create GLX upload context.\n");
+      d->vt->destroy_upload_context(d);
+      return false;
+   }
+
+   return true;
+}
+
+
+static bool xdpy_set_upload_context_current(ALLEGRO_DISPLAY *d, bool current)
+{
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_XGLX *glx = (ALLEGRO_DISPLAY_XGLX *)d;
+
+   if (!current) {
+      if (glx->fbc)
+         return glXMakeContextCurrent(system->gfxdisplay, None, None, NULL);
+      return glXMakeCurrent(system->gfxdisplay, None, NULL);
+   }
+   if (glx->fbc) {
+      return glXMakeContextCurrent(system->gfxdisplay, glx->upload_drawable,
+         glx->upload_drawable, glx->upload_context);
+   }
+   return glXMakeCurrent(system->gfxdisplay, glx->upload_drawable,
+      glx->upload_context);
+}
+
+
+static void xdpy_destroy_upload_context(ALLEGRO_DISPLAY *d)
+{
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_XGLX *glx = (ALLEGRO_DISPLAY_XGLX *)d;
+
+   if (glx->upload_context) {
+      glXDestroyContext(system->gfxdisplay, glx->upload_context);
+      glx->upload_context = NULL;
+   }
+   if (glx->upload_pbuffer) {
+      glXDestroyPbuffer(system->gfxdisplay, glx->upload_pbuffer);
+      glx->upload_pbuffer = 0;
+   }
+   glx->upload_drawable = 0;
+}
+#endif
+
+
 static void xdpy_flip_display(ALLEGRO_DISPLAY *d)
 {
    ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
@@ -857,17 +942,97 @@ static void xdpy_flip_display(ALLEGRO_DISPLAY *d)
       glFlush();
    else
       glXSwapBuffers(system->gfxdisplay, glx->glxwindow);
+   glx->back_buffer_kept = false;
 }
 
 
 static void xdpy_update_display_region(ALLEGRO_DISPLAY *d, int x, int y,
    int w, int h)
 {
-   (void)x;
-   (void)y;
-   (void)w;
-   (void)h;
-   xdpy_flip_display(d);
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_XGLX *glx = (ALLEGRO_DISPLAY_XGLX *)d;
+
+   if (!d->extra_settings.settings[ALLEGRO_UPDATE_DISPLAY_REGION]) {
+      xdpy_flip_display(d);
+      return;
+   }
+
+   if (x < 0) {
+      w += x;
+      x = 0;
+   }
+   if (y < 0) {
+      h += y;
+      y = 0;
+   }
+   w = _ALLEGRO_MIN(w, d->w - x);
+   h = _ALLEGRO_MIN(h, d->h - y);
+
+   /* Copying leaves the back buffer alone, so the next frame can be drawn
+    * on top of this one. This implies a glFlush.
+    */
+   if (w > 0 && h > 0) {
+      glXCopySubBufferMESA(system->gfxdisplay, glx->glxwindow,
+         x, d->h - (y + h), w, h);
+   }
+   else {
+      glFlush();
+   }
+   glx->back_buffer_kept = true;
+}
+
+
+static bool xdpy_get_vsync_timing(ALLEGRO_DISPLAY *d, double *last_vsync,
+   double *interval)
+{
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_XGLX *glx = (ALLEGRO_DISPLAY_XGLX *)d;
+   int64_t ust, msc, sbc;
+   int32_t numerator, denominator;
+   struct timespec now;
+   double age;
+
+   if (!d->ogl_extras->extension_list->ALLEGRO_GLX_OML_sync_control)
+      return false;
+   if (!glXGetSyncValuesOML(system->gfxdisplay, glx->glxwindow,
+         &ust, &msc, &sbc))
+      return false;
+   if (!glXGetMscRateOML(system->gfxdisplay, glx->glxwindow,
+         &numerator, &denominator) || numerator <= 0)
+      return false;
+
+   /* The spec leaves the clock open, but drivers use CLOCK_MONOTONIC in
+    * microseconds. If that is not the case the age comes out wrong.
+    */
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   age = (double)now.tv_sec + now.tv_nsec * 1.0e-9 - ust * 1.0e-6;
+   if (age < 0 || age > 1)
+      return false;
+
+   *last_vsync = al_get_time() - age;
+   *interval = (double)denominator / numerator;
+   return true;
+}
+
+
+static int xdpy_get_buffer_age(ALLEGRO_DISPLAY *d)
+{
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_XGLX *glx = (ALLEGRO_DISPLAY_XGLX *)d;
+   unsigned int age = 0;
+
+   if (d->extra_settings.settings[ALLEGRO_SINGLE_BUFFER] ||
+         glx->back_buffer_kept)
+      return 1;
+
+   /* glXQueryDrawable is GLX 1.3+. */
+   if (!glx->fbc ||
+         !d->ogl_extras->extension_list->ALLEGRO_GLX_EXT_buffer_age)
+      return 0;
+
+   glXQueryDrawable(system->gfxdisplay, glx->glxwindow,
+      GLX_BACK_BUFFER_AGE_EXT, &age);
+   return age;
 }
 
 
@@ -1457,6 +1622,8 @@ ALLEGRO_DISPLAY_INTERFACE *_al_display_xglx_driver(void)
    xdpy_vt.unset_current_display = xdpy_unset_current_display;
    xdpy_vt.flip_display = xdpy_flip_display;
    xdpy_vt.update_display_region = xdpy_update_display_region;
+   xdpy_vt.get_buffer_age = xdpy_get_buffer_age;
+   xdpy_vt.get_vsync_timing = xdpy_get_vsync_timing;
    xdpy_vt.acknowledge_resize = xdpy_acknowledge_resize;
    xdpy_vt.create_bitmap = _al_ogl_create_bitmap;
    xdpy_vt.get_backbuffer = _al_ogl_get_backbuffer;
@@ -1474,6 +1641,14 @@ ALLEGRO_DISPLAY_INTERFACE *_al_display_xglx_driver(void)
    xdpy_vt.set_display_flag = xdpy_set_display_flag;
    xdpy_vt.wait_for_vsync = xdpy_wait_for_vsync;
    xdpy_vt.update_render_state = _al_ogl_update_render_state;
+#ifndef ALLEGRO_CFG_OPENGLES
+   xdpy_vt.queue_bitmap_upload = _al_ogl_queue_bitmap_upload;
+   xdpy_vt.finish_bitmap_upload = _al_ogl_finish_bitmap_upload;
+   xdpy_vt.cancel_bitmap_upload = _al_ogl_cancel_bitmap_upload;
+   xdpy_vt.create_upload_context = xdpy_create_upload_context;
+   xdpy_vt.set_upload_context_current = xdpy_set_upload_context_current;
+   xdpy_vt.destroy_upload_context = xdpy_destroy_upload_context;
+#endif
 
    _al_xwin_add_cursor_functions(&xdpy_vt);
    _al_xwin_add_clipboard_functions(&xdpy_vt);
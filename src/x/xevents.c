@@ -45,6 +45,12 @@ static void process_x11_event(ALLEGRO_SYSTEM_XGLX *s, XEvent event)
    unsigned int i;
    ALLEGRO_DISPLAY_XGLX *d = NULL;
 
+   /* Raw mouse motion is not tied to a window. */
+   if (event.type == GenericEvent &&
+         _al_xwin_mouse_generic_event_handler(&event)) {
+      return;
+   }
+
    /* With many windows, it's bad to loop through them all, but typically
     * we have one or at most two or so.
     */
@@ -190,6 +196,8 @@ void _al_xwin_background_thread(_AL_THREAD *self, void *arg)
    XEvent event;
    double last_reset_screensaver_time = 0.0;
 
+   _al_thread_set_name(self, "al-x-events");
+
    while (!_al_get_thread_should_stop(self)) {
       /* Note:
        * Most older X11 implementations are not thread-safe no matter what, so
@@ -220,6 +228,7 @@ void _al_xwin_background_thread(_AL_THREAD *self, void *arg)
          XNextEvent(s->x11display, &event);
          process_x11_event(s, event);
       }
+      _al_xwin_mouse_flush_raw_motion();
 
       /* The Xlib manual is particularly useless about the XResetScreenSaver()
        * function.  Nevertheless, this does seem to work to inhibit the native
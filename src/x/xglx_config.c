@@ -248,6 +248,13 @@ static ALLEGRO_EXTRA_DISPLAY_SETTINGS** get_visuals_new(ALLEGRO_DISPLAY_XGLX *gl
          al_free(eds[j]);
          continue;
       }
+      if (glx->display.flags & ALLEGRO_SRGB_FRAMEBUFFER) {
+         int srgb = 0;
+         glXGetFBConfigAttrib(system->gfxdisplay, fbconfig[i],
+            GLX_FRAMEBUFFER_SRGB_CAPABLE_EXT, &srgb);
+         if (srgb)
+            eds[j]->score += 128;
+      }
       eds[j]->index = i;
       eds[j]->info = al_malloc(sizeof(GLXFBConfig));
       memcpy(eds[j]->info, &fbconfig[i], sizeof(GLXFBConfig));
@@ -0,0 +1,780 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Headless EGL display driver.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+/* Used by the X system driver when it can't connect to an X server. Each
+ * display is an EGL pbuffer of the display's size, which stands in for the
+ * window, and an OpenGL context made current on it. So the rest of the
+ * OpenGL driver, which treats framebuffer 0 as the backbuffer, works
+ * unchanged, while video bitmaps are drawn to through FBOs as usual.
+ *
+ * The EGL display is taken from a GPU through EGL_EXT_platform_device if one
+ * can be found, else from EGL_MESA_platform_surfaceless. The new display
+ * adapter picks the device, when it is set.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_opengl.h"
+#include "allegro5/internal/aintern_pixels.h"
+#include "allegro5/internal/aintern_x.h"
+#include "allegro5/internal/aintern_xsystem.h"
+#include "allegro5/platform/aintxglx.h"
+
+#ifdef ALLEGRO_XWINDOWS_WITH_EGL_HEADLESS
+
+#include <EGL/egl.h>
+
+ALLEGRO_DEBUG_CHANNEL("display")
+
+#define MAX_DEVICES     16
+
+#ifndef EGL_PLATFORM_DEVICE_EXT
+#define EGL_PLATFORM_DEVICE_EXT              0x313F
+#endif
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA        0x31DD
+#endif
+#ifndef EGL_CONTEXT_MAJOR_VERSION_KHR
+#define EGL_CONTEXT_MAJOR_VERSION_KHR        0x3098
+#define EGL_CONTEXT_MINOR_VERSION_KHR        0x30FB
+#define EGL_CONTEXT_FLAGS_KHR                0x30FC
+#define EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR  0x30FD
+#define EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR   0x00000001
+#define EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE_BIT_KHR   0x00000002
+#endif
+#ifndef EGL_OPENGL_ES3_BIT_KHR
+#define EGL_OPENGL_ES3_BIT_KHR               0x00000040
+#endif
+
+typedef EGLDisplay (*GET_PLATFORM_DISPLAY_PROC)(EGLenum platform,
+   void *native_display, const EGLint *attribs);
+typedef EGLBoolean (*QUERY_DEVICES_PROC)(EGLint max_devices,
+   void **devices, EGLint *num_devices);
+typedef const char *(*QUERY_DEVICE_STRING_PROC)(void *device, EGLint name);
+
+typedef struct ALLEGRO_DISPLAY_HEADLESS
+{
+   ALLEGRO_DISPLAY display;
+   EGLConfig config;
+   EGLContext context;
+   EGLSurface pbuffer;
+   EGLContext upload_context;
+} ALLEGRO_DISPLAY_HEADLESS;
+
+static ALLEGRO_DISPLAY_INTERFACE headless_vt;
+
+/* All displays share one EGL display, so their contexts can share objects. */
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static bool have_surfaceless_context;
+
+
+static bool has_extension(const char *list, const char *name)
+{
+   return list && _al_ogl_look_for_an_extension(name, (const GLubyte *)list);
+}
+
+
+/* Prefers a hardware device, which has a DRM device file, over software
+ * renderers. Returns -1 if there is none.
+ */
+static int find_device(void **devices, int num_devices)
+{
+   QUERY_DEVICE_STRING_PROC query_device_string;
+   int i;
+
+   query_device_string = (QUERY_DEVICE_STRING_PROC)
+      eglGetProcAddress("eglQueryDeviceStringEXT");
+   if (!query_device_string)
+      return -1;
+
+   for (i = 0; i < num_devices; i++) {
+      const char *ext = query_device_string(devices[i], EGL_EXTENSIONS);
+      if (has_extension(ext, "EGL_EXT_device_drm"))
+         return i;
+   }
+   return -1;
+}
+
+
+static EGLDisplay open_egl_display(int adapter)
+{
+   const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   GET_PLATFORM_DISPLAY_PROC get_platform_display;
+   void *devices[MAX_DEVICES];
+   EGLint num_devices = 0;
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+   int i;
+
+   if (!has_extension(ext, "EGL_EXT_platform_base")) {
+      ALLEGRO_ERROR("EGL_EXT_platform_base not supported.\n");
+      return EGL_NO_DISPLAY;
+   }
+   get_platform_display = (GET_PLATFORM_DISPLAY_PROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+   if (!get_platform_display)
+      return EGL_NO_DISPLAY;
+
+   if (has_extension(ext, "EGL_EXT_platform_device")) {
+      QUERY_DEVICES_PROC query_devices = (QUERY_DEVICES_PROC)
+         eglGetProcAddress("eglQueryDevicesEXT");
+      if (!query_devices ||
+            !query_devices(MAX_DEVICES, devices, &num_devices)) {
+         num_devices = 0;
+      }
+      ALLEGRO_INFO("%d EGL devices.\n", (int)num_devices);
+
+      i = (adapter >= 0 && adapter < num_devices) ? adapter
+         : find_device(devices, num_devices);
+      if (i >= 0) {
+         ALLEGRO_INFO("Using EGL device %d.\n", i);
+         dpy = get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[i], NULL);
+      }
+   }
+
+   if (dpy == EGL_NO_DISPLAY &&
+         has_extension(ext, "EGL_MESA_platform_surfaceless")) {
+      ALLEGRO_INFO("Using the surfaceless EGL platform.\n");
+      dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+         EGL_DEFAULT_DISPLAY, NULL);
+   }
+
+   if (dpy == EGL_NO_DISPLAY && num_devices > 0) {
+      ALLEGRO_INFO("Using EGL device 0.\n");
+      dpy = get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[0], NULL);
+   }
+
+   return dpy;
+}
+
+
+static bool use_egl_display(int adapter)
+{
+   EGLint major, minor;
+
+   if (egl_display != EGL_NO_DISPLAY)
+      return true;
+
+   egl_display = open_egl_display(adapter);
+   if (egl_display == EGL_NO_DISPLAY) {
+      ALLEGRO_ERROR("No headless EGL display available.\n");
+      return false;
+   }
+   if (!eglInitialize(egl_display, &major, &minor)) {
+      ALLEGRO_ERROR("eglInitialize failed (0x%x).\n", eglGetError());
+      egl_display = EGL_NO_DISPLAY;
+      return false;
+   }
+   ALLEGRO_INFO("EGL %d.%d (%s).\n", major, minor,
+      eglQueryString(egl_display, EGL_VENDOR));
+
+   have_surfaceless_context = has_extension(
+      eglQueryString(egl_display, EGL_EXTENSIONS),
+      "EGL_KHR_surfaceless_context");
+   return true;
+}
+
+
+static bool want_es(ALLEGRO_DISPLAY *display)
+{
+   return (display->flags & ALLEGRO_OPENGL_ES_PROFILE) != 0;
+}
+
+
+/* Picks the first config with exactly the requested colour sizes, as
+ * eglChooseConfig puts deeper ones first.
+ */
+static bool choose_config(ALLEGRO_DISPLAY_HEADLESS *d)
+{
+   ALLEGRO_DISPLAY *display = (ALLEGRO_DISPLAY *)d;
+   ALLEGRO_EXTRA_DISPLAY_SETTINGS *eds = _al_get_new_display_settings();
+   EGLint attribs[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_ALPHA_SIZE, 8,
+      EGL_DEPTH_SIZE, eds->settings[ALLEGRO_DEPTH_SIZE],
+      EGL_STENCIL_SIZE, eds->settings[ALLEGRO_STENCIL_SIZE],
+      EGL_SAMPLE_BUFFERS, eds->settings[ALLEGRO_SAMPLE_BUFFERS],
+      EGL_SAMPLES, eds->settings[ALLEGRO_SAMPLES],
+      EGL_NONE
+   };
+   EGLConfig *configs;
+   EGLint num_configs = 0;
+   EGLint i;
+
+   if (want_es(display)) {
+      attribs[3] = (al_get_new_display_option(ALLEGRO_OPENGL_MAJOR_VERSION, 0)
+         >= 3) ? EGL_OPENGL_ES3_BIT_KHR : EGL_OPENGL_ES2_BIT;
+   }
+   if (eds->settings[ALLEGRO_RED_SIZE] || eds->settings[ALLEGRO_GREEN_SIZE] ||
+         eds->settings[ALLEGRO_BLUE_SIZE] ||
+         eds->settings[ALLEGRO_ALPHA_SIZE]) {
+      attribs[5] = eds->settings[ALLEGRO_RED_SIZE];
+      attribs[7] = eds->settings[ALLEGRO_GREEN_SIZE];
+      attribs[9] = eds->settings[ALLEGRO_BLUE_SIZE];
+      attribs[11] = eds->settings[ALLEGRO_ALPHA_SIZE];
+   }
+   else if (eds->settings[ALLEGRO_COLOR_SIZE] == 16) {
+      attribs[5] = 5;
+      attribs[7] = 6;
+      attribs[9] = 5;
+      attribs[11] = 0;
+   }
+
+   if (!eglChooseConfig(egl_display, attribs, NULL, 0, &num_configs) ||
+         num_configs == 0) {
+      ALLEGRO_ERROR("No matching EGL config.\n");
+      return false;
+   }
+   configs = al_malloc(num_configs * sizeof *configs);
+   if (!configs)
+      return false;
+   eglChooseConfig(egl_display, attribs, configs, num_configs, &num_configs);
+
+   d->config = configs[0];
+   for (i = 0; i < num_configs; i++) {
+      EGLint r, g, b;
+      eglGetConfigAttrib(egl_display, configs[i], EGL_RED_SIZE, &r);
+      eglGetConfigAttrib(egl_display, configs[i], EGL_GREEN_SIZE, &g);
+      eglGetConfigAttrib(egl_display, configs[i], EGL_BLUE_SIZE, &b);
+      if (r == attribs[5] && g == attribs[7] && b == attribs[9]) {
+         d->config = configs[i];
+         break;
+      }
+   }
+   al_free(configs);
+   return true;
+}
+
+
+/* Fills in the display settings from the chosen config. */
+static void read_config(ALLEGRO_DISPLAY_HEADLESS *d)
+{
+   ALLEGRO_EXTRA_DISPLAY_SETTINGS *eds = &d->display.extra_settings;
+   EGLint r, g, b, a, depth, stencil, sample_buffers, samples;
+   int format;
+
+   eglGetConfigAttrib(egl_display, d->config, EGL_RED_SIZE, &r);
+   eglGetConfigAttrib(egl_display, d->config, EGL_GREEN_SIZE, &g);
+   eglGetConfigAttrib(egl_display, d->config, EGL_BLUE_SIZE, &b);
+   eglGetConfigAttrib(egl_display, d->config, EGL_ALPHA_SIZE, &a);
+   eglGetConfigAttrib(egl_display, d->config, EGL_DEPTH_SIZE, &depth);
+   eglGetConfigAttrib(egl_display, d->config, EGL_STENCIL_SIZE, &stencil);
+   eglGetConfigAttrib(egl_display, d->config, EGL_SAMPLE_BUFFERS,
+      &sample_buffers);
+   eglGetConfigAttrib(egl_display, d->config, EGL_SAMPLES, &samples);
+
+   /* EGL does not tell the component order, so assume what X visuals use. */
+   if (r == 5 && g == 6 && b == 5)
+      format = ALLEGRO_PIXEL_FORMAT_RGB_565;
+   else if (a > 0)
+      format = ALLEGRO_PIXEL_FORMAT_ARGB_8888;
+   else
+      format = ALLEGRO_PIXEL_FORMAT_XRGB_8888;
+   _al_set_color_components(format, eds, ALLEGRO_REQUIRE);
+
+   eds->settings[ALLEGRO_DEPTH_SIZE] = depth;
+   eds->settings[ALLEGRO_STENCIL_SIZE] = stencil;
+   eds->settings[ALLEGRO_SAMPLE_BUFFERS] = sample_buffers;
+   eds->settings[ALLEGRO_SAMPLES] = samples;
+   eds->settings[ALLEGRO_RENDER_METHOD] = 1;
+   eds->settings[ALLEGRO_SINGLE_BUFFER] = 1;
+   eds->settings[ALLEGRO_SWAP_METHOD] = 1;
+   eds->settings[ALLEGRO_VSYNC] = 2;
+}
+
+
+static EGLContext create_context(ALLEGRO_DISPLAY_HEADLESS *d,
+   EGLContext share)
+{
+   ALLEGRO_DISPLAY *display = (ALLEGRO_DISPLAY *)d;
+   int major = al_get_new_display_option(ALLEGRO_OPENGL_MAJOR_VERSION, 0);
+   int minor = al_get_new_display_option(ALLEGRO_OPENGL_MINOR_VERSION, 0);
+   bool forward_compat = (display->flags & ALLEGRO_OPENGL_FORWARD_COMPATIBLE) != 0;
+   bool core_profile = (display->flags & ALLEGRO_OPENGL_CORE_PROFILE) != 0;
+   EGLint attribs[9];
+   int n = 0;
+
+   if (want_es(display)) {
+      eglBindAPI(EGL_OPENGL_ES_API);
+      attribs[n++] = EGL_CONTEXT_MAJOR_VERSION_KHR;
+      attribs[n++] = (major == 0) ? 2 : major;
+   }
+   else {
+      eglBindAPI(EGL_OPENGL_API);
+      if ((display->flags & ALLEGRO_OPENGL_3_0) || major != 0 || core_profile) {
+         if (major == 0)
+            major = 3;
+         if (core_profile && major == 3 && minor < 2)
+            minor = 2;
+         attribs[n++] = EGL_CONTEXT_MAJOR_VERSION_KHR;
+         attribs[n++] = major;
+         attribs[n++] = EGL_CONTEXT_MINOR_VERSION_KHR;
+         attribs[n++] = minor;
+         if (forward_compat) {
+            attribs[n++] = EGL_CONTEXT_FLAGS_KHR;
+            attribs[n++] = EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE_BIT_KHR;
+         }
+         if (core_profile) {
+            attribs[n++] = EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR;
+            attribs[n++] = EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR;
+         }
+         /* See _al_xglx_config_create_context. */
+         display->extra_settings.settings[ALLEGRO_COMPATIBLE_DISPLAY] = 1;
+         if (forward_compat && !(display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE))
+            display->extra_settings.settings[ALLEGRO_COMPATIBLE_DISPLAY] = 0;
+      }
+   }
+   attribs[n] = EGL_NONE;
+
+   return eglCreateContext(egl_display, d->config, share, attribs);
+}
+
+
+static EGLSurface create_pbuffer(ALLEGRO_DISPLAY_HEADLESS *d, int w, int h)
+{
+   EGLint attribs[] = { EGL_WIDTH, w, EGL_HEIGHT, h, EGL_NONE };
+
+   return eglCreatePbufferSurface(egl_display, d->config, attribs);
+}
+
+
+static void headless_destroy_display(ALLEGRO_DISPLAY *d);
+
+
+static ALLEGRO_DISPLAY *headless_create_display(int w, int h)
+{
+   ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_HEADLESS *d;
+   ALLEGRO_DISPLAY *display;
+   ALLEGRO_OGL_EXTRAS *ogl;
+   EGLContext share = EGL_NO_CONTEXT;
+
+   if (w <= 0 || h <= 0) {
+      ALLEGRO_ERROR("Invalid display size %dx%d\n", w, h);
+      return NULL;
+   }
+
+   d = al_calloc(1, sizeof *d);
+   ogl = al_calloc(1, sizeof *ogl);
+   if (!d || !ogl) {
+      al_free(d);
+      al_free(ogl);
+      return NULL;
+   }
+   display = (ALLEGRO_DISPLAY *)d;
+   display->ogl_extras = ogl;
+   display->w = w;
+   display->h = h;
+   display->vt = _al_display_egl_headless_driver();
+   display->refresh_rate = al_get_new_display_refresh_rate();
+   display->flags = al_get_new_display_flags();
+   display->flags &= ~(ALLEGRO_FULLSCREEN | ALLEGRO_FULLSCREEN_WINDOW);
+   display->flags |= ALLEGRO_OPENGL;
+#ifdef ALLEGRO_CFG_OPENGLES2
+   display->flags |= ALLEGRO_PROGRAMMABLE_PIPELINE;
+#endif
+#ifdef ALLEGRO_CFG_OPENGLES
+   display->flags |= ALLEGRO_OPENGL_ES_PROFILE;
+#endif
+
+   _al_mutex_lock(&system->lock);
+
+   if (!use_egl_display(al_get_new_display_adapter())) {
+      _al_mutex_unlock(&system->lock);
+      al_free(d);
+      al_free(ogl);
+      return NULL;
+   }
+
+   /* Share objects with an existing display. */
+   if (_al_vector_size(&system->system.displays) > 0) {
+      ALLEGRO_DISPLAY_HEADLESS **first =
+         _al_vector_ref_front(&system->system.displays);
+      share = (*first)->context;
+   }
+
+   ALLEGRO_DISPLAY_HEADLESS **add = _al_vector_alloc_back(&system->system.displays);
+   *add = d;
+   _al_event_source_init(&display->es);
+
+   _al_mutex_unlock(&system->lock);
+
+   if (!choose_config(d))
+      goto Error;
+   read_config(d);
+
+   d->context = create_context(d, share);
+   if (d->context == EGL_NO_CONTEXT) {
+      ALLEGRO_ERROR("eglCreateContext failed (0x%x).\n", eglGetError());
+      goto Error;
+   }
+   ogl->is_shared = true;
+
+   d->pbuffer = create_pbuffer(d, w, h);
+   if (d->pbuffer == EGL_NO_SURFACE) {
+      ALLEGRO_ERROR("eglCreatePbufferSurface failed (0x%x).\n", eglGetError());
+      goto Error;
+   }
+
+   if (!eglMakeCurrent(egl_display, d->pbuffer, d->pbuffer, d->context)) {
+      ALLEGRO_ERROR("eglMakeCurrent failed (0x%x).\n", eglGetError());
+      goto Error;
+   }
+
+   _al_ogl_manage_extensions(display);
+   _al_ogl_set_extensions(ogl->extension_api);
+
+   ALLEGRO_INFO("OpenGL Version: %s\n", (const char*)glGetString(GL_VERSION));
+   ALLEGRO_INFO("Vendor: %s\n", (const char*)glGetString(GL_VENDOR));
+   ALLEGRO_INFO("Renderer: %s\n", (const char*)glGetString(GL_RENDERER));
+
+   const int v = ogl->ogl_info.version;
+   display->extra_settings.settings[ALLEGRO_OPENGL_MAJOR_VERSION] = (v >> 24) & 0xFF;
+   display->extra_settings.settings[ALLEGRO_OPENGL_MINOR_VERSION] = (v >> 16) & 0xFF;
+
+   if (v < _ALLEGRO_OPENGL_VERSION_1_2) {
+      ALLEGRO_EXTRA_DISPLAY_SETTINGS *eds = _al_get_new_display_settings();
+      if (eds->required & (1<<ALLEGRO_COMPATIBLE_DISPLAY)) {
+         ALLEGRO_ERROR("Allegro requires at least OpenGL version 1.2 to work.\n");
+         goto Error;
+      }
+      display->extra_settings.settings[ALLEGRO_COMPATIBLE_DISPLAY] = 0;
+   }
+   else if (!display->extra_settings.settings[ALLEGRO_OPENGL_MAJOR_VERSION] ||
+         !(display->flags & ALLEGRO_OPENGL_FORWARD_COMPATIBLE) ||
+         (display->flags & ALLEGRO_PROGRAMMABLE_PIPELINE)) {
+      display->extra_settings.settings[ALLEGRO_COMPATIBLE_DISPLAY] = 1;
+   }
+
+   if (display->extra_settings.settings[ALLEGRO_COMPATIBLE_DISPLAY])
+      _al_ogl_setup_gl(display);
+
+   ALLEGRO_INFO("Created %dx%d headless display.\n", w, h);
+   return display;
+
+Error:
+   headless_destroy_display(display);
+   return NULL;
+}
+
+
+static void headless_destroy_display(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_SYSTEM_XGLX *s = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
+   ALLEGRO_DISPLAY_HEADLESS *d = (ALLEGRO_DISPLAY_HEADLESS *)display;
+   ALLEGRO_OGL_EXTRAS *ogl = display->ogl_extras;
+   ALLEGRO_DISPLAY *living = NULL;
+   size_t i;
+
+   ALLEGRO_DEBUG("destroying headless display.\n");
+
+#ifndef ALLEGRO_CFG_OPENGLES
+   _al_ogl_destroy_upload_queue(display);
+#endif
+
+   /* Pass the bitmaps to another display, as all share their objects, or
+    * make them memory bitmaps if this is the last one.
+    */
+   for (i = 0; i < _al_vector_size(&s->system.displays); i++) {
+      ALLEGRO_DISPLAY **slot = _al_vector_ref(&s->system.displays, i);
+      if (*slot != display) {
+         living = *slot;
+         break;
+      }
+   }
+   if (living) {
+      for (i = 0; i < _al_vector_size(&display->bitmaps); i++) {
+         ALLEGRO_BITMAP **add = _al_vector_alloc_back(&living->bitmaps);
+         ALLEGRO_BITMAP **ref = _al_vector_ref(&display->bitmaps, i);
+         *add = *ref;
+         (*add)->_display = living;
+      }
+   }
+   else {
+      while (_al_vector_size(&display->bitmaps) > 0) {
+         ALLEGRO_BITMAP **bptr = _al_vector_ref_back(&display->bitmaps);
+         _al_convert_to_memory_bitmap(*bptr);
+      }
+   }
+
+   _al_ogl_unmanage_extensions(display);
+
+   _al_mutex_lock(&s->lock);
+   _al_vector_find_and_delete(&s->system.displays, &display);
+
+   if (ogl->backbuffer) {
+      _al_ogl_destroy_backbuffer(ogl->backbuffer);
+      ogl->backbuffer = NULL;
+   }
+
+   if (eglGetCurrentContext() == d->context)
+      eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   if (d->pbuffer != EGL_NO_SURFACE)
+      eglDestroySurface(egl_display, d->pbuffer);
+   if (d->context != EGL_NO_CONTEXT)
+      eglDestroyContext(egl_display, d->context);
+
+   if (!living && egl_display != EGL_NO_DISPLAY) {
+      eglTerminate(egl_display);
+      egl_display = EGL_NO_DISPLAY;
+   }
+
+   _al_vector_free(&display->bitmaps);
+   _al_event_source_free(&display->es);
+
+   al_free(display->ogl_extras);
+   al_free(display->vertex_cache);
+   al_free(display);
+
+   _al_mutex_unlock(&s->lock);
+}
+
+
+static bool headless_set_current_display(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_DISPLAY_HEADLESS *d = (ALLEGRO_DISPLAY_HEADLESS *)display;
+
+   if (!eglMakeCurrent(egl_display, d->pbuffer, d->pbuffer, d->context)) {
+      ALLEGRO_ERROR("eglMakeCurrent failed (0x%x).\n", eglGetError());
+      return false;
+   }
+   _al_ogl_set_extensions(display->ogl_extras->extension_api);
+   _al_ogl_update_render_state(display);
+   return true;
+}
+
+
+static void headless_unset_current_display(ALLEGRO_DISPLAY *display)
+{
+   (void)display;
+   eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+
+#ifndef ALLEGRO_CFG_OPENGLES
+/* Background uploads need no surface where EGL_KHR_surfaceless_context is
+ * supported, which is the case for both platforms used here.
+ */
+static bool headless_create_upload_context(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_DISPLAY_HEADLESS *d = (ALLEGRO_DISPLAY_HEADLESS *)display;
+
+   if (!have_surfaceless_context)
+      return false;
+
+   d->upload_context = eglCreateContext(egl_display, d->config, d->context,
+      NULL);
+   if (d->upload_context == EGL_NO_CONTEXT) {
+      ALLEGRO_ERROR("Failed to create EGL upload context.\n");
+      return false;
+   }
+   return true;
+}
+
+
+static bool headless_set_upload_context_current(ALLEGRO_DISPLAY *display,
+   bool current)
+{
+   ALLEGRO_DISPLAY_HEADLESS *d = (ALLEGRO_DISPLAY_HEADLESS *)display;
+
+   return eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+      current ? d->upload_context : EGL_NO_CONTEXT);
+}
+
+
+static void headless_destroy_upload_context(ALLEGRO_DISPLAY *display)
+{
+   ALLEGRO_DISPLAY_HEADLESS *d = (ALLEGRO_DISPLAY_HEADLESS *)display;
+
+   if (d->upload_context != EGL_NO_CONTEXT) {
+      eglDestroyContext(egl_display, d->upload_context);
+      d->upload_context = EGL_NO_CONTEXT;
+   }
+}
+#endif
+
+
+/* The pbuffer is single buffered, so there is nothing to show. */
+static void headless_flip_display(ALLEGRO_DISPLAY *display)
+{
+   int e = glGetError();
+   if (e) {
+      ALLEGRO_ERROR("OpenGL error was not 0: %s\n", _al_gl_error_string(e));
+   }
+   (void)display;
+   glFlush();
+}
+
+
+static void headless_update_display_region(ALLEGRO_DISPLAY *display,
+   int x, int y, int w, int h)
+{
+   (void)x;
+   (void)y;
+   (void)w;
+   (void)h;
+   headless_flip_display(display);
+}
+
+
+/* Flipping never discards the contents. */
+static int headless_get_buffer_age(ALLEGRO_DISPLAY *display)
+{
+   (void)display;
+   return 1;
+}
+
+
+static bool headless_acknowledge_resize(ALLEGRO_DISPLAY *display)
+{
+   (void)display;
+   return true;
+}
+
+
+/* The pbuffer can't change size, so a new one replaces it. Its contents are
+ * lost.
+ */
+static bool headless_resize_display(ALLEGRO_DISPLAY *display, int w, int h)
+{
+   ALLEGRO_DISPLAY_HEADLESS *d = (ALLEGRO_DISPLAY_HEADLESS *)display;
+   EGLSurface pbuffer;
+
+   if (w <= 0 || h <= 0)
+      return false;
+   if (w == display->w && h == display->h)
+      return true;
+
+   pbuffer = create_pbuffer(d, w, h);
+   if (pbuffer == EGL_NO_SURFACE) {
+      ALLEGRO_ERROR("eglCreatePbufferSurface failed (0x%x).\n", eglGetError());
+      return false;
+   }
+
+   /* If the old pbuffer is current in another thread, EGL only destroys it
+    * when it is released there.
+    */
+   if (eglGetCurrentContext() == d->context)
+      eglMakeCurrent(egl_display, pbuffer, pbuffer, d->context);
+   eglDestroySurface(egl_display, d->pbuffer);
+   d->pbuffer = pbuffer;
+
+   display->w = w;
+   display->h = h;
+   _al_ogl_setup_gl(display);
+   return true;
+}
+
+
+static bool headless_is_compatible_bitmap(ALLEGRO_DISPLAY *display,
+   ALLEGRO_BITMAP *bitmap)
+{
+   /* All contexts are shared. */
+   (void)display;
+   (void)bitmap;
+   return true;
+}
+
+
+static bool headless_wait_for_vsync(ALLEGRO_DISPLAY *display)
+{
+   (void)display;
+   return false;
+}
+
+
+static void headless_set_window_title(ALLEGRO_DISPLAY *display,
+   const char *title)
+{
+   (void)display;
+   (void)title;
+}
+
+
+static void headless_set_icons(ALLEGRO_DISPLAY *display, int num_icons,
+   ALLEGRO_BITMAP *bitmaps[])
+{
+   (void)display;
+   (void)num_icons;
+   (void)bitmaps;
+}
+
+
+static void headless_get_window_position(ALLEGRO_DISPLAY *display,
+   int *x, int *y)
+{
+   (void)display;
+   *x = 0;
+   *y = 0;
+}
+
+
+static bool headless_set_display_flag(ALLEGRO_DISPLAY *display, int flag,
+   bool onoff)
+{
+   (void)display;
+   (void)flag;
+   (void)onoff;
+   return false;
+}
+
+
+/* Obtain a reference to this driver. */
+ALLEGRO_DISPLAY_INTERFACE *_al_display_egl_headless_driver(void)
+{
+   if (headless_vt.create_display)
+      return &headless_vt;
+
+   headless_vt.create_display = headless_create_display;
+   headless_vt.destroy_display = headless_destroy_display;
+   headless_vt.set_current_display = headless_set_current_display;
+   headless_vt.unset_current_display = headless_unset_current_display;
+   headless_vt.flip_display = headless_flip_display;
+   headless_vt.update_display_region = headless_update_display_region;
+   headless_vt.get_buffer_age = headless_get_buffer_age;
+   headless_vt.acknowledge_resize = headless_acknowledge_resize;
+   headless_vt.create_bitmap = _al_ogl_create_bitmap;
+   headless_vt.get_backbuffer = _al_ogl_get_backbuffer;
+   headless_vt.set_target_bitmap = _al_ogl_set_target_bitmap;
+   headless_vt.is_compatible_bitmap = headless_is_compatible_bitmap;
+   headless_vt.resize_display = headless_resize_display;
+   headless_vt.set_icons = headless_set_icons;
+   headless_vt.set_window_title = headless_set_window_title;
+   headless_vt.get_window_position = headless_get_window_position;
+   headless_vt.set_display_flag = headless_set_display_flag;
+   headless_vt.wait_for_vsync = headless_wait_for_vsync;
+   headless_vt.update_render_state = _al_ogl_update_render_state;
+#ifndef ALLEGRO_CFG_OPENGLES
+   headless_vt.queue_bitmap_upload = _al_ogl_queue_bitmap_upload;
+   headless_vt.finish_bitmap_upload = _al_ogl_finish_bitmap_upload;
+   headless_vt.cancel_bitmap_upload = _al_ogl_cancel_bitmap_upload;
+   headless_vt.create_upload_context = headless_create_upload_context;
+   headless_vt.set_upload_context_current = headless_set_upload_context_current;
+   headless_vt.destroy_upload_context = headless_destroy_upload_context;
+#endif
+
+   _al_ogl_add_drawing_functions(&headless_vt);
+
+   return &headless_vt;
+}
+
+#endif /* ALLEGRO_XWINDOWS_WITH_EGL_HEADLESS */
+
+/* vim: set sts=3 sw=3 et: */
@@ -38,14 +38,56 @@
 #define ALLEGRO_DISPLAY_XGLX ALLEGRO_DISPLAY_RASPBERRYPI
 #endif
 
+#if defined(ALLEGRO_XWINDOWS_WITH_XINPUT2) && !defined(ALLEGRO_RASPBERRYPI)
+#define SUPPORT_RAW_INPUT
+#include <X11/extensions/XInput2.h>
+#endif
+
 ALLEGRO_DEBUG_CHANNEL("mouse")
 
+/* Raw motion samples collected while the background thread drains the X
+ * event queue, emitted together afterwards.
+ */
+#define MAX_RAW_SAMPLES    64
+
+/* Number of pointer devices whose valuator mode is remembered. */
+#define MAX_RAW_DEVICES    16
+
+/* For this long after a relative device moved, core motion events are
+ * assumed to repeat its raw motion and only update the position.
+ */
+#define RAW_MOTION_GRACE   0.1
+
+typedef struct RAW_SAMPLE
+{
+   int dx, dy;
+   double timestamp;
+} RAW_SAMPLE;
+
+typedef struct RAW_DEVICE
+{
+   int id;
+   bool relative;
+} RAW_DEVICE;
+
 typedef struct ALLEGRO_MOUSE_XWIN
 {
    ALLEGRO_MOUSE parent;
    ALLEGRO_MOUSE_STATE state;
    int min_x, min_y;
    int max_x, max_y;
+
+   /* Raw input mode, see _al_xwin_mouse_generic_event_handler. */
+   bool raw_input;
+   int xi_opcode;
+   double raw_dx, raw_dy;        /* sub-pixel motion not reported yet */
+   double last_raw_motion;
+   double time_offset;           /* Allegro time minus X server time */
+   bool have_time_offset;
+   RAW_SAMPLE raw_samples[MAX_RAW_SAMPLES];
+   int num_raw_samples;
+   RAW_DEVICE raw_devices[MAX_RAW_DEVICES];
+   int num_raw_devices;
 } ALLEGRO_MOUSE_XWIN;
 
 
@@ -74,6 +116,12 @@ static void generate_mouse_event(unsigned int type,
    int dx, int dy, int dz, int dw,
    unsigned int button,
    ALLEGRO_DISPLAY *display);
+static void generate_mouse_event_at(double timestamp, unsigned int type,
+   int x, int y, int z, int w, float pressure,
+   int dx, int dy, int dz, int dw,
+   unsigned int button,
+   ALLEGRO_DISPLAY *display);
+static void enable_raw_input(ALLEGRO_SYSTEM_XGLX *system, bool enable);
 
 
 
@@ -131,6 +179,8 @@ static bool xmouse_init(void)
 
    _al_event_source_init(&the_mouse.parent.es);
 
+   enable_raw_input(system, true);
+
    xmouse_installed = true;
 
    return true;
@@ -147,6 +197,8 @@ static void xmouse_exit(void)
       return;
    xmouse_installed = false;
 
+   enable_raw_input((void *)al_get_system_driver(), false);
+
    _al_event_source_free(&the_mouse.parent.es);
 }
 
@@ -456,6 +508,13 @@ void _al_xwin_mouse_motion_notify_handler(int x, int y,
    the_mouse.state.y = y;
    the_mouse.state.display = display;
 
+   /* The motion was or will be reported from the raw events. */
+   if (event_type == ALLEGRO_EVENT_MOUSE_AXES && the_mouse.raw_input &&
+         al_get_time() - the_mouse.last_raw_motion < RAW_MOTION_GRACE) {
+      _al_event_source_unlock(&the_mouse.parent.es);
+      return;
+   }
+
    generate_mouse_event(
       event_type,
       the_mouse.state.x, the_mouse.state.y, the_mouse.state.z,
@@ -504,6 +563,22 @@ static void generate_mouse_event(unsigned int type,
                                  int dx, int dy, int dz, int dw,
                                  unsigned int button,
                                  ALLEGRO_DISPLAY *display)
+{
+   generate_mouse_event_at(al_get_time(), type, x, y, z, w, pressure,
+      dx, dy, dz, dw, button, display);
+}
+
+
+
+/* generate_mouse_event_at: [bgman thread]
+ *  Like generate_mouse_event, for an event which happened at the given
+ *  time rather than just now.
+ */
+static void generate_mouse_event_at(double timestamp, unsigned int type,
+                                    int x, int y, int z, int w, float pressure,
+                                    int dx, int dy, int dz, int dw,
+                                    unsigned int button,
+                                    ALLEGRO_DISPLAY *display)
 {
    ALLEGRO_EVENT event;
 
@@ -511,7 +586,7 @@ static void generate_mouse_event(unsigned int type,
       return;
 
    event.mouse.type = type;
-   event.mouse.timestamp = al_get_time();
+   event.mouse.timestamp = timestamp;
    event.mouse.display = display;
    event.mouse.x = x;
    event.mouse.y = y;
@@ -573,6 +648,242 @@ void _al_xwin_mouse_switch_handler(ALLEGRO_DISPLAY *display,
    _al_event_source_unlock(&the_mouse.parent.es);
 }
 
+/* enable_raw_input: [primary thread]
+ *  Start or stop receiving XI_RawMotion events, if raw input is enabled
+ *  in the configuration and the server supports it.
+ */
+static void enable_raw_input(ALLEGRO_SYSTEM_XGLX *system, bool enable)
+{
+#ifdef SUPPORT_RAW_INPUT
+   XIEventMask event_mask;
+   unsigned char mask[XIMaskLen(XI_RawMotion)];
+
+   if (enable) {
+      const char *value = al_get_config_value(al_get_system_config(),
+         "x11", "raw_mouse_input");
+      int event, error;
+      int major = 2;
+      int minor = 2;
+
+      if (!value || strcmp(value, "true") != 0)
+         return;
+
+      if (!XQueryExtension(system->x11display, "XInputExtension",
+            &the_mouse.xi_opcode, &event, &error) ||
+            XIQueryVersion(system->x11display, &major, &minor) != Success) {
+         ALLEGRO_WARN("XInput2 not available, no raw mouse input.\n");
+         return;
+      }
+   }
+   else if (!the_mouse.raw_input) {
+      return;
+   }
+
+   /* Raw events are only delivered to the root window. */
+   memset(mask, 0, sizeof(mask));
+   if (enable)
+      XISetMask(mask, XI_RawMotion);
+   event_mask.deviceid = XIAllMasterDevices;
+   event_mask.mask_len = sizeof(mask);
+   event_mask.mask = mask;
+
+   _al_mutex_lock(&system->lock);
+   XISelectEvents(system->x11display, DefaultRootWindow(system->x11display),
+      &event_mask, 1);
+   XFlush(system->x11display);
+   the_mouse.raw_input = enable;
+   _al_mutex_unlock(&system->lock);
+
+   ALLEGRO_INFO("Raw mouse input %s.\n", enable ? "enabled" : "disabled");
+#else
+   (void)system;
+   (void)enable;
+#endif
+}
+
+
+
+#ifdef SUPPORT_RAW_INPUT
+/* is_relative_device: [bgman thread]
+ *  Return true if the device reports its motion as deltas, rather than
+ *  as absolute positions like tablets and touchscreens do.
+ */
+static bool is_relative_device(Display *dpy, int deviceid)
+{
+   XIDeviceInfo *info;
+   bool relative = false;
+   int num_devices;
+   int i;
+
+   for (i = 0; i < the_mouse.num_raw_devices; i++) {
+      if (the_mouse.raw_devices[i].id == deviceid)
+         return the_mouse.raw_devices[i].relative;
+   }
+
+   info = XIQueryDevice(dpy, deviceid, &num_devices);
+   if (info) {
+      for (i = 0; i < info->num_classes; i++) {
+         XIValuatorClassInfo *v = (XIValuatorClassInfo *)info->classes[i];
+         if (v->type == XIValuatorClass && v->number == 0) {
+            relative = (v->mode == XIModeRelative);
+            break;
+         }
+      }
+      XIFreeDeviceInfo(info);
+   }
+
+   if (the_mouse.num_raw_devices < MAX_RAW_DEVICES) {
+      the_mouse.raw_devices[the_mouse.num_raw_devices].id = deviceid;
+      the_mouse.raw_devices[the_mouse.num_raw_devices].relative = relative;
+      the_mouse.num_raw_devices++;
+   }
+
+   return relative;
+}
+
+
+
+/* server_time_to_allegro: [bgman thread]
+ *  Convert an X server timestamp to the al_get_time clock.
+ */
+static double server_time_to_allegro(Time time)
+{
+   const double server_time = time / 1000.0;
+   const double offset = al_get_time() - server_time;
+
+   /* Events only ever arrive late, so the smallest difference seen is the
+    * closest to the real one. Start over if the server clock jumps, e.g.
+    * when it wraps around after 49 days.
+    */
+   if (!the_mouse.have_time_offset || offset < the_mouse.time_offset ||
+         offset - the_mouse.time_offset > 1.0) {
+      the_mouse.time_offset = offset;
+      the_mouse.have_time_offset = true;
+   }
+
+   return server_time + the_mouse.time_offset;
+}
+
+
+
+/* handle_raw_motion: [bgman thread]
+ *  Queue up the motion of a raw event, unaccelerated and with its own
+ *  timestamp.
+ */
+static void handle_raw_motion(Display *dpy, const XIRawEvent *raw)
+{
+   const double *value = raw->raw_values;
+   double dx = 0.0;
+   double dy = 0.0;
+   RAW_SAMPLE *sample;
+   int i;
+
+   if (!is_relative_device(dpy, raw->sourceid))
+      return;
+
+   /* Only the valuators in the mask are present, in order. */
+   for (i = 0; i < raw->valuators.mask_len * 8 && i <= 1; i++) {
+      if (XIMaskIsSet(raw->valuators.mask, i)) {
+         if (i == 0)
+            dx = *value;
+         else
+            dy = *value;
+         value++;
+      }
+   }
+
+   the_mouse.last_raw_motion = al_get_time();
+
+   /* Raw events come for the whole screen. */
+   if (!the_mouse.state.display)
+      return;
+
+   /* Keep the fractions of high resolution mice for later. */
+   the_mouse.raw_dx += dx;
+   the_mouse.raw_dy += dy;
+   if ((int)the_mouse.raw_dx == 0 && (int)the_mouse.raw_dy == 0)
+      return;
+
+   if (the_mouse.num_raw_samples == MAX_RAW_SAMPLES)
+      _al_xwin_mouse_flush_raw_motion();
+
+   sample = &the_mouse.raw_samples[the_mouse.num_raw_samples++];
+   sample->dx = (int)the_mouse.raw_dx;
+   sample->dy = (int)the_mouse.raw_dy;
+   sample->timestamp = server_time_to_allegro(raw->time);
+   the_mouse.raw_dx -= sample->dx;
+   the_mouse.raw_dy -= sample->dy;
+}
+#endif
+
+
+
+/* _al_xwin_mouse_generic_event_handler: [bgman thread]
+ *  Called by the background thread for GenericEvent events, before they
+ *  are dispatched to a display. Returns true if it was a raw motion event,
+ *  which this consumed.
+ *
+ *  With raw_mouse_input set in the [x11] configuration section, mouse
+ *  motion is reported from XI_RawMotion events. These come straight
+ *  from the device, without pointer acceleration and without being
+ *  merged by the server, and carry the server's timestamp. The core
+ *  motion events then only update the position, unless the motion comes
+ *  from an absolute device.
+ */
+bool _al_xwin_mouse_generic_event_handler(XEvent *event)
+{
+#ifdef SUPPORT_RAW_INPUT
+   ALLEGRO_SYSTEM_XGLX *system = (void *)al_get_system_driver();
+   XGenericEventCookie *cookie = &event->xcookie;
+
+   if (!xmouse_installed || !the_mouse.raw_input)
+      return false;
+   if (cookie->extension != the_mouse.xi_opcode ||
+         cookie->evtype != XI_RawMotion) {
+      return false;
+   }
+
+   if (XGetEventData(system->x11display, cookie)) {
+      handle_raw_motion(system->x11display, cookie->data);
+      XFreeEventData(system->x11display, cookie);
+   }
+   return true;
+#else
+   (void)event;
+   return false;
+#endif
+}
+
+
+
+/* _al_xwin_mouse_flush_raw_motion: [bgman thread]
+ *  Emit the raw motion samples collected since the last call, under a
+ *  single lock of the event source.
+ */
+void _al_xwin_mouse_flush_raw_motion(void)
+{
+   int i;
+
+   if (the_mouse.num_raw_samples == 0)
+      return;
+
+   _al_event_source_lock(&the_mouse.parent.es);
+   for (i = 0; i < the_mouse.num_raw_samples; i++) {
+      const RAW_SAMPLE *sample = &the_mouse.raw_samples[i];
+      generate_mouse_event_at(sample->timestamp,
+         ALLEGRO_EVENT_MOUSE_AXES,
+         the_mouse.state.x, the_mouse.state.y, the_mouse.state.z,
+         the_mouse.state.w, the_mouse.state.pressure,
+         sample->dx, sample->dy, 0, 0,
+         0, the_mouse.state.display);
+   }
+   _al_event_source_unlock(&the_mouse.parent.es);
+
+   the_mouse.num_raw_samples = 0;
+}
+
+
+
 bool _al_xwin_grab_mouse(ALLEGRO_DISPLAY *display)
 {
    ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
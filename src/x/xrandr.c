@@ -782,6 +782,11 @@ static void xrandr_handle_xevent(ALLEGRO_SYSTEM_XGLX *s, ALLEGRO_DISPLAY_XGLX *d
       xrandr_screen *screen = _al_vector_ref(&s->xrandr_screens, d->xscreen);
       screen->timestamp = rre->timestamp;
       screen->configTimestamp = rre->config_timestamp;
+
+      /* The server sends this after any change to the CRTCs or outputs,
+       * which the RRNotify handling above has already applied.
+       */
+      _al_display_config_changed();
    }
 }
 
@@ -181,7 +181,14 @@ static ALLEGRO_DISPLAY_INTERFACE *xglx_get_display_driver(void)
    ALLEGRO_SYSTEM_XGLX *system = (ALLEGRO_SYSTEM_XGLX *)al_get_system_driver();
    _al_mutex_lock(&system->lock);
    /* _al_display_xglx_driver has global state. */
-   ALLEGRO_DISPLAY_INTERFACE *driver = _al_display_xglx_driver();
+   ALLEGRO_DISPLAY_INTERFACE *driver;
+#ifdef ALLEGRO_XWINDOWS_WITH_EGL_HEADLESS
+   /* Without an X server, render through EGL. */
+   if (!system->x11display)
+      driver = _al_display_egl_headless_driver();
+   else
+#endif
+   driver = _al_display_xglx_driver();
    _al_mutex_unlock(&system->lock);
    return driver;
 }
@@ -9,6 +9,7 @@
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_color.h>
 #include <allegro5/allegro_image.h>
@@ -21,10 +22,16 @@
 #define MAX_FONTS    16
 #define MAX_VERTICES 100
 #define MAX_POLYGONS 8
+#define MAX_INSTANCES 16
+#define MAX_ROW      1024
+#define MAX_TEXT_ITEMS 16
+#define MAX_STATE_BLOCKS 8
+#define MAX_TILES 256
 
 typedef struct {
    ALLEGRO_USTR   *name;
    ALLEGRO_BITMAP *bitmap[2];
+   bool           borrowed;   /* Owned by the atlas, not destroyed by us. */
 } Bitmap;
 
 typedef enum {
@@ -50,6 +57,19 @@ typedef struct {
    ALLEGRO_FONT   *font;
 } NamedFont;
 
+typedef struct {
+   ALLEGRO_USTR   *name;
+   ALLEGRO_RENDER_STATE_BLOCK *block;
+} NamedStateBlock;
+
+typedef struct {
+   ALLEGRO_USTR   *suite;
+   ALLEGRO_USTR   *name;
+   BmpType        bmp_type;
+   double         median;
+   double         p95;
+} BenchResult;
+
 int               argc;
 char              **argv;
 ALLEGRO_DISPLAY   *display;
@@ -58,11 +78,19 @@ Bitmap            bitmaps[MAX_BITMAPS];
 LockRegion        lock_region;
 Transform         transforms[MAX_TRANS];
 NamedFont         fonts[MAX_FONTS];
+NamedStateBlock   state_blocks[MAX_STATE_BLOCKS];
 ALLEGRO_VERTEX    vertices[MAX_VERTICES];
 float             simple_vertices[2 * MAX_VERTICES];
 int               num_simple_vertices;
 int               vertex_counts[MAX_POLYGONS];
+ALLEGRO_SPRITE_INSTANCE instances[MAX_INSTANCES];
+ALLEGRO_TEXT_ITEM text_items[MAX_TEXT_ITEMS];
+int               num_text_items;
 int               num_global_bitmaps;
+ALLEGRO_ATLAS     *atlas;
+ALLEGRO_TEXT_LAYOUT *text_layout;
+ALLEGRO_TILE_LAYER *tile_layer;
+int               tiles[MAX_TILES];
 float             delay = 0.0;
 bool              save_outputs = false;
 bool              save_on_failure = false;
@@ -74,6 +102,11 @@ int               total_tests = 0;
 int               passed_tests = 0;
 int               failed_tests = 0;
 int               skipped_tests = 0;
+int               bench_runs = 0;
+char const        *bench_output = "bench.json";
+char const        *current_suite = "";
+BenchResult       *bench_results = NULL;
+int               num_bench_results = 0;
 
 #define streq(a, b)  (0 == strcmp((a), (b)))
 
@@ -116,6 +149,8 @@ int               skipped_tests = 0;
       (sscanf(stmt, fn " %79[(]" " )", ARGS1) == 1)
 #define SCAN(fn, arity) \
       (sscanf(stmt, fn " (" PAT##arity " )", ARGS##arity) == arity)
+#define SCANLVAL0(fn) \
+      (sscanf(stmt, PAT " = " fn " %79[(]" " )", lval, ARGS1) == 2)
 #define SCANLVAL(fn, arity) \
       (sscanf(stmt, PAT " = " fn " (" PAT##arity " )", lval, ARGS##arity) \
          == 1 + arity)
@@ -200,14 +235,14 @@ static void load_bitmaps(ALLEGRO_CONFIG const *cfg, const char *section,
    num_global_bitmaps = i;
 }
 
-static ALLEGRO_BITMAP **reserve_local_bitmap(const char *name, BmpType bmp_type)
+static Bitmap *reserve_local_slot(const char *name)
 {
    int i;
 
    for (i = num_global_bitmaps; i < MAX_BITMAPS; i++) {
       if (!bitmaps[i].name) {
          bitmaps[i].name = al_ustr_new(name);
-         return &bitmaps[i].bitmap[bmp_type];
+         return &bitmaps[i];
       }
    }
 
@@ -215,6 +250,19 @@ static ALLEGRO_BITMAP **reserve_local_bitmap(const char *name, BmpType bmp_type)
    return NULL;
 }
 
+static ALLEGRO_BITMAP **reserve_local_bitmap(const char *name, BmpType bmp_type)
+{
+   return &reserve_local_slot(name)->bitmap[bmp_type];
+}
+
+/* For bitmaps owned by the atlas, which free_test_data leaves alone. */
+static ALLEGRO_BITMAP **reserve_atlas_bitmap(const char *name, BmpType bmp_type)
+{
+   Bitmap *slot = reserve_local_slot(name);
+   slot->borrowed = true;
+   return &slot->bitmap[bmp_type];
+}
+
 static void unload_data(void)
 {
    int i;
@@ -361,6 +409,62 @@ static ALLEGRO_TRANSFORM *get_transform(const char *name)
    return NULL;
 }
 
+static ALLEGRO_RENDER_STATE_BLOCK **reserve_state_block(const char *name)
+{
+   int i;
+
+   for (i = 0; i < MAX_STATE_BLOCKS; i++) {
+      if (!state_blocks[i].name) {
+         state_blocks[i].name = al_ustr_new(name);
+         return &state_blocks[i].block;
+      }
+   }
+
+   fatal_error("render state block limit reached");
+   return NULL;
+}
+
+static ALLEGRO_RENDER_STATE_BLOCK *get_state_block(const char *name)
+{
+   int i;
+
+   for (i = 0; i < MAX_STATE_BLOCKS; i++) {
+      if (state_blocks[i].name && streq(al_cstr(state_blocks[i].name), name))
+         return state_blocks[i].block;
+   }
+
+   fatal_error("undefined render state block: %s", name);
+   return NULL;
+}
+
+static int get_state_flag(char const *v)
+{
+   return streq(v, "ALLEGRO_STATE_TARGET_BITMAP") ? ALLEGRO_STATE_TARGET_BITMAP
+      : streq(v, "ALLEGRO_STATE_BLENDER") ? ALLEGRO_STATE_BLENDER
+      : streq(v, "ALLEGRO_STATE_TRANSFORM") ? ALLEGRO_STATE_TRANSFORM
+      : streq(v, "ALLEGRO_STATE_PROJECTION_TRANSFORM") ? ALLEGRO_STATE_PROJECTION_TRANSFORM
+      : streq(v, "ALLEGRO_STATE_SHADER") ? ALLEGRO_STATE_SHADER
+      : streq(v, "ALLEGRO_STATE_CLIPPING_RECTANGLE") ? ALLEGRO_STATE_CLIPPING_RECTANGLE
+      : atoi(v);
+}
+
+/* Takes flags joined with '|'. */
+static int get_state_flags(char const *v)
+{
+   char buf[80];
+   char *tok, *bar;
+   int flags = 0;
+
+   snprintf(buf, sizeof(buf), "%s", v);
+   for (tok = buf; tok; tok = bar) {
+      bar = strchr(tok, '|');
+      if (bar)
+         *bar++ = '\0';
+      flags |= get_state_flag(tok);
+   }
+   return flags;
+}
+
 static int get_pixel_format(char const *v)
 {
    int format = streq(v, "ALLEGRO_PIXEL_FORMAT_ANY") ? ALLEGRO_PIXEL_FORMAT_ANY
@@ -393,6 +497,8 @@ static int get_pixel_format(char const *v)
       : streq(v, "ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1") ? ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT1
       : streq(v, "ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3") ? ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT3
       : streq(v, "ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5") ? ALLEGRO_PIXEL_FORMAT_COMPRESSED_RGBA_DXT5
+      : streq(v, "ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1") ? ALLEGRO_PIXEL_FORMAT_COMPRESSED_RED_RGTC1
+      : streq(v, "ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2") ? ALLEGRO_PIXEL_FORMAT_COMPRESSED_RG_RGTC2
       : -1;
    if (format == -1)
       fatal_error("invalid format: %s", v);
@@ -439,6 +545,123 @@ static void fill_lock_region(LockRegion *lr, float alphafactor, bool blended)
    }
 }
 
+/* Copies a block with the row functions, one row at a time. */
+static void copy_pixel_rows(ALLEGRO_BITMAP *src, int sx, int sy, int w, int h,
+   int dx, int dy, bool u32)
+{
+   ALLEGRO_COLOR colors[MAX_ROW];
+   uint32_t pixels[MAX_ROW];
+   int y;
+
+   if (w > MAX_ROW)
+      fatal_error("row too long: %d", w);
+
+   for (y = 0; y < h; y++) {
+      if (u32) {
+         al_get_pixel_row_u32(src, sx, sy + y, w, pixels);
+         al_put_pixel_row_u32(dx, dy + y, w, pixels);
+      }
+      else {
+         al_get_pixel_row(src, sx, sy + y, w, colors);
+         al_put_pixel_row(dx, dy + y, w, colors);
+      }
+   }
+}
+
+typedef void (*COLOR_N_FUNC)(const float *in, float *out, int n);
+typedef void (*COLOR8_N_FUNC)(const unsigned char *in, float *out, int n);
+typedef void (*COLOR_FUNC)(float x, float y, float z,
+   float *ox, float *oy, float *oz);
+
+static float max_color_error(float *a, float x, float y, float z, float err)
+{
+   float d[3];
+   int i;
+
+   d[0] = fabsf(a[0] - x);
+   d[1] = fabsf(a[1] - y);
+   d[2] = fabsf(a[2] - z);
+   for (i = 0; i < 3; i++) {
+      if (d[i] > err)
+         err = d[i];
+   }
+   return err;
+}
+
+/* Converts the pixels of a bitmap with the array versions of a colour
+ * space conversion, forwards from float and 8-bit RGB and then back, and
+ * returns the largest difference to the single colour functions.
+ */
+static float color_n_error(ALLEGRO_BITMAP *bmp, char const *space)
+{
+   float rgb[3 * MAX_ROW], out[3 * MAX_ROW], out8[3 * MAX_ROW], back[3 * MAX_ROW];
+   unsigned char rgb8[3 * MAX_ROW];
+   COLOR_N_FUNC to, from;
+   COLOR8_N_FUNC to8;
+   COLOR_FUNC to1, from1;
+   int w = al_get_bitmap_width(bmp);
+   int h = al_get_bitmap_height(bmp);
+   float err = 0;
+   float x, y, z;
+   int i, j;
+
+   if (streq(space, "linear")) {
+      to = al_color_rgb_to_linear_n;
+      to8 = al_color_rgb8_to_linear_n;
+      from = al_color_linear_to_rgb_n;
+      to1 = al_color_rgb_to_linear;
+      from1 = al_color_linear_to_rgb;
+   }
+   else if (streq(space, "oklab")) {
+      to = al_color_rgb_to_oklab_n;
+      to8 = al_color_rgb8_to_oklab_n;
+      from = al_color_oklab_to_rgb_n;
+      to1 = al_color_rgb_to_oklab;
+      from1 = al_color_oklab_to_rgb;
+   }
+   else if (streq(space, "lab")) {
+      to = al_color_rgb_to_lab_n;
+      to8 = al_color_rgb8_to_lab_n;
+      from = al_color_lab_to_rgb_n;
+      to1 = al_color_rgb_to_lab;
+      from1 = al_color_lab_to_rgb;
+   }
+   else {
+      fatal_error("unknown colour space: %s", space);
+      return 0;
+   }
+
+   if (w > MAX_ROW)
+      fatal_error("row too long: %d", w);
+
+   al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+
+   for (j = 0; j < h; j++) {
+      for (i = 0; i < w; i++) {
+         ALLEGRO_COLOR c = al_get_pixel(bmp, i, j);
+         al_unmap_rgb_f(c, &rgb[3*i + 0], &rgb[3*i + 1], &rgb[3*i + 2]);
+         al_unmap_rgb(c, &rgb8[3*i + 0], &rgb8[3*i + 1], &rgb8[3*i + 2]);
+      }
+
+      to(rgb, out, w);
+      to8(rgb8, out8, w);
+      from(out, back, w);
+
+      for (i = 0; i < w; i++) {
+         to1(rgb[3*i + 0], rgb[3*i + 1], rgb[3*i + 2], &x, &y, &z);
+         err = max_color_error(out + 3*i, x, y, z, err);
+         to1(rgb8[3*i + 0] / 255.0f, rgb8[3*i + 1] / 255.0f,
+            rgb8[3*i + 2] / 255.0f, &x, &y, &z);
+         err = max_color_error(out8 + 3*i, x, y, z, err);
+         from1(out[3*i + 0], out[3*i + 1], out[3*i + 2], &x, &y, &z);
+         err = max_color_error(back + 3*i, x, y, z, err);
+      }
+   }
+
+   al_unlock_bitmap(bmp);
+   return err;
+}
+
 static int get_load_font_flags(char const *v)
 {
    return streq(v, "ALLEGRO_NO_PREMULTIPLIED_ALPHA") ? ALLEGRO_NO_PREMULTIPLIED_ALPHA
@@ -529,6 +752,43 @@ static int get_font_align(char const *value)
       : atoi(value);
 }
 
+/* Items are given as "font, color, x, y, align, text" where the text is
+ * looked up in the test's section.
+ */
+static void fill_text_items(ALLEGRO_CONFIG const *cfg, char const *section,
+   char const *name)
+{
+#define MAXBUF    80
+
+   char const *value;
+   char buf[MAXBUF];
+   char font[MAXBUF], color[MAXBUF], align[MAXBUF], text[MAXBUF];
+   ALLEGRO_TEXT_ITEM *item;
+   int i;
+
+   memset(text_items, 0, sizeof(text_items));
+
+   for (i = 0; i < MAX_TEXT_ITEMS; i++) {
+      sprintf(buf, "t%d", i);
+      value = al_get_config_value(cfg, name, buf);
+      if (!value)
+         break;
+
+      item = &text_items[i];
+      if (sscanf(value, " %79[^ ,] , %79[^ ,] , %f , %f , %79[^ ,] , %79s",
+            font, color, &item->x, &item->y, align, text) == 6) {
+         item->font = get_font(font);
+         item->color = get_color(color);
+         item->flags = get_font_align(align);
+         item->text = resolve_var(cfg, section, text);
+      }
+   }
+
+   num_text_items = i;
+
+#undef MAXBUF
+}
+
 static void set_config_int(ALLEGRO_CONFIG *cfg, char const *section,
    char const *var, int value)
 {
@@ -605,6 +865,80 @@ static void fill_simple_vertices(ALLEGRO_CONFIG const *cfg, char const *name)
 #undef MAXBUF
 }
 
+/* Transforms the points of a simple vertex section with the batch functions
+ * and stores the results in another section, which the polygon statements
+ * can then draw. dims is 2 or 4; 4D points start with z = 0 and w = 1.
+ */
+static void transform_simple_vertices(ALLEGRO_CONFIG *cfg, char const *src,
+   char const *dst, ALLEGRO_TRANSFORM const *trans, int dims)
+{
+   float xyzw[4 * MAX_VERTICES];
+   char key[20];
+   char buf[80];
+   int i;
+
+   fill_simple_vertices(cfg, src);
+
+   for (i = 0; i < num_simple_vertices; i++) {
+      xyzw[dims*i + 0] = simple_vertices[2*i + 0];
+      xyzw[dims*i + 1] = simple_vertices[2*i + 1];
+      if (dims == 4) {
+         xyzw[dims*i + 2] = 0;
+         xyzw[dims*i + 3] = 1;
+      }
+   }
+
+   if (dims == 4)
+      al_transform_coordinates_4d_n(trans, xyzw, 4 * sizeof(float),
+         num_simple_vertices);
+   else
+      al_transform_coordinates_n(trans, xyzw, 2 * sizeof(float),
+         num_simple_vertices);
+
+   for (i = 0; i < num_simple_vertices; i++) {
+      sprintf(key, "v%d", i);
+      sprintf(buf, "%f, %f", xyzw[dims*i + 0], xyzw[dims*i + 1]);
+      al_set_config_value(cfg, dst, key, buf);
+   }
+}
+
+/* Like transform_simple_vertices but for the positions of a full vertex
+ * section, transformed in place inside the ALLEGRO_VERTEX array.
+ */
+static void transform_vertices(ALLEGRO_CONFIG *cfg, char const *src,
+   char const *dst, ALLEGRO_TRANSFORM const *trans, bool projective)
+{
+   char const *value;
+   char const *rest;
+   char key[20];
+   char buf[120];
+   int n, i;
+
+   fill_vertices(cfg, src);
+
+   for (n = 0; n < MAX_VERTICES; n++) {
+      sprintf(key, "v%d", n);
+      if (!al_get_config_value(cfg, src, key))
+         break;
+   }
+
+   if (projective)
+      al_transform_coordinates_3d_projective_n(trans, &vertices[0].x,
+         sizeof(ALLEGRO_VERTEX), n);
+   else
+      al_transform_coordinates_3d_n(trans, &vertices[0].x,
+         sizeof(ALLEGRO_VERTEX), n);
+
+   for (i = 0; i < n; i++) {
+      sprintf(key, "v%d", i);
+      value = al_get_config_value(cfg, src, key);
+      rest = strchr(value, ';');
+      snprintf(buf, sizeof(buf), "%f, %f, %f%s",
+         vertices[i].x, vertices[i].y, vertices[i].z, rest ? rest : "");
+      al_set_config_value(cfg, dst, key, buf);
+   }
+}
+
 static void fill_vertex_counts(ALLEGRO_CONFIG const *cfg, char const *name)
 {
 #define MAXBUF    80
@@ -630,6 +964,35 @@ static void fill_vertex_counts(ALLEGRO_CONFIG const *cfg, char const *name)
 #undef MAXBUF
 }
 
+static void fill_instances(ALLEGRO_CONFIG const *cfg, char const *name)
+{
+#define MAXBUF    80
+
+   char const *value;
+   char buf[MAXBUF];
+   ALLEGRO_SPRITE_INSTANCE *in;
+   int i;
+
+   memset(instances, 0, sizeof(instances));
+
+   for (i = 0; i < MAX_INSTANCES; i++) {
+      sprintf(buf, "i%d", i);
+      value = al_get_config_value(cfg, name, buf);
+      if (!value)
+         return;
+
+      in = &instances[i];
+      if (sscanf(value, " %f , %f , %f , %f ; %f , %f ; %f , %f ; %f , %f ; %f ; %s",
+            &in->sx, &in->sy, &in->sw, &in->sh, &in->cx, &in->cy,
+            &in->dx, &in->dy, &in->xscale, &in->yscale, &in->angle,
+            buf) == 12) {
+         in->tint = get_color(buf);
+      }
+   }
+
+#undef MAXBUF
+}
+
 static int get_prim_type(char const *value)
 {
    return streq(value, "ALLEGRO_PRIM_POINT_LIST") ? ALLEGRO_PRIM_POINT_LIST
@@ -642,6 +1005,58 @@ static int get_prim_type(char const *value)
       : atoi(value);
 }
 
+static int get_prim_buffer_flags(char const *value)
+{
+   return streq(value, "ALLEGRO_PRIM_BUFFER_STREAM") ? ALLEGRO_PRIM_BUFFER_STREAM
+      : streq(value, "ALLEGRO_PRIM_BUFFER_STATIC") ? ALLEGRO_PRIM_BUFFER_STATIC
+      : streq(value, "ALLEGRO_PRIM_BUFFER_DYNAMIC") ? ALLEGRO_PRIM_BUFFER_DYNAMIC
+      : atoi(value);
+}
+
+/* Takes a comma separated list of w * h tile numbers, or NULL. */
+static int *fill_tiles(char const *value, int w, int h)
+{
+   char const *p = value;
+   int i;
+
+   if (streq(value, "NULL"))
+      return NULL;
+
+   if (w * h > MAX_TILES)
+      fatal_error("too many tiles: %d", w * h);
+
+   for (i = 0; i < w * h; i++) {
+      if (!p)
+         fatal_error("too few tiles: %s", value);
+      tiles[i] = atoi(p);
+      p = strchr(p, ',');
+      if (p)
+         p++;
+   }
+   return tiles;
+}
+
+/* Draws the tiles one by one, the way the tile layer should look. */
+static void draw_tile_regions(ALLEGRO_BITMAP *bmp, int tw, int th, int w,
+   int h, char const *value, float dx, float dy)
+{
+   int columns = al_get_bitmap_width(bmp) / tw;
+   int *t = fill_tiles(value, w, h);
+   int x, y;
+
+   al_hold_bitmap_drawing(true);
+   for (y = 0; y < h; y++) {
+      for (x = 0; x < w; x++) {
+         int tile = t[y * w + x];
+         if (tile < 0)
+            continue;
+         al_draw_bitmap_region(bmp, (tile % columns) * tw,
+            (tile / columns) * th, tw, th, dx + x * tw, dy + y * th, 0);
+      }
+   }
+   al_hold_bitmap_drawing(false);
+}
+
 static int get_line_join(char const *value)
 {
    return streq(value, "ALLEGRO_LINE_JOIN_NONE") ? ALLEGRO_LINE_JOIN_NONE
@@ -941,8 +1356,9 @@ static bool check_similarity(ALLEGRO_CONFIG const *cfg,
    }
 }
 
-static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
-   ALLEGRO_BITMAP *target, int bmp_type, bool reliable, bool do_check_hash)
+/* Runs the statements of a test, drawing to target. */
+static void run_ops(ALLEGRO_CONFIG *cfg, char const *testname,
+   ALLEGRO_BITMAP *target, int bmp_type)
 {
 #define MAXBUF    80
 
@@ -952,15 +1368,6 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
    char buf[MAXBUF];
    char arg[14][MAXBUF];
    char lval[MAXBUF];
-   int i;
-
-   if (verbose) {
-      /* So in case it segfaults, we know which test to re-run. */
-      printf("\nRunning %s [%s].\n", testname, bmp_type_to_string(bmp_type));
-      fflush(stdout);
-   }
-
-   set_target_reset(target);
 
    for (op = 0; ; op++) {
       sprintf(buf, "op%d", op);
@@ -1146,6 +1553,32 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          continue;
       }
 
+      /* Atlases (5.2) */
+      if (SCAN("al_create_atlas", 2)) {
+         al_destroy_atlas(atlas);
+         atlas = al_create_atlas(I(0), I(1));
+         continue;
+      }
+      if (SCANLVAL("al_create_atlas_bitmap", 2)) {
+         ALLEGRO_BITMAP **bmp = reserve_atlas_bitmap(lval, bmp_type);
+         (*bmp) = al_create_atlas_bitmap(atlas, I(0), I(1));
+         continue;
+      }
+      if (SCANLVAL("al_add_atlas_bitmap", 1)) {
+         ALLEGRO_BITMAP **bmp = reserve_atlas_bitmap(lval, bmp_type);
+         (*bmp) = al_add_atlas_bitmap(atlas, B(0));
+         continue;
+      }
+      if (SCANLVAL("al_get_atlas_page", 1)) {
+         ALLEGRO_BITMAP **bmp = reserve_atlas_bitmap(lval, bmp_type);
+         (*bmp) = al_get_atlas_page(atlas, I(0));
+         continue;
+      }
+      if (SCANLVAL0("al_get_atlas_num_pages")) {
+         set_config_int(cfg, testname, lval, al_get_atlas_num_pages(atlas));
+         continue;
+      }
+
       if (SCANLVAL("al_load_bitmap", 1)) {
          ALLEGRO_BITMAP **bmp = reserve_local_bitmap(lval, bmp_type);
          (*bmp) = load_relative_bitmap(V(0), 0);
@@ -1170,6 +1603,13 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          continue;
       }
 
+      if (SCAN("al_draw_bitmap_instances", 4)) {
+         fill_instances(cfg, V(1));
+         al_draw_bitmap_instances(B(0), instances, I(2),
+            get_draw_bitmap_flag(V(3)));
+         continue;
+      }
+
       if (SCAN("al_hold_bitmap_drawing", 1)) {
          al_hold_bitmap_drawing(get_bool(V(0)));
          continue;
@@ -1205,6 +1645,17 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          continue;
       }
 
+      /* Render state blocks (5.2) */
+      if (SCANLVAL("al_create_render_state_block", 1)) {
+         ALLEGRO_RENDER_STATE_BLOCK **block = reserve_state_block(lval);
+         (*block) = al_create_render_state_block(get_state_flags(V(0)));
+         continue;
+      }
+      if (SCAN("al_apply_render_state_block", 1)) {
+         al_apply_render_state_block(get_state_block(V(0)));
+         continue;
+      }
+
       /* Conversion */
       if (SCAN("al_convert_bitmap", 1)) {
          ALLEGRO_BITMAP *bmp = B(0);
@@ -1246,6 +1697,11 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          fill_lock_region(&lock_region, F(0), get_bool(V(1)));
          continue;
       }
+      if (SCAN("copy_pixel_rows", 8)) {
+         copy_pixel_rows(B(0), I(1), I(2), I(3), I(4), I(5), I(6),
+            get_bool(V(7)));
+         continue;
+      }
 
       /* Fonts */
       if (SCAN("al_draw_text", 6)) {
@@ -1287,10 +1743,55 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          set_config_int(cfg, testname, V(5), bbh);
          continue;
       }
+      if (SCAN("al_draw_text_batch", 1)) {
+         fill_text_items(cfg, section, V(0));
+         al_draw_text_batch(text_items, num_text_items);
+         continue;
+      }
       if (SCAN("al_set_fallback_font", 2)) {
          al_set_fallback_font(get_font(V(0)), get_font(V(1)));
          continue;
       }
+      if (SCAN("al_draw_multiline_text", 8)) {
+         al_draw_multiline_text(get_font(V(0)), C(1), F(2), F(3), F(4), F(5),
+            get_font_align(V(6)), V(7));
+         continue;
+      }
+
+      /* Text layouts (5.2) */
+      if (SCAN("al_create_text_layout", 2)) {
+         al_destroy_text_layout(text_layout);
+         text_layout = al_create_text_layout(get_font(V(0)), F(1));
+         continue;
+      }
+      if (SCAN("al_set_text_layout_text", 1)) {
+         al_set_text_layout_text(text_layout, V(0));
+         continue;
+      }
+      if (SCAN("al_append_text_layout_text", 1)) {
+         al_append_text_layout_text(text_layout, V(0));
+         continue;
+      }
+      if (SCAN("al_replace_text_layout_range", 3)) {
+         ALLEGRO_USTR_INFO info;
+         al_replace_text_layout_range(text_layout, I(0), I(1),
+            al_ref_cstr(&info, V(2)));
+         continue;
+      }
+      if (SCAN("al_set_text_layout_width", 1)) {
+         al_set_text_layout_width(text_layout, F(0));
+         continue;
+      }
+      if (SCANLVAL0("al_get_text_layout_line_count")) {
+         int n = al_get_text_layout_line_count(text_layout);
+         set_config_int(cfg, testname, lval, n);
+         continue;
+      }
+      if (SCAN("al_draw_text_layout", 5)) {
+         al_draw_text_layout(text_layout, C(0), F(1), F(2), F(3),
+            get_font_align(V(4)));
+         continue;
+      }
 
       /* Primitives */
       if (SCAN("al_draw_line", 6)) {
@@ -1412,6 +1913,10 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          al_orthographic_transform(get_transform(V(0)), F(1), F(2), F(3), F(4), F(5), F(6));
          continue;
       }
+      if (SCAN("al_perspective_transform", 7)) {
+         al_perspective_transform(get_transform(V(0)), F(1), F(2), F(3), F(4), F(5), F(6));
+         continue;
+      }
       if (SCAN("al_use_projection_transform", 1)) {
          al_use_projection_transform(get_transform(V(0)));
          continue;
@@ -1421,6 +1926,51 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          continue;
       }
 
+      /* Batch transformations (5.2) */
+      if (SCAN("al_transform_coordinates_n", 3)) {
+         transform_simple_vertices(cfg, V(1), V(2), get_transform(V(0)), 2);
+         continue;
+      }
+      if (SCAN("al_transform_coordinates_4d_n", 3)) {
+         transform_simple_vertices(cfg, V(1), V(2), get_transform(V(0)), 4);
+         continue;
+      }
+      if (SCAN("al_transform_coordinates_3d_n", 3)) {
+         transform_vertices(cfg, V(1), V(2), get_transform(V(0)), false);
+         continue;
+      }
+      if (SCAN("al_transform_coordinates_3d_projective_n", 3)) {
+         transform_vertices(cfg, V(1), V(2), get_transform(V(0)), true);
+         continue;
+      }
+
+      /* Tile layers (5.2) */
+      if (SCAN("al_create_tile_layer", 7)) {
+         al_destroy_tile_layer(tile_layer);
+         tile_layer = al_create_tile_layer(B(0), I(1), I(2), I(3), I(4),
+            fill_tiles(V(5), I(3), I(4)), get_prim_buffer_flags(V(6)));
+         if (!tile_layer)
+            fatal_error("al_create_tile_layer failed");
+         continue;
+      }
+      if (SCAN("al_set_tile_layer_tile", 3)) {
+         al_set_tile_layer_tile(tile_layer, I(0), I(1), I(2));
+         continue;
+      }
+      if (SCANLVAL("al_get_tile_layer_tile", 2)) {
+         int tile = al_get_tile_layer_tile(tile_layer, I(0), I(1));
+         set_config_int(cfg, testname, lval, tile);
+         continue;
+      }
+      if (SCAN("al_draw_tile_layer", 2)) {
+         al_draw_tile_layer(tile_layer, F(0), F(1));
+         continue;
+      }
+      if (SCAN("draw_tile_regions", 8)) {
+         draw_tile_regions(B(0), I(1), I(2), I(3), I(4), V(5), F(6), F(7));
+         continue;
+      }
+
       /* Simple arithmetic, generally useful. (5.1) */
       if (SCANLVAL("isum", 2)) {
          int result  = I(0) + I(1);
@@ -1512,6 +2062,11 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          set_config_float(cfg, testname, lval, d);
          continue;
       }
+      if (SCANLVAL("color_n_error", 2)) {
+         float err = color_n_error(B(0), V(1));
+         set_config_float(cfg, testname, lval, err);
+         continue;
+      }
       if (SCANLVAL("al_color_lab", 3)) {
          ALLEGRO_COLOR rgb = al_color_lab(F(0), F(1), F(2));
          char hex[100];
@@ -1523,6 +2078,63 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
       fatal_error("statement didn't scan: %s", stmt);
    }
 
+#undef MAXBUF
+}
+
+/* Frees what a test created for itself. */
+static void free_test_data(int bmp_type)
+{
+   int i;
+
+   /* The layer may use a local bitmap as its atlas. */
+   al_destroy_tile_layer(tile_layer);
+   tile_layer = NULL;
+
+   /* Destroy local bitmaps. */
+   for (i = num_global_bitmaps; i < MAX_BITMAPS; i++) {
+      if (bitmaps[i].name) {
+         al_ustr_free(bitmaps[i].name);
+         bitmaps[i].name = NULL;
+         if (!bitmaps[i].borrowed)
+            al_destroy_bitmap(bitmaps[i].bitmap[bmp_type]);
+         bitmaps[i].bitmap[bmp_type] = NULL;
+         bitmaps[i].borrowed = false;
+      }
+   }
+
+   al_destroy_atlas(atlas);
+   atlas = NULL;
+
+   al_destroy_text_layout(text_layout);
+   text_layout = NULL;
+
+   for (i = 0; i < MAX_STATE_BLOCKS; i++) {
+      al_ustr_free(state_blocks[i].name);
+      state_blocks[i].name = NULL;
+      al_destroy_render_state_block(state_blocks[i].block);
+      state_blocks[i].block = NULL;
+   }
+
+   /* Free transform names. */
+   for (i = 0; i < MAX_TRANS; i++) {
+      al_ustr_free(transforms[i].name);
+      transforms[i].name = NULL;
+   }
+}
+
+static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
+   ALLEGRO_BITMAP *target, int bmp_type, bool reliable, bool do_check_hash)
+{
+   if (verbose) {
+      /* So in case it segfaults, we know which test to re-run. */
+      printf("\nRunning %s [%s].\n", testname, bmp_type_to_string(bmp_type));
+      fflush(stdout);
+   }
+
+   set_target_reset(target);
+
+   run_ops(cfg, testname, target, bmp_type);
+
    al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
 
    bool good;
@@ -1555,24 +2167,117 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
    /* Ensure we don't target a bitmap which is about to be destroyed. */
    al_set_target_bitmap(display ? al_get_backbuffer(display) : NULL);
 
-   /* Destroy local bitmaps. */
-   for (i = num_global_bitmaps; i < MAX_BITMAPS; i++) {
-      if (bitmaps[i].name) {
-         al_ustr_free(bitmaps[i].name);
-         bitmaps[i].name = NULL;
-         al_destroy_bitmap(bitmaps[i].bitmap[bmp_type]);
-         bitmaps[i].bitmap[bmp_type] = NULL;
+   free_test_data(bmp_type);
+
+   return good;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+   double x = *(const double *)a;
+   double y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+/* Runs the statements of a test bench_runs times without checking the
+ * output, and records the median and 95th percentile of the time taken.
+ */
+static void bench_test(ALLEGRO_CONFIG *cfg, char const *testname,
+   ALLEGRO_BITMAP *target, BmpType bmp_type)
+{
+   double *times = calloc(bench_runs, sizeof(double));
+   BenchResult *r;
+   int i;
+
+   if (!times)
+      fatal_error("out of memory");
+
+   for (i = 0; i < bench_runs; i++) {
+      double t0;
+
+      set_target_reset(target);
+      t0 = al_get_time();
+      run_ops(cfg, testname, target, bmp_type);
+      if (bmp_type == HW) {
+         /* Reading back a pixel waits for the GPU to finish drawing. */
+         al_lock_bitmap_region(target, 0, 0, 1, 1,
+            ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+         al_unlock_bitmap(target);
       }
+      times[i] = al_get_time() - t0;
+
+      al_set_new_bitmap_format(ALLEGRO_PIXEL_FORMAT_ANY_WITH_ALPHA);
+      al_set_target_bitmap(display ? al_get_backbuffer(display) : NULL);
+      free_test_data(bmp_type);
    }
 
-   /* Free transform names. */
-   for (i = 0; i < MAX_TRANS; i++) {
-      al_ustr_free(transforms[i].name);
-      transforms[i].name = NULL;
+   qsort(times, bench_runs, sizeof(double), compare_times);
+
+   r = realloc(bench_results, (num_bench_results + 1) * sizeof(BenchResult));
+   if (!r)
+      fatal_error("out of memory");
+   bench_results = r;
+   r = &bench_results[num_bench_results++];
+   r->suite = al_ustr_new(current_suite);
+   r->name = al_ustr_new(testname);
+   r->bmp_type = bmp_type;
+   if (bench_runs % 2)
+      r->median = times[bench_runs / 2];
+   else
+      r->median = (times[bench_runs / 2 - 1] + times[bench_runs / 2]) / 2;
+   /* Nearest rank. */
+   r->p95 = times[(int)ceil(0.95 * bench_runs) - 1];
+
+   free(times);
+}
+
+static void print_json_string(FILE *f, ALLEGRO_USTR const *us)
+{
+   char const *s = al_cstr(us);
+
+   fputc('"', f);
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         fprintf(f, "\\%c", *s);
+      else if ((unsigned char)*s < 0x20)
+         fprintf(f, "\\u%04x", *s);
+      else
+         fputc(*s, f);
    }
+   fputc('"', f);
+}
 
-   return good;
-#undef MAXBUF
+static void write_bench_results(void)
+{
+   FILE *f;
+   int i;
+
+   f = fopen(bench_output, "w");
+   if (!f)
+      fatal_error("failed to write %s", bench_output);
+
+   fprintf(f, "{\n  \"runs\": %d,\n  \"tests\": [", bench_runs);
+   for (i = 0; i < num_bench_results; i++) {
+      BenchResult *r = &bench_results[i];
+
+      fprintf(f, "%s\n    {\"suite\": ", i > 0 ? "," : "");
+      print_json_string(f, r->suite);
+      fprintf(f, ", \"name\": ");
+      print_json_string(f, r->name);
+      fprintf(f, ", \"type\": \"%s\", \"median_ms\": %.4f, \"p95_ms\": %.4f}",
+         bmp_type_to_string(r->bmp_type), r->median * 1000.0, r->p95 * 1000.0);
+
+      al_ustr_free(r->suite);
+      al_ustr_free(r->name);
+   }
+   fprintf(f, "\n  ]\n}\n");
+   fclose(f);
+
+   free(bench_results);
+   bench_results = NULL;
+   num_bench_results = 0;
+
+   printf("benchmark results written to %s\n", bench_output);
 }
 
 static void sw_hw_test(ALLEGRO_CONFIG *cfg, char const *testname)
@@ -1593,6 +2298,8 @@ static void sw_hw_test(ALLEGRO_CONFIG *cfg, char const *testname)
    al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
    if (!hw_only) {
       reliable = do_test(cfg, testname, membuf, SW, true, true);
+      if (bench_runs > 0)
+         bench_test(cfg, testname, membuf, SW);
    }
 
    if (sw_only) return;
@@ -1600,6 +2307,8 @@ static void sw_hw_test(ALLEGRO_CONFIG *cfg, char const *testname)
    if (display) {
       al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
       do_test(cfg, testname, al_get_backbuffer(display), HW, reliable, hw_only);
+      if (bench_runs > 0)
+         bench_test(cfg, testname, al_get_backbuffer(display), HW);
    } else if (hw_only) {
       printf("WARNING: Skipping hardware-only test due to the --no-display flag: %s\n",
              testname);
@@ -1726,6 +2435,7 @@ static void process_ini_files(void)
       if (verbose)
          printf("Running %s\n", argv[0]);
 
+      current_suite = argv[0];
       argc--;
       argv++;
 
@@ -1763,6 +2473,8 @@ const char* help_str =
 "file, but individual TEST_NAMEs can be specified after each CONFIG_FILE.\n"
 "\n"
 "Options:\n"
+" -b, --bench N         also run each test N times and record its timings\n"
+" --bench-output FILE   write the timings as JSON to FILE (default bench.json)\n"
 " -d, --delay           duration (in sec) to wait between tests\n"
 " --force-d3d           force using D3D (Windows only)\n"
 " --force-opengl-1.2    force using OpenGL 1.2\n"
@@ -1803,6 +2515,19 @@ int main(int _argc, char *_argv[])
       if (streq(opt, "-d") || streq(opt, "--delay")) {
          delay = 1.0;
       }
+      else if (streq(opt, "-b") || streq(opt, "--bench")) {
+         if (argc < 2 || (bench_runs = atoi(argv[1])) <= 0)
+            fatal_error("%s requires a positive number of runs", opt);
+         argc--;
+         argv++;
+      }
+      else if (streq(opt, "--bench-output")) {
+         if (argc < 2)
+            fatal_error("%s requires a file name", opt);
+         bench_output = argv[1];
+         argc--;
+         argv++;
+      }
       else if (streq(opt, "-s") || streq(opt, "--save")) {
          save_outputs = true;
       }
@@ -1880,6 +2605,9 @@ int main(int _argc, char *_argv[])
    printf("skipped tests: %d\n", skipped_tests);
    printf("\n");
 
+   if (bench_runs > 0)
+      write_bench_results();
+
    return !!failed_tests;
 }
 